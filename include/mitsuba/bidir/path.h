@@ -26,6 +26,8 @@
 
 MTS_NAMESPACE_BEGIN
 
+struct PathMISCache;
+
 /**
  * \brief Bidirectional path data structure
  *
@@ -419,6 +421,24 @@ public:
             const Path &sensorSubpath, int s, int t,
             bool direct, bool lightImage);
 
+    /**
+     * \brief Compute the multiple importance sampling weight of the <tt>(s,t)</tt>
+     * sampling strategy using cached subpath densities
+     *
+     * This is equivalent to the function above, but it reads the densities
+     * and flags of the interior subpath vertices from the provided caches
+     * (see \ref PathMISCache) instead of the vertex and edge records.
+     * Unless the subpaths contain \ref BSDF::ENull interactions, the cost
+     * of this function does not depend on the length of the path.
+     */
+    static Float miWeight(const Scene *scene,
+            const Path &emitterSubpath,
+            const PathEdge *connectionEdge,
+            const Path &sensorSubpath, int s, int t,
+            bool direct, bool lightImage,
+            const PathMISCache *emitterCache,
+            const PathMISCache *sensorCache);
+
     /**
      * \brief Collapse a path into an entire edge that summarizes the aggregate
      * transport and sampling densities
@@ -516,6 +536,61 @@ private:
     std::vector<PathEdgePtr>   m_edges;
 };
 
+/**
+ * \brief Structure-of-arrays copy of the sampling densities and flags of a
+ * subpath that are needed by \ref Path::miWeight()
+ *
+ * BDPT computes the weights of O(n^2) connections per sample. These
+ * records are large, hence this cache gathers the few relevant fields into
+ * contiguous arrays once per subpath. The cache must be updated after the
+ * random walk; afterwards, only the connection endpoints may change, which
+ * \ref Path::miWeight() always queries directly. The same holds for the first
+ * vertex and edge, since direct sampling strategies temporarily replace them
+ * (see \ref Path::swapEndpoints()).
+ *
+ * In addition, the cache accumulates the contributions of all strategies
+ * along the subpath to the power heuristic in a single recursive pass.
+ * The densities of strategies that are more than a few vertices away from
+ * the connection only differ from those of the <tt>(s,t)</tt> strategy by
+ * a product of fixed per-vertex ratios, hence \ref Path::miWeight() only
+ * needs to visit a constant number of vertices around the connection.
+ *
+ * \ingroup libbidir
+ */
+struct MTS_EXPORT_BIDIR PathMISCache {
+    /// Vertex densities (per transport mode)
+    std::vector<Float> vertexPdf[2];
+    /// Edge densities (per transport mode)
+    std::vector<Float> edgePdf[2];
+    /// Is vertex \c i connectable?
+    std::vector<uint8_t> connectable;
+    /// Is vertex \c i a non-connectable \ref BSDF::ENull interaction?
+    std::vector<uint8_t> isNull;
+    /**
+     * \brief Sum of the squared densities of the strategies ending at
+     * vertices <tt>0..m-1</tt> (emitter subpath) or <tt>1..m</tt> (sensor
+     * subpath), relative to a strategy connecting through vertex \c m
+     */
+    std::vector<double> partialWeight;
+    /// Does the subpath contain any \ref BSDF::ENull interactions?
+    bool hasNull;
+    /// Parameters that were used to compute \ref partialWeight
+    bool sampleDirect, lightImage;
+
+    /**
+     * \brief Gather the densities and flags of the given subpath
+     *
+     * \param mode
+     *    \ref EImportance for emitter and \ref ERadiance for sensor subpaths
+     * \param sampleDirect
+     *    Same as the parameter of \ref Path::miWeight()
+     * \param lightImage
+     *    Same as the parameter of \ref Path::miWeight()
+     */
+    void update(const Scene *scene, const Path &path, ETransportMode mode,
+        bool sampleDirect, bool lightImage);
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_BIDIR_PATH_H_ */
@@ -22,6 +22,7 @@
 
 #include <mitsuba/bidir/path.h>
 #include <boost/function.hpp>
+#include <boost/filesystem/path.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -168,6 +169,29 @@ public:
             bool fineGrained, const Bitmap *importanceMap,
             std::vector<PathSeed> &seeds);
 
+    /**
+     * \brief Generates a sequence of MLT seeds using all cores
+     * of the scheduler
+     *
+     * This function is equivalent to the serial version above, except that
+     * the luminance samples are taken by a parallel process. Every work unit
+     * draws its samples from a separate sequence of the underlying
+     * \ref ReplayableSampler, which is recorded in \ref PathSeed::sequence.
+     *
+     * \param sceneResID
+     *     Resource ID of the scene
+     * \param seedFile
+     *     Optional file, which stores the resulting seeds and the average
+     *     luminance. When it exists and was created using a matching
+     *     configuration, the luminance samples are skipped altogether.
+     *     Changes to the scene itself are not detected -- the file must be
+     *     removed in this case. Ignored when an importance map is given.
+     */
+    Float generateSeeds(int sceneResID, size_t sampleCount, size_t seedCount,
+            bool fineGrained, const Bitmap *importanceMap,
+            std::vector<PathSeed> &seeds,
+            const fs::path &seedFile = fs::path());
+
     /**
      * \brief Compute the average luminance over the image plane
      * \param sampleCount
@@ -175,6 +199,19 @@ public:
      */
     Float computeAverageLuminance(size_t sampleCount);
 
+    /**
+     * \brief Compute the average luminance over the image plane
+     * using all cores of the scheduler
+     *
+     * \param sceneResID
+     *     Resource ID of the scene
+     * \param seedFile
+     *     Optional file, which caches the average luminance
+     *     (see \ref generateSeeds())
+     */
+    Float computeAverageLuminance(int sceneResID, size_t sampleCount,
+            const fs::path &seedFile = fs::path());
+
     /**
      * \brief Reconstruct a path from a \ref PathSeed record
      *
@@ -188,10 +225,26 @@ public:
     /// Return the underlying memory pool
     inline MemoryPool &getMemoryPool() { return m_pool; }
 
+    /**
+     * \brief Take luminance samples and record candidate seeds
+     *
+     * This is the inner loop of seed generation, which is shared by the
+     * serial and parallel implementations. The mean and the sum of squared
+     * deviations of the sample luminances are returned via \c mean
+     * and \c m2.
+     */
+    void sampleSeedCandidates(size_t sampleCount, bool fineGrained,
+            const Bitmap *importanceMap, std::vector<PathSeed> *candidates,
+            double &mean, double &m2);
+
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
     virtual ~PathSampler();
+
+    /// Draw \c seedCount seeds proportional to the candidates' luminance
+    void resampleSeeds(const std::vector<PathSeed> &candidates,
+            size_t seedCount, std::vector<PathSeed> &seeds);
 protected:
     ETechnique m_technique;
     ref<const Scene> m_scene;
@@ -207,6 +260,7 @@ protected:
     int m_emitterDepth, m_sensorDepth;
     Path m_emitterSubpath, m_sensorSubpath;
     Path m_connectionSubpath, m_fullPath;
+    PathMISCache m_emitterCache, m_sensorCache;
     MemoryPool m_pool;
 };
 
@@ -223,17 +277,20 @@ struct PathSeed {
     Float luminance;    ///< Luminance value of the path (for sanity checks)
     int s;              ///< Number of steps from the luminaire
     int t;              ///< Number of steps from the eye
+    uint32_t sequence;  ///< Random number sequence of the \ref ReplayableSampler
 
     inline PathSeed() { }
 
-    inline PathSeed(size_t sampleIndex, Float luminance, int s = 0, int t = 0)
-        : sampleIndex(sampleIndex), luminance(luminance), s(s), t(t) { }
+    inline PathSeed(size_t sampleIndex, Float luminance, int s = 0, int t = 0,
+            uint32_t sequence = 0) : sampleIndex(sampleIndex),
+            luminance(luminance), s(s), t(t), sequence(sequence) { }
 
     inline PathSeed(Stream *stream) {
         sampleIndex = stream->readSize();
         luminance = stream->readFloat();
         s = stream->readInt();
         t = stream->readInt();
+        sequence = stream->readUInt();
     }
 
     void serialize(Stream *stream) const {
@@ -241,11 +298,13 @@ struct PathSeed {
         stream->writeFloat(luminance);
         stream->writeInt(s);
         stream->writeInt(t);
+        stream->writeUInt(sequence);
     }
 
     std::string toString() const {
         std::ostringstream oss;
         oss << "PathSeed[" << endl
+            << "  sequence = " << sequence << "," << endl
             << "  sampleIndex = " << sampleIndex << "," << endl
             << "  luminance = " << luminance << "," << endl
             << "  s = " << s << "," << endl
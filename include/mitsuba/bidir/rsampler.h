@@ -33,6 +33,11 @@ MTS_NAMESPACE_BEGIN
  * to store millions of path. Note that `rewinding' is naive -- it just
  * resets & regenerates the whole random number sequence, which might be slow.
  *
+ * Besides the default sequence (with index 0), the sampler provides an
+ * arbitrary number of further independent sequences, which are all
+ * derived from the same initial state. They make it possible to generate
+ * seed paths on several workers at once (see \ref setSequence()).
+ *
  * \ingroup libbidir
  */
 class MTS_EXPORT_BIDIR ReplayableSampler : public Sampler {
@@ -58,6 +63,29 @@ public:
     /// Manually set the current sample index
     virtual void setSampleIndex(size_t sampleIndex);
 
+    /**
+     * \brief Switch to another random number sequence
+     *
+     * Unless \c sequence is already active, this rewinds the sampler to
+     * the beginning of the sequence. Sample indices always refer to the
+     * currently active sequence.
+     */
+    void setSequence(uint32_t sequence);
+
+    /// Return the index of the active random number sequence
+    inline uint32_t getSequence() const { return m_sequence; }
+
+    /**
+     * \brief Replace the initial state, which determines
+     * all random number sequences
+     *
+     * This is used to resume from a stored set of seed paths.
+     */
+    void setInitialState(Random *random);
+
+    /// Return the initial state, which determines all random number sequences
+    inline const Random *getInitialState() const { return m_initial.get(); }
+
     /// Retrieve the next component value from the current sample
     virtual Float next1D();
 
@@ -89,8 +117,17 @@ public:
 protected:
     /// Virtual destructor
     virtual ~ReplayableSampler();
+protected:
+    /// Reset the sampler to the start of the active sequence
+    void rewind();
+
+    /// Recompute the start of the active sequence and rewind
+    void resetSequence();
 protected:
     ref<Random> m_initial, m_random;
+    /// Start of the active sequence (equal to \c m_initial for sequence 0)
+    ref<Random> m_start;
+    uint32_t m_sequence;
 };
 
 MTS_NAMESPACE_END
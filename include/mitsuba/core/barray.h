@@ -86,9 +86,14 @@ public:
      * \remark This function performs type casts when <tt>Value != AltValue</tt>
      */
     template <typename AltValue> void init(const AltValue *data) {
-        for (int y=0; y<m_size.y; ++y)
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(static)
+        #endif
+        for (int y=0; y<m_size.y; ++y) {
+            const AltValue *row = data + (size_t) y * (size_t) m_size.x;
             for (int x=0; x<m_size.x; ++x)
-                    (*this)(x, y) = Value(*data++);
+                (*this)(x, y) = Value(row[x]);
+        }
     }
 
     /**
@@ -104,22 +109,41 @@ public:
             AltValue &min_, AltValue &max_, AltValue &avg_) {
         typedef typename AltValue::Scalar Scalar;
 
-        AltValue
-            min(+std::numeric_limits<Scalar>::infinity()),
-            max(-std::numeric_limits<Scalar>::infinity()),
-            avg((Scalar) 0);
+        /* Rows are processed in parallel; keep per-row statistics */
+        std::vector<AltValue>
+            rowMin(m_size.y, AltValue(+std::numeric_limits<Scalar>::infinity())),
+            rowMax(m_size.y, AltValue(-std::numeric_limits<Scalar>::infinity())),
+            rowSum(m_size.y, AltValue((Scalar) 0));
 
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(static)
+        #endif
         for (int y=0; y<m_size.y; ++y) {
+            const AltValue *row = data + (size_t) y * (size_t) m_size.x;
+            AltValue &min = rowMin[y], &max = rowMax[y], &sum = rowSum[y];
             for (int x=0; x<m_size.x; ++x) {
-                const AltValue &value = *data++;
+                const AltValue &value = row[x];
                 for (int i=0; i<AltValue::dim; ++i) {
-                    min[i]  = std::min(min[i], value[i]);
-                    max[i]  = std::max(max[i], value[i]);
-                    avg[i] += value[i];
+                    min[i] = std::min(min[i], value[i]);
+                    max[i] = std::max(max[i], value[i]);
+                    sum[i] += value[i];
                 }
                 (*this)(x, y) = Value(value);
             }
         }
+
+        AltValue
+            min(+std::numeric_limits<Scalar>::infinity()),
+            max(-std::numeric_limits<Scalar>::infinity()),
+            avg((Scalar) 0);
+
+        for (int y=0; y<m_size.y; ++y) {
+            for (int i=0; i<AltValue::dim; ++i) {
+                min[i] = std::min(min[i], rowMin[y][i]);
+                max[i] = std::max(max[i], rowMax[y][i]);
+                avg[i] += rowSum[y][i];
+            }
+        }
         min_ = min;
         max_ = max;
         avg_ = avg / (Scalar) (m_size.x * m_size.y);
@@ -134,9 +158,14 @@ public:
      * \remark This function performs type casts when <tt>Value != AltValue</tt>
      */
     template <typename AltValue> void copyTo(AltValue *data) const {
-        for (int y=0; y<m_size.y; ++y)
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(static)
+        #endif
+        for (int y=0; y<m_size.y; ++y) {
+            AltValue *row = data + (size_t) y * (size_t) m_size.x;
             for (int x=0; x<m_size.x; ++x)
-                    *data++ = AltValue((*this)(x, y));
+                row[x] = AltValue((*this)(x, y));
+        }
     }
 
 
@@ -0,0 +1,443 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_CORE_BCARRAY_H_)
+#define __MITSUBA_CORE_BCARRAY_H_
+
+#include <mitsuba/core/half.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Block-compressed generic 2D array of non-negative values
+ *
+ * This class stores a read-only 2D array in blocks of 4x4 entries using
+ * a format that is modeled after single-subset BC6H (unsigned): every
+ * block holds two endpoints as half precision bit patterns, and each
+ * entry references one of 16 colors that are interpolated between them.
+ *
+ * Like in BC6H, the interpolation operates on the bit patterns rather
+ * than on the values themselves, i.e. it is piecewise linear in an
+ * (approximately) logarithmic space. This keeps the relative error of
+ * high dynamic range data bounded, and decoding an entry only requires
+ * a few integer operations and the half precision conversion table.
+ * An RGB block occupies 20 bytes instead of the 96 bytes taken up by
+ * 16 uncompressed half precision entries.
+ *
+ * Encoding is considerably more expensive than decoding, since the
+ * endpoints of each block are fit to its contents in several passes. The
+ * array is thus meant for data that is written once (e.g. MIP maps).
+ * Its interface otherwise mirrors that of \ref BlockedArray.
+ *
+ * \tparam Value
+ *    A \c TSpectrum or \c TVector instance with non-negative components.
+ *    Negative values and NaNs are clamped to zero.
+ */
+template <typename Value> class CompressedBlockArray {
+public:
+    typedef typename Value::Scalar Scalar;
+
+    /// Number of components per entry
+    static const int dim = Value::dim;
+
+    /// Base-2 logarithm of the edge length of a block
+    static const int blockShift = 2;
+
+    /// Edge length of a block
+    static const int blockSize = 1 << blockShift;
+
+    /// Storage of a block of 4x4 entries
+    struct Block {
+        /// Half precision bit patterns of the two endpoints
+        uint16_t endpoints[2][dim];
+        /// 4-bit palette indices of the entries (row-major order)
+        uint32_t indices[2];
+    };
+
+    /// Create an unitialized compressed array
+    CompressedBlockArray() : m_data(NULL), m_size(-1), m_owner(false) { }
+
+    /**
+     * \brief Allocate memory for a new compressed array of
+     * the specified width and height
+     */
+    CompressedBlockArray(const Vector2i &size) : m_data(NULL),
+            m_size(-1), m_owner(false) {
+        alloc(size);
+    }
+
+    /**
+     * \brief Allocate memory for a compressed array of
+     * the specified width and height
+     */
+    void alloc(const Vector2i &size) {
+        if (m_data && m_owner)
+            freeAligned(m_data);
+
+        m_blocks = blockCount(size);
+        m_data = (Block *) allocAligned(bufferSize(size));
+        m_owner = true; /* We own this pointer */
+        m_size = size;
+    }
+
+    /**
+     * \brief Initialize the compressed array with a given pointer
+     * and array size.
+     *
+     * This is useful in case memory has already been allocated.
+     */
+    void map(void *ptr, const Vector2i &size) {
+        if (m_data && m_owner)
+            freeAligned(m_data);
+
+        m_blocks = blockCount(size);
+        m_data = (Block *) ptr;
+        m_owner = false; /* We do not own this pointer */
+        m_size = size;
+    }
+
+    /**
+     * \brief Encode values from a non-blocked source in row-major order
+     *
+     * Entries of partially covered blocks that lie outside of the array
+     * don't affect the encoding and are set to the first endpoint.
+     */
+    template <typename AltValue> void init(const AltValue *data) {
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(dynamic)
+        #endif
+        for (int yb=0; yb<m_blocks.y; ++yb)
+            for (int xb=0; xb<m_blocks.x; ++xb)
+                encode(data, xb, yb, m_data[xb + (size_t) yb * m_blocks.x]);
+    }
+
+    /**
+     * \brief Encode values from a non-blocked source in row-major order
+     * and collect component-wise minimum, maximum, and average information
+     * about the (uncompressed) input.
+     */
+    template <typename AltValue> void init(const AltValue *data,
+            AltValue &min_, AltValue &max_, AltValue &avg_) {
+        typedef typename AltValue::Scalar AltScalar;
+
+        AltValue
+            min(+std::numeric_limits<AltScalar>::infinity()),
+            max(-std::numeric_limits<AltScalar>::infinity()),
+            avg((AltScalar) 0);
+
+        size_t count = (size_t) m_size.x * (size_t) m_size.y;
+        for (size_t i=0; i<count; ++i) {
+            const AltValue &value = data[i];
+            for (int j=0; j<AltValue::dim; ++j) {
+                min[j] = std::min(min[j], value[j]);
+                max[j] = std::max(max[j], value[j]);
+                avg[j] += value[j];
+            }
+        }
+        min_ = min;
+        max_ = max;
+        avg_ = avg / (AltScalar) count;
+
+        init(data);
+    }
+
+    /**
+     * \brief Decode the contents of the compressed array to a non-blocked
+     * destination buffer in row-major order.
+     *
+     * \remark This function performs type casts when <tt>Value != AltValue</tt>
+     */
+    template <typename AltValue> void copyTo(AltValue *data) const {
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(static)
+        #endif
+        for (int y=0; y<m_size.y; ++y) {
+            AltValue *row = data + (size_t) y * (size_t) m_size.x;
+            for (int x=0; x<m_size.x; ++x)
+                row[x] = AltValue((*this)(x, y));
+        }
+    }
+
+    /// Return the size of the array
+    inline const Vector2i &getSize() const { return m_size; }
+
+    /// Return the number of blocks along each axis for the given size
+    inline static Vector2i blockCount(const Vector2i &size) {
+        return Vector2i(
+            (size.x + blockSize - 1) >> blockShift,
+            (size.y + blockSize - 1) >> blockShift);
+    }
+
+    /// Return the hypothetical heap memory requirements of a compressed array for the given size
+    inline static size_t bufferSize(const Vector2i &size) {
+        Vector2i blocks = blockCount(size);
+        return (size_t) blocks.x * (size_t) blocks.y * sizeof(Block);
+    }
+
+    /// Return the size of the allocated buffer
+    inline size_t getBufferSize() const {
+        return (size_t) m_blocks.x * (size_t) m_blocks.y * sizeof(Block);
+    }
+
+    /// Return the width of the array
+    inline int getWidth() const { return m_size.x; }
+
+    /// Return the height of the array
+    inline int getHeight() const { return m_size.y; }
+
+    /// Release all memory
+    ~CompressedBlockArray() {
+        if (m_data && m_owner)
+            freeAligned(m_data);
+    }
+
+    /// Decode the specified entry
+    inline Value operator()(int x, int y) const {
+        return decode(m_data[(x >> blockShift)
+            + (size_t) (y >> blockShift) * m_blocks.x], x, y);
+    }
+
+    /// Return the interpolation weight (out of 64) of a palette index, as in BC7
+    static inline int getWeight(int index) {
+        static const int weights[16] = {
+            0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+        };
+        return weights[index];
+    }
+
+    /**
+     * \brief Decode an entry of a block
+     *
+     * Only the lower two bits of \c x and \c y are used
+     */
+    static inline Value decode(const Block &block, int x, int y) {
+        int index = ((y & (blockSize-1)) << blockShift) | (x & (blockSize-1));
+        int w = getWeight((block.indices[index >> 3] >> ((index & 7) << 2)) & 0xF);
+
+        Value result;
+        half h;
+        for (int i=0; i<dim; ++i) {
+            h.setBits((unsigned short) (((64 - w) * (int) block.endpoints[0][i]
+                + w * (int) block.endpoints[1][i] + 32) >> 6));
+            result[i] = (Scalar) (float) h;
+        }
+        return result;
+    }
+
+    /// Return a pointer to the internal representation
+    inline Block *getData() { return m_data; }
+
+    /// Return a pointer to the internal representation (const version)
+    inline const Block *getData() const { return m_data; }
+protected:
+    /// Convert a value into the bit pattern of a non-negative half precision number
+    static inline Float toBits(Float value) {
+        if (!(value > 0)) /* Also catches NaNs */
+            return 0;
+        return (Float) half((float) std::min(value, (Float) HALF_MAX)).bits();
+    }
+
+    /**
+     * \brief Find the palette indices of a block for the given endpoints
+     * (in bit pattern space) and return the squared error
+     */
+    static Float fitIndices(const Float points[][dim], const bool *valid,
+            const Float endpoints[2][dim], int *indices) {
+        /* Reproduce the integer interpolation of the decoder */
+        Float palette[16][dim];
+        for (int k=0; k<16; ++k)
+            for (int i=0; i<dim; ++i)
+                palette[k][i] = (Float) (((64 - getWeight(k)) * (int) endpoints[0][i]
+                    + getWeight(k) * (int) endpoints[1][i] + 32) >> 6);
+
+        Float error = 0;
+        for (int j=0; j<blockSize*blockSize; ++j) {
+            indices[j] = 0;
+            if (!valid[j])
+                continue;
+            Float best = std::numeric_limits<Float>::infinity();
+            for (int k=0; k<16; ++k) {
+                Float dist = 0;
+                for (int i=0; i<dim; ++i) {
+                    Float diff = palette[k][i] - points[j][i];
+                    dist += diff*diff;
+                }
+                if (dist < best) {
+                    best = dist;
+                    indices[j] = k;
+                }
+            }
+            error += best;
+        }
+        return error;
+    }
+
+    /// Round the endpoints to valid bit patterns within the given bounds
+    static void quantizeEndpoints(Float endpoints[2][dim],
+            const Float *lower, const Float *upper) {
+        for (int e=0; e<2; ++e)
+            for (int i=0; i<dim; ++i)
+                endpoints[e][i] = (Float) math::roundToInt(
+                    math::clamp(endpoints[e][i], lower[i], upper[i]));
+    }
+
+    /// Encode the block with the given coordinates
+    template <typename AltValue> void encode(const AltValue *data,
+            int xb, int yb, Block &block) const {
+        const int count = blockSize*blockSize;
+
+        /* Gather the entries of the block in bit pattern space */
+        Float points[count][dim], lower[dim], upper[dim], mean[dim];
+        bool valid[count];
+        int n = 0;
+        for (int i=0; i<dim; ++i) {
+            lower[i] = std::numeric_limits<Float>::infinity();
+            upper[i] = -std::numeric_limits<Float>::infinity();
+            mean[i] = 0;
+        }
+        for (int j=0; j<count; ++j) {
+            int x = (xb << blockShift) + (j & (blockSize-1)),
+                y = (yb << blockShift) + (j >> blockShift);
+            valid[j] = x < m_size.x && y < m_size.y;
+            if (!valid[j])
+                continue;
+            const AltValue &value = data[x + (size_t) y * (size_t) m_size.x];
+            for (int i=0; i<dim; ++i) {
+                points[j][i] = toBits((Float) value[i]);
+                lower[i] = std::min(lower[i], points[j][i]);
+                upper[i] = std::max(upper[i], points[j][i]);
+                mean[i] += points[j][i];
+            }
+            ++n;
+        }
+        for (int i=0; i<dim; ++i)
+            mean[i] /= n;
+
+        /* Principal axis of the entries (power iteration on the
+           covariance matrix, starting with the bounding box diagonal) */
+        Float axis[dim], cov[dim][dim];
+        for (int i=0; i<dim; ++i) {
+            axis[i] = upper[i] - lower[i];
+            for (int k=0; k<dim; ++k)
+                cov[i][k] = 0;
+        }
+        for (int j=0; j<count; ++j) {
+            if (!valid[j])
+                continue;
+            for (int i=0; i<dim; ++i)
+                for (int k=0; k<dim; ++k)
+                    cov[i][k] += (points[j][i] - mean[i]) * (points[j][k] - mean[k]);
+        }
+        for (int it=0; it<8 && dim > 1; ++it) {
+            Float tmp[dim], norm = 0;
+            for (int i=0; i<dim; ++i) {
+                tmp[i] = 0;
+                for (int k=0; k<dim; ++k)
+                    tmp[i] += cov[i][k] * axis[k];
+                norm = std::max(norm, std::abs(tmp[i]));
+            }
+            if (norm == 0)
+                break;
+            for (int i=0; i<dim; ++i)
+                axis[i] = tmp[i] / norm;
+        }
+
+        /* Initial endpoints: extent of the projections onto the axis */
+        Float axisLength2 = 0, tMin = 0, tMax = 0;
+        for (int i=0; i<dim; ++i)
+            axisLength2 += axis[i]*axis[i];
+        if (axisLength2 > 0) {
+            tMin = std::numeric_limits<Float>::infinity();
+            tMax = -std::numeric_limits<Float>::infinity();
+            for (int j=0; j<count; ++j) {
+                if (!valid[j])
+                    continue;
+                Float t = 0;
+                for (int i=0; i<dim; ++i)
+                    t += (points[j][i] - mean[i]) * axis[i];
+                t /= axisLength2;
+                tMin = std::min(tMin, t);
+                tMax = std::max(tMax, t);
+            }
+        }
+
+        Float endpoints[2][dim];
+        for (int i=0; i<dim; ++i) {
+            endpoints[0][i] = mean[i] + tMin * axis[i];
+            endpoints[1][i] = mean[i] + tMax * axis[i];
+        }
+        quantizeEndpoints(endpoints, lower, upper);
+
+        int indices[count];
+        Float error = fitIndices(points, valid, endpoints, indices);
+
+        /* Refine the endpoints with a least squares fit for the current
+           indices, which often reduces the error of skewed distributions */
+        for (int it=0; it<2 && error > 0; ++it) {
+            Float a00 = 0, a01 = 0, a11 = 0, b0[dim], b1[dim];
+            for (int i=0; i<dim; ++i)
+                b0[i] = b1[i] = 0;
+            for (int j=0; j<count; ++j) {
+                if (!valid[j])
+                    continue;
+                Float alpha = getWeight(indices[j]) * (Float) (1.0 / 64.0),
+                      beta = 1 - alpha;
+                a00 += beta*beta; a01 += alpha*beta; a11 += alpha*alpha;
+                for (int i=0; i<dim; ++i) {
+                    b0[i] += beta * points[j][i];
+                    b1[i] += alpha * points[j][i];
+                }
+            }
+            Float det = a00*a11 - a01*a01;
+            if (std::abs(det) < 1e-6f)
+                break;
+
+            Float refined[2][dim];
+            for (int i=0; i<dim; ++i) {
+                refined[0][i] = (a11*b0[i] - a01*b1[i]) / det;
+                refined[1][i] = (a00*b1[i] - a01*b0[i]) / det;
+            }
+            quantizeEndpoints(refined, lower, upper);
+
+            int refinedIndices[count];
+            Float refinedError = fitIndices(points, valid, refined, refinedIndices);
+            if (refinedError >= error)
+                break;
+            error = refinedError;
+            memcpy(endpoints, refined, sizeof(endpoints));
+            memcpy(indices, refinedIndices, sizeof(indices));
+        }
+
+        for (int e=0; e<2; ++e)
+            for (int i=0; i<dim; ++i)
+                block.endpoints[e][i] = (uint16_t) endpoints[e][i];
+        block.indices[0] = block.indices[1] = 0;
+        for (int j=0; j<count; ++j)
+            block.indices[j >> 3] |= (uint32_t) indices[j] << ((j & 7) << 2);
+    }
+private:
+    Block *m_data;
+    Vector2i m_size;
+    Vector2i m_blocks;
+    bool m_owner;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_CORE_BCARRAY_H_ */
@@ -575,6 +575,28 @@ public:
      */
     void write(const fs::path &filename, int compression = -1) const;
 
+    /**
+     * \brief Write an encoded form of the bitmap to a file on a
+     * background thread
+     *
+     * This function returns immediately, which e.g. allows a rendering to
+     * finish while a large image is still being compressed. The bitmap
+     * keeps itself alive until the write has finished and must not be
+     * modified in the meantime. Writes to the same file are carried out
+     * in the order in which they were requested. Errors are reported as
+     * warnings, since there is no caller that could catch them.
+     *
+     * \sa write(EFileFormat, const fs::path &, int) and \ref waitAsyncWrites()
+     */
+    void writeAsync(EFileFormat format, const fs::path &filename, int compression = -1) const;
+
+    /**
+     * \brief Wait until all writes started by \ref writeAsync() have finished
+     *
+     * This is automatically done by \ref staticShutdown().
+     */
+    static void waitAsyncWrites();
+
     //! @}
     // ======================================================================
 
@@ -1175,6 +1197,22 @@ public:
     /// Return the names of the image channels if explicitly specified (empty by default)
     inline const std::vector<std::string> &getChannelNames() const { return m_channelNames; }
 
+    /**
+     * \brief Explicitly set the component format of every channel in
+     * OpenEXR output files
+     *
+     * This allows e.g. storing the auxiliary channels of a multi-channel
+     * image in half precision, while the bitmap itself (and the radiance
+     * channels) use \ref EFloat32. The formats must be \ref EFloat16,
+     * \ref EFloat32 or \ref EUInt32, and OpenEXR converts the values
+     * while writing. The setting only takes effect when channel names
+     * have also been specified, and it is ignored by other file formats.
+     */
+    void setChannelFormats(const std::vector<EComponentFormat> &formats);
+
+    /// Return the component formats of the channels in OpenEXR files (empty by default)
+    inline const std::vector<EComponentFormat> &getChannelFormats() const { return m_channelFormats; }
+
     //! @}
     // ======================================================================
 
@@ -1304,6 +1342,7 @@ protected:
     bool m_ownsData;
     Properties m_metadata;
     std::vector<std::string> m_channelNames;
+    std::vector<EComponentFormat> m_channelFormats;
 };
 
 /** \brief Bitmap format conversion helper class
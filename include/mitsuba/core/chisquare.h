@@ -29,6 +29,9 @@ MTS_NAMESPACE_BEGIN
 /// Minimum expected cell frequency. Cells below this value will be pooled
 #define CHISQR_MIN_EXP_FREQUENCY 5
 
+/// Number of samples per chunk in \ref ChiSquare::fillParallel()
+#define CHISQR_CHUNK_SIZE 65536
+
 /**
  * \brief Chi-square goodness-of-fit test on the sphere
  *
@@ -144,6 +147,27 @@ public:
         const boost::function<boost::tuple<Vector, Float, EMeasure>()> &sampleFn,
         const boost::function<Float (const Vector &, EMeasure)> &pdfFn);
 
+    /**
+     * \brief Fill the actual and reference bin counts using several
+     * threads
+     *
+     * The samples are split into chunks of \ref CHISQR_CHUNK_SIZE
+     * samples, which are binned in parallel. Every chunk uses its own
+     * sample function, which is created by calling \c sampleFnFactory
+     * with the chunk index. All factory calls happen on the calling
+     * thread, in the order of the chunk indices, before any sample is
+     * drawn. When every sample function is seeded deterministically
+     * (e.g. from the chunk index, or by cloning a sampler in the
+     * factory), the resulting tables don't depend on the number of
+     * threads.
+     *
+     * Like in \ref fill(), \c pdfFn is called from several threads at
+     * the same time while the reference bin counts are integrated.
+     */
+    void fillParallel(
+        const boost::function<boost::function<boost::tuple<Vector, Float, EMeasure>()> (size_t)> &sampleFnFactory,
+        const boost::function<Float (const Vector &, EMeasure)> &pdfFn);
+
     /**
      * \brief Dump the bin counts to a file using MATLAB format
      */
@@ -166,13 +190,17 @@ protected:
     /// Release all memory
     virtual ~ChiSquare();
 
-    /// Functor to evaluate the pdf values in parallel using OpenMP
+    /// Add the discrete densities to the reference bin counts
+    void addDiscreteDirections(const std::vector<Vector> &directions,
+        const boost::function<Float (const Vector &, EMeasure)> &pdfFn);
+
+    /// Compute the reference bin counts (one bin per thread)
+    void integrate(const boost::function<Float (const Vector &, EMeasure)> &pdfFn);
+
+    /// Functor to evaluate the pdf values of a bin
     static void integrand(
         const boost::function<Float (const Vector &, EMeasure)> &pdfFn,
             size_t nPts, const Float *in, Float *out) {
-        #if defined(MTS_OPENMP)
-        #pragma omp parallel for
-        #endif
         for (int i=0; i<(int) nPts; ++i)
             out[i] = pdfFn(sphericalDirection(in[2*i], in[2*i+1]), ESolidAngle)
                 * std::sin(in[2*i]);
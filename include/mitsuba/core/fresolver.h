@@ -21,6 +21,7 @@
 #define __MITSUBA_CORE_FRESOLVER_H_
 
 #include <mitsuba/mitsuba.h>
+#include <mitsuba/core/lock.h>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <deque>
@@ -35,6 +36,11 @@ MTS_NAMESPACE_BEGIN
  * compatible manner (similar to the $PATH variable on various
  * operating systems).
  *
+ * Optionally, the results of \ref resolve() can be cached (see
+ * \ref setCaching()), which avoids querying the file system over and
+ * over again for resources that are referenced many times. This is
+ * mostly useful on network file systems, where every query is slow.
+ *
  * \ingroup libcore
  * \ingroup libpython
  */
@@ -83,6 +89,23 @@ public:
     /// Clear all stored search paths
     void clear();
 
+    /**
+     * \brief Cache the results of \ref resolve()?
+     *
+     * When enabled, both successful and failed lookups are remembered
+     * until the search paths change or \ref clearCache() is called.
+     * Hence, files that are created after a failed lookup are not found
+     * until then. This is safe to use from several threads. Disabled by
+     * default (clones inherit this setting).
+     */
+    void setCaching(bool caching);
+
+    /// Are the results of \ref resolve() cached?
+    inline bool isCaching() const { return m_caching; }
+
+    /// Forget the results of previous lookups
+    void clearCache();
+
     /// Return the number of stored paths
     inline size_t getPathCount() const { return m_paths.size(); }
 
@@ -95,8 +118,14 @@ public:
     MTS_DECLARE_CLASS()
 protected:
     virtual ~FileResolver() { }
+private:
+    /// Uncached version of \ref resolve()
+    fs::path resolveUncached(const fs::path &path) const;
 private:
     std::deque<fs::path> m_paths;
+    mutable std::map<std::string, fs::path> m_cache;
+    mutable ref<Mutex> m_cacheMutex;
+    bool m_caching;
 };
 
 MTS_NAMESPACE_END
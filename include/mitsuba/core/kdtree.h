@@ -22,6 +22,17 @@
 
 #include <mitsuba/core/aabb.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/statistics.h>
+
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
+
+/**
+ * \brief Minimum number of points, for which \ref PointKDTree
+ * distributes the tree construction over multiple threads
+ */
+#define MTS_POINTKD_PARALLEL_THRESHOLD 65536
 
 MTS_NAMESPACE_BEGIN
 
@@ -286,7 +297,7 @@ public:
      * number of points
      */
     inline PointKDTree(size_t nodes = 0, EHeuristic heuristic = ESlidingMidpoint)
-        : m_nodes(nodes), m_heuristic(heuristic), m_depth(0) { }
+        : m_nodes(nodes), m_heuristic(heuristic), m_depth(0), m_parallelBuild(true) { }
 
     // =============================================================
     //! @{ \name \c stl::vector-like interface
@@ -322,6 +333,18 @@ public:
     /// Set the depth of the constructed KD-tree (be careful with this)
     inline void setDepth(size_t depth) { m_depth = depth; }
 
+    /**
+     * \brief Specify whether the tree construction should run in parallel
+     *
+     * When enabled (the default) and Mitsuba was compiled with OpenMP,
+     * the subtrees below the top levels of large trees are built on
+     * multiple threads. The resulting tree is identical to the one
+     * produced by a serial build.
+     */
+    inline void setParallelBuild(bool parallel) { m_parallelBuild = parallel; }
+    /// Return whether the tree construction runs in parallel
+    inline bool getParallelBuild() const { return m_parallelBuild; }
+
     /// Construct the KD-tree hierarchy
     void build(bool recomputeAABB = false) {
         ref<Timer> timer = new Timer();
@@ -333,6 +356,7 @@ public:
 
         SLog(EDebug, "Building a %i-dimensional kd-tree over " SIZE_T_FMT " data points (%s)",
             PointType::dim, m_nodes.size(), memString(m_nodes.size() * sizeof(NodeType)).c_str());
+        m_memory.set(m_nodes.capacity() * sizeof(NodeType));
 
         if (recomputeAABB) {
             m_aabb.reset();
@@ -351,30 +375,69 @@ public:
         for (size_t i=0; i<m_nodes.size(); ++i)
             indirection[i] = (IndexType) i;
 
-        m_depth = 0;
-        int constructionTime;
-        if (NodeType::leftBalancedLayout) {
-            std::vector<IndexType> permutation(m_nodes.size());
-            buildLB(0, 1, indirection.begin(), indirection.begin(),
+        BuildContext ctx(m_aabb);
+        std::vector<BuildTask> tasks;
+        std::vector<IndexType> permutation;
+        if (NodeType::leftBalancedLayout)
+            permutation.resize(m_nodes.size());
+
+#if defined(MTS_OPENMP)
+        /* Build the top levels serially and collect the subtrees below
+           them, which are subsequently built on multiple threads */
+        int threadCount = mts_omp_get_max_threads();
+        if (m_parallelBuild && threadCount > 1 &&
+                m_nodes.size() >= MTS_POINTKD_PARALLEL_THRESHOLD) {
+            ctx.tasks = &tasks;
+            ctx.taskSize = (IndexType) (m_nodes.size() / (8 * threadCount));
+        }
+#endif
+
+        if (NodeType::leftBalancedLayout)
+            buildLB(ctx, 0, 1, indirection.begin(), indirection.begin(),
                 indirection.end(), permutation);
-            constructionTime = timer->getMilliseconds();
-            timer->reset();
+        else
+            build(ctx, 1, indirection.begin(), indirection.begin(), indirection.end());
+
+#if defined(MTS_OPENMP)
+        if (!tasks.empty()) {
+            std::vector<size_t> taskDepth(tasks.size());
+
+            #pragma omp parallel for schedule(dynamic)
+            for (int i=0; i<(int) tasks.size(); ++i) {
+                const BuildTask &task = tasks[i];
+                BuildContext taskCtx(task.aabb);
+                typename std::vector<IndexType>::iterator base = indirection.begin();
+                if (NodeType::leftBalancedLayout)
+                    buildLB(taskCtx, task.index, task.depth, base, base + task.start,
+                        base + task.end, permutation);
+                else
+                    build(taskCtx, task.depth, base, base + task.start, base + task.end);
+                taskDepth[i] = taskCtx.depth;
+            }
+
+            for (size_t i=0; i<tasks.size(); ++i)
+                ctx.depth = std::max(ctx.depth, taskDepth[i]);
+        }
+#endif
+        m_depth = ctx.depth;
+
+        int constructionTime = timer->getMilliseconds();
+        timer->reset();
+        if (NodeType::leftBalancedLayout)
             permute_inplace(&m_nodes[0], permutation);
-        } else {
-            build(1, indirection.begin(), indirection.begin(), indirection.end());
-            constructionTime = timer->getMilliseconds();
-            timer->reset();
+        else
             permute_inplace(&m_nodes[0], indirection);
-        }
 
         int permutationTime = timer->getMilliseconds();
 
         if (recomputeAABB)
-            SLog(EDebug, "Done after %i ms (breakdown: aabb: %i ms, build: %i ms, permute: %i ms). ",
-                aabbTime + constructionTime + permutationTime, aabbTime, constructionTime, permutationTime);
+            SLog(EDebug, "Done after %i ms (breakdown: aabb: %i ms, build: %i ms, permute: %i ms, "
+                "parallel subtrees: " SIZE_T_FMT "). ", aabbTime + constructionTime + permutationTime,
+                aabbTime, constructionTime, permutationTime, tasks.size());
         else
-            SLog(EDebug, "Done after %i ms (breakdown: build: %i ms, permute: %i ms). ",
-                constructionTime + permutationTime, constructionTime, permutationTime);
+            SLog(EDebug, "Done after %i ms (breakdown: build: %i ms, permute: %i ms, "
+                "parallel subtrees: " SIZE_T_FMT "). ", constructionTime + permutationTime,
+                constructionTime, permutationTime, tasks.size());
     }
 
     /**
@@ -811,6 +874,44 @@ public:
         }
     }
 protected:
+    /// Subtree that is deferred to the parallel phase of the tree construction
+    struct BuildTask {
+        IndexType index, start, end;
+        size_t depth;
+        AABBType aabb;
+    };
+
+    /// State of one thread during the tree construction
+    struct BuildContext {
+        /// Bounds of the subtree that is currently being built
+        AABBType aabb;
+        /// Maximum depth reached so far
+        size_t depth;
+        /// When set, subtrees with at most \c taskSize points are deferred
+        std::vector<BuildTask> *tasks;
+        IndexType taskSize;
+
+        inline BuildContext(const AABBType &aabb)
+            : aabb(aabb), depth(0), tasks(NULL), taskSize(0) { }
+
+        /// Defer the construction of a subtree if it is small enough
+        inline bool defer(IndexType index, size_t depth,
+                typename std::vector<IndexType>::iterator base,
+                typename std::vector<IndexType>::iterator rangeStart,
+                typename std::vector<IndexType>::iterator rangeEnd) {
+            if (!tasks || (IndexType) (rangeEnd - rangeStart) > taskSize)
+                return false;
+            BuildTask task;
+            task.index = index;
+            task.start = (IndexType) (rangeStart - base);
+            task.end = (IndexType) (rangeEnd - base);
+            task.depth = depth;
+            task.aabb = aabb;
+            tasks->push_back(task);
+            return true;
+        }
+    };
+
     struct CoordinateOrdering : public std::binary_function<IndexType, IndexType, bool> {
     public:
         inline CoordinateOrdering(const std::vector<NodeType> &nodes, int axis)
@@ -874,16 +975,19 @@ protected:
     }
 
     /// Left-balanced tree construction routine
-    void buildLB(IndexType idx, size_t depth,
+    void buildLB(BuildContext &ctx, IndexType idx, size_t depth,
               typename std::vector<IndexType>::iterator base,
               typename std::vector<IndexType>::iterator rangeStart,
               typename std::vector<IndexType>::iterator rangeEnd,
               typename std::vector<IndexType> &permutation) {
-        m_depth = std::max(depth, m_depth);
-
         IndexType count = (IndexType) (rangeEnd-rangeStart);
         SAssert(count > 0);
 
+        if (count > 1 && ctx.defer(idx, depth, base, rangeStart, rangeEnd))
+            return;
+
+        ctx.depth = std::max(depth, ctx.depth);
+
         if (count == 1) {
             /* Create a leaf node */
             m_nodes[*rangeStart].setLeaf(true);
@@ -891,9 +995,10 @@ protected:
             return;
         }
 
+        AABBType &aabb = ctx.aabb;
         typename std::vector<IndexType>::iterator split
             = rangeStart + leftSubtreeSize(count);
-        int axis = m_aabb.getLargestAxis();
+        int axis = aabb.getLargestAxis();
         std::nth_element(rangeStart, split, rangeEnd,
             CoordinateOrdering(m_nodes, axis));
 
@@ -903,43 +1008,47 @@ protected:
         permutation[idx] = *split;
 
         /* Recursively build the children */
-        Scalar temp = m_aabb.max[axis],
+        Scalar temp = aabb.max[axis],
             splitPos = splitNode.getPosition()[axis];
-        m_aabb.max[axis] = splitPos;
-        buildLB(2*idx+1, depth+1, base, rangeStart, split, permutation);
-        m_aabb.max[axis] = temp;
+        aabb.max[axis] = splitPos;
+        buildLB(ctx, 2*idx+1, depth+1, base, rangeStart, split, permutation);
+        aabb.max[axis] = temp;
 
         if (split+1 != rangeEnd) {
-            temp = m_aabb.min[axis];
-            m_aabb.min[axis] = splitPos;
-            buildLB(2*idx+2, depth+1, base, split+1, rangeEnd, permutation);
-            m_aabb.min[axis] = temp;
+            temp = aabb.min[axis];
+            aabb.min[axis] = splitPos;
+            buildLB(ctx, 2*idx+2, depth+1, base, split+1, rangeEnd, permutation);
+            aabb.min[axis] = temp;
         }
     }
 
     /// Default tree construction routine
-    void build(size_t depth,
+    void build(BuildContext &ctx, size_t depth,
               typename std::vector<IndexType>::iterator base,
               typename std::vector<IndexType>::iterator rangeStart,
               typename std::vector<IndexType>::iterator rangeEnd) {
-        m_depth = std::max(depth, m_depth);
-
         IndexType count = (IndexType) (rangeEnd-rangeStart);
         SAssert(count > 0);
 
+        if (count > 1 && ctx.defer(0, depth, base, rangeStart, rangeEnd))
+            return;
+
+        ctx.depth = std::max(depth, ctx.depth);
+
         if (count == 1) {
             /* Create a leaf node */
             m_nodes[*rangeStart].setLeaf(true);
             return;
         }
 
+        AABBType &aabb = ctx.aabb;
         int axis = 0;
         typename std::vector<IndexType>::iterator split;
 
         switch (m_heuristic) {
             case EBalanced: {
                     split = rangeStart + count/2;
-                    axis = m_aabb.getLargestAxis();
+                    axis = aabb.getLargestAxis();
                     std::nth_element(rangeStart, split, rangeEnd,
                         CoordinateOrdering(m_nodes, axis));
                 };
@@ -947,7 +1056,7 @@ protected:
 
             case ELeftBalanced: {
                     split = rangeStart + leftSubtreeSize(count);
-                    axis = m_aabb.getLargestAxis();
+                    axis = aabb.getLargestAxis();
                     std::nth_element(rangeStart, split, rangeEnd,
                         CoordinateOrdering(m_nodes, axis));
                 };
@@ -955,10 +1064,10 @@ protected:
 
             case ESlidingMidpoint: {
                     /* Sliding midpoint rule: find a split that is close to the spatial median */
-                    axis = m_aabb.getLargestAxis();
+                    axis = aabb.getLargestAxis();
 
                     Scalar midpoint = (Scalar) 0.5f
-                        * (m_aabb.max[axis]+m_aabb.min[axis]);
+                        * (aabb.max[axis]+aabb.min[axis]);
 
                     size_t nLT = std::count_if(rangeStart, rangeEnd,
                             LessThanOrEqual(m_nodes, axis, midpoint));
@@ -984,8 +1093,8 @@ protected:
                             CoordinateOrdering(m_nodes, dim));
 
                         size_t numLeft = 1, numRight = count-2;
-                        AABBType leftAABB(m_aabb), rightAABB(m_aabb);
-                        Float invVolume = 1.0f / m_aabb.getVolume();
+                        AABBType leftAABB(aabb), rightAABB(aabb);
+                        Float invVolume = 1.0f / aabb.getVolume();
                         for (typename std::vector<IndexType>::iterator it = rangeStart+1;
                                 it != rangeEnd; ++it) {
                             ++numLeft; --numRight;
@@ -1022,24 +1131,26 @@ protected:
         std::iter_swap(rangeStart, split);
 
         /* Recursively build the children */
-        Scalar temp = m_aabb.max[axis],
+        Scalar temp = aabb.max[axis],
             splitPos = splitNode.getPosition()[axis];
-        m_aabb.max[axis] = splitPos;
-        build(depth+1, base, rangeStart+1, split+1);
-        m_aabb.max[axis] = temp;
+        aabb.max[axis] = splitPos;
+        build(ctx, depth+1, base, rangeStart+1, split+1);
+        aabb.max[axis] = temp;
 
         if (split+1 != rangeEnd) {
-            temp = m_aabb.min[axis];
-            m_aabb.min[axis] = splitPos;
-            build(depth+1, base, split+1, rangeEnd);
-            m_aabb.min[axis] = temp;
+            temp = aabb.min[axis];
+            aabb.min[axis] = splitPos;
+            build(ctx, depth+1, base, split+1, rangeEnd);
+            aabb.min[axis] = temp;
         }
     }
 protected:
     std::vector<NodeType> m_nodes;
+    TrackedMemory<EMemoryPointKDTree> m_memory;
     AABBType m_aabb;
     EHeuristic m_heuristic;
     size_t m_depth;
+    bool m_parallelBuild;
 };
 
 MTS_NAMESPACE_END
@@ -200,7 +200,39 @@ public:
     bool readLog(std::string &target);
 
     /// Return the number of warnings reported so far
-    inline size_t getWarningCount() const { return m_warningCount; }
+    inline size_t getWarningCount() const { return (size_t) m_warningCount; }
+
+    /**
+     * \brief Enable or disable asynchronous logging
+     *
+     * In asynchronous mode, \ref log() only formats a message and
+     * queues it without taking any locks. A background thread
+     * periodically passes the queued messages on to the appenders,
+     * so that slow appenders (log files, the GUI log widget) don't
+     * serialize threads that log heavily. Errors and progress
+     * messages are still processed right away, after the queued
+     * messages. Disabled by default.
+     */
+    void setAsynchronous(bool value);
+
+    /// Is asynchronous logging enabled?
+    inline bool isAsynchronous() const { return m_asynchronous; }
+
+    /// Pass all queued messages on to the appenders
+    void flush();
+
+    /**
+     * \brief Limit the number of warnings that are reported
+     * from any single source location
+     *
+     * Further warnings from that location are still counted by
+     * \ref getWarningCount(), but discarded. A value of zero
+     * disables the limit. The default is 100.
+     */
+    void setWarningLimit(size_t limit);
+
+    /// Return the maximum number of warnings reported per source location
+    inline size_t getWarningLimit() const { return m_warningLimit; }
 
     /// Initialize logging
     static void staticInitialization();
@@ -213,12 +245,31 @@ protected:
     /// Virtual destructor
     virtual ~Logger();
 private:
+    struct QueuedMessage;
+    typedef std::map<std::pair<std::string, int>, size_t> WarningMap;
+
+    /// Count a warning, returns how often the location has reported one
+    size_t countWarning(const char *fileName, int lineNumber);
+
+    /// Pass the queued messages on to the appenders (with \c m_mutex held)
+    void drain();
+
     ELogLevel m_logLevel;
     ELogLevel m_errorLevel;
     ref<Formatter> m_formatter;
     ref<Mutex> m_mutex;
     std::vector<Appender *> m_appenders;
-    size_t m_warningCount;
+    volatile int64_t m_warningCount;
+
+    /* Asynchronous logging */
+    bool m_asynchronous;
+    QueuedMessage *m_queue;
+    ref<Thread> m_drainThread;
+
+    /* Rate limiting of warnings */
+    size_t m_warningLimit;
+    WarningMap m_warnings;
+    ref<Mutex> m_warningMutex;
 };
 
 MTS_NAMESPACE_END
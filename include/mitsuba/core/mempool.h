@@ -97,7 +97,8 @@ public:
 private:
     void increaseCapacity(size_t nEntries = MTS_MEMPOOL_GRANULARITY) {
         T *ptr = static_cast<T *>(allocAligned(sizeof(T) * nEntries));
-        for (size_t i=0; i<nEntries; ++i)
+        /* Hand out consecutive entries in ascending order */
+        for (size_t i=nEntries; i-- > 0; )
             m_free.push_back(&ptr[i]);
         m_cleanup.push_back(ptr);
         m_size += nEntries;
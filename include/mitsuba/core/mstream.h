@@ -75,6 +75,16 @@ public:
     /// Set size and position to zero without changing the underlying buffer
     void reset();
 
+    /**
+     * \brief Copy content from this stream into another stream
+     *
+     * In contrast to the generic implementation, this hands the
+     * buffer to the destination stream with a single \ref write()
+     * call, which avoids one system call per 512-byte block when
+     * writing to a socket or file.
+     */
+    void copyTo(Stream *stream, int64_t numBytes = -1);
+
     //! @}
     // =============================================================
 
@@ -56,6 +56,20 @@ public:
      */
     void decRef(bool autoDeallocate = true) const;
 
+    /**
+     * \brief Specify whether the object is only referenced by a single thread
+     *
+     * Reference count updates of thread-confined objects use plain
+     * instead of atomic instructions, which avoids cache line transfers
+     * between cores. This is only safe when references are never acquired
+     * or released concurrently, e.g. for per-worker copies of a resource
+     * that are handed between threads using a lock.
+     */
+    inline void setThreadConfined(bool value) { m_threadConfined = value; }
+
+    /// Is the object only referenced by a single thread?
+    inline bool isThreadConfined() const { return m_threadConfined; }
+
     /// Retrieve this object's class
     virtual const Class *getClass() const;
 
@@ -90,12 +104,63 @@ private:
 #else
     volatile mutable long m_refCount;
 #endif
+    bool m_threadConfined;
 };
 
 inline int Object::getRefCount() const {
     return m_refCount;
 }
 
+/**
+ * \brief Thread-caching allocator for small objects that are
+ * created and destroyed at a high rate
+ *
+ * Every thread keeps a bounded free list for each size class (multiples
+ * of 16 bytes up to \ref EMaxSize), so that most allocations made by
+ * worker threads never reach the shared system allocator. Blocks may be
+ * released by a different thread than the one that allocated them.
+ * Classes opt into this allocator using \ref MTS_DECLARE_POOLED_ALLOCATION.
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE ObjectAllocator {
+public:
+    enum {
+        /// Larger allocations are forwarded to the system allocator
+        EMaxSize = 512,
+        /// Maximum number of cached blocks per thread and size class
+        EMaxCached = 256
+    };
+
+    /// Allocate a block of memory
+    static void *alloc(size_t size);
+
+    /// Release a block of memory that was obtained from \ref alloc()
+    static void release(void *ptr, size_t size);
+
+    /// Set up the per-thread caches
+    static void staticInitialization();
+
+    /// Free the memory taken by staticInitialization()
+    static void staticShutdown();
+};
+
+/**
+ * \brief Allocate instances of a class (and its subclasses)
+ * using the thread-caching \ref ObjectAllocator
+ *
+ * This must be placed in the public section of the class declaration.
+ */
+#define MTS_DECLARE_POOLED_ALLOCATION() \
+    static void *operator new(size_t size) { \
+        return mitsuba::ObjectAllocator::alloc(size); \
+    } \
+    static void *operator new(size_t, void *ptr) { return ptr; } \
+    static void operator delete(void *ptr, size_t size) { \
+        mitsuba::ObjectAllocator::release(ptr, size); \
+    } \
+    static void operator delete(void *, void *) { }
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_CORE_OBJECT_H_ */
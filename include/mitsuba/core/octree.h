@@ -35,6 +35,10 @@ MTS_NAMESPACE_BEGIN
  * threads. These are internally realized via atomic compare and exchange
  * operations, meaning that no lock must be acquired.
  *
+ * When the order of the elements does not matter, \ref prepend() should be
+ * preferred: it takes constant time and a single atomic operation, while
+ * \ref append() has to walk (and atomically test) the entire list.
+ *
  * \ingroup libcore
  */
 template <typename T> class LockFreeList {
@@ -69,6 +73,15 @@ public:
         while (!atomicCompareAndExchangePtr<ListItem>(cur, item, NULL))
             cur = &((*cur)->next);
     }
+
+    /// Insert an element at the front of the list
+    void prepend(const T &value) {
+        ListItem *item = new ListItem(value);
+
+        do {
+            item->next = m_head;
+        } while (!atomicCompareAndExchangePtr<ListItem>(&m_head, item, item->next));
+    }
 private:
     ListItem *m_head;
 };
@@ -82,6 +95,10 @@ private:
  * The \c Item template parameter must implement a function
  * named <tt>getPosition()</tt> that returns a \ref Point.
  *
+ * When compiled with OpenMP support, the top levels of the tree are
+ * built serially (with a parallel labeling pass), and the subtrees
+ * below them are then built in parallel.
+ *
  * \ingroup libcore
  */
 template <typename Item, typename NodeData> class StaticOctree {
@@ -140,7 +157,19 @@ public:
             perm[i] = i;
 
         /* Build the kd-tree and compute a suitable permutation of the elements */
-        m_root = build(m_aabb, 0, &perm[0], &temp[0], &perm[0], &perm[0] + m_items.size());
+        std::vector<Subtree> subtrees;
+        m_root = build(m_aabb, 0, &perm[0], &temp[0], &perm[0],
+            &perm[0] + m_items.size(), &subtrees);
+
+        /* Build the deferred subtrees, which cover disjoint ranges */
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(dynamic)
+        #endif
+        for (int i=0; i<(int) subtrees.size(); ++i) {
+            const Subtree &subtree = subtrees[i];
+            *subtree.node = build(subtree.aabb, subtree.depth, &perm[0],
+                &temp[0], subtree.start, subtree.end, NULL);
+        }
 
         /* Apply the permutation */
         permute_inplace(&m_items[0], perm);
@@ -149,6 +178,21 @@ public:
     }
 
 protected:
+    /// Depth, below which the subtrees are built in parallel
+    static const uint32_t ParallelBuildDepth = 2;
+
+    /// Subtree whose construction was deferred by \ref build()
+    struct Subtree {
+        OctreeNode **node;
+        AABB aabb;
+        uint32_t depth;
+        uint32_t *start, *end;
+
+        inline Subtree(OctreeNode **node, const AABB &aabb, uint32_t depth,
+            uint32_t *start, uint32_t *end) : node(node), aabb(aabb),
+            depth(depth), start(start), end(end) { }
+    };
+
     struct LabelOrdering : public std::binary_function<uint32_t, uint32_t, bool> {
         LabelOrdering(const std::vector<Item> &items) : m_items(items) { }
 
@@ -171,8 +215,15 @@ protected:
         return childAABB;
     }
 
+    /**
+     * \brief Recursively build the subtree over the items <tt>[start, end)</tt>
+     *
+     * When \c subtrees is not \c NULL, the nodes at \ref ParallelBuildDepth
+     * are not built but appended to this list.
+     */
     OctreeNode *build(const AABB &aabb, uint32_t depth, uint32_t *base,
-            uint32_t *temp, uint32_t *start, uint32_t *end) {
+            uint32_t *temp, uint32_t *start, uint32_t *end,
+            std::vector<Subtree> *subtrees) {
         if (start == end) {
             return NULL;
         } else if ((uint32_t) (end-start) < m_maxItems || depth > m_maxDepth) {
@@ -187,9 +238,13 @@ protected:
         uint32_t nestedCounts[8];
         memset(nestedCounts, 0, sizeof(uint32_t)*8);
 
-        /* Label all items */
-        for (uint32_t *it = start; it != end; ++it) {
-            Item &item = m_items[*it];
+        /* Label all items (in parallel while building the top levels) */
+        int count = (int) (end-start);
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for if (subtrees != NULL)
+        #endif
+        for (int i=0; i<count; ++i) {
+            Item &item = m_items[start[i]];
             const Point &p = item.getPosition();
 
             uint8_t label = 0;
@@ -201,20 +256,25 @@ protected:
             SAssert(bounds.contains(p));
 
             item.label = label;
-            nestedCounts[label]++;
         }
 
+        for (uint32_t *it = start; it != end; ++it)
+            nestedCounts[m_items[*it].label]++;
+
         uint32_t nestedOffsets[9];
         nestedOffsets[0] = 0;
         for (int i=1; i<=8; ++i)
             nestedOffsets[i] = nestedOffsets[i-1] + nestedCounts[i-1];
 
-        /* Sort by label */
+        /* Sort by label (using the part of the scratch space that
+           corresponds to this range, since subtrees may be built
+           concurrently) */
+        uint32_t *scratch = temp + (start - base);
         for (uint32_t *it = start; it != end; ++it) {
             int offset = nestedOffsets[m_items[*it].label]++;
-            temp[offset] = *it;
+            scratch[offset] = *it;
         }
-        memcpy(start, temp, (end-start) * sizeof(uint32_t));
+        memcpy(start, scratch, (end-start) * sizeof(uint32_t));
 
         /* Recurse */
         OctreeNode *result = new OctreeNode();
@@ -222,7 +282,14 @@ protected:
             AABB bounds = childBounds(i, aabb, center);
 
             uint32_t *it = start + nestedCounts[i];
-            result->children[i] = build(bounds, depth+1, base, temp, start, it);
+            if (subtrees && depth+1 == ParallelBuildDepth && it != start) {
+                result->children[i] = NULL;
+                subtrees->push_back(Subtree(&result->children[i],
+                    bounds, depth+1, start, it));
+            } else {
+                result->children[i] = build(bounds, depth+1, base,
+                    temp, start, it, subtrees);
+            }
             start = it;
         }
 
@@ -320,7 +387,8 @@ private:
            than the current node size */
         if (depth == m_maxDepth ||
             (nodeAABB.getExtents().lengthSquared() < diag2)) {
-            node->data.append(value);
+            /* The order of the items within a node does not matter */
+            node->data.prepend(value);
             return;
         }
 
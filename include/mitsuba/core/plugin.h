@@ -125,6 +125,17 @@ public:
     /// Ensure that a plugin is loaded and ready
     void ensurePluginLoaded(const std::string &name);
 
+    /**
+     * \brief Load several plugins ahead of time (in parallel)
+     *
+     * Plugins are otherwise loaded one by one when the first instance
+     * is created, while holding a lock. This function resolves and loads
+     * the given plugins concurrently instead, which hides the latency
+     * of slow (e.g. network) file systems. Plugins that cannot be loaded
+     * are skipped; the error is reported once they are instantiated.
+     */
+    void preloadPlugins(const std::vector<std::string> &names);
+
     /// Return the list of loaded plugins
     std::vector<std::string> getLoadedPlugins() const;
 
@@ -168,6 +179,9 @@ protected:
 
     /// Destruct and unload all plugins
     ~PluginManager();
+
+    /// Return the file name of a plugin relative to the search path
+    static fs::path getPluginFileName(const std::string &name);
 private:
     std::map<std::string, Plugin *> m_plugins;
     mutable ref<Mutex> m_mutex;
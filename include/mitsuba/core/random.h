@@ -137,6 +137,39 @@ public:
     /// Return a normally distributed value
     Float nextStandardNormal();
 
+    /**
+     * \brief Fill an array with 64-bit integers
+     *
+     * This produces exactly the same values as calling \ref nextULong()
+     * \c count times, but it copies whole blocks of the SIMD-generated
+     * internal state at once instead of extracting them one by one.
+     *
+     * \remark This function is currently not exposed
+     * by the Python bindings
+     */
+    void fill(uint64_t *values, size_t count);
+
+    /**
+     * \brief Fill an array with 32-bit integers
+     *
+     * Each internally generated 64-bit value provides two entries.
+     *
+     * \remark This function is currently not exposed
+     * by the Python bindings
+     */
+    void fill(uint32_t *values, size_t count);
+
+    /**
+     * \brief Fill an array with floating point values on the [0, 1) interval
+     *
+     * This produces exactly the same values as calling \ref nextFloat()
+     * \c count times.
+     *
+     * \remark This function is currently not exposed
+     * by the Python bindings
+     */
+    void fill(Float *values, size_t count);
+
     /**
      * \brief Draw a uniformly distributed permutation and permute the
      * given STL container.
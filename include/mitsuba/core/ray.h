@@ -174,6 +174,46 @@ struct RayDifferential : public Ray {
         ryDirection = d + (ryDirection - d) * amountUV.y;
     }
 
+    /**
+     * \brief Return the width of the ray footprint at distance \c t
+     *
+     * The differentials are interpreted as a ray cone, i.e. only the
+     * larger of the two offsets is taken into account.
+     */
+    inline Float getConeWidth(Float t) const {
+        if (!hasDifferentials)
+            return 0.0f;
+        Float wx = ((rxOrigin - o) + (rxDirection - d) * t).length(),
+              wy = ((ryOrigin - o) + (ryDirection - d) * t).length();
+        return std::max(wx, wy);
+    }
+
+    /// Return the spread angle of the ray cone (in radians)
+    inline Float getConeSpread() const {
+        if (!hasDifferentials)
+            return 0.0f;
+        return std::max((rxDirection - d).length(),
+            (ryDirection - d).length());
+    }
+
+    /**
+     * \brief Replace the differentials by an isotropic ray cone
+     *
+     * \param width
+     *     Width of the footprint at the ray origin
+     * \param spread
+     *     Spread angle of the cone (in radians)
+     */
+    inline void setCone(Float width, Float spread) {
+        Vector s, t;
+        coordinateSystem(d, s, t);
+        rxOrigin = o + s * width;
+        ryOrigin = o + t * width;
+        rxDirection = d + s * spread;
+        ryDirection = d + t * spread;
+        hasDifferentials = true;
+    }
+
     inline void operator=(const RayDifferential &ray) {
         o = ray.o;
         mint = ray.mint;
@@ -35,11 +35,19 @@ struct RayPacket4 {
     QuadVector o, d;
     QuadVector dRcp;
     uint8_t signs[4][4];
+    Float time[4];
 
     inline RayPacket4() {
     }
 
+    /**
+     * \brief Load four rays into the packet
+     *
+     * \return \c true if the direction signs of all rays agree, i.e.
+     * when the packet can be traced coherently
+     */
     inline bool load(const Ray *rays) {
+        bool coherent = true;
         for (int i=0; i<4; i++) {
             for (int axis=0; axis<3; axis++) {
                 o[axis].f[i] = rays[i].o[axis];
@@ -47,10 +55,11 @@ struct RayPacket4 {
                 dRcp[axis].f[i] = rays[i].dRcp[axis];
                 signs[axis][i] = rays[i].d[axis] < 0 ? 1 : 0;
                 if (signs[axis][i] != signs[axis][0])
-                    return false;
+                    coherent = false;
             }
+            time[i] = rays[i].time;
         }
-        return true;
+        return coherent;
     }
 };
 
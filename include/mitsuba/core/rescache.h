@@ -0,0 +1,107 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#pragma once
+#if !defined(__MITSUBA_CORE_RESCACHE_H_)
+#define __MITSUBA_CORE_RESCACHE_H_
+
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/lock.h>
+#include <boost/filesystem/path.hpp>
+#include <ctime>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Persistent on-disk store of serialized scheduler resources,
+ * which are addressed by their content hash (see \ref contentHash())
+ *
+ * This is used by <tt>mtssrv</tt> to keep the resources of past jobs
+ * around, so that unchanged meshes, textures, etc. need not be sent
+ * over the network again when a following job reuses them. When the
+ * total size exceeds the given limit, the least recently used entries
+ * are removed. The cache can be shared by several connections.
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE ResourceCache : public Object {
+public:
+    /**
+     * \brief Open (or create) a resource cache in the given directory
+     *
+     * \param path
+     *    Directory that holds the cache entries
+     * \param maxSize
+     *    Maximum total size of the cache entries in bytes
+     */
+    ResourceCache(const fs::path &path, size_t maxSize);
+
+    /**
+     * \brief Look up a resource by its content hash
+     *
+     * \return The serialized resource (positioned at the beginning and
+     *    using network byte order), or \c NULL if the cache contains no
+     *    valid entry with this hash
+     */
+    ref<MemoryStream> load(const std::string &hash);
+
+    /**
+     * \brief Store a serialized resource under its content hash
+     *
+     * The contents of \c data up to its current position are stored.
+     */
+    void store(const std::string &hash, const MemoryStream *data);
+
+    /// Return the total size of the cache entries in bytes
+    size_t getSize() const;
+
+    /// Return the number of cache entries
+    size_t getEntryCount() const;
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    struct Entry {
+        size_t size;
+        std::time_t lastUse;
+    };
+
+    /// Virtual destructor
+    virtual ~ResourceCache() { }
+
+    /// Return the file name of a cache entry
+    fs::path getFilename(const std::string &hash) const;
+
+    /// Remove an entry (the lock must be held)
+    void remove(const std::string &hash);
+
+    /// Remove the least recently used entries until the size limit is met
+    void evict();
+private:
+    fs::path m_path;
+    size_t m_maxSize, m_size;
+    std::map<std::string, Entry> m_entries;
+    mutable ref<Mutex> m_mutex;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_CORE_RESCACHE_H_ */
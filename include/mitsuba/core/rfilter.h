@@ -38,6 +38,12 @@ MTS_NAMESPACE_BEGIN
  * each sample, the implementation of this class internally precomputes
  * an discrete representation (resolution given by \ref MTS_FILTER_RESOLUTION)
  *
+ * When the \c importanceSampling parameter is set, the sensor sample
+ * positions are instead drawn proportionally to the absolute value of this
+ * discretized filter (see \ref sample()), and each sample only contributes
+ * to the pixel it was generated for. Image blocks then no longer require a
+ * border region (\ref getBorderSize() returns zero).
+ *
  * \ingroup librender
  * \ingroup libpython
  */
@@ -69,6 +75,9 @@ public:
     /// Return the block border size required when rendering with this filter
     inline int getBorderSize() const { return m_borderSize; }
 
+    /// Are sensor sample positions importance sampled from the filter?
+    inline bool isImportanceSampled() const { return m_importanceSampling; }
+
     /// Evaluate the filter function
     virtual Float eval(Float x) const = 0;
 
@@ -76,6 +85,48 @@ public:
     inline Float evalDiscretized(Float x) const { return m_values[
         std::min((int) std::abs(x * m_scaleFactor), MTS_FILTER_RESOLUTION)]; }
 
+    /**
+     * \brief Importance sample the discretized filter
+     *
+     * \param u
+     *    A uniformly distributed number on <tt>[0, 1)</tt>
+     * \param weight
+     *    Set to the sign of the filter at the sampled position. Since the
+     *    samples are distributed proportionally to the absolute value of the
+     *    filter, this is its value divided by the density up to a constant
+     *    factor, which cancels when normalizing by the weight channel.
+     * \return An offset on <tt>[-radius, radius]</tt>
+     */
+    Float sample(Float u, Float &weight) const;
+
+    /**
+     * \brief Importance sample the 2D (separable) filter
+     *
+     * \return An offset relative to the pixel center
+     * \see sample(Float, Float &)
+     */
+    inline Vector2 sample(const Point2 &u, Float &weight) const {
+        Float weightX, weightY;
+        Vector2 result(sample(u.x, weightX), sample(u.y, weightY));
+        weight = weightX * weightY;
+        return result;
+    }
+
+    /**
+     * \brief Generate the film position of a sensor sample
+     *
+     * Without importance sampling, this places the sample uniformly within
+     * the given pixel and sets \c weight to one. Otherwise, the sample is
+     * offset from the pixel center using \ref sample(const Point2 &, Float &).
+     */
+    inline Point2 samplePosition(const Point2i &pixel, const Point2 &u, Float &weight) const {
+        if (!m_importanceSampling) {
+            weight = 1.0f;
+            return Point2(pixel) + Vector2(u);
+        }
+        return Point2(pixel) + Vector2(0.5f) + sample(u, weight);
+    }
+
     /// Serialize the filter to a binary data stream
     void serialize(Stream *stream, InstanceManager *manager) const;
 
@@ -95,7 +146,9 @@ protected:
 protected:
     Float m_radius, m_scaleFactor;
     Float m_values[MTS_FILTER_RESOLUTION+1];
+    Float m_cdf[MTS_FILTER_RESOLUTION+1];
     int m_borderSize;
+    bool m_importanceSampling;
 };
 
 /**
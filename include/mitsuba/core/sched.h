@@ -234,6 +234,29 @@ public:
      */
     virtual EStatus generateWork(WorkUnit *unit, int worker) = 0;
 
+    /**
+     * \brief Generate several pieces of work at once.
+     *
+     * Fills up to \c count pre-allocated work units (see
+     * \ref generateWork()) and stores the number of filled entries
+     * in \c generated. The return value refers to the state of the
+     * process after the last unit: \ref ESuccess when all \c count
+     * units were filled, and \ref EFailure or \ref EPause when fewer
+     * units (possibly none at all) could be generated.
+     *
+     * The scheduler uses this function to acquire several work units
+     * while holding its mutex only once. The default implementation
+     * repeatedly calls \ref generateWork() -- subclasses can override
+     * it to avoid the per-unit overhead.
+     *
+     * \param units     Array of work unit data structures to be filled
+     * \param count     Number of entries of \c units
+     * \param generated Used to return the number of filled entries
+     * \param worker    ID of the worker executing this function
+     */
+    virtual EStatus generateWorkBatch(WorkUnit * const *units,
+        size_t count, size_t &generated, int worker);
+
     /**
      * \brief Called whenever a work unit has been completed.
      *
@@ -254,6 +277,23 @@ public:
     virtual void processResult(const WorkResult *result,
         bool cancelled) = 0;
 
+    /**
+     * \brief Called by the scheduler whenever a work unit has been
+     * completed, along with the unit itself
+     *
+     * The default implementation forwards to \ref processResult().
+     * This is overridden by processes that need to know which of their
+     * work units produced a result (e.g. \ref RemoteProcess).
+     *
+     * \param unit Work unit that was processed
+     * \param result Work result to be processed
+     * \param cancelled Was the associated work unit not fully completed
+     */
+    virtual void processUnitResult(const WorkUnit *unit,
+        const WorkResult *result, bool cancelled) {
+        processResult(result, cancelled);
+    }
+
     /**
      * \brief Called when the parallel process is canceled by
      * \ref Scheduler::cancel().
@@ -321,17 +361,48 @@ public:
      */
     virtual std::vector<std::string> getRequiredPlugins();
 
+    /**
+     * \brief Return the amount of memory (in bytes) that a machine needs
+     * to hold the resources of this process
+     *
+     * Work units are only handed to remote nodes that announced at least
+     * this much memory. The default of zero means that the footprint is
+     * unknown, in which case every node receives work.
+     */
+    inline size_t getMemoryFootprint() const { return m_memoryFootprint; }
+
+    /// Declare the memory footprint of this process (see \ref getMemoryFootprint())
+    inline void setMemoryFootprint(size_t footprint) { m_memoryFootprint = footprint; }
+
+    /**
+     * \brief Return the relative share of the workers that this
+     * process is entitled to
+     *
+     * When several processes are runnable, the scheduler hands the next
+     * work unit to the one that received the fewest work units in relation
+     * to its share. A process with twice the share of another one thus
+     * receives about twice as many work units while both are running.
+     * The default of zero means that the process inherits the share of
+     * the thread that scheduled it (see \ref Scheduler::setThreadShare()).
+     */
+    inline Float getShare() const { return m_share; }
+
+    /// Set the relative share of the workers (see \ref getShare())
+    inline void setShare(Float share) { m_share = share; }
+
     MTS_DECLARE_CLASS()
 protected:
     /// Protected constructor
     inline ParallelProcess() : m_returnStatus(EUnknown),
-        m_logLevel(EDebug) { }
+        m_logLevel(EDebug), m_memoryFootprint(0), m_share(0) { }
     /// Virtual destructor
     virtual ~ParallelProcess() { }
 protected:
     ResourceBindings m_bindings;
     EStatus m_returnStatus;
     ELogLevel m_logLevel;
+    size_t m_memoryFootprint;
+    Float m_share;
 };
 
 class Worker;
@@ -477,6 +548,38 @@ public:
     /// Is the scheduler currently executing work?
     bool isBusy() const;
 
+    /**
+     * \brief Set the number of work units that local workers acquire
+     * from the scheduler at once.
+     *
+     * When set to a value greater than one, the scheduler operates in a
+     * work stealing mode: every \ref LocalWorker generates a batch of
+     * work units while holding the central lock, keeps them in a private
+     * queue, and steals queued work from other local workers before
+     * blocking. This greatly reduces lock contention on machines with
+     * many cores when the individual work units are small. Remote
+     * workers are not affected. The default value of 1 disables this
+     * mode. Should be called before \ref start().
+     */
+    inline void setLocalBatchSize(size_t batchSize) { m_localBatchSize = batchSize; }
+
+    /// Return the number of work units that local workers acquire at once
+    inline size_t getLocalBatchSize() const { return m_localBatchSize; }
+
+    /**
+     * \brief Set the share of the workers given to processes that
+     * are scheduled by the calling thread
+     *
+     * This applies to processes that don't specify a share of their own
+     * (see \ref ParallelProcess::getShare()) and is e.g. used by
+     * \ref RenderJob so that concurrently rendered scenes divide the
+     * workers according to their priorities. The default is 1.
+     */
+    static void setThreadShare(Float share);
+
+    /// Return the share given to processes scheduled by the calling thread
+    static Float getThreadShare();
+
     /// Initialize the scheduler of this process -- called once in main()
     static void staticInitialization();
 
@@ -487,6 +590,17 @@ public:
 public:
     // Public, but shouldn't be part of the documentation
     /// \cond
+    /**
+     * Prepared work processor of a worker that switched to another
+     * process, along with its work unit and result buffers
+     */
+    struct PooledItem {
+        int coreOffset;
+        ref<WorkProcessor> wp;
+        ref<WorkUnit> workUnit;
+        ref<WorkResult> workResult;
+    };
+
     struct ProcessRecord {
         /* Unique ID value assigned to this process */
         int id;
@@ -504,10 +618,21 @@ public:
         ref<WaitFlag> done;
         /* Log level for events associated with this process */
         ELogLevel logLevel;
+        /* Work units that were lost and must be handed out again */
+        std::deque<ref<WorkUnit> > reissued;
+        /* Idle work processors, units and results, for reuse when a worker
+           returns to this process */
+        std::vector<PooledItem> pool;
+        /* Memory needed by a node to process work units (or zero) */
+        size_t memory;
+        /* Relative share of the workers (see ParallelProcess::getShare()) */
+        Float share;
+        /* Work units handed out so far, divided by the share */
+        Float usage;
 
         inline ProcessRecord(int id, ELogLevel logLevel, Mutex *mutex)
          : id(id), inflight(0), morework(true), cancelled(false),
-            active(true), logLevel(logLevel) {
+            active(true), logLevel(logLevel), memory(0), share(1), usage(0) {
             cond = new ConditionVariable(mutex);
             done = new WaitFlag();
         }
@@ -529,9 +654,11 @@ public:
         ref<WorkUnit> workUnit;
         ref<WorkResult> workResult;
         bool stop;
+        /* Memory of the executing node (or zero if unlimited) */
+        size_t memoryLimit;
 
         inline Item() : id(-1), workerIndex(-1), coreOffset(-1),
-            proc(NULL), rec(NULL), stop(false) {
+            proc(NULL), rec(NULL), stop(false), memoryLimit(0) {
         }
 
         std::string toString() const;
@@ -540,6 +667,7 @@ public:
     struct ResourceRecord {
         std::vector<SerializableObject *> resources;
         ref<MemoryStream> stream;
+        std::string hash;
         int refCount;
         bool multi;
 
@@ -570,6 +698,12 @@ public:
     /// Return a resource in the form of a binary data stream
     const MemoryStream *getResourceStream(int id);
 
+    /**
+     * \brief Return the content hash of the data returned by
+     * \ref getResourceStream() (see \ref contentHash())
+     */
+    std::string getResourceHash(int id);
+
     /**
      * \brief Test whether this is a multi-resource,
      * i.e. different for every core.
@@ -588,13 +722,25 @@ protected:
      */
     EStatus acquireWork(Item &item, bool local, bool onlyTry, bool keepLock);
 
+    /**
+     * Acquire a batch of up to \c count work units belonging to the same
+     * parallel process using \ref ParallelProcess::generateWorkBatch()
+     * -- internally used by the different worker implementations. The
+     * first unit is stored in \c item, and the remaining ones are
+     * appended to \c units. Entries of \c spare are recycled when
+     * their type matches.
+     */
+    EStatus acquireWork(Item &item, bool local, bool onlyTry, bool keepLock,
+        size_t count, std::vector<ref<WorkUnit> > &units,
+        std::vector<ref<WorkUnit> > &spare);
+
     /// Release the main scheduler lock -- internally used by the remote worker
     inline void releaseLock() { m_mutex->unlock(); }
 
     inline void releaseWork(Item &item) {
         ProcessRecord *rec = item.rec;
         try {
-            item.proc->processResult(item.workResult, item.stop);
+            item.proc->processUnitResult(item.workUnit, item.workResult, item.stop);
         } catch (const std::exception &ex) {
             Log(EWarn, "Caught an exception - canceling process %i: %s",
                 item.id, ex.what());
@@ -604,10 +750,21 @@ protected:
         LockGuard lock(m_mutex);
         --rec->inflight;
         rec->cond->signal();
-        if (rec->inflight == 0 && !rec->morework && !item.stop)
+        if (rec->inflight == 0 && !rec->morework && !item.stop
+                && rec->reissued.empty())
             signalProcessTermination(item.proc, item.rec);
     }
 
+    /**
+     * \brief Hand out an in-flight work unit again, e.g. because the
+     * connection to the remote worker processing it was lost
+     *
+     * The unit is given to the next worker that requests work from the
+     * process (before any newly generated units). If the process was
+     * cancelled or no longer exists, the unit is simply discarded.
+     */
+    void reissueWork(int id, WorkUnit *unit);
+
     /**
      * Cancel the execution of a parallelizable process. Upon
      * return, no more work from this process is running. When
@@ -622,13 +779,39 @@ protected:
      */
     inline void setProcessByID(Item &item, int id) {
         LockGuard lock(m_mutex);
-        ParallelProcess *proc = m_idToProcess[id];
-        if (proc == NULL) {
+        std::map<int, ParallelProcess *>::iterator it = m_idToProcess.find(id);
+        if (it == m_idToProcess.end() || it->second == NULL)
             Log(EError, "Process %i is not locally known!", id);
-        };
+        ParallelProcess *proc = it->second;
+
+        /* Park the buffers of the previous process in case this worker
+           returns to it (e.g. when several jobs are interleaved) */
+        std::map<int, ParallelProcess *>::iterator prev = m_idToProcess.find(item.id);
+        if (prev != m_idToProcess.end() && item.wp.get() && item.id != id) {
+            PooledItem pooled;
+            pooled.coreOffset = item.coreOffset;
+            pooled.wp = item.wp;
+            pooled.workUnit = item.workUnit;
+            pooled.workResult = item.workResult;
+            m_processes[prev->second]->pool.push_back(pooled);
+        }
+
         item.proc = proc;
         item.id = id;
         item.rec = m_processes[proc];
+
+        /* Work processors are bound to the multi-resources of a core */
+        std::vector<PooledItem> &pool = item.rec->pool;
+        for (size_t i=0; i<pool.size(); ++i) {
+            if (pool[i].coreOffset != item.coreOffset)
+                continue;
+            item.wp = pool[i].wp;
+            item.workUnit = pool[i].workUnit;
+            item.workResult = pool[i].workResult;
+            pool.erase(pool.begin() + i);
+            return;
+        }
+
         item.wp = proc->createWorkProcessor();
         const ParallelProcess::ResourceBindings &bindings = item.proc->getResourceBindings();
         for (ParallelProcess::ResourceBindings::const_iterator it = bindings.begin();
@@ -645,6 +828,20 @@ protected:
 
     /// Announces the termination of a process
     void signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec);
+
+    /**
+     * Return the queue entry with the lowest usage (relative to its share)
+     * among those whose memory footprint fits the node executing \c item
+     * (or <tt>queue.end()</tt>)
+     */
+    std::deque<int>::iterator findWork(std::deque<int> &queue, const Item &item);
+
+    /**
+     * Make a process that enters the queue start out with the lowest usage
+     * among the queued ones, so that it neither monopolizes the workers
+     * nor has to wait until the others have caught up
+     */
+    void resetUsage(ProcessRecord *rec);
 private:
     /// Global scheduler instance
     static ref<Scheduler> m_scheduler;
@@ -663,6 +860,7 @@ private:
     /// List of all active workers
     std::vector<Worker *> m_workers;
     int m_resourceCounter, m_processCounter;
+    size_t m_localBatchSize;
     bool m_running;
 };
 
@@ -677,6 +875,11 @@ public:
     inline size_t getCoreCount() const { return m_coreCount; }
     /// Is this a remote worker?
     inline bool isRemoteWorker() const { return m_isRemote; };
+    /**
+     * \brief Return the memory (in bytes) of the machine executing the
+     * work units, or zero for local workers, which are not limited
+     */
+    inline size_t getMemoryLimit() const { return m_schedItem.memoryLimit; }
 
     MTS_DECLARE_CLASS()
 protected:
@@ -720,6 +923,14 @@ protected:
         return m_scheduler->acquireWork(m_schedItem, local, onlyTry, keepLock);
     }
 
+    /// Acquire a batch of work units from the same process
+    inline Scheduler::EStatus acquireWork(bool local, bool onlyTry,
+            bool keepLock, size_t count, std::vector<ref<WorkUnit> > &units,
+            std::vector<ref<WorkUnit> > &spare) {
+        return m_scheduler->acquireWork(m_schedItem, local, onlyTry,
+            keepLock, count, units, spare);
+    }
+
     void releaseSchedulerLock() {
         return m_scheduler->releaseLock();
     }
@@ -729,6 +940,11 @@ protected:
         m_scheduler->releaseWork(item);
     }
 
+    /// Hand out a work unit that could not be processed to another worker
+    inline void reissueWork(int id, WorkUnit *unit) {
+        m_scheduler->reissueWork(id, unit);
+    }
+
     /// Initialize the m_schedItem data structure when only the process ID is known
     void setProcessByID(Scheduler::Item &item, int id) {
         return m_scheduler->setProcessByID(item, id);
@@ -742,6 +958,11 @@ protected:
     inline void cancel(bool reduceInflight) {
         m_scheduler->cancel(m_schedItem.proc, reduceInflight);
     }
+
+    /// Cancel the specified parallel process
+    inline void cancel(ParallelProcess *proc, bool reduceInflight) {
+        m_scheduler->cancel(proc, reduceInflight);
+    }
 protected:
     Scheduler *m_scheduler;
     Scheduler::Item m_schedItem;
@@ -778,13 +999,42 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    /// A prefetched work unit waiting to be processed (work stealing mode)
+    struct QueuedUnit {
+        int id;
+        ParallelProcess *proc;
+        Scheduler::ProcessRecord *rec;
+        ref<WorkUnit> workUnit;
+    };
+
     /// Virtual destructor
     virtual ~LocalWorker();
     /* Worker implementation */
     virtual void run();
+    virtual void clear();
+    virtual void start(Scheduler *scheduler,
+        int workerIndex, int coreOffset);
     virtual void signalResourceExpiration(int id);
     virtual void signalProcessCancellation(int id);
     virtual void signalProcessTermination(int id);
+
+    /**
+     * \brief Fetch the next work unit in work stealing mode
+     *
+     * Tries the private queue first, then the scheduler, then the
+     * queues of the other local workers. Blocks when no work can be
+     * found in any of these places. Returns \c false if the
+     * scheduler is shutting down.
+     */
+    bool acquireQueuedWork(size_t batchSize);
+
+    /// Try to steal a prefetched work unit from another local worker
+    bool steal(QueuedUnit &unit);
+protected:
+    ref<Mutex> m_queueMutex;
+    std::deque<QueuedUnit> m_queue;
+    std::vector<ref<WorkUnit> > m_spareUnits;
+    std::vector<LocalWorker *> m_peers;
 };
 
 /**
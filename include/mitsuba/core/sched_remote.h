@@ -21,20 +21,35 @@
 #define __MITSUBA_CORE_SCHED_REMOTE_H_
 
 #include <mitsuba/core/sched.h>
+#include <mitsuba/core/rescache.h>
+#include <mitsuba/core/timer.h>
 #include <set>
 
 /// Default port of <tt>mtssrv</tt>
 #define MTS_DEFAULT_PORT 7554
 
 /** How many work units should be sent to a remote worker
-   at a time? This is a multiple of the worker's core count */
+   at a time? This is a multiple of the worker's core count. It
+   is used until the throughput of the node has been measured,
+   after which the backlog adapts to the latency of the link */
 #define MTS_BACKLOG_FACTOR 3
 
 /** Once the back log factor drops below this value (also a
    multiple of the core size), the stream processor will
-   continue sending batches of work units */
+   continue sending batches of work units. With an adaptive
+   backlog, the same ratio of the backlog is used */
 #define MTS_CONTINUE_FACTOR 2
 
+/// Upper limit of the adaptive backlog (a multiple of the core count)
+#define MTS_MAX_BACKLOG_FACTOR 16
+
+/// Number of results after which the adaptive backlog is used
+#define MTS_ADAPTIVE_BACKLOG_RESULTS 8
+
+/** Resources are sent to remote workers in chunks of
+   this size (in bytes), which are compressed separately */
+#define MTS_RESOURCE_CHUNK_SIZE (4*1024*1024)
+
 MTS_NAMESPACE_BEGIN
 
 class RemoteWorkerReader;
@@ -53,12 +68,72 @@ public:
     /**
      * \brief Construct a new remote worker with the given name and
      * communication stream
+     *
+     * \param relayHosts
+     *    Optional semicolon-separated list of further <tt>mtssrv</tt>
+     *    instances (of the form <tt>host[:port]</tt>), which the remote
+     *    node should connect to and forward resources and work to. This
+     *    is used to distribute the data along a tree -- see
+     *    \ref partitionBroadcastTree().
+     * \param fanout
+     *    Maximum number of direct connections that each node of the
+     *    tree establishes to the relay hosts
+     */
+    RemoteWorker(const std::string &name, Stream *stream,
+        const std::string &relayHosts = "", int fanout = 0);
+
+    /**
+     * \brief Distribute a list of hosts along a tree with the given fanout
+     *
+     * Returns at most \c fanout lists. The first entry of each list is a
+     * host that should be connected to directly, and the remaining ones
+     * are the hosts that it should relay to. Since every node sends the
+     * resources to at most \c fanout others, the time needed to distribute
+     * them grows logarithmically with the number of hosts. A \c fanout
+     * of zero or less connects to all hosts directly.
      */
-    RemoteWorker(const std::string &name, Stream *stream);
+    static std::vector<std::vector<std::string> > partitionBroadcastTree(
+        const std::vector<std::string> &hosts, int fanout);
+
+    /**
+     * \brief Open a direct connection to a <tt>mtssrv</tt> instance
+     * given in the form <tt>host[:port]</tt>
+     */
+    static ref<Stream> connect(const std::string &host);
 
     /// Return the name of the node on the other side
     inline const std::string &getNodeName() const { return m_nodeName; }
 
+    /**
+     * \brief Set the ZLIB compression level used when sending
+     * resources to the remote node
+     *
+     * \c 0 disables compression, and \c 9 compresses best. The default
+     * is \c 1, which is fast enough to keep up with gigabit networks.
+     */
+    inline void setCompressionLevel(int level) { m_compressionLevel = level; }
+
+    /// Return the ZLIB compression level used when sending resources
+    inline int getCompressionLevel() const { return m_compressionLevel; }
+
+    /// Return the measured round trip time of the connection (in seconds)
+    inline Float getLatency() const { return m_latency; }
+
+    /**
+     * \brief Return the number of work units that are currently
+     * kept in flight
+     *
+     * Enough work units are sent to keep all remote cores busy during
+     * one round trip of the connection, given the rate at which the node
+     * has been returning results so far. This avoids starving nodes behind
+     * slow links, while nodes on a fast network do not hoard work units
+     * that other nodes could process at the end of a job.
+     */
+    size_t getBacklog() const;
+
+    /// Is the connection to the remote node still working?
+    inline bool isConnected() const { return m_connected; }
+
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
@@ -72,17 +147,78 @@ protected:
     virtual void start(Scheduler *scheduler, int workerIndex, int coreOffset);
     void flush();
 
-    inline void signalCompletion() {
-        LockGuard lock(m_mutex);
-        m_inFlight--;
-        m_finishCond->signal();
-    }
+    /// Hand out work units to the remote node until the scheduler stops
+    void runLoop();
+
+    /**
+     * \brief Send a serialized resource in chunks of
+     * \ref MTS_RESOURCE_CHUNK_SIZE bytes
+     *
+     * The chunks are written directly to the stream so that large
+     * resources are never copied into the message buffer. The worker
+     * lock (held by \c lock) is released during the transfer, and
+     * control messages of other threads (e.g. cancellations or the
+     * completion of work units) are sent between two chunks instead
+     * of waiting for the whole resource.
+     */
+    void sendResource(UniqueLock &lock, short type, int resID, const MemoryStream *data);
+
+    /// Return the number of work units that should be acquired in one go
+    size_t getBatchSize();
+
+    /**
+     * \brief Called by the reader thread when the result of the
+     * work unit with the given sequence number has arrived
+     *
+     * \return The time in seconds since the unit was sent
+     */
+    Float signalCompletion(int sequence);
+
+    /**
+     * \brief Mark the connection as lost and hand out all work units
+     * that were sent to the node again, through other workers
+     */
+    void handleConnectionLoss(const std::string &reason);
+
+    /// Return an unused work unit of the current process
+    ref<WorkUnit> getSpareWorkUnit();
 protected:
+    /// A work unit that was sent to the remote node
+    struct OutstandingUnit {
+        int id;
+        ref<WorkUnit> workUnit;
+        /* Value of \c m_timer when the unit was sent */
+        Float sent;
+
+        inline OutstandingUnit() : id(-1), sent(0) { }
+        inline OutstandingUnit(int id, WorkUnit *workUnit, Float sent)
+            : id(id), workUnit(workUnit), sent(sent) { }
+    };
+
     ref<Mutex> m_mutex;
     ref<ConditionVariable> m_finishCond;
     ref<MemoryStream> m_memStream;
+    ref<MemoryStream> m_chunkStream;
+    ref<MemoryStream> m_headerStream;
+    /* Serializes writes to the stream. Must be acquired after \c m_mutex */
+    ref<Mutex> m_sendMutex;
+    /* Process whose resources are currently being sent (or -1) */
+    int m_uploading;
     ref<Stream> m_stream;
     ref<RemoteWorkerReader> m_reader;
+    int m_compressionLevel;
+
+    /* Measurements for the adaptive backlog */
+    ref<Timer> m_timer;
+    Float m_latency;
+    Float m_unitTime;
+    Float m_lastCompletion;
+    size_t m_resultCount;
+
+    /* Resource cache handshake with the remote node */
+    bool m_remoteCache;
+    bool m_queryPending;
+    std::set<int> m_cachedResources;
 
     /* List of processes and resources that are
        currently active at the remote node */
@@ -91,6 +227,14 @@ protected:
     std::set<std::string> m_plugins;
     std::string m_nodeName;
     size_t m_inFlight;
+    std::vector<ref<WorkUnit> > m_spareUnits;
+
+    /* Work units that have not been returned by the remote node yet
+       (indexed by sequence number) and ones that can be reused */
+    std::map<int, OutstandingUnit> m_outstanding;
+    std::vector<ref<WorkUnit> > m_returnedUnits;
+    int m_sequence;
+    bool m_connected;
 };
 
 /**
@@ -143,6 +287,8 @@ public:
     EStatus generateWork(WorkUnit *unit, int worker);
     void processResult(const WorkResult *result,
         bool cancelled);
+    void processUnitResult(const WorkUnit *unit,
+        const WorkResult *result, bool cancelled);
     ref<WorkProcessor> createWorkProcessor() const;
     void handleCancellation();
 
@@ -160,10 +306,17 @@ public:
         return wu;
     }
 
-    /// Make a full work unit available to the process
-    inline void putFullWorkUnit(WorkUnit *wu) {
+    /**
+     * \brief Make a full work unit available to the process
+     *
+     * \param sequence
+     *     Sequence number assigned by the client, which is sent back
+     *     along with the result
+     */
+    inline void putFullWorkUnit(WorkUnit *wu, int sequence) {
         LockGuard lock(m_mutex);
         m_full.push_back(wu);
+        m_fullSequence.push_back(sequence);
     }
 
     /// Mark the process as finished
@@ -181,6 +334,8 @@ private:
     ref<StreamBackend> m_backend;
     std::vector<WorkUnit *> m_empty;
     std::deque<WorkUnit *> m_full;
+    std::deque<int> m_fullSequence;
+    std::map<const WorkUnit *, int> m_activeSequence;
     ref<WorkProcessor> m_wp;
     ref<Mutex> m_mutex;
     bool m_done;
@@ -216,6 +371,28 @@ public:
     StreamBackend(const std::string &name, Scheduler *scheduler,
         const std::string &nodeName, Stream *stream, bool detach);
 
+    /**
+     * \brief Keep the received resources in a persistent cache
+     *
+     * Before sending a resource, the client then checks whether this
+     * node already has a copy with the same content hash, in which case
+     * the transfer is skipped. The cache can be shared by several
+     * backends. This must be called before \ref start().
+     */
+    inline void setResourceCache(ResourceCache *cache) { m_cache = cache; }
+
+    /**
+     * \brief Set the amount of memory (in bytes) announced to the client
+     *
+     * The client only sends work of processes whose memory footprint
+     * fits into this limit. Defaults to the physical memory of the
+     * machine, and must be called before \ref start().
+     */
+    inline void setMemoryLimit(size_t limit) { m_memoryLimit = limit; }
+
+    /// Return the amount of memory announced to the client
+    inline size_t getMemoryLimit() const { return m_memoryLimit; }
+
     MTS_DECLARE_CLASS()
 protected:
     enum EMessage {
@@ -231,6 +408,10 @@ protected:
         EProcessCancelled,
         EEnsurePluginLoaded,
         EResourceExpired,
+        EResourceQuery,
+        EResourceStatus,
+        EPing,
+        EPong,
         EQuit,
         EIncompatible,
         EHello = 0x1bcd
@@ -239,8 +420,11 @@ protected:
     /// Virtual destructor
     virtual ~StreamBackend();
     virtual void run();
-    void sendWorkResult(int id, const WorkResult *result, bool cancelled);
-    void sendCancellation(int id, int numLost);
+    void sendWorkResult(int id, int sequence, const WorkResult *result, bool cancelled);
+    void sendCancellation(int id, const std::deque<int> &lost);
+
+    /// Connect to the given relay hosts and add them to the scheduler
+    void connectRelays(const std::vector<std::string> &hosts, int fanout);
 private:
     Scheduler *m_scheduler;
     std::string m_nodeName;
@@ -248,7 +432,13 @@ private:
     ref<MemoryStream> m_memStream;
     std::map<int, RemoteProcess *> m_processes;
     std::map<int, int> m_resources;
+    std::map<int, ref<MemoryStream> > m_partialResources;
+    std::map<int, std::string> m_resourceHashes;
+    ref<ResourceCache> m_cache;
+    std::vector<ref<RemoteWorker> > m_relays;
+    ref<MemoryStream> m_chunkStream;
     ref<Mutex> m_sendMutex;
+    size_t m_memoryLimit;
     bool m_detach;
 };
 
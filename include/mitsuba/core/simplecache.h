@@ -93,6 +93,68 @@ public:
     }
 };
 
+/// Per-thread storage of \ref MultiCache
+template <typename ArgType, typename ReturnType, size_t Size> struct MultiCacheEntries {
+    ArgType arguments[Size];
+    ReturnType values[Size];
+    size_t count, next;
+
+    inline MultiCacheEntries() : count(0), next(0) { }
+};
+
+/**
+ * \brief Thread-local cache with a few entries for caching evaluations
+ * of expensive function calls
+ *
+ * This is a variant of \ref SimpleCache that remembers the last \c Size
+ * distinct arguments of every thread. It is useful when a thread
+ * alternates between a small set of arguments (e.g. a few discrete time
+ * values), which would constantly evict the entry of a \ref SimpleCache.
+ * Entries are looked up linearly and replaced in round-robin order.
+ *
+ * \tparam ArgType
+ *     Argument type of the function whose return values should be cached
+ *
+ * \tparam ReturnType
+ *     Return type of the function whose return values should be cached
+ *
+ * \tparam Size
+ *     Number of entries per thread
+ */
+template <typename ArgType, typename ReturnType, size_t Size> class MultiCache
+    : protected PrimitiveThreadLocal< MultiCacheEntries<ArgType, ReturnType, Size> > {
+protected:
+    typedef MultiCacheEntries<ArgType, ReturnType, Size> ValueType;
+    typedef PrimitiveThreadLocal<ValueType>              ParentType;
+public:
+    MultiCache() : ParentType() { }
+
+    /**
+     * \brief Return the cache entry for the argument \c argument
+     * or run \c UpdateFunctor to compute it
+     *
+     * The returned reference remains valid until \c Size other
+     * arguments have been evaluated by the calling thread.
+     */
+    template <typename UpdateFunctor> inline ReturnType &get(const UpdateFunctor &functor, const ArgType &argument) {
+        ValueType &entries = this->ParentType::get();
+
+        for (size_t i=0; i<entries.count; ++i) {
+            if (entries.arguments[i] == argument)
+                return entries.values[i];
+        }
+
+        size_t idx = entries.next;
+        entries.next = (idx + 1) % Size;
+        if (entries.count < Size)
+            ++entries.count;
+
+        entries.arguments[idx] = argument;
+        functor(entries.arguments[idx], entries.values[idx]);
+        return entries.values[idx];
+    }
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_CORE_CACHE_H_ */
@@ -21,6 +21,9 @@
 #define __MITSUBA_CORE_SPECTRUM_H_
 
 #include <mitsuba/mitsuba.h>
+#if defined(MTS_SSE)
+#include <mitsuba/core/ssemath.h>
+#endif
 
 #if !defined(SPECTRUM_SAMPLES)
 #error The desired number of spectral samples must be \
@@ -282,6 +285,146 @@ protected:
     std::vector<Float> m_wavelengths, m_values;
 };
 
+namespace detail {
+    /**
+     * \brief SIMD kernels used by the component-wise operations of \ref TSpectrum
+     *
+     * The generic version is disabled, in which case \ref TSpectrum uses
+     * plain loops. When compiled with SSE support, the specialization for
+     * single precision spectra with a multiple of four samples (e.g.
+     * <tt>SPECTRUM_SAMPLES=8</tt> or \c 16) processes four samples per
+     * instruction.
+     *
+     * Spectra are frequently stored inside of other data structures
+     * (e.g. the interleaved channels of an \ref ImageBlock), hence no
+     * alignment can be assumed and all memory accesses are unaligned.
+     */
+    template <typename T, int N> struct spectrum_sse {
+        enum { enabled = 0 };
+
+        static inline void add(T *, const T *, const T *) { }
+        static inline void sub(T *, const T *, const T *) { }
+        static inline void mul(T *, const T *, const T *) { }
+        static inline void div(T *, const T *, const T *) { }
+        static inline void mul(T *, const T *, T) { }
+        static inline void addWeighted(T *, T, const T *) { }
+        static inline void neg(T *, const T *) { }
+        static inline void abs(T *, const T *) { }
+        static inline void sqrt(T *, const T *) { }
+        static inline void exp(T *, const T *) { }
+        static inline void clampNegative(T *) { }
+        static inline T sum(const T *) { return 0; }
+        static inline T max(const T *) { return 0; }
+        static inline T min(const T *) { return 0; }
+        static inline bool isZero(const T *) { return false; }
+    };
+
+#if defined(MTS_SSE)
+    template <int N> struct spectrum_sse<float, N> {
+        enum { enabled = (N % 4 == 0) };
+
+        static inline void add(float *dst, const float *a, const float *b) {
+            for (int i=0; i<N; i += 4)
+                _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+
+        static inline void sub(float *dst, const float *a, const float *b) {
+            for (int i=0; i<N; i += 4)
+                _mm_storeu_ps(dst + i, _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+
+        static inline void mul(float *dst, const float *a, const float *b) {
+            for (int i=0; i<N; i += 4)
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+
+        static inline void div(float *dst, const float *a, const float *b) {
+            for (int i=0; i<N; i += 4)
+                _mm_storeu_ps(dst + i, _mm_div_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+
+        static inline void mul(float *dst, const float *a, float f) {
+            __m128 factor = _mm_set1_ps(f);
+            for (int i=0; i<N; i += 4)
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(a + i), factor));
+        }
+
+        static inline void addWeighted(float *dst, float weight, const float *a) {
+            __m128 factor = _mm_set1_ps(weight);
+            for (int i=0; i<N; i += 4)
+                _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+                    _mm_mul_ps(factor, _mm_loadu_ps(a + i))));
+        }
+
+        static inline void neg(float *dst, const float *a) {
+            for (int i=0; i<N; i += 4)
+                _mm_storeu_ps(dst + i, negate_ps(_mm_loadu_ps(a + i)));
+        }
+
+        static inline void abs(float *dst, const float *a) {
+            for (int i=0; i<N; i += 4)
+                _mm_storeu_ps(dst + i, _mm_andnot_ps(
+                    SSEConstants::negation_mask.ps, _mm_loadu_ps(a + i)));
+        }
+
+        static inline void sqrt(float *dst, const float *a) {
+            for (int i=0; i<N; i += 4)
+                _mm_storeu_ps(dst + i, _mm_sqrt_ps(_mm_loadu_ps(a + i)));
+        }
+
+        static inline void exp(float *dst, const float *a) {
+            for (int i=0; i<N; i += 4) {
+                __m128 x = _mm_loadu_ps(a + i);
+                __m128 result = math::exp_ps(x);
+
+                /* exp_ps() clamps its argument -- restore the
+                   behavior of the scalar version outside of
+                   the supported range and for NaNs */
+                result = mux_ps(_mm_cmplt_ps(x, _mm_set1_ps(-88.3762626647949f)),
+                    _mm_setzero_ps(), result);
+                result = mux_ps(_mm_cmpgt_ps(x, _mm_set1_ps(88.3762626647949f)),
+                    SSEConstants::p_inf.ps, result);
+                result = mux_ps(_mm_cmpunord_ps(x, x), x, result);
+                _mm_storeu_ps(dst + i, result);
+            }
+        }
+
+        static inline void clampNegative(float *dst) {
+            for (int i=0; i<N; i += 4)
+                _mm_storeu_ps(dst + i, _mm_max_ps(_mm_loadu_ps(dst + i), _mm_setzero_ps()));
+        }
+
+        static inline float sum(const float *a) {
+            __m128 result = _mm_loadu_ps(a);
+            for (int i=4; i<N; i += 4)
+                result = _mm_add_ps(result, _mm_loadu_ps(a + i));
+            return math::hsum_ps(result);
+        }
+
+        static inline float max(const float *a) {
+            __m128 result = _mm_loadu_ps(a);
+            for (int i=4; i<N; i += 4)
+                result = _mm_max_ps(result, _mm_loadu_ps(a + i));
+            return math::hmax_ps(result);
+        }
+
+        static inline float min(const float *a) {
+            __m128 result = _mm_loadu_ps(a);
+            for (int i=4; i<N; i += 4)
+                result = _mm_min_ps(result, _mm_loadu_ps(a + i));
+            return math::hmin_ps(result);
+        }
+
+        static inline bool isZero(const float *a) {
+            __m128 nonzero = _mm_setzero_ps();
+            for (int i=0; i<N; i += 4)
+                nonzero = _mm_or_ps(nonzero, _mm_cmpneq_ps(_mm_loadu_ps(a + i), _mm_setzero_ps()));
+            return _mm_movemask_ps(nonzero) == 0;
+        }
+    };
+#endif
+};
+
 /**
  * \brief Abstract spectral power distribution data type
  *
@@ -296,6 +439,9 @@ template <typename T, int N> struct TSpectrum {
 public:
     typedef T          Scalar;
 
+    /// SIMD kernels (only used if <tt>SSE::enabled</tt> is nonzero)
+    typedef detail::spectrum_sse<T, N> SSE;
+
     /// Number of dimensions
     const static int dim = N;
 
@@ -333,7 +479,12 @@ public:
 
     /// Add two spectral power distributions
     inline TSpectrum operator+(const TSpectrum &spec) const {
-        TSpectrum value = *this;
+        TSpectrum value;
+        if (SSE::enabled) {
+            SSE::add(value.s, s, spec.s);
+            return value;
+        }
+        value = *this;
         for (int i=0; i<N; i++)
             value.s[i] += spec.s[i];
         return value;
@@ -341,6 +492,10 @@ public:
 
     /// Add a spectral power distribution to this instance
     inline TSpectrum& operator+=(const TSpectrum &spec) {
+        if (SSE::enabled) {
+            SSE::add(s, s, spec.s);
+            return *this;
+        }
         for (int i=0; i<N; i++)
             s[i] += spec.s[i];
         return *this;
@@ -348,7 +503,12 @@ public:
 
     /// Subtract a spectral power distribution
     inline TSpectrum operator-(const TSpectrum &spec) const {
-        TSpectrum value = *this;
+        TSpectrum value;
+        if (SSE::enabled) {
+            SSE::sub(value.s, s, spec.s);
+            return value;
+        }
+        value = *this;
         for (int i=0; i<N; i++)
             value.s[i] -= spec.s[i];
         return value;
@@ -356,6 +516,10 @@ public:
 
     /// Subtract a spectral power distribution from this instance
     inline TSpectrum& operator-=(const TSpectrum &spec) {
+        if (SSE::enabled) {
+            SSE::sub(s, s, spec.s);
+            return *this;
+        }
         for (int i=0; i<N; i++)
             s[i] -= spec.s[i];
         return *this;
@@ -363,7 +527,12 @@ public:
 
     /// Multiply by a scalar
     inline TSpectrum operator*(Scalar f) const {
-        TSpectrum value = *this;
+        TSpectrum value;
+        if (SSE::enabled) {
+            SSE::mul(value.s, s, f);
+            return value;
+        }
+        value = *this;
         for (int i=0; i<N; i++)
             value.s[i] *= f;
         return value;
@@ -376,6 +545,10 @@ public:
 
     /// Multiply by a scalar
     inline TSpectrum& operator*=(Scalar f) {
+        if (SSE::enabled) {
+            SSE::mul(s, s, f);
+            return *this;
+        }
         for (int i=0; i<N; i++)
             s[i] *= f;
         return *this;
@@ -383,7 +556,12 @@ public:
 
     /// Perform a component-wise multiplication by another spectrum
     inline TSpectrum operator*(const TSpectrum &spec) const {
-        TSpectrum value = *this;
+        TSpectrum value;
+        if (SSE::enabled) {
+            SSE::mul(value.s, s, spec.s);
+            return value;
+        }
+        value = *this;
         for (int i=0; i<N; i++)
             value.s[i] *= spec.s[i];
         return value;
@@ -391,6 +569,10 @@ public:
 
     /// Perform a component-wise multiplication by another spectrum
     inline TSpectrum& operator*=(const TSpectrum &spec) {
+        if (SSE::enabled) {
+            SSE::mul(s, s, spec.s);
+            return *this;
+        }
         for (int i=0; i<N; i++)
             s[i] *= spec.s[i];
         return *this;
@@ -398,6 +580,10 @@ public:
 
     /// Perform a component-wise division by another spectrum
     inline TSpectrum& operator/=(const TSpectrum &spec) {
+        if (SSE::enabled) {
+            SSE::div(s, s, spec.s);
+            return *this;
+        }
         for (int i=0; i<N; i++)
             s[i] /= spec.s[i];
         return *this;
@@ -405,7 +591,12 @@ public:
 
     /// Perform a component-wise division by another spectrum
     inline TSpectrum operator/(const TSpectrum &spec) const {
-        TSpectrum value = *this;
+        TSpectrum value;
+        if (SSE::enabled) {
+            SSE::div(value.s, s, spec.s);
+            return value;
+        }
+        value = *this;
         for (int i=0; i<N; i++)
             value.s[i] /= spec.s[i];
         return value;
@@ -419,6 +610,10 @@ public:
             SLog(EWarn, "TSpectrum: Division by zero!");
 #endif
         Scalar recip = 1.0f / f;
+        if (SSE::enabled) {
+            SSE::mul(value.s, s, recip);
+            return value;
+        }
         for (int i=0; i<N; i++)
             value.s[i] *= recip;
         return value;
@@ -450,6 +645,10 @@ public:
             SLog(EWarn, "TTSpectrum: Division by zero!");
 #endif
         Scalar recip = 1.0f / f;
+        if (SSE::enabled) {
+            SSE::mul(s, s, recip);
+            return *this;
+        }
         for (int i=0; i<N; i++)
             s[i] *= recip;
         return *this;
@@ -473,12 +672,18 @@ public:
 
     /// Multiply-accumulate operation, adds \a weight * \a spec
     inline void addWeighted(Scalar weight, const TSpectrum &spec) {
+        if (SSE::enabled) {
+            SSE::addWeighted(s, weight, spec.s);
+            return;
+        }
         for (int i=0; i<N; i++)
             s[i] += weight * spec.s[i];
     }
 
     /// Return the average over all wavelengths
     inline Scalar average() const {
+        if (SSE::enabled)
+            return SSE::sum(s) * (1.0f / N);
         Scalar result = 0.0f;
         for (int i=0; i<N; i++)
             result += s[i];
@@ -488,6 +693,10 @@ public:
     /// Component-wise absolute value
     inline TSpectrum abs() const {
         TSpectrum value;
+        if (SSE::enabled) {
+            SSE::abs(value.s, s);
+            return value;
+        }
         for (int i=0; i<N; i++)
             value.s[i] = std::abs(s[i]);
         return value;
@@ -496,6 +705,10 @@ public:
     /// Component-wise square root
     inline TSpectrum sqrt() const {
         TSpectrum value;
+        if (SSE::enabled) {
+            SSE::sqrt(value.s, s);
+            return value;
+        }
         for (int i=0; i<N; i++)
             value.s[i] = std::sqrt(s[i]);
         return value;
@@ -520,6 +733,10 @@ public:
     /// Component-wise exponentation
     inline TSpectrum exp() const {
         TSpectrum value;
+        if (SSE::enabled) {
+            SSE::exp(value.s, s);
+            return value;
+        }
         for (int i=0; i<N; i++)
             value.s[i] = math::fastexp(s[i]);
         return value;
@@ -535,12 +752,18 @@ public:
 
     /// Clamp negative values
     inline void clampNegative() {
+        if (SSE::enabled) {
+            SSE::clampNegative(s);
+            return;
+        }
         for (int i=0; i<N; i++)
             s[i] = std::max((Scalar) 0.0f, s[i]);
     }
 
     /// Return the highest-valued spectral sample
     inline Scalar max() const {
+        if (SSE::enabled)
+            return SSE::max(s);
         Scalar result = s[0];
         for (int i=1; i<N; i++)
             result = std::max(result, s[i]);
@@ -549,6 +772,8 @@ public:
 
     /// Return the lowest-valued spectral sample
     inline Scalar min() const {
+        if (SSE::enabled)
+            return SSE::min(s);
         Scalar result = s[0];
         for (int i=1; i<N; i++)
             result = std::min(result, s[i]);
@@ -558,6 +783,10 @@ public:
     /// Negate
     inline TSpectrum operator-() const {
         TSpectrum value;
+        if (SSE::enabled) {
+            SSE::neg(value.s, s);
+            return value;
+        }
         for (int i=0; i<N; i++)
             value.s[i] = -s[i];
         return value;
@@ -575,6 +804,8 @@ public:
 
     /// Check if this spectrum is zero at all wavelengths
     inline bool isZero() const {
+        if (SSE::enabled)
+            return SSE::isZero(s);
         for (int i=0; i<N; i++) {
             if (s[i] != 0.0f)
                 return false;
@@ -58,6 +58,18 @@ MTS_NAMESPACE_BEGIN
 extern MTS_EXPORT_CORE Float evalCubicInterp1D(Float x, const Float *values,
         size_t size, Float min, Float max, bool extrapolate = false);
 
+/**
+ * \brief Evaluate a cubic spline interpolant of a uniformly sampled 1D function
+ * at \c count positions
+ *
+ * Batched version of the above function, which stores the interpolated values
+ * in \c result. The knot index of every query is computed directly from its
+ * position, and four queries are processed at a time when SSE is available.
+ */
+extern MTS_EXPORT_CORE void evalCubicInterp1D(size_t count, const Float *x,
+        Float *result, const Float *values, size_t size, Float min, Float max,
+        bool extrapolate = false);
+
 /**
  * \brief Evaluate a cubic spline interpolant of a \a nonuniformly sampled 1D function
  *
@@ -213,6 +225,17 @@ extern MTS_EXPORT_CORE Float sampleCubicInterp1DN(size_t idx, const Float *nodes
 extern MTS_EXPORT_CORE Float evalCubicInterp2D(const Point2 &p, const Float *values,
         const Size2 &size, const Point2 &min, const Point2 &max, bool extrapolate = false);
 
+/**
+ * \brief Evaluate a cubic spline interpolant of a uniformly sampled 2D function
+ * at \c count positions
+ *
+ * Batched version of the above function, which stores the interpolated values
+ * in \c result.
+ */
+extern MTS_EXPORT_CORE void evalCubicInterp2D(size_t count, const Point2 *p,
+        Float *result, const Float *values, const Size2 &size, const Point2 &min,
+        const Point2 &max, bool extrapolate = false);
+
 /**
  * \brief Evaluate a cubic spline interpolant of a \a nonuniformly sampled 2D function
  *
@@ -273,6 +296,17 @@ extern MTS_EXPORT_CORE Float evalCubicInterp2DN(const Point2 &p, const Float **n
 extern MTS_EXPORT_CORE Float evalCubicInterp3D(const Point3 &p, const Float *values,
         const Size3 &size, const Point3 &min, const Point3 &max, bool extrapolate = false);
 
+/**
+ * \brief Evaluate a cubic spline interpolant of a uniformly sampled 3D function
+ * at \c count positions
+ *
+ * Batched version of the above function, which stores the interpolated values
+ * in \c result.
+ */
+extern MTS_EXPORT_CORE void evalCubicInterp3D(size_t count, const Point3 *p,
+        Float *result, const Float *values, const Size3 &size, const Point3 &min,
+        const Point3 &max, bool extrapolate = false);
+
 /**
  * \brief Evaluate a cubic spline interpolant of a \a nonuniformly sampled 3D function
  *
@@ -25,6 +25,10 @@
 
 //#define MTS_NO_STATISTICS 1
 
+/* Time the hot paths of the renderer (ray intersection, BSDF and emitter
+   sampling, etc.) using the processor's time stamp counter */
+//#define MTS_HOTPATH_TIMING 1
+
 #if defined(_MSC_VER)
 # include <intrin.h>
 #endif
@@ -43,14 +47,22 @@ MTS_NAMESPACE_BEGIN
  * \ref StatsCounter instance.
  *
  * This is needed for SMP/ccNUMA systems where different processors might
- * be contending for a cache line containing a counter. The solution used
- * here tries to ensure that every processor has  its own local counter.
+ * be contending for a cache line containing a counter. Every thread owns
+ * one of the counters (see \ref Thread::getStatisticsSlot()), which it
+ * updates without atomic operations. The values are only summed up when
+ * they are read.
  */
 #define NUM_COUNTERS       128   // Must be a power of 2
 
 /// Bitmask for \ref NUM_COUNTERS
 #define NUM_COUNTERS_MASK (NUM_COUNTERS-1)
 
+/**
+ * Index of the counter that is shared by all threads without a slot of
+ * their own, which is updated atomically
+ */
+#define MTS_SHARED_COUNTER (NUM_COUNTERS-1)
+
 /// Determines the multiples (e.g. 1000, 1024) and units of a \ref StatsCounter
 enum EStatsType {
     ENumberValue = 0, ///< Simple unitless number, e.g. # of rays
@@ -58,9 +70,31 @@ enum EStatsType {
     EPercentage,      ///< Percentage with respect to a base counter
     EMinimumValue,    ///< Minimum observed value of some quantity
     EMaximumValue,    ///< Maximum observed value of some quantity
-    EAverage          ///< Average value with respect to a base counter
+    EAverage,         ///< Average value with respect to a base counter
+    ECycleCount       ///< Processor cycles spent in a number of calls (the base counter)
 };
 
+/**
+ * \brief Read the time stamp counter of the processor
+ *
+ * The counter runs at a constant frequency on current processors,
+ * which \ref Statistics determines when reporting \ref ECycleCount
+ * counters. Other architectures fall back to a nanosecond clock.
+ */
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+inline uint64_t readCycleCounter() {
+    return (uint64_t) __rdtsc();
+}
+#elif defined(__i386__) || defined(__amd64__)
+inline uint64_t readCycleCounter() {
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t) hi << 32) | lo;
+}
+#else
+extern MTS_EXPORT_CORE uint64_t readCycleCounter();
+#endif
+
 #if (defined(_WIN32) && !defined(_WIN64)) || (defined(__POWERPC__) && !defined(_LP64))
 #define MTS_32BIT_COUNTERS 1
 #endif
@@ -113,18 +147,11 @@ public:
 #if defined(MTS_NO_STATISTICS)
         // do nothing
         return 0;
-#elif defined(_MSC_VER) && defined(_WIN64)
-        const int offset = Thread::getID() & NUM_COUNTERS_MASK;
-        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_value[offset].value), 1);
-        return m_value[offset].value;
-#elif defined(_MSC_VER) && defined(_WIN32)
-        const int offset = Thread::getID() & NUM_COUNTERS_MASK;
-        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_value[offset].value), 1);
-        return m_value[offset].value;
-#elif defined(__POWERPC__) && !defined(_LP64)
-        return (uint64_t) __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, 1);
 #else
-        return __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, 1);
+        const int slot = Thread::getStatisticsSlot();
+        if (EXPECT_TAKEN(slot != MTS_SHARED_COUNTER))
+            return m_value[slot].value++;
+        return addShared(m_value[slot], 1);
 #endif
     }
 
@@ -132,12 +159,12 @@ public:
     inline void operator+=(size_t amount) {
 #ifdef MTS_NO_STATISTICS
         /// do nothing
-#elif defined(_MSC_VER) && defined(_WIN64)
-        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
-#elif defined(_MSC_VER) && defined(_WIN32)
-        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
 #else
-        __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, amount);
+        const int slot = Thread::getStatisticsSlot();
+        if (EXPECT_TAKEN(slot != MTS_SHARED_COUNTER))
+            m_value[slot].value += amount;
+        else
+            addShared(m_value[slot], amount);
 #endif
     }
 
@@ -145,12 +172,12 @@ public:
     inline void incrementBase(size_t amount = 1) {
 #ifdef MTS_NO_STATISTICS
         /// do nothing
-#elif defined(_MSC_VER) && defined(_WIN64)
-        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
-#elif defined(_WIN32)
-        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
 #else
-        __sync_fetch_and_add(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value, amount);
+        const int slot = Thread::getStatisticsSlot();
+        if (EXPECT_TAKEN(slot != MTS_SHARED_COUNTER))
+            m_base[slot].value += amount;
+        else
+            addShared(m_base[slot], amount);
 #endif
     }
 
@@ -159,7 +186,7 @@ public:
      * an observation of the quantity whose minimum is to be determined
      */
     inline void recordMinimum(size_t value) {
-        int id = Thread::getID() & NUM_COUNTERS_MASK;
+        int id = Thread::getStatisticsSlot();
         #if MTS_32BIT_COUNTERS == 1
             volatile int32_t *ptr =
                 (volatile int32_t *) &m_value[id].value;
@@ -187,7 +214,7 @@ public:
      * an observation of the quantity whose maximum is to be determined
      */
     inline void recordMaximum(size_t value) {
-        int id = Thread::getID() & NUM_COUNTERS_MASK;
+        int id = Thread::getStatisticsSlot();
         #if MTS_32BIT_COUNTERS == 1
             volatile int32_t *ptr =
                 (volatile int32_t *) &m_value[id].value;
@@ -247,6 +274,22 @@ public:
     }
 #endif
 
+    /**
+     * \brief Return the part of the value that was accumulated by the
+     * calling thread
+     *
+     * This is exact only for threads that own an exclusive counter slot;
+     * otherwise, the result includes the contributions of all threads
+     * sharing the slot.
+     */
+#ifdef MTS_NO_STATISTICS
+    inline uint64_t getThreadValue() const { return 0L; }
+#else
+    inline uint64_t getThreadValue() const {
+        return m_value[Thread::getStatisticsSlot()].value;
+    }
+#endif
+
     /// Get the reference number (only used with the EPercentage/EAverage counter type)
 #ifdef MTS_NO_STATISTICS
     inline uint64_t getBase() const { return 0L; }
@@ -268,6 +311,19 @@ public:
 
     /// Sorting by name (for the statistics)
     bool operator<(const StatsCounter &v) const;
+private:
+    /// Atomically add to a counter (returns the previous value)
+    static inline uint64_t addShared(CacheLineCounter &counter, size_t amount) {
+#if defined(_MSC_VER) && defined(_WIN64)
+        return (uint64_t) _InterlockedExchangeAdd64(
+            reinterpret_cast<__int64 volatile *>(&counter.value), (__int64) amount);
+#elif defined(_MSC_VER) && defined(_WIN32)
+        return (uint64_t) _InterlockedExchangeAdd(
+            reinterpret_cast<long volatile *>(&counter.value), (long) amount);
+#else
+        return (uint64_t) __sync_fetch_and_add(&counter.value, amount);
+#endif
+    }
 private:
     std::string m_category;
     std::string m_name;
@@ -276,6 +332,26 @@ private:
     CacheLineCounter *m_base;
 };
 
+/**
+ * \brief Adds the processor cycles spent in its scope to a
+ * \ref ECycleCount counter and increments the call count
+ *
+ * \ingroup libcore
+ */
+class ScopedCycleTimer {
+public:
+    inline ScopedCycleTimer(StatsCounter &counter)
+        : m_counter(counter), m_start(readCycleCounter()) { }
+
+    inline ~ScopedCycleTimer() {
+        m_counter += (size_t) (readCycleCounter() - m_start);
+        m_counter.incrementBase();
+    }
+private:
+    StatsCounter &m_counter;
+    uint64_t m_start;
+};
+
 /** \brief General-purpose progress reporter
  *
  * This class is used to track the progress of various operations that might
@@ -325,13 +401,170 @@ private:
     char m_string[PROGRESS_MSG_SIZE];
     ref<Timer> m_timer;
     const void *m_ptr;
+    bool m_logged;
+};
+
+/// Subsystems whose memory usage is accounted for by \ref MemoryTracker
+enum EMemoryCategory {
+    /// kd-tree nodes and indices, including temporary construction buffers
+    EMemoryKDTree = 0,
+    /// Triangle mesh attributes (excluding memory-mapped files)
+    EMemoryMesh,
+    /// MIP map pyramids of bitmap textures (excluding cache files)
+    EMemoryMIPMap,
+    /// Photon maps and other point kd-trees
+    EMemoryPointKDTree,
+    /// Image blocks of films and render processes
+    EMemoryImageBlock,
+    /// Volume data sources (excluding memory-mapped files)
+    EMemoryVolume,
+
+    EMemoryCategoryCount
+};
+
+/** \brief Accounting of the large allocations made by various subsystems
+ *
+ * The tracked subsystems record their allocations along with an
+ * \ref EMemoryCategory. The current and peak usage of every category
+ * are part of \ref Statistics::getStats(). An optional memory budget
+ * turns allocations that would exceed it into an exception, so that a
+ * large scene fails with a clear message instead of being killed by the
+ * operating system. Untracked allocations don't count towards the budget.
+ *
+ * Most code should use \ref TrackedMemory rather than this class.
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE MemoryTracker {
+public:
+    /**
+     * \brief Record an allocation of \c size bytes
+     *
+     * Throws an exception when the allocation would exceed the budget
+     */
+    static void allocate(EMemoryCategory category, size_t size);
+
+    /// Record the release of \c size bytes
+    static void release(EMemoryCategory category, size_t size);
+
+    /// Return the current usage of a category in bytes
+    static size_t getUsage(EMemoryCategory category);
+
+    /// Return the peak usage of a category in bytes
+    static size_t getPeakUsage(EMemoryCategory category);
+
+    /// Return the current usage of all categories in bytes
+    static size_t getTotalUsage();
+
+    /// Return the peak usage of all categories in bytes
+    static size_t getPeakTotalUsage();
+
+    /// Return a human-readable name of a category
+    static const char *getCategoryName(EMemoryCategory category);
+
+    /// Set the memory budget in bytes (0 means unlimited, the default)
+    static void setBudget(size_t budget);
+
+    /// Return the memory budget in bytes (0 means unlimited)
+    static size_t getBudget();
+};
+
+/**
+ * \brief Memory of one object that is accounted for by \ref MemoryTracker
+ *
+ * The owner reports its current memory usage using \ref set(), which
+ * may throw if the budget is exceeded -- ideally before allocating.
+ * The usage is released when the instance is destroyed.
+ *
+ * \ingroup libcore
+ */
+template <EMemoryCategory Category> class TrackedMemory {
+public:
+    inline TrackedMemory() : m_size(0) { }
+
+    inline TrackedMemory(const TrackedMemory &other) : m_size(0) {
+        set(other.m_size);
+    }
+
+    inline ~TrackedMemory() {
+        if (m_size)
+            MemoryTracker::release(Category, m_size);
+    }
+
+    inline TrackedMemory &operator=(const TrackedMemory &other) {
+        set(other.m_size);
+        return *this;
+    }
+
+    /// Update the number of bytes used by the owner
+    inline void set(size_t size) {
+        if (size > m_size)
+            MemoryTracker::allocate(Category, size - m_size);
+        else if (size < m_size)
+            MemoryTracker::release(Category, m_size - size);
+        m_size = size;
+    }
+
+    /// Return the number of bytes used by the owner
+    inline size_t get() const { return m_size; }
+private:
+    size_t m_size;
+};
+
+/** \brief Measures the time spent in a named phase of the program
+ *
+ * A phase lasts from the construction of a \c ScopedPhase instance until
+ * its destruction. Phases started while another one is active on the same
+ * thread become its children, and phases with the same name below the
+ * same parent are merged, i.e. their times and invocation counts add up.
+ * Each phase also records by how much it increased the memory tracked by
+ * \ref MemoryTracker (the maximum over all invocations).
+ * The resulting timing tree is part of \ref Statistics::getStats() and can
+ * be exported using \ref Statistics::getPhaseTimingsJSON().
+ *
+ * Worker threads can attach their phases to the one of the thread that
+ * spawned them using \ref getCurrent() and \ref setCurrent().
+ *
+ * \code
+ * {
+ *     ScopedPhase phase("Build kd-tree");
+ *     ...
+ * }
+ * \endcode
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE ScopedPhase {
+public:
+    /// Opaque handle to a node of the timing tree
+    typedef void *Handle;
+
+    /// Start a phase below the current phase of the calling thread
+    ScopedPhase(const std::string &name);
+
+    /// Stop the phase and record its duration
+    ~ScopedPhase();
+
+    /// Return the current phase of the calling thread (or \c NULL)
+    static Handle getCurrent();
+
+    /// Set the current phase of the calling thread
+    static void setCurrent(Handle handle);
+private:
+    ScopedPhase(const ScopedPhase &);
+    ScopedPhase &operator=(const ScopedPhase &);
+private:
+    Handle m_node, m_parent;
+    ref<Timer> m_timer;
+    size_t m_memory;
 };
 
 /** \brief Collects various rendering statistics and presents them
  * in a human-readable form.
  *
- * \remark Only the \ref getInstance(), \ref getStats(), and
- * \ref printStats() functions are implemented in the Python bindings.
+ * \remark Only the \ref getInstance(), \ref getStats(), \ref getStatsJSON(),
+ * \ref getPhaseTimingsJSON(), \ref resetAll() and \ref printStats()
+ * functions are implemented in the Python bindings.
  *
  * \ingroup libcore
  * \ingroup libpython
@@ -347,15 +580,51 @@ public:
     /// Record that a plugin has been loaded
     void logPlugin(const std::string &pname, const std::string &descr);
 
+    /// Record that a \ref ProgressReporter finished after \c time seconds
+    void logProgress(const std::string &title, Float time);
+
+    /**
+     * \brief Record that a work unit of a parallel process was completed
+     *
+     * \param process
+     *    Name of the parallel process
+     * \param worker
+     *    Name of the machine that processed the unit
+     * \param time
+     *    Time in seconds between handing out the unit and receiving
+     *    its result
+     */
+    void logWorkUnit(const std::string &process,
+        const std::string &worker, Float time);
+
     /// Print a summary of gathered statistics
     void printStats();
 
     /// Return a string containing gathered statistics
     std::string getStats();
 
-    /// Reset all statistics counters
+    /**
+     * \brief Return the phase timings recorded by \ref ScopedPhase
+     * as a JSON array of nested <tt>{name, time, count, children}</tt>
+     * objects (times are given in seconds)
+     */
+    std::string getPhaseTimingsJSON();
+
+    /**
+     * \brief Return all gathered statistics as a JSON object
+     *
+     * Contains the counters, loaded plugins, phase timings, the duration
+     * of every \ref ProgressReporter, the work units that each machine
+     * processed per parallel process, and the peak memory usage.
+     */
+    std::string getStatsJSON();
+
+    /// Reset all statistics counters and phase timings
     void resetAll();
 
+    /// Return the frequency of \ref readCycleCounter() in Hz
+    double getCycleFrequency() const;
+
     /// Initialize the global statistics collector
     static void staticInitialization();
 
@@ -367,8 +636,25 @@ protected:
     /// Create a statistics instance
     Statistics();
     /// Virtual destructor
-    virtual ~Statistics() { }
+    virtual ~Statistics();
 private:
+    friend class ScopedPhase;
+    struct PhaseNode;
+
+    struct ProgressRecord {
+        size_t count;
+        double time;
+
+        inline ProgressRecord() : count(0), time(0) { }
+    };
+
+    struct WorkRecord {
+        size_t count;
+        double time, first, last;
+
+        inline WorkRecord() : count(0), time(0), first(0), last(0) { }
+    };
+
     struct compareCategory {
         bool operator()(const StatsCounter *c1, const StatsCounter *c2) {
             if (c1->getCategory() == c2->getCategory())
@@ -381,6 +667,12 @@ private:
     std::vector<const StatsCounter *> m_counters;
     std::vector<std::pair<std::string, std::string> > m_plugins;
     ref<Mutex> m_mutex;
+    PhaseNode *m_phases;
+    ref<Mutex> m_phaseMutex;
+    std::map<std::string, ProgressRecord> m_progress;
+    std::map<std::pair<std::string, std::string>, WorkRecord> m_work;
+    ref<Timer> m_timer;
+    uint64_t m_cycleStart;
 };
 
 MTS_NAMESPACE_END
@@ -451,7 +451,7 @@ public:
      *      The number of bytes to copy. When -1 is specified,
      *      copying proceeds until the end of the source stream.
      */
-    void copyTo(Stream *stream, int64_t numBytes = -1);
+    virtual void copyTo(Stream *stream, int64_t numBytes = -1);
 
     /**
      * \brief Read an element from the stream (uses partial template
@@ -94,6 +94,18 @@ public:
     /// Return the thread ID
     static int getID();
 
+    /**
+     * \brief Return the index of the \ref StatsCounter slot of the
+     * calling thread
+     *
+     * Every thread is assigned an exclusive slot when it starts or is
+     * registered, which is handed to a later thread once it exits.
+     * Threads that did not get one (because all slots are taken, or
+     * because they are not known to Mitsuba) receive the shared slot
+     * \ref MTS_SHARED_COUNTER, which must be updated atomically.
+     */
+    static int getStatisticsSlot();
+
     /// Return the name of this thread
     const std::string &getName() const;
 
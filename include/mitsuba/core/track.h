@@ -24,6 +24,9 @@
 #include <mitsuba/core/simplecache.h>
 #include <set>
 
+/// Number of evaluations of an \ref AnimatedTransform that are cached per thread
+#define MTS_TRACK_CACHE_SIZE 4
+
 MTS_NAMESPACE_BEGIN
 
 template <typename T> class AnimationTrack;
@@ -334,15 +337,29 @@ template<> inline void AnimationTrack<Quaternion>::serialize(Stream *stream, con
  */
 class MTS_EXPORT_CORE AnimatedTransform : public Object {
 private:
-    /// Internal functor used by \ref eval() and \ref SimpleCache
+    /// Decomposed transformation at one of the keyframes of the tracks
+    struct Keyframe {
+        Float time;
+        Vector translation;
+        Vector scale;
+        Quaternion rotation;
+    };
+
+    /// Internal functor used by \ref eval() and \ref MultiCache
     struct MTS_EXPORT_CORE TransformFunctor {
     public:
-        inline TransformFunctor(const std::vector<AbstractAnimationTrack *> &tracks)
-            : m_tracks(tracks) {}
+        inline TransformFunctor(const std::vector<AbstractAnimationTrack *> &tracks,
+                const std::vector<Keyframe> &keyframes)
+            : m_tracks(tracks), m_keyframes(keyframes) {}
 
         void operator()(const Float &time, Transform &trafo) const;
+
+        /// Evaluate the individual tracks at the given time
+        static void evalTracks(const std::vector<AbstractAnimationTrack *> &tracks,
+            Float time, Vector &translation, Vector &scale, Quaternion &rotation);
     private:
         const std::vector<AbstractAnimationTrack *> &m_tracks;
+        const std::vector<Keyframe> &m_keyframes;
     };
 public:
     /**
@@ -395,15 +412,16 @@ public:
     /**
      * \brief Compute the transformation for the specified time value
      *
-     * Note that the returned reference leads to a thread-local cache.
-     * This means that it will become invalidated at the next call
-     * to this function.
+     * Note that the returned reference leads to a thread-local cache,
+     * which holds the last \ref MTS_TRACK_CACHE_SIZE time values that
+     * were evaluated by the calling thread. This means that it will
+     * become invalidated by subsequent calls to this function.
      */
     inline const Transform &eval(Float t) const {
         if (EXPECT_TAKEN(m_tracks.size() == 0))
             return m_transform;
         else
-            return m_cache.get(TransformFunctor(m_tracks), t);
+            return m_cache.get(TransformFunctor(m_tracks, m_keyframes), t);
     }
 
     /// Is the animation static?
@@ -497,9 +515,21 @@ public:
 protected:
     /// Virtual destructor
     virtual ~AnimatedTransform();
+
+    /**
+     * \brief Precompute the decomposed transformation at the union of
+     * all keyframes of the tracks
+     *
+     * Within each segment of this table, all tracks are interpolated
+     * linearly (or along the same great arc in the case of rotations),
+     * hence \ref eval() only needs a single binary search and one
+     * interpolation step. The table is discarded when tracks are added.
+     */
+    void updateKeyframes();
 private:
     std::vector<AbstractAnimationTrack *> m_tracks;
-    mutable SimpleCache<Float, Transform> m_cache;
+    std::vector<Keyframe> m_keyframes;
+    mutable MultiCache<Float, Transform, MTS_TRACK_CACHE_SIZE> m_cache;
     Transform m_transform;
 };
 
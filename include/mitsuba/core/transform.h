@@ -313,6 +313,30 @@ public:
         return result;
     }
 
+    /**
+     * \brief Transform an array of points
+     *
+     * Equivalent to calling \ref operator()(const Point &, Point &) for
+     * every element, but processes the points in groups of four using
+     * SSE (when available) and splits large arrays across threads.
+     * The source and destination arrays may be identical.
+     *
+     * \remark This function is not available in the Python bindings
+     */
+    void transformPoints(const Point *src, Point *dest, size_t count) const;
+
+    /**
+     * \brief Transform an array of normals (using the inverse transpose)
+     *
+     * Like \ref transformPoints(), this is a batched version of
+     * \ref operator()(const Normal &, Normal &). When \c normalize
+     * is set to \c true, the transformed normals are also normalized.
+     *
+     * \remark This function is not available in the Python bindings
+     */
+    void transformNormals(const Normal *src, Normal *dest, size_t count,
+        bool normalize = false) const;
+
     /// Return the underlying matrix
     inline const Matrix4x4 &getMatrix() const { return m_transform; }
 
@@ -65,6 +65,16 @@ extern MTS_EXPORT_CORE std::string timeString(Float time, bool precise = false);
 /// Turn a memory size into a human-readable string
 extern MTS_EXPORT_CORE std::string memString(size_t size, bool precise = false);
 
+/**
+ * \brief Compute a 128 bit hash of a memory region and return it
+ * as a string of 32 hexadecimal digits
+ *
+ * This uses the MurmurHash3 function, which is fast but not suitable
+ * for cryptographic purposes. It is meant for identifying data by its
+ * content. The result depends on the byte order of the host.
+ */
+extern MTS_EXPORT_CORE std::string contentHash(const void *data, size_t size);
+
 /// Return a string representation of a list of objects
 template<class Iterator> std::string containerToString(const Iterator &start, const Iterator &end) {
     std::ostringstream oss;
@@ -112,12 +122,56 @@ extern std::string MTS_EXPORT_CORE lastErrorText();
 /// Determine the number of available CPU cores
 extern MTS_EXPORT_CORE int getCoreCount();
 
+/**
+ * \brief Return the NUMA node associated with each available CPU core
+ *
+ * Entry \c i refers to the <tt>i</tt>-th available core using the same
+ * indexing scheme as \ref Thread::setCoreAffinity(). On platforms or
+ * machines without NUMA information, all entries are set to zero.
+ */
+extern MTS_EXPORT_CORE std::vector<int> getCoreNUMANodes();
+
+/// Return the number of NUMA nodes of this machine (at least one)
+extern MTS_EXPORT_CORE int getNUMANodeCount();
+
+/**
+ * \brief Return an ordering of the available CPU cores that cycles
+ * through the NUMA nodes, so that any prefix of the list spreads
+ * evenly over all memory controllers
+ */
+extern MTS_EXPORT_CORE std::vector<int> getNUMAInterleavedCores();
+
+/**
+ * \brief Enable or disable interleaved placement of large, read-only
+ * scene data structures (kd-trees, mesh data) across NUMA nodes
+ *
+ * \sa interleaveMemory()
+ */
+extern MTS_EXPORT_CORE void setNUMAInterleaving(bool enabled);
+
+/// Is interleaved placement of scene data across NUMA nodes enabled?
+extern MTS_EXPORT_CORE bool getNUMAInterleaving();
+
+/**
+ * \brief Distribute the memory pages of the given region evenly
+ * across all NUMA nodes
+ *
+ * Pages that were already touched are migrated. Only whole pages within
+ * the region are affected. This is currently only implemented on Linux;
+ * on other platforms and on machines with a single NUMA node, the
+ * function does nothing and returns \c false.
+ */
+extern MTS_EXPORT_CORE bool interleaveMemory(void *ptr, size_t size);
+
 /// Return the host name of this machine
 extern MTS_EXPORT_CORE std::string getHostName();
 
 /// Return the process private memory usage in bytes
 extern MTS_EXPORT_CORE size_t getPrivateMemoryUsage();
 
+/// Return the peak resident memory usage of the process in bytes
+extern MTS_EXPORT_CORE size_t getPeakMemoryUsage();
+
 /// Returns the total amount of memory available to the OS
 extern MTS_EXPORT_CORE size_t getTotalSystemMemory();
 
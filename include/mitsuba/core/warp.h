@@ -121,6 +121,38 @@ namespace warp {
 
     //! @}
     // =============================================================
+
+    // =============================================================
+    //! @{ \name Batched warping techniques
+    //
+    // These are equivalent to calling the corresponding single-sample
+    // function for every entry of \c samples. When Mitsuba is compiled
+    // with SSE support, they process four samples at a time using the
+    // vectorized trigonometric functions of \c ssemath.h.
+    // =============================================================
+
+    /// Batched version of \ref squareToUniformSphere()
+    extern MTS_EXPORT_CORE void squareToUniformSphere(size_t count,
+        const Point2 *samples, Vector *result);
+
+    /// Batched version of \ref squareToUniformHemisphere()
+    extern MTS_EXPORT_CORE void squareToUniformHemisphere(size_t count,
+        const Point2 *samples, Vector *result);
+
+    /// Batched version of \ref squareToCosineHemisphere()
+    extern MTS_EXPORT_CORE void squareToCosineHemisphere(size_t count,
+        const Point2 *samples, Vector *result);
+
+    /// Batched version of \ref squareToUniformDisk()
+    extern MTS_EXPORT_CORE void squareToUniformDisk(size_t count,
+        const Point2 *samples, Point2 *result);
+
+    /// Batched version of \ref squareToUniformDiskConcentric()
+    extern MTS_EXPORT_CORE void squareToUniformDiskConcentric(size_t count,
+        const Point2 *samples, Point2 *result);
+
+    //! @}
+    // =============================================================
 };
 
 MTS_NAMESPACE_END
@@ -21,11 +21,15 @@
 #define __MITSUBA_CORE_ZSTREAM_H_
 
 #include <mitsuba/mitsuba.h>
+#include <mitsuba/core/mstream.h>
 #include <zlib.h>
 
 /// Buffer size used to communicate with zlib. The larger, the better.
 #define ZSTREAM_BUFSIZE 32768
 
+/// Uncompressed size of the blocks written by \ref ZStream::writeBlocks()
+#define ZSTREAM_BLOCKSIZE 1048576
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -68,6 +72,35 @@ public:
     //! @}
     // =============================================================
 
+    // =============================================================
+    //! @{ \name Block-parallel compression
+    // =============================================================
+
+    /**
+     * \brief Compress a memory region in independent blocks
+     *
+     * The data is split into blocks of \c blockSize bytes, which are
+     * compressed on several threads (similar to \c pigz). The target
+     * stream receives the number of blocks, the compressed and the
+     * uncompressed size of every block, followed by one zlib stream per
+     * block. Since every block can be decoded by itself, \ref readBlocks()
+     * also decompresses them in parallel.
+     */
+    static void writeBlocks(Stream *stream, const void *data, size_t size,
+        size_t blockSize = ZSTREAM_BLOCKSIZE, int level = Z_DEFAULT_COMPRESSION);
+
+    /**
+     * \brief Read and decompress data that was written using
+     * \ref writeBlocks()
+     *
+     * \return A memory stream (positioned at the beginning) that
+     * holds the decompressed data
+     */
+    static ref<MemoryStream> readBlocks(Stream *stream);
+
+    //! @}
+    // =============================================================
+
     // =============================================================
     //! @{ \name Implementation of the Stream interface
     // =============================================================
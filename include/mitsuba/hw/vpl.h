@@ -150,10 +150,34 @@ public:
 
     /// Reset the VPL counter
     inline void resetCounter() { m_vplIndex = 0; }
+
+    /**
+     * \brief Limit the number of GPU programs that are compiled
+     * by a single call to \ref drawAllGeometryForVPL()
+     *
+     * Compiling the programs of a scene with many different materials
+     * can take a long time. With a budget, materials whose program
+     * would exceed it are temporarily drawn using a placeholder, and are
+     * compiled by subsequent calls instead. A negative value (the default)
+     * disables the limit.
+     */
+    inline void setCompilationBudget(int budget) { m_compilationBudget = budget; }
+
+    /// Return the number of programs that may be compiled per pass
+    inline int getCompilationBudget() const { return m_compilationBudget; }
+
+    /// Return the number of programs compiled by the last pass
+    inline int getCompiledProgramCount() const { return m_compiledPrograms; }
+
+    /// Return the number of materials that were drawn using a placeholder in the last pass
+    inline int getDeferredProgramCount() const { return m_deferredPrograms; }
 protected:
     /// Virtual destructor
     virtual ~VPLShaderManager();
 
+    /// Bind the placeholder program used for unsupported materials
+    void bindUnsupported(const Matrix4x4 &instanceTransform);
+
     /**
      * \brief This helper class stores a reference to a \ref Shader and all
      * sub-shaders that are part of its evaluation
@@ -393,6 +417,8 @@ private:
     int m_shadowMapResolution;
     uint32_t m_vplIndex;
     Float m_clamping, m_alpha;
+    int m_compilationBudget;
+    int m_compiledPrograms, m_deferredPrograms;
 };
 
 MTS_NAMESPACE_END
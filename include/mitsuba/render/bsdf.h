@@ -440,6 +440,33 @@ public:
     virtual Float pdf(const BSDFSamplingRecord &bRec,
         EMeasure measure = ESolidAngle) const = 0;
 
+    /**
+     * \brief Evaluate the BSDF and the probability of sampling
+     * \c bRec.wo (given \c bRec.wi) in a single call
+     *
+     * This is equivalent to calling \ref eval() followed by \ref pdf()
+     * using the same arguments, which is what the default implementation
+     * does. BSDFs that perform expensive computations needed by both
+     * (e.g. texture lookups, microfacet distribution and Fresnel terms)
+     * override this method to do that work only once.
+     *
+     * \param bRec
+     *     A record with detailed information on the BSDF query
+     *
+     * \param pdf
+     *     Will record the value that \ref pdf() would return
+     *
+     * \param measure
+     *     Specifies the measure of the component (see \ref eval())
+     *
+     * \return The value that \ref eval() would return
+     *
+     * \remark From Python, this function is is called using the syntax
+     *         <tt>value, pdf = bsdf.evalWithPdf(bRec, measure)</tt>
+     */
+    virtual Spectrum evalWithPdf(const BSDFSamplingRecord &bRec,
+        Float &pdf, EMeasure measure = ESolidAngle) const;
+
     /**
      * \brief For transmissive BSDFs: return the material's
      * relative index of refraction
@@ -0,0 +1,270 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_BVH_H_)
+#define __MITSUBA_RENDER_BVH_H_
+
+#include <mitsuba/render/skdtree.h>
+
+/// Maximum depth of the 4-wide BVH (the build switches to median splits beyond this)
+#define MTS_BVH_MAXDEPTH 64
+
+/// Number of bins used to evaluate the surface area heuristic
+#define MTS_BVH_BINS 16
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief 4-wide bounding volume hierarchy for fast ray-shape intersections
+ *
+ * This is an alternative to \ref ShapeKDTree, which can be selected on a
+ * per-scene basis. Every primitive is referenced exactly once, hence the
+ * memory usage is predictable and usually much lower than that of the
+ * kd-tree on scenes with many large or overlapping triangles. The tree
+ * is constructed top-down using a binned surface area heuristic, where
+ * each node receives up to four children by repeatedly splitting the
+ * child with the largest surface area. Traversal tests a ray against all
+ * four child boxes at once using SSE (when available).
+ *
+ * Since the topology of the hierarchy does not depend on the exact
+ * primitive positions, it can be cheaply updated via \ref refit() when
+ * the geometry deforms without changing its connectivity.
+ *
+ * Triangles use the same "TriAccel" representation as \ref ShapeKDTree;
+ * it is stored in the order in which the leaves reference them.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER ShapeBVH : public Object {
+public:
+    typedef uint32_t IndexType;
+    typedef uint32_t SizeType;
+
+    /// BVH node with four children, stored in SoA layout
+    struct BVHNode {
+        /// Child bounding boxes (min x/y/z followed by max x/y/z)
+        float bounds[6][4];
+
+        /**
+         * \brief Per-child reference
+         *
+         * For interior children, this is the index of the child node.
+         * For leaves, this is the offset of the first primitive.
+         */
+        uint32_t child[4];
+
+        /// Primitive count of leaf children (zero for interior children)
+        uint32_t count[4];
+
+        /// Is the specified child a leaf?
+        inline bool isLeaf(int i) const { return count[i] != 0; }
+
+        /// Is the specified child slot unused?
+        inline bool isEmpty(int i) const { return count[i] == 0 && child[i] == EEmpty; }
+
+        /// Set the bounding box of a child
+        void setBounds(int i, const AABB &aabb);
+
+        /// Return the bounding box of a child
+        AABB getBounds(int i) const;
+
+        enum { EEmpty = 0xFFFFFFFFu };
+    } MM_ALIGN16;
+
+    // =============================================================
+    //! @{ \name Initialization and tree construction
+    // =============================================================
+
+    /// Create an empty BVH
+    ShapeBVH();
+
+    /// Add a shape to the BVH
+    void addShape(const Shape *shape);
+
+    /// Return the list of stored shapes
+    inline const std::vector<const Shape *> &getShapes() const { return m_shapes; }
+
+    /// Return the total number of low-level primitives
+    inline SizeType getPrimitiveCount() const {
+        return m_shapeMap[m_shapeMap.size()-1];
+    }
+
+    /// Return an axis-aligned bounding box containing all primitives
+    inline const AABB &getAABB() const { return m_aabb; }
+
+    /// Return the number of nodes of the hierarchy
+    inline SizeType getNodeCount() const { return m_nodeCount; }
+
+    /// Return whether or not the BVH has been built
+    inline bool isBuilt() const { return m_nodes != NULL; }
+
+    /// Set the maximum number of primitives in a leaf (default: 4)
+    inline void setLeafSize(SizeType leafSize) { m_leafSize = leafSize; }
+
+    /// Return the maximum number of primitives in a leaf
+    inline SizeType getLeafSize() const { return m_leafSize; }
+
+    /// Build the BVH (needs to be called before tracing any rays)
+    void build();
+
+    /**
+     * \brief Update the bounding boxes and the precomputed triangle data
+     * after the geometry has changed, while preserving the topology
+     *
+     * This is much faster than a rebuild, but the quality of the hierarchy
+     * degrades when the primitives move far from their original positions.
+     * The shapes must keep their number of primitives (e.g. a deformed
+     * mesh with the same connectivity).
+     */
+    void refit();
+
+    //! @}
+    // =============================================================
+
+    // =============================================================
+    //! @{ \name Ray tracing routines
+    // =============================================================
+
+    /**
+     * \brief Intersect a ray against all primitives stored in the BVH
+     * and return detailed intersection information
+     *
+     * \sa ShapeKDTree::rayIntersect()
+     */
+    bool rayIntersect(const Ray &ray, Intersection &its) const;
+
+    /**
+     * \brief Intersect a ray against all primitives stored in the BVH
+     * and return the traveled distance and intersected shape
+     *
+     * \sa ShapeKDTree::rayIntersect()
+     */
+    bool rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
+        Normal &n, Point2 &uv) const;
+
+    /**
+     * \brief Intersect a ray against all primitives stored in the BVH
+     * and defer the computation of the detailed intersection record
+     *
+     * \sa ShapeKDTree::rayIntersectDeferred()
+     */
+    bool rayIntersectDeferred(const Ray &ray, Float &t,
+        ConstShapePtr &shape, void *temp) const;
+
+    /**
+     * \brief Compute the detailed intersection record of a hit
+     * that was found by \ref rayIntersectDeferred()
+     *
+     * \sa ShapeKDTree::fillDeferredIntersectionRecord()
+     */
+    void fillDeferredIntersectionRecord(const Ray &ray,
+        const void *temp, Intersection &its) const;
+
+    /**
+     * \brief Test a ray for occlusion with respect to all primitives
+     *    stored in the BVH.
+     *
+     * \sa ShapeKDTree::rayIntersect()
+     */
+    bool rayIntersect(const Ray &ray) const;
+
+    //! @}
+    // =============================================================
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Temporarily holds some intersection information
+    struct IntersectionCache {
+        SizeType shapeIndex;
+        SizeType primIndex;
+        Float u, v;
+    };
+
+    /// Virtual destructor
+    virtual ~ShapeBVH();
+
+    /// Return the bounding box of a primitive
+    AABB getPrimitiveAABB(IndexType shapeIndex, IndexType primIndex) const;
+
+    /// Precompute the intersection data of a primitive
+    void loadPrimitive(IndexType idx, IndexType shapeIndex, IndexType primIndex);
+
+    /**
+     * \brief Traverse the hierarchy and find the closest intersection
+     * within the interval [mint, maxt] (or any, if \c shadowRay is set)
+     */
+    template <bool shadowRay> bool traverse(const Ray &ray,
+        Float mint, Float maxt, Float &t, void *temp) const;
+
+    /// Check whether a primitive is intersected by the given ray
+    FINLINE bool intersect(const Ray &ray, IndexType idx, Float mint,
+            Float maxt, Float &t, void *temp) const {
+        const TriAccel &ta = m_triAccel[idx];
+        IntersectionCache *cache = static_cast<IntersectionCache *>(temp);
+        if (EXPECT_TAKEN(ta.k != KNoTriangleFlag)) {
+            Float tempU, tempV, tempT;
+            if (ta.rayIntersect(ray, mint, maxt, tempU, tempV, tempT)) {
+                t = tempT;
+                cache->shapeIndex = ta.shapeIndex;
+                cache->primIndex = ta.primIndex;
+                cache->u = tempU;
+                cache->v = tempV;
+                return true;
+            }
+        } else {
+            const Shape *shape = m_shapes[ta.shapeIndex];
+            if (shape->rayIntersect(ray, mint, maxt, t,
+                    reinterpret_cast<uint8_t*>(temp) + 2*sizeof(IndexType))) {
+                cache->shapeIndex = ta.shapeIndex;
+                cache->primIndex = KNoTriangleFlag;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Check whether a primitive is intersected by the given shadow ray
+    FINLINE bool intersect(const Ray &ray, IndexType idx,
+            Float mint, Float maxt) const {
+        const TriAccel &ta = m_triAccel[idx];
+        if (EXPECT_TAKEN(ta.k != KNoTriangleFlag)) {
+            Float tempU, tempV, tempT;
+            return ta.rayIntersect(ray, mint, maxt, tempU, tempV, tempT);
+        } else {
+            return m_shapes[ta.shapeIndex]->rayIntersect(ray, mint, maxt);
+        }
+    }
+private:
+    std::vector<const Shape *> m_shapes;
+    std::vector<bool> m_triangleFlag;
+    std::vector<SizeType> m_shapeMap;
+    BVHNode *m_nodes;
+    TriAccel *m_triAccel;
+    SizeType m_nodeCount;
+    SizeType m_leafSize;
+    SizeType m_maxDepth;
+    AABB m_aabb;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_BVH_H_ */
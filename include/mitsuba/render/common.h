@@ -121,6 +121,15 @@ public:
      * a pointer to this object.
      */
     const ConfigurableObject *object;
+
+    /**
+     * \brief Optional: Index of the primitive on which the position lies
+     *
+     * Shapes consisting of several primitives (e.g. the triangles of a
+     * \ref TriMesh) use this attribute when the sampling density differs
+     * between primitives. It is set to <tt>(uint32_t) -1</tt> when unknown.
+     */
+    uint32_t primIndex;
 public:
     /// Create an invalid position sampling record
     inline PositionSamplingRecord() { }
@@ -134,7 +143,7 @@ public:
      *    position sample. This only matters when things are in motion
      */
     inline PositionSamplingRecord(Float time) : time(time),
-        uv(0.0f), object(NULL) { }
+        uv(0.0f), object(NULL), primIndex((uint32_t) -1) { }
 
     /**
      * \brief Create a position sampling record
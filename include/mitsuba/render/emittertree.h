@@ -0,0 +1,133 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_EMITTERTREE_H_)
+#define __MITSUBA_RENDER_EMITTERTREE_H_
+
+#include <mitsuba/core/pmf.h>
+#include <mitsuba/core/aabb.h>
+#include <mitsuba/render/emitter.h>
+#include <boost/unordered_map.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Bounding volume hierarchy over the emitters of a scene that is
+ * used to choose an emitter for direct illumination sampling
+ *
+ * Every node stores the bounding box, the total power and a cone bounding
+ * the emission directions of the emitters below it. Starting at the root,
+ * the sampling routine descends into each child with a probability that is
+ * proportional to a conservative estimate of the child's contribution to
+ * the reference point (and normal, if available). Emitters that are far
+ * away or face away from the reference point are thus chosen rarely, which
+ * greatly reduces variance in scenes with many emitters.
+ *
+ * Emitters without a finite position (environment and directional
+ * emitters) can't be bounded and are instead chosen proportionally to their
+ * sampling weight. The probability of choosing this group rather than the
+ * tree is given by the ratio of their sampling weights to the total.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER EmitterTree : public Object {
+public:
+    /// Build an emitter tree for the given list of emitters
+    EmitterTree(ref_vector<Emitter> &emitters);
+
+    /**
+     * \brief Choose an emitter for the given reference point
+     *
+     * \param p
+     *     Reference point in world space
+     * \param n
+     *     Surface normal at \c p or a zero vector (e.g. inside media)
+     * \param sample
+     *     A uniformly distributed number on [0,1], which is adjusted so
+     *     that it can be reused
+     * \param pdf
+     *     Returns the discrete probability of the chosen emitter
+     * \return
+     *     Index of the emitter in the list passed to the constructor
+     */
+    size_t sample(const Point &p, const Normal &n, Float &sample, Float &pdf) const;
+
+    /**
+     * \brief Return the discrete probability of choosing \c emitter
+     * at the given reference point in \ref sample()
+     */
+    Float pdf(const Point &p, const Normal &n, const Emitter *emitter) const;
+
+    /// Return the number of nodes in the tree
+    inline size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Return a human-readable string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~EmitterTree() { }
+private:
+    struct Node {
+        AABB aabb;
+        /// Axis of the cone of emitted surface normals
+        Vector axis;
+        /// Spread of the cone of normals
+        Float cosThetaO, sinThetaO;
+        /// Spread of the emission around each normal
+        Float cosThetaE;
+        Float power;
+        /// Right child (interior nodes) or emitter index (leaves)
+        uint32_t index;
+        uint32_t parent;
+        bool leaf;
+    };
+
+    struct Primitive;
+    struct BinPredicate;
+
+    /// Recursively build the subtree over <tt>[start, end)</tt>
+    uint32_t build(std::vector<Primitive> &prims, size_t start,
+        size_t end, uint32_t parent);
+
+    /// Conservative estimate of the contribution of a node
+    Float importance(const Node &node, const Point &p, const Normal &n) const;
+
+    /// Probability of entering the left child of an interior node
+    inline Float leftProbability(uint32_t node, const Point &p, const Normal &n) const {
+        /* The left child directly follows its parent */
+        Float il = importance(m_nodes[node + 1], p, n),
+              ir = importance(m_nodes[m_nodes[node].index], p, n);
+        if (il + ir <= 0)
+            return 0.5f;
+        return il / (il + ir);
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_leaves;
+    std::vector<uint32_t> m_infinite;
+    boost::unordered_map<const Emitter *, uint32_t> m_indices;
+    DiscreteDistribution m_infinitePDF;
+    Float m_infiniteProb;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_EMITTERTREE_H_ */
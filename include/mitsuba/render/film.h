@@ -22,6 +22,7 @@
 
 #include <mitsuba/render/sampler.h>
 #include <mitsuba/render/imageblock.h>
+#include <mitsuba/core/lock.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -91,12 +92,38 @@ public:
     /// Return whether or not this film records the alpha channel
     virtual bool hasAlpha() const = 0;
 
+    /**
+     * \brief Return whether or not this film records per-pixel
+     * variance statistics
+     *
+     * When this is the case, rendering processes attach a variance
+     * buffer (see \ref ImageBlock::allocateVariance()) to the image
+     * blocks passed to \ref put().
+     */
+    virtual bool hasVariance() const { return false; }
+
     /// Return the image reconstruction filter
     inline ReconstructionFilter *getReconstructionFilter() { return m_filter.get(); }
 
     /// Return the image reconstruction filter (const version)
     inline const ReconstructionFilter *getReconstructionFilter() const { return m_filter.get(); }
 
+    /**
+     * \brief Return the regions of the film that changed since the
+     * last call and forget about them
+     *
+     * Films record the extent of every block passed to \ref put(),
+     * including the border of the reconstruction filter. When the
+     * whole image changed (e.g. after \ref clear() or \ref setBitmap())
+     * or when too many regions are pending, a single region covering the
+     * crop window is returned instead. Like the arguments of
+     * \ref develop(), the offsets are relative to the crop window.
+     *
+     * This allows a user interface to only develop and display the
+     * parts of the image that were updated during rendering.
+     */
+    void takeDirtyRegions(std::vector<std::pair<Point2i, Vector2i> > &regions);
+
     // =============================================================
     //! @{ \name ConfigurableObject interface
     // =============================================================
@@ -126,11 +153,20 @@ protected:
 
     /// Virtual destructor
     virtual ~Film();
+
+    /// Record the region covered by an image block as changed (see \ref takeDirtyRegions())
+    void markDirty(const ImageBlock *block);
+
+    /// Record the whole film as changed (see \ref takeDirtyRegions())
+    void markDirty();
 protected:
     Point2i m_cropOffset;
     Vector2i m_size, m_cropSize;
     bool m_highQualityEdges;
     ref<ReconstructionFilter> m_filter;
+    ref<Mutex> m_dirtyMutex;
+    std::vector<std::pair<Point2i, Vector2i> > m_dirtyRegions;
+    bool m_dirtyAll;
 };
 
 MTS_NAMESPACE_END
@@ -0,0 +1,102 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_FOOTPRINT_H_)
+#define __MITSUBA_RENDER_FOOTPRINT_H_
+
+#include <mitsuba/core/stream.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Number of 64-bit words stored by an \ref ObjectFootprint
+#define MTS_FOOTPRINT_WORDS 4
+
+/// Number of bits that are set for every inserted object
+#define MTS_FOOTPRINT_HASHES 3
+
+/**
+ * \brief Compact Bloom filter over the IDs of scene objects
+ *
+ * This is used to record the shapes and BSDFs encountered by the paths of
+ * an image block (see \ref Scene::setFootprint() and \ref RenderRegionCache).
+ * Objects are identified by their ID in the scene description, so that
+ * footprints remain meaningful when the scene is loaded again. Membership
+ * queries may return false positives, but never false negatives.
+ *
+ * \ingroup librender
+ */
+struct MTS_EXPORT_RENDER ObjectFootprint {
+    uint64_t bits[MTS_FOOTPRINT_WORDS];
+
+    /// Create an empty footprint
+    inline ObjectFootprint() { clear(); }
+
+    /// Create the footprint of a single object with the given ID
+    explicit ObjectFootprint(const std::string &id);
+
+    /// Unserialize a footprint from a binary data stream
+    inline ObjectFootprint(Stream *stream) {
+        stream->readULongArray(bits, MTS_FOOTPRINT_WORDS);
+    }
+
+    /// Serialize the footprint to a binary data stream
+    inline void serialize(Stream *stream) const {
+        stream->writeULongArray(bits, MTS_FOOTPRINT_WORDS);
+    }
+
+    /// Remove all objects
+    inline void clear() {
+        for (int i=0; i<MTS_FOOTPRINT_WORDS; ++i)
+            bits[i] = 0;
+    }
+
+    /// Is the footprint empty?
+    inline bool isEmpty() const {
+        for (int i=0; i<MTS_FOOTPRINT_WORDS; ++i)
+            if (bits[i])
+                return false;
+        return true;
+    }
+
+    /// Insert an object with the given ID
+    inline void insert(const std::string &id) {
+        insert(ObjectFootprint(id));
+    }
+
+    /// Insert all objects of another footprint
+    inline void insert(const ObjectFootprint &other) {
+        for (int i=0; i<MTS_FOOTPRINT_WORDS; ++i)
+            bits[i] |= other.bits[i];
+    }
+
+    /// Does this footprint (possibly) contain all objects of \c other?
+    inline bool contains(const ObjectFootprint &other) const {
+        for (int i=0; i<MTS_FOOTPRINT_WORDS; ++i)
+            if ((bits[i] & other.bits[i]) != other.bits[i])
+                return false;
+        return true;
+    }
+
+    /// Return a string representation
+    std::string toString() const;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_FOOTPRINT_H_ */
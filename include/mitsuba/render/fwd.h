@@ -27,9 +27,11 @@ class BlockedRenderProcess;
 class BlockListener;
 class BSDF;
 struct BSDFSamplingRecord;
+struct DeferredIntersection;
 struct DirectionSamplingRecord;
 struct DirectSamplingRecord;
 class Emitter;
+class EmitterTree;
 class Film;
 class GatherPhotonProcess;
 class HemisphereSampler;
@@ -66,6 +68,9 @@ class RectangularWorkUnit;
 class RenderJob;
 class RenderListener;
 class RenderQueue;
+struct RenderRequest;
+class RenderService;
+class RenderServiceConnection;
 class SamplingIntegrator;
 class Sampler;
 class Sensor;
@@ -77,6 +82,8 @@ class SparseMipmap3D;
 class Spiral;
 class Subsurface;
 class Texture;
+class TextureTileCache;
+class TransmittanceCache;
 struct TriAccel;
 struct TriAccel4;
 class TriMesh;
@@ -22,6 +22,7 @@
 
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/statistics.h>
 #include <boost/static_assert.hpp>
 #include <stack>
 
@@ -29,6 +30,10 @@
 #include <malloc.h>
 #endif
 
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
+
 /// Activate lots of extra checks
 //#define MTS_KD_DEBUG 1
 
@@ -43,6 +48,12 @@
 #define MTS_KD_BLOCKSIZE_KD  (512*1024/sizeof(KDNode))
 #define MTS_KD_BLOCKSIZE_IDX (512*1024/sizeof(uint32_t))
 
+/**
+ * \brief Min-max binning and partitioning of nodes with at least this
+ * many primitives are distributed over all cores (parallel builds only)
+ */
+#define MTS_KD_PARALLEL_MINMAX_THRESHOLD 131072
+
 /**
  * \brief To avoid numerical issues, the size of the scene
  * bounding box is increased by this amount
@@ -92,8 +103,10 @@ public:
      */
     void cleanup() {
         for (std::vector<Chunk>::iterator it = m_chunks.begin();
-                it != m_chunks.end(); ++it)
+                it != m_chunks.end(); ++it) {
+            MemoryTracker::release(EMemoryKDTree, (*it).size);
             freeAligned((*it).start);
+        }
         m_chunks.clear();
     }
 
@@ -138,6 +151,7 @@ public:
             m_minAllocation);
 
         Chunk chunk;
+        MemoryTracker::allocate(EMemoryKDTree, allocSize);
         chunk.start = (uint8_t *) allocAligned(allocSize);
         chunk.cur = chunk.start + size;
         chunk.size = allocSize;
@@ -729,7 +743,7 @@ public:
      * \brief Create a new kd-tree instance initialized with
      * the default parameters.
      */
-    GenericKDTree() : m_indices(NULL) {
+    GenericKDTree() : m_indices(NULL), m_sahCost(0) {
         m_nodes = NULL;
         m_traversalCost = 15;
         m_queryCost = 20;
@@ -931,7 +945,74 @@ public:
     inline SizeType getExactPrimitiveThreshold() const {
         return m_exactPrimThreshold;
     }
+
+    /**
+     * \brief Return the SAH cost of the tree, as computed at the end of
+     * the last call to \ref buildInternal()
+     */
+    inline Float getSAHCost() const {
+        return m_sahCost;
+    }
 protected:
+    /// Temporary data used by \ref refitInternal()
+    struct RefitContext {
+        const std::vector<AABBType> &primAABBs;
+        std::vector<IndexType> indices;
+        Float heuristicCost, maxCost;
+
+        RefitContext(const std::vector<AABBType> &primAABBs, Float maxCost)
+            : primAABBs(primAABBs), heuristicCost(0), maxCost(maxCost) { }
+    };
+
+    /// Recursively re-insert primitives into the subtree rooted at \c node
+    void refitNode(RefitContext &ctx, KDNode *node, const AABBType &nodeAABB,
+            const std::vector<IndexType> &prims) {
+        Float quantity = TreeConstructionHeuristic::getQuantity(nodeAABB);
+
+        /* The cost only grows from here -- give up early? */
+        if (ctx.heuristicCost > ctx.maxCost)
+            return;
+
+        if (node->isLeaf()) {
+            node->initLeafNode((unsigned int) ctx.indices.size(),
+                (unsigned int) prims.size());
+            ctx.indices.insert(ctx.indices.end(), prims.begin(), prims.end());
+            ctx.heuristicCost += quantity * prims.size() * m_queryCost;
+            return;
+        }
+
+        ctx.heuristicCost += quantity * m_traversalCost;
+
+        int axis = node->getAxis();
+        Float split = node->getSplit();
+
+        /* The split plane may now lie outside of the node */
+        Float clampedSplit = std::min(std::max(split,
+            (Float) nodeAABB.min[axis]), (Float) nodeAABB.max[axis]);
+
+        for (int side=0; side<2; ++side) {
+            AABBType childAABB(nodeAABB);
+            if (side == 0)
+                childAABB.max[axis] = clampedSplit;
+            else
+                childAABB.min[axis] = clampedSplit;
+
+            std::vector<IndexType> childPrims;
+            for (size_t i=0; i<prims.size(); ++i) {
+                IndexType index = prims[i];
+                AABBType primAABB = m_clip ?
+                    cast()->getClippedAABB(index, nodeAABB) : ctx.primAABBs[index];
+                if (m_clip && !primAABB.isValid())
+                    continue;
+                if (side == 0 ? (primAABB.min[axis] <= split)
+                              : (primAABB.max[axis] >= split))
+                    childPrims.push_back(index);
+            }
+
+            refitNode(ctx, node->getLeft() + side, childAABB, childPrims);
+        }
+    }
+
     /**
      * \brief Once the tree has been constructed, it is rewritten into
      * a more convenient binary storage format.
@@ -972,6 +1053,7 @@ protected:
         if (primCount == 0) {
             KDLog(EWarn, "kd-tree contains no geometry!");
             // +1 shift is for alignment purposes (see KDNode::getSibling)
+            m_memory.set(sizeof(KDNode) * 2);
             m_nodes = static_cast<KDNode *>(allocAligned(sizeof(KDNode) * 2))+1;
             m_nodes[0].initLeafNode(0, 0);
             return;
@@ -996,6 +1078,23 @@ protected:
         ref<Timer> timer = new Timer();
         AABBType &aabb = m_aabb;
         aabb.reset();
+#if defined(MTS_OPENMP)
+        if (m_parallelBuild && primCount >= MTS_KD_PARALLEL_MINMAX_THRESHOLD) {
+            int threadCount = getCoreCount();
+            std::vector<AABBType> threadAABBs(threadCount);
+            #pragma omp parallel num_threads(threadCount)
+            {
+                AABBType &threadAABB = threadAABBs[omp_get_thread_num()];
+                #pragma omp for schedule(static)
+                for (int i=0; i<(int) primCount; ++i) {
+                    threadAABB.expandBy(cast()->getAABB((IndexType) i));
+                    indices[i] = (IndexType) i;
+                }
+            }
+            for (int i=0; i<threadCount; ++i)
+                aabb.expandBy(threadAABBs[i]);
+        } else
+#endif
         for (IndexType i=0; i<primCount; ++i) {
             aabb.expandBy(cast()->getAABB(i));
             indices[i] = i;
@@ -1110,6 +1209,8 @@ protected:
         m_indexCount = ctx.primIndexCount;
 
         // +1 shift is for alignment purposes (see KDNode::getSibling)
+        m_memory.set(sizeof(KDNode) * (m_nodeCount+1)
+            + sizeof(IndexType) * m_indexCount);
         m_nodes = static_cast<KDNode *> (allocAligned(
                 sizeof(KDNode) * (m_nodeCount+1)))+1;
         m_indices = new IndexType[m_indexCount];
@@ -1209,6 +1310,7 @@ protected:
         expLeavesVisited /= rootQuantity;
         expPrimitivesIntersected /= rootQuantity;
         heuristicCost /= rootQuantity;
+        m_sahCost = heuristicCost;
 
         /* Slightly enlarge the bounding box
            (necessary e.g. when the scene is planar) */
@@ -1262,6 +1364,101 @@ protected:
         #endif
     }
 
+    /**
+     * \brief Update the kd-tree after the primitives have moved
+     *
+     * This keeps all split planes of the current tree and re-inserts
+     * every primitive into the leaves that it now overlaps, which is
+     * much cheaper than \ref buildInternal(). The quality of the tree
+     * degrades as the geometry moves away from the configuration it was
+     * built for; compare the returned cost against \ref getSAHCost()
+     * to decide when to rebuild. The number of primitives must not
+     * change.
+     *
+     * To be called by the subclass.
+     *
+     * \param maxCost
+     *    The refit is aborted as soon as the SAH cost of the updated tree
+     *    is known to exceed this value. In this case, the tree is left in
+     *    an invalid state and must be rebuilt (see \ref clearInternal()).
+     *
+     * \return The SAH cost of the updated tree, or infinity if the
+     *    refit was aborted
+     */
+    Float refitInternal(Float maxCost = std::numeric_limits<Float>::infinity()) {
+        if (!isBuilt())
+            KDLog(EError, "The kd-tree has not been built yet!");
+
+        ref<Timer> timer = new Timer();
+        SizeType primCount = cast()->getPrimitiveCount();
+
+        std::vector<AABBType> primAABBs(primCount);
+        std::vector<IndexType> indices(primCount);
+        AABBType aabb;
+        aabb.reset();
+        for (SizeType i=0; i<primCount; ++i) {
+            primAABBs[i] = cast()->getAABB(i);
+            aabb.expandBy(primAABBs[i]);
+            indices[i] = i;
+        }
+
+        Float rootQuantity = TreeConstructionHeuristic::getQuantity(aabb);
+        RefitContext ctx(primAABBs, maxCost * rootQuantity);
+        ctx.indices.reserve(m_indexCount);
+        if (primCount > 0)
+            refitNode(ctx, m_nodes, aabb, indices);
+
+        if (ctx.heuristicCost > ctx.maxCost) {
+            KDLog(m_logLevel, "Aborted the kd-tree refit after %i ms (SAH "
+                "cost exceeds %.2f)", timer->getMilliseconds(), maxCost);
+            return std::numeric_limits<Float>::infinity();
+        }
+
+        /* Replace the index list */
+        delete[] m_indices;
+        m_indexCount = (SizeType) ctx.indices.size();
+        m_memory.set(sizeof(KDNode) * (m_nodeCount+1)
+            + sizeof(IndexType) * std::max(m_indexCount, (SizeType) 1));
+        m_indices = new IndexType[std::max(m_indexCount, (SizeType) 1)];
+        if (m_indexCount > 0)
+            memcpy(m_indices, &ctx.indices[0], sizeof(IndexType) * m_indexCount);
+
+        Float cost = rootQuantity > 0 ? ctx.heuristicCost / rootQuantity : 0;
+
+        /* Slightly enlarge the bounding box (see buildInternal()) */
+        m_tightAABB = aabb;
+        const Float eps = MTS_KD_AABB_EPSILON;
+        m_aabb = aabb;
+        m_aabb.min -= (aabb.max-aabb.min) * eps + VectorType(eps);
+        m_aabb.max += (aabb.max-aabb.min) * eps + VectorType(eps);
+
+        KDLog(m_logLevel, "Refitted the kd-tree (%i ms, %s indices, SAH cost "
+            "%.2f -> %.2f)", timer->getMilliseconds(),
+            memString(m_indexCount * sizeof(IndexType)).c_str(), m_sahCost, cost);
+
+        return cost;
+    }
+
+    /**
+     * \brief Release the tree so that \ref buildInternal() can be
+     * called again (e.g. after the geometry has changed)
+     */
+    void clearInternal() {
+        if (m_indices) {
+            delete[] m_indices;
+            m_indices = NULL;
+        }
+        if (m_nodes) {
+            freeAligned(m_nodes-1); // undo alignment shift
+            m_nodes = NULL;
+        }
+        m_nodeCount = m_indexCount = 0;
+        m_memory.set(0);
+        m_sahCost = 0;
+        m_interface.threadMap.clear();
+        m_interface.done = false;
+    }
+
 protected:
     /// Primitive classification during tree-construction
     enum EClassificationResult {
@@ -1808,8 +2005,11 @@ protected:
         /*                              Binning                                 */
         /* ==================================================================== */
 
+        bool parallel = m_parallelBuild &&
+            primCount >= MTS_KD_PARALLEL_MINMAX_THRESHOLD;
+
         ctx.minMaxBins.setAABB(tightAABB);
-        ctx.minMaxBins.bin(cast(), indices, primCount);
+        ctx.minMaxBins.bin(cast(), indices, primCount, parallel);
 
         /* ==================================================================== */
         /*                        Split candidate search                        */
@@ -1848,7 +2048,7 @@ protected:
 
         typename MinMaxBins::Partition partition =
             ctx.minMaxBins.partition(ctx, cast(), indices, bestSplit,
-            isLeftChild, m_traversalCost, m_queryCost);
+            isLeftChild, m_traversalCost, m_queryCost, parallel);
 
         /* ==================================================================== */
         /*                              Recursion                               */
@@ -2440,12 +2640,47 @@ protected:
          *     a given list of primitives
          * \param indices Primitive indirection list
          * \param primCount Specifies the length of \a indices
+         * \param parallel Distribute the work over all cores using OpenMP
          */
         void bin(const Derived *derived, IndexType *indices,
-                SizeType primCount) {
+                SizeType primCount, bool parallel = false) {
+            const size_t binStride = PointType::dim * m_binCount;
             m_primCount = primCount;
-            memset(m_minBins, 0, sizeof(SizeType) * PointType::dim * m_binCount);
-            memset(m_maxBins, 0, sizeof(SizeType) * PointType::dim * m_binCount);
+            memset(m_minBins, 0, sizeof(SizeType) * binStride);
+            memset(m_maxBins, 0, sizeof(SizeType) * binStride);
+
+#if defined(MTS_OPENMP)
+            if (parallel) {
+                /* Bin into thread-local histograms and merge them afterwards */
+                int threadCount = getCoreCount();
+                std::vector<SizeType> threadBins(2 * binStride * threadCount, 0);
+
+                #pragma omp parallel num_threads(threadCount)
+                {
+                    SizeType *minBins = &threadBins[2 * binStride * omp_get_thread_num()];
+                    SizeType *maxBins = minBins + binStride;
+
+                    #pragma omp for schedule(static)
+                    for (int i=0; i<(int) m_primCount; ++i) {
+                        const AABBType aabb = derived->getAABB(indices[i]);
+                        for (int axis=0; axis<PointType::dim; ++axis) {
+                            minBins[axis * m_binCount + computeIndex(math::castflt_down(aabb.min[axis]), axis)]++;
+                            maxBins[axis * m_binCount + computeIndex(math::castflt_up  (aabb.max[axis]), axis)]++;
+                        }
+                    }
+                }
+
+                for (int t=0; t<threadCount; ++t) {
+                    const SizeType *minBins = &threadBins[2 * binStride * t];
+                    const SizeType *maxBins = minBins + binStride;
+                    for (size_t i=0; i<binStride; ++i) {
+                        m_minBins[i] += minBins[i];
+                        m_maxBins[i] += maxBins[i];
+                    }
+                }
+                return;
+            }
+#endif
 
             for (SizeType i=0; i<m_primCount; ++i) {
                 const AABBType aabb = derived->getAABB(indices[i]);
@@ -2522,7 +2757,7 @@ protected:
         Partition partition(
                 BuildContext &ctx, const Derived *derived, IndexType *primIndices,
                 SplitCandidate &split, bool isLeftChild, Float traversalCost,
-                Float queryCost) {
+                Float queryCost, bool parallel = false) {
             SizeType numLeft = 0, numRight = 0;
             AABBType leftBounds, rightBounds;
             const int axis = split.axis;
@@ -2538,6 +2773,88 @@ protected:
                 rightIndices = primIndices;
             }
 
+#if defined(MTS_OPENMP)
+            if (parallel) {
+                /* Classify all primitives in parallel and scatter them into
+                   the list that is not shared with the input. The in-place
+                   list is compacted afterwards in a cheap sequential pass.
+                   The resulting lists match those of the serial code. */
+                int threadCount = getCoreCount();
+                std::vector<uint8_t> side(m_primCount);
+                std::vector<SizeType> threadLeft(threadCount + 1, 0),
+                    threadRight(threadCount + 1, 0);
+                std::vector<AABBType> threadLeftBounds(threadCount),
+                    threadRightBounds(threadCount);
+                const int leftBin = split.leftBin;
+
+                #pragma omp parallel num_threads(threadCount)
+                {
+                    int tid = omp_get_thread_num();
+                    SizeType localLeft = 0, localRight = 0;
+                    AABBType &localLeftBounds = threadLeftBounds[tid],
+                             &localRightBounds = threadRightBounds[tid];
+
+                    #pragma omp for schedule(static)
+                    for (int i=0; i<(int) m_primCount; ++i) {
+                        const AABBType aabb = derived->getAABB(primIndices[i]);
+                        int startIdx = computeIndex(math::castflt_down(aabb.min[axis]), axis);
+                        int endIdx   = computeIndex(math::castflt_up  (aabb.max[axis]), axis);
+                        uint8_t value = 0;
+                        if (startIdx <= leftBin) {
+                            localLeftBounds.expandBy(aabb);
+                            ++localLeft;
+                            value |= 1;
+                        }
+                        if (endIdx > leftBin) {
+                            localRightBounds.expandBy(aabb);
+                            ++localRight;
+                            value |= 2;
+                        }
+                        side[i] = value;
+                    }
+                    threadLeft[tid+1] = localLeft;
+                    threadRight[tid+1] = localRight;
+
+                    #pragma omp barrier
+                    #pragma omp single
+                    {
+                        for (int t=0; t<threadCount; ++t) {
+                            threadLeft[t+1] += threadLeft[t];
+                            threadRight[t+1] += threadRight[t];
+                        }
+                    }
+
+                    /* Same static schedule as above, hence each thread
+                       revisits the range that it has just classified */
+                    const uint8_t flag = isLeftChild ? 2 : 1;
+                    IndexType *target = isLeftChild ? rightIndices : leftIndices;
+                    SizeType pos = isLeftChild ? threadRight[tid] : threadLeft[tid];
+                    #pragma omp for schedule(static)
+                    for (int i=0; i<(int) m_primCount; ++i) {
+                        if (side[i] & flag)
+                            target[pos++] = primIndices[i];
+                    }
+                }
+
+                /* Compact the list that shares its memory with the input */
+                const uint8_t flag = isLeftChild ? 1 : 2;
+                IndexType *target = isLeftChild ? leftIndices : rightIndices;
+                SizeType pos = 0;
+                for (SizeType i=0; i<m_primCount; ++i) {
+                    if (side[i] & flag)
+                        target[pos++] = primIndices[i];
+                }
+
+                for (int t=0; t<threadCount; ++t) {
+                    if (threadLeft[t+1] > threadLeft[t])
+                        leftBounds.expandBy(threadLeftBounds[t]);
+                    if (threadRight[t+1] > threadRight[t])
+                        rightBounds.expandBy(threadRightBounds[t]);
+                }
+                numLeft = threadLeft[threadCount];
+                numRight = threadRight[threadCount];
+            } else
+#endif
             for (SizeType i=0; i<m_primCount; ++i) {
                 const IndexType primIndex = primIndices[i];
                 const AABBType aabb = derived->getAABB(primIndex);
@@ -2592,6 +2909,7 @@ protected:
 
 protected:
     IndexType *m_indices;
+    Float m_sahCost;
     Float m_traversalCost;
     Float m_queryCost;
     Float m_emptySpaceBonus;
@@ -2603,6 +2921,7 @@ protected:
     SizeType m_minMaxBins;
     SizeType m_nodeCount;
     SizeType m_indexCount;
+    TrackedMemory<EMemoryKDTree> m_memory;
     std::vector<TreeBuilder *> m_builders;
     std::vector<KDNode *> m_indirections;
     ref<Mutex> m_indirectionLock;
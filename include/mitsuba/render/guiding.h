@@ -0,0 +1,338 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_GUIDING_H_)
+#define __MITSUBA_RENDER_GUIDING_H_
+
+#include <mitsuba/render/bsdf.h>
+#include <mitsuba/core/aabb.h>
+
+/// Maximum number of vertices per path, whose incident radiance is recorded
+#define MTS_GUIDING_MAX_VERTICES 32
+
+/// Maximum number of copies, into which a path is split by ADRRS
+#define MTS_ADRRS_MAX_SPLIT 8
+
+MTS_NAMESPACE_BEGIN
+
+class SamplingIntegrator;
+class RenderQueue;
+class RenderJob;
+
+/**
+ * \brief Learned distribution of incident radiance for guiding the random
+ * walks of path tracers
+ *
+ * This implements the spatio-directional tree ("SD-tree") of Practical
+ * Path Guiding by Mueller et al.: a binary tree over the scene's
+ * bounding box, whose leaves (\a regions) each store a quadtree over the
+ * sphere of directions. The quadtrees approximate the incident radiance
+ * and are used to sample directions, which are combined with BSDF
+ * sampling using one-sample multiple importance sampling.
+ *
+ * The distribution is learned while rendering: \ref render() splits the
+ * sample budget into passes with a doubling number of samples per pixel.
+ * Every training pass records the radiance found along the guided paths
+ * and the tree is refined afterwards. Only the last pass, which receives
+ * the remaining budget (at least half of it), ends up in the final image.
+ *
+ * The learned distribution and the images of the training passes can also
+ * drive Russian roulette and splitting (adjoint-driven Russian roulette and
+ * splitting, ``ADRRS'' by Vorba and K\v{r}iv\'{a}nek) in the final pass,
+ * see \ref rouletteAndSplit().
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER PathGuide : public Object {
+public:
+    /**
+     * \brief Quadtree over the sphere of directions
+     *
+     * Directions are mapped to the unit square using the equal-area
+     * cylindrical mapping (\f$\cos\theta\f$, \f$\phi\f$). Every node stores
+     * the radiance recorded in its four quadrants.
+     */
+    class MTS_EXPORT_RENDER DirectionalTree {
+    public:
+        /// Create a tree with a single (empty) node
+        DirectionalTree();
+
+        /// Return the density of \ref sample() with respect to the unit square
+        Float pdf(Point2 p) const;
+
+        /// Warp a uniformly distributed sample on the unit square
+        Point2 sample(Point2 sample) const;
+
+        /// Atomically add a radiance sample (can be called from several threads)
+        void record(Point2 p, Float value) const;
+
+        /**
+         * \brief Create an empty tree that is refined where this tree has
+         * recorded more than \c threshold of its total energy
+         *
+         * \param maxNodes
+         *    Upper bound on the number of nodes of the new tree
+         */
+        void refine(DirectionalTree &target, Float threshold,
+            int maxDepth, size_t maxNodes) const;
+
+        /// Return the total recorded radiance
+        inline Float getEnergy() const {
+            const Node &root = m_nodes[0];
+            return root.sum[0] + root.sum[1] + root.sum[2] + root.sum[3];
+        }
+
+        /// Return the number of recorded samples
+        inline double getSampleCount() const { return m_sampleCount; }
+
+        /// Scale the recorded radiance and number of samples (when splitting a region)
+        void scale(Float factor);
+
+        /// Return the number of nodes
+        inline size_t getNodeCount() const { return m_nodes.size(); }
+    private:
+        struct Node {
+            Float sum[4];
+            /// Indices of the child nodes (0: the quadrant is a leaf)
+            uint32_t children[4];
+
+            inline Node() {
+                for (int i=0; i<4; ++i) {
+                    sum[i] = 0.0f;
+                    children[i] = 0;
+                }
+            }
+        };
+
+        /* Modified concurrently by record() */
+        mutable std::vector<Node> m_nodes;
+        mutable double m_sampleCount;
+    };
+
+    /// Directional distributions of a leaf of the spatial tree
+    struct Region {
+        /// Distribution that is sampled during the current pass
+        DirectionalTree sampling;
+        /// Distribution that is being recorded during the current pass
+        DirectionalTree building;
+    };
+
+    /**
+     * \brief Collects the guided vertices of a path and the radiance
+     * that was subsequently found along them
+     */
+    class MTS_EXPORT_RENDER PathRecord {
+    public:
+        inline PathRecord() : m_count(0) { }
+
+        /**
+         * \brief Append a vertex whose outgoing direction \c d was sampled
+         * with density \c pdf
+         *
+         * \param throughput
+         *    Path throughput including the weight of the sampled direction
+         */
+        inline bool append(const Region *region, const Vector &d,
+                const Spectrum &throughput, Float pdf) {
+            if (m_count == MTS_GUIDING_MAX_VERTICES || !region || pdf <= 0)
+                return false;
+            Vertex &vertex = m_vertices[m_count++];
+            vertex.region = region;
+            vertex.d = d;
+            vertex.throughput = throughput;
+            vertex.radiance = Spectrum(0.0f);
+            vertex.pdf = pdf;
+            return true;
+        }
+
+        /// Add a contribution of the path (including throughput) to all vertices
+        inline void addRadiance(const Spectrum &value) {
+            for (int i=0; i<m_count; ++i)
+                m_vertices[i].radiance += value;
+        }
+
+        /**
+         * \brief Add a contribution that was found along the direction of the
+         * last vertex, which receives \c lastValue instead (i.e. the value
+         * without the MIS weight of the sampling strategy)
+         */
+        inline void addRadiance(const Spectrum &value, const Spectrum &lastValue) {
+            if (m_count == 0)
+                return;
+            for (int i=0; i<m_count-1; ++i)
+                m_vertices[i].radiance += value;
+            m_vertices[m_count-1].radiance += lastValue;
+        }
+
+        /// Record the incident radiance of all vertices in the guiding distribution
+        void commit() const;
+    private:
+        struct Vertex {
+            const Region *region;
+            Vector d;
+            Spectrum throughput, radiance;
+            Float pdf;
+        };
+
+        Vertex m_vertices[MTS_GUIDING_MAX_VERTICES];
+        int m_count;
+    };
+
+    /**
+     * \brief Create a path guide from the parameters of an integrator
+     *
+     * The recognized parameters are \c guiding (sample the learned distribution?),
+     * \c guidingBSDFFraction, \c guidingSpatialThreshold, \c guidingDirectionalThreshold,
+     * \c guidingMaxMemory (in MiB), and \c adrrs (use ADRRS in the final pass?).
+     */
+    PathGuide(const Properties &props);
+
+    /**
+     * \brief Render an image with the given integrator, while learning
+     * the guiding distribution
+     *
+     * This calls \ref SamplingIntegrator::render() once per pass. The passes
+     * render disjoint subsets of the sampler's per-pixel sample sequence.
+     */
+    bool render(SamplingIntegrator *integrator, Scene *scene,
+        RenderQueue *queue, const RenderJob *job, int sceneResID,
+        int sensorResID, int samplerResID);
+
+    /// Cancel a running \ref render() operation
+    void cancel();
+
+    /// Does the current pass record training data?
+    inline bool isTraining() const { return m_training; }
+
+    /// Does the current pass use adjoint-driven Russian roulette and splitting?
+    inline bool hasADRRS() const { return m_adrrs && !m_training && !m_pixelEstimate.empty(); }
+
+    /// Return the region containing \c p
+    const Region *lookup(const Point &p) const;
+
+    /**
+     * \brief Sample an outgoing direction at a surface interaction from
+     * the mixture of the BSDF and the guiding distribution of \c region
+     *
+     * Like \ref BSDF::sample(), this returns the BSDF value (including
+     * the foreshortening factor) divided by the density. Degenerate BSDF
+     * components can only be sampled by the BSDF. When the BSDF has no
+     * smooth components or \c region has not been trained, this reduces
+     * to plain BSDF sampling.
+     */
+    Spectrum sample(const Region *region, const BSDF *bsdf,
+        BSDFSamplingRecord &bRec, Float &pdf, Point2 sample) const;
+
+    /**
+     * \brief Return the density of \ref sample() for the world-space
+     * direction \c d, given the BSDF sampling density \c bsdfPdf
+     */
+    Float pdf(const Region *region, const BSDF *bsdf,
+        Float bsdfPdf, const Vector &d) const;
+
+    /**
+     * \brief Estimate the radiance arriving at a point of \c region from
+     * the world-space direction \c d
+     *
+     * Returns zero when the region has not been trained.
+     */
+    Float estimateRadiance(const Region *region, const Vector &d) const;
+
+    /**
+     * \brief Look up the value of the pixel that is seen by a sensor ray
+     * in the images of the training passes
+     *
+     * Returns zero when the pixel is unknown.
+     */
+    Float estimatePixel(const Sensor *sensor, const Ray &ray) const;
+
+    /**
+     * \brief Adjoint-driven Russian roulette and splitting
+     *
+     * Compares the expected contribution of a path (its throughput times
+     * \c radianceEstimate) to the \c pixelEstimate and keeps it within a
+     * window around the latter: paths with a much lower contribution are
+     * terminated with a corresponding probability, while paths with a much
+     * higher contribution are split into several copies. The \c throughput
+     * is adjusted accordingly.
+     *
+     * \param maxCopies
+     *    Upper bound on the number of copies the caller can handle
+     *
+     * \return The number of copies that should continue the path
+     *    (zero if it was terminated)
+     */
+    int rouletteAndSplit(Spectrum &throughput, Float radianceEstimate,
+        Float pixelEstimate, Float sample, int maxCopies) const;
+
+    /// Return the memory usage of the trees in bytes
+    size_t getMemoryUsage() const;
+
+    /// Return a human-readable string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~PathGuide() { }
+
+    /// Start over with a single region that covers \c aabb
+    void reset(const AABB &aabb);
+
+    /// Refine the trees based on the data recorded in a pass
+    void refine(size_t passSamples);
+
+    /// Add the image of a training pass to the pixel estimates
+    void accumulatePixelEstimate(const Film *film, size_t passSamples);
+
+    /// Can the distribution of \c region be used for sampling?
+    inline bool isGuided(const Region *region, const BSDF *bsdf) const {
+        return m_sampling && region && (bsdf->getType() & BSDF::ESmooth)
+            && region->sampling.getEnergy() > 0;
+    }
+private:
+    struct SpatialNode {
+        /// Indices of the child nodes (0: this is a leaf)
+        uint32_t children[2];
+        /// Index of the region (leaves only)
+        uint32_t region;
+        /// Split axis
+        int axis;
+    };
+
+    std::vector<SpatialNode> m_nodes;
+    std::vector<Region> m_regions;
+    AABB m_aabb;
+    Vector m_invExtents;
+    Float m_bsdfFraction;
+    Float m_spatialThreshold;
+    Float m_directionalThreshold;
+    size_t m_maxMemory;
+    bool m_sampling, m_adrrs;
+    bool m_training, m_cancelled;
+    /* Average of the training pass images (ADRRS only) */
+    std::vector<Float> m_pixelEstimate;
+    size_t m_pixelEstimateSamples;
+    Point2i m_cropOffset;
+    Vector2i m_cropSize;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_GUIDING_H_ */
@@ -0,0 +1,132 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_HITCACHE_H_)
+#define __MITSUBA_RENDER_HITCACHE_H_
+
+#include <mitsuba/render/shape.h>
+#include <mitsuba/core/mmap.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Memory-mapped file with the primary hits of all sensor samples
+ *
+ * Multi-pass pipelines often render the same camera several times with
+ * different integrators (e.g. a beauty pass, ambient occlusion and a few
+ * \c field passes). When these jobs share a cache file (\c primaryHitCache
+ * parameter of \ref SamplingIntegrator), the first one stores the sensor
+ * sample and the intersected primitive of every sample. The following
+ * ones reconstruct the \ref Intersection from there instead of tracing
+ * the sensor rays.
+ *
+ * The file is keyed by a hash of the geometry, the sensor (including its
+ * film and sampler) and the number of samples per pixel. A file that
+ * doesn't match the scene is overwritten by the next job. Samples whose
+ * hit cannot be reconstructed from the shape list of the scene (e.g.
+ * instanced geometry) only store the sensor sample and are traced as
+ * usual, and so are samples that were rendered by remote workers.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER PrimaryHitCache : public Object {
+public:
+    /// State of a stored sample
+    enum EState {
+        /// Nothing was stored for this sample
+        EEmpty = 0,
+        /// The sensor ray escaped from the scene
+        EMiss,
+        /// The ray hit a triangle of a mesh (with barycentrics \c u, \c v)
+        ETriangle,
+        /// The ray hit another kind of shape, which is intersected again
+        EShape,
+        /// Only the sensor sample is known, the ray must be traced
+        ETrace
+    };
+
+    /// Data that is stored for every sample
+    struct Record {
+        Point2 samplePos;
+        Point2 apertureSample;
+        Float filterWeight;
+        Float timeSample;
+        Float u, v, t;
+        uint32_t shapeIndex;
+        uint32_t primIndex;
+        uint32_t state;
+    };
+
+    /**
+     * \brief Open the cache file of a scene
+     *
+     * When the file exists and matches the scene, its records are
+     * replayed (see \ref isReplaying()). Otherwise, it is (re-)created
+     * with empty records, which are filled in during rendering.
+     */
+    PrimaryHitCache(const fs::path &filename, const Scene *scene);
+
+    /// Were the records loaded from a previous job?
+    inline bool isReplaying() const { return m_replaying; }
+
+    /**
+     * \brief Return the record of a sample or \c NULL if the pixel
+     * (relative to the crop window) or the sample index lies outside
+     * of the cache
+     */
+    inline Record *getRecord(const Point2i &pixel, size_t sampleIndex) const {
+        if (pixel.x < 0 || pixel.y < 0 || pixel.x >= m_size.x || pixel.y >= m_size.y
+                || sampleIndex >= m_sampleCount)
+            return NULL;
+        return m_records + ((size_t) pixel.y * m_size.x + pixel.x)
+            * m_sampleCount + sampleIndex;
+    }
+
+    /// Store the sensor sample and the primary hit of a sample
+    void put(Record *rec, const Point2 &samplePos, Float filterWeight,
+        const Point2 &apertureSample, Float timeSample, const Ray &ray,
+        const Intersection &its) const;
+
+    /**
+     * \brief Reconstruct the primary hit of a recorded sample
+     *
+     * \return \c false if the sample must be traced instead
+     */
+    bool get(const Record &rec, const Ray &ray, Intersection &its) const;
+
+    /// Return a hash of everything that determines the contents of the cache
+    static uint64_t getCacheKey(const Scene *scene);
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~PrimaryHitCache() { }
+private:
+    ref<MemoryMappedFile> m_mmap;
+    std::vector<const Shape *> m_shapes;
+    std::map<const Shape *, uint32_t> m_shapeIndices;
+    Record *m_records;
+    Vector2i m_size;
+    size_t m_sampleCount;
+    bool m_replaying;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_HITCACHE_H_ */
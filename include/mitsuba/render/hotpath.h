@@ -0,0 +1,71 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_HOTPATH_H_)
+#define __MITSUBA_RENDER_HOTPATH_H_
+
+#include <mitsuba/core/statistics.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Cycle counters of the rendering hot paths
+ *
+ * These only exist when Mitsuba is compiled with \c MTS_HOTPATH_TIMING.
+ * Every counter accumulates the time spent in one kind of operation along
+ * with the number of calls, and is reported by \ref Statistics. The times
+ * are inclusive, e.g. the shadow rays traced by emitter sampling also
+ * count towards ray intersection.
+ *
+ * \ingroup librender
+ */
+#if defined(MTS_HOTPATH_TIMING)
+namespace hotpath {
+    /// Scene::rayIntersect() and related queries
+    extern MTS_EXPORT_RENDER StatsCounter rayIntersect;
+    /// BSDF::sample() calls made by the integrators
+    extern MTS_EXPORT_RENDER StatsCounter bsdfSample;
+    /// BSDF::eval() calls made by the integrators
+    extern MTS_EXPORT_RENDER StatsCounter bsdfEval;
+    /// Scene::sampleEmitterDirect() and its attenuated variant
+    extern MTS_EXPORT_RENDER StatsCounter emitterSample;
+    /// Medium::sampleDistance() calls made by the integrators
+    extern MTS_EXPORT_RENDER StatsCounter mediumSample;
+    /// ImageBlock::put()
+    extern MTS_EXPORT_RENDER StatsCounter imageBlockPut;
+};
+
+/// Time the remainder of the current scope
+#define MTS_HOTPATH_SCOPE(counter) \
+    ScopedCycleTimer __hotpathTimer(hotpath::counter)
+
+/**
+ * \brief Time the evaluation of an expression (along with the rest
+ * of the full expression that contains it)
+ */
+#define MTS_HOTPATH_TIMED(counter, expr) \
+    (ScopedCycleTimer(hotpath::counter), (expr))
+#else
+#define MTS_HOTPATH_SCOPE(counter)
+#define MTS_HOTPATH_TIMED(counter, expr) (expr)
+#endif
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_HOTPATH_H_ */
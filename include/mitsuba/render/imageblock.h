@@ -23,9 +23,44 @@
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/rfilter.h>
+#include <mitsuba/render/footprint.h>
+#include <mitsuba/render/hotpath.h>
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+#include <mitsuba/core/sse.h>
+#endif
+
+/// Number of rows sharing a lock in \ref ImageBlock::putConcurrent()
+#define MTS_IMAGEBLOCK_STRIPE 8
+
+/// Tile size used by \ref SparseImageBlock
+#define MTS_IMAGEBLOCK_SPARSE_TILE 32
 
 MTS_NAMESPACE_BEGIN
 
+class SparseImageBlock;
+
+/**
+ * \brief Cost of rendering an image block, as measured by the worker
+ * that rendered it (see \ref ImageBlock::allocateCost())
+ *
+ * \ingroup librender
+ */
+struct BlockCost {
+    /// Wall-clock time in seconds
+    Float time;
+    /// Number of samples taken
+    uint64_t samples;
+    /// Number of rays traced (zero when statistics are disabled)
+    uint64_t rays;
+
+    inline BlockCost() { clear(); }
+
+    inline void clear() {
+        time = 0;
+        samples = rays = 0;
+    }
+};
+
 /**
  * \brief Storage for an image sub-block (a.k.a render bucket)
  *
@@ -96,14 +131,142 @@ public:
     /// Return a pointer to the underlying bitmap representation (const version)
     inline const Bitmap *getBitmap() const { return m_bitmap.get(); }
 
+    /**
+     * \brief Allocate a per-pixel variance buffer
+     *
+     * The buffer covers the block without its border region and stores
+     * three channels per pixel: the sum and the sum of squares of the
+     * luminance of several independent estimates of the pixel, and the
+     * number of estimates. It is used by the adaptive sampling mode of
+     * \ref BlockedRenderProcess. Its contents are transmitted along with
+     * the block and are cleared by \ref clear().
+     */
+    void allocateVariance();
+
+    /// Does this block have a variance buffer?
+    inline bool hasVariance() const { return m_variance.get() != NULL; }
+
+    /// Return the variance buffer (or \c NULL if none was allocated)
+    inline Bitmap *getVariance() { return m_variance; }
+
+    /// Return the variance buffer (const version)
+    inline const Bitmap *getVariance() const { return m_variance.get(); }
+
+    /**
+     * \brief Allocate an object footprint
+     *
+     * The footprint records the shapes and BSDFs that were encountered
+     * while rendering the block (see \ref Scene::setFootprint()). It is
+     * used by \ref RenderRegionCache, transmitted along with the block, and
+     * cleared by \ref clear().
+     */
+    void allocateFootprint();
+
+    /// Does this block have an object footprint?
+    inline bool hasFootprint() const { return m_footprint != NULL; }
+
+    /// Return the object footprint (or \c NULL if none was allocated)
+    inline ObjectFootprint *getFootprint() { return m_footprint; }
+
+    /// Return the object footprint (const version)
+    inline const ObjectFootprint *getFootprint() const { return m_footprint; }
+
+    /**
+     * \brief Allocate a cost record
+     *
+     * The record holds the time, samples and rays spent on rendering the
+     * block (see \ref BlockedRenderProcess::setTileCostRecord()). It is
+     * transmitted along with the block and cleared by \ref clear().
+     */
+    void allocateCost();
+
+    /// Does this block have a cost record?
+    inline bool hasCost() const { return m_cost != NULL; }
+
+    /// Return the cost record (or \c NULL if none was allocated)
+    inline BlockCost *getCost() { return m_cost; }
+
+    /// Return the cost record (const version)
+    inline const BlockCost *getCost() const { return m_cost; }
+
+    /**
+     * \brief Store some of the spectral layers of a block with the pixel
+     * format \ref Bitmap::EMultiSpectrumAlphaWeight in half precision
+     *
+     * This is meant for the full-resolution storage of multi-channel
+     * films, whose auxiliary layers (e.g. normals or texture coordinates)
+     * don't need the accuracy of the radiance layer. The layers flagged
+     * in \c compact are moved into a separate \ref Bitmap::EFloat16
+     * bitmap (see \ref getCompactBitmap()), and the regular bitmap only
+     * keeps the remaining layers, the alpha value and the weight.
+     *
+     * Blocks passed to \ref put(const ImageBlock *) must still use the
+     * full channel layout, and \ref getRows() reassembles it. The sample
+     * splatting functions can't be used on such a block, and it can't be
+     * transmitted over the network. The contents are cleared.
+     */
+    void setCompactLayers(const std::vector<bool> &compact);
+
+    /// Does this block store some layers in half precision?
+    inline bool hasCompactLayers() const { return m_compact.get() != NULL; }
+
+    /// Return the half precision layers (or \c NULL if there are none)
+    inline const Bitmap *getCompactBitmap() const { return m_compact.get(); }
+
+    /**
+     * \brief Copy \c count rows starting at \c y into a buffer of single
+     * or double precision values that uses the full channel layout
+     *
+     * This also works for blocks without compact layers, in which case
+     * it simply copies the bitmap data.
+     */
+    void getRows(int y, int count, Float *target) const;
+
     /// Clear everything to zero
-    inline void clear() { m_bitmap->clear(); }
+    inline void clear() {
+        m_bitmap->clear();
+        if (m_compact)
+            m_compact->clear();
+        if (m_variance)
+            m_variance->clear();
+        if (m_footprint)
+            m_footprint->clear();
+        if (m_cost)
+            m_cost->clear();
+    }
 
-    /// Accumulate another image block into this one
+    /// Accumulate another image block (and its variance buffer and footprint, if both have one) into this one
     inline void put(const ImageBlock *block) {
-        m_bitmap->accumulate(block->getBitmap(),
+        if (EXPECT_NOT_TAKEN(m_compact.get() != NULL))
+            putCompact(block);
+        else
+            m_bitmap->accumulate(block->getBitmap(),
             Point2i(block->getOffset() - m_offset
                 - Vector2i(block->getBorderSize() - m_borderSize)));
+        if (m_variance && block->hasVariance())
+            m_variance->accumulate(block->getVariance(),
+                Point2i(block->getOffset() - m_offset));
+        if (m_footprint && block->hasFootprint())
+            m_footprint->insert(*block->getFootprint());
+    }
+
+    /// Accumulate the tiles of a sparse image block into this one
+    void put(const SparseImageBlock *block);
+
+    /**
+     * \brief Record a sample luminance in the variance buffer
+     *
+     * \param pos
+     *    Pixel position relative to the block offset
+     * \param luminance
+     *    Luminance of the sample
+     */
+    inline void putVariance(const Point2i &pos, Float luminance) {
+        Float *target = m_variance->getFloatData()
+            + (pos.y * (size_t) m_variance->getWidth() + pos.x) * 3;
+        target[0] += luminance;
+        target[1] += luminance * luminance;
+        target[2] += 1;
     }
 
     /**
@@ -142,6 +305,7 @@ public:
      *    NaN or negative. A warning is also printed in this case
      */
     FINLINE bool put(const Point2 &_pos, const Float *value) {
+        MTS_HOTPATH_SCOPE(imageBlockPut);
         const int channels = m_bitmap->getChannelCount();
 
         /* Check if all sample values are valid */
@@ -178,10 +342,8 @@ public:
                     + (y * (size_t) size.x + min.x) * channels;
 
                 for (int x=min.x, xr=0; x<=max.x; ++x, ++xr) {
-                    const Float weight = m_weightsX[xr] * weightY;
-
-                    for (int k=0; k<channels; ++k)
-                        *dest++ += weight * value[k];
+                    accumulate(dest, value, m_weightsX[xr] * weightY, channels);
+                    dest += channels;
                 }
             }
         }
@@ -203,10 +365,128 @@ public:
         return false;
     }
 
+    /**
+     * \brief Store a single sample in exactly one pixel of the block
+     *
+     * This is used when the sensor sample positions are importance sampled
+     * from the reconstruction filter (see \ref ReconstructionFilter::sample()),
+     * in which case no splatting into neighboring pixels takes place.
+     *
+     * \param pixel
+     *    Denotes the target pixel in absolute (film) coordinates
+     * \param value
+     *    Pointer to an array containing each channel of the sample values.
+     *    The array must match the length given by \ref getChannelCount()
+     * \param weight
+     *    Factor (usually the sign of the filter) applied to all channels
+     * \return \c false if one of the sample values was \a invalid, e.g.
+     *    NaN or negative. A warning is also printed in this case
+     */
+    FINLINE bool putPixel(const Point2i &pixel, const Float *value, Float weight) {
+        const int channels = m_bitmap->getChannelCount();
+
+        /* Check if all sample values are valid */
+        for (int i=0; i<channels; ++i) {
+            if (EXPECT_NOT_TAKEN((!std::isfinite(value[i]) || value[i] < 0) && m_warn)) {
+                std::ostringstream oss;
+                oss << "Invalid sample value : [";
+                for (int j=0; j<channels; ++j) {
+                    oss << value[j];
+                    if (j+1 < channels)
+                        oss << ", ";
+                }
+                oss << "]";
+                Log(EWarn, "%s", oss.str().c_str());
+                return false;
+            }
+        }
+
+        const Vector2i &size = m_bitmap->getSize();
+        const int x = pixel.x - m_offset.x + m_borderSize,
+                  y = pixel.y - m_offset.y + m_borderSize;
+        if (x >= 0 && y >= 0 && x < size.x && y < size.y)
+            accumulate(m_bitmap->getFloatData() + (y * (size_t) size.x + x) * channels,
+                value, weight, channels);
+        return true;
+    }
+
+    /**
+     * \brief Store a single sample in exactly one pixel of the block
+     *
+     * \see putPixel(const Point2i &, const Float *, Float)
+     */
+    FINLINE bool putPixel(const Point2i &pixel, const Spectrum &spec, Float alpha, Float weight) {
+        Float temp[SPECTRUM_SAMPLES + 2];
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            temp[i] = spec[i];
+        temp[SPECTRUM_SAMPLES] = alpha;
+        temp[SPECTRUM_SAMPLES + 1] = 1.0f;
+        return putPixel(pixel, temp, weight);
+    }
+
+    /**
+     * \brief Store several samples inside the block
+     *
+     * \param pos
+     *    Array of \c count sample positions in fractional pixel coordinates
+     * \param values
+     *    Sample values in a contiguous array, where each sample provides
+     *    \ref getChannelCount() entries
+     * \param count
+     *    The number of samples
+     * \return The number of valid samples (invalid ones are skipped as in
+     *    \ref put(const Point2 &, const Float *))
+     */
+    inline size_t put(const Point2 *pos, const Float *values, size_t count) {
+        const int channels = m_bitmap->getChannelCount();
+        size_t valid = 0;
+        for (size_t i=0; i<count; ++i) {
+            if (put(pos[i], values + i * channels))
+                ++valid;
+        }
+        return valid;
+    }
+
+    /**
+     * \brief Thread-safe version of \ref put(const Point2 &, const Float *)
+     *
+     * This function may be called concurrently by several threads that
+     * splat into the same (typically full-resolution) image block. The
+     * filter weights are kept on the stack, and every horizontal stripe
+     * of \ref MTS_IMAGEBLOCK_STRIPE rows is protected by a spin lock that
+     * is held while the sample is accumulated into it. This avoids
+     * allocating a separate image per rendering thread.
+     *
+     * \return \c false if one of the sample values was \a invalid, e.g.
+     *    NaN or negative. A warning is also printed in this case
+     */
+    bool putConcurrent(const Point2 &pos, const Float *value);
+
+    /**
+     * \brief Thread-safe version of \ref put(const Point2 &, const Spectrum &, Float)
+     */
+    inline bool putConcurrent(const Point2 &pos, const Spectrum &spec, Float alpha) {
+        Float temp[SPECTRUM_SAMPLES + 2];
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            temp[i] = spec[i];
+        temp[SPECTRUM_SAMPLES] = alpha;
+        temp[SPECTRUM_SAMPLES + 1] = 1.0f;
+        return putConcurrent(pos, temp);
+    }
+
     /// Create a clone of the entire image block
     ref<ImageBlock> clone() const {
         ref<ImageBlock> clone = new ImageBlock(m_bitmap->getPixelFormat(),
-            m_bitmap->getSize() - Vector2i(2*m_borderSize, 2*m_borderSize), m_filter, m_bitmap->getChannelCount());
+            m_bitmap->getSize() - Vector2i(2*m_borderSize, 2*m_borderSize), m_filter,
+            m_bitmap->getChannelCount() + (m_compact.get() ? m_compact->getChannelCount() : 0));
+        if (m_compact.get())
+            clone->setCompactLayers(m_compactLayers);
+        if (m_variance.get())
+            clone->allocateVariance();
+        if (m_footprint)
+            clone->allocateFootprint();
+        if (m_cost)
+            clone->allocateCost();
         copyTo(clone);
         return clone;
     }
@@ -214,6 +494,14 @@ public:
     /// Copy the contents of this image block to another one with the same configuration
     void copyTo(ImageBlock *copy) const {
         memcpy(copy->getBitmap()->getUInt8Data(), m_bitmap->getUInt8Data(), m_bitmap->getBufferSize());
+        if (m_compact.get() && copy->m_compact.get())
+            memcpy(copy->m_compact->getUInt8Data(), m_compact->getUInt8Data(), m_compact->getBufferSize());
+        if (m_variance.get() && copy->m_variance.get())
+            memcpy(copy->m_variance->getUInt8Data(), m_variance->getUInt8Data(), m_variance->getBufferSize());
+        if (m_footprint && copy->m_footprint)
+            *copy->m_footprint = *m_footprint;
+        if (m_cost && copy->m_cost)
+            *copy->m_cost = *m_cost;
         copy->m_size = m_size;
         copy->m_offset = m_offset;
         copy->m_warn = m_warn;
@@ -234,16 +522,104 @@ public:
 protected:
     /// Virtual destructor
     virtual ~ImageBlock();
+
+    /// Implementation of \ref put(const ImageBlock *) for blocks with compact layers
+    void putCompact(const ImageBlock *block);
+
+    /// Compute <tt>dest[i] += weight * src[i]</tt> for <tt>i=0..count-1</tt>
+    static FINLINE void accumulate(Float * __restrict dest,
+            const Float * __restrict src, Float weight, int count) {
+        int i = 0;
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+        const __m128 w = _mm_set1_ps(weight);
+        for (; i+8 <= count; i += 8) {
+            __m128 d0 = _mm_loadu_ps(dest + i),
+                   d1 = _mm_loadu_ps(dest + i + 4);
+            d0 = _mm_add_ps(d0, _mm_mul_ps(w, _mm_loadu_ps(src + i)));
+            d1 = _mm_add_ps(d1, _mm_mul_ps(w, _mm_loadu_ps(src + i + 4)));
+            _mm_storeu_ps(dest + i, d0);
+            _mm_storeu_ps(dest + i + 4, d1);
+        }
+        for (; i+4 <= count; i += 4)
+            _mm_storeu_ps(dest + i, _mm_add_ps(_mm_loadu_ps(dest + i),
+                _mm_mul_ps(w, _mm_loadu_ps(src + i))));
+#endif
+        for (; i<count; ++i)
+            dest[i] += weight * src[i];
+    }
 protected:
     ref<Bitmap> m_bitmap;
+    ref<Bitmap> m_compact;
+    std::vector<bool> m_compactLayers;
+    ref<Bitmap> m_variance;
+    TrackedMemory<EMemoryImageBlock> m_memory;
+    ObjectFootprint *m_footprint;
+    BlockCost *m_cost;
     Point2i m_offset;
     Vector2i m_size;
     int m_borderSize;
     const ReconstructionFilter *m_filter;
     Float *m_weightsX, *m_weightsY;
+    volatile int32_t *m_stripeLocks;
     bool m_warn;
 };
 
+/**
+ * \brief Sparse tiled copy of an \ref ImageBlock
+ *
+ * Particle tracing techniques splat into full-resolution light images, which
+ * remain mostly empty when the work units are small. This class only stores
+ * the tiles of such a block that contain nonzero values. It is used to send
+ * these images over the network, and a received copy can be accumulated
+ * into another block at a cost that is proportional to the number of tiles.
+ * The variance buffer is not included.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER SparseImageBlock : public Object {
+public:
+    /// Create an empty sparse image block
+    SparseImageBlock();
+
+    /// Gather the nonzero tiles of the given image block
+    void set(const ImageBlock *block);
+
+    /// Return the number of stored tiles
+    inline size_t getTileCount() const { return m_tiles.size(); }
+
+    /// Fill the sparse block with content acquired from a binary data stream
+    void load(Stream *stream);
+
+    /// Serialize the sparse block to a binary data stream
+    void save(Stream *stream) const;
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    friend class ImageBlock;
+
+    /// Virtual destructor
+    virtual ~SparseImageBlock() { }
+
+    /// Return the position and size of the given tile within the bitmap
+    inline void getTile(uint32_t index, Point2i &pos, Vector2i &size) const {
+        int tilesX = (m_bitmapSize.x + MTS_IMAGEBLOCK_SPARSE_TILE - 1)
+            / MTS_IMAGEBLOCK_SPARSE_TILE;
+        pos = Point2i((int) (index % tilesX), (int) (index / tilesX))
+            * MTS_IMAGEBLOCK_SPARSE_TILE;
+        size = Vector2i(
+            std::min(MTS_IMAGEBLOCK_SPARSE_TILE, m_bitmapSize.x - pos.x),
+            std::min(MTS_IMAGEBLOCK_SPARSE_TILE, m_bitmapSize.y - pos.y));
+    }
+protected:
+    Point2i m_offset;
+    Vector2i m_bitmapSize;
+    int m_borderSize, m_channels;
+    std::vector<uint32_t> m_tiles;
+    std::vector<Float> m_data;
+};
 
 MTS_NAMESPACE_END
 
@@ -21,6 +21,7 @@
 #define __MITSUBA_RENDER_IMAGEPROC_H_
 
 #include <mitsuba/core/sched.h>
+#include <mitsuba/core/bitmap.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -28,18 +29,55 @@ MTS_NAMESPACE_BEGIN
  * Abstract parallel process, which performs a certain task (to be defined by
  * the subclass) on the pixels of an image where work on adjacent pixels
  * is independent. For preview purposes, a spiraling pattern of square
- * pixel blocks is generated.
+ * pixel blocks is generated by default. Alternatively, the blocks can be
+ * generated along a Hilbert curve (see \ref setBlockOrder()), so that
+ * consecutive work units (e.g. those handed to one worker by
+ * \ref generateWorkBatch()) cover neighboring image regions. Given a
+ * prediction of the cost of every pixel (see \ref setCostPrediction()),
+ * the blocks are instead sorted by decreasing cost, which avoids ending
+ * the job with a single expensive block that keeps one core busy.
  *
  * \ingroup librender
  */
 class MTS_EXPORT_RENDER BlockedImageProcess : public ParallelProcess {
 public:
+    /// Order in which the pixel blocks are generated
+    enum EBlockOrder {
+        /// Spiral starting at the center of the image
+        ESpiral = 0,
+        /// Hilbert curve (improves the cache locality of each worker)
+        EHilbert
+    };
+
+    /// Set the order of the generated blocks (must be called before \ref init())
+    inline void setBlockOrder(EBlockOrder order) { m_blockOrder = order; }
+
+    /// Return the order of the generated blocks
+    inline EBlockOrder getBlockOrder() const { return m_blockOrder; }
+
+    /**
+     * \brief Generate the most expensive blocks first
+     *
+     * \param cost
+     *    Single-channel floating point bitmap covering the processed image
+     *    region (without the offset passed to \ref init()), whose pixels
+     *    are proportional to the expected cost of each pixel (e.g. the
+     *    time channel recorded by a \ref TileCostMap). Blocks of equal
+     *    cost keep the order given by \ref setBlockOrder(). Passing
+     *    \c NULL disables the prediction. Must be called before
+     *    \ref init().
+     */
+    void setCostPrediction(const Bitmap *cost);
+
     // ======================================================================
     //! @{ \name Implementation of the ParallelProcess interface
     // ======================================================================
 
     virtual EStatus generateWork(WorkUnit *unit, int worker);
 
+    virtual EStatus generateWorkBatch(WorkUnit * const *units,
+        size_t count, size_t &generated, int worker);
+
     //! @}
     // ======================================================================
 
@@ -57,8 +95,18 @@ protected:
      */
     void init(const Point2i &offset, const Vector2i &size, uint32_t blockSize);
 
+    /**
+     * \brief Fill the given work unit with the next block of the
+     * spiral or Hilbert curve (non-virtual helper used by the
+     * generateWork*() functions)
+     */
+    EStatus nextBlock(WorkUnit *unit);
+
+    /// Advance \c m_curBlock to the next block of the spiral
+    void advanceSpiral();
+
     /// Protected constructor
-    inline BlockedImageProcess() { }
+    inline BlockedImageProcess() : m_blockOrder(ESpiral) { }
     /// Virtual destructor
     virtual ~BlockedImageProcess() { }
 protected:
@@ -76,6 +124,10 @@ protected:
     int m_stepsLeft, m_numBlocksTotal;
     int m_numBlocksGenerated;
     int m_blockSize;
+    EBlockOrder m_blockOrder;
+    ref<const Bitmap> m_costPrediction;
+    /// Explicit block order (Hilbert curve or cost prediction)
+    std::vector<Point2i> m_blockList;
 };
 
 MTS_NAMESPACE_END
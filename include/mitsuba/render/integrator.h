@@ -23,6 +23,7 @@
 #include <mitsuba/core/netobject.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/render/shape.h>
+#include <mitsuba/render/hitcache.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -114,6 +115,24 @@ public:
      */
     virtual const Integrator *getSubIntegrator(int index) const;
 
+    /**
+     * \brief Write the state of an ongoing rendering to a checkpoint
+     *
+     * Integrators that support checkpoints call \ref RenderJob::saveCheckpoint()
+     * at points of their \ref render() implementation where their state is
+     * consistent, which in turn invokes this function. The default
+     * implementation raises an error.
+     */
+    virtual void saveCheckpoint(Stream *stream) const;
+
+    /**
+     * \brief Restore the state written by \ref saveCheckpoint()
+     *
+     * This is invoked via \ref RenderJob::loadCheckpoint(). The default
+     * implementation raises an error.
+     */
+    virtual void loadCheckpoint(Stream *stream);
+
     /// Serialize this integrator to a binary data stream
     void serialize(Stream *stream, InstanceManager *manager) const;
 
@@ -196,22 +215,40 @@ public:
         EAdaptiveQuery = 0x02
     };
 
+    /**
+     * \brief Auxiliary first-hit quantities (AOVs), which an integrator
+     * can record as a by-product of the sensor ray via \ref recordAOVs()
+     */
+    enum EAOV {
+        /// Diffuse reflectance of the first surface interaction
+        EAOVAlbedo = 0,
+        /// Shading normal of the first surface interaction (encoded as RGB)
+        EAOVNormal,
+        /// Ray distance to the first surface interaction
+        EAOVDepth,
+        /// Index of the intersected shape in \ref Scene::getShapes() (or -1)
+        EAOVShapeIndex,
+        /// Number of supported AOVs
+        EAOVCount
+    };
+
     /// Construct an invalid radiance query record
     inline RadianceQueryRecord()
      : type(0), scene(NULL), sampler(NULL), medium(NULL),
-       depth(0), alpha(0), dist(-1), extra(0) {
+       depth(0), alpha(0), dist(-1), extra(0), aovs(NULL) {
     }
 
     /// Construct a radiance query record for the given scene and sampler
     inline RadianceQueryRecord(const Scene *scene, Sampler *sampler)
      : type(0), scene(scene), sampler(sampler), medium(NULL),
-       depth(0), alpha(0), dist(-1), extra(0) {
+       depth(0), alpha(0), dist(-1), extra(0), aovs(NULL) {
     }
 
     /// Copy constructor
     inline RadianceQueryRecord(const RadianceQueryRecord &rRec)
      : type(rRec.type), scene(rRec.scene), sampler(rRec.sampler), medium(rRec.medium),
-       depth(rRec.depth), alpha(rRec.alpha), dist(rRec.dist), extra(rRec.extra) {
+       depth(rRec.depth), alpha(rRec.alpha), dist(rRec.dist), extra(rRec.extra),
+       aovs(rRec.aovs) {
     }
 
     /// Begin a new query of the given type
@@ -261,6 +298,29 @@ public:
      */
     inline bool rayIntersect(const RayDifferential &ray);
 
+    /**
+     * \brief Provide an intersection that was already computed by the
+     * caller (e.g. via \ref Scene::rayIntersectStream())
+     *
+     * Apart from not tracing the ray, this behaves exactly like
+     * \ref rayIntersect(), i.e. steps 2-5 are still performed if
+     * \c EIntersection is set in \c type.
+     *
+     * \return \c true if there is a valid intersection.
+     */
+    inline bool setIntersection(const RayDifferential &ray, const Intersection &its);
+
+    /**
+     * \brief Store the AOVs of the current intersection \c its
+     * (or of a ray, which escaped from the scene) in \ref aovs
+     *
+     * Integrators that support AOV output call this function right after
+     * the first \ref rayIntersect(). Does nothing if \ref aovs is \c NULL;
+     * otherwise, \ref aovs is reset to \c NULL so that subsequent calls
+     * (e.g. from recursive queries) leave the recorded values untouched.
+     */
+    void recordAOVs(const RayDifferential &ray);
+
     /// Retrieve a 2D sample
     inline Point2 nextSample2D();
 
@@ -306,6 +366,15 @@ public:
      * is dependent on the particular integrator implementation. (*)
      */
     int extra;
+
+    /**
+     * Optional array of \ref EAOVCount entries, which receives the
+     * first-hit AOVs of supporting integrators (see \ref recordAOVs())
+     */
+    Spectrum *aovs;
+protected:
+    /// Compute alpha/distance values of a new intersection and clear \c EIntersection
+    inline void processIntersection(const RayDifferential &ray);
 };
 
 /** \brief Abstract base class, which describes integrators
@@ -358,6 +427,39 @@ public:
      * associated rays in a pixel region is then taken as an approximation
      * of that pixel's radiance value. For adaptive strategies, have a look at
      * the \c adaptive plugin, which is an extension of this class.
+     *
+     * When the \c adaptiveSampling parameter is set, the image is instead
+     * rendered in several passes that concentrate the samples on blocks
+     * with a high estimated error (see \ref BlockedRenderProcess::setAdaptive()).
+     * Alternatively, the \c progressiveSamples parameter renders the image in
+     * rounds that advance all blocks by the same number of samples per pixel
+     * (see \ref BlockedRenderProcess::setProgressive()).
+     *
+     * The \c regionCache parameter stores the rendered blocks together with
+     * the shapes and BSDFs that their paths encountered in the file
+     * <tt>&lt;output&gt;.regioncache</tt>. When the IDs of the objects that
+     * were modified since then are given via \c regionCacheChanged, blocks
+     * that never encountered them are copied from that file instead of
+     * being rendered (see \ref RenderRegionCache).
+     *
+     * The \c tileCost parameter writes the time, samples and rays that
+     * were spent on every block to <tt>&lt;output&gt;.tilecost.exr</tt>
+     * (see \ref TileCostMap). Such a file can be passed to the next frame
+     * of an animation via \c tileCostPrediction, which then renders the
+     * blocks in the order of decreasing predicted cost.
+     *
+     * The \c primaryHitCache parameter specifies a file that is shared by
+     * several jobs rendering the same view (e.g. a beauty pass and a few
+     * \c field passes). The first job records the primary hit of every
+     * sample there, and the following ones reconstruct it instead of
+     * tracing the sensor rays (see \ref PrimaryHitCache). Since the sensor
+     * rays are then generated one at a time, \ref renderBlockStream()
+     * falls back to the default implementation in this case.
+     *
+     * When AOV output is enabled (\c aovs parameter of the path tracers),
+     * each sample additionally stores the first-hit quantities listed in
+     * \ref RadianceQueryRecord::EAOV into consecutive channels of a
+     * multi-channel film.
      */
     bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
         int sceneResID, int sensorResID, int samplerResID);
@@ -394,6 +496,43 @@ public:
         Sampler *sampler, ImageBlock *block, const bool &stop,
         const std::vector< TPoint2<uint8_t> > &points) const;
 
+    /**
+     * \brief Variant of \ref renderBlock(), which only takes the samples
+     * with indices <tt>firstSample, .., firstSample+sampleCount-1</tt>
+     * of the sampler's per-pixel sequence
+     *
+     * This is used by the progressive rendering mode, which advances all
+     * image blocks by a few samples per round. The default implementation
+     * is the one used by \ref renderBlock(). Integrators that override
+     * \ref renderBlock() should override this function as well, or they
+     * cannot be used in progressive mode.
+     */
+    virtual void renderBlockSamples(const Scene *scene, const Sensor *sensor,
+        Sampler *sampler, ImageBlock *block, const bool &stop,
+        const std::vector< TPoint2<uint8_t> > &points,
+        size_t firstSample, size_t sampleCount) const;
+
+    /**
+     * \brief Variant of \ref renderBlock(), which first generates the
+     * sensor rays of several neighboring pixels and then traces them
+     * together using \ref Scene::rayIntersectStream()
+     *
+     * This is meant for integrators whose \ref Li() implementation
+     * starts with \ref RadianceQueryRecord::rayIntersect() and spends
+     * a significant fraction of its time on the primary rays. Such
+     * integrators can simply forward their \ref renderBlock()
+     * implementation to this function. The sampler is re-initialized
+     * for each pixel after the rays of a batch have been traced, hence
+     * randomized samplers will use different (but equally distributed)
+     * values for the remaining sample dimensions. The parameters are
+     * the same as in \ref renderBlockSamples(); by default, all samples
+     * of the sampler are taken.
+     */
+    void renderBlockStream(const Scene *scene, const Sensor *sensor,
+        Sampler *sampler, ImageBlock *block, const bool &stop,
+        const std::vector< TPoint2<uint8_t> > &points,
+        size_t firstSample = 0, size_t sampleCount = (size_t) -1) const;
+
     /**
      * <tt>NetworkedObject</tt> implementation:
      * When a parallel rendering process starts, the integrator is
@@ -430,9 +569,46 @@ protected:
 
     /// Virtual destructor
     virtual ~SamplingIntegrator() { }
+
+    /**
+     * \brief Store a sensor sample in an image block
+     *
+     * When \c aovs is not \c NULL, the first-hit AOVs are written after
+     * the radiance, in which case \c temp must provide storage for
+     * <tt>(1 + EAOVCount) * SPECTRUM_SAMPLES + 2</tt> values.
+     *
+     * \return \c false if the sample was rejected by the block
+     */
+    static bool putSensorSample(ImageBlock *block, bool importanceSampled,
+        const Point2i &pixel, const Point2 &pos, Float filterWeight,
+        const Spectrum &spec, Float alpha, const Spectrum *aovs, Float *temp);
 protected:
     /// Used to temporarily cache a parallel process while it is in operation
     ref<ParallelProcess> m_process;
+
+    /* Image-space adaptive sampling (see render()) */
+    bool m_adaptiveSampling;
+    Float m_adaptiveRounds, m_adaptiveMaxError, m_adaptiveTimeLimit;
+    int m_adaptivePasses;
+
+    /* Progressive rendering (see render()) */
+    int m_progressiveSamples;
+    Float m_progressiveTimeLimit, m_progressiveMaxError;
+
+    /* Render region caching (see render()) */
+    bool m_regionCache, m_regionCacheReuse;
+    std::vector<std::string> m_regionCacheChanged;
+
+    /* Tile cost measurement and prediction (see render()) */
+    bool m_tileCost;
+    std::string m_tileCostPrediction;
+
+    /* Primary hits shared between jobs (see render()) */
+    std::string m_primaryHitCacheFile;
+    ref<PrimaryHitCache> m_primaryHits;
+
+    /// Write first-hit AOVs into additional film channels?
+    bool m_aovs;
 };
 
 /*
@@ -454,11 +630,36 @@ protected:
     MonteCarloIntegrator(Stream *stream, InstanceManager *manager);
     /// Virtual destructor
     virtual ~MonteCarloIntegrator() { }
+
+    /**
+     * \brief Propagate the ray cone of a path segment to its continuation
+     *
+     * When \c rayCones is enabled, this widens the footprint of \c prev
+     * until distance \c t, adds the angular spread of the scattering
+     * event that sampled the direction of \c ray with density \c pdf
+     * (solid angle), and stores the result as the differentials of \c ray.
+     * Texture lookups at the next intersection then use a footprint that
+     * matches the blur of the path and access coarser MIP map levels.
+     *
+     * \param delta
+     *     Was the direction sampled from a degenerate (e.g. specular)
+     *     component? In this case, the spread does not change.
+     */
+    inline void continueRayCone(const RayDifferential &prev, Float t,
+            bool delta, Float pdf, RayDifferential &ray) const {
+        if (!m_rayCones || !prev.hasDifferentials)
+            return;
+        Float spread = prev.getConeSpread();
+        if (!delta && pdf > 0)
+            spread += std::min(std::sqrt(INV_PI / pdf), (Float) 1.0f);
+        ray.setCone(prev.getConeWidth(t), spread);
+    }
 protected:
     int m_maxDepth;
     int m_rrDepth;
     bool m_strictNormals;
     bool m_hideEmitters;
+    bool m_rayCones;
 };
 
 MTS_NAMESPACE_END
@@ -117,6 +117,7 @@ private:
     uint32_t m_M, m_N;
     SampleEntry *m_entries;
     Vector *m_uk, *m_vk, *m_vkMinus;
+    Point2 *m_samples, *m_disk;
     Spectrum m_E;
     RotationalGradient m_rGrad;
     TranslationalGradient m_tGrad;
@@ -163,6 +164,18 @@ public:
      */
     IrradianceCache(Stream *stream, InstanceManager *manager);
 
+    /**
+     * \brief Create a copy of another irradiance cache
+     *
+     * \param sensor
+     *      When specified, the screen-space clamping of the copied records,
+     *      which depends on the sensor that was used to create them, is
+     *      recomputed for this sensor. This allows reusing the records when
+     *      rendering the scene from another viewpoint (e.g. in the next
+     *      frame of an animation).
+     */
+    IrradianceCache(const IrradianceCache *cache, const Sensor *sensor = NULL);
+
     /**
      * Set the quality parameter \kappa from the
      * Tabellion and Lamorlette paper. Once samples
@@ -212,9 +225,19 @@ public:
      */
     bool get(const Intersection &its, Spectrum &E) const;
 
-    /// Manually insert an irradiance record
+    /**
+     * \brief Manually insert an irradiance record
+     *
+     * This is lock-free and can be called from several threads at once.
+     */
     void insert(Record *rec);
 
+    /// Return the number of stored records
+    size_t getRecordCount() const;
+
+    /// Return the bounding box of the cache
+    inline const AABB &getAABB() const { return m_octree.getAABB(); }
+
     /**
      * Serialize an irradiance cache to a binary data stream
      */
@@ -330,12 +353,12 @@ protected:
     /* ===================================================================== */
 
     DynamicOctree<Record *> m_octree;
-    std::vector<Record *> m_records;
+    /* All records, i.e. the storage owned by the cache */
+    LockFreeList<Record *> m_records;
     Float m_kappa;
     Float m_sceneSize;
     Float m_minDist, m_maxDist;
     bool m_clampScreen, m_clampNeighbor, m_useGradients;
-    ref<Mutex> m_mutex;
 };
 
 MTS_NAMESPACE_END
@@ -0,0 +1,140 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_LIGHTTREE_H_)
+#define __MITSUBA_RENDER_LIGHTTREE_H_
+
+#include <mitsuba/render/vpl.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Binary tree over a set of virtual point lights, which is used
+ * to evaluate their illumination at sub-linear cost
+ *
+ * This implements the \a lightcuts technique by Walter et al. Every node
+ * of the tree represents a cluster of VPLs by a single representative VPL
+ * of the cluster, whose contribution is scaled by the ratio of the total
+ * intensity of the cluster to its own. When shading a point, a \a cut
+ * through the tree is refined starting from the root(s): the cluster with
+ * the largest upper bound on its error is replaced by its children until
+ * all bounds are below a fraction of the total estimate. Since the
+ * representative of a cluster is also the representative of one of its
+ * children, every refinement only costs a single new shadow ray.
+ *
+ * VPLs with a position (surface and point emitter VPLs) and directional
+ * VPLs are stored in two separate trees. The clusters are bounded by the
+ * box of their positions (or directions) and a cone of their normals.
+ * The bound of the receiving material is exact for diffuse BSDFs and
+ * approximated for all other materials.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER LightTree : public Object {
+public:
+    /**
+     * \brief Build a light tree over the given VPLs
+     *
+     * \param random
+     *     Random number generator used to choose the representative
+     *     VPLs of the clusters (proportional to their intensity)
+     */
+    LightTree(const std::deque<VPL> &vpls, Random *random);
+
+    /**
+     * \brief Estimate the radiance reflected at \c its towards
+     * <tt>its.wi</tt> due to all VPLs
+     *
+     * \param relError
+     *     Upper bound on the error of every cluster relative to the total
+     *     estimate. Zero evaluates every VPL separately.
+     * \param maxCutSize
+     *     Upper bound on the number of clusters of the cut
+     * \param minDist
+     *     Distances between VPLs and the shading point are clamped to
+     *     at least this value to avoid singularities
+     */
+    Spectrum eval(const Scene *scene, const Intersection &its,
+        Float relError, size_t maxCutSize, Float minDist) const;
+
+    /// Return the number of VPLs
+    inline size_t getVPLCount() const { return m_vpls.size(); }
+
+    /// Return the number of nodes in the tree
+    inline size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Return a human-readable string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~LightTree() { }
+private:
+    struct Node {
+        /// Positions (or propagation directions) of the VPLs
+        AABB aabb;
+        /// Axis of the cone of VPL normals
+        Vector axis;
+        /// Spread of the cone of normals
+        Float cosThetaO, sinThetaO;
+        /// Total intensity
+        Spectrum intensity;
+        /// Representative VPL
+        uint32_t vpl;
+        /// Right child (the left one directly follows its parent), zero for leaves
+        uint32_t right;
+    };
+
+    /// VPL along with data needed by the tree
+    struct Light {
+        VPL vpl;
+        /// Intensity along the normal (excluding the cosine falloff)
+        Spectrum intensity;
+        /// Does the VPL emit proportionally to the cosine of its normal?
+        bool oriented;
+
+        inline Light(const VPL &vpl) : vpl(vpl) { }
+    };
+
+    struct Primitive;
+    struct AxisPredicate;
+    struct CutEntry;
+
+    /// Recursively build the subtree over <tt>[start, end)</tt>
+    uint32_t build(std::vector<Primitive> &prims, size_t start,
+        size_t end, bool directional, Float normalScale, Random *random);
+
+    /// Evaluate the contribution of a single VPL (including visibility)
+    Spectrum evalLight(const Scene *scene, const Intersection &its,
+        const BSDF *bsdf, const Light &light, Float minDist2) const;
+
+    /// Upper bound on the contribution of any VPL of a cluster
+    Float errorBound(const Intersection &its, const BSDF *bsdf,
+        const Node &node, bool directional, Float minDist2) const;
+
+    std::vector<Light> m_vpls;
+    std::vector<Node> m_nodes;
+    /// Roots of the two trees, or -1 when empty
+    int m_root, m_directionalRoot;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_LIGHTTREE_H_ */
@@ -208,6 +208,77 @@ protected:
     Spectrum m_sigmaT;
 };
 
+/**
+ * \brief Accumulates the transmittance along a chain of ray segments
+ * that are separated by index-matched medium boundaries
+ *
+ * Segments inside homogeneous media only add to an optical depth, which
+ * is exponentiated once when \ref get() is called. This avoids a virtual
+ * \ref Medium::evalTransmittance() call and an exponential per segment.
+ * Whether the current medium is homogeneous and its extinction coefficient
+ * are cached until \ref setMedium() is called.
+ *
+ * \ingroup librender
+ */
+struct TransmittanceAccumulator {
+    /// Create an accumulator starting inside the given medium (or \c NULL)
+    inline TransmittanceAccumulator(const Medium *medium)
+        : m_transmittance(1.0f), m_medium(NULL), m_opticalDepth(0.0f) {
+        setMedium(medium);
+    }
+
+    /// Switch to another medium (e.g. after crossing a boundary)
+    inline void setMedium(const Medium *medium) {
+        if (medium == m_medium && medium != NULL)
+            return;
+        m_medium = medium;
+        m_homogeneous = medium && medium->isHomogeneous();
+        if (m_homogeneous)
+            m_sigmaT = medium->getSigmaT();
+    }
+
+    /// Return the current medium
+    inline const Medium *getMedium() const { return m_medium; }
+
+    /// Account for the segment [ray.mint, ray.maxt] within the current medium
+    inline void append(const Ray &ray, Sampler *sampler) {
+        if (!m_medium)
+            return;
+        if (m_homogeneous) {
+            Float length = ray.maxt - ray.mint;
+            for (int i=0; i<SPECTRUM_SAMPLES; ++i) {
+                if (m_sigmaT[i] != 0)
+                    m_opticalDepth[i] += m_sigmaT[i] * length;
+            }
+        } else {
+            m_transmittance *= m_medium->evalTransmittance(ray, sampler);
+        }
+    }
+
+    /// Multiply by another factor (e.g. the transmission of a null BSDF)
+    inline void scale(const Spectrum &value) { m_transmittance *= value; }
+
+    /// Check whether a factor or heterogeneous segment was fully opaque
+    inline bool isZero() const { return m_transmittance.isZero(); }
+
+    /// Return the transmittance of all segments so far
+    inline Spectrum get() const {
+        Spectrum result(m_transmittance);
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i) {
+            if (m_opticalDepth[i] != 0)
+                result[i] *= math::fastexp(-m_opticalDepth[i]);
+        }
+        return result;
+    }
+
+private:
+    Spectrum m_transmittance;
+    const Medium *m_medium;
+    bool m_homogeneous;
+    Spectrum m_sigmaT;
+    Spectrum m_opticalDepth;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_RENDER_MEDIUM_H_ */
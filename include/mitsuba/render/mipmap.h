@@ -23,9 +23,12 @@
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/rfilter.h>
 #include <mitsuba/core/barray.h>
+#include <mitsuba/core/bcarray.h>
 #include <mitsuba/core/mmap.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/render/tilecache.h>
 #include <boost/filesystem/fstream.hpp>
 
 MTS_NAMESPACE_BEGIN
@@ -37,7 +40,7 @@ MTS_NAMESPACE_BEGIN
 #define MTS_MIPMAP_LUT_SIZE 64
 
 /// MIP map cache file version
-#define MTS_MIPMAP_CACHE_VERSION 0x01
+#define MTS_MIPMAP_CACHE_VERSION 0x02
 
 /// Make sure that the actual cache contents start on a cache line
 #define MTS_MIPMAP_CACHE_ALIGNMENT 64
@@ -74,7 +77,15 @@ enum EMIPFilterType {
  * anisotropy of texture lookups in UV space.
  *
  * Generating good mip maps is costly, and therefore this class provides
- * the means to cache them on disk if desired.
+ * the means to cache them on disk if desired. Cache files can either be
+ * memory-mapped as a whole, or be paged in on demand through the global
+ * \ref TextureTileCache, which bounds the memory that is spent on the
+ * texture data of all MIP maps of a scene.
+ *
+ * Optionally, the levels can be stored in a block-compressed format
+ * (\ref CompressedBlockArray), which reduces their memory and cache file
+ * footprint by a factor of 4.8 (RGB) at the cost of a slight loss of
+ * precision. Compressed texels are decoded on the fly during lookups.
  *
  * \tparam Value
  *    This class can be parameterized to yield MIP map classes for
@@ -98,6 +109,16 @@ public:
     typedef LinearArray<QuantizedValue> Array2DType;
 #endif
 
+#if MTS_MIPMAP_BLOCKED == 1
+    /// Base-2 logarithm of the edge length of a contiguously stored block
+    static const int StorageShift = 2;
+#else
+    static const int StorageShift = 0;
+#endif
+
+    /// Block-compressed storage of MIP map data
+    typedef CompressedBlockArray<Value> CompressedArray2DType;
+
     /// Shortcut
     typedef ReconstructionFilter::EBoundaryCondition EBoundaryCondition;
 
@@ -151,6 +172,10 @@ public:
      *    When an RGB image is transformed into a spectral representation,
      *    this parameter specifies what conversion method should be used.
      *    See \ref Spectrum::EConversionIntent for further details.
+     *
+     * \param compressed
+     *    Store the MIP levels in a block-compressed format
+     *    (see \ref CompressedBlockArray)
      */
     TMIPMap(Bitmap *bitmap_,
             Bitmap::EPixelFormat pixelFormat,
@@ -163,12 +188,15 @@ public:
             fs::path cacheFilename = fs::path(),
             uint64_t timestamp = 0,
             Float maxValue = 1.0f,
-            Spectrum::EConversionIntent intent = Spectrum::EReflectance)
+            Spectrum::EConversionIntent intent = Spectrum::EReflectance,
+            bool compressed = false)
         : m_pixelFormat(pixelFormat), m_bcu(bcu), m_bcv(bcv), m_filterType(filterType),
-          m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy) {
+          m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy), m_compressedPyramid(NULL),
+          m_tileFile(0) {
 
         /* Keep track of time */
         ref<Timer> timer = new Timer();
+        ScopedPhase phase("Create MIP map");
 
         /* Compute the size of the MIP map cache file (for now
            assuming that one should be created) */
@@ -176,7 +204,7 @@ public:
         if (padding)
             padding = MTS_MIPMAP_CACHE_ALIGNMENT - padding;
         size_t cacheSize = sizeof(MIPMapHeader) + padding +
-            Array2DType::bufferSize(bitmap_->getSize());
+            getLevelBufferSize(bitmap_->getSize(), compressed);
 
         /* 1. Determine the number of MIP levels. The following
               code also handles non-power-of-2 input. */
@@ -186,13 +214,17 @@ public:
             while (size.x > 1 || size.y > 1) {
                 size.x = std::max(1, (size.x + 1) / 2);
                 size.y = std::max(1, (size.y + 1) / 2);
-                cacheSize += Array2DType::bufferSize(size);
+                cacheSize += getLevelBufferSize(size, compressed);
                 ++m_levels;
             }
         }
 
         stats::mipStorage += cacheSize;
 
+        /* Without a cache file, the pyramid is stored on the heap */
+        if (cacheFilename.empty())
+            m_memory.set(cacheSize);
+
         /* Potentially create a MIP map cache file */
         uint8_t *mmapData = NULL, *mmapPtr = NULL;
         if (!cacheFilename.empty()) {
@@ -211,32 +243,33 @@ public:
         /* 2. Store the base image in a suitable memory layout */
         m_pyramid = new Array2DType[m_levels];
         m_sizeRatio = new Vector2[m_levels];
+        if (compressed)
+            m_compressedPyramid = new CompressedArray2DType[m_levels];
 
         /* Allocate memory for the first MIP map level */
-        if (mmapPtr) {
+        if (mmapPtr)
             mmapPtr += sizeof(MIPMapHeader) + padding;
-            m_pyramid[0].map(mmapPtr, bitmap_->getSize());
-            mmapPtr += m_pyramid[0].getBufferSize();
-        } else {
-            m_pyramid[0].alloc(bitmap_->getSize());
-        }
+        allocLevel(0, bitmap_->getSize(), mmapPtr);
 
         /* Initialize the first mip map level and extract some general
            information (i.e. the minimum, maximum, and average texture value) */
         ref<Bitmap> bitmap = bitmap_->expand()->convert(pixelFormat,
             componentFormat, 1.0f, 1.0f, intent);
 
-        m_pyramid[0].cleanup();
-        m_pyramid[0].init((Value *) bitmap->getData(), m_minimum, m_maximum, m_average);
+        initLevel(0, (Value *) bitmap->getData(), true);
 
         if (m_minimum.min() < 0) {
             Log(EWarn, "The texture contains negative pixel values! These will be clamped!");
             Value *value = (Value *) bitmap->getData();
+            ssize_t count = (ssize_t) bitmap->getPixelCount();
 
-            for (size_t i=0, count=bitmap->getPixelCount(); i<count; ++i)
-                (*value++).clampNegative();
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for schedule(static)
+            #endif
+            for (ssize_t i=0; i<count; ++i)
+                value[i].clampNegative();
 
-            m_pyramid[0].init((Value *) bitmap->getData(), m_minimum, m_maximum, m_average);
+            initLevel(0, (Value *) bitmap->getData(), true);
         }
 
         m_sizeRatio[0] = Vector2(1, 1);
@@ -251,16 +284,10 @@ public:
                 size.y = std::max(1, (size.y + 1) / 2);
 
                 /* Either allocate memory or index into the memory map file */
-                if (mmapPtr) {
-                    m_pyramid[m_levels].map(mmapPtr, size);
-                    mmapPtr += m_pyramid[m_levels].getBufferSize();
-                } else {
-                    m_pyramid[m_levels].alloc(size);
-                }
+                allocLevel(m_levels, size, mmapPtr);
 
                 bitmap = bitmap->resample(rfilter, bcu, bcv, size, 0.0f, maxValue);
-                m_pyramid[m_levels].cleanup();
-                m_pyramid[m_levels].init((Value *) bitmap->getData());
+                initLevel(m_levels, (Value *) bitmap->getData(), false);
                 m_sizeRatio[m_levels] = Vector2(
                     (Float) size.x / (Float) m_pyramid[0].getWidth(),
                     (Float) size.y / (Float) m_pyramid[0].getHeight());
@@ -280,6 +307,7 @@ public:
             header.bcu = (uint8_t) bcu;
             header.bcv = (uint8_t) bcv;
             header.filterType = (uint8_t) m_filterType;
+            header.compressed = compressed ? 1 : 0;
             header.gamma = (float) bitmap_->getGamma();
             header.width = bitmap_->getWidth();
             header.height = bitmap_->getHeight();
@@ -315,19 +343,38 @@ public:
      *    kernel. This is necessary to bound the computational
      *    cost of filtered lookups. This parameter is independent of the
      *    cache file that was previously created.
+     *
+     * \param outOfCore
+     *    Instead of memory-mapping the whole file, load tiles of the
+     *    MIP levels on demand through the global \ref TextureTileCache.
+     *    This bounds the resident memory, at the cost of slightly more
+     *    expensive texel lookups. In this mode, \ref getArray() returns
+     *    arrays without any storage.
      */
-    TMIPMap(fs::path cacheFilename, Float maxAnisotropy = 20.0f)
-            : m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy) {
-        m_mmap = new MemoryMappedFile(cacheFilename);
-        uint8_t *mmapPtr = (uint8_t *) m_mmap->getData();
-        Log(EInfo, "Mapped MIP map cache file \"%s\" into memory (%s).", cacheFilename.string().c_str(),
-            memString(m_mmap->getSize()).c_str());
+    TMIPMap(fs::path cacheFilename, Float maxAnisotropy = 20.0f,
+            bool outOfCore = false) : m_weightLut(NULL),
+            m_maxAnisotropy(maxAnisotropy), m_compressedPyramid(NULL), m_tileFile(0) {
+        MIPMapHeader header;
+        uint8_t *mmapPtr = NULL;
 
-        stats::mipStorage += m_mmap->getSize();
+        if (outOfCore) {
+            ref<FileStream> fs = new FileStream(cacheFilename, FileStream::EReadOnly);
+            fs->read(&header, sizeof(MIPMapHeader));
+            Log(EInfo, "Opened MIP map cache file \"%s\" for out-of-core access (%s).",
+                cacheFilename.string().c_str(), memString(fs->getSize()).c_str());
+        } else {
+            m_mmap = new MemoryMappedFile(cacheFilename);
+            mmapPtr = (uint8_t *) m_mmap->getData();
+            Log(EInfo, "Mapped MIP map cache file \"%s\" into memory (%s).", cacheFilename.string().c_str(),
+                memString(m_mmap->getSize()).c_str());
 
-        /* Load the file header, and run some santity checks */
-        MIPMapHeader header;
-        memcpy(&header, mmapPtr, sizeof(MIPMapHeader));
+            stats::mipStorage += m_mmap->getSize();
+
+            /* Load the file header */
+            memcpy(&header, mmapPtr, sizeof(MIPMapHeader));
+        }
+
+        /* Run some santity checks on the header */
         Assert(header.identifier[0] == 'M' && header.identifier[1] == 'I'
             && header.identifier[2] == 'P' && header.version == MTS_MIPMAP_CACHE_VERSION);
         m_pixelFormat = (Bitmap::EPixelFormat) header.pixelFormat;
@@ -343,14 +390,22 @@ public:
         size_t padding = sizeof(MIPMapHeader) % MTS_MIPMAP_CACHE_ALIGNMENT;
         if (padding)
             padding = MTS_MIPMAP_CACHE_ALIGNMENT - padding;
-        mmapPtr += sizeof(MIPMapHeader) + padding;
+        if (mmapPtr)
+            mmapPtr += sizeof(MIPMapHeader) + padding;
 
         /* Map the highest resolution level */
+        std::vector<TextureTileCache::LevelInfo> levels;
+        uint64_t offset = sizeof(MIPMapHeader) + padding;
         m_pyramid = new Array2DType[m_levels];
         m_sizeRatio = new Vector2[m_levels];
+        if (header.compressed)
+            m_compressedPyramid = new CompressedArray2DType[m_levels];
         Vector2i size(header.width, header.height);
-        m_pyramid[0].map(mmapPtr, size);
-        mmapPtr += m_pyramid[0].getBufferSize();
+        size_t levelSize = mapLevel(0, size, mmapPtr);
+        levels.push_back(TextureTileCache::LevelInfo(offset, getStorageCells(size)));
+        offset += levelSize;
+        if (mmapPtr)
+            mmapPtr += levelSize;
         m_sizeRatio[0] = Vector2(1, 1);
 
         if (m_filterType != ENearest && m_filterType != EBilinear) {
@@ -359,15 +414,33 @@ public:
             while (size.x > 1 || size.y > 1) {
                 size.x = std::max(1, (size.x + 1) / 2);
                 size.y = std::max(1, (size.y + 1) / 2);
-                m_pyramid[level].map(mmapPtr, size);
+                levelSize = mapLevel(level, size, mmapPtr);
                 m_sizeRatio[level] = Vector2(
                     (Float) size.x / (Float) m_pyramid[0].getWidth(),
                     (Float) size.y / (Float) m_pyramid[0].getHeight());
-                mmapPtr += m_pyramid[level++].getBufferSize();
+                levels.push_back(TextureTileCache::LevelInfo(offset, getStorageCells(size)));
+                offset += levelSize;
+                if (mmapPtr)
+                    mmapPtr += levelSize;
+                ++level;
             }
             Assert(level == m_levels);
         }
 
+        if (outOfCore) {
+            TextureTileCache *cache = TextureTileCache::getInstance();
+            if (!cache)
+                Log(EError, "The texture tile cache has not been initialized!");
+            if (m_compressedPyramid)
+                m_tileFile = cache->registerFile(cacheFilename,
+                    sizeof(typename CompressedArray2DType::Block),
+                    MTS_TILECACHE_TILE_SHIFT - CompressedArray2DType::blockShift, levels);
+            else
+                m_tileFile = cache->registerFile(cacheFilename,
+                    sizeof(QuantizedValue) << (2*StorageShift),
+                    MTS_TILECACHE_TILE_SHIFT - StorageShift, levels);
+        }
+
         if (m_filterType == EEWA) {
             m_weightLut = static_cast<Float *>(allocAligned(sizeof(Float) * MTS_MIPMAP_LUT_SIZE));
             for (int i=0; i<MTS_MIPMAP_LUT_SIZE; ++i) {
@@ -379,7 +452,10 @@ public:
 
     /// Release all memory
     ~TMIPMap() {
+        if (m_tileFile && TextureTileCache::getInstance())
+            TextureTileCache::getInstance()->unregisterFile(m_tileFile);
         delete[] m_pyramid;
+        delete[] m_compressedPyramid;
         delete[] m_sizeRatio;
         if (m_weightLut)
             freeAligned(m_weightLut);
@@ -400,11 +476,14 @@ public:
      * \param gamma
      *    If nonzero, it is verified that the provided gamma value
      *    matches that of the cache file.
+     * \param compressed
+     *    Whether the MIP levels should be block-compressed
      * \return \c true if the texture file is good for use
      */
     static bool validateCacheFile(const fs::path &path, uint64_t timestamp,
             Bitmap::EPixelFormat pixelFormat, EBoundaryCondition bcu,
-            EBoundaryCondition bcv, EMIPFilterType filterType, Float gamma) {
+            EBoundaryCondition bcv, EMIPFilterType filterType, Float gamma,
+            bool compressed = false) {
         fs::ifstream is(path);
         if (!is.good())
             return false;
@@ -419,7 +498,8 @@ public:
             || header.timestamp != timestamp
             || header.bcu != (uint8_t) bcu || header.bcv != (uint8_t) bcv
             || header.pixelFormat != (uint8_t) pixelFormat
-            || header.filterType != (uint8_t) filterType)
+            || header.filterType != (uint8_t) filterType
+            || header.compressed != (compressed ? 1 : 0))
             return false;
 
         if (gamma != 0 && (float) gamma != header.gamma)
@@ -432,13 +512,13 @@ public:
 
         Vector2i size(header.width, header.height);
         size_t expectedFileSize = sizeof(MIPMapHeader) + padding
-            + Array2DType::bufferSize(size);
+            + getLevelBufferSize(size, compressed);
 
         if (filterType != ENearest && filterType != EBilinear) {
             while (size.x > 1 || size.y > 1) {
                 size.x = std::max(1, (size.x + 1) / 2);
                 size.y = std::max(1, (size.y + 1) / 2);
-                expectedFileSize += Array2DType::bufferSize(size);
+                expectedFileSize += getLevelBufferSize(size, compressed);
             }
         }
 
@@ -449,7 +529,8 @@ public:
     size_t getBufferSize() const {
         size_t size = 0;
         for (int i=0; i<m_levels; ++i)
-            size += m_pyramid[i].getBufferSize();
+            size += m_compressedPyramid ? m_compressedPyramid[i].getBufferSize()
+                : m_pyramid[i].getBufferSize();
         return size;
     }
 
@@ -477,7 +558,18 @@ public:
     /// Get the component-wise average
     inline const Value &getAverage() const { return m_average; }
 
-    /// Return the blocked array used to store a given MIP level
+    /// Return whether texels are paged in through the \ref TextureTileCache
+    inline bool isOutOfCore() const { return m_tileFile != 0; }
+
+    /// Return whether the MIP levels are block-compressed
+    inline bool isCompressed() const { return m_compressedPyramid != NULL; }
+
+    /**
+     * \brief Return the blocked array used to store a given MIP level
+     *
+     * When the MIP map is compressed or out-of-core, the array
+     * has no storage and only describes the size of the level.
+     */
     inline const Array2DType &getArray(int level = 0) const {
         return m_pyramid[level];
     }
@@ -491,7 +583,18 @@ public:
             array.getSize()
         );
 
-        array.copyTo((QuantizedValue *) result->getData());
+        if (m_tileFile) {
+            /* Fetch the texels through the tile cache */
+            QuantizedValue *target = (QuantizedValue *) result->getData();
+            for (int y=0; y<array.getHeight(); ++y)
+                for (int x=0; x<array.getWidth(); ++x)
+                    *target++ = m_compressedPyramid ? QuantizedValue(
+                        lookupCompressedTile(level, x, y)) : lookupTile(level, x, y);
+        } else if (m_compressedPyramid) {
+            m_compressedPyramid[level].copyTo((QuantizedValue *) result->getData());
+        } else {
+            array.copyTo((QuantizedValue *) result->getData());
+        }
 
         return result;
     }
@@ -559,6 +662,13 @@ public:
             }
         }
 
+        if (EXPECT_NOT_TAKEN(m_tileFile != 0))
+            return m_compressedPyramid ? lookupCompressedTile(level, x, y)
+                : Value(lookupTile(level, x, y));
+
+        if (m_compressedPyramid)
+            return m_compressedPyramid[level](x, y);
+
         return Value(m_pyramid[level](x, y));
     }
 
@@ -625,6 +735,49 @@ public:
         gradient[1] = (p01 + p00*(dx-1) - tmp*dx) * static_cast<Float> (size.y);
     }
 
+    /**
+     * \brief Evaluate a filtered gradient of the texture
+     *
+     * Since the levels of the pyramid are prefiltered versions of the
+     * texture, the gradient of a level is the gradient of the filtered
+     * texture. This function picks two levels based on the footprint
+     * (like the trilinear filter of \ref eval()) and interpolates their
+     * bilinear gradients, which avoids the aliasing of the full-resolution
+     * gradient without any additional texture lookups.
+     */
+    void evalGradient(const Point2 &uv, const Vector2 &d0,
+            const Vector2 &d1, Value *gradient) const {
+        if (m_filterType == ENearest) {
+            /* Piecewise constant reconstruction */
+            gradient[0] = gradient[1] = Value(0.0f);
+            return;
+        } else if (m_filterType == EBilinear) {
+            evalGradientBilinear(0, uv, gradient);
+            return;
+        }
+
+        /* Approximate the major radius of the footprint in texels */
+        const Vector2i &size = m_pyramid[0].getSize();
+        Float du0 = d0.x * size.x, dv0 = d0.y * size.y,
+              du1 = d1.x * size.x, dv1 = d1.y * size.y;
+        Float majorRadius = std::sqrt(std::max(
+            du0*du0 + dv0*dv0, du1*du1 + dv1*dv1));
+
+        Float level = math::log2(std::max(majorRadius, Epsilon));
+        int ilevel = math::floorToInt(level);
+
+        if (!(level >= 0)) {
+            evalGradientBilinear(0, uv, gradient);
+        } else {
+            Value grad0[2], grad1[2];
+            Float a = level - ilevel;
+            evalGradientBilinear(ilevel,   uv, grad0);
+            evalGradientBilinear(ilevel+1, uv, grad1);
+            gradient[0] = grad0[0] * (1.0f - a) + grad1[0] * a;
+            gradient[1] = grad0[1] * (1.0f - a) + grad1[1] * a;
+        }
+    }
+
     /// \brief Perform a filtered texture lookup using the configured method
     Value eval(const Point2 &uv, const Vector2 &d0, const Vector2 &d1) const {
         if (m_filterType == ENearest)
@@ -721,7 +874,8 @@ public:
             << "   pixelFormat = " << m_pixelFormat << "," << endl
             << "   size = " << memString(getBufferSize()) << "," << endl
             << "   levels = " << m_levels << "," << endl
-            << "   cached = " << (m_mmap.get() ? "yes" : "no") << "," << endl
+            << "   cached = " << (m_mmap.get() ? "yes" : (m_tileFile ? "out-of-core" : "no")) << "," << endl
+            << "   compressed = " << (m_compressedPyramid ? "yes" : "no") << "," << endl
             << "   filterType = ";
 
         switch (m_filterType) {
@@ -750,6 +904,7 @@ protected:
         uint8_t bcu:4;
         uint8_t bcv:4;
         uint8_t filterType;
+        uint8_t compressed;
         float gamma;
         int width;
         int height;
@@ -760,6 +915,103 @@ protected:
     };
 
 
+    /// Return the size of the storage of a level in bytes
+    static size_t getLevelBufferSize(const Vector2i &size, bool compressed) {
+        return compressed ? CompressedArray2DType::bufferSize(size)
+            : Array2DType::bufferSize(size);
+    }
+
+    /// Return the number of contiguously stored blocks along each axis of a level
+    Vector2i getStorageCells(const Vector2i &size) const {
+        if (m_compressedPyramid)
+            return CompressedArray2DType::blockCount(size);
+        return Vector2i(
+            (size.x + (1 << StorageShift) - 1) >> StorageShift,
+            (size.y + (1 << StorageShift) - 1) >> StorageShift);
+    }
+
+    /**
+     * \brief Point a level at the given (possibly \c NULL) storage
+     * and return its size in bytes
+     */
+    size_t mapLevel(int level, const Vector2i &size, uint8_t *ptr) {
+        if (m_compressedPyramid) {
+            /* The uncompressed array only records the size */
+            m_pyramid[level].map(NULL, size);
+            m_compressedPyramid[level].map(ptr, size);
+            return m_compressedPyramid[level].getBufferSize();
+        } else {
+            m_pyramid[level].map(ptr, size);
+            return m_pyramid[level].getBufferSize();
+        }
+    }
+
+    /**
+     * \brief Allocate the storage of a level, or index into the memory
+     * mapped cache file (and advance \c mmapPtr) if there is one
+     */
+    void allocLevel(int level, const Vector2i &size, uint8_t *&mmapPtr) {
+        if (mmapPtr) {
+            mmapPtr += mapLevel(level, size, mmapPtr);
+        } else if (m_compressedPyramid) {
+            m_pyramid[level].map(NULL, size);
+            m_compressedPyramid[level].alloc(size);
+        } else {
+            m_pyramid[level].alloc(size);
+        }
+    }
+
+    /**
+     * \brief Store the (row-major) texels of a level and optionally
+     * collect the minimum, maximum, and average texture value
+     */
+    void initLevel(int level, const Value *data, bool statistics) {
+        if (m_compressedPyramid) {
+            if (statistics)
+                m_compressedPyramid[level].init(data, m_minimum, m_maximum, m_average);
+            else
+                m_compressedPyramid[level].init(data);
+        } else {
+            m_pyramid[level].cleanup();
+            if (statistics)
+                m_pyramid[level].init(data, m_minimum, m_maximum, m_average);
+            else
+                m_pyramid[level].init(data);
+        }
+    }
+
+    /// Fetch an in-bounds texel through the tile cache
+    inline const QuantizedValue &lookupTile(int level, int x, int y) const {
+        const int tileShift = MTS_TILECACHE_TILE_SHIFT - StorageShift,
+                  storageMask = (1 << StorageShift) - 1,
+                  tileMask = (1 << tileShift) - 1;
+        int bx = x >> StorageShift, by = y >> StorageShift;
+
+        const QuantizedValue *tile = (const QuantizedValue *)
+            TextureTileCache::getInstance()->lookup(m_tileFile, level,
+                bx >> tileShift, by >> tileShift);
+
+        size_t block = (size_t) ((bx & tileMask) + ((by & tileMask) << tileShift));
+        return tile[(block << (2*StorageShift))
+            + ((y & storageMask) << StorageShift) + (x & storageMask)];
+    }
+
+    /// Fetch and decode an in-bounds texel of a compressed level through the tile cache
+    inline Value lookupCompressedTile(int level, int x, int y) const {
+        typedef typename CompressedArray2DType::Block Block;
+        const int blockShift = CompressedArray2DType::blockShift,
+                  tileShift = MTS_TILECACHE_TILE_SHIFT - blockShift,
+                  tileMask = (1 << tileShift) - 1;
+        int bx = x >> blockShift, by = y >> blockShift;
+
+        const Block *tile = (const Block *)
+            TextureTileCache::getInstance()->lookup(m_tileFile, level,
+                bx >> tileShift, by >> tileShift);
+
+        return CompressedArray2DType::decode(
+            tile[(bx & tileMask) + ((by & tileMask) << tileShift)], x, y);
+    }
+
     /// Calculate the elliptically weighted average of a sample and associated Jacobian
     Value evalEWA(int level, const Point2 &uv, Float A, Float B, Float C) const {
         Assert(A > 0);
@@ -834,6 +1086,7 @@ protected:
     }
 private:
     ref<MemoryMappedFile> m_mmap;
+    TrackedMemory<EMemoryMIPMap> m_memory;
     Bitmap::EPixelFormat m_pixelFormat;
     EBoundaryCondition m_bcu, m_bcv;
     EMIPFilterType m_filterType;
@@ -841,10 +1094,12 @@ private:
     Float m_maxAnisotropy;
     Vector2 *m_sizeRatio;
     Array2DType *m_pyramid;
+    CompressedArray2DType *m_compressedPyramid;
     int m_levels;
     Value m_minimum;
     Value m_maximum;
     Value m_average;
+    uint32_t m_tileFile;
 };
 
 template <typename Value, typename QuantizedValue>
@@ -70,6 +70,47 @@ public:
      */
     static Float turbulence(const Point &p, const Vector &dpdx,
         const Vector &dpdy, Float omega, int maxOctaves);
+
+    /**
+     * \brief Return the (fractional) number of octaves that \ref fbm()
+     * and \ref turbulence() use for the given differentials
+     */
+    static Float getOctaveCount(const Vector &dpdx,
+        const Vector &dpdy, int maxOctaves);
+
+    //! @{ \name Batched evaluation
+    // =============================================================
+    /* The following functions evaluate the noise at a whole array of
+       points. When Mitsuba is compiled with SSE support, four points
+       are processed at a time. */
+
+    /// Evaluate \ref perlinNoise() at \c count points
+    static void perlinNoise(size_t count, const Point *p, Float *result);
+
+    /**
+     * \brief Evaluate \ref fbm() at \c count points, which share
+     * the same number of octaves
+     *
+     * \param octaves Fractional number of octaves, e.g. computed
+     *    using \ref getOctaveCount(). Passing \c maxOctaves matches
+     *    the scalar version without differentials.
+     */
+    static void fbm(size_t count, const Point *p, Float *result,
+        Float omega, Float octaves);
+
+    /**
+     * \brief Evaluate \ref turbulence() at \c count points, which
+     * share the same number of octaves
+     *
+     * \param octaves Fractional number of octaves, e.g. computed
+     *    using \ref getOctaveCount(). Passing \c maxOctaves matches
+     *    the scalar version without differentials.
+     */
+    static void turbulence(size_t count, const Point *p, Float *result,
+        Float omega, Float octaves);
+
+    //! @}
+    // =============================================================
 };
 
 MTS_NAMESPACE_END
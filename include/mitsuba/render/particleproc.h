@@ -227,6 +227,35 @@ public:
         bool delta, const MediumSamplingRecord &mRec, const Medium *medium,
         const Vector &wi, const Spectrum &weight);
 
+    /**
+     * \brief Handle the traversal of a ray segment through a medium
+     *
+     * To be overridden in a subclass. The default implementation
+     * does nothing. This event is delivered before a distance is
+     * sampled along the segment, which is useful for methods that
+     * store entire particle paths (e.g. photon beams).
+     *
+     * \param depth
+     *    Depth of the interaction at the end of the segment in path
+     *    space (with 1 corresponding to the first bounce)
+     * \param nullInteractions
+     *    Specifies how many of the preceding interactions were of type
+     *    BSDF::ENull (i.e. index-matched medium transitions)
+     * \param delta
+     *    Denotes if the previous scattering event was a degenerate
+     *    specular reflection or refraction.
+     * \param ray
+     *    Ray segment <tt>[mint, maxt]</tt> up to the next surface
+     *    (\c maxt is infinite if there is none)
+     * \param medium
+     *    Pointer to the current medium
+     * \param weight
+     *    Weight/power of the particle at the start of the segment
+     */
+    virtual void handleMediumSegment(int depth, int nullInteractions,
+        bool delta, const Ray &ray, const Medium *medium,
+        const Spectrum &weight);
+
     MTS_DECLARE_CLASS()
 protected:
     /// Protected constructor
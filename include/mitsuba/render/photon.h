@@ -36,15 +36,14 @@ MTS_NAMESPACE_BEGIN
 
 /// Internal data record used by \ref Photon
 struct PhotonData {
-#if defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
-    uint8_t power[4];       //!< Photon power stored in Greg Ward's RGBE format
-#else
-    Spectrum power;         //!< Accurate spectral photon power representation
-#endif
-    uint8_t theta;          //!< Discretized photon direction (\a theta component)
-    uint8_t phi;            //!< Discretized photon direction (\a phi component)
-    uint8_t thetaN;         //!< Discretized surface normal (\a theta component)
-    uint8_t phiN;           //!< Discretized surface normal (\a phi component)
+    /**
+     * \brief Photon power stored as 8-bit mantissas with a shared exponent
+     *
+     * With three spectral samples, this is Greg Ward's RGBE format.
+     */
+    uint8_t power[SPECTRUM_SAMPLES + 1];
+    uint8_t dir[2];         //!< Octahedral encoding of the photon direction
+    uint8_t normal[2];      //!< Octahedral encoding of the surface normal
     uint16_t depth;         //!< Photon depth (number of preceding interactions)
 };
 
@@ -81,40 +80,23 @@ public:
         return data.depth;
     }
 
-    /**
-     * Convert the photon direction from quantized spherical coordinates
-     * to a floating point vector value. Precomputation idea based on
-     * Jensen's implementation.
-     */
+    /// Convert the photon direction from its octahedral encoding
     inline Vector getDirection() const {
-        return Vector(
-            m_cosPhi[data.phi] * m_sinTheta[data.theta],
-            m_sinPhi[data.phi] * m_sinTheta[data.theta],
-            m_cosTheta[data.theta]
-        );
+        return decodeOctahedral(data.dir);
     }
 
-    /**
-     * Convert the normal direction from quantized spherical coordinates
-     * to a floating point vector value.
-     */
+    /// Convert the surface normal from its octahedral encoding
     inline Normal getNormal() const {
-        return Normal(
-            m_cosPhi[data.phiN] * m_sinTheta[data.thetaN],
-            m_sinPhi[data.phiN] * m_sinTheta[data.thetaN],
-            m_cosTheta[data.thetaN]
-        );
+        return Normal(decodeOctahedral(data.normal));
     }
 
-    /// Convert the photon power from RGBE to floating point
+    /// Convert the photon power from its shared exponent encoding
     inline Spectrum getPower() const {
-#if defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
         Spectrum result;
-        result.fromRGBE(data.power);
+        Float scale = m_expTable[data.power[SPECTRUM_SAMPLES]];
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            result[i] = data.power[i] * scale;
         return result;
-#else
-        return data.power;
-#endif
     }
 
     /// Serialize to a binary data stream
@@ -123,20 +105,33 @@ public:
     /// Return a string representation (for debugging)
     std::string toString() const;
 protected:
-    // ======================================================================
-    /// @{ \name Precomputed lookup tables
-    // ======================================================================
+    /**
+     * \brief Map a unit vector onto the octahedron and quantize
+     * the result to 8 bits per coordinate
+     *
+     * Compared to quantized spherical coordinates, this distributes
+     * the precision uniformly over the sphere and can be decoded
+     * without trigonometric functions.
+     */
+    static void encodeOctahedral(const Vector &v, uint8_t result[2]);
+
+    /// Convert an octahedral encoding back into a unit vector
+    inline static Vector decodeOctahedral(const uint8_t value[2]) {
+        Float x = value[0] * (2.0f / 255.0f) - 1.0f,
+              y = value[1] * (2.0f / 255.0f) - 1.0f,
+              z = 1.0f - std::abs(x) - std::abs(y);
+        if (z < 0) {
+            Float tx = x;
+            x = math::signum(x) * (1.0f - std::abs(y));
+            y = math::signum(y) * (1.0f - std::abs(tx));
+        }
+        return normalize(Vector(x, y, z));
+    }
 
-    static Float m_cosTheta[256];
-    static Float m_sinTheta[256];
-    static Float m_cosPhi[256];
-    static Float m_sinPhi[256];
+    /// Precomputed powers of two used to decode the photon power
     static Float m_expTable[256];
     static bool m_precompTableReady;
 
-    /// @}
-    // ======================================================================
-
     /// Initialize the precomputed lookup tables
     static bool createPrecompTables();
 };
@@ -170,7 +170,7 @@ public:
      * This has to be done once after all photons have been stored,
      * but prior to executing any queries.
      */
-    inline void build(bool recomputeAABB = false) { m_kdtree.build(recomputeAABB); }
+    void build(bool recomputeAABB = false);
 
     /// Return the depth of the constructed KD-tree
     inline size_t getDepth() const { return m_kdtree.getDepth(); }
@@ -74,6 +74,7 @@ public:
         return m_rangeEnd - m_rangeStart + 1;
     }
 
+    MTS_DECLARE_POOLED_ALLOCATION()
     MTS_DECLARE_CLASS()
 private:
     size_t m_rangeStart, m_rangeEnd;
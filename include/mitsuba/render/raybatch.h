@@ -0,0 +1,114 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_RAYBATCH_H_)
+#define __MITSUBA_RENDER_RAYBATCH_H_
+
+#include <mitsuba/core/sched.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Arrays of rays and intersection results processed by
+ * \ref RayBatchProcess
+ *
+ * All arrays are dense and owned by the caller. The output pointers
+ * may be \c NULL to skip the associated quantity.
+ *
+ * \ingroup librender
+ */
+struct RayBatch {
+    /// Number of rays
+    size_t count;
+    /// Ray origins (3 values per ray)
+    const Float *origins;
+    /// Ray directions (3 values per ray, need not be normalized)
+    const Float *directions;
+
+    /// Distance to the intersection, or infinity for rays that miss
+    Float *t;
+    /**
+     * \brief Index of the intersected shape into \ref Scene::getShapes(),
+     * or <tt>0xFFFFFFFF</tt> for rays that miss. Hits of an instanced
+     * shape refer to the instance.
+     */
+    uint32_t *shapeIndex;
+    /// Primitive index within the shape (e.g. triangle index), or <tt>0xFFFFFFFF</tt>
+    uint32_t *primIndex;
+    /// UV coordinates of the intersection (2 values per ray, zero for misses)
+    Float *uv;
+    /// Shading normal at the intersection (3 values per ray, zero for misses)
+    Float *normals;
+
+    inline RayBatch() : count(0), origins(NULL), directions(NULL), t(NULL),
+        shapeIndex(NULL), primIndex(NULL), uv(NULL), normals(NULL) { }
+};
+
+/**
+ * \brief Parallel process that intersects a large batch of rays with a
+ * scene (e.g. on behalf of the Python bindings)
+ *
+ * The rays are split into chunks that are traced by the scheduler's
+ * workers. The scene must be bound as the resource \c "scene" before the
+ * process is scheduled. Since every work unit carries its rays, remote
+ * workers can take part as well.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER RayBatchProcess : public ParallelProcess {
+public:
+    /**
+     * \brief Create a new ray batch process
+     *
+     * \param batch
+     *    Rays and output arrays (these must stay valid until the process
+     *    has finished)
+     * \param granularity
+     *    Number of rays per work unit
+     */
+    RayBatchProcess(const RayBatch &batch, size_t granularity = 4096);
+
+    /// Return the number of rays that were traced so far
+    inline size_t getFinishedCount() const { return m_finished; }
+
+    // ======================================================================
+    //! @{ \name Implementation of the ParallelProcess interface
+    // ======================================================================
+
+    ref<WorkProcessor> createWorkProcessor() const;
+    EStatus generateWork(WorkUnit *unit, int worker);
+    void processResult(const WorkResult *result, bool cancelled);
+
+    //! @}
+    // ======================================================================
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~RayBatchProcess() { }
+private:
+    RayBatch m_batch;
+    size_t m_granularity;
+    size_t m_nextRay, m_finished;
+    ref<Mutex> m_resultMutex;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_RAYBATCH_H_ */
@@ -118,29 +118,42 @@ inline bool RadianceQueryRecord::rayIntersect(const RayDifferential &ray) {
     /* Only search for an intersection if this was explicitly requested */
     if (type & EIntersection) {
         scene->rayIntersect(ray, its);
-        if (type & EOpacity) {
-            int unused = INT_MAX;
-
-            if (its.isValid()) {
-                if (EXPECT_TAKEN(!its.isMediumTransition()))
-                    alpha = 1.0f;
-                else
-                    alpha = 1-scene->evalTransmittance(its.p, true,
-                        ray(scene->getBSphere().radius*2), false,
-                        ray.time, its.getTargetMedium(ray.d), unused).average();
-            } else if (medium) {
-                alpha = 1-scene->evalTransmittance(ray.o, false,
+        processIntersection(ray);
+    }
+    return its.isValid();
+}
+
+inline bool RadianceQueryRecord::setIntersection(const RayDifferential &ray,
+        const Intersection &_its) {
+    if (type & EIntersection) {
+        its = _its;
+        processIntersection(ray);
+    }
+    return its.isValid();
+}
+
+inline void RadianceQueryRecord::processIntersection(const RayDifferential &ray) {
+    if (type & EOpacity) {
+        int unused = INT_MAX;
+
+        if (its.isValid()) {
+            if (EXPECT_TAKEN(!its.isMediumTransition()))
+                alpha = 1.0f;
+            else
+                alpha = 1-scene->evalTransmittance(its.p, true,
                     ray(scene->getBSphere().radius*2), false,
-                    ray.time, medium, unused).average();
-            } else {
-                alpha = 0.0f;
-            }
+                    ray.time, its.getTargetMedium(ray.d), unused).average();
+        } else if (medium) {
+            alpha = 1-scene->evalTransmittance(ray.o, false,
+                ray(scene->getBSphere().radius*2), false,
+                ray.time, medium, unused).average();
+        } else {
+            alpha = 0.0f;
         }
-        if (type & EDistance)
-            dist = its.t;
-        type ^= EIntersection; // unset the intersection bit
     }
-    return its.isValid();
+    if (type & EDistance)
+        dist = its.t;
+    type ^= EIntersection; // unset the intersection bit
 }
 
 inline Point2 RadianceQueryRecord::nextSample2D() {
@@ -152,7 +165,8 @@ inline Float RadianceQueryRecord::nextSample1D() {
 }
 
 inline PositionSamplingRecord::PositionSamplingRecord(const Intersection &its, EMeasure measure)
-    : p(its.p), time(its.time), n(its.shFrame.n), measure(measure), uv(its.uv), object(NULL) { }
+    : p(its.p), time(its.time), n(its.shFrame.n), measure(measure), uv(its.uv), object(NULL),
+      primIndex(its.primIndex) { }
 
 inline DirectionSamplingRecord::DirectionSamplingRecord(const Intersection &its, EMeasure measure)
     : d(its.toWorld(its.wi)), measure(measure) { }
@@ -172,6 +186,7 @@ void DirectSamplingRecord::setQuery(const Ray &ray, const Intersection &its, EMe
     n = its.shFrame.n;
     measure = _measure;
     uv = its.uv;
+    primIndex = its.primIndex;
     object = its.shape->getEmitter();
     d = ray.d;
     dist = its.t;
@@ -47,6 +47,7 @@ public:
 
     std::string toString() const;
 
+    MTS_DECLARE_POOLED_ALLOCATION()
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
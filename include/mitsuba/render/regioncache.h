@@ -0,0 +1,131 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_REGIONCACHE_H_)
+#define __MITSUBA_RENDER_REGIONCACHE_H_
+
+#include <mitsuba/render/imageblock.h>
+#include <mitsuba/core/lock.h>
+#include <boost/filesystem/path.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+/// Identifies render region cache files
+#define MTS_REGIONCACHE_MAGIC "MTS_REGIONCACHE"
+
+/// Version of the render region cache file format
+#define MTS_REGIONCACHE_VERSION 1
+
+/**
+ * \brief Stores the rendered image blocks of a scene along with the
+ * scene objects that their paths encountered
+ *
+ * When the same scene is rendered again after a small number of shapes
+ * or BSDFs were modified (e.g. while adjusting a material), only blocks
+ * whose \ref ObjectFootprint contains one of the modified objects must be
+ * rendered again. The remaining blocks are copied from the cache by
+ * \ref BlockedRenderProcess (see \ref BlockedRenderProcess::setRegionCache()).
+ *
+ * Caches are only interchangeable between renderings with the same film
+ * crop window, block size, pixel format and reconstruction filter.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER RenderRegionCache : public Object {
+public:
+    /**
+     * \brief Create an empty cache
+     *
+     * \param filter
+     *    Reconstruction filter of the film (determines the border size)
+     * \param pixelFormat
+     *    Pixel format of the image blocks
+     * \param channelCount
+     *    Number of channels of the image blocks
+     * \param offset
+     *    Offset of the rendered region (usually the film crop offset)
+     * \param size
+     *    Size of the rendered region
+     * \param blockSize
+     *    Edge length of the image blocks
+     */
+    RenderRegionCache(const ReconstructionFilter *filter,
+        Bitmap::EPixelFormat pixelFormat, int channelCount,
+        const Point2i &offset, const Vector2i &size, int blockSize);
+
+    /// Store a copy of an image block (it must have a footprint)
+    void put(const ImageBlock *block);
+
+    /**
+     * \brief Look up a cached block that can be reused
+     *
+     * \param offset
+     *    Offset of the block
+     * \param size
+     *    Size of the block
+     * \param changed
+     *    Footprints of the objects that were modified since the
+     *    cache was recorded
+     * \return The cached block, or \c NULL if none exists or if its
+     *    footprint contains one of the modified objects
+     */
+    const ImageBlock *lookup(const Point2i &offset, const Vector2i &size,
+        const std::vector<ObjectFootprint> &changed) const;
+
+    /// Return the number of cached blocks
+    size_t getBlockCount() const;
+
+    /**
+     * \brief Replace the contents of the cache with the blocks stored in a file
+     *
+     * \return \c false (and a warning is printed) if the file does not
+     *    exist, cannot be read, or was created using a different
+     *    configuration. The cache is left empty in this case.
+     */
+    bool load(const fs::path &filename);
+
+    /// Write the contents of the cache to a file
+    void save(const fs::path &filename) const;
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    typedef std::map<std::pair<int, int>, ref<ImageBlock> > BlockMap;
+
+    /// Virtual destructor
+    virtual ~RenderRegionCache() { }
+
+    /// Create an empty image block with the cache's configuration
+    ref<ImageBlock> createBlock() const;
+private:
+    ref<const ReconstructionFilter> m_filter;
+    Bitmap::EPixelFormat m_pixelFormat;
+    int m_channelCount;
+    Point2i m_offset;
+    Vector2i m_size;
+    int m_blockSize;
+    BlockMap m_blocks;
+    mutable ref<Mutex> m_mutex;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_REGIONCACHE_H_ */
@@ -110,6 +110,66 @@ public:
     /// Return the amount of time spent rendering the given job (in seconds)
     inline Float getRenderTime() const { return m_queue->getRenderTime(this); }
 
+    /**
+     * \brief Set the share of the scheduler's workers given to this job
+     *
+     * Jobs that are rendered concurrently divide the workers in
+     * proportion to their shares, e.g. a job with a share of 3 receives
+     * three times as many work units as a concurrent job with the default
+     * share of 1. Must be called before \ref start().
+     */
+    inline void setShare(Float share) { m_share = share; }
+
+    /// Return the share of the scheduler's workers given to this job
+    inline Float getShare() const { return m_share; }
+
+    // =============================================================
+    //! @{ \name Checkpointing
+    // =============================================================
+
+    /**
+     * \brief Set the interval (in seconds) between checkpoints
+     *
+     * When set to a positive value, integrators that support this feature
+     * periodically write their state to \ref getCheckpointFile(), and an
+     * existing checkpoint is used to resume an interrupted rendering. The
+     * checkpoint is removed once the job finishes successfully. The default
+     * is \c -1, which disables checkpoints.
+     */
+    inline void setCheckpointInterval(int interval) { m_checkpointInterval = interval; }
+
+    /// Return the interval (in seconds) between checkpoints
+    inline int getCheckpointInterval() const { return m_checkpointInterval; }
+
+    /// Return the path of the checkpoint file associated with this job
+    fs::path getCheckpointFile() const;
+
+    /**
+     * \brief Write a checkpoint if one is due
+     *
+     * Integrators should call this function whenever their state is
+     * consistent (e.g. between two passes). When checkpoints are enabled
+     * and the interval has elapsed (or when \c force is set), this writes
+     * a header followed by the output of \ref Integrator::saveCheckpoint().
+     * The file is replaced atomically, hence a crash while writing leaves
+     * the previous checkpoint intact.
+     */
+    void saveCheckpoint(const Integrator *integrator, bool force = false) const;
+
+    /**
+     * \brief Attempt to resume from an existing checkpoint
+     *
+     * Verifies that the checkpoint was created by the same integrator
+     * and for the same image and block size, and then invokes
+     * \ref Integrator::loadCheckpoint().
+     *
+     * \return \c true if the integrator state was restored
+     */
+    bool loadCheckpoint(Integrator *integrator) const;
+
+    //! @}
+    // =============================================================
+
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
@@ -125,6 +185,9 @@ private:
     bool m_ownsSamplerResource;
     bool m_cancelled;
     bool m_interactive;
+    int m_checkpointInterval;
+    mutable ref<Timer> m_checkpointTimer;
+    Float m_share;
 };
 
 MTS_NAMESPACE_END
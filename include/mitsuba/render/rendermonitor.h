@@ -0,0 +1,128 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_RENDERMONITOR_H_)
+#define __MITSUBA_RENDER_RENDERMONITOR_H_
+
+#include <mitsuba/render/renderqueue.h>
+#include <mitsuba/core/lock.h>
+#include <mitsuba/core/thread.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Render listener that periodically writes live progress
+ * metrics to a stream
+ *
+ * Every \c interval seconds, a background thread appends one line
+ * containing a JSON object to the stream (e.g. a \ref FileStream that
+ * was opened in append mode, or a \ref SocketStream). It holds
+ *
+ * - \c time: seconds since the monitor was created
+ * - \c queueDepth: number of jobs in the render queue
+ * - \c memory: resident, peak and tracked (\ref MemoryTracker) bytes
+ * - \c jobs: for every running job, the completed and in-flight
+ *   blocks, the rendered fraction of the film, the number of samples
+ *   per second, an estimate of the remaining time, and the time since
+ *   the last block was finished
+ * - \c nodes: for every machine, its worker and core count, the
+ *   blocks it finished in the last interval, and its utilization
+ *   (the fraction of its cores that held a block in the last interval)
+ *
+ * A final line with <tt>"finished": true</tt> is written when a job
+ * completes. The numbers are derived from the block events of the
+ * queue, hence integrators that don't render blocks (e.g. photon
+ * mapping passes) only show up in the queue depth and memory usage.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER RenderMonitor : public RenderListener {
+public:
+    /**
+     * \brief Create a monitor that reports to \c stream every
+     * \c interval seconds
+     *
+     * Register it with \ref RenderQueue::registerListener() and call
+     * \ref stop() once rendering has finished.
+     */
+    RenderMonitor(RenderQueue *queue, Stream *stream, Float interval = 1.0f);
+
+    /// Write a final report and shut down the background thread
+    void stop();
+
+    /// Write a report immediately
+    void report();
+
+    /* RenderListener implementation */
+    void workBeginEvent(const RenderJob *job, const RectangularWorkUnit *wu, int worker);
+    void workEndEvent(const RenderJob *job, const ImageBlock *block, bool cancelled);
+    void finishJobEvent(const RenderJob *job, bool cancelled);
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~RenderMonitor();
+
+    /// Append the report of one job to \c oss (called with the lock held)
+    void reportJob(std::ostringstream &oss, const RenderJob *job,
+        Float time, bool finished);
+private:
+    /// A block that has been handed out, but not yet been finished
+    struct InFlight {
+        const RenderJob *job;
+        Point2i offset;
+        int worker;
+        Float start;
+    };
+
+    struct JobRecord {
+        std::string name;
+        Float start, lastBlock;
+        size_t pixels, blocks;
+        size_t filmPixels, sampleCount;
+
+        inline JobRecord() : start(0), lastBlock(0), pixels(0),
+            blocks(0), filmPixels(0), sampleCount(0) { }
+    };
+
+    struct WorkerRecord {
+        Float busy;
+        size_t blocks;
+
+        inline WorkerRecord() : busy(0), blocks(0) { }
+    };
+
+    /// Credit the busy time of a block to its worker until \c time
+    void accountBusy(InFlight &block, Float time);
+
+    RenderQueue *m_queue;
+    ref<Stream> m_stream;
+    ref<Thread> m_thread;
+    ref<Timer> m_timer;
+    ref<Mutex> m_mutex;
+    std::map<const RenderJob *, JobRecord> m_jobs;
+    std::vector<InFlight> m_inFlight;
+    std::vector<WorkerRecord> m_workers;
+    Float m_lastReport;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_RENDERMONITOR_H_ */
@@ -23,6 +23,11 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/imageproc.h>
 #include <mitsuba/render/renderqueue.h>
+#include <mitsuba/render/regioncache.h>
+#include <mitsuba/render/tilecost.h>
+
+/// Maximum number of rendering rounds of a block per work unit in adaptive mode
+#define MTS_ADAPTIVE_UNIT_ROUNDS 4
 
 MTS_NAMESPACE_BEGIN
 
@@ -32,6 +37,19 @@ MTS_NAMESPACE_BEGIN
  * Splits an image into independent rectangular pixel regions, which are
  * then rendered in parallel.
  *
+ * The process optionally supports image-space adaptive sampling (see
+ * \ref setAdaptive()). In this mode, each block is rendered in several
+ * \a rounds, i.e. repeated invocations of \ref SamplingIntegrator::renderBlock()
+ * that each take the number of samples configured in the sampler. The rounds
+ * yield independent per-pixel estimates, whose variance is tracked in the
+ * variance buffer of the returned \ref ImageBlock. After a first pass that
+ * renders every block twice, the remaining budget is distributed over
+ * further passes, where each block receives rounds in proportion to its
+ * estimated relative error.
+ *
+ * Blocks can also be reused from a previous rendering of the same scene
+ * (see \ref setRegionCache()).
+ *
  * \sa SamplingIntegrator
  * \ingroup librender
  */
@@ -62,6 +80,89 @@ public:
     void setPixelFormat(Bitmap::EPixelFormat pixelFormat,
         int channelCount = -1, bool warnInvalid = false);
 
+    /**
+     * \brief Enable adaptive sampling
+     *
+     * This requires the default pixel format and a sampler that
+     * produces different samples every time a pixel is revisited
+     * (e.g. \c independent, \c stratified, or \c ldsampler).
+     *
+     * \param rounds
+     *    Average number of rendering rounds per block (at least 2).
+     *    Multiplied by the sampler's sample count, this gives the
+     *    average number of samples per pixel.
+     * \param passes
+     *    Number of passes, including the initial uniform one
+     * \param maxError
+     *    Blocks whose average relative standard error falls below this
+     *    value don't receive further samples, and the rendering stops
+     *    when all blocks have converged. Zero disables this criterion.
+     * \param timeLimit
+     *    No further passes are started after this many seconds. Zero
+     *    disables this criterion.
+     */
+    void setAdaptive(Float rounds, int passes, Float maxError, Float timeLimit);
+
+    /**
+     * \brief Enable progressive rendering
+     *
+     * In this mode, the image is rendered in rounds, where every block
+     * advances by the same number of samples per pixel. Each round
+     * renders the next range of sample indices of the sampler's per-pixel
+     * sequence (see \ref SamplingIntegrator::renderBlockSamples()), so
+     * the quality of the image improves uniformly until the sampler's
+     * sample count has been reached.
+     *
+     * \param samplesPerRound
+     *    Number of samples per pixel that each round adds
+     * \param sampleCount
+     *    Total number of samples per pixel
+     * \param timeLimit
+     *    No further rounds are started that are expected to
+     *    complete after this many seconds. Zero disables this criterion.
+     * \param maxError
+     *    The rendering stops once the average relative standard error of
+     *    the pixels falls below this value. This records the luminance
+     *    statistics of every sample and requires the default pixel format.
+     *    Zero disables this criterion.
+     */
+    void setProgressive(size_t samplesPerRound, size_t sampleCount,
+        Float timeLimit, Float maxError = 0);
+
+    /**
+     * \brief Reuse and record rendered blocks using render region caches
+     *
+     * Every rendered block records the shapes and BSDFs that its paths
+     * intersected (see \ref Scene::setFootprint()) and is stored in
+     * \c record. Blocks of \c previous, whose footprint contains none of
+     * the modified objects, are copied to the film instead of being
+     * rendered (they are also stored in \c record). This is not supported
+     * in combination with adaptive sampling or progressive rendering.
+     *
+     * \param previous
+     *    Cache of a previous rendering (or \c NULL)
+     * \param changed
+     *    Footprints of the objects that were modified since \c previous
+     *    was recorded
+     * \param record
+     *    Cache that receives the blocks of this rendering
+     */
+    void setRegionCache(const RenderRegionCache *previous,
+        const std::vector<ObjectFootprint> &changed, RenderRegionCache *record);
+
+    /// Return the number of blocks that were copied from the previous rendering
+    inline size_t getReusedBlockCount() const { return m_cacheReused; }
+
+    /**
+     * \brief Record the time, samples and rays spent on every block
+     *
+     * The workers measure the cost of each block they render, and the
+     * finished blocks are added to \c record. Blocks that are copied from
+     * a render region cache don't contribute. Passing \c NULL disables
+     * the measurement. Must be called before the process is scheduled.
+     */
+    inline void setTileCostRecord(TileCostMap *record) { m_costRecord = record; }
+
     // ======================================================================
     //! @{ \name Implementation of the ParallelProcess interface
     // ======================================================================
@@ -70,14 +171,64 @@ public:
     void processResult(const WorkResult *result, bool cancelled);
     void bindResource(const std::string &name, int id);
     EStatus generateWork(WorkUnit *unit, int worker);
+    EStatus generateWorkBatch(WorkUnit * const *units, size_t count,
+        size_t &generated, int worker);
 
     //! @}
     // ======================================================================
 
     MTS_DECLARE_CLASS()
 protected:
+    /// Per-block state of the adaptive sampling mode
+    struct AdaptiveBlock {
+        Point2i offset;
+        Vector2i size;
+        Float error;
+        Float carry;
+    };
+
     /// Virtual destructor
     virtual ~BlockedRenderProcess();
+
+    /// Enumerate the blocks and queue the initial pass (adaptive mode)
+    void initAdaptive();
+
+    /**
+     * \brief Estimate the remaining error and queue the next pass
+     * (adaptive mode, called with \c m_resultMutex held)
+     *
+     * \return \c false if the rendering is complete
+     */
+    bool planAdaptivePass();
+
+    /// Produce the next work unit of the current pass (adaptive mode)
+    EStatus nextAdaptiveBlock(WorkUnit *unit);
+
+    /// Add the variance buffer of a block to \ref m_variance and update the largest estimate count
+    void mergeVariance(const ImageBlock *block, uint32_t &maxCount);
+
+    /// Return the luminance below which relative errors are measured against a constant
+    Float errorBase() const;
+
+    /// Enumerate the blocks in \ref m_blocks (adaptive and progressive modes)
+    void enumerateBlocks();
+
+    /// Enumerate the blocks and start the first round (progressive mode)
+    void initProgressive();
+
+    /**
+     * \brief Start the next round (progressive mode, called
+     * with \c m_resultMutex held)
+     *
+     * \return \c false if the rendering is complete
+     */
+    bool planProgressiveRound();
+
+    /// Produce the next work unit of the current round (progressive mode)
+    EStatus nextProgressiveBlock(WorkUnit *unit);
+
+    /// Produce the next block that cannot be copied from the previous rendering
+    EStatus nextUncachedBlock(WorkUnit *unit, int worker);
 protected:
     ref<RenderQueue> m_queue;
     ref<Scene> m_scene;
@@ -90,6 +241,30 @@ protected:
     Bitmap::EPixelFormat m_pixelFormat;
     int m_channelCount;
     bool m_warnInvalid;
+
+    /* Adaptive sampling */
+    bool m_adaptive, m_adaptiveDone;
+    Float m_adaptiveRounds, m_maxError, m_timeLimit;
+    int m_passes, m_pass;
+    size_t m_roundsTotal, m_roundsLeft, m_roundsDone, m_outstanding;
+    std::vector<AdaptiveBlock> m_blocks;
+    std::deque<std::pair<uint32_t, uint32_t> > m_adaptiveQueue;
+    std::vector<Float> m_variance;
+    ref<Timer> m_adaptiveTimer;
+
+    /* Progressive rendering (shares the block list, variance buffer, timer and limits) */
+    bool m_progressive;
+    size_t m_roundSamples, m_totalSamples;
+    size_t m_roundFirstSample, m_roundCount, m_nextBlock;
+
+    /* Render region caching */
+    ref<const RenderRegionCache> m_cachePrevious;
+    ref<RenderRegionCache> m_cacheRecord;
+    std::vector<ObjectFootprint> m_cacheChanged;
+    size_t m_cacheReused;
+
+    /* Tile cost measurement */
+    ref<TileCostMap> m_costRecord;
 };
 
 MTS_NAMESPACE_END
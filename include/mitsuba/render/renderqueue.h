@@ -94,7 +94,13 @@ public:
     /// Releases resources held by recently finished jobs
     void join() const;
 
-    /// Cause all render jobs to write out the current image
+    /**
+     * \brief Cause all render jobs to write out the current image
+     *
+     * The queue is not locked while the images are developed and
+     * written, hence render workers (which report every finished block
+     * to the queue) keep running during intermediate dumps.
+     */
     void flush();
 
     /* Event distribution */
@@ -121,7 +127,7 @@ private:
 
     std::map<RenderJob *, JobRecord> m_jobs;
     mutable std::vector<RenderJob *> m_joinList;
-    mutable ref<Mutex> m_mutex, m_joinMutex;
+    mutable ref<Mutex> m_mutex, m_joinMutex, m_flushMutex;
     mutable ref<ConditionVariable> m_cond;
     ref<Timer> m_timer;
     std::vector<RenderListener *> m_listeners;
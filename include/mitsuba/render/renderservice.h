@@ -0,0 +1,202 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_RENDERSERVICE_H_)
+#define __MITSUBA_RENDER_RENDERSERVICE_H_
+
+#include <mitsuba/render/scenehandler.h>
+#include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/lock.h>
+#include <mitsuba/core/thread.h>
+#include <mitsuba/core/transform.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Parameters of a render request sent to a \ref RenderService
+ *
+ * Every field that is left at its default value is taken from the
+ * sensor, film and sampler of the loaded scene.
+ *
+ * \ingroup librender
+ */
+struct MTS_EXPORT_RENDER RenderRequest {
+    /// Should \ref toWorld replace the sensor transformation?
+    bool hasTransform;
+    /// Sensor-to-world transformation
+    Transform toWorld;
+    /// Field of view of a perspective sensor in degrees (or <tt>0</tt>)
+    Float fov;
+    /// Film resolution (or <tt>(0, 0)</tt>)
+    Vector2i size;
+    /// Offset of the film crop window
+    Point2i cropOffset;
+    /// Size of the film crop window (or <tt>(0, 0)</tt> for the whole film)
+    Vector2i cropSize;
+    /// Number of samples per pixel (or <tt>0</tt>)
+    int sampleCount;
+    /// Format of the returned image
+    Bitmap::EFileFormat fileFormat;
+
+    /// Create a request that renders the scene as it was loaded
+    inline RenderRequest() : hasTransform(false), fov(0), size(0),
+        cropOffset(0), cropSize(0), sampleCount(0),
+        fileFormat(Bitmap::EOpenEXR) { }
+
+    /// Unserialize a request from a binary data stream
+    RenderRequest(Stream *stream);
+
+    /// Serialize the request to a binary data stream
+    void serialize(Stream *stream) const;
+
+    /// Return a string representation
+    std::string toString() const;
+};
+
+/**
+ * \brief Keeps a set of scenes loaded and renders them on request
+ *
+ * The scenes are loaded once and stay resident along with their
+ * acceleration data structures, and each one is registered with the
+ * scheduler a single time, so that network rendering nodes receive it
+ * only once as well. A render request then only creates a new sensor,
+ * film and sampler, which removes the startup cost of a separate
+ * \c mitsuba invocation per image.
+ *
+ * Requests for the same scene are processed one at a time, since the
+ * integrator instance is shared between them. Different scenes can be
+ * rendered concurrently.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER RenderService : public Object {
+public:
+    /// Messages exchanged with a \ref RenderServiceConnection
+    enum EMessage {
+        /**
+         * Load a scene: name, filename, parameter count and
+         * (key, value) pairs. Replied by \ref ESuccess or \ref EFailure.
+         */
+        ELoadScene = 0,
+        /// Release a scene: name. Replied by \ref ESuccess or \ref EFailure
+        EUnloadScene,
+        /**
+         * Render a scene: name and a serialized \ref RenderRequest.
+         * Replied by \ref EImage or \ref EFailure.
+         */
+        ERender,
+        /// Close the connection
+        EQuit,
+        /// The request was successful
+        ESuccess,
+        /// The request failed: error message
+        EFailure,
+        /// Rendered image: render time, size in bytes and the encoded image
+        EImage
+    };
+
+    /// Create an empty render service
+    RenderService();
+
+    /**
+     * \brief Load a scene and keep it resident under the given name
+     *
+     * An existing scene with the same name is replaced. The kd-tree or
+     * BVH is built right away.
+     */
+    void loadScene(const std::string &name, const fs::path &filename,
+        const SceneHandler::ParameterMap &params = SceneHandler::ParameterMap());
+
+    /// Release a scene. Returns \c false if no such scene exists
+    bool unloadScene(const std::string &name);
+
+    /// Check whether a scene with the given name is loaded
+    bool hasScene(const std::string &name) const;
+
+    /**
+     * \brief Render a loaded scene and return the developed image
+     *
+     * \param renderTime
+     *    Receives the time spent rendering (in seconds)
+     */
+    ref<Bitmap> render(const std::string &name,
+        const RenderRequest &request, Float &renderTime);
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    struct SceneRecord {
+        ref<Scene> scene;
+        int resID;
+        ref<Mutex> mutex;
+    };
+
+    /// Virtual destructor
+    virtual ~RenderService();
+private:
+    std::map<std::string, SceneRecord> m_scenes;
+    mutable ref<Mutex> m_mutex;
+    int m_jobIndex;
+};
+
+/**
+ * \brief Answers the requests of one client of a \ref RenderService
+ *
+ * Reads messages of type \ref RenderService::EMessage from the stream
+ * until the client disconnects or sends \ref RenderService::EQuit.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER RenderServiceConnection : public Thread {
+public:
+    /**
+     * \brief Create a new connection thread
+     *
+     * \param name
+     *    Thread name
+     * \param service
+     *    Service that holds the loaded scenes
+     * \param stream
+     *    Stream used to communicate with the client
+     * \param detach
+     *    Should the thread be detached?
+     */
+    RenderServiceConnection(const std::string &name,
+        RenderService *service, Stream *stream, bool detach);
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~RenderServiceConnection() { }
+
+    void run();
+
+    /// Send an error message to the client
+    void sendError(const std::string &message);
+private:
+    ref<RenderService> m_service;
+    ref<Stream> m_stream;
+    bool m_detach;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_RENDERSERVICE_H_ */
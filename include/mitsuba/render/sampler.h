@@ -93,6 +93,23 @@ public:
      */
     virtual void setFilmResolution(const Vector2i &res, bool blocked);
 
+    /**
+     * \brief Announce the image block that is about to be rendered
+     *
+     * This function is called by the block-based renderer before it
+     * calls \ref generate() for the pixels of a block. Samplers which
+     * have to locate the samples of each pixel in the underlying sequence
+     * can use this hint to precompute this mapping for all pixels of the
+     * block at once and to reuse it when the same block is rendered
+     * again. The default implementation does nothing.
+     *
+     * \param offset
+     *    Offset of the block in pixels (as passed to \ref generate())
+     * \param size
+     *    Size of the block in pixels
+     */
+    virtual void setBlock(const Point2i &offset, const Vector2i &size);
+
     /**
      * \brief Generate new samples
      *
@@ -116,6 +133,25 @@ public:
     /// Retrieve the next two component values from the current sample
     virtual Point2 next2D() = 0;
 
+    /**
+     * \brief Retrieve the next \c count component values from the
+     * current sample
+     *
+     * This produces exactly the same values as calling \ref next1D()
+     * \c count times in a row, but it allows samplers to amortize their
+     * per-call overheads (e.g. locating the current sample within the
+     * underlying sequence) over a whole batch of dimensions. Integrators
+     * can use it to fetch all dimensions of a path vertex at once.
+     *
+     * The default implementation simply calls \ref next1D() repeatedly.
+     *
+     * \remark This function is currently not exposed by the Python API
+     */
+    virtual void next1DBatch(Float *values, size_t count);
+
+    /// Same as \ref next1DBatch(), but for \ref next2D()
+    virtual void next2DBatch(Point2 *values, size_t count);
+
     /**
      * \brief Retrieve the next 2D array of values from the current sample.
      *
@@ -25,6 +25,7 @@
 #include <mitsuba/core/aabb.h>
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/render/skdtree.h>
+#include <mitsuba/render/bvh.h>
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/bsdf.h>
@@ -33,9 +34,36 @@
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/volume.h>
 #include <mitsuba/render/phase.h>
+#include <mitsuba/render/emittertree.h>
+#include <mitsuba/render/footprint.h>
+#include <mitsuba/render/hotpath.h>
+#include <mitsuba/render/imageproc.h>
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Result of a ray intersection query whose detailed
+ * intersection record has not been computed yet
+ *
+ * \sa Scene::rayIntersect(const Ray &, DeferredIntersection &)
+ * \ingroup librender
+ */
+struct DeferredIntersection {
+    /// Traveled distance (infinity when nothing was intersected)
+    Float t;
+
+    /// Intersected shape (\c NULL when nothing was intersected)
+    const Shape *shape;
+
+    /// Data needed to compute the detailed intersection record
+    uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+
+    inline DeferredIntersection() : t(std::numeric_limits<Float>::infinity()), shape(NULL) { }
+
+    /// Was an intersection found?
+    inline bool isValid() const { return shape != NULL; }
+};
+
 /**
  * \brief Principal scene data structure
  *
@@ -80,6 +108,46 @@ public:
      */
     void invalidate();
 
+    /**
+     * \brief Apply the edits made to an initialized scene
+     *
+     * This supports incremental changes between renderings (e.g. when
+     * rendering many variations of a scene) without building the scene
+     * again. Swapping the BSDF of a shape (\ref Shape::setBSDF()) takes
+     * effect immediately and requires no work. When the bounding box of
+     * a shape has changed (e.g. after moving an \c instance), only the
+     * top-level acceleration data structure is updated: a BVH is refit,
+     * while a kd-tree is rebuilt over the existing shapes. The kd-trees
+     * of the instanced shape groups are left unchanged. Afterwards, the
+     * scene bounds are updated via \ref initializeBidirectional().
+     *
+     * This function must not be called while the scene is being rendered.
+     *
+     * \param geometryChanged
+     *    Set this to \c true to update the acceleration data structure
+     *    even though no bounding box has changed (e.g. after modifying
+     *    the vertices of a mesh without changing its connectivity)
+     * \return \c true if the acceleration data structure was updated
+     */
+    bool commit(bool geometryChanged = false);
+
+    /**
+     * \brief Share the acceleration data structure of another scene
+     * with the same geometry
+     *
+     * This is meant for sequences of scenes that are loaded one after
+     * the other and only differ by their sensor, emitters or integrator
+     * (e.g. the frames of a turntable animation when the scene loader
+     * reuses unchanged objects, see \ref SceneHandler::setObjectReuse()).
+     * It must be called before \ref initialize(). When the shapes of this
+     * scene are exactly the ones of \c scene (which must be initialized),
+     * the kd-tree or BVH of \c scene is taken over instead of being built
+     * again. Otherwise, the scene is left unchanged.
+     *
+     * \return \c true if the acceleration data structure was shared
+     */
+    bool reuseGeometry(const Scene *scene);
+
     /**
      * \brief Initialize the scene for bidirectional rendering algorithms.
      *
@@ -185,7 +253,12 @@ public:
      * \return \c true if an intersection was found
      */
     inline bool rayIntersect(const Ray &ray, Intersection &its) const {
-        return m_kdtree->rayIntersect(ray, its);
+        MTS_HOTPATH_SCOPE(rayIntersect);
+        bool result = m_bvh.get() ? m_bvh->rayIntersect(ray, its)
+            : m_kdtree->rayIntersect(ray, its);
+        if (EXPECT_NOT_TAKEN(m_footprint != NULL) && result)
+            recordFootprint(its.shape);
+        return result;
     }
 
     /**
@@ -219,7 +292,54 @@ public:
      */
     inline bool rayIntersect(const Ray &ray, Float &t,
             ConstShapePtr &shape, Normal &n, Point2 &uv) const {
-        return m_kdtree->rayIntersect(ray, t, shape, n, uv);
+        MTS_HOTPATH_SCOPE(rayIntersect);
+        bool result = m_bvh.get() ? m_bvh->rayIntersect(ray, t, shape, n, uv)
+            : m_kdtree->rayIntersect(ray, t, shape, n, uv);
+        if (EXPECT_NOT_TAKEN(m_footprint != NULL) && result)
+            recordFootprint(shape);
+        return result;
+    }
+
+    /**
+     * \brief Intersect a ray against all primitives stored in the scene
+     * and defer the computation of the detailed intersection record
+     *
+     * This is useful when many hits only need to know the traveled
+     * distance and the intersected shape (e.g. when a medium interaction
+     * is likely to occur before the surface is reached). The detailed
+     * record can then be computed on demand via
+     * \ref fillIntersectionRecord().
+     *
+     * \return \c true if an intersection was found
+     */
+    inline bool rayIntersect(const Ray &ray, DeferredIntersection &hit) const {
+        MTS_HOTPATH_SCOPE(rayIntersect);
+        bool result = m_bvh.get()
+            ? m_bvh->rayIntersectDeferred(ray, hit.t, hit.shape, hit.temp)
+            : m_kdtree->rayIntersectDeferred(ray, hit.t, hit.shape, hit.temp);
+        if (!result)
+            hit.shape = NULL;
+        else if (EXPECT_NOT_TAKEN(m_footprint != NULL))
+            recordFootprint(hit.shape);
+        return result;
+    }
+
+    /**
+     * \brief Compute the detailed intersection record of a hit that
+     * was found by tracing \c ray with the deferred version of
+     * \ref rayIntersect()
+     *
+     * When nothing was intersected, \c its is marked as invalid.
+     */
+    inline void fillIntersectionRecord(const Ray &ray,
+            const DeferredIntersection &hit, Intersection &its) const {
+        its.t = hit.t;
+        if (!hit.shape)
+            return;
+        if (m_bvh.get())
+            m_bvh->fillDeferredIntersectionRecord(ray, hit.temp, its);
+        else
+            m_kdtree->fillDeferredIntersectionRecord(ray, hit.temp, its);
     }
 
     /**
@@ -239,9 +359,41 @@ public:
      * \return \c true if an intersection was found
      */
     inline bool rayIntersect(const Ray &ray) const {
+        MTS_HOTPATH_SCOPE(rayIntersect);
+        if (m_bvh.get())
+            return m_bvh->rayIntersect(ray);
         return m_kdtree->rayIntersect(ray);
     }
 
+    /**
+     * \brief Intersect a stream of rays against all primitives stored
+     * in the scene and return detailed intersection information
+     *
+     * This produces the same result as calling \ref rayIntersect() for
+     * each ray. When coherent ray tracing support is available and the
+     * scene uses a kd-tree, the rays are traced in packets of four, which
+     * is considerably faster for coherent rays (e.g. sensor rays of
+     * neighboring pixels). Packets with differing direction signs
+     * transparently fall back to individual queries.
+     *
+     * \param rays
+     *    Array of \c count rays
+     * \param its
+     *    Array of \c count intersection records that will be filled in.
+     *    Check \ref Intersection::isValid() to see if a ray hit anything.
+     * \param count
+     *    Number of rays in the stream
+     */
+    void rayIntersectStream(const Ray *rays, Intersection *its, size_t count) const;
+
+    /**
+     * \brief Intersect a packet of four rays against all primitives
+     * stored in the scene
+     *
+     * \sa rayIntersectStream()
+     */
+    void rayIntersectPacket(const Ray *rays, Intersection *its) const;
+
     /**
      * \brief Return the transmittance between \c p1 and \c p2 at the
      * specified time.
@@ -551,13 +703,17 @@ public:
      *    implementations can do a better job at sampling when they have
      *    access to additional random numbers.
      *
+     * \param cache
+     *    Optional: a transmittance cache, which replaces the shadow ray
+     *    when it covers the sampled emitter and \c medium.
+     *
      * \return
      *    An importance weight given by the radiance received along
      *    the sampled ray divided by the sample probability.
      */
     Spectrum sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
             const Medium *medium, int &interactions, const Point2 &sample,
-            Sampler *sampler = NULL) const;
+            Sampler *sampler = NULL, const TransmittanceCache *cache = NULL) const;
 
     /**
      * \brief "Direct illumination" sampling routine for the main scene sensor
@@ -844,6 +1000,11 @@ public:
     /**
      * \brief Return the discrete probability of choosing a
      * certain emitter in <tt>sampleEmitter*</tt>
+     *
+     * When the scene uses an \ref EmitterTree for direct illumination
+     * (<tt>emitterSampling=tree</tt>), the probability of the direct
+     * sampling routines instead depends on the reference point and is
+     * accounted for by \ref pdfEmitterDirect().
      */
     inline Float pdfEmitterDiscrete(const Emitter *emitter) const {
         return emitter->getSamplingWeight() * m_emitterPDF.getNormalization();
@@ -1070,6 +1231,12 @@ public:
     inline ShapeKDTree *getKDTree() { return m_kdtree; }
     /// Return the scene's kd-tree accelerator
     inline const ShapeKDTree *getKDTree() const { return m_kdtree.get(); }
+    /// Return the scene's BVH accelerator (\c NULL unless selected via \c accelerator)
+    inline ShapeBVH *getBVH() { return m_bvh; }
+    /// Return the scene's BVH accelerator (\c NULL unless selected via \c accelerator)
+    inline const ShapeBVH *getBVH() const { return m_bvh.get(); }
+    /// Return the emitter tree (\c NULL unless selected via \c emitterSampling)
+    inline const EmitterTree *getEmitterTree() const { return m_emitterTree.get(); }
 
     /// Return the a list of all subsurface integrators
     inline ref_vector<Subsurface> &getSubsurfaceIntegrators() { return m_ssIntegrators; }
@@ -1115,11 +1282,28 @@ public:
     /// Does the destination file already exist?
     inline bool destinationExists() const { return m_sensor->getFilm()->destinationExists(*m_destinationFile); }
 
+    /**
+     * \brief Record the shapes and BSDFs found by subsequent intersection
+     * queries in the given footprint (\c NULL disables this)
+     *
+     * Only queries that return the intersected shape are recorded. Since
+     * the footprint is not synchronized, this is meant to be used with the
+     * per-thread shallow copies of the scene made by rendering processes.
+     */
+    inline void setFootprint(ObjectFootprint *footprint) { m_footprint = footprint; }
+    /// Return the footprint that intersection queries are recorded in
+    inline ObjectFootprint *getFootprint() const { return m_footprint; }
+
     /// Set the block resolution used to split images into parallel workloads
     inline void setBlockSize(uint32_t size) { m_blockSize = size; }
     /// Return the block resolution used to split images into parallel workloads
     inline uint32_t getBlockSize() const { return m_blockSize; }
 
+    /// Set the order in which image blocks are handed out to the workers
+    inline void setBlockOrder(BlockedImageProcess::EBlockOrder order) { m_blockOrder = order; }
+    /// Return the order in which image blocks are handed out to the workers
+    inline BlockedImageProcess::EBlockOrder getBlockOrder() const { return m_blockOrder; }
+
     /// Serialize the whole scene to a network/file stream
     void serialize(Stream *stream, InstanceManager *manager) const;
 
@@ -1143,8 +1327,20 @@ protected:
     /// Add a shape to the scene
     void addShape(Shape *shape);
     /// \endcond
+
+    /// Insert the IDs of a shape and its BSDF into the active footprint
+    void recordFootprint(const Shape *shape) const;
+
+    /// Choose an emitter for direct illumination sampling at \c dRec.ref
+    inline size_t sampleEmitterIndex(const DirectSamplingRecord &dRec,
+            Float &sample, Float &pdf) const {
+        if (m_emitterTree.get())
+            return m_emitterTree->sample(dRec.ref, dRec.refN, sample, pdf);
+        return m_emitterPDF.sampleReuse(sample, pdf);
+    }
 private:
     ref<ShapeKDTree> m_kdtree;
+    ref<ShapeBVH> m_bvh;
     ref<Sensor> m_sensor;
     ref<Integrator> m_integrator;
     ref<Sampler> m_sampler;
@@ -1161,10 +1357,22 @@ private:
     fs::path *m_sourceFile;
     fs::path *m_destinationFile;
     DiscreteDistribution m_emitterPDF;
+    ref<EmitterTree> m_emitterTree;
     AABB m_aabb;
+    /// Bounding boxes of the shapes at the last build (see \ref commit())
+    std::vector<AABB> m_shapeBounds;
     uint32_t m_blockSize;
+    BlockedImageProcess::EBlockOrder m_blockOrder;
+    bool m_kdCache;
+    bool m_emitterTreeSampling;
     bool m_degenerateSensor;
     bool m_degenerateEmitters;
+
+    /* Footprint recording (see setFootprint()) */
+    ObjectFootprint *m_footprint;
+    mutable std::map<const Shape *, ObjectFootprint> m_shapeFootprints;
+    mutable const Shape *m_lastShape;
+    mutable const ObjectFootprint *m_lastShapeFootprint;
 };
 
 MTS_NAMESPACE_END
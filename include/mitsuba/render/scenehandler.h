@@ -75,6 +75,30 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  * \brief XML parser for Mitsuba scene files. To be used with the
  * SAX interface of Xerces-C++.
  *
+ * The objects declared in a scene file are not created while parsing.
+ * Instead, the handler records a dependency graph where every object
+ * depends on its children, and instantiates it once the closing
+ * \c scene tag has been reached. Objects of the same depth in this graph
+ * (e.g. all meshes and bitmap textures without nested objects) are
+ * independent and are created and configured in parallel. Children are
+ * always added to their parents in document order, hence the resulting
+ * scene does not depend on the number of threads.
+ *
+ * Exporters often write the same mesh many times with different
+ * \c toWorld transformations instead of using a \c shapegroup.
+ * Before instantiating, the handler therefore rewrites two or more
+ * top-level \c serialized, \c ply or \c obj shapes that only differ
+ * by their transformation into one shape group with an instance per
+ * copy, so that the mesh is loaded and stored only once. Shapes with
+ * children other than a BSDF (e.g. emitters) are left untouched. Set the
+ * boolean \c instanceDuplicates property of the scene to \c false to
+ * disable this.
+ *
+ * When the same handler parses several versions of a scene (e.g. the
+ * frames of an animation that only differ by a few parameters, see
+ * \ref setObjectReuse()), it can reuse the objects of the previous one
+ * whose plugin, properties and children did not change.
+ *
  * \remark In the Python bindings, only the static function
  *         \ref loadScene() is exposed.
  * \ingroup librender
@@ -82,7 +106,10 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  */
 class MTS_EXPORT_RENDER SceneHandler : public xercesc::HandlerBase {
 public:
-    typedef std::map<std::string, ConfigurableObject *> NamedObjectMap;
+    /// Scene object whose creation is deferred until the scene is complete
+    struct ObjectNode;
+
+    typedef std::map<std::string, ObjectNode *> NamedObjectMap;
     typedef std::map<std::string, std::string, SimpleStringOrdering> ParameterMap;
 
     SceneHandler(const ParameterMap &params, NamedObjectMap *objects = NULL,
@@ -97,6 +124,24 @@ public:
     static ref<Scene> loadSceneFromString(const std::string &string,
         const ParameterMap &params= ParameterMap());
 
+    /// Set the values of the parameters that are referenced as \c $key
+    inline void setParameters(const ParameterMap &params) { m_params = params; }
+
+    /**
+     * \brief Reuse the objects of the previously parsed scene?
+     *
+     * When enabled, the handler remembers the objects that it created.
+     * The next scene parsed by this handler then reuses every object
+     * whose plugin, properties and children are unchanged instead of
+     * creating it again. When only the sensor or an emitter differ, the
+     * geometry and textures are thus loaded once (also see
+     * \ref Scene::reuseGeometry()). The scene object itself is always
+     * created anew. The objects must not be in use by a previous scene
+     * (e.g. a rendering) during the next parse. Calling this function
+     * forgets the objects of earlier scenes. Disabled by default.
+     */
+    void setObjectReuse(bool reuse);
+
     /// Initialize Xerces-C++ (needs to be called once at program startup)
     static void staticInitialization();
 
@@ -133,6 +178,29 @@ protected:
 
     void clear();
 
+    /// Create and configure all objects of the scene (in parallel)
+    void instantiate();
+
+    /// Create and configure the object associated with a node
+    void instantiateNode(ObjectNode *node);
+
+    /**
+     * \brief Rewrite meshes of the scene that are only transformed
+     * copies of each other into a shape group with instances
+     *
+     * \return The created shape group nodes
+     */
+    std::vector<ObjectNode *> instanceDuplicates(ObjectNode *scene);
+
+    /// Log the memory saved by \ref instanceDuplicates()
+    void reportInstancing(const std::vector<ObjectNode *> &groups);
+
+    /// Find an object of the previous scene that matches a node
+    ConfigurableObject *findReusableObject(const ObjectNode *node) const;
+
+    /// Remember the objects of the current scene for \ref setObjectReuse()
+    void rememberObjects();
+
 private:
     /**
      * Enumeration of all possible tags that can be encountered in a
@@ -159,26 +227,66 @@ private:
         ETag tag;
         Properties properties;
         std::map<std::string, std::string> attributes;
-        std::vector<std::pair<std::string, ConfigurableObject *> > children;
+        std::vector<std::pair<std::string, ObjectNode *> > children;
     };
 
 
     typedef std::pair<ETag, const Class *> TagEntry;
     typedef boost::unordered_map<std::string, TagEntry> TagMap;
 
+    /// An object of the previous scene (see \ref setObjectReuse())
+    struct ReusableObject {
+        const Class *cls;
+        Properties properties;
+        std::vector<std::pair<std::string, ref<ConfigurableObject> > > children;
+        ref<ConfigurableObject> object;
+    };
+
+    /// Reusable objects, indexed by plugin name
+    typedef std::multimap<std::string, ReusableObject> ReusableObjectMap;
+
     const xercesc::Locator *m_locator;
     xercesc::XMLTranscoder* m_transcoder;
     ref<Scene> m_scene;
+    ObjectNode *m_sceneNode;
     ParameterMap m_params;
     NamedObjectMap *m_namedObjects;
+    std::vector<ObjectNode *> *m_nodes;
     PluginManager *m_pluginManager;
     std::stack<ParseContext> m_context;
     TagMap m_tags;
     Transform m_transform;
     ref<AnimatedTransform> m_animatedTransform;
+    ReusableObjectMap m_reusableObjects;
+    bool m_reuseObjects;
     bool m_isIncludedFile;
 };
 
+struct SceneHandler::ObjectNode {
+    /// Tag name and position in the scene file (for messages)
+    std::string tag, location;
+    /// Class of the object, or \c NULL if \c object was created while parsing
+    const Class *cls;
+    /// Properties passed to the plugin
+    Properties properties;
+    /// Nested and referenced objects
+    std::vector<std::pair<std::string, ObjectNode *> > children;
+    /// The instantiated object
+    ref<ConfigurableObject> object;
+    /// Properties before the object was created (see \ref setObjectReuse())
+    Properties sourceProperties;
+    /// Was \c object taken over from the previous scene?
+    bool reused;
+    /// Should the object be configured? (not the case for included scenes)
+    bool configure;
+    /// Creation order (i.e. the order of the closing tags)
+    size_t index;
+    /// Length of the longest path to an object without children
+    int level;
+    /// Number of objects that have this one as a child
+    int parents;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_RENDER_SCENEHANDLER_H_ */
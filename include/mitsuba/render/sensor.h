@@ -91,7 +91,10 @@ public:
         EPositionSampleMapsToPixels  = 0x1000,
 
         /// Does the sample given to \ref sampleDirection() determine the pixel coordinates
-        EDirectionSampleMapsToPixels = 0x2000
+        EDirectionSampleMapsToPixels = 0x2000,
+
+        /// Do some pixels need fewer samples than others? (see \ref getSampleBudget())
+        ENonuniformSampleBudget      = 0x4000
     };
 
     // =============================================================
@@ -197,8 +200,50 @@ public:
         const Point2 &apertureSample,
         Float timeSample) const;
 
-    /// Importance sample the temporal part of the sensor response function
+    /**
+     * \brief Importance sample several ray differentials at once
+     *
+     * This is equivalent to calling \ref sampleRayDifferential() for every
+     * entry, and it is used by \ref SamplingIntegrator::renderBlockStream()
+     * to generate the sensor rays of a batch of pixels. The default
+     * implementation does exactly that. Sensors with a static
+     * transformation override it to evaluate their transformations once
+     * per batch instead of once per ray.
+     *
+     * \param count
+     *    Number of rays to generate
+     * \param samplePositions
+     *    Sample positions in fractional pixel coordinates
+     * \param apertureSamples
+     *    Aperture samples (or \c NULL when \ref needsApertureSample()
+     *    == \c false, in which case <tt>(0.5, 0.5)</tt> is used)
+     * \param timeSamples
+     *    Time samples (or \c NULL when \ref needsTimeSample() == \c false,
+     *    in which case 0.5 is used)
+     * \param rays
+     *    Output array of ray differentials
+     * \param weights
+     *    Output array of importance weights
+     */
+    virtual void sampleRayDifferentials(size_t count,
+        const Point2 *samplePositions,
+        const Point2 *apertureSamples,
+        const Float *timeSamples,
+        RayDifferential *rays,
+        Spectrum *weights) const;
+
+    /**
+     * \brief Importance sample the temporal part of the sensor response function
+     *
+     * When the sensor uses time buckets (see \ref getTimeBuckets()),
+     * the sample is snapped to the center of its bucket.
+     */
     inline Float sampleTime(Float sample) const {
+        if (m_timeBuckets > 0) {
+            Float bucket = std::min(std::floor(sample * m_timeBuckets),
+                (Float) (m_timeBuckets - 1));
+            sample = (bucket + 0.5f) * m_invTimeBuckets;
+        }
         return m_shutterOpen + m_shutterOpenTime * sample;
     }
 
@@ -280,6 +325,12 @@ public:
     /// Return the length, for which the shutter remains open
     inline Float getShutterOpenTime() const { return m_shutterOpenTime; }
 
+    /**
+     * \brief Return the number of discrete times at which the sensor
+     * samples the shutter interval (or zero for a continuous interval)
+     */
+    inline size_t getTimeBuckets() const { return m_timeBuckets; }
+
     /// Set the length, for which the shutter remains open
     void setShutterOpenTime(Float time);
 
@@ -302,6 +353,21 @@ public:
      */
     inline bool needsApertureSample() const { return m_type & ENeedsApertureSample; }
 
+    /**
+     * \brief Return the fraction of the sampler's samples that should
+     * be taken in the given pixel
+     *
+     * Sensors whose pixels cover very different parts of their domain
+     * (e.g. the rows close to the poles of a spherical camera) can use
+     * this to reduce the work spent on the small pixels. The sampling-based
+     * integrators only consult it when the sensor has the flag
+     * \ref ENonuniformSampleBudget. The default implementation returns 1.
+     */
+    virtual Float getSampleBudget(const Point2i &pixel) const;
+
+    /// Does \ref getSampleBudget() vary from pixel to pixel?
+    inline bool hasSampleBudget() const { return m_type & ENonuniformSampleBudget; }
+
     /// Return the \ref Film instance associated with this sensor
     inline Film *getFilm() { return m_film; }
 
@@ -371,6 +437,8 @@ protected:
     Vector2 m_invResolution;
     Float m_shutterOpen;
     Float m_shutterOpenTime;
+    size_t m_timeBuckets;
+    Float m_invTimeBuckets;
     Float m_aspect;
 };
 
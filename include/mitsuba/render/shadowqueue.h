@@ -0,0 +1,107 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_SHADOWQUEUE_H_)
+#define __MITSUBA_RENDER_SHADOWQUEUE_H_
+
+#include <mitsuba/render/scene.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Queue of deferred occlusion queries (shadow rays)
+ *
+ * Many integrators only trace a shadow ray to decide whether a
+ * precomputed contribution (e.g. an emitter sample) should be added to
+ * their estimate. Instead of tracing such rays right away, they can be
+ * pushed to this queue together with the contribution and the location
+ * it should be added to. \ref flush() then sorts the queued rays by the
+ * octant of their direction and by their origin (along a Morton curve
+ * over the scene bounds), and traces them one after the other using
+ * any-hit queries, which stop at the first occluder. Rays of similar
+ * origin and direction thus traverse the same parts of the kd-tree in
+ * succession, which is considerably more cache-friendly than tracing
+ * incoherent shadow rays as they are generated.
+ *
+ * A queue is not thread-safe and meant to be owned by a single thread
+ * (e.g. the one rendering an image block).
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER ShadowRayQueue {
+public:
+    /**
+     * \brief Create an empty queue for shadow rays in \c scene
+     *
+     * \param capacity
+     *    Number of queries for which memory is reserved up front
+     */
+    ShadowRayQueue(const Scene *scene, size_t capacity = 0);
+
+    /**
+     * \brief Enqueue a shadow ray
+     *
+     * When the ray turns out to be unoccluded, \c value is added to
+     * \c *target by the next call to \ref flush(), hence \c target must
+     * remain valid until then.
+     */
+    inline void push(const Ray &ray, const Spectrum &value, Spectrum *target) {
+        Entry entry;
+        entry.ray = ray;
+        entry.value = value;
+        entry.target = target;
+        m_entries.push_back(entry);
+    }
+
+    /**
+     * \brief Trace all queued shadow rays, add the contributions of the
+     * unoccluded ones, and clear the queue
+     *
+     * \return The number of unoccluded rays
+     */
+    size_t flush();
+
+    /// Return the number of queued shadow rays
+    inline size_t getSize() const { return m_entries.size(); }
+
+    /// Is the queue empty?
+    inline bool isEmpty() const { return m_entries.empty(); }
+
+    /// Discard all queued shadow rays
+    inline void clear() { m_entries.clear(); }
+private:
+    struct Entry {
+        Ray ray;
+        Spectrum value;
+        Spectrum *target;
+    };
+
+    /// Compute the sort key of a ray (direction octant and Morton code of its origin)
+    uint32_t getKey(const Ray &ray) const;
+
+    const Scene *m_scene;
+    Point m_origin;
+    Vector m_invExtents;
+    std::vector<Entry> m_entries;
+    std::vector<std::pair<uint32_t, uint32_t> > m_order;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_SHADOWQUEUE_H_ */
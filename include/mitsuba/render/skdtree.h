@@ -71,6 +71,8 @@ class MTS_EXPORT_RENDER ShapeKDTree : public SAHKDTree3D<ShapeKDTree> {
     friend class SAHKDTree3D<ShapeKDTree>;
     friend class Instance;
     friend class AnimatedInstance;
+    friend class InstanceArray;
+    friend class ShapeProxy;
     friend class SingleScatter;
 
 public:
@@ -97,9 +99,51 @@ public:
     /// Return an axis-aligned bounding box containing all primitives
     inline const AABB &getAABB() const { return m_aabb; }
 
-    /// Build the kd-tree (needs to be called before tracing any rays)
+    /**
+     * \brief Build the kd-tree (needs to be called before tracing any rays)
+     *
+     * When a cache directory was specified, this function first tries to
+     * memory-map a previously constructed tree from there and only builds
+     * (and subsequently stores) the tree when no matching entry exists.
+     */
     void build();
 
+    /**
+     * \brief Specify a directory for persistent on-disk caching of the tree
+     *
+     * Cache entries are named after a hash of the geometry and of all
+     * construction parameters, hence they are automatically invalidated
+     * when any of these change. An empty path (the default) disables
+     * the cache.
+     */
+    void setCacheDirectory(const fs::path &path);
+
+    /// Return the directory used for persistent caching (if any)
+    const fs::path &getCacheDirectory() const;
+
+    /**
+     * \brief Share the tree with all other trees of identical geometry
+     * and construction parameters in this process
+     *
+     * When enabled, \ref build() first looks for a matching tree in a
+     * process-wide registry, which is keyed by the same hash as the
+     * persistent cache. Otherwise, the tree is built (or loaded from the
+     * cache directory) and then published in the registry. The tree data
+     * is kept alive as long as one of the trees referencing it exists.
+     * Only the nodes, indices and triangle data are shared -- every tree
+     * keeps its own list of shapes. Disabled by default.
+     */
+    inline void setShared(bool shared) { m_shared = shared; }
+
+    /// Return whether the tree is shared with other trees in this process
+    inline bool isShared() const { return m_shared; }
+
+    /**
+     * \brief Return whether the tree data was loaded from the persistent
+     * cache or from the process-wide registry (see \ref setShared())
+     */
+    inline bool isCached() const { return m_cacheData.get() != NULL; }
+
     //! @}
     // =============================================================
 
@@ -156,6 +200,31 @@ public:
     bool rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
         Normal &n, Point2 &uv) const;
 
+    /**
+     * \brief Intersect a ray against all primitives stored in the kd-tree
+     * and defer the computation of the detailed intersection record
+     *
+     * Only the traveled distance and the intersected shape are determined.
+     * The data required to compute the remaining information later on
+     * (see \ref fillDeferredIntersectionRecord()) is stored in \c temp,
+     * which must provide \ref MTS_KD_INTERSECTION_TEMP bytes.
+     *
+     * \return \c true if an intersection was found
+     */
+    bool rayIntersectDeferred(const Ray &ray, Float &t,
+        ConstShapePtr &shape, void *temp) const;
+
+    /**
+     * \brief Compute the detailed intersection record of a hit
+     * that was found by \ref rayIntersectDeferred()
+     *
+     * \c its.t must contain the traveled distance.
+     */
+    inline void fillDeferredIntersectionRecord(const Ray &ray,
+            const void *temp, Intersection &its) const {
+        fillIntersectionRecord<true>(ray, temp, its);
+    }
+
     /**
      * \brief Test a ray for occlusion with respect to all primitives
      *    stored in the kd-tree.
@@ -189,7 +258,127 @@ public:
      */
     void rayIntersectPacketIncoherent(const RayPacket4 &packet,
         const RayInterval4 &interval, Intersection4 &its, void *temp) const;
+
+    /**
+     * \brief Create a detailed intersection record for one of the rays
+     * of a packet query
+     *
+     * \param ray
+     *    The ray with the given index in the packet
+     * \param its4
+     *    Result of \ref rayIntersectPacket() or \ref rayIntersectPacketIncoherent()
+     * \param index
+     *    Index of the ray within the packet (0..3)
+     * \param temp
+     *    Temporary storage that was passed to the packet query
+     * \param its
+     *    Intersection record that will be filled in
+     */
+    void fillPacketIntersectionRecord(const Ray &ray, const Intersection4 &its4,
+        int index, void *temp, Intersection &its) const;
 #endif
+
+    /**
+     * \brief Fill an intersection record for a triangle of a mesh given
+     * the barycentric coordinates of the intersection
+     *
+     * This excludes the shading frame and \c wi, which are computed by
+     * the caller once the record is complete. It is shared with other
+     * acceleration data structures (e.g. \ref ShapeBVH).
+     */
+    template<bool BarycentricPos> static FINLINE void fillTriangleIntersectionRecord(
+            const Ray &ray, const TriMesh *trimesh, IndexType primIndex,
+            Float u, Float v, Intersection &its) {
+        const Triangle &tri = trimesh->getTriangles()[primIndex];
+        const Point *vertexPositions = trimesh->getVertexPositions();
+        const TangentSpace *vertexTangents = trimesh->getUVTangents();
+        const Vector b(1 - u - v, u, v);
+
+        const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
+        const Point &p0 = vertexPositions[idx0];
+        const Point &p1 = vertexPositions[idx1];
+        const Point &p2 = vertexPositions[idx2];
+
+        if (BarycentricPos)
+            its.p = p0 * b.x + p1 * b.y + p2 * b.z;
+        else
+            its.p = ray(its.t);
+
+        Vector side1(p1-p0), side2(p2-p0);
+        Normal faceNormal(cross(side1, side2));
+        Float length = faceNormal.length();
+        if (!faceNormal.isZero())
+            faceNormal /= length;
+
+        if (EXPECT_NOT_TAKEN(vertexTangents)) {
+            const TangentSpace *smoothTangents = trimesh->getVertexTangents();
+            if (smoothTangents) {
+                /* Interpolate the precomputed per-vertex tangents */
+                const TangentSpace &ts0 = smoothTangents[idx0],
+                                   &ts1 = smoothTangents[idx1],
+                                   &ts2 = smoothTangents[idx2];
+                its.dpdu = ts0.dpdu * b.x + ts1.dpdu * b.y + ts2.dpdu * b.z;
+                its.dpdv = ts0.dpdv * b.x + ts1.dpdv * b.y + ts2.dpdv * b.z;
+            } else {
+                const TangentSpace &ts = vertexTangents[primIndex];
+                its.dpdu = ts.dpdu;
+                its.dpdv = ts.dpdv;
+            }
+        } else {
+            its.dpdu = side1;
+            its.dpdv = side2;
+        }
+
+        if (EXPECT_TAKEN(trimesh->hasVertexNormals())) {
+            const Normal
+                n0 = trimesh->getVertexNormal(idx0),
+                n1 = trimesh->getVertexNormal(idx1),
+                n2 = trimesh->getVertexNormal(idx2);
+
+            its.shFrame.n = normalize(n0 * b.x + n1 * b.y + n2 * b.z);
+
+            /* Ensure that the geometric & shading normals face the same direction */
+            if (dot(faceNormal, its.shFrame.n) < 0)
+                faceNormal = -faceNormal;
+        } else {
+            its.shFrame.n = faceNormal;
+        }
+        its.geoFrame = Frame(faceNormal);
+
+        if (EXPECT_TAKEN(trimesh->hasVertexTexcoords())) {
+            const Point2 t0 = trimesh->getVertexTexcoord(idx0);
+            const Point2 t1 = trimesh->getVertexTexcoord(idx1);
+            const Point2 t2 = trimesh->getVertexTexcoord(idx2);
+            its.uv = t0 * b.x + t1 * b.y + t2 * b.z;
+        } else {
+            its.uv = Point2(b.y, b.z);
+        }
+
+        if (EXPECT_NOT_TAKEN(trimesh->hasVertexColors())) {
+            const Color3 c0 = trimesh->getVertexColor(idx0),
+                         c1 = trimesh->getVertexColor(idx1),
+                         c2 = trimesh->getVertexColor(idx2);
+            Color3 result(c0 * b.x + c1 * b.y + c2 * b.z);
+            its.color.fromLinearRGB(result[0], result[1],
+                result[2], Spectrum::EReflectance);
+        }
+
+        its.shape = trimesh;
+        its.hasUVPartials = false;
+        its.primIndex = primIndex;
+        its.instance = NULL;
+        its.time = ray.time;
+    }
+
+    /**
+     * \brief Return the number of normal and shadow rays that were traced
+     * by the calling thread so far (over all kd-trees)
+     *
+     * This is based on the ray statistics and is always zero when Mitsuba
+     * is compiled with \c MTS_NO_STATISTICS
+     */
+    static uint64_t getThreadRayCount();
+
     //! @}
     // =============================================================
 
@@ -345,79 +534,9 @@ protected:
         const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
         const Shape *shape = m_shapes[cache->shapeIndex];
         if (m_triangleFlag[cache->shapeIndex]) {
-            const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
-            const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
-            const Point *vertexPositions = trimesh->getVertexPositions();
-            const Normal *vertexNormals = trimesh->getVertexNormals();
-            const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
-            const Color3 *vertexColors = trimesh->getVertexColors();
-            const TangentSpace *vertexTangents = trimesh->getUVTangents();
-            const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
-
-            const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
-            const Point &p0 = vertexPositions[idx0];
-            const Point &p1 = vertexPositions[idx1];
-            const Point &p2 = vertexPositions[idx2];
-
-            if (BarycentricPos)
-                its.p = p0 * b.x + p1 * b.y + p2 * b.z;
-            else
-                its.p = ray(its.t);
-
-            Vector side1(p1-p0), side2(p2-p0);
-            Normal faceNormal(cross(side1, side2));
-            Float length = faceNormal.length();
-            if (!faceNormal.isZero())
-                faceNormal /= length;
-
-            if (EXPECT_NOT_TAKEN(vertexTangents)) {
-                const TangentSpace &ts = vertexTangents[cache->primIndex];
-                its.dpdu = ts.dpdu;
-                its.dpdv = ts.dpdv;
-            } else {
-                its.dpdu = side1;
-                its.dpdv = side2;
-            }
-
-            if (EXPECT_TAKEN(vertexNormals)) {
-                const Normal
-                    &n0 = vertexNormals[idx0],
-                    &n1 = vertexNormals[idx1],
-                    &n2 = vertexNormals[idx2];
-
-                its.shFrame.n = normalize(n0 * b.x + n1 * b.y + n2 * b.z);
-
-                /* Ensure that the geometric & shading normals face the same direction */
-                if (dot(faceNormal, its.shFrame.n) < 0)
-                    faceNormal = -faceNormal;
-            } else {
-                its.shFrame.n = faceNormal;
-            }
-            its.geoFrame = Frame(faceNormal);
-
-            if (EXPECT_TAKEN(vertexTexcoords)) {
-                const Point2 &t0 = vertexTexcoords[idx0];
-                const Point2 &t1 = vertexTexcoords[idx1];
-                const Point2 &t2 = vertexTexcoords[idx2];
-                its.uv = t0 * b.x + t1 * b.y + t2 * b.z;
-            } else {
-                its.uv = Point2(b.y, b.z);
-            }
-
-            if (EXPECT_NOT_TAKEN(vertexColors)) {
-                const Color3 &c0 = vertexColors[idx0],
-                             &c1 = vertexColors[idx1],
-                             &c2 = vertexColors[idx2];
-                Color3 result(c0 * b.x + c1 * b.y + c2 * b.z);
-                its.color.fromLinearRGB(result[0], result[1],
-                    result[2], Spectrum::EReflectance);
-            }
-
-            its.shape = trimesh;
-            its.hasUVPartials = false;
-            its.primIndex = cache->primIndex;
-            its.instance = NULL;
-            its.time = ray.time;
+            fillTriangleIntersectionRecord<BarycentricPos>(ray,
+                static_cast<const TriMesh *>(shape), cache->primIndex,
+                cache->u, cache->v, its);
         } else {
             shape->fillIntersectionRecord(ray,
                 reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
@@ -459,6 +578,32 @@ protected:
 
     /// Virtual destructor
     virtual ~ShapeKDTree();
+
+    /// Compute a hash of the geometry and construction parameters
+    uint64_t getCacheKey() const;
+
+    /// Try to memory-map the tree from the given cache file
+    bool loadCache(const fs::path &filename, uint64_t key);
+
+    /// Write the constructed tree to the given cache file
+    void saveCache(const fs::path &filename, uint64_t key) const;
+
+    /// Write the constructed tree to a stream (in the cache file format)
+    void writeCache(Stream *stream, uint64_t key) const;
+
+    /**
+     * \brief Use the tree stored in a memory region in the cache file
+     * format, which is kept alive by \c owner
+     *
+     * Throws an exception when the data doesn't match the geometry.
+     */
+    void mapCache(Object *owner, uint8_t *data, size_t size, uint64_t key);
+
+    /// Look for a tree with the given key in the process-wide registry
+    bool acquireSharedTree(uint64_t key);
+
+    /// Publish the tree in the process-wide registry
+    void publishSharedTree(uint64_t key);
 private:
     std::vector<const Shape *> m_shapes;
     std::vector<bool> m_triangleFlag;
@@ -466,6 +611,9 @@ private:
 #if !defined(MTS_KD_CONSERVE_MEMORY)
     TriAccel *m_triAccel;
 #endif
+    fs::path *m_cacheDirectory;
+    ref<Object> m_cacheData;
+    bool m_shared;
 };
 
 MTS_NAMESPACE_END
@@ -21,6 +21,7 @@
 #define __MITSUBA_RENDER_TESTCASE_H_
 
 #include <mitsuba/render/util.h>
+#include <mitsuba/core/timer.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -43,6 +44,19 @@ MTS_NAMESPACE_BEGIN
  * the shutdown() method is called. See the files in 'mitsuba/src/tests'
  * for examples.
  *
+ * Performance tests are declared using MTS_DECLARE_BENCHMARK(), which also
+ * specifies the number of operations performed by one call of the method.
+ * They only run when the test case is invoked with the \c -b option
+ * (e.g. <tt>mtsutil test_spectrum -b</tt>, or <tt>mtsutil -t -- -b</tt>
+ * to run all test cases). Every benchmark is called once to warm up and
+ * then timed over several repetitions (\c -n, default: 10). A benchmark
+ * can call \ref startMeasurement() to exclude its set-up work. The time
+ * per operation is compared against a baseline file (\c -B, default:
+ * <tt>&lt;test case class&gt;.perf</tt>) using Welch's t-test, and a
+ * benchmark fails when it is significantly slower than the baseline by
+ * more than a tolerance (\c -T, default: 5 percent). The \c -u option
+ * records the measured times as the new baseline.
+ *
  * \ingroup librender
  */
 class MTS_EXPORT_RENDER TestCase : public Utility {
@@ -117,8 +131,44 @@ protected:
 
     /// Increase the number of succeeded tests
     void succeed();
+
+    /// Parse the benchmark options (called by MTS_BEGIN_TESTCASE())
+    void parseBenchmarkOptions(int argc, char **argv);
+
+    /// Exclude the preceding set-up work of a benchmark from its timing
+    inline void startMeasurement() { m_benchmarkTimer->reset(); }
+
+    /**
+     * \brief Report the timings of a benchmark and compare them against
+     * the baseline
+     *
+     * \param times
+     *     Duration of every repetition in seconds
+     * \param operations
+     *     Number of operations performed by one repetition
+     * \return \c false if the benchmark is significantly slower
+     *     than the baseline
+     */
+    bool evaluateBenchmark(const std::string &name,
+        const std::vector<Float> &times, size_t operations);
+
+    /// Write the updated baseline if requested (called by MTS_END_TESTCASE())
+    void finishBenchmarks();
 protected:
+    /// Time per operation of a benchmark
+    struct BenchmarkResult {
+        double mean, stddev;
+        int runs;
+    };
+    typedef std::map<std::string, BenchmarkResult> BenchmarkMap;
+
     int m_executed, m_succeeded;
+    bool m_benchmark, m_updateBaseline;
+    int m_benchmarkRuns;
+    Float m_benchmarkTolerance;
+    std::string m_baselineFile;
+    BenchmarkMap m_baseline, m_measured;
+    ref<Timer> m_benchmarkTimer;
 };
 
 MTS_NAMESPACE_END
@@ -133,9 +183,29 @@ MTS_NAMESPACE_END
         Log(EInfo, "Testcase failed with error: %s", e.what());\
     }
 
+#define EXECUTE_BENCHMARK(name, operations) \
+    if (m_benchmark) { \
+        try { \
+            Log(EInfo, "Executing benchmark \"%s\" ..", #name); \
+            m_executed++;\
+            name();\
+            std::vector<Float> times; \
+            for (int i=0; i<m_benchmarkRuns; ++i) { \
+                m_benchmarkTimer->reset(); \
+                name();\
+                times.push_back(m_benchmarkTimer->getSeconds()); \
+            } \
+            if (evaluateBenchmark(#name, times, operations)) \
+                m_succeeded++;\
+        } catch (std::exception &e) {\
+            Log(EInfo, "Benchmark failed with error: %s", e.what());\
+        } \
+    }
+
 #define MTS_BEGIN_TESTCASE() \
     MTS_DECLARE_CLASS() \
     int run(int argc, char **argv) {\
+        parseBenchmarkOptions(argc, argv); \
         init(); \
         Log(EInfo, "Executing testcase \"%s\" ..", getClass()->getName().c_str()); \
         m_executed = m_succeeded = 0;
@@ -143,7 +213,11 @@ MTS_NAMESPACE_END
 #define MTS_DECLARE_TEST(name) \
         EXECUTE_GUARDED(name)
 
+#define MTS_DECLARE_BENCHMARK(name, operations) \
+        EXECUTE_BENCHMARK(name, operations)
+
 #define MTS_END_TESTCASE()\
+        finishBenchmarks();\
         shutdown();\
         return m_executed - m_succeeded;\
     }
@@ -132,7 +132,8 @@ public:
      * The parameter \c gradient should point to an array with space for
      * two \ref Spectrum data structures corresponding to the U and V derivative.
      *
-     * \remark This function is usually implemented pointwise without any kind of filtering.
+     * When ray differentials are available, the filtered version of the
+     * gradient lookup is used (see below).
      */
     void evalGradient(const Intersection &its, Spectrum *gradient) const;
 
@@ -149,6 +150,14 @@ public:
     /// Unfiltered radient lookup lookup -- Texture2D subclasses can optionally provide this function
     virtual void evalGradient(const Point2 &uv, Spectrum *gradient) const;
 
+    /**
+     * \brief Filtered gradient lookup -- Texture2D subclasses can optionally
+     * provide this function. The default implementation ignores the
+     * footprint and performs an unfiltered lookup.
+     */
+    virtual void evalGradient(const Point2 &uv, const Vector2 &d0,
+            const Vector2 &d1, Spectrum *gradient) const;
+
     /**
      * \brief Return a bitmap representation of the texture
      *
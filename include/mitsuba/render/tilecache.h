@@ -0,0 +1,173 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_TILECACHE_H_)
+#define __MITSUBA_RENDER_TILECACHE_H_
+
+#include <mitsuba/core/tls.h>
+#include <boost/filesystem/path.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+/// Base-2 logarithm of the edge length of a cached tile in texels
+#define MTS_TILECACHE_TILE_SHIFT 6
+
+/// Number of entries in the per-thread tile pointer cache (power of two)
+#define MTS_TILECACHE_MICROCACHE_SIZE 64
+
+/// Default memory budget of the tile cache in bytes
+#define MTS_TILECACHE_DEFAULT_LIMIT (512 * 1024 * 1024)
+
+/**
+ * \brief Process-wide cache of texture tiles that are paged in on demand
+ *
+ * This class keeps fixed-size square tiles of the MIP levels of registered
+ * texture files (e.g. MIP map cache files, see \ref TMIPMap) in memory.
+ * Tiles are only read from disk when they are first accessed, and the
+ * least recently used ones are evicted as soon as the total size of all
+ * resident tiles exceeds a global memory budget (\ref setMemoryLimit()).
+ * This makes it possible to render scenes whose textures are much larger
+ * than the main system memory.
+ *
+ * Lookups first consult a small direct-mapped cache of tile pointers that
+ * is private to the calling thread, hence repeated accesses to the same
+ * tiles don't require any synchronization. Only misses of this cache take
+ * the global lock, and tiles are read from disk without holding it.
+ *
+ * Each level of a registered file must be stored as a row-major grid of
+ * equally-sized \a cells (e.g. a single texel, or a block of a
+ * \ref BlockedArray). A tile covers a square region of
+ * <tt>2^tileCellShift</tt> by <tt>2^tileCellShift</tt> cells, whose rows
+ * are stored contiguously in the tile's memory. Cells of partial tiles at
+ * the right and bottom boundaries of a level are left uninitialized.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER TextureTileCache : public Object {
+public:
+    /// Describes the storage of one level of a registered file
+    struct LevelInfo {
+        /// Offset of the level's first cell in bytes
+        uint64_t offset;
+        /// Number of cells along each axis
+        Vector2i cells;
+
+        inline LevelInfo() { }
+        inline LevelInfo(uint64_t offset, const Vector2i &cells)
+            : offset(offset), cells(cells) { }
+    };
+
+    /// Return the global tile cache instance
+    inline static TextureTileCache *getInstance() { return m_instance; }
+
+    /**
+     * \brief Register a file whose tiles should be served by the cache
+     *
+     * \param filename
+     *     Path of the file
+     * \param cellSize
+     *     Size of a storage cell in bytes
+     * \param tileCellShift
+     *     Base-2 logarithm of the tile edge length in cells
+     * \param levels
+     *     Layout of the levels contained in the file
+     * \return A file identifier that is passed to \ref lookup()
+     */
+    uint32_t registerFile(const fs::path &filename, size_t cellSize,
+        int tileCellShift, const std::vector<LevelInfo> &levels);
+
+    /// Unregister a file and release all of its resident tiles
+    void unregisterFile(uint32_t id);
+
+    /**
+     * \brief Return a pointer to the contents of a tile
+     *
+     * The tile is loaded from disk if it is not resident. The returned
+     * pointer remains valid until the calling thread performs its next
+     * lookup, even if the tile is evicted in the meantime.
+     */
+    inline const uint8_t *lookup(uint32_t id, int level, int x, int y) const {
+        uint64_t key = ((uint64_t) id << 40) | ((uint64_t) level << 32)
+            | ((uint64_t) (uint16_t) y << 16) | (uint64_t) (uint16_t) x;
+        MicroCache &cache = m_microCache.get();
+        MicroCache::Entry &entry = cache.entries[(size_t) ((key ^ (key >> 13)
+            ^ (key >> 29)) & (MTS_TILECACHE_MICROCACHE_SIZE - 1))];
+        if (EXPECT_TAKEN(entry.key == key))
+            return entry.data;
+        return lookupSlow(entry, key, id, level, x, y);
+    }
+
+    /// Set the memory budget of the cache in bytes
+    void setMemoryLimit(size_t limit);
+
+    /// Return the memory budget of the cache in bytes
+    inline size_t getMemoryLimit() const { return m_memoryLimit; }
+
+    /// Return the total size of all resident tiles in bytes
+    size_t getMemoryUsage() const;
+
+    /// Return a human-readable string representation
+    std::string toString() const;
+
+    /// Initialize the global tile cache
+    static void staticInitialization();
+
+    /// Free the memory taken by staticInitialization()
+    static void staticShutdown();
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Per-thread direct-mapped cache of tile pointers
+    struct MicroCache {
+        struct Entry {
+            uint64_t key;
+            const uint8_t *data;
+            ref<Object> tile;
+
+            inline Entry() : key((uint64_t) -1), data(NULL) { }
+        };
+
+        Entry entries[MTS_TILECACHE_MICROCACHE_SIZE];
+    };
+
+    /// Create an empty tile cache
+    TextureTileCache();
+
+    /// Virtual destructor
+    virtual ~TextureTileCache();
+
+    /// Handle a miss of the per-thread tile pointer cache
+    const uint8_t *lookupSlow(MicroCache::Entry &entry, uint64_t key, uint32_t id,
+        int level, int x, int y) const;
+
+    /// Evict tiles until the memory budget is satisfied (mutex must be held)
+    void enforceLimit() const;
+private:
+    struct CachedFile;
+    struct TileStore;
+
+    static ref<TextureTileCache> m_instance;
+    mutable PrimitiveThreadLocal<MicroCache> m_microCache;
+    TileStore *m_store;
+    size_t m_memoryLimit;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_TILECACHE_H_ */
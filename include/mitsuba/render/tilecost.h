@@ -0,0 +1,103 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_TILECOST_H_)
+#define __MITSUBA_RENDER_TILECOST_H_
+
+#include <mitsuba/render/imageblock.h>
+#include <mitsuba/core/lock.h>
+#include <boost/filesystem/path.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Per-pixel map of the cost of rendering an image
+ *
+ * The map collects the cost records of the image blocks finished by
+ * \ref BlockedRenderProcess (see \ref BlockedRenderProcess::setTileCostRecord()).
+ * Every pixel of the map stores the wall-clock time, the number of samples
+ * and the number of rays of the block that covered it, divided by the
+ * block's pixel count. The channels are named \c time, \c samples and
+ * \c rays, and the map is written as a multichannel OpenEXR file that can
+ * be inspected as a heat map of the load distribution.
+ *
+ * The time channel of a map recorded for one frame of an animation
+ * predicts the cost of the next frame, and can be passed to
+ * \ref BlockedImageProcess::setCostPrediction() to render the expensive
+ * blocks first.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER TileCostMap : public Object {
+public:
+    /// Create an empty map of the given size (usually the film crop size)
+    TileCostMap(const Vector2i &size);
+
+    /**
+     * \brief Add the cost record of an image block
+     *
+     * The block offset is relative to the film crop window. Parts of the
+     * block outside of the map (e.g. a high quality edge region) are
+     * ignored. Blocks without a cost record are skipped.
+     */
+    void put(const ImageBlock *block);
+
+    /// Return the size of the map
+    inline const Vector2i &getSize() const { return m_bitmap->getSize(); }
+
+    /// Return the underlying three-channel bitmap
+    inline const Bitmap *getBitmap() const { return m_bitmap.get(); }
+
+    /// Return the total time (in seconds) of all recorded blocks
+    Float getTotalTime() const;
+
+    /**
+     * \brief Return the time channel as a single-channel bitmap
+     * (for use with \ref BlockedImageProcess::setCostPrediction())
+     */
+    ref<Bitmap> getTimePrediction() const;
+
+    /**
+     * \brief Replace the contents of the map with the ones of an
+     * OpenEXR file written by \ref save()
+     *
+     * \return \c false (and a warning is printed) if the file does not
+     *    exist, cannot be read, or has a different size. The map is
+     *    left empty in this case.
+     */
+    bool load(const fs::path &filename);
+
+    /// Write the map to an OpenEXR file
+    void save(const fs::path &filename) const;
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~TileCostMap() { }
+private:
+    ref<Bitmap> m_bitmap;
+    mutable ref<Mutex> m_mutex;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_TILECOST_H_ */
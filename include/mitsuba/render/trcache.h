@@ -0,0 +1,147 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_TRCACHE_H_)
+#define __MITSUBA_RENDER_TRCACHE_H_
+
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/aabb.h>
+#include <mitsuba/core/spectrum.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Grid-based cache of the transmittance towards directional emitters
+ *
+ * For every pair of an emitter with a degenerate direction (such as the
+ * \c directional plugin) and a participating medium of the scene, this
+ * class stores the transmittance (including occlusion by surfaces) from
+ * the vertices of a regular grid that spans the scene's bounding box
+ * towards the emitter. The grid values are computed in a parallel
+ * preprocess, after which medium vertices can replace their shadow rays
+ * by a trilinear lookup (see \ref Scene::sampleAttenuatedEmitterDirect).
+ *
+ * Interpolation blurs shadow boundaries and transmittance variations
+ * below the grid resolution, hence the cache introduces bias. An estimate
+ * of this error is computed after construction from a set of randomly
+ * placed reference points (see \ref getMeanError() and \ref getMaxError()).
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER TransmittanceCache : public SerializableObject {
+public:
+    /**
+     * \brief Create an empty transmittance cache
+     *
+     * \param resolution
+     *     Number of grid vertices along the longest axis of the scene's
+     *     bounding box (the other axes use a matching cell size)
+     * \param sampleCount
+     *     Number of transmittance estimates that are averaged per vertex
+     */
+    TransmittanceCache(int resolution, int sampleCount);
+
+    /// Unserialize a transmittance cache from a binary data stream
+    TransmittanceCache(Stream *stream, InstanceManager *manager);
+
+    /**
+     * \brief Build a grid for every pair of directional emitter and
+     * participating medium of the given scene
+     *
+     * \return \c false if the process was cancelled
+     */
+    bool build(const Scene *scene, const void *progressReporterPayload,
+        int sceneResID, int samplerResID);
+
+    /// Cancel a running \ref build() operation
+    void cancel();
+
+    /**
+     * \brief Resolve the emitter and medium references of an unserialized
+     * cache against the given scene
+     */
+    void bind(const Scene *scene);
+
+    /**
+     * \brief Look up the transmittance at \c p towards \c emitter
+     * inside \c medium
+     *
+     * \return \c false if the cache doesn't cover this configuration,
+     *     in which case the caller should trace a shadow ray instead.
+     */
+    bool eval(const Emitter *emitter, const Medium *medium,
+        const Point &p, Spectrum &result) const;
+
+    /// Return whether the cache contains any grids
+    inline bool isEmpty() const { return m_grids.empty(); }
+
+    /// Return the grid resolution
+    inline const Vector3i &getResolution() const { return m_res; }
+
+    /// Return the mean absolute error of all grids at the reference points
+    Float getMeanError() const;
+
+    /// Return the maximum absolute error of all grids at the reference points
+    Float getMaxError() const;
+
+    /// Serialize the cache to a binary data stream
+    void serialize(Stream *stream, InstanceManager *manager) const;
+
+    /// Return a human-readable string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~TransmittanceCache() { }
+
+    /// Compute the grid of a single emitter/medium pair
+    bool buildGrid(const Scene *scene, size_t grid, Float time,
+        const void *progressReporterPayload, int sceneResID, int samplerResID);
+
+    /// Compare a grid against reference estimates at random positions
+    void validateGrid(const Scene *scene, size_t grid, Float time);
+
+    /// Return the world-space position of a grid vertex
+    inline Point getVertexPosition(int x, int y, int z) const {
+        return m_aabb.min + Vector(x * m_cellSize.x,
+            y * m_cellSize.y, z * m_cellSize.z);
+    }
+private:
+    struct Grid {
+        uint32_t emitterIndex;
+        uint32_t mediumIndex;
+        const Emitter *emitter;
+        const Medium *medium;
+        std::vector<Spectrum> values;
+        Float meanError, maxError;
+    };
+
+    std::vector<Grid> m_grids;
+    AABB m_aabb;
+    Vector3i m_res;
+    Vector m_cellSize, m_invCellSize;
+    int m_resolution, m_sampleCount;
+    ref<ParallelProcess> m_process;
+    bool m_cancelled;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_TRCACHE_H_ */
@@ -22,6 +22,9 @@
 
 #include <mitsuba/core/triangle.h>
 #include <mitsuba/core/pmf.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/half.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/render/shape.h>
 
 MTS_NAMESPACE_BEGIN
@@ -133,26 +136,61 @@ public:
     /// Return the vertex positions
     inline Point *getVertexPositions() { return m_positions; };
 
-    /// Return the vertex normals (const version)
+    /**
+     * \brief Return the vertex normals (const version)
+     *
+     * This is \c NULL when the attributes are quantized, see \ref quantize()
+     */
     inline const Normal *getVertexNormals() const { return m_normals; };
     /// Return the vertex normals
     inline Normal *getVertexNormals() { return m_normals; };
     /// Does the mesh have vertex normals?
-    inline bool hasVertexNormals() const { return m_normals != NULL; };
+    inline bool hasVertexNormals() const { return m_normals != NULL || m_packedNormals != NULL; };
+
+    /// Return the normal of a vertex (also supports quantized storage)
+    inline Normal getVertexNormal(size_t index) const {
+        if (EXPECT_TAKEN(m_normals != NULL))
+            return m_normals[index];
+        return decodeNormal(m_packedNormals[index]);
+    }
 
-    /// Return the vertex colors (const version)
+    /**
+     * \brief Return the vertex colors (const version)
+     *
+     * This is \c NULL when the attributes are quantized, see \ref quantize()
+     */
     inline const Color3 *getVertexColors() const { return m_colors; };
     /// Return the vertex colors
     inline Color3 *getVertexColors() { return m_colors; };
     /// Does the mesh have vertex colors?
-    inline bool hasVertexColors() const { return m_colors != NULL; };
+    inline bool hasVertexColors() const { return m_colors != NULL || m_packedColors != NULL; };
+
+    /// Return the color of a vertex (also supports quantized storage)
+    inline Color3 getVertexColor(size_t index) const {
+        if (EXPECT_TAKEN(m_colors != NULL))
+            return m_colors[index];
+        const half *c = m_packedColors + 3*index;
+        return Color3((Float) c[0], (Float) c[1], (Float) c[2]);
+    }
 
-    /// Return the vertex texture coordinates (const version)
+    /**
+     * \brief Return the vertex texture coordinates (const version)
+     *
+     * This is \c NULL when the attributes are quantized, see \ref quantize()
+     */
     inline const Point2 *getVertexTexcoords() const { return m_texcoords; };
     /// Return the vertex texture coordinates
     inline Point2 *getVertexTexcoords() { return m_texcoords; };
     /// Does the mesh have vertex texture coordinates?
-    inline bool hasVertexTexcoords() const { return m_texcoords != NULL; };
+    inline bool hasVertexTexcoords() const { return m_texcoords != NULL || m_packedTexcoords != NULL; };
+
+    /// Return the texture coordinates of a vertex (also supports quantized storage)
+    inline Point2 getVertexTexcoord(size_t index) const {
+        if (EXPECT_TAKEN(m_texcoords != NULL))
+            return m_texcoords[index];
+        const half *uv = m_packedTexcoords + 2*index;
+        return Point2((Float) uv[0], (Float) uv[1]);
+    }
 
     /// Return the per-triangle UV tangents (const version)
     inline const TangentSpace *getUVTangents() const { return m_tangents; };
@@ -161,6 +199,18 @@ public:
     /// Does the mesh have UV tangent information?
     inline bool hasUVTangents() const { return m_tangents != NULL; };
 
+    /**
+     * \brief Return the per-vertex UV tangents (const version)
+     *
+     * These are only available when the mesh was configured with
+     * \c smoothTangents, see \ref computeUVTangents().
+     */
+    inline const TangentSpace *getVertexTangents() const { return m_vertexTangents; };
+    /// Return the per-vertex UV tangents
+    inline TangentSpace *getVertexTangents() { return m_vertexTangents; };
+    /// Does the mesh have per-vertex UV tangent information?
+    inline bool hasVertexTangents() const { return m_vertexTangents != NULL; };
+
     //! @}
     // =============================================================
 
@@ -197,6 +247,34 @@ public:
 
     Float pdfPosition(const PositionSamplingRecord &pRec) const;
 
+    /**
+     * \brief Sample a point on the mesh by choosing a triangle
+     * proportionally to its area and then sampling the solid angle
+     * that it subtends at the reference point
+     *
+     * Compared to \ref Shape::sampleDirect(), this significantly reduces
+     * variance when the reference point is close to large triangles.
+     * Triangles that subtend very small or very large solid angles
+     * fall back to uniform sampling with respect to area.
+     *
+     * \param dRec
+     *     A direct sampling record that specifies the reference point and
+     *     receives the sampled position, direction, and solid angle density
+     * \param sample
+     *     A uniformly distributed 2D vector
+     */
+    void sampleDirectSolidAngle(DirectSamplingRecord &dRec,
+            const Point2 &sample) const;
+
+    /**
+     * \brief Query the probability density of
+     * \ref sampleDirectSolidAngle()
+     *
+     * This requires the triangle index in \c dRec.primIndex. When it is
+     * unknown, the density of \ref Shape::pdfDirect() is returned.
+     */
+    Float pdfDirectSolidAngle(const DirectSamplingRecord &dRec) const;
+
     //! @}
     // =============================================================
 
@@ -208,6 +286,12 @@ public:
      * \brief Generate per-triangle space basis vectors from
      * a user-specified set of UV coordinates
      *
+     * When \ref setSmoothTangents() was requested, this function
+     * additionally averages them into per-vertex tangents (weighted by
+     * the triangle areas), which are then interpolated over the
+     * triangles. This yields a continuous tangent frame, so that bump
+     * and normal maps don't reveal the tessellation of the mesh.
+     *
      * Will throw an exception when no UV coordinates are
      * associated with the mesh.
      */
@@ -239,6 +323,52 @@ public:
      */
     void rebuildTopology(Float maxAngle);
 
+    /**
+     * \brief Convert the vertex normals, texture coordinates and colors
+     * into a compact quantized representation
+     *
+     * Normals are stored using a 32 bit octahedral encoding, while
+     * texture coordinates and colors use half precision, which cuts the
+     * storage of these attributes by a factor of 2-3 (more in double
+     * precision builds). They are decoded on the fly when an
+     * intersection record is created. Afterwards, the raw attribute
+     * arrays (e.g. \ref getVertexNormals()) are \c NULL, and the
+     * per-vertex accessors (e.g. \ref getVertexNormal()) must be used
+     * instead. Vertex positions are not affected.
+     *
+     * This is done automatically by \ref configure() when the
+     * \c quantize parameter of the shape is set to \c true.
+     */
+    void quantize();
+
+    /// Are the vertex attributes stored in quantized form?
+    inline bool isQuantized() const { return m_quantized; }
+
+    /// Request that \ref configure() quantizes the vertex attributes
+    inline void setQuantize(bool quantize) { m_quantize = quantize; }
+
+    /// Request per-vertex UV tangents (see \ref computeUVTangents())
+    inline void setSmoothTangents(bool smoothTangents) { m_smoothTangents = smoothTangents; }
+
+    /// Encode a unit vector using 2x16 bit octahedral coordinates
+    static uint32_t encodeNormal(const Normal &n);
+
+    /// Decode a unit vector created by \ref encodeNormal()
+    static inline Normal decodeNormal(uint32_t value) {
+        Float x = (int16_t) (value & 0xFFFF) * (1.0f / 32767.0f),
+              y = (int16_t) (value >> 16) * (1.0f / 32767.0f),
+              z = 1 - std::abs(x) - std::abs(y);
+
+        if (z < 0) {
+            /* Unfold the lower hemisphere */
+            Float ox = x;
+            x = (1 - std::abs(y))  * (ox < 0 ? -1.0f : 1.0f);
+            y = (1 - std::abs(ox)) * (y  < 0 ? -1.0f : 1.0f);
+        }
+
+        return normalize(Normal(x, y, z));
+    }
+
     /// Serialize to a file/network stream
     void serialize(Stream *stream, InstanceManager *manager) const;
 
@@ -251,6 +381,25 @@ public:
      */
     void serialize(Stream *stream) const;
 
+    /**
+     * \brief Serialize to an uncompressed file that can be memory-mapped
+     *
+     * This writes the same triangle data as \ref serialize(Stream *), but
+     * uses a newer version of the file format that stores the attribute
+     * arrays uncompressed, in the floating point precision of this build
+     * and starting at a page boundary of the underlying file. Such files
+     * are considerably larger, but the \c serialized plugin can hand the
+     * memory-mapped contents directly to the mesh (see \ref loadMapped()),
+     * and multiple processes rendering from the same file share the pages.
+     *
+     * \remark The stream position must correspond to the offset within the
+     * output file, hence it should be a \ref FileStream.
+     */
+    void serializeUncompressed(Stream *stream) const;
+
+    /// Does this mesh reference attribute arrays in a memory-mapped file?
+    inline bool isMapped() const { return m_mappedFile.get() != NULL; }
+
     /**
      * \brief Build a discrete probability distribution
      * for sampling.
@@ -324,6 +473,23 @@ protected:
     /// Load a Mitsuba compressed triangle mesh substream
     void loadCompressed(Stream *stream, int idx = 0);
 
+    /**
+     * \brief Reference the triangle mesh stored at the specified
+     * offset of a memory-mapped file without copying it
+     *
+     * The mesh must have been written using \ref serializeUncompressed()
+     * with a matching floating point precision. Returns \c false (without
+     * modifying the mesh) if the data cannot be used in place, in which
+     * case the caller should fall back to \ref loadCompressed().
+     */
+    bool loadMapped(MemoryMappedFile *file, size_t offset);
+
+    /**
+     * \brief Replace any attribute arrays referencing a memory-mapped
+     * file by private copies, so that they can be modified
+     */
+    void makeWritable();
+
     /**
      * \brief Reads the header information of a compressed file, returning
      * the version ID.
@@ -350,8 +516,37 @@ protected:
      static int readOffsetDictionary(Stream *stream, short version,
          std::vector<size_t>& outOffsets);
 
+    /// Can meshes stored using the given file version be memory-mapped?
+    static bool isMappableVersion(short version);
+
     /// Prepare internal tables for sampling uniformly wrt. area
     void prepareSamplingTable();
+
+    /// Write the vertex attribute arrays (decoding quantized data if needed)
+    void serializeAttributes(Stream *stream) const;
+
+    /// Does the given array point into the memory-mapped file?
+    inline bool isMapped(const void *ptr) const {
+        if (!m_mappedFile)
+            return false;
+        const uint8_t *start = static_cast<const uint8_t *>(m_mappedFile->getData());
+        return ptr >= start && ptr < start + m_mappedFile->getSize();
+    }
+
+    /// Release an attribute array unless it is part of a memory-mapped file
+    template <typename T> inline void freeArray(T *&ptr) {
+        if (ptr && !isMapped(ptr))
+            delete[] ptr;
+        ptr = NULL;
+    }
+
+    /// Size of an attribute array unless it is part of a memory-mapped file
+    template <typename T> inline size_t arraySize(const T *ptr, size_t count) const {
+        return (ptr && !isMapped(ptr)) ? sizeof(T) * count : 0;
+    }
+
+    /// Report the memory used by the attribute arrays to \ref MemoryTracker
+    void trackMemory();
 protected:
     AABB m_aabb;
     Triangle *m_triangles;
@@ -359,17 +554,26 @@ protected:
     Normal *m_normals;
     Point2 *m_texcoords;
     TangentSpace *m_tangents;
+    TangentSpace *m_vertexTangents;
     Color3 *m_colors;
+    uint32_t *m_packedNormals;
+    half *m_packedTexcoords;
+    half *m_packedColors;
     size_t m_triangleCount;
     size_t m_vertexCount;
     bool m_flipNormals;
     bool m_faceNormals;
+    bool m_quantize;
+    bool m_quantized;
+    bool m_smoothTangents;
 
     /* Surface and distribution -- generated on demand */
     DiscreteDistribution m_areaDistr;
     Float m_surfaceArea;
     Float m_invSurfaceArea;
     ref<Mutex> m_mutex;
+    ref<MemoryMappedFile> m_mappedFile;
+    TrackedMemory<EMemoryMesh> m_memory;
 };
 
 MTS_NAMESPACE_END
@@ -45,6 +45,19 @@ public:
     /// Look up a floating point value by position
     virtual Float lookupFloat(const Point &p) const;
 
+    /**
+     * \brief Look up floating point values at a sequence of
+     * equidistant positions
+     *
+     * Writes the values at <tt>p + i*step</tt> for <tt>i=0, ...,
+     * count-1</tt> into \c result. This is used by ray marching
+     * code (e.g. Simpson quadrature) and allows implementations to
+     * amortize per-lookup overheads over a whole ray segment. The
+     * default implementation calls \ref lookupFloat() for each point.
+     */
+    virtual void lookupFloatBatch(const Point &p, const Vector &step,
+        size_t count, Float *result) const;
+
     /// Are spectrum-valued lookups permitted?
     virtual bool supportsSpectrumLookups() const;
 
@@ -71,6 +84,17 @@ public:
      */
     virtual Float getMaximumFloatValue() const = 0;
 
+    /**
+     * \brief Return the maximum floating point value that could be
+     * returned by \ref lookupFloat within the given (world space)
+     * bounding box.
+     *
+     * This is used to build majorant grids for Woodcock tracking. The
+     * default implementation conservatively returns the global
+     * maximum given by \ref getMaximumFloatValue().
+     */
+    virtual Float getLocalMaximumFloatValue(const AABB &aabb) const;
+
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
@@ -129,12 +129,24 @@ public:
             offset += bsdf->getComponentCount();
             m_usesRayDifferentials |= bsdf->usesRayDifferentials();
         }
+
+        /* Avoid the texture lookups when the weight is the same everywhere */
+        m_constantWeight = m_weight->isConstant();
+        m_weightValue = std::min((Float) 1.0f, std::max((Float) 0.0f,
+            m_weight->getAverage().average()));
         BSDF::configure();
     }
 
+    /// Look up the (clamped) blend weight at \c its
+    inline Float evalWeight(const Intersection &its) const {
+        if (m_constantWeight)
+            return m_weightValue;
+        return std::min((Float) 1.0f, std::max((Float) 0.0f,
+            m_weight->eval(its).average()));
+    }
+
     Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
-        Float weight = std::min((Float) 1.0f, std::max((Float) 0.0f,
-            m_weight->eval(bRec.its).average()));
+        Float weight = evalWeight(bRec.its);
 
         if (bRec.component == -1) {
             return
@@ -154,8 +166,7 @@ public:
     Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         Spectrum result;
 
-        Float weight = std::min((Float) 1.0f, std::max((Float) 0.0f,
-            m_weight->eval(bRec.its).average()));
+        Float weight = evalWeight(bRec.its);
 
         if (bRec.component == -1) {
             return
@@ -172,12 +183,34 @@ public:
         }
     }
 
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        Float weight = evalWeight(bRec.its);
+
+        if (bRec.component == -1) {
+            Float pdf0, pdf1;
+            Spectrum result =
+                m_bsdfs[0]->evalWithPdf(bRec, pdf0, measure) * (1-weight) +
+                m_bsdfs[1]->evalWithPdf(bRec, pdf1, measure) * weight;
+            pdf = pdf0 * (1-weight) + pdf1 * weight;
+            return result;
+        } else {
+            /* Pick out an individual component */
+            int idx = m_indices[bRec.component].first;
+            if (idx == 0)
+                weight = 1-weight;
+            BSDFSamplingRecord bRec2(bRec);
+            bRec2.component = m_indices[bRec.component].second;
+            Spectrum result = m_bsdfs[idx]->evalWithPdf(bRec2, pdf, measure) * weight;
+            pdf *= weight;
+            return result;
+        }
+    }
+
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &_sample) const {
         Point2 sample(_sample);
 
         Float weights[2];
-        weights[1] = std::min((Float) 1.0f, std::max((Float) 0.0f,
-            m_weight->eval(bRec.its).average()));
+        weights[1] = evalWeight(bRec.its);
         weights[0] = 1-weights[1];
 
         if (bRec.component == -1) {
@@ -222,8 +255,7 @@ public:
         Point2 sample(_sample);
 
         Float weights[2];
-        weights[1] = std::min((Float) 1.0f, std::max((Float) 0.0f,
-            m_weight->eval(bRec.its).average()));
+        weights[1] = evalWeight(bRec.its);
         weights[0] = 1-weights[1];
 
         if (bRec.component == -1) {
@@ -298,6 +330,8 @@ public:
 private:
     std::vector<BSDF *> m_bsdfs;
     ref<Texture> m_weight;
+    Float m_weightValue;
+    bool m_constantWeight;
     std::vector<std::pair<int, int> > m_indices;
     std::vector<int> m_offsets;
 };
@@ -56,6 +56,13 @@ MTS_NAMESPACE_BEGIN
  * the strength of the displacement. If desired, the \pluginref{scale}
  * texture plugin can be used to magnify or reduce the effect of a
  * bump map texture.
+ *
+ * The gradient of a \pluginref{bitmap} texture is obtained from the
+ * two MIP map levels that match the footprint of the lookup, which filters
+ * the bump map like the texture itself instead of aliasing at a distance.
+ * On triangle meshes, the perturbed frame is built around the per-triangle
+ * UV tangents; set the \code{smoothTangents} parameter of the mesh for a
+ * continuous frame that doesn't reveal the tessellation.
  * \begin{xml}[caption=A rough metal model with a scaled image-based bump map]
  * <bsdf type="bumpmap">
  *     <!-- The bump map is applied to a rough metal BRDF -->
@@ -191,6 +198,24 @@ public:
         return m_nested->pdf(perturbedQuery, measure);
     }
 
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        const Intersection& its = bRec.its;
+        Intersection perturbed(its);
+        perturbed.shFrame = getFrame(its);
+
+        BSDFSamplingRecord perturbedQuery(perturbed,
+            perturbed.toLocal(its.toWorld(bRec.wi)),
+            perturbed.toLocal(its.toWorld(bRec.wo)), bRec.mode);
+        if (Frame::cosTheta(bRec.wo) * Frame::cosTheta(perturbedQuery.wo) <= 0) {
+            pdf = 0.0f;
+            return Spectrum(0.0f);
+        }
+        perturbedQuery.sampler = bRec.sampler;
+        perturbedQuery.typeMask = bRec.typeMask;
+        perturbedQuery.component = bRec.component;
+        return m_nested->evalWithPdf(perturbedQuery, pdf, measure);
+    }
+
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
         const Intersection& its = bRec.its;
         Intersection perturbed(its);
@@ -295,6 +295,61 @@ public:
         }
     }
 
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        bool sampleSpecular = (bRec.typeMask & EDeltaReflection)
+            && (bRec.component == -1 || bRec.component == (int) m_components.size()-1);
+        bool sampleNested = (bRec.typeMask & m_nested->getType() & BSDF::EAll)
+            && (bRec.component == -1 || bRec.component < (int) m_components.size()-1);
+
+        Float R12;
+        Vector wiPrime = refractIn(bRec.wi, R12);
+
+        /* Reallocate samples */
+        Float probSpecular = (R12*m_specularSamplingWeight) /
+            (R12*m_specularSamplingWeight +
+            (1-R12) * (1-m_specularSamplingWeight));
+
+        pdf = 0.0f;
+        if (measure == EDiscrete && sampleSpecular &&
+                std::abs(dot(reflect(bRec.wi), bRec.wo)-1) < DeltaEpsilon) {
+            pdf = sampleNested ? probSpecular : 1.0f;
+            return m_specularReflectance->eval(bRec.its) *
+                fresnelDielectricExt(std::abs(Frame::cosTheta(bRec.wi)), m_eta);
+        } else if (sampleNested) {
+            Float R21;
+            BSDFSamplingRecord bRecInt(bRec);
+            bRecInt.wi = wiPrime;
+            bRecInt.wo = refractIn(bRec.wo, R21);
+
+            if (R12 == 1 || R21 == 1) /* Total internal reflection */
+                return Spectrum(0.0f);
+
+            Spectrum result = m_nested->evalWithPdf(bRecInt, pdf, measure)
+                * (1-R12) * (1-R21);
+
+            Spectrum sigmaA = m_sigmaA->eval(bRec.its) * m_thickness;
+            if (!sigmaA.isZero())
+                result *= (-sigmaA *
+                    (1/std::abs(Frame::cosTheta(bRecInt.wi)) +
+                     1/std::abs(Frame::cosTheta(bRecInt.wo)))).exp();
+
+            /* Solid angle compression & irradiance conversion factors */
+            if (measure == ESolidAngle) {
+                Float factor = m_invEta * m_invEta *
+                    Frame::cosTheta(bRec.wo) / Frame::cosTheta(bRecInt.wo);
+                result *= factor;
+                pdf *= factor;
+            }
+
+            if (sampleSpecular)
+                pdf *= 1 - probSpecular;
+
+            return result;
+        }
+
+        return Spectrum(0.0f);
+    }
+
     Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &_sample) const {
         bool sampleSpecular = (bRec.typeMask & EDeltaReflection)
             && (bRec.component == -1 || bRec.component == (int) m_components.size()-1);
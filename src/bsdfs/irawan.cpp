@@ -42,6 +42,14 @@ MTS_NAMESPACE_BEGIN
  *     \parameter{repeatU, repeatV}{\Float}{Specifies the number
  *         of weave pattern repetitions over a $[0,1]^2$ region of the UV
  *         parameterization}
+ *     \parameter{tableResolution}{\Integer}{
+ *         The radius of curvature of every yarn's spine is tabulated
+ *         ahead of time using this many entries along the yarn (and,
+ *         when the weave pattern contains noise, a quarter as many
+ *         over the range of inclination angles). Higher values are more
+ *         accurate, and \code{0} evaluates it exactly instead.
+ *         \default{64}
+ *     }
  *     \parameter{(\emph{Additional parameters})}{\Spectrum\Or\Float}{
  *         Weave pattern files may define their own custom parameters; this is
  *         useful for instance to support changing the color of a weave
@@ -81,6 +89,23 @@ MTS_NAMESPACE_BEGIN
  */
 class IrawanClothBRDF : public BSDF {
 public:
+    /// Direction-independent quantities of a yarn that are computed by \ref configure()
+    struct YarnTable {
+        /// Tangent and absolute sine of the fiber twist angle
+        Float tanPsi, absSinPsi;
+        /// Normalization by the area of the yarn type
+        Float areaScale;
+        /// Smallest tabulated inclination angle and inverse spacing of the table
+        Float umaxMin, invUmaxSpacing;
+        /// Number of tabulated inclination angles
+        int umaxResolution;
+        /// Radius of curvature (umax-major, \c m_tableResolution entries per row)
+        std::vector<Float> curvature;
+
+        YarnTable() : tanPsi(0), absSinPsi(0), areaScale(1),
+            umaxMin(0), invUmaxSpacing(0), umaxResolution(0) { }
+    };
+
     IrawanClothBRDF(const Properties &props)
         : BSDF(props), m_specularNormalization(0) {
 
@@ -112,6 +137,10 @@ public:
         m_repeatU = props.getFloat("repeatU");
         m_repeatV = props.getFloat("repeatV");
 
+        m_tableResolution = props.getInteger("tableResolution", 64);
+        if (m_tableResolution < 0 || m_tableResolution == 1)
+            Log(EError, "The 'tableResolution' parameter must be zero or at least two!");
+
         if (props.hasProperty("ksMultiplier") || props.hasProperty("kdMultiplier"))
             Log(EError, "The 'ksMultiplier' and 'kdMultiplier' parameters were "
                 "replaced by a normalization scheme. Please remove them and "
@@ -124,6 +153,7 @@ public:
         m_repeatU = stream->readFloat();
         m_repeatV = stream->readFloat();
         m_specularNormalization = stream->readFloat();
+        m_tableResolution = stream->readInt();
         configure();
     }
 
@@ -134,6 +164,7 @@ public:
         stream->writeFloat(m_repeatU);
         stream->writeFloat(m_repeatV);
         stream->writeFloat(m_specularNormalization);
+        stream->writeInt(m_tableResolution);
     }
 
     void configure() {
@@ -143,6 +174,8 @@ public:
         m_components.push_back(EDiffuseReflection | EFrontSide
             | ESpatiallyVarying);
 
+        precompute();
+
         /* Estimate the average reflectance under diffuse
            illumination and use it to normalize the specular
            component */
@@ -281,13 +314,14 @@ public:
         // Compute specular contribution.
         Spectrum result(0.0f);
         if (hasSpecular) {
+            const YarnTable &table = m_yarnTables[yarnID];
             Float integrand;
             if (psi != 0.0f)
                 integrand = evalStapleIntegrand(u, v, om_i, om_r, m_pattern.alpha,
-                        m_pattern.beta, psi, umax, kappa, w, l);
+                        m_pattern.beta, psi, umax, kappa, w, l, table);
             else
                 integrand = evalFilamentIntegrand(u, v, om_i, om_r, m_pattern.alpha,
-                        m_pattern.beta, m_pattern.ss, umax, kappa, w, l);
+                        m_pattern.beta, m_pattern.ss, umax, kappa, w, l, table);
 
             // Initialize random number generator based on texture location.
             Float intensityVariation = 1.0f;
@@ -306,10 +340,7 @@ public:
             else
                 result = Spectrum(intensityVariation * integrand);
 
-            if (type == Yarn::EWarp)
-                result *= (m_pattern.warpArea + m_pattern.weftArea) / m_pattern.warpArea;
-            else
-                result *= (m_pattern.warpArea + m_pattern.weftArea) / m_pattern.weftArea;
+            result *= table.areaScale;
         }
 
         if (hasDiffuse && !m_initialization)
@@ -386,10 +417,11 @@ public:
      *  weave pattern
      *  w    width of segment rectangle
      *  l    length of segment rectangle
+     *  table precomputed quantities of the yarn
      */
     Float evalFilamentIntegrand(Float u, Float v, const Vector &om_i,
             const Vector &om_r, Float alpha, Float beta, Float ss,
-            Float umax, Float kappa, Float w, Float l) const {
+            Float umax, Float kappa, Float w, Float l, const YarnTable &table) const {
         // 0 <= ss < 1.0
         if (ss < 0.0f || ss >= 1.0f)
             return 0.0f;
@@ -417,7 +449,7 @@ public:
             Vector t = normalize(Vector(0.0f, std::cos(u_of_v), -std::sin(u_of_v)));
 
             // R is radius of curvature.
-            Float R = radiusOfCurvature(std::min(std::abs(u_of_v),
+            Float R = lookupRadiusOfCurvature(table, std::min(std::abs(u_of_v),
                 (1-ss)*umax), (1-ss)*umax, kappa, w, l);
 
             // G is geometry factor.
@@ -478,10 +510,11 @@ public:
      *  weave pattern
      *  w    width of segment rectangle
      *  l    length of segment rectangle
+     *  table precomputed quantities of the yarn
      */
     Float evalStapleIntegrand(Float u, Float v, const Vector &om_i,
             const Vector &om_r, Float alpha, Float beta, Float psi,
-            Float umax, Float kappa, Float w, Float l) const {
+            Float umax, Float kappa, Float w, Float l, const YarnTable &table) const {
         // w * sin(umax) < l
         if (w * std::sin(umax) >= l)
             return 0.0f;
@@ -495,7 +528,7 @@ public:
 
         // v_of_u is location of specular reflection.
         Float D = (h.y*std::cos(u) - h.z*std::sin(u))
-            / (std::sqrt(h.x * h.x + std::pow(h.y * std::sin(u) + h.z * std::cos(u), (Float) 2.0f)) * std::tan(psi));
+            / (std::sqrt(h.x * h.x + std::pow(h.y * std::sin(u) + h.z * std::cos(u), (Float) 2.0f)) * table.tanPsi);
         Float v_of_u = std::atan2(-h.y * std::sin(u) - h.z * std::cos(u), h.x) + math::safe_acos(D);
 
         // Check if v_of_u within the range of valid v values
@@ -511,13 +544,13 @@ public:
                     -std::sin(u) * std::cos(psi) + std::cos(u) * std::sin(v_of_u) * std::sin(psi))); */
 
             // R is radius of curvature.
-            Float R = radiusOfCurvature(std::abs(u), umax, kappa, w, l);
+            Float R = lookupRadiusOfCurvature(table, std::abs(u), umax, kappa, w, l);
 
             // G is geometry factor.
             Float a = 0.5f * w;
             Vector om_i_plus_om_r(om_i + om_r);
             Float Gv = a * (R + a * std::cos(v_of_u))
-                / (om_i_plus_om_r.length() * dot(n, h) * std::abs(std::sin(psi)));
+                / (om_i_plus_om_r.length() * dot(n, h) * table.absSinPsi);
 
             // fc is phase function.
             Float fc = alpha + vonMises(-dot(om_i, om_r), beta);
@@ -584,10 +617,85 @@ public:
         return math::fastlog((1.0f + arg) / (1.0f - arg)) / 2.0f;
     }
 
-    // von Mises Distribution
-    Float vonMises(Float cos_x, Float b) const {
-        // assumes a = 0, b > 0 is a concentration parameter.
+    /**
+     * \brief Look up the radius of curvature in the table of a yarn,
+     * or, if the arguments aren't covered by it, evaluate it exactly
+     */
+    Float lookupRadiusOfCurvature(const YarnTable &table, Float u, Float umax,
+            Float kappa, Float w, Float l) const {
+        if (!table.curvature.empty() && umax > 0) {
+            Float x = (umax - table.umaxMin) * table.invUmaxSpacing,
+                  y = u / umax * (m_tableResolution - 1);
+            bool covered = table.umaxResolution == 1 ? umax == table.umaxMin
+                : (x >= 0 && x <= table.umaxResolution - 1);
+            if (covered && y >= 0 && y <= m_tableResolution - 1) {
+                int x0 = std::max(0, std::min((int) x, table.umaxResolution - 2)),
+                    y0 = std::min((int) y, m_tableResolution - 2);
+                Float dx = x - x0, dy = y - y0;
+                const Float *row0 = &table.curvature[x0 * m_tableResolution + y0],
+                            *row1 = table.umaxResolution == 1 ? row0 : row0 + m_tableResolution;
+                return (1 - dx) * ((1 - dy) * row0[0] + dy * row0[1])
+                     + dx * ((1 - dy) * row1[0] + dy * row1[1]);
+            }
+        }
+        return radiusOfCurvature(u, umax, kappa, w, l);
+    }
+
+    /// Precompute the direction-independent quantities of the pattern and its yarns
+    void precompute() {
+        m_vonMisesNormalization = 1 / (2 * M_PI * besselI0(m_pattern.beta));
 
+        /* umax varies by this much between yarn segments (Perlin noise is within [-1, 1]) */
+        Float warpNoise = 0, weftNoise = 0;
+        if (m_pattern.period > 0.0f) {
+            warpNoise = std::abs(m_pattern.dWarpUmaxOverDWarp) + std::abs(m_pattern.dWarpUmaxOverDWeft);
+            weftNoise = std::abs(m_pattern.dWeftUmaxOverDWarp) + std::abs(m_pattern.dWeftUmaxOverDWeft);
+        }
+
+        m_yarnTables.clear();
+        m_yarnTables.resize(m_pattern.yarns.size());
+        for (size_t i=0; i<m_pattern.yarns.size(); ++i) {
+            const Yarn &yarn = m_pattern.yarns[i];
+            YarnTable &table = m_yarnTables[i];
+
+            table.tanPsi = std::tan(yarn.psi);
+            table.absSinPsi = std::abs(std::sin(yarn.psi));
+            table.areaScale = (m_pattern.warpArea + m_pattern.weftArea) /
+                (yarn.type == Yarn::EWarp ? m_pattern.warpArea : m_pattern.weftArea);
+
+            if (m_tableResolution == 0)
+                continue;
+
+            /* The filament model evaluates the curvature of a shortened spine */
+            Float scale = yarn.psi != 0.0f ? (Float) 1 : 1 - m_pattern.ss,
+                  noise = yarn.type == Yarn::EWarp ? warpNoise : weftNoise;
+            table.umaxMin = scale * (yarn.umax - noise);
+            table.umaxResolution = noise > 0 ? std::max(2, m_tableResolution / 4) : 1;
+            table.invUmaxSpacing = noise > 0 ? (table.umaxResolution - 1)
+                / (scale * 2 * noise) : (Float) 0;
+
+            table.curvature.resize(table.umaxResolution * m_tableResolution);
+            bool valid = true;
+            for (int j=0; j<table.umaxResolution; ++j) {
+                Float umax = noise > 0 ? table.umaxMin + j / table.invUmaxSpacing
+                    : table.umaxMin;
+                for (int k=0; k<m_tableResolution; ++k) {
+                    Float R = radiusOfCurvature(umax * k / (m_tableResolution - 1),
+                        umax, yarn.kappa, yarn.width, yarn.length);
+                    table.curvature[j * m_tableResolution + k] = R;
+                    valid &= std::isfinite(R);
+                }
+            }
+
+            /* Degenerate yarns (e.g. with a vanishing inclination
+               angle) are evaluated exactly */
+            if (!valid)
+                table.curvature.clear();
+        }
+    }
+
+    /// Modified Bessel function of the first kind and order zero (polynomial approximation)
+    static Float besselI0(Float b) {
         Float I0, absB = std::abs(b);
         if (std::abs(b) <= 3.75f) {
             Float t = absB / 3.75f;
@@ -600,8 +708,14 @@ public:
                 + t*(0.00225319f + t*(-0.00157565f + t*(0.00916281f + t*(-0.02057706f
                 + t*(0.02635537f + t*(-0.01647633f + t*0.00392377f))))))));
         }
+        return I0;
+    }
 
-        return math::fastexp(b * cos_x) / (2 * M_PI * I0);
+    // von Mises Distribution
+    inline Float vonMises(Float cos_x, Float b) const {
+        // assumes a = 0, b > 0 is a concentration parameter.
+        // The normalization only depends on the pattern and is precomputed
+        return math::fastexp(b * cos_x) * m_vonMisesNormalization;
     }
 
     /// Attenuation term
@@ -626,7 +740,8 @@ public:
             << "  id = \"" << getID() << "\"," << endl
             << "  weavePattern = " << indent(m_pattern.toString()) << "," << endl
             << "  repeatU = " << m_repeatU << "," << endl
-            << "  repeatV = " << m_repeatV << endl
+            << "  repeatV = " << m_repeatV << "," << endl
+            << "  tableResolution = " << m_tableResolution << endl
             << "]";
         return oss.str();
     }
@@ -638,6 +753,9 @@ private:
     WeavePattern m_pattern;
     Float m_repeatU, m_repeatV;
     Float m_specularNormalization;
+    Float m_vonMisesNormalization;
+    int m_tableResolution;
+    std::vector<YarnTable> m_yarnTables;
     bool m_initialization;
 };
 
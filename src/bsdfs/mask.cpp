@@ -146,6 +146,30 @@ public:
         }
     }
 
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        bool sampleTransmission = bRec.typeMask & ENull
+            && (bRec.component == -1 || bRec.component == getComponentCount()-1);
+        bool sampleNested = bRec.component == -1 || bRec.component < getComponentCount()-1;
+
+        Spectrum opacity = m_opacity->eval(bRec.its);
+        Float prob = opacity.getLuminance();
+
+        pdf = 0.0f;
+        if (measure == ESolidAngle) {
+            Float nestedPdf;
+            Spectrum result = m_nestedBSDF->evalWithPdf(bRec, nestedPdf, ESolidAngle) * opacity;
+            if (sampleNested)
+                pdf = sampleTransmission ? nestedPdf * prob : nestedPdf;
+            return result;
+        } else if (measure == EDiscrete && std::abs(1-dot(bRec.wi, -bRec.wo)) < DeltaEpsilon) {
+            if (sampleTransmission)
+                pdf = sampleNested ? 1-prob : 1.0f;
+            return Spectrum(1.0f) - opacity;
+        } else {
+            return Spectrum(0.0f);
+        }
+    }
+
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &_sample) const {
         Point2 sample(_sample);
         Spectrum opacity = m_opacity->eval(bRec.its);
@@ -26,6 +26,25 @@
 
 MTS_NAMESPACE_BEGIN
 
+/// Enumeration of the microfacet distribution types, see \ref TMicrofacetDistribution
+class MicrofacetDistributionBase {
+public:
+    /// Supported distribution types
+    enum EType {
+        /// Beckmann distribution derived from Gaussian random surfaces
+        EBeckmann         = 0,
+
+        /// GGX: Long-tailed distribution for very rough surfaces (aka. Trowbridge-Reitz distr.)
+        EGGX              = 1,
+
+        /// Phong distribution (with the anisotropic extension by Ashikhmin and Shirley)
+        EPhong            = 2,
+
+        /// Template argument of \ref TMicrofacetDistribution: type is chosen at runtime
+        EDynamic          = -1
+    };
+};
+
 /**
  * \brief Implementation of the Beckman and GGX / Trowbridge-Reitz microfacet
  * distributions and various useful sampling routines
@@ -41,21 +60,25 @@ MTS_NAMESPACE_BEGIN
  *    by Eric Heitz and Eugene D'Eon
  *
  *  The visible normal sampling code was provided by Eric Heitz and Eugene D'Eon.
+ *
+ * The default arguments yield the general implementation (available as the
+ * \ref MicrofacetDistribution typedef), which selects the distribution type
+ * and the isotropic code paths at runtime. The rough BSDFs instead
+ * instantiate the kernels of their BSDF for \c Type set to a fixed
+ * distribution and, if both roughness values are known to always agree,
+ * for <tt>Isotropic=true</tt>. All type and isotropy checks then resolve at
+ * compile time (see \ref selectMicrofacetKernels()).
+ *
+ * \tparam Type
+ *     A value of \ref EType, or \c EDynamic to use the type that is passed
+ *     to the constructor
+ * \tparam Isotropic
+ *     Can be set to \c true when alphaU and alphaV are guaranteed to be
+ *     equal. Otherwise, isotropy is checked at runtime.
  */
-class MicrofacetDistribution {
+template <int Type = MicrofacetDistributionBase::EDynamic, bool Isotropic = false>
+class TMicrofacetDistribution : public MicrofacetDistributionBase {
 public:
-    /// Supported distribution types
-    enum EType {
-        /// Beckmann distribution derived from Gaussian random surfaces
-        EBeckmann         = 0,
-
-        /// GGX: Long-tailed distribution for very rough surfaces (aka. Trowbridge-Reitz distr.)
-        EGGX              = 1,
-
-        /// Phong distribution (with the anisotropic extension by Ashikhmin and Shirley)
-        EPhong            = 2
-    };
-
     /**
      * Create an isotropic microfacet distribution of the specified type
      *
@@ -64,12 +87,12 @@ public:
      * \param alpha
      *     The surface roughness
      */
-    inline MicrofacetDistribution(EType type, Float alpha, bool sampleVisible = true)
+    inline TMicrofacetDistribution(EType type, Float alpha, bool sampleVisible = true)
         : m_type(type), m_alphaU(alpha), m_alphaV(alpha), m_sampleVisible(sampleVisible),
           m_exponentU(0.0f), m_exponentV(0.0f) {
         m_alphaU = std::max(m_alphaU, (Float) 1e-4f);
         m_alphaV = std::max(m_alphaV, (Float) 1e-4f);
-        if (m_type == EPhong)
+        if (getType() == EPhong)
             computePhongExponent();
     }
 
@@ -83,12 +106,12 @@ public:
      * \param alphaV
      *     The surface roughness in the bitangent direction
      */
-    inline MicrofacetDistribution(EType type, Float alphaU, Float alphaV, bool sampleVisible = true)
+    inline TMicrofacetDistribution(EType type, Float alphaU, Float alphaV, bool sampleVisible = true)
         : m_type(type), m_alphaU(alphaU), m_alphaV(alphaV), m_sampleVisible(sampleVisible),
           m_exponentU(0.0f), m_exponentV(0.0f) {
         m_alphaU = std::max(m_alphaU, (Float) 1e-4f);
         m_alphaV = std::max(m_alphaV, (Float) 1e-4f);
-        if (m_type == EPhong)
+        if (getType() == EPhong)
             computePhongExponent();
     }
 
@@ -96,7 +119,7 @@ public:
      * \brief Create a microfacet distribution from a Property data
      * structure
      */
-    MicrofacetDistribution(const Properties &props, EType type = EBeckmann,
+    TMicrofacetDistribution(const Properties &props, EType type = EBeckmann,
         Float alphaU = 0.1f, Float alphaV = 0.1f, bool sampleVisible = true)
         : m_type(type), m_alphaU(alphaU), m_alphaV(alphaV), m_exponentU(0.0f),
           m_exponentV(0.0f) {
@@ -145,7 +168,7 @@ public:
     }
 
     /// Return the distribution type
-    inline EType getType() const { return m_type; }
+    inline EType getType() const { return Type == EDynamic ? m_type : (EType) Type; }
 
     /// Return the roughness (isotropic case)
     inline Float getAlpha() const { return m_alphaU; }
@@ -169,16 +192,16 @@ public:
     inline bool getSampleVisible() const { return m_sampleVisible; }
 
     /// Is this an anisotropic microfacet distribution?
-    inline bool isAnisotropic() const { return m_alphaU != m_alphaV; }
+    inline bool isAnisotropic() const { return !isIsotropic(); }
 
     /// Is this an anisotropic microfacet distribution?
-    inline bool isIsotropic() const { return m_alphaU == m_alphaV; }
+    inline bool isIsotropic() const { return Isotropic || m_alphaU == m_alphaV; }
 
     /// Scale the roughness values by some constant
     inline void scaleAlpha(Float value) {
         m_alphaU *= value;
         m_alphaV *= value;
-        if (m_type == EPhong)
+        if (getType() == EPhong)
             computePhongExponent();
     }
 
@@ -197,7 +220,7 @@ public:
                 + (m.y*m.y) / (m_alphaV * m_alphaV)) / cosTheta2;
 
         Float result;
-        switch (m_type) {
+        switch (getType()) {
             case EBeckmann: {
                     /* Beckmann distribution function for Gaussian random surfaces - [Walter 2005] evaluation */
                     result = math::fastexp(-beckmannExponent) /
@@ -291,7 +314,7 @@ public:
         Float sinPhiM, cosPhiM;
         Float alphaSqr;
 
-        switch (m_type) {
+        switch (getType()) {
             case EBeckmann: {
                     /* Beckmann distribution function for Gaussian random surfaces */
                     if (isIsotropic()) {
@@ -369,8 +392,10 @@ public:
                     }
                     math::sincos(phiM, &sinPhiM, &cosPhiM);
                     cosThetaM = std::pow(sample.x, 1.0f / (exponent + 2.0f));
+
+                    /* cosThetaM^(exponent+1) = sample.x / cosThetaM */
                     pdf = std::sqrt((m_exponentU + 2.0f) * (m_exponentV + 2.0f))
-                        * INV_TWOPI * std::pow(cosThetaM, exponent + 1.0f);
+                        * INV_TWOPI * (cosThetaM > 0 ? sample.x / cosThetaM : (Float) 0);
                 }
                 break;
 
@@ -426,14 +451,15 @@ public:
             _wi.z
         ));
 
-        /* Get polar coordinates */
-        Float theta = 0, phi = 0;
+        /* Get polar coordinates (the azimuth is only needed
+           in terms of its sine and cosine) */
+        Float theta = 0, sinPhi = 0, cosPhi = 1;
         if (wi.z < (Float) 0.99999) {
             theta = std::acos(wi.z);
-            phi = std::atan2(wi.y, wi.x);
+            Float invSinTheta = 1 / std::sqrt(wi.x*wi.x + wi.y*wi.y);
+            cosPhi = wi.x * invSinTheta;
+            sinPhi = wi.y * invSinTheta;
         }
-        Float sinPhi, cosPhi;
-        math::sincos(phi, &sinPhi, &cosPhi);
 
         /* Step 2: simulate P22_{wi}(slope.x, slope.y, 1, 1) */
         Vector2 slope = sampleVisible11(theta, sample);
@@ -486,7 +512,7 @@ public:
             return 1.0f;
 
         Float alpha = projectRoughness(v);
-        switch (m_type) {
+        switch (getType()) {
             case EPhong:
             case EBeckmann: {
                     Float a = 1.0f / (alpha * tanTheta);
@@ -534,7 +560,7 @@ public:
     /// Return a string representation of the contents of this instance
     std::string toString() const {
         return formatString("MicrofacetDistribution[type=\"%s\", alphaU=%f, alphaV=%f]",
-            distributionName(m_type).c_str(), m_alphaU, m_alphaV);
+            distributionName(getType()).c_str(), m_alphaU, m_alphaV);
     }
 protected:
     /// Compute the effective roughness projected on direction \c v
@@ -574,7 +600,7 @@ protected:
         const Float SQRT_PI_INV = 1 / std::sqrt(M_PI);
         Vector2 slope;
 
-        switch (m_type) {
+        switch (getType()) {
             case EBeckmann: {
                     /* Special case (normal incidence) */
                     if (thetaI < 1e-4f) {
@@ -720,6 +746,49 @@ protected:
     Float m_exponentU, m_exponentV;
 };
 
+/// General microfacet distribution, whose type is chosen at runtime
+typedef TMicrofacetDistribution<> MicrofacetDistribution;
+
+/**
+ * \brief Call <tt>target->setKernels<Distribution>()</tt>, where \c Distribution
+ * is the specialization of \ref TMicrofacetDistribution that matches the
+ * given distribution type
+ *
+ * This is used by the rough BSDFs to pick the instantiations of their
+ * evaluation and sampling routines once at configuration time, which avoids
+ * the type and isotropy checks in every call.
+ *
+ * \param isotropic
+ *     Set to \c true if the roughness along both tangent directions is
+ *     guaranteed to be equal (e.g. because it is given by the same texture)
+ */
+template <typename Target> void selectMicrofacetKernels(Target *target,
+        MicrofacetDistribution::EType type, bool isotropic) {
+    typedef MicrofacetDistributionBase Base;
+    switch (type) {
+        case Base::EBeckmann:
+            if (isotropic)
+                target->template setKernels<TMicrofacetDistribution<Base::EBeckmann, true> >();
+            else
+                target->template setKernels<TMicrofacetDistribution<Base::EBeckmann, false> >();
+            break;
+        case Base::EGGX:
+            if (isotropic)
+                target->template setKernels<TMicrofacetDistribution<Base::EGGX, true> >();
+            else
+                target->template setKernels<TMicrofacetDistribution<Base::EGGX, false> >();
+            break;
+        case Base::EPhong:
+            if (isotropic)
+                target->template setKernels<TMicrofacetDistribution<Base::EPhong, true> >();
+            else
+                target->template setKernels<TMicrofacetDistribution<Base::EPhong, false> >();
+            break;
+        default:
+            SLog(EError, "Invalid distribution type!");
+    }
+}
+
 MTS_NAMESPACE_END
 
 #endif /* __MICROFACET_H */
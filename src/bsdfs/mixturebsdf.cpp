@@ -205,6 +205,27 @@ public:
         return result;
     }
 
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        Spectrum result(0.0f);
+
+        if (bRec.component == -1) {
+            pdf = 0.0f;
+            for (size_t i=0; i<m_bsdfs.size(); ++i) {
+                Float prob;
+                result += m_bsdfs[i]->evalWithPdf(bRec, prob, measure) * m_weights[i];
+                pdf += prob * m_pdf[i];
+            }
+        } else {
+            /* Pick out an individual component */
+            int idx = m_indices[bRec.component].first;
+            BSDFSamplingRecord bRec2(bRec);
+            bRec2.component = m_indices[bRec.component].second;
+            return m_bsdfs[idx]->evalWithPdf(bRec2, pdf, measure) * m_weights[idx];
+        }
+
+        return result;
+    }
+
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &_sample) const {
         Point2 sample(_sample);
         if (bRec.component == -1) {
@@ -43,6 +43,10 @@ MTS_NAMESPACE_BEGIN
  * To turn the 3D normal directions into (nonnegative) color values
  * suitable for this plugin, the
  * mapping $x \mapsto (x+1)/2$ must be applied to each component.
+ *
+ * On triangle meshes, the tangent directions of the local shading frame
+ * are constant over each triangle by default. Set the \code{smoothTangents}
+ * parameter of the mesh to interpolate them over the vertices instead.
  */
 class NormalMap : public BSDF {
 public:
@@ -200,6 +204,24 @@ public:
         return m_nested->pdf(perturbedQuery, measure);
     }
 
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        const Intersection& its = bRec.its;
+        Intersection perturbed(its);
+        perturbed.shFrame = getFrame(its);
+
+        BSDFSamplingRecord perturbedQuery(perturbed,
+            perturbed.toLocal(its.toWorld(bRec.wi)),
+            perturbed.toLocal(its.toWorld(bRec.wo)), bRec.mode);
+        if (Frame::cosTheta(bRec.wo) * Frame::cosTheta(perturbedQuery.wo) <= 0) {
+            pdf = 0.0f;
+            return Spectrum(0.0f);
+        }
+        perturbedQuery.sampler = bRec.sampler;
+        perturbedQuery.typeMask = bRec.typeMask;
+        perturbedQuery.component = bRec.component;
+        return m_nested->evalWithPdf(perturbedQuery, pdf, measure);
+    }
+
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
         const Intersection& its = bRec.its;
         Intersection perturbed(its);
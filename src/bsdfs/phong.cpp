@@ -180,6 +180,46 @@ public:
             return 0.0f;
     }
 
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        pdf = 0.0f;
+        if (Frame::cosTheta(bRec.wi) <= 0 ||
+            Frame::cosTheta(bRec.wo) <= 0 || measure != ESolidAngle)
+            return Spectrum(0.0f);
+
+        bool hasSpecular = (bRec.typeMask & EGlossyReflection)
+                && (bRec.component == -1 || bRec.component == 0);
+        bool hasDiffuse  = (bRec.typeMask & EDiffuseReflection)
+                && (bRec.component == -1 || bRec.component == 1);
+
+        Spectrum result(0.0f);
+        Float diffuseProb = 0.0f, specProb = 0.0f;
+
+        if (hasSpecular) {
+            Float alpha    = dot(bRec.wo, reflect(bRec.wi)),
+                  exponent = m_exponent->eval(bRec.its).average();
+
+            if (alpha > 0.0f) {
+                Float lobe = std::pow(alpha, exponent);
+                result += m_specularReflectance->eval(bRec.its) *
+                    ((exponent + 2) * INV_TWOPI * lobe);
+                specProb = lobe * (exponent + 1.0f) / (2.0f * M_PI);
+            }
+        }
+
+        if (hasDiffuse) {
+            result += m_diffuseReflectance->eval(bRec.its) * INV_PI;
+            diffuseProb = warp::squareToCosineHemispherePdf(bRec.wo);
+        }
+
+        if (hasDiffuse && hasSpecular)
+            pdf = m_specularSamplingWeight * specProb +
+                  (1-m_specularSamplingWeight) * diffuseProb;
+        else
+            pdf = diffuseProb + specProb;
+
+        return result * Frame::cosTheta(bRec.wo);
+    }
+
     inline Spectrum sample(BSDFSamplingRecord &bRec, Float &_pdf, const Point2 &_sample) const {
         Point2 sample(_sample);
 
@@ -208,12 +248,13 @@ public:
             Float exponent = m_exponent->eval(bRec.its).average();
 
             /* Sample from a Phong lobe centered around (0, 0, 1) */
-            Float sinAlpha = std::sqrt(1-std::pow(sample.y, 2/(exponent + 1)));
             Float cosAlpha = std::pow(sample.y, 1/(exponent + 1));
-            Float phi = (2.0f * M_PI) * sample.x;
+            Float sinAlpha = std::sqrt(1 - cosAlpha*cosAlpha);
+            Float sinPhi, cosPhi;
+            math::sincos((2.0f * M_PI) * sample.x, &sinPhi, &cosPhi);
             Vector localDir = Vector(
-                sinAlpha * std::cos(phi),
-                sinAlpha * std::sin(phi),
+                sinAlpha * cosPhi,
+                sinAlpha * sinPhi,
                 cosAlpha
             );
 
@@ -306,6 +306,49 @@ public:
         return 0.0f;
     }
 
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        bool hasSpecular   = (bRec.typeMask & EDeltaReflection)
+                && (bRec.component == -1 || bRec.component == 0);
+        bool hasDiffuse = (bRec.typeMask & EDiffuseReflection)
+                && (bRec.component == -1 || bRec.component == 1);
+
+        pdf = 0.0f;
+        if (Frame::cosTheta(bRec.wo) <= 0 || Frame::cosTheta(bRec.wi) <= 0)
+            return Spectrum(0.0f);
+
+        Float Fi = fresnelDielectricExt(Frame::cosTheta(bRec.wi), m_eta);
+
+        Float probSpecular = hasSpecular ? 1.0f : 0.0f;
+        if (hasSpecular && hasDiffuse)
+            probSpecular = (Fi*m_specularSamplingWeight) /
+                (Fi*m_specularSamplingWeight +
+                (1-Fi) * (1-m_specularSamplingWeight));
+
+        if (hasSpecular && measure == EDiscrete) {
+            /* Check if the provided direction pair matches an ideal
+               specular reflection; tolerate some roundoff errors */
+            if (std::abs(dot(reflect(bRec.wi), bRec.wo)-1) < DeltaEpsilon) {
+                pdf = probSpecular;
+                return m_specularReflectance->eval(bRec.its) * Fi;
+            }
+        } else if (hasDiffuse && measure == ESolidAngle) {
+            Float Fo = fresnelDielectricExt(Frame::cosTheta(bRec.wo), m_eta);
+
+            Spectrum diff = m_diffuseReflectance->eval(bRec.its);
+
+            if (m_nonlinear)
+                diff /= Spectrum(1.0f) - diff * m_fdrInt;
+            else
+                diff /= 1 - m_fdrInt;
+
+            Float cosPdf = warp::squareToCosineHemispherePdf(bRec.wo);
+            pdf = cosPdf * (1-probSpecular);
+            return diff * (cosPdf * m_invEta2 * (1-Fi) * (1-Fo));
+        }
+
+        return Spectrum(0.0f);
+    }
+
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
         bool hasSpecular   = (bRec.typeMask & EDeltaReflection)
                 && (bRec.component == -1 || bRec.component == 0);
@@ -206,23 +206,26 @@ public:
             m_specularReflectance, "specularReflectance", 1.0f);
 
         if (!m_roughTransmittance.get()) {
-            /* Load precomputed data used to compute the rough
-               transmittance through the dielectric interface */
-            m_roughTransmittance = new RoughTransmittance(m_type);
-
-            m_roughTransmittance->checkEta(m_eta);
-            m_roughTransmittance->checkAlpha(m_alpha->getMinimum().average());
-            m_roughTransmittance->checkAlpha(m_alpha->getMaximum().average());
-
-            /* Reduce the rough transmittance data to a 2D slice */
-            m_roughTransmittance->setEta(m_eta);
-
-            /* If possible, even reduce it to a 1D slice */
+            /* Look up the precomputed data used to compute the rough
+               transmittance through the dielectric interface. The 2D
+               slice is shared with all other materials that use the
+               same parameters */
+            ref<const RoughTransmittance> slice =
+                RoughTransmittance::getShared(m_type, m_eta);
+            slice->checkAlpha(m_alpha->getMinimum().average());
+            slice->checkAlpha(m_alpha->getMaximum().average());
+
+            /* If possible, even use a 1D slice */
             if (m_alpha->isConstant())
-                m_roughTransmittance->setAlpha(
-                    m_alpha->eval(Intersection()).average());
+                m_roughTransmittance = RoughTransmittance::getShared(m_type,
+                    m_eta, m_alpha->eval(Intersection()).average());
+            else
+                m_roughTransmittance = slice;
         }
 
+        /* Select the kernels for the distribution type and isotropy */
+        selectMicrofacetKernels(this, m_type, true);
+
         BSDF::configure();
     }
 
@@ -254,7 +257,7 @@ public:
         }
     }
 
-    Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+    template <typename Distribution> Spectrum evalImpl(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         bool hasNested = (bRec.typeMask & m_nested->getType() & BSDF::EAll)
             && (bRec.component == -1 || bRec.component < (int) m_components.size()-1);
         bool hasSpecular = (bRec.typeMask & EGlossyReflection)
@@ -263,7 +266,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alpha->eval(bRec.its).average(),
             m_sampleVisible
@@ -296,9 +299,11 @@ public:
             bRecInt.wi = refractTo(EInterior, bRec.wi);
             bRecInt.wo = refractTo(EInterior, bRec.wo);
 
-            Spectrum nestedResult = m_nested->eval(bRecInt, measure) *
-                m_roughTransmittance->eval(std::abs(Frame::cosTheta(bRec.wi)), distr.getAlpha()) *
-                m_roughTransmittance->eval(std::abs(Frame::cosTheta(bRec.wo)), distr.getAlpha());
+            Float cosTheta[2] = { std::abs(Frame::cosTheta(bRec.wi)),
+                std::abs(Frame::cosTheta(bRec.wo)) }, T[2];
+            m_roughTransmittance->eval(2, cosTheta, T, distr.getAlpha());
+
+            Spectrum nestedResult = m_nested->eval(bRecInt, measure) * (T[0] * T[1]);
 
             Spectrum sigmaA = m_sigmaA->eval(bRec.its) * m_thickness;
             if (!sigmaA.isZero())
@@ -317,7 +322,7 @@ public:
         return result;
     }
 
-    Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+    template <typename Distribution> Float pdfImpl(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         bool hasNested = (bRec.typeMask & m_nested->getType() & BSDF::EAll)
             && (bRec.component == -1 || bRec.component < (int) m_components.size()-1);
         bool hasSpecular = (bRec.typeMask & EGlossyReflection)
@@ -330,7 +335,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alpha->eval(bRec.its).average(),
             m_sampleVisible
@@ -381,7 +386,105 @@ public:
         return result;
     }
 
-    inline Spectrum sample(BSDFSamplingRecord &bRec, Float &_pdf, const Point2 &_sample) const {
+    template <typename Distribution> Spectrum evalWithPdfImpl(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        bool hasNested = (bRec.typeMask & m_nested->getType() & BSDF::EAll)
+            && (bRec.component == -1 || bRec.component < (int) m_components.size()-1);
+        bool hasSpecular = (bRec.typeMask & EGlossyReflection)
+            && (bRec.component == -1 || bRec.component == (int) m_components.size()-1)
+            && measure == ESolidAngle;
+
+        /* Construct the microfacet distribution matching the
+           roughness values at the current surface position. */
+        Distribution distr(
+            m_type,
+            m_alpha->eval(bRec.its).average(),
+            m_sampleVisible
+        );
+
+        /* Transmittance through the rough interface along the incident
+           direction, needed both by the nested model and for sampling */
+        Float T12 = (hasNested || hasSpecular) ? m_roughTransmittance->eval(
+            std::abs(Frame::cosTheta(bRec.wi)), distr.getAlpha()) : 0.0f;
+
+        Float probNested, probSpecular;
+        if (hasSpecular && hasNested) {
+            /* Find the probability of sampling the specular component */
+            probSpecular = 1-T12;
+
+            /* Reallocate samples */
+            probSpecular = (probSpecular*m_specularSamplingWeight) /
+                (probSpecular*m_specularSamplingWeight +
+                (1-probSpecular) * (1-m_specularSamplingWeight));
+
+            probNested = 1 - probSpecular;
+        } else {
+            probNested = probSpecular = 1.0f;
+        }
+
+        Spectrum result(0.0f);
+        pdf = 0.0f;
+
+        if (hasSpecular && Frame::cosTheta(bRec.wo) * Frame::cosTheta(bRec.wi) > 0) {
+            /* Calculate the reflection half-vector */
+            const Vector H = normalize(bRec.wo+bRec.wi)
+                * math::signum(Frame::cosTheta(bRec.wo));
+
+            /* Evaluate the microfacet normal distribution */
+            const Float D = distr.eval(H);
+
+            /* Fresnel term */
+            const Float F = fresnelDielectricExt(absDot(bRec.wi, H), m_eta);
+
+            /* Smith's shadow-masking function */
+            const Float G1 = distr.smithG1(bRec.wi, H),
+                        G = G1 * distr.smithG1(bRec.wo, H);
+
+            /* Calculate the specular reflection component */
+            Float value = F * D * G /
+                (4.0f * std::abs(Frame::cosTheta(bRec.wi)));
+
+            result += m_specularReflectance->eval(bRec.its) * value;
+
+            /* Evaluate the microfacet model sampling density function */
+            Float prob = m_sampleVisible
+                ? G1 * absDot(bRec.wi, H) * D / std::abs(Frame::cosTheta(bRec.wi))
+                : D * Frame::cosTheta(H);
+
+            /* Jacobian of the half-direction mapping */
+            pdf = prob * probSpecular / (4.0f * absDot(bRec.wo, H));
+        }
+
+        if (hasNested) {
+            BSDFSamplingRecord bRecInt(bRec);
+            bRecInt.wi = refractTo(EInterior, bRec.wi);
+            bRecInt.wo = refractTo(EInterior, bRec.wo);
+
+            Float prob;
+            Spectrum nestedResult = m_nested->evalWithPdf(bRecInt, prob, measure) * T12 *
+                m_roughTransmittance->eval(std::abs(Frame::cosTheta(bRec.wo)), distr.getAlpha());
+
+            Spectrum sigmaA = m_sigmaA->eval(bRec.its) * m_thickness;
+            if (!sigmaA.isZero())
+                nestedResult *= (-sigmaA *
+                    (1/std::abs(Frame::cosTheta(bRecInt.wi)) +
+                     1/std::abs(Frame::cosTheta(bRecInt.wo)))).exp();
+
+            /* Solid angle compression & irradiance conversion factors */
+            if (measure == ESolidAngle) {
+                Float factor = m_invEta * m_invEta *
+                    Frame::cosTheta(bRec.wo) / Frame::cosTheta(bRecInt.wo);
+                nestedResult *= factor;
+                prob *= factor;
+            }
+
+            result += nestedResult;
+            pdf += prob * probNested;
+        }
+
+        return result;
+    }
+
+    template <typename Distribution> Spectrum sampleImpl(BSDFSamplingRecord &bRec, Float &_pdf, const Point2 &_sample) const {
         bool hasNested = (bRec.typeMask & m_nested->getType() & BSDF::EAll)
             && (bRec.component == -1 || bRec.component < (int) m_components.size()-1);
         bool hasSpecular = (bRec.typeMask & EGlossyReflection)
@@ -392,7 +495,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alpha->eval(bRec.its).average(),
             m_sampleVisible
@@ -442,12 +545,36 @@ public:
 
         /* Guard against numerical imprecisions */
         EMeasure measure = getMeasure(bRec.sampledType);
-        _pdf = pdf(bRec, measure);
+        _pdf = pdfImpl<Distribution>(bRec, measure);
 
         if (_pdf == 0)
             return Spectrum(0.0f);
         else
-            return eval(bRec, measure) / _pdf;
+            return evalImpl<Distribution>(bRec, measure) / _pdf;
+    }
+
+    Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+        return (this->*m_evalKernel)(bRec, measure);
+    }
+
+    Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+        return (this->*m_pdfKernel)(bRec, measure);
+    }
+
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        return (this->*m_evalWithPdfKernel)(bRec, pdf, measure);
+    }
+
+    Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &sample) const {
+        return (this->*m_samplePdfKernel)(bRec, pdf, sample);
+    }
+
+    /// Point the kernels to the instantiations for a specific distribution
+    template <typename Distribution> void setKernels() {
+        m_evalKernel = &RoughCoating::evalImpl<Distribution>;
+        m_pdfKernel = &RoughCoating::pdfImpl<Distribution>;
+        m_evalWithPdfKernel = &RoughCoating::evalWithPdfImpl<Distribution>;
+        m_samplePdfKernel = &RoughCoating::sampleImpl<Distribution>;
     }
 
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
@@ -500,7 +627,12 @@ public:
     MTS_DECLARE_CLASS()
 private:
     MicrofacetDistribution::EType m_type;
-    ref<RoughTransmittance> m_roughTransmittance;
+    /* Evaluation and sampling routines specialized for m_type */
+    Spectrum (RoughCoating::*m_evalKernel)(const BSDFSamplingRecord &, EMeasure) const;
+    Float (RoughCoating::*m_pdfKernel)(const BSDFSamplingRecord &, EMeasure) const;
+    Spectrum (RoughCoating::*m_evalWithPdfKernel)(const BSDFSamplingRecord &, Float &, EMeasure) const;
+    Spectrum (RoughCoating::*m_samplePdfKernel)(BSDFSamplingRecord &, Float &, const Point2 &) const;
+    ref<const RoughTransmittance> m_roughTransmittance;
     ref<Texture> m_sigmaA;
     ref<Texture> m_alpha;
     ref<Texture> m_specularReflectance;
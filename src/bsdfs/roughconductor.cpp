@@ -246,6 +246,9 @@ public:
             m_alphaV->usesRayDifferentials() ||
             m_specularReflectance->usesRayDifferentials();
 
+        /* Select the kernels for the distribution type and isotropy */
+        selectMicrofacetKernels(this, m_type, m_alphaU == m_alphaV);
+
         BSDF::configure();
     }
 
@@ -254,7 +257,7 @@ public:
         return 2 * dot(wi, m) * Vector(m) - wi;
     }
 
-    Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+    template <typename Distribution> Spectrum evalImpl(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         /* Stop if this component was not requested */
         if (measure != ESolidAngle ||
             Frame::cosTheta(bRec.wi) <= 0 ||
@@ -268,7 +271,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alphaU->eval(bRec.its).average(),
             m_alphaV->eval(bRec.its).average(),
@@ -293,7 +296,7 @@ public:
         return F * model;
     }
 
-    Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+    template <typename Distribution> Float pdfImpl(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         if (measure != ESolidAngle ||
             Frame::cosTheta(bRec.wi) <= 0 ||
             Frame::cosTheta(bRec.wo) <= 0 ||
@@ -306,7 +309,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alphaU->eval(bRec.its).average(),
             m_alphaV->eval(bRec.its).average(),
@@ -320,7 +323,54 @@ public:
             return distr.pdf(bRec.wi, H) / (4 * absDot(bRec.wo, H));
     }
 
-    Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
+    template <typename Distribution> Spectrum evalWithPdfImpl(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        pdf = 0.0f;
+        if (measure != ESolidAngle ||
+            Frame::cosTheta(bRec.wi) <= 0 ||
+            Frame::cosTheta(bRec.wo) <= 0 ||
+            ((bRec.component != -1 && bRec.component != 0) ||
+            !(bRec.typeMask & EGlossyReflection)))
+            return Spectrum(0.0f);
+
+        /* Calculate the reflection half-vector */
+        Vector H = normalize(bRec.wo+bRec.wi);
+
+        /* Construct the microfacet distribution matching the
+           roughness values at the current surface position. */
+        Distribution distr(
+            m_type,
+            m_alphaU->eval(bRec.its).average(),
+            m_alphaV->eval(bRec.its).average(),
+            m_sampleVisible
+        );
+
+        /* Evaluate the microfacet normal distribution */
+        const Float D = distr.eval(H);
+        if (D == 0)
+            return Spectrum(0.0f);
+
+        /* Shadowing term of the incident direction, shared by both */
+        const Float G1 = distr.smithG1(bRec.wi, H);
+
+        if (m_sampleVisible)
+            pdf = D * G1 / (4.0f * Frame::cosTheta(bRec.wi));
+        else
+            pdf = distr.pdf(bRec.wi, H) / (4 * absDot(bRec.wo, H));
+
+        /* Fresnel factor */
+        const Spectrum F = fresnelConductorExact(dot(bRec.wi, H), m_eta, m_k) *
+            m_specularReflectance->eval(bRec.its);
+
+        /* Smith's shadow-masking function */
+        const Float G = G1 * distr.smithG1(bRec.wo, H);
+
+        /* Calculate the total amount of reflection */
+        Float model = D * G / (4.0f * Frame::cosTheta(bRec.wi));
+
+        return F * model;
+    }
+
+    template <typename Distribution> Spectrum sampleImpl(BSDFSamplingRecord &bRec, const Point2 &sample) const {
         if (Frame::cosTheta(bRec.wi) < 0 ||
             ((bRec.component != -1 && bRec.component != 0) ||
             !(bRec.typeMask & EGlossyReflection)))
@@ -328,7 +378,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alphaU->eval(bRec.its).average(),
             m_alphaV->eval(bRec.its).average(),
@@ -366,7 +416,7 @@ public:
         return F * weight;
     }
 
-    Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &sample) const {
+    template <typename Distribution> Spectrum sampleImpl(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &sample) const {
         if (Frame::cosTheta(bRec.wi) < 0 ||
             ((bRec.component != -1 && bRec.component != 0) ||
             !(bRec.typeMask & EGlossyReflection)))
@@ -374,7 +424,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alphaU->eval(bRec.its).average(),
             m_alphaV->eval(bRec.its).average(),
@@ -414,6 +464,35 @@ public:
         return F * weight;
     }
 
+    Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+        return (this->*m_evalKernel)(bRec, measure);
+    }
+
+    Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+        return (this->*m_pdfKernel)(bRec, measure);
+    }
+
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        return (this->*m_evalWithPdfKernel)(bRec, pdf, measure);
+    }
+
+    Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
+        return (this->*m_sampleKernel)(bRec, sample);
+    }
+
+    Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &sample) const {
+        return (this->*m_samplePdfKernel)(bRec, pdf, sample);
+    }
+
+    /// Point the kernels to the instantiations for a specific distribution
+    template <typename Distribution> void setKernels() {
+        m_evalKernel = &RoughConductor::evalImpl<Distribution>;
+        m_pdfKernel = &RoughConductor::pdfImpl<Distribution>;
+        m_evalWithPdfKernel = &RoughConductor::evalWithPdfImpl<Distribution>;
+        m_sampleKernel = &RoughConductor::sampleImpl<Distribution>;
+        m_samplePdfKernel = &RoughConductor::sampleImpl<Distribution>;
+    }
+
     void addChild(const std::string &name, ConfigurableObject *child) {
         if (child->getClass()->derivesFrom(MTS_CLASS(Texture))) {
             if (name == "alpha")
@@ -456,6 +535,12 @@ public:
     MTS_DECLARE_CLASS()
 private:
     MicrofacetDistribution::EType m_type;
+    /* Evaluation and sampling routines specialized for m_type */
+    Spectrum (RoughConductor::*m_evalKernel)(const BSDFSamplingRecord &, EMeasure) const;
+    Float (RoughConductor::*m_pdfKernel)(const BSDFSamplingRecord &, EMeasure) const;
+    Spectrum (RoughConductor::*m_evalWithPdfKernel)(const BSDFSamplingRecord &, Float &, EMeasure) const;
+    Spectrum (RoughConductor::*m_sampleKernel)(BSDFSamplingRecord &, const Point2 &) const;
+    Spectrum (RoughConductor::*m_samplePdfKernel)(BSDFSamplingRecord &, Float &, const Point2 &) const;
     ref<Texture> m_specularReflectance;
     ref<Texture> m_alphaU, m_alphaV;
     bool m_sampleVisible;
@@ -264,10 +264,13 @@ public:
             m_specularReflectance->usesRayDifferentials() ||
             m_specularTransmittance->usesRayDifferentials();
 
+        /* Select the kernels for the distribution type and isotropy */
+        selectMicrofacetKernels(this, m_type, m_alphaU == m_alphaV);
+
         BSDF::configure();
     }
 
-    Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+    template <typename Distribution> Spectrum evalImpl(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         if (measure != ESolidAngle || Frame::cosTheta(bRec.wi) == 0)
             return Spectrum(0.0f);
 
@@ -303,7 +306,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alphaU->eval(bRec.its).average(),
             m_alphaV->eval(bRec.its).average(),
@@ -347,7 +350,7 @@ public:
         }
     }
 
-    Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+    template <typename Distribution> Float pdfImpl(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         if (measure != ESolidAngle)
             return 0.0f;
 
@@ -396,7 +399,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution sampleDistr(
+        Distribution sampleDistr(
             m_type,
             m_alphaU->eval(bRec.its).average(),
             m_alphaV->eval(bRec.its).average(),
@@ -421,7 +424,111 @@ public:
         return std::abs(prob * dwh_dwo);
     }
 
-    Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &_sample) const {
+    template <typename Distribution> Spectrum evalWithPdfImpl(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        if (measure != ESolidAngle || Frame::cosTheta(bRec.wi) == 0) {
+            pdf = pdfImpl<Distribution>(bRec, measure);
+            return Spectrum(0.0f);
+        }
+        pdf = 0.0f;
+
+        /* Determine the type of interaction */
+        bool hasReflection   = ((bRec.component == -1 || bRec.component == 0)
+                              && (bRec.typeMask & EGlossyReflection)),
+             hasTransmission = ((bRec.component == -1 || bRec.component == 1)
+                              && (bRec.typeMask & EGlossyTransmission)),
+             reflect         = Frame::cosTheta(bRec.wi)
+                             * Frame::cosTheta(bRec.wo) > 0;
+
+        Vector H;
+        Float dwh_dwo, eta = Frame::cosTheta(bRec.wi) > 0 ? m_eta : m_invEta;
+
+        if (reflect) {
+            /* Stop if this component was not requested */
+            if (!hasReflection)
+                return Spectrum(0.0f);
+
+            /* Calculate the reflection half-vector */
+            H = normalize(bRec.wo+bRec.wi);
+
+            /* Jacobian of the half-direction mapping */
+            dwh_dwo = 1.0f / (4.0f * dot(bRec.wo, H));
+        } else {
+            /* Stop if this component was not requested */
+            if (!hasTransmission)
+                return Spectrum(0.0f);
+
+            /* Calculate the transmission half-vector */
+            H = normalize(bRec.wi + bRec.wo*eta);
+
+            /* Jacobian of the half-direction mapping */
+            Float sqrtDenom = dot(bRec.wi, H) + eta * dot(bRec.wo, H);
+            dwh_dwo = (eta*eta * dot(bRec.wo, H)) / (sqrtDenom*sqrtDenom);
+        }
+
+        /* Ensure that the half-vector points into the
+           same hemisphere as the macrosurface normal */
+        H *= math::signum(Frame::cosTheta(H));
+
+        /* Construct the microfacet distribution matching the
+           roughness values at the current surface position. */
+        Distribution distr(
+            m_type,
+            m_alphaU->eval(bRec.its).average(),
+            m_alphaV->eval(bRec.its).average(),
+            m_sampleVisible
+        );
+
+        /* Terms that are shared by the model and its sampling density */
+        const Float D = distr.eval(H);
+        const Float F = fresnelDielectricExt(dot(bRec.wi, H), m_eta);
+        const Float G1 = distr.smithG1(bRec.wi, H);
+
+        /* Evaluate the microfacet model sampling density function */
+        Float prob;
+        if (m_sampleVisible) {
+            prob = G1 * absDot(bRec.wi, H) * D / std::abs(Frame::cosTheta(bRec.wi));
+        } else {
+            /* Scaled roughness trick by Walter et al., see pdf() */
+            Distribution sampleDistr(distr);
+            sampleDistr.scaleAlpha(1.2f - 0.2f * std::sqrt(
+                std::abs(Frame::cosTheta(bRec.wi))));
+            prob = sampleDistr.pdf(math::signum(Frame::cosTheta(bRec.wi)) * bRec.wi, H);
+        }
+
+        if (hasTransmission && hasReflection)
+            prob *= reflect ? F : (1-F);
+
+        pdf = std::abs(prob * dwh_dwo);
+
+        if (D == 0)
+            return Spectrum(0.0f);
+
+        /* Smith's shadow-masking function */
+        const Float G = G1 * distr.smithG1(bRec.wo, H);
+
+        if (reflect) {
+            /* Calculate the total amount of reflection */
+            Float value = F * D * G /
+                (4.0f * std::abs(Frame::cosTheta(bRec.wi)));
+
+            return m_specularReflectance->eval(bRec.its) * value;
+        } else {
+            /* Calculate the total amount of transmission */
+            Float sqrtDenom = dot(bRec.wi, H) + eta * dot(bRec.wo, H);
+            Float value = ((1 - F) * D * G * eta * eta
+                * dot(bRec.wi, H) * dot(bRec.wo, H)) /
+                (Frame::cosTheta(bRec.wi) * sqrtDenom * sqrtDenom);
+
+            /* Account for the solid angle compression when tracing radiance */
+            Float factor = (bRec.mode == ERadiance)
+                ? (Frame::cosTheta(bRec.wi) > 0 ? m_invEta : m_eta) : 1.0f;
+
+            return m_specularTransmittance->eval(bRec.its)
+                * std::abs(value * factor * factor);
+        }
+    }
+
+    template <typename Distribution> Spectrum sampleImpl(BSDFSamplingRecord &bRec, const Point2 &_sample) const {
         Point2 sample(_sample);
 
         bool hasReflection = ((bRec.component == -1 || bRec.component == 0)
@@ -435,7 +542,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alphaU->eval(bRec.its).average(),
             m_alphaV->eval(bRec.its).average(),
@@ -445,7 +552,7 @@ public:
         /* Trick by Walter et al.: slightly scale the roughness values to
            reduce importance sampling weights. Not needed for the
            Heitz and D'Eon sampling technique. */
-        MicrofacetDistribution sampleDistr(distr);
+        Distribution sampleDistr(distr);
         if (!m_sampleVisible)
             sampleDistr.scaleAlpha(1.2f - 0.2f * std::sqrt(
                 std::abs(Frame::cosTheta(bRec.wi))));
@@ -510,7 +617,7 @@ public:
         return weight;
     }
 
-    Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &_sample) const {
+    template <typename Distribution> Spectrum sampleImpl(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &_sample) const {
         Point2 sample(_sample);
 
         bool hasReflection = ((bRec.component == -1 || bRec.component == 0)
@@ -524,7 +631,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alphaU->eval(bRec.its).average(),
             m_alphaV->eval(bRec.its).average(),
@@ -534,7 +641,7 @@ public:
         /* Trick by Walter et al.: slightly scale the roughness values to
            reduce importance sampling weights. Not needed for the
            Heitz and D'Eon sampling technique. */
-        MicrofacetDistribution sampleDistr(distr);
+        Distribution sampleDistr(distr);
         if (!m_sampleVisible)
             sampleDistr.scaleAlpha(1.2f - 0.2f * std::sqrt(
                 std::abs(Frame::cosTheta(bRec.wi))));
@@ -614,6 +721,35 @@ public:
         return weight;
     }
 
+    Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+        return (this->*m_evalKernel)(bRec, measure);
+    }
+
+    Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+        return (this->*m_pdfKernel)(bRec, measure);
+    }
+
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        return (this->*m_evalWithPdfKernel)(bRec, pdf, measure);
+    }
+
+    Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
+        return (this->*m_sampleKernel)(bRec, sample);
+    }
+
+    Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &sample) const {
+        return (this->*m_samplePdfKernel)(bRec, pdf, sample);
+    }
+
+    /// Point the kernels to the instantiations for a specific distribution
+    template <typename Distribution> void setKernels() {
+        m_evalKernel = &RoughDielectric::evalImpl<Distribution>;
+        m_pdfKernel = &RoughDielectric::pdfImpl<Distribution>;
+        m_evalWithPdfKernel = &RoughDielectric::evalWithPdfImpl<Distribution>;
+        m_sampleKernel = &RoughDielectric::sampleImpl<Distribution>;
+        m_samplePdfKernel = &RoughDielectric::sampleImpl<Distribution>;
+    }
+
     void addChild(const std::string &name, ConfigurableObject *child) {
         if (child->getClass()->derivesFrom(MTS_CLASS(Texture))) {
             if (name == "alpha")
@@ -662,6 +798,12 @@ public:
     MTS_DECLARE_CLASS()
 private:
     MicrofacetDistribution::EType m_type;
+    /* Evaluation and sampling routines specialized for m_type */
+    Spectrum (RoughDielectric::*m_evalKernel)(const BSDFSamplingRecord &, EMeasure) const;
+    Float (RoughDielectric::*m_pdfKernel)(const BSDFSamplingRecord &, EMeasure) const;
+    Spectrum (RoughDielectric::*m_evalWithPdfKernel)(const BSDFSamplingRecord &, Float &, EMeasure) const;
+    Spectrum (RoughDielectric::*m_sampleKernel)(BSDFSamplingRecord &, const Point2 &) const;
+    Spectrum (RoughDielectric::*m_samplePdfKernel)(BSDFSamplingRecord &, Float &, const Point2 &) const;
     ref<Texture> m_specularTransmittance;
     ref<Texture> m_specularReflectance;
     ref<Texture> m_alphaU, m_alphaV;
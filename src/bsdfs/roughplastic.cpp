@@ -279,23 +279,16 @@ public:
         m_invEta2 = 1.0f / (m_eta*m_eta);
 
         if (!m_externalRoughTransmittance.get()) {
-            /* Load precomputed data used to compute the rough
-               transmittance through the dielectric interface */
-            m_externalRoughTransmittance = new RoughTransmittance(m_type);
-
-            m_externalRoughTransmittance->checkEta(m_eta);
-            m_externalRoughTransmittance->checkAlpha(m_alpha->getMinimum().average());
-            m_externalRoughTransmittance->checkAlpha(m_alpha->getMaximum().average());
-
-            /* Reduce the rough transmittance data to a 2D slice */
-            m_internalRoughTransmittance = m_externalRoughTransmittance->clone();
-            m_externalRoughTransmittance->setEta(m_eta);
-            m_internalRoughTransmittance->setEta(1/m_eta);
-
-            /* If possible, even reduce it to a 1D slice */
-            if (constAlpha)
-                m_externalRoughTransmittance->setAlpha(
-                    m_alpha->eval(Intersection()).average());
+            /* Look up the precomputed data used to compute the rough
+               transmittance through the dielectric interface. The 2D
+               slices (or 1D, if possible) are shared with all other
+               materials that use the same parameters */
+            m_internalRoughTransmittance = RoughTransmittance::getShared(m_type, 1/m_eta);
+            m_internalRoughTransmittance->checkAlpha(m_alpha->getMinimum().average());
+            m_internalRoughTransmittance->checkAlpha(m_alpha->getMaximum().average());
+
+            m_externalRoughTransmittance = RoughTransmittance::getShared(m_type, m_eta,
+                constAlpha ? m_alpha->eval(Intersection()).average() : (Float) -1);
         }
 
         m_usesRayDifferentials =
@@ -303,6 +296,9 @@ public:
             m_diffuseReflectance->usesRayDifferentials() ||
             m_alpha->usesRayDifferentials();
 
+        /* Select the kernels for the distribution type and isotropy */
+        selectMicrofacetKernels(this, m_type, true);
+
         BSDF::configure();
     }
 
@@ -323,7 +319,7 @@ public:
         return 2 * dot(wi, m) * Vector(m) - wi;
     }
 
-    Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+    template <typename Distribution> Spectrum evalImpl(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         bool hasSpecular = (bRec.typeMask & EGlossyReflection) &&
             (bRec.component == -1 || bRec.component == 0);
         bool hasDiffuse = (bRec.typeMask & EDiffuseReflection) &&
@@ -337,7 +333,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alpha->eval(bRec.its).average(),
             m_sampleVisible
@@ -366,8 +362,9 @@ public:
 
         if (hasDiffuse) {
             Spectrum diff = m_diffuseReflectance->eval(bRec.its);
-            Float T12 = m_externalRoughTransmittance->eval(Frame::cosTheta(bRec.wi), distr.getAlpha());
-            Float T21 = m_externalRoughTransmittance->eval(Frame::cosTheta(bRec.wo), distr.getAlpha());
+            Float cosTheta[2] = { Frame::cosTheta(bRec.wi), Frame::cosTheta(bRec.wo) }, T[2];
+            m_externalRoughTransmittance->eval(2, cosTheta, T, distr.getAlpha());
+            Float T12 = T[0], T21 = T[1];
             Float Fdr = 1-m_internalRoughTransmittance->evalDiffuse(distr.getAlpha());
 
             if (m_nonlinear)
@@ -381,7 +378,7 @@ public:
         return result;
     }
 
-    Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+    template <typename Distribution> Float pdfImpl(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         bool hasSpecular = (bRec.typeMask & EGlossyReflection) &&
             (bRec.component == -1 || bRec.component == 0);
         bool hasDiffuse = (bRec.typeMask & EDiffuseReflection) &&
@@ -395,7 +392,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alpha->eval(bRec.its).average(),
             m_sampleVisible
@@ -436,7 +433,95 @@ public:
         return result;
     }
 
-    inline Spectrum sample(BSDFSamplingRecord &bRec, Float &_pdf, const Point2 &_sample) const {
+    template <typename Distribution> Spectrum evalWithPdfImpl(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        bool hasSpecular = (bRec.typeMask & EGlossyReflection) &&
+            (bRec.component == -1 || bRec.component == 0);
+        bool hasDiffuse = (bRec.typeMask & EDiffuseReflection) &&
+            (bRec.component == -1 || bRec.component == 1);
+
+        pdf = 0.0f;
+        if (measure != ESolidAngle ||
+            Frame::cosTheta(bRec.wi) <= 0 ||
+            Frame::cosTheta(bRec.wo) <= 0 ||
+            (!hasSpecular && !hasDiffuse))
+            return Spectrum(0.0f);
+
+        /* Construct the microfacet distribution matching the
+           roughness values at the current surface position. */
+        Distribution distr(
+            m_type,
+            m_alpha->eval(bRec.its).average(),
+            m_sampleVisible
+        );
+
+        /* Transmittance through the rough interface, which is needed both
+           by the diffuse component and the specular sampling probability */
+        Float T12 = m_externalRoughTransmittance->eval(Frame::cosTheta(bRec.wi), distr.getAlpha());
+
+        Float probDiffuse, probSpecular;
+        if (hasSpecular && hasDiffuse) {
+            /* Find the probability of sampling the specular component */
+            probSpecular = 1-T12;
+
+            /* Reallocate samples */
+            probSpecular = (probSpecular*m_specularSamplingWeight) /
+                (probSpecular*m_specularSamplingWeight +
+                (1-probSpecular) * (1-m_specularSamplingWeight));
+
+            probDiffuse = 1 - probSpecular;
+        } else {
+            probDiffuse = probSpecular = 1.0f;
+        }
+
+        Spectrum result(0.0f);
+        if (hasSpecular) {
+            /* Calculate the reflection half-vector */
+            const Vector H = normalize(bRec.wo+bRec.wi);
+
+            /* Evaluate the microfacet normal distribution */
+            const Float D = distr.eval(H);
+
+            /* Fresnel term */
+            const Float F = fresnelDielectricExt(dot(bRec.wi, H), m_eta);
+
+            /* Smith's shadow-masking function */
+            const Float G1 = distr.smithG1(bRec.wi, H),
+                        G = G1 * distr.smithG1(bRec.wo, H);
+
+            /* Calculate the specular reflection component */
+            Float value = F * D * G /
+                (4.0f * Frame::cosTheta(bRec.wi));
+
+            result += m_specularReflectance->eval(bRec.its) * value;
+
+            /* Evaluate the microfacet model sampling density function */
+            Float prob = m_sampleVisible
+                ? G1 * absDot(bRec.wi, H) * D / Frame::cosTheta(bRec.wi)
+                : D * Frame::cosTheta(H);
+
+            /* Jacobian of the half-direction mapping */
+            pdf = prob * probSpecular / (4.0f * dot(bRec.wo, H));
+        }
+
+        if (hasDiffuse) {
+            Spectrum diff = m_diffuseReflectance->eval(bRec.its);
+            Float T21 = m_externalRoughTransmittance->eval(Frame::cosTheta(bRec.wo), distr.getAlpha());
+            Float Fdr = 1-m_internalRoughTransmittance->evalDiffuse(distr.getAlpha());
+
+            if (m_nonlinear)
+                diff /= Spectrum(1.0f) - diff * Fdr;
+            else
+                diff /= 1-Fdr;
+
+            result += diff * (INV_PI * Frame::cosTheta(bRec.wo) * T12 * T21 * m_invEta2);
+
+            pdf += probDiffuse * warp::squareToCosineHemispherePdf(bRec.wo);
+        }
+
+        return result;
+    }
+
+    template <typename Distribution> Spectrum sampleImpl(BSDFSamplingRecord &bRec, Float &_pdf, const Point2 &_sample) const {
         bool hasSpecular = (bRec.typeMask & EGlossyReflection) &&
             (bRec.component == -1 || bRec.component == 0);
         bool hasDiffuse = (bRec.typeMask & EDiffuseReflection) &&
@@ -450,7 +535,7 @@ public:
 
         /* Construct the microfacet distribution matching the
            roughness values at the current surface position. */
-        MicrofacetDistribution distr(
+        Distribution distr(
             m_type,
             m_alpha->eval(bRec.its).average(),
             m_sampleVisible
@@ -492,12 +577,36 @@ public:
         bRec.eta = 1.0f;
 
         /* Guard against numerical imprecisions */
-        _pdf = pdf(bRec, ESolidAngle);
+        _pdf = pdfImpl<Distribution>(bRec, ESolidAngle);
 
         if (_pdf == 0)
             return Spectrum(0.0f);
         else
-            return eval(bRec, ESolidAngle) / _pdf;
+            return evalImpl<Distribution>(bRec, ESolidAngle) / _pdf;
+    }
+
+    Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+        return (this->*m_evalKernel)(bRec, measure);
+    }
+
+    Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
+        return (this->*m_pdfKernel)(bRec, measure);
+    }
+
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        return (this->*m_evalWithPdfKernel)(bRec, pdf, measure);
+    }
+
+    Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &sample) const {
+        return (this->*m_samplePdfKernel)(bRec, pdf, sample);
+    }
+
+    /// Point the kernels to the instantiations for a specific distribution
+    template <typename Distribution> void setKernels() {
+        m_evalKernel = &RoughPlastic::evalImpl<Distribution>;
+        m_pdfKernel = &RoughPlastic::pdfImpl<Distribution>;
+        m_evalWithPdfKernel = &RoughPlastic::evalWithPdfImpl<Distribution>;
+        m_samplePdfKernel = &RoughPlastic::sampleImpl<Distribution>;
     }
 
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
@@ -551,8 +660,13 @@ public:
     MTS_DECLARE_CLASS()
 private:
     MicrofacetDistribution::EType m_type;
-    ref<RoughTransmittance> m_externalRoughTransmittance;
-    ref<RoughTransmittance> m_internalRoughTransmittance;
+    /* Evaluation and sampling routines specialized for m_type */
+    Spectrum (RoughPlastic::*m_evalKernel)(const BSDFSamplingRecord &, EMeasure) const;
+    Float (RoughPlastic::*m_pdfKernel)(const BSDFSamplingRecord &, EMeasure) const;
+    Spectrum (RoughPlastic::*m_evalWithPdfKernel)(const BSDFSamplingRecord &, Float &, EMeasure) const;
+    Spectrum (RoughPlastic::*m_samplePdfKernel)(BSDFSamplingRecord &, Float &, const Point2 &) const;
+    ref<const RoughTransmittance> m_externalRoughTransmittance;
+    ref<const RoughTransmittance> m_internalRoughTransmittance;
     ref<Texture> m_diffuseReflectance;
     ref<Texture> m_specularReflectance;
     ref<Texture> m_alpha;
@@ -22,6 +22,7 @@
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/spline.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/lock.h>
 #include "microfacet.h"
 
 #if defined(_MSC_VER)
@@ -68,6 +69,11 @@ MTS_NAMESPACE_BEGIN
  * As a final bonus, this class also has support for evaluating the \a diffuse
  * rough transmittance, which is defined as a cosine-weighted integral
  * of the rough transmittance over the incident hemisphere.
+ *
+ * Scenes often contain many materials with the same index of refraction
+ * (and roughness). Instead of loading and reducing their own copy of the
+ * table, these should call \ref getShared(), which looks up the slice in a
+ * process-wide cache and only computes it upon the first request.
  */
 class RoughTransmittance : public Object {
 public:
@@ -157,17 +163,57 @@ public:
 
     }
 
+    /**
+     * \brief Return a shared instance that is reduced to a constant
+     * relative index of refraction and optionally also to a constant
+     * roughness (see \ref setEta() and \ref setAlpha())
+     *
+     * The full table of each distribution type is loaded at most once per
+     * process, and every slice is only computed upon the first request.
+     * The returned instance must not be modified.
+     *
+     * \param type
+     *     Denotes the type of a microfacet distribution,
+     *     i.e. Beckmann or GGX
+     * \param eta
+     *     Relative index of refraction
+     * \param alpha
+     *     Constant roughness or <tt>-1</tt> when the roughness varies
+     */
+    static ref<const RoughTransmittance> getShared(MicrofacetDistribution::EType type,
+            Float eta, Float alpha = -1) {
+        SharedCache &cache = getSharedCache();
+        LockGuard lock(cache.mutex);
+
+        SharedCache::Key key(type, eta, alpha);
+        SharedCache::Map::iterator it = cache.slices.find(key);
+        if (it != cache.slices.end())
+            return it->second.get();
+
+        ref<RoughTransmittance> result;
+        if (alpha >= 0) {
+            /* Reduce a (shared) 2D slice to 1D */
+            result = getSharedSlice(cache, type, eta)->clone();
+            result->checkAlpha(alpha);
+            result->setAlpha(alpha);
+        } else {
+            result = getSharedSlice(cache, type, eta);
+        }
+        cache.slices[key] = result;
+        return result.get();
+    }
+
     /// Return the minimum roughness value that is available in the precomputed data
-    inline Float getAlphaMin() { return m_alphaMin; }
+    inline Float getAlphaMin() const { return m_alphaMin; }
 
     /// Return the maximum roughness value that is available in the precomputed data
-    inline Float getAlphaMax() { return m_alphaMax; }
+    inline Float getAlphaMax() const { return m_alphaMax; }
 
     /// Return the minimum index of refraction that is available in the precomputed data
-    inline Float getEtaMin() { return m_etaMin; }
+    inline Float getEtaMin() const { return m_etaMin; }
 
     /// Return the maximum index of refraction that is available in the precomputed data
-    inline Float getEtaMax() { return m_etaMax; }
+    inline Float getEtaMax() const { return m_etaMax; }
 
     /**
      * \brief Evaluate the rough transmittance for a given index of refraction,
@@ -234,6 +280,50 @@ public:
     }
 
 
+    /**
+     * \brief Evaluate the rough transmittance for several angles of
+     * incidence that share the same roughness and index of refraction
+     *
+     * Equivalent to calling \ref eval() for every entry of \c cosTheta,
+     * but uses the batched spline routines when the table has been
+     * reduced to a 1D or 2D one.
+     */
+    void eval(size_t count, const Float *cosTheta, Float *result,
+            Float alpha = 0, Float eta = 0) const {
+        if (!m_etaFixed) {
+            for (size_t i=0; i<count; ++i)
+                result[i] = eval(cosTheta[i], alpha, eta);
+            return;
+        }
+
+        const size_t batchSize = 16;
+        Float warpedAlpha = m_alphaFixed ? (Float) 0 : std::pow((alpha - m_alphaMin)
+                / (m_alphaMax-m_alphaMin), (Float) 0.25f);
+
+        for (size_t offset=0; offset<count; offset += batchSize) {
+            size_t n = std::min(batchSize, count - offset);
+            Float warpedCosTheta[batchSize];
+            Point2 p[batchSize];
+            for (size_t i=0; i<n; ++i) {
+                warpedCosTheta[i] = std::pow(std::abs(cosTheta[offset+i]), (Float) 0.25f);
+                p[i] = Point2(warpedCosTheta[i], warpedAlpha);
+            }
+
+            if (m_alphaFixed)
+                evalCubicInterp1D(n, warpedCosTheta, result + offset,
+                    m_trans, m_thetaSamples, 0.0f, 1.0f);
+            else
+                evalCubicInterp2D(n, p, result + offset, m_trans,
+                    Size2(m_thetaSamples, m_alphaSamples), Point2(0.0f), Point2(1.0f));
+
+            for (size_t i=0; i<n; ++i) {
+                Float &value = result[offset+i];
+                value = !(cosTheta[offset+i] >= 0) ? (Float) 0 :
+                    std::min((Float) 1.0f, std::max((Float) 0.0f, value));
+            }
+        }
+    }
+
     /**
      * \brief Evaluate the \a diffuse rough transmittance for a given
      * index of refraction, roughness, and angle of incidence.
@@ -387,7 +477,7 @@ public:
         m_alphaFixed = true;
     }
 
-    void checkAlpha(Float alpha) {
+    void checkAlpha(Float alpha) const {
         if (alpha < m_alphaMin || alpha > m_alphaMax) {
             SLog(EError, "Error: the requested roughness value alpha=%f is"
                 " outside of the supported range [%f, %f]! Please scale "
@@ -396,7 +486,7 @@ public:
         }
     }
 
-    void checkEta(Float eta) {
+    void checkEta(Float eta) const {
         if (eta < 1)
             eta = 1/eta;
         if (eta < m_etaMin || eta > m_etaMax)
@@ -429,6 +519,58 @@ public:
     }
 protected:
     inline RoughTransmittance() { }
+
+    /// Process-wide cache of the tables used by \ref getShared()
+    struct SharedCache {
+        /// (distribution type, eta, alpha)
+        struct Key {
+            int type;
+            Float eta, alpha;
+
+            inline Key(int type, Float eta, Float alpha)
+                : type(type), eta(eta), alpha(alpha) { }
+
+            inline bool operator<(const Key &k) const {
+                if (type != k.type)
+                    return type < k.type;
+                if (eta != k.eta)
+                    return eta < k.eta;
+                return alpha < k.alpha;
+            }
+        };
+
+        typedef std::map<Key, ref<RoughTransmittance> > Map;
+
+        ref<Mutex> mutex;
+        std::map<int, ref<RoughTransmittance> > tables;
+        Map slices;
+
+        SharedCache() : mutex(new Mutex()) { }
+    };
+
+    static SharedCache &getSharedCache() {
+        static SharedCache cache;
+        return cache;
+    }
+
+    /// Return the shared 2D slice for a given IOR (cache mutex must be held)
+    static RoughTransmittance *getSharedSlice(SharedCache &cache,
+            MicrofacetDistribution::EType type, Float eta) {
+        SharedCache::Key key(type, eta, -1);
+        SharedCache::Map::iterator it = cache.slices.find(key);
+        if (it != cache.slices.end())
+            return it->second;
+
+        ref<RoughTransmittance> &table = cache.tables[type];
+        if (!table)
+            table = new RoughTransmittance(type);
+        table->checkEta(eta);
+
+        ref<RoughTransmittance> slice = table->clone();
+        slice->setEta(eta);
+        cache.slices[key] = slice;
+        return slice;
+    }
 protected:
     std::string m_name;
     size_t m_etaSamples;
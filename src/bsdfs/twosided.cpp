@@ -133,6 +133,20 @@ public:
         }
     }
 
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        BSDFSamplingRecord b(bRec);
+
+        if (Frame::cosTheta(b.wi) > 0) {
+            return m_nestedBRDF[0]->evalWithPdf(b, pdf, measure);
+        } else {
+            if (b.component != -1)
+                b.component -= m_nestedBRDF[0]->getComponentCount();
+            b.wi.z *= -1;
+            b.wo.z *= -1;
+            return m_nestedBRDF[1]->evalWithPdf(b, pdf, measure);
+        }
+    }
+
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
         bool flipped = false;
 
@@ -203,7 +203,7 @@ public:
                     break;
                 case EBalanced:
                     factor1 = dot(H,H) / (M_PI * alphaU * alphaV
-                        * std::pow(Frame::cosTheta(H),4));
+                        * (H.z*H.z) * (H.z*H.z));
                     break;
                 default:
                     Log(EError, "Unknown model type!");
@@ -242,7 +242,7 @@ public:
             Float alphaV = m_alphaV->eval(bRec.its).average();
             Vector H = normalize(bRec.wi+bRec.wo);
             Float factor1 = 1.0f / (4.0f * M_PI * alphaU * alphaV *
-                dot(H, bRec.wi) * std::pow(Frame::cosTheta(H), 3));
+                dot(H, bRec.wi) * H.z*H.z*H.z);
             Float factor2 = H.x / alphaU, factor3 = H.y / alphaV;
 
             Float exponent = -(factor2*factor2+factor3*factor3)/(H.z*H.z);
@@ -263,6 +263,73 @@ public:
             return 0.0f;
     }
 
+    Spectrum evalWithPdf(const BSDFSamplingRecord &bRec, Float &pdf, EMeasure measure) const {
+        pdf = 0.0f;
+        if (Frame::cosTheta(bRec.wi) <= 0 ||
+            Frame::cosTheta(bRec.wo) <= 0 || measure != ESolidAngle)
+            return Spectrum(0.0f);
+
+        bool hasSpecular = (bRec.typeMask & EGlossyReflection)
+                && (bRec.component == -1 || bRec.component == 0);
+        bool hasDiffuse  = (bRec.typeMask & EDiffuseReflection)
+                && (bRec.component == -1 || bRec.component == 1);
+
+        Spectrum result(0.0f);
+        Float diffuseProb = 0.0f, specProb = 0.0f;
+
+        if (hasSpecular) {
+            Vector H = bRec.wi+bRec.wo;
+            Float alphaU = m_alphaU->eval(bRec.its).average();
+            Float alphaV = m_alphaV->eval(bRec.its).average();
+
+            Float factor1 = 0.0f;
+            switch (m_modelVariant) {
+                case EWard:
+                    factor1 = 1.0f / (4.0f * M_PI * alphaU * alphaV *
+                        std::sqrt(Frame::cosTheta(bRec.wi)*Frame::cosTheta(bRec.wo)));
+                    break;
+                case EWardDuer:
+                    factor1 = 1.0f / (4.0f * M_PI * alphaU * alphaV *
+                        Frame::cosTheta(bRec.wi)*Frame::cosTheta(bRec.wo));
+                    break;
+                case EBalanced:
+                    factor1 = dot(H,H) / (M_PI * alphaU * alphaV
+                        * (H.z*H.z) * (H.z*H.z));
+                    break;
+                default:
+                    Log(EError, "Unknown model type!");
+            }
+
+            /* The exponential term is invariant to the length of H,
+               hence it is shared with the sampling density */
+            Float factor2 = H.x / alphaU, factor3 = H.y / alphaV;
+            Float exponent = math::fastexp(-(factor2*factor2+factor3*factor3)/(H.z*H.z));
+            Float specRef = factor1 * exponent;
+            /* Important to prevent numeric issues when evaluating the
+               sampling density of the Ward model in places where it takes
+               on miniscule values (Veach-MLT does this for instance) */
+            if (specRef > 1e-10f)
+                result += m_specularReflectance->eval(bRec.its) * specRef;
+
+            Vector Hn = normalize(H);
+            specProb = exponent / (4.0f * M_PI * alphaU * alphaV *
+                dot(Hn, bRec.wi) * Hn.z*Hn.z*Hn.z);
+        }
+
+        if (hasDiffuse) {
+            result += m_diffuseReflectance->eval(bRec.its) * INV_PI;
+            diffuseProb = warp::squareToCosineHemispherePdf(bRec.wo);
+        }
+
+        if (hasDiffuse && hasSpecular)
+            pdf = m_specularSamplingWeight * specProb +
+                  (1-m_specularSamplingWeight) * diffuseProb;
+        else
+            pdf = diffuseProb + specProb;
+
+        return result * Frame::cosTheta(bRec.wo);
+    }
+
     inline Spectrum sample(BSDFSamplingRecord &bRec, Float &_pdf, const Point2 &_sample) const {
         Point2 sample(_sample);
 
@@ -482,16 +482,13 @@ void writeGeometry(ColladaContext &ctx, const std::string &prefixName, std::stri
     id += formatString("_%i", geomIndex);
     std::string filename;
 
+    size_t shapeIndex = 0;
     if (!ctx.cvt->m_geometryFile) {
         filename = id + std::string(".serialized");
-        ref<FileStream> stream = new FileStream(ctx.meshesDirectory / filename, FileStream::ETruncReadWrite);
-        stream->setByteOrder(Stream::ELittleEndian);
-        mesh->serialize(stream);
-        stream->close();
+        ctx.cvt->m_geometryWriter->put(mesh, ctx.meshesDirectory / filename);
         filename = "meshes/" + filename;
     } else {
-        ctx.cvt->m_geometryDict.push_back((uint64_t) ctx.cvt->m_geometryFile->getPos());
-        mesh->serialize(ctx.cvt->m_geometryFile);
+        shapeIndex = ctx.cvt->m_geometryWriter->put(mesh);
         filename = ctx.cvt->m_geometryFileName.filename().string();
     }
 
@@ -505,7 +502,7 @@ void writeGeometry(ColladaContext &ctx, const std::string &prefixName, std::stri
         ctx.os << "\t<shape id=\"" << id << "\" type=\"serialized\">" << endl;
         ctx.os << "\t\t<string name=\"filename\" value=\"" << filename << "\"/>" << endl;
         if (ctx.cvt->m_geometryFile)
-            ctx.os << "\t\t<integer name=\"shapeIndex\" value=\"" << (ctx.cvt->m_geometryDict.size() - 1) << "\"/>" << endl;
+            ctx.os << "\t\t<integer name=\"shapeIndex\" value=\"" << shapeIndex << "\"/>" << endl;
         if (!transform.isIdentity()) {
             ctx.os << "\t\t<transform name=\"toWorld\">" << endl;
             ctx.os << "\t\t\t<matrix value=\"" << matrixValues.substr(0, matrixValues.length()-1) << "\"/>" << endl;
@@ -518,7 +515,7 @@ void writeGeometry(ColladaContext &ctx, const std::string &prefixName, std::stri
         ctx.os << "\t\t<shape type=\"serialized\">" << endl;
         ctx.os << "\t\t\t<string name=\"filename\" value=\"" << filename << "\"/>" << endl;
         if (ctx.cvt->m_geometryFile)
-            ctx.os << "\t\t\t<integer name=\"shapeIndex\" value=\"" << (ctx.cvt->m_geometryDict.size() - 1)<< "\"/>" << endl;
+            ctx.os << "\t\t\t<integer name=\"shapeIndex\" value=\"" << shapeIndex << "\"/>" << endl;
         if (matID != "")
             ctx.os << "\t\t\t<ref name=\"bsdf\" id=\"" << matID << "\"/>" << endl;
         ctx.os << "\t\t</shape>" << endl << endl;
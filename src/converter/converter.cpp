@@ -36,6 +36,7 @@
 #include <xercesc/util/XMLUni.hpp>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mstream.h>
 #include <boost/algorithm/string.hpp>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -99,6 +100,153 @@ void cleanup(DOMNode *node) {
     }
 }
 
+/// Background thread of a GeometryWriter
+class GeometryWriterThread : public Thread {
+public:
+    GeometryWriterThread(GeometryWriter *writer, int index)
+        : Thread(formatString("geo%i", index)), m_writer(writer) { }
+
+    void run() {
+        m_writer->work();
+    }
+private:
+    /* No reference -- the writer owns this thread */
+    GeometryWriter *m_writer;
+};
+
+GeometryWriter::GeometryWriter(FileStream *packedFile, bool compress, int threadCount)
+        : m_packedFile(packedFile), m_compress(compress), m_done(false) {
+    m_mutex = new Mutex();
+    m_fileMutex = new Mutex();
+    m_jobAvailable = new ConditionVariable(m_mutex);
+    m_slotAvailable = new ConditionVariable(m_mutex);
+
+    /* Bound the number of meshes that are kept in memory */
+    threadCount = std::max(threadCount, 1);
+    m_maxQueued = 2 * (size_t) threadCount;
+
+    for (int i=0; i<threadCount; ++i) {
+        ref<Thread> thread = new GeometryWriterThread(this, i);
+        thread->start();
+        m_threads.push_back(thread);
+    }
+}
+
+GeometryWriter::~GeometryWriter() {
+    stop();
+}
+
+size_t GeometryWriter::put(const TriMesh *mesh) {
+    SAssert(m_packedFile != NULL);
+    size_t index;
+    {
+        LockGuard lock(m_fileMutex);
+        index = m_dictionary.size();
+        m_dictionary.push_back(0);
+    }
+    enqueue(mesh, index, fs::path());
+    return index;
+}
+
+void GeometryWriter::put(const TriMesh *mesh, const fs::path &filename) {
+    enqueue(mesh, 0, filename);
+}
+
+void GeometryWriter::enqueue(const TriMesh *mesh, size_t index, const fs::path &filename) {
+    Job job;
+    job.mesh = mesh;
+    job.index = index;
+    job.filename = filename;
+
+    LockGuard lock(m_mutex);
+    while (m_jobs.size() >= m_maxQueued)
+        m_slotAvailable->wait();
+    m_jobs.push_back(job);
+    m_jobAvailable->signal();
+}
+
+void GeometryWriter::work() {
+    while (true) {
+        Job job;
+        {
+            LockGuard lock(m_mutex);
+            while (m_jobs.empty() && !m_done)
+                m_jobAvailable->wait();
+            if (m_jobs.empty())
+                break;
+            job = m_jobs.front();
+            m_jobs.pop_front();
+            m_slotAvailable->signal();
+        }
+
+        try {
+            if (!job.filename.empty()) {
+                ref<FileStream> stream = new FileStream(job.filename, FileStream::ETruncReadWrite);
+                stream->setByteOrder(Stream::ELittleEndian);
+                if (m_compress)
+                    job.mesh->serialize(stream);
+                else
+                    job.mesh->serializeUncompressed(stream);
+                stream->close();
+                continue;
+            }
+
+            /* Serialize into memory and append the result to the packed file */
+            ref<MemoryStream> mstream = new MemoryStream();
+            mstream->setByteOrder(Stream::ELittleEndian);
+            if (m_compress)
+                job.mesh->serialize(mstream);
+            else
+                job.mesh->serializeUncompressed(mstream);
+
+            LockGuard lock(m_fileMutex);
+            if (!m_compress) {
+                /* The attribute arrays are page-aligned relative to the
+                   start of the memory stream, so keep that alignment
+                   (see MTS_FILEFORMAT_PAGE_SIZE in trimesh.cpp) */
+                const size_t pageSize = 4096;
+                static const uint8_t zeros[pageSize] = { 0 };
+                size_t pos = m_packedFile->getPos();
+                m_packedFile->write(zeros, (pageSize - pos % pageSize) % pageSize);
+            }
+            m_dictionary[job.index] = (uint64_t) m_packedFile->getPos();
+            m_packedFile->write(mstream->getData(), mstream->getSize());
+        } catch (const std::exception &ex) {
+            LockGuard lock(m_fileMutex);
+            m_errors.push_back(formatString("\"%s\": %s",
+                job.mesh->getName().c_str(), ex.what()));
+        }
+    }
+}
+
+void GeometryWriter::stop() {
+    {
+        LockGuard lock(m_mutex);
+        m_done = true;
+        m_jobAvailable->broadcast();
+    }
+    for (size_t i=0; i<m_threads.size(); ++i)
+        m_threads[i]->join();
+    m_threads.clear();
+}
+
+void GeometryWriter::finish() {
+    stop();
+
+    if (!m_errors.empty()) {
+        for (size_t i=0; i<m_errors.size(); ++i)
+            SLog(EWarn, "Could not save the mesh %s", m_errors[i].c_str());
+        SLog(EError, "Could not save " SIZE_T_FMT " meshes!", m_errors.size());
+    }
+
+    if (m_packedFile) {
+        for (size_t i=0; i<m_dictionary.size(); ++i)
+            m_packedFile->writeULong(m_dictionary[i]);
+        m_packedFile->writeUInt((uint32_t) m_dictionary.size());
+        m_packedFile->close();
+    }
+}
+
 void GeometryConverter::convert(const fs::path &inputFile,
     const fs::path &outputDirectory,
     const fs::path &sceneName,
@@ -122,6 +270,7 @@ void GeometryConverter::convert(const fs::path &inputFile,
         m_geometryFile = new FileStream(m_geometryFileName, FileStream::ETruncReadWrite);
         m_geometryFile->setByteOrder(Stream::ELittleEndian);
     }
+    m_geometryWriter = new GeometryWriter(m_geometryFile, m_compressGeometry, m_threadCount);
 
     if (!fs::exists(textureDirectory)) {
         SLog(EInfo, "Creating directory \"%s\" ..", textureDirectory.string().c_str());
@@ -295,12 +444,8 @@ void GeometryConverter::convert(const fs::path &inputFile,
         ofile << os.str();
         ofile.close();
     }
-    if (m_geometryFile) {
-        for (size_t i=0; i<m_geometryDict.size(); ++i)
-            m_geometryFile->writeULong((uint64_t) m_geometryDict[i]);
-        m_geometryFile->writeUInt((uint32_t) m_geometryDict.size());
-        m_geometryFile->close();
-    }
+    m_geometryWriter->finish();
+    m_geometryWriter = NULL;
 
     m_filename = outputFile;
 }
@@ -17,10 +17,68 @@
 */
 
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/lock.h>
+#include <mitsuba/render/trimesh.h>
+#include <deque>
 #include <set>
 
 using namespace mitsuba;
 
+/**
+ * \brief Serializes the converted meshes on a pool of background threads
+ *
+ * Compressing the meshes dominates the import time of large scenes, hence
+ * the converter only builds them and queues them here. When writing a
+ * packed geometry file, the meshes are appended in the order in which they
+ * finish (their offsets are stored in the trailing dictionary), and
+ * uncompressed meshes start on a page boundary so that they can be mapped.
+ */
+class GeometryWriter : public Object {
+public:
+    /**
+     * \brief Create a writer with \c threadCount threads
+     *
+     * \param packedFile
+     *    Geometry file that receives all meshes passed to \ref put(const TriMesh *)
+     *    (may be \c NULL if only separate files are written)
+     */
+    GeometryWriter(FileStream *packedFile, bool compress, int threadCount);
+
+    /// Queue a mesh for the packed file and return its shape index
+    size_t put(const TriMesh *mesh);
+
+    /// Queue a mesh that is saved to a separate file
+    void put(const TriMesh *mesh, const fs::path &filename);
+
+    /// Wait for the queued meshes and append the dictionary to the packed file
+    void finish();
+
+    /// Serialize queued meshes until \ref finish() is called (used by the threads)
+    void work();
+protected:
+    virtual ~GeometryWriter();
+
+    void enqueue(const TriMesh *mesh, size_t index, const fs::path &filename);
+    void stop();
+private:
+    struct Job {
+        ref<const TriMesh> mesh;
+        size_t index;
+        fs::path filename;
+    };
+
+    ref<FileStream> m_packedFile;
+    ref<Mutex> m_mutex, m_fileMutex;
+    ref<ConditionVariable> m_jobAvailable, m_slotAvailable;
+    std::deque<Job> m_jobs;
+    std::vector<uint64_t> m_dictionary;
+    std::vector<ref<Thread> > m_threads;
+    std::vector<std::string> m_errors;
+    size_t m_maxQueued;
+    bool m_compress, m_done;
+};
+
 class GeometryConverter {
 public:
     inline GeometryConverter() {
@@ -31,6 +89,8 @@ public:
         m_packGeometry = true;
         m_importMaterials = true;
         m_importAnimations = false;
+        m_compressGeometry = true;
+        m_threadCount = getCoreCount();
     }
 
     void convert(const fs::path &inputFile,
@@ -44,6 +104,8 @@ public:
     inline void setMapSmallerSide(bool mapSmallerSide) { m_mapSmallerSide = mapSmallerSide; }
     inline void setResolution(int xres, int yres) { m_xres = xres; m_yres = yres; }
     inline void setPackGeometry(bool packGeometry) { m_packGeometry = packGeometry; }
+    inline void setCompressGeometry(bool compressGeometry) { m_compressGeometry = compressGeometry; }
+    inline void setThreadCount(int threadCount) { m_threadCount = threadCount; }
     inline void setImportMaterials(bool importMaterials) { m_importMaterials = importMaterials; }
     inline void setImportAnimations(bool importAnimations) { m_importAnimations = importAnimations; }
     inline void setFilmType(const std::string &filmType) { m_filmType = filmType; }
@@ -63,6 +125,8 @@ public:
     std::string m_filmType;
     ref<FileStream> m_geometryFile;
     fs::path m_geometryFileName;
-    std::vector<size_t> m_geometryDict;
+    ref<GeometryWriter> m_geometryWriter;
     bool m_packGeometry;
+    bool m_compressGeometry;
+    int m_threadCount;
 };
@@ -62,6 +62,8 @@ void help() {
         <<  "   -m          Map the larger image side to the full field of view" << endl << endl
         <<  "   -z          Import animations" << endl << endl
         <<  "   -y          Don't pack all geometry data into a single file" << endl << endl
+        <<  "   -u          Write uncompressed geometry files that can be memory-mapped" << endl << endl
+        <<  "   -p count    Number of threads that compress and write the meshes (default: all cores)" << endl << endl
         <<  "   -n          Don't import any materials (an adjustments file will be necessary)" << endl << endl
         <<  "   -l <type>   Override the type of film (e.g. 'hdrfilm', 'ldrfilm', ..)" << endl << endl
         <<  "   -r <w>x<h>  Override the image resolution to e.g. 1920x1080" << endl << endl
@@ -72,16 +74,16 @@ int importMain(int argc, char **argv) {
     bool srgb = false, mapSmallerSide = true;
     int optchar;
     char *end_ptr = NULL;
-    int xres = -1, yres = -1;
+    int xres = -1, yres = -1, threadCount = getCoreCount();
     std::string filmType = "hdrfilm";
     FileResolver *fileResolver = Thread::getThread()->getFileResolver();
     ELogLevel logLevel = EInfo;
     bool packGeometry = true, importMaterials = true,
-         importAnimations = false;
+         importAnimations = false, compressGeometry = true;
 
     optind = 1;
 
-    while ((optchar = getopt(argc, argv, "snzvyhmr:a:l:")) != -1) {
+    while ((optchar = getopt(argc, argv, "snzvyuhmr:a:l:p:")) != -1) {
         switch (optchar) {
             case 'a': {
                     std::vector<std::string> paths = tokenize(optarg, ";");
@@ -110,6 +112,14 @@ int importMain(int argc, char **argv) {
             case 'y':
                 packGeometry = false;
                 break;
+            case 'u':
+                compressGeometry = false;
+                break;
+            case 'p':
+                threadCount = strtol(optarg, &end_ptr, 10);
+                if (*end_ptr != '\0' || threadCount < 1)
+                    SLog(EError, "Invalid thread count!");
+                break;
             case 'r': {
                     std::vector<std::string> tokens = tokenize(optarg, "x");
                     if (tokens.size() != 2)
@@ -144,6 +154,8 @@ int importMain(int argc, char **argv) {
     converter.setImportAnimations(importAnimations);
     converter.setMapSmallerSide(mapSmallerSide);
     converter.setPackGeometry(packGeometry);
+    converter.setCompressGeometry(compressGeometry);
+    converter.setThreadCount(threadCount);
     converter.setFilmType(filmType);
 
     const Logger *logger = Thread::getThread()->getLogger();
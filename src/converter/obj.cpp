@@ -201,17 +201,13 @@ void GeometryConverter::convertOBJ(const fs::path &inputFile,
         if (!m_geometryFile) {
             std::string filename = mesh->getName() + std::string(".serialized");
             SLog(EInfo, "Saving \"%s\"", filename.c_str());
-            ref<FileStream> stream = new FileStream(meshesDirectory / filename, FileStream::ETruncReadWrite);
-            stream->setByteOrder(Stream::ELittleEndian);
-            mesh->serialize(stream);
-            stream->close();
+            m_geometryWriter->put(mesh, meshesDirectory / filename);
             os << "\t\t<string name=\"filename\" value=\"meshes/" << filename.c_str() << "\"/>" << endl;
         } else {
-            m_geometryDict.push_back((uint64_t) m_geometryFile->getPos());
             SLog(EInfo, "Saving mesh \"%s\" ..", mesh->getName().c_str());
-            mesh->serialize(m_geometryFile);
+            size_t shapeIndex = m_geometryWriter->put(mesh);
             os << "\t\t<string name=\"filename\" value=\"" << m_geometryFileName.filename().string() << "\"/>" << endl;
-            os << "\t\t<integer name=\"shapeIndex\" value=\"" << (m_geometryDict.size()-1) << "\"/>" << endl;
+            os << "\t\t<integer name=\"shapeIndex\" value=\"" << shapeIndex << "\"/>" << endl;
         }
 
         if (mesh->getBSDF() != NULL &&
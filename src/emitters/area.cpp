@@ -18,6 +18,7 @@
 
 #include <mitsuba/render/emitter.h>
 #include <mitsuba/render/shape.h>
+#include <mitsuba/render/trimesh.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/hw/gpuprogram.h>
 #include <mitsuba/core/warp.h>
@@ -36,6 +37,11 @@ MTS_NAMESPACE_BEGIN
  *         Specifies the relative amount of samples
  *         allocated to this emitter. \default{1}
  *     }
+ *     \parameter{solidAngleSampling}{\Boolean}{
+ *         When attached to a triangle mesh, sample the solid angle
+ *         subtended by the individual triangles for direct illumination
+ *         instead of their area (see below). \default{\code{false}}
+ *     }
  * }
  *
  * This plugin implements an area light, i.e. a light source that emits
@@ -50,6 +56,14 @@ MTS_NAMESPACE_BEGIN
  * particularly good direct illumination sampling strategy (see
  * the \pluginref{sphere} plugin for an example).
  *
+ * Emissive triangle meshes normally generate direct illumination samples
+ * by picking a triangle proportionally to its area and then a uniform
+ * position on it, which is noisy close to large triangles. With
+ * \code{solidAngleSampling} enabled, the position is instead sampled
+ * uniformly within the solid angle that the chosen triangle subtends at
+ * the reference point. Triangles that appear tiny or huge keep using
+ * area sampling.
+ *
  * To create an area light source, simply instantiate the desired
  * emitter shape and specify an \code{area} instance as its child:
  *
@@ -76,12 +90,14 @@ public:
 
         m_radiance = props.getSpectrum("radiance", Spectrum::getD65());
         m_power = Spectrum(0.0f); /// Don't know the power yet
+        m_solidAngleSampling = props.getBoolean("solidAngleSampling", false);
     }
 
     AreaLight(Stream *stream, InstanceManager *manager)
         : Emitter(stream, manager) {
         m_radiance = Spectrum(stream);
         m_power = Spectrum(stream);
+        m_solidAngleSampling = stream->readBool();
         configure();
     }
 
@@ -89,6 +105,14 @@ public:
         Emitter::serialize(stream, manager);
         m_radiance.serialize(stream);
         m_power.serialize(stream);
+        stream->writeBool(m_solidAngleSampling);
+    }
+
+    /// Return the attached mesh if triangles should be sampled by solid angle
+    inline const TriMesh *getSolidAngleMesh() const {
+        if (!m_solidAngleSampling || !m_shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+            return NULL;
+        return static_cast<const TriMesh *>(m_shape);
     }
 
     Spectrum samplePosition(PositionSamplingRecord &pRec,
@@ -157,7 +181,11 @@ public:
 
     Spectrum sampleDirect(DirectSamplingRecord &dRec,
             const Point2 &sample) const {
-        m_shape->sampleDirect(dRec, sample);
+        const TriMesh *mesh = getSolidAngleMesh();
+        if (mesh)
+            mesh->sampleDirectSolidAngle(dRec, sample);
+        else
+            m_shape->sampleDirect(dRec, sample);
 
         /* Check that the emitter and reference position are oriented correctly
            with respect to each other. Note that the >= 0 check
@@ -176,7 +204,8 @@ public:
         /* Check that the emitter and receiver are oriented correctly
            with respect to each other. */
         if (dot(dRec.d, dRec.refN) >= 0 && dot(dRec.d, dRec.n) < 0) {
-            return m_shape->pdfDirect(dRec);
+            const TriMesh *mesh = getSolidAngleMesh();
+            return mesh ? mesh->pdfDirectSolidAngle(dRec) : m_shape->pdfDirect(dRec);
         } else {
             return 0.0f;
         }
@@ -210,6 +239,7 @@ public:
         oss << "AreaLight[" << endl
             << "  radiance = " << m_radiance.toString() << "," << endl
             << "  samplingWeight = " << m_samplingWeight << "," << endl
+            << "  solidAngleSampling = " << m_solidAngleSampling << "," << endl
             << "  surfaceArea = ";
         if (m_shape)
             oss << m_shape->getSurfaceArea();
@@ -226,6 +256,7 @@ public:
     MTS_DECLARE_CLASS()
 protected:
     Spectrum m_radiance, m_power;
+    bool m_solidAngleSampling;
 };
 
 // ================ Hardware shader implementation ================
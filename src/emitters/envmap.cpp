@@ -34,6 +34,61 @@ MTS_NAMESPACE_BEGIN
 # define ENVMAP_PIXELFORMAT Bitmap::ESpectrum
 #endif
 
+/// Version of the sampling table cache file format
+#define ENVMAP_SAMPLING_CACHE_VERSION 1
+
+/**
+ * Build an alias table for sampling an index proportionally to the
+ * given weights using Vose's method
+ */
+static void buildAliasTable(const std::vector<double> &weights, float *prob, uint16_t *alias) {
+    size_t n = weights.size();
+    double sum = 0;
+    for (size_t i=0; i<n; ++i)
+        sum += weights[i];
+
+    if (!(sum > 0)) {
+        /* This table is never sampled */
+        for (size_t i=0; i<n; ++i) {
+            prob[i] = 1.0f;
+            alias[i] = (uint16_t) i;
+        }
+        return;
+    }
+
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    for (size_t i=0; i<n; ++i) {
+        scaled[i] = weights[i] * (n / sum);
+        if (scaled[i] < 1)
+            small.push_back((uint32_t) i);
+        else
+            large.push_back((uint32_t) i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back(), l = large.back();
+        small.pop_back();
+        prob[s] = (float) scaled[s];
+        alias[s] = (uint16_t) l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1;
+        if (scaled[l] < 1) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    /* Remaining entries (up to roundoff errors) have a probability of one */
+    for (size_t i=0; i<large.size(); ++i) {
+        prob[large[i]] = 1.0f;
+        alias[large[i]] = (uint16_t) large[i];
+    }
+    for (size_t i=0; i<small.size(); ++i) {
+        prob[small[i]] = 1.0f;
+        alias[small[i]] = (uint16_t) small[i];
+    }
+}
+
 /*!\plugin{envmap}{Environment emitter}
  * \icon{emitter_envmap}
  * \order{9}
@@ -65,6 +120,18 @@ MTS_NAMESPACE_BEGIN
  *         Specifies the relative amount of samples
  *         allocated to this emitter. \default{1}
  *     }
+ *     \parameter{samplingMethod}{\String}{
+ *         Data structure used to importance sample pixels of the map:
+ *         \begin{enumerate}[(i)]
+ *             \item \code{cdf}: Marginal and conditional cumulative
+ *             distribution functions that are searched using bisection.
+ *             Preserves the stratification of the input samples.
+ *             \item \code{alias}: Marginal and conditional alias tables
+ *             that sample pixels in constant time, which is faster for very
+ *             large maps. Does not preserve stratification of the samples.
+ *         \end{enumerate}
+ *         \default{\code{cdf}}
+ *     }
  * }
  * \renderings{
  *   \rendering{The museum environment map by Bernhard Vogl that is used
@@ -94,7 +161,9 @@ MTS_NAMESPACE_BEGIN
  * Like the \pluginref{bitmap} texture, this plugin generates a cache file
  * named \emph{filename}\code{.mip} when given a large input image. This
  * significantly accelerates the loading times of subsequent renderings. When this
- * is not desired, specify \code{cache=false} to the plugin.
+ * is not desired, specify \code{cache=false} to the plugin. The data structures
+ * used for importance sampling are then stored as well, in a file named
+ * \emph{filename}\code{.sampling}.
  */
 class EnvironmentMap : public Emitter {
 public:
@@ -103,7 +172,9 @@ public:
     typedef TMIPMap<Spectrum, SpectrumHalf> MIPMap;
 
     EnvironmentMap(const Properties &props) : Emitter(props),
-            m_mipmap(NULL), m_cdfRows(NULL), m_cdfCols(NULL), m_rowWeights(NULL) {
+            m_mipmap(NULL), m_cdfRows(NULL), m_cdfCols(NULL), m_rowWeights(NULL),
+            m_aliasProbRows(NULL), m_aliasProbCols(NULL), m_aliasRows(NULL),
+            m_aliasCols(NULL), m_timestamp(0) {
         m_type |= EOnSurface | EEnvironmentEmitter;
         uint64_t timestamp = 0;
         bool tryReuseCache = false;
@@ -186,17 +257,51 @@ public:
 
         /* Scale factor */
         m_scale = props.getFloat("scale", 1.0f);
+
+        std::string samplingMethod = props.getString("samplingMethod", "cdf");
+        if (samplingMethod == "alias")
+            m_aliasSampling = true;
+        else if (samplingMethod == "cdf")
+            m_aliasSampling = false;
+        else
+            Log(EError, "Unknown sampling method \"%s\" (must be \"cdf\" "
+                "or \"alias\")", samplingMethod.c_str());
+
+        /* Also cache the sampling data structures of large maps */
+        m_timestamp = timestamp;
+        m_updateSamplingCache = true;
+        const Vector2i &size = m_mipmap->getArray().getSize();
+        if (!cacheFile.empty() && props.getBoolean("cache",
+                (size_t) size.x * (size_t) size.y > 1024*1024)) {
+            m_samplingCacheFile = m_filename;
+            m_samplingCacheFile.replace_extension(".sampling");
+        }
     }
 
     EnvironmentMap(Stream *stream, InstanceManager *manager) : Emitter(stream, manager),
-            m_mipmap(NULL), m_cdfRows(NULL), m_cdfCols(NULL), m_rowWeights(NULL) {
+            m_mipmap(NULL), m_cdfRows(NULL), m_cdfCols(NULL), m_rowWeights(NULL),
+            m_aliasProbRows(NULL), m_aliasProbCols(NULL), m_aliasRows(NULL),
+            m_aliasCols(NULL), m_timestamp(0) {
         m_filename = stream->readString();
         Log(EDebug, "Unserializing texture \"%s\"", m_filename.filename().string().c_str());
         m_gamma = stream->readFloat();
         m_scale = stream->readFloat();
+        m_aliasSampling = stream->readBool();
+        bool samplingCache = stream->readBool();
         m_sceneBSphere = BSphere(stream);
         m_geoBSphere = BSphere(stream);
 
+        /* Reuse cached sampling tables if the image is also available locally */
+        m_updateSamplingCache = false;
+        if (samplingCache && fs::exists(m_filename)) {
+            boost::system::error_code ec;
+            m_timestamp = (uint64_t) fs::last_write_time(m_filename, ec);
+            if (!ec.value()) {
+                m_samplingCacheFile = m_filename;
+                m_samplingCacheFile.replace_extension(".sampling");
+            }
+        }
+
         size_t size = stream->readSize();
         ref<MemoryStream> mStream = new MemoryStream(size);
         stream->copyTo(mStream, size);
@@ -229,6 +334,14 @@ public:
             delete[] m_cdfCols;
         if (m_rowWeights)
             delete[] m_rowWeights;
+        if (m_aliasProbRows)
+            delete[] m_aliasProbRows;
+        if (m_aliasProbCols)
+            delete[] m_aliasProbCols;
+        if (m_aliasRows)
+            delete[] m_aliasRows;
+        if (m_aliasCols)
+            delete[] m_aliasCols;
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -236,6 +349,8 @@ public:
         stream->writeString(m_filename.string());
         stream->writeFloat(m_gamma);
         stream->writeFloat(m_scale);
+        stream->writeBool(m_aliasSampling);
+        stream->writeBool(!m_samplingCacheFile.empty());
         m_sceneBSphere.serialize(stream);
         m_geoBSphere.serialize(stream);
 
@@ -261,67 +376,19 @@ public:
         Emitter::configure();
 
         if (!m_rowWeights) {
-            /// Build CDF tables to sample the environment map
-            const MIPMap::Array2DType &array = m_mipmap->getArray();
-            m_size = array.getSize();
-
-            size_t nEntries = (size_t) (m_size.x + 1) * (size_t) m_size.y,
-                totalStorage = sizeof(float) * (m_size.x + 1 + nEntries);
-
-            Log(EInfo, "Precomputing data structures for environment map sampling (%s)",
-                memString(totalStorage).c_str());
-
-            ref<Timer> timer = new Timer();
-            m_cdfCols = new float[nEntries];
-            m_cdfRows = new float[m_size.y + 1];
-            m_rowWeights = new Float[m_size.y];
-
-            size_t colPos = 0, rowPos = 0;
-            Float rowSum = 0.0f;
-
-            /* Build a marginal & conditional cumulative distribution
-               function over luminances weighted by sin(theta) */
-            m_cdfRows[rowPos++] = 0;
-            for (int y=0; y<m_size.y; ++y) {
-                Float colSum = 0;
-
-                m_cdfCols[colPos++] = 0;
-                for (int x=0; x<m_size.x; ++x) {
-                    Spectrum value(array(x, y));
-
-                    colSum += value.getLuminance();
-                    m_cdfCols[colPos++] = (float) colSum;
-                }
-
-                float normalization = 1.0f / (float) colSum;
-                for (int x=1; x<m_size.x; ++x)
-                    m_cdfCols[colPos-x-1] *= normalization;
-                m_cdfCols[colPos-1] = 1.0f;
-
-                Float weight = std::sin((y + 0.5f) * M_PI / m_size.y);
-                m_rowWeights[y] = weight;
-                rowSum += colSum * weight;
-                m_cdfRows[rowPos++] = (float) rowSum;
+            m_size = m_mipmap->getArray().getSize();
+            if (m_aliasSampling && std::max(m_size.x, m_size.y) > 0x10000)
+                Log(EError, "Alias table sampling requires environment maps "
+                    "with at most 65536 pixels in width and height");
+
+            if (m_samplingCacheFile.empty() || !loadSamplingCache()) {
+                buildSamplingTables();
+                if (!m_samplingCacheFile.empty() && m_updateSamplingCache)
+                    saveSamplingCache();
             }
 
-            float normalization = 1.0f / (float) rowSum;
-            for (int y=1; y<m_size.y; ++y)
-                m_cdfRows[rowPos-y-1] *= normalization;
-            m_cdfRows[rowPos-1] = 1.0f;
-
-            if (rowSum == 0)
-                Log(EError, "The environment map is completely black -- this is not allowed.");
-            else if (!std::isfinite(rowSum))
-                Log(EError, "The environment map contains an invalid floating"
-                    " point value (nan/inf) -- giving up.");
-
-            m_normalization = 1.0f / (rowSum *
-                (2 * M_PI / m_size.x) * (M_PI / m_size.y));
-
             /* Size of a pixel in spherical coordinates */
             m_pixelSize = Vector2(2 * M_PI / m_size.x, M_PI / m_size.y);
-
-            Log(EInfo, "Done (took %i ms)", timer->getMilliseconds());
         }
         Float surfaceArea = 4 * M_PI * m_sceneBSphere.radius * m_sceneBSphere.radius;
         m_invSurfaceArea = 1 / surfaceArea;
@@ -566,8 +633,15 @@ public:
     /// Helper function that samples a direction from the environment map
     void internalSampleDirection(Point2 sample, Vector &d, Spectrum &value, Float &pdf) const {
         /* Sample a discrete pixel position */
-        uint32_t row = sampleReuse(m_cdfRows, m_size.y, sample.y),
-                 col = sampleReuse(m_cdfCols + row * (m_size.x+1), m_size.x, sample.x);
+        uint32_t row, col;
+        if (m_aliasSampling) {
+            row = sampleAlias(m_aliasProbRows, m_aliasRows, m_size.y, sample.y);
+            size_t offset = (size_t) row * (size_t) m_size.x;
+            col = sampleAlias(m_aliasProbCols + offset, m_aliasCols + offset, m_size.x, sample.x);
+        } else {
+            row = sampleReuse(m_cdfRows, m_size.y, sample.y);
+            col = sampleReuse(m_cdfCols + row * (m_size.x+1), m_size.x, sample.x);
+        }
 
         /* Using the remaining bits of precision to shift the sample by an offset
            drawn from a tent function. This effectively creates a sampling strategy
@@ -653,6 +727,219 @@ public:
 
     MTS_DECLARE_CLASS()
 private:
+    /// Return the memory consumption of the sampling data structures in bytes
+    size_t getSamplingTableSize() const {
+        size_t rows = (size_t) m_size.y, cols = (size_t) m_size.x;
+        if (m_aliasSampling)
+            return (sizeof(float) + sizeof(uint16_t)) * (rows * cols + rows)
+                + sizeof(Float) * rows;
+        else
+            return sizeof(float) * ((cols + 1) * rows + rows + 1)
+                + sizeof(Float) * rows;
+    }
+
+    /**
+     * \brief Build data structures to sample pixels proportionally
+     * to their luminance weighted by sin(theta)
+     */
+    void buildSamplingTables() {
+        const MIPMap::Array2DType &array = m_mipmap->getArray();
+
+        Log(EInfo, "Precomputing data structures for environment map sampling (%s)",
+            memString(getSamplingTableSize()).c_str());
+
+        ref<Timer> timer = new Timer();
+        m_rowWeights = new Float[m_size.y];
+
+        std::vector<Float> colSums(m_size.y);
+
+        if (m_aliasSampling) {
+            size_t nPixels = (size_t) m_size.x * (size_t) m_size.y;
+            m_aliasProbCols = new float[nPixels];
+            m_aliasCols = new uint16_t[nPixels];
+            m_aliasProbRows = new float[m_size.y];
+            m_aliasRows = new uint16_t[m_size.y];
+
+            /* Build a marginal & conditional alias table over luminances
+               weighted by sin(theta) */
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for schedule(static)
+            #endif
+            for (int y=0; y<m_size.y; ++y) {
+                std::vector<double> weights(m_size.x);
+                Float colSum = 0;
+                for (int x=0; x<m_size.x; ++x) {
+                    weights[x] = Spectrum(array(x, y)).getLuminance();
+                    colSum += (Float) weights[x];
+                }
+                size_t offset = (size_t) y * (size_t) m_size.x;
+                buildAliasTable(weights, m_aliasProbCols + offset, m_aliasCols + offset);
+                colSums[y] = colSum;
+            }
+
+            std::vector<double> rowWeights(m_size.y);
+            Float rowSum = 0.0f;
+            for (int y=0; y<m_size.y; ++y) {
+                Float weight = std::sin((y + 0.5f) * M_PI / m_size.y);
+                m_rowWeights[y] = weight;
+                rowWeights[y] = colSums[y] * weight;
+                rowSum += colSums[y] * weight;
+            }
+            buildAliasTable(rowWeights, m_aliasProbRows, m_aliasRows);
+            setNormalization(rowSum);
+
+            Log(EInfo, "Done (took %i ms)", timer->getMilliseconds());
+            return;
+        }
+
+        size_t nEntries = (size_t) (m_size.x + 1) * (size_t) m_size.y;
+        m_cdfCols = new float[nEntries];
+        m_cdfRows = new float[m_size.y + 1];
+
+        /* Build a marginal & conditional cumulative distribution
+           function over luminances weighted by sin(theta). The
+           conditional distributions are independent of each other */
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(static)
+        #endif
+        for (int y=0; y<m_size.y; ++y) {
+            float *cdfCols = m_cdfCols + (size_t) y * (size_t) (m_size.x + 1);
+            Float colSum = 0;
+
+            cdfCols[0] = 0;
+            for (int x=0; x<m_size.x; ++x) {
+                Spectrum value(array(x, y));
+
+                colSum += value.getLuminance();
+                cdfCols[x+1] = (float) colSum;
+            }
+
+            float normalization = 1.0f / (float) colSum;
+            for (int x=1; x<m_size.x; ++x)
+                cdfCols[x] *= normalization;
+            cdfCols[m_size.x] = 1.0f;
+            colSums[y] = colSum;
+        }
+
+        size_t rowPos = 0;
+        Float rowSum = 0.0f;
+
+        m_cdfRows[rowPos++] = 0;
+        for (int y=0; y<m_size.y; ++y) {
+            Float weight = std::sin((y + 0.5f) * M_PI / m_size.y);
+            m_rowWeights[y] = weight;
+            rowSum += colSums[y] * weight;
+            m_cdfRows[rowPos++] = (float) rowSum;
+        }
+
+        float normalization = 1.0f / (float) rowSum;
+        for (int y=1; y<m_size.y; ++y)
+            m_cdfRows[rowPos-y-1] *= normalization;
+        m_cdfRows[rowPos-1] = 1.0f;
+
+        setNormalization(rowSum);
+
+        Log(EInfo, "Done (took %i ms)", timer->getMilliseconds());
+    }
+
+    /// Compute the normalization of the sampling density from the sum of all weights
+    void setNormalization(Float rowSum) {
+        if (rowSum == 0)
+            Log(EError, "The environment map is completely black -- this is not allowed.");
+        else if (!std::isfinite(rowSum))
+            Log(EError, "The environment map contains an invalid floating"
+                " point value (nan/inf) -- giving up.");
+
+        m_normalization = 1.0f / (rowSum *
+            (2 * M_PI / m_size.x) * (M_PI / m_size.y));
+    }
+
+    /// Header of the sampling table cache file
+    struct SamplingCacheHeader {
+        char identifier[3];
+        uint8_t version;
+        uint8_t aliasSampling;
+        float gamma;
+        int width;
+        int height;
+        uint64_t timestamp;
+        double normalization;
+    };
+
+    /// Try to load the sampling data structures from the cache file
+    bool loadSamplingCache() {
+        if (!fs::exists(m_samplingCacheFile))
+            return false;
+
+        ref<FileStream> fs = new FileStream(m_samplingCacheFile, FileStream::EReadOnly);
+        SamplingCacheHeader header;
+        if (fs->getSize() != sizeof(SamplingCacheHeader) + getSamplingTableSize())
+            return false;
+        fs->read(&header, sizeof(SamplingCacheHeader));
+
+        if (header.identifier[0] != 'E' || header.identifier[1] != 'N'
+            || header.identifier[2] != 'V' || header.version != ENVMAP_SAMPLING_CACHE_VERSION
+            || header.aliasSampling != (uint8_t) m_aliasSampling
+            || header.timestamp != m_timestamp || header.gamma != (float) m_gamma
+            || header.width != m_size.x || header.height != m_size.y)
+            return false;
+
+        ref<Timer> timer = new Timer();
+        size_t rows = (size_t) m_size.y, cols = (size_t) m_size.x;
+        m_rowWeights = new Float[rows];
+        fs->read(m_rowWeights, sizeof(Float) * rows);
+        if (m_aliasSampling) {
+            m_aliasProbRows = new float[rows];
+            m_aliasRows = new uint16_t[rows];
+            m_aliasProbCols = new float[rows * cols];
+            m_aliasCols = new uint16_t[rows * cols];
+            fs->read(m_aliasProbRows, sizeof(float) * rows);
+            fs->read(m_aliasRows, sizeof(uint16_t) * rows);
+            fs->read(m_aliasProbCols, sizeof(float) * rows * cols);
+            fs->read(m_aliasCols, sizeof(uint16_t) * rows * cols);
+        } else {
+            m_cdfRows = new float[rows + 1];
+            m_cdfCols = new float[rows * (cols + 1)];
+            fs->read(m_cdfRows, sizeof(float) * (rows + 1));
+            fs->read(m_cdfCols, sizeof(float) * rows * (cols + 1));
+        }
+        m_normalization = (Float) header.normalization;
+
+        Log(EInfo, "Loaded environment map sampling data structures from \"%s\" (took %i ms)",
+            m_samplingCacheFile.filename().string().c_str(), timer->getMilliseconds());
+        return true;
+    }
+
+    /// Write the sampling data structures to the cache file
+    void saveSamplingCache() const {
+        SamplingCacheHeader header;
+        memset(&header, 0, sizeof(SamplingCacheHeader));
+        header.identifier[0] = 'E';
+        header.identifier[1] = 'N';
+        header.identifier[2] = 'V';
+        header.version = ENVMAP_SAMPLING_CACHE_VERSION;
+        header.aliasSampling = (uint8_t) m_aliasSampling;
+        header.gamma = (float) m_gamma;
+        header.width = m_size.x;
+        header.height = m_size.y;
+        header.timestamp = m_timestamp;
+        header.normalization = (double) m_normalization;
+
+        ref<FileStream> fs = new FileStream(m_samplingCacheFile, FileStream::ETruncWrite);
+        size_t rows = (size_t) m_size.y, cols = (size_t) m_size.x;
+        fs->write(&header, sizeof(SamplingCacheHeader));
+        fs->write(m_rowWeights, sizeof(Float) * rows);
+        if (m_aliasSampling) {
+            fs->write(m_aliasProbRows, sizeof(float) * rows);
+            fs->write(m_aliasRows, sizeof(uint16_t) * rows);
+            fs->write(m_aliasProbCols, sizeof(float) * rows * cols);
+            fs->write(m_aliasCols, sizeof(uint16_t) * rows * cols);
+        } else {
+            fs->write(m_cdfRows, sizeof(float) * (rows + 1));
+            fs->write(m_cdfCols, sizeof(float) * rows * (cols + 1));
+        }
+    }
+
     /// Sample from an array using the inversion method
     inline uint32_t sampleReuse(float *cdf, uint32_t size, Float &sample) const {
         float *entry = std::lower_bound(cdf, cdf+size+1, (float) sample);
@@ -660,11 +947,32 @@ private:
         sample = (sample - (Float) cdf[index]) / (Float) (cdf[index+1] - cdf[index]);
         return index;
     }
+
+    /// Sample from an alias table in constant time
+    inline uint32_t sampleAlias(const float *prob, const uint16_t *alias,
+            uint32_t size, Float &sample) const {
+        Float scaled = sample * size;
+        uint32_t index = std::min((uint32_t) scaled, size - 1);
+        Float u = std::min(scaled - (Float) index, ONE_MINUS_EPS), p = prob[index];
+        if (u < p) {
+            sample = u / p;
+            return index;
+        } else {
+            sample = (u - p) / (1 - p);
+            return alias[index];
+        }
+    }
 private:
     MIPMap *m_mipmap;
     float *m_cdfRows, *m_cdfCols;
     Float *m_rowWeights;
+    float *m_aliasProbRows, *m_aliasProbCols;
+    uint16_t *m_aliasRows, *m_aliasCols;
     fs::path m_filename;
+    fs::path m_samplingCacheFile;
+    uint64_t m_timestamp;
+    bool m_aliasSampling;
+    bool m_updateSamplingCache;
     Float m_gamma, m_scale;
     Float m_normalization;
     Float m_power;
@@ -22,6 +22,7 @@
 #include <mitsuba/core/plugin.h>
 #include "sunsky/sunmodel.h"
 #include "sunsky/skymodel.h"
+#include "sunsky/skycache.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -67,6 +68,10 @@ MTS_NAMESPACE_BEGIN
  *         This parameter can be used to scale the amount of illumination
  *         emitted by the sky emitter. \default{1}
  *     }
+ *     \parameter{cacheDirectory}{\String}{
+ *         Directory in which rasterized environment maps are cached
+ *         across renderings \default{none, i.e. caching is disabled}
+ *     }
  *     \parameter{samplingWeight}{\Float}{
  *         Specifies the relative amount of samples
  *         allocated to this emitter. \default{1}
@@ -163,6 +168,14 @@ MTS_NAMESPACE_BEGIN
  * distribution is so smooth, but it can be adjusted manually if
  * necessary using the \code{resolution} parameter.
  *
+ * When rendering many frames with the same sky configuration (e.g. an
+ * animation of a turntable or a batch of renderings at a few times of day),
+ * the \code{cacheDirectory} parameter can be used to store the precomputed
+ * environment maps on disk. They are keyed by all parameters that influence
+ * the sky radiance (the turbidity, ground albedo, sun direction, stretch,
+ * scale and resolution), and subsequent renderings with a matching
+ * configuration load them instead of evaluating the sky model again.
+ *
  * Note that while the model encompasses sunrise and sunset configurations,
  * it does not extend to the night sky, where illumination from stars, galaxies,
  * and the moon dominate. When started with a sun configuration that lies
@@ -226,6 +239,7 @@ public:
         m_albedo = props.getSpectrum("albedo", Spectrum(0.2f));
         m_sun = computeSunCoordinates(props);
         m_extend = props.getBoolean("extend", false);
+        m_cacheDirectory = props.getString("cacheDirectory", "");
 
         if (m_turbidity < 1 || m_turbidity > 10)
             Log(EError, "The turbidity parameter must be in the range [1,10]!");
@@ -307,32 +321,17 @@ public:
         if (i != 0)
             return NULL;
 
-        ref<Timer> timer = new Timer();
-        Log(EDebug, "Rasterizing skylight emitter to an %ix%i environment map ..",
-                m_resolution, m_resolution/2);
-        ref<Bitmap> bitmap = new Bitmap(SKY_PIXELFORMAT, Bitmap::EFloat,
-            Vector2i(m_resolution, m_resolution/2));
+        SkyCache cache(m_cacheDirectory, "sky");
+        appendCacheKey(cache);
 
-        Point2 factor((2*M_PI) / bitmap->getWidth(),
-            M_PI / bitmap->getHeight());
+        Vector2i size(m_resolution, m_resolution/2);
+        ref<Bitmap> bitmap = cache.load(SKY_PIXELFORMAT, size);
 
-        #if defined(MTS_OPENMP)
-            #pragma omp parallel for
-        #endif
-        for (int y=0; y<bitmap->getHeight(); ++y) {
-            Float theta = (y+.5f) * factor.y;
-            Spectrum *target = (Spectrum *) bitmap->getFloatData()
-                + y * bitmap->getWidth();
-
-            for (int x=0; x<bitmap->getWidth(); ++x) {
-                Float phi = (x+.5f) * factor.x;
-
-                *target++ = getSkyRadiance(SphericalCoordinates(theta, phi));
-            }
+        if (!bitmap) {
+            bitmap = rasterize(size);
+            cache.save(bitmap);
         }
 
-        Log(EDebug, "Done (took %i ms)", timer->getMilliseconds());
-
         #if defined(MTS_DEBUG_SUNSKY)
         /* Write a debug image for inspection */
         {
@@ -393,6 +392,18 @@ public:
         return getSkyRadiance(fromSphere(ray.d));
     }
 
+    /// Append all parameters that influence the sky radiance to a cache key
+    void appendCacheKey(SkyCache &cache) const {
+        cache.append(m_resolution);
+        cache.append(m_scale);
+        cache.append(m_turbidity);
+        cache.append(m_stretch);
+        cache.append(m_extend);
+        cache.append(m_albedo);
+        cache.append(m_sun.elevation);
+        cache.append(m_sun.azimuth);
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "SkyEmitter[" << endl
@@ -409,6 +420,36 @@ protected:
         NotImplementedError("getAABB");
     }
 
+    /// Evaluate the sky model for every pixel of an environment map
+    ref<Bitmap> rasterize(const Vector2i &size) const {
+        ref<Timer> timer = new Timer();
+        Log(EDebug, "Rasterizing skylight emitter to an %ix%i environment map ..",
+                size.x, size.y);
+        ref<Bitmap> bitmap = new Bitmap(SKY_PIXELFORMAT, Bitmap::EFloat, size);
+
+        Point2 factor((2*M_PI) / bitmap->getWidth(),
+            M_PI / bitmap->getHeight());
+
+        /* Rows below the horizon are cheap, hence use dynamic scheduling */
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(dynamic, 4)
+        #endif
+        for (int y=0; y<bitmap->getHeight(); ++y) {
+            Float theta = (y+.5f) * factor.y;
+            Spectrum *target = (Spectrum *) bitmap->getFloatData()
+                + y * bitmap->getWidth();
+
+            for (int x=0; x<bitmap->getWidth(); ++x) {
+                Float phi = (x+.5f) * factor.x;
+
+                *target++ = getSkyRadiance(SphericalCoordinates(theta, phi));
+            }
+        }
+
+        Log(EDebug, "Done (took %i ms)", timer->getMilliseconds());
+        return bitmap;
+    }
+
     /// Calculates the spectral radiance of the sky in the specified direction.
     Spectrum getSkyRadiance(const SphericalCoordinates &coords) const {
         Float theta = coords.elevation / m_stretch;
@@ -463,6 +504,8 @@ protected:
     bool m_extend;
     /// Ground albedo
     Spectrum m_albedo;
+    /// Directory of the rasterized environment map cache (optional)
+    fs::path m_cacheDirectory;
 
     /// State vector for the sky model
     #if SPECTRUM_SAMPLES == 3
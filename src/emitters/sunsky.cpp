@@ -21,6 +21,7 @@
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/qmc.h>
 #include "sunsky/sunmodel.h"
+#include "sunsky/skycache.h"
 
 #if SPECTRUM_SAMPLES == 3
 # define SUNSKY_PIXELFORMAT Bitmap::ERGB
@@ -78,6 +79,10 @@ MTS_NAMESPACE_BEGIN
  *         Scale factor to adjust the radius of the sun, while preserving its power.
  *         Set to \code{0} to turn it into a directional light source.
  *     }
+ *     \parameter{cacheDirectory}{\String}{
+ *         Directory in which the merged environment maps are cached across
+ *         renderings, see \pluginref{sky} \default{none, i.e. caching is disabled}
+ *     }
  * }
  * \vspace{-3mm}
  *
@@ -120,33 +125,60 @@ public:
         props.markQueried("albedo");
 
         int resolution = props.getInteger("resolution", 512);
-        ref<Bitmap> bitmap = new Bitmap(SUNSKY_PIXELFORMAT, Bitmap::EFloat,
-            Vector2i(resolution, resolution/2));
+        Vector2i size(resolution, resolution/2);
+
+        SphericalCoordinates sun = computeSunCoordinates(props);
+        Float turbidity = props.getFloat("turbidity", 3.0f),
+              stretch = props.getFloat("stretch", 1.0f);
+
+        /* Key the merged environment map by all parameters of the sun & sky */
+        SkyCache cache(props.getString("cacheDirectory", ""), "sunsky");
+        SphericalCoordinates skySun = computeSunCoordinates(skyProps);
+        cache.append(resolution);
+        cache.append(skyScale);
+        cache.append(sunScale);
+        cache.append(sunRadiusScale);
+        cache.append(turbidity);
+        cache.append(stretch);
+        cache.append(props.getBoolean("extend", false));
+        cache.append(props.getSpectrum("albedo", Spectrum(0.2f)));
+        cache.append(skySun.elevation);
+        cache.append(skySun.azimuth);
+        cache.append(sun.elevation);
+        cache.append(sun.azimuth);
+
+        ref<Bitmap> bitmap = cache.load(SUNSKY_PIXELFORMAT, size);
+        bool cached = bitmap.get() != NULL;
+        if (!cached)
+            bitmap = new Bitmap(SUNSKY_PIXELFORMAT, Bitmap::EFloat, size);
 
         Point2 factor((2*M_PI) / bitmap->getWidth(),
             M_PI / bitmap->getHeight());
 
         ref<Timer> timer = new Timer();
-        Log(EDebug, "Rasterizing sun & skylight emitter to an %ix%i environment map ..",
-                resolution, resolution/2);
-
         Spectrum *data = (Spectrum *) bitmap->getFloatData();
 
-        /* First, rasterize the sky */
-        #if defined(MTS_OPENMP)
-            #pragma omp parallel for
-        #endif
-        for (int y=0; y<bitmap->getHeight(); ++y) {
-            Float theta = (y+.5f) * factor.y;
-            Spectrum *target = data + y * bitmap->getWidth();
+        if (!cached) {
+            Log(EDebug, "Rasterizing sun & skylight emitter to an %ix%i environment map ..",
+                    resolution, resolution/2);
+
+            /* First, rasterize the sky. Rows below the horizon are cheap,
+               hence use dynamic scheduling */
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for schedule(dynamic, 4)
+            #endif
+            for (int y=0; y<bitmap->getHeight(); ++y) {
+                Float theta = (y+.5f) * factor.y;
+                Spectrum *target = data + y * bitmap->getWidth();
 
-            for (int x=0; x<bitmap->getWidth(); ++x) {
-                Float phi = (x+.5f) * factor.x;
+                for (int x=0; x<bitmap->getWidth(); ++x) {
+                    Float phi = (x+.5f) * factor.x;
 
-                RayDifferential ray(Point(0.0f),
-                    toSphere(SphericalCoordinates(theta, phi)), 0.0f);
+                    RayDifferential ray(Point(0.0f),
+                        toSphere(SphericalCoordinates(theta, phi)), 0.0f);
 
-                *target++ = sky->evalEnvironment(ray);
+                    *target++ = sky->evalEnvironment(ray);
+                }
             }
         }
 
@@ -161,10 +193,9 @@ public:
            pixel in the output environment map will be covered
            by the sun */
 
-        SphericalCoordinates sun = computeSunCoordinates(props);
         Spectrum sunRadiance = computeSunRadiance(sun.elevation,
-            props.getFloat("turbidity", 3.0f)) * sunScale;
-        sun.elevation *= props.getFloat("stretch", 1.0f);
+            turbidity) * sunScale;
+        sun.elevation *= stretch;
         Frame sunFrame = Frame(toSphere(sun));
 
         Float theta = degToRad(SUN_APP_RADIUS * 0.5f);
@@ -179,7 +210,7 @@ public:
             m_dirEmitter = static_cast<Emitter *>(
                 PluginManager::getInstance()->createObject(
                 MTS_CLASS(Emitter), props));
-        } else {
+        } else if (!cached) {
             size_t pixelCount = resolution*resolution/2;
             Float cosTheta = std::cos(theta * sunRadiusScale);
 
@@ -215,7 +246,10 @@ public:
 
         }
 
-        Log(EDebug, "Done (took %i ms)", timer->getMilliseconds());
+        if (!cached) {
+            Log(EDebug, "Done (took %i ms)", timer->getMilliseconds());
+            cache.save(bitmap);
+        }
 
         /* Instantiate a nested envmap plugin */
         Properties envProps("envmap");
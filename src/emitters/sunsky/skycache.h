@@ -0,0 +1,160 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__SKYCACHE_H)
+#define __SKYCACHE_H
+
+#include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/timer.h>
+#include <boost/filesystem/operations.hpp>
+
+/// Version of the rasterized sky cache file format
+#define SKYCACHE_VERSION 1
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief On-disk cache of rasterized sky environment maps
+ *
+ * The \pluginref{sky} and \pluginref{sunsky} plugins append every parameter
+ * that influences the rasterized image to the cache key. The key is hashed
+ * to obtain the name of the cache file, and it is also stored within the
+ * file so that hash collisions are detected. Files are written to a
+ * temporary name and then renamed, hence several processes can safely
+ * share one cache directory.
+ */
+class SkyCache {
+public:
+    SkyCache(const fs::path &directory, const std::string &prefix)
+        : m_directory(directory), m_prefix(prefix) {
+        append((int) SPECTRUM_SAMPLES);
+    }
+
+    /// Is the cache enabled?
+    inline bool isEnabled() const { return !m_directory.empty(); }
+
+    /// Append a parameter to the cache key
+    inline void append(Float value) { append(&value, sizeof(Float)); }
+
+    /// Append a parameter to the cache key
+    inline void append(int value) { append(&value, sizeof(int)); }
+
+    /// Append a parameter to the cache key
+    inline void append(bool value) { append((int) value); }
+
+    /// Append a parameter to the cache key
+    inline void append(const Spectrum &value) {
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            append(value[i]);
+    }
+
+    /// Append raw data to the cache key
+    void append(const void *data, size_t size) {
+        const uint8_t *ptr = static_cast<const uint8_t *>(data);
+        m_key.insert(m_key.end(), ptr, ptr + size);
+    }
+
+    /// Return the path of the cache file that corresponds to the current key
+    fs::path getPath() const {
+        /* 64 bit FNV-1a hash of the key */
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (size_t i=0; i<m_key.size(); ++i)
+            hash = (hash ^ m_key[i]) * 0x100000001b3ULL;
+        return m_directory / formatString("%s_%016llx.cache",
+            m_prefix.c_str(), (unsigned long long) hash);
+    }
+
+    /**
+     * \brief Try to load a rasterized environment map from the cache
+     *
+     * \return The cached bitmap or \c NULL if there is no matching
+     *     cache file
+     */
+    ref<Bitmap> load(Bitmap::EPixelFormat pixelFormat, const Vector2i &size) const {
+        if (!isEnabled())
+            return NULL;
+        fs::path path = getPath();
+        if (!fs::exists(path))
+            return NULL;
+
+        ref<Timer> timer = new Timer();
+        ref<Bitmap> bitmap = new Bitmap(pixelFormat, Bitmap::EFloat, size);
+        try {
+            ref<FileStream> fs = new FileStream(path, FileStream::EReadOnly);
+            char identifier[4];
+            fs->read(identifier, 4);
+            if (memcmp(identifier, "SKYC", 4) != 0 || fs->readUInt() != SKYCACHE_VERSION)
+                return NULL;
+
+            std::vector<uint8_t> key(fs->readSize());
+            if (key.size() != m_key.size())
+                return NULL;
+            fs->read(&key[0], key.size());
+            if (key != m_key || fs->readSize() != bitmap->getBufferSize())
+                return NULL;
+
+            fs->read(bitmap->getData(), bitmap->getBufferSize());
+        } catch (const std::exception &ex) {
+            SLog(EWarn, "Could not read the sky cache file \"%s\": %s",
+                path.string().c_str(), ex.what());
+            return NULL;
+        }
+
+        SLog(EDebug, "Loaded the rasterized sky from \"%s\" (took %i ms)",
+            path.filename().string().c_str(), timer->getMilliseconds());
+        return bitmap;
+    }
+
+    /// Store a rasterized environment map in the cache
+    void save(const Bitmap *bitmap) const {
+        if (!isEnabled())
+            return;
+        fs::path path = getPath(),
+                 tmpPath = path.parent_path() / (path.filename().string()
+                    + "." + fs::unique_path().string());
+
+        try {
+            if (!fs::exists(m_directory))
+                fs::create_directories(m_directory);
+
+            ref<FileStream> fs = new FileStream(tmpPath, FileStream::ETruncWrite);
+            fs->write("SKYC", 4);
+            fs->writeUInt(SKYCACHE_VERSION);
+            fs->writeSize(m_key.size());
+            fs->write(&m_key[0], m_key.size());
+            fs->writeSize(bitmap->getBufferSize());
+            fs->write(bitmap->getData(), bitmap->getBufferSize());
+            fs->close();
+            fs::rename(tmpPath, path);
+        } catch (const std::exception &ex) {
+            SLog(EWarn, "Could not write the sky cache file \"%s\": %s",
+                path.string().c_str(), ex.what());
+            boost::system::error_code ec;
+            fs::remove(tmpPath, ec);
+        }
+    }
+private:
+    fs::path m_directory;
+    std::string m_prefix;
+    std::vector<uint8_t> m_key;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __SKYCACHE_H */
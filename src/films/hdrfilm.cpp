@@ -54,6 +54,17 @@ MTS_NAMESPACE_BEGIN
  *         \code{float16}, \code{float32}, or \code{uint32}.
  *         \default{\code{float16}}
  *     }
+ *     \parameter{layerFormat}{\String}{When writing several layers
+ *         to an OpenEXR file (see \pluginref{multichannel}), this optional
+ *         comma-separated list specifies the component format of every
+ *         layer, in the order of \code{pixelFormat}. For instance, the
+ *         radiance can be stored in \code{float32}, while normals and
+ *         positions use \code{float16} and object IDs use \code{uint32}.
+ *         Layers other than the first one that are written in \code{float16}
+ *         are also accumulated in half precision while rendering, which
+ *         considerably reduces the memory usage of the film.
+ *         \default{\code{componentFormat} for all layers}
+ *     }
  *     \parameter{cropOffsetX, cropOffsetY, cropWidth, cropHeight}{\Integer}{
  *       These parameters can optionally be provided to select a sub-rectangle
  *       of the output. In this case, Mitsuba will only render the requested
@@ -67,6 +78,23 @@ MTS_NAMESPACE_BEGIN
  *     \parameter{banner}{\Boolean}{Include a small Mitsuba banner in the
  *         output image? \default{\code{true}}
  *     }
+ *     \parameter{asyncWrite}{\Boolean}{
+ *         Encode and write the output image on a background thread? This
+ *         lets the rendering finish (and e.g. the next queued scene start)
+ *         while a large image is still being compressed. Mitsuba waits
+ *         for pending writes before exiting.
+ *         \default{\code{false}}
+ *     }
+ *     \parameter{variance}{\Boolean}{
+ *         Record per-pixel sample statistics while rendering and store
+ *         them as two additional layers \code{variance.Y} (the estimated
+ *         variance of the pixel's mean luminance) and \code{sampleCount.Y}
+ *         (the number of samples that contributed to these statistics). This is
+ *         useful to drive denoisers or to check for convergence. Only
+ *         supported when writing OpenEXR files, and only filled in by
+ *         sampling-based integrators.
+ *         \default{\code{false}}
+ *     }
  *     \parameter{highQualityEdges}{\Boolean}{
  *        If set to \code{true}, regions slightly outside of the film
  *        plane will also be sampled. This may improve the image
@@ -202,6 +230,25 @@ MTS_NAMESPACE_BEGIN
  *
  */
 
+/// Number of rows of the storage that are expanded at once by \c developLayers()
+#define HDRFILM_DEVELOP_ROWS 64
+
+/// Parse the name of an OpenEXR component format
+static Bitmap::EComponentFormat parseComponentFormat(const std::string &name,
+        const char *parameter) {
+    if (name == "float16") {
+        return Bitmap::EFloat16;
+    } else if (name == "float32") {
+        return Bitmap::EFloat32;
+    } else if (name == "uint32") {
+        return Bitmap::EUInt32;
+    } else {
+        SLog(EError, "The \"%s\" parameter must either be "
+            "equal to \"float16\", \"float32\", or \"uint32\"!", parameter);
+        return Bitmap::EFloat32;
+    }
+}
+
 class HDRFilm : public Film {
 public:
     HDRFilm(const Properties &props) : Film(props) {
@@ -209,6 +256,10 @@ public:
         m_banner = props.getBoolean("banner", true);
         /* Attach the log file as the EXR comment attribute? */
         m_attachLog = props.getBoolean("attachLog", true);
+        /* Write the output image on a background thread? */
+        m_asyncWrite = props.getBoolean("asyncWrite", false);
+        /* Write per-pixel variance and sample count layers? */
+        m_variance = props.getBoolean("variance", false);
 
         std::string fileFormat = boost::to_lower_copy(
             props.getString("fileFormat", "openexr"));
@@ -218,6 +269,8 @@ public:
             props.getString("channelNames", ""), ", ");
         std::string componentFormat = boost::to_lower_copy(
             props.getString("componentFormat", "float16"));
+        std::vector<std::string> layerFormats = tokenize(boost::to_lower_copy(
+            props.getString("layerFormat", "")), " ,");
 
         if (fileFormat == "openexr") {
             m_fileFormat = Bitmap::EOpenEXR;
@@ -240,6 +293,17 @@ public:
         if (pixelFormats.size() != 1 && m_fileFormat != Bitmap::EOpenEXR)
             Log(EError, "General multi-channel output is only supported when writing OpenEXR files!");
 
+        if (!layerFormats.empty() && pixelFormats.size() == 1)
+            Log(EError, "The \"layerFormat\" parameter requires general multi-channel output!");
+
+        if (!layerFormats.empty() && layerFormats.size() != pixelFormats.size())
+            Log(EError, "Number of layer formats must match the number of specified pixel formats!");
+
+        m_componentFormat = parseComponentFormat(componentFormat, "componentFormat");
+        std::vector<Bitmap::EComponentFormat> layerComponentFormats;
+        for (size_t i=0; i<layerFormats.size(); ++i)
+            layerComponentFormats.push_back(parseComponentFormat(layerFormats[i], "layerFormat"));
+
         for (size_t i=0; i<pixelFormats.size(); ++i) {
             std::string pixelFormat = pixelFormats[i];
             std::string name = i < channelNames.size() ? (channelNames[i] + std::string(".")) : "";
@@ -291,6 +355,9 @@ public:
                     "\"luminance\", \"luminanceAlpha\", \"rgb\", \"rgba\", \"xyz\", \"xyza\", "
                     "\"spectrum\", or \"spectrumAlpha\"!");
             }
+
+            if (!layerComponentFormats.empty())
+                m_channelFormats.resize(m_channelNames.size(), layerComponentFormats[i]);
         }
 
         for (size_t i=0; i<m_pixelFormats.size(); ++i) {
@@ -300,16 +367,8 @@ public:
                     "it with a different configuration. Please see the documentation for details.");
         }
 
-        if (componentFormat == "float16") {
-            m_componentFormat = Bitmap::EFloat16;
-        } else if (componentFormat == "float32") {
-            m_componentFormat = Bitmap::EFloat32;
-        } else if (componentFormat == "uint32") {
-            m_componentFormat = Bitmap::EUInt32;
-        } else {
-            Log(EError, "The \"componentFormat\" parameter must either be "
-                "equal to \"float16\", \"float32\", or \"uint32\"!");
-        }
+        if (m_variance && m_fileFormat != Bitmap::EOpenEXR)
+            Log(EError, "Variance output is only supported when writing OpenEXR files!");
 
         if (m_fileFormat == Bitmap::ERGBE) {
             /* RGBE output; override pixel & component format if necessary */
@@ -353,13 +412,25 @@ public:
         } else {
             m_storage = new ImageBlock(Bitmap::EMultiSpectrumAlphaWeight, m_cropSize,
                 NULL, (int) (SPECTRUM_SAMPLES * m_pixelFormats.size() + 2));
+
+            /* Accumulate the half precision layers in half precision. The
+               first one is always kept at full accuracy for the preview */
+            std::vector<bool> compact(m_pixelFormats.size(), false);
+            for (size_t i=1; i<layerComponentFormats.size(); ++i)
+                compact[i] = layerComponentFormats[i] == Bitmap::EFloat16;
+            if (std::count(compact.begin(), compact.end(), true) > 0)
+                m_storage->setCompactLayers(compact);
         }
+        if (m_variance)
+            m_storage->allocateVariance();
     }
 
     HDRFilm(Stream *stream, InstanceManager *manager)
         : Film(stream, manager) {
         m_banner = stream->readBool();
         m_attachLog = stream->readBool();
+        m_asyncWrite = stream->readBool();
+        m_variance = stream->readBool();
         m_fileFormat = (Bitmap::EFileFormat) stream->readUInt();
         m_pixelFormats.resize((size_t) stream->readUInt());
         for (size_t i=0; i<m_pixelFormats.size(); ++i)
@@ -368,12 +439,17 @@ public:
         for (size_t i=0; i<m_channelNames.size(); ++i)
             m_channelNames[i] = stream->readString();
         m_componentFormat = (Bitmap::EComponentFormat) stream->readUInt();
+        m_channelFormats.resize((size_t) stream->readUInt());
+        for (size_t i=0; i<m_channelFormats.size(); ++i)
+            m_channelFormats[i] = (Bitmap::EComponentFormat) stream->readUInt();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         Film::serialize(stream, manager);
         stream->writeBool(m_banner);
         stream->writeBool(m_attachLog);
+        stream->writeBool(m_asyncWrite);
+        stream->writeBool(m_variance);
         stream->writeUInt(m_fileFormat);
         stream->writeUInt((uint32_t) m_pixelFormats.size());
         for (size_t i=0; i<m_pixelFormats.size(); ++i)
@@ -382,18 +458,26 @@ public:
         for (size_t i=0; i<m_channelNames.size(); ++i)
             stream->writeString(m_channelNames[i]);
         stream->writeUInt(m_componentFormat);
+        stream->writeUInt((uint32_t) m_channelFormats.size());
+        for (size_t i=0; i<m_channelFormats.size(); ++i)
+            stream->writeUInt(m_channelFormats[i]);
     }
 
     void clear() {
         m_storage->clear();
+        markDirty();
     }
 
     void put(const ImageBlock *block) {
         m_storage->put(block);
+        markDirty(block);
     }
 
     void setBitmap(const Bitmap *bitmap, Float multiplier) {
+        if (m_storage->hasCompactLayers())
+            Log(EError, "setBitmap(): not supported when storing layers in half precision!");
         bitmap->convert(m_storage->getBitmap(), multiplier);
+        markDirty();
     }
 
     void addBitmap(const Bitmap *bitmap, Float multiplier) {
@@ -422,6 +506,7 @@ public:
                 *target++ += *source++ * weight;
             target += 2;
         }
+        markDirty();
     }
 
     bool develop(const Point2i &sourceOffset, const Vector2i &size,
@@ -488,9 +573,11 @@ public:
         if (m_pixelFormats.size() == 1) {
             bitmap = m_storage->getBitmap()->convert(m_pixelFormats[0], m_componentFormat);
             bitmap->setChannelNames(m_channelNames);
-        } else {
+        } else if (m_channelFormats.empty()) {
             bitmap = m_storage->getBitmap()->convertMultiSpectrumAlphaWeight(m_pixelFormats,
                     m_componentFormat, m_channelNames);
+        } else {
+            bitmap = developLayers();
         }
 
         if (m_banner && m_cropSize.x > bannerWidth+5 && m_cropSize.y > bannerHeight + 5 && m_pixelFormats.size() == 1) {
@@ -519,7 +606,6 @@ public:
             filename.replace_extension(properExtension);
 
         Log(EInfo, "Writing image to \"%s\" ..", filename.string().c_str());
-        ref<FileStream> stream = new FileStream(filename, FileStream::ETruncWrite);
 
         if (m_pixelFormats.size() == 1)
             annotate(scene, m_properties, bitmap, renderTime, 1.0f);
@@ -533,7 +619,108 @@ public:
             bitmap->setMetadataString("log", log);
         }
 
-        bitmap->write(m_fileFormat, stream);
+        if (m_variance)
+            bitmap = appendVariance(bitmap);
+
+        if (m_asyncWrite) {
+            bitmap->writeAsync(m_fileFormat, filename);
+        } else {
+            ref<FileStream> stream = new FileStream(filename, FileStream::ETruncWrite);
+            bitmap->write(m_fileFormat, stream);
+        }
+    }
+
+    /**
+     * \brief Develop a multi-layer image with per-layer component formats
+     *
+     * The storage is expanded in strips of rows, so that the half precision
+     * layers are never converted all at once. The resulting bitmap uses
+     * \ref Bitmap::EFloat32 (or \ref Bitmap::EFloat16 if all layers are
+     * written in half precision), and OpenEXR converts the channels to
+     * their final format while writing the file.
+     */
+    ref<Bitmap> developLayers() const {
+        Bitmap::EComponentFormat componentFormat = Bitmap::EFloat16;
+        for (size_t i=0; i<m_channelFormats.size(); ++i) {
+            if (m_channelFormats[i] != Bitmap::EFloat16)
+                componentFormat = Bitmap::EFloat32;
+        }
+
+        if (m_channelNames.size() > std::numeric_limits<uint8_t>::max())
+            Log(EError, "developLayers(): excessive number of channels!");
+        ref<Bitmap> bitmap = new Bitmap(Bitmap::EMultiChannel, componentFormat,
+            m_cropSize, (uint8_t) m_channelNames.size());
+        bitmap->setChannelNames(m_channelNames);
+        bitmap->setChannelFormats(m_channelFormats);
+
+        int rows = std::min(HDRFILM_DEVELOP_ROWS, m_cropSize.y);
+        ref<Bitmap> strip = new Bitmap(Bitmap::EMultiSpectrumAlphaWeight, Bitmap::EFloat,
+            Vector2i(m_cropSize.x, rows), (int) (SPECTRUM_SAMPLES * m_pixelFormats.size() + 2));
+        size_t bytesPerRow = bitmap->getBytesPerPixel() * (size_t) m_cropSize.x;
+
+        for (int y=0; y<m_cropSize.y; y += rows) {
+            int count = std::min(rows, m_cropSize.y - y);
+            m_storage->getRows(y, count, strip->getFloatData());
+            Bitmap::convertMultiSpectrumAlphaWeight(strip, strip->getUInt8Data(),
+                bitmap, bitmap->getUInt8Data() + y * bytesPerRow, m_pixelFormats,
+                componentFormat, (size_t) count * (size_t) m_cropSize.x);
+        }
+        return bitmap;
+    }
+
+    /**
+     * \brief Return a multi-channel copy of \c bitmap with two extra
+     * channels that store the variance of each pixel's mean luminance
+     * and the number of samples it is based on
+     */
+    ref<Bitmap> appendVariance(Bitmap *bitmap) const {
+        const Bitmap *variance = m_storage->getVariance();
+        ref<Bitmap> source = bitmap->convert(bitmap->getPixelFormat(),
+            Bitmap::EFloat, bitmap->getGamma());
+        int channels = source->getChannelCount();
+        if (channels + 2 > std::numeric_limits<uint8_t>::max())
+            Log(EError, "appendVariance(): excessive number of channels!");
+
+        ref<Bitmap> result = new Bitmap(Bitmap::EMultiChannel, Bitmap::EFloat,
+            source->getSize(), channels + 2);
+        result->setMetadata(source->getMetadata());
+        result->setGamma(source->getGamma());
+
+        size_t pixelCount = source->getPixelCount();
+        const Float *src = source->getFloatData();
+        const Float *stats = variance->getFloatData();
+        Float *dst = result->getFloatData();
+
+        for (size_t i=0; i<pixelCount; ++i) {
+            for (int j=0; j<channels; ++j)
+                *dst++ = *src++;
+
+            Float sum = stats[0], sumSq = stats[1], n = stats[2];
+            Float var = 0;
+            if (n > 1)
+                var = std::max((Float) 0, (sumSq - sum*sum/n) / (n*(n-1)));
+            *dst++ = var;
+            *dst++ = n;
+            stats += 3;
+        }
+
+        std::vector<std::string> channelNames = m_channelNames;
+        channelNames.push_back("variance.Y");
+        channelNames.push_back("sampleCount.Y");
+
+        result = result->convert(Bitmap::EMultiChannel,
+            bitmap->getComponentFormat(), result->getGamma());
+        result->setChannelNames(channelNames);
+        if (!bitmap->getChannelFormats().empty()) {
+            std::vector<Bitmap::EComponentFormat> channelFormats = bitmap->getChannelFormats();
+            channelFormats.resize(channelFormats.size() + 2, m_componentFormat);
+            result->setChannelFormats(channelFormats);
+        }
+        return result;
+    }
+
+    bool hasVariance() const {
+        return m_variance;
     }
 
     bool hasAlpha() const {
@@ -576,9 +763,15 @@ public:
             oss << "\"" << m_channelNames[i] << "\"" << ", ";
         oss << endl
             << "  componentFormat = " << m_componentFormat << "," << endl
+            << "  channelFormats = ";
+        for (size_t i=0; i<m_channelFormats.size(); ++i)
+            oss << m_channelFormats[i] << ", ";
+        oss << endl
             << "  cropOffset = " << m_cropOffset.toString() << "," << endl
             << "  cropSize = " << m_cropSize.toString() << "," << endl
             << "  banner = " << m_banner << "," << endl
+            << "  asyncWrite = " << m_asyncWrite << "," << endl
+            << "  variance = " << m_variance << "," << endl
             << "  filter = " << indent(m_filter->toString()) << endl
             << "]";
         return oss.str();
@@ -590,8 +783,11 @@ protected:
     std::vector<Bitmap::EPixelFormat> m_pixelFormats;
     std::vector<std::string> m_channelNames;
     Bitmap::EComponentFormat m_componentFormat;
+    std::vector<Bitmap::EComponentFormat> m_channelFormats;
     bool m_banner;
     bool m_attachLog;
+    bool m_asyncWrite;
+    bool m_variance;
     fs::path m_destFile;
     ref<ImageBlock> m_storage;
 };
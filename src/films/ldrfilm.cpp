@@ -20,6 +20,7 @@
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/qmc.h>
 #include <boost/algorithm/string.hpp>
 #include "banner.h"
 #include "annotations.h"
@@ -73,9 +74,23 @@ MTS_NAMESPACE_BEGIN
  *       When \code{reinhard} tonemapping is active, this parameter in $[0,1]$ specifies how much
  *       highlights can burn out. \default{0, i.e. map all luminance values into the displayable range}
  *     }
+ *     \parameter{dither}{\Boolean}{
+ *       Add triangular noise with an amplitude of one quantization step
+ *       before converting to 8 bit? This hides the banding of smooth
+ *       gradients. The noise pattern only depends on the pixel position,
+ *       hence images remain reproducible.
+ *       \default{\code{false}}
+ *     }
  *     \parameter{banner}{\Boolean}{Include a banner in the
  *         output image?\default{\code{true}}
  *     }
+ *     \parameter{asyncWrite}{\Boolean}{
+ *         Encode and write the output image on a background thread? This
+ *         lets the rendering finish (and e.g. the next queued scene start)
+ *         while a large image is still being compressed. Mitsuba waits
+ *         for pending writes before exiting.
+ *         \default{\code{false}}
+ *     }
  *     \parameter{cropOffsetX, cropOffsetY, cropWidth, cropHeight}{\Integer}{
  *       These parameters can optionally be provided to select a sub-rectangle
  *       of the output. In this case, Mitsuba will only render the requested
@@ -117,6 +132,11 @@ MTS_NAMESPACE_BEGIN
  * primaries with a D65 white point. When $\texttt{gamma}$ is set to $\code{-1}$ (the default),
  * the output is in the sRGB color space and will display as intended on compatible devices.
  *
+ * The output image is developed in a single pass over the accumulated
+ * samples: every row is normalized, tonemapped and quantized (using the
+ * SSE conversion routines when possible) without intermediate full-frame
+ * images.
+ *
  * Note that this plugin supports render-time \emph{annotations}, which
  * are described on page~\pageref{sec:film-annotations}.
  */
@@ -130,6 +150,8 @@ public:
     LDRFilm(const Properties &props) : Film(props) {
         /* Should an Mitsuba banner be added to the output image? */
         m_hasBanner = props.getBoolean("banner", true);
+        /* Write the output image on a background thread? */
+        m_asyncWrite = props.getBoolean("asyncWrite", false);
 
         std::string fileFormat = boost::to_lower_copy(
             props.getString("fileFormat", "png"));
@@ -181,6 +203,7 @@ public:
         m_exposure = props.getFloat("exposure", 0.0f);
         m_reinhardKey = props.getFloat("key", 0.18f);
         m_reinhardBurn = props.getFloat("burn", 0.0);
+        m_dither = props.getBoolean("dither", false);
 
         std::vector<std::string> keys = props.getPropertyNames();
         for (size_t i=0; i<keys.size(); ++i) {
@@ -198,6 +221,7 @@ public:
     LDRFilm(Stream *stream, InstanceManager *manager)
         : Film(stream, manager) {
         m_hasBanner = stream->readBool();
+        m_asyncWrite = stream->readBool();
         m_pixelFormat = (Bitmap::EPixelFormat) stream->readUInt();
         m_fileFormat = (Bitmap::EFileFormat) stream->readUInt();
         m_gamma = stream->readFloat();
@@ -205,11 +229,13 @@ public:
         m_exposure = stream->readFloat();
         m_reinhardKey = stream->readFloat();
         m_reinhardBurn = stream->readFloat();
+        m_dither = stream->readBool();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         Film::serialize(stream, manager);
         stream->writeBool(m_hasBanner);
+        stream->writeBool(m_asyncWrite);
         stream->writeUInt(m_pixelFormat);
         stream->writeUInt(m_fileFormat);
         stream->writeFloat(m_gamma);
@@ -217,18 +243,22 @@ public:
         stream->writeFloat(m_exposure);
         stream->writeFloat(m_reinhardKey);
         stream->writeFloat(m_reinhardBurn);
+        stream->writeBool(m_dither);
     }
 
     void clear() {
         m_storage->clear();
+        markDirty();
     }
 
     void put(const ImageBlock *block) {
         m_storage->put(block);
+        markDirty(block);
     }
 
     void setBitmap(const Bitmap *bitmap, Float multiplier) {
         bitmap->convert(m_storage->getBitmap(), multiplier);
+        markDirty();
     }
 
     void addBitmap(const Bitmap *bitmap, Float multiplier) {
@@ -256,6 +286,7 @@ public:
                 *target++ += *source++ * weight;
             target += 2;
         }
+        markDirty();
     }
 
     bool develop(const Point2i &sourceOffset, const Vector2i &size,
@@ -303,22 +334,47 @@ public:
 
         Log(EDebug, "Developing film ..");
 
-        ref<Bitmap> bitmap = m_storage->getBitmap();
-        Float multiplier = 1.0f;
+        ref<Bitmap> bitmap = new Bitmap(m_pixelFormat, Bitmap::EUInt8, m_cropSize);
+        Float multiplier = 1.0f, scale = 0.0f, invWp2 = 0.0f;
+        bool reinhard = false;
 
         if (m_tonemapMethod == EReinhard) {
-            bitmap = bitmap->convert(m_pixelFormat, Bitmap::EFloat);
-
-            Float logAvgLuminance = 0, maxLuminance = 0; /* Unused */
-            bitmap->tonemapReinhard(logAvgLuminance, maxLuminance,
-                m_reinhardKey, m_reinhardBurn);
+            Float logAvgLuminance = 0, maxLuminance = 0;
+            computeLuminanceStatistics(logAvgLuminance, maxLuminance);
             Log(EInfo, "Tonemapping finished (log-avg luminance=%f, max luminance=%f)",
                 logAvgLuminance, maxLuminance);
+
+            /* Same parameterization as Bitmap::tonemapReinhard() */
+            if (maxLuminance > 0) {
+                Float burn = std::min((Float) 1, std::max((Float) 1e-8f, 1-m_reinhardBurn));
+                scale = m_reinhardKey / logAvgLuminance;
+                Float Lwhite = maxLuminance * scale;
+                invWp2 = 1 / (Lwhite * Lwhite * std::pow(burn, (Float) 4));
+                reinhard = true;
+            }
         } else {
             multiplier = std::pow((Float) 2, (Float) m_exposure);
         }
 
-        bitmap = bitmap->convert(m_pixelFormat, Bitmap::EUInt8, m_gamma, multiplier);
+        /* Normalize, tonemap and quantize one row at a time */
+        const FormatConverter *cvt = FormatConverter::getInstance(
+            std::make_pair(Bitmap::EFloat32, Bitmap::EUInt8));
+        const int channels = bitmap->getChannelCount();
+
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(dynamic, 16)
+        #endif
+        for (int y=0; y<m_cropSize.y; ++y) {
+            std::vector<float> row((size_t) m_cropSize.x * channels);
+            developRow(y, &row[0], reinhard, scale, invWp2);
+
+            uint8_t *target = bitmap->getUInt8Data() + (size_t) y * m_cropSize.x * channels;
+            if (m_dither)
+                quantizeDithered(&row[0], target, y, multiplier);
+            else
+                cvt->convert(m_pixelFormat, 1.0f, &row[0], m_pixelFormat,
+                    m_gamma, target, m_cropSize.x, multiplier);
+        }
 
         if (m_hasBanner && m_cropSize.x > bannerWidth+5 && m_cropSize.y > bannerHeight + 5) {
             int xoffs = m_cropSize.x - bannerWidth - 5,
@@ -345,11 +401,127 @@ public:
             filename.replace_extension(expectedExtension);
 
         Log(EInfo, "Writing image to \"%s\" ..", filename.string().c_str());
-        ref<FileStream> stream = new FileStream(filename, FileStream::ETruncWrite);
 
         annotate(scene, m_properties, bitmap, renderTime, m_gamma);
 
-        bitmap->write(m_fileFormat, stream);
+        if (m_asyncWrite) {
+            bitmap->writeAsync(m_fileFormat, filename);
+        } else {
+            ref<FileStream> stream = new FileStream(filename, FileStream::ETruncWrite);
+            bitmap->write(m_fileFormat, stream);
+        }
+    }
+
+    /// Return the normalized color (RGB or luminance) and alpha of a stored pixel
+    inline void getPixel(const Float *data, bool color, Float *value, Float &alpha) const {
+        Float weight = data[SPECTRUM_SAMPLES + 1],
+              invWeight = (weight != 0) ? 1 / weight : weight;
+        Spectrum spec;
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            spec[i] = data[i] * invWeight;
+        if (color)
+            spec.toLinearRGB(value[0], value[1], value[2]);
+        else
+            value[0] = spec.getLuminance();
+        alpha = data[SPECTRUM_SAMPLES] * invWeight;
+    }
+
+    /// Compute the log-average and maximum luminance for Reinhard tonemapping
+    void computeLuminanceStatistics(Float &logAvgLuminance, Float &maxLuminance) const {
+        const Float *data = m_storage->getBitmap()->getFloatData();
+        const int stride = SPECTRUM_SAMPLES + 2, border = m_storage->getBorderSize();
+        const int width = m_storage->getWidth();
+        double logSum = 0;
+        Float maxValue = 0;
+
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for reduction(+:logSum) schedule(static)
+        #endif
+        for (int y=0; y<m_cropSize.y; ++y) {
+            const Float *ptr = data + ((size_t) (y + border) * width + border) * stride;
+            Float rowMax = 0, rgb[3], alpha;
+            for (int x=0; x<m_cropSize.x; ++x, ptr += stride) {
+                getPixel(ptr, true, rgb, alpha);
+                Float luminance = rgb[0] * (Float) 0.212671 + rgb[1] * (Float) 0.715160
+                    + rgb[2] * (Float) 0.072169;
+                rowMax = std::max(rowMax, luminance);
+                logSum += math::fastlog(1e-3f + luminance);
+            }
+            #if defined(MTS_OPENMP)
+                #pragma omp critical
+            #endif
+            maxValue = std::max(maxValue, rowMax);
+        }
+
+        size_t pixels = (size_t) m_cropSize.x * (size_t) m_cropSize.y;
+        logAvgLuminance = math::fastexp((Float) (logSum / pixels));
+        maxLuminance = maxValue;
+    }
+
+    /// Normalize (and optionally tonemap) a row of the film into \c row
+    void developRow(int y, float *row, bool reinhard, Float scale, Float invWp2) const {
+        const int stride = SPECTRUM_SAMPLES + 2, border = m_storage->getBorderSize();
+        const Float *ptr = m_storage->getBitmap()->getFloatData()
+            + ((size_t) (y + border) * m_storage->getWidth() + border) * stride;
+        const bool color = m_pixelFormat == Bitmap::ERGB || m_pixelFormat == Bitmap::ERGBA;
+
+        for (int x=0; x<m_cropSize.x; ++x, ptr += stride) {
+            Float value[3], alpha;
+            getPixel(ptr, color, value, alpha);
+
+            if (reinhard && color) {
+                /* Reinhard et al.'s operator in xyY (see Bitmap::tonemapReinhard()) */
+                Float X = value[0] * 0.412453f + value[1] * 0.357580f + value[2] * 0.180423f;
+                Float Y = value[0] * 0.212671f + value[1] * 0.715160f + value[2] * 0.072169f;
+                Float Z = value[0] * 0.019334f + value[1] * 0.119193f + value[2] * 0.950227f;
+                Float normalization = 1 / (X + Y + Z),
+                    cx = X * normalization,
+                    cy = Y * normalization,
+                    Lp = Y * scale;
+                Y = Lp * (1.0f + Lp*invWp2) / (1.0f + Lp);
+                Float ratio = Y/cy;
+                X = ratio * cx;
+                Z = ratio * ((Float) 1.0f - cx - cy);
+                value[0] =  3.240479f * X + -1.537150f * Y + -0.498535f * Z;
+                value[1] = -0.969256f * X +  1.875991f * Y +  0.041556f * Z;
+                value[2] =  0.055648f * X + -0.204043f * Y +  1.057311f * Z;
+            } else if (reinhard) {
+                Float Lp = value[0] * scale;
+                value[0] = Lp * (1.0f + Lp*invWp2) / (1.0f + Lp);
+            }
+
+            for (int i=0; i<(color ? 3 : 1); ++i)
+                *row++ = (float) value[i];
+            if (hasAlpha())
+                *row++ = (float) alpha;
+        }
+    }
+
+    /// Apply the gamma ramp and quantize a row with triangular dithering
+    void quantizeDithered(const float *row, uint8_t *target, int y, Float multiplier) const {
+        const int channels = (m_pixelFormat == Bitmap::ERGB || m_pixelFormat == Bitmap::ERGBA) ? 3 : 1;
+        const bool alpha = hasAlpha();
+
+        for (int x=0; x<m_cropSize.x; ++x) {
+            uint32_t pixel = (uint32_t) y * (uint32_t) m_cropSize.x + (uint32_t) x;
+            for (int i=0; i<channels; ++i) {
+                Float value = std::max((Float) 0, *row++ * multiplier);
+                if (m_gamma == -1)
+                    value = (value <= (Float) 0.0031308) ? ((Float) 12.92 * value)
+                        : ((Float) 1.055 * std::pow(value, (Float) (1.0/2.4)) - (Float) 0.055);
+                else if (m_gamma != 1)
+                    value = std::pow(value, 1 / m_gamma);
+
+                uint64_t noise = sampleTEA(pixel, (uint32_t) i);
+                Float dither = (Float) (uint32_t) noise * (Float) (1.0 / 4294967296.0)
+                    - (Float) (uint32_t) (noise >> 32) * (Float) (1.0 / 4294967296.0);
+                *target++ = (uint8_t) std::min((Float) 255, std::max((Float) 0,
+                    value * 255 + dither + (Float) 0.5f));
+            }
+            if (alpha)
+                *target++ = (uint8_t) std::min((Float) 255, std::max((Float) 0,
+                    *row++ * (Float) 255 + (Float) 0.5f));
+        }
     }
 
     bool hasAlpha() const {
@@ -383,10 +555,12 @@ public:
             << "  cropOffset = " << m_cropOffset.toString() << "," << endl
             << "  cropSize = " << m_cropSize.toString() << "," << endl
             << "  banner = " << m_hasBanner << "," << endl
+            << "  asyncWrite = " << m_asyncWrite << "," << endl
             << "  method = " << ((m_tonemapMethod == EGamma) ? "gamma" : "reinhard") << "," << endl
             << "  exposure = " << m_exposure << "," << endl
             << "  reinhardKey = " << m_reinhardKey << "," << endl
             << "  reinhardBurn = " << m_reinhardBurn << "," << endl
+            << "  dither = " << m_dither << "," << endl
             << "  filter = " << indent(m_filter->toString()) << endl
             << "]";
         return oss.str();
@@ -397,11 +571,13 @@ protected:
     Bitmap::EFileFormat m_fileFormat;
     Bitmap::EPixelFormat m_pixelFormat;
     bool m_hasBanner;
+    bool m_asyncWrite;
     fs::path m_destFile;
     Float m_gamma;
     ref<ImageBlock> m_storage;
     ETonemapMethod m_tonemapMethod;
     Float m_exposure, m_reinhardKey, m_reinhardBurn;
+    bool m_dither;
 };
 
 MTS_IMPLEMENT_CLASS_S(LDRFilm, false, Film)
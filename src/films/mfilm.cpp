@@ -19,6 +19,7 @@
 #include <mitsuba/render/film.h>
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/mmap.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <iomanip>
@@ -40,14 +41,25 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{fileFormat}{\String}{
  *       Specifies the desired output format; must be one of
- *       \code{matlab}, \code{mathematica}, or \code{numpy}. \default{\code{matlab}}
+ *       \code{matlab}, \code{mathematica}, \code{numpy} (a \code{.npy} file),
+ *       or \code{npz} (a NumPy archive containing \code{variable}).
+ *       \default{\code{matlab}}
  *     }
  *     \parameter{digits}{\Integer}{
- *       Number of significant digits to be written \default{4}
+ *       Number of significant digits to be written (MATLAB and
+ *       Mathematica only) \default{4}
  *     }
  *     \parameter{variable}{\String}{
  *       Name of the target variable \default{\code{"data"}}
  *     }
+ *     \parameter{appendFrames}{\Boolean}{
+ *       NumPy only: store the image as a frame along an additional leading
+ *       axis, and append it to an existing \code{.npy} file of compatible
+ *       shape. This is convenient for animations and parameter sweeps, which
+ *       then accumulate into a single array. Partial outputs written during
+ *       the rendering replace the frame of the current job.
+ *       \default{\code{false}}
+ *     }
  *     \parameter{pixelFormat}{\String}{Specifies the desired pixel format
  *         of the generated image. The options are \code{luminance},
  *         \code{luminanceAlpha}, \code{rgb}, \code{rgba}, \code{spectrum},
@@ -77,13 +89,18 @@ MTS_NAMESPACE_BEGIN
  * This is useful when running Mitsuba as simulation step as part of a
  * larger virtual experiment. It can also come in handy when
  * verifying parts of the renderer using an automated test suite.
+ *
+ * NumPy \code{.npy} files are written through a memory mapping: the pixel
+ * values are converted directly into the mapped output file, which avoids
+ * both text formatting and an intermediate copy of the image.
  */
 class MFilm : public Film {
 public:
     enum EMode {
         EMATLAB = 0,
         EMathematica,
-        ENumPy
+        ENumPy,
+        ENumPyArchive
     };
 
     MFilm(const Properties &props) : Film(props) {
@@ -126,13 +143,20 @@ public:
             m_fileFormat = EMathematica;
         } else if (fileFormat == "numpy") {
             m_fileFormat = ENumPy;
+        } else if (fileFormat == "npz") {
+            m_fileFormat = ENumPyArchive;
         } else {
             Log(EError, "The \"fileFormat\" parameter must either be equal to "
-                "\"matlab\" or \"mathematica\" or \"numpy\" or \"numpycompressed\"!");
+                "\"matlab\", \"mathematica\", \"numpy\", or \"npz\"!");
         }
 
         m_digits = props.getInteger("digits", 4);
         m_variable = props.getString("variable", "data");
+        m_appendFrames = props.getBoolean("appendFrames", false);
+        m_frameIndex = -1;
+
+        if (m_appendFrames && m_fileFormat != ENumPy)
+            Log(EError, "The \"appendFrames\" parameter requires fileFormat=\"numpy\"!");
 
         m_storage = new ImageBlock(Bitmap::ESpectrumAlphaWeight, m_cropSize);
     }
@@ -143,6 +167,8 @@ public:
         m_fileFormat = (EMode) stream->readUInt();
         m_digits = stream->readInt();
         m_variable = stream->readString();
+        m_appendFrames = stream->readBool();
+        m_frameIndex = -1;
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -151,6 +177,7 @@ public:
         stream->writeUInt(m_fileFormat);
         stream->writeInt(m_digits);
         stream->writeString(m_variable);
+        stream->writeBool(m_appendFrames);
     }
 
     void configure() {
@@ -166,14 +193,17 @@ public:
 
     void clear() {
         m_storage->clear();
+        markDirty();
     }
 
     void put(const ImageBlock *block) {
         m_storage->put(block);
+        markDirty(block);
     }
 
     void setBitmap(const Bitmap *bitmap, Float multiplier) {
         bitmap->convert(m_storage->getBitmap(), multiplier);
+        markDirty();
     }
 
     void addBitmap(const Bitmap *bitmap, Float multiplier) {
@@ -201,6 +231,7 @@ public:
                 *target++ += *source++ * weight;
             target += 2;
         }
+        markDirty();
     }
 
     bool develop(const Point2i &sourceOffset, const Vector2i &size,
@@ -240,6 +271,147 @@ public:
 
     void setDestinationFile(const fs::path &destFile, uint32_t blockSize) {
         m_destFile = destFile;
+        m_frameIndex = -1;
+    }
+
+    /// Create a NumPy header describing an array of the given shape
+    static std::string createNumPyHeader(const std::vector<size_t> &shape, size_t minLength) {
+        std::ostringstream oss;
+        oss << "{'descr': '" << (Stream::getHostByteOrder() == Stream::ELittleEndian ? '<' : '>')
+            << "f" << sizeof(Float) << "', 'fortran_order': False, 'shape': (";
+        for (size_t i=0; i<shape.size(); ++i)
+            oss << shape[i] << (shape.size() == 1 || i+1 < shape.size() ? "," : "");
+        oss << "), }";
+        std::string dict = oss.str();
+
+        /* Pad the header to a multiple of 64 bytes (this also leaves room
+           for a larger frame count when appending) and end it with \n */
+        size_t length = std::max(minLength, (10 + dict.size() + 1 + 63) / 64 * 64);
+        dict.append(length - 10 - dict.size() - 1, ' ');
+        dict += '\n';
+
+        std::string header("\x93NUMPY\x01\x00", 8);
+        header += (char) ((length - 10) & 0xFF);
+        header += (char) ((length - 10) >> 8);
+        return header + dict;
+    }
+
+    /**
+     * \brief Parse the header of an existing NumPy file
+     *
+     * \return \c false if the file is not a C-ordered array using the
+     * floating point representation of this build
+     */
+    static bool parseNumPyHeader(const uint8_t *data, size_t size,
+            size_t &headerLength, std::vector<size_t> &shape) {
+        if (size < 10 || memcmp(data, "\x93NUMPY\x01", 7) != 0)
+            return false;
+        headerLength = 10 + (size_t) data[8] + ((size_t) data[9] << 8);
+        if (headerLength > size)
+            return false;
+        std::string dict((const char *) data + 10, headerLength - 10);
+        std::string expectedDescr = createNumPyHeader(shape, 0).substr(10).substr(0, 17);
+
+        if (dict.compare(0, expectedDescr.size(), expectedDescr) != 0 ||
+            dict.find("'fortran_order': False") == std::string::npos)
+            return false;
+
+        size_t start = dict.find('('), end = dict.find(')');
+        if (start == std::string::npos || end == std::string::npos || end < start)
+            return false;
+        std::vector<std::string> tokens = tokenize(dict.substr(start+1, end-start-1), ", ");
+        shape.clear();
+        for (size_t i=0; i<tokens.size(); ++i)
+            shape.push_back((size_t) atoll(tokens[i].c_str()));
+        return true;
+    }
+
+    /**
+     * \brief Write the image to a NumPy file
+     *
+     * The file is memory-mapped, and the pixel values are converted
+     * directly into it. In \c appendFrames mode, the image is stored as
+     * frame \c m_frameIndex of the array, which is determined on the
+     * first call.
+     */
+    void writeNumPy(const fs::path &filename) {
+        const Bitmap *source = m_storage->getBitmap();
+        std::vector<size_t> frameShape;
+        frameShape.push_back((size_t) source->getHeight());
+        frameShape.push_back((size_t) source->getWidth());
+        int channels;
+        switch (m_pixelFormat) {
+            case Bitmap::ELuminance: channels = 1; break;
+            case Bitmap::ELuminanceAlpha: channels = 2; break;
+            case Bitmap::ERGB:
+            case Bitmap::EXYZ: channels = 3; break;
+            case Bitmap::ERGBA:
+            case Bitmap::EXYZA: channels = 4; break;
+            case Bitmap::ESpectrum: channels = SPECTRUM_SAMPLES; break;
+            case Bitmap::ESpectrumAlpha: channels = SPECTRUM_SAMPLES + 1; break;
+            default: Log(EError, "Unsupported pixel format!"); return;
+        }
+        if (channels > 1)
+            frameShape.push_back((size_t) channels);
+        size_t pixelCount = (size_t) source->getWidth() * (size_t) source->getHeight(),
+               frameSize = pixelCount * channels * sizeof(Float);
+
+        ref<MemoryMappedFile> mmap;
+        size_t headerLength = 0, frameCount = 1;
+        std::vector<size_t> shape;
+
+        if (m_appendFrames && fs::exists(filename)) {
+            mmap = new MemoryMappedFile(filename, false);
+            std::vector<size_t> fileShape;
+            size_t oldHeaderLength;
+            bool compatible = parseNumPyHeader((const uint8_t *) mmap->getData(),
+                mmap->getSize(), oldHeaderLength, fileShape) &&
+                fileShape.size() == frameShape.size() + 1 &&
+                std::equal(frameShape.begin(), frameShape.end(), fileShape.begin() + 1) &&
+                mmap->getSize() >= oldHeaderLength + fileShape[0] * frameSize;
+
+            if (compatible) {
+                if (m_frameIndex < 0)
+                    m_frameIndex = (int) fileShape[0];
+                frameCount = std::max(fileShape[0], (size_t) m_frameIndex + 1);
+                shape.push_back(frameCount);
+                shape.insert(shape.end(), frameShape.begin(), frameShape.end());
+
+                std::string header = createNumPyHeader(shape, oldHeaderLength);
+                headerLength = header.size();
+                size_t existingFrames = std::min(fileShape[0], frameCount);
+                mmap->resize(headerLength + frameCount * frameSize);
+                uint8_t *data = (uint8_t *) mmap->getData();
+                if (headerLength != oldHeaderLength)
+                    memmove(data + headerLength, data + oldHeaderLength,
+                        existingFrames * frameSize);
+                memcpy(data, header.c_str(), headerLength);
+            } else {
+                Log(EWarn, "\"%s\" does not contain compatible frames -- overwriting it.",
+                    filename.string().c_str());
+                mmap = NULL;
+            }
+        }
+
+        if (!mmap) {
+            if (m_appendFrames) {
+                m_frameIndex = 0;
+                shape.push_back(1);
+            }
+            shape.insert(shape.end(), frameShape.begin(), frameShape.end());
+            std::string header = createNumPyHeader(shape, 0);
+            headerLength = header.size();
+            mmap = new MemoryMappedFile(filename, headerLength + frameSize);
+            memcpy(mmap->getData(), header.c_str(), headerLength);
+        }
+
+        /* Convert the accumulated pixel values into the mapped file */
+        uint8_t *target = (uint8_t *) mmap->getData() + headerLength
+            + (m_appendFrames ? (size_t) m_frameIndex * frameSize : 0);
+        const FormatConverter *cvt = FormatConverter::getInstance(
+            std::make_pair(Bitmap::EFloat, Bitmap::EFloat));
+        cvt->convert(source->getPixelFormat(), 1.0f, source->getUInt8Data(),
+            m_pixelFormat, 1.0f, target, pixelCount);
     }
 
     void develop(const Scene *scene, Float renderTime) {
@@ -255,17 +427,24 @@ public:
             expectedExtension = ".m";
         } else if (m_fileFormat == ENumPy) {
             expectedExtension = ".npy";
+        } else if (m_fileFormat == ENumPyArchive) {
+            expectedExtension = ".npz";
         } else {
             Log(EError, "Invalid file format!");
         }
         if (extension != expectedExtension)
             filename.replace_extension(expectedExtension);
 
+        Log(EInfo, "Writing image to \"%s\" ..", filename.filename().string().c_str());
+
+        if (m_fileFormat == ENumPy) {
+            writeNumPy(filename);
+            return;
+        }
+
         ref<Bitmap> bitmap = m_storage->getBitmap()->convert(
             m_pixelFormat, Bitmap::EFloat);
 
-        Log(EInfo, "Writing image to \"%s\" ..", filename.filename().string().c_str());
-
         if (m_fileFormat == EMathematica || m_fileFormat == EMATLAB) {
             fs::ofstream os(filename);
             if (!os.good() || os.fail())
@@ -344,7 +523,7 @@ public:
                 N = 2;
 
             const Float *data = bitmap->getFloatData();
-            cnpy::npy_save(filename.string(), data, shape_ptr, N, "w");
+            cnpy::npz_save(filename.string(), m_variable, data, shape_ptr, N, "w");
         }
     }
 
@@ -355,6 +534,8 @@ public:
             expectedExtension = ".m";
         } else if (m_fileFormat == ENumPy) {
             expectedExtension = ".npy";
+        } else if (m_fileFormat == ENumPyArchive) {
+            expectedExtension = ".npz";
         } else {
             Log(EError, "Invalid file format!");
         }
@@ -378,6 +559,7 @@ public:
             << "  pixelFormat = " << m_pixelFormat << "," << endl
             << "  digits = " << m_digits << "," << endl
             << "  variable = \"" << m_variable << "\"," << endl
+            << "  appendFrames = " << m_appendFrames << "," << endl
             << "  cropOffset = " << m_cropOffset.toString() << "," << endl
             << "  cropSize = " << m_cropSize.toString() << "," << endl
             << "  filter = " << indent(m_filter->toString()) << endl
@@ -393,6 +575,8 @@ protected:
     ref<ImageBlock> m_storage;
     std::string m_variable;
     int m_digits;
+    bool m_appendFrames;
+    int m_frameIndex;
 };
 
 MTS_IMPLEMENT_CLASS_S(MFilm, false, Film)
@@ -60,6 +60,13 @@ MTS_NAMESPACE_BEGIN
  *         \code{float16}, \code{float32}, or \code{uint32}
  *         \default{\code{float16}}
  *     }
+ *     \parameter{memoryLimit}{\Integer}{
+ *         Upper bound on the memory (in MiB) used by tiles that have already
+ *         been rendered but can't be written yet, since some of their neighbors
+ *         are still missing. When the limit is exceeded, the least recently used
+ *         tiles are temporarily moved to a scratch file. A value of zero
+ *         disables this limit. \default{0}
+ *     }
  *
  *     \parameter{\Unnamed}{\RFilter}{Reconstruction filter that should
  *     be used by the film. \default{\code{gaussian}, a windowed Gaussian filter}}
@@ -73,6 +80,14 @@ MTS_NAMESPACE_BEGIN
  * large output images that would otherwise not fit into memory (e.g.
  * 100K$\times$100K).
  *
+ * A tile can only be written once all of its neighbors have been rendered,
+ * since the reconstruction filter spreads samples across tile borders. Until
+ * then, the film keeps a partially merged version of the tile in memory. For
+ * very large renderings, the \code{memoryLimit} parameter bounds the amount of
+ * memory taken up by these tiles. When the rendering is
+ * interrupted, all tiles that have been rendered so far are written to the
+ * output file before it is closed.
+ *
  * When the image can fit into memory, usage of this plugin is discouraged:
  * due to the extra overhead of tracking image tiles, the rendering process
  * will be slower, and the output files also generally do not compress as
@@ -189,6 +204,8 @@ public:
         if (m_highQualityEdges)
             Log(EError, "The 'highQualityEdges' parameter is incompatible with the "
                 "tiled EXR film. Please disable it.");
+
+        m_memoryLimit = (size_t) props.getLong("memoryLimit", 0) * 1024 * 1024;
     }
 
     TiledHDRFilm(Stream *stream, InstanceManager *manager)
@@ -200,6 +217,7 @@ public:
         for (size_t i=0; i<m_channelNames.size(); ++i)
             m_channelNames[i] = stream->readString();
         m_componentFormat = (Bitmap::EComponentFormat) stream->readUInt();
+        m_memoryLimit = 0;
     }
 
     virtual ~TiledHDRFilm() {
@@ -294,7 +312,12 @@ public:
         }
 
         m_output->setFrameBuffer(*m_frameBuffer);
-        m_peakUsage = 0;
+        m_status.clear();
+        m_status.resize((size_t) m_blocksH * (size_t) m_blocksV, ETileMissing);
+        m_accessCounter = 0;
+        m_residentCount = m_peakUsage = m_spillCount = 0;
+        m_maxResident = 0;
+        m_spillSize = 0;
     }
 
     void put(const ImageBlock *block) {
@@ -308,38 +331,46 @@ public:
             block->getSize().y > m_blockSize)
             Log(EError, "Encountered an oversized block!");
 
+        if (block->getBorderSize() > m_blockSize)
+            Log(EError, "The reconstruction filter is too wide for the chosen block size!");
+
         int x = block->getOffset().x / (int) m_blockSize;
         int y = block->getOffset().y / (int) m_blockSize;
+        m_status[x + y * (size_t) m_blocksH] = ETileRendered;
 
-        /* Create two copies: a clean one, and one that is used for accumulation */
-        ref<ImageBlock> copy1, copy2;
-        if (m_freeBlocks.size() > 0) {
-            copy1 = m_freeBlocks.back();
-            block->copyTo(copy1);
-            m_freeBlocks.pop_back();
-        } else {
-            copy1 = block->clone();
-            copy1->incRef();
-            ++m_peakUsage;
-        }
+        /* Splat the block (including its border region) onto the
+           partially merged versions of all overlapping tiles */
+        const Bitmap *source = block->getBitmap();
+        Point2i sourceMin = block->getOffset() - Vector2i(block->getBorderSize()),
+                sourceMax = sourceMin + source->getSize();
 
-        if (m_freeBlocks.size() > 0) {
-            copy2 = m_freeBlocks.back();
-            block->copyTo(copy2);
-            m_freeBlocks.pop_back();
-        } else {
-            copy2 = block->clone();
-            copy2->incRef();
-            ++m_peakUsage;
-        }
+        for (int yo = -1; yo <= 1; ++yo) {
+            for (int xo = -1; xo <= 1; ++xo) {
+                int xp = x + xo, yp = y + yo;
+                if (xp < 0 || yp < 0 || xp >= m_blocksH || yp >= m_blocksV)
+                    continue;
 
-        uint32_t idx = (uint32_t) x + (uint32_t) y * m_blocksH;
-        m_origBlocks[idx]   = copy1;
-        m_mergedBlocks[idx] = copy2;
+                Point2i tileMin(xp * m_blockSize, yp * m_blockSize);
+                if (sourceMax.x <= tileMin.x || sourceMax.y <= tileMin.y ||
+                    sourceMin.x >= tileMin.x + m_blockSize ||
+                    sourceMin.y >= tileMin.y + m_blockSize)
+                    continue;
+
+                uint32_t idx = (uint32_t) xp + (uint32_t) yp * m_blocksH;
+                if (m_status[idx] == ETileWritten)
+                    continue;
+
+                Bitmap *tile = acquireTile(idx, source);
+                tile->accumulate(source, Point2i(0), Point2i(sourceMin - tileMin),
+                    source->getSize());
+            }
+        }
 
         for (int yo = -1; yo <= 1; ++yo)
             for (int xo = -1; xo <= 1; ++xo)
                 potentiallyWrite(x + xo, y + yo);
+
+        enforceMemoryLimit();
     }
 
     void setBitmap(const Bitmap *bitmap, Float multiplier) {
@@ -354,62 +385,35 @@ public:
             "rendering technique or use a non-tiled film. (e.g. 'hdrfilm')");
     }
 
-    void potentiallyWrite(int x, int y) {
+    void potentiallyWrite(int x, int y, bool force = false) {
         if (x < 0 || y < 0 || x >= m_blocksH || y >= m_blocksV)
             return;
 
         uint32_t idx = (uint32_t) x + (uint32_t) y * m_blocksH;
-        std::map<uint32_t, ImageBlock *>::iterator it = m_origBlocks.find(idx);
-        if (it == m_origBlocks.end())
+        if (m_status[idx] != ETileRendered)
             return;
 
-        ImageBlock *origBlock = it->second;
-        if (origBlock == NULL)
-            return;
-
-        /* This could be accelerated using some counters */
-        for (int yo = -1; yo <= 1; ++yo) {
-            for (int xo = -1; xo <= 1; ++xo) {
-                int xp = x + xo, yp = y + yo;
-                if (xp < 0 || yp < 0 || xp >= m_blocksH || yp >= m_blocksV
-                   || (xp == x && yp == y))
-                    continue;
-
-                uint32_t idx2 = (uint32_t) xp + (uint32_t) yp * m_blocksH;
-                if (m_origBlocks.find(idx2) == m_origBlocks.end())
-                    return; /* Not all neighboring blocks are there yet */
-            }
-        }
-
-        ImageBlock *mergedBlock = m_mergedBlocks[idx];
-        if (mergedBlock == NULL)
-            return;
-
-        /* All neighboring blocks are there -- join overlapping regions */
-        for (int yo = -1; yo <= 1; ++yo) {
-            for (int xo = -1; xo <= 1; ++xo) {
-                int xp = x + xo, yp = y + yo;
-                if (xp < 0 || yp < 0 || xp >= m_blocksH || yp >= m_blocksV
-                   || (xp == x && yp == y))
-                    continue;
-                uint32_t idx2 = (uint32_t) xp + (uint32_t) yp * m_blocksH;
-                ImageBlock *origBlock2   = m_origBlocks[idx2];
-                ImageBlock *mergedBlock2 = m_mergedBlocks[idx2];
-                if (!origBlock2 || !mergedBlock2)
-                    continue;
+        if (!force) {
+            for (int yo = -1; yo <= 1; ++yo) {
+                for (int xo = -1; xo <= 1; ++xo) {
+                    int xp = x + xo, yp = y + yo;
+                    if (xp < 0 || yp < 0 || xp >= m_blocksH || yp >= m_blocksV)
+                        continue;
 
-                mergedBlock->put(origBlock2);
-                mergedBlock2->put(origBlock);
+                    uint32_t idx2 = (uint32_t) xp + (uint32_t) yp * m_blocksH;
+                    if (m_status[idx2] == ETileMissing)
+                        return; /* Not all neighboring blocks are there yet */
+                }
             }
         }
 
-        const Bitmap *source = mergedBlock->getBitmap();
+        /* All contributions to this tile have been merged -- write it */
+        ref<Bitmap> source = acquireTile(idx, NULL);
 
         size_t sourceBpp = source->getBytesPerPixel();
         size_t targetBpp = m_tile->getBytesPerPixel();
 
-        const uint8_t *sourceData = source->getUInt8Data()
-            + mergedBlock->getBorderSize() * sourceBpp * (1 + source->getWidth());
+        const uint8_t *sourceData = source->getUInt8Data();
         uint8_t *targetData = m_tile->getUInt8Data();
 
         const FormatConverter *cvt = FormatConverter::getInstance(
@@ -430,8 +434,8 @@ public:
         }
 
         /* Commit to disk */
-        size_t ptrOffset = mergedBlock->getOffset().x * m_pixelStride +
-            mergedBlock->getOffset().y * m_rowStride;
+        size_t ptrOffset = (size_t) x * m_blockSize * m_pixelStride +
+            (size_t) y * m_blockSize * m_rowStride;
 
         for (Imf::FrameBuffer::Iterator it = m_frameBuffer->begin();
             it != m_frameBuffer->end(); ++it)
@@ -444,11 +448,107 @@ public:
             it != m_frameBuffer->end(); ++it)
             it.slice().base += ptrOffset;
 
-        /* Release the block */
-        m_freeBlocks.push_back(origBlock);
-        m_freeBlocks.push_back(mergedBlock);
-        m_origBlocks[idx] = NULL;
-        m_mergedBlocks[idx] = NULL;
+        /* Release the tile */
+        releaseTile(idx);
+        m_status[idx] = ETileWritten;
+    }
+
+    /**
+     * \brief Return the partially merged version of a tile
+     *
+     * The tile is created when it doesn't exist yet (using the pixel format
+     * of \c prototype), and it is loaded back from the scratch file when
+     * it was spilled before.
+     */
+    Bitmap *acquireTile(uint32_t idx, const Bitmap *prototype) {
+        TileRecord &record = m_tiles[idx];
+        if (record.bitmap) {
+            m_lru.erase(record.lastAccess);
+        } else {
+            if (!m_freeTiles.empty()) {
+                record.bitmap = m_freeTiles.back();
+                m_freeTiles.pop_back();
+            } else {
+                if (!m_tilePrototype) {
+                    Assert(prototype != NULL);
+                    m_tilePrototype = new Bitmap(prototype->getPixelFormat(),
+                        Bitmap::EFloat, Vector2i(1), prototype->getChannelCount());
+                    size_t tileBytes = m_tilePrototype->getBytesPerPixel()
+                        * (size_t) m_blockSize * (size_t) m_blockSize;
+                    if (m_memoryLimit > 0)
+                        m_maxResident = std::max((size_t) 1, m_memoryLimit / tileBytes);
+                }
+                record.bitmap = new Bitmap(m_tilePrototype->getPixelFormat(),
+                    Bitmap::EFloat, Vector2i(m_blockSize), m_tilePrototype->getChannelCount());
+            }
+
+            if (record.spillOffset >= 0) {
+                m_spillFile->seek((size_t) record.spillOffset);
+                m_spillFile->read(record.bitmap->getUInt8Data(),
+                    record.bitmap->getBufferSize());
+                m_freeSlots.push_back((size_t) record.spillOffset);
+                record.spillOffset = -1;
+            } else {
+                record.bitmap->clear();
+            }
+
+            m_peakUsage = std::max(m_peakUsage, ++m_residentCount);
+        }
+
+        record.lastAccess = ++m_accessCounter;
+        m_lru[record.lastAccess] = idx;
+        return record.bitmap;
+    }
+
+    /// Forget about a tile that has been written to disk
+    void releaseTile(uint32_t idx) {
+        std::map<uint32_t, TileRecord>::iterator it = m_tiles.find(idx);
+        if (it == m_tiles.end())
+            return;
+        TileRecord &record = it->second;
+        if (record.bitmap) {
+            m_lru.erase(record.lastAccess);
+            if (m_freeTiles.size() < 9)
+                m_freeTiles.push_back(record.bitmap);
+            --m_residentCount;
+        }
+        if (record.spillOffset >= 0)
+            m_freeSlots.push_back((size_t) record.spillOffset);
+        m_tiles.erase(it);
+    }
+
+    /// Move the least recently used tiles to the scratch file until the memory limit is met
+    void enforceMemoryLimit() {
+        if (m_maxResident == 0)
+            return;
+
+        while (m_residentCount > m_maxResident) {
+            uint32_t idx = m_lru.begin()->second;
+            m_lru.erase(m_lru.begin());
+            TileRecord &record = m_tiles[idx];
+
+            if (!m_spillFile) {
+                m_spillFile = FileStream::createTemporary();
+                Log(EInfo, "Exceeded the memory limit of %s, moving "
+                    "tiles to a scratch file..", memString(m_memoryLimit).c_str());
+            }
+
+            size_t size = record.bitmap->getBufferSize(), offset;
+            if (!m_freeSlots.empty()) {
+                offset = m_freeSlots.back();
+                m_freeSlots.pop_back();
+            } else {
+                offset = m_spillSize;
+                m_spillSize += size;
+            }
+
+            m_spillFile->seek(offset);
+            m_spillFile->write(record.bitmap->getUInt8Data(), size);
+            record.spillOffset = (int64_t) offset;
+            record.bitmap = NULL;
+            --m_residentCount;
+            ++m_spillCount;
+        }
     }
 
     bool develop(const Point2i &sourceOffset, const Vector2i &size,
@@ -459,32 +559,31 @@ public:
 
     void develop(const Scene *scene, Float renderTime) {
         if (m_output) {
-            Log(EInfo, "Closing EXR file (%u tiles in total, peak memory usage: %u tiles)..",
-                m_blocksH * m_blocksV, m_peakUsage);
+            /* Write tiles whose neighbors never arrived (e.g. when the
+               rendering was interrupted) using the data that is available */
+            for (int y=0; y<m_blocksV; ++y)
+                for (int x=0; x<m_blocksH; ++x)
+                    potentiallyWrite(x, y, true);
+
+            Log(EInfo, "Closing EXR file (%u tiles in total, peak memory usage: " SIZE_T_FMT
+                " tiles, " SIZE_T_FMT " tiles spilled to disk)..", m_blocksH * m_blocksV,
+                m_peakUsage, m_spillCount);
             delete m_output;
             delete m_frameBuffer;
             m_output = NULL;
             m_frameBuffer = NULL;
             m_tile = NULL;
-
-            for (std::vector<ImageBlock *>::iterator it = m_freeBlocks.begin();
-                it != m_freeBlocks.end(); ++it)
-                (*it)->decRef();
-            m_freeBlocks.clear();
-
-            for (std::map<uint32_t, ImageBlock *>::iterator it = m_origBlocks.begin();
-                it != m_origBlocks.end(); ++it) {
-                if ((*it).second)
-                    (*it).second->decRef();
-            }
-            m_origBlocks.clear();
-
-            for (std::map<uint32_t, ImageBlock *>::iterator it = m_mergedBlocks.begin();
-                it != m_mergedBlocks.end(); ++it) {
-                if ((*it).second)
-                    (*it).second->decRef();
+            m_tilePrototype = NULL;
+            m_freeTiles.clear();
+            m_tiles.clear();
+            m_lru.clear();
+            m_freeSlots.clear();
+            m_status.clear();
+
+            if (m_spillFile) {
+                m_spillFile->close();
+                m_spillFile = NULL;
             }
-            m_mergedBlocks.clear();
         }
     }
 
@@ -530,16 +629,40 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    /// Rendering state of an image tile
+    enum ETileStatus {
+        ETileMissing = 0,
+        ETileRendered,
+        ETileWritten
+    };
+
+    /// Partially merged tile that hasn't been written yet
+    struct TileRecord {
+        ref<Bitmap> bitmap;  ///< Resident tile contents (or \c NULL if spilled)
+        int64_t spillOffset; ///< Position within the scratch file (or -1)
+        uint64_t lastAccess; ///< Key into the LRU list
+
+        TileRecord() : spillOffset(-1), lastAccess(0) { }
+    };
+
     std::vector<Bitmap::EPixelFormat> m_pixelFormats;
     std::vector<std::string> m_channelNames;
     Bitmap::EComponentFormat m_componentFormat;
-    std::vector<ImageBlock *> m_freeBlocks;
-    std::map<uint32_t, ImageBlock *> m_origBlocks, m_mergedBlocks;
+    std::vector<uint8_t> m_status;
+    std::map<uint32_t, TileRecord> m_tiles;
+    std::map<uint64_t, uint32_t> m_lru;
+    std::vector<ref<Bitmap> > m_freeTiles;
+    std::vector<size_t> m_freeSlots;
+    ref<Bitmap> m_tilePrototype;
+    ref<FileStream> m_spillFile;
     Imf::TiledOutputFile *m_output;
     Imf::FrameBuffer *m_frameBuffer;
     ref<Bitmap> m_tile;
     size_t m_pixelStride, m_rowStride;
-    int m_blocksH, m_blocksV, m_peakUsage;
+    size_t m_memoryLimit, m_maxResident, m_spillSize;
+    size_t m_residentCount, m_peakUsage, m_spillCount;
+    uint64_t m_accessCounter;
+    int m_blocksH, m_blocksV;
     int m_blockSize;
 };
 
@@ -29,7 +29,8 @@ MTS_NAMESPACE_BEGIN
 
 class BDPTRenderer : public WorkProcessor {
 public:
-    BDPTRenderer(const BDPTConfiguration &config) : m_config(config) { }
+    BDPTRenderer(const BDPTConfiguration &config, ImageBlock *sharedLightImage = NULL)
+        : m_config(config), m_sharedLightImage(sharedLightImage) { }
 
     BDPTRenderer(Stream *stream, InstanceManager *manager)
         : WorkProcessor(stream, manager), m_config(stream) { }
@@ -46,7 +47,7 @@ public:
 
     ref<WorkResult> createWorkResult() const {
         return new BDPTWorkResult(m_config, m_rfilter.get(),
-            Vector2i(m_config.blockSize));
+            Vector2i(m_config.blockSize), const_cast<ImageBlock *>(m_sharedLightImage.get()));
     }
 
     void prepare() {
@@ -139,6 +140,12 @@ public:
         PathVertex tempEndpoint, tempSample;
         PathEdge tempEdge, connectionEdge;
 
+        /* Gather the sampling densities needed by the MIS weights */
+        m_emitterCache.update(scene, emitterSubpath, EImportance,
+            m_config.sampleDirect, m_config.lightImage);
+        m_sensorCache.update(scene, sensorSubpath, ERadiance,
+            m_config.sampleDirect, m_config.lightImage);
+
         /* Compute the combined weights along the two subpaths */
         Spectrum *importanceWeights = (Spectrum *) alloca(emitterSubpath.vertexCount() * sizeof(Spectrum)),
                  *radianceWeights  = (Spectrum *) alloca(sensorSubpath.vertexCount()  * sizeof(Spectrum));
@@ -280,7 +287,8 @@ public:
 
                 /* Compute the multiple importance sampling weight */
                 Float miWeight = Path::miWeight(scene, emitterSubpath, &connectionEdge,
-                    sensorSubpath, s, t, m_config.sampleDirect, m_config.lightImage);
+                    sensorSubpath, s, t, m_config.sampleDirect, m_config.lightImage,
+                    &m_emitterCache, &m_sensorCache);
 
                 if (sampleDirect) {
                     /* Now undo the previous change */
@@ -314,7 +322,8 @@ public:
     }
 
     ref<WorkProcessor> clone() const {
-        return new BDPTRenderer(m_config);
+        return new BDPTRenderer(m_config,
+            const_cast<ImageBlock *>(m_sharedLightImage.get()));
     }
 
     MTS_DECLARE_CLASS()
@@ -324,8 +333,10 @@ private:
     ref<Sampler> m_sampler;
     ref<ReconstructionFilter> m_rfilter;
     MemoryPool m_pool;
+    PathMISCache m_emitterCache, m_sensorCache;
     BDPTConfiguration m_config;
     HilbertCurve2D<uint8_t> m_hilbertCurve;
+    ref<ImageBlock> m_sharedLightImage;
 };
 
 
@@ -340,16 +351,24 @@ BDPTProcess::BDPTProcess(const RenderJob *parent, RenderQueue *queue,
 }
 
 ref<WorkProcessor> BDPTProcess::createWorkProcessor() const {
-    return new BDPTRenderer(m_config);
+    return new BDPTRenderer(m_config,
+        const_cast<ImageBlock *>(m_sharedLightImage.get()));
 }
 
 void BDPTProcess::develop() {
     if (!m_config.lightImage)
         return;
     LockGuard lock(m_resultMutex);
-    const ImageBlock *lightImage = m_result->getLightImage();
+
+    /* Combine the light images of remote workers with the
+       one that is shared by all local workers */
+    ref<Bitmap> lightImage = m_result->getLightImage()->getBitmap()->clone();
+    int borderSize = m_sharedLightImage->getBorderSize();
+    lightImage->accumulate(m_sharedLightImage->getBitmap(),
+        Point2i(borderSize), Point2i(0), lightImage->getSize());
+
     m_film->setBitmap(m_result->getImageBlock()->getBitmap());
-    m_film->addBitmap(lightImage->getBitmap(), 1.0f / m_config.sampleCount);
+    m_film->addBitmap(lightImage, 1.0f / m_config.sampleCount);
     m_refreshTimer->reset();
     m_queue->signalRefresh(m_parent);
 }
@@ -372,21 +391,26 @@ void BDPTProcess::processResult(const WorkResult *wr, bool cancelled) {
 
             Float invSampleCount = 1.0f / m_config.sampleCount;
             const Bitmap *sourceBitmap = lightImage->getBitmap();
+            const Bitmap *sharedBitmap = m_sharedLightImage->getBitmap();
             Bitmap *destBitmap = block->getBitmap();
             int borderSize = block->getBorderSize();
+            int sharedBorderSize = m_sharedLightImage->getBorderSize();
             Point2i offset = block->getOffset();
             Vector2i size = block->getSize();
 
             for (int y=0; y<size.y; ++y) {
                 const Float *source = sourceBitmap->getFloatData()
                     + (offset.x + (y+offset.y) * sourceBitmap->getWidth()) * SPECTRUM_SAMPLES;
+                const Float *shared = sharedBitmap->getFloatData()
+                    + (offset.x + sharedBorderSize + (y + offset.y + sharedBorderSize)
+                        * sharedBitmap->getWidth()) * SPECTRUM_SAMPLES;
                 Float *dest = destBitmap->getFloatData()
                     + (borderSize + (y + borderSize) * destBitmap->getWidth()) * (SPECTRUM_SAMPLES + 2);
 
                 for (int x=0; x<size.x; ++x) {
                     Float weight = dest[SPECTRUM_SAMPLES + 1] * invSampleCount;
                     for (int k=0; k<SPECTRUM_SAMPLES; ++k)
-                        *dest++ += *source++ * weight;
+                        *dest++ += (*source++ + *shared++) * weight;
                     dest += 2;
                 }
             }
@@ -413,6 +437,12 @@ void BDPTProcess::bindResource(const std::string &name, int id) {
         /* If needed, allocate memory for the light image */
         m_result = new BDPTWorkResult(m_config, NULL, m_film->getCropSize());
         m_result->clear();
+
+        /* Local workers splat into this light image directly, which
+           avoids allocating a full-resolution copy per rendering thread */
+        m_sharedLightImage = new ImageBlock(Bitmap::ESpectrum,
+            m_film->getCropSize(), m_film->getReconstructionFilter());
+        m_sharedLightImage->clear();
     }
 }
 
@@ -55,6 +55,7 @@ protected:
     virtual ~BDPTProcess() { }
 private:
     ref<BDPTWorkResult> m_result;
+    ref<ImageBlock> m_sharedLightImage;
     ref<Timer> m_refreshTimer;
     BDPTConfiguration m_config;
 };
@@ -27,7 +27,9 @@ MTS_NAMESPACE_BEGIN
 /* ==================================================================== */
 
 BDPTWorkResult::BDPTWorkResult(const BDPTConfiguration &conf,
-        const ReconstructionFilter *rfilter, Vector2i blockSize) {
+        const ReconstructionFilter *rfilter, Vector2i blockSize,
+        ImageBlock *sharedLightImage) : m_sharedLightImage(sharedLightImage),
+        m_rfilter(rfilter), m_cropSize(conf.cropSize) {
     /* Stores the 'camera image' -- this can be blocked when
        spreading out work to multiple workers */
     if (blockSize == Vector2i(-1, -1))
@@ -37,14 +39,11 @@ BDPTWorkResult::BDPTWorkResult(const BDPTConfiguration &conf,
     m_block->setOffset(Point2i(0, 0));
     m_block->setSize(blockSize);
 
-    if (conf.lightImage) {
+    if (conf.lightImage && !sharedLightImage) {
         /* Stores the 'light image' -- every worker requires a
            full-resolution version, since contributions of s==0
            and s==1 paths can affect any pixel of this bitmap */
-        m_lightImage = new ImageBlock(Bitmap::ESpectrum,
-                conf.cropSize, rfilter);
-        m_lightImage->setSize(conf.cropSize);
-        m_lightImage->setOffset(Point2i(0, 0));
+        allocateLightImage();
     }
 
     /* When debug mode is active, we additionally create
@@ -65,14 +64,23 @@ BDPTWorkResult::BDPTWorkResult(const BDPTConfiguration &conf,
 
 BDPTWorkResult::~BDPTWorkResult() { }
 
+void BDPTWorkResult::allocateLightImage() {
+    m_lightImage = new ImageBlock(Bitmap::ESpectrum,
+            m_cropSize, m_rfilter);
+    m_lightImage->setSize(m_cropSize);
+    m_lightImage->setOffset(Point2i(0, 0));
+}
+
 void BDPTWorkResult::put(const BDPTWorkResult *workResult) {
 #if BDPT_DEBUG == 1
     for (size_t i=0; i<m_debugBlocks.size(); ++i)
         m_debugBlocks[i]->put(workResult->m_debugBlocks[i].get());
 #endif
     m_block->put(workResult->m_block.get());
-    if (m_lightImage)
+    if (m_lightImage.get() && workResult->m_lightImage.get())
         m_lightImage->put(workResult->m_lightImage.get());
+    else if (m_lightImage.get() && workResult->m_sparseLightImage.get())
+        m_lightImage->put(workResult->m_sparseLightImage.get());
 }
 
 void BDPTWorkResult::clear() {
@@ -111,8 +119,13 @@ void BDPTWorkResult::load(Stream *stream) {
     for (size_t i=0; i<m_debugBlocks.size(); ++i)
         m_debugBlocks[i]->load(stream);
 #endif
-    if (m_lightImage)
-        m_lightImage->load(stream);
+    if (stream->readBool()) {
+        if (!m_sparseLightImage)
+            m_sparseLightImage = new SparseImageBlock();
+        m_sparseLightImage->load(stream);
+    } else {
+        m_sparseLightImage = NULL;
+    }
     m_block->load(stream);
 }
 
@@ -121,8 +134,17 @@ void BDPTWorkResult::save(Stream *stream) const {
     for (size_t i=0; i<m_debugBlocks.size(); ++i)
         m_debugBlocks[i]->save(stream);
 #endif
-    if (m_lightImage.get())
-        m_lightImage->save(stream);
+    /* Only transmit the tiles of the light image that were touched */
+    if (m_lightImage.get()) {
+        ref<SparseImageBlock> sparse = new SparseImageBlock();
+        sparse->set(m_lightImage.get());
+        stream->writeBool(true);
+        sparse->save(stream);
+    } else {
+        stream->writeBool(m_sparseLightImage.get() != NULL);
+        if (m_sparseLightImage.get())
+            m_sparseLightImage->save(stream);
+    }
     m_block->save(stream);
 }
 
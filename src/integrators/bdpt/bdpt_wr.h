@@ -33,11 +33,18 @@ MTS_NAMESPACE_BEGIN
    Bidirectional path tracing needs its own WorkResult implementation,
    since each rendering thread simultaneously renders to a small 'camera
    image' block and potentially a full-resolution 'light image'.
+
+   To avoid allocating one light image per rendering thread, local workers
+   can instead splat into a light image that is shared by all of them (see
+   \c sharedLightImage). Remote workers still use their own light images,
+   but only send the tiles that received contributions (see
+   \ref SparseImageBlock), which are merged without expanding them into a
+   full-resolution image.
 */
 class BDPTWorkResult : public WorkResult {
 public:
     BDPTWorkResult(const BDPTConfiguration &conf, const ReconstructionFilter *filter,
-            Vector2i blockSize = Vector2i(-1, -1));
+            Vector2i blockSize = Vector2i(-1, -1), ImageBlock *sharedLightImage = NULL);
 
     // Clear the contents of the work result
     void clear();
@@ -68,7 +75,10 @@ public:
     }
 
     inline void putLightSample(const Point2 &sample, const Spectrum &spec) {
-        m_lightImage->put(sample, spec, 1.0f);
+        if (m_sharedLightImage)
+            m_sharedLightImage->putConcurrent(sample, spec, 1.0f);
+        else
+            m_lightImage->put(sample, spec, 1.0f);
     }
 
     inline const ImageBlock *getImageBlock() const {
@@ -95,6 +105,9 @@ protected:
     /// Virtual destructor
     virtual ~BDPTWorkResult();
 
+    /// Allocate a full-resolution light image owned by this work result
+    void allocateLightImage();
+
     inline int strategyIndex(int s, int t) const {
         int above = s+t-2;
         return s + above*(5+above)/2;
@@ -104,6 +117,11 @@ protected:
     ref_vector<ImageBlock> m_debugBlocks;
 #endif
     ref<ImageBlock> m_block, m_lightImage;
+    ref<ImageBlock> m_sharedLightImage;
+    /// Light image that was received from a remote worker
+    ref<SparseImageBlock> m_sparseLightImage;
+    const ReconstructionFilter *m_rfilter;
+    Vector2i m_cropSize;
 };
 
 MTS_NAMESPACE_END
@@ -29,6 +29,11 @@ MTS_NAMESPACE_BEGIN
  *
  *     \parameter{rayLength}{\Float}{Specifies the world-space length of the
  *         ambient occlusion rays that will be cast. \default{\code{-1}, i.e. automatic}}.
+ *
+ *     \parameter{subsampling}{\Integer}{When set to a value $k>1$, ambient
+ *         occlusion is only computed on a grid with a spacing of $k$ pixels
+ *         and interpolated in between, except for pixels close to geometric
+ *         discontinuities (see below). \default{\code{1}, i.e. disabled}}
  * }
  * \renderings{
  *    \rendering{A view of the scene on page \pageref{fig:rungholt}, rendered using
@@ -39,6 +44,21 @@ MTS_NAMESPACE_BEGIN
  * to uniform illumination incident from all direction. It produces approximate shadowing between closeby
  * objects, as well as darkening in corners, creases, and cracks. The scattering models associated with objects
  * in the scene are ignored.
+ *
+ * Since ambient occlusion usually varies smoothly over the image, the
+ * \code{subsampling} parameter can be used to substantially reduce
+ * the number of occlusion rays: all samples of every $k$-th pixel (in both
+ * directions) are rendered as usual. For the remaining pixels, only the
+ * primary rays are traced, and the result is bilinearly interpolated
+ * from the four surrounding grid pixels, provided that the hit points of
+ * all involved rays agree---i.e. that they lie on the same shape, and that
+ * their geometric normals (within $25^\circ$) and distances to the
+ * sensor (within 5\%) are similar. These are the same quantities that
+ * the \pluginref{field} integrator reports as \code{shapeIndex},
+ * \code{geoNormal}, and \code{distance}. Samples failing this test, which
+ * typically occur along silhouettes and creases, are rendered with the
+ * full number of occlusion rays. Subsampling cannot be combined with
+ * the \code{aovs} parameter.
  */
 
 class AmbientOcclusionIntegrator : public SamplingIntegrator {
@@ -46,6 +66,12 @@ public:
     AmbientOcclusionIntegrator(const Properties &props) : SamplingIntegrator(props) {
         m_shadingSamples = props.getSize("shadingSamples", 1);
         m_rayLength = props.getFloat("rayLength", -1);
+        m_subsampling = props.getInteger("subsampling", 1);
+
+        if (m_subsampling < 1)
+            Log(EError, "'subsampling' must be at least 1!");
+        if (m_subsampling > 1 && m_aovs)
+            Log(EError, "'subsampling' cannot be combined with AOV output!");
     }
 
     /// Unserialize from a binary data stream
@@ -53,6 +79,7 @@ public:
      : SamplingIntegrator(stream, manager) {
         m_shadingSamples = stream->readSize();
         m_rayLength = stream->readFloat();
+        m_subsampling = stream->readInt();
         configure();
     }
 
@@ -60,6 +87,7 @@ public:
         SamplingIntegrator::serialize(stream, manager);
         stream->writeSize(m_shadingSamples);
         stream->writeFloat(m_rayLength);
+        stream->writeInt(m_subsampling);
     }
 
     void configureSampler(const Scene *scene, Sampler *sampler) {
@@ -81,6 +109,121 @@ public:
         return true;
     }
 
+    void renderBlock(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points) const {
+        if (m_subsampling > 1) {
+            renderBlockSubsampled(scene, sensor, sampler, block, stop, points);
+            return;
+        }
+
+        /* Trace the sensor rays of neighboring pixels together */
+        renderBlockStream(scene, sensor, sampler, block, stop, points);
+    }
+
+    void renderBlockSamples(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points,
+            size_t firstSample, size_t sampleCount) const {
+        if (m_subsampling > 1)
+            Log(EError, "Subsampling cannot be combined with progressive rendering!");
+        renderBlockStream(scene, sensor, sampler, block, stop, points,
+            firstSample, sampleCount);
+    }
+
+    /// Render a block, interpolating occlusion away from discontinuities
+    void renderBlockSubsampled(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points) const {
+        const Vector2i &size = block->getSize();
+        const int stride = m_subsampling;
+
+        PixelContext ctx(scene, sensor, sampler, block);
+        block->clear();
+
+        /* Grid pixels: every stride-th row/column and the last one */
+        const int gridX = coarseIndex(size.x - 1, size.x),
+                  gridY = coarseIndex(size.y - 1, size.y);
+        std::vector<GridPixel> grid((gridX + 1) * (gridY + 1));
+
+        for (int iy = 0; iy <= gridY; ++iy) {
+            for (int ix = 0; ix <= gridX; ++ix) {
+                if (stop)
+                    return;
+                Point2i pos(std::min(ix * stride, size.x - 1),
+                            std::min(iy * stride, size.y - 1));
+                GridPixel &pixel = grid[ix + iy * (gridX + 1)];
+                pixel.feature = centerFeature(ctx, pos);
+                pixel.valid = renderPixel(ctx, pos, &pixel.feature, &pixel.value);
+            }
+        }
+
+        for (size_t i = 0; i<points.size(); ++i) {
+            Point2i pos(points[i]);
+            if (stop)
+                break;
+            if (isCoarse(pos.x, size.x, stride) && isCoarse(pos.y, size.y, stride))
+                continue;
+
+            /* Look up the grid pixels surrounding the current pixel */
+            int xl = (pos.x / stride) * stride, xu = std::min(xl + stride, size.x - 1),
+                yl = (pos.y / stride) * stride, yu = std::min(yl + stride, size.y - 1);
+            Float fx = xu > xl ? (pos.x - xl) / (Float) (xu - xl) : (Float) 0,
+                  fy = yu > yl ? (pos.y - yl) / (Float) (yu - yl) : (Float) 0;
+            int ixl = coarseIndex(xl, size.x), ixu = coarseIndex(xu, size.x),
+                iyl = coarseIndex(yl, size.y), iyu = coarseIndex(yu, size.y);
+
+            const GridPixel *corners[4] = {
+                &grid[ixl + iyl * (gridX + 1)], &grid[ixu + iyl * (gridX + 1)],
+                &grid[ixl + iyu * (gridX + 1)], &grid[ixu + iyu * (gridX + 1)]
+            };
+            Float weights[4] = {
+                (1-fx) * (1-fy), fx * (1-fy), (1-fx) * fy, fx * fy
+            };
+
+            bool interpolate = true;
+            Spectrum value(0.0f);
+            for (int k=0; k<4; ++k) {
+                if (weights[k] == 0)
+                    continue;
+                if (!corners[k]->valid) {
+                    interpolate = false;
+                    break;
+                }
+                value += corners[k]->value * weights[k];
+            }
+
+            if (!interpolate) {
+                renderPixel(ctx, pos, NULL, NULL);
+                continue;
+            }
+
+            Point2i offset = pos + Vector2i(block->getOffset());
+            sampler->generate(offset);
+
+            for (size_t j = 0; j<sampler->getSampleCount(); j++) {
+                Point2 samplePos;
+                Spectrum spec = ctx.sampleRay(offset, samplePos);
+
+                Intersection its;
+                scene->rayIntersect(ctx.sensorRay, its);
+                ctx.rRec.setIntersection(ctx.sensorRay, its);
+
+                Feature feature(its);
+                bool compatible = true;
+                for (int k=0; k<4 && compatible; ++k)
+                    compatible = weights[k] == 0 || corners[k]->feature.isCompatible(feature);
+
+                /* Fall back to the full computation near discontinuities */
+                spec *= compatible ? value : Li(ctx.sensorRay, ctx.rRec);
+
+                if (ctx.put(offset, samplePos, spec) && ctx.recordVariance)
+                    block->putVariance(pos, spec.getLuminance());
+                sampler->advance();
+            }
+        }
+    }
+
     Spectrum Li(const RayDifferential &ray, RadianceQueryRecord &rRec) const {
         /* Some aliases and local variables */
         Spectrum Li(0.0f);
@@ -110,13 +253,20 @@ public:
             sample = rRec.nextSample2D();
         }
 
+        /* Warp the samples in small batches (vectorized when possible) */
         const Intersection &its = rRec.its;
-        for (size_t i=0; i<numShadingSamples; ++i) {
-            Vector d = its.toWorld(warp::squareToCosineHemisphere(sampleArray[i]));
+        const size_t batchSize = 16;
+        Vector directions[batchSize];
+        for (size_t offset=0; offset<numShadingSamples; offset += batchSize) {
+            size_t count = std::min(batchSize, numShadingSamples - offset);
+            warp::squareToCosineHemisphere(count, sampleArray + offset, directions);
 
-            Ray shadowRay(its.p, d, Epsilon, m_rayLength, ray.time);
-            if (!rRec.scene->rayIntersect(shadowRay))
-                Li += Spectrum(1.0f);
+            for (size_t i=0; i<count; ++i) {
+                Ray shadowRay(its.p, its.toWorld(directions[i]),
+                    Epsilon, m_rayLength, ray.time);
+                if (!rRec.scene->rayIntersect(shadowRay))
+                    Li += Spectrum(1.0f);
+            }
         }
 
         Li /= static_cast<Float>(numShadingSamples);
@@ -128,15 +278,162 @@ public:
         std::ostringstream oss;
         oss << "AmbientOcclusionIntegrator[" << endl
             << "  shadingSamples = " << m_shadingSamples << "," << endl
-            << "  rayLength = " << m_rayLength << endl
+            << "  rayLength = " << m_rayLength << "," << endl
+            << "  subsampling = " << m_subsampling << endl
             << "]";
         return oss.str();
     }
 
     MTS_DECLARE_CLASS()
+protected:
+    /// Geometric information used to detect discontinuities
+    struct Feature {
+        const Shape *shape;
+        Normal geoFrameN;
+        Float dist;
+
+        inline Feature() : shape(NULL) { }
+
+        inline Feature(const Intersection &its) : shape(NULL) {
+            if (its.isValid()) {
+                shape = its.shape;
+                geoFrameN = its.geoFrame.n;
+                dist = its.t;
+            }
+        }
+
+        /// Can occlusion values be interpolated between the two hit points?
+        inline bool isCompatible(const Feature &f) const {
+            if (!shape || !f.shape)
+                return shape == f.shape;
+            return shape == f.shape
+                && dot(geoFrameN, f.geoFrameN) > 0.9f
+                && std::abs(dist - f.dist) <= 0.05f * std::max(dist, f.dist);
+        }
+    };
+
+    /// Pixel of the coarse grid used by renderBlockSubsampled()
+    struct GridPixel {
+        Feature feature;
+        Spectrum value;
+        /// Did all samples of the pixel agree with \c feature?
+        bool valid;
+    };
+
+    /// Per-block state that is shared by the helper functions below
+    struct PixelContext {
+        const Scene *scene;
+        const Sensor *sensor;
+        Sampler *sampler;
+        ImageBlock *block;
+        const ReconstructionFilter *rfilter;
+        RadianceQueryRecord rRec;
+        RayDifferential sensorRay;
+        uint32_t queryType;
+        Float diffScaleFactor, filterWeight;
+        bool needsApertureSample, needsTimeSample, recordVariance;
+
+        PixelContext(const Scene *scene, const Sensor *sensor,
+                Sampler *sampler, ImageBlock *block)
+            : scene(scene), sensor(sensor), sampler(sampler), block(block),
+              rfilter(sensor->getFilm()->getReconstructionFilter()),
+              rRec(scene, sampler) {
+            diffScaleFactor = 1.0f / std::sqrt((Float) sampler->getSampleCount());
+            needsApertureSample = sensor->needsApertureSample();
+            needsTimeSample = sensor->needsTimeSample();
+            recordVariance = block->hasVariance();
+            queryType = RadianceQueryRecord::ESensorRay;
+            if (!sensor->getFilm()->hasAlpha())
+                queryType &= ~RadianceQueryRecord::EOpacity;
+        }
+
+        /// Start a new query and generate the sensor ray of the current sample
+        Spectrum sampleRay(const Point2i &offset, Point2 &samplePos) {
+            Point2 apertureSample(0.5f);
+            Float timeSample = 0.5f;
+
+            rRec.newQuery(queryType, sensor->getMedium());
+            samplePos = rfilter->samplePosition(offset, rRec.nextSample2D(), filterWeight);
+
+            if (needsApertureSample)
+                apertureSample = rRec.nextSample2D();
+            if (needsTimeSample)
+                timeSample = rRec.nextSample1D();
+
+            Spectrum spec = sensor->sampleRayDifferential(
+                sensorRay, samplePos, apertureSample, timeSample);
+            sensorRay.scaleDifferential(diffScaleFactor);
+            return spec;
+        }
+
+        /// Store the current sample in the image block
+        bool put(const Point2i &offset, const Point2 &samplePos, const Spectrum &spec) {
+            if (rfilter->isImportanceSampled())
+                return block->putPixel(offset, spec, rRec.alpha, filterWeight);
+            else
+                return block->put(samplePos, spec, rRec.alpha);
+        }
+    };
+
+    /// Is the given pixel coordinate part of the coarse grid?
+    static inline bool isCoarse(int x, int size, int stride) {
+        return x % stride == 0 || x == size - 1;
+    }
+
+    /// Map a coarse pixel coordinate to its index within the grid
+    inline int coarseIndex(int x, int size) const {
+        return x / m_subsampling + ((x == size - 1 && x % m_subsampling != 0) ? 1 : 0);
+    }
+
+    /// Compute the features of the ray through the center of a pixel
+    Feature centerFeature(PixelContext &ctx, const Point2i &pos) const {
+        Point2 center = Point2(pos + Vector2i(ctx.block->getOffset())) + Vector2(0.5f);
+        Ray ray;
+        ctx.sensor->sampleRay(ray, center, Point2(0.5f), 0.5f);
+        Intersection its;
+        ctx.scene->rayIntersect(ray, its);
+        return Feature(its);
+    }
+
+    /**
+     * \brief Render all samples of a pixel with the full number of occlusion rays
+     *
+     * When \c feature is given, the function stores the average occlusion
+     * in \c value and returns whether all hit points are compatible
+     * with \c feature.
+     */
+    bool renderPixel(PixelContext &ctx, const Point2i &pos,
+            const Feature *feature, Spectrum *value) const {
+        Point2i offset = pos + Vector2i(ctx.block->getOffset());
+        size_t sampleCount = ctx.sampler->getSampleCount();
+        bool compatible = true;
+        Spectrum sum(0.0f);
+
+        ctx.sampler->generate(offset);
+        for (size_t j = 0; j<sampleCount; j++) {
+            Point2 samplePos;
+            Spectrum spec = ctx.sampleRay(offset, samplePos);
+
+            Spectrum result = Li(ctx.sensorRay, ctx.rRec);
+            if (feature) {
+                compatible &= feature->isCompatible(Feature(ctx.rRec.its));
+                sum += result;
+            }
+            spec *= result;
+
+            if (ctx.put(offset, samplePos, spec) && ctx.recordVariance)
+                ctx.block->putVariance(pos, spec.getLuminance());
+            ctx.sampler->advance();
+        }
+
+        if (value)
+            *value = sum / (Float) sampleCount;
+        return compatible;
+    }
 private:
     size_t m_shadingSamples;
     Float m_rayLength;
+    int m_subsampling;
 };
 
 MTS_IMPLEMENT_CLASS_S(AmbientOcclusionIntegrator, false, SamplingIntegrator)
@@ -37,6 +37,11 @@ MTS_NAMESPACE_BEGIN
  *        using the BSDF sampling strategies implemented by the scene's
  *        surfaces\default{set to the value of \code{shadingSamples}}
  *     }
+ *     \parameter{risCandidates}{\Integer}{When set to a value $M>1$,
+ *        each emitter sample is chosen among $M$ candidates using
+ *        resampled importance sampling (see below)
+ *        \default{1, i.e. disabled}
+ *     }
  *     \parameter{strictNormals}{\Boolean}{Be strict about potential
  *        inconsistencies involving shading normals? See
  *        page~\pageref{sec:strictnormals} for details.
@@ -82,6 +87,15 @@ MTS_NAMESPACE_BEGIN
  * parameter of this integrator should be increased until the variance in
  * the output renderings is acceptable.
  *
+ * In scenes with many emitters, most shadow rays of the emitter sampling
+ * technique are wasted on weak contributions. Setting \code{risCandidates}
+ * to a value $M>1$ enables \emph{resampled importance sampling}: for every
+ * emitter sample, the integrator draws $M$ candidates and evaluates their
+ * contribution without shadow rays, which is cheap. It then picks one
+ * candidate proportionally to its (luminance) contribution and only traces a
+ * shadow ray towards this one. The result remains unbiased, and the combination
+ * with BSDF sampling is unaffected.
+ *
  * \remarks{
  *    \item This integrator does not handle participating media or
  *          indirect illumination.
@@ -104,6 +118,10 @@ public:
         /* When this flag is set to true, contributions from directly
          * visible emitters will not be included in the rendered image */
         m_hideEmitters = props.getBoolean("hideEmitters", false);
+        /* Number of RIS candidates per emitter sample (1 = plain emitter sampling) */
+        m_risCandidates = props.getSize("risCandidates", 1);
+        if (m_risCandidates == 0)
+            Log(EError, "The 'risCandidates' parameter must be positive!");
         Assert(m_emitterSamples + m_bsdfSamples > 0);
     }
 
@@ -114,6 +132,7 @@ public:
         m_bsdfSamples = stream->readSize();
         m_strictNormals = stream->readBool();
         m_hideEmitters = stream->readBool();
+        m_risCandidates = stream->readSize();
         configure();
     }
 
@@ -123,6 +142,7 @@ public:
         stream->writeSize(m_bsdfSamples);
         stream->writeBool(m_strictNormals);
         stream->writeBool(m_hideEmitters);
+        stream->writeSize(m_risCandidates);
     }
 
     void configure() {
@@ -143,6 +163,21 @@ public:
             sampler->request2DArray(m_bsdfSamples);
     }
 
+    void renderBlock(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points) const {
+        /* Trace the sensor rays of neighboring pixels together */
+        renderBlockStream(scene, sensor, sampler, block, stop, points);
+    }
+
+    void renderBlockSamples(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points,
+            size_t firstSample, size_t sampleCount) const {
+        renderBlockStream(scene, sensor, sampler, block, stop, points,
+            firstSample, sampleCount);
+    }
+
     Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
         /* Some aliases and local variables */
         const Scene *scene = rRec.scene;
@@ -219,28 +254,12 @@ public:
                BSDF has smooth (i.e. non-Dirac delta) component */
             for (size_t i=0; i<numDirectSamples; ++i) {
                 /* Estimate the direct illumination if this is requested */
-                Spectrum value = scene->sampleEmitterDirect(dRec, sampleArray[i]);
-                if (!value.isZero()) {
-                    const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
-
-                    /* Allocate a record for querying the BSDF */
-                    BSDFSamplingRecord bRec(its, its.toLocal(dRec.d));
-
-                    /* Evaluate BSDF * cos(theta) */
-                    const Spectrum bsdfVal = bsdf->eval(bRec);
-
-                    if (!bsdfVal.isZero() && (!m_strictNormals
-                            || dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) > 0)) {
-                        /* Calculate prob. of sampling that direction using BSDF sampling */
-                        Float bsdfPdf = emitter->isOnSurface() ? bsdf->pdf(bRec) : 0;
-
-                        /* Weight using the power heuristic */
-                        const Float weight = miWeight(dRec.pdf * fracLum,
-                                bsdfPdf * fracBSDF) * weightLum;
-
-                        Li += value * bsdfVal * weight;
-                    }
-                }
+                if (m_risCandidates > 1)
+                    Li += sampleEmitterRIS(rRec, bsdf, sampleArray[i],
+                        fracLum, fracBSDF) * weightLum;
+                else
+                    Li += sampleEmitter(scene, its, bsdf, dRec, sampleArray[i],
+                        fracLum, fracBSDF, true) * weightLum;
             }
         }
 
@@ -260,7 +279,7 @@ public:
             Float bsdfPdf;
 
             BSDFSamplingRecord bRec(its, rRec.sampler, ERadiance);
-            Spectrum bsdfVal = bsdf->sample(bRec, bsdfPdf, sampleArray[i]);
+            Spectrum bsdfVal = MTS_HOTPATH_TIMED(bsdfSample, bsdf->sample(bRec, bsdfPdf, sampleArray[i]));
             if (bsdfVal.isZero())
                 continue;
 
@@ -308,6 +327,84 @@ public:
         return Li;
     }
 
+    /**
+     * \brief Sample an emitter and return its MIS-weighted contribution
+     * (i.e. the emitted radiance times BSDF * cos(theta), divided by the
+     * sample probability). The shadow ray is optional.
+     */
+    inline Spectrum sampleEmitter(const Scene *scene, const Intersection &its,
+            const BSDF *bsdf, DirectSamplingRecord &dRec, const Point2 &sample,
+            Float fracLum, Float fracBSDF, bool testVisibility) const {
+        Spectrum value = scene->sampleEmitterDirect(dRec, sample, testVisibility);
+        if (value.isZero())
+            return Spectrum(0.0f);
+
+        const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+
+        /* Allocate a record for querying the BSDF */
+        BSDFSamplingRecord bRec(its, its.toLocal(dRec.d));
+
+        /* Evaluate BSDF * cos(theta) and, when needed for MIS, the
+           prob. of sampling that direction using BSDF sampling */
+        Float bsdfPdf = 0;
+        const Spectrum bsdfVal = MTS_HOTPATH_TIMED(bsdfEval, emitter->isOnSurface()
+            ? bsdf->evalWithPdf(bRec, bsdfPdf) : bsdf->eval(bRec));
+
+        if (bsdfVal.isZero() || (m_strictNormals
+                && dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) <= 0))
+            return Spectrum(0.0f);
+
+        /* Weight using the power heuristic */
+        return value * bsdfVal * miWeight(dRec.pdf * fracLum, bsdfPdf * fracBSDF);
+    }
+
+    /**
+     * \brief Resampled importance sampling of the emitters
+     *
+     * Draws \c m_risCandidates candidates with \ref sampleEmitter() (without
+     * shadow rays) and selects one of them proportionally to the luminance of
+     * its contribution using a single-sample reservoir. Only the selected one
+     * is tested for visibility. Its contribution is rescaled by the average
+     * candidate weight divided by its own weight, which keeps the estimate
+     * unbiased. The first candidate uses \c sample, the others draw their
+     * random numbers from the sampler.
+     */
+    Spectrum sampleEmitterRIS(RadianceQueryRecord &rRec, const BSDF *bsdf,
+            const Point2 &sample, Float fracLum, Float fracBSDF) const {
+        const Scene *scene = rRec.scene;
+        const Intersection &its = rRec.its;
+
+        DirectSamplingRecord selected(its);
+        Spectrum selectedValue(0.0f);
+        Float selectedWeight = 0, weightSum = 0;
+
+        for (size_t i=0; i<m_risCandidates; ++i) {
+            DirectSamplingRecord dRec(its);
+            Spectrum value = sampleEmitter(scene, its, bsdf, dRec,
+                i == 0 ? sample : rRec.nextSample2D(), fracLum, fracBSDF, false);
+            Float weight = value.getLuminance();
+            if (!(weight > 0))
+                continue;
+
+            weightSum += weight;
+            if (rRec.nextSample1D() * weightSum < weight) {
+                selected = dRec;
+                selectedValue = value;
+                selectedWeight = weight;
+            }
+        }
+
+        if (selectedWeight == 0)
+            return Spectrum(0.0f);
+
+        Ray ray(selected.ref, selected.d, Epsilon,
+            selected.dist*(1-ShadowEpsilon), selected.time);
+        if (scene->rayIntersect(ray))
+            return Spectrum(0.0f);
+
+        return selectedValue * (weightSum / (selectedWeight * m_risCandidates));
+    }
+
     inline Float miWeight(Float pdfA, Float pdfB) const {
         pdfA *= pdfA; pdfB *= pdfB;
         return pdfA / (pdfA + pdfB);
@@ -318,6 +415,7 @@ public:
         oss << "MIDirectIntegrator[" << endl
             << "  emitterSamples = " << m_emitterSamples << "," << endl
             << "  bsdfSamples = " << m_bsdfSamples << "," << endl
+            << "  risCandidates = " << m_risCandidates << "," << endl
             << "  strictNormals = " << m_strictNormals << endl
             << "]";
         return oss.str();
@@ -327,6 +425,7 @@ public:
 private:
     size_t m_emitterSamples;
     size_t m_bsdfSamples;
+    size_t m_risCandidates;
     Float m_fracBSDF, m_fracLum;
     Float m_weightBSDF, m_weightLum;
     bool m_strictNormals;
@@ -25,7 +25,7 @@
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{erpt}{Energy redistribution path tracing}
- * \order{11}
+ * \order{12}
  * \parameters{
  *     \parameter{maxDepth}{\Integer}{Specifies the longest path depth
  *         in the generated output image (where \code{-1} corresponds to $\infty$).
@@ -41,6 +41,11 @@ MTS_NAMESPACE_BEGIN
  *         How many Markov Chains should be started \emph{at most} (per
  *         pixel) \default{\code{0}, i.e. this feature is not used}
  *     }
+ *     \parameter{adaptiveChains}{\Boolean}{
+ *         Start more chains in pixels whose seed paths have a high
+ *         relative variance, and fewer in smooth regions (see below)
+ *         \default{\code{false}}
+ *     }
  *     \parameter{chainLength}{\Integer}{
  *         Specifies the number of perturbation steps that are executed per Markov Chain\default{1}.
  *     }
@@ -62,6 +67,10 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{lambda}{\Float}{
  *         Jump size of the manifold perturbation \default{\code{50}}}
+ *     \parameter{seedFile}{\String}{
+ *        File for reusing the average luminance of a previous rendering.
+ *        See \pluginref{pssmlt} for details. \default{none}
+ *     }
  * }
  * \renderings{
  *  \rendering{A brass chandelier with 24 glass-enclosed bulbs}{integrator_mept_luminaire}
@@ -123,6 +132,14 @@ MTS_NAMESPACE_BEGIN
  * Chain is created that has an initial configuration matching the seed path.
  * It is simulated for \code{chainLength} iterations, and each intermediate
  * state is recorded in the output image.
+ *
+ * When \code{adaptiveChains} is enabled, the expected number of chains is
+ * additionally scaled (by a factor between $1/4$ and $4$) according to the
+ * relative standard deviation of the energy seeded by the samples of the
+ * neighboring pixels, compared to the average over all pixels rendered so
+ * far by the same worker. Since the deposition energy of every chain is
+ * divided by the expected number of chains, this doesn't introduce bias.
+ * The seed pool of a pixel must contain at least two samples.
  */
 class EnergyRedistributionPathTracing : public Integrator {
 public:
@@ -134,6 +151,9 @@ public:
         m_config.numChains = props.getFloat("numChains", 1.0f);
         m_config.maxChains = props.getInteger("maxChains", 0);
 
+        /* Allocate the chains adaptively based on the variance of the seeds */
+        m_config.adaptiveChains = props.getBoolean("adaptiveChains", false);
+
         /* Specifies the number of mutations to be performed in each
            Markov Chain */
         m_config.chainLength = props.getInteger("chainLength", 100);
@@ -167,6 +187,9 @@ public:
         m_config.avgAngleChangeSurface = props.getFloat("avgAngleChangeSurface", 0);
         m_config.avgAngleChangeMedium = props.getFloat("avgAngleChangeMedium", 0);
 
+        /* Optional file for reusing the luminance estimate of a previous run */
+        m_seedFile = props.getString("seedFile", "");
+
         if (m_config.maxDepth <= 0 && m_config.maxDepth != -1)
             Log(EError, "'maxDepth' must be set to -1 (infinite) or a value greater than zero!");
     }
@@ -231,7 +254,7 @@ public:
             m_config.separateDirect, true, true);
 
         m_config.luminance = pathSampler->computeAverageLuminance(
-                m_config.luminanceSamples);
+                sceneResID, m_config.luminanceSamples, m_seedFile);
         m_config.blockSize = scene->getBlockSize();
 
         m_config.dump();
@@ -276,6 +299,7 @@ public:
 private:
     ref<ParallelProcess> m_process;
     ref<RenderJob> m_nestedJob;
+    fs::path m_seedFile;
     ERPTConfiguration m_config;
 };
 
@@ -51,6 +51,7 @@ struct ERPTConfiguration {
     Float avgAngleChangeSurface;
     Float avgAngleChangeMedium;
     int maxChains;
+    bool adaptiveChains;
 
     inline ERPTConfiguration() { }
 
@@ -69,7 +70,8 @@ struct ERPTConfiguration {
         SLog(EDebug, "ERPT configuration:");
         SLog(EDebug, "   Maximum path length         : %i", maxDepth);
         SLog(EDebug, "   Chain length                : " SIZE_T_FMT, chainLength);
-        SLog(EDebug, "   Average number of chains    : %f", numChains);
+        SLog(EDebug, "   Average number of chains    : %f%s", numChains,
+            adaptiveChains ? " (adaptive)" : "");
         SLog(EDebug, "   Separate direct illum.      : %s",
             separateDirect ? formatString("%i samples", directSamples).c_str() : "no");
         SLog(EDebug, "   Active mutators             : %s", oss.str().c_str());
@@ -100,6 +102,7 @@ struct ERPTConfiguration {
         avgAngleChangeSurface = stream->readFloat();
         avgAngleChangeMedium = stream->readFloat();
         maxChains = stream->readInt();
+        adaptiveChains = stream->readBool();
     }
 
     inline void serialize(Stream *stream) const {
@@ -120,6 +123,7 @@ struct ERPTConfiguration {
         stream->writeFloat(avgAngleChangeSurface);
         stream->writeFloat(avgAngleChangeMedium);
         stream->writeInt(maxChains);
+        stream->writeBool(adaptiveChains);
     }
 };
 
@@ -65,14 +65,19 @@ public:
 /*                         Worker implementation                        */
 /* ==================================================================== */
 
+/// Range of the per-pixel chain count scale factor (adaptive mode)
+#define ERPT_MIN_CHAIN_SCALE 0.25f
+#define ERPT_MAX_CHAIN_SCALE 4.0f
+
 class ERPTRenderer : public WorkProcessor {
 public:
     ERPTRenderer(const ERPTConfiguration &conf)
-        : m_config(conf) {
+        : m_config(conf), m_chainScale(1), m_errorSum(0), m_errorCount(0) {
     }
 
     ERPTRenderer(Stream *stream, InstanceManager *manager)
-        : WorkProcessor(stream, manager) {
+        : WorkProcessor(stream, manager), m_chainScale(1),
+          m_errorSum(0), m_errorCount(0) {
         m_config = ERPTConfiguration(stream);
     }
 
@@ -154,7 +159,9 @@ public:
         }
 #endif
 
-        Float meanChains = m_config.numChains * weight
+        m_sampleEnergy += weight;
+
+        Float meanChains = m_config.numChains * weight * m_chainScale
             / (m_config.luminance * m_sampler->getSampleCount());
 
         /* Optional: do not launch too many chains if this is desired by the user */
@@ -301,6 +308,10 @@ public:
         boost::function<void (int, int, Float, Path &)> callback
             = boost::bind(&ERPTRenderer::pathCallback, this, _1, _2, _3, _4, &stop);
 
+        bool adaptive = m_config.adaptiveChains && m_sampler->getSampleCount() > 1;
+        Float localError = -1;
+        m_chainScale = 1;
+
         for (size_t i=0; i<m_hilbertCurve.getPointCount(); ++i) {
             if (stop)
                 break;
@@ -310,10 +321,32 @@ public:
             Point2i offset = Point2i(m_hilbertCurve[i]) + Vector2i(rect->getOffset());
             m_sampler->generate(offset);
 
+            /* Running mean and variance of the energy seeded per sample */
+            Float mean = 0, m2 = 0;
             for (size_t j = 0; j<m_sampler->getSampleCount(); j++) {
+                m_sampleEnergy = 0;
                 m_pathSampler->samplePaths(offset, callback);
                 m_sampler->advance();
+
+                Float delta = m_sampleEnergy - mean;
+                mean += delta / (j+1);
+                m2 += delta * (m_sampleEnergy - mean);
             }
+
+            if (!adaptive)
+                continue;
+
+            /* Consecutive points of the Hilbert curve are neighbors, hence
+               the smoothed error of the last pixels predicts the next one */
+            Float error = mean > 0 ? std::sqrt(std::max((Float) 0,
+                m2 / (m_sampler->getSampleCount() - 1))) / mean : (Float) 0;
+            localError = localError < 0 ? error : 0.5f * (localError + error);
+            m_errorSum += error;
+            m_errorCount++;
+
+            Float avgError = m_errorSum / m_errorCount;
+            m_chainScale = avgError > 0 ? math::clamp(localError / avgError,
+                (Float) ERPT_MIN_CHAIN_SCALE, (Float) ERPT_MAX_CHAIN_SCALE) : (Float) 1;
         }
 
         if (!m_pool->unused())
@@ -336,6 +369,14 @@ private:
     HilbertCurve2D<uint8_t> m_hilbertCurve;
     ERPTWorkResult *m_result;
     MemoryPool *m_pool;
+
+    /* Adaptive chain allocation: scale of the expected number of chains
+       in the current pixel, energy seeded by the current sample, and the
+       average relative error over the pixels rendered by this worker */
+    Float m_chainScale;
+    Float m_sampleEnergy;
+    Float m_errorSum;
+    size_t m_errorCount;
 };
 
 /* ==================================================================== */
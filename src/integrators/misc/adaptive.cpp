@@ -23,7 +23,7 @@
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{adaptive}{Adaptive integrator}
- * \order{13}
+ * \order{14}
  * \parameters{
  *     \parameter{maxError}{\Float}{Maximum relative error
  *         threshold\default{0.05}}
@@ -165,6 +165,13 @@ public:
         return true;
     }
 
+    void renderBlockSamples(const Scene *, const Sensor *,
+            Sampler *, ImageBlock *, const bool &,
+            const std::vector< TPoint2<uint8_t> > &, size_t, size_t) const {
+        Log(EError, "The adaptive integrator chooses its own sample counts "
+            "and cannot be used in progressive mode!");
+    }
+
     void renderBlock(const Scene *scene, const Sensor *sensor,
             Sampler *sampler, ImageBlock *block, const bool &stop,
             const std::vector< TPoint2<uint8_t> > &points) const {
@@ -184,8 +191,9 @@ public:
             std::sqrt((Float) sampler->getSampleCount());
 
         Point2 apertureSample(0.5f);
-        Float timeSample = 0.5f;
-        int borderSize = sensor->getFilm()->getReconstructionFilter()->getBorderSize();
+        Float timeSample = 0.5f, filterWeight;
+        const ReconstructionFilter *rfilter = sensor->getFilm()->getReconstructionFilter();
+        int borderSize = rfilter->getBorderSize();
 
         size_t sampleCount;
         block->clear();
@@ -219,7 +227,8 @@ public:
                 rRec.newQuery(RadianceQueryRecord::ESensorRay, sensor->getMedium());
                 rRec.extra = RadianceQueryRecord::EAdaptiveQuery;
 
-                Point2 samplePos(Point2(offset) + Vector2(rRec.nextSample2D()));
+                Point2 samplePos(rfilter->samplePosition(offset,
+                    rRec.nextSample2D(), filterWeight));
                 if (needsApertureSample)
                     apertureSample = rRec.nextSample2D();
                 if (needsTimeSample)
@@ -232,7 +241,10 @@ public:
                 sampleValue *= m_subIntegrator->Li(eyeRay, rRec);
 
                 Float sampleLuminance;
-                if (block->put(samplePos, sampleValue, rRec.alpha)) {
+                bool valid = rfilter->isImportanceSampled()
+                    ? block->putPixel(offset, sampleValue, rRec.alpha, filterWeight)
+                    : block->put(samplePos, sampleValue, rRec.alpha);
+                if (valid) {
                     /* Check for problems with the sample */
                     sampleLuminance = sampleValue.getLuminance();
                 } else {
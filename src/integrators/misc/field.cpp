@@ -18,13 +18,21 @@
 
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/renderproc.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/hw/session.h>
+#include <mitsuba/hw/device.h>
+#include <mitsuba/hw/renderer.h>
+#include <mitsuba/hw/gputexture.h>
+#include <mitsuba/hw/gpuprogram.h>
+#include <mitsuba/hw/gpugeometry.h>
 
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{field}{Field extraction integrator}
- * \order{17}
+ * \order{18}
  * \parameters{
- *     \parameter{field}{\String}{Denotes the name of the field that should be extracted.
+ *     \parameter{field}{\String}{Denotes the name of the field that should be extracted,
+ *        or a comma-separated list of several fields (see below).
  *        The following choices are possible:
  *        \begin{itemize}
  *            \setlength{\itemsep}{1pt}
@@ -42,6 +50,10 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{undefined}{\Spectrum\Or\Float}{Value that should be returned when
  *                           there is no intersection \default{0}}
+ *     \parameter{hardware}{\Boolean}{Rasterize the triangle meshes of the scene
+ *        on the graphics card instead of tracing rays (see below) \default{\code{false}}}
+ *     \parameter{tileSize}{\Integer}{Size of the tiles that are rasterized
+ *        in hardware mode \default{2048}}
  * }
  *
  * This integrator extracts a requested field of from the intersection records of shading
@@ -50,6 +62,37 @@ MTS_NAMESPACE_BEGIN
  * of surfaces seen by the camera) into extra channels of a rendered image, for instance to
  * create benchmark data for computer vision applications.
  * Please refer to the documentation of \pluginref{multichannel} for an example.
+ *
+ * When \code{field} lists several fields, the integrator must be used on its own
+ * (i.e. not nested in \pluginref{multichannel}). It then produces all of them from a
+ * single intersection per sample and writes them into consecutive channels of the film,
+ * using the same layout as \pluginref{multichannel}. Instead of nesting one \pluginref{field}
+ * instance per channel (which traces the same sensor ray once per field), one can thus write
+ * \begin{xml}
+ * <integrator type="field">
+ *     <string name="field" value="shNormal, distance, uv"/>
+ * </integrator>
+ * <sensor type="perspective">
+ *     <film type="hdrfilm">
+ *         <string name="pixelFormat" value="rgb, luminance, rgb"/>
+ *         <string name="channelNames" value="normal, distance, uv"/>
+ *     </film>
+ * </sensor>
+ * \end{xml}
+ *
+ * Extracting fields from very large images with the default ray tracing
+ * approach can take a while. When \code{hardware} is set to \code{true},
+ * the integrator instead rasterizes all triangle meshes using OpenGL
+ * (like the \pluginref{vpl} integrator) in tiles of \code{tileSize}
+ * pixels and writes the result straight into the film. Pixels that might
+ * see any other kind of shape (e.g. analytic spheres, instances or hair),
+ * as determined by its projected bounding box, are still ray traced, so
+ * the output matches the ray traced fields. Hardware mode takes a single
+ * sample at the center of every pixel, and requires a perspective or
+ * orthographic camera without depth of field. It is ignored when the
+ * integrator is nested in \pluginref{multichannel}, for the
+ * \code{albedo} field, and for other camera types (with a warning).
+ * Primitive indices are exact up to $2^{24}$ triangles per mesh.
  */
 
 class FieldIntegrator : public SamplingIntegrator {
@@ -67,31 +110,11 @@ public:
     };
 
     FieldIntegrator(const Properties &props) : SamplingIntegrator(props) {
-        std::string field = props.getString("field");
-
-        if (field == "position") {
-            m_field = EPosition;
-        } else if (field == "relPosition") {
-            m_field = ERelativePosition;
-        } else if (field == "distance") {
-            m_field = EDistance;
-        } else if (field == "geoNormal") {
-            m_field = EGeometricNormal;
-        } else if (field == "shNormal") {
-            m_field = EShadingNormal;
-        } else if (field == "uv") {
-            m_field = EUV;
-        } else if (field == "albedo") {
-            m_field = EAlbedo;
-        } else if (field == "shapeIndex") {
-            m_field = EShapeIndex;
-        } else if (field == "primIndex") {
-            m_field = EPrimIndex;
-        } else {
-            Log(EError, "Invalid 'field' parameter. Must be one of 'position', "
-                "'relPosition', 'distance', 'geoNormal', 'shNormal', "
-                "'primIndex', 'shapeIndex', or 'uv'!");
-        }
+        std::vector<std::string> fields = tokenize(props.getString("field"), ", ");
+        for (size_t i=0; i<fields.size(); ++i)
+            m_fields.push_back(parseField(fields[i]));
+        if (m_fields.empty())
+            Log(EError, "The 'field' parameter must name at least one field!");
 
         if (props.hasProperty("undefined")) {
             if (props.getType("undefined") == Properties::EFloat)
@@ -102,34 +125,86 @@ public:
             m_undefined = Spectrum(0.0f);
         }
 
-        if (SPECTRUM_SAMPLES != 3 && (m_field == EUV || m_field == EShadingNormal || m_field == EGeometricNormal
-                || m_field == ERelativePosition || m_field == EPosition)) {
-            Log(EError, "The field integrator implementation requires renderings to be done in RGB when "
-                    "extracting positional data or surface normals / UV coordinates.");
+        m_hardware = props.getBoolean("hardware", false);
+        m_tileSize = props.getInteger("tileSize", 2048);
+        if (m_tileSize <= 0)
+            Log(EError, "The 'tileSize' parameter must be positive!");
+        m_cancel = false;
+
+        for (size_t i=0; i<m_fields.size(); ++i) {
+            EField field = m_fields[i];
+            if (SPECTRUM_SAMPLES != 3 && (field == EUV || field == EShadingNormal || field == EGeometricNormal
+                    || field == ERelativePosition || field == EPosition)) {
+                Log(EError, "The field integrator implementation requires renderings to be done in RGB when "
+                        "extracting positional data or surface normals / UV coordinates.");
+            }
         }
+        m_field = m_fields[0];
     }
 
     FieldIntegrator(Stream *stream, InstanceManager *manager)
      : SamplingIntegrator(stream, manager) {
-         m_field = (EField) stream->readInt();
+         m_fields.resize(stream->readSize());
+         for (size_t i=0; i<m_fields.size(); ++i)
+             m_fields[i] = (EField) stream->readInt();
+         m_field = m_fields[0];
          m_undefined = Spectrum(stream);
+         /* Hardware rendering always happens locally */
+         m_hardware = false;
+         m_tileSize = 0;
+         m_cancel = false;
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         SamplingIntegrator::serialize(stream, manager);
-        stream->writeInt((int) m_field);
+        stream->writeSize(m_fields.size());
+        for (size_t i=0; i<m_fields.size(); ++i)
+            stream->writeInt((int) m_fields[i]);
         m_undefined.serialize(stream);
     }
 
+    void renderBlock(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points) const {
+        if (m_fields.size() > 1) {
+            renderBlockFields(scene, sensor, sampler, block, stop, points,
+                0, sampler->getSampleCount());
+            return;
+        }
+        /* Trace the sensor rays of neighboring pixels together */
+        renderBlockStream(scene, sensor, sampler, block, stop, points);
+    }
+
+    void renderBlockSamples(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points,
+            size_t firstSample, size_t sampleCount) const {
+        if (m_fields.size() > 1) {
+            renderBlockFields(scene, sensor, sampler, block, stop, points,
+                firstSample, sampleCount);
+            return;
+        }
+        renderBlockStream(scene, sensor, sampler, block, stop, points,
+            firstSample, sampleCount);
+    }
+
     Spectrum Li(const RayDifferential &ray, RadianceQueryRecord &rRec) const {
-        Spectrum result(m_undefined);
+        if (EXPECT_NOT_TAKEN(m_fields.size() > 1))
+            Log(EError, "A field integrator with several fields cannot be "
+                "nested in another integrator!");
 
         if (!rRec.rayIntersect(ray))
-            return result;
+            return m_undefined;
 
-        Intersection &its = rRec.its;
+        return evalField(m_field, rRec);
+    }
 
-        switch (m_field) {
+    /// Extract a field from the intersection record of a query
+    Spectrum evalField(EField field, const RadianceQueryRecord &rRec) const {
+        const Intersection &its = rRec.its;
+        Spectrum result;
+
+        switch (field) {
             case EPosition:
                 result.fromLinearRGB(its.p.x, its.p.y, its.p.z);
                 break;
@@ -176,14 +251,552 @@ public:
         return result;
     }
 
+    void cancel() {
+        m_cancel = true;
+        SamplingIntegrator::cancel();
+    }
+
+    bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        if (m_fields.size() > 1) {
+            if (m_hardware)
+                Log(EWarn, "Hardware field extraction only supports a single "
+                    "field -- falling back to ray tracing.");
+            return renderFields(scene, queue, job, sceneResID,
+                sensorResID, samplerResID);
+        }
+
+        if (m_hardware) {
+            const Sensor *sensor = scene->getSensor();
+            if (m_field == EAlbedo) {
+                Log(EWarn, "The 'albedo' field requires BSDF evaluations and "
+                    "cannot be rasterized -- falling back to ray tracing.");
+            } else if (!sensor->getClass()->derivesFrom(MTS_CLASS(ProjectiveCamera))
+                    || !(sensor->getType() & (Sensor::EPerspectiveCamera
+                        | Sensor::EOrthographicCamera))
+                    || sensor->needsApertureSample()) {
+                Log(EWarn, "Hardware field extraction requires a perspective or "
+                    "orthographic camera without depth of field -- falling "
+                    "back to ray tracing.");
+            } else {
+                return renderHardware(scene, job);
+            }
+        }
+
+        return SamplingIntegrator::render(scene, queue, job,
+            sceneResID, sensorResID, samplerResID);
+    }
+
     std::string toString() const {
         return "FieldIntegrator[]";
     }
 
     MTS_DECLARE_CLASS()
+protected:
+    /// Convert the name of a field into the corresponding enumeration value
+    static EField parseField(const std::string &field) {
+        if (field == "position") {
+            return EPosition;
+        } else if (field == "relPosition") {
+            return ERelativePosition;
+        } else if (field == "distance") {
+            return EDistance;
+        } else if (field == "geoNormal") {
+            return EGeometricNormal;
+        } else if (field == "shNormal") {
+            return EShadingNormal;
+        } else if (field == "uv") {
+            return EUV;
+        } else if (field == "albedo") {
+            return EAlbedo;
+        } else if (field == "shapeIndex") {
+            return EShapeIndex;
+        } else if (field == "primIndex") {
+            return EPrimIndex;
+        } else {
+            SLog(EError, "Invalid 'field' parameter \"%s\". Must be one of 'position', "
+                "'relPosition', 'distance', 'geoNormal', 'shNormal', 'albedo', "
+                "'primIndex', 'shapeIndex', or 'uv'!", field.c_str());
+            return EPosition;
+        }
+    }
+
+    /// Render several fields into the consecutive channels of the film
+    bool renderFields(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        ref<Scheduler> sched = Scheduler::getInstance();
+        ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
+        ref<Film> film = sensor->getFilm();
+
+        size_t nCores = sched->getCoreCount();
+        const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
+        size_t sampleCount = sampler->getSampleCount();
+
+        Log(EInfo, "Starting render job (%ix%i, " SIZE_T_FMT " %s, " SIZE_T_FMT
+            " %s, " SIZE_T_FMT " fields) ..", film->getCropSize().x, film->getCropSize().y,
+            sampleCount, sampleCount == 1 ? "sample" : "samples", nCores,
+            nCores == 1 ? "core" : "cores", m_fields.size());
+
+        ref<BlockedRenderProcess> proc = new BlockedRenderProcess(job,
+            queue, scene->getBlockSize());
+        proc->setBlockOrder(scene->getBlockOrder());
+        proc->setPixelFormat(Bitmap::EMultiSpectrumAlphaWeight,
+            (int) (m_fields.size() * SPECTRUM_SAMPLES + 2), false);
+
+        int integratorResID = sched->registerResource(this);
+        proc->bindResource("integrator", integratorResID);
+        proc->bindResource("scene", sceneResID);
+        proc->bindResource("sensor", sensorResID);
+        proc->bindResource("sampler", samplerResID);
+        scene->bindUsedResources(proc);
+        bindUsedResources(proc);
+        sched->schedule(proc);
+
+        m_process = proc;
+        sched->wait(proc);
+        m_process = NULL;
+        sched->unregisterResource(integratorResID);
+
+        return proc->getReturnStatus() == ParallelProcess::ESuccess;
+    }
+
+    /// Extract all fields from a single intersection per sample
+    void renderBlockFields(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points,
+            size_t firstSample, size_t sampleCount) const {
+        sampleCount = std::min(sampleCount, sampler->getSampleCount() - firstSample);
+        Float diffScaleFactor = 1.0f /
+            std::sqrt((Float) sampler->getSampleCount());
+
+        bool needsApertureSample = sensor->needsApertureSample();
+        bool needsTimeSample = sensor->needsTimeSample();
+        const ReconstructionFilter *rfilter = sensor->getFilm()->getReconstructionFilter();
+
+        RadianceQueryRecord rRec(scene, sampler);
+        Point2 apertureSample(0.5f);
+        Float timeSample = 0.5f, filterWeight;
+        RayDifferential sensorRay;
+
+        block->clear();
+
+        uint32_t queryType = RadianceQueryRecord::ESensorRay;
+        Float *temp = (Float *) alloca(sizeof(Float) * (m_fields.size() * SPECTRUM_SAMPLES + 2));
+
+        for (size_t i = 0; i<points.size(); ++i) {
+            Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
+            if (stop)
+                break;
+
+            sampler->generate(offset);
+            if (firstSample > 0)
+                sampler->setSampleIndex(firstSample);
+
+            for (size_t j = 0; j<sampleCount; j++) {
+                rRec.newQuery(queryType, sensor->getMedium());
+                Point2 samplePos(rfilter->samplePosition(offset,
+                    rRec.nextSample2D(), filterWeight));
+
+                if (needsApertureSample)
+                    apertureSample = rRec.nextSample2D();
+
+                if (needsTimeSample)
+                    timeSample = rRec.nextSample1D();
+
+                Spectrum spec = sensor->sampleRayDifferential(
+                    sensorRay, samplePos, apertureSample, timeSample);
+
+                sensorRay.scaleDifferential(diffScaleFactor);
+                bool hit = rRec.rayIntersect(sensorRay);
+
+                int channel = 0;
+                for (size_t k = 0; k<m_fields.size(); ++k) {
+                    Spectrum result = spec * (hit ? evalField(m_fields[k], rRec) : m_undefined);
+                    for (int l = 0; l<SPECTRUM_SAMPLES; ++l)
+                        temp[channel++] = result[l];
+                }
+                temp[channel++] = rRec.alpha;
+                temp[channel] = 1.0f;
+                if (rfilter->isImportanceSampled())
+                    block->putPixel(offset, temp, filterWeight);
+                else
+                    block->put(samplePos, temp);
+                sampler->advance();
+            }
+        }
+    }
+
+    /// Rasterize the triangle meshes and ray trace the remaining shapes
+    bool renderHardware(Scene *scene, const RenderJob *job) {
+        const ProjectiveCamera *sensor =
+            static_cast<const ProjectiveCamera *>(scene->getSensor());
+        Film *film = scene->getFilm();
+        const ref_vector<Shape> &shapes = scene->getShapes();
+        const Vector2i &cropSize = film->getCropSize();
+        const Point2i &cropOffset = film->getCropOffset();
+        bool directional = sensor->getType() & Sensor::EOrthographicCamera;
+        m_cancel = false;
+
+        /* Use the same (centered) camera sample as rays traced below */
+        Float time = sensor->getShutterOpen() + 0.5f * sensor->getShutterOpenTime();
+        const Transform &cameraToWorld = sensor->getWorldTransform()->eval(time);
+        Transform worldToCamera = cameraToWorld.inverse();
+        Transform projTransform = sensor->getProjectionTransform(Point2(0.5f), Point2(0.5f));
+
+        /* Clip space transformation that matches GLRenderer::setCamera() */
+        Matrix4x4 clip = (projTransform * Transform::scale(Vector(-1, 1, -1))
+            * worldToCamera).getMatrix();
+
+        /* Find the image regions that may see shapes other than triangle meshes */
+        std::vector<std::pair<Point2i, Point2i> > traced;
+        std::vector<const TriMesh *> meshes;
+        std::vector<Float> meshIndices;
+        for (size_t i=0; i<shapes.size(); ++i) {
+            const Shape *shape = shapes[i].get();
+            if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+                meshes.push_back(static_cast<const TriMesh *>(shape));
+                meshIndices.push_back((Float) i);
+                continue;
+            }
+            std::pair<Point2i, Point2i> rect;
+            if (projectBounds(shape->getAABB(), clip, cropSize, rect))
+                traced.push_back(rect);
+        }
+
+        Log(EInfo, "Rasterizing %i triangle meshes (%i shapes are ray traced)",
+            (int) meshes.size(), (int) (shapes.size() - meshes.size()));
+
+        ref<Session> session = Session::create();
+        ref<Device> device = Device::create(session);
+        ref<Renderer> renderer = Renderer::create(session);
+        int tileSize = m_tileSize;
+
+        MTS_AUTORELEASE_BEGIN()
+        session->init();
+        device->setSize(Vector2i(tileSize));
+        device->init();
+        device->setVisible(false);
+        renderer->init(device);
+
+        const RendererCapabilities *caps = renderer->getCapabilities();
+        if (!caps->isSupported(RendererCapabilities::EShadingLanguage))
+            Log(EError, "Support for GLSL is required!");
+        if (!caps->isSupported(RendererCapabilities::ERenderToTexture))
+            Log(EError, "Render-to-texture support is required!");
+        if (!caps->isSupported(RendererCapabilities::EFloatingPointBuffer))
+            Log(EError, "Floating point render buffer support is required!");
+        if (!caps->isSupported(RendererCapabilities::EVertexBufferObjects))
+            Log(EError, "Vertex buffer object support is required!");
+        if (!caps->isSupported(RendererCapabilities::EGeometryShaders))
+            Log(EError, "Geometry shader support is required!");
+
+        ref<GPUTexture> framebuffer = renderer->createGPUTexture("Field buffer", NULL);
+        framebuffer->setFrameBufferType(GPUTexture::EColorAndDepthBuffer);
+        framebuffer->setComponentFormat(GPUTexture::EFloat32);
+        framebuffer->setPixelFormat(GPUTexture::ERGBA);
+        framebuffer->setSize(Point3i(tileSize, tileSize, 1));
+        framebuffer->setFilterType(GPUTexture::ENearest);
+        framebuffer->setMipMapped(false);
+        framebuffer->init();
+
+        ref<GPUProgram> program = createProgram(renderer, directional);
+        int param_shapeIndex = program->getParameterID("shapeIndex", false);
+        int param_hasNormals = program->getParameterID("hasNormals", false);
+        int param_hasUVs = program->getParameterID("hasUVs", false);
+
+        std::vector<GPUGeometry *> geometry(meshes.size());
+        for (size_t i=0; i<meshes.size(); ++i)
+            geometry[i] = renderer->registerGeometry(meshes[i]);
+
+        ref<Bitmap> tile = new Bitmap(Bitmap::ERGBA, Bitmap::EFloat32, Vector2i(tileSize));
+        ref<ImageBlock> block = new ImageBlock(Bitmap::ESpectrumAlphaWeight,
+            Vector2i(tileSize), NULL);
+        std::vector<uint8_t> traceMask((size_t) tileSize * (size_t) tileSize);
+        const int channels = SPECTRUM_SAMPLES + 2;
+        bool scalarField = m_field == EDistance || m_field == EShapeIndex
+            || m_field == EPrimIndex;
+
+        Vector2i tiles(
+            (cropSize.x + tileSize - 1) / tileSize,
+            (cropSize.y + tileSize - 1) / tileSize);
+        ProgressReporter progress("Rendering", tiles.x * tiles.y, job);
+
+        for (int ty=0; ty<tiles.y && !m_cancel; ++ty) {
+            for (int tx=0; tx<tiles.x && !m_cancel; ++tx) {
+                Point2i offset(tx * tileSize, ty * tileSize);
+                Vector2i size(
+                    std::min(tileSize, cropSize.x - offset.x),
+                    std::min(tileSize, cropSize.y - offset.y));
+
+                /* Zoom the projection into the tile. Rows of the downloaded
+                   texture start at the top, like the film */
+                Float scaleX = cropSize.x / (Float) tileSize,
+                      scaleY = cropSize.y / (Float) tileSize;
+                Float centerX = (2 * offset.x + tileSize) / (Float) cropSize.x - 1,
+                      centerY = 1 - (2 * offset.y + tileSize) / (Float) cropSize.y;
+                Transform tileTransform =
+                    Transform::scale(Vector(scaleX, scaleY, 1)) *
+                    Transform::translate(Vector(-centerX, -centerY, 0));
+
+                renderer->setDepthMask(true);
+                renderer->setDepthTest(true);
+                renderer->setBlendMode(Renderer::EBlendNone);
+                /* Covered pixels are marked by a zero alpha value */
+                renderer->setClearColor(Color3(0.0f));
+                framebuffer->activateTarget();
+                framebuffer->clear();
+                renderer->setCamera((tileTransform * projTransform).getMatrix(),
+                    worldToCamera.getMatrix());
+
+                program->bind();
+                program->setParameter("camPosition", cameraToWorld(Point(0.0f)), false);
+                program->setParameter("camDirection",
+                    normalize(cameraToWorld(Vector(0, 0, 1))), false);
+                program->setParameter(program->getParameterID("worldToCamera", false),
+                    worldToCamera.getMatrix());
+                renderer->beginDrawingMeshes();
+                for (size_t i=0; i<meshes.size(); ++i) {
+                    if (!geometry[i])
+                        continue;
+                    program->setParameter(param_shapeIndex, meshIndices[i]);
+                    program->setParameter(param_hasNormals, meshes[i]->hasVertexNormals());
+                    program->setParameter(param_hasUVs, meshes[i]->hasVertexTexcoords());
+                    renderer->drawMesh(geometry[i]);
+                }
+                renderer->endDrawingMeshes();
+                program->unbind();
+                framebuffer->releaseTarget();
+                framebuffer->download(tile);
+                renderer->checkError();
+
+                /* Mark the pixels that need to be ray traced */
+                bool needsTracing = false;
+                memset(&traceMask[0], 0, traceMask.size());
+                for (size_t i=0; i<traced.size(); ++i) {
+                    int x0 = std::max(traced[i].first.x - offset.x, 0),
+                        y0 = std::max(traced[i].first.y - offset.y, 0),
+                        x1 = std::min(traced[i].second.x - offset.x, size.x),
+                        y1 = std::min(traced[i].second.y - offset.y, size.y);
+                    for (int y=y0; y<y1; ++y) {
+                        memset(&traceMask[(size_t) y * tileSize + x0], 1, std::max(0, x1 - x0));
+                        needsTracing |= x1 > x0;
+                    }
+                }
+
+                const float *source = tile->getFloat32Data();
+                Float *target = block->getBitmap()->getFloatData();
+
+                #pragma omp parallel for schedule(dynamic) if (needsTracing)
+                for (int y=0; y<size.y; ++y) {
+                    RadianceQueryRecord rRec(scene, NULL);
+                    for (int x=0; x<size.x; ++x) {
+                        size_t index = (size_t) y * tileSize + x;
+                        const float *value = source + 4 * index;
+                        Float *pixel = target + channels * index;
+                        Spectrum result(m_undefined);
+                        Float alpha = 0;
+
+                        if (traceMask[index]) {
+                            RayDifferential ray;
+                            Point2 samplePos(
+                                cropOffset.x + offset.x + x + 0.5f,
+                                cropOffset.y + offset.y + y + 0.5f);
+                            Spectrum weight = sensor->sampleRayDifferential(
+                                ray, samplePos, Point2(0.5f), 0.5f);
+                            rRec.newQuery(RadianceQueryRecord::ESensorRay, sensor->getMedium());
+                            result = weight * Li(ray, rRec);
+                            alpha = rRec.alpha;
+                        } else if (value[3] == 0) {
+                            if (scalarField)
+                                result = Spectrum((Float) value[0]);
+                            else
+                                result.fromLinearRGB(value[0], value[1], value[2]);
+                            alpha = 1;
+                        }
+
+                        for (int k=0; k<SPECTRUM_SAMPLES; ++k)
+                            pixel[k] = result[k];
+                        pixel[SPECTRUM_SAMPLES] = alpha;
+                        pixel[SPECTRUM_SAMPLES + 1] = 1;
+                    }
+                }
+
+                block->setOffset(offset);
+                block->setSize(size);
+                film->put(block);
+                progress.update(ty * tiles.x + tx + 1);
+            }
+        }
+        progress.finish();
+
+        for (size_t i=0; i<meshes.size(); ++i) {
+            if (geometry[i])
+                renderer->unregisterGeometry(meshes[i]);
+        }
+        program->cleanup();
+        framebuffer->cleanup();
+        renderer->shutdown();
+        device->shutdown();
+        session->shutdown();
+        MTS_AUTORELEASE_END()
+        return !m_cancel;
+    }
+
+    /**
+     * \brief Compute a conservative pixel rectangle of the crop window
+     * that contains the projection of \c aabb
+     */
+    static bool projectBounds(const AABB &aabb, const Matrix4x4 &clip,
+            const Vector2i &cropSize, std::pair<Point2i, Point2i> &rect) {
+        if (!aabb.isValid())
+            return false;
+
+        Float minX = std::numeric_limits<Float>::infinity(), maxX = -minX,
+              minY = minX, maxY = -minX;
+        for (int i=0; i<8; ++i) {
+            Point p = aabb.getCorner(i);
+            Float v[4];
+            for (int j=0; j<4; ++j)
+                v[j] = clip(j, 0) * p.x + clip(j, 1) * p.y + clip(j, 2) * p.z + clip(j, 3);
+            if (v[3] <= Epsilon) {
+                /* The box reaches behind the camera */
+                rect = std::make_pair(Point2i(0), Point2i(cropSize));
+                return true;
+            }
+            Float x = (v[0] / v[3] + 1) * 0.5f * cropSize.x,
+                  y = (1 - v[1] / v[3]) * 0.5f * cropSize.y;
+            minX = std::min(minX, x); maxX = std::max(maxX, x);
+            minY = std::min(minY, y); maxY = std::max(maxY, y);
+        }
+
+        rect.first = Point2i(
+            std::max(0, (int) std::floor(minX) - 1),
+            std::max(0, (int) std::floor(minY) - 1));
+        rect.second = Point2i(
+            std::min(cropSize.x, (int) std::ceil(maxX) + 1),
+            std::min(cropSize.y, (int) std::ceil(maxY) + 1));
+        return rect.first.x < rect.second.x && rect.first.y < rect.second.y;
+    }
+
+    /// Create the GPU program that writes the requested field
+    ref<GPUProgram> createProgram(Renderer *renderer, bool directional) const {
+        ref<GPUProgram> prog = renderer->createGPUProgram("Field program");
+        prog->setSource(GPUProgram::EVertexProgram,
+            "varying vec3 posInWorldSpace_vertex;\n"
+            "varying vec3 normal_vertex;\n"
+            "varying vec2 uv_vertex;\n"
+            "\n"
+            "void main() {\n"
+            "   posInWorldSpace_vertex = gl_Vertex.xyz;\n"
+            "   normal_vertex = gl_Normal;\n"
+            "   uv_vertex = gl_MultiTexCoord0.xy;\n"
+            "   gl_Position = ftransform();\n"
+            "}\n"
+        );
+
+        /* Compute face normals and barycentric coordinates like TriMesh */
+        prog->setSource(GPUProgram::EGeometryProgram,
+            "#extension GL_EXT_geometry_shader4 : enable\n"
+            "\n"
+            "varying in vec3 posInWorldSpace_vertex[3];\n"
+            "varying in vec3 normal_vertex[3];\n"
+            "varying in vec2 uv_vertex[3];\n"
+            "varying out vec3 posInWorldSpace;\n"
+            "varying out vec3 normal;\n"
+            "varying out vec3 faceNormal;\n"
+            "varying out vec2 uv;\n"
+            "varying out vec2 barycentric;\n"
+            "\n"
+            "void main() {\n"
+            "   vec3 n = cross(posInWorldSpace_vertex[1] - posInWorldSpace_vertex[0],\n"
+            "                  posInWorldSpace_vertex[2] - posInWorldSpace_vertex[0]);\n"
+            "   for (int i=0; i<gl_VerticesIn; ++i) {\n"
+            "      gl_Position = gl_PositionIn[i];\n"
+            "      gl_PrimitiveID = gl_PrimitiveIDIn;\n"
+            "      posInWorldSpace = posInWorldSpace_vertex[i];\n"
+            "      normal = normal_vertex[i];\n"
+            "      faceNormal = n;\n"
+            "      uv = uv_vertex[i];\n"
+            "      barycentric = vec2(i == 1 ? 1.0 : 0.0, i == 2 ? 1.0 : 0.0);\n"
+            "      EmitVertex();\n"
+            "   }\n"
+            "   EndPrimitive();\n"
+            "}\n"
+        );
+        prog->setInputGeometryType(GPUProgram::ETriangles);
+        prog->setOutputGeometryType(GPUProgram::ETriangleStrips);
+        prog->setMaxVertices(3);
+
+        prog->setSource(GPUProgram::EFragmentProgram,
+            "#extension GL_EXT_gpu_shader4 : enable\n"
+            "\n"
+            "uniform float shapeIndex;\n"
+            "uniform bool hasNormals, hasUVs;\n"
+            "uniform vec3 camPosition, camDirection;\n"
+            "uniform mat4 worldToCamera;\n"
+            "varying vec3 posInWorldSpace;\n"
+            "varying vec3 normal;\n"
+            "varying vec3 faceNormal;\n"
+            "varying vec2 uv;\n"
+            "varying vec2 barycentric;\n"
+            "\n"
+            "void main() {\n"
+            "   vec3 geoNormal = normalize(faceNormal), shNormal = geoNormal;\n"
+            "   if (hasNormals) {\n"
+            "      shNormal = normalize(normal);\n"
+            "      if (dot(geoNormal, shNormal) < 0.0)\n"
+            "         geoNormal = -geoNormal;\n"
+            "   }\n"
+            "   vec3 value;\n"
+            "#if defined(FIELD_POSITION)\n"
+            "   value = posInWorldSpace;\n"
+            "#elif defined(FIELD_REL_POSITION)\n"
+            "   value = (worldToCamera * vec4(posInWorldSpace, 1.0)).xyz;\n"
+            "#elif defined(FIELD_DISTANCE) && defined(DIRECTIONAL_CAMERA)\n"
+            "   value = vec3(dot(posInWorldSpace - camPosition, camDirection));\n"
+            "#elif defined(FIELD_DISTANCE)\n"
+            "   value = vec3(length(posInWorldSpace - camPosition));\n"
+            "#elif defined(FIELD_GEO_NORMAL)\n"
+            "   value = geoNormal;\n"
+            "#elif defined(FIELD_SH_NORMAL)\n"
+            "   value = shNormal;\n"
+            "#elif defined(FIELD_UV)\n"
+            "   value = vec3(hasUVs ? uv : barycentric, 0.0);\n"
+            "#elif defined(FIELD_SHAPE_INDEX)\n"
+            "   value = vec3(shapeIndex);\n"
+            "#else\n"
+            "   value = vec3(float(gl_PrimitiveID));\n"
+            "#endif\n"
+            "   gl_FragColor = vec4(value, 0.0);\n"
+            "}\n"
+        );
+
+        switch (m_field) {
+            case EPosition: prog->define("FIELD_POSITION"); break;
+            case ERelativePosition: prog->define("FIELD_REL_POSITION"); break;
+            case EDistance: prog->define("FIELD_DISTANCE"); break;
+            case EGeometricNormal: prog->define("FIELD_GEO_NORMAL"); break;
+            case EShadingNormal: prog->define("FIELD_SH_NORMAL"); break;
+            case EUV: prog->define("FIELD_UV"); break;
+            case EShapeIndex: prog->define("FIELD_SHAPE_INDEX"); break;
+            case EPrimIndex: prog->define("FIELD_PRIM_INDEX"); break;
+            default: Log(EError, "Internal error!");
+        }
+        if (directional)
+            prog->define("DIRECTIONAL_CAMERA");
+
+        prog->init();
+        return prog;
+    }
+
 private:
+    std::vector<EField> m_fields;
+    /// The first entry of \ref m_fields
     EField m_field;
     Spectrum m_undefined;
+    bool m_hardware;
+    int m_tileSize;
+    bool m_cancel;
 };
 
 MTS_IMPLEMENT_CLASS_S(FieldIntegrator, false, SamplingIntegrator)
@@ -17,12 +17,13 @@
 */
 
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fstream.h>
 #include "irrcache_proc.h"
 
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{irrcache}{Irradiance caching integrator}
- * \order{15}
+ * \order{16}
  * \parameters{
  *     \parameter{resolution}{\Integer}{Elevational resolution of the stratified
  *      final gather hemisphere. The azimuthal resolution is two times this value. \default{14, i.e. $2\cdot14^2$=392 samples in total}}
@@ -39,6 +40,9 @@ MTS_NAMESPACE_BEGIN
  *     \parameter{indirectOnly}{\Boolean}{Only show the indirect illumination? This can be useful to check
  *      the interpolation quality. \default{\code{false}}}
  *     \parameter{debug}{\Boolean}{Visualize the sample placement? \default{\code{false}}}
+ *     \parameter{cacheFile}{\String}{When specified, the irradiance cache is
+ *      initialized from this file (if it exists), and written back after
+ *      rendering. See below for details. \default{none}}
  * }
  * \renderings{
  *  \unframedbigrendering{Illustration of the effect of the different optimizatations
@@ -78,6 +82,19 @@ MTS_NAMESPACE_BEGIN
  * improve the achieved interpolation quality, namely irradiance gradients
  * \cite{Ward1992Irradiance}, neighbor clamping \cite{Krivanek2006Making}, a screen-space
  * clamping metric and an improved error function \cite{Tabellion2004Approximate}.
+ *
+ * When rendering a camera flythrough of a scene with static geometry and
+ * lighting, the \code{cacheFile} parameter allows to reuse the cache across
+ * frames: the first frame creates the cache as usual and saves it after
+ * rendering. Every subsequent frame loads it and extends it, i.e. the
+ * overture pass and the rendering pass only compute new records where the
+ * new viewpoint reveals parts of the scene that are not yet covered. The
+ * extended cache is saved again afterwards. Since the screen-space clamping
+ * of the valid radii depends on the viewpoint, it is recomputed for the
+ * records of the loaded cache.
+ * A cache that was created for a scene with a different bounding box is
+ * discarded; otherwise, the file must be deleted whenever the geometry or
+ * lighting changes.
  */
 
 class IrradianceCacheIntegrator : public SamplingIntegrator {
@@ -115,6 +132,10 @@ public:
         /* If set to true, direct illumination will be suppressed -
            useful for checking the interpolation quality */
         m_indirectOnly = props.getBoolean("indirectOnly", false);
+        /* If set, the cache is kept in this file across renderings
+           (e.g. the frames of a static-lighting flythrough) */
+        m_cacheFile = props.getString("cacheFile", "");
+        m_loadedRecords = 0;
 
         if (m_debug)
             m_overture = false;
@@ -136,6 +157,7 @@ public:
         m_gradients = stream->readBool();
         m_debug = stream->readBool();
         m_indirectOnly = stream->readBool();
+        m_loadedRecords = 0;
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -193,11 +215,34 @@ public:
             return false;
 
         ref<Scheduler> sched = Scheduler::getInstance();
-        m_irrCache = new IrradianceCache(scene->getAABB());
+        ref<IrradianceCache> previous;
+        if (!m_cacheFile.empty() && fs::exists(m_cacheFile)) {
+            /* Reuse the cache of a previous frame */
+            ref<FileStream> stream = new FileStream(m_cacheFile, FileStream::EReadOnly);
+            previous = new IrradianceCache(stream, NULL);
+            if (!(previous->getAABB() == scene->getAABB())) {
+                Log(EWarn, "The irradiance cache \"%s\" was created for a different "
+                    "scene (bounding box %s) -- discarding it!", m_cacheFile.string().c_str(),
+                    previous->getAABB().toString().c_str());
+                previous = NULL;
+            }
+        }
+
+        if (previous) {
+            /* Redo the screen-space clamping for the current viewpoint */
+            previous->setQuality(m_quality);
+            m_irrCache = new IrradianceCache(previous.get(), scene->getSensor());
+            Log(EInfo, "Loaded " SIZE_T_FMT " irradiance samples from \"%s\"",
+                m_irrCache->getRecordCount(), m_cacheFile.string().c_str());
+            previous = NULL;
+        } else {
+            m_irrCache = new IrradianceCache(scene->getAABB());
+        }
         m_irrCache->clampNeighbor(m_clampNeighbor);
         m_irrCache->clampScreen(m_clampScreen);
         m_irrCache->useGradients(m_gradients);
         m_irrCache->setQuality(m_quality);
+        m_loadedRecords = m_irrCache->getRecordCount();
 
         std::string irrCacheStatus;
         if (m_overture)
@@ -224,8 +269,15 @@ public:
             proc->bindResource("sensor", sensorResID);
             proc->bindResource("subIntegrator", subIntegratorResID);
             bindUsedResources(proc);
+            int irrCacheResID = -1;
+            if (m_loadedRecords > 0) {
+                irrCacheResID = sched->registerResource(m_irrCache);
+                proc->bindResource("irrCache", irrCacheResID);
+            }
             sched->schedule(proc);
             sched->unregisterResource(subIntegratorResID);
+            if (irrCacheResID != -1)
+                sched->unregisterResource(irrCacheResID);
             sched->wait(proc);
             m_proc = NULL;
 
@@ -236,7 +288,12 @@ public:
 
             ref<const IrradianceRecordVector> vec = proc->getSamples();
             Log(EDebug, "Overture pass generated %i irradiance samples", vec->size());
-            for (size_t i=0; i<vec->size(); ++i)
+
+            /* Insertions into the cache are lock-free */
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for schedule(dynamic, 256)
+            #endif
+            for (int i=0; i<(int) vec->size(); ++i)
                 m_irrCache->insert(new IrradianceCache::Record((*vec)[i]));
 
             m_irrCache->setQuality(m_quality * m_qualityAdjustment);
@@ -244,6 +301,23 @@ public:
         return true;
     }
 
+    bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        if (!SamplingIntegrator::render(scene, queue, job,
+                sceneResID, sensorResID, samplerResID))
+            return false;
+
+        if (!m_cacheFile.empty()) {
+            ref<FileStream> stream = new FileStream(m_cacheFile, FileStream::ETruncReadWrite);
+            m_irrCache->serialize(stream, NULL);
+            size_t recordCount = m_irrCache->getRecordCount();
+            Log(EInfo, "Saved " SIZE_T_FMT " irradiance samples to \"%s\" (" SIZE_T_FMT
+                " reused, " SIZE_T_FMT " new)", recordCount, m_cacheFile.string().c_str(),
+                m_loadedRecords, recordCount - m_loadedRecords);
+        }
+        return true;
+    }
+
     void cancel() {
         if (m_proc) {
             Scheduler::getInstance()->cancel(m_proc);
@@ -378,6 +452,8 @@ private:
     mutable ref<IrradianceCache> m_irrCache;
     ref<SamplingIntegrator> m_subIntegrator;
     ref<ParallelProcess> m_proc;
+    fs::path m_cacheFile;
+    size_t m_loadedRecords;
     Float m_quality, m_qualityAdjustment, m_diffScaleFactor;
     bool m_clampScreen, m_clampNeighbor;
     bool m_overture, m_gradients, m_debug, m_indirectOnly;
@@ -65,7 +65,14 @@ public:
             createObject(MTS_CLASS(Sampler), props));
         m_subIntegrator->wakeup(NULL, m_resources);
 
-        m_irrCache = new IrradianceCache(m_scene->getAABB());
+        /* When extending the cache of a previous frame, start out with its
+           records so that only uncovered regions receive new samples */
+        std::map<std::string, SerializableObject *>::const_iterator it
+            = m_resources.find("irrCache");
+        if (it != m_resources.end())
+            m_irrCache = new IrradianceCache(static_cast<IrradianceCache *>(it->second));
+        else
+            m_irrCache = new IrradianceCache(m_scene->getAABB());
         m_irrCache->clampNeighbor(m_clampNeighbor);
         m_irrCache->clampScreen(m_clampScreen);
         m_irrCache->useGradients(m_gradients);
@@ -20,6 +20,9 @@
 #include <mitsuba/render/renderproc.h>
 #include <mitsuba/core/autodiff.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/fresolver.h>
 #include <boost/algorithm/string.hpp>
 
 DECLARE_DIFFSCALAR_BASE();
@@ -28,6 +31,10 @@ MTS_NAMESPACE_BEGIN
 
 static StatsCounter statsConverged(
         " manifold", "Converged manifold walks", EPercentage);
+static StatsCounter statsWarmStarted(
+        " manifold", "Successful warm starts", EPercentage);
+static StatsCounter statsSpaceSteps(
+        " manifold", "Avg. spatial steps per manifold walk", EAverage);
 
 /*!\plugin{motion}{Motion and specular motion vector integrator}
  * \parameters{
@@ -64,6 +71,17 @@ static StatsCounter statsConverged(
  *     \parameter{maxSpaceSteps}{\Integer}{
  *        Maximum number of spatial sub-steps \default{10}
  *     }
+ *     \parameter{warmStart}{\Boolean}{
+ *        Try to solve for the specular path at the target time directly,
+ *        starting from the screen-space motion of a recently solved
+ *        neighboring pixel or of the previous frame before falling back
+ *        to the gradual time stepping. \default{\code{true}}
+ *     }
+ *     \parameter{previousFrame}{\String}{
+ *        Optional OpenEXR image with the motion vectors of the
+ *        previous frame, which was rendered by this integrator. They
+ *        are used as an additional warm start. \default{none}
+ *     }
  * }
  * This integrator extracts motion vectors for animated input scenes, alternatively
  * at primary hit points or at hit points observed through sequences of reflective
@@ -75,6 +93,16 @@ static StatsCounter statsConverged(
  * the pixel color is set to infinity. The images on the following page show
  * motion vectors obtained for a sphere that is moving from the left to the right.
  *
+ * Every worker thread remembers the motion of the most recently solved pixels of
+ * its current block. When \code{warmStart} is enabled, the solver first predicts
+ * the position of a pixel at the target time using the motion of the nearest of
+ * these pixels (or of the same pixel in \code{previousFrame}), and refines this
+ * prediction with spatial steps only. Since neighboring pixels usually move
+ * coherently, this often converges after a few steps and avoids the temporal
+ * sub-steps. Should the warm start fail, the regular time stepping is used.
+ * The statistics printed after rendering report how many walks converged,
+ * how many of them were warm-started, and the average number of spatial steps.
+ *
  * \renderings{
  *     \rendering{Input scene at time $t=0$}{integrator_motion_sphere_1}
  *     \rendering{Input scene at time $t=1$}{integrator_motion_sphere_2}
@@ -150,6 +178,17 @@ public:
         m_maxSpaceSteps = props.getInteger("maxSpaceSteps", 10);
         m_glossyThreshold = props.getFloat("glossyThreshold", 0);
         m_subSteps = props.getInteger("subSteps", 1);
+        m_warmStart = props.getBoolean("warmStart", true);
+
+        if (props.hasProperty("previousFrame")) {
+            fs::path filename = Thread::getThread()->getFileResolver()->resolve(
+                props.getString("previousFrame"));
+            Log(EInfo, "Loading the motion vectors of the previous frame from \"%s\"",
+                filename.filename().string().c_str());
+            ref<FileStream> fs = new FileStream(filename, FileStream::EReadOnly);
+            m_previousFrame = (new Bitmap(Bitmap::EAuto, fs))->convert(
+                Bitmap::ERGB, Bitmap::EFloat32);
+        }
     }
 
     MotionIntegrator(Stream *stream, InstanceManager *manager)
@@ -161,6 +200,13 @@ public:
          m_maxSpaceSteps = stream->readInt();
          m_glossyThreshold = stream->readFloat();
          m_subSteps = stream->readInt();
+         m_warmStart = stream->readBool();
+         if (stream->readBool()) {
+             Vector2i size(stream);
+             m_previousFrame = new Bitmap(Bitmap::ERGB, Bitmap::EFloat32, size);
+             stream->readSingleArray(m_previousFrame->getFloat32Data(),
+                 (size_t) size.x * (size_t) size.y * 3);
+         }
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -172,6 +218,14 @@ public:
         stream->writeInt(m_maxSpaceSteps);
         stream->writeFloat(m_glossyThreshold);
         stream->writeInt(m_subSteps);
+        stream->writeBool(m_warmStart);
+        stream->writeBool(m_previousFrame.get() != NULL);
+        if (m_previousFrame.get()) {
+            Vector2i size = m_previousFrame->getSize();
+            size.serialize(stream);
+            stream->writeSingleArray(m_previousFrame->getFloat32Data(),
+                (size_t) size.x * (size_t) size.y * 3);
+        }
     }
 
     Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
@@ -211,6 +265,11 @@ public:
             m_scene = rRec.scene;
             p0 = source[1].p;
 
+            if (m_warmStart && !m_derivativesOnly) {
+                if (warmStart(rRec, r, apertureSample, source, target, temp, temp2, p1))
+                    goto solved;
+            }
+
             int timeIteration = 0;
 
             Float stepSizeReduction = 1.0f;
@@ -256,11 +315,15 @@ public:
             }
         }
 
+    solved:
         const Sensor *sensor = rRec.scene->getSensor();
         DirectSamplingRecord dRec0(p0, r.time), dRec1(p1, m_time);
         sensor->sampleDirect(dRec0, apertureSample);
         sensor->sampleDirect(dRec1, apertureSample);
 
+        if (m_warmStart && m_config.length() > 1 && !m_derivativesOnly)
+            m_recent.get().add(dRec0.uv, dRec1.uv - dRec0.uv);
+
         /* Step 4: Compute depth difference */
         Float dDelta = dRec1.dist - dRec0.dist;
         Spectrum result(0.0f);
@@ -270,9 +333,80 @@ public:
         return result;
     }
 
+    /**
+     * \brief Attempt to find the path at time \c m_time directly, starting
+     * from the predicted screen-space motion of the current pixel
+     */
+    bool warmStart(RadianceQueryRecord &rRec, const RayDifferential &r,
+            const Point2 &apertureSample, std::vector<Intersection> &source,
+            std::vector<Intersection> &target, std::vector<Intersection> &temp,
+            std::vector<Intersection> &temp2, Point &p1) const {
+        const Sensor *sensor = rRec.scene->getSensor();
+        DirectSamplingRecord dRec(source[1].p, r.time);
+        sensor->sampleDirect(dRec, apertureSample);
+
+        Vector2 flow;
+        if (!m_recent.get().lookup(dRec.uv, flow) && !lookupPreviousFrame(dRec.uv, flow))
+            return false;
+
+        adjustTime(rRec, apertureSample, source, target, 1.0f);
+
+        bool moved = false;
+        for (size_t i=0; i<source.size(); ++i)
+            if ((source[i].p-target[i].p).length() > 1e-4f)
+                moved = true;
+        if (!moved)
+            return false;
+
+        /* Generate a ray through the predicted position by
+           re-expressing the current ray in the target frame */
+        RayDifferential ray;
+        sensor->sampleRay(ray, dRec.uv + flow, apertureSample, 0.5f);
+        const AnimatedTransform *trafo = sensor->getWorldTransform();
+        Vector d = trafo->eval(m_time)(trafo->eval(ray.time).inverse()(ray.d));
+        Ray predicted(target[0].p, normalize(d), m_time);
+
+        statsWarmStarted.incrementBase();
+        if (!spaceSolve(rRec, predicted, target, temp, temp2))
+            return false;
+
+        ++statsWarmStarted;
+        statsConverged.incrementBase();
+        ++statsConverged;
+        p1 = temp[1].p;
+        return true;
+    }
+
+    /// Look up the motion of the current pixel in the previous frame
+    bool lookupPreviousFrame(const Point2 &uv, Vector2 &flow) const {
+        if (!m_previousFrame.get())
+            return false;
+        Vector2i size = m_previousFrame->getSize();
+        int x = (int) uv.x, y = (int) uv.y;
+        if (x < 0 || y < 0 || x >= size.x || y >= size.y)
+            return false;
+        const float *ptr = m_previousFrame->getFloat32Data() + 3 * (x + y * (size_t) size.x);
+        if (!std::isfinite(ptr[0]) || !std::isfinite(ptr[1]))
+            return false;
+        flow = Vector2((Float) ptr[0], (Float) ptr[1]);
+        return true;
+    }
+
     bool timeStep(RadianceQueryRecord &rRec, std::vector<Intersection> &source, const std::vector<Intersection> &target, std::vector<Intersection> &temp, std::vector<Intersection> &temp2) const {
         Ray ray = extrapolateTimeRay(source, target);
 
+        if (!spaceSolve(rRec, ray, target, temp, temp2))
+            return false;
+
+        source = temp;
+        return true;
+    }
+
+    /**
+     * \brief Starting from \c ray, take spatial steps until the
+     * traced path (stored in \c temp) matches \c target
+     */
+    bool spaceSolve(RadianceQueryRecord &rRec, const Ray &ray, const std::vector<Intersection> &target, std::vector<Intersection> &temp, std::vector<Intersection> &temp2) const {
         if (!tracePath(rRec, ray, temp))
             return false;
 
@@ -284,6 +418,8 @@ public:
             ++spaceIteration;
 
             if (spaceIteration > m_maxSpaceSteps) {
+                statsSpaceSteps.incrementBase();
+                statsSpaceSteps += spaceIteration - 1;
                 return false;
             }
 
@@ -304,7 +440,8 @@ public:
             }
         }
 
-        source = temp;
+        statsSpaceSteps.incrementBase();
+        statsSpaceSteps += spaceIteration;
         return true;
     }
 
@@ -548,6 +685,40 @@ public:
 
     MTS_DECLARE_CLASS()
 private:
+    /**
+     * \brief Screen-space motion of the pixels that were most recently
+     * solved by a worker thread (i.e. neighbors within its current block)
+     */
+    struct RecentSolutions {
+        enum { ESize = 64 };
+        Point2 uv[ESize];
+        Vector2 flow[ESize];
+        size_t count, next;
+
+        inline RecentSolutions() : count(0), next(0) { }
+
+        inline void add(const Point2 &p, const Vector2 &f) {
+            if (!std::isfinite(f.x) || !std::isfinite(f.y))
+                return;
+            uv[next] = p; flow[next] = f;
+            next = (next + 1) % ESize;
+            count = std::min(count + 1, (size_t) ESize);
+        }
+
+        /// Find the motion of the closest pixel that is at most 1.5 pixels away
+        inline bool lookup(const Point2 &p, Vector2 &f) const {
+            Float best = 1.5f * 1.5f;
+            bool found = false;
+            for (size_t i=0; i<count; ++i) {
+                Float dist = distanceSquared(p, uv[i]);
+                if (dist < best) {
+                    best = dist; f = flow[i]; found = true;
+                }
+            }
+            return found;
+        }
+    };
+
     Float m_time;
     std::string m_config;
     bool m_derivativesOnly;
@@ -555,6 +726,9 @@ private:
     int m_maxTimeSteps;
     int m_subSteps;
     Float m_glossyThreshold;
+    bool m_warmStart;
+    ref<Bitmap> m_previousFrame;
+    mutable PrimitiveThreadLocal<RecentSolutions> m_recent;
     mutable const Scene *m_scene;
 };
 
@@ -19,13 +19,23 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/renderproc.h>
 
+/// Target number of sensor rays that are traced at once
+#define MTS_MULTICHANNEL_RAY_BATCH 64
+
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{multichannel}{Multi-channel integrator}
- * \order{16}
+ * \order{17}
  * \parameters{
  *     \parameter{\Unnamed}{\Integrator}{One or more sub-integrators whose output
  *     should be rendered into a combined multi-channel image}
+ *     \parameter{sharedSamples}{\Boolean}{
+ *     When set to \code{true}, all sub-integrators receive the same sample
+ *     values (i.e. they start at the same sampler dimension after the sensor
+ *     has been sampled). Otherwise, each one continues with the dimensions
+ *     left over by its predecessor, which may exceed the dimensions that a
+ *     low discrepancy sampler stratifies. \default{\code{false}}
+ *     }
  * }
  *
  * The multi-channel integrator groups several sub-integrators together
@@ -43,6 +53,11 @@ MTS_NAMESPACE_BEGIN
  * This is simply to process extracted fields for which it is fine
  * to take on such values.
  *
+ * The sensor rays of several neighboring pixels are traced together, and the
+ * resulting intersection of each sample is shared by all sub-integrators
+ * (which only compute their first intersection when none was provided). All
+ * channels of a sample are then stored in the image block at once.
+ *
  * The following example contains a typical setup for rendering an 7 channel EXR image:
  * 3 for a path traced image (RGB), 3 for surface normals
  * (encoded as RGB), and 1 channel for the ray distance measured from the camera.
@@ -86,10 +101,13 @@ MTS_NAMESPACE_BEGIN
 
 class MultiChannelIntegrator : public SamplingIntegrator {
 public:
-    MultiChannelIntegrator(const Properties &props) : SamplingIntegrator(props) { }
+    MultiChannelIntegrator(const Properties &props) : SamplingIntegrator(props) {
+        m_sharedSamples = props.getBoolean("sharedSamples", false);
+    }
 
     MultiChannelIntegrator(Stream *stream, InstanceManager *manager)
      : SamplingIntegrator(stream, manager) {
+        m_sharedSamples = stream->readBool();
         m_integrators.resize(stream->readSize());
         for (size_t i=0; i<m_integrators.size(); ++i)
             m_integrators[i] = static_cast<SamplingIntegrator *>(manager->getInstance(stream));
@@ -98,6 +116,7 @@ public:
     void serialize(Stream *stream, InstanceManager *manager) const {
         SamplingIntegrator::serialize(stream, manager);
 
+        stream->writeBool(m_sharedSamples);
         stream->writeSize(m_integrators.size());
         for (size_t i=0; i<m_integrators.size(); ++i)
             manager->serialize(stream, m_integrators[i].get());
@@ -165,57 +184,109 @@ public:
             const Sensor *sensor, Sampler *sampler, ImageBlock *block,
             const bool &stop, const std::vector< TPoint2<uint8_t> > &points) const {
 
+        size_t sampleCount = sampler->getSampleCount();
         Float diffScaleFactor = 1.0f /
-            std::sqrt((Float) sampler->getSampleCount());
+            std::sqrt((Float) sampleCount);
 
         bool needsApertureSample = sensor->needsApertureSample();
         bool needsTimeSample = sensor->needsTimeSample();
+        const ReconstructionFilter *rfilter = sensor->getFilm()->getReconstructionFilter();
 
         RadianceQueryRecord rRec(scene, sampler);
         Point2 apertureSample(0.5f);
         Float timeSample = 0.5f;
-        RayDifferential sensorRay;
 
         block->clear();
 
         uint32_t queryType = RadianceQueryRecord::ESensorRay;
         Float *temp = (Float *) alloca(sizeof(Float) * (m_integrators.size() * SPECTRUM_SAMPLES + 2));
 
-        for (size_t i = 0; i<points.size(); ++i) {
-            Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
+        /* Number of pixels, whose sensor rays are traced together */
+        size_t pixelsPerBatch = std::max((size_t) 1,
+            (size_t) MTS_MULTICHANNEL_RAY_BATCH / sampleCount);
+        size_t maxRays = pixelsPerBatch * sampleCount;
+
+        std::vector<RayDifferential> sensorRays(maxRays);
+        std::vector<Ray> rays(maxRays);
+        std::vector<Intersection> its(maxRays);
+        std::vector<Point2> samplePos(maxRays);
+        std::vector<Spectrum> weights(maxRays);
+        std::vector<Float> filterWeights(maxRays);
+
+        for (size_t i = 0; i<points.size(); i += pixelsPerBatch) {
             if (stop)
                 break;
 
-            sampler->generate(offset);
+            size_t pixelCount = std::min(pixelsPerBatch, points.size() - i);
 
-            for (size_t j = 0; j<sampler->getSampleCount(); j++) {
-                rRec.newQuery(queryType, sensor->getMedium());
-                Point2 samplePos(Point2(offset) + Vector2(rRec.nextSample2D()));
+            /* 1. Generate the sensor rays of all pixels in the batch */
+            size_t rayIndex = 0;
+            for (size_t k = 0; k<pixelCount; ++k) {
+                Point2i offset = Point2i(points[i+k]) + Vector2i(block->getOffset());
+                sampler->generate(offset);
 
-                if (needsApertureSample)
-                    apertureSample = rRec.nextSample2D();
+                for (size_t j = 0; j<sampleCount; j++) {
+                    rRec.newQuery(queryType, sensor->getMedium());
+                    samplePos[rayIndex] = rfilter->samplePosition(offset,
+                        rRec.nextSample2D(), filterWeights[rayIndex]);
 
-                if (needsTimeSample)
-                    timeSample = rRec.nextSample1D();
+                    if (needsApertureSample)
+                        apertureSample = rRec.nextSample2D();
+                    if (needsTimeSample)
+                        timeSample = rRec.nextSample1D();
 
-                Spectrum spec = sensor->sampleRayDifferential(
-                    sensorRay, samplePos, apertureSample, timeSample);
+                    weights[rayIndex] = sensor->sampleRayDifferential(
+                        sensorRays[rayIndex], samplePos[rayIndex], apertureSample, timeSample);
 
-                sensorRay.scaleDifferential(diffScaleFactor);
-                rRec.rayIntersect(sensorRay);
+                    sensorRays[rayIndex].scaleDifferential(diffScaleFactor);
+                    rays[rayIndex] = sensorRays[rayIndex];
+                    ++rayIndex;
+                    sampler->advance();
+                }
+            }
 
-                int offset = 0;
-                for (size_t k = 0; k<m_integrators.size(); ++k) {
-                    RadianceQueryRecord rRec2(rRec);
-                    rRec2.its = rRec.its;
-                    Spectrum result = spec * m_integrators[k]->Li(sensorRay, rRec2);
-                    for (int l = 0; l<SPECTRUM_SAMPLES; ++l)
-                        temp[offset++] = result[l];
+            /* 2. Trace them */
+            scene->rayIntersectStream(&rays[0], &its[0], rayIndex);
+
+            /* 3. Evaluate all sub-integrators using the shared intersections */
+            rayIndex = 0;
+            for (size_t k = 0; k<pixelCount; ++k) {
+                Point2i offset = Point2i(points[i+k]) + Vector2i(block->getOffset());
+                if (pixelCount > 1)
+                    sampler->generate(offset);
+
+                for (size_t j = 0; j<sampleCount; j++) {
+                    rRec.newQuery(queryType, sensor->getMedium());
+                    rRec.setIntersection(sensorRays[rayIndex], its[rayIndex]);
+
+                    int channel = 0;
+                    for (size_t l = 0; l<m_integrators.size(); ++l) {
+                        /* Skip the sample dimensions used by the sensor */
+                        if (l == 0 || m_sharedSamples) {
+                            sampler->setSampleIndex(j);
+                            rRec.nextSample2D();
+                            if (needsApertureSample)
+                                rRec.nextSample2D();
+                            if (needsTimeSample)
+                                rRec.nextSample1D();
+                        }
+
+                        RadianceQueryRecord rRec2(rRec);
+                        rRec2.its = rRec.its;
+                        Spectrum result = weights[rayIndex] *
+                            m_integrators[l]->Li(sensorRays[rayIndex], rRec2);
+                        for (int m = 0; m<SPECTRUM_SAMPLES; ++m)
+                            temp[channel++] = result[m];
+                    }
+                    temp[channel++] = rRec.alpha;
+                    temp[channel] = 1.0f;
+
+                    if (rfilter->isImportanceSampled())
+                        block->putPixel(offset, temp, filterWeights[rayIndex]);
+                    else
+                        block->put(samplePos[rayIndex], temp);
+                    ++rayIndex;
                 }
-                temp[offset++] = rRec.alpha;
-                temp[offset] = 1.0f;
-                block->put(samplePos, temp);
-                sampler->advance();
             }
         }
     }
@@ -264,6 +335,7 @@ public:
     std::string toString() const {
         std::ostringstream oss;
         oss << "MultiChannelIntegrator[" << endl
+            << "  sharedSamples = " << m_sharedSamples << "," << endl
             << "  integrators = {" << endl;
         for (size_t i=0; i<m_integrators.size(); ++i)
             oss << "    " << indent(m_integrators[i]->toString(), 2) << "," << endl;
@@ -275,6 +347,7 @@ public:
     MTS_DECLARE_CLASS()
 private:
     ref_vector<SamplingIntegrator> m_integrators;
+    bool m_sharedSamples;
 };
 
 MTS_IMPLEMENT_CLASS_S(MultiChannelIntegrator, false, SamplingIntegrator)
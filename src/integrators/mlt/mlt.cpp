@@ -23,7 +23,7 @@
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{mlt}{Path Space Metropolis Light Transport}
- * \order{10}
+ * \order{11}
  * \parameters{
  *     \parameter{maxDepth}{\Integer}{Specifies the longest path depth
  *         in the generated output image (where \code{-1} corresponds to $\infty$).
@@ -60,6 +60,10 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{lambda}{\Float}{
  *         Jump size of the manifold perturbation \default{50}}
+ *     \parameter{seedFile}{\String}{
+ *        File for reusing the seed paths and average luminance of a previous
+ *        rendering. See \pluginref{pssmlt} for details. \default{none}
+ *     }
  * }
  * Metropolis Light Transport (MLT) is a seminal rendering technique proposed by Veach and
  * Guibas \cite{Veach1997Metropolis}, which applies the Metropolis-Hastings
@@ -196,6 +200,9 @@ public:
 
         /* Stop MLT after X seconds -- useful for equal-time comparisons */
         m_config.timeout = props.getInteger("timeout", 0);
+
+        /* Optional file for reusing the seed paths of a previous run */
+        m_seedFile = props.getString("seedFile", "");
     }
 
     /// Unserialize from a binary data stream
@@ -302,8 +309,9 @@ public:
         ref<MLTProcess> process = new MLTProcess(job, queue,
                 m_config, directImage, pathSeeds);
 
-        m_config.luminance = pathSampler->generateSeeds(luminanceSamples,
-            m_config.workUnits, true, m_config.importanceMap, pathSeeds);
+        m_config.luminance = pathSampler->generateSeeds(sceneResID,
+            luminanceSamples, m_config.workUnits, true, m_config.importanceMap,
+            pathSeeds, nested ? fs::path() : m_seedFile);
 
         if (!nested)
             m_config.dump();
@@ -329,6 +337,7 @@ public:
 private:
     ref<ParallelProcess> m_process;
     ref<RenderJob> m_nestedJob;
+    fs::path m_seedFile;
     MLTConfiguration m_config;
 };
 
@@ -32,6 +32,8 @@ static StatsCounter statsAccepted("Path Space MLT",
         "Accepted mutations", EPercentage);
 static StatsCounter forcedAcceptance("Path Space MLT",
         "Number of forced acceptances");
+static StatsCounter statsSuitabilityReuse("Path Space MLT",
+        "Reused suitability evaluations", EPercentage);
 
 /* ==================================================================== */
 /*                         Worker implementation                        */
@@ -126,7 +128,11 @@ public:
         relWeight = current->getRelativeWeight();
         BDAssert(!relWeight.isZero());
 
-        DiscreteDistribution suitabilities(m_mutators.size());
+        /* Suitabilities of the current path (they only change
+           when a mutation is accepted) */
+        DiscreteDistribution suitabilities(m_mutators.size()),
+            proposedSuitabilities(m_mutators.size());
+        bool suitabilitiesValid = false;
         MutationRecord muRec, currentMuRec(Mutator::EMutationTypeCount,0,0,0,Spectrum(0.f));
         ref<Timer> timer = new Timer();
 
@@ -148,9 +154,22 @@ public:
                 break;
 
             /* Query all mutators for their suitability */
-            suitabilities.clear();
-            for (size_t j=0; j<m_mutators.size(); ++j)
-                suitabilities.append(m_mutators[j]->suitability(*current));
+            statsSuitabilityReuse.incrementBase();
+            if (!suitabilitiesValid) {
+                suitabilities.clear();
+                for (size_t j=0; j<m_mutators.size(); ++j)
+                    suitabilities.append(m_mutators[j]->suitability(*current));
+                suitabilitiesValid = true;
+                if (suitabilities.normalize() == 0) {
+                    /* No mutator can handle this path -- give up */
+                    size_t skip = m_config.nMutations - mutationCtr;
+                    accumulatedWeight += skip;
+                    consecRejections += skip;
+                    break;
+                }
+            } else {
+                ++statsSuitabilityReuse;
+            }
             #if defined(MTS_BD_DEBUG_HEAVY)
                 current->clone(backup, *m_pool);
             #endif
@@ -159,14 +178,6 @@ public:
             bool success = false;
             Mutator *mutator = NULL;
 
-            if (suitabilities.normalize() == 0) {
-                /* No mutator can handle this path -- give up */
-                size_t skip = m_config.nMutations - mutationCtr;
-                accumulatedWeight += skip;
-                consecRejections += skip;
-                break;
-            }
-
             mutatorIdx = suitabilities.sample(m_sampler->next1D());
             mutator = m_mutators[mutatorIdx].get();
 
@@ -198,11 +209,11 @@ public:
             statsAccepted.incrementBase(1);
             if (success) {
                 Float Qxy = mutator->Q(*current, *proposed, muRec) * suitabilities[mutatorIdx];
-                suitabilities.clear();
+                proposedSuitabilities.clear();
                 for (size_t j=0; j<m_mutators.size(); ++j)
-                    suitabilities.append(m_mutators[j]->suitability(*proposed));
-                suitabilities.normalize();
-                Float Qyx = mutator->Q(*proposed, *current, muRec.reverse()) * suitabilities[mutatorIdx];
+                    proposedSuitabilities.append(m_mutators[j]->suitability(*proposed));
+                bool proposedValid = proposedSuitabilities.normalize() != 0;
+                Float Qyx = mutator->Q(*proposed, *current, muRec.reverse()) * proposedSuitabilities[mutatorIdx];
 
                 Float a;
                 if (!m_config.importanceMap) {
@@ -261,6 +272,8 @@ public:
 
                     /* The mutation was accepted */
                     std::swap(current, proposed);
+                    std::swap(suitabilities, proposedSuitabilities);
+                    suitabilitiesValid = proposedValid;
                     relWeight = current->getRelativeWeight();
                     mutator->accept(muRec);
                     currentMuRec = muRec;
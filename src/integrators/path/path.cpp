@@ -17,12 +17,62 @@
 */
 
 #include <mitsuba/render/scene.h>
+#include <mitsuba/render/guiding.h>
+#include <mitsuba/render/shadowqueue.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/qmc.h>
+
+/// Number of paths that are advanced together in wavefront mode
+#define MTS_WAVEFRONT_PATHS 4096
 
 MTS_NAMESPACE_BEGIN
 
 static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage);
 
+/**
+ * \brief Sampler that provides the random numbers of a path in wavefront
+ * mode: a pseudorandom sequence that only depends on a per-path key, so
+ * that paths can be advanced in an arbitrary order
+ */
+class WavefrontPathSampler : public Sampler {
+public:
+    WavefrontPathSampler() : Sampler(Properties()), m_key(0), m_dimension(0) {
+        m_sampleCount = 1;
+    }
+
+    /// Continue the sequence of the path with the given key
+    inline void setPath(uint32_t key, uint32_t dimension) {
+        m_key = key;
+        m_dimension = dimension;
+    }
+
+    /// Return the number of dimensions that were used so far
+    inline uint32_t getDimension() const { return m_dimension; }
+
+    ref<Sampler> clone() {
+        return new WavefrontPathSampler();
+    }
+
+    Float next1D() {
+        return sampleTEAFloat(m_key, m_dimension++);
+    }
+
+    Point2 next2D() {
+        Float x = next1D(), y = next1D();
+        return Point2(x, y);
+    }
+
+    std::string toString() const {
+        return "WavefrontPathSampler[]";
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~WavefrontPathSampler() { }
+private:
+    uint32_t m_key, m_dimension;
+};
+
 /*! \plugin{path}{Path tracer}
  * \order{2}
  * \parameters{
@@ -44,6 +94,46 @@ static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage
  *        See page~\pageref{sec:hideemitters} for details.
  *        \default{no, i.e. \code{false}}
  *     }
+ *     \parameter{aovs}{\Boolean}{Also store the albedo, shading normal,
+ *        distance and shape index of the first surface interaction in
+ *        additional film channels? See page~\pageref{sec:aovs} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{rayCones}{\Boolean}{Propagate the ray differentials of
+ *        the camera ray along the path, so that textures seen at indirect
+ *        bounces are filtered with a wider footprint? See
+ *        page~\pageref{sec:raycones} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{guiding}{\Boolean}{Learn a distribution of the incident
+ *        radiance while rendering and use it to sample directions?
+ *        See page~\pageref{sec:guiding} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{guidingBSDFFraction}{\Float}{Probability of sampling
+ *        the BSDF instead of the learned distribution. \default{0.5}
+ *     }
+ *     \parameter{guidingSpatialThreshold}{\Float}{Regions of space are
+ *        split when they receive more than this number of path vertices
+ *        (times the square root of the samples per pixel of the pass).
+ *        \default{12000}
+ *     }
+ *     \parameter{guidingDirectionalThreshold}{\Float}{Directional cells
+ *        are split when they hold more than this fraction of the radiance
+ *        of their region. \default{0.01}
+ *     }
+ *     \parameter{guidingMaxMemory}{\Integer}{Memory budget of the
+ *        learned distribution in MiB. \default{256}
+ *     }
+ *     \parameter{adrrs}{\Boolean}{Use adjoint-driven Russian roulette
+ *        and splitting? See page~\pageref{sec:guiding} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{wavefront}{\Boolean}{Advance the paths of an image block
+ *        together, one bounce at a time, and shade them sorted by material?
+ *        See page~\pageref{sec:wavefront} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
  * }
  *
  * This integrator implements a basic path tracer and is a \emph{good default choice}
@@ -100,6 +190,95 @@ static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage
  * implicitly have \code{strictNormals} set to \code{true}. Hence, another use of this parameter
  * is to match renderings created by these methods.
  *
+ * \paragraph{AOV output:}\label{sec:aovs}
+ * Denoisers usually require a few auxiliary feature images in addition to
+ * the noisy rendering. When \code{aovs} is set to \code{true}, the path tracer
+ * records the diffuse albedo, shading normal, distance and shape index of the
+ * first surface interaction as a by-product of each sensor ray, i.e. without
+ * any additional ray intersections (in contrast to combining several
+ * \pluginref{field} integrators using \pluginref{multichannel}). They are
+ * written after the radiance into a multi-channel \pluginref{hdrfilm}, which
+ * must be configured as follows (the same applies to \pluginref{volpath}
+ * and \pluginref[volpathsimple]{volpath\_simple}):
+ * \begin{xml}
+ * <integrator type="path">
+ *     <boolean name="aovs" value="true"/>
+ * </integrator>
+ * <sensor type="perspective">
+ *     <film type="hdrfilm">
+ *         <string name="pixelFormat" value="rgb, rgb, rgb, luminance, luminance"/>
+ *         <string name="channelNames" value="color, albedo, normal, distance, shapeIndex"/>
+ *     </film>
+ * </sensor>
+ * \end{xml}
+ *
+ * \paragraph{Ray cones:}\label{sec:raycones}
+ * Normally, only the camera ray carries ray differentials, and all textures
+ * seen at later bounces are looked up without filtering, i.e. at the finest
+ * MIP map level. When \code{rayCones} is set to \code{true}, the
+ * differentials are instead propagated along the path as a ray cone
+ * \cite{Amanatides1984Ray}, whose spread angle grows at every non-specular
+ * bounce by an amount derived from the density of the sampled direction:
+ * diffuse bounces widen the cone a lot, while specular reflection and
+ * refraction only carry it along. Textures at indirect bounces are then
+ * filtered over a footprint that matches the blur introduced by the path,
+ * which accesses coarser MIP map levels and greatly reduces the memory
+ * traffic of texture-heavy scenes. Because the spread ignores the surface
+ * curvature, the texture detail seen through curved mirrors can be
+ * slightly over-blurred. The \pluginref{volpath} integrator supports the same
+ * parameter; the bidirectional integrators do not use ray differentials.
+ *
+ * \paragraph{Path guiding:}\label{sec:guiding}
+ * When \code{guiding} is set to \code{true}, the path tracer learns an
+ * approximation of the incident radiance while rendering and samples the
+ * directions at surface interactions from a mixture of the BSDF and this
+ * approximation \cite{Mueller2017Practical}. This is helpful when most
+ * of the illumination arrives indirectly through a few narrow openings, but
+ * costs some time for training and is not worthwhile for mostly directly
+ * lit scenes. The approximation consists of a binary tree over the scene,
+ * whose leaves each store a quadtree over the sphere of directions.
+ *
+ * The samples per pixel are split into passes of doubling size (1, 2, 4, ...).
+ * After each pass, the trees are refined based on the radiance found by
+ * the paths of that pass. Only the last pass, which receives the remaining
+ * samples (at least half of them), contributes to the final image. The trees
+ * never exceed the memory budget given by \code{guidingMaxMemory}.
+ * Path guiding is not supported in network rendering.
+ *
+ * When \code{adrrs} is set to \code{true}, the final pass additionally
+ * replaces the throughput-based Russian roulette by adjoint-driven Russian
+ * roulette and splitting \cite{Vorba2016Adjoint}: the learned radiance and
+ * the images of the training passes estimate how much a path will still
+ * contribute to its pixel. Paths that are expected to contribute little
+ * are terminated early (also before \code{rrDepth}), while paths that are
+ * expected to contribute a lot are split into several copies. This helps
+ * in scenes with large differences in brightness, e.g. a dimly lit room next
+ * to a bright one. The training passes (and hence the learned distribution)
+ * are also used when \code{guiding} is disabled, in which case directions are
+ * chosen by BSDF sampling alone. The number of terminated and split paths
+ * is reported in the statistics at the end of the rendering.
+ *
+ * \paragraph{Wavefront mode:}\label{sec:wavefront}
+ * By default, every sample is traced depth-first from the sensor to the
+ * end of its path. In scenes with many different materials, neighboring
+ * paths quickly run through unrelated BSDF and texture code after the
+ * first bounce, and the processor caches are mostly busy with evicting
+ * each other's data. When \code{wavefront} is set to \code{true}, the
+ * integrator instead keeps up to 4096 paths of an image block in a queue.
+ * Their rays are traced together (see the \code{Scene::rayIntersectStream()}
+ * function), and the intersections are then sorted by BSDF before
+ * computing the direct illumination and sampling the next direction, so
+ * that each material is evaluated for a coherent batch of paths. The
+ * shadow rays of a bounce are likewise collected and traced after sorting
+ * them by origin and direction.
+ *
+ * The result converges to the same image, but the noise pattern differs:
+ * since the paths of a block are advanced out of order, only the sensor
+ * sample (the image plane, aperture and time) comes from the chosen sample
+ * generator. All later random numbers of a path are taken from a hashed
+ * pseudorandom sequence that is keyed by its pixel and sample index. This
+ * mode is ignored when path guiding or primary hit caching is used.
+ *
  * \remarks{
  *    \item This integrator does not handle participating media
  *    \item This integrator has poor convergence properties when rendering
@@ -110,35 +289,84 @@ static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage
 class MIPathTracer : public MonteCarloIntegrator {
 public:
     MIPathTracer(const Properties &props)
-        : MonteCarloIntegrator(props) { }
+        : MonteCarloIntegrator(props) {
+        if (props.getBoolean("guiding", false) || props.getBoolean("adrrs", false))
+            m_guide = new PathGuide(props);
+
+        m_wavefront = props.getBoolean("wavefront", false);
+        if (m_wavefront && m_guide) {
+            Log(EWarn, "Path guiding is not supported in wavefront mode, "
+                "rendering depth-first instead.");
+            m_wavefront = false;
+        }
+    }
 
     /// Unserialize from a binary data stream
     MIPathTracer(Stream *stream, InstanceManager *manager)
-        : MonteCarloIntegrator(stream, manager) { }
+        : MonteCarloIntegrator(stream, manager) {
+        m_wavefront = stream->readBool();
+    }
 
     Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
-        /* Some aliases and local variables */
-        const Scene *scene = rRec.scene;
-        Intersection &its = rRec.its;
         RayDifferential ray(r);
-        Spectrum Li(0.0f);
-        bool scattered = false;
 
         /* Perform the first ray intersection (or ignore if the
            intersection has already been provided). */
         rRec.rayIntersect(ray);
+        rRec.recordAOVs(ray);
         ray.mint = Epsilon;
 
-        Spectrum throughput(1.0f);
-        Float eta = 1.0f;
+        /* Vertices whose incident radiance is used to train the guiding distribution */
+        const PathGuide *guide = m_guide.get();
+        bool training = guide && guide->isTraining();
+        PathGuide::PathRecord record;
+
+        /* Expected pixel value for adjoint-driven Russian roulette and splitting */
+        Float pixelEstimate = (guide && guide->hasADRRS())
+            ? guide->estimatePixel(rRec.scene->getSensor(), r) : (Float) 0.0f;
+        int splitBudget = MTS_ADRRS_MAX_SPLIT;
+
+        Spectrum Li = tracePath(ray, rRec, Spectrum(1.0f), 1.0f, false,
+            record, pixelEstimate, splitBudget);
+
+        if (training)
+            record.commit();
+
+        /* Store statistics */
+        avgPathLength.incrementBase();
+        avgPathLength += rRec.depth;
+
+        return Li;
+    }
+
+    /**
+     * \brief Continue a path at the intersection \c rRec.its, which was
+     * found by tracing \c ray
+     *
+     * Paths that are split by ADRRS continue via recursive calls, which
+     * take at most \c splitBudget additional copies in total.
+     */
+    Spectrum tracePath(RayDifferential &ray, RadianceQueryRecord &rRec,
+            Spectrum throughput, Float eta, bool scattered,
+            PathGuide::PathRecord &record, Float pixelEstimate,
+            int &splitBudget) const {
+        /* Some aliases and local variables */
+        const Scene *scene = rRec.scene;
+        Intersection &its = rRec.its;
+        const PathGuide *guide = m_guide.get();
+        bool training = guide && guide->isTraining();
+        Spectrum Li(0.0f);
 
         while (rRec.depth <= m_maxDepth || m_maxDepth < 0) {
             if (!its.isValid()) {
                 /* If no intersection could be found, potentially return
                    radiance from a environment luminaire if it exists */
                 if ((rRec.type & RadianceQueryRecord::EEmittedRadiance)
-                    && (!m_hideEmitters || scattered))
-                    Li += throughput * scene->evalEnvironment(ray);
+                    && (!m_hideEmitters || scattered)) {
+                    Spectrum value = throughput * scene->evalEnvironment(ray);
+                    Li += value;
+                    record.addRadiance(value);
+                }
                 break;
             }
 
@@ -150,8 +378,11 @@ public:
                 Li += throughput * its.Le(-ray.d);
 
             /* Include radiance from a subsurface scattering model if requested */
-            if (its.hasSubsurface() && (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance))
-                Li += throughput * its.LoSub(scene, rRec.sampler, -ray.d, rRec.depth);
+            if (its.hasSubsurface() && (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance)) {
+                Spectrum value = throughput * its.LoSub(scene, rRec.sampler, -ray.d, rRec.depth);
+                Li += value;
+                record.addRadiance(value);
+            }
 
             if ((rRec.depth >= m_maxDepth && m_maxDepth > 0)
                 || (m_strictNormals && dot(ray.d, its.geoFrame.n)
@@ -164,6 +395,9 @@ public:
                 break;
             }
 
+            /* Region of the guiding distribution, if enabled */
+            const PathGuide::Region *region = guide ? guide->lookup(its.p) : NULL;
+
             /* ==================================================================== */
             /*                     Direct illumination sampling                     */
             /* ==================================================================== */
@@ -180,21 +414,24 @@ public:
                     /* Allocate a record for querying the BSDF */
                     BSDFSamplingRecord bRec(its, its.toLocal(dRec.d), ERadiance);
 
-                    /* Evaluate BSDF * cos(theta) */
-                    const Spectrum bsdfVal = bsdf->eval(bRec);
+                    /* Evaluate BSDF * cos(theta) and, when needed for MIS, the
+                       prob. of having generated that direction using BSDF sampling */
+                    Float bsdfPdf = 0;
+                    const Spectrum bsdfVal = MTS_HOTPATH_TIMED(bsdfEval,
+                        (emitter->isOnSurface() && dRec.measure == ESolidAngle)
+                        ? bsdf->evalWithPdf(bRec, bsdfPdf) : bsdf->eval(bRec));
+                    if (region && bsdfPdf > 0)
+                        bsdfPdf = guide->pdf(region, bsdf, bsdfPdf, dRec.d);
 
                     /* Prevent light leaks due to the use of shading normals */
                     if (!bsdfVal.isZero() && (!m_strictNormals
                             || dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) > 0)) {
 
-                        /* Calculate prob. of having generated that direction
-                           using BSDF sampling */
-                        Float bsdfPdf = (emitter->isOnSurface() && dRec.measure == ESolidAngle)
-                            ? bsdf->pdf(bRec) : 0;
-
                         /* Weight using the power heuristic */
                         Float weight = miWeight(dRec.pdf, bsdfPdf);
-                        Li += throughput * value * bsdfVal * weight;
+                        Spectrum contribution = throughput * value * bsdfVal * weight;
+                        Li += contribution;
+                        record.addRadiance(contribution);
                     }
                 }
             }
@@ -203,10 +440,12 @@ public:
             /*                            BSDF sampling                             */
             /* ==================================================================== */
 
-            /* Sample BSDF * cos(theta) */
+            /* Sample BSDF * cos(theta), possibly mixed with the guiding distribution */
             Float bsdfPdf;
             BSDFSamplingRecord bRec(its, rRec.sampler, ERadiance);
-            Spectrum bsdfWeight = bsdf->sample(bRec, bsdfPdf, rRec.nextSample2D());
+            Spectrum bsdfWeight = region
+                ? guide->sample(region, bsdf, bRec, bsdfPdf, rRec.nextSample2D())
+                : MTS_HOTPATH_TIMED(bsdfSample, bsdf->sample(bRec, bsdfPdf, rRec.nextSample2D()));
             if (bsdfWeight.isZero())
                 break;
 
@@ -218,11 +457,17 @@ public:
             if (m_strictNormals && woDotGeoN * Frame::cosTheta(bRec.wo) <= 0)
                 break;
 
+            /* Radiance that is expected to arrive from this direction (ADRRS only) */
+            Float radianceEstimate = pixelEstimate > 0
+                ? guide->estimateRadiance(region, wo) : (Float) 0.0f;
+
             bool hitEmitter = false;
             Spectrum value;
 
             /* Trace a ray in this direction */
-            ray = Ray(its.p, wo, ray.time);
+            RayDifferential next(its.p, wo, ray.time);
+            continueRayCone(ray, its.t, bRec.sampledType & BSDF::EDelta, bsdfPdf, next);
+            ray = next;
             if (scene->rayIntersect(ray, its)) {
                 /* Intersected something - check if it was a luminaire */
                 if (its.isEmitter()) {
@@ -252,6 +497,10 @@ public:
             throughput *= bsdfWeight;
             eta *= bRec.eta;
 
+            /* Degenerate directions are not learned by the guiding distribution */
+            bool recorded = training && !(bRec.sampledType & BSDF::EDelta)
+                && record.append(region, wo, throughput, bsdfPdf);
+
             /* If a luminaire was hit, estimate the local illumination and
                weight using the power heuristic */
             if (hitEmitter &&
@@ -260,7 +509,14 @@ public:
                    implemented direct illumination sampling technique */
                 const Float lumPdf = (!(bRec.sampledType & BSDF::EDelta)) ?
                     scene->pdfEmitterDirect(dRec) : 0;
-                Li += throughput * value * miWeight(bsdfPdf, lumPdf);
+                Spectrum contribution = throughput * value * miWeight(bsdfPdf, lumPdf);
+                Li += contribution;
+
+                /* The new vertex learns the full radiance along its direction */
+                if (recorded)
+                    record.addRadiance(contribution, throughput * value);
+                else
+                    record.addRadiance(contribution);
             }
 
             /* ==================================================================== */
@@ -273,7 +529,24 @@ public:
                 break;
             rRec.type = RadianceQueryRecord::ERadianceNoEmission;
 
-            if (rRec.depth++ >= m_rrDepth) {
+            if (radianceEstimate > 0) {
+                /* Adjoint-driven Russian roulette and splitting: compare the
+                   expected contribution of the path to the pixel value */
+                rRec.depth++;
+                int copies = guide->rouletteAndSplit(throughput, radianceEstimate,
+                    pixelEstimate, rRec.nextSample1D(), 1 + splitBudget);
+                if (copies == 0)
+                    break;
+                splitBudget -= copies - 1;
+
+                for (int i=1; i<copies; ++i) {
+                    RadianceQueryRecord rRecCopy(rRec);
+                    rRecCopy.its = its;
+                    RayDifferential rayCopy(ray);
+                    Li += tracePath(rayCopy, rRecCopy, throughput, eta,
+                        scattered, record, pixelEstimate, splitBudget);
+                }
+            } else if (rRec.depth++ >= m_rrDepth) {
                 /* Russian roulette: try to keep path weights equal to one,
                    while accounting for the solid angle compression at refractive
                    index boundaries. Stop with at least some probability to avoid
@@ -286,21 +559,416 @@ public:
             }
         }
 
-        /* Store statistics */
-        avgPathLength.incrementBase();
-        avgPathLength += rRec.depth;
-
         return Li;
     }
 
+    void renderBlockSamples(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points,
+            size_t firstSample, size_t sampleCount) const {
+        if (m_wavefront && !m_primaryHits.get())
+            renderBlockWavefront(scene, sensor, sampler, block, stop,
+                points, firstSample, sampleCount);
+        else
+            MonteCarloIntegrator::renderBlockSamples(scene, sensor, sampler,
+                block, stop, points, firstSample, sampleCount);
+    }
+
+    /* ==================================================================== */
+    /*                            Wavefront mode                            */
+    /* ==================================================================== */
+
+    /// State of a path that is advanced in wavefront mode
+    struct WavefrontPath {
+        RadianceQueryRecord rRec;
+        RayDifferential ray;
+        DirectSamplingRecord dRec;
+        Spectrum throughput, Li;
+        Float eta;
+        bool scattered;
+
+        /* Material at the current vertex */
+        const BSDF *bsdf;
+
+        /* How the direction of the current ray was sampled (if bounced) */
+        bool bounced;
+        unsigned int sampledType;
+        Float bsdfPdf;
+
+        /* Pixel and key of the random number sequence */
+        Point2i pixel;
+        uint32_t point;
+        uint32_t key, dimension;
+
+        Spectrum aovs[RadianceQueryRecord::EAOVCount];
+
+        inline WavefrontPath(const Scene *scene, Sampler *sampler)
+            : rRec(scene, sampler) { }
+    };
+
+    /**
+     * \brief Render a block in wavefront mode: all paths of a batch of
+     * pixels are advanced together, one bounce at a time
+     * (see \ref SamplingIntegrator::renderBlockSamples())
+     */
+    void renderBlockWavefront(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points,
+            size_t firstSample, size_t sampleCount) const {
+        sampleCount = std::min(sampleCount, sampler->getSampleCount() - firstSample);
+
+        Float diffScaleFactor = 1.0f / std::sqrt((Float) sampler->getSampleCount());
+        bool needsApertureSample = sensor->needsApertureSample();
+        bool needsTimeSample = sensor->needsTimeSample();
+        const ReconstructionFilter *rfilter = sensor->getFilm()->getReconstructionFilter();
+        bool importanceSampled = rfilter->isImportanceSampled();
+        int filmWidth = sensor->getFilm()->getSize().x;
+
+        block->clear();
+
+        uint32_t queryType = RadianceQueryRecord::ESensorRay;
+        if (!sensor->getFilm()->hasAlpha()) /* Don't compute an alpha channel if we don't have to */
+            queryType &= ~RadianceQueryRecord::EOpacity;
+
+        /* Record per-pixel sample statistics if the block has a variance buffer */
+        bool recordVariance = block->hasVariance();
+
+        /* Number of pixels, whose paths are advanced together */
+        size_t pixelsPerBatch = std::max((size_t) 1,
+            (size_t) MTS_WAVEFRONT_PATHS / std::max(sampleCount, (size_t) 1));
+        size_t maxPaths = pixelsPerBatch * sampleCount;
+
+        ref<WavefrontPathSampler> pathSampler = new WavefrontPathSampler();
+        RadianceQueryRecord sensorRec(scene, sampler);
+        std::vector<WavefrontPath> paths(maxPaths, WavefrontPath(scene, pathSampler));
+        std::vector<RayDifferential> sensorRays(maxPaths);
+        std::vector<Ray> rays(maxPaths);
+        std::vector<Intersection> its(maxPaths);
+        std::vector<Point2> samplePos(maxPaths);
+        std::vector<Point2> apertureSamples(needsApertureSample ? maxPaths : 0);
+        std::vector<Float> timeSamples(needsTimeSample ? maxPaths : 0);
+        std::vector<Spectrum> weights(maxPaths);
+        std::vector<Float> filterWeights(maxPaths);
+        std::vector<uint32_t> active;
+        std::vector<std::pair<const BSDF *, uint32_t> > queue;
+        active.reserve(maxPaths);
+        queue.reserve(maxPaths);
+        ShadowRayQueue shadowRays(scene, maxPaths);
+
+        Float *temp = m_aovs ? (Float *) alloca(sizeof(Float) *
+            ((1 + RadianceQueryRecord::EAOVCount) * SPECTRUM_SAMPLES + 2)) : NULL;
+
+        for (size_t i = 0; i<points.size(); i += pixelsPerBatch) {
+            if (stop)
+                break;
+
+            size_t pixelCount = std::min(pixelsPerBatch, points.size() - i);
+
+            /* 1. Generate the sensor rays of all paths in the batch */
+            size_t pathCount = 0;
+            for (size_t k = 0; k<pixelCount; ++k) {
+                Point2i offset = Point2i(points[i+k]) + Vector2i(block->getOffset());
+                sampler->generate(offset);
+                if (firstSample > 0)
+                    sampler->setSampleIndex(firstSample);
+
+                for (size_t j = 0; j<sampleCount; j++) {
+                    sensorRec.newQuery(queryType, sensor->getMedium());
+                    samplePos[pathCount] = rfilter->samplePosition(offset,
+                        sensorRec.nextSample2D(), filterWeights[pathCount]);
+
+                    if (needsApertureSample)
+                        apertureSamples[pathCount] = sensorRec.nextSample2D();
+                    if (needsTimeSample)
+                        timeSamples[pathCount] = sensorRec.nextSample1D();
+
+                    WavefrontPath &path = paths[pathCount];
+                    path.pixel = offset;
+                    path.point = (uint32_t) (i + k);
+                    path.key = (uint32_t) sampleTEA(
+                        (uint32_t) (offset.x + offset.y * filmWidth),
+                        (uint32_t) (firstSample + j));
+
+                    ++pathCount;
+                    sampler->advance();
+                }
+            }
+
+            sensor->sampleRayDifferentials(pathCount, &samplePos[0],
+                needsApertureSample ? &apertureSamples[0] : NULL,
+                needsTimeSample ? &timeSamples[0] : NULL,
+                &sensorRays[0], &weights[0]);
+
+            for (size_t k = 0; k<pathCount; ++k) {
+                sensorRays[k].scaleDifferential(diffScaleFactor);
+                rays[k] = sensorRays[k];
+            }
+
+            /* 2. Trace them */
+            scene->rayIntersectStream(&rays[0], &its[0], pathCount);
+
+            active.clear();
+            for (size_t k = 0; k<pathCount; ++k) {
+                WavefrontPath &path = paths[k];
+                RadianceQueryRecord &rRec = path.rRec;
+                rRec.newQuery(queryType, sensor->getMedium());
+                rRec.setIntersection(sensorRays[k], its[k]);
+                if (m_aovs) {
+                    rRec.aovs = path.aovs;
+                    rRec.recordAOVs(sensorRays[k]);
+                }
+                path.ray = sensorRays[k];
+                path.ray.mint = Epsilon;
+                path.throughput = Spectrum(1.0f);
+                path.Li = Spectrum(0.0f);
+                path.eta = 1.0f;
+                path.scattered = false;
+                path.bounced = false;
+                path.dimension = 0;
+                active.push_back((uint32_t) k);
+            }
+
+            /* 3. Advance the paths one bounce at a time */
+            while (!active.empty()) {
+                /* Account for the new vertices and sort them by material */
+                queue.clear();
+                for (size_t k = 0; k<active.size(); ++k) {
+                    WavefrontPath &path = paths[active[k]];
+                    if (beginVertex(path, pathSampler))
+                        queue.push_back(std::make_pair(path.bsdf, active[k]));
+                }
+                std::sort(queue.begin(), queue.end());
+
+                /* Shade coherent batches of intersections */
+                active.clear();
+                for (size_t k = 0; k<queue.size(); ++k) {
+                    if (shadeVertex(paths[queue[k].second], pathSampler, shadowRays))
+                        active.push_back(queue[k].second);
+                }
+                shadowRays.flush();
+
+                /* Trace the continuations in the original (coherent) order */
+                std::sort(active.begin(), active.end());
+                for (size_t k = 0; k<active.size(); ++k)
+                    rays[k] = paths[active[k]].ray;
+                scene->rayIntersectStream(&rays[0], &its[0], active.size());
+                for (size_t k = 0; k<active.size(); ++k)
+                    paths[active[k]].rRec.its = its[k];
+            }
+
+            /* 4. Store the samples */
+            for (size_t k = 0; k<pathCount; ++k) {
+                WavefrontPath &path = paths[k];
+                Spectrum spec = weights[k] * path.Li;
+
+                bool valid = putSensorSample(block, importanceSampled, path.pixel,
+                    samplePos[k], filterWeights[k], spec, path.rRec.alpha,
+                    m_aovs ? path.aovs : NULL, temp);
+                if (valid && recordVariance)
+                    block->putVariance(Point2i(points[path.point]), spec.getLuminance());
+
+                avgPathLength.incrementBase();
+                avgPathLength += path.rRec.depth;
+            }
+        }
+    }
+
+    /**
+     * \brief Account for the vertex that was found by the last ray of a
+     * path in wavefront mode (same steps as in \ref tracePath())
+     *
+     * \return \c false if the path terminates at this vertex
+     */
+    bool beginVertex(WavefrontPath &path, WavefrontPathSampler *sampler) const {
+        RadianceQueryRecord &rRec = path.rRec;
+        const Scene *scene = rRec.scene;
+        Intersection &its = rRec.its;
+        RayDifferential &ray = path.ray;
+
+        sampler->setPath(path.key, path.dimension);
+
+        bool alive = true;
+        if (path.bounced) {
+            bool hitEmitter = false;
+            Spectrum value;
+
+            if (its.isValid()) {
+                /* Intersected something - check if it was a luminaire */
+                if (its.isEmitter()) {
+                    value = its.Le(-ray.d);
+                    path.dRec.setQuery(ray, its);
+                    hitEmitter = true;
+                }
+            } else {
+                /* Intersected nothing -- perhaps there is an environment map? */
+                const Emitter *env = scene->getEnvironmentEmitter();
+
+                if (env && !(m_hideEmitters && !path.scattered)) {
+                    value = env->evalEnvironment(ray);
+                    hitEmitter = env->fillDirectSamplingRecord(path.dRec, ray);
+                }
+                alive = false;
+            }
+
+            /* If a luminaire was hit, estimate the local illumination and
+               weight using the power heuristic */
+            if (hitEmitter &&
+                (rRec.type & RadianceQueryRecord::EDirectSurfaceRadiance)) {
+                const Float lumPdf = (!(path.sampledType & BSDF::EDelta)) ?
+                    scene->pdfEmitterDirect(path.dRec) : 0;
+                path.Li += path.throughput * value * miWeight(path.bsdfPdf, lumPdf);
+            }
+
+            if (!alive || !(rRec.type & RadianceQueryRecord::EIndirectSurfaceRadiance))
+                return false;
+            rRec.type = RadianceQueryRecord::ERadianceNoEmission;
+
+            if (rRec.depth++ >= m_rrDepth) {
+                /* Russian roulette (see tracePath()) */
+                Float q = std::min(path.throughput.max() * path.eta * path.eta, (Float) 0.95f);
+                if (rRec.nextSample1D() >= q)
+                    alive = false;
+                else
+                    path.throughput /= q;
+            }
+        }
+
+        if (alive && !(rRec.depth <= m_maxDepth || m_maxDepth < 0))
+            alive = false;
+
+        if (alive && !its.isValid()) {
+            /* Radiance from an environment luminaire (sensor rays only) */
+            if ((rRec.type & RadianceQueryRecord::EEmittedRadiance)
+                && (!m_hideEmitters || path.scattered))
+                path.Li += path.throughput * scene->evalEnvironment(ray);
+            alive = false;
+        }
+
+        if (alive) {
+            path.bsdf = its.getBSDF(ray);
+
+            /* Possibly include emitted radiance if requested */
+            if (its.isEmitter() && (rRec.type & RadianceQueryRecord::EEmittedRadiance)
+                && (!m_hideEmitters || path.scattered))
+                path.Li += path.throughput * its.Le(-ray.d);
+
+            /* Include radiance from a subsurface scattering model if requested */
+            if (its.hasSubsurface() && (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance))
+                path.Li += path.throughput * its.LoSub(scene, rRec.sampler, -ray.d, rRec.depth);
+
+            if ((rRec.depth >= m_maxDepth && m_maxDepth > 0)
+                || (m_strictNormals && dot(ray.d, its.geoFrame.n)
+                    * Frame::cosTheta(its.wi) >= 0))
+                alive = false;
+        }
+
+        path.dimension = sampler->getDimension();
+        return alive;
+    }
+
+    /**
+     * \brief Sample the direct illumination and the next direction at the
+     * current vertex of a path in wavefront mode
+     *
+     * The shadow ray of the direct illumination estimate is pushed to
+     * \c shadowRays, which adds its contribution when it is flushed.
+     *
+     * \return \c false if the path terminates at this vertex
+     */
+    bool shadeVertex(WavefrontPath &path, WavefrontPathSampler *sampler,
+            ShadowRayQueue &shadowRays) const {
+        RadianceQueryRecord &rRec = path.rRec;
+        const Scene *scene = rRec.scene;
+        const Intersection &its = rRec.its;
+        const BSDF *bsdf = path.bsdf;
+        DirectSamplingRecord &dRec = path.dRec;
+
+        sampler->setPath(path.key, path.dimension);
+        dRec = DirectSamplingRecord(its);
+
+        /* Estimate the direct illumination if this is requested */
+        if (rRec.type & RadianceQueryRecord::EDirectSurfaceRadiance &&
+            (bsdf->getType() & BSDF::ESmooth)) {
+            Spectrum value = scene->sampleEmitterDirect(dRec, rRec.nextSample2D(), false);
+            if (!value.isZero()) {
+                const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+
+                /* Evaluate BSDF * cos(theta) and, when needed for MIS, the
+                   prob. of having generated that direction using BSDF sampling */
+                BSDFSamplingRecord bRec(its, its.toLocal(dRec.d), ERadiance);
+                Float bsdfPdf = 0;
+                const Spectrum bsdfVal = MTS_HOTPATH_TIMED(bsdfEval,
+                    (emitter->isOnSurface() && dRec.measure == ESolidAngle)
+                    ? bsdf->evalWithPdf(bRec, bsdfPdf) : bsdf->eval(bRec));
+
+                /* Prevent light leaks due to the use of shading normals */
+                if (!bsdfVal.isZero() && (!m_strictNormals
+                        || dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) > 0)) {
+                    shadowRays.push(Ray(dRec.ref, dRec.d, Epsilon,
+                        dRec.dist*(1-ShadowEpsilon), dRec.time),
+                        path.throughput * value * bsdfVal * miWeight(dRec.pdf, bsdfPdf),
+                        &path.Li);
+                }
+            }
+        }
+
+        /* Sample BSDF * cos(theta) */
+        Float bsdfPdf;
+        BSDFSamplingRecord bRec(its, rRec.sampler, ERadiance);
+        Spectrum bsdfWeight = MTS_HOTPATH_TIMED(bsdfSample,
+            bsdf->sample(bRec, bsdfPdf, rRec.nextSample2D()));
+        path.dimension = sampler->getDimension();
+        if (bsdfWeight.isZero())
+            return false;
+
+        path.scattered |= bRec.sampledType != BSDF::ENull;
+
+        /* Prevent light leaks due to the use of shading normals */
+        const Vector wo = its.toWorld(bRec.wo);
+        if (m_strictNormals && dot(its.geoFrame.n, wo) * Frame::cosTheta(bRec.wo) <= 0)
+            return false;
+
+        /* The ray in this direction is traced by the caller */
+        RayDifferential next(its.p, wo, path.ray.time);
+        continueRayCone(path.ray, its.t, bRec.sampledType & BSDF::EDelta, bsdfPdf, next);
+        path.ray = next;
+
+        /* Keep track of the throughput and relative
+           refractive index along the path */
+        path.throughput *= bsdfWeight;
+        path.eta *= bRec.eta;
+        path.bsdfPdf = bsdfPdf;
+        path.sampledType = bRec.sampledType;
+        path.bounced = true;
+        return true;
+    }
+
     inline Float miWeight(Float pdfA, Float pdfB) const {
         pdfA *= pdfA;
         pdfB *= pdfB;
         return pdfA / (pdfA + pdfB);
     }
 
+    bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        if (!m_guide)
+            return MonteCarloIntegrator::render(scene, queue, job,
+                sceneResID, sensorResID, samplerResID);
+        return m_guide->render(this, scene, queue, job,
+            sceneResID, sensorResID, samplerResID);
+    }
+
+    void cancel() {
+        if (m_guide)
+            m_guide->cancel();
+        MonteCarloIntegrator::cancel();
+    }
+
     void serialize(Stream *stream, InstanceManager *manager) const {
+        if (m_guide.get())
+            Log(EError, "Path guiding is not supported in network rendering!");
         MonteCarloIntegrator::serialize(stream, manager);
+        stream->writeBool(m_wavefront);
     }
 
     std::string toString() const {
@@ -308,14 +976,21 @@ public:
         oss << "MIPathTracer[" << endl
             << "  maxDepth = " << m_maxDepth << "," << endl
             << "  rrDepth = " << m_rrDepth << "," << endl
-            << "  strictNormals = " << m_strictNormals << endl
+            << "  strictNormals = " << m_strictNormals << "," << endl
+            << "  rayCones = " << m_rayCones << "," << endl
+            << "  wavefront = " << m_wavefront << "," << endl
+            << "  guide = " << (m_guide.get() ? indent(m_guide->toString()) : "null") << endl
             << "]";
         return oss.str();
     }
 
     MTS_DECLARE_CLASS()
+private:
+    ref<PathGuide> m_guide;
+    bool m_wavefront;
 };
 
+MTS_IMPLEMENT_CLASS(WavefrontPathSampler, false, Sampler)
 MTS_IMPLEMENT_CLASS_S(MIPathTracer, false, MonteCarloIntegrator)
 MTS_EXPORT_PLUGIN(MIPathTracer, "MI path tracer");
 MTS_NAMESPACE_END
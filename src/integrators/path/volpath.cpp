@@ -17,6 +17,8 @@
 */
 
 #include <mitsuba/render/scene.h>
+#include <mitsuba/render/trcache.h>
+#include <mitsuba/render/guiding.h>
 #include <mitsuba/core/statistics.h>
 
 MTS_NAMESPACE_BEGIN
@@ -45,6 +47,41 @@ static StatsCounter avgPathLength("Volumetric path tracer", "Average path length
  *        See page~\pageref{sec:hideemitters} for details.
  *        \default{no, i.e. \code{false}}
  *     }
+ *     \parameter{aovs}{\Boolean}{Also store the albedo, shading normal,
+ *        distance and shape index of the first surface interaction in
+ *        additional film channels? See page~\pageref{sec:aovs} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{rayCones}{\Boolean}{Propagate the ray differentials of
+ *        the camera ray along the path, so that textures seen at indirect
+ *        bounces are filtered with a wider footprint? See
+ *        page~\pageref{sec:raycones} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{shadowCacheResolution}{\Integer}{When set to a nonzero
+ *        value, the transmittance towards directional emitters is precomputed
+ *        on a grid with this many vertices along the longest axis of the scene,
+ *        which replaces the shadow rays of medium vertices. See below for
+ *        details. \default{\code{0}, i.e. disabled}
+ *     }
+ *     \parameter{shadowCacheSamples}{\Integer}{Number of transmittance
+ *        estimates that are averaged per vertex of the shadow cache
+ *        \default{\code{16}}
+ *     }
+ *     \parameter{guiding}{\Boolean}{Learn a distribution of the incident
+ *        radiance while rendering and use it to sample directions at
+ *        surface interactions? See page~\pageref{sec:guiding} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{adrrs}{\Boolean}{Use adjoint-driven Russian roulette
+ *        and splitting? See page~\pageref{sec:guiding} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{guidingBSDFFraction, guidingSpatialThreshold,
+ *        guidingDirectionalThreshold, guidingMaxMemory}{}{
+ *        Parameters of the learned distribution. These have the same
+ *        meaning as for the \pluginref{path} plugin.
+ *     }
  * }
  *
  * This plugin provides a volumetric path tracer that can be used to
@@ -64,6 +101,22 @@ static StatsCounter avgPathLength("Volumetric path tracer", "Average path length
  * index-matched boundaries that involve some amount of interaction.} BSDF assigned
  * to it (as compared to, say, a \pluginref{dielectric} or \pluginref{roughdielectric} BSDF).
  *
+ * In scenes with a dominant \pluginref{directional} emitter (or a
+ * \pluginref{sun} with \code{sunRadiusScale=0}), most of the rendering time
+ * can be spent tracing shadow rays through heterogeneous media. The
+ * \code{shadowCacheResolution} parameter enables a deep shadow cache that
+ * stores the transmittance towards each such emitter for every medium
+ * of the scene; it is computed in parallel before rendering starts. Since
+ * the cache is interpolated, it blurs shadows below its resolution and
+ * thus introduces bias; an estimate of the resulting error is printed
+ * after its construction. Surface vertices always trace shadow rays.
+ *
+ * Path guiding (\code{guiding}) and adjoint-driven Russian roulette and
+ * splitting (\code{adrrs}) work as described for the \pluginref{path}
+ * plugin. The learned distribution is only used at surface interactions;
+ * medium interactions keep sampling the phase function, but the radiance
+ * that is found through them is part of the training data.
+ *
  * \remarks{
  *    \item This integrator will generally perform poorly when rendering
  *      participating media that have a different index of refraction compared
@@ -75,33 +128,126 @@ static StatsCounter avgPathLength("Volumetric path tracer", "Average path length
  */
 class VolumetricPathTracer : public MonteCarloIntegrator {
 public:
-    VolumetricPathTracer(const Properties &props) : MonteCarloIntegrator(props) { }
+    VolumetricPathTracer(const Properties &props) : MonteCarloIntegrator(props) {
+        m_shadowCacheResolution = props.getInteger("shadowCacheResolution", 0);
+        m_shadowCacheSamples = props.getInteger("shadowCacheSamples", 16);
+        if (props.getBoolean("guiding", false) || props.getBoolean("adrrs", false))
+            m_guide = new PathGuide(props);
+    }
 
     /// Unserialize from a binary data stream
     VolumetricPathTracer(Stream *stream, InstanceManager *manager)
-     : MonteCarloIntegrator(stream, manager) { }
+     : MonteCarloIntegrator(stream, manager) {
+        m_shadowCacheResolution = stream->readInt();
+        m_shadowCacheSamples = stream->readInt();
+        if (stream->readBool())
+            m_shadowCache = new TransmittanceCache(stream, manager);
+    }
+
+    bool preprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        if (!MonteCarloIntegrator::preprocess(scene, queue, job,
+                sceneResID, sensorResID, samplerResID))
+            return false;
+
+        m_shadowCache = NULL;
+        if (m_shadowCacheResolution > 0 && scene->hasMedia()) {
+            ref<TransmittanceCache> cache = new TransmittanceCache(
+                m_shadowCacheResolution, m_shadowCacheSamples);
+            m_shadowCache = cache;
+            bool success = cache->build(scene, job, sceneResID, samplerResID);
+            m_shadowCache = (success && !cache->isEmpty()) ? cache.get() : NULL;
+            if (!success)
+                return false;
+        }
+        return true;
+    }
+
+    void wakeup(ConfigurableObject *parent,
+            std::map<std::string, SerializableObject *> &params) {
+        MonteCarloIntegrator::wakeup(parent, params);
+        if (m_shadowCache && params.find("scene") != params.end())
+            m_shadowCache->bind(static_cast<Scene *>(params["scene"]));
+    }
+
+    bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        if (!m_guide)
+            return MonteCarloIntegrator::render(scene, queue, job,
+                sceneResID, sensorResID, samplerResID);
+        return m_guide->render(this, scene, queue, job,
+            sceneResID, sensorResID, samplerResID);
+    }
+
+    void cancel() {
+        if (m_shadowCache)
+            m_shadowCache->cancel();
+        if (m_guide)
+            m_guide->cancel();
+        MonteCarloIntegrator::cancel();
+    }
 
     Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
-        /* Some aliases and local variables */
-        const Scene *scene = rRec.scene;
-        Intersection &its = rRec.its;
-        MediumSamplingRecord mRec;
         RayDifferential ray(r);
-        Spectrum Li(0.0f);
-        Float eta = 1.0f;
 
         /* Perform the first ray intersection (or ignore if the
            intersection has already been provided). */
         rRec.rayIntersect(ray);
+        rRec.recordAOVs(ray);
+
+        /* Vertices whose incident radiance is used to train the guiding distribution */
+        const PathGuide *guide = m_guide.get();
+        bool training = guide && guide->isTraining();
+        PathGuide::PathRecord record;
+
+        /* Expected pixel value for adjoint-driven Russian roulette and splitting */
+        Float pixelEstimate = (guide && guide->hasADRRS())
+            ? guide->estimatePixel(rRec.scene->getSensor(), r) : (Float) 0.0f;
+        int splitBudget = MTS_ADRRS_MAX_SPLIT;
+
+        Spectrum Li = tracePath(ray, rRec, Spectrum(1.0f), 1.0f, false,
+            record, pixelEstimate, splitBudget);
 
-        Spectrum throughput(1.0f);
-        bool scattered = false;
+        if (training)
+            record.commit();
+        avgPathLength.incrementBase();
+        avgPathLength += rRec.depth;
+        return Li;
+    }
+
+    /**
+     * \brief Continue a path at the intersection \c rRec.its, which was
+     * found by tracing \c ray (through the medium \c rRec.medium)
+     *
+     * Paths that are split by ADRRS continue via recursive calls, which
+     * take at most \c splitBudget additional copies in total.
+     */
+    Spectrum tracePath(RayDifferential &ray, RadianceQueryRecord &rRec,
+            Spectrum throughput, Float eta, bool scattered,
+            PathGuide::PathRecord &record, Float pixelEstimate,
+            int &splitBudget) const {
+        /* Some aliases and local variables */
+        const Scene *scene = rRec.scene;
+        Intersection &its = rRec.its;
+        MediumSamplingRecord mRec;
+
+        /* The detailed record of a surface hit is only computed once the
+           path actually reaches it (i.e. no medium interaction occurs) */
+        DeferredIntersection hit;
+        bool deferred = false;
+        const PathGuide *guide = m_guide.get();
+        bool training = guide && guide->isTraining();
+        Spectrum Li(0.0f);
 
         while (rRec.depth <= m_maxDepth || m_maxDepth < 0) {
+            /* Radiance that is expected to arrive along the sampled direction (ADRRS only) */
+            Float radianceEstimate = 0.0f;
+
             /* ==================================================================== */
             /*                 Radiative Transfer Equation sampling                 */
             /* ==================================================================== */
-            if (rRec.medium && rRec.medium->sampleDistance(Ray(ray, 0, its.t), mRec, rRec.sampler)) {
+            if (rRec.medium && MTS_HOTPATH_TIMED(mediumSample,
+                    rRec.medium->sampleDistance(Ray(ray, 0, its.t), mRec, rRec.sampler))) {
                 /* Sample the integral
                    \int_x^y tau(x, x') [ \sigma_s \int_{S^2} \rho(\omega,\omega') L(x,\omega') d\omega' ] dx'
                 */
@@ -124,7 +270,7 @@ public:
 
                     Spectrum value = scene->sampleAttenuatedEmitterDirect(
                             dRec, rRec.medium, interactions,
-                            rRec.nextSample2D(), rRec.sampler);
+                            rRec.nextSample2D(), rRec.sampler, m_shadowCache.get());
 
                     if (!value.isZero()) {
                         const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
@@ -141,7 +287,9 @@ public:
 
                             /* Weight using the power heuristic */
                             const Float weight = miWeight(dRec.pdf, phasePdf);
-                            Li += throughput * value * phaseVal * weight;
+                            Spectrum contribution = throughput * value * phaseVal * weight;
+                            Li += contribution;
+                            record.addRadiance(contribution);
                         }
                     }
                 }
@@ -158,18 +306,22 @@ public:
                 throughput *= phaseVal;
 
                 /* Trace a ray in this direction */
-                ray = Ray(mRec.p, pRec.wo, ray.time);
+                RayDifferential next(mRec.p, pRec.wo, ray.time);
+                continueRayCone(ray, mRec.t, false, phasePdf, next);
+                ray = next;
                 ray.mint = 0;
 
                 Spectrum value(0.0f);
                 rayIntersectAndLookForEmitter(scene, rRec.sampler, rRec.medium,
-                    m_maxDepth - rRec.depth - 1, ray, its, dRec, value);
+                    m_maxDepth - rRec.depth - 1, ray, its, hit, deferred, dRec, value);
 
                 /* If a luminaire was hit, estimate the local illumination and
                    weight using the power heuristic */
                 if (!value.isZero() && (rRec.type & RadianceQueryRecord::EDirectMediumRadiance)) {
                     const Float emitterPdf = scene->pdfEmitterDirect(dRec);
-                    Li += throughput * value * miWeight(phasePdf, emitterPdf);
+                    Spectrum contribution = throughput * value * miWeight(phasePdf, emitterPdf);
+                    Li += contribution;
+                    record.addRadiance(contribution);
                 }
 
                 /* ==================================================================== */
@@ -188,6 +340,11 @@ public:
                 if (rRec.medium)
                     throughput *= mRec.transmittance / mRec.pdfFailure;
 
+                if (deferred) {
+                    scene->fillIntersectionRecord(ray, hit, its);
+                    deferred = false;
+                }
+
                 if (!its.isValid()) {
                     /* If no intersection could be found, possibly return
                        attenuated radiance from a background luminaire */
@@ -197,6 +354,7 @@ public:
                         if (rRec.medium)
                             value *= rRec.medium->evalTransmittance(ray, rRec.sampler);
                         Li += value;
+                        record.addRadiance(value);
                     }
 
                     break;
@@ -204,12 +362,18 @@ public:
 
                 /* Possibly include emitted radiance if requested */
                 if (its.isEmitter() && (rRec.type & RadianceQueryRecord::EEmittedRadiance)
-                    && (!m_hideEmitters || scattered))
-                    Li += throughput * its.Le(-ray.d);
+                    && (!m_hideEmitters || scattered)) {
+                    Spectrum value = throughput * its.Le(-ray.d);
+                    Li += value;
+                    record.addRadiance(value);
+                }
 
                 /* Include radiance from a subsurface integrator if requested */
-                if (its.hasSubsurface() && (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance))
-                    Li += throughput * its.LoSub(scene, rRec.sampler, -ray.d, rRec.depth);
+                if (its.hasSubsurface() && (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance)) {
+                    Spectrum value = throughput * its.LoSub(scene, rRec.sampler, -ray.d, rRec.depth);
+                    Li += value;
+                    record.addRadiance(value);
+                }
 
                 if (rRec.depth >= m_maxDepth && m_maxDepth != -1)
                     break;
@@ -227,6 +391,9 @@ public:
                 const BSDF *bsdf = its.getBSDF(ray);
                 DirectSamplingRecord dRec(its);
 
+                /* Region of the guiding distribution, if enabled */
+                const PathGuide::Region *region = guide ? guide->lookup(its.p) : NULL;
+
                 /* Estimate the direct illumination if this is requested */
                 if ((rRec.type & RadianceQueryRecord::EDirectSurfaceRadiance) &&
                     (bsdf->getType() & BSDF::ESmooth)) {
@@ -239,24 +406,26 @@ public:
                     if (!value.isZero()) {
                         const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
 
-                        /* Evaluate BSDF * cos(theta) */
+                        /* Evaluate BSDF * cos(theta) and, when needed for MIS, the
+                           prob. of having generated that direction using BSDF sampling */
                         BSDFSamplingRecord bRec(its, its.toLocal(dRec.d));
-                        const Spectrum bsdfVal = bsdf->eval(bRec);
+                        Float bsdfPdf = 0.0f;
+                        const Spectrum bsdfVal = MTS_HOTPATH_TIMED(bsdfEval,
+                                (emitter->isOnSurface() && dRec.measure == ESolidAngle)
+                                ? bsdf->evalWithPdf(bRec, bsdfPdf) : bsdf->eval(bRec));
+                        if (region && bsdfPdf > 0)
+                            bsdfPdf = guide->pdf(region, bsdf, bsdfPdf, dRec.d);
 
                         Float woDotGeoN = dot(its.geoFrame.n, dRec.d);
 
                         /* Prevent light leaks due to the use of shading normals */
                         if (!bsdfVal.isZero() && (!m_strictNormals ||
                             woDotGeoN * Frame::cosTheta(bRec.wo) > 0)) {
-                            /* Calculate prob. of having generated that direction
-                               using BSDF sampling */
-                            Float bsdfPdf = (emitter->isOnSurface()
-                                    && dRec.measure == ESolidAngle)
-                                    ? bsdf->pdf(bRec) : (Float) 0.0f;
-
                             /* Weight using the power heuristic */
                             const Float weight = miWeight(dRec.pdf, bsdfPdf);
-                            Li += throughput * value * bsdfVal * weight;
+                            Spectrum contribution = throughput * value * bsdfVal * weight;
+                            Li += contribution;
+                            record.addRadiance(contribution);
                         }
                     }
                 }
@@ -266,10 +435,12 @@ public:
                 /*                            BSDF sampling                             */
                 /* ==================================================================== */
 
-                /* Sample BSDF * cos(theta) */
+                /* Sample BSDF * cos(theta), possibly mixed with the guiding distribution */
                 BSDFSamplingRecord bRec(its, rRec.sampler, ERadiance);
                 Float bsdfPdf;
-                Spectrum bsdfWeight = bsdf->sample(bRec, bsdfPdf, rRec.nextSample2D());
+                Spectrum bsdfWeight = region
+                    ? guide->sample(region, bsdf, bRec, bsdfPdf, rRec.nextSample2D())
+                    : MTS_HOTPATH_TIMED(bsdfSample, bsdf->sample(bRec, bsdfPdf, rRec.nextSample2D()));
                 if (bsdfWeight.isZero())
                     break;
 
@@ -279,8 +450,13 @@ public:
                 if (woDotGeoN * Frame::cosTheta(bRec.wo) <= 0 && m_strictNormals)
                     break;
 
+                if (pixelEstimate > 0)
+                    radianceEstimate = guide->estimateRadiance(region, wo);
+
                 /* Trace a ray in this direction */
-                ray = Ray(its.p, wo, ray.time);
+                RayDifferential next(its.p, wo, ray.time);
+                continueRayCone(ray, its.t, bRec.sampledType & BSDF::EDelta, bsdfPdf, next);
+                ray = next;
 
                 /* Keep track of the throughput, medium, and relative
                    refractive index along the path */
@@ -289,27 +465,40 @@ public:
                 if (its.isMediumTransition())
                     rRec.medium = its.getTargetMedium(ray.d);
 
+                /* Degenerate directions are not learned by the guiding distribution */
+                bool recorded = training && !(bRec.sampledType & BSDF::EDelta)
+                    && record.append(region, wo, throughput, bsdfPdf);
+
                 /* Handle index-matched medium transitions specially */
                 if (bRec.sampledType == BSDF::ENull) {
                     if (!(rRec.type & RadianceQueryRecord::EIndirectSurfaceRadiance))
                         break;
                     rRec.type = scattered ? RadianceQueryRecord::ERadianceNoEmission
                         : RadianceQueryRecord::ERadiance;
-                    scene->rayIntersect(ray, its);
+                    scene->rayIntersect(ray, hit);
+                    its.t = hit.t;
+                    deferred = true;
                     rRec.depth++;
                     continue;
                 }
 
                 Spectrum value(0.0f);
                 rayIntersectAndLookForEmitter(scene, rRec.sampler, rRec.medium,
-                    m_maxDepth - rRec.depth - 1, ray, its, dRec, value);
+                    m_maxDepth - rRec.depth - 1, ray, its, hit, deferred, dRec, value);
 
                 /* If a luminaire was hit, estimate the local illumination and
                    weight using the power heuristic */
                 if (!value.isZero() && (rRec.type & RadianceQueryRecord::EDirectSurfaceRadiance)) {
                     const Float emitterPdf = (!(bRec.sampledType & BSDF::EDelta)) ?
                         scene->pdfEmitterDirect(dRec) : 0;
-                    Li += throughput * value * miWeight(bsdfPdf, emitterPdf);
+                    Spectrum contribution = throughput * value * miWeight(bsdfPdf, emitterPdf);
+                    Li += contribution;
+
+                    /* The new vertex learns the full radiance along its direction */
+                    if (recorded)
+                        record.addRadiance(contribution, throughput * value);
+                    else
+                        record.addRadiance(contribution);
                 }
 
                 /* ==================================================================== */
@@ -323,7 +512,29 @@ public:
                 rRec.type = RadianceQueryRecord::ERadianceNoEmission;
             }
 
-            if (rRec.depth++ >= m_rrDepth) {
+            if (radianceEstimate > 0) {
+                /* Adjoint-driven Russian roulette and splitting: compare the
+                   expected contribution of the path to the pixel value */
+                rRec.depth++;
+                int copies = guide->rouletteAndSplit(throughput, radianceEstimate,
+                    pixelEstimate, rRec.nextSample1D(), 1 + splitBudget);
+                if (copies == 0)
+                    break;
+                splitBudget -= copies - 1;
+
+                if (deferred && copies > 1) {
+                    scene->fillIntersectionRecord(ray, hit, its);
+                    deferred = false;
+                }
+
+                for (int i=1; i<copies; ++i) {
+                    RadianceQueryRecord rRecCopy(rRec);
+                    rRecCopy.its = its;
+                    RayDifferential rayCopy(ray);
+                    Li += tracePath(rayCopy, rRecCopy, throughput, eta,
+                        true, record, pixelEstimate, splitBudget);
+                }
+            } else if (rRec.depth++ >= m_rrDepth) {
                 /* Russian roulette: try to keep path weights equal to one,
                    while accounting for the solid angle compression at refractive
                    index boundaries. Stop with at least some probability to avoid
@@ -337,8 +548,6 @@ public:
 
             scattered = true;
         }
-        avgPathLength.incrementBase();
-        avgPathLength += rRec.depth;
         return Li;
     }
 
@@ -352,7 +561,10 @@ public:
      * This function
      *
      * 1. Intersects 'ray' against the scene geometry and returns the
-     *    *first* intersection via the '_its' argument.
+     *    *first* intersection via the '_its' argument. Its detailed
+     *    record is only computed when needed here; otherwise, only
+     *    'its.t' is set, '_hit' holds the deferred intersection, and
+     *    'deferred' is set to true.
      *
      * 2. It checks whether the intersected shape was an emitter, or if
      *    the ray intersects nothing and there is an environment emitter.
@@ -369,21 +581,25 @@ public:
      */
     void rayIntersectAndLookForEmitter(const Scene *scene, Sampler *sampler,
             const Medium *medium, int maxInteractions, Ray ray, Intersection &_its,
+            DeferredIntersection &_hit, bool &deferred,
             DirectSamplingRecord &dRec, Spectrum &value) const {
         Intersection its2, *its = &_its;
-        Spectrum transmittance(1.0f);
+        DeferredIntersection hit2, *hit = &_hit;
+        TransmittanceAccumulator transmittance(medium);
         bool surface = false;
         int interactions = 0;
 
         while (true) {
-            surface = scene->rayIntersect(ray, *its);
+            surface = scene->rayIntersect(ray, *hit);
+            its->t = hit->t;
+            if (its == &_its)
+                deferred = true;
 
-            if (medium)
-                transmittance *= medium->evalTransmittance(Ray(ray, 0, its->t), sampler);
+            transmittance.append(Ray(ray, 0, its->t), sampler);
 
             if (surface && (interactions == maxInteractions ||
-                !(its->getBSDF()->getType() & BSDF::ENull) ||
-                its->isEmitter())) {
+                !(hit->shape->getBSDF()->getType() & BSDF::ENull) ||
+                hit->shape->isEmitter())) {
                 /* Encountered an occluder / light source */
                 break;
             }
@@ -394,17 +610,23 @@ public:
             if (transmittance.isZero())
                 return;
 
+            /* Pass through the index-matched boundary */
+            scene->fillIntersectionRecord(ray, *hit, *its);
+            if (its == &_its)
+                deferred = false;
+
             if (its->isMediumTransition())
-                medium = its->getTargetMedium(ray.d);
+                transmittance.setMedium(its->getTargetMedium(ray.d));
 
             Vector wo = its->shFrame.toLocal(ray.d);
             BSDFSamplingRecord bRec(*its, -wo, wo, ERadiance);
             bRec.typeMask = BSDF::ENull;
-            transmittance *= its->getBSDF()->eval(bRec, EDiscrete);
+            transmittance.scale(its->getBSDF()->eval(bRec, EDiscrete));
 
             ray.o = ray(its->t);
             ray.mint = Epsilon;
             its = &its2;
+            hit = &hit2;
 
             if (++interactions > 100) { /// Just a precaution..
                 Log(EWarn, "rayIntersectAndLookForEmitter(): round-off error issues?");
@@ -414,16 +636,19 @@ public:
 
         if (surface) {
             /* Intersected something - check if it was a luminaire */
-            if (its->isEmitter()) {
+            if (hit->shape->isEmitter()) {
+                scene->fillIntersectionRecord(ray, *hit, *its);
+                if (its == &_its)
+                    deferred = false;
                 dRec.setQuery(ray, *its);
-                value = transmittance * its->Le(-ray.d);
+                value = transmittance.get() * its->Le(-ray.d);
             }
         } else {
             /* Intersected nothing -- perhaps there is an environment map? */
             const Emitter *env = scene->getEnvironmentEmitter();
 
             if (env && env->fillDirectSamplingRecord(dRec, ray))
-                value = transmittance * env->evalEnvironment(RayDifferential(ray));
+                value = transmittance.get() * env->evalEnvironment(RayDifferential(ray));
         }
     }
 
@@ -433,7 +658,14 @@ public:
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
+        if (m_guide.get())
+            Log(EError, "Path guiding is not supported in network rendering!");
         MonteCarloIntegrator::serialize(stream, manager);
+        stream->writeInt(m_shadowCacheResolution);
+        stream->writeInt(m_shadowCacheSamples);
+        stream->writeBool(m_shadowCache.get() != NULL);
+        if (m_shadowCache.get())
+            m_shadowCache->serialize(stream, manager);
     }
 
     std::string toString() const {
@@ -441,12 +673,20 @@ public:
         oss << "VolumetricPathTracer[" << endl
             << "  maxDepth = " << m_maxDepth << "," << endl
             << "  rrDepth = " << m_rrDepth << "," << endl
-            << "  strictNormals = " << m_strictNormals << endl
+            << "  strictNormals = " << m_strictNormals << "," << endl
+            << "  shadowCacheResolution = " << m_shadowCacheResolution << "," << endl
+            << "  shadowCacheSamples = " << m_shadowCacheSamples << "," << endl
+            << "  guide = " << (m_guide.get() ? indent(m_guide->toString()) : "null") << endl
             << "]";
         return oss.str();
     }
 
     MTS_DECLARE_CLASS()
+private:
+    ref<TransmittanceCache> m_shadowCache;
+    ref<PathGuide> m_guide;
+    int m_shadowCacheResolution;
+    int m_shadowCacheSamples;
 };
 
 MTS_IMPLEMENT_CLASS_S(VolumetricPathTracer, false, MonteCarloIntegrator)
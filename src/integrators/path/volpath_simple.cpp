@@ -45,6 +45,11 @@ static StatsCounter avgPathLength("Volumetric path tracer", "Average path length
  *        See page~\pageref{sec:hideemitters} for details.
  *        \default{no, i.e. \code{false}}
  *     }
+ *     \parameter{aovs}{\Boolean}{Also store the albedo, shading normal,
+ *        distance and shape index of the first surface interaction in
+ *        additional film channels? See page~\pageref{sec:aovs} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
  * }
  *
  * This plugin provides a basic volumetric path tracer that can be used to
@@ -98,6 +103,7 @@ public:
         /* Perform the first ray intersection (or ignore if the
            intersection has already been provided). */
         rRec.rayIntersect(ray);
+        rRec.recordAOVs(ray);
         Spectrum throughput(1.0f);
 
         if (m_maxDepth == 1)
@@ -113,7 +119,8 @@ public:
             /* ==================================================================== */
             /*                 Radiative Transfer Equation sampling                 */
             /* ==================================================================== */
-            if (rRec.medium && rRec.medium->sampleDistance(Ray(ray, 0, its.t), mRec, rRec.sampler)) {
+            if (rRec.medium && MTS_HOTPATH_TIMED(mediumSample,
+                    rRec.medium->sampleDistance(Ray(ray, 0, its.t), mRec, rRec.sampler))) {
                 /* Sample the integral
                    \int_x^y tau(x, x') [ \sigma_s \int_{S^2} \rho(\omega,\omega') L(x,\omega') d\omega' ] dx'
                 */
@@ -222,7 +229,7 @@ public:
                         /* Prevent light leaks due to the use of shading normals */
                         if (!m_strictNormals ||
                             woDotGeoN * Frame::cosTheta(bRec.wo) > 0)
-                            Li += throughput * value * bsdf->eval(bRec);
+                            Li += throughput * value * MTS_HOTPATH_TIMED(bsdfEval, bsdf->eval(bRec));
                     }
                 }
 
@@ -232,7 +239,7 @@ public:
 
                 /* Sample BSDF * cos(theta) */
                 BSDFSamplingRecord bRec(its, rRec.sampler, ERadiance);
-                Spectrum bsdfVal = bsdf->sample(bRec, rRec.nextSample2D());
+                Spectrum bsdfVal = MTS_HOTPATH_TIMED(bsdfSample, bsdf->sample(bRec, rRec.nextSample2D()));
                 if (bsdfVal.isZero())
                     break;
 
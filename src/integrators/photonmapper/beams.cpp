@@ -0,0 +1,431 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/medium.h>
+#include <mitsuba/render/phase.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
+#include "beams.h"
+
+MTS_NAMESPACE_BEGIN
+
+/// Beams are split into segments of at most this many kernel radii
+#define BEAM_SEGMENT_LENGTH 16
+
+/// Maximum number of segments in a leaf node of the hierarchy
+#define BEAM_LEAF_SIZE 4
+
+static StatsCounter avgBeamTests("Photon beams",
+        "Average beams tested per query", EAverage);
+
+struct PhotonBeamMap::SegmentPredicate {
+    const std::vector<PhotonBeam> &beams;
+    int axis;
+
+    inline SegmentPredicate(const std::vector<PhotonBeam> &beams, int axis)
+        : beams(beams), axis(axis) { }
+
+    inline Float center(const Segment &segment) const {
+        const PhotonBeam &beam = beams[segment.beam];
+        return beam.origin[axis] + beam.direction[axis]
+            * (segment.mint + segment.maxt) * 0.5f;
+    }
+
+    inline bool operator()(const Segment &a, const Segment &b) const {
+        return center(a) < center(b);
+    }
+};
+
+PhotonBeamMap::PhotonBeamMap(const std::vector<PhotonBeam> &beams,
+        Float radius, Float scaleFactor) : m_beams(beams),
+        m_radius(radius), m_scaleFactor(scaleFactor), m_depth(0) {
+    ref<Timer> timer = new Timer();
+    Float maxLength = BEAM_SEGMENT_LENGTH * m_radius;
+
+    for (size_t i=0; i<m_beams.size(); ++i) {
+        const PhotonBeam &beam = m_beams[i];
+        size_t count = std::max((size_t) 1,
+            (size_t) std::ceil(beam.length / maxLength));
+        Float step = beam.length / count;
+        for (size_t j=0; j<count; ++j) {
+            Segment segment;
+            segment.beam = (uint32_t) i;
+            segment.mint = j * step;
+            segment.maxt = (j+1 == count) ? beam.length : (j+1) * step;
+            m_segments.push_back(segment);
+        }
+    }
+
+    if (!m_segments.empty()) {
+        m_nodes.reserve(2 * m_segments.size() / BEAM_LEAF_SIZE + 1);
+        build(0, m_segments.size(), 1);
+    }
+
+    Log(EInfo, "Built a hierarchy over " SIZE_T_FMT " photon beams ("
+        SIZE_T_FMT " segments, %s) in %i ms", m_beams.size(), m_segments.size(),
+        memString(m_beams.size() * sizeof(PhotonBeam)
+            + m_segments.size() * sizeof(Segment)
+            + m_nodes.size() * sizeof(Node)).c_str(),
+        timer->getMilliseconds());
+}
+
+PhotonBeamMap::PhotonBeamMap(Stream *stream, InstanceManager *manager) {
+    m_radius = stream->readFloat();
+    m_scaleFactor = stream->readFloat();
+    m_depth = stream->readSize();
+    m_beams.resize(stream->readSize());
+    for (size_t i=0; i<m_beams.size(); ++i)
+        m_beams[i] = PhotonBeam(stream);
+    m_segments.resize(stream->readSize());
+    for (size_t i=0; i<m_segments.size(); ++i) {
+        Segment &segment = m_segments[i];
+        segment.beam = stream->readUInt();
+        segment.mint = stream->readFloat();
+        segment.maxt = stream->readFloat();
+    }
+    m_nodes.resize(stream->readSize());
+    for (size_t i=0; i<m_nodes.size(); ++i) {
+        Node &node = m_nodes[i];
+        node.aabb = AABB(stream);
+        node.right = stream->readUInt();
+        node.start = stream->readUInt();
+        node.count = stream->readUInt();
+    }
+}
+
+void PhotonBeamMap::serialize(Stream *stream, InstanceManager *manager) const {
+    Log(EDebug, "Serializing a photon beam map (" SIZE_T_FMT " beams)", m_beams.size());
+    stream->writeFloat(m_radius);
+    stream->writeFloat(m_scaleFactor);
+    stream->writeSize(m_depth);
+    stream->writeSize(m_beams.size());
+    for (size_t i=0; i<m_beams.size(); ++i)
+        m_beams[i].serialize(stream);
+    stream->writeSize(m_segments.size());
+    for (size_t i=0; i<m_segments.size(); ++i) {
+        const Segment &segment = m_segments[i];
+        stream->writeUInt(segment.beam);
+        stream->writeFloat(segment.mint);
+        stream->writeFloat(segment.maxt);
+    }
+    stream->writeSize(m_nodes.size());
+    for (size_t i=0; i<m_nodes.size(); ++i) {
+        const Node &node = m_nodes[i];
+        node.aabb.serialize(stream);
+        stream->writeUInt(node.right);
+        stream->writeUInt(node.start);
+        stream->writeUInt(node.count);
+    }
+}
+
+AABB PhotonBeamMap::getAABB(const Segment &segment) const {
+    const PhotonBeam &beam = m_beams[segment.beam];
+    AABB aabb(beam.origin + beam.direction * segment.mint);
+    aabb.expandBy(beam.origin + beam.direction * segment.maxt);
+    aabb.min -= Vector(m_radius);
+    aabb.max += Vector(m_radius);
+    return aabb;
+}
+
+uint32_t PhotonBeamMap::build(size_t start, size_t end, size_t depth) {
+    uint32_t index = (uint32_t) m_nodes.size();
+    m_nodes.push_back(Node());
+    m_depth = std::max(m_depth, depth);
+
+    Node node;
+    AABB centers;
+    for (size_t i=start; i<end; ++i) {
+        AABB aabb = getAABB(m_segments[i]);
+        node.aabb.expandBy(aabb);
+        centers.expandBy(aabb.getCenter());
+    }
+    node.right = 0;
+    node.start = (uint32_t) start;
+    node.count = (uint32_t) (end - start);
+
+    if (end - start > BEAM_LEAF_SIZE) {
+        /* Median split along the largest extent of the segment centers */
+        size_t mid = (start + end) / 2;
+        std::nth_element(m_segments.begin() + start, m_segments.begin() + mid,
+            m_segments.begin() + end, SegmentPredicate(m_beams, centers.getLargestAxis()));
+
+        build(start, mid, depth+1);
+        node.right = build(mid, end, depth+1);
+        node.count = 0;
+    }
+
+    m_nodes[index] = node;
+    return index;
+}
+
+Spectrum PhotonBeamMap::query(const Ray &ray, const Medium *medium) const {
+    Spectrum result(0.0f);
+    if (m_nodes.empty())
+        return result;
+
+    uint32_t *stack = (uint32_t *) alloca((m_depth+1) * sizeof(uint32_t));
+    uint32_t index = 0, stackPos = 0;
+    const PhaseFunction *phase = medium->getPhaseFunction();
+    Float radiusSqr = m_radius * m_radius;
+    MediumSamplingRecord mRec;
+    size_t tested = 0;
+
+    while (true) {
+        const Node &node = m_nodes[index];
+
+        /* Test against the node's bounding box */
+        Float mint, maxt;
+        if (node.aabb.rayIntersect(ray, mint, maxt) && maxt >= ray.mint && mint <= ray.maxt) {
+            if (node.right != 0) {
+                stack[stackPos++] = node.right;
+                ++index;
+                continue;
+            }
+
+            for (uint32_t i=node.start; i<node.start+node.count; ++i) {
+                const Segment &segment = m_segments[i];
+                const PhotonBeam &beam = m_beams[segment.beam];
+                ++tested;
+
+                /* Closest points between the query ray and the beam */
+                Vector originDiff = ray.o - beam.origin;
+                Float cosTheta = dot(ray.d, beam.direction),
+                      sinTheta2 = 1 - cosTheta * cosTheta;
+                if (sinTheta2 < 1e-6f)
+                    continue;
+
+                Float dotRay = dot(ray.d, originDiff),
+                      dotBeam = dot(beam.direction, originDiff),
+                      t = (cosTheta * dotBeam - dotRay) / sinTheta2,
+                      v = (dotBeam - cosTheta * dotRay) / sinTheta2;
+
+                /* Segments are half-open so that split beams are not counted twice */
+                if (t < ray.mint || t > ray.maxt || v < segment.mint || v >= segment.maxt)
+                    continue;
+
+                Point beamPoint = beam.origin + beam.direction * v;
+                if ((ray(t) - beamPoint).lengthSquared() >= radiusSqr)
+                    continue;
+
+                /* Transmittance along the query ray (and scattering coefficient at its end) */
+                medium->eval(Ray(ray, ray.mint, t), mRec);
+
+                /* Transmittance along the beam */
+                Spectrum beamTransmittance = medium->evalTransmittance(
+                    Ray(beam.origin, beam.direction, 0, v, ray.time));
+
+                result += beam.power * mRec.sigmaS * mRec.transmittance * beamTransmittance
+                    * (phase->eval(PhaseFunctionSamplingRecord(mRec, -beam.direction, -ray.d))
+                    / std::sqrt(sinTheta2));
+            }
+        }
+
+        if (stackPos == 0)
+            break;
+        index = stack[--stackPos];
+    }
+
+    avgBeamTests.incrementBase();
+    avgBeamTests += tested;
+
+    /* 1D box kernel of the given radius */
+    return result * (m_scaleFactor / (2 * m_radius));
+}
+
+/**
+ * \brief This work result implementation stores a sequence of photon beams,
+ * which can be sent over the wire as needed.
+ */
+class BeamVector : public WorkResult {
+public:
+    BeamVector() { }
+
+    inline void nextParticle() {
+        m_particleIndices.push_back((uint32_t) m_beams.size());
+    }
+
+    inline void put(const PhotonBeam &beam) {
+        m_beams.push_back(beam);
+    }
+
+    inline size_t size() const {
+        return m_beams.size();
+    }
+
+    inline size_t getParticleCount() const {
+        return m_particleIndices.size()-1;
+    }
+
+    inline size_t getParticleIndex(size_t idx) const {
+        return m_particleIndices.at(idx);
+    }
+
+    inline void clear() {
+        m_beams.clear();
+        m_particleIndices.clear();
+    }
+
+    inline const PhotonBeam &operator[](size_t index) const {
+        return m_beams[index];
+    }
+
+    void load(Stream *stream) {
+        clear();
+        size_t count = (size_t) stream->readUInt();
+        m_particleIndices.resize(count);
+        stream->readUIntArray(&m_particleIndices[0], count);
+        count = (size_t) stream->readUInt();
+        m_beams.resize(count);
+        for (size_t i=0; i<count; ++i)
+            m_beams[i] = PhotonBeam(stream);
+    }
+
+    void save(Stream *stream) const {
+        stream->writeUInt((uint32_t) m_particleIndices.size());
+        stream->writeUIntArray(&m_particleIndices[0], m_particleIndices.size());
+        stream->writeUInt((uint32_t) m_beams.size());
+        for (size_t i=0; i<m_beams.size(); ++i)
+            m_beams[i].serialize(stream);
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "BeamVector[size=" << m_beams.size() << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    // Virtual destructor
+    virtual ~BeamVector() { }
+private:
+    std::vector<PhotonBeam> m_beams;
+    std::vector<uint32_t> m_particleIndices;
+};
+
+/**
+ * This class does the actual photon beam tracing work
+ */
+class GatherBeamWorker : public ParticleTracer {
+public:
+    GatherBeamWorker(int maxDepth, int rrDepth)
+        : ParticleTracer(maxDepth, rrDepth, false) { }
+
+    GatherBeamWorker(Stream *stream, InstanceManager *manager)
+     : ParticleTracer(stream, manager) { }
+
+    ref<WorkProcessor> clone() const {
+        return new GatherBeamWorker(m_maxDepth, m_rrDepth);
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new BeamVector();
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        m_workResult = static_cast<BeamVector *>(workResult);
+        m_workResult->clear();
+        ParticleTracer::process(workUnit, workResult, stop);
+        m_workResult->nextParticle();
+        m_workResult = NULL;
+    }
+
+    void handleNewParticle() {
+        m_workResult->nextParticle();
+    }
+
+    void handleMediumSegment(int depth, int nullInteractions, bool delta,
+            const Ray &ray, const Medium *medium, const Spectrum &weight) {
+        Float maxt = ray.maxt;
+        if (!std::isfinite(maxt)) {
+            /* Clip beams that escape to infinity against the scene bounds */
+            Float nearT, farT;
+            if (!m_scene->getAABB().rayIntersect(ray, nearT, farT) || farT <= ray.mint)
+                return;
+            maxt = farT;
+        }
+        m_workResult->put(PhotonBeam(ray(ray.mint), ray.d, maxt - ray.mint, weight));
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~GatherBeamWorker() { }
+protected:
+    ref<BeamVector> m_workResult;
+};
+
+GatherBeamProcess::GatherBeamProcess(size_t beamCount, size_t granularity,
+    int maxDepth, int rrDepth, bool isLocal, bool autoCancel,
+    const void *progressReporterPayload)
+    : ParticleProcess(ParticleProcess::EGather, beamCount, granularity,
+      "Gathering photon beams", progressReporterPayload), m_beamCount(beamCount),
+      m_maxDepth(maxDepth), m_rrDepth(rrDepth), m_isLocal(isLocal),
+      m_autoCancel(autoCancel), m_excess(0), m_numShot(0) {
+    m_beams.reserve(beamCount);
+}
+
+bool GatherBeamProcess::isLocal() const {
+    return m_isLocal;
+}
+
+ref<WorkProcessor> GatherBeamProcess::createWorkProcessor() const {
+    return new GatherBeamWorker(m_maxDepth, m_rrDepth);
+}
+
+void GatherBeamProcess::processResult(const WorkResult *wr, bool cancelled) {
+    if (cancelled)
+        return;
+    const BeamVector &vec = *static_cast<const BeamVector *>(wr);
+    LockGuard lock(m_resultMutex);
+
+    size_t nParticles = 0;
+    for (size_t i=0; i<vec.getParticleCount(); ++i) {
+        size_t start = vec.getParticleIndex(i),
+               end   = vec.getParticleIndex(i+1);
+        /* Only accept complete particle paths */
+        if (m_beams.size() + (end - start) > m_beamCount) {
+            m_excess += vec.size() - start;
+            break;
+        }
+        ++nParticles;
+        for (size_t j=start; j<end; ++j)
+            m_beams.push_back(vec[j]);
+    }
+    m_numShot += nParticles;
+    increaseResultCount(vec.size());
+}
+
+ParallelProcess::EStatus GatherBeamProcess::generateWork(WorkUnit *unit, int worker) {
+    /* Use the same approach as PBRT for auto canceling */
+    LockGuard lock(m_resultMutex);
+    if (m_autoCancel && m_numShot > 100000 && m_beams.size() < m_beamCount
+            && (m_beams.empty() || m_beams.size() < m_numShot/1024)) {
+        Log(EInfo, "Not enough photon beams could be collected, giving up");
+        return EFailure;
+    }
+
+    return ParticleProcess::generateWork(unit, worker);
+}
+
+MTS_IMPLEMENT_CLASS_S(PhotonBeamMap, false, SerializableObject)
+MTS_IMPLEMENT_CLASS(GatherBeamProcess, false, ParticleProcess)
+MTS_IMPLEMENT_CLASS_S(GatherBeamWorker, false, ParticleTracer)
+MTS_IMPLEMENT_CLASS(BeamVector, false, WorkResult)
+MTS_NAMESPACE_END
@@ -0,0 +1,201 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__PHOTON_BEAMS_H)
+#define __PHOTON_BEAMS_H
+
+#include <mitsuba/render/particleproc.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Segment of a photon path through a participating medium
+struct PhotonBeam {
+    /// Start of the beam
+    Point origin;
+    /// Direction of propagation
+    Vector direction;
+    /// Length of the beam (up to the next surface)
+    Float length;
+    /// Power of the photon at the start of the beam
+    Spectrum power;
+
+    inline PhotonBeam() { }
+
+    inline PhotonBeam(const Point &origin, const Vector &direction,
+        Float length, const Spectrum &power) : origin(origin),
+        direction(direction), length(length), power(power) { }
+
+    /// Unserialize a photon beam from a binary data stream
+    inline PhotonBeam(Stream *stream) {
+        origin = Point(stream);
+        direction = Vector(stream);
+        length = stream->readFloat();
+        power = Spectrum(stream);
+    }
+
+    /// Serialize a photon beam to a binary data stream
+    inline void serialize(Stream *stream) const {
+        origin.serialize(stream);
+        direction.serialize(stream);
+        stream->writeFloat(length);
+        power.serialize(stream);
+    }
+};
+
+/**
+ * \brief Stores photon beams in a bounding volume hierarchy and estimates
+ * the in-scattered radiance along camera rays
+ *
+ * This implements the ``Beam $\times$ Beam 1D'' estimator described in
+ * "A Comprehensive Theory of Volumetric Radiance Estimation using Photon
+ * Points and Beams" by Wojciech Jarosz, Derek Nowrouzezahrai, Iman Sadeghi,
+ * and Henrik Wann Jensen. Since every beam accounts for the entire path
+ * segment of a photon through the medium, far fewer photons are needed
+ * than with the volumetric photon map.
+ */
+class PhotonBeamMap : public SerializableObject {
+public:
+    /**
+     * \brief Create a beam map from a set of photon beams
+     *
+     * \param radius
+     *     Radius of the (constant) blurring kernel around the beams
+     * \param scaleFactor
+     *     Factor that is applied to the power of every beam
+     *     (usually the reciprocal of the number of shot particles)
+     */
+    PhotonBeamMap(const std::vector<PhotonBeam> &beams,
+        Float radius, Float scaleFactor);
+
+    /// Unserialize a beam map from a binary data stream
+    PhotonBeamMap(Stream *stream, InstanceManager *manager);
+
+    /// Serialize to a binary data stream
+    void serialize(Stream *stream, InstanceManager *manager) const;
+
+    /**
+     * \brief Estimate the radiance that is scattered towards the origin of
+     * the ray segment <tt>[mint, maxt]</tt> by the given medium
+     *
+     * The result includes the transmittance between the scattering
+     * locations and the start of the segment.
+     */
+    Spectrum query(const Ray &ray, const Medium *medium) const;
+
+    /// Return the number of stored beams
+    inline size_t getBeamCount() const { return m_beams.size(); }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~PhotonBeamMap() { }
+
+    /// Part of a beam referenced by the hierarchy
+    struct Segment {
+        uint32_t beam;
+        Float mint, maxt;
+    };
+
+    struct Node {
+        AABB aabb;
+        /// Right child (the left one directly follows its parent), zero for leaves
+        uint32_t right;
+        /// Range of segments (leaves only)
+        uint32_t start, count;
+    };
+
+    struct SegmentPredicate;
+
+    /// Recursively build the hierarchy over the segments <tt>[start, end)</tt>
+    uint32_t build(size_t start, size_t end, size_t depth);
+
+    /// Compute the bounding box of a segment, which includes the kernel radius
+    AABB getAABB(const Segment &segment) const;
+private:
+    std::vector<PhotonBeam> m_beams;
+    std::vector<Segment> m_segments;
+    std::vector<Node> m_nodes;
+    Float m_radius, m_scaleFactor;
+    size_t m_depth;
+};
+
+/**
+ * \brief Process for parallel photon beam tracing
+ *
+ * Traces particles until the requested number of photon beams
+ * (i.e. path segments within participating media) has been collected.
+ */
+class GatherBeamProcess : public ParticleProcess {
+public:
+    /**
+     * Create a new process for parallel photon beam gathering
+     *
+     * \param beamCount
+     *     Specifies the number of requested beams
+     * \param granularity
+     *     Size of the internally used work units (in particles)
+     * \param isLocal
+     *     Should the parallel process only be executed locally?
+     * \param autoCancel
+     *     Indicates if the gathering process should be canceled if there
+     *     are not enough beams generated
+     * \param progressReporterPayload
+     *    Custom pointer payload to be delivered with progress messages
+     */
+    GatherBeamProcess(size_t beamCount, size_t granularity, int maxDepth,
+        int rrDepth, bool isLocal, bool autoCancel,
+        const void *progressReporterPayload);
+
+    /// Return the collected beams
+    inline const std::vector<PhotonBeam> &getBeams() const { return m_beams; }
+
+    /// Return the number of particles that had to be shot to collect the beams
+    inline size_t getShotParticles() const { return m_numShot; }
+
+    /// Return the number of beams that were discarded due to parallelism
+    inline size_t getExcessBeams() const { return m_excess; }
+
+    // ======================================================================
+    /// @{ \name ParallelProcess implementation
+    // ======================================================================
+
+    bool isLocal() const;
+    ref<WorkProcessor> createWorkProcessor() const;
+    void processResult(const WorkResult *wr, bool cancelled);
+    EStatus generateWork(WorkUnit *unit, int worker);
+
+    /// @}
+    // ======================================================================
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~GatherBeamProcess() { }
+protected:
+    std::vector<PhotonBeam> m_beams;
+    size_t m_beamCount;
+    int m_maxDepth;
+    int m_rrDepth;
+    bool m_isLocal;
+    bool m_autoCancel;
+    size_t m_excess, m_numShot;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __PHOTON_BEAMS_H */
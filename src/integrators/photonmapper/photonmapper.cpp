@@ -20,6 +20,7 @@
 #include <mitsuba/render/common.h>
 #include <mitsuba/render/gatherproc.h>
 #include "bre.h"
+#include "beams.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -39,6 +40,11 @@ MTS_NAMESPACE_BEGIN
  *     \parameter{globalPhotons}{\Integer}{Number of photons that will be collected for the global photon map\default{250000}}
  *     \parameter{causticPhotons}{\Integer}{Number of photons that will be collected for the caustic photon map\default{250000}}
  *     \parameter{volumePhotons}{\Integer}{Number of photons that will be collected for the volumetric photon map\default{250000}}
+ *     \parameter{photonBeams}{\Boolean}{Estimate the volumetric scattering using
+ *        photon beams instead of the volumetric photon map? \default{\code{false}}}
+ *     \parameter{volumeBeams}{\Integer}{Number of photon beams that will be collected
+ *        when \code{photonBeams} is enabled\default{10000}}
+ *     \parameter{beamRadius}{\Float}{Radius of the photon beams (relative to the scene size)\default{0.005}}
  *     \parameter{globalLookup\showbreak Radius}{\Float}{Maximum radius of photon lookups in the global photon map (relative to the scene size)\default{0.05}}
  *     \parameter{causticLookup\showbreak Radius}{\Float}{Maximum radius of photon lookups in the caustic photon map (relative to the scene size)\default{0.0125}}
  *     \parameter{lookupSize}{\Integer}{Number of photons that should be fetched in photon map queries\default{120}}
@@ -81,8 +87,24 @@ MTS_NAMESPACE_BEGIN
  * When the scene contains participating media, the Beam Radiance Estimate \cite{Jarosz2008Beam}
  * by Jarosz et al. is used to estimate the illumination due to volumetric scattering.
  *
+ * Alternatively, when \code{photonBeams} is set to \code{true}, the photon tracing
+ * step records the entire path segments of the photons within media (\emph{photon beams})
+ * instead of individual scattering events. The in-scattered radiance along camera rays
+ * is then estimated using the ``Beam $\times$ Beam 1D'' estimator of Jarosz et al.
+ * \cite{Jarosz2011Comprehensive}, which evaluates the transmittance along both the beams
+ * and the camera rays. Since every beam contributes along its whole length, this
+ * requires far fewer photons than the volumetric photon map, particularly in sparse media.
+ * \begin{xml}[caption={Photon mapping with photon beams}]
+ * <integrator type="photonmapper">
+ *     <boolean name="photonBeams" value="true"/>
+ *     <integer name="volumeBeams" value="20000"/>
+ * </integrator>
+ * \end{xml}
+ *
  * \remarks{
- *     \item Currently, only homogeneous participating media are supported by this implementation
+ *     \item The volumetric photon map only supports homogeneous participating media.
+ *     Photon beams also support heterogeneous media, which must use the
+ *     \code{simpson} integration method.
  * }
  */
 class PhotonMapIntegrator : public SamplingIntegrator {
@@ -115,6 +137,12 @@ public:
         m_causticPhotons = props.getSize("causticPhotons", 250000);
         /* Number of photons to collect for the volumetric photon map */
         m_volumePhotons = props.getSize("volumePhotons", 250000);
+        /* Estimate volumetric scattering using photon beams? */
+        m_photonBeams = props.getBoolean("photonBeams", false);
+        /* Number of photon beams to collect */
+        m_volumeBeams = props.getSize("volumeBeams", 10000);
+        /* Radius of the photon beams (relative to the scene size) */
+        m_beamRadiusRel = props.getFloat("beamRadius", 0.005f);
         /* Max. radius of lookups in the global photon map (relative to the scene size) */
         m_globalLookupRadiusRel = props.getFloat("globalLookupRadius", 0.05f);
         /* Max. radius of lookups in the caustic photon map (relative to the scene size) */
@@ -146,7 +174,7 @@ public:
             m_maxDepth = 128;
         }
 
-        m_causticPhotonMapID = m_globalPhotonMapID = m_breID = 0;
+        m_causticPhotonMapID = m_globalPhotonMapID = m_breID = m_beamMapID = 0;
     }
 
     /// Unserialize from a binary data stream
@@ -160,6 +188,9 @@ public:
         m_globalPhotons = stream->readSize();
         m_causticPhotons = stream->readSize();
         m_volumePhotons = stream->readSize();
+        m_photonBeams = stream->readBool();
+        m_volumeBeams = stream->readSize();
+        m_beamRadiusRel = stream->readFloat();
         m_globalLookupRadius = stream->readFloat();
         m_causticLookupRadius = stream->readFloat();
         m_globalLookupSize = stream->readInt();
@@ -168,7 +199,7 @@ public:
         m_gatherLocally = stream->readBool();
         m_autoCancelGathering = stream->readBool();
         m_hideEmitters = stream->readBool();
-        m_causticPhotonMapID = m_globalPhotonMapID = m_breID = 0;
+        m_causticPhotonMapID = m_globalPhotonMapID = m_breID = m_beamMapID = 0;
         configure();
     }
 
@@ -180,6 +211,8 @@ public:
             sched->unregisterResource(m_causticPhotonMapID);
         if (m_breID)
             sched->unregisterResource(m_breID);
+        if (m_beamMapID)
+            sched->unregisterResource(m_beamMapID);
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -192,6 +225,9 @@ public:
         stream->writeSize(m_globalPhotons);
         stream->writeSize(m_causticPhotons);
         stream->writeSize(m_volumePhotons);
+        stream->writeBool(m_photonBeams);
+        stream->writeSize(m_volumeBeams);
+        stream->writeFloat(m_beamRadiusRel);
         stream->writeFloat(m_globalLookupRadius);
         stream->writeFloat(m_causticLookupRadius);
         stream->writeInt(m_globalLookupSize);
@@ -248,8 +284,9 @@ public:
 
         const ref_vector<Medium> &media = scene->getMedia();
         for (ref_vector<Medium>::const_iterator it = media.begin(); it != media.end(); ++it) {
-            if (!(*it)->isHomogeneous())
-                Log(EError, "Inhomogeneous media are currently not supported by the photon mapper!");
+            if (!(*it)->isHomogeneous() && !m_photonBeams)
+                Log(EError, "Inhomogeneous media are only supported by the photon mapper "
+                    "when photon beams are used!");
         }
 
         if (m_globalPhotonMap.get() == NULL && m_globalPhotons > 0) {
@@ -314,7 +351,7 @@ public:
             }
         }
 
-        size_t volumePhotons = scene->getMedia().size() == 0 ? 0 : m_volumePhotons;
+        size_t volumePhotons = scene->getMedia().size() == 0 || m_photonBeams ? 0 : m_volumePhotons;
         if (m_volumePhotonMap.get() == NULL && volumePhotons > 0) {
             /* Generate the volume photon map */
             ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
@@ -346,6 +383,37 @@ public:
             }
         }
 
+        size_t volumeBeams = scene->getMedia().size() == 0 || !m_photonBeams ? 0 : m_volumeBeams;
+        if (m_beamMap.get() == NULL && volumeBeams > 0) {
+            /* Generate the photon beams */
+            ref<GatherBeamProcess> proc = new GatherBeamProcess(
+                volumeBeams, m_granularity, m_maxDepth-1, m_rrDepth,
+                m_gatherLocally, m_autoCancelGathering, job);
+
+            proc->bindResource("scene", sceneResID);
+            proc->bindResource("sensor", sensorResID);
+            proc->bindResource("sampler", qmcSamplerID);
+
+            m_proc = proc;
+            sched->schedule(proc);
+            sched->wait(proc);
+            m_proc = NULL;
+
+            if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+                return false;
+
+            if (!proc->getBeams().empty()) {
+                Log(EDebug, "Collected " SIZE_T_FMT " photon beams. Shot " SIZE_T_FMT " particles, "
+                    "excess beams due to parallelism: " SIZE_T_FMT, proc->getBeams().size(),
+                    proc->getShotParticles(), proc->getExcessBeams());
+
+                m_beamMap = new PhotonBeamMap(proc->getBeams(),
+                    m_beamRadiusRel * scene->getBSphere().radius,
+                    1 / (Float) proc->getShotParticles());
+                m_beamMapID = sched->registerResource(m_beamMap);
+            }
+        }
+
         /* Adapt to scene extents */
         m_globalLookupRadius = m_globalLookupRadiusRel * scene->getBSphere().radius;
         m_causticLookupRadius = m_causticLookupRadiusRel * scene->getBSphere().radius;
@@ -370,6 +438,8 @@ public:
             proc->bindResource("causticPhotonMap", m_causticPhotonMapID);
         if (m_bre.get())
             proc->bindResource("bre", m_breID);
+        if (m_beamMap.get())
+            proc->bindResource("beamMap", m_beamMapID);
     }
 
     /// Connect to globally shared resources
@@ -380,6 +450,8 @@ public:
             m_causticPhotonMap = static_cast<PhotonMap *>(params["causticPhotonMap"]);
         if (!m_bre.get() && params.find("bre") != params.end())
             m_bre = static_cast<BeamRadianceEstimator *>(params["bre"]);
+        if (!m_beamMap.get() && params.find("beamMap") != params.end())
+            m_beamMap = static_cast<PhotonBeamMap *>(params["beamMap"]);
 
         if (parent && parent->getClass()->derivesFrom(MTS_CLASS(SamplingIntegrator)))
             m_parentIntegrator = static_cast<SamplingIntegrator *>(parent);
@@ -410,8 +482,12 @@ public:
             transmittance = rRec.medium->evalTransmittance(mediumRaySegment);
             mediumRaySegment.mint = ray.mint;
             if (rRec.type & RadianceQueryRecord::EVolumeRadiance &&
-                    (rRec.depth < m_maxDepth || m_maxDepth < 0) && m_bre.get() != NULL)
-                LiMedium = m_bre->query(mediumRaySegment, rRec.medium);
+                    (rRec.depth < m_maxDepth || m_maxDepth < 0)) {
+                if (m_bre.get() != NULL)
+                    LiMedium = m_bre->query(mediumRaySegment, rRec.medium);
+                else if (m_beamMap.get() != NULL)
+                    LiMedium = m_beamMap->query(mediumRaySegment, rRec.medium);
+            }
         }
 
         if (!its.isValid()) {
@@ -655,6 +731,9 @@ public:
             << "  globalPhotons = " << m_globalPhotons << "," << endl
             << "  causticPhotons = " << m_causticPhotons << "," << endl
             << "  volumePhotons = " << m_volumePhotons << "," << endl
+            << "  photonBeams = " << m_photonBeams << "," << endl
+            << "  volumeBeams = " << m_volumeBeams << "," << endl
+            << "  beamRadius = " << m_beamRadiusRel << "," << endl
             << "  gatherLocally = " << m_gatherLocally << "," << endl
             << "  globalLookupRadius = " << m_globalLookupRadius << "," << endl
             << "  causticLookupRadius = " << m_causticLookupRadius << "," << endl
@@ -676,10 +755,13 @@ private:
     ref<PhotonMap> m_causticPhotonMap;
     ref<PhotonMap> m_volumePhotonMap;
     ref<BeamRadianceEstimator> m_bre;
+    ref<PhotonBeamMap> m_beamMap;
     ref<ParallelProcess> m_proc;
     SamplingIntegrator *m_parentIntegrator;
-    int m_globalPhotonMapID, m_causticPhotonMapID, m_breID;
-    size_t m_globalPhotons, m_causticPhotons, m_volumePhotons;
+    int m_globalPhotonMapID, m_causticPhotonMapID, m_breID, m_beamMapID;
+    size_t m_globalPhotons, m_causticPhotons, m_volumePhotons, m_volumeBeams;
+    Float m_beamRadiusRel;
+    bool m_photonBeams;
     int m_globalLookupSize, m_causticLookupSize, m_volumeLookupSize;
     Float m_globalLookupRadiusRel, m_globalLookupRadius;
     Float m_causticLookupRadiusRel, m_causticLookupRadius;
@@ -18,8 +18,12 @@
 
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/bitmap.h>
-#include <mitsuba/render/gatherproc.h>
+#include <mitsuba/core/atomic.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/render/particleproc.h>
+#include <mitsuba/render/range.h>
 #include <mitsuba/render/renderqueue.h>
+#include <mitsuba/render/renderjob.h>
 
 #if defined(MTS_OPENMP)
 # include <omp.h>
@@ -27,6 +31,767 @@
 
 MTS_NAMESPACE_BEGIN
 
+/// Represents one individual PPM gather point including relevant statistics
+struct SPPMGatherPoint {
+    Intersection its;
+    Float radius;
+    Spectrum weight;
+    Spectrum flux;
+    Spectrum emission;
+    Float N;
+    int depth;
+    Point2i pos;
+
+    /* Photon statistics of the current pass, which are
+       accumulated atomically while tracing photons */
+    Spectrum passFlux;
+    int32_t passM;
+
+    inline SPPMGatherPoint() : weight(0.0f), flux(0.0f), emission(0.0f), N(0.0f),
+        passFlux(0.0f), passM(0) { }
+};
+
+/// Trace a camera path through the pixel \c gatherPoint.pos and create its gather point
+static void createGatherPoint(const Scene *scene, Sampler *sampler,
+        int maxDepth, SPPMGatherPoint &gatherPoint) {
+    const Sensor *sensor = scene->getSensor();
+    Point2 apertureSample, sample;
+    Float timeSample = 0.0f;
+    sampler->generate(gatherPoint.pos);
+    if (sensor->needsApertureSample())
+        apertureSample = sampler->next2D();
+    if (sensor->needsTimeSample())
+        timeSample = sampler->next1D();
+    sample = sampler->next2D();
+    sample += Vector2((Float) gatherPoint.pos.x, (Float) gatherPoint.pos.y);
+    RayDifferential ray;
+    sensor->sampleRayDifferential(ray, sample, apertureSample, timeSample);
+    Spectrum weight(1.0f);
+    int depth = 1;
+    gatherPoint.emission = Spectrum(0.0f);
+
+    while (true) {
+        if (scene->rayIntersect(ray, gatherPoint.its)) {
+            if (gatherPoint.its.isEmitter())
+                gatherPoint.emission += weight * gatherPoint.its.Le(-ray.d);
+
+            if (depth >= maxDepth && maxDepth != -1) {
+                gatherPoint.depth = -1;
+                break;
+            }
+
+            const BSDF *bsdf = gatherPoint.its.getBSDF();
+
+            /* Create hit point if this is a diffuse material or a glossy
+               one, and there has been a previous interaction with
+               a glossy material */
+            if ((bsdf->getType() & BSDF::EAll) == BSDF::EDiffuseReflection ||
+                (bsdf->getType() & BSDF::EAll) == BSDF::EDiffuseTransmission ||
+                (depth + 1 > maxDepth && maxDepth != -1)) {
+                gatherPoint.weight = weight;
+                gatherPoint.depth = depth;
+                break;
+            } else {
+                /* Recurse for dielectric materials and (specific to SPPM):
+                   recursive "final gathering" for glossy materials */
+                BSDFSamplingRecord bRec(gatherPoint.its, sampler);
+                weight *= bsdf->sample(bRec, sampler->next2D());
+                if (weight.isZero()) {
+                    gatherPoint.depth = -1;
+                    break;
+                }
+                ray = RayDifferential(gatherPoint.its.p,
+                    gatherPoint.its.toWorld(bRec.wo), ray.time);
+                ++depth;
+            }
+        } else {
+            /* Generate an invalid sample */
+            gatherPoint.depth = -1;
+            gatherPoint.emission += weight * scene->evalEnvironment(ray);
+            break;
+        }
+    }
+    sampler->advance();
+}
+
+/**
+ * \brief Apply the photon statistics of a pass to a gather point
+ *
+ * \param M
+ *     Number of photons found within the search radius
+ * \param flux
+ *     Photon flux that was gathered, including the throughput of the
+ *     camera path
+ * \param shot
+ *     Number of particles traced during the pass
+ * \param totalEmitted
+ *     Number of particles traced in all passes so far
+ * \return
+ *     The current radiance estimate of the gather point
+ */
+static Spectrum updateGatherPoint(SPPMGatherPoint &gp, Float M, const Spectrum &flux,
+        const Spectrum &emission, size_t shot, size_t totalEmitted, Float alpha) {
+    Float N = gp.N;
+    if (N == 0 && !emission.isZero())
+        gp.N = N = 1;
+
+    if (N+M == 0) {
+        gp.flux = Spectrum(0.0f);
+        return Spectrum(0.0f);
+    }
+
+    Float ratio = (N + alpha * M) / (N + M);
+    gp.radius = gp.radius * std::sqrt(ratio);
+
+    gp.flux = (gp.flux + flux +
+        emission * (Float) shot * M_PI * gp.radius*gp.radius) * ratio;
+    gp.N = N + alpha * M;
+    return gp.flux / ((Float) totalEmitted * gp.radius*gp.radius * M_PI);
+}
+
+/**
+ * \brief Spatial hash grid over the gather points of a pass
+ *
+ * Each gather point is registered with all grid cells that are overlapped by
+ * the bounding box of its search radius. A photon then only has to visit
+ * the entries of the cell containing it. The cell size is set to the
+ * largest search diameter and only recomputed once the radii have shrunk by
+ * more than a factor of two, hence every gather point occupies at most
+ * eight cells.
+ */
+class SPPMGatherPointGrid {
+public:
+    SPPMGatherPointGrid() : m_cellSize(0), m_invCellSize(0) { }
+
+    /// Build the grid over all valid gather points of the given blocks
+    void build(std::vector<std::vector<SPPMGatherPoint> > &blocks) {
+        m_points.clear();
+        Float maxRadius = 0;
+        for (size_t i=0; i<blocks.size(); ++i) {
+            for (size_t j=0; j<blocks[i].size(); ++j) {
+                SPPMGatherPoint &gp = blocks[i][j];
+                if (gp.depth == -1)
+                    continue;
+                m_points.push_back(&gp);
+                maxRadius = std::max(maxRadius, gp.radius);
+            }
+        }
+
+        if (m_points.empty() || maxRadius == 0) {
+            m_cellStarts.assign(2, 0);
+            m_entries.clear();
+            return;
+        }
+
+        if (m_cellSize == 0 || 2 * maxRadius > m_cellSize || 4 * maxRadius < m_cellSize) {
+            m_cellSize = 2 * maxRadius;
+            m_invCellSize = 1 / m_cellSize;
+            SLog(EDebug, "Gather point grid: using a cell size of %f", m_cellSize);
+        }
+
+        /* Count the entries of each hash bucket, then fill them */
+        uint32_t tableSize = (uint32_t) m_points.size();
+        m_cellStarts.assign(tableSize + 1, 0);
+        for (int pass=0; pass<2; ++pass) {
+            if (pass == 1) {
+                for (uint32_t i=0; i<tableSize; ++i)
+                    m_cellStarts[i+1] += m_cellStarts[i];
+                m_entries.resize(m_cellStarts[tableSize]);
+            }
+
+            for (uint32_t i=0; i<(uint32_t) m_points.size(); ++i) {
+                const SPPMGatherPoint &gp = *m_points[i];
+                Vector extent(gp.radius);
+                Point3i min = getCell(gp.its.p - extent),
+                        max = getCell(gp.its.p + extent);
+
+                /* Avoid duplicate entries due to hash collisions */
+                uint32_t buckets[27];
+                int bucketCount = 0;
+                for (int z=min.z; z<=std::min(max.z, min.z+2); ++z)
+                    for (int y=min.y; y<=std::min(max.y, min.y+2); ++y)
+                        for (int x=min.x; x<=std::min(max.x, min.x+2); ++x)
+                            buckets[bucketCount++] = hash(Point3i(x, y, z));
+                std::sort(buckets, buckets + bucketCount);
+                bucketCount = (int) (std::unique(buckets, buckets + bucketCount) - buckets);
+
+                for (int j=0; j<bucketCount; ++j) {
+                    if (pass == 0)
+                        m_cellStarts[buckets[j] + 1]++;
+                    else
+                        m_entries[--m_cellStarts[buckets[j] + 1]] = i;
+                }
+            }
+        }
+
+        /* The second pass left the start of bucket i in m_cellStarts[i+1] */
+        for (uint32_t i=0; i<tableSize; ++i)
+            m_cellStarts[i] = m_cellStarts[i+1];
+        m_cellStarts[tableSize] = (uint32_t) m_entries.size();
+    }
+
+    /// Return the range of candidate gather points for a photon at \c p
+    inline void lookup(const Point &p, const uint32_t *&start, const uint32_t *&end) const {
+        if (m_entries.empty()) {
+            start = end = NULL;
+            return;
+        }
+        uint32_t bucket = hash(getCell(p));
+        start = &m_entries[0] + m_cellStarts[bucket];
+        end = &m_entries[0] + m_cellStarts[bucket + 1];
+    }
+
+    /// Return the gather point associated with a grid entry
+    inline SPPMGatherPoint &getGatherPoint(uint32_t index) const {
+        return *m_points[index];
+    }
+
+    /// Return the number of gather points in the grid
+    inline size_t getGatherPointCount() const { return m_points.size(); }
+protected:
+    inline Point3i getCell(const Point &p) const {
+        return Point3i(
+            (int) std::floor(p.x * m_invCellSize),
+            (int) std::floor(p.y * m_invCellSize),
+            (int) std::floor(p.z * m_invCellSize));
+    }
+
+    inline uint32_t hash(const Point3i &cell) const {
+        return (((uint32_t) cell.x * 73856093u) ^ ((uint32_t) cell.y * 19349663u)
+            ^ ((uint32_t) cell.z * 83492791u)) % (uint32_t) m_points.size();
+    }
+private:
+    std::vector<SPPMGatherPoint *> m_points;
+    std::vector<uint32_t> m_cellStarts;
+    std::vector<uint32_t> m_entries;
+    Float m_cellSize, m_invCellSize;
+};
+
+/// Number of traced particles and deposited photons of a work unit
+class SPPMPhotonResult : public WorkResult {
+public:
+    SPPMPhotonResult() : m_particleCount(0), m_photonCount(0) { }
+
+    inline void clear() { m_particleCount = m_photonCount = 0; }
+    inline void nextParticle() { ++m_particleCount; }
+    inline void nextPhoton() { ++m_photonCount; }
+    inline size_t getParticleCount() const { return m_particleCount; }
+    inline size_t getPhotonCount() const { return m_photonCount; }
+
+    void load(Stream *stream) {
+        m_particleCount = stream->readSize();
+        m_photonCount = stream->readSize();
+    }
+
+    void save(Stream *stream) const {
+        stream->writeSize(m_particleCount);
+        stream->writeSize(m_photonCount);
+    }
+
+    std::string toString() const {
+        return formatString("SPPMPhotonResult[particles=" SIZE_T_FMT
+            ", photons=" SIZE_T_FMT "]", m_particleCount, m_photonCount);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMPhotonResult() { }
+private:
+    size_t m_particleCount, m_photonCount;
+};
+
+/**
+ * \brief Traces photons and directly splats them into the gather points
+ * that are registered with a \ref SPPMGatherPointGrid
+ */
+class SPPMPhotonWorker : public ParticleTracer {
+public:
+    SPPMPhotonWorker(const SPPMGatherPointGrid *grid, int maxDepth,
+        int rrDepth, int gatherMaxDepth) : ParticleTracer(maxDepth, rrDepth, false),
+        m_grid(grid), m_gatherMaxDepth(gatherMaxDepth) { }
+
+    SPPMPhotonWorker(Stream *stream, InstanceManager *manager)
+        : ParticleTracer(stream, manager), m_grid(NULL) {
+        m_gatherMaxDepth = stream->readInt();
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new SPPMPhotonWorker(m_grid, m_maxDepth, m_rrDepth, m_gatherMaxDepth);
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        ParticleTracer::serialize(stream, manager);
+        stream->writeInt(m_gatherMaxDepth);
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new SPPMPhotonResult();
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        m_workResult = static_cast<SPPMPhotonResult *>(workResult);
+        m_workResult->clear();
+        ParticleTracer::process(workUnit, workResult, stop);
+        m_workResult = NULL;
+    }
+
+    void handleNewParticle() {
+        m_workResult->nextParticle();
+    }
+
+    void handleSurfaceInteraction(int depth_, int nullInteractions, bool delta,
+            const Intersection &its, const Medium *medium,
+            const Spectrum &weight) {
+        int bsdfType = its.getBSDF()->getType(), depth = depth_ - nullInteractions;
+        if (!(bsdfType & BSDF::EDiffuseReflection) && !(bsdfType & BSDF::EGlossyReflection))
+            return;
+        m_workResult->nextPhoton();
+
+        const uint32_t *start, *end;
+        m_grid->lookup(its.p, start, end);
+
+        Vector wi = its.toWorld(its.wi);
+        const Normal &photonNormal = its.geoFrame.n;
+        Float wiDotGeoN = absDot(photonNormal, wi);
+
+        for (const uint32_t *it = start; it != end; ++it) {
+            SPPMGatherPoint &gp = m_grid->getGatherPoint(*it);
+            if (distanceSquared(gp.its.p, its.p) > gp.radius * gp.radius)
+                continue;
+            atomicAdd(&gp.passM, 1);
+
+            if ((m_gatherMaxDepth != -1 && depth > m_gatherMaxDepth - gp.depth)
+                || dot(photonNormal, gp.its.shFrame.n) < 1e-1f
+                || wiDotGeoN < 1e-2f)
+                continue;
+
+            BSDFSamplingRecord bRec(gp.its, gp.its.toLocal(wi), gp.its.wi, EImportance);
+            Spectrum value = weight * gp.its.getBSDF()->eval(bRec);
+            if (value.isZero())
+                continue;
+
+            /* Account for non-symmetry due to shading normals */
+            value *= std::abs(Frame::cosTheta(bRec.wi) /
+                (wiDotGeoN * Frame::cosTheta(bRec.wo)));
+
+            for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+                atomicAdd(&gp.passFlux[i], value[i]);
+        }
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMPhotonWorker() { }
+protected:
+    const SPPMGatherPointGrid *m_grid;
+    int m_gatherMaxDepth;
+    ref<SPPMPhotonResult> m_workResult;
+};
+
+/**
+ * \brief Parallel process, which traces photons until the requested
+ * number of photons has been splatted into the gather points
+ */
+class SPPMPhotonProcess : public ParticleProcess {
+public:
+    SPPMPhotonProcess(const SPPMGatherPointGrid *grid, size_t photonCount,
+        size_t granularity, int maxDepth, int rrDepth, int gatherMaxDepth,
+        bool autoCancel, const void *progressReporterPayload)
+        : ParticleProcess(ParticleProcess::EGather, photonCount, granularity,
+          "Gathering photons", progressReporterPayload), m_grid(grid),
+          m_photonCount(photonCount), m_maxDepth(maxDepth), m_rrDepth(rrDepth),
+          m_gatherMaxDepth(gatherMaxDepth), m_autoCancel(autoCancel),
+          m_numShot(0), m_numPhotons(0) { }
+
+    /// Return the number of particles that were traced
+    inline size_t getShotParticles() const { return m_numShot; }
+
+    /// Return the number of photons that were splatted
+    inline size_t getPhotonCount() const { return m_numPhotons; }
+
+    bool isLocal() const {
+        return true;
+    }
+
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new SPPMPhotonWorker(m_grid, m_maxDepth, m_rrDepth, m_gatherMaxDepth);
+    }
+
+    void processResult(const WorkResult *wr, bool cancelled) {
+        /* The photons have already been splatted, hence the particles
+           are accounted for even if the work unit was cancelled */
+        const SPPMPhotonResult *result = static_cast<const SPPMPhotonResult *>(wr);
+        LockGuard lock(m_resultMutex);
+        m_numShot += result->getParticleCount();
+        m_numPhotons += result->getPhotonCount();
+        increaseResultCount(result->getPhotonCount());
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        /* Use the same approach as PBRT for auto canceling */
+        LockGuard lock(m_resultMutex);
+        if (m_autoCancel && m_numShot > 100000 && m_numPhotons < m_photonCount
+                && (m_numPhotons == 0 || m_numPhotons < m_numShot/1024)) {
+            Log(EInfo, "Not enough photons could be collected, giving up");
+            return EFailure;
+        }
+
+        return ParticleProcess::generateWork(unit, worker);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMPhotonProcess() { }
+private:
+    const SPPMGatherPointGrid *m_grid;
+    size_t m_photonCount;
+    int m_maxDepth, m_rrDepth, m_gatherMaxDepth;
+    bool m_autoCancel;
+    size_t m_numShot, m_numPhotons;
+};
+
+/// Image region and search radii of a gather point shard
+class SPPMShardWorkUnit : public WorkUnit {
+public:
+    inline void setBlockIndex(int index) { m_blockIndex = index; }
+    inline int getBlockIndex() const { return m_blockIndex; }
+
+    inline void setOffset(const Point2i &offset) { m_offset = offset; }
+    inline const Point2i &getOffset() const { return m_offset; }
+
+    inline void setSize(const Vector2i &size) { m_size = size; }
+    inline const Vector2i &getSize() const { return m_size; }
+
+    /// Return the search radii of the gather points in scanline order
+    inline std::vector<Float> &getRadii() { return m_radii; }
+    inline const std::vector<Float> &getRadii() const { return m_radii; }
+
+    void set(const WorkUnit *workUnit) {
+        const SPPMShardWorkUnit *wu = static_cast<const SPPMShardWorkUnit *>(workUnit);
+        m_blockIndex = wu->m_blockIndex;
+        m_offset = wu->m_offset;
+        m_size = wu->m_size;
+        m_radii = wu->m_radii;
+    }
+
+    void load(Stream *stream) {
+        m_blockIndex = stream->readInt();
+        m_offset = Point2i(stream);
+        m_size = Vector2i(stream);
+        m_radii.resize(m_size.x * m_size.y);
+        stream->readFloatArray(&m_radii[0], m_radii.size());
+    }
+
+    void save(Stream *stream) const {
+        stream->writeInt(m_blockIndex);
+        m_offset.serialize(stream);
+        m_size.serialize(stream);
+        stream->writeFloatArray(&m_radii[0], m_radii.size());
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "SPPMShardWorkUnit[blockIndex=" << m_blockIndex
+            << ", offset=" << m_offset.toString()
+            << ", size=" << m_size.toString() << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMShardWorkUnit() { }
+private:
+    int m_blockIndex;
+    Point2i m_offset;
+    Vector2i m_size;
+    std::vector<Float> m_radii;
+};
+
+/// Per-gather point photon statistics of a shard that are sent back to the master
+class SPPMShardResult : public WorkResult {
+public:
+    SPPMShardResult() : m_blockIndex(0), m_shot(0), m_photons(0) { }
+
+    inline void setBlockIndex(int index) { m_blockIndex = index; }
+    inline int getBlockIndex() const { return m_blockIndex; }
+
+    inline void setShotParticles(size_t shot) { m_shot = shot; }
+    inline size_t getShotParticles() const { return m_shot; }
+
+    inline void setPhotonCount(size_t photons) { m_photons = photons; }
+    inline size_t getPhotonCount() const { return m_photons; }
+
+    /// Resize the per-gather point arrays
+    inline void setSize(size_t size) {
+        m_M.resize(size);
+        m_flux.resize(size);
+        m_emission.resize(size);
+    }
+
+    inline size_t getSize() const { return m_M.size(); }
+
+    inline void put(size_t index, uint32_t M, const Spectrum &flux, const Spectrum &emission) {
+        m_M[index] = M;
+        m_flux[index] = flux;
+        m_emission[index] = emission;
+    }
+
+    inline uint32_t getM(size_t index) const { return m_M[index]; }
+    inline const Spectrum &getFlux(size_t index) const { return m_flux[index]; }
+    inline const Spectrum &getEmission(size_t index) const { return m_emission[index]; }
+
+    void load(Stream *stream) {
+        m_blockIndex = stream->readInt();
+        m_shot = stream->readSize();
+        m_photons = stream->readSize();
+        setSize(stream->readSize());
+        for (size_t i=0; i<m_M.size(); ++i) {
+            m_M[i] = stream->readUInt();
+            m_flux[i] = Spectrum(stream);
+            m_emission[i] = Spectrum(stream);
+        }
+    }
+
+    void save(Stream *stream) const {
+        stream->writeInt(m_blockIndex);
+        stream->writeSize(m_shot);
+        stream->writeSize(m_photons);
+        stream->writeSize(m_M.size());
+        for (size_t i=0; i<m_M.size(); ++i) {
+            stream->writeUInt(m_M[i]);
+            m_flux[i].serialize(stream);
+            m_emission[i].serialize(stream);
+        }
+    }
+
+    std::string toString() const {
+        return formatString("SPPMShardResult[blockIndex=%i, shot=" SIZE_T_FMT
+            ", photons=" SIZE_T_FMT "]", m_blockIndex, m_shot, m_photons);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMShardResult() { }
+private:
+    int m_blockIndex;
+    size_t m_shot, m_photons;
+    std::vector<uint32_t> m_M;
+    std::vector<Spectrum> m_flux;
+    std::vector<Spectrum> m_emission;
+};
+
+/**
+ * \brief Creates the gather points of a shard, traces a photon batch of
+ * its own and splats it into them
+ *
+ * Since the gather points never leave the machine that processes the
+ * shard, only their photon statistics have to be transferred.
+ */
+class SPPMShardWorker : public SPPMPhotonWorker {
+public:
+    SPPMShardWorker(int maxDepth, int rrDepth, int gatherMaxDepth,
+        size_t photonCount, size_t granularity, bool autoCancel)
+        : SPPMPhotonWorker(&m_localGrid, maxDepth, rrDepth, gatherMaxDepth),
+          m_photonCount(photonCount), m_granularity(granularity),
+          m_autoCancel(autoCancel) { }
+
+    SPPMShardWorker(Stream *stream, InstanceManager *manager)
+        : SPPMPhotonWorker(stream, manager) {
+        m_grid = &m_localGrid;
+        m_photonCount = stream->readSize();
+        m_granularity = stream->readSize();
+        m_autoCancel = stream->readBool();
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new SPPMShardWorker(m_maxDepth, m_rrDepth, m_gatherMaxDepth,
+            m_photonCount, m_granularity, m_autoCancel);
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        SPPMPhotonWorker::serialize(stream, manager);
+        stream->writeSize(m_photonCount);
+        stream->writeSize(m_granularity);
+        stream->writeBool(m_autoCancel);
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new SPPMShardWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new SPPMShardResult();
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        const SPPMShardWorkUnit *wu = static_cast<const SPPMShardWorkUnit *>(workUnit);
+        SPPMShardResult *result = static_cast<SPPMShardResult *>(workResult);
+        const Vector2i &size = wu->getSize();
+        const std::vector<Float> &radii = wu->getRadii();
+
+        /* Create the gather points of the shard */
+        m_gatherPoints.resize(1);
+        std::vector<SPPMGatherPoint> &gatherPoints = m_gatherPoints[0];
+        gatherPoints.resize(radii.size());
+        for (size_t i=0; i<gatherPoints.size(); ++i) {
+            SPPMGatherPoint &gp = gatherPoints[i];
+            gp.pos = wu->getOffset() + Vector2i((int) i % size.x, (int) i / size.x);
+            gp.radius = radii[i];
+            gp.passFlux = Spectrum(0.0f);
+            gp.passM = 0;
+            createGatherPoint(m_scene, m_sampler, m_gatherMaxDepth, gp);
+        }
+        m_localGrid.build(m_gatherPoints);
+
+        /* Trace photons until the shard's photon budget is met */
+        ref<RangeWorkUnit> range = new RangeWorkUnit();
+        ref<SPPMPhotonResult> counts = new SPPMPhotonResult();
+        size_t shot = 0, photons = 0;
+        while (photons < m_photonCount && !stop) {
+            if (m_autoCancel && shot > 100000 && (photons == 0 || photons < shot/1024)) {
+                Log(EInfo, "Not enough photons could be collected, giving up");
+                break;
+            }
+            range->setRange(shot, shot + m_granularity - 1);
+            SPPMPhotonWorker::process(range, counts, stop);
+            shot += counts->getParticleCount();
+            photons += counts->getPhotonCount();
+        }
+
+        result->setBlockIndex(wu->getBlockIndex());
+        result->setShotParticles(shot);
+        result->setPhotonCount(photons);
+        result->setSize(gatherPoints.size());
+        for (size_t i=0; i<gatherPoints.size(); ++i) {
+            const SPPMGatherPoint &gp = gatherPoints[i];
+            if (gp.depth != -1)
+                result->put(i, (uint32_t) gp.passM, gp.weight * gp.passFlux, gp.emission);
+            else
+                result->put(i, 0, Spectrum(0.0f), gp.emission);
+        }
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMShardWorker() { }
+private:
+    std::vector<std::vector<SPPMGatherPoint> > m_gatherPoints;
+    SPPMGatherPointGrid m_localGrid;
+    size_t m_photonCount, m_granularity;
+    bool m_autoCancel;
+};
+
+/**
+ * \brief Parallel process that renders one SPPM pass by distributing
+ * shards of gather points over the available workers
+ *
+ * The process keeps the accumulated statistics of all gather points and
+ * updates them as the shard results come in.
+ */
+class SPPMShardProcess : public ParallelProcess {
+public:
+    SPPMShardProcess(std::vector<std::vector<SPPMGatherPoint> > &blocks,
+        const std::vector<Point2i> &offsets, const std::vector<Vector2i> &sizes,
+        std::vector<size_t> &emitted, Bitmap *bitmap, Float alpha,
+        size_t photonCount, size_t granularity, int maxDepth, int rrDepth,
+        bool autoCancel, const void *progressReporterPayload)
+        : m_blocks(blocks), m_offsets(offsets), m_sizes(sizes), m_emitted(emitted),
+          m_bitmap(bitmap), m_alpha(alpha), m_photonCount(photonCount),
+          m_maxDepth(maxDepth), m_rrDepth(rrDepth), m_autoCancel(autoCancel),
+          m_nextBlock(0), m_resultCount(0), m_numShot(0), m_numPhotons(0) {
+        m_granularity = granularity > 0 ? granularity
+            : std::max((size_t) 1, photonCount / 16);
+        m_progress = new ProgressReporter("Rendering shards", blocks.size(),
+            progressReporterPayload);
+        m_resultMutex = new Mutex();
+    }
+
+    /// Return the number of particles that were traced by all shards
+    inline size_t getShotParticles() const { return m_numShot; }
+
+    /// Return the number of photons that were splatted by all shards
+    inline size_t getPhotonCount() const { return m_numPhotons; }
+
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new SPPMShardWorker(m_maxDepth == -1 ? -1 : m_maxDepth-1,
+            m_rrDepth, m_maxDepth, m_photonCount, m_granularity, m_autoCancel);
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        if (m_nextBlock == m_blocks.size())
+            return EFailure;
+
+        SPPMShardWorkUnit *wu = static_cast<SPPMShardWorkUnit *>(unit);
+        const std::vector<SPPMGatherPoint> &gatherPoints = m_blocks[m_nextBlock];
+        wu->setBlockIndex((int) m_nextBlock);
+        wu->setOffset(m_offsets[m_nextBlock]);
+        wu->setSize(m_sizes[m_nextBlock]);
+        std::vector<Float> &radii = wu->getRadii();
+        radii.resize(gatherPoints.size());
+        for (size_t i=0; i<gatherPoints.size(); ++i)
+            radii[i] = gatherPoints[i].radius;
+        ++m_nextBlock;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *wr, bool cancelled) {
+        if (cancelled)
+            return;
+        const SPPMShardResult *result = static_cast<const SPPMShardResult *>(wr);
+        int blockIdx = result->getBlockIndex();
+        std::vector<SPPMGatherPoint> &gatherPoints = m_blocks[blockIdx];
+        const Point2i &offset = m_offsets[blockIdx];
+        int width = m_sizes[blockIdx].x;
+
+        /* Each shard is normalized by the particles that were traced for it */
+        size_t shot = result->getShotParticles(),
+               totalEmitted = (m_emitted[blockIdx] += shot);
+
+        Spectrum *target = (Spectrum *) m_bitmap->getUInt8Data();
+        for (size_t i=0; i<gatherPoints.size(); ++i) {
+            SPPMGatherPoint &gp = gatherPoints[i];
+            gp.pos = offset + Vector2i((int) i % width, (int) i / width);
+            Spectrum contrib = updateGatherPoint(gp, (Float) result->getM(i),
+                result->getFlux(i), result->getEmission(i), shot, totalEmitted, m_alpha);
+            target[gp.pos.y * m_bitmap->getWidth() + gp.pos.x] = contrib;
+        }
+
+        LockGuard lock(m_resultMutex);
+        m_numShot += shot;
+        m_numPhotons += result->getPhotonCount();
+        m_progress->update(++m_resultCount);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMShardProcess() {
+        delete m_progress;
+    }
+private:
+    std::vector<std::vector<SPPMGatherPoint> > &m_blocks;
+    const std::vector<Point2i> &m_offsets;
+    const std::vector<Vector2i> &m_sizes;
+    std::vector<size_t> &m_emitted;
+    ref<Bitmap> m_bitmap;
+    Float m_alpha;
+    size_t m_photonCount, m_granularity;
+    int m_maxDepth, m_rrDepth;
+    bool m_autoCancel;
+    size_t m_nextBlock, m_resultCount;
+    size_t m_numShot, m_numPhotons;
+    ProgressReporter *m_progress;
+    ref<Mutex> m_resultMutex;
+};
+
 /*!\plugin{sppm}{Stochastic progressive photon mapping integrator}
  * \order{8}
  * \parameters{
@@ -50,20 +815,47 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{maxPasses}{\Integer}{Maximum number of passes to render (where \code{-1}
  *        corresponds to rendering until stopped manually). \default{\code{-1}}}
+ *     \parameter{distributed}{\Boolean}{Partition the gather points into shards
+ *        that are processed independently, possibly on remote machines
+ *        (see below). \default{\code{false}}}
+ *     \parameter{shardCount}{\Integer}{Number of shards used in distributed mode
+ *        \default{0, i.e. one per core of all connected machines}}
  * }
  * This plugin implements stochastic progressive photon mapping by Hachisuka et al.
  * \cite{Hachisuka2009Stochastic}. This algorithm is an extension of progressive photon
  * mapping (\pluginref{ppm}) that improves convergence
  * when rendering scenes involving depth-of-field, motion blur, and glossy reflections.
  *
+ * Instead of building a photon map in every pass, the implementation
+ * stores the gather points in a spatial hash grid and directly
+ * accumulates the contribution of each photon into the gather points
+ * around it while tracing. The memory usage is thus independent of the
+ * number of photons per pass.
+ *
+ * By default, every pass traces a single batch of photons on the local
+ * machine. When \code{distributed} is set to \code{true}, the image is
+ * instead split into horizontal strips (shards). Every pass then sends one
+ * work unit per shard to the scheduler, which may run it on any local or
+ * remote core. The worker creates the shard's gather points, traces
+ * \code{photonCount} photons of its own, and only returns the per-pixel
+ * photon statistics. This removes the bottleneck of a single machine
+ * tracing and gathering all photons, at the cost of photons that land
+ * outside of a shard not contributing to it---the total number of traced
+ * photons per pass therefore grows with the number of shards.
+ *
  * Note that the implementation of \pluginref{sppm} in Mitsuba ignores the sampler
  * configuration---hence, the usual steps of choosing a sample generator and a desired
  * number of samples per pixel are not necessary. As with \pluginref{ppm}, once started,
  * the rendering process continues indefinitely until it is manually stopped.
  *
+ * When \code{mitsuba} is started with the \code{-r} option, this integrator
+ * periodically writes a checkpoint containing the per-pixel photon statistics
+ * and sampler states next to the output file. A subsequent invocation with
+ * \code{-r} then continues from the last checkpoint instead of starting over.
+ *
  * \remarks{
- *    \item Due to the data dependencies of this algorithm, the parallelization is
- *    limited to the local machine (i.e. cluster-wide renderings are not implemented)
+ *    \item Unless \code{distributed} is enabled, the parallelization is
+ *    limited to the local machine
  *    \item This integrator does not handle participating media
  *    \item This integrator does not currently work with subsurface scattering
  *    models.
@@ -71,19 +863,7 @@ MTS_NAMESPACE_BEGIN
  */
 class SPPMIntegrator : public Integrator {
 public:
-    /// Represents one individual PPM gather point including relevant statistics
-    struct GatherPoint {
-        Intersection its;
-        Float radius;
-        Spectrum weight;
-        Spectrum flux;
-        Spectrum emission;
-        Float N;
-        int depth;
-        Point2i pos;
-
-        inline GatherPoint() : weight(0.0f), flux(0.0f), emission(0.0f), N(0.0f) { }
-    };
+    typedef SPPMGatherPoint GatherPoint;
 
     SPPMIntegrator(const Properties &props) : Integrator(props) {
         /* Initial photon query radius (0 = infer based on scene size and sensor resolution) */
@@ -105,11 +885,17 @@ public:
         m_autoCancelGathering = props.getBoolean("autoCancelGathering", true);
         /* Maximum number of passes to render. -1 renders until the process is stopped. */
         m_maxPasses = props.getInteger("maxPasses", -1);
+        /* Split the gather points into shards that are processed independently */
+        m_distributed = props.getBoolean("distributed", false);
+        /* Number of shards in distributed mode (0 = one per core) */
+        m_shardCount = props.getInteger("shardCount", 0);
         m_mutex = new Mutex();
         if (m_maxDepth <= 1 && m_maxDepth != -1)
             Log(EError, "Maximum depth must be set to \"2\" or higher!");
         if (m_maxPasses <= 0 && m_maxPasses != -1)
             Log(EError, "Maximum number of Passes must either be set to \"-1\" or \"1\" or higher!");
+        if (m_shardCount < 0)
+            Log(EError, "The number of shards must be positive!");
     }
 
     SPPMIntegrator(Stream *stream, InstanceManager *manager)
@@ -154,9 +940,12 @@ public:
         Point2i cropOffset = film->getCropOffset();
 
         m_gatherBlocks.clear();
+        m_offset.clear();
+        m_size.clear();
         m_running = true;
         m_totalEmitted = 0;
         m_totalPhotons = 0;
+        m_iteration = 0;
 
         ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
             createObject(MTS_CLASS(Sampler), Properties("independent")));
@@ -166,28 +955,36 @@ public:
         /* Allocate memory */
         m_bitmap = new Bitmap(Bitmap::ESpectrum, Bitmap::EFloat, film->getSize());
         m_bitmap->clear();
-        for (int yofs=0; yofs<cropSize.y; yofs += blockSize) {
-            for (int xofs=0; xofs<cropSize.x; xofs += blockSize) {
-                m_gatherBlocks.push_back(std::vector<GatherPoint>());
-                m_offset.push_back(Point2i(cropOffset.x + xofs, cropOffset.y + yofs));
-                std::vector<GatherPoint> &gatherPoints = m_gatherBlocks[m_gatherBlocks.size()-1];
-                int nPixels = std::min(blockSize, cropSize.y-yofs)
-                            * std::min(blockSize, cropSize.x-xofs);
-                gatherPoints.resize(nPixels);
-                for (int i=0; i<nPixels; ++i)
-                    gatherPoints[i].radius = m_initialRadius;
-            }
+        if (m_distributed) {
+            /* Use horizontal strips of the image as shards */
+            int shardCount = std::min(m_shardCount > 0 ? m_shardCount : (int) nCores, cropSize.y);
+            int rows = (cropSize.y + shardCount - 1) / shardCount;
+            for (int yofs=0; yofs<cropSize.y; yofs += rows)
+                addGatherBlock(Point2i(cropOffset.x, cropOffset.y + yofs),
+                    Vector2i(cropSize.x, std::min(rows, cropSize.y-yofs)));
+            Log(EInfo, "Distributing the gather points over " SIZE_T_FMT " shards",
+                m_gatherBlocks.size());
+        } else {
+            for (int yofs=0; yofs<cropSize.y; yofs += blockSize)
+                for (int xofs=0; xofs<cropSize.x; xofs += blockSize)
+                    addGatherBlock(Point2i(cropOffset.x + xofs, cropOffset.y + yofs),
+                        Vector2i(std::min(blockSize, cropSize.x-xofs),
+                                 std::min(blockSize, cropSize.y-yofs)));
         }
+        m_shardEmitted.assign(m_gatherBlocks.size(), 0);
 
         /* Create a sampler instance for every core */
-        std::vector<SerializableObject *> samplers(sched->getCoreCount());
+        m_samplers.resize(sched->getCoreCount());
         for (size_t i=0; i<sched->getCoreCount(); ++i) {
             ref<Sampler> clonedSampler = sampler->clone();
             clonedSampler->incRef();
-            samplers[i] = clonedSampler.get();
+            m_samplers[i] = clonedSampler.get();
         }
 
-        int samplerResID = sched->registerMultiResource(samplers);
+        /* Possibly continue an interrupted rendering */
+        job->loadCheckpoint(this);
+
+        int samplerResID = sched->registerMultiResource(m_samplers);
 
 #ifdef MTS_DEBUG_FP
         enableFPExceptions();
@@ -197,32 +994,47 @@ public:
         Thread::initializeOpenMP(nCores);
 #endif
 
-        int it = 0;
-        while (m_running && (m_maxPasses == -1 || it < m_maxPasses)) {
-            distributedRTPass(scene, samplers);
-            photonMapPass(++it, queue, job, film, sceneResID,
+        while (m_running && (m_maxPasses == -1 || m_iteration < m_maxPasses)) {
+            if (m_distributed) {
+                shardPass(++m_iteration, queue, job, film, sceneResID,
                     sensorResID, samplerResID);
+            } else {
+                distributedRTPass(scene, m_samplers);
+                photonMapPass(++m_iteration, queue, job, film, sceneResID,
+                        sensorResID, samplerResID);
+            }
+            job->saveCheckpoint(this);
         }
 
+        /* Keep the latest state around when the rendering was interrupted */
+        if (!m_running)
+            job->saveCheckpoint(this, true);
+
 #ifdef MTS_DEBUG_FP
         disableFPExceptions();
 #endif
 
-        for (size_t i=0; i<samplers.size(); ++i)
-            samplers[i]->decRef();
+        for (size_t i=0; i<m_samplers.size(); ++i)
+            m_samplers[i]->decRef();
+        m_samplers.clear();
 
         sched->unregisterResource(samplerResID);
         return true;
     }
 
+    /// Append a block of gather points covering the given image region
+    void addGatherBlock(const Point2i &offset, const Vector2i &size) {
+        m_gatherBlocks.push_back(std::vector<GatherPoint>(size.x * size.y));
+        m_offset.push_back(offset);
+        m_size.push_back(size);
+        std::vector<GatherPoint> &gatherPoints = m_gatherBlocks[m_gatherBlocks.size()-1];
+        for (size_t i=0; i<gatherPoints.size(); ++i)
+            gatherPoints[i].radius = m_initialRadius;
+    }
+
     void distributedRTPass(Scene *scene, std::vector<SerializableObject *> &samplers) {
-        ref<Sensor> sensor = scene->getSensor();
-        bool needsApertureSample = sensor->needsApertureSample();
-        bool needsTimeSample = sensor->needsTimeSample();
-        ref<Film> film = sensor->getFilm();
+        ref<Film> film = scene->getSensor()->getFilm();
         Vector2i cropSize = film->getCropSize();
-        Point2i cropOffset = film->getCropOffset();
-        int blockSize = scene->getBlockSize();
 
         /* Process the image in parallel using blocks for better memory locality */
         Log(EInfo, "Creating %i gather points", cropSize.x*cropSize.y);
@@ -237,88 +1049,57 @@ public:
                 Sampler *sampler = static_cast<Sampler *>(samplers[0]);
             #endif
 
-            int xofs = m_offset[i].x, yofs = m_offset[i].y;
             int index = 0;
-            for (int yofsInt = 0; yofsInt < blockSize; ++yofsInt) {
-                if (yofsInt + yofs - cropOffset.y >= cropSize.y)
-                    continue;
-                for (int xofsInt = 0; xofsInt < blockSize; ++xofsInt) {
-                    if (xofsInt + xofs - cropOffset.x >= cropSize.x)
-                        continue;
-                    Point2 apertureSample, sample;
-                    Float timeSample = 0.0f;
+            for (int y = 0; y < m_size[i].y; ++y) {
+                for (int x = 0; x < m_size[i].x; ++x) {
                     GatherPoint &gatherPoint = gatherPoints[index++];
-                    gatherPoint.pos = Point2i(xofs + xofsInt, yofs + yofsInt);
-                    sampler->generate(gatherPoint.pos);
-                    if (needsApertureSample)
-                        apertureSample = sampler->next2D();
-                    if (needsTimeSample)
-                        timeSample = sampler->next1D();
-                    sample = sampler->next2D();
-                    sample += Vector2((Float) gatherPoint.pos.x, (Float) gatherPoint.pos.y);
-                    RayDifferential ray;
-                    sensor->sampleRayDifferential(ray, sample, apertureSample, timeSample);
-                    Spectrum weight(1.0f);
-                    int depth = 1;
-                    gatherPoint.emission = Spectrum(0.0f);
-
-                    while (true) {
-                        if (scene->rayIntersect(ray, gatherPoint.its)) {
-                            if (gatherPoint.its.isEmitter())
-                                gatherPoint.emission += weight * gatherPoint.its.Le(-ray.d);
-
-                            if (depth >= m_maxDepth && m_maxDepth != -1) {
-                                gatherPoint.depth = -1;
-                                break;
-                            }
-
-                            const BSDF *bsdf = gatherPoint.its.getBSDF();
-
-                            /* Create hit point if this is a diffuse material or a glossy
-                               one, and there has been a previous interaction with
-                               a glossy material */
-                            if ((bsdf->getType() & BSDF::EAll) == BSDF::EDiffuseReflection ||
-                                (bsdf->getType() & BSDF::EAll) == BSDF::EDiffuseTransmission ||
-                                (depth + 1 > m_maxDepth && m_maxDepth != -1)) {
-                                gatherPoint.weight = weight;
-                                gatherPoint.depth = depth;
-                                break;
-                            } else {
-                                /* Recurse for dielectric materials and (specific to SPPM):
-                                   recursive "final gathering" for glossy materials */
-                                BSDFSamplingRecord bRec(gatherPoint.its, sampler);
-                                weight *= bsdf->sample(bRec, sampler->next2D());
-                                if (weight.isZero()) {
-                                    gatherPoint.depth = -1;
-                                    break;
-                                }
-                                ray = RayDifferential(gatherPoint.its.p,
-                                    gatherPoint.its.toWorld(bRec.wo), ray.time);
-                                ++depth;
-                            }
-                        } else {
-                            /* Generate an invalid sample */
-                            gatherPoint.depth = -1;
-                            gatherPoint.emission += weight * scene->evalEnvironment(ray);
-                            break;
-                        }
-                    }
-                    sampler->advance();
+                    gatherPoint.pos = m_offset[i] + Vector2i(x, y);
+                    createGatherPoint(scene, sampler, m_maxDepth, gatherPoint);
                 }
             }
         }
     }
 
+    /// Render a pass by processing all shards of gather points in parallel
+    void shardPass(int it, RenderQueue *queue, const RenderJob *job,
+            Film *film, int sceneResID, int sensorResID, int samplerResID) {
+        Log(EInfo, "Performing a sharded photon mapping pass %i (" SIZE_T_FMT " photons so far)",
+                it, m_totalPhotons);
+        ref<Scheduler> sched = Scheduler::getInstance();
+
+        ref<SPPMShardProcess> proc = new SPPMShardProcess(m_gatherBlocks, m_offset,
+            m_size, m_shardEmitted, m_bitmap, m_alpha, m_photonCount, m_granularity,
+            m_maxDepth, m_rrDepth, m_autoCancelGathering, job);
+
+        proc->bindResource("scene", sceneResID);
+        proc->bindResource("sensor", sensorResID);
+        proc->bindResource("sampler", samplerResID);
+
+        sched->schedule(proc);
+        sched->wait(proc);
+
+        Log(EDebug, "Shot " SIZE_T_FMT " particles, which deposited " SIZE_T_FMT
+            " photons", proc->getShotParticles(), proc->getPhotonCount());
+
+        m_totalEmitted += proc->getShotParticles();
+        m_totalPhotons += proc->getPhotonCount();
+        film->clear();
+        film->setBitmap(m_bitmap);
+        queue->signalRefresh(job);
+    }
+
     void photonMapPass(int it, RenderQueue *queue, const RenderJob *job,
             Film *film, int sceneResID, int sensorResID, int samplerResID) {
         Log(EInfo, "Performing a photon mapping pass %i (" SIZE_T_FMT " photons so far)",
                 it, m_totalPhotons);
         ref<Scheduler> sched = Scheduler::getInstance();
 
-        /* Generate the global photon map */
-        ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
-            GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
-            m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1, m_rrDepth, true,
+        /* Register the gather points with the hash grid */
+        m_grid.build(m_gatherBlocks);
+
+        /* Trace photons and splat them into the gather points */
+        ref<SPPMPhotonProcess> proc = new SPPMPhotonProcess(&m_grid, m_photonCount,
+            m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1, m_rrDepth, m_maxDepth,
             m_autoCancelGathering, job);
 
         proc->bindResource("scene", sceneResID);
@@ -328,14 +1109,12 @@ public:
         sched->schedule(proc);
         sched->wait(proc);
 
-        ref<PhotonMap> photonMap = proc->getPhotonMap();
-        photonMap->build();
-        Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
-            SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
+        Log(EDebug, "Shot " SIZE_T_FMT " particles, which deposited " SIZE_T_FMT
+            " photons", proc->getShotParticles(), proc->getPhotonCount());
 
         Log(EInfo, "Gathering ..");
         m_totalEmitted += proc->getShotParticles();
-        m_totalPhotons += photonMap->size();
+        m_totalPhotons += proc->getPhotonCount();
         film->clear();
         #if defined(MTS_OPENMP)
             #pragma omp parallel for schedule(dynamic)
@@ -346,40 +1125,107 @@ public:
             Spectrum *target = (Spectrum *) m_bitmap->getUInt8Data();
             for (size_t i=0; i<gatherPoints.size(); ++i) {
                 GatherPoint &gp = gatherPoints[i];
-                Float M, N = gp.N;
-                Spectrum flux, contrib;
+                Float M;
+                Spectrum flux;
 
                 if (gp.depth != -1) {
-                    M = (Float) photonMap->estimateRadianceRaw(
-                        gp.its, gp.radius, flux, m_maxDepth == -1 ? INT_MAX : m_maxDepth-gp.depth);
+                    M = (Float) gp.passM;
+                    flux = gp.weight * gp.passFlux;
                 } else {
                     M = 0;
                     flux = Spectrum(0.0f);
                 }
+                gp.passM = 0;
+                gp.passFlux = Spectrum(0.0f);
 
-                if (N == 0 && !gp.emission.isZero())
-                    gp.N = N = 1;
-
-                if (N+M == 0) {
-                    gp.flux = contrib = Spectrum(0.0f);
-                } else {
-                    Float ratio = (N + m_alpha * M) / (N + M);
-                    gp.radius = gp.radius * std::sqrt(ratio);
-
-                    gp.flux = (gp.flux +
-                            gp.weight * flux +
-                            gp.emission * (Float) proc->getShotParticles() * M_PI * gp.radius*gp.radius) * ratio;
-                    gp.N = N + m_alpha * M;
-                    contrib = gp.flux / ((Float) m_totalEmitted * gp.radius*gp.radius * M_PI);
-                }
-
-                target[gp.pos.y * m_bitmap->getWidth() + gp.pos.x] = contrib;
+                target[gp.pos.y * m_bitmap->getWidth() + gp.pos.x] = updateGatherPoint(gp, M,
+                    flux, gp.emission, proc->getShotParticles(), m_totalEmitted, m_alpha);
             }
         }
         film->setBitmap(m_bitmap);
         queue->signalRefresh(job);
     }
 
+    void saveCheckpoint(Stream *stream) const {
+        stream->writeInt(m_iteration);
+        stream->writeSize(m_totalEmitted);
+        stream->writeSize(m_totalPhotons);
+
+        /* Only the accumulated statistics need to be stored -- the
+           gather points are re-created at the beginning of every pass */
+        stream->writeSize(m_gatherBlocks.size());
+        for (size_t i=0; i<m_gatherBlocks.size(); ++i) {
+            const std::vector<GatherPoint> &gatherPoints = m_gatherBlocks[i];
+            stream->writeSize(gatherPoints.size());
+            for (size_t j=0; j<gatherPoints.size(); ++j) {
+                const GatherPoint &gp = gatherPoints[j];
+                stream->writeFloat(gp.radius);
+                gp.flux.serialize(stream);
+                stream->writeFloat(gp.N);
+            }
+        }
+
+        /* In distributed mode, every shard has its own particle count */
+        stream->writeBool(m_distributed);
+        if (m_distributed) {
+            for (size_t i=0; i<m_shardEmitted.size(); ++i)
+                stream->writeSize(m_shardEmitted[i]);
+        }
+
+        /* Store the sampler states so that the resumed rendering doesn't
+           replay the random number sequences of the earlier passes */
+        ref<InstanceManager> manager = new InstanceManager();
+        stream->writeSize(m_samplers.size());
+        for (size_t i=0; i<m_samplers.size(); ++i)
+            manager->serialize(stream, m_samplers[i]);
+    }
+
+    void loadCheckpoint(Stream *stream) {
+        int iteration = stream->readInt();
+        size_t totalEmitted = stream->readSize(),
+               totalPhotons = stream->readSize();
+
+        if (stream->readSize() != m_gatherBlocks.size())
+            Log(EError, "The number of gather point blocks does not match!");
+        for (size_t i=0; i<m_gatherBlocks.size(); ++i) {
+            std::vector<GatherPoint> &gatherPoints = m_gatherBlocks[i];
+            if (stream->readSize() != gatherPoints.size())
+                Log(EError, "The number of gather points does not match!");
+            for (size_t j=0; j<gatherPoints.size(); ++j) {
+                GatherPoint &gp = gatherPoints[j];
+                gp.radius = stream->readFloat();
+                gp.flux = Spectrum(stream);
+                gp.N = stream->readFloat();
+            }
+        }
+
+        if (stream->readBool() != m_distributed)
+            Log(EError, "The checkpoint was created with a different \"distributed\" setting!");
+        if (m_distributed) {
+            for (size_t i=0; i<m_shardEmitted.size(); ++i)
+                m_shardEmitted[i] = stream->readSize();
+        }
+
+        /* Restore the sampler states. When the number of cores has
+           changed, additional samplers are derived from the first one */
+        ref<InstanceManager> manager = new InstanceManager();
+        std::vector<ref<Sampler> > samplers(stream->readSize());
+        for (size_t i=0; i<samplers.size(); ++i)
+            samplers[i] = static_cast<Sampler *>(manager->getInstance(stream));
+        for (size_t i=0; i<m_samplers.size() && !samplers.empty(); ++i) {
+            ref<Sampler> sampler = i < samplers.size() ? samplers[i] : samplers[0]->clone();
+            sampler->incRef();
+            m_samplers[i]->decRef();
+            m_samplers[i] = sampler.get();
+        }
+
+        m_iteration = iteration;
+        m_totalEmitted = totalEmitted;
+        m_totalPhotons = totalPhotons;
+        Log(EInfo, "Continuing after pass %i (" SIZE_T_FMT " photons so far)",
+            m_iteration, m_totalPhotons);
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "SPPMIntegrator[" << endl
@@ -389,7 +1235,9 @@ public:
             << "  alpha = " << m_alpha << "," << endl
             << "  photonCount = " << m_photonCount << "," << endl
             << "  granularity = " << m_granularity << "," << endl
-            << "  maxPasses = " << m_maxPasses << endl
+            << "  maxPasses = " << m_maxPasses << "," << endl
+            << "  distributed = " << m_distributed << "," << endl
+            << "  shardCount = " << m_shardCount << endl
             << "]";
         return oss.str();
     }
@@ -397,7 +1245,11 @@ public:
     MTS_DECLARE_CLASS()
 private:
     std::vector<std::vector<GatherPoint> > m_gatherBlocks;
+    SPPMGatherPointGrid m_grid;
     std::vector<Point2i> m_offset;
+    std::vector<Vector2i> m_size;
+    std::vector<size_t> m_shardEmitted;
+    std::vector<SerializableObject *> m_samplers;
     ref<Mutex> m_mutex;
     ref<Bitmap> m_bitmap;
     Float m_initialRadius, m_alpha;
@@ -406,9 +1258,18 @@ private:
     size_t m_totalEmitted, m_totalPhotons;
     bool m_running;
     bool m_autoCancelGathering;
-    int m_maxPasses;
+    int m_maxPasses, m_iteration;
+    bool m_distributed;
+    int m_shardCount;
 };
 
+MTS_IMPLEMENT_CLASS(SPPMPhotonResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(SPPMPhotonWorker, false, ParticleTracer)
+MTS_IMPLEMENT_CLASS(SPPMPhotonProcess, false, ParticleProcess)
+MTS_IMPLEMENT_CLASS(SPPMShardWorkUnit, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(SPPMShardResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(SPPMShardWorker, false, SPPMPhotonWorker)
+MTS_IMPLEMENT_CLASS(SPPMShardProcess, false, ParallelProcess)
 MTS_IMPLEMENT_CLASS_S(SPPMIntegrator, false, Integrator)
 MTS_EXPORT_PLUGIN(SPPMIntegrator, "Stochastic progressive photon mapper");
 MTS_NAMESPACE_END
@@ -24,7 +24,7 @@
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{pssmlt}{Primary Sample Space Metropolis Light Transport}
- * \order{9}
+ * \order{10}
  * \parameters{
  *     \parameter{bidirectional}{\Boolean}{
  *     PSSMLT works in conjunction with another rendering
@@ -72,6 +72,22 @@ MTS_NAMESPACE_BEGIN
  *       with a completely new one. Usually, there is little need to change
  *       this. \default{0.3}
  *     }
+ *     \parameter{chains}{\Integer}{
+ *       Number of independent Markov chains. Every chain starts from its own
+ *       seed path and is advanced in segments by consecutive work units,
+ *       which any worker can pick up. Fewer and longer chains reduce the
+ *       cost of seed generation and start-up bias; there should be at least
+ *       as many chains as cores to keep all workers busy. When set to
+ *       \code{-1}, each work unit runs a separate chain. \default{\code{-1}}
+ *     }
+ *     \parameter{seedFile}{\String}{
+ *       File, in which the seed paths and the average luminance are stored.
+ *       When it already exists and was created with matching parameters,
+ *       the luminance sampling step is skipped, which speeds up repeated
+ *       renderings (e.g. of different exposures). Changes to the scene
+ *       are not detected, hence the file must be deleted by hand in this
+ *       case. Not supported by two-stage MLT. \default{none}
+ *     }
  * }
  * Primary Sample Space Metropolis Light Transport (PSSMLT) is a rendering
  * technique developed by Kelemen et al. \cite{Kelemen2002Simple} which is
@@ -242,8 +258,18 @@ public:
            workers busy. */
         m_config.workUnits = props.getInteger("workUnits", -1);
 
+        /* Number of Markov chains. Each chain is advanced by several
+           consecutive work units, which carry the chain state between
+           them. When set to <tt>-1</tt>, every work unit runs its own
+           chain starting from a fresh seed path. */
+        m_config.chains = props.getInteger("chains", -1);
+        m_config.chainSegments = 1;
+
         /* Stop MLT after X seconds -- useful for equal-time comparisons */
         m_config.timeout = props.getInteger("timeout", 0);
+
+        /* Optional file for reusing the seed paths of a previous run */
+        m_seedFile = props.getString("seedFile", "");
     }
 
     /// Unserialize from a binary data stream
@@ -328,16 +354,29 @@ public:
             m_config.workUnits = (int) std::max(workUnits, (size_t) 1);
         }
 
+        /* Distribute the work units over the Markov chains */
+        int chains = m_config.chains;
+        if (chains <= 0 || chains > m_config.workUnits)
+            chains = m_config.workUnits;
+        if (m_config.chains > 0 && chains < (int) nCores && !nested)
+            Log(EWarn, "There are fewer Markov chains (%i) than cores -- "
+                "some of the cores will be idle!", chains);
+        int chainSegments = (m_config.workUnits + chains - 1) / chains;
+        m_config.chains = chains;
+        m_config.chainSegments = chainSegments;
+        m_config.workUnits = chains * chainSegments;
+
+        /* Keep the total number of mutations per pixel */
+        m_config.nMutations = (cropSize.x * cropSize.y *
+            sampleCount) / m_config.workUnits;
+
         size_t luminanceSamples = m_config.luminanceSamples;
-        if (luminanceSamples < (size_t) m_config.workUnits * 10) {
-            luminanceSamples = (size_t) m_config.workUnits * 10;
+        if (luminanceSamples < (size_t) chains * 10) {
+            luminanceSamples = (size_t) chains * 10;
             Log(EWarn, "Warning: increasing number of luminance samples to " SIZE_T_FMT,
                 luminanceSamples);
         }
 
-        m_config.nMutations = (cropSize.x * cropSize.y *
-            sampleCount) / m_config.workUnits;
-
         ref<Bitmap> directImage;
         if (m_config.separateDirect && m_config.directSamples > 0 && !nested) {
             directImage = BidirectionalUtils::renderDirectComponent(scene,
@@ -355,8 +394,9 @@ public:
         ref<PSSMLTProcess> process = new PSSMLTProcess(job, queue,
                 m_config, directImage, pathSeeds);
 
-        m_config.luminance = pathSampler->generateSeeds(luminanceSamples,
-            m_config.workUnits, false, m_config.importanceMap, pathSeeds);
+        m_config.luminance = pathSampler->generateSeeds(sceneResID,
+            luminanceSamples, m_config.chains, false, m_config.importanceMap,
+            pathSeeds, nested ? fs::path() : m_seedFile);
 
         if (!nested)
             m_config.dump();
@@ -393,6 +433,7 @@ public:
 private:
     ref<ParallelProcess> m_process;
     ref<RenderJob> m_nestedJob;
+    fs::path m_seedFile;
     PSSMLTConfiguration m_config;
 };
 
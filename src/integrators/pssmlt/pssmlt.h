@@ -44,6 +44,8 @@ struct PSSMLTConfiguration {
     Float luminance;
     Float pLarge;
     int workUnits;
+    int chains;
+    int chainSegments;
     int directSamples;
     int luminanceSamples;
     size_t nMutations;
@@ -82,6 +84,8 @@ struct PSSMLTConfiguration {
         SLog(EDebug, "   Overall MLT image luminance : %f (%i samples)",
             luminance, luminanceSamples);
         SLog(EDebug, "   Total number of work units  : %i", workUnits);
+        SLog(EDebug, "   Markov chains               : %i (%i work units each)",
+            chains, chainSegments);
         SLog(EDebug, "   Mutations per work unit     : " SIZE_T_FMT, nMutations);
         if (timeout)
             SLog(EDebug, "   Timeout                     : " SIZE_T_FMT,  timeout);
@@ -96,6 +100,8 @@ struct PSSMLTConfiguration {
         luminance = stream->readFloat();
         pLarge = stream->readFloat();
         workUnits = stream->readInt();
+        chains = stream->readInt();
+        chainSegments = stream->readInt();
         directSamples = stream->readInt();
         luminanceSamples = stream->readInt();
         nMutations = stream->readSize();
@@ -123,6 +129,8 @@ struct PSSMLTConfiguration {
         stream->writeFloat(luminance);
         stream->writeFloat(pLarge);
         stream->writeInt(workUnits);
+        stream->writeInt(chains);
+        stream->writeInt(chainSegments);
         stream->writeInt(directSamples);
         stream->writeInt(luminanceSamples);
         stream->writeSize(nMutations);
@@ -18,6 +18,7 @@
 
 #include <mitsuba/bidir/util.h>
 #include <mitsuba/bidir/path.h>
+#include <mitsuba/core/mstream.h>
 #include "pssmlt_proc.h"
 #include "pssmlt_sampler.h"
 
@@ -52,12 +53,12 @@ public:
     }
 
     ref<WorkUnit> createWorkUnit() const {
-        return new SeedWorkUnit();
+        return new PSSMLTWorkUnit();
     }
 
     ref<WorkResult> createWorkResult() const {
-        return new ImageBlock(Bitmap::ESpectrum,
-            m_film->getCropSize(), m_film->getReconstructionFilter());
+        return new PSSMLTWorkResult(m_film->getCropSize(),
+            m_film->getReconstructionFilter());
     }
 
     void prepare() {
@@ -85,12 +86,50 @@ public:
             m_config.rrDepth, m_config.separateDirect, m_config.directSampling);
     }
 
-    void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
-        ImageBlock *result = static_cast<ImageBlock *>(workResult);
-        const SeedWorkUnit *wu = static_cast<const SeedWorkUnit *>(workUnit);
-        const PathSeed &seed = wu->getSeed();
-        SplatList *current = new SplatList(), *proposed = new SplatList();
+    /// Continue a chain from the state left behind by its previous segment
+    void loadChain(const std::vector<uint8_t> &state, SplatList *current) {
+        ref<MemoryStream> mstream = new MemoryStream(
+            const_cast<uint8_t *>(&state[0]), state.size());
+        m_sensorSampler->loadState(mstream);
+        m_emitterSampler->loadState(mstream);
+        m_directSampler->loadState(mstream);
 
+        ref<Random> random = m_origSampler->getRandom();
+        m_sensorSampler->setRandom(random);
+        m_emitterSampler->setRandom(random);
+        m_directSampler->setRandom(random);
+
+        current->clear();
+        size_t count = mstream->readSize();
+        for (size_t i=0; i<count; ++i) {
+            Point2 pos(mstream);
+            Spectrum value(mstream);
+            current->splats.push_back(std::make_pair(pos, value));
+        }
+        current->luminance = mstream->readFloat();
+        current->nSamples = mstream->readInt();
+    }
+
+    /// Serialize the chain state so that a later segment can continue it
+    void saveChain(std::vector<uint8_t> &state, const SplatList *current) {
+        ref<MemoryStream> mstream = new MemoryStream();
+        m_sensorSampler->saveState(mstream);
+        m_emitterSampler->saveState(mstream);
+        m_directSampler->saveState(mstream);
+
+        mstream->writeSize(current->size());
+        for (size_t i=0; i<current->size(); ++i) {
+            current->getPosition(i).serialize(mstream);
+            current->getValue(i).serialize(mstream);
+        }
+        mstream->writeFloat(current->luminance);
+        mstream->writeInt(current->nSamples);
+
+        state.assign(mstream->getData(), mstream->getData() + mstream->getSize());
+    }
+
+    /// Start a chain by replaying its seed path
+    void startChain(const PathSeed &seed, SplatList *current) {
         m_emitterSampler->reset();
         m_sensorSampler->reset();
         m_directSampler->reset();
@@ -101,10 +140,10 @@ public:
         /* Generate the initial sample by replaying the seeding random
            number stream at the appropriate position. Afterwards, revert
            back to this worker's own source of random numbers */
+        m_rplSampler->setSequence(seed.sequence);
         m_rplSampler->setSampleIndex(seed.sampleIndex);
 
         m_pathSampler->sampleSplats(Point2i(-1), *current);
-        result->clear();
 
         ref<Random> random = m_origSampler->getRandom();
         m_sensorSampler->setRandom(random);
@@ -126,12 +165,30 @@ public:
                 / seed.luminance) > Epsilon)
             Log(EError, "Error when reconstructing a seed path: luminance "
                 "= %f, but expected luminance = %f", current->luminance, seed.luminance);
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
+        PSSMLTWorkResult *wr = static_cast<PSSMLTWorkResult *>(workResult);
+        ImageBlock *result = wr->getImageBlock();
+        const PSSMLTWorkUnit *wu = static_cast<const PSSMLTWorkUnit *>(workUnit);
+        SplatList *current = new SplatList(), *proposed = new SplatList();
+
+        result->clear();
+        wr->setChain(wu->getChain());
+        wr->getState().clear();
+
+        if (wu->getState().empty()) {
+            startChain(wu->getSeed(), current);
+            current->normalize(m_config.importanceMap);
+        } else {
+            loadChain(wu->getState(), current);
+        }
+        ref<Random> random = m_origSampler->getRandom();
 
         ref<Timer> timer = new Timer();
 
         /* MLT main loop */
         Float cumulativeWeight = 0;
-        current->normalize(m_config.importanceMap);
         for (uint64_t mutationCtr=0; mutationCtr<m_config.nMutations && !stop; ++mutationCtr) {
             if (wu->getTimeout() > 0 && (mutationCtr % 8192) == 0
                     && (int) timer->getMilliseconds() > wu->getTimeout())
@@ -227,6 +284,8 @@ public:
                 result->put(current->getPosition(k), &value[0]);
         }
 
+        if (!wu->isLastSegment())
+            saveChain(wr->getState(), current);
 
         delete current;
         delete proposed;
@@ -265,6 +324,12 @@ PSSMLTProcess::PSSMLTProcess(const RenderJob *parent, RenderQueue *queue,
     m_resultCounter = 0;
     m_workCounter = 0;
     m_refreshTimeout = 1;
+    m_paused = false;
+
+    m_chainStates.resize(conf.chains);
+    m_segmentsLeft.resize(conf.chains, conf.chainSegments);
+    for (int i=0; i<conf.chains; ++i)
+        m_idleChains.push_back(i);
 }
 
 ref<WorkProcessor> PSSMLTProcess::createWorkProcessor() const {
@@ -310,16 +375,34 @@ void PSSMLTProcess::develop() {
 }
 
 void PSSMLTProcess::processResult(const WorkResult *wr, bool cancelled) {
-    LockGuard lock(m_resultMutex);
-    const ImageBlock *result = static_cast<const ImageBlock *>(wr);
-    m_accum->put(result);
+    UniqueLock lock(m_resultMutex);
+    const PSSMLTWorkResult *result = static_cast<const PSSMLTWorkResult *>(wr);
+    m_accum->put(result->getImageBlock());
     m_progress->update(++m_resultCounter);
     m_refreshTimeout = std::min(2000U, m_refreshTimeout * 2);
 
+    /* Return the chain to the pool so that any worker can continue it */
+    int chain = result->getChain();
+    bool reschedule = false;
+    if (m_segmentsLeft[chain] > 0 && !cancelled) {
+        m_chainStates[chain] = result->getState();
+        m_idleChains.push_back(chain);
+        reschedule = m_paused;
+        m_paused = false;
+    } else {
+        m_chainStates[chain].clear();
+    }
+
     /* Re-develop the entire image every two seconds if partial results are
        visible (e.g. in a graphical user interface). */
     if (m_job->isInteractive() && m_refreshTimer->getMilliseconds() > m_refreshTimeout)
         develop();
+    lock.unlock();
+
+    /* The scheduler must not be called while holding the result lock
+       (it may itself be waiting in generateWork() for that lock) */
+    if (reschedule)
+        Scheduler::getInstance()->schedule(this);
 }
 
 ParallelProcess::EStatus PSSMLTProcess::generateWork(WorkUnit *unit, int worker) {
@@ -329,11 +412,27 @@ ParallelProcess::EStatus PSSMLTProcess::generateWork(WorkUnit *unit, int worker)
                   static_cast<int64_t>(m_timeoutTimer->getMilliseconds()));
     }
 
+    LockGuard lock(m_resultMutex);
     if (m_workCounter >= m_config.workUnits || timeout < 0)
         return EFailure;
 
-    SeedWorkUnit *workUnit = static_cast<SeedWorkUnit *>(unit);
-    workUnit->setSeed(m_seeds[m_workCounter++]);
+    if (m_idleChains.empty()) {
+        /* All remaining segments belong to chains that are currently
+           being advanced -- wait until one of them is returned */
+        m_paused = true;
+        return EPause;
+    }
+
+    int chain = m_idleChains.front();
+    m_idleChains.pop_front();
+    int segmentsLeft = --m_segmentsLeft[chain];
+    ++m_workCounter;
+
+    PSSMLTWorkUnit *workUnit = static_cast<PSSMLTWorkUnit *>(unit);
+    workUnit->setSeed(m_seeds[chain]);
+    workUnit->setChain(chain);
+    workUnit->setState(m_chainStates[chain]);
+    workUnit->setLastSegment(segmentsLeft == 0);
     workUnit->setTimeout(timeout);
     return ESuccess;
 }
@@ -354,5 +453,7 @@ void PSSMLTProcess::bindResource(const std::string &name, int id) {
 MTS_IMPLEMENT_CLASS_S(PSSMLTRenderer, false, WorkProcessor)
 MTS_IMPLEMENT_CLASS(PSSMLTProcess, false, ParallelProcess)
 MTS_IMPLEMENT_CLASS(SeedWorkUnit, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(PSSMLTWorkUnit, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(PSSMLTWorkResult, false, WorkResult)
 
 MTS_NAMESPACE_END
@@ -24,9 +24,150 @@
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/bitmap.h>
 #include "pssmlt.h"
+#include <deque>
 
 MTS_NAMESPACE_BEGIN
 
+/* ==================================================================== */
+/*                      Work unit and work result                       */
+/* ==================================================================== */
+
+/**
+ * \brief PSSMLT work unit: advances one Markov chain by a fixed
+ * number of mutations
+ *
+ * The first segment of a chain starts from its seed path. Subsequent
+ * segments continue from the chain state that was returned in the
+ * \ref PSSMLTWorkResult of the previous segment, which may have been
+ * computed by a different worker.
+ */
+class PSSMLTWorkUnit : public WorkUnit {
+public:
+    inline PSSMLTWorkUnit() : m_chain(0), m_timeout(0), m_lastSegment(true) { }
+
+    inline void set(const WorkUnit *wu) {
+        const PSSMLTWorkUnit *other = static_cast<const PSSMLTWorkUnit *>(wu);
+        m_seed = other->m_seed;
+        m_chain = other->m_chain;
+        m_timeout = other->m_timeout;
+        m_lastSegment = other->m_lastSegment;
+        m_state = other->m_state;
+    }
+
+    /// Return the seed path of the chain
+    inline const PathSeed &getSeed() const { return m_seed; }
+    /// Set the seed path of the chain
+    inline void setSeed(const PathSeed &seed) { m_seed = seed; }
+
+    /// Return the index of the chain
+    inline int getChain() const { return m_chain; }
+    /// Set the index of the chain
+    inline void setChain(int chain) { m_chain = chain; }
+
+    /// Return the timeout (in milliseconds, or 0 if there is none)
+    inline int getTimeout() const { return m_timeout; }
+    /// Set the timeout (in milliseconds, or 0 if there is none)
+    inline void setTimeout(int timeout) { m_timeout = timeout; }
+
+    /// Is this the last segment of the chain (i.e. the state can be discarded)?
+    inline bool isLastSegment() const { return m_lastSegment; }
+    /// Specify whether this is the last segment of the chain
+    inline void setLastSegment(bool value) { m_lastSegment = value; }
+
+    /// Return the serialized chain state (empty for the first segment)
+    inline const std::vector<uint8_t> &getState() const { return m_state; }
+    /// Set the serialized chain state
+    inline void setState(const std::vector<uint8_t> &state) { m_state = state; }
+
+    void load(Stream *stream) {
+        m_seed = PathSeed(stream);
+        m_chain = stream->readInt();
+        m_timeout = stream->readInt();
+        m_lastSegment = stream->readBool();
+        m_state.resize(stream->readSize());
+        if (!m_state.empty())
+            stream->read(&m_state[0], m_state.size());
+    }
+
+    void save(Stream *stream) const {
+        m_seed.serialize(stream);
+        stream->writeInt(m_chain);
+        stream->writeInt(m_timeout);
+        stream->writeBool(m_lastSegment);
+        stream->writeSize(m_state.size());
+        if (!m_state.empty())
+            stream->write(&m_state[0], m_state.size());
+    }
+
+    std::string toString() const {
+        return formatString("PSSMLTWorkUnit[chain=%i]", m_chain);
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    PathSeed m_seed;
+    int m_chain;
+    int m_timeout;
+    bool m_lastSegment;
+    std::vector<uint8_t> m_state;
+};
+
+/**
+ * \brief PSSMLT work result: the splatted contributions of one
+ * chain segment along with the final state of the chain
+ */
+class PSSMLTWorkResult : public WorkResult {
+public:
+    PSSMLTWorkResult(const Vector2i &size, const ReconstructionFilter *filter)
+            : m_chain(0) {
+        m_block = new ImageBlock(Bitmap::ESpectrum, size, filter);
+    }
+
+    /// Return the image block containing the splats
+    inline ImageBlock *getImageBlock() { return m_block; }
+    /// Return the image block containing the splats (const version)
+    inline const ImageBlock *getImageBlock() const { return m_block.get(); }
+
+    /// Return the index of the chain
+    inline int getChain() const { return m_chain; }
+    /// Set the index of the chain
+    inline void setChain(int chain) { m_chain = chain; }
+
+    /// Return the serialized chain state (empty after the last segment)
+    inline std::vector<uint8_t> &getState() { return m_state; }
+    /// Return the serialized chain state (const version)
+    inline const std::vector<uint8_t> &getState() const { return m_state; }
+
+    void load(Stream *stream) {
+        m_block->load(stream);
+        m_chain = stream->readInt();
+        m_state.resize(stream->readSize());
+        if (!m_state.empty())
+            stream->read(&m_state[0], m_state.size());
+    }
+
+    void save(Stream *stream) const {
+        m_block->save(stream);
+        stream->writeInt(m_chain);
+        stream->writeSize(m_state.size());
+        if (!m_state.empty())
+            stream->write(&m_state[0], m_state.size());
+    }
+
+    std::string toString() const {
+        return formatString("PSSMLTWorkResult[chain=%i]", m_chain);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~PSSMLTWorkResult() { }
+private:
+    ref<ImageBlock> m_block;
+    int m_chain;
+    std::vector<uint8_t> m_state;
+};
+
 /* ==================================================================== */
 /*                           Parallel process                           */
 /* ==================================================================== */
@@ -63,6 +204,13 @@ private:
     int m_resultCounter, m_workCounter;
     unsigned int m_refreshTimeout;
     ref<Timer> m_timeoutTimer, m_refreshTimer;
+    /// Serialized state of every chain between two of its segments
+    std::vector<std::vector<uint8_t> > m_chainStates;
+    /// Remaining segments of every chain
+    std::vector<int> m_segmentsLeft;
+    /// Chains that are not currently being advanced by a worker
+    std::deque<int> m_idleChains;
+    bool m_paused;
 };
 
 MTS_NAMESPACE_END
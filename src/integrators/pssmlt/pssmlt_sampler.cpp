@@ -51,6 +51,14 @@ void PSSMLTSampler::serialize(Stream *stream, InstanceManager *manager) const {
 
 void PSSMLTSampler::configure() {
     m_logRatio = -math::fastlog(m_s2/m_s1);
+    #if KELEMEN_STYLE_MUTATIONS == 1
+        /* Variance of a single mutation: the offset is s2 * (s1/s2)^u
+           with u uniformly distributed on [0, 1] */
+        m_mutationVariance = m_s2 * m_s2 * (1 - (m_s1*m_s1) / (m_s2*m_s2))
+            / (2 * math::fastlog(m_s2/m_s1));
+    #else
+        m_mutationVariance = 1e-4f;
+    #endif
     m_time = 0;
     m_largeStepTime = 0;
     m_largeStep = false;
@@ -80,6 +88,31 @@ void PSSMLTSampler::reject() {
     m_sampleIndex = 0;
 }
 
+void PSSMLTSampler::saveState(Stream *stream) const {
+    stream->writeSize(m_time);
+    stream->writeSize(m_largeStepTime);
+    stream->writeSize(m_u.size());
+    for (size_t i=0; i<m_u.size(); ++i) {
+        stream->writeFloat(m_u[i].value);
+        stream->writeSize(m_u[i].modify);
+    }
+}
+
+void PSSMLTSampler::loadState(Stream *stream) {
+    m_time = stream->readSize();
+    m_largeStepTime = stream->readSize();
+    size_t count = stream->readSize();
+    m_u.clear();
+    m_u.reserve(count);
+    for (size_t i=0; i<count; ++i) {
+        SampleStruct sample(stream->readFloat());
+        sample.modify = stream->readSize();
+        m_u.push_back(sample);
+    }
+    m_backup.clear();
+    m_sampleIndex = 0;
+}
+
 Float PSSMLTSampler::primarySample(size_t i) {
     while (i >= m_u.size())
         m_u.push_back(SampleStruct(m_random->nextFloat()));
@@ -95,9 +128,9 @@ Float PSSMLTSampler::primarySample(size_t i) {
                 m_u[i].value = m_random->nextFloat();
             }
 
-            while (m_u[i].modify + 1 < m_time) {
-                m_u[i].value = mutate(m_u[i].value);
-                m_u[i].modify++;
+            if (m_u[i].modify + 1 < m_time) {
+                m_u[i].value = mutate(m_u[i].value, m_time - 1 - m_u[i].modify);
+                m_u[i].modify = m_time - 1;
             }
 
             m_backup.push_back(std::pair<size_t, SampleStruct>(i, m_u[i]));
@@ -110,6 +143,24 @@ Float PSSMLTSampler::primarySample(size_t i) {
     return m_u[i].value;
 }
 
+Float PSSMLTSampler::mutate(Float value, size_t count) {
+    if (count <= PSSMLT_LAZY_MUTATIONS) {
+        for (size_t i=0; i<count; ++i)
+            value = mutate(value);
+        return value;
+    }
+
+    /* A wrapped normal distribution with a variance above 0.7 deviates
+       from the uniform distribution by less than 1e-6 */
+    Float variance = m_mutationVariance * (Float) count;
+    if (variance > 0.7f)
+        return m_random->nextFloat();
+
+    value += std::sqrt(variance) * m_random->nextStandardNormal();
+    value -= std::floor(value);
+    return value < 1 ? value : 0;
+}
+
 ref<Sampler> PSSMLTSampler::clone() {
     ref<PSSMLTSampler> sampler = new PSSMLTSampler(this);
     sampler->m_sampleCount = m_sampleCount;
@@ -24,6 +24,12 @@
 #include <mitsuba/core/random.h>
 #include "pssmlt.h"
 
+/**
+ * Lazily updated coordinates that have missed more than this many
+ * small steps are caught up using a single normally distributed offset
+ */
+#define PSSMLT_LAZY_MUTATIONS 16
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -99,6 +105,20 @@ public:
         return value;
     }
 
+    /**
+     * \brief Apply \c count consecutive mutations to a coordinate
+     *
+     * Coordinates are only updated when they are accessed, hence a
+     * coordinate that was not used by the last few paths must catch up
+     * on all mutations it missed. Long sequences are replaced by a
+     * single wrapped normal offset with the same variance, or by a
+     * uniform sample once that offset is spread out over the whole
+     * unit interval. Both are symmetric, so the mutation remains a
+     * valid Metropolis proposal, and the cost no longer depends on
+     * the number of missed steps.
+     */
+    Float mutate(Float value, size_t count);
+
     /// Return a primary sample
     Float primarySample(size_t i);
 
@@ -111,6 +131,19 @@ public:
     /// Reject a mutation
     void reject();
 
+    /**
+     * \brief Write the current primary sample vector to a stream
+     *
+     * Together with the splats of the current path, this is the complete
+     * state of a Markov chain, which can thus be continued by another
+     * sampler (possibly on a different machine) via \ref loadState().
+     * Must be called after \ref accept() or \ref reject().
+     */
+    void saveState(Stream *stream) const;
+
+    /// Restore a primary sample vector written by \ref saveState()
+    void loadState(Stream *stream);
+
     /// Replace the underlying random number generator
     inline void setRandom(Random *random) { m_random = random; }
 
@@ -141,6 +174,7 @@ protected:
 
     ref<Random> m_random;
     Float m_s1, m_s2, m_logRatio;
+    Float m_mutationVariance;
     bool m_largeStep;
     std::vector<std::pair<size_t, SampleStruct> > m_backup;
     std::vector<SampleStruct> m_u;
@@ -21,7 +21,7 @@
 MTS_NAMESPACE_BEGIN
 
 /*! \plugin{ptracer}{Adjoint particle tracer}
- * \order{12}
+ * \order{13}
  * \parameters{
  *     \parameter{maxDepth}{\Integer}{Specifies the longest path depth
  *         in the generated output image (where \code{-1} corresponds to $\infty$).
@@ -25,16 +25,29 @@ MTS_NAMESPACE_BEGIN
 /* ==================================================================== */
 
 void CaptureParticleWorkResult::load(Stream *stream) {
-    size_t nEntries = (size_t) m_size.x * (size_t) m_size.y;
-    stream->readFloatArray(reinterpret_cast<Float *>(m_bitmap->getFloatData()),
-        nEntries * SPECTRUM_SAMPLES);
+    m_hasImage = stream->readBool();
+    if (m_hasImage) {
+        if (!m_sparseImage)
+            m_sparseImage = new SparseImageBlock();
+        m_sparseImage->load(stream);
+    } else {
+        m_sparseImage = NULL;
+    }
     m_range->load(stream);
 }
 
 void CaptureParticleWorkResult::save(Stream *stream) const {
-    size_t nEntries = (size_t) m_size.x * (size_t) m_size.y;
-    stream->writeFloatArray(reinterpret_cast<const Float *>(m_bitmap->getFloatData()),
-        nEntries * SPECTRUM_SAMPLES);
+    stream->writeBool(m_hasImage);
+    if (m_hasImage) {
+        /* Only transmit the tiles that were touched */
+        if (m_sparseImage.get()) {
+            m_sparseImage->save(stream);
+        } else {
+            ref<SparseImageBlock> sparse = new SparseImageBlock();
+            sparse->set(this);
+            sparse->save(stream);
+        }
+    }
     m_range->save(stream);
 }
 
@@ -62,12 +75,14 @@ void CaptureParticleWorker::prepare() {
 
 ref<WorkProcessor> CaptureParticleWorker::clone() const {
     return new CaptureParticleWorker(m_maxDepth,
-        m_maxPathDepth, m_rrDepth, m_bruteForce);
+        m_maxPathDepth, m_rrDepth, m_bruteForce,
+        const_cast<ImageBlock *>(m_shared.get()));
 }
 
 ref<WorkResult> CaptureParticleWorker::createWorkResult() const {
     const Film *film = m_sensor->getFilm();
-    return new CaptureParticleWorkResult(film->getCropSize(), m_rfilter.get());
+    return new CaptureParticleWorkResult(film->getCropSize(),
+        m_rfilter.get(), m_shared.get() == NULL);
 }
 
 void CaptureParticleWorker::process(const WorkUnit *workUnit, WorkResult *workResult,
@@ -75,7 +90,8 @@ void CaptureParticleWorker::process(const WorkUnit *workUnit, WorkResult *workRe
     const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
     m_workResult = static_cast<CaptureParticleWorkResult *>(workResult);
     m_workResult->setRangeWorkUnit(range);
-    m_workResult->clear();
+    if (m_workResult->hasImage())
+        m_workResult->clear();
     ParticleTracer::process(workUnit, workResult, stop);
     m_workResult = NULL;
 }
@@ -103,7 +119,7 @@ void CaptureParticleWorker::handleEmission(const PositionSamplingRecord &pRec,
     value *= emitter->evalDirection(DirectionSamplingRecord(dRec.d), pRec);
 
     /* Splat onto the accumulation buffer */
-    m_workResult->put(dRec.uv, (Float *) &value[0]);
+    splat(dRec.uv, value);
 }
 
 void CaptureParticleWorker::handleSurfaceInteraction(int depth, int nullInteractions,
@@ -124,7 +140,7 @@ void CaptureParticleWorker::handleSurfaceInteraction(int depth, int nullInteract
         if (value.isZero())
             return;
 
-        m_workResult->put(uv, (Float *) &value[0]);
+        splat(uv, value);
         return;
     }
 
@@ -161,7 +177,7 @@ void CaptureParticleWorker::handleSurfaceInteraction(int depth, int nullInteract
     value *= bsdf->eval(bRec) * correction;
 
     /* Splat onto the accumulation buffer */
-    m_workResult->put(dRec.uv, (Float *) &value[0]);
+    splat(dRec.uv, value);
 }
 
 void CaptureParticleWorker::handleMediumInteraction(int depth, int nullInteractions, bool caustic,
@@ -190,7 +206,7 @@ void CaptureParticleWorker::handleMediumInteraction(int depth, int nullInteracti
         return;
 
     /* Splat onto the accumulation buffer */
-    m_workResult->put(dRec.uv, (Float *) &value[0]);
+    splat(dRec.uv, value);
 }
 
 /* ==================================================================== */
@@ -200,7 +216,17 @@ void CaptureParticleWorker::handleMediumInteraction(int depth, int nullInteracti
 void CaptureParticleProcess::develop() {
     Float weight = (m_accum->getWidth() * m_accum->getHeight())
         / (Float) m_receivedResultCount;
-    m_film->setBitmap(m_accum->getBitmap(), weight);
+
+    /* Combine the results of remote workers with the shared buffer of the
+       local ones. While rendering, the latter may also contain contributions
+       of work units that haven't been counted yet; this only affects the
+       preview and is resolved once all results have arrived. */
+    ref<Bitmap> bitmap = m_accum->getBitmap()->clone();
+    int borderSize = m_shared->getBorderSize();
+    bitmap->accumulate(m_shared->getBitmap(), Point2i(borderSize),
+        Point2i(0), bitmap->getSize());
+
+    m_film->setBitmap(bitmap, weight);
     m_queue->signalRefresh(m_job);
 }
 
@@ -213,7 +239,10 @@ void CaptureParticleProcess::processResult(const WorkResult *wr, bool cancelled)
 
     LockGuard lock(m_resultMutex);
     increaseResultCount(range->getSize());
-    m_accum->put(result);
+    if (result->getSparseImage())
+        m_accum->put(result->getSparseImage());
+    else if (result->hasImage())
+        m_accum->put(result);
     if (m_job->isInteractive() || m_receivedResultCount == m_workCount)
         develop();
 }
@@ -224,13 +253,20 @@ void CaptureParticleProcess::bindResource(const std::string &name, int id) {
         m_film = sensor->getFilm();
         m_accum = new ImageBlock(Bitmap::ESpectrum, m_film->getCropSize(), NULL);
         m_accum->clear();
+
+        /* Local workers splat into this buffer directly, which avoids
+           allocating a full-resolution image per rendering thread */
+        m_shared = new ImageBlock(Bitmap::ESpectrum, m_film->getCropSize(),
+            m_film->getReconstructionFilter());
+        m_shared->clear();
     }
     ParticleProcess::bindResource(name, id);
 }
 
 ref<WorkProcessor> CaptureParticleProcess::createWorkProcessor() const {
     return new CaptureParticleWorker(m_maxDepth, m_maxPathDepth,
-            m_rrDepth, m_bruteForce);
+            m_rrDepth, m_bruteForce,
+        const_cast<ImageBlock *>(m_shared.get()));
 }
 
 MTS_IMPLEMENT_CLASS(CaptureParticleProcess, false, ParticleProcess)
@@ -33,16 +33,31 @@ MTS_NAMESPACE_BEGIN
 /**
  * \brief Packages the result of a particle tracing work unit. Contains
  * the range of traced particles plus a snapshot of the sensor film.
+ *
+ * When the local workers splat into a shared accumulation buffer (see
+ * \ref CaptureParticleProcess), the result only carries the particle
+ * range. Remote workers only transmit the tiles of their image that
+ * received contributions (see \ref SparseImageBlock).
  */
 class CaptureParticleWorkResult : public ImageBlock {
 public:
-    inline CaptureParticleWorkResult(const Vector2i &res, const ReconstructionFilter *filter)
-     : ImageBlock(Bitmap::ESpectrum, res, filter) {
+    inline CaptureParticleWorkResult(const Vector2i &res,
+            const ReconstructionFilter *filter, bool hasImage = true)
+     : ImageBlock(Bitmap::ESpectrum, hasImage ? res : Vector2i(1, 1), filter),
+       m_hasImage(hasImage) {
         setOffset(Point2i(0, 0));
         setSize(res);
         m_range = new RangeWorkUnit();
     }
 
+    /// Does this work result contain an image?
+    inline bool hasImage() const { return m_hasImage; }
+
+    /// Return the image that was received from a remote worker (if any)
+    inline const SparseImageBlock *getSparseImage() const {
+        return m_sparseImage.get();
+    }
+
     inline const RangeWorkUnit *getRangeWorkUnit() const {
         return m_range.get();
     }
@@ -61,6 +76,8 @@ protected:
     virtual ~CaptureParticleWorkResult() { }
 protected:
     ref<RangeWorkUnit> m_range;
+    ref<SparseImageBlock> m_sparseImage;
+    bool m_hasImage;
 };
 
 
@@ -74,8 +91,19 @@ protected:
  */
 class CaptureParticleWorker : public ParticleTracer {
 public:
+    /**
+     * \brief Create a new particle tracing worker
+     *
+     * \param shared
+     *    Optional full-resolution accumulation buffer, which is shared by
+     *    all local workers. When specified, samples are splatted directly
+     *    into it using atomic operations instead of being accumulated in
+     *    a separate image per work result. This buffer is not serialized,
+     *    hence remote workers always use separate images.
+     */
     inline CaptureParticleWorker(int maxDepth, int maxPathDepth,
-        int rrDepth, bool bruteForce) : ParticleTracer(maxDepth, rrDepth, true),
+        int rrDepth, bool bruteForce, ImageBlock *shared = NULL)
+        : ParticleTracer(maxDepth, rrDepth, true), m_shared(shared),
         m_maxPathDepth(maxPathDepth), m_bruteForce(bruteForce) { }
 
     CaptureParticleWorker(Stream *stream, InstanceManager *manager);
@@ -121,10 +149,19 @@ public:
 protected:
     /// Virtual destructor
     virtual ~CaptureParticleWorker() { }
+
+    /// Splat a sample onto the shared buffer or the current work result
+    inline void splat(const Point2 &uv, const Spectrum &value) {
+        if (m_shared)
+            m_shared->putConcurrent(uv, (const Float *) &value);
+        else
+            m_workResult->put(uv, (const Float *) &value);
+    }
 private:
     ref<const Sensor> m_sensor;
     ref<const ReconstructionFilter> m_rfilter;
     ref<CaptureParticleWorkResult> m_workResult;
+    ref<ImageBlock> m_shared;
     int m_maxPathDepth;
     bool m_bruteForce;
 };
@@ -163,6 +200,7 @@ private:
     ref<RenderQueue> m_queue;
     ref<Film> m_film;
     ref<ImageBlock> m_accum;
+    ref<ImageBlock> m_shared;
     int m_maxDepth;
     int m_maxPathDepth;
     int m_rrDepth;
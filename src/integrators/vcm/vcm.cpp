@@ -0,0 +1,261 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/plugin.h>
+#include "vcm_proc.h"
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{vcm}{Vertex connection and merging}
+ * \order{9}
+ * \parameters{
+ *     \parameter{maxDepth}{\Integer}{Specifies the longest path depth
+ *         in the generated output image (where \code{-1} corresponds to $\infty$).
+ *         A value of \code{1} will only render directly visible light sources.
+ *         \code{2} will lead to single-bounce (direct-only) illumination,
+ *         and so on. \default{\code{-1}}
+ *     }
+ *     \parameter{rrDepth}{\Integer}{Specifies the minimum path depth, after
+ *        which the implementation will start to use the ``russian roulette''
+ *        path termination criterion. \default{\code{5}}
+ *     }
+ *     \parameter{initialRadius}{\Float}{Initial merging radius in world space units.
+ *         \default{0, i.e. decide automatically}}
+ *     \parameter{alpha}{\Float}{Radius reduction parameter \code{alpha}. After
+ *         $i$ iterations, the radius is given by $r_i=r_0\, i^{(\alpha-1)/2}$.
+ *         \default{0.75}}
+ *     \parameter{granularity}{\Integer}{
+ *         Granularity of the light subpath tracing work units for the purpose
+ *         of parallelization (in \# of light subpaths) \default{0, i.e. decide automatically}
+ *     }
+ * }
+ * This plugin implements vertex connection and merging (VCM) as proposed by
+ * Georgiev et al. \cite{Georgiev2012Light}. It combines the sampling strategies
+ * of a bidirectional path tracer (\pluginref{bdpt}) with those of a progressive
+ * photon mapper (\pluginref{sppm}) using multiple importance sampling. Paths
+ * that are difficult to find by connecting two subpaths, such as reflected
+ * caustics, are thus handled by photon density estimation (\emph{vertex merging}),
+ * while bidirectional path tracing takes over wherever it works well.
+ *
+ * The rendering proceeds in iterations. Every iteration first traces one light
+ * subpath per pixel and stores its vertices in a hash grid. Afterwards, every
+ * pixel traces a sensor subpath. Its vertices are connected to the emitters, to
+ * the vertices of a separate light subpath, which is also connected to the
+ * sensor, and merged with nearby vertices of the grid. The merging radius is
+ * reduced between iterations, which makes the method consistent. The number
+ * of iterations is given by the sample count of the sampler.
+ *
+ * The MIS weights are evaluated in constant time per strategy using the
+ * recursive formulation from the technical report of Georgiev et al.
+ *
+ * As with \pluginref{bdpt}, connections to the sensor can contribute to any
+ * pixel, hence every remote worker accumulates a full-resolution light image.
+ *
+ * \remarks{
+ *    \item This integrator does not handle participating media
+ *    \item This integrator does not work with dipole-style subsurface
+ *    scattering models.
+ *    \item Only perspective sensors with an infinitesimal aperture are supported.
+ *    \item Environment and directional emitters are only reached by sensor
+ *    subpaths, i.e. by emitter sampling and by BSDF sampling.
+ * }
+ */
+class VCMIntegrator : public Integrator {
+public:
+    VCMIntegrator(const Properties &props) : Integrator(props) {
+        /* Load the parameters / defaults */
+        m_config.maxDepth = props.getInteger("maxDepth", -1);
+        m_config.rrDepth = props.getInteger("rrDepth", 5);
+        /* Initial merging radius (0 = infer based on scene size and sensor resolution) */
+        m_config.initialRadius = props.getFloat("initialRadius", 0);
+        /* Influences the speed, at which the merging radius is reduced */
+        m_config.alpha = props.getFloat("alpha", 0.75f);
+        m_config.granularity = (size_t) props.getInteger("granularity", 0);
+        m_config.iteration = 0;
+        m_config.radius = m_config.initialRadius;
+
+        if (m_config.rrDepth <= 0)
+            Log(EError, "'rrDepth' must be set to a value greater than zero!");
+
+        if (m_config.maxDepth <= 0 && m_config.maxDepth != -1)
+            Log(EError, "'maxDepth' must be set to -1 (infinite) or a value greater than zero!");
+
+        if (m_config.initialRadius < 0)
+            Log(EError, "'initialRadius' must be positive (or zero to choose automatically)!");
+
+        if (m_config.alpha <= 0 || m_config.alpha > 1)
+            Log(EError, "'alpha' must be in the interval (0, 1]!");
+    }
+
+    /// Unserialize from a binary data stream
+    VCMIntegrator(Stream *stream, InstanceManager *manager)
+     : Integrator(stream, manager) {
+        m_config = VCMConfiguration(stream);
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Integrator::serialize(stream, manager);
+        m_config.serialize(stream);
+    }
+
+    bool preprocess(const Scene *scene, RenderQueue *queue,
+            const RenderJob *job, int sceneResID, int sensorResID,
+            int samplerResID) {
+        Integrator::preprocess(scene, queue, job, sceneResID,
+                sensorResID, samplerResID);
+
+        if (scene->getSubsurfaceIntegrators().size() > 0)
+            Log(EError, "Subsurface integrators are not supported "
+                "by vertex connection and merging!");
+
+        if (scene->hasMedia())
+            Log(EError, "Participating media are not supported "
+                "by vertex connection and merging!");
+
+        const Sensor *sensor = scene->getSensor();
+        if (!(sensor->getType() & Sensor::EDeltaPosition) ||
+            !(sensor->getType() & Sensor::EDirectionSampleMapsToPixels))
+            Log(EError, "Vertex connection and merging requires a sensor "
+                "with an infinitesimal aperture (e.g. 'perspective')!");
+
+        if (m_config.initialRadius == 0) {
+            /* Guess an initial radius if not provided
+              (use scene width / horizontal or vertical pixel count) * 5 */
+            Float rad = scene->getBSphere().radius;
+            Vector2i filmSize = sensor->getFilm()->getSize();
+
+            m_config.initialRadius = std::min(rad / filmSize.x, rad / filmSize.y) * 5;
+        }
+
+        return true;
+    }
+
+    void cancel() {
+        m_cancelled = true;
+        ref<ParallelProcess> process = m_process;
+        if (process)
+            Scheduler::getInstance()->cancel(process);
+    }
+
+    void configureSampler(const Scene *scene, Sampler *sampler) {
+        /* Prepare the sampler for tile-based rendering */
+        sampler->setFilmResolution(scene->getFilm()->getCropSize(), true);
+    }
+
+    bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        ref<Scheduler> scheduler = Scheduler::getInstance();
+        ref<Sensor> sensor = scene->getSensor();
+        const Film *film = sensor->getFilm();
+        size_t sampleCount = scene->getSampler()->getSampleCount();
+        size_t nCores = scheduler->getCoreCount();
+
+        Log(EInfo, "Starting render job (%ix%i, " SIZE_T_FMT " iterations, " SIZE_T_FMT
+            " %s, " SSE_STR ") ..", film->getCropSize().x, film->getCropSize().y,
+            sampleCount, nCores, nCores == 1 ? "core" : "cores");
+
+        m_config.blockSize = scene->getBlockSize();
+        m_config.cropSize = film->getCropSize();
+        m_config.sampleCount = sampleCount;
+        m_config.dump();
+
+        /* The light subpaths of the merging pass are traced using
+           independent samplers (one instance for every core) */
+        ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+            createObject(MTS_CLASS(Sampler), Properties("independent")));
+        std::vector<SerializableObject *> samplers(nCores);
+        for (size_t i=0; i<nCores; ++i) {
+            ref<Sampler> clonedSampler = sampler->clone();
+            clonedSampler->incRef();
+            samplers[i] = clonedSampler.get();
+        }
+        int lightSamplerResID = scheduler->registerMultiResource(samplers);
+
+        /* The camera and light images are accumulated over all iterations */
+        ref<VCMWorkResult> result = new VCMWorkResult(m_config, NULL, m_config.cropSize);
+        result->clear();
+        ref<ImageBlock> sharedLightImage = new ImageBlock(Bitmap::ESpectrum,
+            m_config.cropSize, film->getReconstructionFilter());
+        sharedLightImage->clear();
+
+        m_cancelled = false;
+        bool success = true;
+        for (size_t i=0; i<sampleCount && success && !m_cancelled; ++i) {
+            m_config.iteration = (int) i;
+            m_config.radius = m_config.initialRadius *
+                std::pow((Float) (i+1), (m_config.alpha - 1) / 2);
+
+            /* Trace the light subpaths that are used for vertex merging */
+            ref<VCMLightVertexProcess> lightProcess =
+                new VCMLightVertexProcess(job, m_config);
+            lightProcess->bindResource("scene", sceneResID);
+            lightProcess->bindResource("sensor", sensorResID);
+            lightProcess->bindResource("sampler", lightSamplerResID);
+
+            m_process = lightProcess;
+            if (m_cancelled)
+                break;
+            scheduler->schedule(lightProcess);
+            scheduler->wait(lightProcess);
+            m_process = NULL;
+
+            if (lightProcess->getReturnStatus() != ParallelProcess::ESuccess) {
+                success = false;
+                break;
+            }
+
+            ref<VCMLightVertexGrid> grid = lightProcess->createGrid();
+            int gridResID = scheduler->registerResource(grid);
+
+            /* Render one sample per pixel using all strategies */
+            ref<VCMProcess> process = new VCMProcess(job, queue,
+                m_config, result, sharedLightImage);
+            process->bindResource("scene", sceneResID);
+            process->bindResource("sensor", sensorResID);
+            process->bindResource("sampler", samplerResID);
+            process->bindResource("lightVertices", gridResID);
+
+            m_process = process;
+            if (!m_cancelled) {
+                scheduler->schedule(process);
+                scheduler->wait(process);
+            }
+            m_process = NULL;
+            scheduler->unregisterResource(gridResID);
+
+            process->develop();
+            success = process->getReturnStatus() == ParallelProcess::ESuccess;
+        }
+
+        scheduler->unregisterResource(lightSamplerResID);
+        for (size_t i=0; i<nCores; ++i)
+            samplers[i]->decRef();
+
+        return success && !m_cancelled;
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    ref<ParallelProcess> m_process;
+    VCMConfiguration m_config;
+    bool m_cancelled;
+};
+
+MTS_IMPLEMENT_CLASS_S(VCMIntegrator, false, Integrator)
+MTS_EXPORT_PLUGIN(VCMIntegrator, "Vertex connection and merging");
+MTS_NAMESPACE_END
@@ -0,0 +1,155 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__VCM_H)
+#define __VCM_H
+
+#include <mitsuba/mitsuba.h>
+
+MTS_NAMESPACE_BEGIN
+
+/* ==================================================================== */
+/*                         Configuration storage                        */
+/* ==================================================================== */
+
+/**
+ * \brief Stores all configuration parameters of the vertex
+ * connection and merging integrator.
+ *
+ * Besides the user-specified parameters, this also holds the state of
+ * the current iteration (index and merging radius), since every
+ * iteration is rendered by a separate set of parallel processes.
+ */
+struct VCMConfiguration {
+    int maxDepth, blockSize;
+    int rrDepth;
+    size_t sampleCount, granularity;
+    Vector2i cropSize;
+    Float initialRadius, alpha;
+
+    /* State of the current iteration */
+    int iteration;
+    Float radius;
+
+    inline VCMConfiguration() { }
+
+    inline VCMConfiguration(Stream *stream) {
+        maxDepth = stream->readInt();
+        blockSize = stream->readInt();
+        rrDepth = stream->readInt();
+        sampleCount = stream->readSize();
+        granularity = stream->readSize();
+        cropSize = Vector2i(stream);
+        initialRadius = stream->readFloat();
+        alpha = stream->readFloat();
+        iteration = stream->readInt();
+        radius = stream->readFloat();
+    }
+
+    inline void serialize(Stream *stream) const {
+        stream->writeInt(maxDepth);
+        stream->writeInt(blockSize);
+        stream->writeInt(rrDepth);
+        stream->writeSize(sampleCount);
+        stream->writeSize(granularity);
+        cropSize.serialize(stream);
+        stream->writeFloat(initialRadius);
+        stream->writeFloat(alpha);
+        stream->writeInt(iteration);
+        stream->writeFloat(radius);
+    }
+
+    /**
+     * \brief Return the number of light subpaths that are traced
+     * per iteration (for both connections and merging)
+     */
+    inline size_t getLightPathCount() const {
+        return (size_t) cropSize.x * (size_t) cropSize.y;
+    }
+
+    /**
+     * \brief Return the ratio of the vertex merging and connection
+     * densities, i.e. the merging area times the number of light paths
+     */
+    inline Float getMergingEta() const {
+        return (Float) M_PI * radius * radius * (Float) getLightPathCount();
+    }
+
+    void dump() const {
+        SLog(EDebug, "Vertex connection and merging configuration:");
+        SLog(EDebug, "   Maximum path depth          : %i", maxDepth);
+        SLog(EDebug, "   Image size                  : %ix%i",
+            cropSize.x, cropSize.y);
+        SLog(EDebug, "   Russian roulette depth      : %i", rrDepth);
+        SLog(EDebug, "   Block size                  : %i", blockSize);
+        SLog(EDebug, "   Number of iterations        : " SIZE_T_FMT, sampleCount);
+        SLog(EDebug, "   Initial merging radius      : %f", initialRadius);
+        SLog(EDebug, "   Radius reduction (alpha)    : %f", alpha);
+        SLog(EDebug, "   Light path granularity      : " SIZE_T_FMT, granularity);
+    }
+};
+
+/// Weighting function of the power heuristic (used by all MIS weights)
+inline Float vcmMis(Float value) {
+    return value * value;
+}
+
+/* ==================================================================== */
+/*                      Stored light subpath vertex                     */
+/* ==================================================================== */
+
+/**
+ * \brief Light subpath vertex that is kept for the vertex
+ * merging strategy
+ *
+ * Only the quantities needed to evaluate a merge are stored, i.e. no
+ * BSDF information: the position, the direction towards the preceding
+ * vertex, the accumulated throughput (including the emitted power) and
+ * the recursively computed MIS quantities of [Georgiev et al. 2012].
+ */
+struct VCMLightVertex {
+    Point p;
+    Vector wi;
+    Spectrum throughput;
+    Float dVCM, dVM;
+    int depth;
+
+    inline VCMLightVertex() { }
+
+    inline VCMLightVertex(Stream *stream) {
+        p = Point(stream);
+        wi = Vector(stream);
+        throughput = Spectrum(stream);
+        dVCM = stream->readFloat();
+        dVM = stream->readFloat();
+        depth = stream->readInt();
+    }
+
+    inline void serialize(Stream *stream) const {
+        p.serialize(stream);
+        wi.serialize(stream);
+        throughput.serialize(stream);
+        stream->writeFloat(dVCM);
+        stream->writeFloat(dVM);
+        stream->writeInt(depth);
+    }
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __VCM_H */
@@ -0,0 +1,89 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/timer.h>
+#include "vcm_grid.h"
+
+MTS_NAMESPACE_BEGIN
+
+VCMLightVertexGrid::VCMLightVertexGrid(std::vector<VCMLightVertex> &vertices, Float radius)
+        : m_radius(radius), m_invCellSize(1 / (2 * radius)) {
+    m_vertices.swap(vertices);
+    build();
+}
+
+VCMLightVertexGrid::VCMLightVertexGrid(Stream *stream, InstanceManager *manager)
+        : SerializableObject(stream, manager) {
+    m_radius = stream->readFloat();
+    m_invCellSize = 1 / (2 * m_radius);
+    size_t count = stream->readSize();
+    m_vertices.reserve(count);
+    for (size_t i=0; i<count; ++i)
+        m_vertices.push_back(VCMLightVertex(stream));
+    build();
+}
+
+void VCMLightVertexGrid::serialize(Stream *stream, InstanceManager *manager) const {
+    SerializableObject::serialize(stream, manager);
+    stream->writeFloat(m_radius);
+    stream->writeSize(m_vertices.size());
+    for (size_t i=0; i<m_vertices.size(); ++i)
+        m_vertices[i].serialize(stream);
+}
+
+void VCMLightVertexGrid::build() {
+    if (m_vertices.empty()) {
+        m_cellStarts.assign(2, 0);
+        return;
+    }
+
+    ref<Timer> timer = new Timer();
+
+    /* Count the entries of each hash bucket */
+    uint32_t tableSize = (uint32_t) m_vertices.size();
+    std::vector<uint32_t> buckets(m_vertices.size());
+    m_cellStarts.assign(tableSize + 1, 0);
+    for (size_t i=0; i<m_vertices.size(); ++i) {
+        buckets[i] = hash(getCell(m_vertices[i].p));
+        m_cellStarts[buckets[i] + 1]++;
+    }
+    for (uint32_t i=0; i<tableSize; ++i)
+        m_cellStarts[i+1] += m_cellStarts[i];
+
+    /* Sort the vertices by their bucket */
+    std::vector<uint32_t> offsets(m_cellStarts.begin(), m_cellStarts.end() - 1);
+    std::vector<VCMLightVertex> sorted(m_vertices.size());
+    for (size_t i=0; i<m_vertices.size(); ++i)
+        sorted[offsets[buckets[i]]++] = m_vertices[i];
+    m_vertices.swap(sorted);
+
+    SLog(EDebug, "Built a light vertex grid over " SIZE_T_FMT " vertices (took %i ms)",
+        m_vertices.size(), timer->getMilliseconds());
+}
+
+std::string VCMLightVertexGrid::toString() const {
+    std::ostringstream oss;
+    oss << "VCMLightVertexGrid[" << endl
+        << "  vertexCount = " << m_vertices.size() << "," << endl
+        << "  radius = " << m_radius << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS_S(VCMLightVertexGrid, false, SerializableObject)
+MTS_NAMESPACE_END
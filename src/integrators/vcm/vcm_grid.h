@@ -0,0 +1,127 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__VCM_GRID_H)
+#define __VCM_GRID_H
+
+#include <mitsuba/core/serialization.h>
+#include "vcm.h"
+
+MTS_NAMESPACE_BEGIN
+
+/* ==================================================================== */
+/*                        Light vertex hash grid                        */
+/* ==================================================================== */
+
+/**
+ * \brief Spatial hash grid over the light subpath vertices of one
+ * iteration, which is used to find the merging candidates of a sensor
+ * subpath vertex.
+ *
+ * The cell size equals the merging diameter, hence the vertices within
+ * the merging radius of any point are contained in the (at most eight)
+ * cells overlapping with the query sphere. Each vertex is stored once,
+ * sorted by the hash bucket of its cell.
+ *
+ * The grid is registered as a resource with the scheduler so that
+ * remote workers can perform merges as well. Only the vertices are
+ * transmitted; the receiving side rebuilds the hash table.
+ */
+class VCMLightVertexGrid : public SerializableObject {
+public:
+    /**
+     * \brief Build the grid over the given vertices
+     *
+     * The contents of \c vertices are moved into the grid
+     */
+    VCMLightVertexGrid(std::vector<VCMLightVertex> &vertices, Float radius);
+
+    /// Unserialize from a binary data stream
+    VCMLightVertexGrid(Stream *stream, InstanceManager *manager);
+
+    /// Serialize to a binary data stream
+    void serialize(Stream *stream, InstanceManager *manager) const;
+
+    /**
+     * \brief Invoke <tt>functor(vertex)</tt> for every stored vertex
+     * within the merging radius of \c p
+     */
+    template <typename Functor> void query(const Point &p, Functor &functor) const {
+        if (m_vertices.empty())
+            return;
+
+        Point3i min = getCell(p - Vector(m_radius)),
+                max = getCell(p + Vector(m_radius));
+
+        /* Avoid visiting buckets twice due to hash collisions */
+        uint32_t buckets[8];
+        int bucketCount = 0;
+        for (int z=min.z; z<=std::min(max.z, min.z+1); ++z)
+            for (int y=min.y; y<=std::min(max.y, min.y+1); ++y)
+                for (int x=min.x; x<=std::min(max.x, min.x+1); ++x)
+                    buckets[bucketCount++] = hash(Point3i(x, y, z));
+        std::sort(buckets, buckets + bucketCount);
+        bucketCount = (int) (std::unique(buckets, buckets + bucketCount) - buckets);
+
+        Float radiusSqr = m_radius * m_radius;
+        for (int i=0; i<bucketCount; ++i) {
+            for (uint32_t j=m_cellStarts[buckets[i]]; j<m_cellStarts[buckets[i]+1]; ++j) {
+                const VCMLightVertex &vertex = m_vertices[j];
+                if (distanceSquared(vertex.p, p) <= radiusSqr)
+                    functor(vertex);
+            }
+        }
+    }
+
+    /// Return the merging radius
+    inline Float getRadius() const { return m_radius; }
+
+    /// Return the number of stored vertices
+    inline size_t getVertexCount() const { return m_vertices.size(); }
+
+    /// Return a human-readable string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~VCMLightVertexGrid() { }
+
+    /// Sort the vertices into the hash buckets
+    void build();
+
+    inline Point3i getCell(const Point &p) const {
+        return Point3i(
+            (int) std::floor(p.x * m_invCellSize),
+            (int) std::floor(p.y * m_invCellSize),
+            (int) std::floor(p.z * m_invCellSize));
+    }
+
+    inline uint32_t hash(const Point3i &cell) const {
+        return (((uint32_t) cell.x * 73856093u) ^ ((uint32_t) cell.y * 19349663u)
+            ^ ((uint32_t) cell.z * 83492791u)) % (uint32_t) m_vertices.size();
+    }
+private:
+    std::vector<VCMLightVertex> m_vertices;
+    std::vector<uint32_t> m_cellStarts;
+    Float m_radius, m_invCellSize;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __VCM_GRID_H */
@@ -0,0 +1,819 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/pmf.h>
+#include <mitsuba/core/sfcurve.h>
+#include <mitsuba/render/range.h>
+#include <boost/unordered_map.hpp>
+#include "vcm_proc.h"
+
+MTS_NAMESPACE_BEGIN
+
+/* ==================================================================== */
+/*                           Subpath sampling                           */
+/* ==================================================================== */
+
+/**
+ * \brief State of a subpath during the random walk
+ *
+ * Apart from the throughput, this records the quantities dVCM, dVC and
+ * dVM from the technical report by Georgiev et al., which allow to
+ * compute the MIS weights of all connection and merging strategies in
+ * constant time from the two subpath endpoints.
+ */
+struct VCMPathState {
+    /// Emitted power (light subpaths) or sensor importance weight
+    Spectrum power;
+    /// Product of the scattering weights along the subpath
+    Spectrum throughput;
+    Float dVCM, dVC, dVM;
+    /// Number of segments of the subpath
+    int depth;
+};
+
+/// Light subpath vertex that is kept for the duration of one sample
+struct VCMPathVertex {
+    Intersection its;
+    VCMPathState state;
+};
+
+/**
+ * \brief Random walk code that is shared by the light vertex tracer
+ * and the renderer
+ */
+class VCMPathSampler {
+public:
+    void configure(const VCMConfiguration &config) {
+        m_config = config;
+        Float eta = config.getMergingEta();
+        m_misVmWeightFactor = vcmMis(eta);
+        m_misVcWeightFactor = vcmMis(1 / eta);
+    }
+
+    void initialize(const Scene *scene, Sampler *sampler) {
+        m_scene = scene;
+        m_sampler = sampler;
+
+        /* Light subpaths only start on emitters with a finite position;
+           the remaining ones are handled by the sensor subpaths */
+        const ref_vector<Emitter> &emitters = scene->getEmitters();
+        m_emitters.clear();
+        m_emitterIndices.clear();
+        m_emitterPDF.clear();
+        for (size_t i=0; i<emitters.size(); ++i) {
+            const Emitter *emitter = emitters[i].get();
+            if (emitter->isEnvironmentEmitter() ||
+                (emitter->getType() & Emitter::EDeltaDirection))
+                continue;
+            m_emitterIndices[emitter] = m_emitters.size();
+            m_emitters.push_back(emitter);
+            m_emitterPDF.append(emitter->getSamplingWeight());
+        }
+        if (!m_emitters.empty())
+            m_emitterPDF.normalize();
+    }
+
+    inline Float getMisVmWeightFactor() const { return m_misVmWeightFactor; }
+    inline Float getMisVcWeightFactor() const { return m_misVcWeightFactor; }
+
+    /**
+     * \brief Return the density of sampling an emission from position
+     * \c pRec into direction \c d when starting a light subpath
+     */
+    Float pdfEmission(const Emitter *emitter, const PositionSamplingRecord &pRec,
+            const Vector &d) const {
+        boost::unordered_map<const Emitter *, size_t>::const_iterator it =
+            m_emitterIndices.find(emitter);
+        if (it == m_emitterIndices.end())
+            return 0.0f;
+
+        PositionSamplingRecord rec(pRec);
+        rec.measure = (emitter->getType() & Emitter::EDeltaPosition) ? EDiscrete : EArea;
+        return m_emitterPDF[it->second] * emitter->pdfPosition(rec)
+            * emitter->pdfDirection(DirectionSamplingRecord(d), rec);
+    }
+
+    /**
+     * \brief Trace a light subpath and record all vertices with a smooth
+     * BSDF component (i.e. those that support connections and merges)
+     */
+    void traceLightSubpath(Float time, std::vector<VCMPathVertex> &path) {
+        path.clear();
+        if (m_emitters.empty() || (m_config.maxDepth != -1 && m_config.maxDepth < 2))
+            return;
+
+        /* Sample an emitter, a position on it and a direction */
+        Point2 sample = m_sampler->next2D();
+        Float emitterPdf;
+        size_t index = m_emitterPDF.sampleReuse(sample.x, emitterPdf);
+        const Emitter *emitter = m_emitters[index];
+
+        PositionSamplingRecord pRec(time);
+        DirectionSamplingRecord dRec;
+        Spectrum power = emitter->samplePosition(pRec, sample);
+        power *= emitter->sampleDirection(dRec, pRec, m_sampler->next2D());
+        if (power.isZero())
+            return;
+        pRec.object = emitter;
+
+        bool deltaPosition = emitter->getType() & Emitter::EDeltaPosition;
+        Float emissionPdf = emitterPdf * pRec.pdf * dRec.pdf;
+        Float cosLight = emitter->isOnSurface() ? absDot(pRec.n, dRec.d) : 1.0f;
+
+        VCMPathState state;
+        state.power = power / emitterPdf;
+        state.throughput = Spectrum(1.0f);
+        state.depth = 0;
+        state.dVCM = 0.0f;
+        state.dVC = deltaPosition ? 0.0f : vcmMis(cosLight / emissionPdf);
+        state.dVM = state.dVC * m_misVcWeightFactor;
+
+        Ray ray(pRec.p, dRec.d, time);
+        Intersection its;
+        while (m_scene->rayIntersect(ray, its)) {
+            if (++state.depth == 1) {
+                /* The direct sampling density of the emitter position
+                   depends on the first vertex, hence dVCM is set here */
+                DirectSamplingRecord directRec(its);
+                static_cast<PositionSamplingRecord &>(directRec) = pRec;
+                directRec.d = -ray.d;
+                directRec.dist = its.t;
+                directRec.measure = deltaPosition ? EDiscrete : ESolidAngle;
+                Float directPdfA = m_scene->pdfEmitterDirect(directRec);
+                if (!deltaPosition)
+                    directPdfA *= cosLight / (its.t * its.t);
+                state.dVCM = vcmMis(directPdfA / emissionPdf);
+            }
+
+            if (!updateHit(ray, its, state))
+                break;
+
+            if (its.getBSDF()->getType() & BSDF::ESmooth) {
+                path.push_back(VCMPathVertex());
+                path.back().its = its;
+                path.back().state = state;
+            }
+
+            /* Deeper vertices can't be part of any complete path */
+            if (m_config.maxDepth != -1 && state.depth >= m_config.maxDepth - 1)
+                break;
+
+            if (!sampleScattering(its, ray, state, EImportance))
+                break;
+        }
+    }
+
+    /**
+     * \brief Account for the new segment \c ray, which has reached the
+     * surface \c its, in the MIS quantities
+     */
+    inline bool updateHit(const Ray &ray, const Intersection &its, VCMPathState &state) const {
+        Float cosTheta = absDot(its.geoFrame.n, ray.d);
+        if (cosTheta == 0)
+            return false;
+        Float invCos = 1 / vcmMis(cosTheta);
+        state.dVCM *= vcmMis(its.t * its.t) * invCos;
+        state.dVC *= invCos;
+        state.dVM *= invCos;
+        return true;
+    }
+
+    /**
+     * \brief Extend a subpath by sampling the BSDF at its last vertex
+     *
+     * \return \c false if the subpath was terminated
+     */
+    bool sampleScattering(const Intersection &its, Ray &ray,
+            VCMPathState &state, ETransportMode mode) {
+        const BSDF *bsdf = its.getBSDF();
+        BSDFSamplingRecord bRec(its, m_sampler, mode);
+        Float pdf;
+        Spectrum weight = bsdf->sample(bRec, pdf, m_sampler->next2D());
+        if (weight.isZero() || pdf == 0)
+            return false;
+
+        /* Prevent light leaks due to the use of shading normals */
+        Vector wo = its.toWorld(bRec.wo);
+        Float wiDotGeoN = -dot(its.geoFrame.n, ray.d),
+              woDotGeoN = dot(its.geoFrame.n, wo);
+        if (wiDotGeoN * Frame::cosTheta(bRec.wi) <= 0 ||
+            woDotGeoN * Frame::cosTheta(bRec.wo) <= 0)
+            return false;
+
+        /* Density of sampling the reverse direction */
+        EMeasure measure = BSDF::getMeasure(bRec.sampledType);
+        bRec.reverse();
+        Float pdfRev = bsdf->pdf(bRec, measure);
+        bRec.reverse();
+
+        Float cosThetaOut = std::abs(woDotGeoN);
+        if (measure != ESolidAngle) {
+            /* Connections and merges are impossible at this vertex -- only
+               the discrete probabilities of the two directions differ */
+            Float factor = vcmMis(cosThetaOut * pdfRev / pdf);
+            state.dVC *= factor;
+            state.dVM *= factor;
+            state.dVCM = 0.0f;
+        } else {
+            Float factor = vcmMis(cosThetaOut / pdf);
+            state.dVC = factor * (state.dVC * vcmMis(pdfRev)
+                + state.dVCM + m_misVmWeightFactor);
+            state.dVM = factor * (state.dVM * vcmMis(pdfRev)
+                + state.dVCM * m_misVcWeightFactor + 1);
+            state.dVCM = vcmMis(1 / pdf);
+        }
+
+        state.throughput *= weight;
+
+        /* Russian roulette (not accounted for in the MIS weights) */
+        if (state.depth >= m_config.rrDepth) {
+            Float q = std::min(state.throughput.max(), (Float) 0.95f);
+            if (m_sampler->next1D() >= q)
+                return false;
+            state.throughput /= q;
+        }
+
+        ray = Ray(its.p, wo, ray.time);
+        return true;
+    }
+private:
+    const Scene *m_scene;
+    Sampler *m_sampler;
+    VCMConfiguration m_config;
+    std::vector<const Emitter *> m_emitters;
+    boost::unordered_map<const Emitter *, size_t> m_emitterIndices;
+    DiscreteDistribution m_emitterPDF;
+    Float m_misVmWeightFactor, m_misVcWeightFactor;
+};
+
+/* ==================================================================== */
+/*                     Light vertex tracer (merging)                    */
+/* ==================================================================== */
+
+class VCMLightVertexTracer : public WorkProcessor {
+public:
+    VCMLightVertexTracer(const VCMConfiguration &config) : m_config(config) { }
+
+    VCMLightVertexTracer(Stream *stream, InstanceManager *manager)
+        : WorkProcessor(stream, manager), m_config(stream) { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        m_config.serialize(stream);
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RangeWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new VCMLightVertexResult();
+    }
+
+    void prepare() {
+        Scene *scene = static_cast<Scene *>(getResource("scene"));
+        m_scene = new Scene(scene);
+        m_sampler = static_cast<Sampler *>(getResource("sampler"));
+        Sensor *newSensor = static_cast<Sensor *>(getResource("sensor"));
+        m_scene->removeSensor(scene->getSensor());
+        m_scene->addSensor(newSensor);
+        m_scene->setSensor(newSensor);
+        m_scene->wakeup(NULL, m_resources);
+
+        m_pathSampler.configure(m_config);
+        m_pathSampler.initialize(m_scene, m_sampler);
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
+        const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+        VCMLightVertexResult *result = static_cast<VCMLightVertexResult *>(workResult);
+        const Sensor *sensor = m_scene->getSensor();
+        bool needsTimeSample = sensor->needsTimeSample();
+        Float time = sensor->getShutterOpen() + 0.5f * sensor->getShutterOpenTime();
+
+        /* Continue the sample sequence of the previous iterations */
+        size_t offset = (size_t) m_config.iteration * m_config.getLightPathCount();
+
+        result->clear();
+        m_sampler->generate(Point2i(0));
+
+        for (size_t index = range->getRangeStart(); index <= range->getRangeEnd() && !stop; ++index) {
+            m_sampler->setSampleIndex(offset + index);
+
+            if (needsTimeSample)
+                time = sensor->sampleTime(m_sampler->next1D());
+
+            m_pathSampler.traceLightSubpath(time, m_path);
+
+            for (size_t i=0; i<m_path.size(); ++i) {
+                const VCMPathVertex &vertex = m_path[i];
+                VCMLightVertex lightVertex;
+                lightVertex.p = vertex.its.p;
+                lightVertex.wi = vertex.its.toWorld(vertex.its.wi);
+                lightVertex.throughput = vertex.state.power * vertex.state.throughput;
+                lightVertex.dVCM = vertex.state.dVCM;
+                lightVertex.dVM = vertex.state.dVM;
+                lightVertex.depth = vertex.state.depth;
+                result->put(lightVertex);
+            }
+            result->nextPath();
+        }
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new VCMLightVertexTracer(m_config);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~VCMLightVertexTracer() { }
+private:
+    ref<Scene> m_scene;
+    ref<Sampler> m_sampler;
+    VCMConfiguration m_config;
+    VCMPathSampler m_pathSampler;
+    std::vector<VCMPathVertex> m_path;
+};
+
+/* ==================================================================== */
+/*                         Worker implementation                        */
+/* ==================================================================== */
+
+class VCMRenderer : public WorkProcessor {
+public:
+    VCMRenderer(const VCMConfiguration &config, ImageBlock *sharedLightImage = NULL)
+        : m_config(config), m_sharedLightImage(sharedLightImage) { }
+
+    VCMRenderer(Stream *stream, InstanceManager *manager)
+        : WorkProcessor(stream, manager), m_config(stream) { }
+
+    virtual ~VCMRenderer() { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        m_config.serialize(stream);
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RectangularWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new VCMWorkResult(m_config, m_rfilter.get(),
+            Vector2i(m_config.blockSize), const_cast<ImageBlock *>(m_sharedLightImage.get()));
+    }
+
+    void prepare() {
+        Scene *scene = static_cast<Scene *>(getResource("scene"));
+        m_scene = new Scene(scene);
+        m_sampler = static_cast<Sampler *>(getResource("sampler"));
+        m_sensor = static_cast<Sensor *>(getResource("sensor"));
+        m_grid = static_cast<VCMLightVertexGrid *>(getResource("lightVertices"));
+        m_rfilter = m_sensor->getFilm()->getReconstructionFilter();
+        m_scene->removeSensor(scene->getSensor());
+        m_scene->addSensor(m_sensor);
+        m_scene->setSensor(m_sensor);
+        m_scene->setSampler(m_sampler);
+        m_scene->wakeup(NULL, m_resources);
+
+        m_pathSampler.configure(m_config);
+        m_pathSampler.initialize(m_scene, m_sampler);
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
+        const RectangularWorkUnit *rect = static_cast<const RectangularWorkUnit *>(workUnit);
+        VCMWorkResult *result = static_cast<VCMWorkResult *>(workResult);
+        bool needsTimeSample = m_sensor->needsTimeSample();
+
+        result->setOffset(rect->getOffset());
+        result->setSize(rect->getSize());
+        result->clear();
+        m_hilbertCurve.initialize(TVector2<uint8_t>(rect->getSize()));
+
+        #if defined(MTS_DEBUG_FP)
+            enableFPExceptions();
+        #endif
+
+        for (size_t i=0; i<m_hilbertCurve.getPointCount(); ++i) {
+            if (stop)
+                break;
+
+            Point2i offset = Point2i(m_hilbertCurve[i]) + Vector2i(rect->getOffset());
+
+            /* Every iteration renders one sample per pixel */
+            m_sampler->generate(offset);
+            m_sampler->setSampleIndex(m_config.iteration);
+
+            Point2 samplePos = Point2(offset) + Vector2(m_sampler->next2D());
+            Float timeSample = needsTimeSample ? m_sampler->next1D() : 0.5f;
+
+            result->putSample(samplePos, sample(result, samplePos, timeSample));
+        }
+
+        #if defined(MTS_DEBUG_FP)
+            disableFPExceptions();
+        #endif
+    }
+
+    /// Compute the contributions of one sample of the current iteration
+    Spectrum sample(VCMWorkResult *wr, const Point2 &samplePos, Float timeSample) {
+        /* Trace a light subpath for the connection strategies and
+           connect its vertices to the sensor */
+        m_pathSampler.traceLightSubpath(m_sensor->sampleTime(timeSample), m_lightPath);
+        connectToSensor(wr);
+
+        /* Start the sensor subpath */
+        Ray ray;
+        VCMPathState state;
+        state.power = m_sensor->sampleRay(ray, samplePos, Point2(0.5f), timeSample);
+        state.throughput = Spectrum(1.0f);
+        state.depth = 0;
+
+        Float pdfSensor = m_sensor->pdfDirection(DirectionSamplingRecord(ray.d),
+            PositionSamplingRecord(ray.time));
+        if (state.power.isZero() || pdfSensor == 0)
+            return Spectrum(0.0f);
+
+        /* The number of light subpaths matches the number of pixels,
+           hence the film-wide density can be used directly */
+        state.dVCM = vcmMis(1 / pdfSensor);
+        state.dVC = state.dVM = 0.0f;
+
+        Spectrum Li(0.0f);
+        Intersection intersections[2];
+        Intersection *its = &intersections[0], *prevIts = &intersections[1];
+
+        while (true) {
+            if (!m_scene->rayIntersect(ray, *its)) {
+                /* Intersected nothing -- perhaps there is an environment map? */
+                const Emitter *env = m_scene->getEnvironmentEmitter();
+                if (env && (m_config.maxDepth == -1 || state.depth < m_config.maxDepth)) {
+                    Spectrum value = env->evalEnvironment(RayDifferential(ray));
+                    if (state.depth > 0 && !value.isZero()) {
+                        /* Environment emitters are only reached by sensor
+                           subpaths, hence only direct sampling competes */
+                        DirectSamplingRecord dRec(*prevIts);
+                        if (env->fillDirectSamplingRecord(dRec, ray))
+                            value /= 1 + vcmMis(m_scene->pdfEmitterDirect(dRec)) * state.dVCM;
+                        else
+                            value = Spectrum(0.0f);
+                    }
+                    Li += state.power * state.throughput * value;
+                }
+                break;
+            }
+
+            ++state.depth;
+            if (!m_pathSampler.updateHit(ray, *its, state))
+                break;
+
+            if (its->isEmitter()) {
+                Spectrum value = its->Le(-ray.d);
+                if (state.depth > 1 && !value.isZero())
+                    value /= 1 + misEmitterHit(ray, *its, *prevIts, state);
+                Li += state.power * state.throughput * value;
+            }
+
+            if (m_config.maxDepth != -1 && state.depth >= m_config.maxDepth)
+                break;
+
+            if (its->getBSDF()->getType() & BSDF::ESmooth) {
+                Spectrum value = sampleEmitterDirect(*its, state)
+                    + connectVertices(*its, state)
+                    + mergeVertices(*its, state);
+                Li += state.power * state.throughput * value;
+            }
+
+            if (!m_pathSampler.sampleScattering(*its, ray, state, ERadiance))
+                break;
+
+            std::swap(its, prevIts);
+        }
+
+        return Li;
+    }
+
+    /**
+     * \brief Return the sum of the MIS weights of the other strategies
+     * relative to the one that hit the emitter at \c its
+     */
+    Float misEmitterHit(const Ray &ray, const Intersection &its,
+            const Intersection &prevIts, const VCMPathState &state) const {
+        const Emitter *emitter = its.shape->getEmitter();
+        DirectSamplingRecord dRec(prevIts);
+        dRec.setQuery(ray, its);
+
+        Float directPdfA = m_scene->pdfEmitterDirect(dRec)
+            * absDot(its.shFrame.n, ray.d) / (its.t * its.t);
+        Float emissionPdf = m_pathSampler.pdfEmission(emitter,
+            PositionSamplingRecord(its), -ray.d);
+
+        return vcmMis(directPdfA) * state.dVCM + vcmMis(emissionPdf) * state.dVC;
+    }
+
+    /// Connect the vertices of the light subpath to the sensor
+    void connectToSensor(VCMWorkResult *wr) {
+        Float misVmWeightFactor = m_pathSampler.getMisVmWeightFactor();
+
+        for (size_t i=0; i<m_lightPath.size(); ++i) {
+            const VCMPathVertex &vertex = m_lightPath[i];
+            const Intersection &its = vertex.its;
+
+            DirectSamplingRecord dRec(its);
+            Spectrum value = m_scene->sampleSensorDirect(dRec, m_sampler->next2D());
+            if (value.isZero())
+                continue;
+
+            const BSDF *bsdf = its.getBSDF();
+            BSDFSamplingRecord bRec(its, its.toLocal(dRec.d), EImportance);
+
+            /* Prevent light leaks due to the use of shading normals -- [Veach, p. 158] */
+            Vector wi = its.toWorld(its.wi);
+            Float wiDotGeoN = dot(its.geoFrame.n, wi),
+                  woDotGeoN = dot(its.geoFrame.n, dRec.d);
+            if (wiDotGeoN * Frame::cosTheta(bRec.wi) <= 0 ||
+                woDotGeoN * Frame::cosTheta(bRec.wo) <= 0)
+                continue;
+
+            /* Adjoint BSDF for shading normals -- [Veach, p. 155] */
+            Float correction = std::abs(
+                (Frame::cosTheta(bRec.wi) * woDotGeoN)/
+                (Frame::cosTheta(bRec.wo) * wiDotGeoN));
+            value *= bsdf->eval(bRec) * correction;
+            if (value.isZero())
+                continue;
+
+            bRec.reverse();
+            Float pdfRev = bsdf->pdf(bRec);
+
+            Float pdfSensorA = m_sensor->pdfDirection(DirectionSamplingRecord(-dRec.d), dRec)
+                * std::abs(woDotGeoN) / (dRec.dist * dRec.dist);
+            Float wLight = vcmMis(pdfSensorA) * (misVmWeightFactor
+                + vertex.state.dVCM + vertex.state.dVC * vcmMis(pdfRev));
+
+            wr->putLightSample(dRec.uv, vertex.state.power *
+                vertex.state.throughput * value / (1 + wLight));
+        }
+    }
+
+    /// Sample a position on an emitter and connect to it (next event estimation)
+    Spectrum sampleEmitterDirect(const Intersection &its, const VCMPathState &state) {
+        DirectSamplingRecord dRec(its);
+        Spectrum value = m_scene->sampleEmitterDirect(dRec, m_sampler->next2D());
+        if (value.isZero())
+            return Spectrum(0.0f);
+
+        const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+        const BSDF *bsdf = its.getBSDF();
+        BSDFSamplingRecord bRec(its, its.toLocal(dRec.d), ERadiance);
+
+        Float pdf = 0;
+        Spectrum bsdfVal = bsdf->evalWithPdf(bRec, pdf);
+
+        /* Prevent light leaks due to the use of shading normals */
+        if (bsdfVal.isZero() || dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) <= 0)
+            return Spectrum(0.0f);
+
+        bRec.reverse();
+        Float pdfRev = bsdf->pdf(bRec);
+
+        /* BSDF sampling can only hit emitters without a degenerate direct sampling density */
+        Float wLight = 0, directPdfA = dRec.pdf;
+        if (dRec.measure == ESolidAngle) {
+            wLight = vcmMis(pdf / dRec.pdf);
+            directPdfA *= absDot(dRec.n, dRec.d) / (dRec.dist * dRec.dist);
+        }
+
+        Float wCamera = 0;
+        Float emissionPdf = m_pathSampler.pdfEmission(emitter, dRec, -dRec.d);
+        if (emissionPdf > 0 && directPdfA > 0)
+            wCamera = vcmMis(emissionPdf * absDot(its.geoFrame.n, dRec.d) /
+                (directPdfA * dRec.dist * dRec.dist)) *
+                (m_pathSampler.getMisVmWeightFactor() + state.dVCM + state.dVC * vcmMis(pdfRev));
+
+        return value * bsdfVal / (1 + wLight + wCamera);
+    }
+
+    /// Connect a sensor subpath vertex to all vertices of the light subpath
+    Spectrum connectVertices(const Intersection &its, const VCMPathState &state) {
+        Float misVmWeightFactor = m_pathSampler.getMisVmWeightFactor();
+        const BSDF *bsdf = its.getBSDF();
+        Spectrum result(0.0f);
+
+        for (size_t i=0; i<m_lightPath.size(); ++i) {
+            const VCMPathVertex &vertex = m_lightPath[i];
+            const Intersection &lightIts = vertex.its;
+
+            /* The vertices are ordered by depth */
+            if (m_config.maxDepth != -1 &&
+                vertex.state.depth + state.depth + 1 > m_config.maxDepth)
+                break;
+
+            Vector d = lightIts.p - its.p;
+            Float distSquared = d.lengthSquared();
+            if (distSquared == 0)
+                continue;
+            Float dist = std::sqrt(distSquared);
+            d /= dist;
+
+            /* Evaluate the BSDF at the sensor subpath vertex */
+            BSDFSamplingRecord bRec(its, its.toLocal(d), ERadiance);
+            Float pdf = 0;
+            Spectrum value = bsdf->evalWithPdf(bRec, pdf);
+            Float cosSensor = dot(its.geoFrame.n, d);
+            if (value.isZero() || cosSensor * Frame::cosTheta(bRec.wo) <= 0)
+                continue;
+            bRec.reverse();
+            Float pdfRev = bsdf->pdf(bRec);
+
+            /* Evaluate the adjoint BSDF at the light subpath vertex */
+            const BSDF *lightBSDF = lightIts.getBSDF();
+            BSDFSamplingRecord lRec(lightIts, lightIts.toLocal(-d), EImportance);
+            Float lightPdf = 0;
+            Spectrum lightValue = lightBSDF->evalWithPdf(lRec, lightPdf);
+            Float wiDotGeoN = dot(lightIts.geoFrame.n, lightIts.toWorld(lightIts.wi)),
+                  woDotGeoN = -dot(lightIts.geoFrame.n, d);
+            if (lightValue.isZero() ||
+                wiDotGeoN * Frame::cosTheta(lRec.wi) <= 0 ||
+                woDotGeoN * Frame::cosTheta(lRec.wo) <= 0)
+                continue;
+            lightValue *= std::abs(
+                (Frame::cosTheta(lRec.wi) * woDotGeoN)/
+                (Frame::cosTheta(lRec.wo) * wiDotGeoN));
+            lRec.reverse();
+            Float lightPdfRev = lightBSDF->pdf(lRec);
+
+            /* Convert the directional densities to area measure */
+            Float pdfA = pdf * std::abs(woDotGeoN) / distSquared,
+                  lightPdfA = lightPdf * std::abs(cosSensor) / distSquared;
+
+            Float wLight = vcmMis(pdfA) * (misVmWeightFactor + vertex.state.dVCM
+                    + vertex.state.dVC * vcmMis(lightPdfRev)),
+                  wCamera = vcmMis(lightPdfA) * (misVmWeightFactor + state.dVCM
+                    + state.dVC * vcmMis(pdfRev));
+
+            Ray shadowRay(its.p, d, Epsilon, dist * (1 - ShadowEpsilon), its.time);
+            if (m_scene->rayIntersect(shadowRay))
+                continue;
+
+            result += vertex.state.power * vertex.state.throughput * value
+                * lightValue / (distSquared * (1 + wLight + wCamera));
+        }
+
+        return result;
+    }
+
+    /// Gathers the light vertices that are merged with a sensor subpath vertex
+    struct MergeQuery {
+        inline MergeQuery(const Intersection &its, const VCMPathState &state,
+                int maxDepth, Float misVcWeightFactor) : its(its), state(state),
+                maxDepth(maxDepth), misVcWeightFactor(misVcWeightFactor),
+                result(0.0f) {
+            bsdf = its.getBSDF();
+        }
+
+        inline void operator()(const VCMLightVertex &vertex) {
+            if (maxDepth != -1 && vertex.depth + state.depth > maxDepth)
+                return;
+
+            BSDFSamplingRecord bRec(its, its.toLocal(vertex.wi), ERadiance);
+            Float pdf = 0;
+            Spectrum value = bsdf->evalWithPdf(bRec, pdf);
+            Float cosTheta = Frame::cosTheta(bRec.wo);
+            if (value.isZero() || dot(its.geoFrame.n, vertex.wi) * cosTheta <= 0)
+                return;
+            bRec.reverse();
+            Float pdfRev = bsdf->pdf(bRec);
+
+            Float wLight = vertex.dVCM * misVcWeightFactor + vertex.dVM * vcmMis(pdf),
+                  wCamera = state.dVCM * misVcWeightFactor + state.dVM * vcmMis(pdfRev);
+
+            /* The density estimate does not include the foreshortening
+               factor, which is part of the evaluated BSDF */
+            result += vertex.throughput * value /
+                (std::abs(cosTheta) * (1 + wLight + wCamera));
+        }
+
+        const Intersection &its;
+        const VCMPathState &state;
+        const BSDF *bsdf;
+        int maxDepth;
+        Float misVcWeightFactor;
+        Spectrum result;
+    };
+
+    /// Merge a sensor subpath vertex with the nearby light vertices
+    Spectrum mergeVertices(const Intersection &its, const VCMPathState &state) {
+        MergeQuery query(its, state, m_config.maxDepth,
+            m_pathSampler.getMisVcWeightFactor());
+        m_grid->query(its.p, query);
+        return query.result / m_config.getMergingEta();
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new VCMRenderer(m_config,
+            const_cast<ImageBlock *>(m_sharedLightImage.get()));
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    ref<Scene> m_scene;
+    ref<Sensor> m_sensor;
+    ref<Sampler> m_sampler;
+    ref<ReconstructionFilter> m_rfilter;
+    ref<const VCMLightVertexGrid> m_grid;
+    VCMConfiguration m_config;
+    VCMPathSampler m_pathSampler;
+    std::vector<VCMPathVertex> m_lightPath;
+    HilbertCurve2D<uint8_t> m_hilbertCurve;
+    ref<ImageBlock> m_sharedLightImage;
+};
+
+/* ==================================================================== */
+/*                           Parallel processes                         */
+/* ==================================================================== */
+
+VCMLightVertexProcess::VCMLightVertexProcess(const RenderJob *parent,
+        const VCMConfiguration &config)
+    : ParticleProcess(ParticleProcess::ETrace, config.getLightPathCount(),
+        config.granularity, "Tracing light paths", parent), m_config(config) { }
+
+ref<WorkProcessor> VCMLightVertexProcess::createWorkProcessor() const {
+    return new VCMLightVertexTracer(m_config);
+}
+
+void VCMLightVertexProcess::processResult(const WorkResult *wr, bool cancelled) {
+    if (cancelled)
+        return;
+    const VCMLightVertexResult *result = static_cast<const VCMLightVertexResult *>(wr);
+    const std::vector<VCMLightVertex> &vertices = result->getVertices();
+    {
+        LockGuard lock(m_resultMutex);
+        m_vertices.insert(m_vertices.end(), vertices.begin(), vertices.end());
+    }
+    increaseResultCount(result->getPathCount());
+}
+
+ref<VCMLightVertexGrid> VCMLightVertexProcess::createGrid() {
+    LockGuard lock(m_resultMutex);
+    return new VCMLightVertexGrid(m_vertices, m_config.radius);
+}
+
+VCMProcess::VCMProcess(const RenderJob *parent, RenderQueue *queue,
+        const VCMConfiguration &config, VCMWorkResult *result,
+        ImageBlock *sharedLightImage) :
+    BlockedRenderProcess(parent, queue, config.blockSize), m_result(result),
+    m_sharedLightImage(sharedLightImage), m_config(config) { }
+
+ref<WorkProcessor> VCMProcess::createWorkProcessor() const {
+    return new VCMRenderer(m_config,
+        const_cast<ImageBlock *>(m_sharedLightImage.get()));
+}
+
+void VCMProcess::develop() {
+    LockGuard lock(m_resultMutex);
+
+    /* Combine the light images of remote workers with the
+       one that is shared by all local workers */
+    ref<Bitmap> lightImage = m_result->getLightImage()->getBitmap()->clone();
+    int borderSize = m_sharedLightImage->getBorderSize();
+    lightImage->accumulate(m_sharedLightImage->getBitmap(),
+        Point2i(borderSize), Point2i(0), lightImage->getSize());
+
+    m_film->setBitmap(m_result->getImageBlock()->getBitmap());
+    m_film->addBitmap(lightImage, 1.0f / (m_config.iteration + 1));
+    m_queue->signalRefresh(m_parent);
+}
+
+void VCMProcess::processResult(const WorkResult *wr, bool cancelled) {
+    if (cancelled)
+        return;
+    const VCMWorkResult *result = static_cast<const VCMWorkResult *>(wr);
+    ImageBlock *block = const_cast<ImageBlock *>(result->getImageBlock());
+    LockGuard lock(m_resultMutex);
+    m_progress->update(++m_resultCount);
+    m_result->put(result);
+    m_film->put(block);
+    m_queue->signalWorkEnd(m_parent, result->getImageBlock(), false);
+}
+
+MTS_IMPLEMENT_CLASS_S(VCMLightVertexTracer, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS_S(VCMRenderer, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(VCMLightVertexProcess, false, ParticleProcess)
+MTS_IMPLEMENT_CLASS(VCMProcess, false, BlockedRenderProcess)
+MTS_NAMESPACE_END
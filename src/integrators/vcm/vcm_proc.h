@@ -0,0 +1,91 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__VCM_PROC_H)
+#define __VCM_PROC_H
+
+#include <mitsuba/render/renderproc.h>
+#include <mitsuba/render/particleproc.h>
+#include <mitsuba/render/renderjob.h>
+#include <mitsuba/core/bitmap.h>
+#include "vcm_wr.h"
+#include "vcm_grid.h"
+
+MTS_NAMESPACE_BEGIN
+
+/* ==================================================================== */
+/*                           Parallel processes                         */
+/* ==================================================================== */
+
+/**
+ * \brief Traces the light subpaths of one iteration and collects
+ * their vertices for the vertex merging strategy
+ */
+class VCMLightVertexProcess : public ParticleProcess {
+public:
+    VCMLightVertexProcess(const RenderJob *parent, const VCMConfiguration &config);
+
+    /// Build a hash grid over the collected vertices (consumes them)
+    ref<VCMLightVertexGrid> createGrid();
+
+    /* ParallelProcess impl. */
+    void processResult(const WorkResult *wr, bool cancelled);
+    ref<WorkProcessor> createWorkProcessor() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~VCMLightVertexProcess() { }
+private:
+    std::vector<VCMLightVertex> m_vertices;
+    VCMConfiguration m_config;
+};
+
+/**
+ * \brief Renders work units (rectangular image regions) of one iteration
+ * using vertex connection and merging
+ *
+ * The accumulated camera and light images are owned by the integrator,
+ * since they persist across iterations.
+ */
+class VCMProcess : public BlockedRenderProcess {
+public:
+    VCMProcess(const RenderJob *parent, RenderQueue *queue,
+        const VCMConfiguration &config, VCMWorkResult *result,
+        ImageBlock *sharedLightImage);
+
+    /// Develop the image based on the iterations completed so far
+    void develop();
+
+    /* ParallelProcess impl. */
+    void processResult(const WorkResult *wr, bool cancelled);
+    ref<WorkProcessor> createWorkProcessor() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~VCMProcess() { }
+private:
+    ref<VCMWorkResult> m_result;
+    ref<ImageBlock> m_sharedLightImage;
+    VCMConfiguration m_config;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __VCM_PROC_H */
@@ -0,0 +1,119 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "vcm_wr.h"
+
+MTS_NAMESPACE_BEGIN
+
+/* ==================================================================== */
+/*                             Work results                             */
+/* ==================================================================== */
+
+VCMWorkResult::VCMWorkResult(const VCMConfiguration &conf,
+        const ReconstructionFilter *rfilter, Vector2i blockSize,
+        ImageBlock *sharedLightImage) : m_sharedLightImage(sharedLightImage) {
+    /* Stores the 'camera image' -- this can be blocked when
+       spreading out work to multiple workers */
+    if (blockSize == Vector2i(-1, -1))
+        blockSize = Vector2i(conf.blockSize, conf.blockSize);
+
+    m_block = new ImageBlock(Bitmap::ESpectrumAlphaWeight, blockSize, rfilter);
+    m_block->setOffset(Point2i(0, 0));
+    m_block->setSize(blockSize);
+
+    if (!sharedLightImage) {
+        /* Stores the 'light image' -- every worker requires a
+           full-resolution version, since connections to the
+           sensor can affect any pixel of this bitmap */
+        m_lightImage = new ImageBlock(Bitmap::ESpectrum,
+                conf.cropSize, rfilter);
+        m_lightImage->setSize(conf.cropSize);
+        m_lightImage->setOffset(Point2i(0, 0));
+    }
+}
+
+VCMWorkResult::~VCMWorkResult() { }
+
+void VCMWorkResult::put(const VCMWorkResult *workResult) {
+    m_block->put(workResult->m_block.get());
+    if (m_lightImage.get() && workResult->m_lightImage.get())
+        m_lightImage->put(workResult->m_lightImage.get());
+    else if (m_lightImage.get() && workResult->m_sparseLightImage.get())
+        m_lightImage->put(workResult->m_sparseLightImage.get());
+}
+
+void VCMWorkResult::clear() {
+    if (m_lightImage)
+        m_lightImage->clear();
+    m_block->clear();
+}
+
+void VCMWorkResult::load(Stream *stream) {
+    if (stream->readBool()) {
+        if (!m_sparseLightImage)
+            m_sparseLightImage = new SparseImageBlock();
+        m_sparseLightImage->load(stream);
+    } else {
+        m_sparseLightImage = NULL;
+    }
+    m_block->load(stream);
+}
+
+void VCMWorkResult::save(Stream *stream) const {
+    /* Only transmit the tiles of the light image that were touched */
+    if (m_lightImage.get()) {
+        ref<SparseImageBlock> sparse = new SparseImageBlock();
+        sparse->set(m_lightImage.get());
+        stream->writeBool(true);
+        sparse->save(stream);
+    } else {
+        stream->writeBool(m_sparseLightImage.get() != NULL);
+        if (m_sparseLightImage.get())
+            m_sparseLightImage->save(stream);
+    }
+    m_block->save(stream);
+}
+
+std::string VCMWorkResult::toString() const {
+    return m_block->toString();
+}
+
+void VCMLightVertexResult::load(Stream *stream) {
+    m_pathCount = stream->readSize();
+    size_t count = stream->readSize();
+    m_vertices.clear();
+    m_vertices.reserve(count);
+    for (size_t i=0; i<count; ++i)
+        m_vertices.push_back(VCMLightVertex(stream));
+}
+
+void VCMLightVertexResult::save(Stream *stream) const {
+    stream->writeSize(m_pathCount);
+    stream->writeSize(m_vertices.size());
+    for (size_t i=0; i<m_vertices.size(); ++i)
+        m_vertices[i].serialize(stream);
+}
+
+std::string VCMLightVertexResult::toString() const {
+    return formatString("VCMLightVertexResult[paths=" SIZE_T_FMT
+        ", vertices=" SIZE_T_FMT "]", m_pathCount, m_vertices.size());
+}
+
+MTS_IMPLEMENT_CLASS(VCMWorkResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS(VCMLightVertexResult, false, WorkResult)
+MTS_NAMESPACE_END
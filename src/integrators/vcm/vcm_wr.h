@@ -0,0 +1,144 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__VCM_WR_H)
+#define __VCM_WR_H
+
+#include <mitsuba/render/imageblock.h>
+#include "vcm.h"
+
+MTS_NAMESPACE_BEGIN
+
+/* ==================================================================== */
+/*                             Work results                             */
+/* ==================================================================== */
+
+/**
+   As with bidirectional path tracing, every rendering thread renders to
+   a small 'camera image' block and a 'light image', which receives the
+   contributions of light subpath vertices that are connected to the
+   sensor and can thus affect any pixel.
+
+   Local workers splat into a light image that is shared by all of them
+   (see \c sharedLightImage). Remote workers use their own light images,
+   but only send the tiles that received contributions.
+*/
+class VCMWorkResult : public WorkResult {
+public:
+    VCMWorkResult(const VCMConfiguration &conf, const ReconstructionFilter *filter,
+            Vector2i blockSize = Vector2i(-1, -1), ImageBlock *sharedLightImage = NULL);
+
+    // Clear the contents of the work result
+    void clear();
+
+    /// Fill the work result with content acquired from a binary data stream
+    virtual void load(Stream *stream);
+
+    /// Serialize a work result to a binary data stream
+    virtual void save(Stream *stream) const;
+
+    /// Accumulate another work result into this one
+    void put(const VCMWorkResult *workResult);
+
+    inline void putSample(const Point2 &sample, const Spectrum &spec) {
+        m_block->put(sample, spec, 1.0f);
+    }
+
+    inline void putLightSample(const Point2 &sample, const Spectrum &spec) {
+        if (m_sharedLightImage)
+            m_sharedLightImage->putConcurrent(sample, spec, 1.0f);
+        else
+            m_lightImage->put(sample, spec, 1.0f);
+    }
+
+    inline const ImageBlock *getImageBlock() const {
+        return m_block.get();
+    }
+
+    inline const ImageBlock *getLightImage() const {
+        return m_lightImage.get();
+    }
+
+    inline void setSize(const Vector2i &size) {
+        m_block->setSize(size);
+    }
+
+    inline void setOffset(const Point2i &offset) {
+        m_block->setOffset(offset);
+    }
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~VCMWorkResult();
+protected:
+    ref<ImageBlock> m_block, m_lightImage;
+    ref<ImageBlock> m_sharedLightImage;
+    /// Light image that was received from a remote worker
+    ref<SparseImageBlock> m_sparseLightImage;
+};
+
+/**
+ * \brief Stores the light subpath vertices that were generated
+ * by one work unit of the vertex merging pass
+ */
+class VCMLightVertexResult : public WorkResult {
+public:
+    VCMLightVertexResult() : m_pathCount(0) { }
+
+    inline void clear() {
+        m_vertices.clear();
+        m_pathCount = 0;
+    }
+
+    inline void put(const VCMLightVertex &vertex) {
+        m_vertices.push_back(vertex);
+    }
+
+    inline void nextPath() { ++m_pathCount; }
+
+    inline size_t getPathCount() const { return m_pathCount; }
+
+    inline const std::vector<VCMLightVertex> &getVertices() const {
+        return m_vertices;
+    }
+
+    /// Fill the work result with content acquired from a binary data stream
+    virtual void load(Stream *stream);
+
+    /// Serialize a work result to a binary data stream
+    virtual void save(Stream *stream) const;
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~VCMLightVertexResult() { }
+protected:
+    std::vector<VCMLightVertex> m_vertices;
+    size_t m_pathCount;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __VCM_WR_H */
@@ -0,0 +1,199 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/scene.h>
+#include <mitsuba/render/lighttree.h>
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{lightcuts}{Lightcuts}
+ * \order{16}
+ * \parameters{
+ *     \parameter{maxDepth}{\Integer}{Specifies the longest path depth
+ *         in the generated output image (where \code{-1} corresponds to $\infty$).
+ *         A value of \code{2} will lead to direct-only illumination.
+ *         \default{\code{5}}
+ *     }
+ *     \parameter{vplCount}{\Integer}{
+ *       Number of virtual point lights that should be generated \default{10000}
+ *     }
+ *     \parameter{relError}{\Float}{
+ *       Upper bound on the error of every cluster of VPLs relative
+ *       to the total estimate at a shading point. \code{0} evaluates
+ *       all VPLs separately. \default{0.02}
+ *     }
+ *     \parameter{maxCutSize}{\Integer}{
+ *       Upper bound on the number of clusters that are evaluated
+ *       per shading point \default{1000}
+ *     }
+ *     \parameter{clamping}{\Float}{
+ *       Distances between shading points and VPLs below this fraction
+ *       of the scene's bounding sphere radius are clamped, which avoids
+ *       bright blotches in corners \default{0.01}
+ *     }
+ *     \parameter{maxSpecularDepth}{\Integer}{Number of perfectly specular
+ *       interactions that a sensor ray can undergo before reaching a
+ *       surface that is shaded using the VPLs \default{4}
+ *     }
+ * }
+ *
+ * This integrator is a software implementation of the Instant
+ * Radiosity method \cite{Keller1997Instant} (see \pluginref{vpl}), which
+ * scales to large numbers of virtual point lights (VPLs) using the
+ * \emph{lightcuts} technique by Walter et al. \cite{Walter2005Lightcuts}.
+ * All VPLs are organized in a binary tree whose nodes represent
+ * clusters of similar VPLs. At every shading point, a \emph{cut} through
+ * this tree is chosen such that the error bound of every cluster in the cut
+ * is small compared to the total illumination. Each cluster is then
+ * evaluated using a single representative VPL (and a single shadow ray).
+ * Since the size of typical cuts grows only slowly with the number of VPLs,
+ * scenes can be rendered with hundreds of thousands of VPLs, which reduces
+ * the noise and blotches of the \pluginref{vpl} integrator.
+ *
+ * The direct illumination is also handled by VPLs, which are placed on the
+ * emitters. The samples per pixel specified to the sampler are used for
+ * antialiasing.
+ *
+ * \remarks{
+ *    \item The error bounds are only conservative for diffuse receivers.
+ *    Glossy materials work but can lead to larger errors.
+ *    \item Participating media are not supported.
+ *    \item This integrator does not support network rendering.
+ * }
+ */
+class LightcutsIntegrator : public SamplingIntegrator {
+public:
+    LightcutsIntegrator(const Properties &props) : SamplingIntegrator(props) {
+        /* Max. depth (expressed as path length) */
+        m_maxDepth = props.getInteger("maxDepth", 5);
+        /* Number of VPLs that should be generated */
+        m_vplCount = props.getSize("vplCount", 10000);
+        /* Relative error threshold of the clusters in a cut */
+        m_relError = props.getFloat("relError", 0.02f);
+        /* Upper bound on the number of clusters per shading point */
+        m_maxCutSize = props.getSize("maxCutSize", 1000);
+        /* Relative clamping distance */
+        m_clamping = props.getFloat("clamping", 0.01f);
+        /* Max. number of specular interactions before shading */
+        m_maxSpecularDepth = props.getInteger("maxSpecularDepth", 4);
+
+        if (m_relError < 0)
+            Log(EError, "'relError' must be nonnegative!");
+        if (m_maxCutSize == 0)
+            Log(EError, "'maxCutSize' must be greater than zero!");
+    }
+
+    /// Unserialize from a binary data stream
+    LightcutsIntegrator(Stream *stream, InstanceManager *manager)
+     : SamplingIntegrator(stream, manager) {
+        Log(EError, "Lightcuts are not supported in network rendering!");
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Log(EError, "Lightcuts are not supported in network rendering!");
+    }
+
+    bool preprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        if (!SamplingIntegrator::preprocess(scene, queue, job, sceneResID,
+                sensorResID, samplerResID))
+            return false;
+
+        if (scene->hasMedia())
+            Log(EError, "Participating media are not supported by the lightcuts integrator!");
+
+        ref<Random> random = new Random();
+        std::deque<VPL> vpls;
+        size_t sampleIndex = generateVPLs(scene, random,
+                0, m_vplCount, m_maxDepth, true, vpls);
+        Float normalization = sampleIndex > 0 ? (Float) 1 / sampleIndex : (Float) 0;
+        for (size_t i=0; i<vpls.size(); ++i) {
+            vpls[i].P *= normalization;
+            vpls[i].emitterScale *= normalization;
+        }
+        Log(EInfo, "Generated %i virtual point lights", (int) vpls.size());
+
+        m_lightTree = new LightTree(vpls, random);
+        m_minDist = m_clamping * scene->getBSphere().radius;
+        return true;
+    }
+
+    Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
+        const Scene *scene = rRec.scene;
+        Intersection &its = rRec.its;
+        RayDifferential ray(r);
+        Spectrum Li(0.0f), throughput(1.0f);
+        bool intersected = rRec.rayIntersect(ray);
+
+        for (int depth = 0; ; ++depth) {
+            if (!intersected) {
+                if (rRec.type & RadianceQueryRecord::EEmittedRadiance)
+                    Li += throughput * scene->evalEnvironment(ray);
+                break;
+            }
+
+            if (its.isEmitter() && (rRec.type & RadianceQueryRecord::EEmittedRadiance))
+                Li += throughput * its.Le(-ray.d);
+
+            const BSDF *bsdf = its.getBSDF(ray);
+            if (bsdf->getType() & BSDF::ESmooth)
+                Li += throughput * m_lightTree->eval(scene, its,
+                    m_relError, m_maxCutSize, m_minDist);
+
+            /* Follow perfectly specular interactions */
+            if (!(bsdf->getType() & BSDF::EDelta) || depth >= m_maxSpecularDepth)
+                break;
+
+            BSDFSamplingRecord bRec(its, rRec.sampler, ERadiance);
+            bRec.typeMask = BSDF::EDelta;
+            Spectrum bsdfWeight = bsdf->sample(bRec, rRec.nextSample2D());
+            if (bsdfWeight.isZero())
+                break;
+            throughput *= bsdfWeight;
+
+            ray = RayDifferential(its.p, its.toWorld(bRec.wo), ray.time);
+            intersected = scene->rayIntersect(ray, its);
+        }
+
+        return Li;
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "LightcutsIntegrator[" << endl
+            << "  maxDepth = " << m_maxDepth << "," << endl
+            << "  vplCount = " << m_vplCount << "," << endl
+            << "  relError = " << m_relError << "," << endl
+            << "  maxCutSize = " << m_maxCutSize << "," << endl
+            << "  clamping = " << m_clamping << "," << endl
+            << "  maxSpecularDepth = " << m_maxSpecularDepth << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    ref<LightTree> m_lightTree;
+    int m_maxDepth, m_maxSpecularDepth;
+    size_t m_vplCount, m_maxCutSize;
+    Float m_relError, m_clamping, m_minDist;
+};
+
+MTS_IMPLEMENT_CLASS_S(LightcutsIntegrator, false, SamplingIntegrator)
+MTS_EXPORT_PLUGIN(LightcutsIntegrator, "Lightcuts integrator");
+MTS_NAMESPACE_END
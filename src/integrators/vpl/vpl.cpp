@@ -27,7 +27,7 @@
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{vpl}{Virtual Point Light integrator}
- * \order{14}
+ * \order{15}
  * \parameters{
  *     \parameter{maxDepth}{\Integer}{Specifies the longest path depth
  *         in the generated output image (where \code{-1} corresponds to $\infty$).
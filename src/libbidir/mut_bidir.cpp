@@ -26,6 +26,8 @@ static StatsCounter statsAccepted("Bidirectional mutation",
         "Acceptance rate", EPercentage);
 static StatsCounter statsGenerated("Bidirectional mutation",
         "Successful generation rate", EPercentage);
+static StatsCounter statsReused("Bidirectional mutation",
+        "Reused vertices", EPercentage);
 
 BidirectionalMutator::BidirectionalMutator(const Scene *scene,
     Sampler *sampler, MemoryPool &pool, int kmin, int kmax) :
@@ -171,6 +173,8 @@ bool BidirectionalMutator::sampleMutation(
         proposal.vertex(kPrime-1)->updateSamplePosition(
             proposal.vertex(kPrime-2));
 
+    statsReused.incrementBase(proposal.vertexCount());
+    statsReused += proposal.vertexCount() - (muRec.ka + 1);
     ++statsGenerated;
     return true;
 }
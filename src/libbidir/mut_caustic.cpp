@@ -25,6 +25,8 @@ static StatsCounter statsAccepted("Caustic perturbation",
         "Acceptance rate", EPercentage);
 static StatsCounter statsGenerated("Caustic perturbation",
         "Successful generation rate", EPercentage);
+static StatsCounter statsReused("Caustic perturbation",
+        "Reused vertices", EPercentage);
 
 CausticPerturbation::CausticPerturbation(const Scene *scene, Sampler *sampler,
         MemoryPool &pool, Float minJump, Float coveredArea) :
@@ -171,6 +173,8 @@ bool CausticPerturbation::sampleMutation(
     proposal.vertex(k-1)->updateSamplePosition(
         proposal.vertex(k-2));
 
+    statsReused.incrementBase(proposal.vertexCount());
+    statsReused += proposal.vertexCount() - (muRec.ka + 1);
     ++statsGenerated;
     return true;
 }
@@ -25,6 +25,8 @@ static StatsCounter statsAccepted("Lens perturbation",
         "Acceptance rate", EPercentage);
 static StatsCounter statsGenerated("Lens perturbation",
         "Successful generation rate", EPercentage);
+static StatsCounter statsReused("Lens perturbation",
+        "Reused vertices", EPercentage);
 
 LensPerturbation::LensPerturbation(const Scene *scene, Sampler *sampler,
         MemoryPool &pool, Float minJump, Float coveredArea) :
@@ -170,6 +172,8 @@ bool LensPerturbation::sampleMutation(
 
     BDAssert(proposal.matchesConfiguration(source));
 
+    statsReused.incrementBase(proposal.vertexCount());
+    statsReused += proposal.vertexCount() - (muRec.ka + 1);
     ++statsGenerated;
     return true;
 }
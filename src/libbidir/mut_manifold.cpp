@@ -34,6 +34,8 @@ static StatsCounter statsAcceptedImp("Manifold perturbation",
         "Acceptance rate (imp. transport)", EPercentage);
 static StatsCounter statsGeneratedImp("Manifold perturbation",
         "Successful generation rate (imp. transport)", EPercentage);
+static StatsCounter statsReused("Manifold perturbation",
+        "Reused vertices", EPercentage);
 static StatsCounter statsUsedManifold("Manifold perturbation",
         "Perturbations involving manifold walks", EPercentage);
 static StatsCounter statsNonReversible("Manifold perturbation",
@@ -604,6 +606,9 @@ bool ManifoldPerturbation::sampleMutation(
             proposal.vertex(k-2));
     BDAssert(source.matchesConfiguration(proposal));
 
+    statsReused.incrementBase(proposal.vertexCount());
+    statsReused += proposal.vertexCount() - (muRec.ka + 1);
+
     if (mode == EImportance)
         ++statsGeneratedImp;
     else
@@ -25,6 +25,8 @@ static StatsCounter statsAccepted("Multi-chain perturbation",
         "Acceptance rate", EPercentage);
 static StatsCounter statsGenerated("Multi-chain perturbation",
         "Successful generation rate", EPercentage);
+static StatsCounter statsReused("Multi-chain perturbation",
+        "Reused vertices", EPercentage);
 
 MultiChainPerturbation::MultiChainPerturbation(const Scene *scene, Sampler *sampler,
         MemoryPool &pool, Float minJump, Float coveredArea) :
@@ -194,6 +196,8 @@ bool MultiChainPerturbation::sampleMutation(
 
     BDAssert(proposal.matchesConfiguration(source));
 
+    statsReused.incrementBase(proposal.vertexCount());
+    statsReused += proposal.vertexCount() - (muRec.ka + 1);
     ++statsGenerated;
 
     return true;
@@ -203,9 +203,11 @@ void Path::reverse() {
 }
 
 void Path::release(MemoryPool &pool) {
-    for (size_t i=0; i<m_vertices.size(); ++i)
+    /* Release in reverse order, so that the next random walk
+       will receive the entries in the same (ascending) order */
+    for (size_t i=m_vertices.size(); i-- > 0; )
         pool.release(m_vertices[i]);
-    for (size_t i=0; i<m_edges.size(); ++i)
+    for (size_t i=m_edges.size(); i-- > 0; )
         pool.release(m_edges[i]);
     m_vertices.clear();
     m_edges.clear();
@@ -263,9 +265,120 @@ bool Path::operator==(const Path &path) const {
     return true;
 }
 
+/**
+ * Conversion factor from area to projected solid angle density at a
+ * non-connectable vertex \c succ that follows the vertex \c cur
+ */
+static inline Float manifoldFactor(const PathVertex *cur,
+        const PathVertex *succ, const PathEdge *edge) {
+    return edge->length * edge->length / std::abs(
+        (succ->isOnSurface() ? dot(edge->d, succ->getGeometricNormal()) : 1) *
+        (cur->isOnSurface()  ? dot(edge->d, cur->getGeometricNormal())  : 1));
+}
+
+void PathMISCache::update(const Scene *scene, const Path &path,
+        ETransportMode mode, bool sampleDirect, bool lightImage) {
+    size_t nVertices = path.vertexCount(), nEdges = path.edgeCount();
+
+    for (int mode=0; mode<2; ++mode) {
+        vertexPdf[mode].resize(nVertices);
+        edgePdf[mode].resize(nEdges);
+    }
+    connectable.resize(nVertices);
+    isNull.resize(nVertices);
+    hasNull = false;
+
+    for (size_t i=0; i<nVertices; ++i) {
+        const PathVertex *v = path.vertex(i);
+        vertexPdf[EImportance][i] = v->pdf[EImportance];
+        vertexPdf[ERadiance][i] = v->pdf[ERadiance];
+        connectable[i] = v->isConnectable();
+        isNull[i] = v->isNullInteraction() && !connectable[i];
+        hasNull |= isNull[i] != 0;
+    }
+
+    for (size_t i=0; i<nEdges; ++i) {
+        const PathEdge *e = path.edge(i);
+        edgePdf[EImportance][i] = e->pdf[EImportance];
+        edgePdf[ERadiance][i] = e->pdf[ERadiance];
+    }
+
+    this->sampleDirect = sampleDirect;
+    this->lightImage = lightImage;
+    partialWeight.assign(nVertices, 0.0);
+    if (hasNull || nVertices < 3)
+        return;
+
+    /* Replicate the flags and direct sampling ratio that Path::miWeight()
+       uses for the vertices next to the emitter or sensor (when the
+       connection is sufficiently far away from them) */
+    bool *conn = (bool *) alloca(nVertices * sizeof(bool));
+    for (size_t i=0; i<nVertices; ++i)
+        conn[i] = connectable[i] != 0;
+
+    Float ratioDirect = 0.0f;
+    if (sampleDirect) {
+        const PathVertex *sample = path.vertex(1);
+        EMeasure measure = sample->getAbstractEmitter()->getDirectMeasure();
+        conn[0] = measure != EDiscrete && measure != EInvalidMeasure;
+        conn[1] = measure != EInvalidMeasure;
+
+        if (conn[1] && conn[2])
+            ratioDirect = path.vertex(2)->evalPdfDirect(scene, sample, mode,
+                measure == ESolidAngle ? EArea : measure)
+                / (vertexPdf[mode][0] * edgePdf[mode][0]);
+    }
+
+    /* Moving the connection by one vertex towards the end of the subpath
+       multiplies the relative densities of all strategies beyond it by the
+       ratio of the reverse and forward densities of the skipped vertex */
+    ETransportMode reverse = mode == ERadiance ? EImportance : ERadiance;
+    for (size_t m=1; m+1<nVertices; ++m) {
+        Float pdfForward = vertexPdf[mode][m-1] * edgePdf[mode][m-1],
+              pdfReverse = vertexPdf[reverse][m+1] * edgePdf[reverse][m];
+
+        if (m >= 2 && conn[m-1] && !conn[m])
+            pdfForward *= manifoldFactor(path.vertex(m-1), path.vertex(m), path.edge(m-1));
+        if (m >= 2 && conn[m+1] && !conn[m])
+            pdfReverse *= manifoldFactor(path.vertex(m+1), path.vertex(m), path.edge(m));
+
+        double term = 0;
+        if (conn[m-1] && conn[m] && (mode == EImportance || lightImage || m > 2)) {
+            term = 1;
+            if (sampleDirect && m == 2)
+                term = (double) ratioDirect * (double) ratioDirect;
+        }
+
+        double ratio = (double) pdfReverse / (double) pdfForward;
+        partialWeight[m] = ratio * ratio * (partialWeight[m-1] + term);
+    }
+}
+
 Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
         const PathEdge *connectionEdge, const Path &sensorSubpath,
         int s, int t, bool sampleDirect, bool lightImage) {
+    return miWeight(scene, emitterSubpath, connectionEdge, sensorSubpath,
+        s, t, sampleDirect, lightImage, NULL, NULL);
+}
+
+/// Density of vertex \c i of a subpath (the endpoint \c end is never cached)
+static inline Float vertexPdf(const Path &path, const PathMISCache *cache,
+        int i, int end, ETransportMode mode) {
+    return (cache && i > 0 && i < end) ? cache->vertexPdf[mode][i]
+        : path.vertex(i)->pdf[mode];
+}
+
+/// Density of edge \c i of a subpath
+static inline Float edgePdf(const Path &path, const PathMISCache *cache,
+        int i, ETransportMode mode) {
+    return (cache && i > 0) ? cache->edgePdf[mode][i]
+        : path.edge(i)->pdf[mode];
+}
+
+Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
+        const PathEdge *connectionEdge, const Path &sensorSubpath,
+        int s, int t, bool sampleDirect, bool lightImage,
+        const PathMISCache *emitterCache, const PathMISCache *sensorCache) {
     int k = s+t+1, n = k+1;
 
     const PathVertex
@@ -274,6 +387,20 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
             *vs = emitterSubpath.vertex(s),
             *vt = sensorSubpath.vertex(t);
 
+    /* When the subpaths don't contain ENull interactions, the contributions
+       of strategies that are more than three vertices away from the
+       connection can be obtained from the partial sums of the caches. In
+       that case, only the vertices in the window [lo, hi] are visited */
+    bool useCaches = emitterCache && sensorCache
+        && !emitterCache->hasNull && !sensorCache->hasNull
+        && emitterCache->sampleDirect == sampleDirect
+        && sensorCache->sampleDirect == sampleDirect
+        && sensorCache->lightImage == lightImage;
+    bool emitterPartial = useCaches && s >= 5,
+         sensorPartial  = useCaches && t >= 5;
+    int lo = emitterPartial ? s-3 : 0,
+        hi = sensorPartial  ? s+4 : k;
+
     /* pdfImp[i] and pdfRad[i] store the area/volume density of vertex
        'i' when sampled from the adjacent vertex in the emitter
        and sensor direction, respectively. */
@@ -285,19 +412,36 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
           *isNull      = (bool *)  alloca(n * sizeof(bool));
 
     /* Keep track of which vertices are connectable / null interactions */
-    int pos = 0;
-    for (int i=0; i<=s; ++i) {
-        const PathVertex *v = emitterSubpath.vertex(i);
-        connectable[pos] = v->isConnectable();
-        isNull[pos] = v->isNullInteraction() && !connectable[pos];
-        pos++;
+    for (int i=lo; i<=s; ++i) {
+        if (emitterCache && i > 0 && i < s) {
+            connectable[i] = emitterCache->connectable[i] != 0;
+            isNull[i] = emitterCache->isNull[i] != 0;
+        } else {
+            const PathVertex *v = emitterSubpath.vertex(i);
+            connectable[i] = v->isConnectable();
+            isNull[i] = v->isNullInteraction() && !connectable[i];
+        }
+    }
+
+    for (int pos=s+1; pos<=hi; ++pos) {
+        int i = k-pos;
+        if (sensorCache && i > 0 && i < t) {
+            connectable[pos] = sensorCache->connectable[i] != 0;
+            isNull[pos] = sensorCache->isNull[i] != 0;
+        } else {
+            const PathVertex *v = sensorSubpath.vertex(i);
+            connectable[pos] = v->isConnectable();
+            isNull[pos] = v->isNullInteraction() && !connectable[pos];
+        }
     }
 
-    for (int i=t; i>=0; --i) {
-        const PathVertex *v = sensorSubpath.vertex(i);
-        connectable[pos] = v->isConnectable();
-        isNull[pos] = v->isNullInteraction() && !connectable[pos];
-        pos++;
+    if (emitterPartial || sensorPartial) {
+        /* The endpoints might still be ENull interactions */
+        for (int i=lo; i<=hi; ++i) {
+            if (isNull[i])
+                return miWeight(scene, emitterSubpath, connectionEdge,
+                    sensorSubpath, s, t, sampleDirect, lightImage, NULL, NULL);
+        }
     }
 
     if (k <= 3)
@@ -314,10 +458,14 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
         EMeasure emitterDirectMeasure = emitter->getDirectMeasure();
         EMeasure sensorDirectMeasure  = sensor->getDirectMeasure();
 
-        connectable[0]   = emitterDirectMeasure != EDiscrete && emitterDirectMeasure != EInvalidMeasure;
-        connectable[1]   = emitterDirectMeasure != EInvalidMeasure;
-        connectable[k-1] = sensorDirectMeasure != EInvalidMeasure;
-        connectable[k]   = sensorDirectMeasure != EDiscrete && sensorDirectMeasure != EInvalidMeasure;
+        if (!emitterPartial) {
+            connectable[0] = emitterDirectMeasure != EDiscrete && emitterDirectMeasure != EInvalidMeasure;
+            connectable[1] = emitterDirectMeasure != EInvalidMeasure;
+        }
+        if (!sensorPartial) {
+            connectable[k-1] = sensorDirectMeasure != EInvalidMeasure;
+            connectable[k]   = sensorDirectMeasure != EDiscrete && sensorDirectMeasure != EInvalidMeasure;
+        }
 
         /* The following is needed to handle orthographic cameras &
            directional light sources together with direct sampling */
@@ -328,44 +476,46 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
     }
 
     /* Collect importance transfer area/volume densities from vertices */
-    pos = 0;
-    pdfImp[pos++] = 1.0;
+    pdfImp[0] = 1.0;
 
-    for (int i=0; i<s; ++i)
-        pdfImp[pos++] = emitterSubpath.vertex(i)->pdf[EImportance]
-            * emitterSubpath.edge(i)->pdf[EImportance];
+    for (int i=std::max(lo, 1); i<=s; ++i)
+        pdfImp[i] = vertexPdf(emitterSubpath, emitterCache, i-1, s, EImportance)
+            * edgePdf(emitterSubpath, emitterCache, i-1, EImportance);
 
-    pdfImp[pos++] = vs->evalPdf(scene, vsPred, vt, EImportance, vsMeasure)
+    pdfImp[s+1] = vs->evalPdf(scene, vsPred, vt, EImportance, vsMeasure)
         * connectionEdge->pdf[EImportance];
 
     if (t > 0) {
-        pdfImp[pos++] = vt->evalPdf(scene, vs, vtPred, EImportance, vtMeasure)
+        pdfImp[s+2] = vt->evalPdf(scene, vs, vtPred, EImportance, vtMeasure)
             * sensorSubpath.edge(t-1)->pdf[EImportance];
 
-        for (int i=t-1; i>0; --i)
-            pdfImp[pos++] = sensorSubpath.vertex(i)->pdf[EImportance]
-                * sensorSubpath.edge(i-1)->pdf[EImportance];
+        for (int pos=s+3; pos<=hi; ++pos) {
+            int i = k-pos+1;
+            pdfImp[pos] = vertexPdf(sensorSubpath, sensorCache, i, t, EImportance)
+                * edgePdf(sensorSubpath, sensorCache, i-1, EImportance);
+        }
     }
 
     /* Collect radiance transfer area/volume densities from vertices */
-    pos = 0;
     if (s > 0) {
-        for (int i=0; i<s-1; ++i)
-            pdfRad[pos++] = emitterSubpath.vertex(i+1)->pdf[ERadiance]
-                * emitterSubpath.edge(i)->pdf[ERadiance];
+        for (int i=lo; i<s-1; ++i)
+            pdfRad[i] = vertexPdf(emitterSubpath, emitterCache, i+1, s, ERadiance)
+                * edgePdf(emitterSubpath, emitterCache, i, ERadiance);
 
-        pdfRad[pos++] = vs->evalPdf(scene, vt, vsPred, ERadiance, vsMeasure)
+        pdfRad[s-1] = vs->evalPdf(scene, vt, vsPred, ERadiance, vsMeasure)
             * emitterSubpath.edge(s-1)->pdf[ERadiance];
     }
 
-    pdfRad[pos++] = vt->evalPdf(scene, vtPred, vs, ERadiance, vtMeasure)
+    pdfRad[s] = vt->evalPdf(scene, vtPred, vs, ERadiance, vtMeasure)
         * connectionEdge->pdf[ERadiance];
 
-    for (int i=t; i>0; --i)
-        pdfRad[pos++] = sensorSubpath.vertex(i-1)->pdf[ERadiance]
-            * sensorSubpath.edge(i-1)->pdf[ERadiance];
+    for (int pos=s+1; pos<=std::min(hi, k-1); ++pos) {
+        int i = k-pos;
+        pdfRad[pos] = vertexPdf(sensorSubpath, sensorCache, i-1, t, ERadiance)
+            * edgePdf(sensorSubpath, sensorCache, i-1, ERadiance);
+    }
 
-    pdfRad[pos++] = 1.0;
+    pdfRad[k] = 1.0;
 
 
     /* When the path contains specular surface interactions, it is possible
@@ -375,7 +525,7 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
        all cancel out. But to make sure that that's actually true, we need to
        convert some of the area densities in the 'pdfRad' and 'pdfImp' arrays
        into the projected solid angle measure */
-    for (int i=1; i <= k-3; ++i) {
+    for (int i=std::max(lo, 1); i <= std::min(hi-1, k-3); ++i) {
         if (i == s || !(connectable[i] && !connectable[i+1]))
             continue;
 
@@ -383,12 +533,10 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
         const PathVertex *succ = i+1 <= s ? emitterSubpath.vertex(i+1) : sensorSubpath.vertex(k-i-1);
         const PathEdge *edge = i < s ? emitterSubpath.edge(i) : sensorSubpath.edge(k-i-1);
 
-        pdfImp[i+1] *= edge->length * edge->length / std::abs(
-            (succ->isOnSurface() ? dot(edge->d, succ->getGeometricNormal()) : 1) *
-            (cur->isOnSurface()  ? dot(edge->d, cur->getGeometricNormal())  : 1));
+        pdfImp[i+1] *= manifoldFactor(cur, succ, edge);
     }
 
-    for (int i=k-1; i >= 3; --i) {
+    for (int i=std::min(hi, k-1); i >= std::max(lo+1, 3); --i) {
         if (i-1 == s || !(connectable[i] && !connectable[i-1]))
             continue;
 
@@ -396,9 +544,7 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
         const PathVertex *succ = i-1 <= s ? emitterSubpath.vertex(i-1) : sensorSubpath.vertex(k-i+1);
         const PathEdge *edge = i <= s ? emitterSubpath.edge(i-1) : sensorSubpath.edge(k-i);
 
-        pdfRad[i-1] *= edge->length * edge->length / std::abs(
-            (succ->isOnSurface() ? dot(edge->d, succ->getGeometricNormal()) : 1) *
-            (cur->isOnSurface()  ? dot(edge->d, cur->getGeometricNormal())  : 1));
+        pdfRad[i-1] *= manifoldFactor(cur, succ, edge);
     }
 
     int emitterRefIndirection = 2, sensorRefIndirection = k-2;
@@ -406,8 +552,10 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
     /* One more array sweep before the actual useful work starts -- phew! :)
        "Collapse" edges/vertices that were caused by BSDF::ENull interactions.
        The BDPT implementation is smart enough to connect straight through those,
-       so they shouldn't be treated as Dirac delta events in what follows */
-    for (int i=1; i <= k-3; ++i) {
+       so they shouldn't be treated as Dirac delta events in what follows.
+       (This is not needed when the partial sums are used, since the full
+       path is then known not to contain such interactions) */
+    for (int i=1; i <= k-3 && lo == 0 && hi == k; ++i) {
         if (!connectable[i] || !isNull[i+1])
             continue;
 
@@ -450,27 +598,32 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
     double initial = 1.0f;
 
     /* When direct sampling strategies are enabled, we must
-       account for them here as well */
+       account for them here as well. The ratios are only needed
+       when the window extends to the respective end of the path. */
     if (sampleDirect) {
         /* Direct connection probability of the emitter */
-        const PathVertex *sample = s>0 ? emitterSubpath.vertex(1) : vt;
-        const PathVertex *ref = emitterRefIndirection <= s
-            ? emitterSubpath.vertex(emitterRefIndirection) : sensorSubpath.vertex(k-emitterRefIndirection);
-        EMeasure measure = sample->getAbstractEmitter()->getDirectMeasure();
-
-        if (connectable[1] && connectable[emitterRefIndirection])
-            ratioEmitterDirect = ref->evalPdfDirect(scene, sample, EImportance,
-                measure == ESolidAngle ? EArea : measure) / pdfImp[1];
+        if (!emitterPartial) {
+            const PathVertex *sample = s>0 ? emitterSubpath.vertex(1) : vt;
+            const PathVertex *ref = emitterRefIndirection <= s
+                ? emitterSubpath.vertex(emitterRefIndirection) : sensorSubpath.vertex(k-emitterRefIndirection);
+            EMeasure measure = sample->getAbstractEmitter()->getDirectMeasure();
+
+            if (connectable[1] && connectable[emitterRefIndirection])
+                ratioEmitterDirect = ref->evalPdfDirect(scene, sample, EImportance,
+                    measure == ESolidAngle ? EArea : measure) / pdfImp[1];
+        }
 
         /* Direct connection probability of the sensor */
-        sample = t>0 ? sensorSubpath.vertex(1) : vs;
-        ref = sensorRefIndirection <= s ? emitterSubpath.vertex(sensorRefIndirection)
-            : sensorSubpath.vertex(k-sensorRefIndirection);
-        measure = sample->getAbstractEmitter()->getDirectMeasure();
-
-        if (connectable[k-1] && connectable[sensorRefIndirection])
-            ratioSensorDirect = ref->evalPdfDirect(scene, sample, ERadiance,
-                measure == ESolidAngle ? EArea : measure) / pdfRad[k-1];
+        if (!sensorPartial) {
+            const PathVertex *sample = t>0 ? sensorSubpath.vertex(1) : vs;
+            const PathVertex *ref = sensorRefIndirection <= s ? emitterSubpath.vertex(sensorRefIndirection)
+                : sensorSubpath.vertex(k-sensorRefIndirection);
+            EMeasure measure = sample->getAbstractEmitter()->getDirectMeasure();
+
+            if (connectable[k-1] && connectable[sensorRefIndirection])
+                ratioSensorDirect = ref->evalPdfDirect(scene, sample, ERadiance,
+                    measure == ESolidAngle ? EArea : measure) / pdfRad[k-1];
+        }
 
         if (s == 1)
             initial /= ratioEmitterDirect;
@@ -486,7 +639,7 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
        an incremental scheme can be used that only finds the densities relative
        to the (s,t) strategy, which can be done using a linear sweep. For
        details, refer to the Veach thesis, p.306. */
-    for (int i=s+1; i<k; ++i) {
+    for (int i=s+1; i<std::min(hi, k); ++i) {
         double next = pdf * (double) pdfImp[i] / (double) pdfRad[i],
                value = next;
 
@@ -505,10 +658,15 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
         pdf = next;
     }
 
+    /* The remaining strategies only differ by fixed ratios of
+       the sensor subpath, whose sum was accumulated in advance */
+    if (sensorPartial)
+        weight += pdf * pdf * sensorCache->partialWeight[t-3];
+
     /* As above, but now compute pdf[i] with i<s (this is done by
        evaluating the inverse of the previous expressions). */
     pdf = initial;
-    for (int i=s-1; i>=0; --i) {
+    for (int i=s-1; i>=lo; --i) {
         double next = pdf * (double) pdfRad[i+1] / (double) pdfImp[i+1],
                value = next;
 
@@ -526,6 +684,9 @@ Float Path::miWeight(const Scene *scene, const Path &emitterSubpath,
         pdf = next;
     }
 
+    if (emitterPartial)
+        weight += pdf * pdf * emitterCache->partialWeight[s-3];
+
     return (Float) (1.0 / weight);
 }
 
@@ -21,8 +21,21 @@
 #include <mitsuba/bidir/util.h>
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/render/range.h>
+#include <mitsuba/render/scene.h>
+#include <boost/filesystem/operations.hpp>
 #include <boost/bind.hpp>
 
+/// Number of luminance samples per work unit of the parallel bootstrap
+#define PATHSEED_GRANULARITY 1024
+
+/// Version of the seed file format
+#define PATHSEED_FILE_VERSION 1
+
 MTS_NAMESPACE_BEGIN
 
 PathSampler::PathSampler(ETechnique technique, const Scene *scene, Sampler *sensorSampler,
@@ -85,6 +98,12 @@ void PathSampler::sampleSplats(const Point2i &offset, SplatList &list) {
                     m_sensorSubpath.randomWalkFromPixel(m_scene, m_sensorSampler,
                         m_sensorDepth, offset, m_rrDepth, m_pool);
 
+                /* Gather the sampling densities needed by the MIS weights */
+                m_emitterCache.update(m_scene, m_emitterSubpath, EImportance,
+                    m_sampleDirect, m_lightImage);
+                m_sensorCache.update(m_scene, m_sensorSubpath, ERadiance,
+                    m_sampleDirect, m_lightImage);
+
                 /* Compute the combined weights along the two subpaths */
                 Spectrum *importanceWeights = (Spectrum *) alloca(m_emitterSubpath.vertexCount() * sizeof(Spectrum)),
                          *radianceWeights  = (Spectrum *) alloca(m_sensorSubpath.vertexCount()  * sizeof(Spectrum));
@@ -242,7 +261,8 @@ void PathSampler::sampleSplats(const Point2i &offset, SplatList &list) {
 
                         /* Compute the multiple importance sampling weight */
                         value *= Path::miWeight(m_scene, m_emitterSubpath, &connectionEdge,
-                            m_sensorSubpath, s, t, m_sampleDirect, m_lightImage);
+                            m_sensorSubpath, s, t, m_sampleDirect, m_lightImage,
+                            &m_emitterCache, &m_sensorCache);
 
                         if (sampleDirect) {
                             /* Now undo the previous change */
@@ -335,6 +355,12 @@ void PathSampler::samplePaths(const Point2i &offset, PathCallback &callback) {
         m_sensorSubpath.randomWalkFromPixel(m_scene, m_sensorSampler,
             m_sensorDepth, offset, m_rrDepth, m_pool);
 
+    /* Gather the sampling densities needed by the MIS weights */
+    m_emitterCache.update(m_scene, m_emitterSubpath, EImportance,
+        m_sampleDirect, m_lightImage);
+    m_sensorCache.update(m_scene, m_sensorSubpath, ERadiance,
+        m_sampleDirect, m_lightImage);
+
     /* Compute the combined weights along the two subpaths */
     Spectrum *importanceWeights = (Spectrum *) alloca(m_emitterSubpath.vertexCount() * sizeof(Spectrum)),
              *radianceWeights  = (Spectrum *) alloca(m_sensorSubpath.vertexCount()  * sizeof(Spectrum));
@@ -494,7 +520,8 @@ void PathSampler::samplePaths(const Point2i &offset, PathCallback &callback) {
 
             /* Compute the multiple importance sampling weight */
             value *= Path::miWeight(m_scene, m_emitterSubpath, &connectionEdge,
-                m_sensorSubpath, s, t, m_sampleDirect, m_lightImage);
+                m_sensorSubpath, s, t, m_sampleDirect, m_lightImage,
+                &m_emitterCache, &m_sensorCache);
 
             if (!value.isZero()) {
                 int k = (int) m_connectionSubpath.vertexCount();
@@ -543,6 +570,8 @@ void PathSampler::samplePaths(const Point2i &offset, PathCallback &callback) {
  */
 struct PathSeedSortPredicate {
     bool operator()(const PathSeed &left, const PathSeed &right) {
+        if (left.sequence != right.sequence)
+            return left.sequence < right.sequence;
         return left.sampleIndex < right.sampleIndex;
     }
 };
@@ -597,28 +626,27 @@ static void seedCallback(std::vector<PathSeed> &output, const Bitmap *importance
     output.push_back(PathSeed(0, weight, s, t));
 }
 
-Float PathSampler::generateSeeds(size_t sampleCount, size_t seedCount,
-        bool fineGrained, const Bitmap *importanceMap, std::vector<PathSeed> &seeds) {
-    Log(EInfo, "Integrating luminance values over the image plane ("
-            SIZE_T_FMT " samples)..", sampleCount);
-
+void PathSampler::sampleSeedCandidates(size_t sampleCount, bool fineGrained,
+        const Bitmap *importanceMap, std::vector<PathSeed> *candidates,
+        double &mean, double &m2) {
     BDAssert(m_sensorSampler == m_emitterSampler);
     BDAssert(m_sensorSampler->getClass()->derivesFrom(MTS_CLASS(ReplayableSampler)));
+    ReplayableSampler *rplSampler = static_cast<ReplayableSampler *>(m_sensorSampler.get());
 
-    ref<Timer> timer = new Timer();
     std::vector<PathSeed> tempSeeds;
-    tempSeeds.reserve(sampleCount);
+    if (!candidates)
+        candidates = &tempSeeds;
 
     SplatList splatList;
     Float luminance;
     PathCallback callback = boost::bind(&seedCallback,
-        boost::ref(tempSeeds), importanceMap, boost::ref(luminance),
+        boost::ref(*candidates), importanceMap, boost::ref(luminance),
         _1, _2, _3, _4);
 
-    Float mean = 0.0f, variance = 0.0f;
+    mean = m2 = 0;
     for (size_t i=0; i<sampleCount; ++i) {
-        size_t seedIndex = tempSeeds.size();
-        size_t sampleIndex = m_sensorSampler->getSampleIndex();
+        size_t seedIndex = candidates->size();
+        size_t sampleIndex = rplSampler->getSampleIndex();
         luminance = 0.0f;
 
         if (fineGrained) {
@@ -626,8 +654,10 @@ Float PathSampler::generateSeeds(size_t sampleCount, size_t seedCount,
 
             /* Fine seed granularity (e.g. for Veach-MLT).
                Set the correct the sample index value */
-            for (size_t j = seedIndex; j<tempSeeds.size(); ++j)
-                tempSeeds[j].sampleIndex = sampleIndex;
+            for (size_t j = seedIndex; j<candidates->size(); ++j) {
+                (*candidates)[j].sampleIndex = sampleIndex;
+                (*candidates)[j].sequence = rplSampler->getSequence();
+            }
         } else {
             /* Run the path sampling strategy */
             sampleSplats(Point2i(-1), splatList);
@@ -636,42 +666,463 @@ Float PathSampler::generateSeeds(size_t sampleCount, size_t seedCount,
 
             /* Coarse seed granularity (e.g. for PSSMLT) */
             if (luminance != 0)
-                tempSeeds.push_back(PathSeed(sampleIndex, luminance));
+                candidates->push_back(PathSeed(sampleIndex, luminance,
+                    0, 0, rplSampler->getSequence()));
         }
 
         /* Numerically robust online variance estimation using an
            algorithm proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232) */
-        Float delta = luminance - mean;
-        mean += delta / (Float) (i+1);
-        variance += delta * (luminance - mean);
+        double delta = luminance - mean;
+        mean += delta / (double) (i+1);
+        m2 += delta * (luminance - mean);
+
+        if (candidates == &tempSeeds)
+            tempSeeds.clear();
     }
     BDAssert(m_pool.unused());
-    Float stddev = std::sqrt(variance / (sampleCount-1));
-
-    Log(EInfo, "Done -- average luminance value = %f, stddev = %f (took %i ms)",
-            mean, stddev, timer->getMilliseconds());
-
-    if (mean == 0)
-        Log(EError, "The average image luminance appears to be zero! This could indicate "
-            "a problem with the scene setup. Aborting the MLT rendering process.");
+}
 
+void PathSampler::resampleSeeds(const std::vector<PathSeed> &candidates,
+        size_t seedCount, std::vector<PathSeed> &seeds) {
     Log(EDebug, "Sampling " SIZE_T_FMT "/" SIZE_T_FMT " MLT seeds",
-        seedCount, tempSeeds.size());
+        seedCount, candidates.size());
 
-    DiscreteDistribution seedPDF(tempSeeds.size());
-    for (size_t i=0; i<tempSeeds.size(); ++i)
-        seedPDF.append(tempSeeds[i].luminance);
+    DiscreteDistribution seedPDF(candidates.size());
+    for (size_t i=0; i<candidates.size(); ++i)
+        seedPDF.append(candidates[i].luminance);
     seedPDF.normalize();
 
     seeds.clear();
     seeds.reserve(seedCount);
     for (size_t i=0; i<seedCount; ++i)
-        seeds.push_back(tempSeeds.at(seedPDF.sample(m_sensorSampler->next1D())));
+        seeds.push_back(candidates.at(seedPDF.sample(m_sensorSampler->next1D())));
 
     /* Sort the seeds to avoid unnecessary rewinds in the ReplayableSampler */
     std::sort(seeds.begin(), seeds.end(), PathSeedSortPredicate());
+}
 
-    return mean;
+Float PathSampler::generateSeeds(size_t sampleCount, size_t seedCount,
+        bool fineGrained, const Bitmap *importanceMap, std::vector<PathSeed> &seeds) {
+    Log(EInfo, "Integrating luminance values over the image plane ("
+            SIZE_T_FMT " samples)..", sampleCount);
+
+    ref<Timer> timer = new Timer();
+    std::vector<PathSeed> tempSeeds;
+    tempSeeds.reserve(sampleCount);
+
+    double mean, m2;
+    sampleSeedCandidates(sampleCount, fineGrained, importanceMap,
+        &tempSeeds, mean, m2);
+    Float stddev = (Float) std::sqrt(m2 / (sampleCount-1));
+
+    Log(EInfo, "Done -- average luminance value = %f, stddev = %f (took %i ms)",
+            mean, stddev, timer->getMilliseconds());
+
+    if (mean == 0)
+        Log(EError, "The average image luminance appears to be zero! This could indicate "
+            "a problem with the scene setup. Aborting the MLT rendering process.");
+
+    resampleSeeds(tempSeeds, seedCount, seeds);
+
+    return (Float) mean;
+}
+
+/**
+ * \brief Stores the candidate seeds and luminance statistics
+ * of one work unit of the parallel bootstrap
+ */
+class PathSeedVector : public WorkResult {
+public:
+    std::vector<PathSeed> seeds;
+    uint32_t sequence;
+    size_t sampleCount;
+    double mean, m2;
+
+    void load(Stream *stream) {
+        sequence = stream->readUInt();
+        sampleCount = stream->readSize();
+        mean = stream->readDouble();
+        m2 = stream->readDouble();
+        seeds.resize(stream->readSize());
+        for (size_t i=0; i<seeds.size(); ++i)
+            seeds[i] = PathSeed(stream);
+    }
+
+    void save(Stream *stream) const {
+        stream->writeUInt(sequence);
+        stream->writeSize(sampleCount);
+        stream->writeDouble(mean);
+        stream->writeDouble(m2);
+        stream->writeSize(seeds.size());
+        for (size_t i=0; i<seeds.size(); ++i)
+            seeds[i].serialize(stream);
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "PathSeedVector[sequence=" << sequence
+            << ", sampleCount=" << sampleCount
+            << ", seeds=" << seeds.size() << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~PathSeedVector() { }
+};
+
+/// Parameters of the path sampler that are needed by the bootstrap workers
+struct PathSeedConfig {
+    PathSampler::ETechnique technique;
+    int maxDepth, rrDepth;
+    bool excludeDirectIllum, sampleDirect, lightImage;
+    bool fineGrained, collectSeeds;
+
+    inline PathSeedConfig() { }
+
+    inline PathSeedConfig(Stream *stream) {
+        technique = (PathSampler::ETechnique) stream->readInt();
+        maxDepth = stream->readInt();
+        rrDepth = stream->readInt();
+        excludeDirectIllum = stream->readBool();
+        sampleDirect = stream->readBool();
+        lightImage = stream->readBool();
+        fineGrained = stream->readBool();
+        collectSeeds = stream->readBool();
+    }
+
+    void serialize(Stream *stream) const {
+        stream->writeInt((int) technique);
+        stream->writeInt(maxDepth);
+        stream->writeInt(rrDepth);
+        stream->writeBool(excludeDirectIllum);
+        stream->writeBool(sampleDirect);
+        stream->writeBool(lightImage);
+        stream->writeBool(fineGrained);
+        stream->writeBool(collectSeeds);
+    }
+};
+
+/* Parallel MLT bootstrap (worker) */
+class PathSeedWorker : public WorkProcessor {
+public:
+    PathSeedWorker(const PathSeedConfig &config, const Bitmap *importanceMap)
+        : m_config(config), m_importanceMap(importanceMap) { }
+
+    PathSeedWorker(Stream *stream, InstanceManager *manager) {
+        m_config = PathSeedConfig(stream);
+        if (stream->readBool()) {
+            ref<Bitmap> importanceMap = new Bitmap(Bitmap::ELuminance,
+                Bitmap::EFloat, Vector2i(stream));
+            stream->readFloatArray(importanceMap->getFloatData(),
+                importanceMap->getPixelCount());
+            m_importanceMap = importanceMap;
+        }
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        m_config.serialize(stream);
+        const Bitmap *importanceMap = m_importanceMap.get();
+        stream->writeBool(importanceMap != NULL);
+        if (importanceMap) {
+            importanceMap->getSize().serialize(stream);
+            stream->writeFloatArray(importanceMap->getFloatData(),
+                importanceMap->getPixelCount());
+        }
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RangeWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new PathSeedVector();
+    }
+
+    void prepare() {
+        Scene *scene = static_cast<Scene *>(getResource("scene"));
+        scene->wakeup(NULL, m_resources);
+        m_rplSampler = static_cast<ReplayableSampler *>(
+            static_cast<Sampler *>(getResource("rplSampler"))->clone().get());
+        m_pathSampler = new PathSampler(m_config.technique, scene,
+            m_rplSampler, m_rplSampler, m_rplSampler, m_config.maxDepth,
+            m_config.rrDepth, m_config.excludeDirectIllum,
+            m_config.sampleDirect, m_config.lightImage);
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+        PathSeedVector *result = static_cast<PathSeedVector *>(workResult);
+
+        /* Sequence 0 is reserved for the serial implementation */
+        result->sequence = (uint32_t) (range->getRangeStart()
+            / PATHSEED_GRANULARITY) + 1;
+        result->sampleCount = range->getSize();
+        result->seeds.clear();
+
+        m_rplSampler->setSequence(result->sequence);
+        m_rplSampler->setSampleIndex(0);
+        m_pathSampler->sampleSeedCandidates(result->sampleCount,
+            m_config.fineGrained, m_importanceMap.get(),
+            m_config.collectSeeds ? &result->seeds : NULL,
+            result->mean, result->m2);
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new PathSeedWorker(m_config, m_importanceMap.get());
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~PathSeedWorker() { }
+private:
+    PathSeedConfig m_config;
+    ref<const Bitmap> m_importanceMap;
+    ref<ReplayableSampler> m_rplSampler;
+    ref<PathSampler> m_pathSampler;
+};
+
+/* Parallel MLT bootstrap (work distribution) */
+class PathSeedProcess : public ParallelProcess {
+public:
+    PathSeedProcess(const PathSeedConfig &config, const Bitmap *importanceMap,
+            size_t sampleCount) : m_config(config), m_importanceMap(importanceMap),
+            m_sampleCount(sampleCount), m_workUnits(0), m_finished(0) {
+        m_resultMutex = new Mutex();
+        m_results.resize((sampleCount + PATHSEED_GRANULARITY - 1)
+            / PATHSEED_GRANULARITY);
+        m_progress = new ProgressReporter("Bootstrapping", sampleCount, NULL);
+    }
+
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new PathSeedWorker(m_config, m_importanceMap.get());
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        size_t start = m_workUnits * PATHSEED_GRANULARITY;
+        if (start >= m_sampleCount)
+            return EFailure;
+        size_t end = std::min(start + PATHSEED_GRANULARITY, m_sampleCount) - 1;
+        static_cast<RangeWorkUnit *>(unit)->setRange(start, end);
+        ++m_workUnits;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *wr, bool cancelled) {
+        if (cancelled)
+            return;
+        const PathSeedVector *result = static_cast<const PathSeedVector *>(wr);
+        LockGuard lock(m_resultMutex);
+        PathSeedVector *copy = new PathSeedVector();
+        copy->sequence = result->sequence;
+        copy->sampleCount = result->sampleCount;
+        copy->mean = result->mean;
+        copy->m2 = result->m2;
+        copy->seeds = result->seeds;
+        m_results.at(result->sequence - 1) = copy;
+        m_finished += result->sampleCount;
+        m_progress->update(m_finished);
+    }
+
+    /**
+     * \brief Merge the results of all work units (in a deterministic order)
+     *
+     * The luminance statistics are combined using the pairwise update
+     * by Chan et al.
+     */
+    void merge(std::vector<PathSeed> &candidates, double &mean, double &m2) const {
+        size_t n = 0;
+        mean = m2 = 0;
+        for (size_t i=0; i<m_results.size(); ++i) {
+            const PathSeedVector *result = m_results[i].get();
+            if (!result)
+                continue;
+            size_t nb = result->sampleCount, nab = n + nb;
+            double delta = result->mean - mean;
+            mean += delta * nb / nab;
+            m2 += result->m2 + delta * delta * ((double) n * nb / nab);
+            n = nab;
+            candidates.insert(candidates.end(),
+                result->seeds.begin(), result->seeds.end());
+        }
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~PathSeedProcess() {
+        delete m_progress;
+    }
+private:
+    PathSeedConfig m_config;
+    ref<const Bitmap> m_importanceMap;
+    ref_vector<PathSeedVector> m_results;
+    ref<Mutex> m_resultMutex;
+    ProgressReporter *m_progress;
+    size_t m_sampleCount, m_workUnits, m_finished;
+};
+
+/**
+ * \brief Key that identifies the configuration of a seed file
+ *
+ * Scene changes are not detected, hence this only guards against
+ * accidentally reusing a file with different sampling parameters.
+ */
+static std::vector<uint8_t> seedFileKey(const Scene *scene,
+        const PathSeedConfig &config, size_t sampleCount, size_t seedCount) {
+    ref<MemoryStream> mstream = new MemoryStream();
+    mstream->writeInt(SPECTRUM_SAMPLES);
+    mstream->writeInt((int) sizeof(Float));
+    config.serialize(mstream);
+    mstream->writeSize(sampleCount);
+    mstream->writeSize(seedCount);
+    const Film *film = scene->getSensor()->getFilm();
+    film->getSize().serialize(mstream);
+    film->getCropSize().serialize(mstream);
+    film->getCropOffset().serialize(mstream);
+    return std::vector<uint8_t>(mstream->getData(),
+        mstream->getData() + mstream->getSize());
+}
+
+Float PathSampler::generateSeeds(int sceneResID, size_t sampleCount,
+        size_t seedCount, bool fineGrained, const Bitmap *importanceMap,
+        std::vector<PathSeed> &seeds, const fs::path &seedFile) {
+    BDAssert(m_sensorSampler == m_emitterSampler);
+    BDAssert(m_sensorSampler->getClass()->derivesFrom(MTS_CLASS(ReplayableSampler)));
+    ReplayableSampler *rplSampler = static_cast<ReplayableSampler *>(m_sensorSampler.get());
+
+    PathSeedConfig config;
+    config.technique = m_technique;
+    config.maxDepth = m_maxDepth;
+    config.rrDepth = m_rrDepth;
+    config.excludeDirectIllum = m_excludeDirectIllum;
+    config.sampleDirect = m_sampleDirect;
+    config.lightImage = m_lightImage;
+    config.fineGrained = fineGrained;
+    config.collectSeeds = seedCount > 0;
+
+    bool useFile = !seedFile.empty();
+    if (useFile && importanceMap) {
+        Log(EWarn, "Seed files are not supported by two-stage MLT, ignoring \"%s\"",
+            seedFile.string().c_str());
+        useFile = false;
+    }
+
+    std::vector<uint8_t> key;
+    if (useFile)
+        key = seedFileKey(m_scene, config, sampleCount, seedCount);
+
+    if (useFile && fs::exists(seedFile)) {
+        try {
+            ref<FileStream> fs = new FileStream(seedFile, FileStream::EReadOnly);
+            char identifier[4];
+            fs->read(identifier, 4);
+            std::vector<uint8_t> fileKey;
+            if (memcmp(identifier, "SEED", 4) == 0
+                    && fs->readUInt() == PATHSEED_FILE_VERSION) {
+                fileKey.resize(fs->readSize());
+                if (!fileKey.empty())
+                    fs->read(&fileKey[0], fileKey.size());
+            }
+
+            if (fileKey == key) {
+                Float mean = fs->readFloat();
+                seeds.resize(fs->readSize());
+                for (size_t i=0; i<seeds.size(); ++i)
+                    seeds[i] = PathSeed(fs);
+                ref<InstanceManager> manager = new InstanceManager();
+                ref<Random> initial = static_cast<Random *>(manager->getInstance(fs));
+                rplSampler->setInitialState(initial);
+
+                Log(EInfo, "Loaded " SIZE_T_FMT " MLT seeds from \"%s\" -- "
+                    "average luminance value = %f", seeds.size(),
+                    seedFile.filename().string().c_str(), mean);
+                return mean;
+            }
+            Log(EInfo, "The seed file \"%s\" was created using a different "
+                "configuration and will be regenerated",
+                seedFile.filename().string().c_str());
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Could not read the seed file \"%s\": %s",
+                seedFile.string().c_str(), ex.what());
+        }
+    }
+
+    Log(EInfo, "Integrating luminance values over the image plane ("
+            SIZE_T_FMT " samples)..", sampleCount);
+
+    ref<Timer> timer = new Timer();
+    ref<Scheduler> scheduler = Scheduler::getInstance();
+    ref<PathSeedProcess> process = new PathSeedProcess(config,
+        importanceMap, sampleCount);
+    int rplSamplerResID = scheduler->registerResource(rplSampler);
+    process->bindResource("scene", sceneResID);
+    process->bindResource("rplSampler", rplSamplerResID);
+    scheduler->schedule(process);
+    scheduler->wait(process);
+    scheduler->unregisterResource(rplSamplerResID);
+
+    if (process->getReturnStatus() != ParallelProcess::ESuccess)
+        Log(EError, "The MLT bootstrap process did not complete successfully!");
+
+    std::vector<PathSeed> candidates;
+    double mean, m2;
+    process->merge(candidates, mean, m2);
+    Float stddev = (Float) std::sqrt(m2 / (sampleCount-1));
+
+    Log(EInfo, "Done -- average luminance value = %f, stddev = %f (took %i ms)",
+            mean, stddev, timer->getMilliseconds());
+
+    if (mean == 0)
+        Log(EError, "The average image luminance appears to be zero! This could indicate "
+            "a problem with the scene setup. Aborting the rendering process.");
+
+    if (seedCount > 0)
+        resampleSeeds(candidates, seedCount, seeds);
+    else
+        seeds.clear();
+
+    if (useFile) {
+        fs::path tmpPath = seedFile.parent_path() / (seedFile.filename().string()
+            + "." + fs::unique_path().string());
+        try {
+            ref<FileStream> fs = new FileStream(tmpPath, FileStream::ETruncWrite);
+            fs->write("SEED", 4);
+            fs->writeUInt(PATHSEED_FILE_VERSION);
+            fs->writeSize(key.size());
+            fs->write(&key[0], key.size());
+            fs->writeFloat((Float) mean);
+            fs->writeSize(seeds.size());
+            for (size_t i=0; i<seeds.size(); ++i)
+                seeds[i].serialize(fs);
+            ref<InstanceManager> manager = new InstanceManager();
+            manager->serialize(fs, rplSampler->getInitialState());
+            fs->close();
+            fs::rename(tmpPath, seedFile);
+            Log(EInfo, "Wrote " SIZE_T_FMT " MLT seeds to \"%s\"",
+                seeds.size(), seedFile.filename().string().c_str());
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Could not write the seed file \"%s\": %s",
+                seedFile.string().c_str(), ex.what());
+            boost::system::error_code ec;
+            fs::remove(tmpPath, ec);
+        }
+    }
+
+    return (Float) mean;
+}
+
+Float PathSampler::computeAverageLuminance(int sceneResID, size_t sampleCount,
+        const fs::path &seedFile) {
+    /* The workers replay a random number stream, even though
+       no seeds are recorded in this case */
+    ref<ReplayableSampler> rplSampler = new ReplayableSampler();
+    ref<PathSampler> pathSampler = new PathSampler(m_technique, m_scene,
+        rplSampler, rplSampler, rplSampler, m_maxDepth, m_rrDepth,
+        m_excludeDirectIllum, m_sampleDirect, m_lightImage);
+    std::vector<PathSeed> seeds;
+    return pathSampler->generateSeeds(sceneResID, sampleCount, 0, false,
+        NULL, seeds, seedFile);
 }
 
 static void reconstructCallback(const PathSeed &seed, const Bitmap *importanceMap,
@@ -701,6 +1152,7 @@ void PathSampler::reconstructPath(const PathSeed &seed, const Bitmap *importance
 
     /* Generate the initial sample by replaying the seeding random
        number stream at the appropriate position. */
+    rplSampler->setSequence(seed.sequence);
     rplSampler->setSampleIndex(seed.sampleIndex);
 
     PathCallback callback = boost::bind(&reconstructCallback,
@@ -761,4 +1213,7 @@ std::string SplatList::toString() const {
 
 MTS_IMPLEMENT_CLASS(PathSampler, false, Object)
 MTS_IMPLEMENT_CLASS(SeedWorkUnit, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(PathSeedVector, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(PathSeedWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(PathSeedProcess, false, ParallelProcess)
 MTS_NAMESPACE_END
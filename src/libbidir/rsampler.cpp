@@ -24,6 +24,8 @@ ReplayableSampler::ReplayableSampler() : Sampler(Properties()) {
     m_initial = new Random();
     m_random = new Random();
     m_random->set(m_initial);
+    m_start = m_initial;
+    m_sequence = 0;
     m_sampleCount = 0;
     m_sampleIndex = 0;
 }
@@ -33,6 +35,8 @@ ReplayableSampler::ReplayableSampler(Stream *stream, InstanceManager *manager)
     m_initial = static_cast<Random *>(manager->getInstance(stream));
     m_random = new Random();
     m_random->set(m_initial);
+    m_start = m_initial;
+    m_sequence = 0;
     m_sampleCount = 0;
     m_sampleIndex = 0;
 }
@@ -51,6 +55,11 @@ ref<Sampler> ReplayableSampler::clone() {
     sampler->m_sampleIndex = m_sampleIndex;
     sampler->m_initial->set(m_initial);
     sampler->m_random->set(m_random);
+    sampler->m_sequence = m_sequence;
+    if (m_sequence != 0) {
+        sampler->m_start = new Random();
+        sampler->m_start->set(m_start);
+    }
     return sampler.get();
 }
 
@@ -65,11 +74,40 @@ void ReplayableSampler::request2DArray(size_t size) {
 void ReplayableSampler::generate(const Point2i &) { }
 void ReplayableSampler::advance() { }
 
-void ReplayableSampler::setSampleIndex(size_t sampleIndex) {
-    if (sampleIndex < m_sampleIndex) {
-        m_sampleIndex = 0;
-        m_random->set(m_initial);
+void ReplayableSampler::rewind() {
+    m_sampleIndex = 0;
+    m_random->set(m_start);
+}
+
+void ReplayableSampler::setSequence(uint32_t sequence) {
+    if (sequence == m_sequence)
+        return;
+    m_sequence = sequence;
+    resetSequence();
+}
+
+void ReplayableSampler::resetSequence() {
+    if (m_sequence == 0) {
+        m_start = m_initial;
+    } else {
+        /* Seed the sequence using the first value of the initial state */
+        ref<Random> temp = new Random();
+        temp->set(m_initial);
+        uint64_t values[2] = { temp->nextULong(), (uint64_t) m_sequence };
+        temp->seed(values, 2);
+        m_start = temp;
     }
+    rewind();
+}
+
+void ReplayableSampler::setInitialState(Random *random) {
+    m_initial->set(random);
+    resetSequence();
+}
+
+void ReplayableSampler::setSampleIndex(size_t sampleIndex) {
+    if (sampleIndex < m_sampleIndex)
+        rewind();
 
     while (m_sampleIndex != sampleIndex) {
         m_random->nextFloat();
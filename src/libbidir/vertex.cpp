@@ -191,13 +191,19 @@ bool PathVertex::sampleNext(const Scene *scene, Sampler *sampler,
 
                 /* Compute the reverse quantities */
                 bRec.reverse();
-                pdf[1-mode] = bsdf->pdf(bRec, (EMeasure) measure);
+                bool symmetric = !(bsdf->getType() & BSDF::ENonSymmetric);
+                Spectrum reverseValue;
+                if (symmetric)
+                    pdf[1-mode] = bsdf->pdf(bRec, (EMeasure) measure);
+                else
+                    reverseValue = bsdf->evalWithPdf(bRec, pdf[1-mode], (EMeasure) measure);
+
                 if (pdf[1-mode] <= RCPOVERFLOW) {
                     /* This can happen rarely due to roundoff errors -- be strict */
                     return false;
                 }
 
-                if (!(bsdf->getType() & BSDF::ENonSymmetric)) {
+                if (symmetric) {
                     /* Make use of symmetry -- no need to re-evaluate
                        everything (only the pdf and cosine factors changed) */
                     weight[1-mode] = weight[mode] * (pdf[mode] / pdf[1-mode]);
@@ -205,7 +211,7 @@ bool PathVertex::sampleNext(const Scene *scene, Sampler *sampler,
                         weight[1-mode] *=
                             std::abs(Frame::cosTheta(bRec.wo) / Frame::cosTheta(bRec.wi));
                 } else {
-                    weight[1-mode] = bsdf->eval(bRec, (EMeasure) measure) / pdf[1-mode];
+                    weight[1-mode] = reverseValue / pdf[1-mode];
                 }
                 bRec.reverse();
 
@@ -553,8 +559,8 @@ bool PathVertex::perturbDirection(const Scene *scene, const PathVertex *pred,
 
                 BSDFSamplingRecord bRec(its, its.toLocal(wi), its.toLocal(wo), mode);
 
-                Spectrum value = bsdf->eval(bRec);
-                Float prob = bsdf->pdf(bRec);
+                Float prob;
+                Spectrum value = bsdf->evalWithPdf(bRec, prob);
 
                 if (value.isZero() || prob <= RCPOVERFLOW)
                     return false;
@@ -591,19 +597,25 @@ bool PathVertex::perturbDirection(const Scene *scene, const PathVertex *pred,
 
                 /* Compute the reverse quantities */
                 bRec.reverse();
-                pdf[1-mode] = bsdf->pdf(bRec, ESolidAngle);
+                bool symmetric = !(bsdf->getType() & BSDF::ENonSymmetric);
+                Spectrum reverseValue;
+                if (symmetric)
+                    pdf[1-mode] = bsdf->pdf(bRec, ESolidAngle);
+                else
+                    reverseValue = bsdf->evalWithPdf(bRec, pdf[1-mode], ESolidAngle);
+
                 if (pdf[1-mode] <= RCPOVERFLOW) {
                     /* This can happen rarely due to roundoff errors -- be strict */
                     return false;
                 }
-                if (!(bsdf->getType() & BSDF::ENonSymmetric)) {
+                if (symmetric) {
                     /* Make use of symmetry -- no need to re-evaluate
                        everything (only the pdf and cosine factors changed) */
                     weight[1-mode] = weight[mode] * std::abs(
                         (pdf[mode] * Frame::cosTheta(bRec.wo)) /
                         (pdf[1-mode] * Frame::cosTheta(bRec.wi)));
                 } else {
-                    weight[1-mode] = bsdf->eval(bRec, ESolidAngle) / pdf[1-mode];
+                    weight[1-mode] = reverseValue / pdf[1-mode];
                 }
                 bRec.reverse();
 
@@ -709,14 +721,15 @@ bool PathVertex::propagatePerturbation(const Scene *scene, const PathVertex *pre
         return false;
 
     bRec.typeMask = BSDF::EAll;
-    Float prob = bsdf->pdf(bRec, EDiscrete);
+    Float prob;
+    Spectrum value = bsdf->evalWithPdf(bRec, prob, EDiscrete);
     if (prob <= RCPOVERFLOW) {
         SLog(EWarn, "Unable to recreate specular vertex in perturbation (bsdf=%s)",
             bsdf->toString().c_str());
         return false;
     }
 
-    weight[mode] = bsdf->eval(bRec, EDiscrete) / prob;
+    weight[mode] = value / prob;
     pdf[mode] = prob;
     measure = EDiscrete;
     componentType = componentType_;
@@ -1101,6 +1114,7 @@ Float PathVertex::evalPdfDirect(const Scene *scene,
     dRec.uv = pRec.uv;
     dRec.measure = measure;
     dRec.object = pRec.object;
+    dRec.primIndex = pRec.primIndex;
     dRec.d = sample->getPosition() - getPosition();
     dRec.dist = dRec.d.length();
     dRec.d /= dRec.dist;
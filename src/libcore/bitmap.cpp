@@ -20,6 +20,7 @@
 #include <mitsuba/core/version.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/core/thread.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/scoped_array.hpp>
 #include <boost/thread/mutex.hpp>
@@ -381,6 +382,75 @@ void Bitmap::write(EFileFormat format, const fs::path &path, int compression) co
     write(format, fs, compression);
 }
 
+/// Background thread used by Bitmap::writeAsync()
+class BitmapWriteThread : public Thread {
+public:
+    BitmapWriteThread(const Bitmap *bitmap, Bitmap::EFileFormat format,
+            const fs::path &filename, int compression, Thread *predecessor)
+        : Thread("bwrite"), m_bitmap(bitmap), m_format(format), m_filename(filename),
+          m_compression(compression), m_predecessor(predecessor) { }
+
+    void run() {
+        if (m_predecessor) {
+            m_predecessor->join();
+            m_predecessor = NULL;
+        }
+        try {
+            m_bitmap->write(m_format, m_filename, m_compression);
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Unable to write \"%s\": %s", m_filename.string().c_str(), ex.what());
+        }
+        m_bitmap = NULL;
+    }
+
+    inline const fs::path &getFilename() const { return m_filename; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~BitmapWriteThread() { }
+private:
+    ref<const Bitmap> m_bitmap;
+    Bitmap::EFileFormat m_format;
+    fs::path m_filename;
+    int m_compression;
+    ref<Thread> m_predecessor;
+};
+
+static boost::mutex __asyncWriteMutex;
+static std::vector<ref<BitmapWriteThread> > __asyncWrites;
+
+void Bitmap::writeAsync(EFileFormat format, const fs::path &path, int compression) const {
+    boost::mutex::scoped_lock guard(__asyncWriteMutex);
+
+    /* Forget about finished writes, and find the most recent one targeting this file */
+    Thread *predecessor = NULL;
+    for (size_t i=0; i<__asyncWrites.size(); ) {
+        if (!__asyncWrites[i]->isRunning()) {
+            __asyncWrites[i]->join();
+            __asyncWrites.erase(__asyncWrites.begin() + i);
+            continue;
+        }
+        if (__asyncWrites[i]->getFilename() == path)
+            predecessor = __asyncWrites[i];
+        ++i;
+    }
+
+    ref<BitmapWriteThread> thread = new BitmapWriteThread(
+        this, format, path, compression, predecessor);
+    thread->start();
+    __asyncWrites.push_back(thread);
+}
+
+void Bitmap::waitAsyncWrites() {
+    std::vector<ref<BitmapWriteThread> > writes;
+    {
+        boost::mutex::scoped_lock guard(__asyncWriteMutex);
+        writes.swap(__asyncWrites);
+    }
+    for (size_t i=0; i<writes.size(); ++i)
+        writes[i]->join();
+}
+
 void Bitmap::write(EFileFormat format, Stream *stream, int compression) const {
     switch (format) {
         case EJPEG:
@@ -443,6 +513,18 @@ void Bitmap::setChannelNames(const std::vector<std::string> &names) {
     m_channelNames = names;
 }
 
+void Bitmap::setChannelFormats(const std::vector<EComponentFormat> &formats) {
+    if (!formats.empty() && formats.size() != m_channelCount)
+        Log(EError, "setChannelFormats(): tried to set %i channel formats for an image with %i channels!",
+            (int) formats.size(), m_channelCount);
+    for (size_t i=0; i<formats.size(); ++i) {
+        if (formats[i] != EFloat16 && formats[i] != EFloat32 && formats[i] != EUInt32)
+            Log(EError, "setChannelFormats(): invalid component format (must be "
+                "float16, float32, or uint32)");
+    }
+    m_channelFormats = formats;
+}
+
 void Bitmap::updateChannelCount() {
     switch (m_pixelFormat) {
         case ELuminance: m_channelCount = 1; break;
@@ -509,6 +591,7 @@ ref<Bitmap> Bitmap::clone() const {
     bitmap->m_metadata = m_metadata;
     bitmap->m_gamma = m_gamma;
     bitmap->m_channelNames = m_channelNames;
+    bitmap->m_channelFormats = m_channelFormats;
     return bitmap;
 }
 
@@ -1532,6 +1615,45 @@ Spectrum Bitmap::getPixel(const Point2i &pos) const {
     return result;
 }
 
+/// Minimum number of pixels per chunk of a parallel format conversion
+#define MTS_BITMAP_CONVERSION_CHUNK (64*1024)
+
+/// Convert a range of rows of \c source into the same rows of \c target
+static inline void convertRows(const FormatConverter *cvt, const Bitmap *source,
+        Bitmap *target, int y0, int rows, Float multiplier,
+        Spectrum::EConversionIntent intent) {
+    size_t offset = (size_t) y0 * (size_t) source->getWidth();
+    cvt->convert(source->getPixelFormat(), source->getGamma(),
+        source->getUInt8Data() + offset * source->getBytesPerPixel(),
+        target->getPixelFormat(), target->getGamma(),
+        target->getUInt8Data() + offset * target->getBytesPerPixel(),
+        (size_t) rows * (size_t) source->getWidth(), multiplier, intent,
+        source->getChannelCount());
+}
+
+/// Run a format conversion in parallel over chunks of rows
+static void convertParallel(const FormatConverter *cvt, const Bitmap *source,
+        Bitmap *target, Float multiplier, Spectrum::EConversionIntent intent) {
+    int height = source->getHeight(),
+        rowsPerChunk = std::max(1, MTS_BITMAP_CONVERSION_CHUNK
+            / std::max(1, source->getWidth())),
+        chunks = (height + rowsPerChunk - 1) / rowsPerChunk;
+
+    /* Convert the first chunk on the calling thread, so that unsupported
+       conversions are reported there and not within an OpenMP thread */
+    convertRows(cvt, source, target, 0, std::min(rowsPerChunk, height),
+        multiplier, intent);
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=1; i<chunks; ++i) {
+        int y0 = i * rowsPerChunk;
+        convertRows(cvt, source, target, y0, std::min(rowsPerChunk,
+            height - y0), multiplier, intent);
+    }
+}
+
 void Bitmap::convert(Bitmap *target, Float multiplier, Spectrum::EConversionIntent intent) const {
     if (m_componentFormat == EBitmask || target->getComponentFormat() == EBitmask)
         Log(EError, "Conversions involving bitmasks are currently not supported!");
@@ -1552,10 +1674,7 @@ void Bitmap::convert(Bitmap *target, Float multiplier, Spectrum::EConversionInte
 
     Assert(cvt != NULL);
 
-    cvt->convert(m_pixelFormat, m_gamma, m_data,
-        target->getPixelFormat(), target->getGamma(), target->getData(),
-        (size_t) m_size.x * (size_t) m_size.y, multiplier, intent,
-        m_channelCount);
+    convertParallel(cvt, this, target, multiplier, intent);
 }
 
 ref<Bitmap> Bitmap::convert(EPixelFormat pixelFormat,
@@ -1584,10 +1703,7 @@ ref<Bitmap> Bitmap::convert(EPixelFormat pixelFormat,
         target->setChannelNames(m_channelNames);
     target->setGamma(gamma);
 
-    cvt->convert(m_pixelFormat, m_gamma, m_data,
-        pixelFormat, gamma, target->getData(),
-        (size_t) m_size.x * (size_t) m_size.y, multiplier, intent,
-        m_channelCount);
+    convertParallel(cvt, this, target, multiplier, intent);
 
     return target;
 }
@@ -3263,8 +3379,14 @@ void Bitmap::writeOpenEXR(Stream *stream) const {
     bool explicitChannelNames = false;
     Imf::ChannelList &channels = header.channels();
     if (m_channelNames.size() == (size_t) getChannelCount()) {
-        for (size_t i=0; i<m_channelNames.size(); ++i)
-            channels.insert(m_channelNames[i].c_str(), Imf::Channel(compType));
+        bool explicitChannelFormats = m_channelFormats.size() == m_channelNames.size();
+        for (size_t i=0; i<m_channelNames.size(); ++i) {
+            Imf::PixelType type = compType;
+            if (explicitChannelFormats) /* OpenEXR converts from 'compType' */
+                type = m_channelFormats[i] == EFloat16 ? Imf::HALF :
+                    (m_channelFormats[i] == EUInt32 ? Imf::UINT : Imf::FLOAT);
+            channels.insert(m_channelNames[i].c_str(), Imf::Channel(type));
+        }
         explicitChannelNames = true;
     } else if (pixelFormat == ELuminance || pixelFormat == ELuminanceAlpha) {
         channels.insert("Y", Imf::Channel(compType));
@@ -3922,6 +4044,9 @@ void Bitmap::staticInitialization() {
 }
 
 void Bitmap::staticShutdown() {
+    /* Don't lose images that are still being written */
+    waitAsyncWrites();
+
     FormatConverter::staticShutdown();
 
 #if defined(MTS_HAS_FFTW)
@@ -4031,5 +4156,6 @@ std::ostream &operator<<(std::ostream &os, const Bitmap::EComponentFormat &value
     return os;
 }
 
+MTS_IMPLEMENT_CLASS(BitmapWriteThread, false, Thread)
 MTS_IMPLEMENT_CLASS(Bitmap, false, Object)
 MTS_NAMESPACE_END
@@ -87,6 +87,17 @@ void ChiSquare::dumpTables(const fs::path &filename) {
     out.close();
 }
 
+/// Return the index of the contingency table bin containing \c direction
+static inline int getBin(const Vector &direction, const Point2 &factor,
+        int thetaBins, int phiBins) {
+    Point2 sphCoords = toSphericalCoordinates(direction);
+    int thetaBin = std::min(std::max(0,
+        math::floorToInt(sphCoords.x * factor.x)), thetaBins-1);
+    int phiBin = std::min(std::max(0,
+        math::floorToInt(sphCoords.y * factor.y)), phiBins-1);
+    return thetaBin * phiBins + phiBin;
+}
+
 void ChiSquare::fill(
     const boost::function<boost::tuple<Vector, Float, EMeasure>()> &sampleFn,
     const boost::function<Float (const Vector &, EMeasure measure)> &pdfFn) {
@@ -102,62 +113,123 @@ void ChiSquare::fill(
     ref<Timer> timer = new Timer();
     for (size_t i=0; i<m_sampleCount; ++i) {
         boost::tuple<Vector, Float, EMeasure> sample = sampleFn();
-        Point2 sphCoords = toSphericalCoordinates(boost::get<0>(sample));
-
-        int thetaBin = std::min(std::max(0,
-            math::floorToInt(sphCoords.x * factor.x)), m_thetaBins-1);
-        int phiBin = std::min(std::max(0,
-            math::floorToInt(sphCoords.y * factor.y)), m_phiBins-1);
-        m_table[thetaBin * m_phiBins + phiBin] += boost::get<1>(sample);
+        m_table[getBin(boost::get<0>(sample), factor, m_thetaBins, m_phiBins)]
+            += boost::get<1>(sample);
         if (boost::get<1>(sample) > 0 && boost::get<2>(sample) == EDiscrete)
             discreteDirections.insert(boost::get<0>(sample));
     }
 
-    if (discreteDirections.size() > 0) {
-        Log(EDebug, "Incorporating the disrete density over "
-            SIZE_T_FMT " direction(s) into the contingency table", discreteDirections.size());
-        for (std::set<Vector, VectorOrder>::const_iterator it = discreteDirections.begin();
-            it != discreteDirections.end(); ++it) {
-            const Vector &direction = *it;
-            Point2 sphCoords = toSphericalCoordinates(direction);
-            Float pdf = pdfFn(direction, EDiscrete);
-
-            int thetaBin = std::min(std::max(0,
-                math::floorToInt(sphCoords.x * factor.x)), m_thetaBins-1);
-            int phiBin = std::min(std::max(0,
-                math::floorToInt(sphCoords.y * factor.y)), m_phiBins-1);
-
-            m_refTable[thetaBin * m_phiBins + phiBin] += pdf * m_sampleCount;
+    addDiscreteDirections(std::vector<Vector>(discreteDirections.begin(),
+        discreteDirections.end()), pdfFn);
+
+    Log(m_logLevel, "Done, took %i ms. Integrating reference "
+        "contingency table ..", timer->getMilliseconds());
+    integrate(pdfFn);
+}
+
+void ChiSquare::fillParallel(
+    const boost::function<boost::function<boost::tuple<Vector, Float, EMeasure>()> (size_t)> &sampleFnFactory,
+    const boost::function<Float (const Vector &, EMeasure measure)> &pdfFn) {
+    typedef boost::function<boost::tuple<Vector, Float, EMeasure>()> SampleFunctor;
+    memset(m_table, 0, m_thetaBins*m_phiBins*sizeof(Float));
+    memset(m_refTable, 0, m_thetaBins*m_phiBins*sizeof(Float));
+
+    size_t binCount = (size_t) (m_thetaBins * m_phiBins),
+           chunkCount = (m_sampleCount + CHISQR_CHUNK_SIZE - 1) / CHISQR_CHUNK_SIZE;
+
+    Log(m_logLevel, "Accumulating " SIZE_T_FMT " samples into a %ix%i"
+            " contingency table (" SIZE_T_FMT " chunks)", m_sampleCount,
+            m_thetaBins, m_phiBins, chunkCount);
+    Point2 factor(m_thetaBins / M_PI, m_phiBins / (2*M_PI));
+
+    /* Create all sample functions up front so that their
+       seeds don't depend on the order of execution */
+    std::vector<SampleFunctor> sampleFns(chunkCount);
+    for (size_t i=0; i<chunkCount; ++i)
+        sampleFns[i] = sampleFnFactory(i);
+
+    std::vector<Float> tables(chunkCount * binCount, 0.0f);
+    std::vector<std::set<Vector, VectorOrder> > discreteDirections(chunkCount);
+
+    ref<Timer> timer = new Timer();
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<(int) chunkCount; ++i) {
+        size_t start = i * (size_t) CHISQR_CHUNK_SIZE,
+               end = std::min(start + CHISQR_CHUNK_SIZE, m_sampleCount);
+        Float *table = &tables[i * binCount];
+        const SampleFunctor &sampleFn = sampleFns[i];
+
+        for (size_t j=start; j<end; ++j) {
+            boost::tuple<Vector, Float, EMeasure> sample = sampleFn();
+            table[getBin(boost::get<0>(sample), factor, m_thetaBins, m_phiBins)]
+                += boost::get<1>(sample);
+            if (boost::get<1>(sample) > 0 && boost::get<2>(sample) == EDiscrete)
+                discreteDirections[i].insert(boost::get<0>(sample));
         }
     }
 
-    factor = Point2(M_PI / m_thetaBins, (2*M_PI) / m_phiBins);
+    /* Merge in chunk order, which keeps the sums deterministic */
+    std::set<Vector, VectorOrder> directions;
+    for (size_t i=0; i<chunkCount; ++i) {
+        for (size_t j=0; j<binCount; ++j)
+            m_table[j] += tables[i * binCount + j];
+        directions.insert(discreteDirections[i].begin(), discreteDirections[i].end());
+    }
+
+    addDiscreteDirections(std::vector<Vector>(directions.begin(),
+        directions.end()), pdfFn);
 
     Log(m_logLevel, "Done, took %i ms. Integrating reference "
         "contingency table ..", timer->getMilliseconds());
-    timer->reset();
-    Float min[2], max[2];
-    size_t idx = 0;
+    integrate(pdfFn);
+}
+
+void ChiSquare::addDiscreteDirections(const std::vector<Vector> &directions,
+        const boost::function<Float (const Vector &, EMeasure)> &pdfFn) {
+    if (directions.empty())
+        return;
+
+    Log(EDebug, "Incorporating the disrete density over "
+        SIZE_T_FMT " direction(s) into the contingency table", directions.size());
+    Point2 factor(m_thetaBins / M_PI, m_phiBins / (2*M_PI));
+    for (size_t i=0; i<directions.size(); ++i) {
+        Float pdf = pdfFn(directions[i], EDiscrete);
+        m_refTable[getBin(directions[i], factor, m_thetaBins, m_phiBins)]
+            += pdf * m_sampleCount;
+    }
+}
+
+void ChiSquare::integrate(const boost::function<Float (const Vector &, EMeasure)> &pdfFn) {
+    ref<Timer> timer = new Timer();
+    Point2 factor(M_PI / m_thetaBins, (2*M_PI) / m_phiBins);
+    int binCount = m_thetaBins * m_phiBins;
+    std::vector<Float> results(binCount), errors(binCount);
 
     NDIntegrator integrator(1, 2, 100000, 0, 1e-6f);
-    Float maxError = 0, integral = 0;
-    for (int i=0; i<m_thetaBins; ++i) {
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int idx=0; idx<binCount; ++idx) {
+        int i = idx / m_phiBins, j = idx % m_phiBins;
+        Float min[2], max[2];
         min[0] = i * factor.x;
         max[0] = (i+1) * factor.x;
-        for (int j=0; j<m_phiBins; ++j) {
-            min[1] = j * factor.y;
-            max[1] = (j+1) * factor.y;
-            Float result, error;
-
-            integrator.integrateVectorized(
-                boost::bind(&ChiSquare::integrand, pdfFn, _1, _2, _3),
-                min, max, &result, &error
-            );
-
-            integral += result;
-            m_refTable[idx++] += result * m_sampleCount;
-            maxError = std::max(maxError, error);
-        }
+        min[1] = j * factor.y;
+        max[1] = (j+1) * factor.y;
+
+        integrator.integrateVectorized(
+            boost::bind(&ChiSquare::integrand, boost::cref(pdfFn), _1, _2, _3),
+            min, max, &results[idx], &errors[idx]
+        );
+    }
+
+    Float maxError = 0, integral = 0;
+    for (int idx=0; idx<binCount; ++idx) {
+        integral += results[idx];
+        m_refTable[idx] += results[idx] * m_sampleCount;
+        maxError = std::max(maxError, errors[idx]);
     }
 
     Log(m_logLevel, "Done, took %i ms (max error = %f, integral=%f).",
@@ -20,6 +20,7 @@
 #define BOOST_MPL_LIMIT_VECTOR_SIZE 40
 
 #include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/ssemath.h>
 #include <boost/mpl/vector.hpp>
 #include <boost/mpl/for_each.hpp>
 #include <boost/mpl/fold.hpp>
@@ -27,6 +28,17 @@
 #include <boost/mpl/pair.hpp>
 #include <boost/mpl/transform.hpp>
 
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
+
+#if defined(MTS_SSE) && defined(__F16C__)
+# include <immintrin.h>
+#endif
+
+/// Number of pixels per chunk when converting large images on several threads
+#define FMTCONV_PARALLEL_PIXELS 65536
+
 MTS_NAMESPACE_BEGIN
 
 namespace mpl = boost::mpl;
@@ -38,8 +50,9 @@ namespace mpl = boost::mpl;
 /*  formats. The switch() and Boost MPL craziness below does exactly this:  */
 /*  it produces code for each possible pair                                 */
 /****************************************************************************/
-/*  Note that some cases in this file really scream for SSE optimization    */
-/*  (in case they ever become a bottleneck, that is..)                      */
+/*  The most frequent conversions between identical pixel formats (float    */
+/*  to 8 bit with sRGB/gamma, and float<->half when F16C is available) have */
+/*  SSE implementations. Large images are converted in parallel chunks.     */
 /****************************************************************************/
 
 namespace detail {
@@ -77,6 +90,181 @@ namespace detail {
     template <> inline half safe_cast(double a) {
         return static_cast<half>(static_cast<float>(a));
     }
+
+    /// Number of components per pixel (or -1 if the format is unsupported)
+    inline int getChannelCount(Bitmap::EPixelFormat format, int channelCount) {
+        switch (format) {
+            case Bitmap::ELuminance:            return 1;
+            case Bitmap::ELuminanceAlpha:       return 2;
+            case Bitmap::ERGB:
+            case Bitmap::EXYZ:                  return 3;
+            case Bitmap::ERGBA:
+            case Bitmap::EXYZA:                 return 4;
+            case Bitmap::ESpectrum:             return SPECTRUM_SAMPLES;
+            case Bitmap::ESpectrumAlpha:        return SPECTRUM_SAMPLES + 1;
+            case Bitmap::ESpectrumAlphaWeight:  return SPECTRUM_SAMPLES + 2;
+            case Bitmap::EMultiChannel:         return channelCount;
+            default:                            return -1;
+        }
+    }
+
+#if defined(MTS_SSE)
+    /**
+     * Determine how the components of an image map onto SSE lanes when
+     * it is processed as a flat array. Returns the number of components
+     * and a mask of the lanes holding alpha values (which are neither
+     * scaled nor gamma-corrected), or \c false unless the format is
+     * such that every group of four components has the same layout.
+     */
+    inline bool getLaneLayout(Bitmap::EPixelFormat format, int channelCount,
+            size_t count, size_t &n, __m128 &alphaMask) {
+        const __m128 none = _mm_setzero_ps();
+        switch (format) {
+            case Bitmap::ELuminance:      n = count;     alphaMask = none; break;
+            case Bitmap::ERGB:            n = count * 3; alphaMask = none; break;
+            case Bitmap::ELuminanceAlpha: n = count * 2;
+                alphaMask = _mm_castsi128_ps(_mm_setr_epi32(0, -1, 0, -1)); break;
+            case Bitmap::ERGBA:           n = count * 4;
+                alphaMask = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1)); break;
+            case Bitmap::EMultiChannel:
+                if (channelCount <= 0)
+                    return false;
+                n = count * channelCount; alphaMask = none; break;
+            default:
+                return false;
+        }
+        return true;
+    }
+
+    /// Select \c a where \c mask is set and \c b otherwise
+    FINLINE __m128 select_ps(__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    /// Apply the gamma ramp of \c FormatConverterImpl::applyGamma() to values in [0, 1]
+    inline __m128 applyGamma_ps(__m128 value, float invGamma) {
+        if (invGamma == -1) {
+            __m128 linear = _mm_mul_ps(value, _mm_set1_ps(12.92f));
+            __m128 curve = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(1.055f),
+                math::exp_ps(_mm_mul_ps(math::log_ps(value), _mm_set1_ps(1.0f / 2.4f)))),
+                _mm_set1_ps(0.055f));
+            return select_ps(_mm_cmple_ps(value, _mm_set1_ps(0.0031308f)), linear, curve);
+        } else {
+            value = _mm_max_ps(value, _mm_set1_ps(std::numeric_limits<float>::min()));
+            return math::exp_ps(_mm_mul_ps(math::log_ps(value), _mm_set1_ps(invGamma)));
+        }
+    }
+
+    /// Load four components, padding with zeros past the end of the array
+    template <typename T> FINLINE void loadPartial(T *temp, const T *source, size_t n) {
+        memset(static_cast<void *>(temp), 0, 4 * sizeof(T));
+        memcpy(static_cast<void *>(temp), source, std::min(n, (size_t) 4) * sizeof(T));
+    }
+
+    /**
+     * SIMD implementations of conversions between identical pixel formats,
+     * which return \c false if they don't support the given arguments
+     */
+    template <typename S, typename D> struct SIMDConverter {
+        static bool convert(Bitmap::EPixelFormat format, const S *source, D *dest,
+                size_t count, int channelCount, float multiplier, float invDestGamma) {
+            return false;
+        }
+    };
+
+    template <> struct SIMDConverter<float, uint8_t> {
+        static bool convert(Bitmap::EPixelFormat format, const float *source, uint8_t *dest,
+                size_t count, int channelCount, float multiplier, float invDestGamma) {
+            size_t n;
+            __m128 alphaMask;
+            if (!getLaneLayout(format, channelCount, count, n, alphaMask))
+                return false;
+
+            const __m128 scale = select_ps(alphaMask, _mm_set1_ps(1.0f), _mm_set1_ps(multiplier)),
+                         zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f),
+                         maxValue = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f);
+
+            for (size_t i=0; i<n; i += 4) {
+                __m128 value;
+                if (EXPECT_TAKEN(i + 4 <= n)) {
+                    value = _mm_loadu_ps(source + i);
+                } else {
+                    float temp[4];
+                    loadPartial(temp, source + i, n - i);
+                    value = _mm_loadu_ps(temp);
+                }
+
+                /* Clamping first is equivalent since the gamma ramps map [0, 1]
+                   onto itself (the operand order maps NaNs to zero) */
+                value = _mm_min_ps(_mm_max_ps(_mm_mul_ps(value, scale), zero), one);
+                if (invDestGamma != 1)
+                    value = select_ps(alphaMask, value, applyGamma_ps(value, invDestGamma));
+
+                __m128i result = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, maxValue), half));
+                result = _mm_packs_epi32(result, result);
+                result = _mm_packus_epi16(result, result);
+                int32_t packed = _mm_cvtsi128_si32(result);
+                memcpy(dest + i, &packed, std::min(n - i, (size_t) 4));
+            }
+            return true;
+        }
+    };
+
+#if defined(__F16C__)
+    template <> struct SIMDConverter<float, half> {
+        static bool convert(Bitmap::EPixelFormat format, const float *source, half *dest,
+                size_t count, int channelCount, float multiplier, float invDestGamma) {
+            size_t n;
+            __m128 alphaMask;
+            if (invDestGamma != 1 || !getLaneLayout(format, channelCount, count, n, alphaMask))
+                return false;
+
+            const __m128 scale = select_ps(alphaMask, _mm_set1_ps(1.0f), _mm_set1_ps(multiplier));
+            for (size_t i=0; i<n; i += 4) {
+                __m128 value;
+                if (EXPECT_TAKEN(i + 4 <= n)) {
+                    value = _mm_loadu_ps(source + i);
+                } else {
+                    float temp[4];
+                    loadPartial(temp, source + i, n - i);
+                    value = _mm_loadu_ps(temp);
+                }
+                __m128i result = _mm_cvtps_ph(_mm_mul_ps(value, scale), 0);
+                int64_t packed = _mm_cvtsi128_si64(result);
+                memcpy(static_cast<void *>(dest + i), &packed, std::min(n - i, (size_t) 4) * sizeof(half));
+            }
+            return true;
+        }
+    };
+
+    template <> struct SIMDConverter<half, float> {
+        static bool convert(Bitmap::EPixelFormat format, const half *source, float *dest,
+                size_t count, int channelCount, float multiplier, float invDestGamma) {
+            size_t n;
+            __m128 alphaMask;
+            if (invDestGamma != 1 || !getLaneLayout(format, channelCount, count, n, alphaMask))
+                return false;
+
+            const __m128 scale = select_ps(alphaMask, _mm_set1_ps(1.0f), _mm_set1_ps(multiplier));
+            for (size_t i=0; i<n; i += 4) {
+                half temp[4];
+                loadPartial(temp, source + i, n - i);
+                int64_t packed;
+                memcpy(&packed, temp, sizeof(packed));
+                __m128 value = _mm_mul_ps(_mm_cvtph_ps(_mm_cvtsi64_si128(packed)), scale);
+                if (EXPECT_TAKEN(i + 4 <= n)) {
+                    _mm_storeu_ps(dest + i, value);
+                } else {
+                    float result[4];
+                    _mm_storeu_ps(result, value);
+                    memcpy(dest + i, result, (n - i) * sizeof(float));
+                }
+            }
+            return true;
+        }
+    };
+#endif
+#endif
 }
 
 template <typename T> struct FormatConverterImpl : public FormatConverter {
@@ -157,6 +345,44 @@ template <typename T> struct FormatConverterImpl : public FormatConverter {
                 precomp[i] = convertScalar<DestFormat>(detail::safe_cast<SourceFormat>(i), sourceGamma, NULL, multiplier, invDestGamma);
         }
 
+        #if defined(MTS_OPENMP)
+            /* Convert large images in chunks of pixels on several threads. This
+               is only done for supported formats, since errors must not be
+               raised within the parallel section */
+            int sourceChannels = detail::getChannelCount(sourceFormat, channelCount),
+                destChannels = detail::getChannelCount(destFormat, channelCount);
+            if (count >= 2 * FMTCONV_PARALLEL_PIXELS && !omp_in_parallel()
+                    && sourceChannels > 0 && destChannels > 0
+                    && (sourceFormat == Bitmap::EMultiChannel) == (destFormat == Bitmap::EMultiChannel)) {
+                int chunks = (int) ((count + FMTCONV_PARALLEL_PIXELS - 1) / FMTCONV_PARALLEL_PIXELS);
+                #pragma omp parallel for schedule(static)
+                for (int i=0; i<chunks; ++i) {
+                    size_t start = (size_t) i * FMTCONV_PARALLEL_PIXELS,
+                           size = std::min(count - start, (size_t) FMTCONV_PARALLEL_PIXELS);
+                    convertRange(sourceFormat, sourceGamma, source + start * sourceChannels,
+                        destFormat, invDestGamma, dest + start * destChannels, size,
+                        precomp, multiplier, intent, channelCount);
+                }
+                return;
+            }
+        #endif
+
+        convertRange(sourceFormat, sourceGamma, source, destFormat, invDestGamma,
+            dest, count, precomp, multiplier, intent, channelCount);
+    }
+
+private:
+    /// Convert a range of pixels (the part of \ref convert() that follows the setup)
+    void convertRange(Bitmap::EPixelFormat sourceFormat, Float sourceGamma, const SourceFormat *source,
+            Bitmap::EPixelFormat destFormat, Float invDestGamma, DestFormat *dest, size_t count,
+            DestFormat *precomp, Float multiplier, Spectrum::EConversionIntent intent, int channelCount) const {
+        #if defined(MTS_SSE)
+            if (sourceFormat == destFormat && sourceGamma == 1 &&
+                detail::SIMDConverter<SourceFormat, DestFormat>::convert(sourceFormat, source,
+                    dest, count, channelCount, (float) multiplier, (float) invDestGamma))
+                return;
+        #endif
+
         const DestFormat one = convertScalar<DestFormat>(1.0f);
 
         Spectrum spec;
@@ -1089,7 +1315,6 @@ template <typename T> struct FormatConverterImpl : public FormatConverter {
         }
     }
 
-private:
     static Float undoGamma(Float value, Float gamma) {
         if (gamma == -1) {
             if (value <= (Float) 0.04045)
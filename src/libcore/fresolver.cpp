@@ -23,7 +23,9 @@ MTS_NAMESPACE_BEGIN
     }
 #endif
 
-FileResolver::FileResolver() {
+FileResolver::FileResolver() : m_caching(false) {
+    m_cacheMutex = new Mutex();
+
     /* Try to detect the base path of the Mitsuba installation */
     fs::path basePath;
 #if defined(__LINUX__)
@@ -93,11 +95,23 @@ FileResolver::FileResolver() {
 FileResolver *FileResolver::clone() const {
     FileResolver *cloned = new FileResolver();
     cloned->m_paths = m_paths;
+    cloned->m_caching = m_caching;
     return cloned;
 }
 
 void FileResolver::clear() {
     m_paths.clear();
+    clearCache();
+}
+
+void FileResolver::setCaching(bool caching) {
+    m_caching = caching;
+    clearCache();
+}
+
+void FileResolver::clearCache() {
+    LockGuard lock(m_cacheMutex);
+    m_cache.clear();
 }
 
 void FileResolver::prependPath(const fs::path &path) {
@@ -106,6 +120,7 @@ void FileResolver::prependPath(const fs::path &path) {
             return;
     }
     m_paths.push_front(path);
+    clearCache();
 }
 
 void FileResolver::appendPath(const fs::path &path) {
@@ -114,9 +129,31 @@ void FileResolver::appendPath(const fs::path &path) {
             return;
     }
     m_paths.push_back(path);
+    clearCache();
 }
 
 fs::path FileResolver::resolve(const fs::path &path) const {
+    if (!m_caching)
+        return resolveUncached(path);
+
+    std::string key = path.string();
+    {
+        LockGuard lock(m_cacheMutex);
+        std::map<std::string, fs::path>::const_iterator it = m_cache.find(key);
+        if (it != m_cache.end())
+            return it->second;
+    }
+
+    /* Query the file system without holding the lock. Concurrent
+       lookups of the same path may both do this, which is harmless */
+    fs::path result = resolveUncached(path);
+
+    LockGuard lock(m_cacheMutex);
+    m_cache[key] = result;
+    return result;
+}
+
+fs::path FileResolver::resolveUncached(const fs::path &path) const {
     /* First, try to resolve in case-sensitive mode */
     for (size_t i=0; i<m_paths.size(); i++) {
         fs::path newPath = m_paths[i] / path;
@@ -165,6 +202,7 @@ fs::path FileResolver::resolveAbsolute(const fs::path &path) const {
 std::string FileResolver::toString() const {
     std::ostringstream oss;
     oss << "FileResolver[" << endl
+        << "  caching = " << (m_caching ? "true" : "false") << "," << endl
         << "  paths = {" << endl;
     for (size_t i=0; i<m_paths.size(); ++i) {
         oss << "    \"" << m_paths[i].string() << "\"";
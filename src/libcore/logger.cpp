@@ -19,6 +19,7 @@
 #include <mitsuba/mitsuba.h>
 #include <mitsuba/core/appender.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/atomic.h>
 #include <stdarg.h>
 
 #if defined(__OSX__)
@@ -29,16 +30,120 @@
 
 MTS_NAMESPACE_BEGIN
 
+/// How often the queue is drained in asynchronous mode (in ms)
+#define MTS_LOG_DRAIN_INTERVAL 20
+
+/// Singly linked list node of a message waiting for the appenders
+struct Logger::QueuedMessage {
+    QueuedMessage *next;
+    ELogLevel level;
+    std::string text;
+
+    inline QueuedMessage(ELogLevel level, const std::string &text)
+        : next(NULL), level(level), text(text) { }
+};
+
+/// Periodically passes queued log messages on to the appenders
+class LogDrainThread : public Thread {
+public:
+    LogDrainThread(Logger *logger) : Thread("logd"), m_logger(logger) {
+        m_stop = new WaitFlag();
+        /* Don't hold a reference to the drained logger; whatever this
+           thread reports itself must not end up in the queue */
+        ref<Logger> own = new Logger(EWarn);
+        own->setFormatter(new DefaultFormatter());
+        setLogger(own);
+    }
+
+    void run() {
+        while (!m_stop->wait(MTS_LOG_DRAIN_INTERVAL))
+            m_logger->flush();
+        m_logger->flush();
+    }
+
+    void stop() {
+        m_stop->set(true);
+        join();
+    }
+
+private:
+    Logger *m_logger;
+    ref<WaitFlag> m_stop;
+};
+
 Logger::Logger(ELogLevel level)
- : m_logLevel(level), m_errorLevel(EError), m_warningCount(0) {
+ : m_logLevel(level), m_errorLevel(EError), m_warningCount(0),
+   m_asynchronous(false), m_queue(NULL), m_warningLimit(100) {
     m_mutex = new Mutex();
+    m_warningMutex = new Mutex();
 }
 
 Logger::~Logger() {
+    setAsynchronous(false);
     for (size_t i=0; i<m_appenders.size(); ++i)
         m_appenders[i]->decRef();
 }
 
+void Logger::setAsynchronous(bool value) {
+    if (value == m_asynchronous)
+        return;
+
+    if (value) {
+        m_drainThread = new LogDrainThread(this);
+        m_drainThread->start();
+        m_asynchronous = true;
+    } else {
+        m_asynchronous = false;
+        static_cast<LogDrainThread *>(m_drainThread.get())->stop();
+        m_drainThread = NULL;
+        /* Catch messages that were queued while shutting down */
+        flush();
+    }
+}
+
+void Logger::flush() {
+    LockGuard lock(m_mutex);
+    drain();
+}
+
+void Logger::drain() {
+    /* Detach the whole queue at once. Since nothing is ever popped
+       individually, this is not susceptible to the ABA problem */
+    QueuedMessage *head;
+    do {
+        head = m_queue;
+    } while (head && !atomicCompareAndExchangePtr(&m_queue,
+            (QueuedMessage *) NULL, head));
+
+    /* The queue is a stack -- restore the original order */
+    QueuedMessage *ordered = NULL;
+    while (head) {
+        QueuedMessage *next = head->next;
+        head->next = ordered;
+        ordered = head;
+        head = next;
+    }
+
+    while (ordered) {
+        for (size_t i=0; i<m_appenders.size(); ++i)
+            m_appenders[i]->append(ordered->level, ordered->text);
+        QueuedMessage *next = ordered->next;
+        delete ordered;
+        ordered = next;
+    }
+}
+
+void Logger::setWarningLimit(size_t limit) {
+    LockGuard lock(m_warningMutex);
+    m_warningLimit = limit;
+}
+
+size_t Logger::countWarning(const char *fileName, int lineNumber) {
+    LockGuard lock(m_warningMutex);
+    return ++m_warnings[std::make_pair(
+        std::string(fileName ? fileName : ""), lineNumber)];
+}
+
 void Logger::setFormatter(Formatter *formatter) {
     LockGuard lock(m_mutex);
     m_formatter = formatter;
@@ -60,6 +165,18 @@ void Logger::log(ELogLevel level, const Class *theClass,
     if (level < m_logLevel)
         return;
 
+    /* Rate limiting of repeated warnings */
+    bool lastWarning = false;
+    if (level >= EWarn && level < m_errorLevel) {
+        atomicAdd(&m_warningCount, (int64_t) 1);
+        if (m_warningLimit > 0) {
+            size_t count = countWarning(file, line);
+            if (count > m_warningLimit)
+                return;
+            lastWarning = count == m_warningLimit;
+        }
+    }
+
     char tmp[512], *msg = tmp;
     va_list iterator;
 
@@ -94,16 +211,30 @@ void Logger::log(ELogLevel level, const Class *theClass,
     std::string text = m_formatter->format(level, theClass,
         Thread::getThread(), msg, file, line);
 
-    if (msg != tmp)
-        delete[] msg;
+    if (lastWarning)
+        text += " (further warnings from this location will be suppressed)";
 
     if (level < m_errorLevel) {
-        LockGuard lock(m_mutex);
-        if (level >= EWarn)
-            m_warningCount++;
-        for (size_t i=0; i<m_appenders.size(); ++i)
-            m_appenders[i]->append(level, text);
+        if (msg != tmp)
+            delete[] msg;
+
+        if (m_asynchronous) {
+            /* Lock-free push onto the queue */
+            QueuedMessage *item = new QueuedMessage(level, text), *head;
+            do {
+                head = m_queue;
+                item->next = head;
+            } while (!atomicCompareAndExchangePtr(&m_queue, item, head));
+        } else {
+            LockGuard lock(m_mutex);
+            drain();
+            for (size_t i=0; i<m_appenders.size(); ++i)
+                m_appenders[i]->append(level, text);
+        }
     } else {
+        /* Report everything that happened before the error */
+        flush();
+
 #if defined(__LINUX__)
         /* A critical error occurred: trap if we're running in a debugger */
 
@@ -144,6 +275,8 @@ void Logger::log(ELogLevel level, const Class *theClass,
         fmt.setHaveLogLevel(false);
         text = fmt.format(level, theClass,
             Thread::getThread(), msg, file, line);
+        if (msg != tmp)
+            delete[] msg;
         throw std::runtime_error(text);
     }
 }
@@ -151,6 +284,7 @@ void Logger::log(ELogLevel level, const Class *theClass,
 void Logger::logProgress(Float progress, const std::string &name,
     const std::string &formatted, const std::string &eta, const void *ptr) {
     LockGuard lock(m_mutex);
+    drain();
     for (size_t i=0; i<m_appenders.size(); ++i)
         m_appenders[i]->logProgress(
             progress, name, formatted, eta, ptr);
@@ -164,6 +298,7 @@ void Logger::addAppender(Appender *appender) {
 
 void Logger::removeAppender(Appender *appender) {
     LockGuard lock(m_mutex);
+    drain();
     m_appenders.erase(std::remove(m_appenders.begin(),
         m_appenders.end(), appender), m_appenders.end());
     appender->decRef();
@@ -172,6 +307,7 @@ void Logger::removeAppender(Appender *appender) {
 bool Logger::readLog(std::string &target) {
     bool success = false;
     LockGuard lock(m_mutex);
+    drain();
     for (size_t i=0; i<m_appenders.size(); ++i) {
         Appender *appender = m_appenders[i];
         if (appender->getClass()->derivesFrom(MTS_CLASS(StreamAppender))) {
@@ -189,6 +325,7 @@ bool Logger::readLog(std::string &target) {
 
 void Logger::clearAppenders() {
     LockGuard lock(m_mutex);
+    drain();
     for (size_t i=0; i<m_appenders.size(); ++i)
         m_appenders[i]->decRef();
     m_appenders.clear();
@@ -204,6 +341,9 @@ void Logger::staticInitialization() {
 }
 
 void Logger::staticShutdown() {
+    Logger *logger = Thread::getThread()->getLogger();
+    if (logger)
+        logger->setAsynchronous(false);
     Thread::getThread()->setLogger(NULL);
 }
 
@@ -98,6 +98,15 @@ void MemoryStream::read(void *ptr, size_t size) {
 }
 
 
+void MemoryStream::copyTo(Stream *stream, int64_t numBytes) {
+    size_t amount = (numBytes == -1) ? (m_size - m_pos) : (size_t) numBytes;
+    if (m_pos + amount > m_size)
+        throw EOFException(formatString("Reading over the end of a memory stream  (amount requested=" SIZE_T_FMT
+            ", amount available=" SIZE_T_FMT ")!", amount, m_size - m_pos), 0);
+    stream->write(m_data + m_pos, amount);
+    m_pos += amount;
+}
+
 void MemoryStream::write(const void *ptr, size_t size) {
     size_t endPos = m_pos + size;
     if (endPos > m_size) {
@@ -23,6 +23,12 @@
 # include <intrin.h>
 #endif
 
+#if defined(__WINDOWS__)
+# include <windows.h>
+#else
+# include <pthread.h>
+#endif
+
 #define DEBUG_REFCOUNTS 0
 
 #if DEBUG_REFCOUNTS == 1
@@ -81,7 +87,7 @@ static RefCountTracker *__ref_tracker = NULL;
 Class *MTS_CLASS(Object) = new Class("Object", false, "");
 
 Object::Object()
- : m_refCount(0) {
+ : m_refCount(0), m_threadConfined(false) {
 #if DEBUG_REFCOUNTS == 1
     if (__ref_tracker)
         __ref_tracker->add(this);
@@ -94,6 +100,10 @@ void Object::incRef() const {
         cout << this << ": Increasing reference count (" << getClass()->getName() << ") -> "
             << (int) (m_refCount + 1) << endl;
 #endif
+    if (m_threadConfined) {
+        ++m_refCount;
+        return;
+    }
 #if defined(_MSC_VER)
     _InterlockedIncrement(&m_refCount);
 #else
@@ -108,10 +118,15 @@ void Object::decRef(bool autoDeallocate) const {
             << std::dec << (int) (m_refCount - 1) << endl;
     }
 #endif
+    int count;
+    if (m_threadConfined)
+        count = --m_refCount;
 #if defined(_MSC_VER)
-    int count = _InterlockedDecrement(&m_refCount);
+    else
+        count = _InterlockedDecrement(&m_refCount);
 #else
-    int count = __sync_sub_and_fetch(&m_refCount, 1);
+    else
+        count = __sync_sub_and_fetch(&m_refCount, 1);
 #endif
     AssertEx(count >= 0, "Reference count is below zero!");
     if (count == 0 && autoDeallocate) {
@@ -149,9 +164,11 @@ void Object::staticInitialization() {
     if (!__ref_tracker)
         __ref_tracker = new RefCountTracker();
 #endif
+    ObjectAllocator::staticInitialization();
 }
 
 void Object::staticShutdown() {
+    ObjectAllocator::staticShutdown();
 #if DEBUG_REFCOUNTS == 1
     if (__ref_tracker) {
         delete __ref_tracker;
@@ -160,4 +177,133 @@ void Object::staticShutdown() {
 #endif
 }
 
+namespace {
+    /// Number of size classes of the object allocator
+    const size_t __alloc_classes = ObjectAllocator::EMaxSize / 16;
+
+    /// Per-thread free lists of the object allocator
+    struct AllocatorCache {
+        struct Block { Block *next; };
+        Block *head[__alloc_classes];
+        uint32_t count[__alloc_classes];
+
+        inline AllocatorCache() {
+            memset(head, 0, sizeof(head));
+            memset(count, 0, sizeof(count));
+        }
+
+        ~AllocatorCache() {
+            for (size_t i=0; i<__alloc_classes; ++i) {
+                while (head[i]) {
+                    Block *block = head[i];
+                    head[i] = block->next;
+                    ::operator delete(block);
+                }
+            }
+        }
+    };
+
+    /* Native TLS with a cleanup hook: the per-thread caches must also
+       work for threads that were not created by Mitsuba */
+    bool __alloc_initialized = false;
+#if defined(__WINDOWS__)
+    DWORD __alloc_key = FLS_OUT_OF_INDEXES;
+
+    void WINAPI destroyAllocatorCache(void *data) {
+        delete static_cast<AllocatorCache *>(data);
+    }
+#else
+    pthread_key_t __alloc_key;
+
+    void destroyAllocatorCache(void *data) {
+        delete static_cast<AllocatorCache *>(data);
+    }
+#endif
+
+    inline AllocatorCache *getAllocatorCache() {
+        if (EXPECT_NOT_TAKEN(!__alloc_initialized))
+            return NULL;
+#if defined(__WINDOWS__)
+        AllocatorCache *cache = static_cast<AllocatorCache *>(FlsGetValue(__alloc_key));
+#else
+        AllocatorCache *cache = static_cast<AllocatorCache *>(pthread_getspecific(__alloc_key));
+#endif
+        if (EXPECT_NOT_TAKEN(!cache)) {
+            cache = new AllocatorCache();
+#if defined(__WINDOWS__)
+            FlsSetValue(__alloc_key, cache);
+#else
+            pthread_setspecific(__alloc_key, cache);
+#endif
+        }
+        return cache;
+    }
+};
+
+void *ObjectAllocator::alloc(size_t size) {
+    if (size == 0 || size > EMaxSize)
+        return ::operator new(size);
+
+    size_t index = (size - 1) / 16;
+    AllocatorCache *cache = getAllocatorCache();
+    if (cache && cache->head[index]) {
+        AllocatorCache::Block *block = cache->head[index];
+        cache->head[index] = block->next;
+        cache->count[index]--;
+        return block;
+    }
+
+    /* Always allocate the full size class, so that the block can
+       later be cached by any thread */
+    return ::operator new((index + 1) * 16);
+}
+
+void ObjectAllocator::release(void *ptr, size_t size) {
+    if (!ptr)
+        return;
+    if (size == 0 || size > EMaxSize) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    size_t index = (size - 1) / 16;
+    AllocatorCache *cache = getAllocatorCache();
+    if (cache && cache->count[index] < EMaxCached) {
+        AllocatorCache::Block *block = static_cast<AllocatorCache::Block *>(ptr);
+        block->next = cache->head[index];
+        cache->head[index] = block;
+        cache->count[index]++;
+    } else {
+        ::operator delete(ptr);
+    }
+}
+
+void ObjectAllocator::staticInitialization() {
+    if (__alloc_initialized)
+        return;
+#if defined(__WINDOWS__)
+    __alloc_key = FlsAlloc(&destroyAllocatorCache);
+    __alloc_initialized = __alloc_key != FLS_OUT_OF_INDEXES;
+#else
+    __alloc_initialized = pthread_key_create(&__alloc_key, &destroyAllocatorCache) == 0;
+#endif
+}
+
+void ObjectAllocator::staticShutdown() {
+    if (!__alloc_initialized)
+        return;
+    /* Release the cache of the calling thread. Other threads have
+       normally exited (and released theirs) at this point */
+    __alloc_initialized = false;
+#if defined(__WINDOWS__)
+    delete static_cast<AllocatorCache *>(FlsGetValue(__alloc_key));
+    FlsSetValue(__alloc_key, NULL);
+    FlsFree(__alloc_key);
+#else
+    delete static_cast<AllocatorCache *>(pthread_getspecific(__alloc_key));
+    pthread_setspecific(__alloc_key, NULL);
+    pthread_key_delete(__alloc_key);
+#endif
+}
+
 MTS_NAMESPACE_END
@@ -179,13 +179,16 @@ PluginManager::~PluginManager() {
 
 ConfigurableObject *PluginManager::createObject(const Class *classType,
     const Properties &props) {
-    ConfigurableObject *object;
+    Plugin *plugin;
 
     {
         LockGuard lock(m_mutex);
         ensurePluginLoaded(props.getPluginName());
-        object = m_plugins[props.getPluginName()]->createInstance(props);
+        plugin = m_plugins[props.getPluginName()];
     }
+    /* Objects may be created concurrently (e.g. by the scene loader),
+       hence the constructor runs without holding the lock */
+    ConfigurableObject *object = plugin->createInstance(props);
     if (!object->getClass()->derivesFrom(classType))
         Log(EError, "Type mismatch when loading plugin \"%s\": Expected "
         "an instance of \"%s\"", props.getPluginName().c_str(), classType->getName().c_str());
@@ -196,13 +199,14 @@ ConfigurableObject *PluginManager::createObject(const Class *classType,
 }
 
 ConfigurableObject *PluginManager::createObject(const Properties &props) {
-    ConfigurableObject *object;
+    Plugin *plugin;
 
     {
         LockGuard lock(m_mutex);
         ensurePluginLoaded(props.getPluginName());
-        object = m_plugins[props.getPluginName()]->createInstance(props);
+        plugin = m_plugins[props.getPluginName()];
     }
+    ConfigurableObject *object = plugin->createInstance(props);
     if (object->getClass()->isAbstract())
         Log(EError, "Error when loading plugin \"%s\": Identifies itself as an abstract class",
         props.getPluginName().c_str());
@@ -224,7 +228,21 @@ void PluginManager::ensurePluginLoaded(const std::string &name) {
     if (m_plugins[name] != NULL)
         return;
 
-    /* Build the full plugin file name */
+    fs::path shortName = getPluginFileName(name);
+    const FileResolver *resolver = Thread::getThread()->getFileResolver();
+    fs::path path = resolver->resolve(shortName);
+
+    if (fs::exists(path)) {
+        Log(EInfo, "Loading plugin \"%s\" ..", shortName.string().c_str());
+        m_plugins[name] = new Plugin(shortName.string(), path);
+        return;
+    }
+
+    /* Plugin not found! */
+    Log(EError, "Plugin \"%s\" not found!", name.c_str());
+}
+
+fs::path PluginManager::getPluginFileName(const std::string &name) {
     fs::path shortName = fs::path("plugins") / name;
 #if defined(__WINDOWS__)
     shortName.replace_extension(".dll");
@@ -233,18 +251,61 @@ void PluginManager::ensurePluginLoaded(const std::string &name) {
 #else
     shortName.replace_extension(".so");
 #endif
+    return shortName;
+}
 
-    const FileResolver *resolver = Thread::getThread()->getFileResolver();
-    fs::path path = resolver->resolve(shortName);
-
-    if (fs::exists(path)) {
-        Log(EInfo, "Loading plugin \"%s\" ..", shortName.string().c_str());
-        m_plugins[name] = new Plugin(shortName.string(), path);
+void PluginManager::preloadPlugins(const std::vector<std::string> &names) {
+    std::vector<std::string> pending;
+    {
+        LockGuard lock(m_mutex);
+        for (size_t i=0; i<names.size(); ++i) {
+            std::map<std::string, Plugin *>::const_iterator it = m_plugins.find(names[i]);
+            if ((it == m_plugins.end() || it->second == NULL) && !names[i].empty() &&
+                std::find(pending.begin(), pending.end(), names[i]) == pending.end())
+                pending.push_back(names[i]);
+        }
+    }
+    if (pending.empty())
         return;
+
+    Thread *loader = Thread::getThread();
+    ref<FileResolver> resolver = loader->getFileResolver();
+    ref<Logger> logger = loader->getLogger();
+    std::vector<Plugin *> plugins(pending.size(), (Plugin *) NULL);
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<(int) pending.size(); ++i) {
+        /* Log error messages like the loading thread */
+        Thread *thread = Thread::getThread();
+        if (!thread) {
+            thread = Thread::registerUnmanagedThread("plugin");
+            thread->setLogger(logger);
+        }
+        try {
+            fs::path shortName = getPluginFileName(pending[i]);
+            fs::path path = resolver->resolve(shortName);
+            if (fs::exists(path))
+                plugins[i] = new Plugin(shortName.string(), path);
+        } catch (const std::exception &) {
+            /* Reported by ensurePluginLoaded() later on */
+        }
     }
 
-    /* Plugin not found! */
-    Log(EError, "Plugin \"%s\" not found!", name.c_str());
+    LockGuard lock(m_mutex);
+    for (size_t i=0; i<pending.size(); ++i) {
+        if (!plugins[i])
+            continue;
+        Plugin *&plugin = m_plugins[pending[i]];
+        if (plugin == NULL) {
+            Log(EInfo, "Loading plugin \"%s\" ..", plugins[i]->getShortName().c_str());
+            plugin = plugins[i];
+        } else {
+            /* Another thread loaded it in the meantime */
+            delete plugins[i];
+        }
+    }
 }
 
 void PluginManager::staticInitialization() {
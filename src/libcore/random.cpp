@@ -296,6 +296,26 @@ struct Random::State {
         return r;
     }
 
+    /**
+     * Copy the next \c count 64-bit pseudorandom numbers to the given
+     * array. This produces the same sequence as repeated calls to
+     * gen_rand64(), but moves whole runs of the state array at once.
+     */
+    inline void fill_array64(uint64_t *array, size_t count) {
+        while (count > 0) {
+            if (idx >= N32) {
+                gen_rand_all();
+                idx = 0;
+            }
+
+            size_t n = std::min(count, (size_t) ((N32 - idx) / 2));
+            memcpy(array, &psfmt64[idx / 2], n * sizeof(uint64_t));
+            idx += 2 * (int) n;
+            array += n;
+            count -= n;
+        }
+    }
+
 private:
 
     /**
@@ -639,6 +659,59 @@ Float Random::nextFloat() {
 }
 #endif
 
+/// Number of 64-bit values that Random::fill() generates at a time
+#define MTS_RANDOM_FILL_CHUNK 256
+
+void Random::fill(uint64_t *values, size_t count) {
+    mt->fill_array64(values, count);
+}
+
+void Random::fill(uint32_t *values, size_t count) {
+    /* Write pairs of 32-bit values and generate the (possibly) odd last one separately */
+    uint64_t temp[MTS_RANDOM_FILL_CHUNK];
+    while (count > 1) {
+        size_t n = std::min(count / 2, (size_t) MTS_RANDOM_FILL_CHUNK);
+        mt->fill_array64(temp, n);
+        for (size_t i=0; i<n; ++i) {
+            values[2*i]   = (uint32_t) temp[i];
+            values[2*i+1] = (uint32_t) (temp[i] >> 32);
+        }
+        values += 2 * n;
+        count -= 2 * n;
+    }
+    if (count)
+        *values = (uint32_t) nextULong();
+}
+
+void Random::fill(Float *values, size_t count) {
+    uint64_t temp[MTS_RANDOM_FILL_CHUNK];
+    while (count > 0) {
+        size_t n = std::min(count, (size_t) MTS_RANDOM_FILL_CHUNK);
+        mt->fill_array64(temp, n);
+
+        /* Same conversion as in nextFloat() */
+        for (size_t i=0; i<n; ++i) {
+#if defined(DOUBLE_PRECISION)
+            union {
+                uint64_t u;
+                double d;
+            } x;
+            x.u = (temp[i] >> 12) | 0x3ff0000000000000ULL;
+            values[i] = x.d - 1.0;
+#else
+            union {
+                uint32_t u;
+                float f;
+            } x;
+            x.u = ((temp[i] & 0xFFFFFFFF) >> 9) | 0x3f800000UL;
+            values[i] = x.f - 1.0f;
+#endif
+        }
+        values += n;
+        count -= n;
+    }
+}
+
 Float Random::nextStandardNormal() {
     /* Marsaglia polar method for generating two standard
        normal variates. One is subsequently thrown away */
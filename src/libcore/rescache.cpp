@@ -0,0 +1,190 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/rescache.h>
+#include <mitsuba/core/fstream.h>
+#include <boost/filesystem/operations.hpp>
+
+/// File extension of resource cache entries
+#define MTS_RESCACHE_EXTENSION ".res"
+
+MTS_NAMESPACE_BEGIN
+
+ResourceCache::ResourceCache(const fs::path &path, size_t maxSize)
+        : m_path(path), m_maxSize(maxSize), m_size(0) {
+    m_mutex = new Mutex();
+
+    if (!fs::exists(m_path))
+        fs::create_directories(m_path);
+    else if (!fs::is_directory(m_path))
+        Log(EError, "Resource cache location \"%s\" is not a directory!",
+            m_path.string().c_str());
+
+    /* Pick up the entries of earlier sessions */
+    for (fs::directory_iterator it(m_path), end; it != end; ++it) {
+        const fs::path &filename = it->path();
+        if (!fs::is_regular_file(filename))
+            continue;
+        if (filename.extension() != MTS_RESCACHE_EXTENSION) {
+            /* Remove left-overs of interrupted writes */
+            if (filename.extension() == ".tmp")
+                fs::remove(filename);
+            continue;
+        }
+        Entry entry;
+        entry.size = (size_t) fs::file_size(filename);
+        entry.lastUse = fs::last_write_time(filename);
+        m_entries[filename.stem().string()] = entry;
+        m_size += entry.size;
+    }
+
+    Log(EInfo, "Resource cache \"%s\": %i entries (%s of %s)",
+        m_path.string().c_str(), (int) m_entries.size(),
+        memString(m_size).c_str(), memString(m_maxSize).c_str());
+    evict();
+}
+
+fs::path ResourceCache::getFilename(const std::string &hash) const {
+    return m_path / (hash + MTS_RESCACHE_EXTENSION);
+}
+
+ref<MemoryStream> ResourceCache::load(const std::string &hash) {
+    LockGuard lock(m_mutex);
+    std::map<std::string, Entry>::iterator it = m_entries.find(hash);
+    if (it == m_entries.end())
+        return NULL;
+
+    fs::path filename = getFilename(hash);
+    size_t size = it->second.size;
+    ref<MemoryStream> data = new MemoryStream(size);
+    data->setByteOrder(Stream::ENetworkByteOrder);
+
+    try {
+        ref<FileStream> fs = new FileStream(filename, FileStream::EReadOnly);
+        if (fs->getSize() != size)
+            Log(EError, "Unexpected file size");
+        data->seek(size);
+        fs->read(data->getData(), size);
+    } catch (const std::exception &e) {
+        Log(EWarn, "Could not read the resource cache entry \"%s\" (%s) -- removing it",
+            filename.string().c_str(), e.what());
+        remove(hash);
+        return NULL;
+    }
+
+    /* Guard against damaged files */
+    if (contentHash(data->getData(), size) != hash) {
+        Log(EWarn, "The resource cache entry \"%s\" is damaged -- removing it",
+            filename.string().c_str());
+        remove(hash);
+        return NULL;
+    }
+
+    it->second.lastUse = std::time(NULL);
+    try {
+        fs::last_write_time(filename, it->second.lastUse);
+    } catch (const std::exception &) {
+        /* Not critical, the entry is just evicted earlier */
+    }
+
+    data->seek(0);
+    return data;
+}
+
+void ResourceCache::store(const std::string &hash, const MemoryStream *data) {
+    size_t size = data->getPos();
+    if (size > m_maxSize)
+        return;
+
+    LockGuard lock(m_mutex);
+    if (m_entries.find(hash) != m_entries.end())
+        return;
+
+    fs::path filename = getFilename(hash);
+    fs::path tempFilename = fs::path(filename.string() + ".tmp");
+    try {
+        ref<FileStream> fs = new FileStream(tempFilename, FileStream::ETruncWrite);
+        fs->write(data->getData(), size);
+        fs->close();
+        fs::rename(tempFilename, filename);
+    } catch (const std::exception &e) {
+        Log(EWarn, "Could not write the resource cache entry \"%s\": %s",
+            filename.string().c_str(), e.what());
+        return;
+    }
+
+    Entry entry;
+    entry.size = size;
+    entry.lastUse = std::time(NULL);
+    m_entries[hash] = entry;
+    m_size += size;
+    evict();
+}
+
+void ResourceCache::remove(const std::string &hash) {
+    std::map<std::string, Entry>::iterator it = m_entries.find(hash);
+    if (it == m_entries.end())
+        return;
+    m_size -= it->second.size;
+    m_entries.erase(it);
+    try {
+        fs::remove(getFilename(hash));
+    } catch (const std::exception &e) {
+        Log(EWarn, "Could not remove the resource cache entry \"%s\": %s",
+            getFilename(hash).string().c_str(), e.what());
+    }
+}
+
+void ResourceCache::evict() {
+    while (m_size > m_maxSize && !m_entries.empty()) {
+        std::map<std::string, Entry>::iterator oldest = m_entries.begin();
+        for (std::map<std::string, Entry>::iterator it = m_entries.begin();
+                it != m_entries.end(); ++it) {
+            if (it->second.lastUse < oldest->second.lastUse)
+                oldest = it;
+        }
+        Log(EDebug, "Evicting resource cache entry %s (%s)", oldest->first.c_str(),
+            memString(oldest->second.size).c_str());
+        remove(oldest->first);
+    }
+}
+
+size_t ResourceCache::getSize() const {
+    LockGuard lock(m_mutex);
+    return m_size;
+}
+
+size_t ResourceCache::getEntryCount() const {
+    LockGuard lock(m_mutex);
+    return m_entries.size();
+}
+
+std::string ResourceCache::toString() const {
+    LockGuard lock(m_mutex);
+    std::ostringstream oss;
+    oss << "ResourceCache[" << endl
+        << "  path = \"" << m_path.string() << "\"," << endl
+        << "  entryCount = " << m_entries.size() << "," << endl
+        << "  size = " << memString(m_size) << "," << endl
+        << "  maxSize = " << memString(m_maxSize) << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(ResourceCache, false, Object)
+MTS_NAMESPACE_END
@@ -21,17 +21,22 @@
 MTS_NAMESPACE_BEGIN
 
 ReconstructionFilter::ReconstructionFilter(const Properties &props)
- : ConfigurableObject(props) { }
+ : ConfigurableObject(props) {
+    /* Importance sample sensor positions and store each sample in a single pixel? */
+    m_importanceSampling = props.getBoolean("importanceSampling", false);
+}
 
 ReconstructionFilter::~ReconstructionFilter() { }
 
 ReconstructionFilter::ReconstructionFilter(Stream *stream, InstanceManager *manager)
  : ConfigurableObject(stream, manager) {
      m_radius = stream->readFloat();
+    m_importanceSampling = stream->readBool();
 }
 
 void ReconstructionFilter::serialize(Stream *stream, InstanceManager *manager) const {
     stream->writeFloat(m_radius);
+    stream->writeBool(m_importanceSampling);
 }
 
 void ReconstructionFilter::configure() {
@@ -47,11 +52,44 @@ void ReconstructionFilter::configure() {
 
     m_values[MTS_FILTER_RESOLUTION] = 0.0f;
     m_scaleFactor = MTS_FILTER_RESOLUTION / m_radius;
-    m_borderSize = (int) std::ceil(m_radius - 0.5f);
+    m_borderSize = m_importanceSampling ? 0 : (int) std::ceil(m_radius - 0.5f);
     sum *= 2 * m_radius / MTS_FILTER_RESOLUTION;
     Float normalization = 1.0f / sum;
     for (size_t i=0; i<MTS_FILTER_RESOLUTION; ++i)
         m_values[i] *= normalization;
+
+    /* Tabulate the CDF of the absolute value of one half of the filter */
+    m_cdf[0] = 0.0f;
+    for (size_t i=0; i<MTS_FILTER_RESOLUTION; ++i)
+        m_cdf[i+1] = m_cdf[i] + std::abs(m_values[i]);
+    if (m_cdf[MTS_FILTER_RESOLUTION] <= 0)
+        Log(EError, "The reconstruction filter vanishes everywhere!");
+    Float invTotal = 1.0f / m_cdf[MTS_FILTER_RESOLUTION];
+    for (size_t i=1; i<MTS_FILTER_RESOLUTION; ++i)
+        m_cdf[i] *= invTotal;
+    m_cdf[MTS_FILTER_RESOLUTION] = 1.0f;
+}
+
+Float ReconstructionFilter::sample(Float u, Float &weight) const {
+    /* The filter is symmetric: first choose a side */
+    Float side = 1.0f;
+    if (u < 0.5f) {
+        u = 2*u;
+        side = -1.0f;
+    } else {
+        u = 2*u - 1;
+    }
+
+    /* Find the discretization cell and sample it uniformly */
+    int index = std::min((int) (std::upper_bound(m_cdf, m_cdf + MTS_FILTER_RESOLUTION + 1, u)
+        - m_cdf) - 1, MTS_FILTER_RESOLUTION - 1);
+    index = std::max(index, 0);
+    Float cellWidth = m_cdf[index+1] - m_cdf[index];
+    Float t = cellWidth > 0 ? (u - m_cdf[index]) / cellWidth : 0.5f;
+    t = std::min(t, ONE_MINUS_EPS);
+
+    weight = m_values[index] < 0 ? -1.0f : 1.0f;
+    return side * (index + t) / m_scaleFactor;
 }
 
 std::ostream &operator<<(std::ostream &os, const ReconstructionFilter::EBoundaryCondition &value) {
@@ -19,11 +19,18 @@
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/tls.h>
 
 #include <boost/thread/thread.hpp>
 
 MTS_NAMESPACE_BEGIN
 
+static StatsCounter stolenWorkUnits("Scheduler", "Stolen work units");
+
+/// Share of the processes scheduled by every thread (zero means the default)
+static PrimitiveThreadLocal<Float> __share_tls;
+
 SerializableObject *WorkProcessor::getResource(const std::string &name) {
     if (m_resources.find(name) == m_resources.end())
         Log(EError, "Could not find a resource named \"%s\"!", name.c_str());
@@ -38,6 +45,18 @@ std::vector<std::string> ParallelProcess::getRequiredPlugins() {
     return PluginManager::getInstance()->getLoadedPlugins();
 }
 
+ParallelProcess::EStatus ParallelProcess::generateWorkBatch(WorkUnit * const *units,
+        size_t count, size_t &generated, int worker) {
+    generated = 0;
+    while (generated < count) {
+        EStatus status = generateWork(units[generated], worker);
+        if (status != ESuccess)
+            return status;
+        ++generated;
+    }
+    return ESuccess;
+}
+
 void ParallelProcess::handleCancellation() {
 }
 
@@ -56,6 +75,7 @@ Scheduler::Scheduler() {
     m_workAvailable = new ConditionVariable(m_mutex);
     m_resourceCounter = 0;
     m_processCounter = 0;
+    m_localBatchSize = 1;
     m_running = false;
 }
 
@@ -229,6 +249,15 @@ const MemoryStream *Scheduler::getResourceStream(int id) {
     return rec->stream;
 }
 
+std::string Scheduler::getResourceHash(int id) {
+    LockGuard lock(m_mutex);
+    const MemoryStream *stream = getResourceStream(id);
+    ResourceRecord *rec = m_resources[id];
+    if (rec->hash.empty())
+        rec->hash = contentHash(stream->getData(), stream->getPos());
+    return rec->hash;
+}
+
 int Scheduler::getResourceID(const SerializableObject *obj) const {
     LockGuard lock(m_mutex);
     std::map<int, ResourceRecord *>::const_iterator it = m_resources.begin();
@@ -245,6 +274,15 @@ int Scheduler::getResourceID(const SerializableObject *obj) const {
     return -1; // Never reached
 }
 
+void Scheduler::setThreadShare(Float share) {
+    __share_tls.set(share);
+}
+
+Float Scheduler::getThreadShare() {
+    Float share = __share_tls.get();
+    return share > 0 ? share : (Float) 1;
+}
+
 bool Scheduler::schedule(ParallelProcess *process) {
     LockGuard lock(m_mutex);
 
@@ -261,6 +299,7 @@ bool Scheduler::schedule(ParallelProcess *process) {
             Log(rec->logLevel, "Waking inactive process %i..", rec->id);
 #endif
             rec->active = true;
+            resetUsage(rec);
             m_localQueue.push_back(rec->id);
             if (!process->isLocal())
                 m_remoteQueue.push_back(rec->id);
@@ -271,6 +310,18 @@ bool Scheduler::schedule(ParallelProcess *process) {
         return false;
     }
 
+    size_t footprint = process->getMemoryFootprint();
+    if (footprint > 0 && !(process->isLocal() || hasLocalWorkers())) {
+        bool fits = false;
+        for (size_t i=0; i<m_workers.size(); ++i) {
+            size_t limit = m_workers[i]->getMemoryLimit();
+            fits |= limit == 0 || limit >= footprint;
+        }
+        if (!fits)
+            Log(EError, "None of the workers has enough memory (%s) "
+                "for %s", memString(footprint).c_str(), process->toString().c_str());
+    }
+
     /* First, check that all resources are available and increase
        their reference count */
     const ParallelProcess::ResourceBindings &bindings = process->getResourceBindings();
@@ -284,6 +335,9 @@ bool Scheduler::schedule(ParallelProcess *process) {
     }
     ProcessRecord *rec = new ProcessRecord(m_processCounter++,
         process->getLogLevel(), m_mutex);
+    rec->memory = footprint;
+    rec->share = process->getShare() > 0 ? process->getShare() : getThreadShare();
+    resetUsage(rec);
     m_processes[process] = rec;
 #if defined(DEBUG_SCHED)
     Log(rec->logLevel, "Scheduling process %i: %s..", rec->id, process->toString().c_str());
@@ -424,29 +478,59 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
     return true;
 }
 
+void Scheduler::reissueWork(int id, WorkUnit *unit) {
+    LockGuard lock(m_mutex);
+    std::map<int, ParallelProcess *>::iterator it = m_idToProcess.find(id);
+    if (it == m_idToProcess.end())
+        return;
+    ParallelProcess *process = (*it).second;
+    ProcessRecord *rec = m_processes[process];
+
+    /* The unit is no longer in flight. Until it is handed out again, the
+       non-empty reissue queue prevents the process from terminating */
+    --rec->inflight;
+    rec->cond->signal();
+    if (rec->cancelled)
+        return;
+    rec->reissued.push_back(unit);
+
+    if (!rec->active) {
+        /* The process has finished generating work or is paused -- put it back into the queue */
+        rec->active = true;
+        resetUsage(rec);
+        m_localQueue.push_front(rec->id);
+        if (!process->isLocal())
+            m_remoteQueue.push_front(rec->id);
+    }
+    m_workAvailable->broadcast();
+}
+
 Scheduler::EStatus Scheduler::acquireWork(Item &item,
         bool local, bool onlyTry, bool keepLock) {
     UniqueLock lock(m_mutex);
     std::deque<int> &queue = local ? m_localQueue : m_remoteQueue;
     while (true) {
-        if (onlyTry && queue.size() == 0) {
+        std::deque<int>::iterator entry = findWork(queue, item);
+        if (onlyTry && entry == queue.end()) {
             return ENone;
         }
 
         /* Wait until work is available and return false
            if stop() is called */
-        while (queue.size() == 0 && m_running)
+        while (entry == queue.end() && m_running) {
             m_workAvailable->wait();
+            entry = findWork(queue, item);
+        }
 
         if (!m_running) {
             return EStop;
         }
 
-        /* Try to create a work unit from the parallel
-           process currently on top of the queue */
+        /* Try to create a work unit from the first parallel
+           process in the queue that fits on the executing node */
         ParallelProcess::EStatus wStatus;
+        int id = *entry;
         try {
-            int id = queue.front();
             if (item.id != id) {
                 /* First work unit from this parallel process - establish
                    connections to referenced resources and prepare the
@@ -454,7 +538,14 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
                 setProcessByID(item, id);
             }
 
-            wStatus = item.proc->generateWork(item.workUnit, item.workerIndex);
+            if (!item.rec->reissued.empty()) {
+                /* Hand out lost work units first */
+                item.workUnit->set(item.rec->reissued.front());
+                item.rec->reissued.pop_front();
+                wStatus = ParallelProcess::ESuccess;
+            } else {
+                wStatus = item.proc->generateWork(item.workUnit, item.workerIndex);
+            }
         } catch (const std::exception &ex) {
             Log(EWarn, "Caught an exception - canceling process %i: %s",
                 item.id, ex.what());
@@ -471,7 +562,7 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 #endif
             item.rec->morework = false;
             item.rec->active = false;
-            queue.pop_front();
+            queue.erase(std::find(queue.begin(), queue.end(), id));
             if (item.rec->inflight == 0)
                 signalProcessTermination(item.proc, item.rec);
         } else if (wStatus == ParallelProcess::EPause) {
@@ -479,11 +570,12 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
             Log(item.rec->logLevel, "Pausing process %i", item.rec->id);
 #endif
             item.rec->active = false;
-            queue.pop_front();
+            queue.erase(std::find(queue.begin(), queue.end(), id));
         }
     }
 
     item.rec->inflight++;
+    item.rec->usage += 1 / item.rec->share;
     item.stop = false;
 
     if (!keepLock)
@@ -495,6 +587,112 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
     return EOK;
 }
 
+Scheduler::EStatus Scheduler::acquireWork(Item &item, bool local,
+        bool onlyTry, bool keepLock, size_t count, std::vector<ref<WorkUnit> > &units,
+        std::vector<ref<WorkUnit> > &spare) {
+    std::deque<int> &queue = local ? m_localQueue : m_remoteQueue;
+    std::vector<WorkUnit *> batch;
+
+    while (true) {
+        EStatus status = acquireWork(item, local, onlyTry, true);
+        if (status != EOK)
+            return status;
+
+        /* The scheduler lock is still held at this point. Generate the
+           remaining work units from the same process in one go */
+        if (count <= 1 || std::find(queue.begin(), queue.end(), item.id) == queue.end())
+            break;
+
+        batch.clear();
+        for (size_t i=0; i<count-1; ++i) {
+            ref<WorkUnit> unit;
+            if (!spare.empty() && spare.back()->getClass()
+                    == item.workUnit->getClass()) {
+                unit = spare.back();
+                spare.pop_back();
+            } else {
+                unit = item.wp->createWorkUnit();
+            }
+            unit->incRef();
+            batch.push_back(unit);
+        }
+
+        ProcessRecord *rec = item.rec;
+        ParallelProcess::EStatus wStatus;
+        size_t generated = 0;
+        try {
+            wStatus = item.proc->generateWorkBatch(&batch[0],
+                batch.size(), generated, item.workerIndex);
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Caught an exception - canceling process %i: %s",
+                item.id, ex.what());
+            for (size_t i=0; i<batch.size(); ++i)
+                batch[i]->decRef();
+            /* Also return the first work unit before canceling */
+            rec->inflight--;
+            releaseLock();
+            cancel(item.proc);
+            continue;
+        }
+
+        for (size_t i=0; i<batch.size(); ++i) {
+            if (i < generated)
+                units.push_back(batch[i]);
+            else
+                spare.push_back(batch[i]);
+            batch[i]->decRef();
+        }
+        rec->inflight += (int) generated;
+        rec->usage += generated / rec->share;
+
+        if (wStatus != ParallelProcess::ESuccess) {
+#if defined(DEBUG_SCHED)
+            if (wStatus == ParallelProcess::EFailure)
+                Log(rec->logLevel, "Process %i has finished generating work", rec->id);
+            else
+                Log(rec->logLevel, "Pausing process %i", rec->id);
+#endif
+            /* The work units acquired so far keep the process
+               alive, hence no termination check is needed here */
+            if (wStatus == ParallelProcess::EFailure)
+                rec->morework = false;
+            rec->active = false;
+            queue.erase(std::find(queue.begin(), queue.end(), rec->id));
+        }
+        break;
+    }
+
+    if (!keepLock)
+        releaseLock();
+    return EOK;
+}
+
+std::deque<int>::iterator Scheduler::findWork(std::deque<int> &queue, const Item &item) {
+    std::deque<int>::iterator best = queue.end();
+    Float bestUsage = std::numeric_limits<Float>::infinity();
+    for (std::deque<int>::iterator it = queue.begin(); it != queue.end(); ++it) {
+        const ProcessRecord *rec = m_processes[m_idToProcess[*it]];
+        if (item.memoryLimit != 0 && rec->memory > item.memoryLimit)
+            continue;
+        /* Ties are resolved in queue order */
+        if (rec->usage < bestUsage) {
+            best = it;
+            bestUsage = rec->usage;
+        }
+    }
+    return best;
+}
+
+void Scheduler::resetUsage(ProcessRecord *rec) {
+    /* The local queue contains every active process */
+    if (m_localQueue.empty())
+        return;
+    Float minUsage = std::numeric_limits<Float>::infinity();
+    for (std::deque<int>::iterator it = m_localQueue.begin(); it != m_localQueue.end(); ++it)
+        minUsage = std::min(minUsage, m_processes[m_idToProcess[*it]]->usage);
+    rec->usage = std::max(rec->usage, minUsage);
+}
+
 void Scheduler::signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec) {
 #if defined(DEBUG_SCHED)
     Log(rec->logLevel, "Process %i is complete.", rec->id);
@@ -633,6 +831,7 @@ void Worker::start(Scheduler *scheduler, int workerIndex, int coreOffset) {
 
 LocalWorker::LocalWorker(int coreID, const std::string &name,
         Thread::EThreadPriority priority) : Worker(name) {
+    m_queueMutex = new Mutex();
     if (coreID >= 0)
         setCoreAffinity(coreID);
     m_coreCount = 1;
@@ -646,10 +845,43 @@ LocalWorker::LocalWorker(int coreID, const std::string &name,
 LocalWorker::~LocalWorker() {
 }
 
+void LocalWorker::start(Scheduler *scheduler, int workerIndex, int coreOffset) {
+    /* Remember the other local workers as potential targets for work stealing */
+    m_peers.clear();
+    for (size_t i=0; i<scheduler->getWorkerCount(); ++i) {
+        Worker *worker = scheduler->getWorker((int) i);
+        if (worker != this && worker->getClass() == MTS_CLASS(LocalWorker))
+            m_peers.push_back(static_cast<LocalWorker *>(worker));
+    }
+    Worker::start(scheduler, workerIndex, coreOffset);
+}
+
+void LocalWorker::clear() {
+    Worker::clear();
+    LockGuard lock(m_queueMutex);
+    m_queue.clear();
+    m_spareUnits.clear();
+}
+
 void LocalWorker::run() {
-    while (acquireWork(true) != Scheduler::EStop) {
+    size_t batchSize = m_scheduler->getLocalBatchSize();
+    Statistics *stats = Statistics::getInstance();
+    ref<Timer> timer = new Timer(false);
+
+    while (true) {
+        if (batchSize > 1) {
+            if (!acquireQueuedWork(batchSize))
+                break;
+        } else if (acquireWork(true) == Scheduler::EStop) {
+            break;
+        }
+
         try {
+            timer->reset();
             m_schedItem.wp->process(m_schedItem.workUnit, m_schedItem.workResult, m_schedItem.stop);
+            if (!m_schedItem.stop)
+                stats->logWorkUnit(m_schedItem.proc->getClass()->getName(),
+                    "local", timer->getSecondsSinceStart());
         } catch (const std::exception &ex) {
             m_schedItem.stop = true;
             releaseWork(m_schedItem);
@@ -664,6 +896,84 @@ void LocalWorker::run() {
     }
 }
 
+bool LocalWorker::acquireQueuedWork(size_t batchSize) {
+    QueuedUnit unit;
+
+    /* 1. Take the oldest entry from the private queue. All of these
+          belong to the process referenced by m_schedItem */
+    {
+        LockGuard lock(m_queueMutex);
+        if (!m_queue.empty()) {
+            unit = m_queue.front();
+            m_queue.pop_front();
+        }
+    }
+    if (unit.workUnit) {
+        if (m_spareUnits.size() < batchSize)
+            m_spareUnits.push_back(m_schedItem.workUnit);
+        m_schedItem.workUnit = unit.workUnit;
+        return true;
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        /* 2. Ask the scheduler for a new batch (blocking on the second try) */
+        std::vector<ref<WorkUnit> > units;
+        Scheduler::EStatus status = acquireWork(true, attempt == 0,
+            false, batchSize, units, m_spareUnits);
+
+        if (status == Scheduler::EStop) {
+            return false;
+        } else if (status == Scheduler::EOK) {
+            LockGuard lock(m_queueMutex);
+            for (size_t i=0; i<units.size(); ++i) {
+                unit.id = m_schedItem.id;
+                unit.proc = m_schedItem.proc;
+                unit.rec = m_schedItem.rec;
+                unit.workUnit = units[i];
+                m_queue.push_back(unit);
+            }
+            return true;
+        }
+
+        /* 3. The scheduler has nothing to offer right now -- try to
+              take over work that was prefetched by another worker */
+        if (attempt == 0 && steal(unit)) {
+            if (unit.id != m_schedItem.id) {
+                try {
+                    setProcessByID(m_schedItem, unit.id);
+                } catch (const std::exception &ex) {
+                    Log(EWarn, "Caught an exception - canceling process %i: %s",
+                        unit.id, ex.what());
+                    cancel(unit.proc, true);
+                    m_schedItem.id = -1;
+                    continue;
+                }
+            }
+            m_schedItem.workUnit = unit.workUnit;
+            m_schedItem.stop = false;
+            ++stolenWorkUnits;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LocalWorker::steal(QueuedUnit &unit) {
+    size_t peerCount = m_peers.size();
+    for (size_t i=0; i<peerCount; ++i) {
+        /* Start with the next worker to spread out the stealing */
+        LocalWorker *victim = m_peers[(m_schedItem.workerIndex + i) % peerCount];
+        LockGuard lock(victim->m_queueMutex);
+        if (!victim->m_queue.empty()) {
+            /* Take the most recently generated entry */
+            unit = victim->m_queue.back();
+            victim->m_queue.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
 void LocalWorker::signalResourceExpiration(int id) {
     /* No-op for local workers */
 }
@@ -675,6 +985,20 @@ void LocalWorker::signalProcessTermination(int id) {
 void LocalWorker::signalProcessCancellation(int id) {
     if (m_schedItem.id == id)
         m_schedItem.stop = true;
+
+    /* Discard prefetched work units of the cancelled process. The
+       scheduler lock is held, hence the in-flight count can be
+       directly adjusted here */
+    LockGuard lock(m_queueMutex);
+    std::deque<QueuedUnit>::iterator it = m_queue.begin();
+    while (it != m_queue.end()) {
+        if (it->id == id) {
+            it->rec->inflight--;
+            it = m_queue.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
 
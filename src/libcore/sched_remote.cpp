@@ -19,8 +19,10 @@
 #include <mitsuba/core/sched_remote.h>
 #include <mitsuba/core/sstream.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/zstream.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/version.h>
+#include <mitsuba/core/statistics.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -38,7 +40,8 @@ private:
     ref<ParallelProcess> m_proc;
 };
 
-RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(name), m_stream(stream) {
+RemoteWorker::RemoteWorker(const std::string &name, Stream *stream,
+        const std::string &relayHosts, int fanout) : Worker(name), m_stream(stream) {
     const size_t dataLength = strlen(MTS_VERSION)+3;
     char *data = (char *) alloca(dataLength);
     strncpy(data, MTS_VERSION, strlen(MTS_VERSION)+1);
@@ -50,6 +53,8 @@ RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(nam
 #endif
     m_stream->writeShort(StreamBackend::EHello);
     m_stream->write(data, dataLength);
+    m_stream->writeInt(fanout);
+    m_stream->writeString(relayHosts);
     m_stream->flush();
 
     int msg = m_stream->readShort();
@@ -59,16 +64,44 @@ RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(nam
         Log(EError, "Received an invalid response!");
     m_coreCount = m_stream->readShort();
     m_nodeName = m_stream->readString();
+    m_remoteCache = m_stream->readBool();
+    m_schedItem.memoryLimit = m_stream->readSize();
+    m_queryPending = false;
+
+    /* Measure the round trip time of the connection */
+    m_timer = new Timer();
+    m_latency = std::numeric_limits<Float>::infinity();
+    for (int i=0; i<3; ++i) {
+        m_timer->reset();
+        m_stream->writeShort(StreamBackend::EPing);
+        m_stream->flush();
+        if (m_stream->readShort() != StreamBackend::EPong)
+            Log(EError, "Received an invalid response!");
+        m_latency = std::min(m_latency, m_timer->getSecondsSinceStart());
+    }
+    m_unitTime = 0;
+    m_lastCompletion = -1;
+    m_resultCount = 0;
+
     m_mutex = new Mutex();
     m_finishCond = new ConditionVariable(m_mutex);
     m_memStream = new MemoryStream();
     m_memStream->setByteOrder(Stream::ENetworkByteOrder);
+    m_chunkStream = new MemoryStream();
+    m_headerStream = new MemoryStream();
+    m_headerStream->setByteOrder(Stream::ENetworkByteOrder);
+    m_sendMutex = new Mutex();
+    m_uploading = -1;
+    m_compressionLevel = 1;
     m_reader = new RemoteWorkerReader(this);
     m_reader->start();
     m_inFlight = 0;
+    m_sequence = 0;
+    m_connected = true;
     m_isRemote = true;
-    Log(EDebug, "Connection to \"%s\" established (%i cores).",
-        m_nodeName.c_str(), m_coreCount);
+    Log(EDebug, "Connection to \"%s\" established (%i cores, %s, %.2f ms latency).",
+        m_nodeName.c_str(), m_coreCount, memString(m_schedItem.memoryLimit).c_str(),
+        m_latency * 1000.0f);
 }
 
 RemoteWorker::~RemoteWorker() {
@@ -78,45 +111,264 @@ RemoteWorker::~RemoteWorker() {
 
     LockGuard lock(m_mutex);
     m_reader->shutdown();
-    m_memStream->writeShort(StreamBackend::EQuit);
-    try {
-        flush();
-    } catch (std::runtime_error &e) {
-        Log(EWarn, "Could not flush buffer: %s", e.what());
+    if (m_connected) {
+        m_memStream->writeShort(StreamBackend::EQuit);
+        try {
+            flush();
+        } catch (std::runtime_error &e) {
+            Log(EWarn, "Could not flush buffer: %s", e.what());
+        }
     }
     m_reader->join();
 }
 
+std::vector<std::vector<std::string> > RemoteWorker::partitionBroadcastTree(
+        const std::vector<std::string> &hosts, int fanout) {
+    size_t childCount = hosts.size();
+    if (fanout > 0)
+        childCount = std::min(childCount, (size_t) fanout);
+
+    std::vector<std::vector<std::string> > result(childCount);
+    for (size_t i=0; i<hosts.size(); ++i)
+        result[i % childCount].push_back(hosts[i]);
+    return result;
+}
+
+ref<Stream> RemoteWorker::connect(const std::string &host) {
+    int port = MTS_DEFAULT_PORT;
+    std::vector<std::string> tokens = tokenize(host, ":");
+    char *end_ptr = NULL;
+    if (tokens.size() == 0 || tokens.size() > 2 || host.find("@") != std::string::npos) {
+        Log(EError, "Invalid host specification '%s'!", host.c_str());
+    } else if (tokens.size() == 2) {
+        port = strtol(tokens[1].c_str(), &end_ptr, 10);
+        if (*end_ptr != '\0')
+            Log(EError, "Invalid host specification '%s'!", host.c_str());
+    }
+    return new SocketStream(tokens[0], port);
+}
+
 void RemoteWorker::start(Scheduler *scheduler, int workerIndex, int coreOffset) {
     Worker::start(scheduler, workerIndex, coreOffset);
     m_reader->m_schedItem.coreOffset = coreOffset;
 }
 
 void RemoteWorker::flush() {
+    LockGuard sendLock(m_sendMutex);
     m_memStream->seek(0);
     m_memStream->copyTo(m_stream);
     m_memStream->reset();
     m_stream->flush();
 }
 
+void RemoteWorker::sendResource(UniqueLock &lock, short type, int resID, const MemoryStream *data) {
+    const size_t size = data->getPos();
+    size_t offset = 0, sent = 0;
+    int progress = 0;
+    ref<Timer> timer = new Timer();
+    ScopedPhase phase(formatString("Send resources to \"%s\"", m_nodeName.c_str()));
+
+    /* Large resources are announced with a progress message every 10 percent */
+    bool verbose = size > MTS_RESOURCE_CHUNK_SIZE;
+    if (verbose)
+        Log(EInfo, "Sending resource %i to \"%s\" (%s)", resID,
+            m_nodeName.c_str(), memString(size).c_str());
+
+    do {
+        size_t chunkSize = std::min(size - offset, (size_t) MTS_RESOURCE_CHUNK_SIZE);
+        const uint8_t *chunk = data->getData() + offset;
+        size_t packedSize = 0;
+
+        /* Compress without holding the lock, so that the reader
+           thread can process results in the meantime */
+        lock.unlock();
+
+        if (m_compressionLevel > 0) {
+            m_chunkStream->reset();
+            ref<ZStream> zstream = new ZStream(m_chunkStream,
+                ZStream::EDeflateStream, m_compressionLevel);
+            zstream->write(chunk, chunkSize);
+            zstream = NULL; /* Finish the ZLIB stream */
+            packedSize = m_chunkStream->getPos();
+        }
+
+        m_headerStream->reset();
+        m_headerStream->writeShort(type);
+        m_headerStream->writeInt(resID);
+        m_headerStream->writeSize(size);
+        m_headerStream->writeSize(chunkSize);
+        m_headerStream->writeSize(packedSize);
+
+        /* Threads with control messages hold the worker lock while they
+           wait for the stream, hence acquiring the worker lock first lets
+           them go ahead of the next chunk */
+        lock.lock();
+        if (!m_connected)
+            return;
+        {
+            LockGuard sendLock(m_sendMutex);
+            lock.unlock();
+            m_headerStream->seek(0);
+            m_headerStream->copyTo(m_stream);
+            if (packedSize > 0)
+                m_stream->write(m_chunkStream->getData(), packedSize);
+            else
+                m_stream->write(chunk, chunkSize);
+            m_stream->flush();
+        }
+        lock.lock();
+
+        offset += chunkSize;
+        sent += packedSize > 0 ? packedSize : chunkSize;
+
+        if (verbose && (int) (10 * offset / size) > progress) {
+            progress = (int) (10 * offset / size);
+            Log(EInfo, "Sending resource %i to \"%s\": %i%%", resID,
+                m_nodeName.c_str(), progress * 10);
+        }
+    } while (offset < size);
+
+    Log(verbose ? EInfo : EDebug, "Sent resource %i to \"%s\" (%s, %s on the wire) in %s",
+        resID, m_nodeName.c_str(), memString(size).c_str(), memString(sent).c_str(),
+        timeString(timer->getMilliseconds() / 1000.0f).c_str());
+}
+
+size_t RemoteWorker::getBacklog() const {
+    if (m_resultCount < MTS_ADAPTIVE_BACKLOG_RESULTS || m_unitTime <= 0)
+        return MTS_BACKLOG_FACTOR * m_coreCount;
+
+    /* One work unit per remote core, plus the number of units that the node
+       finishes during one round trip. Add half of that again (and at least
+       one unit) to absorb fluctuations of the latency and throughput */
+    Float perRoundTrip = m_latency / m_unitTime;
+    size_t backlog = m_coreCount + (size_t) std::ceil(1.5f * perRoundTrip) + 1;
+    return std::min(backlog, (size_t) MTS_MAX_BACKLOG_FACTOR * m_coreCount);
+}
+
+Float RemoteWorker::signalCompletion(int sequence) {
+    LockGuard lock(m_mutex);
+    std::map<int, OutstandingUnit>::iterator it = m_outstanding.find(sequence);
+    if (it == m_outstanding.end())
+        Log(EError, "Received a result for an unknown work unit (%i)", sequence);
+    Float now = m_timer->getSeconds(), sent = it->second.sent;
+    m_returnedUnits.push_back(it->second.workUnit);
+    m_outstanding.erase(it);
+
+    /* Track the time between results while all cores of the node are
+       busy, which is the inverse of its throughput */
+    if (m_lastCompletion >= 0 && m_inFlight >= m_coreCount) {
+        Float elapsed = now - m_lastCompletion;
+        m_unitTime = m_resultCount == 0 ? elapsed
+            : 0.9f * m_unitTime + 0.1f * elapsed;
+        m_resultCount++;
+    }
+    m_lastCompletion = now;
+    m_inFlight--;
+    m_finishCond->signal();
+    return now - sent;
+}
+
+void RemoteWorker::handleConnectionLoss(const std::string &reason) {
+    std::map<int, OutstandingUnit> outstanding;
+    {
+        LockGuard lock(m_mutex);
+        if (!m_connected)
+            return;
+        m_connected = false;
+        outstanding.swap(m_outstanding);
+        m_inFlight = 0;
+        m_finishCond->broadcast();
+    }
+
+    Log(EWarn, "Lost the connection to \"%s\" (%s) -- handing out its %i "
+        "work unit(s) to other workers", m_nodeName.c_str(), reason.c_str(),
+        (int) outstanding.size());
+
+    /* Do this without holding the lock, since the scheduler lock
+       is acquired first when the scheduler calls into this worker */
+    for (std::map<int, OutstandingUnit>::iterator it = outstanding.begin();
+            it != outstanding.end(); ++it)
+        reissueWork(it->second.id, it->second.workUnit);
+}
+
+ref<WorkUnit> RemoteWorker::getSpareWorkUnit() {
+    const Class *cls = m_schedItem.workUnit->getClass();
+    m_spareUnits.insert(m_spareUnits.end(),
+        m_returnedUnits.begin(), m_returnedUnits.end());
+    m_returnedUnits.clear();
+    for (size_t i=0; i<m_spareUnits.size(); ++i) {
+        if (m_spareUnits[i]->getClass() == cls) {
+            ref<WorkUnit> unit = m_spareUnits[i];
+            m_spareUnits.erase(m_spareUnits.begin() + i);
+            return unit;
+        }
+    }
+    return m_schedItem.wp->createWorkUnit();
+}
+
+size_t RemoteWorker::getBatchSize() {
+    /* Acquire enough work units to fill up the backlog, but not more
+       than one per remote core at a time */
+    LockGuard lock(m_mutex);
+    size_t backlog = getBacklog();
+    if (m_inFlight + 1 >= backlog)
+        return 1;
+    return std::min(backlog - m_inFlight, m_coreCount);
+}
+
 void RemoteWorker::run() {
+    try {
+        runLoop();
+    } catch (std::runtime_error &e) {
+        handleConnectionLoss(e.what());
+    }
+}
+
+void RemoteWorker::runLoop() {
     Scheduler::EStatus status;
+    std::vector<ref<WorkUnit> > units;
 
-    while ((status = acquireWork(false, true, true)) != Scheduler::EStop) {
+    while ((status = acquireWork(false, true, true, getBatchSize(),
+            units, m_spareUnits)) != Scheduler::EStop) {
         if (status == Scheduler::ENone) {
             flush();
-            if ((status = acquireWork(false, false, true)) == Scheduler::EStop)
+            if ((status = acquireWork(false, false, true, getBatchSize(),
+                    units, m_spareUnits)) == Scheduler::EStop)
                 break;
         }
         /* Acquire the lock each iteration, release it at the end of each one */
-        LockGuard lock(m_mutex);
+        UniqueLock lock(m_mutex);
 
         const int id = m_schedItem.rec->id;
+        if (!m_connected) {
+            /* The node went away while the scheduler was handing out
+               these units -- return them so that others can process them */
+            releaseSchedulerLock();
+            std::vector<ref<WorkUnit> > lost(units);
+            lost.push_back(m_schedItem.workUnit);
+            m_schedItem.workUnit = m_schedItem.wp->createWorkUnit();
+            units.clear();
+            lock.unlock();
+            for (size_t i=0; i<lost.size(); ++i)
+                reissueWork(id, lost[i]);
+            break;
+        }
+
+        /* Keep track of the units until their results arrive, so that
+           they can be handed out again should the node go away */
+        Float sent = m_timer->getSeconds();
+        m_outstanding[m_sequence++] = OutstandingUnit(id, m_schedItem.workUnit, sent);
+        for (size_t i=0; i<units.size(); ++i)
+            m_outstanding[m_sequence++] = OutstandingUnit(id, units[i], sent);
+        int sequence = m_sequence - (int) units.size() - 1;
+        m_inFlight += 1 + units.size();
+
         if (m_processes.find(id) == m_processes.end()) {
             /* The backend has not yet seen this process - submit
                all information required to receive and execute work
                units on the other side */
             std::vector<std::pair<int, const MemoryStream *> > resources;
+            std::vector<std::string> hashes;
             std::vector<std::pair<int, const SerializableObject *> > multiResources;
 
             /* First, look up all resources required by this process (the scheduler lock
@@ -130,6 +382,8 @@ void RemoteWorker::run() {
                     if (!m_scheduler->isMultiResource(resID)) {
                         resources.push_back(std::pair<int, const MemoryStream *>(resID,
                             m_scheduler->getResourceStream(resID)));
+                        if (m_remoteCache)
+                            hashes.push_back(m_scheduler->getResourceHash(resID));
                     } else {
                         for (size_t i=0; i<m_coreCount; ++i)
                             multiResources.push_back(std::pair<int, const SerializableObject *>(resID,
@@ -138,9 +392,9 @@ void RemoteWorker::run() {
                 }
                 m_resources.insert(resID);
             }
-            /* We can safely release the scheduler lock now. The local message buffer lock is still
-               held and thus, there is no danger of sending a cancellation message for a process which
-               the remote side has not even seen yet. */
+            /* We can safely release the scheduler lock now. Until all information about the
+               process has been sent, cancellation messages for it are held back (see
+               signalProcessCancellation()), hence the remote side always sees the process first. */
             releaseSchedulerLock();
 
             std::vector<std::string> plugins = m_schedItem.proc->getRequiredPlugins();
@@ -156,20 +410,44 @@ void RemoteWorker::run() {
             m_memStream->writeShort(StreamBackend::ENewProcess);
             m_memStream->writeInt(id);
             m_memStream->writeInt(m_schedItem.proc->getLogLevel());
+            m_memStream->writeSize(m_schedItem.proc->getMemoryFootprint());
 
             ref<InstanceManager> manager = new InstanceManager();
             manager->serialize(m_memStream, m_schedItem.wp);
             m_processes.insert(id);
+            m_uploading = id;
+
+            /* Send any pending messages, followed by the resources. Each
+               remote worker runs in its own thread, hence the nodes
+               receive their resources concurrently */
+            flush();
+
+            /* Ask the remote node which resources it has cached from earlier jobs */
+            m_cachedResources.clear();
+            if (m_remoteCache && !resources.empty()) {
+                m_memStream->writeShort(StreamBackend::EResourceQuery);
+                m_memStream->writeInt(id);
+                m_memStream->writeInt((int) resources.size());
+                for (size_t i=0; i<resources.size(); ++i) {
+                    m_memStream->writeInt(resources[i].first);
+                    m_memStream->writeString(hashes[i]);
+                }
+                m_queryPending = true;
+                flush();
+
+                /* The reply is received by the reader thread */
+                while (m_queryPending && m_connected)
+                    m_finishCond->wait();
+            }
 
             for (size_t i=0; i<resources.size(); ++i) {
                 int resID = resources[i].first;
-                const MemoryStream *resStream = resources[i].second;
-                Log(EDebug, "Sending resource %i to \"%s\" (%i KB)", resID, m_nodeName.c_str(),
-                    resStream->getPos() / 1024);
-                m_memStream->writeShort(StreamBackend::ENewResource);
-                m_memStream->writeInt(resID);
-                m_memStream->writeSize(resStream->getPos());
-                m_memStream->write(resStream->getData(), resStream->getPos());
+                if (m_cachedResources.find(resID) != m_cachedResources.end()) {
+                    Log(EDebug, "Resource %i is already cached by \"%s\"", resID,
+                        m_nodeName.c_str());
+                    continue;
+                }
+                sendResource(lock, StreamBackend::ENewResource, resID, resources[i].second);
             }
 
             for (size_t i=0; i<multiResources.size(); i += m_coreCount) {
@@ -179,12 +457,15 @@ void RemoteWorker::run() {
                 resStream->setByteOrder(Stream::ENetworkByteOrder);
                 for (size_t j=0; j<m_coreCount; ++j)
                     manager->serialize(resStream, multiResources[i+j].second);
-                Log(EDebug, "Sending multi resource %i to \"%s\" (%i KB)", resID, m_nodeName.c_str(),
-                    resStream->getPos() / 1024);
-                m_memStream->writeShort(StreamBackend::ENewMultiResource);
-                m_memStream->writeInt(resID);
-                m_memStream->writeSize(resStream->getPos());
-                m_memStream->write(resStream->getData(), resStream->getPos());
+                sendResource(lock, StreamBackend::ENewMultiResource, resID, resStream);
+            }
+
+            if (!m_connected) {
+                /* The outstanding units were already handed out again */
+                m_schedItem.workUnit = m_schedItem.wp->createWorkUnit();
+                units.clear();
+                m_uploading = -1;
+                break;
             }
 
             for (ParallelProcess::ResourceBindings::const_iterator it = bindings.begin();
@@ -200,24 +481,47 @@ void RemoteWorker::run() {
 
         m_memStream->writeShort(StreamBackend::EWorkUnit);
         m_memStream->writeInt(id);
+        m_memStream->writeInt(sequence++);
         m_schedItem.workUnit->save(m_memStream);
 
-        if (++m_inFlight == MTS_BACKLOG_FACTOR * m_coreCount) {
+        /* Submit any further work units that were generated in the same batch */
+        for (size_t i=0; i<units.size(); ++i) {
+            m_memStream->writeShort(StreamBackend::EWorkUnit);
+            m_memStream->writeInt(id);
+            m_memStream->writeInt(sequence++);
+            units[i]->save(m_memStream);
+        }
+        units.clear();
+
+        if (m_uploading != -1) {
+            /* Release any held back messages about this process */
+            m_uploading = -1;
+            m_finishCond->broadcast();
+        }
+
+        /* The unit that was just sent is still owned by m_outstanding */
+        m_schedItem.workUnit = getSpareWorkUnit();
+
+        size_t backlog = getBacklog();
+        if (m_inFlight >= backlog) {
             flush();
             /* There are now too many packets in transit. Wait
                until this clears up a bit before attempting to
                send more work */
-            while (m_inFlight > MTS_CONTINUE_FACTOR * m_coreCount)
+            size_t resume = std::max((size_t) 1,
+                backlog * MTS_CONTINUE_FACTOR / MTS_BACKLOG_FACTOR);
+            while (m_inFlight > resume && m_connected)
                 m_finishCond->wait();
         }
     }
     LockGuard lock(m_mutex);
-    flush();
+    if (m_connected)
+        flush();
 }
 
 void RemoteWorker::signalResourceExpiration(int id) {
     LockGuard lock(m_mutex);
-    if (m_resources.find(id) == m_resources.end()) {
+    if (!m_connected || m_resources.find(id) == m_resources.end()) {
         return;
     }
     m_memStream->writeShort(StreamBackend::EResourceExpired);
@@ -228,7 +532,11 @@ void RemoteWorker::signalResourceExpiration(int id) {
 
 void RemoteWorker::signalProcessCancellation(int id) {
     LockGuard lock(m_mutex);
-    if (m_processes.find(id) == m_processes.end()) {
+    /* The remote side must see the complete process and
+       its first work units before the cancellation */
+    while (m_uploading == id && m_connected)
+        m_finishCond->wait();
+    if (!m_connected || m_processes.find(id) == m_processes.end()) {
         return;
     }
     m_memStream->writeShort(StreamBackend::EProcessCancelled);
@@ -239,7 +547,7 @@ void RemoteWorker::signalProcessCancellation(int id) {
 
 void RemoteWorker::signalProcessTermination(int id) {
     LockGuard lock(m_mutex);
-    if (m_processes.find(id) == m_processes.end()) {
+    if (!m_connected || m_processes.find(id) == m_processes.end()) {
         return;
     }
     m_memStream->writeShort(StreamBackend::EProcessTerminated);
@@ -250,6 +558,8 @@ void RemoteWorker::signalProcessTermination(int id) {
 
 void RemoteWorker::clear() {
     Worker::clear();
+    m_spareUnits.clear();
+    m_returnedUnits.clear();
     m_reader->m_schedItem.wp = NULL;
     m_reader->m_schedItem.workUnit = NULL;
     m_reader->m_schedItem.workResult = NULL;
@@ -278,16 +588,35 @@ void RemoteWorkerReader::run() {
             }
 
             switch (msg) {
-                case StreamBackend::EWorkResult:
-                    m_schedItem.workResult->load(m_stream);
-                    m_schedItem.stop = false;
-                    m_parent->releaseWork(m_schedItem);
-                    m_parent->signalCompletion();
+                case StreamBackend::EWorkResult: {
+                        int sequence = m_stream->readInt();
+                        m_schedItem.workResult->load(m_stream);
+                        m_schedItem.stop = false;
+                        /* The unit will not be reissued from here on */
+                        Float time = m_parent->signalCompletion(sequence);
+                        Statistics::getInstance()->logWorkUnit(
+                            m_schedItem.proc->getClass()->getName(),
+                            m_parent->getNodeName(), time);
+                        m_parent->releaseWork(m_schedItem);
+                    }
+                    break;
+                case StreamBackend::ECancelledWorkResult: {
+                        int sequence = m_stream->readInt();
+                        m_schedItem.stop = true;
+                        m_parent->signalCompletion(sequence);
+                        m_parent->releaseWork(m_schedItem);
+                    }
                     break;
-                case StreamBackend::ECancelledWorkResult:
-                    m_schedItem.stop = true;
-                    m_parent->releaseWork(m_schedItem);
-                    m_parent->signalCompletion();
+                case StreamBackend::EResourceStatus: {
+                        int count = m_stream->readInt();
+                        std::vector<int> cached(count);
+                        for (int i=0; i<count; ++i)
+                            cached[i] = m_stream->readInt();
+                        LockGuard lock(m_parent->m_mutex);
+                        m_parent->m_cachedResources.insert(cached.begin(), cached.end());
+                        m_parent->m_queryPending = false;
+                        m_parent->m_finishCond->broadcast();
+                    }
                     break;
                 case StreamBackend::EProcessCancelled: {
                         Log(EWarn, "Process %i encountered a problem on node \"%s\"."
@@ -306,7 +635,7 @@ void RemoteWorkerReader::run() {
             };
         } catch (std::runtime_error &e) {
             if (!m_shutdown)
-                throw e;
+                m_parent->handleConnectionLoss(e.what());
             break;
         }
     }
@@ -323,7 +652,9 @@ void RemoteWorkerReader::run() {
 StreamBackend::StreamBackend(const std::string &thrName, Scheduler *scheduler,
         const std::string &nodeName, Stream *stream, bool detach) : Thread(thrName),
         m_scheduler(scheduler), m_nodeName(nodeName), m_stream(stream), m_detach(detach) {
+    m_memoryLimit = getTotalSystemMemory();
     m_sendMutex = new Mutex();
+    m_chunkStream = new MemoryStream();
     m_memStream = new MemoryStream();
     m_memStream->setByteOrder(Stream::ENetworkByteOrder);
 }
@@ -366,9 +697,19 @@ void StreamBackend::run() {
     }
 
     Log(EDebug, "Program versions match.");
+
+    /* Connect to the nodes that this one should relay to. This must
+       happen before replying, since the reported core count includes them */
+    int fanout = m_stream->readInt();
+    std::vector<std::string> relayHosts = tokenize(m_stream->readString(), ";");
+    if (!relayHosts.empty())
+        connectRelays(relayHosts, fanout);
+
     m_memStream->writeShort(EHello);
     m_memStream->writeShort((short) m_scheduler->getCoreCount());
     m_memStream->writeString(m_nodeName);
+    m_memStream->writeBool(m_cache.get() != NULL);
+    m_memStream->writeSize(m_memoryLimit);
     m_memStream->seek(0);
     m_memStream->copyTo(m_stream);
     m_stream->flush();
@@ -381,38 +722,100 @@ void StreamBackend::run() {
                 case ENewProcess: {
                         int id = m_stream->readInt();
                         ELogLevel logLevel = (ELogLevel) m_stream->readInt();
+                        size_t footprint = m_stream->readSize();
                         ref<InstanceManager> manager = new InstanceManager();
                         ref<WorkProcessor> wp = static_cast<WorkProcessor *>(manager->getInstance(m_stream));
                         RemoteProcess *rp = new RemoteProcess(id, logLevel, this, wp);
+                        rp->setMemoryFootprint(footprint);
                         rp->incRef();
                         m_processes[id] = rp;
                     }
                     break;
-                case ENewResource: {
+                case ENewResource:
+                case ENewMultiResource: {
+                        /* Resources arrive in chunks, which are possibly compressed */
                         int id = m_stream->readInt();
                         size_t size = m_stream->readSize();
+                        size_t chunkSize = m_stream->readSize();
+                        size_t packedSize = m_stream->readSize();
+
+                        ref<MemoryStream> &mstream = m_partialResources[id];
+                        if (!mstream) {
+                            mstream = new MemoryStream(size);
+                            mstream->setByteOrder(Stream::ENetworkByteOrder);
+                        }
+                        size_t pos = mstream->getPos();
+                        mstream->seek(pos + chunkSize);
+                        uint8_t *target = mstream->getData() + pos;
+
+                        if (packedSize > 0) {
+                            m_chunkStream->reset();
+                            m_chunkStream->seek(packedSize);
+                            m_stream->read(m_chunkStream->getData(), packedSize);
+                            m_chunkStream->seek(0);
+                            ref<ZStream> zstream = new ZStream(m_chunkStream);
+                            zstream->read(target, chunkSize);
+                        } else {
+                            m_stream->read(target, chunkSize);
+                        }
+
+                        if (mstream->getPos() < size)
+                            break;
+
+                        /* The resource is complete -- store it in the cache
+                           if its hash was announced, and unserialize it */
+                        ref<MemoryStream> data = mstream;
+                        m_partialResources.erase(id);
+                        std::map<int, std::string>::iterator hashIt = m_resourceHashes.find(id);
+                        if (hashIt != m_resourceHashes.end()) {
+                            if (m_cache)
+                                m_cache->store(hashIt->second, data);
+                            m_resourceHashes.erase(hashIt);
+                        }
+                        data->seek(0);
                         ref<InstanceManager> manager = new InstanceManager();
-                        ref<MemoryStream> mstream = new MemoryStream(size);
-                        mstream->setByteOrder(Stream::ENetworkByteOrder);
-                        m_stream->copyTo(mstream, size);
-                        mstream->seek(0);
-                        ref<SerializableObject> res = static_cast<SerializableObject *>(manager->getInstance(mstream));
-                        m_resources[id] = m_scheduler->registerResource(res);
+                        if (msg == ENewResource) {
+                            ref<SerializableObject> res = static_cast<SerializableObject *>(manager->getInstance(data));
+                            m_resources[id] = m_scheduler->registerResource(res);
+                        } else {
+                            size_t coreCount = m_scheduler->getCoreCount();
+                            std::vector<SerializableObject *> objects(coreCount);
+                            for (size_t i=0; i<coreCount; ++i)
+                                objects[i] = static_cast<SerializableObject *>(manager->getInstance(data));
+                            m_resources[id] = m_scheduler->registerMultiResource(objects);
+                        }
                     }
                     break;
-                case ENewMultiResource: {
-                        int id = m_stream->readInt();
-                        size_t size = m_stream->readSize();
-                        ref<InstanceManager> manager = new InstanceManager();
-                        ref<MemoryStream> mstream = new MemoryStream(size);
-                        mstream->setByteOrder(Stream::ENetworkByteOrder);
-                        m_stream->copyTo(mstream, size);
-                        mstream->seek(0);
-                        size_t coreCount = m_scheduler->getCoreCount();
-                        std::vector<SerializableObject *> objects(coreCount);
-                        for (size_t i=0; i<coreCount; ++i)
-                            objects[i] = static_cast<SerializableObject *>(manager->getInstance(mstream));
-                        m_resources[id] = m_scheduler->registerMultiResource(objects);
+                case EResourceQuery: {
+                        int procID = m_stream->readInt();
+                        int count = m_stream->readInt();
+                        std::vector<int> cached;
+                        for (int i=0; i<count; ++i) {
+                            int id = m_stream->readInt();
+                            std::string hash = m_stream->readString();
+                            ref<MemoryStream> data = m_cache ? m_cache->load(hash) : NULL;
+                            if (!data) {
+                                m_resourceHashes[id] = hash;
+                                continue;
+                            }
+                            ref<InstanceManager> manager = new InstanceManager();
+                            ref<SerializableObject> res = static_cast<SerializableObject *>(manager->getInstance(data));
+                            m_resources[id] = m_scheduler->registerResource(res);
+                            cached.push_back(id);
+                        }
+                        Log(EInfo, "%i of %i resources were found in the resource cache",
+                            (int) cached.size(), count);
+
+                        LockGuard lock(m_sendMutex);
+                        m_memStream->reset();
+                        m_memStream->writeShort(EResourceStatus);
+                        m_memStream->writeInt(procID);
+                        m_memStream->writeInt((int) cached.size());
+                        for (size_t i=0; i<cached.size(); ++i)
+                            m_memStream->writeInt(cached[i]);
+                        m_memStream->seek(0);
+                        m_memStream->copyTo(m_stream);
+                        m_stream->flush();
                     }
                     break;
                 case EEnsurePluginLoaded: {
@@ -430,10 +833,11 @@ void StreamBackend::run() {
                     break;
                 case EWorkUnit : {
                         int id = m_stream->readInt();
+                        int sequence = m_stream->readInt();
                         RemoteProcess *rp = m_processes[id];
                         WorkUnit *wu = rp->getEmptyWorkUnit();
                         wu->load(m_stream);
-                        rp->putFullWorkUnit(wu);
+                        rp->putFullWorkUnit(wu, sequence);
                         m_scheduler->schedule(rp);
                     }
                     break;
@@ -461,6 +865,12 @@ void StreamBackend::run() {
                         m_resources.erase(id);
                     }
                     break;
+                case EPing: {
+                        LockGuard lock(m_sendMutex);
+                        m_stream->writeShort(EPong);
+                        m_stream->flush();
+                    }
+                    break;
                 case EQuit: running = false; break;
                 default: Log(EError, "Received an unknown message type: %i", msg);
             }
@@ -486,6 +896,18 @@ void StreamBackend::run() {
         m_scheduler->unregisterResource((*it).second);
     }
 
+    if (!m_relays.empty()) {
+        /* Disconnect from the relayed nodes */
+        bool running = m_scheduler->isRunning();
+        if (running)
+            m_scheduler->pause();
+        for (size_t i=0; i<m_relays.size(); ++i)
+            m_scheduler->unregisterWorker(m_relays[i]);
+        m_relays.clear();
+        if (running)
+            m_scheduler->start();
+    }
+
     if (m_stream->getClass()->derivesFrom(MTS_CLASS(SocketStream))) {
         SocketStream *sstream = static_cast<SocketStream *>(m_stream.get());
         Log(EInfo, "Closing connection to %s - received %i KB / sent %i KB",
@@ -494,16 +916,57 @@ void StreamBackend::run() {
     }
 }
 
-void StreamBackend::sendCancellation(int id, int numLost) {
+void StreamBackend::connectRelays(const std::vector<std::string> &hosts, int fanout) {
+    std::vector<std::vector<std::string> > tree =
+        RemoteWorker::partitionBroadcastTree(hosts, fanout);
+    std::vector<ref<RemoteWorker> > workers;
+    size_t reached = 0;
+
+    for (size_t i=0; i<tree.size(); ++i) {
+        std::string subtree;
+        for (size_t j=1; j<tree[i].size(); ++j)
+            subtree += (j > 1 ? ";" : "") + tree[i][j];
+
+        try {
+            workers.push_back(new RemoteWorker(formatString("%s_relay%i",
+                getName().c_str(), (int) i), RemoteWorker::connect(tree[i][0]),
+                subtree, fanout));
+            reached += tree[i].size();
+        } catch (const std::exception &e) {
+            Log(EWarn, "Could not relay to \"%s\" (%s) -- %i node(s) will not "
+                "be used", tree[i][0].c_str(), e.what(), (int) tree[i].size());
+        }
+    }
+
+    if (workers.empty())
+        return;
+
+    /* Workers can only be added while the scheduler is paused */
+    bool running = m_scheduler->isRunning();
+    if (running)
+        m_scheduler->pause();
+    for (size_t i=0; i<workers.size(); ++i) {
+        m_scheduler->registerWorker(workers[i]);
+        m_relays.push_back(workers[i]);
+    }
+    if (running)
+        m_scheduler->start();
+
+    Log(EInfo, "Relaying to %i of %i node(s) through %i direct connection(s)",
+        (int) reached, (int) hosts.size(), (int) workers.size());
+}
+
+void StreamBackend::sendCancellation(int id, const std::deque<int> &lost) {
     Log(EInfo, "Notifying the remote side about the cancellation of process %i", id);
 
     LockGuard lock(m_sendMutex);
     m_memStream->reset();
     m_memStream->writeShort(EProcessCancelled);
     m_memStream->writeInt(id);
-    for (int i=0; i<numLost; ++i) {
+    for (size_t i=0; i<lost.size(); ++i) {
         m_memStream->writeShort(ECancelledWorkResult);
         m_memStream->writeInt(id);
+        m_memStream->writeInt(lost[i]);
     }
     try {
         m_memStream->seek(0);
@@ -516,11 +979,13 @@ void StreamBackend::sendCancellation(int id, int numLost) {
     }
 }
 
-void StreamBackend::sendWorkResult(int id, const WorkResult *result, bool cancelled) {
+void StreamBackend::sendWorkResult(int id, int sequence,
+        const WorkResult *result, bool cancelled) {
     LockGuard lock(m_sendMutex);
     m_memStream->reset();
     m_memStream->writeShort(cancelled ? ECancelledWorkResult : EWorkResult);
     m_memStream->writeInt(id);
+    m_memStream->writeInt(sequence);
     if (!cancelled)
         result->save(m_memStream);
     try {
@@ -562,8 +1027,10 @@ ParallelProcess::EStatus RemoteProcess::generateWork(WorkUnit *unit, int worker)
     LockGuard lock(m_mutex);
     if (m_full.size() > 0) {
         unit->set(m_full.front());
+        m_activeSequence[unit] = m_fullSequence.front();
         m_empty.push_back(m_full.front());
         m_full.pop_front();
+        m_fullSequence.pop_front();
         status = ESuccess;
     } else {
         status = m_done ? EFailure : EPause;
@@ -572,7 +1039,22 @@ ParallelProcess::EStatus RemoteProcess::generateWork(WorkUnit *unit, int worker)
 }
 
 void RemoteProcess::processResult(const WorkResult *result, bool cancelled) {
-    m_backend->sendWorkResult(m_id, result, cancelled);
+    Log(EError, "RemoteProcess::processResult(): results must be "
+        "associated with their work unit!");
+}
+
+void RemoteProcess::processUnitResult(const WorkUnit *unit,
+        const WorkResult *result, bool cancelled) {
+    int sequence;
+    {
+        LockGuard lock(m_mutex);
+        std::map<const WorkUnit *, int>::iterator it = m_activeSequence.find(unit);
+        if (it == m_activeSequence.end())
+            Log(EError, "RemoteProcess::processUnitResult(): unknown work unit!");
+        sequence = it->second;
+        m_activeSequence.erase(it);
+    }
+    m_backend->sendWorkResult(m_id, sequence, result, cancelled);
 }
 
 ref<WorkProcessor> RemoteProcess::createWorkProcessor() const {
@@ -584,9 +1066,10 @@ void RemoteProcess::handleCancellation() {
     /* Also acquire the local queue mutex, purge all queued
        work units and inform the remote side how many were lost */
     LockGuard lock(m_mutex);
-    m_backend->sendCancellation(m_id, (int) m_full.size());
+    m_backend->sendCancellation(m_id, m_fullSequence);
     m_empty.insert(m_empty.end(), m_full.begin(), m_full.end());
     m_full.clear();
+    m_fullSequence.clear();
 }
 
 MTS_IMPLEMENT_CLASS(RemoteWorker, false, Worker)
@@ -59,6 +59,92 @@ Float evalCubicInterp1D(Float x, const Float *values, size_t size, Float min, Fl
         (   t3 - t2)       * d1;
 }
 
+/**
+ * \brief Evaluate a uniform 1D spline at a knot-space position \c t
+ *
+ * Unlike in \ref evalCubicInterp1D(), the endpoint derivatives are
+ * expressed through mirrored ghost nodes, which keeps the arithmetic
+ * identical for all intervals (and for all SSE lanes).
+ */
+static inline Float evalUniform1D(Float t, const Float *values, size_t size) {
+    size_t k = (t > 0) ? std::min((size_t) t, size - 2) : 0;
+    Float f0 = values[k], f1 = values[k+1],
+          fm1 = (k > 0) ? values[k-1] : 2*f0 - f1,
+          fp2 = (k + 2 < size) ? values[k+2] : 2*f1 - f0,
+          d0 = 0.5f * (f1 - fm1),
+          d1 = 0.5f * (fp2 - f0);
+
+    t = t - (Float) k;
+    Float t2 = t*t, t3 = t2*t;
+
+    return
+        ( 2*t3 - 3*t2 + 1) * f0 +
+        (-2*t3 + 3*t2)     * f1 +
+        (   t3 - 2*t2 + t) * d0 +
+        (   t3 - t2)       * d1;
+}
+
+void evalCubicInterp1D(size_t count, const Float *x, Float *result,
+        const Float *values, size_t size, Float min, Float max, bool extrapolate) {
+    const Float scale = (size - 1) / (max - min);
+    size_t i = 0;
+
+#if defined(MTS_SSE)
+    const __m128
+        minV = _mm_set1_ps(min), maxV = _mm_set1_ps(max),
+        scaleV = _mm_set1_ps(scale), maxKnot = _mm_set1_ps((float) (size - 2)),
+        half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f),
+        two = _mm_set1_ps(2.0f), three = _mm_set1_ps(3.0f);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 xv = _mm_loadu_ps(x + i),
+               t = _mm_mul_ps(_mm_sub_ps(xv, minV), scaleV),
+               kf = _mm_min_ps(_mm_max_ps(_mm_cvtepi32_ps(
+                   _mm_cvttps_epi32(t)), _mm_setzero_ps()), maxKnot);
+
+        /* Gather the four nodes around every query (with ghost nodes) */
+        int idx[4];
+        float fm1[4], f0[4], f1[4], fp2[4];
+        _mm_storeu_si128((__m128i *) idx, _mm_cvttps_epi32(kf));
+        for (int j=0; j<4; ++j) {
+            size_t k = (size_t) idx[j];
+            f0[j] = values[k];
+            f1[j] = values[k+1];
+            fm1[j] = (k > 0) ? values[k-1] : 2*f0[j] - f1[j];
+            fp2[j] = (k + 2 < size) ? values[k+2] : 2*f1[j] - f0[j];
+        }
+
+        __m128 v0 = _mm_loadu_ps(f0), v1 = _mm_loadu_ps(f1),
+               d0 = _mm_mul_ps(half, _mm_sub_ps(v1, _mm_loadu_ps(fm1))),
+               d1 = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(fp2), v0));
+
+        t = _mm_sub_ps(t, kf);
+        __m128 t2 = _mm_mul_ps(t, t), t3 = _mm_mul_ps(t2, t),
+               h01 = _mm_sub_ps(_mm_mul_ps(three, t2), _mm_mul_ps(two, t3)),
+               h00 = _mm_sub_ps(one, h01),
+               h10 = _mm_add_ps(_mm_sub_ps(t3, _mm_mul_ps(two, t2)), t),
+               h11 = _mm_sub_ps(t3, t2);
+
+        __m128 r = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(h00, v0), _mm_mul_ps(h01, v1)),
+            _mm_add_ps(_mm_mul_ps(h10, d0), _mm_mul_ps(h11, d1)));
+
+        /* Out-of-range and NaN arguments evaluate to zero */
+        if (!extrapolate)
+            r = _mm_and_ps(r, _mm_and_ps(_mm_cmpge_ps(xv, minV), _mm_cmple_ps(xv, maxV)));
+
+        _mm_storeu_ps(result + i, r);
+    }
+#endif
+
+    for (; i<count; ++i) {
+        if (!(x[i] >= min && x[i] <= max) && !extrapolate)
+            result[i] = 0.0f;
+        else
+            result[i] = evalUniform1D((x[i] - min) * scale, values, size);
+    }
+}
+
 Float evalCubicInterp1DN(Float x, const Float *nodes, const Float *values, size_t size, bool extrapolate) {
     /* Give up when given an out-of-range or NaN argument */
     if (!(x >= nodes[0] && x <= nodes[size-1]) && !extrapolate)
@@ -233,62 +319,62 @@ Float sampleCubicInterp1DN(size_t idx, const Float *nodes, const Float *values,
     }
 }
 
-Float evalCubicInterp2D(const Point2 &p, const Float *values, const Size2 &size,
-        const Point2 &min, const Point2 &max, bool extrapolate) {
-    Float knotWeights[2][4];
-    Size2 knot;
-
-    /* Compute interpolation weights separately for each dimension */
-    for (int dim=0; dim<2; ++dim) {
-        Float *weights = knotWeights[dim];
-        /* Give up when given an out-of-range or NaN argument */
-        if (!(p[dim] >= min[dim] && p[dim] <= max[dim]) && !extrapolate)
-            return 0.0f;
-
-        /* Transform 'p' so that knots lie at integer positions */
-        Float t = ((p[dim] - min[dim]) * (size[dim] - 1))
-            / (max[dim]-min[dim]);
-
-        /* Find the index of the left knot in the queried subinterval, be
-           robust to cases where 't' lies exactly on the right endpoint */
-        knot[dim] = std::min((size_t) t, size[dim] - 2);
-
-        /* Compute the relative position within the interval */
-        t = t - (Float) knot[dim];
-
-        /* Compute node weights */
-        Float t2 = t*t, t3 = t2*t;
-        weights[0] = 0.0f;
-        weights[1] = 2*t3 - 3*t2 + 1;
-        weights[2] = -2*t3 + 3*t2;
-        weights[3] = 0.0f;
+/**
+ * \brief Compute the node weights of a uniform Catmull-Rom spline
+ *
+ * \param t
+ *     Query position, transformed so that the knots lie at integer positions
+ * \return
+ *     The index of the left knot of the queried interval. The weights
+ *     refer to the nodes <tt>knot-1, .., knot+2</tt>.
+ */
+static inline size_t computeUniformWeights(Float t, size_t size, Float *weights) {
+    /* Find the index of the left knot in the queried subinterval, be
+       robust to cases where 't' lies exactly on the right endpoint */
+    size_t knot = std::min((size_t) t, size - 2);
 
-        /* Derivative weights */
-        Float d0 = t3 - 2*t2 + t,
-              d1 = t3 - t2;
+    /* Compute the relative position within the interval */
+    t = t - (Float) knot;
 
-        /* Turn derivative weights into node weights using
-           an appropriate chosen finite differences stencil */
-        if (knot[dim] > 0) {
-            weights[2] +=  0.5f * d0;
-            weights[0] -=  0.5f * d0;
-        } else {
-            weights[2] += d0;
-            weights[1] -= d0;
-        }
+    /* Compute node weights */
+    Float t2 = t*t, t3 = t2*t;
+    weights[0] = 0.0f;
+    weights[1] = 2*t3 - 3*t2 + 1;
+    weights[2] = -2*t3 + 3*t2;
+    weights[3] = 0.0f;
+
+    /* Derivative weights */
+    Float d0 = t3 - 2*t2 + t,
+          d1 = t3 - t2;
+
+    /* Turn derivative weights into node weights using
+       an appropriate chosen finite differences stencil */
+    if (knot > 0) {
+        weights[2] +=  0.5f * d0;
+        weights[0] -=  0.5f * d0;
+    } else {
+        weights[2] += d0;
+        weights[1] -= d0;
+    }
 
-        if (knot[dim] + 2 < size[dim]) {
-            weights[3] += 0.5f * d1;
-            weights[1] -= 0.5f * d1;
-        } else {
-            weights[2] += d1;
-            weights[1] -= d1;
-        }
+    if (knot + 2 < size) {
+        weights[3] += 0.5f * d1;
+        weights[1] -= 0.5f * d1;
+    } else {
+        weights[2] += d1;
+        weights[1] -= d1;
     }
+    return knot;
+}
 
+/// Tensor product evaluation of a uniform 2D spline given the node weights
+static inline Float evalTensor2D(const Float *values, const Size2 &size,
+        const Size2 &knot, Float knotWeights[2][4]) {
     Float result = 0.0f;
     for (int y=-1; y<=2; ++y) {
         Float wy = knotWeights[1][y+1];
+        if (wy == 0)
+            continue;
         for (int x=-1; x<=2; ++x) {
             Float wxy = knotWeights[0][x+1] * wy;
 
@@ -303,6 +389,81 @@ Float evalCubicInterp2D(const Point2 &p, const Float *values, const Size2 &size,
     return result;
 }
 
+/// Tensor product evaluation of a uniform 3D spline given the node weights
+static inline Float evalTensor3D(const Float *values, const Size3 &size,
+        const Size3 &knot, Float knotWeights[3][4]) {
+    Float result = 0.0f;
+    for (int z=-1; z<=2; ++z) {
+        Float wz = knotWeights[2][z+1];
+        if (wz == 0)
+            continue;
+        for (int y=-1; y<=2; ++y) {
+            Float wyz = knotWeights[1][y+1] * wz;
+            if (wyz == 0)
+                continue;
+            for (int x=-1; x<=2; ++x) {
+                Float wxyz = knotWeights[0][x+1] * wyz;
+
+                if (wxyz == 0)
+                    continue;
+
+                size_t pos = ((knot[2] + z) * size[1] + (knot[1] + y))
+                    * size[0] + knot[0] + x;
+
+                result += values[pos] * wxyz;
+            }
+        }
+    }
+    return result;
+}
+
+Float evalCubicInterp2D(const Point2 &p, const Float *values, const Size2 &size,
+        const Point2 &min, const Point2 &max, bool extrapolate) {
+    Float knotWeights[2][4];
+    Size2 knot;
+
+    /* Compute interpolation weights separately for each dimension */
+    for (int dim=0; dim<2; ++dim) {
+        /* Give up when given an out-of-range or NaN argument */
+        if (!(p[dim] >= min[dim] && p[dim] <= max[dim]) && !extrapolate)
+            return 0.0f;
+
+        /* Transform 'p' so that knots lie at integer positions */
+        Float t = ((p[dim] - min[dim]) * (size[dim] - 1))
+            / (max[dim]-min[dim]);
+
+        knot[dim] = computeUniformWeights(t, size[dim], knotWeights[dim]);
+    }
+
+    return evalTensor2D(values, size, knot, knotWeights);
+}
+
+void evalCubicInterp2D(size_t count, const Point2 *p, Float *result,
+        const Float *values, const Size2 &size, const Point2 &min,
+        const Point2 &max, bool extrapolate) {
+    Float scale[2];
+    for (int dim=0; dim<2; ++dim)
+        scale[dim] = (size[dim] - 1) / (max[dim] - min[dim]);
+
+    for (size_t i=0; i<count; ++i) {
+        Float knotWeights[2][4];
+        Size2 knot;
+        bool valid = true;
+
+        for (int dim=0; dim<2; ++dim) {
+            Float x = p[i][dim];
+            if (!(x >= min[dim] && x <= max[dim]) && !extrapolate) {
+                valid = false;
+                break;
+            }
+            knot[dim] = computeUniformWeights((x - min[dim]) * scale[dim],
+                size[dim], knotWeights[dim]);
+        }
+
+        result[i] = valid ? evalTensor2D(values, size, knot, knotWeights) : 0.0f;
+    }
+}
+
 Float evalCubicInterp2DN(const Point2 &p, const Float **nodes_,
             const Float *values, const Size2 &size, bool extrapolate) {
     Float knotWeights[2][4];
@@ -383,7 +544,6 @@ Float evalCubicInterp3D(const Point3 &p, const Float *values, const Size3 &size,
 
     /* Compute interpolation weights separately for each dimension */
     for (int dim=0; dim<3; ++dim) {
-        Float *weights = knotWeights[dim];
         /* Give up when given an out-of-range or NaN argument */
         if (!(p[dim] >= min[dim] && p[dim] <= max[dim]) && !extrapolate)
             return 0.0f;
@@ -392,62 +552,36 @@ Float evalCubicInterp3D(const Point3 &p, const Float *values, const Size3 &size,
         Float t = ((p[dim] - min[dim]) * (size[dim] - 1))
             / (max[dim]-min[dim]);
 
-        /* Find the index of the left knot in the queried subinterval, be
-           robust to cases where 't' lies exactly on the right endpoint */
-        knot[dim] = std::min((size_t) t, size[dim] - 2);
-
-        /* Compute the relative position within the interval */
-        t = t - (Float) knot[dim];
-
-        /* Compute node weights */
-        Float t2 = t*t, t3 = t2*t;
-        weights[0] = 0.0f;
-        weights[1] = 2*t3 - 3*t2 + 1;
-        weights[2] = -2*t3 + 3*t2;
-        weights[3] = 0.0f;
-
-        /* Derivative weights */
-        Float d0 = t3 - 2*t2 + t,
-              d1 = t3 - t2;
-
-        /* Turn derivative weights into node weights using
-           an appropriate chosen finite differences stencil */
-        if (knot[dim] > 0) {
-            weights[2] +=  0.5f * d0;
-            weights[0] -=  0.5f * d0;
-        } else {
-            weights[2] += d0;
-            weights[1] -= d0;
-        }
-
-        if (knot[dim] + 2 < size[dim]) {
-            weights[3] += 0.5f * d1;
-            weights[1] -= 0.5f * d1;
-        } else {
-            weights[2] += d1;
-            weights[1] -= d1;
-        }
+        knot[dim] = computeUniformWeights(t, size[dim], knotWeights[dim]);
     }
 
-    Float result = 0.0f;
-    for (int z=-1; z<=2; ++z) {
-        Float wz = knotWeights[2][z+1];
-        for (int y=-1; y<=2; ++y) {
-            Float wyz = knotWeights[1][y+1] * wz;
-            for (int x=-1; x<=2; ++x) {
-                Float wxyz = knotWeights[0][x+1] * wyz;
-
-                if (wxyz == 0)
-                    continue;
-
-                size_t pos = ((knot[2] + z) * size[1] + (knot[1] + y))
-                    * size[0] + knot[0] + x;
+    return evalTensor3D(values, size, knot, knotWeights);
+}
 
-                result += values[pos] * wxyz;
+void evalCubicInterp3D(size_t count, const Point3 *p, Float *result,
+        const Float *values, const Size3 &size, const Point3 &min,
+        const Point3 &max, bool extrapolate) {
+    Float scale[3];
+    for (int dim=0; dim<3; ++dim)
+        scale[dim] = (size[dim] - 1) / (max[dim] - min[dim]);
+
+    for (size_t i=0; i<count; ++i) {
+        Float knotWeights[3][4];
+        Size3 knot;
+        bool valid = true;
+
+        for (int dim=0; dim<3; ++dim) {
+            Float x = p[i][dim];
+            if (!(x >= min[dim] && x <= max[dim]) && !extrapolate) {
+                valid = false;
+                break;
             }
+            knot[dim] = computeUniformWeights((x - min[dim]) * scale[dim],
+                size[dim], knotWeights[dim]);
         }
+
+        result[i] = valid ? evalTensor3D(values, size, knot, knotWeights) : 0.0f;
     }
-    return result;
 }
 
 Float evalCubicInterp3DN(const Point3 &p, const Float **nodes_,
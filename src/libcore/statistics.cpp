@@ -19,6 +19,7 @@
 #include <mitsuba/mitsuba.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/tls.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -29,7 +30,8 @@ MTS_NAMESPACE_BEGIN
 bool ProgressReporter::m_enabled = true;
 
 ProgressReporter::ProgressReporter(const std::string &title, long long total, const void *ptr)
- : m_title(title), m_total(total), m_value(0), m_percentage(-1), m_fillPos(0), m_ptr(ptr) {
+ : m_title(title), m_total(total), m_value(0), m_percentage(-1), m_fillPos(0), m_ptr(ptr),
+   m_logged(false) {
     m_fillSize = (int) (PROGRESS_MSG_SIZE - title.length() - 3);
     SAssert(m_fillSize > 0);
     for (int i=0; i<m_fillSize; i++)
@@ -51,12 +53,20 @@ void ProgressReporter::reset() {
     m_value = 0;
     m_percentage = -1;
     m_fillPos = 0;
+    m_logged = false;
 }
 
 void ProgressReporter::update(long long value) {
+    value = std::min(std::max(value, (long long) 0), (long long) m_total);
+
+    /* Record the duration even when progress bars are disabled */
+    if (value == m_total && !m_logged) {
+        Statistics::getInstance()->logProgress(m_title, m_timer->getSeconds());
+        m_logged = true;
+    }
+
     if (!m_enabled)
         return;
-    value = std::min(std::max(value, (long long) 0), (long long) m_total);
 
     Float perc = (value * 100.0f) / m_total;
     unsigned int curMs = m_timer->getMilliseconds();
@@ -112,6 +122,214 @@ bool StatsCounter::operator<(const StatsCounter &v) const {
     return getCategory() < v.getCategory();
 }
 
+/// Write a string literal with JSON escapes
+static void writeJSONString(std::ostream &os, const std::string &str) {
+    os << '"';
+    for (size_t i=0; i<str.length(); ++i) {
+        char c = str[i];
+        if (c == '"' || c == '\\')
+            os << '\\' << c;
+        else if ((unsigned char) c < 0x20)
+            os << ' ';
+        else
+            os << c;
+    }
+    os << '"';
+}
+
+/// Node of the phase timing tree
+struct Statistics::PhaseNode {
+    std::string name;
+    double time;
+    size_t count;
+    size_t memory;
+    std::vector<PhaseNode *> children;
+
+    inline PhaseNode(const std::string &name)
+        : name(name), time(0), count(0), memory(0) { }
+
+    ~PhaseNode() {
+        for (size_t i=0; i<children.size(); ++i)
+            delete children[i];
+    }
+
+    /// Look up a child by name and create it if necessary
+    PhaseNode *getChild(const std::string &name) {
+        for (size_t i=0; i<children.size(); ++i) {
+            if (children[i]->name == name)
+                return children[i];
+        }
+        PhaseNode *child = new PhaseNode(name);
+        children.push_back(child);
+        return child;
+    }
+
+    /* Nodes may still be referenced by active phases, hence
+       resetting only clears the times and counts */
+    void reset() {
+        time = 0;
+        count = 0;
+        memory = 0;
+        for (size_t i=0; i<children.size(); ++i)
+            children[i]->reset();
+    }
+
+    /// Were any phases recorded in the subtree of this node?
+    bool isEmpty() const {
+        if (count > 0)
+            return false;
+        for (size_t i=0; i<children.size(); ++i) {
+            if (!children[i]->isEmpty())
+                return false;
+        }
+        return true;
+    }
+
+    void toString(std::ostringstream &oss, int indent) const {
+        for (size_t i=0; i<children.size(); ++i) {
+            const PhaseNode *child = children[i];
+            if (child->isEmpty())
+                continue;
+            oss << std::string(indent, ' ') << "-  " << child->name << " : "
+                << timeString((Float) child->time, true);
+            if (child->count > 1)
+                oss << " (" << child->count << " times)";
+            if (child->memory > 0)
+                oss << ", +" << memString(child->memory) << " tracked memory";
+            oss << endl;
+            child->toString(oss, indent + 3);
+        }
+    }
+
+    void toJSON(std::ostringstream &oss) const {
+        bool first = true;
+        oss << "[";
+        for (size_t i=0; i<children.size(); ++i) {
+            const PhaseNode *child = children[i];
+            if (child->isEmpty())
+                continue;
+            if (!first)
+                oss << ", ";
+            first = false;
+            oss << "{\"name\": ";
+            writeJSONString(oss, child->name);
+            oss << ", \"time\": " << child->time
+                << ", \"count\": " << child->count
+                << ", \"memory\": " << child->memory
+                << ", \"children\": ";
+            child->toJSON(oss);
+            oss << "}";
+        }
+        oss << "]";
+    }
+};
+
+/// Current phase of every thread
+static PrimitiveThreadLocal<ScopedPhase::Handle> __phase_tls;
+
+ScopedPhase::ScopedPhase(const std::string &name) {
+    Statistics *stats = Statistics::getInstance();
+    Handle &current = __phase_tls.get();
+    Statistics::PhaseNode *parent = current ?
+        static_cast<Statistics::PhaseNode *>(current) : stats->m_phases;
+
+    stats->m_phaseMutex->lock();
+    m_node = parent->getChild(name);
+    stats->m_phaseMutex->unlock();
+
+    m_parent = current;
+    current = m_node;
+    m_memory = MemoryTracker::getTotalUsage();
+    m_timer = new Timer();
+}
+
+ScopedPhase::~ScopedPhase() {
+    Statistics *stats = Statistics::getInstance();
+    Statistics::PhaseNode *node = static_cast<Statistics::PhaseNode *>(m_node);
+    double time = (double) m_timer->getNanoseconds() * 1e-9;
+    size_t memory = MemoryTracker::getTotalUsage();
+    memory = memory > m_memory ? memory - m_memory : 0;
+
+    stats->m_phaseMutex->lock();
+    node->time += time;
+    node->count++;
+    node->memory = std::max(node->memory, memory);
+    stats->m_phaseMutex->unlock();
+
+    __phase_tls.get() = m_parent;
+}
+
+ScopedPhase::Handle ScopedPhase::getCurrent() {
+    return __phase_tls.get();
+}
+
+void ScopedPhase::setCurrent(Handle handle) {
+    __phase_tls.get() = handle;
+}
+
+/* Memory accounting */
+static volatile int64_t __memory_usage[EMemoryCategoryCount+1];
+static volatile int64_t __memory_peak[EMemoryCategoryCount+1];
+static size_t __memory_budget = 0;
+
+static const char *__memory_names[] = {
+    "kd-trees", "Triangle meshes", "MIP maps", "Point kd-trees",
+    "Image blocks", "Volumes"
+};
+
+void MemoryTracker::allocate(EMemoryCategory category, size_t size) {
+    int64_t total = atomicAdd(&__memory_usage[EMemoryCategoryCount], (int64_t) size);
+    if (__memory_budget != 0 && (size_t) total > __memory_budget) {
+        atomicAdd(&__memory_usage[EMemoryCategoryCount], -(int64_t) size);
+        std::ostringstream oss;
+        for (int i=0; i<EMemoryCategoryCount; ++i) {
+            if (__memory_usage[i] > 0)
+                oss << ", " << __memory_names[i] << ": " << memString((size_t) __memory_usage[i]);
+        }
+        SLog(EError, "Exceeded the memory budget of %s while allocating %s for "
+            "%s (tracked usage%s)", memString(__memory_budget).c_str(),
+            memString(size).c_str(), __memory_names[category], oss.str().c_str());
+    }
+    atomicMaximum(&__memory_peak[EMemoryCategoryCount], total);
+    atomicMaximum(&__memory_peak[category],
+        atomicAdd(&__memory_usage[category], (int64_t) size));
+}
+
+void MemoryTracker::release(EMemoryCategory category, size_t size) {
+    atomicAdd(&__memory_usage[category], -(int64_t) size);
+    atomicAdd(&__memory_usage[EMemoryCategoryCount], -(int64_t) size);
+}
+
+size_t MemoryTracker::getUsage(EMemoryCategory category) {
+    int64_t usage = __memory_usage[category];
+    return usage > 0 ? (size_t) usage : 0;
+}
+
+size_t MemoryTracker::getPeakUsage(EMemoryCategory category) {
+    return (size_t) __memory_peak[category];
+}
+
+size_t MemoryTracker::getTotalUsage() {
+    int64_t usage = __memory_usage[EMemoryCategoryCount];
+    return usage > 0 ? (size_t) usage : 0;
+}
+
+size_t MemoryTracker::getPeakTotalUsage() {
+    return (size_t) __memory_peak[EMemoryCategoryCount];
+}
+
+const char *MemoryTracker::getCategoryName(EMemoryCategory category) {
+    return __memory_names[category];
+}
+
+void MemoryTracker::setBudget(size_t budget) {
+    __memory_budget = budget;
+}
+
+size_t MemoryTracker::getBudget() {
+    return __memory_budget;
+}
+
 ref<Statistics> Statistics::m_instance = new Statistics();
 
 void Statistics::staticInitialization() {
@@ -124,6 +342,14 @@ void Statistics::staticShutdown() {
 
 Statistics::Statistics() {
     m_mutex = new Mutex();
+    m_phaseMutex = new Mutex();
+    m_phases = new PhaseNode("");
+    m_timer = new Timer();
+    m_cycleStart = readCycleCounter();
+}
+
+Statistics::~Statistics() {
+    delete m_phases;
 }
 
 void Statistics::registerCounter(const StatsCounter *ctr) {
@@ -134,6 +360,25 @@ void Statistics::logPlugin(const std::string &name, const std::string &descr) {
     m_plugins.push_back(std::pair<std::string, std::string>(name, descr));
 }
 
+void Statistics::logProgress(const std::string &title, Float time) {
+    LockGuard lock(m_mutex);
+    ProgressRecord &record = m_progress[title];
+    record.count++;
+    record.time += time;
+}
+
+void Statistics::logWorkUnit(const std::string &process,
+        const std::string &worker, Float time) {
+    double now = (double) m_timer->getNanoseconds() * 1e-9;
+    LockGuard lock(m_mutex);
+    WorkRecord &record = m_work[std::make_pair(process, worker)];
+    if (record.count == 0)
+        record.first = now - time;
+    record.count++;
+    record.time += time;
+    record.last = now;
+}
+
 void Statistics::printStats() {
     mitsuba::Logger *logger = Thread::getThread()->getLogger();
     LockGuard guard(logger->m_mutex);
@@ -147,6 +392,31 @@ void Statistics::resetAll() {
     LockGuard lock(m_mutex);
     for (size_t i=0; i<m_counters.size(); ++i)
         const_cast<StatsCounter *>(m_counters[i])->reset();
+    m_progress.clear();
+    m_work.clear();
+    LockGuard phaseLock(m_phaseMutex);
+    m_phases->reset();
+}
+
+double Statistics::getCycleFrequency() const {
+    uint64_t cycles = readCycleCounter() - m_cycleStart;
+    double seconds = (double) m_timer->getNanoseconds() * 1e-9;
+    return seconds > 0 && cycles > 0 ? cycles / seconds : 1e9;
+}
+
+#if !(defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) \
+    && !defined(__i386__) && !defined(__amd64__)
+uint64_t readCycleCounter() {
+    static ref<Timer> timer = new Timer();
+    return timer->getNanoseconds();
+}
+#endif
+
+std::string Statistics::getPhaseTimingsJSON() {
+    std::ostringstream oss;
+    LockGuard lock(m_phaseMutex);
+    m_phases->toJSON(oss);
+    return oss.str();
 }
 
 std::string Statistics::getStats() {
@@ -256,6 +526,19 @@ std::string Statistics::getStats() {
                         value3, suffixesNumber[suffixIndex2].c_str());
                     break;
                 }
+            case ECycleCount: {
+                    double seconds = counter->getValue() / getCycleFrequency();
+                    Float calls = baseValue;
+                    while (calls > 1000.0f && suffixIndex < lastSuffix) {
+                        calls /= 1000.0f;
+                        suffixIndex++;
+                    }
+                    snprintf(temp, sizeof(temp), "    -  %s : %s (%.2f%s calls, %.1f ns each)",
+                        counter->getName().c_str(), timeString((Float) seconds, true).c_str(),
+                        calls, suffixesNumber[suffixIndex].c_str(),
+                        baseValue == 0 ? 0.0 : seconds * 1e9 / baseValue);
+                    break;
+                }
             default:
                 Log(EError, "Unknown counter type!");
         }
@@ -268,9 +551,149 @@ std::string Statistics::getStats() {
             << "     none." << endl;
     }
 
+    if (!m_work.empty()) {
+        oss << endl << "  * Work units :" << endl;
+        for (std::map<std::pair<std::string, std::string>, WorkRecord>::const_iterator
+                it = m_work.begin(); it != m_work.end(); ++it) {
+            const WorkRecord &record = it->second;
+            double span = record.last - record.first;
+            oss << "    -  " << it->first.first << " on " << it->first.second
+                << " : " << record.count << " ("
+                << timeString((Float) (record.time / record.count), true)
+                << " each";
+            if (span > 0)
+                oss << ", " << formatString("%.2f", record.count / span) << " per second";
+            oss << ")" << endl;
+        }
+    }
+
+    if (MemoryTracker::getPeakTotalUsage() > 0) {
+        oss << endl << "  * Tracked memory :" << endl;
+        for (int i=0; i<EMemoryCategoryCount; ++i) {
+            EMemoryCategory category = (EMemoryCategory) i;
+            if (MemoryTracker::getPeakUsage(category) == 0)
+                continue;
+            oss << "    -  " << MemoryTracker::getCategoryName(category) << " : "
+                << memString(MemoryTracker::getUsage(category)) << " (peak: "
+                << memString(MemoryTracker::getPeakUsage(category)) << ")" << endl;
+        }
+        oss << "    -  Total : " << memString(MemoryTracker::getTotalUsage())
+            << " (peak: " << memString(MemoryTracker::getPeakTotalUsage());
+        if (MemoryTracker::getBudget() > 0)
+            oss << ", budget: " << memString(MemoryTracker::getBudget());
+        oss << ")" << endl;
+    }
+
+    LockGuard phaseLock(m_phaseMutex);
+    if (!m_phases->isEmpty()) {
+        oss << endl << "  * Timings (summed over threads) :" << endl;
+        m_phases->toString(oss, 4);
+    }
+
     oss << "------------------------------------------------------------";
     return oss.str();
 }
 
+std::string Statistics::getStatsJSON() {
+    std::ostringstream oss;
+    LockGuard lock(m_mutex);
+    oss.precision(17);
+
+    oss << "{\"counters\": [";
+    for (size_t i=0; i<m_counters.size(); ++i) {
+        const StatsCounter *counter = m_counters[i];
+        EStatsType type = counter->getType();
+        uint64_t value;
+        const char *typeName;
+
+        switch (type) {
+            case ENumberValue: typeName = "number"; value = counter->getValue(); break;
+            case EByteCount: typeName = "bytes"; value = counter->getValue(); break;
+            case EPercentage: typeName = "percentage"; value = counter->getValue(); break;
+            case EAverage: typeName = "average"; value = counter->getValue(); break;
+            case EMinimumValue: typeName = "minimum"; value = counter->getMinimum(); break;
+            case EMaximumValue: typeName = "maximum"; value = counter->getMaximum(); break;
+            case ECycleCount: typeName = "time"; value = counter->getValue(); break;
+            default:
+                Log(EError, "Unknown counter type!");
+                return "";
+        }
+
+        if (i > 0)
+            oss << ", ";
+        oss << "{\"category\": ";
+        writeJSONString(oss, counter->getCategory());
+        oss << ", \"name\": ";
+        writeJSONString(oss, counter->getName());
+        oss << ", \"type\": \"" << typeName << "\", \"value\": ";
+        if (type == ECycleCount) /* In seconds */
+            oss << value / getCycleFrequency();
+        else
+            oss << value;
+        if (type == EPercentage || type == EAverage || type == ECycleCount)
+            oss << ", \"base\": " << counter->getBase();
+        oss << "}";
+    }
+
+    oss << "], \"plugins\": [";
+    for (size_t i=0; i<m_plugins.size(); ++i) {
+        if (i > 0)
+            oss << ", ";
+        oss << "{\"name\": ";
+        writeJSONString(oss, m_plugins[i].first);
+        oss << ", \"description\": ";
+        writeJSONString(oss, m_plugins[i].second);
+        oss << "}";
+    }
+
+    oss << "], \"phases\": ";
+    {
+        LockGuard phaseLock(m_phaseMutex);
+        m_phases->toJSON(oss);
+    }
+
+    oss << ", \"progress\": [";
+    for (std::map<std::string, ProgressRecord>::const_iterator it = m_progress.begin();
+            it != m_progress.end(); ++it) {
+        if (it != m_progress.begin())
+            oss << ", ";
+        oss << "{\"title\": ";
+        writeJSONString(oss, it->first);
+        oss << ", \"count\": " << it->second.count
+            << ", \"time\": " << it->second.time << "}";
+    }
+
+    oss << "], \"workUnits\": [";
+    for (std::map<std::pair<std::string, std::string>, WorkRecord>::const_iterator
+            it = m_work.begin(); it != m_work.end(); ++it) {
+        const WorkRecord &record = it->second;
+        double span = record.last - record.first;
+        if (it != m_work.begin())
+            oss << ", ";
+        oss << "{\"process\": ";
+        writeJSONString(oss, it->first.first);
+        oss << ", \"worker\": ";
+        writeJSONString(oss, it->first.second);
+        oss << ", \"count\": " << record.count
+            << ", \"time\": " << record.time
+            << ", \"span\": " << span
+            << ", \"throughput\": " << (span > 0 ? record.count / span : 0.0) << "}";
+    }
+
+    oss << "], \"trackedMemory\": [";
+    for (int i=0; i<EMemoryCategoryCount; ++i) {
+        EMemoryCategory category = (EMemoryCategory) i;
+        if (i > 0)
+            oss << ", ";
+        oss << "{\"category\": ";
+        writeJSONString(oss, MemoryTracker::getCategoryName(category));
+        oss << ", \"current\": " << MemoryTracker::getUsage(category)
+            << ", \"peak\": " << MemoryTracker::getPeakUsage(category) << "}";
+    }
+    oss << "], \"memoryBudget\": " << MemoryTracker::getBudget()
+        << ", \"peakMemory\": " << getPeakMemoryUsage() << "}";
+    return oss.str();
+}
+
 MTS_IMPLEMENT_CLASS(Statistics, false, Object)
 MTS_NAMESPACE_END
@@ -19,6 +19,7 @@
 #include <mitsuba/core/lock.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/atomic.h>
+#include <mitsuba/core/statistics.h>
 
 #if defined(MTS_OPENMP)
 # include <omp.h>
@@ -75,6 +76,50 @@ __declspec(thread) int __thread_id;
 #endif
 static int __thread_id_ctr = -1;
 
+/* Statistics slots are stored with an offset of one, so that
+   threads without a slot read the shared one */
+#if defined(__LINUX__) || defined(__OSX__)
+static pthread_key_t __thread_slot;
+#elif defined(__WINDOWS__)
+__declspec(thread) int __thread_slot;
+#endif
+static boost::mutex __slotMutex;
+static std::vector<int> __freeSlots;
+static int __slotCtr = 0;
+
+/// Give the calling thread an exclusive statistics slot, if one is left
+static void acquireStatisticsSlot() {
+    int slot = MTS_SHARED_COUNTER;
+    {
+        boost::lock_guard<boost::mutex> guard(__slotMutex);
+        if (!__freeSlots.empty()) {
+            slot = __freeSlots.back();
+            __freeSlots.pop_back();
+        } else if (__slotCtr < MTS_SHARED_COUNTER) {
+            slot = __slotCtr++;
+        }
+    }
+    #if defined(__LINUX__) || defined(__OSX__)
+        pthread_setspecific(__thread_slot, reinterpret_cast<void *>((intptr_t) slot + 1));
+    #elif defined(__WINDOWS__)
+        __thread_slot = slot + 1;
+    #endif
+}
+
+/// Return the statistics slot of the calling thread for reuse
+static void releaseStatisticsSlot() {
+    int slot = Thread::getStatisticsSlot();
+    if (slot != MTS_SHARED_COUNTER) {
+        boost::lock_guard<boost::mutex> guard(__slotMutex);
+        __freeSlots.push_back(slot);
+    }
+    #if defined(__LINUX__) || defined(__OSX__)
+        pthread_setspecific(__thread_slot, NULL);
+    #elif defined(__WINDOWS__)
+        __thread_slot = 0;
+    #endif
+}
+
 /**
  * Internal Thread members
  */
@@ -163,6 +208,15 @@ int Thread::getID() {
 #endif
 }
 
+int Thread::getStatisticsSlot() {
+#if defined(__WINDOWS__)
+    int slot = __thread_slot - 1;
+#elif defined(__OSX__) || defined(__LINUX__)
+    int slot = static_cast<int>(reinterpret_cast<intptr_t>(pthread_getspecific(__thread_slot))) - 1;
+#endif
+    return slot < 0 ? MTS_SHARED_COUNTER : slot;
+}
+
 const std::string& Thread::getName() const {
     return d->name;
 }
@@ -429,6 +483,7 @@ void Thread::dispatch(Thread *thread) {
     #elif defined(__WINDOWS__)
         __thread_id = id;
     #endif
+    acquireStatisticsSlot();
 
     Thread::ThreadPrivate::self->set(thread);
 
@@ -498,6 +553,7 @@ void Thread::exit() {
     Log(EDebug, "Thread \"%s\" has finished", d->name.c_str());
     d->running = false;
     Assert(ThreadPrivate::self->get() == this);
+    releaseStatisticsSlot();
     detail::destroyLocalTLS();
     decRef();
 }
@@ -539,7 +595,9 @@ void Thread::staticInitialization() {
     #endif
     #if defined(__LINUX__) || defined(__OSX__)
         pthread_key_create(&__thread_id, NULL);
+        pthread_key_create(&__thread_slot, NULL);
     #endif
+    acquireStatisticsSlot();
     detail::initializeGlobalTLS();
     detail::initializeLocalTLS();
 
@@ -564,6 +622,7 @@ Thread *Thread::registerUnmanagedThread(const std::string &name) {
         thread->d->joined = false;
         thread->incRef();
         ThreadPrivate::self->set(thread);
+        acquireStatisticsSlot();
 
         boost::lock_guard<boost::mutex> guard(__unmanagedMutex);
         __unmanagedThreads.push_back((UnmanagedThread *) thread);
@@ -586,6 +645,7 @@ void Thread::staticShutdown() {
     detail::destroyGlobalTLS();
 #if defined(__LINUX__) || defined(__OSX__)
     pthread_key_delete(__thread_id);
+    pthread_key_delete(__thread_slot);
 #endif
 #if defined(__OSX__)
     #if defined(MTS_OPENMP)
@@ -647,6 +707,7 @@ void Thread::initializeOpenMP(size_t threadCount) {
             #elif defined(__WINDOWS__)
                 __thread_id = id;
             #endif
+            acquireStatisticsSlot();
 
             thread->d->running = false;
             thread->d->joined = false;
@@ -23,20 +23,12 @@
 #include <boost/thread/locks.hpp>
 #include <boost/unordered_set.hpp>
 
-#include <boost/scoped_ptr.hpp>
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/member.hpp>
-#include <boost/multi_index/hashed_index.hpp>
-#include <boost/multi_index/sequenced_index.hpp>
-
 #if defined(__OSX__)
 # include <pthread.h>
 #endif
 
 MTS_NAMESPACE_BEGIN
 
-namespace mi = boost::multi_index;
-
 /* The native TLS classes on Linux/MacOS/Windows only support a limited number
    of dynamically allocated entries (usually 1024 or 1088). Furthermore, they
    do not provide appropriate cleanup semantics when the TLS object or one of
@@ -44,7 +36,11 @@ namespace mi = boost::multi_index;
    such limits (caching in various subsystems of Mitsuba may create a huge amount,
    so this is a big deal) as well as nice cleanup semantics. The implementation
    is designed to make the \c get() operation as fast as as possible at the cost
-   of more involved locking when creating or destroying threads and TLS objects */
+   of more involved locking when creating or destroying threads and TLS objects.
+
+   Every TLS object is assigned a slot index, which addresses an array
+   that is stored in native thread-local storage. Once an entry exists,
+   \c get() therefore amounts to a bounds check and two loads. */
 namespace detail {
 
 /// A single TLS entry + cleanup hook
@@ -55,39 +51,27 @@ struct TLSEntry {
     inline TLSEntry() : data(NULL), destructFunctor(NULL) { }
 };
 
-/// boost multi-index element to act as replacement of map<Key,T>
-template<typename T1, typename T2>
-struct mutable_pair {
-    mutable_pair(const T1 &f, const T2 &s) : first(f), second(s) { }
-
-    T1 first;
-    mutable T2 second;
-};
-
-/// Per-thread TLS entry map
+/// Per-thread TLS entry table
 struct PerThreadData {
-    typedef mutable_pair<void *, TLSEntry> MapData;
-    typedef mi::member<MapData, void *, &MapData::first> key_member;
-    struct seq_tag {};
-    struct key_tag {};
-
-    typedef mi::multi_index_container<MapData,
-        mi::indexed_by<
-            mi::hashed_unique<mi::tag<key_tag>, key_member>,
-            mi::sequenced<mi::tag<seq_tag> >
-        >
-    > Map;
-    typedef mi::index<Map, key_tag>::type::iterator         key_iterator;
-    typedef mi::index<Map, seq_tag>::type::reverse_iterator reverse_iterator;
-
-    Map map;
+    /**
+     * \brief Entries indexed by slot. Only the owning thread may
+     * grow this array; other threads merely clear entries of TLS
+     * objects that are being destroyed (with \c mutex held)
+     */
+    std::vector<TLSEntry> slots;
+    /// Slots in order of creation of their entries
+    std::vector<size_t> order;
     boost::recursive_mutex mutex;
 };
 
 /// List of all PerThreadData data structures (one for each thread)
 boost::unordered_set<PerThreadData *> ptdGlobal;
-/// Lock to protect ptdGlobal
+/// Lock to protect ptdGlobal and the slot allocator
 boost::mutex ptdGlobalLock;
+/// Slots of destroyed TLS objects that can be reused
+std::vector<size_t> freeSlots;
+/// Number of slots that were ever handed out
+size_t slotCount = 0;
 
 #if defined(__WINDOWS__)
 __declspec(thread) PerThreadData *ptdLocal = NULL;
@@ -100,10 +84,19 @@ pthread_key_t ptdLocal;
 struct ThreadLocalBase::ThreadLocalPrivate {
     ConstructFunctor constructFunctor;
     DestructFunctor destructFunctor;
+    size_t slot;
 
     ThreadLocalPrivate(const ConstructFunctor &constructFunctor,
             const DestructFunctor &destructFunctor) : constructFunctor(constructFunctor),
-            destructFunctor(destructFunctor) { }
+            destructFunctor(destructFunctor) {
+        boost::lock_guard<boost::mutex> guard(ptdGlobalLock);
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            slot = slotCount++;
+        }
+    }
 
     ~ThreadLocalPrivate() {
         /* The TLS object was destroyed. Walk through all threads
@@ -115,12 +108,12 @@ struct ThreadLocalBase::ThreadLocalPrivate {
             PerThreadData *ptd = *it;
             boost::unique_lock<boost::recursive_mutex> lock(ptd->mutex);
 
-            PerThreadData::Map::iterator it2 = ptd->map.find(this);
             TLSEntry entry;
-
-            if (it2 != ptd->map.end()) {
-                entry = it2->second;
-                ptd->map.erase(it2);
+            if (slot < ptd->slots.size() && ptd->slots[slot].data) {
+                entry = ptd->slots[slot];
+                ptd->slots[slot] = TLSEntry();
+                ptd->order.erase(std::find(ptd->order.begin(),
+                    ptd->order.end(), slot));
             }
 
             lock.unlock();
@@ -128,13 +121,13 @@ struct ThreadLocalBase::ThreadLocalPrivate {
             if (entry.data)
                 destructFunctor(entry.data);
         }
+
+        /* No thread refers to the slot anymore */
+        freeSlots.push_back(slot);
     }
 
     /// Look up a TLS entry. The goal is to make this operation very fast!
-    std::pair<void *, bool> get() {
-        bool existed = true;
-        void *data;
-
+    inline std::pair<void *, bool> get() {
 #if defined(__OSX__)
         PerThreadData *ptd = (PerThreadData *) pthread_getspecific(ptdLocal);
 #else
@@ -144,21 +137,31 @@ struct ThreadLocalBase::ThreadLocalPrivate {
             throw std::runtime_error("Internal error: call to ThreadLocalPrivate::get() "
                 " precedes the construction of thread-specific data structures!");
 
-        /* This is an uncontended thread-local lock (i.e. not to worry) */
-        boost::lock_guard<boost::recursive_mutex> guard(ptd->mutex);
-        PerThreadData::key_iterator it = ptd->map.find(this);
-        if (EXPECT_TAKEN(it != ptd->map.end())) {
-            data = it->second.data;
-        } else {
-            /* This is the first access from this thread */
-            TLSEntry entry;
-            entry.data = data = constructFunctor();
-            entry.destructFunctor = destructFunctor;
-            ptd->map.insert(PerThreadData::MapData(this, entry));
-            existed = false;
+        /* Fast path: no lock is needed, since only this thread adds entries */
+        if (EXPECT_TAKEN(slot < ptd->slots.size())) {
+            void *data = ptd->slots[slot].data;
+            if (EXPECT_TAKEN(data != NULL))
+                return std::make_pair(data, true);
         }
 
-        return std::make_pair(data, existed);
+        return create(ptd);
+    }
+
+    /// This is the first access from this thread
+    std::pair<void *, bool> create(PerThreadData *ptd) {
+        /* The constructor may itself access other TLS objects */
+        void *data = constructFunctor();
+
+        /* This is an uncontended thread-local lock (i.e. not to worry) */
+        boost::lock_guard<boost::recursive_mutex> guard(ptd->mutex);
+        if (slot >= ptd->slots.size())
+            ptd->slots.resize(std::max(slot + 1, 2 * ptd->slots.size()));
+        TLSEntry &entry = ptd->slots[slot];
+        entry.data = data;
+        entry.destructFunctor = destructFunctor;
+        ptd->order.push_back(slot);
+
+        return std::make_pair(data, false);
     }
 };
 
@@ -232,9 +235,9 @@ void destroyLocalTLS() {
     boost::unique_lock<boost::recursive_mutex> lock(ptd->mutex);
 
     // Destroy the data in reverse order of creation
-    for (PerThreadData::reverse_iterator it = mi::get<PerThreadData::seq_tag>(ptd->map).rbegin();
-        it != mi::get<PerThreadData::seq_tag>(ptd->map).rend(); ++it) {
-        TLSEntry &entry = it->second;
+    for (std::vector<size_t>::reverse_iterator it = ptd->order.rbegin();
+        it != ptd->order.rend(); ++it) {
+        TLSEntry &entry = ptd->slots[*it];
         entry.destructFunctor(entry.data);
     }
 
@@ -6,7 +6,7 @@
 MTS_NAMESPACE_BEGIN
 
 AnimatedTransform::AnimatedTransform(const AnimatedTransform *trafo)
-        : m_transform(trafo->m_transform) {
+        : m_keyframes(trafo->m_keyframes), m_transform(trafo->m_transform) {
     m_tracks.reserve(trafo->getTrackCount());
     for (size_t i=0; i<trafo->getTrackCount(); ++i) {
         AbstractAnimationTrack *track = trafo->getTrack(i)->clone();
@@ -50,12 +50,14 @@ AnimatedTransform::AnimatedTransform(Stream *stream) {
             track->incRef();
             m_tracks.push_back(track);
         }
+        updateKeyframes();
     }
 }
 
 void AnimatedTransform::addTrack(AbstractAnimationTrack *track) {
     track->incRef();
     m_tracks.push_back(track);
+    m_keyframes.clear();
 }
 
 AABB1 AnimatedTransform::getTimeBounds() const {
@@ -193,6 +195,43 @@ void AnimatedTransform::sortAndSimplify() {
             m_tracks[i]->decRef();
         m_tracks.clear();
     }
+
+    updateKeyframes();
+}
+
+void AnimatedTransform::updateKeyframes() {
+    m_keyframes.clear();
+    if (m_tracks.empty())
+        return;
+
+    for (size_t i=0; i<m_tracks.size(); ++i) {
+        switch (m_tracks[i]->getType()) {
+            case AbstractAnimationTrack::ETranslationX:
+            case AbstractAnimationTrack::ETranslationY:
+            case AbstractAnimationTrack::ETranslationZ:
+            case AbstractAnimationTrack::ETranslationXYZ:
+            case AbstractAnimationTrack::EScaleX:
+            case AbstractAnimationTrack::EScaleY:
+            case AbstractAnimationTrack::EScaleZ:
+            case AbstractAnimationTrack::EScaleXYZ:
+            case AbstractAnimationTrack::ERotationQuat:
+                break;
+            default:
+                /* Leave the error message to eval() */
+                return;
+        }
+    }
+
+    std::set<Float> times;
+    collectKeyframes(times);
+    m_keyframes.reserve(times.size());
+    for (std::set<Float>::const_iterator it = times.begin(); it != times.end(); ++it) {
+        Keyframe keyframe;
+        keyframe.time = *it;
+        TransformFunctor::evalTracks(m_tracks, keyframe.time,
+            keyframe.translation, keyframe.scale, keyframe.rotation);
+        m_keyframes.push_back(keyframe);
+    }
 }
 
 
@@ -249,6 +288,8 @@ void AnimatedTransform::prependScale(const Vector &scale) {
         trackXYZ->append(0.0f, scale);
         addTrack(trackXYZ);
     }
+
+    updateKeyframes();
 }
 
 void AnimatedTransform::collectKeyframes(std::set<Float> &result) const {
@@ -273,13 +314,15 @@ void AnimatedTransform::serialize(Stream *stream) const {
     }
 }
 
-void AnimatedTransform::TransformFunctor::operator()(const Float &t, Transform &trafo) const {
-    Vector translation(0.0f);
-    Vector scale(1.0f);
-    Quaternion rotation;
+void AnimatedTransform::TransformFunctor::evalTracks(
+        const std::vector<AbstractAnimationTrack *> &tracks, Float t,
+        Vector &translation, Vector &scale, Quaternion &rotation) {
+    translation = Vector(0.0f);
+    scale = Vector(1.0f);
+    rotation = Quaternion();
 
-    for (size_t i=0; i<m_tracks.size(); ++i) {
-        AbstractAnimationTrack *track = m_tracks[i];
+    for (size_t i=0; i<tracks.size(); ++i) {
+        AbstractAnimationTrack *track = tracks[i];
         switch (track->getType()) {
             case AbstractAnimationTrack::ETranslationX:
                 translation.x = static_cast<FloatTrack *>(track)->eval(t);
@@ -313,14 +356,65 @@ void AnimatedTransform::TransformFunctor::operator()(const Float &t, Transform &
                     "animation track type: %i!", track->getType());
         }
     }
+}
 
-    trafo = Transform::translate(translation);
+void AnimatedTransform::TransformFunctor::operator()(const Float &t, Transform &trafo) const {
+    Vector translation, scale;
+    Quaternion rotation;
 
-    if (!rotation.isIdentity())
-        trafo = trafo * rotation.toTransform();
+    if (m_keyframes.empty()) {
+        evalTracks(m_tracks, t, translation, scale, rotation);
+    } else {
+        /* Interpolate between two entries of the keyframe table
+           (same conventions as AnimationTrack::eval()) */
+        size_t lo = 0, hi = m_keyframes.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (m_keyframes[mid].time < t)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        size_t idx0 = lo > 0 ? lo - 1 : 0;
+        size_t idx1 = std::min(idx0 + 1, m_keyframes.size() - 1);
+
+        const Keyframe &k0 = m_keyframes[idx0], &k1 = m_keyframes[idx1];
+        Float alpha = 0.5f;
+        if (k0.time != k1.time) {
+            Float time = std::max(k0.time, std::min(k1.time, t));
+            alpha = (time - k0.time) / (k1.time - k0.time);
+        }
+
+        translation = k0.translation * (1-alpha) + k1.translation * alpha;
+        scale = k0.scale * (1-alpha) + k1.scale * alpha;
+        rotation = slerp(k0.rotation, k1.rotation, alpha);
+    }
+
+    if (scale == Vector(0.0f))
+        scale = Vector(1.0f);
+
+    /* Directly assemble translate * rotate * scale and its inverse */
+    Matrix4x4 rot;
+    if (rotation.isIdentity())
+        rot.setIdentity();
+    else
+        rot = rotation.toTransform().getMatrix();
+
+    Matrix4x4 m, inv;
+    for (int i=0; i<3; ++i) {
+        for (int j=0; j<3; ++j) {
+            m.m[i][j] = rot.m[i][j] * scale[j];
+            inv.m[i][j] = rot.m[j][i] / scale[i];
+        }
+        m.m[i][3] = translation[i];
+        m.m[3][i] = inv.m[3][i] = 0.0f;
+    }
+    for (int i=0; i<3; ++i)
+        inv.m[i][3] = -(inv.m[i][0] * translation.x
+            + inv.m[i][1] * translation.y + inv.m[i][2] * translation.z);
+    m.m[3][3] = inv.m[3][3] = 1.0f;
 
-    if (scale != Vector(0.0f))
-        trafo = trafo * Transform::scale(scale);
+    trafo = Transform(m, inv);
 }
 
 void AnimatedTransform::appendTransform(Float time, const Transform &trafo) {
@@ -377,6 +471,7 @@ void AnimatedTransform::appendTransform(Float time, const Transform &trafo) {
 
     scaling->append(time, Vector(P(0, 0), P(1, 1), P(2, 2)));
     translation->append(time, Vector(m(0, 3), m(1, 3), m(2, 3)));
+    m_keyframes.clear();
 }
 
 std::string AnimatedTransform::toString() const {
@@ -19,8 +19,130 @@
 #include <mitsuba/core/transform.h>
 #include <mitsuba/core/frame.h>
 
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
+
+/// Number of elements that are transformed by one thread at a time
+#define MTS_TRANSFORM_CHUNK_SIZE 65536
+
 MTS_NAMESPACE_BEGIN
 
+#if defined(MTS_SSE)
+namespace {
+    /// Load four packed 3D vectors and transpose them into x, y and z lanes
+    inline void loadTransposed(const float *ptr, __m128 &x, __m128 &y, __m128 &z) {
+        __m128 a = _mm_loadu_ps(ptr),     /* x0 y0 z0 x1 */
+               b = _mm_loadu_ps(ptr + 4), /* y1 z1 x2 y2 */
+               c = _mm_loadu_ps(ptr + 8); /* z2 x3 y3 z3 */
+        x = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 2, 3, 0)),
+                           _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 1, 0));
+        y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 0, 1, 1)),
+                           _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                           _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+    }
+
+    /// Inverse of \ref loadTransposed()
+    inline void storeTransposed(float *ptr, __m128 x, __m128 y, __m128 z) {
+        _mm_storeu_ps(ptr, _mm_shuffle_ps(
+            _mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)),
+            _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(ptr + 4, _mm_shuffle_ps(
+            _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)),
+            _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(ptr + 8, _mm_shuffle_ps(
+            _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)),
+            _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+    }
+
+    /// Dot product of a matrix row (given as broadcast coefficients) with vectors in SoA form
+    inline __m128 dot(const __m128 *row, __m128 x, __m128 y, __m128 z) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(row[0], x), _mm_mul_ps(row[1], y)),
+            _mm_mul_ps(row[2], z));
+    }
+};
+#endif
+
+void Transform::transformPoints(const Point *src, Point *dest, size_t count) const {
+    const Matrix4x4 &m = m_transform;
+    bool affine = m.m[3][0] == 0 && m.m[3][1] == 0 && m.m[3][2] == 0 && m.m[3][3] == 1;
+    int chunks = (int) ((count + MTS_TRANSFORM_CHUNK_SIZE - 1) / MTS_TRANSFORM_CHUNK_SIZE);
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for if (chunks > 1 && !omp_in_parallel())
+    #endif
+    for (int chunk=0; chunk<chunks; ++chunk) {
+        size_t i = (size_t) chunk * MTS_TRANSFORM_CHUNK_SIZE,
+               end = std::min(count, i + MTS_TRANSFORM_CHUNK_SIZE);
+#if defined(MTS_SSE)
+        __m128 rows[4][4];
+        for (int r=0; r<4; ++r)
+            for (int c=0; c<4; ++c)
+                rows[r][c] = _mm_set1_ps(m.m[r][c]);
+
+        for (; i + 4 <= end; i += 4) {
+            __m128 x, y, z;
+            loadTransposed(&src[i].x, x, y, z);
+            __m128 rx = _mm_add_ps(dot(rows[0], x, y, z), rows[0][3]),
+                   ry = _mm_add_ps(dot(rows[1], x, y, z), rows[1][3]),
+                   rz = _mm_add_ps(dot(rows[2], x, y, z), rows[2][3]);
+            if (!affine) {
+                __m128 invW = _mm_div_ps(_mm_set1_ps(1.0f),
+                    _mm_add_ps(dot(rows[3], x, y, z), rows[3][3]));
+                rx = _mm_mul_ps(rx, invW);
+                ry = _mm_mul_ps(ry, invW);
+                rz = _mm_mul_ps(rz, invW);
+            }
+            storeTransposed(&dest[i].x, rx, ry, rz);
+        }
+#endif
+        for (; i<end; ++i) /* Explicit copy, since src and dest may alias */
+            dest[i] = affine ? transformAffine(Point(src[i])) : operator()(Point(src[i]));
+    }
+}
+
+void Transform::transformNormals(const Normal *src, Normal *dest, size_t count, bool normalize) const {
+    int chunks = (int) ((count + MTS_TRANSFORM_CHUNK_SIZE - 1) / MTS_TRANSFORM_CHUNK_SIZE);
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for if (chunks > 1 && !omp_in_parallel())
+    #endif
+    for (int chunk=0; chunk<chunks; ++chunk) {
+        size_t i = (size_t) chunk * MTS_TRANSFORM_CHUNK_SIZE,
+               end = std::min(count, i + MTS_TRANSFORM_CHUNK_SIZE);
+#if defined(MTS_SSE)
+        /* Columns of the inverse matrix = rows of its transpose */
+        const Matrix4x4 &m = m_invTransform;
+        __m128 rows[3][3];
+        for (int r=0; r<3; ++r)
+            for (int c=0; c<3; ++c)
+                rows[r][c] = _mm_set1_ps(m.m[c][r]);
+
+        for (; i + 4 <= end; i += 4) {
+            __m128 x, y, z;
+            loadTransposed(&src[i].x, x, y, z);
+            __m128 rx = dot(rows[0], x, y, z),
+                   ry = dot(rows[1], x, y, z),
+                   rz = dot(rows[2], x, y, z);
+            if (normalize) {
+                __m128 invLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(
+                    _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)),
+                    _mm_mul_ps(rz, rz))));
+                rx = _mm_mul_ps(rx, invLength);
+                ry = _mm_mul_ps(ry, invLength);
+                rz = _mm_mul_ps(rz, invLength);
+            }
+            storeTransposed(&dest[i].x, rx, ry, rz);
+        }
+#endif
+        for (; i<end; ++i) {
+            Normal n = operator()(src[i]);
+            dest[i] = normalize ? mitsuba::normalize(n) : n;
+        }
+    }
+}
+
 // -----------------------------------------------------------------------
 //  Linear transformation class
 // -----------------------------------------------------------------------
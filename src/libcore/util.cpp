@@ -29,6 +29,7 @@
 
 #if defined(__OSX__)
 #include <sys/sysctl.h>
+#include <sys/resource.h>
 #include <mach/mach.h>
 #elif defined(__WINDOWS__)
 #include <windows.h>
@@ -38,6 +39,13 @@
 #include <malloc.h>
 #endif
 
+#if defined(__LINUX__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <fstream>
+#endif
+
 #if defined(__WINDOWS__)
 # include <windows.h>
 # include <winsock2.h>
@@ -216,6 +224,136 @@ done:
 #endif
 }
 
+#if defined(__LINUX__)
+/// Parse a Linux CPU/node list specification (e.g. "0-3,8-11")
+static std::vector<int> parseIndexList(const std::string &str) {
+    std::vector<int> result;
+    std::vector<std::string> ranges = tokenize(str, ",\n");
+    for (size_t i=0; i<ranges.size(); ++i) {
+        std::vector<std::string> bounds = tokenize(ranges[i], "-");
+        if (bounds.size() == 0 || bounds.size() > 2)
+            continue;
+        int start = atoi(bounds[0].c_str()),
+            end = atoi(bounds[bounds.size()-1].c_str());
+        for (int j=start; j<=end; ++j)
+            result.push_back(j);
+    }
+    return result;
+}
+
+static std::string readSysFile(const std::string &filename) {
+    std::ifstream is(filename.c_str());
+    std::string line;
+    if (is.good())
+        std::getline(is, line);
+    return line;
+}
+#endif
+
+static bool __numa_interleaving = false;
+
+std::vector<int> getCoreNUMANodes() {
+    std::vector<int> result(getCoreCount(), 0);
+#if defined(__LINUX__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) != 0)
+        return result;
+
+    std::vector<int> cpuToNode(CPU_SETSIZE, 0);
+    std::vector<int> nodes = parseIndexList(
+        readSysFile("/sys/devices/system/node/online"));
+    for (size_t i=0; i<nodes.size(); ++i) {
+        std::vector<int> cpus = parseIndexList(readSysFile(formatString(
+            "/sys/devices/system/node/node%i/cpulist", nodes[i])));
+        for (size_t j=0; j<cpus.size(); ++j) {
+            if (cpus[j] >= 0 && cpus[j] < CPU_SETSIZE)
+                cpuToNode[cpus[j]] = nodes[i];
+        }
+    }
+
+    /* Use the same indexing as Thread::setCoreAffinity() */
+    size_t available = 0;
+    for (int i=0; i<CPU_SETSIZE && available < result.size(); ++i) {
+        if (CPU_ISSET(i, &cpuset))
+            result[available++] = cpuToNode[i];
+    }
+#endif
+    return result;
+}
+
+int getNUMANodeCount() {
+#if defined(__LINUX__)
+    std::vector<int> nodes = parseIndexList(
+        readSysFile("/sys/devices/system/node/online"));
+    return std::max((int) nodes.size(), 1);
+#else
+    return 1;
+#endif
+}
+
+std::vector<int> getNUMAInterleavedCores() {
+    std::vector<int> coreNodes = getCoreNUMANodes();
+    std::map<int, std::vector<int> > nodeCores;
+    for (size_t i=0; i<coreNodes.size(); ++i)
+        nodeCores[coreNodes[i]].push_back((int) i);
+
+    std::vector<int> result;
+    result.reserve(coreNodes.size());
+    for (size_t i=0; result.size() < coreNodes.size(); ++i) {
+        for (std::map<int, std::vector<int> >::const_iterator it = nodeCores.begin();
+                it != nodeCores.end(); ++it) {
+            if (i < it->second.size())
+                result.push_back(it->second[i]);
+        }
+    }
+    return result;
+}
+
+void setNUMAInterleaving(bool enabled) {
+    __numa_interleaving = enabled;
+}
+
+bool getNUMAInterleaving() {
+    return __numa_interleaving;
+}
+
+bool interleaveMemory(void *ptr, size_t size) {
+#if defined(__LINUX__)
+    std::vector<int> nodes = parseIndexList(
+        readSysFile("/sys/devices/system/node/online"));
+    if (nodes.size() < 2 || ptr == NULL)
+        return false;
+
+    /* Only whole pages can be rebound */
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t) ptr + pageSize - 1) & ~(pageSize - 1),
+              end   = ((uintptr_t) ptr + size) & ~(pageSize - 1);
+    if (end <= start)
+        return false;
+
+    const size_t bitsPerWord = sizeof(unsigned long) * 8;
+    int maxNode = *std::max_element(nodes.begin(), nodes.end());
+    std::vector<unsigned long> nodeMask(maxNode / bitsPerWord + 1, 0);
+    for (size_t i=0; i<nodes.size(); ++i)
+        nodeMask[nodes[i] / bitsPerWord] |= 1UL << (nodes[i] % bitsPerWord);
+
+    /* Invoke mbind(MPOL_INTERLEAVE, MPOL_MF_MOVE) directly to avoid a dependency on libnuma */
+    const int MTS_MPOL_INTERLEAVE = 3;
+    const unsigned int MTS_MPOL_MF_MOVE = 1 << 1;
+    long retval = syscall(SYS_mbind, (void *) start, (unsigned long) (end - start),
+        MTS_MPOL_INTERLEAVE, &nodeMask[0], (unsigned long) (maxNode + 2),
+        MTS_MPOL_MF_MOVE);
+    if (retval != 0) {
+        SLog(EWarn, "interleaveMemory(): mbind() failed: %s", strerror(errno));
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 size_t getTotalSystemMemory() {
 #if defined(__WINDOWS__)
     MEMORYSTATUSEX status;
@@ -274,6 +412,40 @@ size_t getPrivateMemoryUsage() {
 #endif
 }
 
+size_t getPeakMemoryUsage() {
+#if defined(__WINDOWS__)
+    PROCESS_MEMORY_COUNTERS pmc;
+    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+    return (size_t) pmc.PeakWorkingSetSize;
+#elif defined(__OSX__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return (size_t) usage.ru_maxrss; /* In bytes on OSX */
+#else
+    FILE* file = fopen("/proc/self/status", "r");
+    if (!file)
+        return 0;
+
+    char buffer[128];
+    size_t result = 0;
+    while (fgets(buffer, sizeof(buffer), file) != NULL) {
+        if (strncmp(buffer, "VmHWM:", 6) != 0) /* Peak resident set size */
+            continue;
+
+        char *line = buffer;
+        while (*line < '0' || *line > '9')
+            ++line;
+        line[strlen(line)-3] = '\0';
+        result = (size_t) atoi(line) * 1024;
+        break;
+    }
+
+    fclose(file);
+    return result;
+#endif
+}
+
 #if defined(__WINDOWS__)
 std::string lastErrorText() {
     DWORD errCode = GetLastError();
@@ -900,4 +1072,68 @@ std::string memString(size_t size, bool precise) {
     return os.str();
 }
 
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+std::string contentHash(const void *ptr, size_t size) {
+    /* MurmurHash3 (x64, 128 bit variant) by Austin Appleby */
+    const uint8_t *data = (const uint8_t *) ptr;
+    const size_t nblocks = size / 16;
+    const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0, h2 = 0;
+
+    for (size_t i=0; i<nblocks; ++i) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + 16*i, sizeof(uint64_t));
+        memcpy(&k2, data + 16*i + 8, sizeof(uint64_t));
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+    }
+
+    const uint8_t *tail = data + nblocks*16;
+    uint64_t k1 = 0, k2 = 0;
+    switch (size & 15) {
+        case 15: k2 ^= ((uint64_t) tail[14]) << 48;
+        case 14: k2 ^= ((uint64_t) tail[13]) << 40;
+        case 13: k2 ^= ((uint64_t) tail[12]) << 32;
+        case 12: k2 ^= ((uint64_t) tail[11]) << 24;
+        case 11: k2 ^= ((uint64_t) tail[10]) << 16;
+        case 10: k2 ^= ((uint64_t) tail[ 9]) << 8;
+        case  9: k2 ^= ((uint64_t) tail[ 8]);
+                 k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        case  8: k1 ^= ((uint64_t) tail[ 7]) << 56;
+        case  7: k1 ^= ((uint64_t) tail[ 6]) << 48;
+        case  6: k1 ^= ((uint64_t) tail[ 5]) << 40;
+        case  5: k1 ^= ((uint64_t) tail[ 4]) << 32;
+        case  4: k1 ^= ((uint64_t) tail[ 3]) << 24;
+        case  3: k1 ^= ((uint64_t) tail[ 2]) << 16;
+        case  2: k1 ^= ((uint64_t) tail[ 1]) << 8;
+        case  1: k1 ^= ((uint64_t) tail[ 0]);
+                 k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    };
+
+    h1 ^= (uint64_t) size; h2 ^= (uint64_t) size;
+    h1 += h2; h2 += h1;
+    h1 = fmix64(h1); h2 = fmix64(h2);
+    h1 += h2; h2 += h1;
+
+    std::ostringstream os;
+    os << std::hex << std::setfill('0') << std::setw(16) << h1
+       << std::setw(16) << h2;
+    return os.str();
+}
+
 MTS_NAMESPACE_END
@@ -17,6 +17,9 @@
 */
 
 #include <mitsuba/core/warp.h>
+#if defined(MTS_SSE)
+#include <mitsuba/core/ssemath.h>
+#endif
 
 MTS_NAMESPACE_BEGIN
 
@@ -175,6 +178,153 @@ Float intervalToNonuniformTent(Float a, Float b, Float c, Float sample) {
     return b + factor * (1-math::safe_sqrt(sample));
 }
 
+#if defined(MTS_SSE)
+namespace {
+    /// Load four 2D samples and split them into x and y lanes
+    inline void loadSamples(const Point2 *samples, __m128 &x, __m128 &y) {
+        const float *ptr = reinterpret_cast<const float *>(samples);
+        __m128 a = _mm_loadu_ps(ptr),     /* x0 y0 x1 y1 */
+               b = _mm_loadu_ps(ptr + 4); /* x2 y2 x3 y3 */
+        x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    }
+
+    /// Interleave x and y lanes into four 2D points
+    inline void storePoints(Point2 *result, __m128 x, __m128 y) {
+        float *ptr = reinterpret_cast<float *>(result);
+        _mm_storeu_ps(ptr, _mm_unpacklo_ps(x, y));
+        _mm_storeu_ps(ptr + 4, _mm_unpackhi_ps(x, y));
+    }
+
+    /// Write x, y and z lanes to four vectors
+    inline void storeVectors(Vector *result, __m128 x, __m128 y, __m128 z) {
+        float xs[4], ys[4], zs[4];
+        _mm_storeu_ps(xs, x);
+        _mm_storeu_ps(ys, y);
+        _mm_storeu_ps(zs, z);
+        for (int i=0; i<4; ++i)
+            result[i] = Vector(xs[i], ys[i], zs[i]);
+    }
+
+    inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    inline __m128 safeSqrt(__m128 x) {
+        return _mm_sqrt_ps(_mm_max_ps(x, _mm_setzero_ps()));
+    }
+
+    /// Vectorized version of the concentric square to disk mapping
+    inline void concentricDisk(__m128 u, __m128 v, __m128 &x, __m128 &y) {
+        const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f),
+            piOver4 = _mm_set1_ps((float) (M_PI / 4)),
+            piOver2 = _mm_set1_ps((float) (M_PI / 2)),
+            zero = _mm_setzero_ps();
+        __m128 r1 = _mm_sub_ps(_mm_mul_ps(two, u), one),
+               r2 = _mm_sub_ps(_mm_mul_ps(two, v), one),
+               first = _mm_cmpgt_ps(_mm_mul_ps(r1, r1), _mm_mul_ps(r2, r2)),
+               r = select(first, r1, r2),
+               num = select(first, r2, r1),
+               center = _mm_cmpeq_ps(r, zero);
+
+        /* Avoid the division by zero at the center of the disk */
+        __m128 ratio = _mm_div_ps(num, select(center, one, r)),
+               phi = select(first, _mm_mul_ps(piOver4, ratio),
+                   _mm_sub_ps(piOver2, _mm_mul_ps(piOver4, ratio))), sinPhi, cosPhi;
+        phi = _mm_andnot_ps(center, phi);
+
+        math::sincos_ps(phi, &sinPhi, &cosPhi);
+        x = _mm_mul_ps(r, cosPhi);
+        y = _mm_mul_ps(r, sinPhi);
+    }
+};
+#endif
+
+void squareToUniformSphere(size_t count, const Point2 *samples, Vector *result) {
+    size_t i = 0;
+#if defined(MTS_SSE)
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f),
+        twoPi = _mm_set1_ps((float) (2 * M_PI));
+    for (; i + 4 <= count; i += 4) {
+        __m128 u, v, sinPhi, cosPhi;
+        loadSamples(samples + i, u, v);
+        __m128 z = _mm_sub_ps(one, _mm_mul_ps(two, v)),
+               r = safeSqrt(_mm_sub_ps(one, _mm_mul_ps(z, z)));
+        math::sincos_ps(_mm_mul_ps(twoPi, u), &sinPhi, &cosPhi);
+        storeVectors(result + i, _mm_mul_ps(r, cosPhi), _mm_mul_ps(r, sinPhi), z);
+    }
+#endif
+    for (; i < count; ++i)
+        result[i] = squareToUniformSphere(samples[i]);
+}
+
+void squareToUniformHemisphere(size_t count, const Point2 *samples, Vector *result) {
+    size_t i = 0;
+#if defined(MTS_SSE)
+    const __m128 one = _mm_set1_ps(1.0f),
+        twoPi = _mm_set1_ps((float) (2 * M_PI));
+    for (; i + 4 <= count; i += 4) {
+        __m128 z, v, sinPhi, cosPhi;
+        loadSamples(samples + i, z, v);
+        __m128 r = safeSqrt(_mm_sub_ps(one, _mm_mul_ps(z, z)));
+        math::sincos_ps(_mm_mul_ps(twoPi, v), &sinPhi, &cosPhi);
+        storeVectors(result + i, _mm_mul_ps(r, cosPhi), _mm_mul_ps(r, sinPhi), z);
+    }
+#endif
+    for (; i < count; ++i)
+        result[i] = squareToUniformHemisphere(samples[i]);
+}
+
+void squareToCosineHemisphere(size_t count, const Point2 *samples, Vector *result) {
+    size_t i = 0;
+#if defined(MTS_SSE)
+    const __m128 one = _mm_set1_ps(1.0f), eps = _mm_set1_ps(1e-10f);
+    for (; i + 4 <= count; i += 4) {
+        __m128 u, v, x, y;
+        loadSamples(samples + i, u, v);
+        concentricDisk(u, v, x, y);
+        __m128 z = safeSqrt(_mm_sub_ps(_mm_sub_ps(one,
+            _mm_mul_ps(x, x)), _mm_mul_ps(y, y)));
+
+        /* Guard against numerical imprecisions */
+        z = select(_mm_cmpeq_ps(z, _mm_setzero_ps()), eps, z);
+        storeVectors(result + i, x, y, z);
+    }
+#endif
+    for (; i < count; ++i)
+        result[i] = squareToCosineHemisphere(samples[i]);
+}
+
+void squareToUniformDisk(size_t count, const Point2 *samples, Point2 *result) {
+    size_t i = 0;
+#if defined(MTS_SSE)
+    const __m128 twoPi = _mm_set1_ps((float) (2 * M_PI));
+    for (; i + 4 <= count; i += 4) {
+        __m128 u, v, sinPhi, cosPhi;
+        loadSamples(samples + i, u, v);
+        __m128 r = _mm_sqrt_ps(u);
+        math::sincos_ps(_mm_mul_ps(twoPi, v), &sinPhi, &cosPhi);
+        storePoints(result + i, _mm_mul_ps(r, cosPhi), _mm_mul_ps(r, sinPhi));
+    }
+#endif
+    for (; i < count; ++i)
+        result[i] = squareToUniformDisk(samples[i]);
+}
+
+void squareToUniformDiskConcentric(size_t count, const Point2 *samples, Point2 *result) {
+    size_t i = 0;
+#if defined(MTS_SSE)
+    for (; i + 4 <= count; i += 4) {
+        __m128 u, v, x, y;
+        loadSamples(samples + i, u, v);
+        concentricDisk(u, v, x, y);
+        storePoints(result + i, x, y);
+    }
+#endif
+    for (; i < count; ++i)
+        result[i] = squareToUniformDiskConcentric(samples[i]);
+}
+
 };
 
 MTS_NAMESPACE_END
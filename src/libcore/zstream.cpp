@@ -18,6 +18,10 @@
 
 #include <mitsuba/core/zstream.h>
 
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
+
 MTS_NAMESPACE_BEGIN
 
 ZStream::ZStream(Stream *childStream, EStreamType streamType, int level)
@@ -158,6 +162,85 @@ ZStream::~ZStream() {
     inflateEnd(&m_inflateStream);
 }
 
+void ZStream::writeBlocks(Stream *stream, const void *data, size_t size,
+        size_t blockSize, int level) {
+    SAssert(blockSize > 0);
+    const uint8_t *ptr = static_cast<const uint8_t *>(data);
+    const int blockCount = (int) ((size + blockSize - 1) / blockSize);
+
+    std::vector<std::vector<uint8_t> > blocks(blockCount);
+    std::vector<uint64_t> compressedSizes(blockCount), sizes(blockCount);
+    std::vector<int> errors(blockCount, Z_OK);
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<blockCount; ++i) {
+        size_t offset = (size_t) i * blockSize,
+               length = std::min(blockSize, size - offset);
+        uLongf compressedSize = compressBound((uLong) length);
+        blocks[i].resize(compressedSize);
+        errors[i] = compress2(&blocks[i][0], &compressedSize,
+            ptr + offset, (uLong) length, level);
+        compressedSizes[i] = (uint64_t) compressedSize;
+        sizes[i] = (uint64_t) length;
+    }
+
+    for (int i=0; i<blockCount; ++i) {
+        if (errors[i] != Z_OK)
+            SLog(EError, "compress2(): error code %i", errors[i]);
+    }
+
+    stream->writeUInt((uint32_t) blockCount);
+    if (blockCount == 0)
+        return;
+    stream->writeULongArray(&compressedSizes[0], blockCount);
+    stream->writeULongArray(&sizes[0], blockCount);
+    for (int i=0; i<blockCount; ++i)
+        stream->write(&blocks[i][0], (size_t) compressedSizes[i]);
+}
+
+ref<MemoryStream> ZStream::readBlocks(Stream *stream) {
+    const int blockCount = (int) stream->readUInt();
+    std::vector<uint64_t> compressedSizes(blockCount), sizes(blockCount);
+    std::vector<size_t> compressedOffsets(blockCount + 1, 0), offsets(blockCount + 1, 0);
+    if (blockCount > 0) {
+        stream->readULongArray(&compressedSizes[0], blockCount);
+        stream->readULongArray(&sizes[0], blockCount);
+    }
+    for (int i=0; i<blockCount; ++i) {
+        compressedOffsets[i+1] = compressedOffsets[i] + (size_t) compressedSizes[i];
+        offsets[i+1] = offsets[i] + (size_t) sizes[i];
+    }
+
+    std::vector<uint8_t> compressed(compressedOffsets[blockCount]);
+    if (!compressed.empty())
+        stream->read(&compressed[0], compressed.size());
+
+    ref<MemoryStream> result = new MemoryStream(offsets[blockCount]);
+    result->setByteOrder(stream->getByteOrder());
+    result->truncate(offsets[blockCount]);
+    uint8_t *target = result->getData();
+    std::vector<int> errors(blockCount, Z_OK);
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<blockCount; ++i) {
+        uLongf size = (uLongf) sizes[i];
+        errors[i] = uncompress(target + offsets[i], &size,
+            &compressed[compressedOffsets[i]], (uLong) compressedSizes[i]);
+        if (errors[i] == Z_OK && size != (uLongf) sizes[i])
+            errors[i] = Z_DATA_ERROR;
+    }
+
+    for (int i=0; i<blockCount; ++i) {
+        if (errors[i] != Z_OK)
+            SLog(EError, "uncompress(): error code %i in block %i", errors[i], i);
+    }
+    return result;
+}
+
 std::string ZStream::toString() const {
     std::ostringstream oss;
     oss << "ZStream[" << endl
@@ -62,9 +62,6 @@ void GLGeometry::refresh() {
     GLfloat *vertices = new GLfloat[vertexCount * m_stride/sizeof(GLfloat)];
     GLuint *indices = (GLuint *) m_mesh->getTriangles();
     const Point *sourcePositions = m_mesh->getVertexPositions();
-    const Normal *sourceNormals = m_mesh->getVertexNormals();
-    const Point2 *sourceTexcoords = m_mesh->getVertexTexcoords();
-    const Color3 *sourceColors = m_mesh->getVertexColors();
     Vector *sourceTangents = NULL;
 
     if (m_mesh->hasUVTangents()) {
@@ -97,24 +94,27 @@ void GLGeometry::refresh() {
         vertices[pos++] = (GLfloat) sourcePositions[i].x;
         vertices[pos++] = (GLfloat) sourcePositions[i].y;
         vertices[pos++] = (GLfloat) sourcePositions[i].z;
-        if (sourceNormals) {
-            vertices[pos++] = (GLfloat) sourceNormals[i].x;
-            vertices[pos++] = (GLfloat) sourceNormals[i].y;
-            vertices[pos++] = (GLfloat) sourceNormals[i].z;
+        if (m_mesh->hasVertexNormals()) {
+            Normal n = m_mesh->getVertexNormal(i);
+            vertices[pos++] = (GLfloat) n.x;
+            vertices[pos++] = (GLfloat) n.y;
+            vertices[pos++] = (GLfloat) n.z;
         }
-        if (sourceTexcoords) {
-            vertices[pos++] = (GLfloat) sourceTexcoords[i].x;
-            vertices[pos++] = (GLfloat) sourceTexcoords[i].y;
+        if (m_mesh->hasVertexTexcoords()) {
+            Point2 uv = m_mesh->getVertexTexcoord(i);
+            vertices[pos++] = (GLfloat) uv.x;
+            vertices[pos++] = (GLfloat) uv.y;
         }
         if (sourceTangents) {
             vertices[pos++] = (GLfloat) sourceTangents[i].x;
             vertices[pos++] = (GLfloat) sourceTangents[i].y;
             vertices[pos++] = (GLfloat) sourceTangents[i].z;
         }
-        if (sourceColors) {
-            vertices[pos++] = (GLfloat) sourceColors[i][0];
-            vertices[pos++] = (GLfloat) sourceColors[i][1];
-            vertices[pos++] = (GLfloat) sourceColors[i][2];
+        if (m_mesh->hasVertexColors()) {
+            Color3 color = m_mesh->getVertexColor(i);
+            vertices[pos++] = (GLfloat) color[0];
+            vertices[pos++] = (GLfloat) color[1];
+            vertices[pos++] = (GLfloat) color[2];
         }
     }
     Assert(pos * sizeof(GLfloat) == m_stride * vertexCount);
@@ -299,7 +299,7 @@ void GLRenderer::drawMesh(const TriMesh *mesh) {
         glVertexPointer(3, dataType, 0, positions);
 
         if (!m_transmitOnlyPositions) {
-            if (mesh->hasVertexNormals()) {
+            if (normals) {
                 if (!m_normalsEnabled) {
                     glEnableClientState(GL_NORMAL_ARRAY);
                     m_normalsEnabled = true;
@@ -311,7 +311,7 @@ void GLRenderer::drawMesh(const TriMesh *mesh) {
             }
 
             glClientActiveTexture(GL_TEXTURE0);
-            if (mesh->hasVertexTexcoords()) {
+            if (texcoords) {
                 if (!m_texcoordsEnabled) {
                     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
                     m_texcoordsEnabled = true;
@@ -335,7 +335,7 @@ void GLRenderer::drawMesh(const TriMesh *mesh) {
                 m_tangentsEnabled = false;
             }
 
-            if (mesh->hasVertexColors()) {
+            if (colors) {
                 if (!m_colorsEnabled) {
                     glEnableClientState(GL_COLOR_ARRAY);
                     m_colorsEnabled = true;
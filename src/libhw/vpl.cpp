@@ -57,6 +57,8 @@ VPLShaderManager::VPLShaderManager(Renderer *renderer)
     m_diffuseSources = true;
     m_diffuseReceivers = false;
     m_vplIndex = 0;
+    m_compilationBudget = -1;
+    m_compiledPrograms = m_deferredPrograms = 0;
 }
 
 VPLShaderManager::~VPLShaderManager() {
@@ -443,27 +445,7 @@ void VPLShaderManager::bind(const VPL &vpl, const BSDF *bsdf, const Sensor *sens
                 RendererCapabilities::EGeometryShaders);
 
     if (unsupported) {
-        std::map<std::string, VPLConfiguration>::iterator it
-            = m_configurations.find("unsupported");
-        m_targetConfiguration = VPLConfiguration();
-        if (it != m_configurations.end()) {
-            /* A program for this configuration has been created previously */
-            m_currentProgram = (*it).second;
-        } else {
-            m_currentProgram = VPLConfiguration();
-            ref<GPUProgram> prog = m_renderer->createGPUProgram("Unsupported material program");
-            prog->setSource(GPUProgram::EVertexProgram, sh_unsupported_vert);
-            prog->setSource(GPUProgram::EFragmentProgram, sh_unsupported_frag);
-            prog->init();
-            prog->incRef();
-            m_currentProgram.program = prog;
-
-            m_currentProgram.param_instanceTransform = prog->getParameterID("instanceTransform", false);
-            m_configurations["unsupported"] = m_currentProgram;
-        }
-        GPUProgram *prog = m_currentProgram.program;
-        prog->bind();
-        prog->setParameter(m_currentProgram.param_instanceTransform, instanceTransform);
+        bindUnsupported(instanceTransform);
         return;
     }
 
@@ -494,7 +476,13 @@ void VPLShaderManager::bind(const VPL &vpl, const BSDF *bsdf, const Sensor *sens
     if (it != m_configurations.end()) {
         /* A program for this configuration has been created previously */
         m_currentProgram = (*it).second;
+    } else if (m_compilationBudget >= 0 && m_compiledPrograms >= m_compilationBudget) {
+        /* Out of budget -- compile this program in a later pass */
+        m_deferredPrograms++;
+        bindUnsupported(instanceTransform);
+        return;
     } else {
+        m_compiledPrograms++;
         std::ostringstream oss;
         std::string vplEvalName, bsdfEvalName, emitterEvalName;
         m_targetConfiguration.generateCode(oss, vplEvalName, bsdfEvalName, emitterEvalName);
@@ -617,6 +605,30 @@ void VPLShaderManager::bind(const VPL &vpl, const BSDF *bsdf, const Sensor *sens
     m_targetConfiguration.bind(m_currentProgram, 1);
 }
 
+void VPLShaderManager::bindUnsupported(const Matrix4x4 &instanceTransform) {
+    std::map<std::string, VPLConfiguration>::iterator it
+        = m_configurations.find("unsupported");
+    m_targetConfiguration = VPLConfiguration();
+    if (it != m_configurations.end()) {
+        /* A program for this configuration has been created previously */
+        m_currentProgram = (*it).second;
+    } else {
+        m_currentProgram = VPLConfiguration();
+        ref<GPUProgram> prog = m_renderer->createGPUProgram("Unsupported material program");
+        prog->setSource(GPUProgram::EVertexProgram, sh_unsupported_vert);
+        prog->setSource(GPUProgram::EFragmentProgram, sh_unsupported_frag);
+        prog->init();
+        prog->incRef();
+        m_currentProgram.program = prog;
+
+        m_currentProgram.param_instanceTransform = prog->getParameterID("instanceTransform", false);
+        m_configurations["unsupported"] = m_currentProgram;
+    }
+    GPUProgram *prog = m_currentProgram.program;
+    prog->bind();
+    prog->setParameter(m_currentProgram.param_instanceTransform, instanceTransform);
+}
+
 void VPLShaderManager::unbind() {
     if (!m_currentProgram.program)
         return;
@@ -632,6 +644,7 @@ void VPLShaderManager::drawAllGeometryForVPL(const VPL &vpl, const Sensor *senso
     bool currentHasNormals = false;
 
     m_renderer->setDepthTest(true);
+    m_compiledPrograms = m_deferredPrograms = 0;
 
     Matrix4x4 currentObjTrafo;
     currentObjTrafo.setIdentity();
@@ -23,6 +23,7 @@
 #include <mitsuba/core/shvector.h>
 #include <mitsuba/core/sshstream.h>
 #include <mitsuba/render/scenehandler.h>
+#include <mitsuba/render/tilecache.h>
 #include <mitsuba/render/scene.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/python/tuple.hpp>
@@ -71,11 +72,13 @@ static void initializeFramework() {
     Scheduler::staticInitialization();
     SHVector::staticInitialization();
     SceneHandler::staticInitialization();
+    TextureTileCache::staticInitialization();
     Thread::registerCrashHandler(&check_python_exception);
 }
 
 static void shutdownFramework() {
     /* Shutdown the core framework */
+    TextureTileCache::staticShutdown();
     SceneHandler::staticShutdown();
     SHVector::staticShutdown();
     Scheduler::staticShutdown();
@@ -208,6 +211,36 @@ static void scheduler_wait(Scheduler *scheduler, const ParallelProcess *proc) {
     scheduler->wait(proc);
 }
 
+static bool scheduler_schedule(Scheduler *scheduler, ParallelProcess *proc) {
+    ReleaseGIL gil;
+    return scheduler->schedule(proc);
+}
+
+static void scheduler_pause(Scheduler *scheduler) {
+    ReleaseGIL gil;
+    scheduler->pause();
+}
+
+static void scheduler_stop(Scheduler *scheduler) {
+    ReleaseGIL gil;
+    scheduler->stop();
+}
+
+static void stream_flush(Stream *stream) {
+    ReleaseGIL gil;
+    stream->flush();
+}
+
+static void stream_copyTo(Stream *stream, Stream *target, int64_t numBytes) {
+    ReleaseGIL gil;
+    stream->copyTo(target, numBytes);
+}
+
+static std::string stream_readLine(Stream *stream) {
+    ReleaseGIL gil;
+    return stream->readLine();
+}
+
 static Matrix4x4 *Matrix4x4_fromList(bp::list list) {
     if (bp::len(list) == 4) {
         Float buf[4][4];
@@ -670,29 +703,54 @@ static void bitmap_applyMatrix(Bitmap *bitmap, bp::list list) {
 }
 
 static void bitmap_write1(Bitmap *bitmap, Bitmap::EFileFormat fmt, Stream *stream) {
+    ReleaseGIL gil;
     bitmap->write(fmt, stream);
 }
 
 static void bitmap_write2(Bitmap *bitmap, Bitmap::EFileFormat fmt, Stream *stream, int compression) {
+    ReleaseGIL gil;
     bitmap->write(fmt, stream, compression);
 }
 
 static void bitmap_write3(Bitmap *bitmap, Bitmap::EFileFormat fmt, const fs::path &path) {
+    ReleaseGIL gil;
     bitmap->write(fmt, path);
 }
 
 static void bitmap_write4(Bitmap *bitmap, Bitmap::EFileFormat fmt, const fs::path &path, int compression) {
+    ReleaseGIL gil;
     bitmap->write(fmt, path, compression);
 }
 
 static void bitmap_write5(Bitmap *bitmap, const fs::path &path) {
+    ReleaseGIL gil;
     bitmap->write(path);
 }
 
 static void bitmap_write6(Bitmap *bitmap, const fs::path &path, int compression) {
+    ReleaseGIL gil;
     bitmap->write(path, compression);
 }
 
+static ref<Bitmap> bitmap_load_stream(Bitmap::EFileFormat fmt, Stream *stream,
+        const std::string &prefix) {
+    ReleaseGIL gil;
+    return new Bitmap(fmt, stream, prefix);
+}
+
+static ref<Bitmap> bitmap_load_stream_noprefix(Bitmap::EFileFormat fmt, Stream *stream) {
+    return bitmap_load_stream(fmt, stream, "");
+}
+
+static ref<Bitmap> bitmap_load_path(const fs::path &path, const std::string &prefix) {
+    ReleaseGIL gil;
+    return new Bitmap(path, prefix);
+}
+
+static ref<Bitmap> bitmap_load_path_noprefix(const fs::path &path) {
+    return bitmap_load_path(path, "");
+}
+
 static void bitmap_convert_0(Bitmap *bitmap, Bitmap *target) {
     bitmap->convert(target);
 }
@@ -892,6 +950,19 @@ static bp::tuple gaussLobatto_(int n) {
  */
 extern MTS_EXPORT_CORE void gaussLobatto(int n, Float *nodes, Float *weights);
 
+/// Return the buffer protocol format string of a component format (or \c NULL)
+static const char *bufferFormat(Bitmap::EComponentFormat format, size_t &itemSize) {
+    switch (format) {
+        case Bitmap::EUInt8:   itemSize = 1; return "B";
+        case Bitmap::EUInt16:  itemSize = 2; return "H";
+        case Bitmap::EUInt32:  itemSize = 4; return "I";
+        case Bitmap::EFloat16: itemSize = 2; return "e";
+        case Bitmap::EFloat32: itemSize = 4; return "f";
+        case Bitmap::EFloat64: itemSize = 8; return "d";
+        default: itemSize = 0; return NULL;
+    }
+}
+
 struct NativeBuffer {
     ref<Object> owner;
     void *ptr;
@@ -903,16 +974,9 @@ struct NativeBuffer {
     NativeBuffer(Object *owner, void *ptr, Bitmap::EComponentFormat format, int ndim,
             Py_ssize_t shape[3]) : owner(owner), ptr(ptr), format(format), ndim(ndim) {
         size_t itemSize = 0;
-        switch (format) {
-            case Bitmap::EUInt8:   formatString = "B"; itemSize = 1; break;
-            case Bitmap::EUInt16:  formatString = "H"; itemSize = 2; break;
-            case Bitmap::EUInt32:  formatString = "I"; itemSize = 4; break;
-            case Bitmap::EFloat16: formatString = "e"; itemSize = 2; break;
-            case Bitmap::EFloat32: formatString = "f"; itemSize = 4; break;
-            case Bitmap::EFloat64: formatString = "d"; itemSize = 8; break;
-            default:
-                SLog(EError, "Unsupported bufer format!");
-        }
+        formatString = bufferFormat(format, itemSize);
+        if (!formatString)
+            SLog(EError, "Unsupported bufer format!");
         strides[ndim] = itemSize;
 
         for (int i=ndim-1; i>=0; --i) {
@@ -1044,70 +1108,162 @@ static NativeBuffer bitmap_buffer(Bitmap *bitmap) {
 }
 
 
-static ref<Bitmap> bitmap_array_constructor(bp::object _obj) {
-    PyObject *obj = _obj.ptr();
-    if (!obj)
-        SLog(EError, "Expected a non-NULL argument!");
+/**
+ * Bitmap sharing the memory of a Python object (e.g. a NumPy array)
+ * that supports the buffer protocol. The buffer is held until the
+ * bitmap is destroyed.
+ */
+class BufferBitmap : public Bitmap {
+public:
+    BufferBitmap(EPixelFormat pFmt, EComponentFormat cFmt, const Vector2i &size,
+        uint8_t channelCount, Py_buffer &buffer) : Bitmap(pFmt, cFmt, size,
+        channelCount, (uint8_t *) buffer.buf), m_buffer(buffer) { }
 
-    bp::extract<fs::path> extractPath(_obj);
-    if (extractPath.check())
-        return new Bitmap(extractPath());
+protected:
+    virtual ~BufferBitmap() {
+        /* The last reference may be released by a thread of Mitsuba */
+        AcquireGIL gil;
+        PyBuffer_Release(&m_buffer);
+    }
+private:
+    Py_buffer m_buffer;
+};
 
+/// Create a bitmap from an object that supports the buffer protocol
+static ref<Bitmap> bitmap_from_buffer(PyObject *obj, bool copy) {
     Py_buffer buffer;
-    if (PyObject_GetBuffer(obj, &buffer, PyBUF_CONTIG_RO | PyBUF_FORMAT))
-        SLog(EError, "Could not access supplied object using the buffer protocol!");
+    int flags = copy ? (PyBUF_CONTIG_RO | PyBUF_FORMAT) : (PyBUF_CONTIG | PyBUF_FORMAT);
+    if (PyObject_GetBuffer(obj, &buffer, flags)) {
+        PyErr_Clear();
+        SLog(EError, copy ? "Could not access supplied object using the buffer protocol!"
+            : "Could not access supplied object as a writable contiguous buffer!");
+    }
 
     Vector2i size(1);
     Bitmap::EPixelFormat pixelFormat = Bitmap::ELuminance;
     Bitmap::EComponentFormat componentFormat = Bitmap::EUInt8;
     int nChannels = 1;
 
-    if (buffer.ndim == 0 || buffer.ndim > 3)
-        SLog(EError, "Invalid number of dimensions!");
+    try {
+        if (buffer.ndim == 0 || buffer.ndim > 3)
+            SLog(EError, "Invalid number of dimensions!");
 
-    if (buffer.ndim == 1) {
-        size.x = buffer.shape[0];
-    } else if (buffer.ndim > 1) {
-        size.y = buffer.shape[0];
-        size.x = buffer.shape[1];
-    }
-    if (buffer.ndim > 2) {
-        nChannels = buffer.shape[2];
-        if (nChannels == 1)
-            pixelFormat = Bitmap::ELuminance;
-        else if (nChannels == 2)
-            pixelFormat = Bitmap::ELuminanceAlpha;
-        else if (nChannels == 3)
-            pixelFormat = Bitmap::ERGB;
-        else if (nChannels == 4)
-            pixelFormat = Bitmap::ERGBA;
-        else
-            pixelFormat = Bitmap::EMultiChannel;
-    }
-    if (strlen(buffer.format) != 1)
-        SLog(EError, "Invalid buffer format \"%s\"", buffer.format);
-
-    switch (buffer.format[0]) {
-        case 'B': componentFormat = Bitmap::EUInt8; break;
-        case 'H': componentFormat = Bitmap::EUInt16; break;
-        case 'I': componentFormat = Bitmap::EUInt32; break;
-        case 'e': componentFormat = Bitmap::EFloat16; break;
-        case 'f': componentFormat = Bitmap::EFloat32; break;
-        case 'd': componentFormat = Bitmap::EFloat64; break;
-        default:
+        if (buffer.ndim == 1) {
+            size.x = buffer.shape[0];
+        } else if (buffer.ndim > 1) {
+            size.y = buffer.shape[0];
+            size.x = buffer.shape[1];
+        }
+        if (buffer.ndim > 2) {
+            nChannels = buffer.shape[2];
+            if (nChannels == 1)
+                pixelFormat = Bitmap::ELuminance;
+            else if (nChannels == 2)
+                pixelFormat = Bitmap::ELuminanceAlpha;
+            else if (nChannels == 3)
+                pixelFormat = Bitmap::ERGB;
+            else if (nChannels == 4)
+                pixelFormat = Bitmap::ERGBA;
+            else
+                pixelFormat = Bitmap::EMultiChannel;
+        }
+        if (strlen(buffer.format) != 1)
             SLog(EError, "Invalid buffer format \"%s\"", buffer.format);
+
+        switch (buffer.format[0]) {
+            case 'B': componentFormat = Bitmap::EUInt8; break;
+            case 'H': componentFormat = Bitmap::EUInt16; break;
+            case 'I': componentFormat = Bitmap::EUInt32; break;
+            case 'e': componentFormat = Bitmap::EFloat16; break;
+            case 'f': componentFormat = Bitmap::EFloat32; break;
+            case 'd': componentFormat = Bitmap::EFloat64; break;
+            default:
+                SLog(EError, "Invalid buffer format \"%s\"", buffer.format);
+        }
+    } catch (...) {
+        PyBuffer_Release(&buffer);
+        throw;
     }
 
+    if (!copy)
+        return new BufferBitmap(pixelFormat, componentFormat, size, nChannels, buffer);
+
     ref<Bitmap> result = new Bitmap(pixelFormat, componentFormat, size, nChannels);
-    if ((size_t) buffer.len != result->getBufferSize())
+    if ((size_t) buffer.len != result->getBufferSize()) {
+        PyBuffer_Release(&buffer);
         SLog(EError, "Internal error: Python buffer size and Mitsuba bitmap size disagree: "
             SIZE_T_FMT " vs " SIZE_T_FMT, (size_t) buffer.len, (size_t) result->getBufferSize());
+    }
 
     memcpy(result->getData(), buffer.buf, result->getBufferSize());
 
     PyBuffer_Release(&buffer);
     return result;
 }
+
+static ref<Bitmap> bitmap_array_constructor(bp::object _obj) {
+    PyObject *obj = _obj.ptr();
+    if (!obj)
+        SLog(EError, "Expected a non-NULL argument!");
+
+    bp::extract<fs::path> extractPath(_obj);
+    if (extractPath.check())
+        return new Bitmap(extractPath());
+
+    return bitmap_from_buffer(obj, true);
+}
+
+static ref<Bitmap> bitmap_fromBuffer(bp::object obj) {
+    return bitmap_from_buffer(obj.ptr(), false);
+}
+
+/* Buffer protocol of Bitmap instances (exposes the pixels without a copy) */
+static int bitmap_getbuffer(PyObject *obj, Py_buffer *view, int flags) {
+    bp::extract<Bitmap &> b(obj);
+    if (!b.check()) {
+        PyErr_SetString(PyExc_BufferError, "Bitmap is invalid!");
+        view->obj = NULL;
+        return -1;
+    }
+    Bitmap &bitmap = b();
+
+    size_t itemSize = 0;
+    const char *format = bufferFormat(bitmap.getComponentFormat(), itemSize);
+    if (!format) {
+        PyErr_SetString(PyExc_BufferError, "Unsupported bitmap component format!");
+        view->obj = NULL;
+        return -1;
+    }
+
+    /* Shape followed by the strides, freed by bitmap_releasebuffer() */
+    int ndim = bitmap.getChannelCount() == 1 ? 2 : 3;
+    Py_ssize_t *info = new Py_ssize_t[6];
+    info[0] = (Py_ssize_t) bitmap.getHeight();
+    info[1] = (Py_ssize_t) bitmap.getWidth();
+    info[2] = (Py_ssize_t) bitmap.getChannelCount();
+    info[3 + ndim - 1] = (Py_ssize_t) itemSize;
+    for (int i=ndim-2; i>=0; --i)
+        info[3 + i] = info[3 + i + 1] * info[i + 1];
+
+    view->obj = obj;
+    Py_INCREF(obj);
+    view->buf = bitmap.getUInt8Data();
+    view->len = (Py_ssize_t) bitmap.getBufferSize();
+    view->readonly = false;
+    view->itemsize = (Py_ssize_t) itemSize;
+    view->format = (flags & PyBUF_FORMAT) == PyBUF_FORMAT ? const_cast<char *>(format) : NULL;
+    view->ndim = (flags & PyBUF_ND) == PyBUF_ND ? ndim : 1;
+    view->shape = (flags & PyBUF_ND) == PyBUF_ND ? info : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? info + 3 : NULL;
+    view->suboffsets = NULL;
+    view->internal = info;
+    return 0;
+}
+
+static void bitmap_releasebuffer(PyObject *obj, Py_buffer *view) {
+    delete[] static_cast<Py_ssize_t *>(view->internal);
+}
+
 BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(fromLinearRGB_overloads, fromLinearRGB, 3, 4)
 BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(fromXYZ_overloads, fromXYZ, 3, 4)
 BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(fromIPT_overloads, fromIPT, 3, 4)
@@ -1291,15 +1447,15 @@ void export_core() {
         .def("seek", &Stream::seek)
         .def("getPos", &Stream::getPos)
         .def("getSize", &Stream::getSize)
-        .def("flush", &Stream::flush)
+        .def("flush", stream_flush)
         .def("canWrite", &Stream::canWrite)
         .def("canRead", &Stream::canRead)
         .def("skip", &Stream::skip)
-        .def("copyTo", &Stream::copyTo)
+        .def("copyTo", stream_copyTo)
         .def("writeString", &Stream::writeString)
         .def("readString", &Stream::readString)
         .def("writeLine", &Stream::writeLine)
-        .def("readLine", &Stream::readLine)
+        .def("readLine", stream_readLine)
         .def("writeChar", &Stream::writeChar)
         .def("readChar", &Stream::readChar)
         .def("writeUChar", &Stream::writeUChar)
@@ -1459,7 +1615,12 @@ void export_core() {
         .def("getFormatter", &Logger::getFormatter, BP_RETURN_VALUE)
         .def("setFormatter", &Logger::setFormatter)
         .def("readLog", &logger_readLog)
-        .def("getWarningCount", &Logger::getWarningCount);
+        .def("getWarningCount", &Logger::getWarningCount)
+        .def("setAsynchronous", &Logger::setAsynchronous)
+        .def("isAsynchronous", &Logger::isAsynchronous)
+        .def("flush", &Logger::flush)
+        .def("setWarningLimit", &Logger::setWarningLimit)
+        .def("getWarningLimit", &Logger::getWarningLimit);
 
     BP_CLASS(InstanceManager, Object, bp::init<>())
         .def("serialize", &InstanceManager::serialize)
@@ -1509,8 +1670,10 @@ void export_core() {
 
     BP_CLASS(Bitmap, Object, (bp::init<Bitmap::EPixelFormat, Bitmap::EComponentFormat, const Vector2i &>()))
         .def(bp::init<Bitmap::EPixelFormat, Bitmap::EComponentFormat, const Vector2i &, int>())
-        .def(bp::init<Bitmap::EFileFormat, Stream *, bp::optional<std::string> >())
-        .def(bp::init<fs::path, bp::optional<std::string> >())
+        .def("__init__", bp::make_constructor(bitmap_load_stream))
+        .def("__init__", bp::make_constructor(bitmap_load_stream_noprefix))
+        .def("__init__", bp::make_constructor(bitmap_load_path))
+        .def("__init__", bp::make_constructor(bitmap_load_path_noprefix))
         .def("__init__", bp::make_constructor(bitmap_array_constructor))
         .def("getPixelFormat", &Bitmap::getPixelFormat)
         .def("getComponentFormat", &Bitmap::getComponentFormat)
@@ -1587,6 +1750,8 @@ void export_core() {
         .def("toByteArray", &bitmap_toByteArray_1)
         .def("toByteArray", &bitmap_toByteArray_2)
         .def("buffer", bitmap_buffer)
+        .def("fromBuffer", bitmap_fromBuffer)
+        .staticmethod("fromBuffer")
         .def("split", bitmap_split)
         .def("plot", bitmap_plot)
         .staticmethod("join")
@@ -1690,6 +1855,24 @@ void export_core() {
         fb_type->tp_flags |= Py_TPFLAGS_HAVE_NEWBUFFER;
     #endif
 
+    /* Bitmaps themselves also support the buffer protocol */
+    PyTypeObject* bitmap_type = bp::converter::registry::lookup(
+        bp::type_id<Bitmap>()).get_class_object();
+
+    static PyBufferProcs Bitmap_buffer_procs = {
+        #if PY_MAJOR_VERSION < 3
+            NULL, NULL, NULL, NULL,
+        #endif
+        &bitmap_getbuffer,
+        &bitmap_releasebuffer
+    };
+
+    bitmap_type->tp_as_buffer = &Bitmap_buffer_procs;
+
+    #if PY_MAJOR_VERSION < 3
+        bitmap_type->tp_flags |= Py_TPFLAGS_HAVE_NEWBUFFER;
+    #endif
+
     BP_CLASS(FileResolver, Object, bp::init<>())
         .def("getPathCount", &FileResolver::getPathCount)
         .def("getPath", &FileResolver::getPath, BP_RETURN_VALUE)
@@ -1728,6 +1911,8 @@ void export_core() {
 
     BP_CLASS(Statistics, Object, bp::no_init)
         .def("getStats", &Statistics::getStats, BP_RETURN_VALUE)
+        .def("getStatsJSON", &Statistics::getStatsJSON, BP_RETURN_VALUE)
+        .def("getPhaseTimingsJSON", &Statistics::getPhaseTimingsJSON, BP_RETURN_VALUE)
         .def("resetAll", &Statistics::resetAll)
         .def("printStats", &Statistics::printStats)
         .def("getInstance", &Statistics::getInstance, BP_RETURN_VALUE)
@@ -1758,6 +1943,10 @@ void export_core() {
         .def("bindResource", &ParallelProcess::bindResource)
         .def("isLocal", &ParallelProcess::isLocal)
         .def("getLogLevel", &ParallelProcess::getLogLevel)
+        .def("getMemoryFootprint", &ParallelProcess::getMemoryFootprint)
+        .def("setMemoryFootprint", &ParallelProcess::setMemoryFootprint)
+        .def("getShare", &ParallelProcess::getShare)
+        .def("setShare", &ParallelProcess::setShare)
         .def("getRequiredPlugins", &ParallelProcess::getRequiredPlugins, BP_RETURN_VALUE);
 
     BP_SETSCOPE(ParallelProcess_class);
@@ -1771,19 +1960,22 @@ void export_core() {
 
     BP_CLASS(Worker, Thread, bp::no_init)
         .def("getCoreCount", &Worker::getCoreCount)
-        .def("isRemoteWorker", &Worker::isRemoteWorker);
+        .def("isRemoteWorker", &Worker::isRemoteWorker)
+        .def("getMemoryLimit", &Worker::getMemoryLimit);
 
     BP_CLASS(LocalWorker, Worker, (bp::init<int, const std::string>()))
         .def(bp::init<int, const std::string, Thread::EThreadPriority>());
 
     BP_CLASS(RemoteWorker, Worker, (bp::init<const std::string, Stream *>()))
-        .def("getNodeName", &RemoteWorker::getNodeName, BP_RETURN_VALUE);
+        .def("getNodeName", &RemoteWorker::getNodeName, BP_RETURN_VALUE)
+        .def("setCompressionLevel", &RemoteWorker::setCompressionLevel)
+        .def("getCompressionLevel", &RemoteWorker::getCompressionLevel);
 
     bp::class_<SerializableObjectVector>("SerializableObjectVector")
         .def(bp::vector_indexing_suite<SerializableObjectVector>());
 
     BP_CLASS(Scheduler, Object, bp::no_init)
-        .def("schedule", &Scheduler::schedule)
+        .def("schedule", scheduler_schedule)
         .def("wait", scheduler_wait)
         .def("cancel", scheduler_cancel)
         .def("registerResource", &Scheduler::registerResource)
@@ -1797,15 +1989,19 @@ void export_core() {
         .def("getLocalWorkerCount", &Scheduler::getLocalWorkerCount)
         .def("getWorker", &Scheduler::getWorker, BP_RETURN_VALUE)
         .def("start", &Scheduler::start)
-        .def("pause", &Scheduler::pause)
-        .def("stop", &Scheduler::stop)
+        .def("pause", scheduler_pause)
+        .def("stop", scheduler_stop)
         .def("getCoreCount", &Scheduler::getCoreCount)
         .def("hasLocalWorkers", &Scheduler::hasLocalWorkers)
         .def("hasRemoteWorkers", &Scheduler::hasRemoteWorkers)
         .def("getInstance", &Scheduler::getInstance, BP_RETURN_VALUE)
         .def("isRunning", &Scheduler::isRunning)
         .def("isBusy", &Scheduler::isBusy)
-        .staticmethod("getInstance");
+        .def("setThreadShare", &Scheduler::setThreadShare)
+        .def("getThreadShare", &Scheduler::getThreadShare)
+        .staticmethod("getInstance")
+        .staticmethod("setThreadShare")
+        .staticmethod("getThreadShare");
 
     BP_CLASS(AbstractAnimationTrack, Object, bp::no_init)
         .def("getType", &AbstractAnimationTrack::getType)
@@ -2364,6 +2560,7 @@ void export_core() {
     bp::def("getCoreCount", &getCoreCount);
     bp::def("getHostName", &getHostName);
     bp::def("getPrivateMemoryUsage", &getPrivateMemoryUsage);
+    bp::def("getPeakMemoryUsage", &getPeakMemoryUsage);
     bp::def("getTotalSystemMemory", &getTotalSystemMemory);
     bp::def("getFQDN", &getFQDN);
     bp::def("rdtsc", &rdtsc);
@@ -3,6 +3,8 @@
 #include <mitsuba/render/scenehandler.h>
 #include <mitsuba/render/renderqueue.h>
 #include <mitsuba/render/renderjob.h>
+#include <mitsuba/render/rendermonitor.h>
+#include <mitsuba/render/raybatch.h>
 #include <mitsuba/render/noise.h>
 #include "../shapes/instance.h"
 
@@ -41,6 +43,12 @@ static bp::tuple bsdf_sample(const BSDF *bsdf, BSDFSamplingRecord &bRec, const P
     return bp::make_tuple(result, pdf);
 }
 
+static bp::tuple bsdf_evalWithPdf(const BSDF *bsdf, const BSDFSamplingRecord &bRec, EMeasure measure) {
+    Float pdf;
+    Spectrum result = bsdf->evalWithPdf(bRec, pdf, measure);
+    return bp::make_tuple(result, pdf);
+}
+
 static bp::list shapekdtree_getShapes(const ShapeKDTree *kdtree) {
     const std::vector<const Shape *> &shapes = kdtree->getShapes();
     bp::list list;
@@ -55,6 +63,19 @@ static Shape *shape_getShapeGroup(Shape *shape) {
     return static_cast<Instance *>(shape)->getShapeGroup();
 }
 
+static void shape_setInstanceTransform(Shape *shape, bp::object trafo) {
+    if (shape->getClass()->getName() != "Instance")
+        SLog(EError, "setInstanceTransform(): \"%s\" is not an instance!",
+            shape->getName().c_str());
+    bp::extract<AnimatedTransform *> extractAnimated(trafo);
+    ref<const AnimatedTransform> animated;
+    if (extractAnimated.check())
+        animated = extractAnimated();
+    else
+        animated = new AnimatedTransform(bp::extract<const Transform &>(trafo)());
+    static_cast<Instance *>(shape)->setWorldTransform(animated);
+}
+
 static bp::object shape_getElement(Shape *shape, int idx) {
     return cast(shape->getElement(idx));
 }
@@ -114,6 +135,75 @@ static bp::object scene_rayIntersectAll(const Scene *scene, const Ray &ray) {
     return bp::object(its);
 }
 
+#if defined(SINGLE_PRECISION)
+#define NUMPY_FLOAT "float32"
+#else
+#define NUMPY_FLOAT "float64"
+#endif
+
+/// Access to the memory of a contiguous NumPy array (released on destruction)
+class ArrayBuffer {
+public:
+    ArrayBuffer(bp::object array, bool writable) {
+        int flags = PyBUF_C_CONTIGUOUS | (writable ? PyBUF_WRITABLE : 0);
+        if (PyObject_GetBuffer(array.ptr(), &m_buffer, flags))
+            SLog(EError, "Could not access an array using the buffer protocol!");
+    }
+
+    ~ArrayBuffer() { PyBuffer_Release(&m_buffer); }
+
+    template <typename T> inline T *get() { return static_cast<T *>(m_buffer.buf); }
+private:
+    Py_buffer m_buffer;
+};
+
+static bp::tuple scene_rayIntersectBatch(Scene *scene, bp::object origins, bp::object directions) {
+    /* Convert the arguments into contiguous N x 3 arrays of the native precision */
+    bp::object numpy = bp::import("numpy");
+    origins = numpy.attr("ascontiguousarray")(origins, NUMPY_FLOAT).attr("reshape")(-1, 3);
+    directions = numpy.attr("ascontiguousarray")(directions, NUMPY_FLOAT).attr("reshape")(-1, 3);
+    size_t count = (size_t) bp::len(origins);
+    if ((size_t) bp::len(directions) != count)
+        SLog(EError, "rayIntersectBatch(): the number of origins and directions differs!");
+
+    bp::object t = numpy.attr("empty")(count, NUMPY_FLOAT),
+        shapeIndex = numpy.attr("empty")(count, "uint32"),
+        primIndex = numpy.attr("empty")(count, "uint32"),
+        uv = numpy.attr("empty")(bp::make_tuple(count, 2), NUMPY_FLOAT),
+        normals = numpy.attr("empty")(bp::make_tuple(count, 3), NUMPY_FLOAT);
+
+    ArrayBuffer originsBuf(origins, false), directionsBuf(directions, false),
+        tBuf(t, true), shapeIndexBuf(shapeIndex, true), primIndexBuf(primIndex, true),
+        uvBuf(uv, true), normalsBuf(normals, true);
+
+    RayBatch batch;
+    batch.count = count;
+    batch.origins = originsBuf.get<Float>();
+    batch.directions = directionsBuf.get<Float>();
+    batch.t = tBuf.get<Float>();
+    batch.shapeIndex = shapeIndexBuf.get<uint32_t>();
+    batch.primIndex = primIndexBuf.get<uint32_t>();
+    batch.uv = uvBuf.get<Float>();
+    batch.normals = normalsBuf.get<Float>();
+
+    bool success;
+    {
+        ReleaseGIL gil;
+        Scheduler *sched = Scheduler::getInstance();
+        ref<RayBatchProcess> proc = new RayBatchProcess(batch);
+        int sceneResID = sched->registerResource(scene);
+        proc->bindResource("scene", sceneResID);
+        sched->schedule(proc);
+        sched->wait(proc);
+        sched->unregisterResource(sceneResID);
+        success = proc->getReturnStatus() == ParallelProcess::ESuccess;
+    }
+    if (!success)
+        SLog(EError, "rayIntersectBatch(): the ray tracing process failed!");
+
+    return bp::make_tuple(t, shapeIndex, primIndex, uv, normals);
+}
+
 static bp::tuple shape_getCurvature(const Shape *shape, const Intersection &its, bool shadingFrame) {
     Float H, K;
     shape->getCurvature(its, H, K, shadingFrame);
@@ -127,6 +217,7 @@ static bp::tuple shape_getNormalDerivative(const Shape *shape, const Intersectio
 }
 
 static ref<Scene> loadScene1(const fs::path &filename) {
+    ReleaseGIL gil;
     return SceneHandler::loadScene(filename);
 }
 
@@ -134,6 +225,7 @@ static ref<Scene> loadScene2(const fs::path &filename, const StringMap &params)
     SceneHandler::ParameterMap pmap;
     for (StringMap::const_iterator it = params.begin(); it != params.end(); ++it)
         pmap[it->first]=it->second;
+    ReleaseGIL gil;
     return SceneHandler::loadScene(filename, pmap);
 }
 
@@ -287,6 +379,70 @@ static void renderJob_cancel(RenderJob *job) {
     job->cancel();
 }
 
+static bool renderJob_wait(RenderJob *job) {
+    ReleaseGIL gil;
+    return job->wait();
+}
+
+static void renderJob_flush(RenderJob *job) {
+    ReleaseGIL gil;
+    job->flush();
+}
+
+static void scene_initialize(Scene *scene) {
+    ReleaseGIL gil;
+    scene->initialize();
+}
+
+static bool scene_commit(Scene *scene, bool geometryChanged) {
+    ReleaseGIL gil;
+    return scene->commit(geometryChanged);
+}
+
+static bool scene_preprocess(Scene *scene, RenderQueue *queue, const RenderJob *job,
+        int sceneResID, int sensorResID, int samplerResID) {
+    ReleaseGIL gil;
+    return scene->preprocess(queue, job, sceneResID, sensorResID, samplerResID);
+}
+
+static bool scene_render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+        int sceneResID, int sensorResID, int samplerResID) {
+    ReleaseGIL gil;
+    return scene->render(queue, job, sceneResID, sensorResID, samplerResID);
+}
+
+static void scene_postprocess(Scene *scene, RenderQueue *queue, const RenderJob *job,
+        int sceneResID, int sensorResID, int samplerResID) {
+    ReleaseGIL gil;
+    scene->postprocess(queue, job, sceneResID, sensorResID, samplerResID);
+}
+
+static void scene_flush(Scene *scene, RenderQueue *queue, const RenderJob *job) {
+    ReleaseGIL gil;
+    scene->flush(queue, job);
+}
+
+static bool integrator_preprocess(Integrator *integrator, const Scene *scene,
+        RenderQueue *queue, const RenderJob *job, int sceneResID,
+        int sensorResID, int samplerResID) {
+    ReleaseGIL gil;
+    return integrator->preprocess(scene, queue, job, sceneResID, sensorResID, samplerResID);
+}
+
+static bool integrator_render(Integrator *integrator, Scene *scene,
+        RenderQueue *queue, const RenderJob *job, int sceneResID,
+        int sensorResID, int samplerResID) {
+    ReleaseGIL gil;
+    return integrator->render(scene, queue, job, sceneResID, sensorResID, samplerResID);
+}
+
+static void integrator_postprocess(Integrator *integrator, const Scene *scene,
+        RenderQueue *queue, const RenderJob *job, int sceneResID,
+        int sensorResID, int samplerResID) {
+    ReleaseGIL gil;
+    integrator->postprocess(scene, queue, job, sceneResID, sensorResID, samplerResID);
+}
+
 bp::tuple Sensor_sampleRay(Sensor *sensor, const Point2 &samplePosition, const Point2 &apertureSample, Float timeSample) {
     Ray ray;
     Spectrum result = sensor->sampleRay(ray, samplePosition, apertureSample, timeSample);
@@ -359,14 +515,16 @@ void export_render() {
         .def(bp::init<Properties>())
         .def(bp::init<Scene *>())
         .def(bp::init<Stream *, InstanceManager *>())
-        .def("initialize", &Scene::initialize)
+        .def("initialize", scene_initialize)
         .def("invalidate", &Scene::invalidate)
-        .def("preprocess", &Scene::preprocess)
-        .def("render", &Scene::render)
-        .def("postprocess", &Scene::postprocess)
-        .def("flush", &Scene::flush)
+        .def("commit", scene_commit, (bp::arg("geometryChanged") = false))
+        .def("preprocess", scene_preprocess)
+        .def("render", scene_render)
+        .def("postprocess", scene_postprocess)
+        .def("flush", scene_flush)
         .def("cancel", scene_cancel)
         .def("rayIntersect", &scene_rayIntersect)
+        .def("rayIntersectBatch", &scene_rayIntersectBatch)
         .def("rayIntersectAll", &scene_rayIntersectAll)
         .def("evalTransmittance", &Scene::evalTransmittance)
         .def("evalTransmittanceAll", &Scene::evalTransmittanceAll)
@@ -425,9 +583,11 @@ void export_render() {
     Scene *(RenderJob::*renderJob_getScene)(void) = &RenderJob::getScene;
     RenderQueue *(RenderJob::*renderJob_getRenderQueue)(void) = &RenderJob::getRenderQueue;
     BP_CLASS(RenderJob, Thread, (bp::init<const std::string &, Scene *, RenderQueue *, bp::optional<int, int, int, bool, bool> >()))
-        .def("flush", &RenderJob::flush)
+        .def("flush", renderJob_flush)
         .def("cancel", renderJob_cancel)
-        .def("wait", &RenderJob::wait)
+        .def("wait", renderJob_wait)
+        .def("setShare", &RenderJob::setShare)
+        .def("getShare", &RenderJob::getShare)
         .def("isInteractive", &RenderJob::isInteractive)
         .def("setInteractive", &RenderJob::setInteractive)
         .def("getScene", renderJob_getScene, BP_RETURN_VALUE)
@@ -551,7 +711,8 @@ void export_render() {
         .def("getPrimitiveCount", &Shape::getPrimitiveCount)
         .def("getEffectivePrimitiveCount", &Shape::getEffectivePrimitiveCount)
         .def("copyAttachments", &Shape::copyAttachments)
-        .def("getShapeGroup", &shape_getShapeGroup, BP_RETURN_VALUE);
+        .def("getShapeGroup", &shape_getShapeGroup, BP_RETURN_VALUE)
+        .def("setInstanceTransform", &shape_setInstanceTransform);
 
     void (TriMesh::*triMesh_serialize1)(Stream *stream) const = &TriMesh::serialize;
     void (TriMesh::*triMesh_serialize2)(Stream *stream, InstanceManager *) const = &TriMesh::serialize;
@@ -638,6 +799,8 @@ void export_render() {
         .def("pdfTime", &Sensor::pdfTime)
         .def("needsTimeSample", &Sensor::needsTimeSample)
         .def("needsApertureSample", &Sensor::needsApertureSample)
+        .def("getSampleBudget", &Sensor::getSampleBudget)
+        .def("hasSampleBudget", &Sensor::hasSampleBudget)
         .def("getFilm", sensor_getFilm, BP_RETURN_VALUE)
         .def("getSampler", sensor_getSampler, BP_RETURN_VALUE)
         .def("getAspect", &Sensor::getAspect);
@@ -651,6 +814,7 @@ void export_render() {
         .value("EOrthographicCamera", Sensor::EOrthographicCamera)
         .value("EPositionSampleMapsToPixels", Sensor::EPositionSampleMapsToPixels)
         .value("EDirectionSampleMapsToPixels", Sensor::EDirectionSampleMapsToPixels)
+        .value("ENonuniformSampleBudget", Sensor::ENonuniformSampleBudget)
         .export_values();
     BP_SETSCOPE(renderModule);
 
@@ -702,10 +866,10 @@ void export_render() {
         .def("setDiagonalFov", &PerspectiveCamera::setDiagonalFov);
 
     BP_CLASS(Integrator, ConfigurableObject, bp::no_init)
-        .def("preprocess", &Integrator::preprocess)
-        .def("render", &Integrator::render)
+        .def("preprocess", integrator_preprocess)
+        .def("render", integrator_render)
         .def("cancel", &Integrator::cancel)
-        .def("postprocess", &Integrator::postprocess)
+        .def("postprocess", integrator_postprocess)
         .def("configureSampler", &Integrator::configureSampler)
         .def("getSubIntegrator", &Integrator::getSubIntegrator, BP_RETURN_VALUE);
 
@@ -735,6 +899,7 @@ void export_render() {
         .def("sample", &bsdf_sample, BP_RETURN_VALUE)
         .def("eval", &BSDF::eval, BP_RETURN_VALUE)
         .def("pdf", &BSDF::pdf)
+        .def("evalWithPdf", &bsdf_evalWithPdf, BP_RETURN_VALUE)
         .staticmethod("getMeasure");
 
     BP_SETSCOPE(BSDF_class);
@@ -826,5 +991,9 @@ void export_render() {
         .def("refreshEvent", &RenderListener::refreshEvent)
         .def("finishJobEvent", &RenderListener::finishJobEvent);
 
+    BP_CLASS(RenderMonitor, RenderListener, (bp::init<RenderQueue *, Stream *, bp::optional<Float> >()))
+        .def("stop", &RenderMonitor::stop)
+        .def("report", &RenderMonitor::report);
+
     bp::detail::current_scope = oldScope;
 }
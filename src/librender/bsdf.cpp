@@ -59,6 +59,12 @@ void BSDF::configure() {
         m_combinedType |= m_components[i];
 }
 
+Spectrum BSDF::evalWithPdf(const BSDFSamplingRecord &bRec,
+        Float &pdf, EMeasure measure) const {
+    pdf = this->pdf(bRec, measure);
+    return eval(bRec, measure);
+}
+
 Float BSDF::getEta() const {
     return 1.0f;
 }
@@ -0,0 +1,734 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/bvh.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
+
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
+
+/* Every level of the hierarchy adds at most three entries to the traversal
+   stack. Beyond MTS_BVH_MAXDEPTH, median splits add at most 32 levels. */
+#define MTS_BVH_STACKSIZE (3 * (MTS_BVH_MAXDEPTH + 32) + 1)
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter bvhRaysTraced("General", "Normal rays traced (BVH)");
+static StatsCounter bvhShadowRaysTraced("General", "Shadow rays traced (BVH)");
+
+void ShapeBVH::BVHNode::setBounds(int i, const AABB &aabb) {
+    for (int axis=0; axis<3; ++axis) {
+        bounds[axis][i]   = math::castflt_down(aabb.min[axis]);
+        bounds[axis+3][i] = math::castflt_up(aabb.max[axis]);
+    }
+}
+
+AABB ShapeBVH::BVHNode::getBounds(int i) const {
+    return AABB(
+        Point(bounds[0][i], bounds[1][i], bounds[2][i]),
+        Point(bounds[3][i], bounds[4][i], bounds[5][i]));
+}
+
+ShapeBVH::ShapeBVH() : m_nodes(NULL), m_triAccel(NULL),
+        m_nodeCount(0), m_leafSize(4), m_maxDepth(0) {
+    m_shapeMap.push_back(0);
+}
+
+ShapeBVH::~ShapeBVH() {
+    if (m_nodes)
+        freeAligned(m_nodes);
+    if (m_triAccel)
+        freeAligned(m_triAccel);
+    for (size_t i=0; i<m_shapes.size(); ++i)
+        m_shapes[i]->decRef();
+}
+
+void ShapeBVH::addShape(const Shape *shape) {
+    Assert(!isBuilt());
+    if (shape->isCompound())
+        Log(EError, "Cannot add compound shapes to a BVH - expand them first!");
+    if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+        m_shapeMap.push_back((SizeType)
+            static_cast<const TriMesh *>(shape)->getTriangleCount());
+        m_triangleFlag.push_back(true);
+    } else {
+        m_shapeMap.push_back(1);
+        m_triangleFlag.push_back(false);
+    }
+    shape->incRef();
+    m_shapes.push_back(shape);
+}
+
+AABB ShapeBVH::getPrimitiveAABB(IndexType shapeIndex, IndexType primIndex) const {
+    const Shape *shape = m_shapes[shapeIndex];
+    if (m_triangleFlag[shapeIndex]) {
+        const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+        return mesh->getTriangles()[primIndex].getAABB(mesh->getVertexPositions());
+    } else {
+        return shape->getAABB();
+    }
+}
+
+void ShapeBVH::loadPrimitive(IndexType idx, IndexType shapeIndex, IndexType primIndex) {
+    TriAccel &ta = m_triAccel[idx];
+    if (m_triangleFlag[shapeIndex]) {
+        const TriMesh *mesh = static_cast<const TriMesh *>(m_shapes[shapeIndex]);
+        const Triangle &tri = mesh->getTriangles()[primIndex];
+        const Point *positions = mesh->getVertexPositions();
+        ta.load(positions[tri.idx[0]], positions[tri.idx[1]], positions[tri.idx[2]]);
+        ta.shapeIndex = shapeIndex;
+        ta.primIndex = primIndex;
+    } else {
+        /* Create a 'fake' triangle, which redirects to a Shape */
+        memset(&ta, 0, sizeof(TriAccel));
+        ta.shapeIndex = shapeIndex;
+        ta.primIndex = KNoTriangleFlag;
+        ta.k = KNoTriangleFlag;
+    }
+}
+
+namespace {
+    /// Primitive reference used during the construction
+    struct BuildPrimitive {
+        AABB aabb;
+        Point center;
+        uint32_t shapeIndex;
+        uint32_t primIndex;
+    };
+
+    /// Contiguous range of primitives that will form a subtree
+    struct BuildRange {
+        uint32_t begin, end;
+        AABB aabb, centroidAABB;
+
+        inline uint32_t size() const { return end - begin; }
+
+        void update(const BuildPrimitive *prims) {
+            aabb.reset();
+            centroidAABB.reset();
+            for (uint32_t i=begin; i<end; ++i) {
+                aabb.expandBy(prims[i].aabb);
+                centroidAABB.expandBy(prims[i].center);
+            }
+        }
+    };
+
+    /// Subtree that still needs to be constructed
+    struct BuildItem {
+        BuildRange range;
+        uint32_t parent;
+        int lane;
+        uint32_t depth;
+    };
+
+    /// Predicate for partitioning primitives along a binned split plane
+    struct BinPredicate {
+        int axis, splitBin;
+        Float min, scale;
+
+        inline bool operator()(const BuildPrimitive &prim) const {
+            int bin = std::min((int) ((prim.center[axis] - min) * scale), MTS_BVH_BINS - 1);
+            return bin <= splitBin;
+        }
+    };
+
+    /// Predicate for median splits
+    struct CenterPredicate {
+        int axis;
+
+        inline bool operator()(const BuildPrimitive &a, const BuildPrimitive &b) const {
+            return a.center[axis] < b.center[axis];
+        }
+    };
+
+    /**
+     * \brief Split a range of primitives into two non-empty halves
+     *
+     * Evaluates the surface area heuristic at the bin boundaries along all
+     * three axes. Falls back to a median split when the primitive centers
+     * coincide or the depth limit has been reached.
+     */
+    void splitRange(BuildPrimitive *prims, const BuildRange &range,
+            uint32_t depth, BuildRange &left, BuildRange &right) {
+        uint32_t mid = range.begin;
+        bool found = false;
+
+        if (depth < MTS_BVH_MAXDEPTH) {
+            Float bestCost = std::numeric_limits<Float>::infinity();
+            BinPredicate best;
+
+            for (int axis=0; axis<3; ++axis) {
+                Float extent = range.centroidAABB.max[axis] - range.centroidAABB.min[axis];
+                if (extent <= 0)
+                    continue;
+
+                BinPredicate pred;
+                pred.axis = axis;
+                pred.min = range.centroidAABB.min[axis];
+                pred.scale = MTS_BVH_BINS * (1 - Epsilon) / extent;
+
+                uint32_t counts[MTS_BVH_BINS];
+                AABB bins[MTS_BVH_BINS];
+                memset(counts, 0, sizeof(counts));
+
+                for (uint32_t i=range.begin; i<range.end; ++i) {
+                    const BuildPrimitive &prim = prims[i];
+                    int bin = std::min((int) ((prim.center[axis] - pred.min) * pred.scale),
+                        MTS_BVH_BINS - 1);
+                    counts[bin]++;
+                    bins[bin].expandBy(prim.aabb);
+                }
+
+                /* Sweep from the right and record the partial costs */
+                Float rightCost[MTS_BVH_BINS];
+                AABB accum;
+                uint32_t count = 0;
+                for (int i=MTS_BVH_BINS-1; i>0; --i) {
+                    accum.expandBy(bins[i]);
+                    count += counts[i];
+                    rightCost[i] = count > 0 ? count * accum.getSurfaceArea() : 0;
+                }
+
+                /* Sweep from the left and evaluate the SAH */
+                accum.reset();
+                count = 0;
+                for (int i=0; i<MTS_BVH_BINS-1; ++i) {
+                    accum.expandBy(bins[i]);
+                    count += counts[i];
+                    if (count == 0 || count == range.size())
+                        continue;
+                    Float cost = count * accum.getSurfaceArea() + rightCost[i+1];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        best = pred;
+                        best.splitBin = i;
+                        found = true;
+                    }
+                }
+            }
+
+            if (found) {
+                mid = (uint32_t) (std::partition(prims + range.begin,
+                    prims + range.end, best) - prims);
+                found = mid != range.begin && mid != range.end;
+            }
+        }
+
+        if (!found) {
+            CenterPredicate pred;
+            pred.axis = range.centroidAABB.getLargestAxis();
+            mid = range.begin + range.size() / 2;
+            std::nth_element(prims + range.begin, prims + mid,
+                prims + range.end, pred);
+        }
+
+        left.begin = range.begin; left.end = mid;
+        right.begin = mid; right.end = range.end;
+        left.update(prims);
+        right.update(prims);
+    }
+}
+
+void ShapeBVH::build() {
+    if (isBuilt())
+        Log(EError, "The BVH has already been built!");
+    if (m_leafSize == 0)
+        Log(EError, "The leaf size must be > 0");
+
+    for (size_t i=1; i<m_shapeMap.size(); ++i)
+        m_shapeMap[i] += m_shapeMap[i-1];
+
+    SizeType primCount = getPrimitiveCount();
+    ref<Timer> timer = new Timer();
+
+    if (primCount == 0)
+        Log(EWarn, "BVH contains no geometry!");
+    else
+        Log(EDebug, "Constructing a 4-wide BVH over %i primitives ..", primCount);
+
+    std::vector<BuildPrimitive> prims(primCount);
+    for (IndexType i=0; i<m_shapes.size(); ++i) {
+        IndexType offset = m_shapeMap[i], count = m_shapeMap[i+1] - offset;
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(static)
+        #endif
+        for (int j=0; j<(int) count; ++j) {
+            BuildPrimitive &prim = prims[offset + j];
+            prim.aabb = getPrimitiveAABB(i, (IndexType) j);
+            prim.center = prim.aabb.getCenter();
+            prim.shapeIndex = i;
+            prim.primIndex = (IndexType) j;
+        }
+    }
+
+    BuildRange root;
+    root.begin = 0;
+    root.end = primCount;
+    if (primCount > 0)
+        root.update(&prims[0]);
+
+    std::vector<BVHNode> nodes;
+    nodes.reserve(primCount / m_leafSize + 1);
+    std::vector<BuildItem> stack;
+
+    BuildItem item;
+    item.range = root;
+    item.parent = BVHNode::EEmpty;
+    item.lane = 0;
+    item.depth = 0;
+    stack.push_back(item);
+    m_maxDepth = 0;
+
+    while (!stack.empty()) {
+        item = stack.back();
+        stack.pop_back();
+
+        uint32_t nodeIndex = (uint32_t) nodes.size();
+        nodes.push_back(BVHNode());
+        if (item.parent != BVHNode::EEmpty)
+            nodes[item.parent].child[item.lane] = nodeIndex;
+        m_maxDepth = std::max(m_maxDepth, item.depth);
+
+        /* Create up to four children by repeatedly splitting
+           the child with the largest surface area */
+        BuildRange children[4];
+        int childCount = 1;
+        children[0] = item.range;
+        while (childCount < 4) {
+            int best = -1;
+            Float bestArea = -1;
+            for (int i=0; i<childCount; ++i) {
+                if (children[i].size() <= m_leafSize)
+                    continue;
+                Float area = children[i].aabb.getSurfaceArea();
+                if (area > bestArea) {
+                    bestArea = area;
+                    best = i;
+                }
+            }
+            if (best < 0)
+                break;
+            BuildRange range = children[best];
+            splitRange(&prims[0], range, item.depth,
+                children[best], children[childCount]);
+            childCount++;
+        }
+
+        BVHNode &node = nodes[nodeIndex];
+        for (int i=0; i<4; ++i) {
+            if (i >= childCount || children[i].size() == 0) {
+                for (int axis=0; axis<3; ++axis) {
+                    node.bounds[axis][i] = std::numeric_limits<float>::infinity();
+                    node.bounds[axis+3][i] = -std::numeric_limits<float>::infinity();
+                }
+                node.child[i] = BVHNode::EEmpty;
+                node.count[i] = 0;
+                continue;
+            }
+
+            node.setBounds(i, children[i].aabb);
+            if (children[i].size() <= m_leafSize) {
+                node.child[i] = children[i].begin;
+                node.count[i] = children[i].size();
+            } else {
+                node.child[i] = BVHNode::EEmpty;
+                node.count[i] = 0;
+                BuildItem childItem;
+                childItem.range = children[i];
+                childItem.parent = nodeIndex;
+                childItem.lane = i;
+                childItem.depth = item.depth + 1;
+                stack.push_back(childItem);
+            }
+        }
+    }
+
+    m_nodeCount = (SizeType) nodes.size();
+    m_nodes = static_cast<BVHNode *>(allocAligned(sizeof(BVHNode) * m_nodeCount));
+    memcpy(m_nodes, &nodes[0], sizeof(BVHNode) * m_nodeCount);
+
+    /* Precompute the triangle data in leaf order */
+    m_triAccel = static_cast<TriAccel *>(allocAligned(
+        sizeof(TriAccel) * std::max(primCount, (SizeType) 1)));
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(static)
+    #endif
+    for (int i=0; i<(int) primCount; ++i)
+        loadPrimitive((IndexType) i, prims[i].shapeIndex, prims[i].primIndex);
+
+    /* Slightly enlarge the bounding box
+       (necessary e.g. when the scene is planar) */
+    m_aabb = root.aabb;
+    if (m_aabb.isValid()) {
+        const Float eps = MTS_KD_AABB_EPSILON;
+        m_aabb.min -= (m_aabb.max-m_aabb.min) * eps + Vector(eps);
+        m_aabb.max += (m_aabb.max-m_aabb.min) * eps + Vector(eps);
+    }
+
+    Log(EDebug, "Finished -- took %i ms.", timer->getMilliseconds());
+    Log(EDebug, "   Nodes                       : %i (%s)", m_nodeCount,
+        memString(sizeof(BVHNode) * m_nodeCount).c_str());
+    Log(EDebug, "   Triangle data               : %s",
+        memString(sizeof(TriAccel) * primCount).c_str());
+    Log(EDebug, "   Maximum depth               : %i", m_maxDepth);
+    Log(EDebug, "");
+}
+
+void ShapeBVH::refit() {
+    if (!isBuilt())
+        Log(EError, "refit(): The BVH has not been built yet!");
+
+    ref<Timer> timer = new Timer();
+    SizeType primCount = getPrimitiveCount();
+    for (size_t i=0; i<m_shapes.size(); ++i) {
+        SizeType expected = m_shapeMap[i+1] - m_shapeMap[i];
+        if (m_triangleFlag[i] && static_cast<const TriMesh *>(
+                m_shapes[i])->getTriangleCount() != expected)
+            Log(EError, "refit(): the triangle count of shape \"%s\" has "
+                "changed, the BVH must be rebuilt!", m_shapes[i]->getName().c_str());
+    }
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(static)
+    #endif
+    for (int i=0; i<(int) primCount; ++i) {
+        const TriAccel &ta = m_triAccel[i];
+        loadPrimitive((IndexType) i, ta.shapeIndex, ta.primIndex);
+    }
+
+    /* Children are always stored after their parents, hence a
+       reverse sweep over the nodes updates the boxes bottom-up */
+    for (SizeType i=m_nodeCount; i-- > 0; ) {
+        BVHNode &node = m_nodes[i];
+        for (int j=0; j<4; ++j) {
+            if (node.isEmpty(j))
+                continue;
+            AABB aabb;
+            if (node.isLeaf(j)) {
+                for (uint32_t k=node.child[j]; k<node.child[j] + node.count[j]; ++k)
+                    aabb.expandBy(getPrimitiveAABB(m_triAccel[k].shapeIndex,
+                        m_triAccel[k].primIndex));
+            } else {
+                const BVHNode &child = m_nodes[node.child[j]];
+                for (int k=0; k<4; ++k) {
+                    if (!child.isEmpty(k))
+                        aabb.expandBy(child.getBounds(k));
+                }
+            }
+            node.setBounds(j, aabb);
+        }
+    }
+
+    m_aabb.reset();
+    for (int j=0; j<4; ++j) {
+        if (!m_nodes[0].isEmpty(j))
+            m_aabb.expandBy(m_nodes[0].getBounds(j));
+    }
+    if (m_aabb.isValid()) {
+        const Float eps = MTS_KD_AABB_EPSILON;
+        m_aabb.min -= (m_aabb.max-m_aabb.min) * eps + Vector(eps);
+        m_aabb.max += (m_aabb.max-m_aabb.min) * eps + Vector(eps);
+    }
+
+    Log(EDebug, "Refitted the BVH in %i ms", timer->getMilliseconds());
+}
+
+template <bool shadowRay> bool ShapeBVH::traverse(const Ray &ray,
+        Float mint, Float maxt, Float &t, void *temp) const {
+    struct StackEntry {
+        uint32_t child, count;
+        float tNear;
+    };
+
+    StackEntry stack[MTS_BVH_STACKSIZE];
+    int stackPos = 0;
+    bool foundIntersection = false;
+
+    stack[stackPos].child = 0;
+    stack[stackPos].count = 0;
+    stack[stackPos].tNear = math::castflt_down(mint);
+    stackPos++;
+
+    /* Select the near and far box planes based on the direction signs */
+    const int nearX = ray.dRcp.x >= 0 ? 0 : 3, farX = 3 - nearX;
+    const int nearY = ray.dRcp.y >= 0 ? 1 : 4, farY = 5 - nearY;
+    const int nearZ = ray.dRcp.z >= 0 ? 2 : 5, farZ = 7 - nearZ;
+
+#if defined(MTS_SSE)
+    const __m128
+        ox = _mm_set1_ps((float) ray.o.x),
+        oy = _mm_set1_ps((float) ray.o.y),
+        oz = _mm_set1_ps((float) ray.o.z),
+        rx = _mm_set1_ps((float) ray.dRcp.x),
+        ry = _mm_set1_ps((float) ray.dRcp.y),
+        rz = _mm_set1_ps((float) ray.dRcp.z),
+        minT = _mm_set1_ps(math::castflt_down(mint)),
+        eps = _mm_set1_ps(1.0f + 4 * std::numeric_limits<float>::epsilon());
+    __m128 maxT = _mm_set1_ps(math::castflt_up(maxt));
+#else
+    const float
+        ox = (float) ray.o.x, oy = (float) ray.o.y, oz = (float) ray.o.z,
+        rx = (float) ray.dRcp.x, ry = (float) ray.dRcp.y, rz = (float) ray.dRcp.z;
+    float minT = math::castflt_down(mint), maxT = math::castflt_up(maxt);
+#endif
+
+    while (stackPos > 0) {
+        const StackEntry entry = stack[--stackPos];
+        if (entry.tNear > maxt)
+            continue;
+
+        if (entry.count > 0) {
+            /* Leaf node: intersect the referenced primitives */
+            for (uint32_t idx = entry.child; idx < entry.child + entry.count; ++idx) {
+                if (shadowRay) {
+                    if (intersect(ray, idx, mint, maxt))
+                        return true;
+                } else {
+                    Float tempT;
+                    if (intersect(ray, idx, mint, maxt, tempT, temp)) {
+                        maxt = tempT;
+                        foundIntersection = true;
+                    }
+                }
+            }
+#if defined(MTS_SSE)
+            if (!shadowRay)
+                maxT = _mm_set1_ps(math::castflt_up(maxt));
+#else
+            if (!shadowRay)
+                maxT = math::castflt_up(maxt);
+#endif
+            continue;
+        }
+
+        const BVHNode &node = m_nodes[entry.child];
+        float tNear[4];
+        int mask;
+
+#if defined(MTS_SSE)
+        /* When a direction component is zero, some of the products below
+           are NaNs; _mm_max_ps/_mm_min_ps then return the second operand,
+           which effectively ignores the corresponding axis */
+        const __m128
+            nx = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearX]), ox), rx),
+            ny = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearY]), oy), ry),
+            nz = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearZ]), oz), rz),
+            fx = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[farX]), ox), rx),
+            fy = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[farY]), oy), ry),
+            fz = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[farZ]), oz), rz);
+
+        const __m128
+            tn = _mm_max_ps(nx, _mm_max_ps(ny, _mm_max_ps(nz, minT))),
+            tf = _mm_mul_ps(_mm_min_ps(fx, _mm_min_ps(fy, _mm_min_ps(fz, maxT))), eps);
+
+        mask = _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+        _mm_storeu_ps(tNear, tn);
+#else
+        mask = 0;
+        for (int i=0; i<4; ++i) {
+            float tn = minT, tf = maxT, v;
+            v = (node.bounds[nearX][i] - ox) * rx; if (v > tn) tn = v;
+            v = (node.bounds[nearY][i] - oy) * ry; if (v > tn) tn = v;
+            v = (node.bounds[nearZ][i] - oz) * rz; if (v > tn) tn = v;
+            v = (node.bounds[farX][i] - ox) * rx;  if (v < tf) tf = v;
+            v = (node.bounds[farY][i] - oy) * ry;  if (v < tf) tf = v;
+            v = (node.bounds[farZ][i] - oz) * rz;  if (v < tf) tf = v;
+            tNear[i] = tn;
+            if (tn <= tf * (1.0f + 4 * std::numeric_limits<float>::epsilon()))
+                mask |= 1 << i;
+        }
+#endif
+
+        if (mask == 0)
+            continue;
+
+        /* Push the intersected children so that the closest one is
+           processed first (insertion sort on at most four entries) */
+        int first = stackPos;
+        for (int i=0; i<4; ++i) {
+            if (!(mask & (1 << i)))
+                continue;
+            StackEntry e;
+            e.child = node.child[i];
+            e.count = node.count[i];
+            e.tNear = tNear[i];
+            int j = stackPos++;
+            while (j > first && stack[j-1].tNear < e.tNear) {
+                stack[j] = stack[j-1];
+                --j;
+            }
+            stack[j] = e;
+        }
+    }
+
+    if (foundIntersection)
+        t = maxt;
+    return foundIntersection;
+}
+
+/// Compute the ray segment that is considered by the traversal
+static inline bool clipRay(const AABB &aabb, const Ray &ray, Float &mint, Float &maxt, bool shadowRay) {
+    if (!aabb.rayIntersect(ray, mint, maxt))
+        return false;
+
+    /* Use an adaptive ray epsilon */
+    Float rayMinT = ray.mint;
+    if (rayMinT == Epsilon) {
+        if (shadowRay)
+            rayMinT *= std::max(std::max(std::abs(ray.o.x),
+                std::abs(ray.o.y)), std::abs(ray.o.z));
+        else
+            rayMinT *= std::max(std::max(std::max(std::abs(ray.o.x),
+                std::abs(ray.o.y)), std::abs(ray.o.z)), Epsilon);
+    }
+
+    if (rayMinT > mint) mint = rayMinT;
+    if (ray.maxt < maxt) maxt = ray.maxt;
+
+    return maxt > mint;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray, Intersection &its) const {
+    uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+    its.t = std::numeric_limits<Float>::infinity();
+    Float mint, maxt;
+
+    ++bvhRaysTraced;
+    if (!clipRay(m_aabb, ray, mint, maxt, false) ||
+        !traverse<false>(ray, mint, maxt, its.t, temp))
+        return false;
+
+    fillDeferredIntersectionRecord(ray, temp, its);
+    return true;
+}
+
+bool ShapeBVH::rayIntersectDeferred(const Ray &ray, Float &t,
+        ConstShapePtr &shape, void *temp) const {
+    Float mint, maxt;
+
+    t = std::numeric_limits<Float>::infinity();
+
+    ++bvhRaysTraced;
+    if (!clipRay(m_aabb, ray, mint, maxt, false) ||
+        !traverse<false>(ray, mint, maxt, t, temp))
+        return false;
+
+    const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
+    shape = m_shapes[cache->shapeIndex];
+
+    if (!m_triangleFlag[cache->shapeIndex]) {
+        /* Other shapes (e.g. instances) may report a different
+           shape in their intersection record */
+        Intersection its;
+        its.t = t;
+        shape->fillIntersectionRecord(ray,
+            reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
+        if (its.shape)
+            shape = its.shape;
+    }
+    return true;
+}
+
+void ShapeBVH::fillDeferredIntersectionRecord(const Ray &ray,
+        const void *temp, Intersection &its) const {
+    const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
+    const Shape *shape = m_shapes[cache->shapeIndex];
+    if (m_triangleFlag[cache->shapeIndex]) {
+        ShapeKDTree::fillTriangleIntersectionRecord<true>(ray,
+            static_cast<const TriMesh *>(shape), cache->primIndex,
+            cache->u, cache->v, its);
+    } else {
+        shape->fillIntersectionRecord(ray,
+            reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
+    }
+
+    computeShadingFrame(its.shFrame.n, its.dpdu, its.shFrame);
+    its.wi = its.toLocal(-ray.d);
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
+        Normal &n, Point2 &uv) const {
+    uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+    Float mint, maxt;
+
+    t = std::numeric_limits<Float>::infinity();
+
+    ++bvhShadowRaysTraced;
+    if (!clipRay(m_aabb, ray, mint, maxt, true) ||
+        !traverse<false>(ray, mint, maxt, t, temp))
+        return false;
+
+    const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
+    shape = m_shapes[cache->shapeIndex];
+
+    if (m_triangleFlag[cache->shapeIndex]) {
+        const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
+        const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
+        const Point *vertexPositions = trimesh->getVertexPositions();
+        const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
+        const Point &p0 = vertexPositions[idx0];
+        const Point &p1 = vertexPositions[idx1];
+        const Point &p2 = vertexPositions[idx2];
+        n = normalize(cross(p1-p0, p2-p0));
+
+        if (EXPECT_TAKEN(trimesh->hasVertexTexcoords())) {
+            const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
+            uv = trimesh->getVertexTexcoord(idx0) * b.x
+                + trimesh->getVertexTexcoord(idx1) * b.y
+                + trimesh->getVertexTexcoord(idx2) * b.z;
+        } else {
+            uv = Point2(0.0f);
+        }
+    } else {
+        Intersection its;
+        its.t = t;
+        shape->fillIntersectionRecord(ray,
+            reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
+        n = its.geoFrame.n;
+        uv = its.uv;
+        if (its.shape)
+            shape = its.shape;
+    }
+    return true;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray) const {
+    Float mint, maxt, t = std::numeric_limits<Float>::infinity();
+
+    ++bvhShadowRaysTraced;
+    return clipRay(m_aabb, ray, mint, maxt, true) &&
+        traverse<true>(ray, mint, maxt, t, NULL);
+}
+
+std::string ShapeBVH::toString() const {
+    std::ostringstream oss;
+    oss << "ShapeBVH[" << endl
+        << "  shapes = " << m_shapes.size() << "," << endl
+        << "  primitiveCount = " << getPrimitiveCount() << "," << endl
+        << "  nodeCount = " << m_nodeCount << "," << endl
+        << "  leafSize = " << m_leafSize << "," << endl
+        << "  maxDepth = " << m_maxDepth << "," << endl
+        << "  aabb = " << m_aabb.toString() << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(ShapeBVH, false, Object)
+MTS_NAMESPACE_END
@@ -0,0 +1,446 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/emittertree.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/timer.h>
+
+/// Number of bins used by the split heuristic during tree construction
+#define MTS_EMITTERTREE_BINS 12
+
+MTS_NAMESPACE_BEGIN
+
+namespace {
+    /// Bounds of a set of emission directions (a cone of normals + spread)
+    struct DirectionCone {
+        Vector axis;
+        Float thetaO, thetaE;
+
+        inline DirectionCone() : axis(0.0f), thetaO(-1), thetaE(0) { }
+
+        inline DirectionCone(const Vector &axis, Float thetaO, Float thetaE)
+            : axis(axis), thetaO(thetaO), thetaE(thetaE) { }
+
+        inline bool isEmpty() const { return thetaO < 0; }
+
+        /// Expand the cone so that it also contains \c c
+        void expandBy(const DirectionCone &c) {
+            if (c.isEmpty())
+                return;
+            if (isEmpty()) {
+                *this = c;
+                return;
+            }
+            thetaE = std::max(thetaE, c.thetaE);
+
+            Float thetaD = unitAngle(axis, c.axis);
+            if (std::min(thetaD + c.thetaO, (Float) M_PI) <= thetaO)
+                return;
+            if (std::min(thetaD + thetaO, (Float) M_PI) <= c.thetaO) {
+                axis = c.axis;
+                thetaO = c.thetaO;
+                return;
+            }
+
+            Float newThetaO = 0.5f * (thetaO + thetaD + c.thetaO);
+            Vector rotAxis = cross(axis, c.axis);
+            if (newThetaO >= M_PI || rotAxis.lengthSquared() == 0) {
+                thetaO = (Float) M_PI;
+                return;
+            }
+
+            /* Rotate the axis towards \c c (Rodrigues' formula) */
+            rotAxis = normalize(rotAxis);
+            Float sinR, cosR;
+            math::sincos(newThetaO - thetaO, &sinR, &cosR);
+            axis = normalize(axis * cosR + cross(rotAxis, axis) * sinR
+                + rotAxis * (dot(rotAxis, axis) * (1 - cosR)));
+            thetaO = newThetaO;
+        }
+
+        /// Solid angle measure used by the split heuristic
+        Float getMeasure() const {
+            Float thetaW = std::min(thetaO + thetaE, (Float) M_PI);
+            Float sinO, cosO;
+            math::sincos(thetaO, &sinO, &cosO);
+            return 2 * M_PI * (1 - cosO) + 0.5f * M_PI * (2 * thetaW * sinO
+                - std::cos(thetaO - 2 * thetaW) - 2 * thetaO * sinO + cosO);
+        }
+    };
+
+    /// Size measure of a bounding box that doesn't vanish for flat boxes
+    inline Float boxMeasure(const AABB &aabb) {
+        return std::max(aabb.getSurfaceArea(), aabb.getExtents().lengthSquared());
+    }
+
+    /// cos(max(0, a - b)) given the sines and cosines of a and b
+    inline Float cosSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+        if (cosA > cosB)
+            return 1.0f;
+        return cosA * cosB + sinA * sinB;
+    }
+
+    /// sin(max(0, a - b)) given the sines and cosines of a and b
+    inline Float sinSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+        if (cosA > cosB)
+            return 0.0f;
+        return sinA * cosB - cosA * sinB;
+    }
+
+    /// Compute the cone of normals of an area emitter
+    DirectionCone computeNormalCone(Shape *shape) {
+        DirectionCone full(Vector(0, 0, 1), M_PI, 0.5f * M_PI);
+        ref<TriMesh> mesh = shape->createTriMesh();
+        if (!mesh || mesh->getTriangleCount() == 0)
+            return full;
+
+        const Triangle *triangles = mesh->getTriangles();
+        const Point *positions = mesh->getVertexPositions();
+        if (!positions)
+            return full;
+
+        std::vector<Vector> normals;
+        normals.reserve(mesh->getTriangleCount());
+        for (size_t i=0; i<mesh->getTriangleCount(); ++i) {
+            const Triangle &tri = triangles[i];
+            Vector n = cross(positions[tri.idx[1]] - positions[tri.idx[0]],
+                positions[tri.idx[2]] - positions[tri.idx[0]]);
+            if (n.lengthSquared() > 0)
+                normals.push_back(normalize(n));
+        }
+        if (mesh->hasVertexNormals()) {
+            /* Emission is based on the interpolated normals */
+            for (size_t i=0; i<mesh->getVertexCount(); ++i) {
+                Vector n(mesh->getVertexNormal(i));
+                if (n.lengthSquared() > 0)
+                    normals.push_back(normalize(n));
+            }
+        }
+        if (normals.empty())
+            return full;
+
+        Vector axis(0.0f);
+        for (size_t i=0; i<normals.size(); ++i)
+            axis += normals[i];
+        if (axis.length() < 1e-3f * normals.size())
+            return full;
+        axis = normalize(axis);
+
+        Float minCos = 1;
+        for (size_t i=0; i<normals.size(); ++i)
+            minCos = std::min(minCos, dot(axis, normals[i]));
+
+        return DirectionCone(axis, math::safe_acos(minCos), 0.5f * M_PI);
+    }
+};
+
+struct EmitterTree::Primitive {
+    AABB aabb;
+    Point centroid;
+    DirectionCone cone;
+    Float power;
+    uint32_t emitter;
+};
+
+/// Is a primitive's centroid located to the left of a bin boundary?
+struct EmitterTree::BinPredicate {
+    int axis, split;
+    Float min, scale;
+
+    inline bool operator()(const Primitive &prim) const {
+        return std::min(MTS_EMITTERTREE_BINS - 1,
+            (int) ((prim.centroid[axis] - min) * scale)) < split;
+    }
+};
+
+EmitterTree::EmitterTree(ref_vector<Emitter> &emitters) {
+    ref<Timer> timer = new Timer();
+    std::vector<Primitive> prims;
+    Float treeWeight = 0, infiniteWeight = 0;
+
+    m_leaves.resize(emitters.size(), (uint32_t) -1);
+    for (size_t i=0; i<emitters.size(); ++i) {
+        Emitter *emitter = emitters[i];
+        AABB aabb = emitter->getAABB();
+        Float weight = emitter->getSamplingWeight();
+        m_indices[emitter] = (uint32_t) i;
+
+        if (!aabb.isValid() || emitter->isEnvironmentEmitter() ||
+            (emitter->getType() & Emitter::EDeltaDirection)) {
+            m_infinite.push_back((uint32_t) i);
+            m_infinitePDF.append(weight);
+            infiniteWeight += weight;
+            continue;
+        }
+
+        /* Estimate the emitted power from a position sample */
+        PositionSamplingRecord pRec(0.0f);
+        Float power = emitter->samplePosition(pRec, Point2(0.5f)).getLuminance() * weight;
+        if (!std::isfinite(power) || power < 0)
+            power = 0;
+
+        Primitive prim;
+        prim.aabb = aabb;
+        prim.centroid = aabb.getCenter();
+        prim.power = power;
+        prim.emitter = (uint32_t) i;
+        if (emitter->getShape())
+            prim.cone = computeNormalCone(emitter->getShape());
+        else
+            prim.cone = DirectionCone(Vector(0, 0, 1), M_PI, 0.5f * M_PI);
+        prims.push_back(prim);
+        treeWeight += weight;
+    }
+
+    if (infiniteWeight > 0)
+        m_infinitePDF.normalize();
+    m_infiniteProb = (infiniteWeight + treeWeight) > 0 ?
+        infiniteWeight / (infiniteWeight + treeWeight) : 0;
+    if (prims.empty())
+        m_infiniteProb = 1;
+
+    if (!prims.empty()) {
+        m_nodes.reserve(2 * prims.size() - 1);
+        build(prims, 0, prims.size(), 0);
+    }
+
+    Log(EDebug, "Built an emitter tree over %i emitters (%i nodes, %i unbounded "
+        "emitters) in %i ms", (int) prims.size(), (int) m_nodes.size(),
+        (int) m_infinite.size(), timer->getMilliseconds());
+}
+
+uint32_t EmitterTree::build(std::vector<Primitive> &prims, size_t start,
+        size_t end, uint32_t parent) {
+    uint32_t index = (uint32_t) m_nodes.size();
+    m_nodes.push_back(Node());
+
+    AABB aabb, centroidAABB;
+    DirectionCone cone;
+    Float power = 0;
+    for (size_t i=start; i<end; ++i) {
+        aabb.expandBy(prims[i].aabb);
+        centroidAABB.expandBy(prims[i].centroid);
+        cone.expandBy(prims[i].cone);
+        power += prims[i].power;
+    }
+
+    Node &node = m_nodes[index];
+    node.aabb = aabb;
+    node.axis = cone.axis;
+    math::sincos(cone.thetaO, &node.sinThetaO, &node.cosThetaO);
+    node.cosThetaE = std::cos(cone.thetaE);
+    node.power = power;
+    node.parent = parent;
+    node.leaf = end - start == 1;
+
+    if (node.leaf) {
+        node.index = prims[start].emitter;
+        m_leaves[node.index] = index;
+        return index;
+    }
+
+    /* Find the split plane with the smallest surface area orientation
+       heuristic cost (Conty Estevez and Kulla 2018) using binning */
+    Vector extents = centroidAABB.getExtents();
+    Float maxExtent = std::max(std::max(extents.x, extents.y), extents.z);
+    Float bestCost = std::numeric_limits<Float>::infinity();
+    int bestAxis = -1, bestSplit = -1;
+
+    for (int axis=0; axis<3; ++axis) {
+        if (extents[axis] <= 0)
+            continue;
+
+        AABB binAABB[MTS_EMITTERTREE_BINS];
+        DirectionCone binCone[MTS_EMITTERTREE_BINS];
+        Float binPower[MTS_EMITTERTREE_BINS];
+        size_t binCount[MTS_EMITTERTREE_BINS];
+        for (int i=0; i<MTS_EMITTERTREE_BINS; ++i) {
+            binPower[i] = 0;
+            binCount[i] = 0;
+        }
+
+        Float scale = MTS_EMITTERTREE_BINS / extents[axis];
+        for (size_t i=start; i<end; ++i) {
+            int bin = std::min(MTS_EMITTERTREE_BINS - 1, (int) ((prims[i].centroid[axis]
+                - centroidAABB.min[axis]) * scale));
+            binAABB[bin].expandBy(prims[i].aabb);
+            binCone[bin].expandBy(prims[i].cone);
+            binPower[bin] += prims[i].power;
+            binCount[bin]++;
+        }
+
+        /* Penalize splits along short axes of the node */
+        Float kr = maxExtent / extents[axis];
+
+        for (int split=1; split<MTS_EMITTERTREE_BINS; ++split) {
+            AABB aabbL, aabbR;
+            DirectionCone coneL, coneR;
+            Float powerL = 0, powerR = 0;
+            size_t countL = 0, countR = 0;
+            for (int i=0; i<split; ++i) {
+                aabbL.expandBy(binAABB[i]);
+                coneL.expandBy(binCone[i]);
+                powerL += binPower[i];
+                countL += binCount[i];
+            }
+            for (int i=split; i<MTS_EMITTERTREE_BINS; ++i) {
+                aabbR.expandBy(binAABB[i]);
+                coneR.expandBy(binCone[i]);
+                powerR += binPower[i];
+                countR += binCount[i];
+            }
+            if (countL == 0 || countR == 0)
+                continue;
+
+            Float cost = kr * (powerL * coneL.getMeasure() * boxMeasure(aabbL)
+                + powerR * coneR.getMeasure() * boxMeasure(aabbR));
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    size_t mid;
+    if (bestAxis != -1) {
+        BinPredicate pred;
+        pred.axis = bestAxis;
+        pred.split = bestSplit;
+        pred.min = centroidAABB.min[bestAxis];
+        pred.scale = MTS_EMITTERTREE_BINS / extents[bestAxis];
+        mid = std::partition(prims.begin() + start, prims.begin() + end, pred)
+            - prims.begin();
+    } else {
+        /* All centroids coincide: split by count */
+        mid = (start + end) / 2;
+    }
+
+    build(prims, start, mid, index);
+    uint32_t right = build(prims, mid, end, index);
+    m_nodes[index].index = right;
+    return index;
+}
+
+Float EmitterTree::importance(const Node &node, const Point &p, const Normal &n) const {
+    Point center = node.aabb.getCenter();
+    Vector d = p - center;
+    Float dist2 = d.lengthSquared();
+    Float radius2 = 0.25f * node.aabb.getExtents().lengthSquared();
+
+    if (dist2 == 0)
+        return node.power;
+
+    /* Angle subtended by the node's bounding sphere */
+    Float sinThetaB = 0, cosThetaB = -1;
+    if (dist2 > radius2) {
+        Float sin2ThetaB = radius2 / dist2;
+        sinThetaB = std::sqrt(sin2ThetaB);
+        cosThetaB = math::safe_sqrt(1 - sin2ThetaB);
+    }
+
+    Vector wi = d / std::sqrt(dist2);
+    Float cosThetaW = dot(node.axis, wi);
+    Float sinThetaW = math::safe_sqrt(1 - cosThetaW * cosThetaW);
+
+    /* Smallest angle between the cone of normals and the bounding sphere */
+    Float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, node.sinThetaO, node.cosThetaO);
+    Float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, node.sinThetaO, node.cosThetaO);
+    Float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= node.cosThetaE)
+        return 0.0f;
+
+    Float result = node.power * cosThetaP / std::max(dist2, radius2);
+
+    if (!n.isZero()) {
+        Float cosThetaI = absDot(wi, n);
+        Float sinThetaI = math::safe_sqrt(1 - cosThetaI * cosThetaI);
+        result *= cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    }
+
+    return std::max(result, (Float) 0.0f);
+}
+
+size_t EmitterTree::sample(const Point &p, const Normal &n,
+        Float &sample, Float &pdf) const {
+    if (sample < m_infiniteProb) {
+        sample /= m_infiniteProb;
+        size_t index = m_infinitePDF.sampleReuse(sample, pdf);
+        pdf *= m_infiniteProb;
+        return m_infinite[index];
+    }
+
+    sample = std::min((sample - m_infiniteProb) / (1 - m_infiniteProb), ONE_MINUS_EPS);
+    pdf = 1 - m_infiniteProb;
+
+    uint32_t index = 0;
+    while (!m_nodes[index].leaf) {
+        Float probLeft = leftProbability(index, p, n);
+        if (sample < probLeft) {
+            sample /= probLeft;
+            pdf *= probLeft;
+            index = index + 1;
+        } else {
+            sample = (sample - probLeft) / (1 - probLeft);
+            pdf *= 1 - probLeft;
+            index = m_nodes[index].index;
+        }
+        sample = std::min(sample, ONE_MINUS_EPS);
+    }
+
+    return m_nodes[index].index;
+}
+
+Float EmitterTree::pdf(const Point &p, const Normal &n, const Emitter *emitter) const {
+    boost::unordered_map<const Emitter *, uint32_t>::const_iterator it
+        = m_indices.find(emitter);
+    if (it == m_indices.end())
+        return 0.0f;
+
+    uint32_t node = m_leaves[it->second];
+    if (node == (uint32_t) -1) {
+        if (m_infiniteProb == 0)
+            return 0.0f;
+        return m_infiniteProb * emitter->getSamplingWeight()
+            * m_infinitePDF.getNormalization();
+    }
+
+    /* Walk up to the root and account for every branching decision */
+    Float pdf = 1 - m_infiniteProb;
+    while (node != 0) {
+        uint32_t parent = m_nodes[node].parent;
+        Float probLeft = leftProbability(parent, p, n);
+        pdf *= (node == parent + 1) ? probLeft : (1 - probLeft);
+        node = parent;
+    }
+
+    return pdf;
+}
+
+std::string EmitterTree::toString() const {
+    std::ostringstream oss;
+    oss << "EmitterTree[" << endl
+        << "  nodeCount = " << m_nodes.size() << "," << endl
+        << "  unboundedEmitters = " << m_infinite.size() << "," << endl
+        << "  unboundedProb = " << m_infiniteProb << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(EmitterTree, false, Object)
+MTS_NAMESPACE_END
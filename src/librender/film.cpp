@@ -22,6 +22,9 @@
 
 MTS_NAMESPACE_BEGIN
 
+/* Above this number of pending dirty regions, the whole film is reported */
+#define MTS_FILM_MAX_DIRTY_REGIONS 256
+
 Film::Film(const Properties &props)
  : ConfigurableObject(props) {
     bool isMFilm = boost::to_lower_copy(props.getPluginName()) == "mfilm";
@@ -52,6 +55,9 @@ Film::Film(const Properties &props)
        quality at the edges especially with large reconstruction
        filters. */
     m_highQualityEdges = props.getBoolean("highQualityEdges", false);
+
+    m_dirtyMutex = new Mutex();
+    m_dirtyAll = true;
 }
 
 Film::Film(Stream *stream, InstanceManager *manager)
@@ -61,10 +67,50 @@ Film::Film(Stream *stream, InstanceManager *manager)
     m_cropSize = Vector2i(stream);
     m_highQualityEdges = stream->readBool();
     m_filter = static_cast<ReconstructionFilter *>(manager->getInstance(stream));
+    m_dirtyMutex = new Mutex();
+    m_dirtyAll = true;
 }
 
 Film::~Film() { }
 
+void Film::markDirty(const ImageBlock *block) {
+    int border = block->getBorderSize();
+    Point2i offset(
+        std::max(0, block->getOffset().x - border),
+        std::max(0, block->getOffset().y - border));
+    Vector2i size(
+        std::min(m_cropSize.x, block->getOffset().x + block->getSize().x + border) - offset.x,
+        std::min(m_cropSize.y, block->getOffset().y + block->getSize().y + border) - offset.y);
+    if (size.x <= 0 || size.y <= 0)
+        return;
+
+    LockGuard lock(m_dirtyMutex);
+    if (m_dirtyAll)
+        return;
+    if (m_dirtyRegions.size() >= MTS_FILM_MAX_DIRTY_REGIONS) {
+        m_dirtyRegions.clear();
+        m_dirtyAll = true;
+        return;
+    }
+    m_dirtyRegions.push_back(std::make_pair(offset, size));
+}
+
+void Film::markDirty() {
+    LockGuard lock(m_dirtyMutex);
+    m_dirtyRegions.clear();
+    m_dirtyAll = true;
+}
+
+void Film::takeDirtyRegions(std::vector<std::pair<Point2i, Vector2i> > &regions) {
+    LockGuard lock(m_dirtyMutex);
+    regions.clear();
+    if (m_dirtyAll)
+        regions.push_back(std::make_pair(Point2i(0), m_cropSize));
+    else
+        regions.swap(m_dirtyRegions);
+    m_dirtyAll = false;
+}
+
 void Film::serialize(Stream *stream, InstanceManager *manager) const {
     ConfigurableObject::serialize(stream, manager);
     m_size.serialize(stream);
@@ -0,0 +1,687 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/guiding.h>
+#include <mitsuba/render/integrator.h>
+#include <mitsuba/render/renderjob.h>
+#include <mitsuba/core/atomic.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/bitmap.h>
+#include <deque>
+
+/// Maximum depth of the directional quadtrees
+#define MTS_GUIDING_MAX_QUADTREE_DEPTH 20
+
+/// Ratio between the upper and lower bound of the ADRRS weight window
+#define MTS_ADRRS_WINDOW_RATIO 5
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter statsADRRSTerminated("Path guiding",
+    "ADRRS: terminated paths", EPercentage);
+static StatsCounter statsADRRSSplit("Path guiding",
+    "ADRRS: split paths", EPercentage);
+static StatsCounter statsADRRSCopies("Path guiding",
+    "ADRRS: average copies per split", EAverage);
+
+/// Map a world-space direction to the unit square (equal-area)
+static inline Point2 dirToCanonical(const Vector &d) {
+    Float cosTheta = math::clamp(d.z, (Float) -1, (Float) 1);
+    Float phi = std::atan2(d.y, d.x);
+    if (phi < 0)
+        phi += 2 * M_PI;
+    return Point2(
+        math::clamp((cosTheta + 1) * 0.5f, (Float) 0, (Float) ONE_MINUS_EPS),
+        math::clamp(phi * INV_TWOPI, (Float) 0, (Float) ONE_MINUS_EPS));
+}
+
+/// Inverse of \ref dirToCanonical()
+static inline Vector canonicalToDir(const Point2 &p) {
+    Float cosTheta = 2 * p.x - 1,
+          sinTheta = math::safe_sqrt(1 - cosTheta * cosTheta),
+          sinPhi, cosPhi;
+    math::sincos(2 * M_PI * p.y, &sinPhi, &cosPhi);
+    return Vector(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta);
+}
+
+/// Return the quadrant of \c p and map it to the unit square of that quadrant
+static inline int descend(Point2 &p) {
+    int quadrant = 0;
+    for (int i=0; i<2; ++i) {
+        if (p[i] >= 0.5f) {
+            quadrant |= 1 << i;
+            p[i] = p[i] * 2 - 1;
+        } else {
+            p[i] = p[i] * 2;
+        }
+    }
+    return quadrant;
+}
+
+/**
+ * \brief Restricts a sampler to a contiguous range of sample indices
+ * of every pixel (used to split the samples into guiding passes)
+ */
+class GuidingPassSampler : public Sampler {
+public:
+    GuidingPassSampler(Sampler *sampler, size_t offset, size_t count)
+        : Sampler(Properties()), m_sampler(sampler), m_offset(offset) {
+        m_sampleCount = count;
+    }
+
+    ref<Sampler> clone() {
+        return new GuidingPassSampler(m_sampler->clone(), m_offset, m_sampleCount);
+    }
+
+    void generate(const Point2i &offset) {
+        m_sampler->generate(offset);
+        m_sampler->setSampleIndex(m_offset);
+        m_sampleIndex = 0;
+    }
+
+    void advance() {
+        m_sampler->advance();
+        m_sampleIndex++;
+    }
+
+    void setSampleIndex(size_t sampleIndex) {
+        m_sampler->setSampleIndex(m_offset + sampleIndex);
+        m_sampleIndex = sampleIndex;
+    }
+
+    Float next1D() {
+        return m_sampler->next1D();
+    }
+
+    Point2 next2D() {
+        return m_sampler->next2D();
+    }
+
+    void request1DArray(size_t size) {
+        Log(EError, "Sample arrays are not supported when using path guiding!");
+    }
+
+    void request2DArray(size_t size) {
+        Log(EError, "Sample arrays are not supported when using path guiding!");
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "GuidingPassSampler[" << endl
+            << "  offset = " << m_offset << "," << endl
+            << "  sampleCount = " << m_sampleCount << "," << endl
+            << "  sampler = " << indent(m_sampler->toString()) << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~GuidingPassSampler() { }
+private:
+    ref<Sampler> m_sampler;
+    size_t m_offset;
+};
+
+/* ==================================================================== */
+/*                            Directional tree                          */
+/* ==================================================================== */
+
+PathGuide::DirectionalTree::DirectionalTree() : m_sampleCount(0) {
+    m_nodes.push_back(Node());
+}
+
+Float PathGuide::DirectionalTree::pdf(Point2 p) const {
+    if (getEnergy() <= 0)
+        return 1.0f;
+
+    Float result = 1.0f;
+    uint32_t index = 0;
+    while (true) {
+        const Node &node = m_nodes[index];
+        Float total = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+        int quadrant = descend(p);
+        if (node.sum[quadrant] <= 0)
+            return 0.0f;
+        result *= 4 * node.sum[quadrant] / total;
+        if (node.children[quadrant] == 0)
+            return result;
+        index = node.children[quadrant];
+    }
+}
+
+Point2 PathGuide::DirectionalTree::sample(Point2 sample) const {
+    if (getEnergy() <= 0)
+        return sample;
+
+    Point2 origin(0.0f);
+    Float scale = 1.0f;
+    uint32_t index = 0;
+    while (true) {
+        const Node &node = m_nodes[index];
+
+        /* First choose the column, then the row */
+        Float left = node.sum[0] + node.sum[2],
+              right = node.sum[1] + node.sum[3],
+              pLeft = left / (left + right);
+        int quadrant;
+        if (sample.x < pLeft) {
+            sample.x /= pLeft;
+            quadrant = 0;
+        } else {
+            sample.x = (sample.x - pLeft) / (1 - pLeft);
+            quadrant = 1;
+        }
+
+        Float pBottom = node.sum[quadrant] / (quadrant == 0 ? left : right);
+        if (sample.y < pBottom) {
+            sample.y /= pBottom;
+        } else {
+            sample.y = (sample.y - pBottom) / (1 - pBottom);
+            quadrant |= 2;
+        }
+
+        sample.x = std::min(sample.x, (Float) ONE_MINUS_EPS);
+        sample.y = std::min(sample.y, (Float) ONE_MINUS_EPS);
+        scale *= 0.5f;
+        origin += Vector2((quadrant & 1) * scale, (quadrant >> 1) * scale);
+
+        if (node.children[quadrant] == 0)
+            break;
+        index = node.children[quadrant];
+    }
+
+    return Point2(
+        std::min(origin.x + sample.x * scale, (Float) ONE_MINUS_EPS),
+        std::min(origin.y + sample.y * scale, (Float) ONE_MINUS_EPS));
+}
+
+void PathGuide::DirectionalTree::record(Point2 p, Float value) const {
+    atomicAdd(&m_sampleCount, 1.0);
+    if (value <= 0)
+        return;
+
+    uint32_t index = 0;
+    while (true) {
+        Node &node = m_nodes[index];
+        int quadrant = descend(p);
+        atomicAdd(&node.sum[quadrant], value);
+        if (node.children[quadrant] == 0)
+            break;
+        index = node.children[quadrant];
+    }
+}
+
+void PathGuide::DirectionalTree::scale(Float factor) {
+    for (size_t i=0; i<m_nodes.size(); ++i)
+        for (int j=0; j<4; ++j)
+            m_nodes[i].sum[j] *= factor;
+    m_sampleCount *= factor;
+}
+
+void PathGuide::DirectionalTree::refine(DirectionalTree &target, Float threshold,
+        int maxDepth, size_t maxNodes) const {
+    struct Entry {
+        /// Corresponding node of this tree (0: none, i.e. a subdivided leaf)
+        uint32_t source;
+        /// Node of the new tree
+        uint32_t target;
+        /// Energy of each quadrant, if there is no source node
+        Float energy;
+        int depth;
+    };
+
+    target.m_nodes.clear();
+    target.m_nodes.push_back(Node());
+    target.m_sampleCount = 0;
+
+    Float total = getEnergy();
+    if (total <= 0)
+        return;
+
+    /* Subdivide breadth-first, so that the node limit cuts off the finest levels */
+    std::deque<Entry> queue;
+    Entry root = { 0, 0, 0.0f, 1 };
+    queue.push_back(root);
+    bool isRoot = true;
+
+    while (!queue.empty()) {
+        Entry entry = queue.front();
+        queue.pop_front();
+        bool hasSource = isRoot || entry.source != 0;
+        isRoot = false;
+
+        for (int i=0; i<4; ++i) {
+            Float energy = hasSource ? m_nodes[entry.source].sum[i] : entry.energy;
+            if (energy <= threshold * total || entry.depth >= maxDepth
+                || target.m_nodes.size() >= maxNodes)
+                continue;
+
+            uint32_t child = (uint32_t) target.m_nodes.size();
+            target.m_nodes.push_back(Node());
+            target.m_nodes[entry.target].children[i] = child;
+
+            Entry childEntry;
+            childEntry.source = hasSource ? m_nodes[entry.source].children[i] : 0;
+            childEntry.target = child;
+            childEntry.energy = energy / 4;
+            childEntry.depth = entry.depth + 1;
+            queue.push_back(childEntry);
+        }
+    }
+}
+
+/* ==================================================================== */
+/*                              Path records                            */
+/* ==================================================================== */
+
+void PathGuide::PathRecord::commit() const {
+    for (int i=0; i<m_count; ++i) {
+        const Vertex &vertex = m_vertices[i];
+
+        /* Incident radiance along the sampled direction */
+        Spectrum radiance;
+        for (int k=0; k<SPECTRUM_SAMPLES; ++k)
+            radiance[k] = vertex.throughput[k] > 0
+                ? vertex.radiance[k] / vertex.throughput[k] : (Float) 0;
+
+        Float value = radiance.average() / vertex.pdf;
+        if (!std::isfinite(value) || value < 0)
+            value = 0;
+
+        vertex.region->building.record(dirToCanonical(vertex.d), value);
+    }
+}
+
+/* ==================================================================== */
+/*                                Path guide                            */
+/* ==================================================================== */
+
+PathGuide::PathGuide(const Properties &props) {
+    /* Probability of sampling the BSDF instead of the guiding distribution */
+    m_bsdfFraction = props.getFloat("guidingBSDFFraction", 0.5f);
+    /* Number of samples per region (times the square root of the pass
+       sample count), above which regions are split */
+    m_spatialThreshold = props.getFloat("guidingSpatialThreshold", 12000);
+    /* Fraction of a region's energy, above which quadtree nodes are split */
+    m_directionalThreshold = props.getFloat("guidingDirectionalThreshold", 0.01f);
+    /* Memory budget of the guiding trees in MiB */
+    m_maxMemory = (size_t) props.getInteger("guidingMaxMemory", 256) * 1024 * 1024;
+    /* Sample the learned distribution? (it may also just be used by ADRRS) */
+    m_sampling = props.getBoolean("guiding", false);
+    /* Use adjoint-driven Russian roulette and splitting in the final pass? */
+    m_adrrs = props.getBoolean("adrrs", false);
+
+    if (m_bsdfFraction <= 0 || m_bsdfFraction > 1)
+        Log(EError, "'guidingBSDFFraction' must be in the interval (0, 1]!");
+    if (m_spatialThreshold <= 0)
+        Log(EError, "'guidingSpatialThreshold' must be positive!");
+    if (m_directionalThreshold <= 0 || m_directionalThreshold >= 1)
+        Log(EError, "'guidingDirectionalThreshold' must be in the interval (0, 1)!");
+    if (m_maxMemory == 0)
+        Log(EError, "'guidingMaxMemory' must be positive!");
+
+    m_training = m_cancelled = false;
+    m_pixelEstimateSamples = 0;
+    reset(AABB(Point(0.0f), Point(1.0f)));
+}
+
+void PathGuide::reset(const AABB &aabb) {
+    /* Use a cube, so that the alternating splits produce regions
+       with an aspect ratio of at most two */
+    Vector extents = aabb.getExtents();
+    Float size = std::max(std::max(extents.x, extents.y), extents.z);
+    size = size * (1 + Epsilon) + Epsilon;
+    m_aabb = AABB(aabb.min, aabb.min + Vector(size));
+    m_invExtents = Vector(1 / size);
+
+    SpatialNode root;
+    root.children[0] = root.children[1] = 0;
+    root.region = 0;
+    root.axis = 0;
+    m_nodes.clear();
+    m_nodes.push_back(root);
+    m_regions.clear();
+    m_regions.push_back(Region());
+    m_pixelEstimate.clear();
+    m_pixelEstimateSamples = 0;
+}
+
+const PathGuide::Region *PathGuide::lookup(const Point &p) const {
+    Vector rel = (p - m_aabb.min);
+    Point q(
+        math::clamp(rel.x * m_invExtents.x, (Float) 0, (Float) ONE_MINUS_EPS),
+        math::clamp(rel.y * m_invExtents.y, (Float) 0, (Float) ONE_MINUS_EPS),
+        math::clamp(rel.z * m_invExtents.z, (Float) 0, (Float) ONE_MINUS_EPS));
+
+    uint32_t index = 0;
+    while (m_nodes[index].children[0] != 0) {
+        const SpatialNode &node = m_nodes[index];
+        Float &value = q[node.axis];
+        if (value < 0.5f) {
+            value *= 2;
+            index = node.children[0];
+        } else {
+            value = value * 2 - 1;
+            index = node.children[1];
+        }
+    }
+    return &m_regions[m_nodes[index].region];
+}
+
+Spectrum PathGuide::sample(const Region *region, const BSDF *bsdf,
+        BSDFSamplingRecord &bRec, Float &pdf, Point2 sample) const {
+    if (!isGuided(region, bsdf))
+        return bsdf->sample(bRec, pdf, sample);
+
+    Float guidePdf;
+    Spectrum value;
+    if (sample.x < m_bsdfFraction) {
+        sample.x /= m_bsdfFraction;
+        Spectrum weight = bsdf->sample(bRec, pdf, sample);
+        if (weight.isZero())
+            return weight;
+
+        if (bRec.sampledType & BSDF::EDelta) {
+            /* Degenerate components can't be sampled by the guiding distribution */
+            pdf *= m_bsdfFraction;
+            return weight / m_bsdfFraction;
+        }
+
+        value = weight * pdf;
+        pdf = bsdf->pdf(bRec);
+        guidePdf = region->sampling.pdf(dirToCanonical(bRec.its.toWorld(bRec.wo))) * INV_FOURPI;
+    } else {
+        sample.x = (sample.x - m_bsdfFraction) / (1 - m_bsdfFraction);
+        Point2 p = region->sampling.sample(sample);
+        bRec.wo = bRec.its.toLocal(canonicalToDir(p));
+        bRec.sampledComponent = -1;
+        bRec.sampledType = BSDF::EGlossy;
+        bRec.eta = 1.0f;
+        if (Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo) < 0) {
+            Float eta = bsdf->getEta();
+            bRec.eta = Frame::cosTheta(bRec.wi) > 0 ? eta : 1 / eta;
+        }
+
+        value = bsdf->eval(bRec);
+        if (value.isZero())
+            return value;
+        pdf = bsdf->pdf(bRec);
+        guidePdf = region->sampling.pdf(p) * INV_FOURPI;
+    }
+
+    pdf = m_bsdfFraction * pdf + (1 - m_bsdfFraction) * guidePdf;
+    if (pdf <= 0)
+        return Spectrum(0.0f);
+
+    return value / pdf;
+}
+
+Float PathGuide::pdf(const Region *region, const BSDF *bsdf,
+        Float bsdfPdf, const Vector &d) const {
+    if (!isGuided(region, bsdf))
+        return bsdfPdf;
+
+    return m_bsdfFraction * bsdfPdf + (1 - m_bsdfFraction)
+        * region->sampling.pdf(dirToCanonical(d)) * INV_FOURPI;
+}
+
+bool PathGuide::render(SamplingIntegrator *integrator, Scene *scene,
+        RenderQueue *queue, const RenderJob *job, int sceneResID,
+        int sensorResID, int samplerResID) {
+    ref<Scheduler> sched = Scheduler::getInstance();
+    ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
+    ref<Film> film = sensor->getFilm();
+    size_t nCores = sched->getCoreCount();
+
+    std::vector<Sampler *> samplers(nCores);
+    for (size_t i=0; i<nCores; ++i)
+        samplers[i] = static_cast<Sampler *>(sched->getResource(samplerResID, (int) i));
+    size_t sampleCount = samplers[0]->getSampleCount();
+
+    reset(scene->getAABB());
+    m_cancelled = false;
+
+    size_t offset = 0, passSamples = 1;
+    bool success = true;
+    for (int pass = 1; offset < sampleCount && success && !m_cancelled; ++pass) {
+        /* The last pass takes the remaining samples as soon as they
+           don't suffice for two more passes of doubling size */
+        size_t remaining = sampleCount - offset;
+        m_training = remaining >= 3 * passSamples;
+        size_t count = m_training ? passSamples : remaining;
+
+        Log(EInfo, "Path guiding: %s pass %i (" SIZE_T_FMT " %s per pixel)",
+            m_training ? "training" : "final", pass, count,
+            count == 1 ? "sample" : "samples");
+
+        std::vector<SerializableObject *> passSamplers(nCores);
+        for (size_t i=0; i<nCores; ++i) {
+            ref<Sampler> passSampler = new GuidingPassSampler(samplers[i], offset, count);
+            passSampler->incRef();
+            passSamplers[i] = passSampler.get();
+        }
+        int passSamplerResID = sched->registerMultiResource(passSamplers);
+        for (size_t i=0; i<nCores; ++i)
+            passSamplers[i]->decRef();
+
+        /* Only the final pass contributes to the image */
+        film->clear();
+        success = integrator->SamplingIntegrator::render(scene, queue, job,
+            sceneResID, sensorResID, passSamplerResID);
+        sched->unregisterResource(passSamplerResID);
+
+        if (success && m_training && !m_cancelled) {
+            refine(passSamples);
+            if (m_adrrs)
+                accumulatePixelEstimate(film, passSamples);
+        }
+
+        offset += count;
+        passSamples *= 2;
+    }
+
+    m_training = false;
+    return success && !m_cancelled;
+}
+
+void PathGuide::cancel() {
+    m_cancelled = true;
+}
+
+void PathGuide::refine(size_t passSamples) {
+    ref<Timer> timer = new Timer();
+    size_t memory = getMemoryUsage();
+
+    /* Split the regions that received many samples. Both halves start
+       with a copy of the region's distributions */
+    Float threshold = m_spatialThreshold * std::sqrt((Float) passSamples);
+    for (size_t i=0; i<m_nodes.size(); ++i) {
+        uint32_t regionIndex = m_nodes[i].region;
+        if (m_nodes[i].children[0] != 0)
+            continue;
+
+        Region &region = m_regions[regionIndex];
+        if (region.building.getSampleCount() <= threshold)
+            continue;
+
+        size_t regionMemory = sizeof(SpatialNode) * 2 + sizeof(Region) + sizeof(uint32_t) * 8 *
+            (region.sampling.getNodeCount() + region.building.getNodeCount());
+        if (memory + regionMemory > m_maxMemory)
+            continue;
+        memory += regionMemory;
+
+        region.building.scale(0.5f);
+        m_regions.push_back(region);
+
+        SpatialNode child;
+        child.children[0] = child.children[1] = 0;
+        child.axis = (m_nodes[i].axis + 1) % 3;
+        child.region = regionIndex;
+        m_nodes[i].children[0] = (uint32_t) m_nodes.size();
+        m_nodes.push_back(child);
+        child.region = (uint32_t) m_regions.size() - 1;
+        m_nodes[i].children[1] = (uint32_t) m_nodes.size();
+        m_nodes.push_back(child);
+
+        /* Check the new leaves again */
+        --i;
+    }
+
+    /* Distribute the remaining memory among the directional trees
+       (each region holds two of them) */
+    size_t spatialMemory = m_nodes.size() * sizeof(SpatialNode)
+        + m_regions.size() * sizeof(Region);
+    size_t nodeSize = sizeof(uint32_t) * 8;
+    size_t maxNodes = std::max((size_t) 1, (m_maxMemory - std::min(m_maxMemory,
+        spatialMemory)) / (2 * nodeSize * m_regions.size()));
+
+    for (size_t i=0; i<m_regions.size(); ++i) {
+        Region &region = m_regions[i];
+        DirectionalTree tree;
+        region.building.refine(tree, m_directionalThreshold,
+            MTS_GUIDING_MAX_QUADTREE_DEPTH, maxNodes);
+        std::swap(region.sampling, region.building);
+        std::swap(region.building, tree);
+    }
+
+    Log(EInfo, "Path guiding: refined to " SIZE_T_FMT " regions, %s (took %s)",
+        m_regions.size(), memString(getMemoryUsage()).c_str(),
+        timeString(timer->getMilliseconds() / 1000.0f).c_str());
+}
+
+void PathGuide::accumulatePixelEstimate(const Film *film, size_t passSamples) {
+    m_cropOffset = film->getCropOffset();
+    m_cropSize = film->getCropSize();
+
+    ref<Bitmap> bitmap = new Bitmap(Bitmap::ESpectrum, Bitmap::EFloat, m_cropSize);
+    if (!film->develop(Point2i(0), m_cropSize, Point2i(0), bitmap))
+        return;
+
+    size_t pixelCount = (size_t) m_cropSize.x * (size_t) m_cropSize.y;
+    if (m_pixelEstimate.size() != pixelCount) {
+        m_pixelEstimate.clear();
+        m_pixelEstimate.resize(pixelCount, 0.0f);
+        m_pixelEstimateSamples = 0;
+    }
+
+    /* Weight the passes by their sample counts */
+    const Spectrum *data = (const Spectrum *) bitmap->getFloatData();
+    Float weight = (Float) passSamples / (Float) (m_pixelEstimateSamples + passSamples);
+    for (size_t i=0; i<pixelCount; ++i) {
+        Float value = data[i].average();
+        if (!std::isfinite(value) || value < 0)
+            value = 0;
+        m_pixelEstimate[i] = (1 - weight) * m_pixelEstimate[i] + weight * value;
+    }
+    m_pixelEstimateSamples += passSamples;
+}
+
+Float PathGuide::estimateRadiance(const Region *region, const Vector &d) const {
+    if (!region)
+        return 0.0f;
+    const DirectionalTree &tree = region->sampling;
+    Float energy = tree.getEnergy();
+    if (energy <= 0 || tree.getSampleCount() <= 0)
+        return 0.0f;
+
+    /* The recorded values estimate the integral of the incident radiance
+       over the sphere, and the tree's density gives its distribution */
+    return tree.pdf(dirToCanonical(d)) * INV_FOURPI
+        * energy / (Float) tree.getSampleCount();
+}
+
+Float PathGuide::estimatePixel(const Sensor *sensor, const Ray &ray) const {
+    if (m_pixelEstimate.empty())
+        return 0.0f;
+
+    PositionSamplingRecord pRec(ray.time);
+    pRec.p = ray.o;
+    DirectionSamplingRecord dRec(ray.d);
+    Point2 samplePos;
+    if (!sensor->getSamplePosition(pRec, dRec, samplePos))
+        return 0.0f;
+
+    int x = math::floorToInt(samplePos.x) - m_cropOffset.x,
+        y = math::floorToInt(samplePos.y) - m_cropOffset.y;
+    if (x < 0 || y < 0 || x >= m_cropSize.x || y >= m_cropSize.y)
+        return 0.0f;
+
+    return m_pixelEstimate[x + y * (size_t) m_cropSize.x];
+}
+
+int PathGuide::rouletteAndSplit(Spectrum &throughput, Float radianceEstimate,
+        Float pixelEstimate, Float sample, int maxCopies) const {
+    /* Expected contribution relative to the pixel value, which is kept
+       within a window around one */
+    Float ratio = throughput.average() * radianceEstimate / pixelEstimate;
+    const Float lower = 2.0f / (1 + MTS_ADRRS_WINDOW_RATIO),
+                upper = lower * MTS_ADRRS_WINDOW_RATIO;
+
+    statsADRRSTerminated.incrementBase();
+    statsADRRSSplit.incrementBase();
+
+    if (ratio < lower) {
+        /* Russian roulette: the survivors end up in the center of the window */
+        if (sample >= ratio) {
+            ++statsADRRSTerminated;
+            return 0;
+        }
+        throughput /= ratio;
+        return 1;
+    } else if (ratio > upper && maxCopies > 1) {
+        int copies = std::min(std::min(math::floorToInt(ratio), maxCopies),
+            MTS_ADRRS_MAX_SPLIT);
+        throughput /= (Float) copies;
+        ++statsADRRSSplit;
+        statsADRRSCopies.incrementBase();
+        statsADRRSCopies += copies;
+        return copies;
+    }
+
+    return 1;
+}
+
+size_t PathGuide::getMemoryUsage() const {
+    size_t nodeCount = 0;
+    for (size_t i=0; i<m_regions.size(); ++i)
+        nodeCount += m_regions[i].sampling.getNodeCount()
+            + m_regions[i].building.getNodeCount();
+    return nodeCount * sizeof(uint32_t) * 8
+        + m_nodes.size() * sizeof(SpatialNode)
+        + m_regions.size() * sizeof(Region);
+}
+
+std::string PathGuide::toString() const {
+    std::ostringstream oss;
+    oss << "PathGuide[" << endl
+        << "  bsdfFraction = " << m_bsdfFraction << "," << endl
+        << "  spatialThreshold = " << m_spatialThreshold << "," << endl
+        << "  directionalThreshold = " << m_directionalThreshold << "," << endl
+        << "  maxMemory = " << memString(m_maxMemory) << "," << endl
+        << "  sampling = " << m_sampling << "," << endl
+        << "  adrrs = " << m_adrrs << "," << endl
+        << "  regions = " << m_regions.size() << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(GuidingPassSampler, false, Sampler)
+MTS_IMPLEMENT_CLASS(PathGuide, false, Object)
+MTS_NAMESPACE_END
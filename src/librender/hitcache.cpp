@@ -0,0 +1,241 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/hitcache.h>
+#include <mitsuba/render/skdtree.h>
+#include <mitsuba/render/scene.h>
+#include <boost/filesystem/operations.hpp>
+
+/// Version of the primary hit cache file format
+#define MTS_HITCACHE_VERSION 1
+
+/// Size of the file header (keeps the records aligned)
+#define MTS_HITCACHE_HEADER_SIZE 64
+
+MTS_NAMESPACE_BEGIN
+
+/// Mix a 64-bit word into a running hash value
+static inline uint64_t hashCombine(uint64_t hash, uint64_t value) {
+    hash ^= value;
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+}
+
+/// Hash an arbitrary memory region
+static uint64_t hashBuffer(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *ptr = static_cast<const uint8_t *>(data);
+    size_t wordCount = size / sizeof(uint64_t);
+    for (size_t i=0; i<wordCount; ++i) {
+        uint64_t word;
+        memcpy(&word, ptr + i * sizeof(uint64_t), sizeof(uint64_t));
+        hash = hashCombine(hash, word);
+    }
+    for (size_t i=wordCount * sizeof(uint64_t); i<size; ++i)
+        hash = hashCombine(hash, ptr[i]);
+    return hashCombine(hash, size);
+}
+
+static inline uint64_t hashString(uint64_t hash, const std::string &str) {
+    return hashBuffer(hash, str.c_str(), str.length());
+}
+
+/// Layout of the file header
+struct PrimaryHitCacheHeader {
+    char identifier[3];
+    uint8_t version;
+    uint32_t recordSize;
+    uint64_t key;
+    uint64_t sampleCount;
+    int32_t offset[2];
+    int32_t size[2];
+};
+
+uint64_t PrimaryHitCache::getCacheKey(const Scene *scene) {
+    const Sensor *sensor = scene->getSensor();
+    const Film *film = sensor->getFilm();
+
+    uint64_t hash = hashCombine(0, MTS_HITCACHE_VERSION);
+    hash = hashCombine(hash, sizeof(Record));
+    hash = hashCombine(hash, (uint64_t) Stream::getHostByteOrder());
+
+    /* The sensor (whose description includes the film and sampler) .. */
+    hash = hashString(hash, sensor->toString());
+    hash = hashString(hash, scene->getSampler()->getClass()->getName());
+    hash = hashCombine(hash, scene->getSampler()->getSampleCount());
+    hash = hashBuffer(hash, &film->getCropOffset(), sizeof(Point2i));
+    hash = hashBuffer(hash, &film->getCropSize(), sizeof(Vector2i));
+
+    /* .. and the geometry. Generic shapes are represented
+       by their bounding boxes, like in the kd-tree cache */
+    const ref_vector<Shape> &shapes = scene->getShapes();
+    for (size_t i=0; i<shapes.size(); ++i) {
+        const Shape *shape = shapes[i].get();
+        hash = hashString(hash, shape->getClass()->getName());
+        if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+            const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+            hash = hashBuffer(hash, mesh->getTriangles(),
+                sizeof(Triangle) * mesh->getTriangleCount());
+            hash = hashBuffer(hash, mesh->getVertexPositions(),
+                sizeof(Point) * mesh->getVertexCount());
+        } else {
+            AABB aabb = shape->getAABB();
+            hash = hashBuffer(hash, &aabb, sizeof(AABB));
+        }
+    }
+    return hash;
+}
+
+PrimaryHitCache::PrimaryHitCache(const fs::path &filename, const Scene *scene) {
+    const Film *film = scene->getSensor()->getFilm();
+    m_size = film->getCropSize();
+    m_sampleCount = scene->getSampler()->getSampleCount();
+    m_replaying = false;
+
+    const ref_vector<Shape> &shapes = scene->getShapes();
+    for (size_t i=0; i<shapes.size(); ++i) {
+        m_shapes.push_back(shapes[i].get());
+        m_shapeIndices[shapes[i].get()] = (uint32_t) i;
+    }
+
+    uint64_t key = getCacheKey(scene);
+    size_t size = MTS_HITCACHE_HEADER_SIZE + sizeof(Record)
+        * (size_t) m_size.x * (size_t) m_size.y * m_sampleCount;
+
+    if (fs::exists(filename) && (size_t) fs::file_size(filename) == size) {
+        try {
+            m_mmap = new MemoryMappedFile(filename, false);
+            const PrimaryHitCacheHeader *header =
+                static_cast<const PrimaryHitCacheHeader *>(m_mmap->getData());
+            if (header->identifier[0] == 'P' && header->identifier[1] == 'H'
+                && header->identifier[2] == 'C' && header->version == MTS_HITCACHE_VERSION
+                && header->key == key) {
+                m_replaying = true;
+            } else {
+                m_mmap = NULL;
+            }
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Could not map the primary hit cache \"%s\": %s",
+                filename.string().c_str(), ex.what());
+            m_mmap = NULL;
+        }
+    }
+
+    if (m_replaying) {
+        Log(EInfo, "Replaying the primary hits of \"%s\"", filename.string().c_str());
+    } else {
+        Log(EInfo, "Recording the primary hits in \"%s\" (%s)",
+            filename.string().c_str(), memString(size).c_str());
+        if (fs::exists(filename))
+            fs::remove(filename);
+        /* The file is created with zero-initialized (i.e. empty) records */
+        m_mmap = new MemoryMappedFile(filename, size);
+
+        PrimaryHitCacheHeader *header =
+            static_cast<PrimaryHitCacheHeader *>(m_mmap->getData());
+        header->identifier[0] = 'P';
+        header->identifier[1] = 'H';
+        header->identifier[2] = 'C';
+        header->version = MTS_HITCACHE_VERSION;
+        header->recordSize = (uint32_t) sizeof(Record);
+        header->key = key;
+        header->sampleCount = (uint64_t) m_sampleCount;
+        header->offset[0] = film->getCropOffset().x;
+        header->offset[1] = film->getCropOffset().y;
+        header->size[0] = m_size.x; header->size[1] = m_size.y;
+    }
+
+    m_records = reinterpret_cast<Record *>(
+        static_cast<uint8_t *>(m_mmap->getData()) + MTS_HITCACHE_HEADER_SIZE);
+}
+
+void PrimaryHitCache::put(Record *rec, const Point2 &samplePos, Float filterWeight,
+        const Point2 &apertureSample, Float timeSample, const Ray &ray,
+        const Intersection &its) const {
+    rec->samplePos = samplePos;
+    rec->apertureSample = apertureSample;
+    rec->filterWeight = filterWeight;
+    rec->timeSample = timeSample;
+    rec->u = rec->v = 0;
+    rec->t = its.t;
+    rec->shapeIndex = rec->primIndex = 0;
+    rec->state = ETrace;
+
+    if (!its.isValid()) {
+        rec->state = EMiss;
+        return;
+    }
+
+    std::map<const Shape *, uint32_t>::const_iterator it = m_shapeIndices.find(its.shape);
+    if (it == m_shapeIndices.end())
+        return; /* E.g. instanced geometry */
+
+    const Shape *shape = its.shape;
+    rec->shapeIndex = it->second;
+    if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+        /* Recover the barycentric coordinates of the hit */
+        const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+        Float u, v, t;
+        if (mesh->getTriangles()[its.primIndex].rayIntersect(
+                mesh->getVertexPositions(), ray, u, v, t)) {
+            rec->primIndex = its.primIndex;
+            rec->u = u;
+            rec->v = v;
+            rec->state = ETriangle;
+        }
+    } else {
+        rec->state = EShape;
+    }
+}
+
+bool PrimaryHitCache::get(const Record &rec, const Ray &ray, Intersection &its) const {
+    switch (rec.state) {
+        case EMiss:
+            its.t = std::numeric_limits<Float>::infinity();
+            return true;
+
+        case ETriangle: {
+                const TriMesh *mesh = static_cast<const TriMesh *>(m_shapes[rec.shapeIndex]);
+                its.t = rec.t;
+                ShapeKDTree::fillTriangleIntersectionRecord<true>(ray,
+                    mesh, rec.primIndex, rec.u, rec.v, its);
+            }
+            break;
+
+        case EShape: {
+                /* Only intersect the recorded shape */
+                const Shape *shape = m_shapes[rec.shapeIndex];
+                uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+                Float t;
+                if (!shape->rayIntersect(ray, ray.mint, ray.maxt, t, temp))
+                    return false;
+                its.t = t;
+                shape->fillIntersectionRecord(ray, temp, its);
+            }
+            break;
+
+        default:
+            return false;
+    }
+
+    computeShadingFrame(its.shFrame.n, its.dpdu, its.shFrame);
+    its.wi = its.toLocal(-ray.d);
+    return true;
+}
+
+MTS_IMPLEMENT_CLASS(PrimaryHitCache, false, Object)
+MTS_NAMESPACE_END
@@ -17,17 +17,38 @@
 */
 
 #include <mitsuba/render/imageblock.h>
+#include <mitsuba/core/atomic.h>
 
 MTS_NAMESPACE_BEGIN
 
+/* The pixel data of image blocks is transmitted in the byte order of the
+   sending machine, preceded by a tag. When both sides agree (which is
+   practically always the case), the floats are read and written in bulk
+   without any per-value conversion or temporary buffer. */
+static void writeNativeArray(Stream *stream, const Float *data, size_t count) {
+    stream->writeChar((char) Stream::getHostByteOrder());
+    stream->write(data, sizeof(Float) * count);
+}
+
+static void readNativeArray(Stream *stream, Float *data, size_t count) {
+    Stream::EByteOrder byteOrder = (Stream::EByteOrder) stream->readChar();
+    stream->read(data, sizeof(Float) * count);
+    if (byteOrder != Stream::getHostByteOrder()) {
+        for (size_t i=0; i<count; ++i)
+            data[i] = endianness_swap(data[i]);
+    }
+}
+
 ImageBlock::ImageBlock(Bitmap::EPixelFormat fmt, const Vector2i &size,
-        const ReconstructionFilter *filter, int channels, bool warn) : m_offset(0),
-        m_size(size), m_filter(filter), m_weightsX(NULL), m_weightsY(NULL), m_warn(warn) {
+        const ReconstructionFilter *filter, int channels, bool warn) : m_footprint(NULL), m_cost(NULL), m_offset(0),
+        m_size(size), m_filter(filter), m_weightsX(NULL), m_weightsY(NULL), m_stripeLocks(NULL),
+        m_warn(warn) {
     m_borderSize = filter ? filter->getBorderSize() : 0;
 
     /* Allocate a small bitmap data structure for the block */
     m_bitmap = new Bitmap(fmt, Bitmap::EFloat,
         size + Vector2i(2 * m_borderSize), channels);
+    m_memory.set(m_bitmap->getBufferSize());
 
     if (filter) {
         /* Temporary buffers used in put() */
@@ -35,31 +56,292 @@ ImageBlock::ImageBlock(Bitmap::EPixelFormat fmt, const Vector2i &size,
         m_weightsX = new Float[2*tempBufferSize];
         m_weightsY = m_weightsX + tempBufferSize;
     }
+
+    /* Locks used by putConcurrent() */
+    int stripeCount = (m_bitmap->getHeight() + MTS_IMAGEBLOCK_STRIPE - 1)
+        / MTS_IMAGEBLOCK_STRIPE;
+    m_stripeLocks = new int32_t[stripeCount];
+    memset((void *) m_stripeLocks, 0, sizeof(int32_t) * stripeCount);
 }
 
 ImageBlock::~ImageBlock() {
     if (m_weightsX)
         delete[] m_weightsX;
+    if (m_footprint)
+        delete m_footprint;
+    if (m_cost)
+        delete m_cost;
+    delete[] m_stripeLocks;
+}
+
+void ImageBlock::allocateVariance() {
+    if (m_variance)
+        return;
+    m_variance = new Bitmap(Bitmap::EMultiChannel, Bitmap::EFloat,
+        m_bitmap->getSize() - Vector2i(2 * m_borderSize), 3);
+    m_variance->clear();
+    m_memory.set(m_bitmap->getBufferSize() + m_variance->getBufferSize()
+        + (m_compact ? m_compact->getBufferSize() : 0));
+}
+
+void ImageBlock::allocateFootprint() {
+    if (!m_footprint)
+        m_footprint = new ObjectFootprint();
+}
+
+void ImageBlock::allocateCost() {
+    if (!m_cost)
+        m_cost = new BlockCost();
+}
+
+void ImageBlock::setCompactLayers(const std::vector<bool> &compact) {
+    if (m_bitmap->getPixelFormat() != Bitmap::EMultiSpectrumAlphaWeight || m_borderSize != 0)
+        Log(EError, "setCompactLayers(): only supported for multi-spectrum "
+            "blocks without a border region!");
+
+    int layerCount = (m_bitmap->getChannelCount()
+        + (m_compact ? m_compact->getChannelCount() : 0) - 2) / SPECTRUM_SAMPLES;
+    if ((int) compact.size() != layerCount)
+        Log(EError, "setCompactLayers(): expected %i entries, got %i!",
+            layerCount, (int) compact.size());
+
+    int compactCount = (int) std::count(compact.begin(), compact.end(), true);
+    m_compactLayers = compact;
+    m_bitmap = new Bitmap(Bitmap::EMultiSpectrumAlphaWeight, Bitmap::EFloat,
+        m_bitmap->getSize(), (layerCount - compactCount) * SPECTRUM_SAMPLES + 2);
+    m_bitmap->clear();
+    if (compactCount > 0) {
+        m_compact = new Bitmap(Bitmap::EMultiChannel, Bitmap::EFloat16,
+            m_bitmap->getSize(), compactCount * SPECTRUM_SAMPLES);
+        m_compact->clear();
+    } else {
+        m_compact = NULL;
+    }
+
+    m_memory.set(m_bitmap->getBufferSize()
+        + (m_compact ? m_compact->getBufferSize() : 0)
+        + (m_variance ? m_variance->getBufferSize() : 0));
+}
+
+void ImageBlock::putCompact(const ImageBlock *block) {
+    const Bitmap *bitmap = block->getBitmap();
+    const int channels = m_bitmap->getChannelCount(),
+              compactChannels = m_compact->getChannelCount(),
+              sourceChannels = bitmap->getChannelCount();
+    if (sourceChannels != channels + compactChannels)
+        Log(EError, "put(): channel count mismatch (%i vs %i)!",
+            sourceChannels, channels + compactChannels);
+
+    /* Clip the source bitmap (including its border) against this block */
+    Vector2i shift = block->getOffset() - m_offset
+        - Vector2i(block->getBorderSize());
+    const Vector2i &size = m_bitmap->getSize();
+    int x0 = std::max(0, -shift.x), x1 = std::min(bitmap->getWidth(), size.x - shift.x),
+        y0 = std::max(0, -shift.y), y1 = std::min(bitmap->getHeight(), size.y - shift.y);
+
+    for (int y=y0; y<y1; ++y) {
+        const Float *source = bitmap->getFloatData()
+            + (y * (size_t) bitmap->getWidth() + x0) * sourceChannels;
+        size_t index = (y + shift.y) * (size_t) size.x + x0 + shift.x;
+        Float *dest = m_bitmap->getFloatData() + index * channels;
+        half *compactDest = m_compact->getFloat16Data() + index * compactChannels;
+
+        for (int x=x0; x<x1; ++x) {
+            for (size_t i=0; i<m_compactLayers.size(); ++i) {
+                if (m_compactLayers[i]) {
+                    for (int j=0; j<SPECTRUM_SAMPLES; ++j, ++compactDest)
+                        *compactDest = half((float) *compactDest + (float) *source++);
+                } else {
+                    for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+                        *dest++ += *source++;
+                }
+            }
+            /* Alpha and weight */
+            *dest++ += *source++;
+            *dest++ += *source++;
+        }
+    }
+
+    if (m_variance && block->hasVariance())
+        m_variance->accumulate(block->getVariance(),
+            Point2i(block->getOffset() - m_offset));
+    if (m_footprint && block->hasFootprint())
+        m_footprint->insert(*block->getFootprint());
+}
+
+void ImageBlock::getRows(int y, int count, Float *target) const {
+    const int width = m_bitmap->getWidth(),
+              channels = m_bitmap->getChannelCount();
+    const Float *source = m_bitmap->getFloatData() + y * (size_t) width * channels;
+
+    if (!m_compact.get()) {
+        memcpy(target, source, sizeof(Float) * (size_t) width * count * channels);
+        return;
+    }
+
+    const half *compactSource = m_compact->getFloat16Data()
+        + y * (size_t) width * m_compact->getChannelCount();
+    for (size_t k=0; k<(size_t) width * count; ++k) {
+        for (size_t i=0; i<m_compactLayers.size(); ++i) {
+            if (m_compactLayers[i]) {
+                for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+                    *target++ = (Float) (float) *compactSource++;
+            } else {
+                for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+                    *target++ = *source++;
+            }
+        }
+        *target++ = *source++;
+        *target++ = *source++;
+    }
 }
 
 void ImageBlock::load(Stream *stream) {
     m_offset = Point2i(stream);
     m_size = Vector2i(stream);
-    stream->readFloatArray(
+    readNativeArray(stream,
         m_bitmap->getFloatData(),
         (size_t) m_bitmap->getSize().x *
         (size_t) m_bitmap->getSize().y * m_bitmap->getChannelCount());
+    if (m_variance)
+        readNativeArray(stream, m_variance->getFloatData(),
+            m_variance->getPixelCount() * 3);
+    if (m_footprint)
+        *m_footprint = ObjectFootprint(stream);
+    if (m_cost) {
+        m_cost->time = stream->readFloat();
+        m_cost->samples = stream->readULong();
+        m_cost->rays = stream->readULong();
+    }
 }
 
 void ImageBlock::save(Stream *stream) const {
     m_offset.serialize(stream);
     m_size.serialize(stream);
-    stream->writeFloatArray(
+    writeNativeArray(stream,
         m_bitmap->getFloatData(),
         (size_t) m_bitmap->getSize().x *
         (size_t) m_bitmap->getSize().y * m_bitmap->getChannelCount());
+    if (m_variance.get())
+        writeNativeArray(stream, m_variance->getFloatData(),
+            m_variance->getPixelCount() * 3);
+    if (m_footprint)
+        m_footprint->serialize(stream);
+    if (m_cost) {
+        stream->writeFloat(m_cost->time);
+        stream->writeULong(m_cost->samples);
+        stream->writeULong(m_cost->rays);
+    }
 }
 
+void ImageBlock::put(const SparseImageBlock *block) {
+    const int channels = m_bitmap->getChannelCount();
+    if (m_compact)
+        Log(EError, "put(): sparse blocks can't be accumulated into compact layers!");
+    if (block->m_channels != channels)
+        Log(EError, "put(): channel count mismatch (%i vs %i)!",
+            block->m_channels, channels);
+
+    Vector2i shift = block->m_offset - m_offset
+        - Vector2i(block->m_borderSize - m_borderSize);
+    Vector2i targetSize = m_bitmap->getSize();
+    const Float *source = block->m_data.empty() ? NULL : &block->m_data[0];
+
+    for (size_t i=0; i<block->m_tiles.size(); ++i) {
+        Point2i pos;
+        Vector2i size;
+        block->getTile(block->m_tiles[i], pos, size);
+
+        /* Clip the tile against the target bitmap */
+        int x0 = std::max(0, -(pos.x + shift.x)),
+            x1 = std::min(size.x, targetSize.x - (pos.x + shift.x));
+
+        for (int y=0; y<size.y; ++y) {
+            int ty = pos.y + y + shift.y;
+            if (ty >= 0 && ty < targetSize.y && x0 < x1) {
+                Float *dest = m_bitmap->getFloatData() + (ty * (size_t) targetSize.x
+                    + pos.x + shift.x + x0) * channels;
+                accumulate(dest, source + x0 * channels, 1.0f, (x1 - x0) * channels);
+            }
+            source += size.x * channels;
+        }
+    }
+}
+
+bool ImageBlock::putConcurrent(const Point2 &_pos, const Float *value) {
+    const int channels = m_bitmap->getChannelCount();
+
+    /* Check if all sample values are valid */
+    for (int i=0; i<channels; ++i) {
+        if (EXPECT_NOT_TAKEN((!std::isfinite(value[i]) || value[i] < 0) && m_warn)) {
+            std::ostringstream oss;
+            oss << "Invalid sample value : [";
+            for (int j=0; j<channels; ++j) {
+                oss << value[j];
+                if (j+1 < channels)
+                    oss << ", ";
+            }
+            oss << "]";
+            Log(EWarn, "%s", oss.str().c_str());
+            return false;
+        }
+    }
+
+    const Float filterRadius = m_filter->getRadius();
+    const Vector2i &size = m_bitmap->getSize();
+
+    /* Convert to pixel coordinates within the image block */
+    const Point2 pos(
+        _pos.x - 0.5f - (m_offset.x - m_borderSize),
+        _pos.y - 0.5f - (m_offset.y - m_borderSize));
+
+    /* Determine the affected range of pixels */
+    const Point2i min(std::max((int) std::ceil (pos.x - filterRadius), 0),
+                      std::max((int) std::ceil (pos.y - filterRadius), 0)),
+                  max(std::min((int) std::floor(pos.x + filterRadius), size.x - 1),
+                      std::min((int) std::floor(pos.y + filterRadius), size.y - 1));
+
+    if (min.x > max.x || min.y > max.y)
+        return true;
+
+    /* Lookup values from the pre-rasterized filter. The buffers in
+       'm_weightsX' and 'm_weightsY' can't be used here, since they
+       are shared by all threads. */
+    Float *weightsX = (Float *) alloca(sizeof(Float) * (max.x - min.x + 1)),
+          *weightsY = (Float *) alloca(sizeof(Float) * (max.y - min.y + 1));
+    for (int x=min.x, idx = 0; x<=max.x; ++x)
+        weightsX[idx++] = m_filter->evalDiscretized(x-pos.x);
+    for (int y=min.y, idx = 0; y<=max.y; ++y)
+        weightsY[idx++] = m_filter->evalDiscretized(y-pos.y);
+
+    /* Rasterize the filtered sample into the framebuffer while holding
+       the lock of the current stripe (only one lock is held at a time) */
+    int stripe = -1;
+    for (int y=min.y, yr=0; y<=max.y; ++y, ++yr) {
+        if (y / MTS_IMAGEBLOCK_STRIPE != stripe) {
+            if (stripe >= 0)
+                atomicCompareAndExchange(m_stripeLocks + stripe, 0, 1);
+            stripe = y / MTS_IMAGEBLOCK_STRIPE;
+            while (!atomicCompareAndExchange(m_stripeLocks + stripe, 1, 0)) {
+#if (defined(__i386__) || defined(__amd64__))
+                __asm__ __volatile__ ("pause\n");
+#endif
+            }
+        }
+
+        const Float weightY = weightsY[yr];
+        Float *dest = m_bitmap->getFloatData()
+            + (y * (size_t) size.x + min.x) * channels;
+
+        for (int x=min.x, xr=0; x<=max.x; ++x, ++xr) {
+            accumulate(dest, value, weightsX[xr] * weightY, channels);
+            dest += channels;
+        }
+    }
+    atomicCompareAndExchange(m_stripeLocks + stripe, 0, 1);
+
+    return true;
+}
 
 std::string ImageBlock::toString() const {
     std::ostringstream oss;
@@ -71,5 +353,87 @@ std::string ImageBlock::toString() const {
     return oss.str();
 }
 
+SparseImageBlock::SparseImageBlock() : m_offset(0), m_bitmapSize(0),
+    m_borderSize(0), m_channels(0) { }
+
+void SparseImageBlock::set(const ImageBlock *block) {
+    const Bitmap *bitmap = block->getBitmap();
+    m_offset = block->getOffset();
+    m_bitmapSize = bitmap->getSize();
+    m_borderSize = block->getBorderSize();
+    m_channels = bitmap->getChannelCount();
+    m_tiles.clear();
+    m_data.clear();
+
+    int tilesX = (m_bitmapSize.x + MTS_IMAGEBLOCK_SPARSE_TILE - 1) / MTS_IMAGEBLOCK_SPARSE_TILE,
+        tilesY = (m_bitmapSize.y + MTS_IMAGEBLOCK_SPARSE_TILE - 1) / MTS_IMAGEBLOCK_SPARSE_TILE;
+
+    for (uint32_t index=0; index < (uint32_t) (tilesX * tilesY); ++index) {
+        Point2i pos;
+        Vector2i size;
+        getTile(index, pos, size);
+
+        /* Skip tiles that don't contain any contributions */
+        bool empty = true;
+        for (int y=0; y<size.y && empty; ++y) {
+            const Float *row = bitmap->getFloatData() +
+                ((pos.y + y) * (size_t) m_bitmapSize.x + pos.x) * m_channels;
+            for (int x=0; x<size.x * m_channels; ++x) {
+                if (row[x] != 0) {
+                    empty = false;
+                    break;
+                }
+            }
+        }
+        if (empty)
+            continue;
+
+        m_tiles.push_back(index);
+        for (int y=0; y<size.y; ++y) {
+            const Float *row = bitmap->getFloatData() +
+                ((pos.y + y) * (size_t) m_bitmapSize.x + pos.x) * m_channels;
+            m_data.insert(m_data.end(), row, row + size.x * m_channels);
+        }
+    }
+}
+
+void SparseImageBlock::load(Stream *stream) {
+    m_offset = Point2i(stream);
+    m_bitmapSize = Vector2i(stream);
+    m_borderSize = stream->readInt();
+    m_channels = stream->readInt();
+    m_tiles.resize(stream->readSize());
+    m_data.resize(stream->readSize());
+    if (!m_tiles.empty())
+        stream->readUIntArray(&m_tiles[0], m_tiles.size());
+    if (!m_data.empty())
+        readNativeArray(stream, &m_data[0], m_data.size());
+}
+
+void SparseImageBlock::save(Stream *stream) const {
+    m_offset.serialize(stream);
+    m_bitmapSize.serialize(stream);
+    stream->writeInt(m_borderSize);
+    stream->writeInt(m_channels);
+    stream->writeSize(m_tiles.size());
+    stream->writeSize(m_data.size());
+    if (!m_tiles.empty())
+        stream->writeUIntArray(&m_tiles[0], m_tiles.size());
+    if (!m_data.empty())
+        writeNativeArray(stream, &m_data[0], m_data.size());
+}
+
+std::string SparseImageBlock::toString() const {
+    std::ostringstream oss;
+    oss << "SparseImageBlock[" << endl
+        << "  offset = " << m_offset.toString() << "," << endl
+        << "  bitmapSize = " << m_bitmapSize.toString() << "," << endl
+        << "  borderSize = " << m_borderSize << "," << endl
+        << "  tiles = " << m_tiles.size() << endl
+        << "]";
+    return oss.str();
+}
+
 MTS_IMPLEMENT_CLASS(ImageBlock, false, WorkResult)
+MTS_IMPLEMENT_CLASS(SparseImageBlock, false, Object)
 MTS_NAMESPACE_END
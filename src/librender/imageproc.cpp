@@ -18,6 +18,8 @@
 
 #include <mitsuba/render/imageproc.h>
 #include <mitsuba/render/rectwu.h>
+#include <mitsuba/core/sfcurve.h>
+#include <algorithm>
 
 MTS_NAMESPACE_BEGIN
 
@@ -25,6 +27,11 @@ MTS_NAMESPACE_BEGIN
 /*                          BlockedImageProcess                         */
 /* ==================================================================== */
 
+static bool costGreater(const std::pair<double, Point2i> &a,
+        const std::pair<double, Point2i> &b) {
+    return a.first > b.first;
+}
+
 void BlockedImageProcess::init(const Point2i &offset, const Vector2i &size, uint32_t blockSize) {
     m_offset = offset;
     m_size = size;
@@ -38,24 +45,93 @@ void BlockedImageProcess::init(const Point2i &offset, const Vector2i &size, uint
     m_curBlock = Point2i(m_numBlocks / 2);
     m_stepsLeft = 1;
     m_numSteps = 1;
+
+    m_blockList.clear();
+    if (m_blockOrder == EHilbert) {
+        HilbertCurve2D<int> curve;
+        curve.initialize(Vector2i(m_numBlocks));
+        m_blockList.reserve(curve.getPointCount());
+        for (size_t i=0; i<curve.getPointCount(); ++i)
+            m_blockList.push_back(Point2i(curve[i]));
+    }
+
+    if (m_costPrediction) {
+        if (m_blockList.empty()) {
+            m_blockList.reserve(m_numBlocksTotal);
+            for (int i=0; i<m_numBlocksTotal; ++i) {
+                m_blockList.push_back(m_curBlock);
+                if (i + 1 < m_numBlocksTotal)
+                    advanceSpiral();
+            }
+        }
+
+        /* Sum up the predicted cost of each block (clamped to the
+           prediction, which need not cover a border region) */
+        const Vector2i &costSize = m_costPrediction->getSize();
+        const float *data = m_costPrediction->getFloat32Data();
+        std::vector<std::pair<double, Point2i> > blocks(m_blockList.size());
+        for (size_t i=0; i<m_blockList.size(); ++i) {
+            Point2i pos = m_blockList[i] * m_blockSize + m_offset;
+            int xs = std::max(pos.x, 0), xe = std::min(pos.x + m_blockSize, costSize.x),
+                ys = std::max(pos.y, 0), ye = std::min(pos.y + m_blockSize, costSize.y);
+            double cost = 0;
+            for (int y=ys; y<ye; ++y)
+                for (int x=xs; x<xe; ++x)
+                    cost += data[y * (size_t) costSize.x + x];
+            blocks[i] = std::make_pair(cost, m_blockList[i]);
+        }
+
+        /* Longest processing time first */
+        std::stable_sort(blocks.begin(), blocks.end(), costGreater);
+        for (size_t i=0; i<blocks.size(); ++i)
+            m_blockList[i] = blocks[i].second;
+    }
+}
+
+void BlockedImageProcess::setCostPrediction(const Bitmap *cost) {
+    if (cost && (cost->getChannelCount() != 1 ||
+            cost->getComponentFormat() != Bitmap::EFloat32))
+        Log(EError, "setCostPrediction(): expected a single-channel "
+            "32-bit floating point bitmap!");
+    m_costPrediction = cost;
 }
 
 ParallelProcess::EStatus BlockedImageProcess::generateWork(WorkUnit *unit, int worker) {
+    return nextBlock(unit);
+}
+
+ParallelProcess::EStatus BlockedImageProcess::generateWorkBatch(WorkUnit * const *units,
+        size_t count, size_t &generated, int worker) {
+    for (generated = 0; generated < count; ++generated) {
+        if (nextBlock(units[generated]) != ESuccess)
+            return EFailure;
+    }
+    return ESuccess;
+}
+
+ParallelProcess::EStatus BlockedImageProcess::nextBlock(WorkUnit *unit) {
     /* Reimplementation of the spiraling block generator by Adam Arbree */
     RectangularWorkUnit &rect = *static_cast<RectangularWorkUnit *>(unit);
 
     if (m_numBlocksTotal == m_numBlocksGenerated)
         return EFailure;
 
+    if (!m_blockList.empty())
+        m_curBlock = m_blockList[m_numBlocksGenerated];
+
     Point2i pos = m_curBlock * m_blockSize;
     rect.setOffset(pos + m_offset);
     rect.setSize(Vector2i(
         std::min(m_size.x-pos.x, m_blockSize),
         std::min(m_size.y-pos.y, m_blockSize)));
 
-    if (++m_numBlocksGenerated == m_numBlocksTotal)
-        return ESuccess;
+    if (++m_numBlocksGenerated < m_numBlocksTotal && m_blockList.empty())
+        advanceSpiral();
 
+    return ESuccess;
+}
+
+void BlockedImageProcess::advanceSpiral() {
     do {
         switch (m_direction) {
             case ERight: ++m_curBlock.x; break;
@@ -73,8 +149,6 @@ ParallelProcess::EStatus BlockedImageProcess::generateWork(WorkUnit *unit, int w
     } while (m_curBlock.x < 0 || m_curBlock.y < 0
         || m_curBlock.x >= m_numBlocks.x
         || m_curBlock.y >= m_numBlocks.y);
-
-    return ESuccess;
 }
 
 MTS_IMPLEMENT_CLASS(BlockedImageProcess, true, ParallelProcess)
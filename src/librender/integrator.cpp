@@ -20,8 +20,35 @@
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/renderproc.h>
 
+/// Target number of sensor rays that \ref SamplingIntegrator::renderBlockStream() traces at once
+#define MTS_SENSOR_RAY_BATCH 64
+
 MTS_NAMESPACE_BEGIN
 
+/**
+ * Store a sensor sample (together with its AOVs, if given) in an image block.
+ * When the reconstruction filter is importance sampled, the sample is
+ * written to the pixel it was generated for instead of being splatted.
+ */
+bool SamplingIntegrator::putSensorSample(ImageBlock *block, bool importanceSampled,
+        const Point2i &pixel, const Point2 &pos, Float filterWeight,
+        const Spectrum &spec, Float alpha, const Spectrum *aovs, Float *temp) {
+    if (!aovs)
+        return importanceSampled ? block->putPixel(pixel, spec, alpha, filterWeight)
+            : block->put(pos, spec, alpha);
+
+    int offset = 0;
+    for (int l=0; l<SPECTRUM_SAMPLES; ++l)
+        temp[offset++] = spec[l];
+    for (int k=0; k<RadianceQueryRecord::EAOVCount; ++k)
+        for (int l=0; l<SPECTRUM_SAMPLES; ++l)
+            temp[offset++] = aovs[k][l];
+    temp[offset++] = alpha;
+    temp[offset] = 1.0f;
+    return importanceSampled ? block->putPixel(pixel, temp, filterWeight)
+        : block->put(pos, temp);
+}
+
 Integrator::Integrator(const Properties &props)
  : NetworkedObject(props) { }
 
@@ -42,14 +69,112 @@ void Integrator::configureSampler(const Scene *scene, Sampler *sampler) {
 }
 const Integrator *Integrator::getSubIntegrator(int idx) const { return NULL; }
 
+void Integrator::saveCheckpoint(Stream *stream) const {
+    Log(EError, "%s::saveCheckpoint(): checkpoints are not supported by this integrator!",
+        getClass()->getName().c_str());
+}
+
+void Integrator::loadCheckpoint(Stream *stream) {
+    Log(EError, "%s::loadCheckpoint(): checkpoints are not supported by this integrator!",
+        getClass()->getName().c_str());
+}
+
 SamplingIntegrator::SamplingIntegrator(const Properties &props)
- : Integrator(props) { }
+ : Integrator(props) {
+    /* Distribute the samples over several passes based on the estimated error? */
+    m_adaptiveSampling = props.getBoolean("adaptiveSampling", false);
+    /* Average number of rounds (of 'sampleCount' samples) per pixel */
+    m_adaptiveRounds = props.getFloat("adaptiveRounds", 8);
+    /* Number of passes, including the initial uniform one */
+    m_adaptivePasses = props.getInteger("adaptivePasses", 4);
+    /* Relative error at which a block is considered converged (0: disabled) */
+    m_adaptiveMaxError = props.getFloat("adaptiveMaxError", 0.0f);
+    /* Don't start further passes after this many seconds (0: disabled) */
+    m_adaptiveTimeLimit = props.getFloat("adaptiveTimeLimit", 0.0f);
+
+    if (m_adaptiveSampling && (m_adaptiveRounds < 2 || m_adaptivePasses < 1))
+        Log(EError, "Adaptive sampling requires adaptiveRounds >= 2 and adaptivePasses >= 1!");
+
+    /* Render all blocks in rounds of this many samples per pixel (0: disabled) */
+    m_progressiveSamples = props.getInteger("progressiveSamples", 0);
+    /* Don't start further rounds that would exceed this many seconds (0: disabled) */
+    m_progressiveTimeLimit = props.getFloat("progressiveTimeLimit", 0.0f);
+    /* Stop once the average relative error of the pixels falls below this value (0: disabled) */
+    m_progressiveMaxError = props.getFloat("progressiveMaxError", 0.0f);
+
+    if (m_progressiveSamples < 0)
+        Log(EError, "The 'progressiveSamples' parameter must be nonnegative!");
+    if (m_progressiveSamples > 0 && m_adaptiveSampling)
+        Log(EError, "Progressive rendering and adaptive sampling cannot be combined!");
+
+    /* Record the rendered blocks in a cache file next to the output file? */
+    m_regionCache = props.getBoolean("regionCache", false);
+    /* IDs of the shapes and BSDFs modified since the cache was recorded. When
+       specified, blocks that didn't encounter them are copied from the cache */
+    m_regionCacheReuse = props.hasProperty("regionCacheChanged");
+    if (m_regionCacheReuse)
+        m_regionCacheChanged = tokenize(props.getString("regionCacheChanged"), ", \t\n");
+
+    if (m_regionCache && (m_adaptiveSampling || m_progressiveSamples > 0))
+        Log(EError, "Render region caching cannot be combined with adaptive "
+            "sampling or progressive rendering!");
+
+    /* Write the time, samples and rays spent on every block next to the output file? */
+    m_tileCost = props.getBoolean("tileCost", false);
+    /* Tile cost file of a previous frame -- render its expensive blocks first */
+    m_tileCostPrediction = props.getString("tileCostPrediction", "");
+
+    /* File with the primary hits of all samples -- recorded by the first job, replayed by the following ones */
+    m_primaryHitCacheFile = props.getString("primaryHitCache", "");
+
+    if (!m_primaryHitCacheFile.empty() && (m_adaptiveSampling || m_regionCache))
+        Log(EError, "The primary hit cache cannot be combined with adaptive "
+            "sampling or render region caching!");
+
+    /* Enabled by the integrators that support it */
+    m_aovs = false;
+}
 
 SamplingIntegrator::SamplingIntegrator(Stream *stream, InstanceManager *manager)
- : Integrator(stream, manager) { }
+ : Integrator(stream, manager) {
+    m_adaptiveSampling = stream->readBool();
+    m_adaptiveRounds = stream->readFloat();
+    m_adaptivePasses = stream->readInt();
+    m_adaptiveMaxError = stream->readFloat();
+    m_adaptiveTimeLimit = stream->readFloat();
+    m_progressiveSamples = stream->readInt();
+    m_progressiveTimeLimit = stream->readFloat();
+    m_progressiveMaxError = stream->readFloat();
+    m_regionCache = stream->readBool();
+    m_regionCacheReuse = stream->readBool();
+    m_regionCacheChanged.resize(stream->readSize());
+    for (size_t i=0; i<m_regionCacheChanged.size(); ++i)
+        m_regionCacheChanged[i] = stream->readString();
+    m_tileCost = stream->readBool();
+    m_tileCostPrediction = stream->readString();
+    m_primaryHitCacheFile = stream->readString();
+    m_aovs = stream->readBool();
+}
 
 void SamplingIntegrator::serialize(Stream *stream, InstanceManager *manager) const {
     Integrator::serialize(stream, manager);
+    stream->writeBool(m_adaptiveSampling);
+    stream->writeFloat(m_adaptiveRounds);
+    stream->writeInt(m_adaptivePasses);
+    stream->writeFloat(m_adaptiveMaxError);
+    stream->writeFloat(m_adaptiveTimeLimit);
+    stream->writeInt(m_progressiveSamples);
+    stream->writeFloat(m_progressiveTimeLimit);
+    stream->writeFloat(m_progressiveMaxError);
+    stream->writeBool(m_regionCache);
+    stream->writeBool(m_regionCacheReuse);
+    stream->writeSize(m_regionCacheChanged.size());
+    for (size_t i=0; i<m_regionCacheChanged.size(); ++i)
+        stream->writeString(m_regionCacheChanged[i]);
+    stream->writeBool(m_tileCost);
+    stream->writeString(m_tileCostPrediction);
+    stream->writeString(m_primaryHitCacheFile);
+    stream->writeBool(m_aovs);
 }
 
 Spectrum SamplingIntegrator::E(const Scene *scene, const Intersection &its,
@@ -109,8 +234,79 @@ bool SamplingIntegrator::render(Scene *scene,
         nCores == 1 ? "core" : "cores");
 
     /* This is a sampling-based integrator - parallelize */
-    ref<ParallelProcess> proc = new BlockedRenderProcess(job,
+    ref<BlockedRenderProcess> proc = new BlockedRenderProcess(job,
         queue, scene->getBlockSize());
+    proc->setBlockOrder(scene->getBlockOrder());
+
+    if (m_adaptiveSampling) {
+        const std::string &samplerName = sampler->getClass()->getName();
+        if (samplerName == "HaltonSampler" || samplerName == "HammersleySampler" ||
+            samplerName == "SobolSampler")
+            Log(EError, "Adaptive sampling revisits pixels and thus requires a randomized "
+                "sampler (e.g. \"independent\", \"stratified\", or \"ldsampler\")!");
+        Log(EInfo, "Adaptive sampling: %i passes, on average %.1f x " SIZE_T_FMT
+            " samples per pixel", m_adaptivePasses, m_adaptiveRounds, sampleCount);
+        proc->setAdaptive(m_adaptiveRounds, m_adaptivePasses,
+            m_adaptiveMaxError, m_adaptiveTimeLimit);
+    } else if (m_progressiveSamples > 0) {
+        size_t samplesPerRound = std::min((size_t) m_progressiveSamples, sampleCount);
+        Log(EInfo, "Progressive rendering: rounds of " SIZE_T_FMT " of " SIZE_T_FMT
+            " samples per pixel", samplesPerRound, sampleCount);
+        if (m_progressiveMaxError > 0 && m_aovs)
+            Log(EError, "The 'progressiveMaxError' parameter cannot be combined with AOV output!");
+        proc->setProgressive(samplesPerRound, sampleCount,
+            m_progressiveTimeLimit, m_progressiveMaxError);
+    }
+
+    Bitmap::EPixelFormat pixelFormat = Bitmap::ESpectrumAlphaWeight;
+    int channelCount = -1;
+    if (m_aovs) {
+        /* Radiance followed by the first-hit AOVs */
+        pixelFormat = Bitmap::EMultiSpectrumAlphaWeight;
+        channelCount = (1 + RadianceQueryRecord::EAOVCount) * SPECTRUM_SAMPLES + 2;
+        proc->setPixelFormat(pixelFormat, channelCount, false);
+    }
+
+    ref<RenderRegionCache> regionCache;
+    fs::path regionCacheFile(scene->getDestinationFile().string() + ".regioncache");
+    if (m_regionCache) {
+        regionCache = new RenderRegionCache(film->getReconstructionFilter(),
+            pixelFormat, channelCount, film->getCropOffset(), film->getCropSize(),
+            (int) scene->getBlockSize());
+
+        ref<RenderRegionCache> previous;
+        std::vector<ObjectFootprint> changed;
+        if (m_regionCacheReuse) {
+            previous = new RenderRegionCache(film->getReconstructionFilter(),
+                pixelFormat, channelCount, film->getCropOffset(), film->getCropSize(),
+                (int) scene->getBlockSize());
+            if (!previous->load(regionCacheFile))
+                previous = NULL;
+            for (size_t i=0; i<m_regionCacheChanged.size(); ++i)
+                changed.push_back(ObjectFootprint(m_regionCacheChanged[i]));
+        }
+        proc->setRegionCache(previous, changed, regionCache);
+    }
+
+    ref<TileCostMap> tileCost;
+    fs::path tileCostFile(scene->getDestinationFile().string() + ".tilecost.exr");
+    if (m_tileCost) {
+        tileCost = new TileCostMap(film->getCropSize());
+        proc->setTileCostRecord(tileCost);
+    }
+    if (!m_tileCostPrediction.empty()) {
+        ref<TileCostMap> prediction = new TileCostMap(film->getCropSize());
+        if (prediction->load(m_tileCostPrediction))
+            proc->setCostPrediction(prediction->getTimePrediction());
+        else
+            Log(EWarn, "Could not use the tile cost prediction \"%s\"",
+                m_tileCostPrediction.c_str());
+    }
+
+    /* Only used by local workers, remote ones trace all sensor rays */
+    if (!m_primaryHitCacheFile.empty())
+        m_primaryHits = new PrimaryHitCache(m_primaryHitCacheFile, scene);
+
     int integratorResID = sched->registerResource(this);
     proc->bindResource("integrator", integratorResID);
     proc->bindResource("scene", sceneResID);
@@ -123,9 +319,20 @@ bool SamplingIntegrator::render(Scene *scene,
     m_process = proc;
     sched->wait(proc);
     m_process = NULL;
+    m_primaryHits = NULL;
     sched->unregisterResource(integratorResID);
 
-    return proc->getReturnStatus() == ParallelProcess::ESuccess;
+    bool success = proc->getReturnStatus() == ParallelProcess::ESuccess;
+    if (regionCache && success) {
+        if (m_regionCacheReuse)
+            Log(EInfo, "Render region cache: reused " SIZE_T_FMT " of " SIZE_T_FMT " blocks",
+                proc->getReusedBlockCount(), regionCache->getBlockCount());
+        regionCache->save(regionCacheFile);
+    }
+    if (tileCost && success)
+        tileCost->save(tileCostFile);
+
+    return success;
 }
 
 void SamplingIntegrator::bindUsedResources(ParallelProcess *) const {
@@ -140,16 +347,26 @@ void SamplingIntegrator::wakeup(ConfigurableObject *parent,
 void SamplingIntegrator::renderBlock(const Scene *scene,
         const Sensor *sensor, Sampler *sampler, ImageBlock *block,
         const bool &stop, const std::vector< TPoint2<uint8_t> > &points) const {
+    renderBlockSamples(scene, sensor, sampler, block,
+        stop, points, 0, sampler->getSampleCount());
+}
+
+void SamplingIntegrator::renderBlockSamples(const Scene *scene,
+        const Sensor *sensor, Sampler *sampler, ImageBlock *block,
+        const bool &stop, const std::vector< TPoint2<uint8_t> > &points,
+        size_t firstSample, size_t sampleCount) const {
 
     Float diffScaleFactor = 1.0f /
         std::sqrt((Float) sampler->getSampleCount());
 
     bool needsApertureSample = sensor->needsApertureSample();
     bool needsTimeSample = sensor->needsTimeSample();
+    const ReconstructionFilter *rfilter = sensor->getFilm()->getReconstructionFilter();
+    bool importanceSampled = rfilter->isImportanceSampled();
 
     RadianceQueryRecord rRec(scene, sampler);
     Point2 apertureSample(0.5f);
-    Float timeSample = 0.5f;
+    Float timeSample = 0.5f, filterWeight;
     RayDifferential sensorRay;
 
     block->clear();
@@ -159,34 +376,216 @@ void SamplingIntegrator::renderBlock(const Scene *scene,
     if (!sensor->getFilm()->hasAlpha()) /* Don't compute an alpha channel if we don't have to */
         queryType &= ~RadianceQueryRecord::EOpacity;
 
+    /* Record per-pixel sample statistics if the block has a variance buffer */
+    bool recordVariance = block->hasVariance();
+
+    /* Storage for the first-hit AOVs (if requested) */
+    Spectrum aovs[RadianceQueryRecord::EAOVCount];
+    Float *temp = m_aovs ? (Float *) alloca(sizeof(Float) *
+        ((1 + RadianceQueryRecord::EAOVCount) * SPECTRUM_SAMPLES + 2)) : NULL;
+
+    bool hasSampleBudget = sensor->hasSampleBudget();
+
     for (size_t i = 0; i<points.size(); ++i) {
         Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
         if (stop)
             break;
 
+        /* Take only the first samples of the sequence in pixels that need fewer */
+        size_t pixelSampleCount = sampleCount;
+        Float pixelDiffScaleFactor = diffScaleFactor;
+        if (hasSampleBudget) {
+            size_t budget = std::max((size_t) 1, (size_t) std::ceil(
+                sensor->getSampleBudget(offset) * sampler->getSampleCount()));
+            pixelSampleCount = budget > firstSample
+                ? std::min(sampleCount, budget - firstSample) : 0;
+            pixelDiffScaleFactor = 1.0f / std::sqrt((Float) budget);
+        }
+
         sampler->generate(offset);
+        if (firstSample > 0)
+            sampler->setSampleIndex(firstSample);
 
-        for (size_t j = 0; j<sampler->getSampleCount(); j++) {
+        for (size_t j = 0; j<pixelSampleCount; j++) {
             rRec.newQuery(queryType, sensor->getMedium());
-            Point2 samplePos(Point2(offset) + Vector2(rRec.nextSample2D()));
+            Point2 samplePos(rfilter->samplePosition(offset,
+                rRec.nextSample2D(), filterWeight));
 
             if (needsApertureSample)
                 apertureSample = rRec.nextSample2D();
             if (needsTimeSample)
                 timeSample = rRec.nextSample1D();
 
+            /* Replay the sensor sample of a recorded primary hit */
+            PrimaryHitCache::Record *hit = m_primaryHits.get() ?
+                m_primaryHits->getRecord(offset, firstSample + j) : NULL;
+            bool replay = hit && m_primaryHits->isReplaying()
+                && hit->state != PrimaryHitCache::EEmpty;
+            if (replay) {
+                samplePos = hit->samplePos;
+                filterWeight = hit->filterWeight;
+                apertureSample = hit->apertureSample;
+                timeSample = hit->timeSample;
+            }
+
             Spectrum spec = sensor->sampleRayDifferential(
                 sensorRay, samplePos, apertureSample, timeSample);
 
-            sensorRay.scaleDifferential(diffScaleFactor);
+            sensorRay.scaleDifferential(pixelDiffScaleFactor);
+
+            if (replay) {
+                Intersection its;
+                if (m_primaryHits->get(*hit, sensorRay, its))
+                    rRec.setIntersection(sensorRay, its);
+            } else if (hit && !m_primaryHits->isReplaying()) {
+                rRec.rayIntersect(sensorRay);
+                m_primaryHits->put(hit, samplePos, filterWeight,
+                    apertureSample, timeSample, sensorRay, rRec.its);
+            }
 
+            if (m_aovs)
+                rRec.aovs = aovs;
             spec *= Li(sensorRay, rRec);
-            block->put(samplePos, spec, rRec.alpha);
+
+            bool valid = putSensorSample(block, importanceSampled, offset, samplePos,
+                filterWeight, spec, rRec.alpha, m_aovs ? aovs : NULL, temp);
+            if (valid && recordVariance)
+                block->putVariance(Point2i(points[i]), spec.getLuminance());
             sampler->advance();
         }
     }
 }
 
+void SamplingIntegrator::renderBlockStream(const Scene *scene,
+        const Sensor *sensor, Sampler *sampler, ImageBlock *block,
+        const bool &stop, const std::vector< TPoint2<uint8_t> > &points,
+        size_t firstSample, size_t sampleCount) const {
+
+    sampleCount = std::min(sampleCount, sampler->getSampleCount() - firstSample);
+
+    if (m_primaryHits.get() || sensor->hasSampleBudget()) {
+        /* The sensor rays are recorded or replayed one at a time, and
+           pixels with their own sample budget are rendered one by one */
+        SamplingIntegrator::renderBlockSamples(scene, sensor, sampler,
+            block, stop, points, firstSample, sampleCount);
+        return;
+    }
+
+    Float diffScaleFactor = 1.0f / std::sqrt((Float) sampler->getSampleCount());
+
+    bool needsApertureSample = sensor->needsApertureSample();
+    bool needsTimeSample = sensor->needsTimeSample();
+    const ReconstructionFilter *rfilter = sensor->getFilm()->getReconstructionFilter();
+    bool importanceSampled = rfilter->isImportanceSampled();
+
+    RadianceQueryRecord rRec(scene, sampler);
+
+    block->clear();
+
+    uint32_t queryType = RadianceQueryRecord::ESensorRay;
+
+    if (!sensor->getFilm()->hasAlpha()) /* Don't compute an alpha channel if we don't have to */
+        queryType &= ~RadianceQueryRecord::EOpacity;
+
+    /* Record per-pixel sample statistics if the block has a variance buffer */
+    bool recordVariance = block->hasVariance();
+
+    /* Number of pixels, whose sensor rays are generated and traced together */
+    size_t pixelsPerBatch = std::max((size_t) 1,
+        (size_t) MTS_SENSOR_RAY_BATCH / sampleCount);
+    size_t maxRays = pixelsPerBatch * sampleCount;
+
+    std::vector<RayDifferential> sensorRays(maxRays);
+    std::vector<Ray> rays(maxRays);
+    std::vector<Intersection> its(maxRays);
+    std::vector<Point2> samplePos(maxRays);
+    std::vector<Point2> apertureSamples(needsApertureSample ? maxRays : 0);
+    std::vector<Float> timeSamples(needsTimeSample ? maxRays : 0);
+    std::vector<Spectrum> weights(maxRays);
+    std::vector<Float> filterWeights(maxRays);
+
+    /* Storage for the first-hit AOVs (if requested) */
+    Spectrum aovs[RadianceQueryRecord::EAOVCount];
+    Float *temp = m_aovs ? (Float *) alloca(sizeof(Float) *
+        ((1 + RadianceQueryRecord::EAOVCount) * SPECTRUM_SAMPLES + 2)) : NULL;
+
+    for (size_t i = 0; i<points.size(); i += pixelsPerBatch) {
+        if (stop)
+            break;
+
+        size_t pixelCount = std::min(pixelsPerBatch, points.size() - i);
+
+        /* 1. Generate the sensor rays of all pixels in the batch: first
+              draw the samples, then let the sensor convert them at once */
+        size_t rayIndex = 0;
+        for (size_t k = 0; k<pixelCount; ++k) {
+            Point2i offset = Point2i(points[i+k]) + Vector2i(block->getOffset());
+            sampler->generate(offset);
+            if (firstSample > 0)
+                sampler->setSampleIndex(firstSample);
+
+            for (size_t j = 0; j<sampleCount; j++) {
+                rRec.newQuery(queryType, sensor->getMedium());
+                samplePos[rayIndex] = rfilter->samplePosition(offset,
+                    rRec.nextSample2D(), filterWeights[rayIndex]);
+
+                if (needsApertureSample)
+                    apertureSamples[rayIndex] = rRec.nextSample2D();
+                if (needsTimeSample)
+                    timeSamples[rayIndex] = rRec.nextSample1D();
+
+                ++rayIndex;
+                sampler->advance();
+            }
+        }
+
+        sensor->sampleRayDifferentials(rayIndex, &samplePos[0],
+            needsApertureSample ? &apertureSamples[0] : NULL,
+            needsTimeSample ? &timeSamples[0] : NULL,
+            &sensorRays[0], &weights[0]);
+
+        for (size_t k = 0; k<rayIndex; ++k) {
+            sensorRays[k].scaleDifferential(diffScaleFactor);
+            rays[k] = sensorRays[k];
+        }
+
+        /* 2. Trace them */
+        scene->rayIntersectStream(&rays[0], &its[0], rayIndex);
+
+        /* 3. Shade the intersections */
+        rayIndex = 0;
+        for (size_t k = 0; k<pixelCount; ++k) {
+            Point2i offset = Point2i(points[i+k]) + Vector2i(block->getOffset());
+            if (pixelCount > 1)
+                sampler->generate(offset);
+
+            for (size_t j = 0; j<sampleCount; j++) {
+                sampler->setSampleIndex(firstSample + j);
+                rRec.newQuery(queryType, sensor->getMedium());
+
+                /* Skip the sample dimensions used by the sensor */
+                rRec.nextSample2D();
+                if (needsApertureSample)
+                    rRec.nextSample2D();
+                if (needsTimeSample)
+                    rRec.nextSample1D();
+
+                rRec.setIntersection(sensorRays[rayIndex], its[rayIndex]);
+                if (m_aovs)
+                    rRec.aovs = aovs;
+                Spectrum spec = weights[rayIndex] * Li(sensorRays[rayIndex], rRec);
+
+                bool valid = putSensorSample(block, importanceSampled, offset,
+                    samplePos[rayIndex], filterWeights[rayIndex], spec, rRec.alpha,
+                    m_aovs ? aovs : NULL, temp);
+                if (valid && recordVariance)
+                    block->putVariance(Point2i(points[i+k]), spec.getLuminance());
+                ++rayIndex;
+            }
+        }
+    }
+}
+
 MonteCarloIntegrator::MonteCarloIntegrator(const Properties &props) : SamplingIntegrator(props) {
     /* Depth to begin using russian roulette */
     m_rrDepth = props.getInteger("rrDepth", 5);
@@ -217,6 +616,25 @@ MonteCarloIntegrator::MonteCarloIntegrator(const Properties &props) : SamplingIn
      */
     m_hideEmitters = props.getBoolean("hideEmitters", false);
 
+    /**
+     * When this flag is set to true, the ray differentials of the camera
+     * ray are propagated along the path as a ray cone, which becomes wider
+     * at every non-specular bounce. Texture lookups at indirect bounces
+     * then use coarse MIP map levels, which saves memory bandwidth.
+     */
+    m_rayCones = props.getBoolean("rayCones", false);
+
+    /**
+     * When this flag is set to true, the albedo, shading normal, distance
+     * and shape index of the first surface interaction are written into
+     * additional channels of a multi-channel film (e.g. for a denoiser)
+     */
+    m_aovs = props.getBoolean("aovs", false);
+
+    if (m_aovs && SPECTRUM_SAMPLES != 3)
+        Log(EError, "AOV output requires renderings to be done in RGB, since the "
+            "shading normals are stored as RGB values.");
+
     if (m_rrDepth <= 0)
         Log(EError, "'rrDepth' must be set to a value greater than zero!");
 
@@ -230,6 +648,7 @@ MonteCarloIntegrator::MonteCarloIntegrator(Stream *stream, InstanceManager *mana
     m_maxDepth = stream->readInt();
     m_strictNormals = stream->readBool();
     m_hideEmitters = stream->readBool();
+    m_rayCones = stream->readBool();
 }
 
 void MonteCarloIntegrator::serialize(Stream *stream, InstanceManager *manager) const {
@@ -238,6 +657,34 @@ void MonteCarloIntegrator::serialize(Stream *stream, InstanceManager *manager) c
     stream->writeInt(m_maxDepth);
     stream->writeBool(m_strictNormals);
     stream->writeBool(m_hideEmitters);
+    stream->writeBool(m_rayCones);
+}
+
+void RadianceQueryRecord::recordAOVs(const RayDifferential &ray) {
+    if (!aovs)
+        return;
+
+    if (its.isValid()) {
+        const BSDF *bsdf = its.getBSDF(ray);
+        aovs[EAOVAlbedo] = bsdf ? bsdf->getDiffuseReflectance(its) : Spectrum(0.0f);
+        aovs[EAOVNormal].fromLinearRGB(its.shFrame.n.x, its.shFrame.n.y, its.shFrame.n.z);
+        aovs[EAOVDepth] = Spectrum(its.t);
+
+        const ref_vector<Shape> &shapes = scene->getShapes();
+        aovs[EAOVShapeIndex] = Spectrum((Float) -1);
+        for (size_t i=0; i<shapes.size(); ++i) {
+            if (shapes[i] == its.shape) {
+                aovs[EAOVShapeIndex] = Spectrum((Float) i);
+                break;
+            }
+        }
+    } else {
+        aovs[EAOVAlbedo] = aovs[EAOVNormal] = aovs[EAOVDepth] = Spectrum(0.0f);
+        aovs[EAOVShapeIndex] = Spectrum((Float) -1);
+    }
+
+    /* Only the first interaction is recorded */
+    aovs = NULL;
 }
 
 std::string RadianceQueryRecord::toString() const {
@@ -18,6 +18,7 @@
 
 #include <mitsuba/render/irrcache.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/warp.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -26,6 +27,8 @@ HemisphereSampler::HemisphereSampler(uint32_t M, uint32_t N) : m_M(M), m_N(N) {
     m_uk = new Vector[m_N];
     m_vk = new Vector[m_N];
     m_vkMinus = new Vector[m_N];
+    m_samples = new Point2[m_N];
+    m_disk = new Point2[m_N];
     m_random = new Random();
 }
 
@@ -34,23 +37,29 @@ HemisphereSampler::~HemisphereSampler() {
     delete[] m_uk;
     delete[] m_vk;
     delete[] m_vkMinus;
+    delete[] m_samples;
+    delete[] m_disk;
 }
 
 void HemisphereSampler::generateDirections(const Intersection &its) {
     for (uint32_t j=0; j<m_M; j++) {
+        /* Sample uniformly wrt. projected solid angles: the stratified
+           samples are mapped to the unit disk (r^2 = sin^2 theta) in a
+           batch and then lifted onto the hemisphere */
         for (uint32_t k=0; k<m_N; k++) {
-            SampleEntry &entry = m_entries[j*m_N + k];
             Point2 sample(m_random->nextFloat(), m_random->nextFloat());
+            m_samples[k] = Point2((j+sample.x)/m_M, (k+sample.y)/m_N);
+        }
+        warp::squareToUniformDisk(m_N, m_samples, m_disk);
 
-            /* Sample uniformly wrt. projected solid angles */
-            Float sinTheta2 = (j+sample.x)/m_M,
+        for (uint32_t k=0; k<m_N; k++) {
+            SampleEntry &entry = m_entries[j*m_N + k];
+            Float sinTheta2 = m_samples[k].x,
                   cosTheta = math::safe_sqrt(1 - sinTheta2),
-                  sinTheta = std::sqrt(sinTheta2),
-                  sinPhi, cosPhi;
+                  sinTheta = std::sqrt(sinTheta2);
 
-            math::sincos(2*M_PI*(k+sample.y)/m_N, &sinPhi, &cosPhi);
             entry.d  = its.shFrame.toWorld(Vector(
-                sinTheta*cosPhi, sinTheta*sinPhi, cosTheta));
+                m_disk[k].x, m_disk[k].y, cosTheta));
             entry.cosTheta = cosTheta;
             entry.sinTheta = sinTheta;
             entry.dist = -1;
@@ -144,6 +153,29 @@ void HemisphereSampler::process(const Intersection &its) {
     m_E *= M_PI / (m_M*m_N);
 }
 
+/* Clamping recommended by Tabellion and Lamourlette ("An Approximate Global
+   Illumination System for Computer Generated Films"): bound the valid radius
+   of a record by multiples of the pixel footprint at its position */
+static void computeScreenClamp(const RayDifferential &ray, const Point &p,
+        const Normal &n, Float &R0_min, Float &R0_max) {
+    const Float d = -dot(n, Vector(p));
+    const Float txRecip = dot(n, ray.rxDirection),
+                tyRecip = dot(n, ray.ryDirection);
+    if (txRecip != 0 && tyRecip != 0) {
+        // Ray distances traveled
+        const Float tx = -(dot(n, Vector(ray.rxOrigin)) + d) /
+            txRecip;
+        const Float ty = -(dot(n, Vector(ray.ryOrigin)) + d) /
+            tyRecip;
+        Point px = ray.rxOrigin + ray.rxDirection * tx,
+              py = ray.ryOrigin + ray.ryDirection * ty;
+        Float sqrtArea = std::sqrt(cross(px-p, py-p).length())*2;
+
+        R0_min = 3.0f*sqrtArea;
+        R0_max = 20.0f*sqrtArea;
+    }
+}
+
 /* First pass of neighbor clamping */
 struct clamp_self_functor {
     clamp_self_functor(const Point &p, Float &R0) : p(p), R0(R0) {
@@ -221,7 +253,6 @@ IrradianceCache::IrradianceCache(const AABB &aabb)
  : m_octree(aabb) {
     /* Use the longest AABB axis as an estimate of the scene dimensions */
     m_sceneSize = (aabb.max-aabb.min)[aabb.getLargestAxis()];
-    m_mutex = new Mutex();
 
     /* Reasonable default settings */
     setQuality(1.0f);
@@ -232,14 +263,12 @@ IrradianceCache::IrradianceCache(const AABB &aabb)
 
 IrradianceCache::IrradianceCache(Stream *stream, InstanceManager *manager) :
     m_octree(AABB(stream)) {
-    m_mutex = new Mutex();
     m_kappa = stream->readFloat();
     m_sceneSize = stream->readFloat();
     m_clampScreen = stream->readBool();
     m_clampNeighbor = stream->readBool();
     m_useGradients = stream->readBool();
     size_t recordCount = stream->readSize();
-    m_records.reserve(recordCount);
     for (size_t i=0; i<recordCount; ++i) {
         Record *sample = new Record(stream);
         Float validRadius = sample->R0 / (2*m_kappa);
@@ -247,13 +276,60 @@ IrradianceCache::IrradianceCache(Stream *stream, InstanceManager *manager) :
             sample->p-Vector(1,1,1)*validRadius,
             sample->p+Vector(1,1,1)*validRadius
         ));
-        m_records.push_back(sample);
+        m_records.prepend(sample);
+    }
+}
+
+IrradianceCache::IrradianceCache(const IrradianceCache *cache, const Sensor *sensor)
+ : m_octree(cache->getAABB()) {
+    m_kappa = cache->m_kappa;
+    m_sceneSize = cache->m_sceneSize;
+    m_clampScreen = cache->m_clampScreen;
+    m_clampNeighbor = cache->m_clampNeighbor;
+    m_useGradients = cache->m_useGradients;
+
+    Float time = 0;
+    if (sensor)
+        time = sensor->getShutterOpen() + 0.5f * sensor->getShutterOpenTime();
+
+    const LockFreeList<Record *>::ListItem *item = cache->m_records.head();
+    while (item) {
+        Record *record = new Record(item->value);
+        if (sensor) {
+            /* Neighbor clamping only depends on the scene geometry and
+               is already accounted for in 'originalR0' */
+            record->R0_min = 0;
+            record->R0_max = std::numeric_limits<Float>::infinity();
+
+            DirectSamplingRecord dRec(record->p, time);
+            if (m_clampScreen && !sensor->sampleDirect(dRec, Point2(0.5f)).isZero()) {
+                RayDifferential ray;
+                sensor->sampleRayDifferential(ray, dRec.uv, Point2(0.5f), time);
+                computeScreenClamp(ray, record->p, record->n,
+                    record->R0_min, record->R0_max);
+            }
+            record->R0 = std::min(record->R0_max,
+                std::max(record->R0_min, record->originalR0));
+        }
+        insert(record);
+        item = item->next;
     }
 }
 
 IrradianceCache::~IrradianceCache() {
-    for (size_t i=0; i<m_records.size(); ++i)
-        delete m_records[i];
+    const LockFreeList<Record *>::ListItem *item = m_records.head();
+    while (item) {
+        delete item->value;
+        item = item->next;
+    }
+}
+
+size_t IrradianceCache::getRecordCount() const {
+    size_t count = 0;
+    for (const LockFreeList<Record *>::ListItem *item = m_records.head();
+            item; item = item->next)
+        ++count;
+    return count;
 }
 
 void IrradianceCache::serialize(Stream *stream, InstanceManager *manager) const {
@@ -263,9 +339,10 @@ void IrradianceCache::serialize(Stream *stream, InstanceManager *manager) const
     stream->writeBool(m_clampScreen);
     stream->writeBool(m_clampNeighbor);
     stream->writeBool(m_useGradients);
-    stream->writeSize(m_records.size());
-    for (uint32_t i=0; i<m_records.size(); ++i)
-        m_records[i]->serialize(stream);
+    stream->writeSize(getRecordCount());
+    for (const LockFreeList<Record *>::ListItem *item = m_records.head();
+            item; item = item->next)
+        item->value->serialize(stream);
 }
 
 IrradianceCache::Record *IrradianceCache::put(const RayDifferential &ray, const Intersection &its,
@@ -281,26 +358,8 @@ IrradianceCache::Record *IrradianceCache::put(const RayDifferential &ray, const
     }
     Float R0_min = 0, R0_max = std::numeric_limits<Float>::infinity();
 
-    /* Clamping recommended by Tabellion and Lamourlette ("An Approximate Global
-       Illumination System for Computer Generated Films") */
-    if (m_clampScreen && ray.hasDifferentials) {
-        const Float d = -dot(its.geoFrame.n, Vector(its.p));
-        const Float txRecip = dot(its.geoFrame.n, ray.rxDirection),
-                    tyRecip = dot(its.geoFrame.n, ray.ryDirection);
-        if (txRecip != 0 && tyRecip != 0) {
-            // Ray distances traveled
-            const Float tx = -(dot(its.geoFrame.n, Vector(ray.rxOrigin)) + d) /
-                txRecip;
-            const Float ty = -(dot(its.geoFrame.n, Vector(ray.ryOrigin)) + d) /
-                tyRecip;
-            Point px = ray.rxOrigin + ray.rxDirection * tx,
-                  py = ray.ryOrigin + ray.ryDirection * ty;
-            Float sqrtArea = std::sqrt(cross(px-its.p, py-its.p).length())*2;
-
-            R0_min = 3.0f*sqrtArea;
-            R0_max = 20.0f*sqrtArea;
-        }
-    }
+    if (m_clampScreen && ray.hasDifferentials)
+        computeScreenClamp(ray, its.p, its.geoFrame.n, R0_min, R0_max);
 
     if (m_useGradients) {
         /* Limit R0 by the gradient magnitude [Krivanek et al.] */
@@ -348,8 +407,7 @@ void IrradianceCache::insert(Record *record) {
         record->p-Vector(1,1,1)*validRadius,
         record->p+Vector(1,1,1)*validRadius
     ));
-    LockGuard lock(m_mutex);
-    m_records.push_back(record);
+    m_records.prepend(record);
 }
 
 static StatsCounter irradHits("Irradiance cache", "Hits");
@@ -373,7 +431,7 @@ bool IrradianceCache::get(const Intersection &its, Spectrum &E) const {
 std::string IrradianceCache::toString() const {
     std::ostringstream oss;
     oss << "IrradianceCache[" << endl
-        << "  records = " << m_records.size() << "," << endl
+        << "  records = " << getRecordCount() << "," << endl
         << "  quality = " << m_kappa << "," << endl
         << "  sceneSize = " << m_sceneSize << "," << endl
         << "  clampScreen = " << m_clampScreen << "," << endl
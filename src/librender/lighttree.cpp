@@ -0,0 +1,450 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/lighttree.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter avgCutSize("Lightcuts", "Average cut size", EAverage);
+static StatsCounter avgShadowRays("Lightcuts", "Average shadow rays per shading point", EAverage);
+
+namespace {
+    /// cos(max(0, a - b)) given the sines and cosines of a and b
+    inline Float cosSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+        if (cosA > cosB)
+            return 1.0f;
+        return cosA * cosB + sinA * sinB;
+    }
+
+    /// sin(max(0, a - b)) given the sines and cosines of a and b
+    inline Float sinSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+        if (cosA > cosB)
+            return 0.0f;
+        return sinA * cosB - cosA * sinB;
+    }
+}
+
+struct LightTree::Primitive {
+    /// Position (or propagation direction) of the VPL
+    Point p;
+    /// Normal of oriented VPLs
+    Vector n;
+    Spectrum intensity;
+    uint32_t index;
+    bool oriented;
+
+    inline Float coordinate(int axis) const {
+        return axis < 3 ? p[axis] : n[axis - 3];
+    }
+};
+
+struct LightTree::AxisPredicate {
+    int axis;
+
+    inline AxisPredicate(int axis) : axis(axis) { }
+
+    inline bool operator()(const Primitive &a, const Primitive &b) const {
+        return a.coordinate(axis) < b.coordinate(axis);
+    }
+};
+
+struct LightTree::CutEntry {
+    uint32_t node;
+    bool directional;
+    /// Upper bound on the error of the cluster's estimate
+    Float error;
+    /// Unscaled contribution of the representative VPL
+    Spectrum repValue;
+    /// Estimated contribution of the cluster
+    Spectrum estimate;
+
+    inline bool operator<(const CutEntry &entry) const {
+        return error < entry.error;
+    }
+};
+
+LightTree::LightTree(const std::deque<VPL> &vpls, Random *random)
+        : m_root(-1), m_directionalRoot(-1) {
+    ref<Timer> timer = new Timer();
+
+    std::vector<Primitive> prims, directionalPrims;
+    m_vpls.reserve(vpls.size());
+    AABB aabb;
+
+    for (size_t i=0; i<vpls.size(); ++i) {
+        Light light(vpls[i]);
+        const VPL &vpl = light.vpl;
+        const Float invPi = (Float) INV_PI;
+
+        /* Determine the emitted intensity along the normal, which is used to
+           bound the clusters and to choose their representatives */
+        if (vpl.type == ESurfaceVPL) {
+            const BSDF *bsdf = vpl.its.getBSDF();
+            BSDFSamplingRecord bRec(vpl.its, Vector(0, 0, 1), EImportance);
+            light.intensity = vpl.P * bsdf->eval(bRec);
+            light.oriented = true;
+            if (light.intensity.getLuminance() <= 0)
+                light.intensity = vpl.P * invPi;
+        } else if (vpl.type == EPointEmitterVPL) {
+            light.oriented = vpl.emitter->getType() & Emitter::EOnSurface;
+            PositionSamplingRecord pRec(vpl.its.time);
+            pRec.p = vpl.its.p;
+            pRec.n = vpl.its.shFrame.n;
+            pRec.measure = light.oriented ? EArea : EDiscrete;
+            DirectionSamplingRecord dRec(vpl.its.shFrame.n);
+            if (!light.oriented) {
+                /* The center of the sample space is a good guess for the
+                   main emission direction (e.g. of spot lights) */
+                vpl.emitter->sampleDirection(dRec, pRec, Point2(0.5f));
+            }
+            light.intensity = vpl.P * vpl.emitter->evalDirection(dRec, pRec);
+            if (light.intensity.getLuminance() <= 0)
+                light.intensity = vpl.P * (light.oriented ? invPi : (Float) INV_FOURPI);
+        } else {
+            light.intensity = vpl.P;
+            light.oriented = true;
+        }
+
+        if (light.intensity.getLuminance() <= 0)
+            continue;
+
+        Primitive prim;
+        prim.intensity = light.intensity;
+        prim.index = (uint32_t) m_vpls.size();
+        prim.oriented = light.oriented;
+        if (vpl.type == EDirectionalEmitterVPL) {
+            prim.p = Point(vpl.its.shFrame.n);
+            prim.n = vpl.its.shFrame.n;
+            directionalPrims.push_back(prim);
+        } else {
+            prim.p = vpl.its.p;
+            prim.n = light.oriented ? Vector(vpl.its.shFrame.n) : Vector(0.0f);
+            aabb.expandBy(prim.p);
+            prims.push_back(prim);
+        }
+        m_vpls.push_back(light);
+    }
+
+    m_nodes.reserve(2 * m_vpls.size());
+
+    /* Weight of the normals in the split heuristic (Walter et al.) */
+    Float normalScale = aabb.isValid() ? aabb.getExtents().length() : 0.0f;
+    if (!prims.empty())
+        m_root = (int) build(prims, 0, prims.size(), false, normalScale, random);
+    if (!directionalPrims.empty())
+        m_directionalRoot = (int) build(directionalPrims, 0,
+            directionalPrims.size(), true, 0.0f, random);
+
+    Log(EDebug, "Built a light tree over %i VPLs (%i directional, %i nodes) in %i ms",
+        (int) m_vpls.size(), (int) directionalPrims.size(), (int) m_nodes.size(),
+        timer->getMilliseconds());
+}
+
+uint32_t LightTree::build(std::vector<Primitive> &prims, size_t start,
+        size_t end, bool directional, Float normalScale, Random *random) {
+    uint32_t index = (uint32_t) m_nodes.size();
+    m_nodes.push_back(Node());
+
+    AABB aabb, normalAABB;
+    Vector axisSum(0.0f);
+    Spectrum intensity(0.0f);
+    bool omni = false;
+    for (size_t i=start; i<end; ++i) {
+        const Primitive &prim = prims[i];
+        aabb.expandBy(prim.p);
+        intensity += prim.intensity;
+        if (prim.oriented) {
+            normalAABB.expandBy(Point(prim.n));
+            axisSum += prim.n;
+        } else {
+            omni = true;
+        }
+    }
+
+    /* Bounding cone of the normals */
+    Vector axis(0, 0, 1);
+    Float cosThetaO = -1;
+    if (!omni && axisSum.lengthSquared() > 0) {
+        axis = normalize(axisSum);
+        cosThetaO = 1;
+        for (size_t i=start; i<end; ++i)
+            cosThetaO = std::min(cosThetaO, dot(axis, prims[i].n));
+        cosThetaO = std::max((Float) -1, cosThetaO - Epsilon);
+    }
+
+    Node &node = m_nodes[index];
+    node.aabb = aabb;
+    node.axis = axis;
+    node.cosThetaO = cosThetaO;
+    node.sinThetaO = math::safe_sqrt(1 - cosThetaO * cosThetaO);
+    node.intensity = intensity;
+    node.right = 0;
+
+    if (end - start == 1) {
+        node.vpl = prims[start].index;
+        return index;
+    }
+
+    /* Split at the median along the largest extent of the positions
+       and the (scaled) normals */
+    Vector extents = aabb.getExtents();
+    int bestAxis = 0;
+    Float bestExtent = -1;
+    for (int i=0; i<3; ++i) {
+        if (extents[i] > bestExtent) {
+            bestExtent = extents[i];
+            bestAxis = i;
+        }
+    }
+    if (!directional && normalAABB.isValid()) {
+        Vector normalExtents = normalAABB.getExtents() * normalScale;
+        for (int i=0; i<3; ++i) {
+            if (normalExtents[i] > bestExtent) {
+                bestExtent = normalExtents[i];
+                bestAxis = i + 3;
+            }
+        }
+    }
+
+    size_t mid = (start + end) / 2;
+    std::nth_element(prims.begin() + start, prims.begin() + mid,
+        prims.begin() + end, AxisPredicate(bestAxis));
+
+    uint32_t left = build(prims, start, mid, directional, normalScale, random);
+    uint32_t right = build(prims, mid, end, directional, normalScale, random);
+
+    /* Choose one of the children's representatives proportionally to
+       their intensity */
+    Float lumLeft = m_nodes[left].intensity.getLuminance(),
+          lumRight = m_nodes[right].intensity.getLuminance();
+    bool useLeft = random->nextFloat() * (lumLeft + lumRight) < lumLeft;
+
+    m_nodes[index].right = right;
+    m_nodes[index].vpl = m_nodes[useLeft ? left : right].vpl;
+    return index;
+}
+
+Spectrum LightTree::evalLight(const Scene *scene, const Intersection &its,
+        const BSDF *bsdf, const Light &light, Float minDist2) const {
+    const VPL &vpl = light.vpl;
+
+    if (vpl.type == EDirectionalEmitterVPL) {
+        Vector d = -vpl.its.shFrame.n;
+        BSDFSamplingRecord bRec(its, its.toLocal(d));
+        Spectrum f = bsdf->eval(bRec);
+        if (f.isZero())
+            return Spectrum(0.0f);
+        ++avgShadowRays;
+        if (scene->rayIntersect(Ray(its.p, d, Epsilon,
+                std::numeric_limits<Float>::infinity(), its.time)))
+            return Spectrum(0.0f);
+        return vpl.P * f;
+    }
+
+    Vector d = vpl.its.p - its.p;
+    Float dist2 = d.lengthSquared(), dist = std::sqrt(dist2);
+    if (dist == 0)
+        return Spectrum(0.0f);
+    d /= dist;
+
+    Spectrum emitted;
+    if (vpl.type == ESurfaceVPL) {
+        BSDFSamplingRecord bRec(vpl.its, vpl.its.toLocal(-d), EImportance);
+        emitted = vpl.its.getBSDF()->eval(bRec);
+    } else {
+        PositionSamplingRecord pRec(vpl.its.time);
+        pRec.p = vpl.its.p;
+        pRec.n = vpl.its.shFrame.n;
+        pRec.measure = light.oriented ? EArea : EDiscrete;
+        DirectionSamplingRecord dRec(-d);
+        emitted = vpl.emitter->evalDirection(dRec, pRec);
+    }
+    if (emitted.isZero())
+        return Spectrum(0.0f);
+
+    BSDFSamplingRecord bRec(its, its.toLocal(d));
+    Spectrum f = bsdf->eval(bRec);
+    if (f.isZero())
+        return Spectrum(0.0f);
+
+    ++avgShadowRays;
+    if (scene->rayIntersect(Ray(its.p, d, Epsilon, dist * (1 - ShadowEpsilon), its.time)))
+        return Spectrum(0.0f);
+
+    return vpl.P * emitted * f / std::max(dist2, minDist2);
+}
+
+Float LightTree::errorBound(const Intersection &its, const BSDF *bsdf,
+        const Node &node, bool directional, Float minDist2) const {
+    Vector wi;
+    Float sinThetaB, cosThetaB, geometric = 1, cosLight = 1;
+
+    if (directional) {
+        /* The directions towards the VPLs are bounded by the reversed cone */
+        wi = -node.axis;
+        sinThetaB = node.sinThetaO;
+        cosThetaB = node.cosThetaO;
+    } else {
+        Float dist2 = node.aabb.squaredDistanceTo(its.p);
+        if (std::max(dist2, minDist2) == 0)
+            return std::numeric_limits<Float>::infinity();
+        geometric = 1 / std::max(dist2, minDist2);
+
+        /* Angle subtended by the cluster's bounding sphere */
+        Vector d = node.aabb.getCenter() - its.p;
+        Float dc2 = d.lengthSquared();
+        Float radius2 = 0.25f * node.aabb.getExtents().lengthSquared();
+        if (dc2 > radius2 && dc2 > 0) {
+            Float sin2ThetaB = radius2 / dc2;
+            sinThetaB = std::sqrt(sin2ThetaB);
+            cosThetaB = math::safe_sqrt(1 - sin2ThetaB);
+            wi = d / std::sqrt(dc2);
+        } else {
+            sinThetaB = 0;
+            cosThetaB = -1;
+            wi = its.shFrame.n;
+        }
+
+        if (node.cosThetaO > -1) {
+            /* Smallest angle between the cone of normals and the directions
+               towards the shading point */
+            Float cosThetaW = -dot(node.axis, wi);
+            Float sinThetaW = math::safe_sqrt(1 - cosThetaW * cosThetaW);
+            Float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, node.sinThetaO, node.cosThetaO);
+            Float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, node.sinThetaO, node.cosThetaO);
+            cosLight = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+            if (cosLight <= 0)
+                return 0.0f;
+        }
+    }
+
+    /* Smallest angle between the shading normal and the directions
+       towards the VPLs */
+    Float cosThetaI = dot(its.shFrame.n, wi);
+    if (bsdf->getType() & BSDF::ETransmission)
+        cosThetaI = std::abs(cosThetaI);
+    Float sinThetaI = math::safe_sqrt(1 - cosThetaI * cosThetaI);
+    Float cosReceiver = cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    if (cosReceiver <= 0)
+        return 0.0f;
+
+    /* Bound on the material (exact for diffuse BSDFs) */
+    Spectrum material = bsdf->getDiffuseReflectance(its) * INV_PI;
+    if ((bsdf->getType() & BSDF::EAll) != BSDF::EDiffuseReflection) {
+        BSDFSamplingRecord bRec(its, its.toLocal(wi));
+        Float cosTheta = std::abs(Frame::cosTheta(bRec.wo));
+        if (cosTheta > Epsilon) {
+            Spectrum f = bsdf->eval(bRec) / cosTheta;
+            for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+                material[i] = std::max(material[i], f[i]);
+        }
+    }
+
+    return Spectrum(node.intensity * material).getLuminance()
+        * geometric * cosLight * cosReceiver;
+}
+
+Spectrum LightTree::eval(const Scene *scene, const Intersection &its,
+        Float relError, size_t maxCutSize, Float minDist) const {
+    const BSDF *bsdf = its.getBSDF();
+    Float minDist2 = minDist * minDist;
+    if (!(bsdf->getType() & BSDF::ESmooth))
+        return Spectrum(0.0f);
+
+    std::vector<CutEntry> cut;
+    cut.reserve(std::min(maxCutSize, (size_t) 64) + 1);
+    Spectrum total(0.0f);
+
+    avgShadowRays.incrementBase();
+
+    for (int i=0; i<2; ++i) {
+        int root = i == 0 ? m_root : m_directionalRoot;
+        if (root < 0)
+            continue;
+        const Node &node = m_nodes[root];
+        const Light &rep = m_vpls[node.vpl];
+        CutEntry entry;
+        entry.node = (uint32_t) root;
+        entry.directional = i == 1;
+        entry.repValue = evalLight(scene, its, bsdf, rep, minDist2);
+        entry.estimate = entry.repValue * (node.intensity.getLuminance()
+            / rep.intensity.getLuminance());
+        entry.error = node.right == 0 ? 0.0f
+            : errorBound(its, bsdf, node, entry.directional, minDist2);
+        total += entry.estimate;
+        cut.push_back(entry);
+        std::push_heap(cut.begin(), cut.end());
+    }
+
+    /* Refine the cluster with the largest error bound until all of them
+       are small compared to the total */
+    while (!cut.empty() && cut.size() < maxCutSize) {
+        const CutEntry &top = cut.front();
+        if (top.error <= 0 || top.error <= relError * total.getLuminance())
+            break;
+
+        std::pop_heap(cut.begin(), cut.end());
+        CutEntry parent = cut.back();
+        cut.pop_back();
+        total -= parent.estimate;
+
+        const Node &parentNode = m_nodes[parent.node];
+        uint32_t children[2] = { parent.node + 1, parentNode.right };
+        for (int i=0; i<2; ++i) {
+            const Node &node = m_nodes[children[i]];
+            const Light &rep = m_vpls[node.vpl];
+            CutEntry entry;
+            entry.node = children[i];
+            entry.directional = parent.directional;
+            /* The representative is shared with one of the children */
+            entry.repValue = node.vpl == parentNode.vpl ? parent.repValue
+                : evalLight(scene, its, bsdf, rep, minDist2);
+            entry.estimate = entry.repValue * (node.intensity.getLuminance()
+                / rep.intensity.getLuminance());
+            entry.error = node.right == 0 ? 0.0f
+                : errorBound(its, bsdf, node, entry.directional, minDist2);
+            total += entry.estimate;
+            cut.push_back(entry);
+            std::push_heap(cut.begin(), cut.end());
+        }
+    }
+
+    /* Sum up the final cut to avoid accumulated round-off errors */
+    Spectrum result(0.0f);
+    for (size_t i=0; i<cut.size(); ++i)
+        result += cut[i].estimate;
+
+    avgCutSize.incrementBase();
+    avgCutSize += cut.size();
+
+    return result;
+}
+
+std::string LightTree::toString() const {
+    std::ostringstream oss;
+    oss << "LightTree[" << endl
+        << "  vplCount = " << m_vpls.size() << "," << endl
+        << "  nodeCount = " << m_nodes.size() << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(LightTree, false, Object)
+MTS_NAMESPACE_END
@@ -1,4 +1,7 @@
 #include <mitsuba/render/noise.h>
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
 
 MTS_NAMESPACE_BEGIN
 
@@ -100,11 +103,15 @@ Float Noise::perlinNoise(const Point &p) {
     return math::lerp(wz, y0, y1);
 }
 
+Float Noise::getOctaveCount(const Vector &dpdx, const Vector &dpdy, int maxOctaves) {
+    Float s2 = std::max(dpdx.lengthSquared(), dpdy.lengthSquared());
+    return std::min((Float) maxOctaves, 1.f - .5f * math::log2(s2));
+}
+
 Float Noise::fbm(const Point &p, const Vector &dpdx,
         const Vector &dpdy, Float omega, int maxOctaves) {
     // Compute number of octaves for antialiased FBm
-    Float s2 = std::max(dpdx.lengthSquared(), dpdy.lengthSquared());
-    Float foctaves = std::min((Float) maxOctaves, 1.f - .5f * math::log2(s2));
+    Float foctaves = getOctaveCount(dpdx, dpdy, maxOctaves);
     int octaves = (int) foctaves;
 
     // Compute sum of octaves of noise for FBm
@@ -123,8 +130,7 @@ Float Noise::fbm(const Point &p, const Vector &dpdx,
 Float Noise::turbulence(const Point &p, const Vector &dpdx,
         const Vector &dpdy, Float omega, int maxOctaves) {
     // Compute number of octaves for antialiased FBm
-    Float s2 = std::max(dpdx.lengthSquared(), dpdy.lengthSquared());
-    Float foctaves = std::min((Float) maxOctaves, 1.f - .5f * math::log2(s2));
+    Float foctaves = getOctaveCount(dpdx, dpdy, maxOctaves);
     int octaves = (int) foctaves;
 
     // Compute sum of octaves of noise for turbulence
@@ -140,4 +146,210 @@ Float Noise::turbulence(const Point &p, const Vector &dpdx,
     return sum;
 }
 
+#if defined(MTS_SSE)
+namespace {
+    inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    inline __m128 lerp(__m128 t, __m128 v1, __m128 v2) {
+        return _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), t), v1),
+            _mm_mul_ps(t, v2));
+    }
+
+    /// Floor the lanes of \c x (returns the integer part in \c ix)
+    inline __m128 floorToInt(__m128 x, __m128i &ix) {
+        ix = _mm_cvttps_epi32(x);
+        __m128 fx = _mm_cvtepi32_ps(ix), mask = _mm_cmpgt_ps(fx, x);
+        /* Truncation rounds negative values up; correct by one */
+        ix = _mm_add_epi32(ix, _mm_castps_si128(mask));
+        return _mm_sub_ps(fx, _mm_and_ps(mask, _mm_set1_ps(1.0f)));
+    }
+
+    /// Vectorized version of \ref grad() given four hash values
+    inline __m128 grad(__m128i h, __m128 dx, __m128 dy, __m128 dz) {
+        h = _mm_and_si128(h, _mm_set1_epi32(15));
+        __m128 lt4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4))),
+               lt8 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8)));
+#if defined(GRAD_PERLIN)
+        __m128 other = _mm_castsi128_ps(_mm_or_si128(
+            _mm_cmpeq_epi32(h, _mm_set1_epi32(12)),
+            _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+        __m128 u = select(lt8, dx, dy),
+               v = select(lt4, dy, select(other, dx, dz));
+#elif defined(GRAD_PBRT)
+        __m128 other = _mm_castsi128_ps(_mm_or_si128(
+            _mm_cmpeq_epi32(h, _mm_set1_epi32(12)),
+            _mm_cmpeq_epi32(h, _mm_set1_epi32(13))));
+        __m128 u = select(_mm_or_ps(lt8, other), dx, dy),
+               v = select(_mm_or_ps(lt4, other), dy, dz);
+#endif
+        /* Move bits 0 and 1 of the hash into the sign bit */
+        u = _mm_xor_ps(u, _mm_castsi128_ps(_mm_slli_epi32(h, 31)));
+        v = _mm_xor_ps(v, _mm_castsi128_ps(_mm_slli_epi32(
+            _mm_srli_epi32(h, 1), 31)));
+        return _mm_add_ps(u, v);
+    }
+
+    inline __m128 noiseWeight(__m128 t) {
+        __m128 t3 = _mm_mul_ps(_mm_mul_ps(t, t), t),
+               t4 = _mm_mul_ps(t3, t), t5 = _mm_mul_ps(t4, t);
+        return _mm_add_ps(_mm_sub_ps(
+            _mm_mul_ps(_mm_set1_ps(6.0f), t5),
+            _mm_mul_ps(_mm_set1_ps(15.0f), t4)),
+            _mm_mul_ps(_mm_set1_ps(10.0f), t3));
+    }
+
+    /// Evaluate the Perlin noise function at four points
+    __m128 perlinNoise(__m128 x, __m128 y, __m128 z) {
+        __m128i ix, iy, iz;
+        __m128 dx = _mm_sub_ps(x, floorToInt(x, ix)),
+               dy = _mm_sub_ps(y, floorToInt(y, iy)),
+               dz = _mm_sub_ps(z, floorToInt(z, iz));
+
+        /* The permutation table lookups are done one lane at a time */
+        const __m128i mask = _mm_set1_epi32(NOISE_PERM_SIZE-1);
+        SSEVector cx, cy, cz, h[8];
+        cx.pi = _mm_and_si128(ix, mask);
+        cy.pi = _mm_and_si128(iy, mask);
+        cz.pi = _mm_and_si128(iz, mask);
+        for (int i=0; i<4; ++i) {
+            int a  = NoisePerm[cx.i[i]]   + cy.i[i],
+                b  = NoisePerm[cx.i[i]+1] + cy.i[i],
+                aa = NoisePerm[a]   + cz.i[i], ab = NoisePerm[a+1] + cz.i[i],
+                ba = NoisePerm[b]   + cz.i[i], bb = NoisePerm[b+1] + cz.i[i];
+            h[0].i[i] = NoisePerm[aa];   h[1].i[i] = NoisePerm[ba];
+            h[2].i[i] = NoisePerm[ab];   h[3].i[i] = NoisePerm[bb];
+            h[4].i[i] = NoisePerm[aa+1]; h[5].i[i] = NoisePerm[ba+1];
+            h[6].i[i] = NoisePerm[ab+1]; h[7].i[i] = NoisePerm[bb+1];
+        }
+
+        const __m128 one = _mm_set1_ps(1.0f);
+        __m128 dx1 = _mm_sub_ps(dx, one),
+               dy1 = _mm_sub_ps(dy, one),
+               dz1 = _mm_sub_ps(dz, one);
+
+        __m128 w000 = grad(h[0].pi, dx,  dy,  dz),
+               w100 = grad(h[1].pi, dx1, dy,  dz),
+               w010 = grad(h[2].pi, dx,  dy1, dz),
+               w110 = grad(h[3].pi, dx1, dy1, dz),
+               w001 = grad(h[4].pi, dx,  dy,  dz1),
+               w101 = grad(h[5].pi, dx1, dy,  dz1),
+               w011 = grad(h[6].pi, dx,  dy1, dz1),
+               w111 = grad(h[7].pi, dx1, dy1, dz1);
+
+        __m128 wx = noiseWeight(dx),
+               wy = noiseWeight(dy),
+               wz = noiseWeight(dz);
+
+        __m128 x00 = lerp(wx, w000, w100),
+               x10 = lerp(wx, w010, w110),
+               x01 = lerp(wx, w001, w101),
+               x11 = lerp(wx, w011, w111),
+               y0 = lerp(wy, x00, x10),
+               y1 = lerp(wy, x01, x11);
+
+        return lerp(wz, y0, y1);
+    }
+
+    /// Load four points and split them into x, y and z lanes
+    inline void loadPoints(const Point *p, __m128 &x, __m128 &y, __m128 &z) {
+        x = _mm_setr_ps(p[0].x, p[1].x, p[2].x, p[3].x);
+        y = _mm_setr_ps(p[0].y, p[1].y, p[2].y, p[3].y);
+        z = _mm_setr_ps(p[0].z, p[1].z, p[2].z, p[3].z);
+    }
+
+    /// Sum of the octaves of noise at four points (see \ref Noise::fbm())
+    template <bool Turbulence> __m128 fbm(__m128 x, __m128 y, __m128 z,
+            Float omega, int octaves, Float partialWeight) {
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        __m128 sum = _mm_setzero_ps();
+        Float lambda = 1, o = 1;
+        for (int i = 0; i <= octaves; ++i) {
+            Float weight = i < octaves ? o : o * partialWeight;
+            if (weight == 0)
+                break;
+            __m128 l = _mm_set1_ps(lambda),
+                   value = perlinNoise(_mm_mul_ps(l, x),
+                       _mm_mul_ps(l, y), _mm_mul_ps(l, z));
+            if (Turbulence)
+                value = _mm_and_ps(value, absMask);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weight), value));
+            lambda *= 1.99f;
+            o *= omega;
+        }
+        return sum;
+    }
+};
+#endif
+
+void Noise::perlinNoise(size_t count, const Point *p, Float *result) {
+    size_t i = 0;
+#if defined(MTS_SSE)
+    for (; i + 4 <= count; i += 4) {
+        __m128 x, y, z;
+        loadPoints(p + i, x, y, z);
+        _mm_storeu_ps(result + i, mitsuba::perlinNoise(x, y, z));
+    }
+#endif
+    for (; i < count; ++i)
+        result[i] = perlinNoise(p[i]);
+}
+
+void Noise::fbm(size_t count, const Point *p, Float *result,
+        Float omega, Float foctaves) {
+    int octaves = (int) foctaves;
+    Float partialWeight = math::smoothStep((Float) .3f,
+        (Float) .7f, foctaves - octaves);
+
+    size_t i = 0;
+#if defined(MTS_SSE)
+    for (; i + 4 <= count; i += 4) {
+        __m128 x, y, z;
+        loadPoints(p + i, x, y, z);
+        _mm_storeu_ps(result + i, mitsuba::fbm<false>(x, y, z,
+            omega, octaves, partialWeight));
+    }
+#endif
+    for (; i < count; ++i) {
+        Float sum = 0., lambda = 1., o = 1.;
+        for (int j = 0; j < octaves; ++j) {
+            sum += o * perlinNoise(lambda * p[i]);
+            lambda *= 1.99f;
+            o *= omega;
+        }
+        if (partialWeight != 0)
+            sum += o * partialWeight * perlinNoise(lambda * p[i]);
+        result[i] = sum;
+    }
+}
+
+void Noise::turbulence(size_t count, const Point *p, Float *result,
+        Float omega, Float foctaves) {
+    int octaves = (int) foctaves;
+    Float partialWeight = math::smoothStep((Float) .3f,
+        (Float) .7f, foctaves - octaves);
+
+    size_t i = 0;
+#if defined(MTS_SSE)
+    for (; i + 4 <= count; i += 4) {
+        __m128 x, y, z;
+        loadPoints(p + i, x, y, z);
+        _mm_storeu_ps(result + i, mitsuba::fbm<true>(x, y, z,
+            omega, octaves, partialWeight));
+    }
+#endif
+    for (; i < count; ++i) {
+        Float sum = 0., lambda = 1., o = 1.;
+        for (int j = 0; j < octaves; ++j) {
+            sum += o * std::abs(perlinNoise(lambda * p[i]));
+            lambda *= 1.99f;
+            o *= omega;
+        }
+        if (partialWeight != 0)
+            sum += o * partialWeight * std::abs(perlinNoise(lambda * p[i]));
+        result[i] = sum;
+    }
+}
+
 MTS_NAMESPACE_END
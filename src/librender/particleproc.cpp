@@ -163,6 +163,10 @@ void ParticleTracer::process(const WorkUnit *workUnit, WorkResult *workResult,
         while (!throughput.isZero() && (depth <= m_maxDepth || m_maxDepth < 0)) {
             m_scene->rayIntersectAll(ray, its);
 
+            if (medium)
+                handleMediumSegment(depth, nullInteractions, delta,
+                    Ray(ray, ray.mint, its.t), medium, throughput*power);
+
             /* ==================================================================== */
             /*                 Radiative Transfer Equation sampling                 */
             /* ==================================================================== */
@@ -278,6 +282,10 @@ void ParticleTracer::handleMediumInteraction(int depth, int nullInteractions,
     bool delta, const MediumSamplingRecord &mRec, const Medium *medium,
     const Vector &wi, const Spectrum &weight) { }
 
+void ParticleTracer::handleMediumSegment(int depth, int nullInteractions,
+    bool delta, const Ray &ray, const Medium *medium,
+    const Spectrum &weight) { }
+
 MTS_IMPLEMENT_CLASS(RangeWorkUnit, false, WorkUnit)
 MTS_IMPLEMENT_CLASS(ParticleProcess, true, ParallelProcess)
 MTS_IMPLEMENT_CLASS(ParticleTracer, true, WorkProcessor)
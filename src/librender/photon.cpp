@@ -20,41 +20,45 @@
 
 MTS_NAMESPACE_BEGIN
 
-Float Photon::m_cosTheta[256];
-Float Photon::m_sinTheta[256];
-Float Photon::m_cosPhi[256];
-Float Photon::m_sinPhi[256];
 Float Photon::m_expTable[256];
 
 bool Photon::m_precompTableReady = Photon::createPrecompTables();
 
 bool Photon::createPrecompTables() {
-    for (int i=0; i<256; i++) {
-        Float angle = (Float) i * ((Float) M_PI / 256.0f);
-        m_cosPhi[i] = std::cos(2.0f * angle);
-        m_sinPhi[i] = std::sin(2.0f * angle);
-        m_cosTheta[i] = std::cos(angle);
-        m_sinTheta[i] = std::sin(angle);
+    for (int i=0; i<256; i++)
         m_expTable[i] = std::ldexp((Float) 1, i - (128+8));
-    }
     m_expTable[0] = 0;
 
     return true;
 }
 
+void Photon::encodeOctahedral(const Vector &v, uint8_t result[2]) {
+    Float norm = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (norm == 0) {
+        /* Degenerate vector (e.g. the normal of a volume photon) */
+        result[0] = result[1] = 128;
+        return;
+    }
+
+    Float x = v.x / norm, y = v.y / norm;
+    if (v.z < 0) {
+        /* Fold the lower hemisphere over the diagonals */
+        Float tx = x;
+        x = math::signum(x) * (1.0f - std::abs(y));
+        y = math::signum(y) * (1.0f - std::abs(tx));
+    }
+
+    result[0] = (uint8_t) math::clamp(math::roundToInt((x + 1.0f) * 127.5f), 0, 255);
+    result[1] = (uint8_t) math::clamp(math::roundToInt((y + 1.0f) * 127.5f), 0, 255);
+}
+
 Photon::Photon(Stream *stream) {
     position = Point(stream);
     if (!leftBalancedLayout)
         setRightIndex(0, stream->readUInt());
-#if defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
-    stream->read(data.power, 8);
-#else
-    data.power = Spectrum(stream);
-    data.phi = stream->readUChar();
-    data.theta = stream->readUChar();
-    data.phiN = stream->readUChar();
-    data.thetaN = stream->readUChar();
-#endif
+    stream->read(data.power, sizeof(data.power));
+    stream->read(data.dir, sizeof(data.dir));
+    stream->read(data.normal, sizeof(data.normal));
     data.depth = stream->readUShort();
     flags = stream->readUChar();
 }
@@ -63,15 +67,9 @@ void Photon::serialize(Stream *stream) const {
     position.serialize(stream);
     if (!leftBalancedLayout)
         stream->writeUInt(getRightIndex(0));
-    #if defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
-        stream->write(data.power, 8);
-    #else
-        data.power.serialize(stream);
-        stream->writeUChar(data.phi);
-        stream->writeUChar(data.theta);
-        stream->writeUChar(data.phiN);
-        stream->writeUChar(data.thetaN);
-    #endif
+    stream->write(data.power, sizeof(data.power));
+    stream->write(data.dir, sizeof(data.dir));
+    stream->write(data.normal, sizeof(data.normal));
     stream->writeUShort(data.depth);
     stream->writeUChar(flags);
 }
@@ -87,37 +85,27 @@ Photon::Photon(const Point &p, const Normal &normal,
     data.depth = _depth;
     flags = 0;
 
-    /* Convert the direction into an approximate spherical
-       coordinate format to reduce storage requirements */
-    data.theta = (uint8_t) std::min(255,
-        (int) (math::safe_acos(dir.z) * (256.0 / M_PI)));
-
-    int tmp = std::min(255,
-        (int) (std::atan2(dir.y, dir.x) * (256.0 / (2.0 * M_PI))));
-    if (tmp < 0)
-        data.phi = (uint8_t) (tmp + 256);
-    else
-        data.phi = (uint8_t) tmp;
-
-    if (normal.isZero()) {
-        data.thetaN = data.phiN = 0;
+    /* Quantize the direction and normal to reduce storage requirements */
+    encodeOctahedral(dir, data.dir);
+    encodeOctahedral(normal, data.normal);
+
+    /* Store the photon power using 8-bit mantissas and a shared exponent
+       (based on Bruce Walter's and Greg Ward's RGBE code) */
+    Float max = 0;
+    for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+        max = std::max(max, P[i]);
+    if (max < 1e-32) {
+        memset(data.power, 0, sizeof(data.power));
     } else {
-        data.thetaN = (uint8_t) std::min(255,
-            (int) (math::safe_acos(normal.z) * (256.0 / M_PI)));
-        tmp = std::min(255,
-            (int) (std::atan2(normal.y, normal.x) * (256.0 / (2.0 * M_PI))));
-        if (tmp < 0)
-            data.phiN = (uint8_t) (tmp + 256);
-        else
-            data.phiN = (uint8_t) tmp;
+        int e;
+        /* Extract exponent and convert the fractional part into
+           the [0..255] range. Afterwards, divide by max so that
+           any component multiplied by the result will be in [0,255] */
+        Float scale = std::frexp(max, &e) * (Float) 256 / max;
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            data.power[i] = (uint8_t) (std::max((Float) 0, P[i]) * scale);
+        data.power[SPECTRUM_SAMPLES] = (uint8_t) (e + 128);
     }
-
-#if defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
-    /* Pack the photon power into Greg Ward's RGBE format */
-    P.toRGBE(data.power);
-#else
-    data.power = P;
-#endif
 }
 
 std::string Photon::toString() const {
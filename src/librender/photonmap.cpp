@@ -19,10 +19,13 @@
 #include <mitsuba/render/photonmap.h>
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/phase.h>
+#include <mitsuba/core/statistics.h>
 #include <fstream>
 
 MTS_NAMESPACE_BEGIN
 
+static StatsCounter statsPhotonMemory("Photon map", "Memory per stored photon (bytes)", EAverage);
+
 PhotonMap::PhotonMap(size_t photonCount)
         : m_kdtree(0, PhotonTree::ESlidingMidpoint), m_scale(1.0f) {
     m_kdtree.reserve(photonCount);
@@ -55,6 +58,12 @@ void PhotonMap::serialize(Stream *stream, InstanceManager *manager) const {
 PhotonMap::~PhotonMap() {
 }
 
+void PhotonMap::build(bool recomputeAABB) {
+    m_kdtree.build(recomputeAABB);
+    statsPhotonMemory += m_kdtree.size() * sizeof(Photon);
+    statsPhotonMemory.incrementBase(m_kdtree.size());
+}
+
 std::string PhotonMap::toString() const {
     std::ostringstream oss;
     oss << "PhotonMap[" << endl
@@ -0,0 +1,272 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/raybatch.h>
+#include <mitsuba/render/scene.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Marks rays that didn't hit anything
+#define RAYBATCH_MISS 0xFFFFFFFFu
+
+/// A chunk of rays (origin and direction of every ray)
+class RayBatchWorkUnit : public WorkUnit {
+public:
+    inline RayBatchWorkUnit() : m_start(0) { }
+
+    inline void setStart(size_t start) { m_start = start; }
+    inline size_t getStart() const { return m_start; }
+
+    /// Return the rays (6 values per ray: origin followed by direction)
+    inline std::vector<Float> &getRays() { return m_rays; }
+    inline const std::vector<Float> &getRays() const { return m_rays; }
+    inline size_t getSize() const { return m_rays.size() / 6; }
+
+    void set(const WorkUnit *workUnit) {
+        const RayBatchWorkUnit *wu = static_cast<const RayBatchWorkUnit *>(workUnit);
+        m_start = wu->m_start;
+        m_rays = wu->m_rays;
+    }
+
+    void load(Stream *stream) {
+        m_start = stream->readSize();
+        m_rays.resize(stream->readSize() * 6);
+        if (!m_rays.empty())
+            stream->readFloatArray(&m_rays[0], m_rays.size());
+    }
+
+    void save(Stream *stream) const {
+        stream->writeSize(m_start);
+        stream->writeSize(getSize());
+        if (!m_rays.empty())
+            stream->writeFloatArray(&m_rays[0], m_rays.size());
+    }
+
+    std::string toString() const {
+        return formatString("RayBatchWorkUnit[start=" SIZE_T_FMT ", size=" SIZE_T_FMT "]",
+            m_start, getSize());
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~RayBatchWorkUnit() { }
+private:
+    size_t m_start;
+    std::vector<Float> m_rays;
+};
+
+/// Intersection results of a chunk of rays
+class RayBatchResult : public WorkResult {
+public:
+    inline RayBatchResult() : m_start(0) { }
+
+    inline void setStart(size_t start) { m_start = start; }
+    inline size_t getStart() const { return m_start; }
+
+    inline void setSize(size_t size) {
+        m_t.resize(size);
+        m_indices.resize(size * 2);
+        m_uvNormals.resize(size * 5);
+    }
+
+    inline size_t getSize() const { return m_t.size(); }
+
+    inline void put(size_t i, Float t, uint32_t shapeIndex, uint32_t primIndex,
+            const Point2 &uv, const Normal &n) {
+        m_t[i] = t;
+        m_indices[2*i] = shapeIndex;
+        m_indices[2*i+1] = primIndex;
+        Float *uvn = &m_uvNormals[5*i];
+        uvn[0] = uv.x; uvn[1] = uv.y;
+        uvn[2] = n.x; uvn[3] = n.y; uvn[4] = n.z;
+    }
+
+    inline Float getT(size_t i) const { return m_t[i]; }
+    inline uint32_t getShapeIndex(size_t i) const { return m_indices[2*i]; }
+    inline uint32_t getPrimIndex(size_t i) const { return m_indices[2*i+1]; }
+    inline const Float *getUV(size_t i) const { return &m_uvNormals[5*i]; }
+    inline const Float *getNormal(size_t i) const { return &m_uvNormals[5*i+2]; }
+
+    void load(Stream *stream) {
+        m_start = stream->readSize();
+        setSize(stream->readSize());
+        if (m_t.empty())
+            return;
+        stream->readFloatArray(&m_t[0], m_t.size());
+        stream->readUIntArray(&m_indices[0], m_indices.size());
+        stream->readFloatArray(&m_uvNormals[0], m_uvNormals.size());
+    }
+
+    void save(Stream *stream) const {
+        stream->writeSize(m_start);
+        stream->writeSize(m_t.size());
+        if (m_t.empty())
+            return;
+        stream->writeFloatArray(&m_t[0], m_t.size());
+        stream->writeUIntArray(&m_indices[0], m_indices.size());
+        stream->writeFloatArray(&m_uvNormals[0], m_uvNormals.size());
+    }
+
+    std::string toString() const {
+        return formatString("RayBatchResult[start=" SIZE_T_FMT ", size=" SIZE_T_FMT "]",
+            m_start, getSize());
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~RayBatchResult() { }
+private:
+    size_t m_start;
+    std::vector<Float> m_t;
+    std::vector<uint32_t> m_indices;
+    std::vector<Float> m_uvNormals;
+};
+
+/// Traces the rays of a \ref RayBatchWorkUnit
+class RayBatchWorker : public WorkProcessor {
+public:
+    RayBatchWorker() { }
+
+    RayBatchWorker(Stream *stream, InstanceManager *manager)
+        : WorkProcessor(stream, manager) { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const { }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RayBatchWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new RayBatchResult();
+    }
+
+    void prepare() {
+        m_scene = static_cast<Scene *>(getResource("scene"));
+        const ref_vector<Shape> &shapes = m_scene->getShapes();
+        m_shapeIndices.clear();
+        for (size_t i=0; i<shapes.size(); ++i)
+            m_shapeIndices[shapes[i].get()] = (uint32_t) i;
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        const RayBatchWorkUnit *wu = static_cast<const RayBatchWorkUnit *>(workUnit);
+        RayBatchResult *result = static_cast<RayBatchResult *>(workResult);
+        const Float *rays = wu->getRays().empty() ? NULL : &wu->getRays()[0];
+        size_t size = wu->getSize();
+
+        result->setStart(wu->getStart());
+        result->setSize(size);
+
+        Intersection its;
+        for (size_t i=0; i<size && !stop; ++i) {
+            const Float *r = rays + 6*i;
+            Ray ray(Point(r[0], r[1], r[2]), Vector(r[3], r[4], r[5]), 0.0f);
+
+            if (!m_scene->rayIntersect(ray, its)) {
+                result->put(i, std::numeric_limits<Float>::infinity(), RAYBATCH_MISS,
+                    RAYBATCH_MISS, Point2(0.0f), Normal(0.0f));
+                continue;
+            }
+
+            const Shape *shape = its.instance ? its.instance : its.shape;
+            std::map<const Shape *, uint32_t>::const_iterator it = m_shapeIndices.find(shape);
+            result->put(i, its.t, it != m_shapeIndices.end() ? it->second : RAYBATCH_MISS,
+                its.primIndex, its.uv, its.shFrame.n);
+        }
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new RayBatchWorker();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~RayBatchWorker() { }
+private:
+    ref<Scene> m_scene;
+    std::map<const Shape *, uint32_t> m_shapeIndices;
+};
+
+RayBatchProcess::RayBatchProcess(const RayBatch &batch, size_t granularity)
+        : m_batch(batch), m_granularity(std::max(granularity, (size_t) 1)),
+          m_nextRay(0), m_finished(0) {
+    m_resultMutex = new Mutex();
+}
+
+ref<WorkProcessor> RayBatchProcess::createWorkProcessor() const {
+    return new RayBatchWorker();
+}
+
+ParallelProcess::EStatus RayBatchProcess::generateWork(WorkUnit *unit, int worker) {
+    if (m_nextRay >= m_batch.count)
+        return EFailure;
+
+    RayBatchWorkUnit *wu = static_cast<RayBatchWorkUnit *>(unit);
+    size_t size = std::min(m_granularity, m_batch.count - m_nextRay);
+    std::vector<Float> &rays = wu->getRays();
+    rays.resize(size * 6);
+    const Float *o = m_batch.origins + 3 * m_nextRay,
+                *d = m_batch.directions + 3 * m_nextRay;
+    for (size_t i=0; i<size; ++i) {
+        for (int j=0; j<3; ++j) {
+            rays[6*i+j] = o[3*i+j];
+            rays[6*i+3+j] = d[3*i+j];
+        }
+    }
+    wu->setStart(m_nextRay);
+    m_nextRay += size;
+    return ESuccess;
+}
+
+void RayBatchProcess::processResult(const WorkResult *wr, bool cancelled) {
+    if (cancelled)
+        return;
+
+    /* The chunks are disjoint -- only the counter needs the lock */
+    const RayBatchResult *result = static_cast<const RayBatchResult *>(wr);
+    size_t start = result->getStart(), size = result->getSize();
+    for (size_t i=0; i<size; ++i) {
+        size_t index = start + i;
+        if (m_batch.t)
+            m_batch.t[index] = result->getT(i);
+        if (m_batch.shapeIndex)
+            m_batch.shapeIndex[index] = result->getShapeIndex(i);
+        if (m_batch.primIndex)
+            m_batch.primIndex[index] = result->getPrimIndex(i);
+        if (m_batch.uv) {
+            const Float *uv = result->getUV(i);
+            m_batch.uv[2*index] = uv[0];
+            m_batch.uv[2*index+1] = uv[1];
+        }
+        if (m_batch.normals) {
+            const Float *n = result->getNormal(i);
+            for (int j=0; j<3; ++j)
+                m_batch.normals[3*index+j] = n[j];
+        }
+    }
+
+    LockGuard lock(m_resultMutex);
+    m_finished += size;
+}
+
+MTS_IMPLEMENT_CLASS(RayBatchWorkUnit, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(RayBatchResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(RayBatchWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(RayBatchProcess, false, ParallelProcess)
+MTS_NAMESPACE_END
@@ -0,0 +1,195 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <mitsuba/render/regioncache.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/timer.h>
+#include <boost/filesystem/operations.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+ObjectFootprint::ObjectFootprint(const std::string &id) {
+    clear();
+
+    /* 64-bit FNV-1a hash of the ID */
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i=0; i<id.length(); ++i) {
+        hash ^= (uint8_t) id[i];
+        hash *= 1099511628211ULL;
+    }
+
+    /* Each group of 8 bits is one of the Bloom filter's hash functions */
+    const int bitCount = MTS_FOOTPRINT_WORDS * 64;
+    for (int i=0; i<MTS_FOOTPRINT_HASHES; ++i) {
+        int bit = (int) ((hash >> (8*i)) % bitCount);
+        bits[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    }
+}
+
+std::string ObjectFootprint::toString() const {
+    std::ostringstream oss;
+    oss << "ObjectFootprint[";
+    for (int i=0; i<MTS_FOOTPRINT_WORDS; ++i)
+        oss << formatString("%016llx", (unsigned long long) bits[MTS_FOOTPRINT_WORDS-1-i]);
+    oss << "]";
+    return oss.str();
+}
+
+RenderRegionCache::RenderRegionCache(const ReconstructionFilter *filter,
+        Bitmap::EPixelFormat pixelFormat, int channelCount,
+        const Point2i &offset, const Vector2i &size, int blockSize)
+    : m_filter(filter), m_pixelFormat(pixelFormat), m_channelCount(channelCount),
+      m_offset(offset), m_size(size), m_blockSize(blockSize) {
+    m_mutex = new Mutex();
+}
+
+ref<ImageBlock> RenderRegionCache::createBlock() const {
+    ref<ImageBlock> block = new ImageBlock(m_pixelFormat,
+        Vector2i(m_blockSize), m_filter.get(), m_channelCount, false);
+    block->allocateFootprint();
+    return block;
+}
+
+void RenderRegionCache::put(const ImageBlock *block) {
+    if (!block->hasFootprint())
+        Log(EError, "put(): the image block has no footprint!");
+
+    /* Only copy the image and footprint (no variance buffer) */
+    ref<ImageBlock> copy = createBlock();
+    if (copy->getBitmap()->getBufferSize() != block->getBitmap()->getBufferSize())
+        Log(EError, "put(): the image block does not match the cache configuration!");
+    block->copyTo(copy);
+    *copy->getFootprint() = *block->getFootprint();
+
+    LockGuard lock(m_mutex);
+    m_blocks[std::make_pair(block->getOffset().x, block->getOffset().y)] = copy;
+}
+
+const ImageBlock *RenderRegionCache::lookup(const Point2i &offset, const Vector2i &size,
+        const std::vector<ObjectFootprint> &changed) const {
+    LockGuard lock(m_mutex);
+    BlockMap::const_iterator it = m_blocks.find(std::make_pair(offset.x, offset.y));
+    if (it == m_blocks.end() || it->second->getSize() != size)
+        return NULL;
+
+    const ObjectFootprint *footprint = it->second->getFootprint();
+    for (size_t i=0; i<changed.size(); ++i) {
+        if (footprint->contains(changed[i]))
+            return NULL;
+    }
+    return it->second.get();
+}
+
+size_t RenderRegionCache::getBlockCount() const {
+    LockGuard lock(m_mutex);
+    return m_blocks.size();
+}
+
+bool RenderRegionCache::load(const fs::path &filename) {
+    LockGuard lock(m_mutex);
+    m_blocks.clear();
+    if (!fs::exists(filename))
+        return false;
+
+    try {
+        ref<FileStream> fs = new FileStream(filename, FileStream::EReadOnly);
+        if (fs->readString() != MTS_REGIONCACHE_MAGIC ||
+            fs->readShort() != MTS_REGIONCACHE_VERSION) {
+            Log(EWarn, "\"%s\" is not a valid render region cache -- ignoring it.",
+                filename.string().c_str());
+            return false;
+        }
+
+        Bitmap::EPixelFormat pixelFormat = (Bitmap::EPixelFormat) fs->readInt();
+        int channelCount = fs->readInt();
+        Point2i offset(fs);
+        Vector2i size(fs);
+        int blockSize = fs->readInt();
+        std::string filterName = fs->readString();
+        Float filterRadius = fs->readFloat();
+        int borderSize = fs->readInt();
+
+        if (pixelFormat != m_pixelFormat || channelCount != m_channelCount ||
+            offset != m_offset || size != m_size || blockSize != m_blockSize ||
+            filterName != m_filter->getClass()->getName() ||
+            filterRadius != m_filter->getRadius() ||
+            borderSize != m_filter->getBorderSize()) {
+            Log(EWarn, "The render region cache \"%s\" was created using a different "
+                "configuration -- ignoring it.", filename.string().c_str());
+            return false;
+        }
+
+        size_t count = fs->readSize();
+        for (size_t i=0; i<count; ++i) {
+            ref<ImageBlock> block = createBlock();
+            block->load(fs);
+            m_blocks[std::make_pair(block->getOffset().x, block->getOffset().y)] = block;
+        }
+    } catch (const std::exception &ex) {
+        Log(EWarn, "Unable to load the render region cache \"%s\": %s",
+            filename.string().c_str(), ex.what());
+        m_blocks.clear();
+        return false;
+    }
+
+    Log(EInfo, "Loaded " SIZE_T_FMT " blocks from the render region cache \"%s\"",
+        m_blocks.size(), filename.filename().string().c_str());
+    return true;
+}
+
+void RenderRegionCache::save(const fs::path &filename) const {
+    LockGuard lock(m_mutex);
+    fs::path tempFilename = fs::path(filename.string() + ".tmp");
+
+    ref<Timer> timer = new Timer();
+    {
+        ref<FileStream> fs = new FileStream(tempFilename, FileStream::ETruncReadWrite);
+        fs->writeString(MTS_REGIONCACHE_MAGIC);
+        fs->writeShort(MTS_REGIONCACHE_VERSION);
+        fs->writeInt(m_pixelFormat);
+        fs->writeInt(m_channelCount);
+        m_offset.serialize(fs);
+        m_size.serialize(fs);
+        fs->writeInt(m_blockSize);
+        fs->writeString(m_filter->getClass()->getName());
+        fs->writeFloat(m_filter->getRadius());
+        fs->writeInt(m_filter->getBorderSize());
+        fs->writeSize(m_blocks.size());
+        for (BlockMap::const_iterator it = m_blocks.begin(); it != m_blocks.end(); ++it)
+            it->second->save(fs);
+        fs->close();
+    }
+    fs::rename(tempFilename, filename);
+    Log(EInfo, "Stored " SIZE_T_FMT " blocks in the render region cache \"%s\" (took %i ms)",
+        m_blocks.size(), filename.filename().string().c_str(), timer->getMilliseconds());
+}
+
+std::string RenderRegionCache::toString() const {
+    std::ostringstream oss;
+    oss << "RenderRegionCache[" << endl
+        << "  offset = " << m_offset.toString() << "," << endl
+        << "  size = " << m_size.toString() << "," << endl
+        << "  blockSize = " << m_blockSize << "," << endl
+        << "  blockCount = " << getBlockCount() << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(RenderRegionCache, false, Object)
+MTS_NAMESPACE_END
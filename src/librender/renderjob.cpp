@@ -18,14 +18,21 @@
 
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/render/renderproc.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/timer.h>
 #include <boost/filesystem.hpp>
 
+/// Identifies checkpoint files written by \ref RenderJob::saveCheckpoint()
+#define MTS_CHECKPOINT_MAGIC "MTS_CHECKPOINT"
+#define MTS_CHECKPOINT_VERSION 1
+
 MTS_NAMESPACE_BEGIN
 
 RenderJob::RenderJob(const std::string &threadName,
     Scene *scene, RenderQueue *queue, int sceneResID, int sensorResID,
     int samplerResID, bool threadIsCritical, bool interactive)
-    : Thread(threadName), m_scene(scene), m_queue(queue), m_interactive(interactive) {
+    : Thread(threadName), m_scene(scene), m_queue(queue), m_interactive(interactive),
+      m_checkpointInterval(-1), m_share(1) {
 
     /* Optional: bring the process down when this thread crashes */
     setCritical(threadIsCritical);
@@ -60,6 +67,8 @@ RenderJob::RenderJob(const std::string &threadName,
         std::vector<SerializableObject *> samplers(sched->getCoreCount());
         for (size_t i=0; i<sched->getCoreCount(); ++i) {
             ref<Sampler> clonedSampler = sampler->clone();
+            /* Each copy is only ever used by the worker of one core */
+            clonedSampler->setThreadConfined(true);
             clonedSampler->incRef();
             samplers[i] = clonedSampler.get();
         }
@@ -72,6 +81,7 @@ RenderJob::RenderJob(const std::string &threadName,
         m_ownsSamplerResource = false;
     }
     m_cancelled = false;
+    m_checkpointTimer = new Timer();
 }
 
 RenderJob::~RenderJob() {
@@ -89,6 +99,9 @@ void RenderJob::run() {
     ref<Sampler> sampler = m_scene->getSampler();
     m_cancelled = false;
 
+    /* All processes scheduled by the integrator inherit the share of this job */
+    Scheduler::setThreadShare(m_share);
+
     try {
         m_scene->getFilm()->setDestinationFile(m_scene->getDestinationFile(),
             m_scene->getBlockSize());
@@ -114,8 +127,76 @@ void RenderJob::run() {
         m_cancelled = true;
     }
 
+    if (!m_cancelled && m_checkpointInterval > 0) {
+        /* The rendering is complete -- the checkpoint is no longer needed */
+        boost::system::error_code ec;
+        fs::remove(getCheckpointFile(), ec);
+    }
+
     m_queue->removeJob(this, m_cancelled);
 }
 
+fs::path RenderJob::getCheckpointFile() const {
+    return fs::path(m_scene->getDestinationFile().string() + ".checkpoint");
+}
+
+void RenderJob::saveCheckpoint(const Integrator *integrator, bool force) const {
+    if (m_checkpointInterval <= 0 || (!force &&
+        m_checkpointTimer->getMilliseconds() < (unsigned int) m_checkpointInterval * 1000))
+        return;
+
+    fs::path filename = getCheckpointFile(),
+             tempFilename = fs::path(filename.string() + ".tmp");
+
+    Log(EInfo, "Writing a checkpoint to \"%s\" ..", filename.string().c_str());
+    ref<Timer> timer = new Timer();
+    {
+        ref<FileStream> fs = new FileStream(tempFilename, FileStream::ETruncReadWrite);
+        fs->writeString(MTS_CHECKPOINT_MAGIC);
+        fs->writeShort(MTS_CHECKPOINT_VERSION);
+        fs->writeString(integrator->getClass()->getName());
+        m_scene->getFilm()->getCropSize().serialize(fs);
+        fs->writeUInt(m_scene->getBlockSize());
+        integrator->saveCheckpoint(fs);
+        fs->close();
+    }
+    fs::rename(tempFilename, filename);
+    Log(EInfo, "Done (took %i ms)", timer->getMilliseconds());
+    m_checkpointTimer->reset();
+}
+
+bool RenderJob::loadCheckpoint(Integrator *integrator) const {
+    fs::path filename = getCheckpointFile();
+    if (m_checkpointInterval <= 0 || !fs::exists(filename))
+        return false;
+
+    try {
+        ref<FileStream> fs = new FileStream(filename, FileStream::EReadOnly);
+        if (fs->readString() != MTS_CHECKPOINT_MAGIC ||
+            fs->readShort() != MTS_CHECKPOINT_VERSION) {
+            Log(EWarn, "\"%s\" is not a valid checkpoint -- ignoring it.",
+                filename.string().c_str());
+            return false;
+        }
+        std::string className = fs->readString();
+        Vector2i cropSize(fs);
+        uint32_t blockSize = fs->readUInt();
+        if (className != integrator->getClass()->getName() ||
+            cropSize != m_scene->getFilm()->getCropSize() ||
+            blockSize != m_scene->getBlockSize()) {
+            Log(EWarn, "The checkpoint \"%s\" was created using a different "
+                "configuration -- ignoring it.", filename.string().c_str());
+            return false;
+        }
+        Log(EInfo, "Resuming from the checkpoint \"%s\" ..", filename.string().c_str());
+        integrator->loadCheckpoint(fs);
+    } catch (const std::exception &ex) {
+        Log(EWarn, "Unable to load the checkpoint \"%s\": %s", filename.string().c_str(), ex.what());
+        return false;
+    }
+    m_checkpointTimer->reset();
+    return true;
+}
+
 MTS_IMPLEMENT_CLASS(RenderJob, false, Thread)
 MTS_NAMESPACE_END
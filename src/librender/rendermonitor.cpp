@@ -0,0 +1,263 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/rendermonitor.h>
+#include <mitsuba/render/renderjob.h>
+#include <mitsuba/render/imageblock.h>
+#include <mitsuba/core/sched_remote.h>
+#include <mitsuba/core/statistics.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Calls RenderMonitor::report() in regular intervals
+class RenderMonitorThread : public Thread {
+public:
+    RenderMonitorThread(RenderMonitor *monitor, Float interval)
+        : Thread("mon"), m_monitor(monitor),
+          m_interval(std::max(1, (int) (interval * 1000))) {
+        m_stop = new WaitFlag();
+    }
+
+    void run() {
+        while (!m_stop->wait(m_interval)) {
+            try {
+                m_monitor->report();
+            } catch (const std::exception &ex) {
+                Log(EWarn, "Could not write the progress report, "
+                    "disabling the render monitor: %s", ex.what());
+                break;
+            }
+        }
+    }
+
+    void stop() {
+        m_stop->set(true);
+        join();
+    }
+
+private:
+    /* No reference -- the monitor owns this thread */
+    RenderMonitor *m_monitor;
+    ref<WaitFlag> m_stop;
+    int m_interval;
+};
+
+RenderMonitor::RenderMonitor(RenderQueue *queue, Stream *stream, Float interval)
+        : m_queue(queue), m_stream(stream), m_lastReport(0) {
+    m_timer = new Timer();
+    m_mutex = new Mutex();
+    m_thread = new RenderMonitorThread(this, interval);
+    m_thread->start();
+}
+
+RenderMonitor::~RenderMonitor() {
+    stop();
+}
+
+void RenderMonitor::stop() {
+    if (!m_thread)
+        return;
+    static_cast<RenderMonitorThread *>(m_thread.get())->stop();
+    m_thread = NULL;
+    report();
+}
+
+void RenderMonitor::workBeginEvent(const RenderJob *job,
+        const RectangularWorkUnit *wu, int worker) {
+    Float time = m_timer->getSeconds();
+    LockGuard lock(m_mutex);
+
+    std::map<const RenderJob *, JobRecord>::iterator it = m_jobs.find(job);
+    if (it == m_jobs.end()) {
+        JobRecord &rec = m_jobs[job];
+        const Scene *scene = job->getScene();
+        const Vector2i &cropSize = scene->getFilm()->getCropSize();
+        rec.name = job->getName();
+        rec.start = rec.lastBlock = time;
+        rec.filmPixels = (size_t) cropSize.x * (size_t) cropSize.y;
+        rec.sampleCount = scene->getSampler()->getSampleCount();
+    }
+
+    InFlight block;
+    block.job = job;
+    block.offset = wu->getOffset();
+    block.worker = std::max(worker, 0);
+    block.start = time;
+    m_inFlight.push_back(block);
+}
+
+void RenderMonitor::workEndEvent(const RenderJob *job,
+        const ImageBlock *block, bool cancelled) {
+    Float time = m_timer->getSeconds();
+    LockGuard lock(m_mutex);
+
+    for (size_t i=0; i<m_inFlight.size(); ++i) {
+        InFlight &entry = m_inFlight[i];
+        if (entry.job != job || entry.offset != block->getOffset())
+            continue;
+        accountBusy(entry, time);
+        if (!cancelled)
+            m_workers[entry.worker].blocks++;
+        m_inFlight[i] = m_inFlight.back();
+        m_inFlight.pop_back();
+        break;
+    }
+
+    std::map<const RenderJob *, JobRecord>::iterator it = m_jobs.find(job);
+    if (it == m_jobs.end() || cancelled)
+        return;
+
+    JobRecord &rec = it->second;
+    const Vector2i &size = block->getSize();
+    rec.pixels += (size_t) size.x * (size_t) size.y;
+    rec.blocks++;
+    rec.lastBlock = time;
+}
+
+void RenderMonitor::finishJobEvent(const RenderJob *job, bool cancelled) {
+    Float time = m_timer->getSeconds();
+    LockGuard lock(m_mutex);
+
+    std::map<const RenderJob *, JobRecord>::iterator it = m_jobs.find(job);
+    if (it == m_jobs.end())
+        return;
+
+    std::ostringstream oss;
+    oss << "{\"time\": " << time << ", \"jobs\": [";
+    reportJob(oss, job, time, true);
+    oss << "]}";
+    m_stream->writeLine(oss.str());
+    m_stream->flush();
+
+    for (size_t i=0; i<m_inFlight.size(); ) {
+        if (m_inFlight[i].job == job) {
+            m_inFlight[i] = m_inFlight.back();
+            m_inFlight.pop_back();
+        } else {
+            ++i;
+        }
+    }
+    m_jobs.erase(it);
+}
+
+void RenderMonitor::accountBusy(InFlight &block, Float time) {
+    if (block.worker >= (int) m_workers.size())
+        m_workers.resize(block.worker + 1);
+    m_workers[block.worker].busy += time - block.start;
+    block.start = time;
+}
+
+void RenderMonitor::reportJob(std::ostringstream &oss,
+        const RenderJob *job, Float time, bool finished) {
+    const JobRecord &rec = m_jobs[job];
+    size_t inFlight = 0;
+    for (size_t i=0; i<m_inFlight.size(); ++i)
+        if (m_inFlight[i].job == job)
+            ++inFlight;
+
+    Float elapsed = time - rec.start;
+    Float progress = rec.filmPixels == 0 ? (Float) 0 :
+        std::min((Float) 1, rec.pixels / (Float) rec.filmPixels);
+
+    oss << "{\"name\": \"" << rec.name << "\""
+        << ", \"blocks\": " << rec.blocks
+        << ", \"inFlight\": " << inFlight
+        << ", \"progress\": " << progress
+        << ", \"samplesPerSecond\": " << (elapsed > 0
+            ? (rec.pixels * (Float) rec.sampleCount / elapsed) : (Float) 0)
+        << ", \"eta\": ";
+    if (progress > 0)
+        oss << elapsed * (1 - progress) / progress;
+    else
+        oss << "null";
+    oss << ", \"sinceLastBlock\": " << time - rec.lastBlock;
+    if (finished)
+        oss << ", \"finished\": true";
+    oss << "}";
+}
+
+void RenderMonitor::report() {
+    /* Query the scheduler before acquiring the lock: the block events
+       may be delivered while the scheduler's lock is held */
+    Scheduler *scheduler = Scheduler::getInstance();
+    std::vector<std::string> nodeNames;
+    std::vector<size_t> workerNode, nodeWorkers, nodeCores;
+    size_t workerCount = scheduler->getWorkerCount();
+    for (size_t i=0; i<workerCount; ++i) {
+        const Worker *worker = scheduler->getWorker((int) i);
+        std::string name = worker->isRemoteWorker() ?
+            static_cast<const RemoteWorker *>(worker)->getNodeName() : "local";
+        size_t node = std::find(nodeNames.begin(), nodeNames.end(), name)
+            - nodeNames.begin();
+        if (node == nodeNames.size()) {
+            nodeNames.push_back(name);
+            nodeWorkers.push_back(0);
+            nodeCores.push_back(0);
+        }
+        workerNode.push_back(node);
+        nodeWorkers[node]++;
+        nodeCores[node] += worker->getCoreCount();
+    }
+
+    LockGuard lock(m_mutex);
+    Float time = m_timer->getSeconds(),
+          interval = time - m_lastReport;
+    m_lastReport = time;
+
+    for (size_t i=0; i<m_inFlight.size(); ++i)
+        accountBusy(m_inFlight[i], time);
+
+    std::vector<Float> nodeBusy(nodeNames.size(), 0);
+    std::vector<size_t> nodeBlocks(nodeNames.size(), 0);
+    for (size_t i=0; i<std::min(workerCount, m_workers.size()); ++i) {
+        nodeBusy[workerNode[i]] += m_workers[i].busy;
+        nodeBlocks[workerNode[i]] += m_workers[i].blocks;
+    }
+    m_workers.clear();
+
+    std::ostringstream oss;
+    oss << "{\"time\": " << time
+        << ", \"queueDepth\": " << m_queue->getJobCount()
+        << ", \"memory\": {\"resident\": " << getPrivateMemoryUsage()
+        << ", \"peak\": " << getPeakMemoryUsage()
+        << ", \"tracked\": " << MemoryTracker::getTotalUsage() << "}"
+        << ", \"jobs\": [";
+    std::map<const RenderJob *, JobRecord>::iterator it = m_jobs.begin();
+    for (; it != m_jobs.end(); ++it) {
+        if (it != m_jobs.begin())
+            oss << ", ";
+        reportJob(oss, it->first, time, false);
+    }
+    oss << "], \"nodes\": [";
+    for (size_t i=0; i<nodeNames.size(); ++i) {
+        Float utilization = interval > 0 && nodeCores[i] > 0
+            ? nodeBusy[i] / (interval * nodeCores[i]) : (Float) 0;
+        oss << (i > 0 ? ", " : "") << "{\"name\": \"" << nodeNames[i] << "\""
+            << ", \"workers\": " << nodeWorkers[i]
+            << ", \"cores\": " << nodeCores[i]
+            << ", \"blocks\": " << nodeBlocks[i]
+            << ", \"utilization\": " << std::min((Float) 1, utilization) << "}";
+    }
+    oss << "]}";
+
+    m_stream->writeLine(oss.str());
+    m_stream->flush();
+}
+
+MTS_IMPLEMENT_CLASS(RenderMonitor, false, RenderListener)
+MTS_NAMESPACE_END
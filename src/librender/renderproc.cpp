@@ -18,17 +18,69 @@
 
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/sfcurve.h>
+#include <mitsuba/core/timer.h>
 #include <mitsuba/render/renderproc.h>
 #include <mitsuba/render/rectwu.h>
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Rectangular work unit that additionally specifies how many
+ * rendering rounds should be done (used by the adaptive mode)
+ */
+class BlockWorkUnit : public RectangularWorkUnit {
+public:
+    inline BlockWorkUnit() : m_rounds(1), m_firstSample(0), m_sampleCount(0) { }
+
+    void set(const WorkUnit *wu) {
+        RectangularWorkUnit::set(wu);
+        const BlockWorkUnit *other = static_cast<const BlockWorkUnit *>(wu);
+        m_rounds = other->m_rounds;
+        m_firstSample = other->m_firstSample;
+        m_sampleCount = other->m_sampleCount;
+    }
+
+    void load(Stream *stream) {
+        RectangularWorkUnit::load(stream);
+        m_rounds = stream->readUInt();
+        m_firstSample = stream->readSize();
+        m_sampleCount = stream->readSize();
+    }
+
+    void save(Stream *stream) const {
+        RectangularWorkUnit::save(stream);
+        stream->writeUInt(m_rounds);
+        stream->writeSize(m_firstSample);
+        stream->writeSize(m_sampleCount);
+    }
+
+    inline uint32_t getRounds() const { return m_rounds; }
+    inline void setRounds(uint32_t rounds) { m_rounds = rounds; }
+
+    /// Range of per-pixel sample indices to be rendered (progressive mode)
+    inline size_t getFirstSample() const { return m_firstSample; }
+    inline size_t getSampleCount() const { return m_sampleCount; }
+    inline void setSampleRange(size_t firstSample, size_t sampleCount) {
+        m_firstSample = firstSample;
+        m_sampleCount = sampleCount;
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~BlockWorkUnit() { }
+private:
+    uint32_t m_rounds;
+    size_t m_firstSample, m_sampleCount;
+};
+
 class BlockRenderer : public WorkProcessor {
 public:
     BlockRenderer(Bitmap::EPixelFormat pixelFormat, int channelCount, int blockSize,
-        int borderSize, bool warnInvalid) : m_pixelFormat(pixelFormat),
-        m_channelCount(channelCount), m_blockSize(blockSize),
-        m_borderSize(borderSize), m_warnInvalid(warnInvalid) { }
+        int borderSize, bool warnInvalid, bool adaptive, bool variance, bool footprint,
+        bool cost)
+        : m_pixelFormat(pixelFormat), m_channelCount(channelCount), m_blockSize(blockSize),
+        m_borderSize(borderSize), m_warnInvalid(warnInvalid), m_adaptive(adaptive),
+        m_variance(variance), m_footprint(footprint), m_cost(cost) { }
 
     BlockRenderer(Stream *stream, InstanceManager *manager) {
         m_pixelFormat = (Bitmap::EPixelFormat) stream->readInt();
@@ -36,17 +88,30 @@ public:
         m_blockSize = stream->readInt();
         m_borderSize = stream->readInt();
         m_warnInvalid = stream->readBool();
+        m_adaptive = stream->readBool();
+        m_variance = stream->readBool();
+        m_footprint = stream->readBool();
+        m_cost = stream->readBool();
     }
 
     ref<WorkUnit> createWorkUnit() const {
-        return new RectangularWorkUnit();
+        return new BlockWorkUnit();
     }
 
     ref<WorkResult> createWorkResult() const {
-        return new ImageBlock(m_pixelFormat,
+        ref<ImageBlock> block = new ImageBlock(m_pixelFormat,
             Vector2i(m_blockSize),
             m_sensor->getFilm()->getReconstructionFilter(),
             m_channelCount, m_warnInvalid);
+        /* In adaptive mode, the variance buffer records the statistics of
+           whole rounds -- otherwise, renderBlock() records every sample */
+        if (m_adaptive || m_variance)
+            block->allocateVariance();
+        if (m_footprint)
+            block->allocateFootprint();
+        if (m_cost)
+            block->allocateCost();
+        return block.get();
     }
 
     void prepare() {
@@ -67,18 +132,96 @@ public:
 
     void process(const WorkUnit *workUnit, WorkResult *workResult,
         const bool &stop) {
-        const RectangularWorkUnit *rect = static_cast<const RectangularWorkUnit *>(workUnit);
+        const BlockWorkUnit *rect = static_cast<const BlockWorkUnit *>(workUnit);
         ImageBlock *block = static_cast<ImageBlock *>(workResult);
 
 #ifdef MTS_DEBUG_FP
         enableFPExceptions();
 #endif
 
+        uint64_t rays = 0;
+        if (m_cost) {
+            if (!m_timer)
+                m_timer = new Timer(false);
+            m_timer->reset();
+            rays = ShapeKDTree::getThreadRayCount();
+        }
+
         block->setOffset(rect->getOffset());
         block->setSize(rect->getSize());
         m_hilbertCurve.initialize(TVector2<uint8_t>(rect->getSize()));
-        m_integrator->renderBlock(m_scene, m_sensor, m_sampler,
-            block, stop, m_hilbertCurve.getPoints());
+        m_sampler->setBlock(rect->getOffset(), rect->getSize());
+        m_scene->setFootprint(block->getFootprint());
+
+        if (rect->getSampleCount() > 0) {
+            /* Progressive mode: only render the requested range of samples */
+            m_integrator->renderBlockSamples(m_scene, m_sensor, m_sampler,
+                block, stop, m_hilbertCurve.getPoints(),
+                rect->getFirstSample(), rect->getSampleCount());
+        } else if (!m_adaptive) {
+            m_integrator->renderBlock(m_scene, m_sensor, m_sampler,
+                block, stop, m_hilbertCurve.getPoints());
+        } else {
+            /* Render several rounds into a temporary block, and record
+               the luminance of each round in the variance buffer */
+            if (!m_round)
+                m_round = new ImageBlock(m_pixelFormat, Vector2i(m_blockSize),
+                    m_sensor->getFilm()->getReconstructionFilter(),
+                    m_channelCount, m_warnInvalid);
+            m_round->setOffset(rect->getOffset());
+            m_round->setSize(rect->getSize());
+            block->clear();
+
+            const Vector2i &size = rect->getSize();
+            const int channels = m_round->getChannelCount(),
+                      width = m_round->getBitmap()->getWidth(),
+                      varWidth = block->getVariance()->getWidth();
+
+            for (uint32_t round=0; round<rect->getRounds() && !stop; ++round) {
+                m_integrator->renderBlock(m_scene, m_sensor, m_sampler,
+                    m_round, stop, m_hilbertCurve.getPoints());
+                if (stop)
+                    break;
+
+                const Float *source = m_round->getBitmap()->getFloatData();
+                Float *variance = block->getVariance()->getFloatData();
+                for (int y=0; y<size.y; ++y) {
+                    const Float *pixel = source + ((y + m_borderSize) *
+                        (size_t) width + m_borderSize) * channels;
+                    Float *target = variance + y * (size_t) varWidth * 3;
+                    for (int x=0; x<size.x; ++x) {
+                        Float weight = pixel[channels-1];
+                        if (weight > 0) {
+                            Float lum = Spectrum(const_cast<Float *>(pixel)).getLuminance() / weight;
+                            target[0] += lum;
+                            target[1] += lum * lum;
+                            target[2] += 1;
+                        }
+                        pixel += channels;
+                        target += 3;
+                    }
+                }
+                block->put(m_round);
+            }
+        }
+        m_scene->setFootprint(NULL);
+
+        if (m_cost) {
+            /* Set the record last, since the adaptive mode clears the block */
+            const Vector2i &size = rect->getSize();
+            uint64_t samples = (uint64_t) size.x * (uint64_t) size.y;
+            if (rect->getSampleCount() > 0)
+                samples *= rect->getSampleCount();
+            else if (m_adaptive)
+                samples *= (uint64_t) rect->getRounds() * m_sampler->getSampleCount();
+            else
+                samples *= m_sampler->getSampleCount();
+
+            BlockCost *cost = block->getCost();
+            cost->time = m_timer->getSeconds();
+            cost->samples = samples;
+            cost->rays = ShapeKDTree::getThreadRayCount() - rays;
+        }
 
 #ifdef MTS_DEBUG_FP
         disableFPExceptions();
@@ -91,11 +234,16 @@ public:
         stream->writeInt(m_blockSize);
         stream->writeInt(m_borderSize);
         stream->writeBool(m_warnInvalid);
+        stream->writeBool(m_adaptive);
+        stream->writeBool(m_variance);
+        stream->writeBool(m_footprint);
+        stream->writeBool(m_cost);
     }
 
     ref<WorkProcessor> clone() const {
-        return new BlockRenderer(m_pixelFormat, m_channelCount,
-            m_blockSize, m_borderSize, m_warnInvalid);
+        return new BlockRenderer(m_pixelFormat, m_channelCount, m_blockSize,
+            m_borderSize, m_warnInvalid, m_adaptive, m_variance, m_footprint,
+            m_cost);
     }
 
     MTS_DECLARE_CLASS()
@@ -111,7 +259,13 @@ private:
     int m_blockSize;
     int m_borderSize;
     bool m_warnInvalid;
+    bool m_adaptive;
+    bool m_variance;
+    bool m_footprint;
+    bool m_cost;
     HilbertCurve2D<uint8_t> m_hilbertCurve;
+    ref<ImageBlock> m_round;
+    ref<Timer> m_timer;
 };
 
 BlockedRenderProcess::BlockedRenderProcess(const RenderJob *parent, RenderQueue *queue,
@@ -121,6 +275,9 @@ BlockedRenderProcess::BlockedRenderProcess(const RenderJob *parent, RenderQueue
     m_pixelFormat = Bitmap::ESpectrumAlphaWeight;
     m_channelCount = -1;
     m_warnInvalid = true;
+    m_adaptive = m_adaptiveDone = false;
+    m_progressive = false;
+    m_cacheReused = 0;
 }
 
 BlockedRenderProcess::~BlockedRenderProcess() {
@@ -134,27 +291,401 @@ void BlockedRenderProcess::setPixelFormat(Bitmap::EPixelFormat pixelFormat, int
     m_warnInvalid = warnInvalid;
 }
 
+void BlockedRenderProcess::setAdaptive(Float rounds, int passes, Float maxError, Float timeLimit) {
+    if (m_pixelFormat != Bitmap::ESpectrumAlphaWeight)
+        Log(EError, "Adaptive sampling requires the default pixel format!");
+    m_adaptive = true;
+    m_adaptiveRounds = std::max(rounds, (Float) 2);
+    m_passes = std::max(passes, 1);
+    m_maxError = maxError;
+    m_timeLimit = timeLimit;
+}
+
+void BlockedRenderProcess::setProgressive(size_t samplesPerRound, size_t sampleCount,
+        Float timeLimit, Float maxError) {
+    if (m_adaptive)
+        Log(EError, "Progressive rendering cannot be combined with adaptive sampling!");
+    if (maxError > 0 && m_pixelFormat != Bitmap::ESpectrumAlphaWeight)
+        Log(EError, "A progressive rendering noise target requires the default pixel format!");
+    m_progressive = true;
+    m_roundSamples = std::max(samplesPerRound, (size_t) 1);
+    m_totalSamples = std::max(sampleCount, m_roundSamples);
+    m_timeLimit = timeLimit;
+    m_maxError = maxError;
+}
+
+void BlockedRenderProcess::setRegionCache(const RenderRegionCache *previous,
+        const std::vector<ObjectFootprint> &changed, RenderRegionCache *record) {
+    if (m_adaptive || m_progressive)
+        Log(EError, "Render region caching cannot be combined with adaptive "
+            "sampling or progressive rendering!");
+    m_cachePrevious = previous;
+    m_cacheChanged = changed;
+    m_cacheRecord = record;
+    m_cacheReused = 0;
+}
+
 ref<WorkProcessor> BlockedRenderProcess::createWorkProcessor() const {
+    /* A progressive noise target needs the statistics of every sample */
     return new BlockRenderer(m_pixelFormat, m_channelCount,
-            m_blockSize, m_borderSize, m_warnInvalid);
+            m_blockSize, m_borderSize, m_warnInvalid, m_adaptive,
+            m_film->hasVariance() || (m_progressive && m_maxError > 0),
+            m_cacheRecord.get() != NULL, m_costRecord.get() != NULL);
 }
 
 void BlockedRenderProcess::processResult(const WorkResult *result, bool cancelled) {
     const ImageBlock *block = static_cast<const ImageBlock *>(result);
     UniqueLock lock(m_resultMutex);
     m_film->put(block);
-    m_progress->update(++m_resultCount);
+    if (m_cacheRecord && !cancelled)
+        m_cacheRecord->put(block);
+    if (m_costRecord && !cancelled)
+        m_costRecord->put(block);
+
+    bool reschedule = false;
+    if (m_progressive) {
+        m_progress->update(++m_resultCount);
+        if (m_maxError > 0 && !cancelled) {
+            uint32_t sampleCount = 0;
+            mergeVariance(block, sampleCount);
+        }
+
+        /* Decide about the next round once the current one is complete */
+        if (!cancelled && --m_outstanding == 0 && m_nextBlock == m_blocks.size()) {
+            if (!planProgressiveRound())
+                m_adaptiveDone = true;
+            reschedule = true;
+        }
+    } else if (!m_adaptive) {
+        m_progress->update(++m_resultCount);
+    } else if (!cancelled) {
+        /* Merge the per-pixel statistics into the global variance buffer */
+        uint32_t rounds = 0;
+        mergeVariance(block, rounds);
+        m_roundsDone += rounds;
+        m_progress->update(std::min(m_roundsDone, m_roundsTotal));
+
+        /* The last result of a pass determines the next one. The scheduler
+           must not be called while holding the result lock (it may itself
+           be waiting in generateWork() for that lock) */
+        if (--m_outstanding == 0 && m_adaptiveQueue.empty()) {
+            if (!planAdaptivePass())
+                m_adaptiveDone = true;
+            reschedule = true;
+        }
+    }
     lock.unlock();
     m_queue->signalWorkEnd(m_parent, block, cancelled);
+
+    if (reschedule)
+        Scheduler::getInstance()->schedule(this);
+}
+
+void BlockedRenderProcess::enumerateBlocks() {
+    /* Enumerate the blocks in the usual spiral order */
+    ref<RectangularWorkUnit> rect = new RectangularWorkUnit();
+    m_blocks.clear();
+    while (BlockedImageProcess::nextBlock(rect) == ESuccess) {
+        AdaptiveBlock block;
+        block.offset = rect->getOffset();
+        block.size = rect->getSize();
+        block.error = 0;
+        block.carry = 0;
+        m_blocks.push_back(block);
+    }
+}
+
+void BlockedRenderProcess::initAdaptive() {
+    enumerateBlocks();
+
+    m_variance.clear();
+    m_variance.resize((size_t) m_size.x * (size_t) m_size.y * 3, 0.0f);
+    m_roundsLeft = m_roundsTotal = (size_t) (m_adaptiveRounds * m_blocks.size());
+    m_roundsDone = 0;
+    m_outstanding = 0;
+    m_pass = 0;
+    m_adaptiveTimer = new Timer();
+
+    if (m_progress)
+        delete m_progress;
+    m_progress = new ProgressReporter("Rendering", m_roundsTotal, m_parent);
+
+    /* The first pass renders every block twice to obtain a variance estimate */
+    for (size_t i=0; i<m_blocks.size(); ++i)
+        m_adaptiveQueue.push_back(std::make_pair((uint32_t) i, 2u));
+    m_roundsLeft -= std::min(m_roundsLeft, 2 * m_blocks.size());
+    m_outstanding = m_adaptiveQueue.size();
+    m_pass = 1;
+}
+
+/// Relative standard error of a pixel given the sum, sum of squares and number of its estimates
+static inline Float relativeError(const Float *v, Float base) {
+    Float n = v[2];
+    if (n < 2)
+        return 0;
+    Float mean = v[0] / n,
+          var = std::max((Float) 0, (v[1] - v[0] * mean) / (n - 1));
+    return std::sqrt(var / n) / std::max(mean, base);
+}
+
+Float BlockedRenderProcess::errorBase() const {
+    /* Relative errors of dark pixels are measured with respect to
+       a fraction of the average luminance */
+    double avgLuminance = 0;
+    size_t pixelCount = (size_t) m_size.x * (size_t) m_size.y;
+    for (size_t i=0; i<pixelCount; ++i) {
+        const Float *v = &m_variance[3*i];
+        if (v[2] > 0)
+            avgLuminance += v[0] / v[2];
+    }
+    avgLuminance /= pixelCount;
+    return std::max((Float) (avgLuminance * 0.01f), Epsilon);
+}
+
+void BlockedRenderProcess::mergeVariance(const ImageBlock *block, uint32_t &maxCount) {
+    const Bitmap *variance = block->getVariance();
+    const Vector2i &size = block->getSize();
+    const Point2i offset = Point2i(block->getOffset() - m_offset);
+    for (int y=0; y<size.y; ++y) {
+        const Float *source = variance->getFloatData() + y * (size_t) variance->getWidth() * 3;
+        Float *target = &m_variance[((offset.y + y) * (size_t) m_size.x + offset.x) * 3];
+        for (int x=0; x<size.x*3; ++x)
+            target[x] += source[x];
+        maxCount = std::max(maxCount, (uint32_t) source[2]);
+    }
+}
+
+bool BlockedRenderProcess::planAdaptivePass() {
+    if (m_pass >= m_passes || m_roundsLeft == 0)
+        return false;
+
+    if (m_timeLimit > 0 && m_adaptiveTimer->getSeconds() > m_timeLimit) {
+        Log(EInfo, "Adaptive sampling: reached the time limit after %i passes", m_pass);
+        return false;
+    }
+
+    Float base = errorBase();
+
+    /* Average relative standard error of each block */
+    double errorSum = 0;
+    size_t active = 0;
+    Float maxError = 0;
+    for (size_t i=0; i<m_blocks.size(); ++i) {
+        AdaptiveBlock &block = m_blocks[i];
+        Point2i offset = Point2i(block.offset - m_offset);
+        double error = 0;
+        for (int y=0; y<block.size.y; ++y) {
+            const Float *v = &m_variance[((offset.y + y) * (size_t) m_size.x + offset.x) * 3];
+            for (int x=0; x<block.size.x; ++x) {
+                error += relativeError(v, base);
+                v += 3;
+            }
+        }
+        block.error = (Float) (error / ((size_t) block.size.x * block.size.y));
+        maxError = std::max(maxError, block.error);
+        if (block.error > m_maxError) {
+            errorSum += block.error;
+            ++active;
+        }
+    }
+
+    if (active == 0 || errorSum == 0) {
+        Log(EInfo, "Adaptive sampling: converged after %i passes (max. relative error %f)",
+            m_pass, maxError);
+        return false;
+    }
+
+    /* Distribute this pass' share of the remaining budget in proportion
+       to the error, carrying fractional rounds over to later passes */
+    size_t passBudget = m_roundsLeft / (m_passes - m_pass);
+    std::vector<std::pair<Float, uint32_t> > order;
+    for (size_t i=0; i<m_blocks.size(); ++i) {
+        AdaptiveBlock &block = m_blocks[i];
+        if (block.error <= m_maxError)
+            continue;
+        block.carry += (Float) (passBudget * (block.error / errorSum));
+        order.push_back(std::make_pair(block.error, (uint32_t) i));
+    }
+    std::sort(order.begin(), order.end(), std::greater<std::pair<Float, uint32_t> >());
+
+    size_t total = 0, refined = 0;
+    for (size_t i=0; i<order.size(); ++i) {
+        AdaptiveBlock &block = m_blocks[order[i].second];
+        uint32_t rounds = (uint32_t) std::min((size_t) block.carry, m_roundsLeft - total);
+        if (i == 0 && total == 0 && rounds == 0)
+            rounds = 1; /* Always make some progress */
+        block.carry = std::max((Float) 0, block.carry - rounds);
+        total += rounds;
+        if (rounds > 0)
+            ++refined;
+
+        while (rounds > 0) {
+            uint32_t chunk = std::min(rounds, (uint32_t) MTS_ADAPTIVE_UNIT_ROUNDS);
+            m_adaptiveQueue.push_back(std::make_pair(order[i].second, chunk));
+            rounds -= chunk;
+        }
+    }
+
+    m_roundsLeft -= std::min(total, m_roundsLeft);
+    m_outstanding = m_adaptiveQueue.size();
+    ++m_pass;
+    Log(EDebug, "Adaptive sampling: pass %i renders " SIZE_T_FMT " rounds in "
+        SIZE_T_FMT " blocks (max. relative error %f)", m_pass, total, refined, maxError);
+    return m_outstanding > 0;
+}
+
+ParallelProcess::EStatus BlockedRenderProcess::nextAdaptiveBlock(WorkUnit *unit) {
+    LockGuard lock(m_resultMutex);
+    if (m_blocks.empty() && !m_adaptiveDone)
+        initAdaptive();
+
+    if (m_adaptiveQueue.empty())
+        return m_adaptiveDone ? EFailure : EPause;
+
+    std::pair<uint32_t, uint32_t> item = m_adaptiveQueue.front();
+    m_adaptiveQueue.pop_front();
+    const AdaptiveBlock &block = m_blocks[item.first];
+    BlockWorkUnit *rect = static_cast<BlockWorkUnit *>(unit);
+    rect->setOffset(block.offset);
+    rect->setSize(block.size);
+    rect->setRounds(item.second);
+    return ESuccess;
+}
+
+void BlockedRenderProcess::initProgressive() {
+    enumerateBlocks();
+
+    m_roundFirstSample = 0;
+    m_roundCount = 0;
+    m_nextBlock = 0;
+    m_outstanding = m_blocks.size();
+    m_adaptiveTimer = new Timer();
+    if (m_maxError > 0) {
+        m_variance.clear();
+        m_variance.resize((size_t) m_size.x * (size_t) m_size.y * 3, 0.0f);
+    }
+
+    size_t rounds = (m_totalSamples + m_roundSamples - 1) / m_roundSamples;
+    if (m_progress)
+        delete m_progress;
+    m_progress = new ProgressReporter("Rendering", rounds * m_blocks.size(), m_parent);
+    m_resultCount = 0;
+}
+
+bool BlockedRenderProcess::planProgressiveRound() {
+    m_roundFirstSample += m_roundSamples;
+    ++m_roundCount;
+    if (m_roundFirstSample >= m_totalSamples)
+        return false;
+
+    /* Only start another round if it is expected to finish in time */
+    Float elapsed = m_adaptiveTimer->getSeconds();
+    if (m_timeLimit > 0 && elapsed + elapsed / m_roundCount > m_timeLimit) {
+        Log(EInfo, "Progressive rendering: stopping after " SIZE_T_FMT " samples per "
+            "pixel to meet the time limit", m_roundFirstSample);
+        return false;
+    }
+
+    /* Stop when the average relative standard error reaches the noise target */
+    if (m_maxError > 0) {
+        Float base = errorBase();
+        double error = 0;
+        size_t pixelCount = (size_t) m_size.x * (size_t) m_size.y;
+        for (size_t i=0; i<pixelCount; ++i)
+            error += relativeError(&m_variance[3*i], base);
+        error /= pixelCount;
+        Log(EDebug, "Progressive rendering: relative error %f after " SIZE_T_FMT
+            " samples per pixel", error, m_roundFirstSample);
+        if (error <= m_maxError) {
+            Log(EInfo, "Progressive rendering: reached the noise target after "
+                SIZE_T_FMT " samples per pixel (relative error %f)", m_roundFirstSample, error);
+            return false;
+        }
+    }
+
+    m_nextBlock = 0;
+    m_outstanding = m_blocks.size();
+    return true;
+}
+
+ParallelProcess::EStatus BlockedRenderProcess::nextProgressiveBlock(WorkUnit *unit) {
+    LockGuard lock(m_resultMutex);
+    if (m_blocks.empty() && !m_adaptiveDone)
+        initProgressive();
+
+    if (m_nextBlock == m_blocks.size())
+        return m_adaptiveDone ? EFailure : EPause;
+
+    const AdaptiveBlock &block = m_blocks[m_nextBlock++];
+    BlockWorkUnit *rect = static_cast<BlockWorkUnit *>(unit);
+    rect->setOffset(block.offset);
+    rect->setSize(block.size);
+    rect->setRounds(1);
+    rect->setSampleRange(m_roundFirstSample,
+        std::min(m_roundSamples, m_totalSamples - m_roundFirstSample));
+    return ESuccess;
+}
+
+ParallelProcess::EStatus BlockedRenderProcess::nextUncachedBlock(WorkUnit *unit, int worker) {
+    while (true) {
+        EStatus status = nextBlock(unit);
+        if (status != ESuccess || !m_cachePrevious)
+            return status;
+
+        const RectangularWorkUnit *rect = static_cast<RectangularWorkUnit *>(unit);
+        const ImageBlock *cached = m_cachePrevious->lookup(
+            rect->getOffset(), rect->getSize(), m_cacheChanged);
+        if (!cached)
+            return ESuccess;
+
+        /* None of the modified objects were seen -- copy the old block */
+        UniqueLock lock(m_resultMutex);
+        m_film->put(cached);
+        if (m_cacheRecord)
+            m_cacheRecord->put(cached);
+        ++m_cacheReused;
+        m_progress->update(++m_resultCount);
+        lock.unlock();
+        m_queue->signalWorkBegin(m_parent, rect, worker);
+        m_queue->signalWorkEnd(m_parent, cached, false);
+    }
 }
 
 ParallelProcess::EStatus BlockedRenderProcess::generateWork(WorkUnit *unit, int worker) {
-    EStatus status = BlockedImageProcess::generateWork(unit, worker);
+    EStatus status = m_progressive ? nextProgressiveBlock(unit)
+        : (m_adaptive ? nextAdaptiveBlock(unit)
+        : nextUncachedBlock(unit, worker));
     if (status == ESuccess)
         m_queue->signalWorkBegin(m_parent, static_cast<RectangularWorkUnit *>(unit), worker);
     return status;
 }
 
+ParallelProcess::EStatus BlockedRenderProcess::generateWorkBatch(WorkUnit * const *units,
+        size_t count, size_t &generated, int worker) {
+    EStatus status;
+    if (m_progressive) {
+        generated = 0;
+        status = ESuccess;
+        while (generated < count && (status = nextProgressiveBlock(units[generated])) == ESuccess)
+            ++generated;
+    } else if (m_adaptive) {
+        generated = 0;
+        status = ESuccess;
+        while (generated < count && (status = nextAdaptiveBlock(units[generated])) == ESuccess)
+            ++generated;
+    } else if (m_cachePrevious) {
+        generated = 0;
+        status = ESuccess;
+        while (generated < count && (status = nextUncachedBlock(units[generated], worker)) == ESuccess)
+            ++generated;
+    } else {
+        status = BlockedImageProcess::generateWorkBatch(units, count, generated, worker);
+    }
+    for (size_t i=0; i<generated; ++i)
+        m_queue->signalWorkBegin(m_parent, static_cast<RectangularWorkUnit *>(units[i]), worker);
+    return status;
+}
+
 void BlockedRenderProcess::bindResource(const std::string &name, int id) {
     if (name == "sensor") {
         m_film = static_cast<Sensor *>(Scheduler::getInstance()->getResource(id))->getFilm();
@@ -183,4 +714,5 @@ void BlockedRenderProcess::bindResource(const std::string &name, int id) {
 
 MTS_IMPLEMENT_CLASS(BlockedRenderProcess, false, BlockedImageProcess)
 MTS_IMPLEMENT_CLASS_S(BlockRenderer, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(BlockWorkUnit, false, RectangularWorkUnit)
 MTS_NAMESPACE_END
@@ -30,6 +30,7 @@ void RenderListener::finishJobEvent(const RenderJob *job, bool cancelled) { }
 RenderQueue::RenderQueue() {
     m_mutex = new Mutex();
     m_joinMutex = new Mutex();
+    m_flushMutex = new Mutex();
     m_cond = new ConditionVariable(m_mutex);
     m_timer = new Timer();
 }
@@ -71,13 +72,26 @@ Float RenderQueue::getRenderTime(const RenderJob *job) const {
 }
 
 void RenderQueue::flush() {
-    LockGuard lock(m_mutex);
-    std::map<RenderJob *, JobRecord>::iterator it = m_jobs.begin();
-    for (; it != m_jobs.end(); ++it)
-        (*it).first->flush();
+    /* Only one flush at a time. This also keeps jobs from being removed
+       while they are being flushed (see removeJob()) */
+    LockGuard flushLock(m_flushMutex);
+
+    /* Take a snapshot of the job list -- the queue lock is not held while
+       developing, since that would stall the workers of all jobs */
+    std::vector<RenderJob *> jobs;
+    {
+        LockGuard lock(m_mutex);
+        std::map<RenderJob *, JobRecord>::iterator it = m_jobs.begin();
+        for (; it != m_jobs.end(); ++it)
+            jobs.push_back((*it).first);
+    }
+
+    for (size_t i=0; i<jobs.size(); ++i)
+        jobs[i]->flush();
 }
 
 void RenderQueue::removeJob(RenderJob *job, bool cancelled) {
+    LockGuard flushLock(m_flushMutex);
     LockGuard lock(m_mutex);
     std::map<RenderJob *, JobRecord>::iterator it = m_jobs.find(job);
     if (it == m_jobs.end())
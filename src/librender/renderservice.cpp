@@ -0,0 +1,346 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/renderservice.h>
+#include <mitsuba/render/renderjob.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+RenderRequest::RenderRequest(Stream *stream) {
+    hasTransform = stream->readBool();
+    toWorld = Transform(stream);
+    fov = stream->readFloat();
+    size = Vector2i(stream);
+    cropOffset = Point2i(stream);
+    cropSize = Vector2i(stream);
+    sampleCount = stream->readInt();
+    fileFormat = (Bitmap::EFileFormat) stream->readInt();
+}
+
+void RenderRequest::serialize(Stream *stream) const {
+    stream->writeBool(hasTransform);
+    toWorld.serialize(stream);
+    stream->writeFloat(fov);
+    size.serialize(stream);
+    cropOffset.serialize(stream);
+    cropSize.serialize(stream);
+    stream->writeInt(sampleCount);
+    stream->writeInt((int) fileFormat);
+}
+
+std::string RenderRequest::toString() const {
+    std::ostringstream oss;
+    oss << "RenderRequest[" << endl
+        << "  hasTransform = " << hasTransform << "," << endl;
+    if (hasTransform)
+        oss << "  toWorld = " << indent(toWorld.toString()) << "," << endl;
+    oss << "  fov = " << fov << "," << endl
+        << "  size = " << size.toString() << "," << endl
+        << "  cropOffset = " << cropOffset.toString() << "," << endl
+        << "  cropSize = " << cropSize.toString() << "," << endl
+        << "  sampleCount = " << sampleCount << "," << endl
+        << "  fileFormat = " << (int) fileFormat << endl
+        << "]";
+    return oss.str();
+}
+
+RenderService::RenderService() : m_jobIndex(0) {
+    m_mutex = new Mutex();
+}
+
+RenderService::~RenderService() {
+    Scheduler *sched = Scheduler::getInstance();
+    for (std::map<std::string, SceneRecord>::iterator it = m_scenes.begin();
+            it != m_scenes.end(); ++it)
+        sched->unregisterResource(it->second.resID);
+}
+
+void RenderService::loadScene(const std::string &name, const fs::path &filename,
+        const SceneHandler::ParameterMap &params) {
+    Thread *thread = Thread::getThread();
+    ref<FileResolver> resolver = thread->getFileResolver();
+    fs::path path = resolver->resolve(filename);
+
+    /* Resolve relative references with respect to the scene directory */
+    ref<FileResolver> frClone = resolver->clone();
+    frClone->prependPath(fs::absolute(path).parent_path());
+    thread->setFileResolver(frClone);
+
+    ref<Timer> timer = new Timer();
+    SceneRecord record;
+    try {
+        record.scene = SceneHandler::loadScene(path, params);
+        record.scene->setSourceFile(path);
+        record.scene->initialize();
+    } catch (...) {
+        thread->setFileResolver(resolver);
+        throw;
+    }
+    thread->setFileResolver(resolver);
+
+    record.resID = Scheduler::getInstance()->registerResource(record.scene);
+    record.mutex = new Mutex();
+
+    SceneRecord previous;
+    {
+        LockGuard lock(m_mutex);
+        std::map<std::string, SceneRecord>::iterator it = m_scenes.find(name);
+        if (it != m_scenes.end())
+            previous = it->second;
+        m_scenes[name] = record;
+    }
+
+    if (previous.scene) {
+        /* Wait for a job that may still be rendering the old version */
+        LockGuard lock(previous.mutex);
+        Scheduler::getInstance()->unregisterResource(previous.resID);
+    }
+
+    Log(EInfo, "Loaded scene \"%s\" from \"%s\" in %s", name.c_str(),
+        path.string().c_str(), timeString(timer->getSeconds()).c_str());
+}
+
+bool RenderService::unloadScene(const std::string &name) {
+    SceneRecord record;
+    {
+        LockGuard lock(m_mutex);
+        std::map<std::string, SceneRecord>::iterator it = m_scenes.find(name);
+        if (it == m_scenes.end())
+            return false;
+        record = it->second;
+        m_scenes.erase(it);
+    }
+    LockGuard lock(record.mutex);
+    Scheduler::getInstance()->unregisterResource(record.resID);
+    Log(EInfo, "Unloaded scene \"%s\"", name.c_str());
+    return true;
+}
+
+bool RenderService::hasScene(const std::string &name) const {
+    LockGuard lock(m_mutex);
+    return m_scenes.find(name) != m_scenes.end();
+}
+
+ref<Bitmap> RenderService::render(const std::string &name,
+        const RenderRequest &request, Float &renderTime) {
+    SceneRecord record;
+    int jobIndex;
+    {
+        LockGuard lock(m_mutex);
+        std::map<std::string, SceneRecord>::iterator it = m_scenes.find(name);
+        if (it == m_scenes.end())
+            Log(EError, "render(): the scene \"%s\" is not loaded!", name.c_str());
+        record = it->second;
+        jobIndex = m_jobIndex++;
+    }
+
+    /* The integrator is shared by all jobs of a scene */
+    LockGuard lock(record.mutex);
+    PluginManager *pluginMgr = PluginManager::getInstance();
+    Scene *base = record.scene;
+    Sensor *baseSensor = base->getSensor();
+    Film *baseFilm = baseSensor->getFilm();
+
+    Properties filmProps = baseFilm->getProperties();
+    if (request.size.x > 0 && request.size.y > 0) {
+        filmProps.setInteger("width", request.size.x, false);
+        filmProps.setInteger("height", request.size.y, false);
+        if (request.cropSize.x <= 0 || request.cropSize.y <= 0) {
+            /* The previous crop window may not fit the new resolution */
+            filmProps.removeProperty("cropOffsetX");
+            filmProps.removeProperty("cropOffsetY");
+            filmProps.removeProperty("cropWidth");
+            filmProps.removeProperty("cropHeight");
+        }
+    }
+    if (request.cropSize.x > 0 && request.cropSize.y > 0) {
+        filmProps.setInteger("cropOffsetX", request.cropOffset.x, false);
+        filmProps.setInteger("cropOffsetY", request.cropOffset.y, false);
+        filmProps.setInteger("cropWidth", request.cropSize.x, false);
+        filmProps.setInteger("cropHeight", request.cropSize.y, false);
+    }
+    ref<Film> film = static_cast<Film *> (pluginMgr->
+        createObject(MTS_CLASS(Film), filmProps));
+    film->addChild(baseFilm->getReconstructionFilter());
+    film->configure();
+
+    Properties samplerProps = base->getSampler()->getProperties();
+    if (request.sampleCount > 0)
+        samplerProps.setInteger("sampleCount", request.sampleCount, false);
+    ref<Sampler> sampler = static_cast<Sampler *> (pluginMgr->
+        createObject(MTS_CLASS(Sampler), samplerProps));
+    sampler->configure();
+
+    Properties sensorProps = baseSensor->getProperties();
+    if (request.hasTransform)
+        sensorProps.setTransform("toWorld", request.toWorld, false);
+    if (request.fov > 0) {
+        sensorProps.removeProperty("focalLength");
+        sensorProps.setFloat("fov", request.fov, false);
+    }
+    ref<Sensor> sensor = static_cast<Sensor *> (pluginMgr->
+        createObject(MTS_CLASS(Sensor), sensorProps));
+    sensor->addChild(film);
+    sensor->addChild(sampler);
+    if (baseSensor->getMedium())
+        sensor->addChild(baseSensor->getMedium());
+    sensor->configure();
+
+    /* Shallow copy -- the shapes and the acceleration data structure
+       are shared with the resident scene */
+    ref<Scene> scene = new Scene(base);
+    scene->removeSensor(baseSensor);
+    scene->addSensor(sensor);
+    scene->setSensor(sensor);
+    scene->setSampler(sampler);
+    scene->setDestinationFile(fs::path());
+
+    ref<Timer> timer = new Timer();
+    ref<RenderQueue> queue = new RenderQueue();
+    ref<RenderJob> job = new RenderJob(formatString("srv%i", jobIndex),
+        scene, queue, record.resID, -1, -1, false, false);
+    job->start();
+    bool success = job->wait();
+    renderTime = timer->getSeconds();
+    if (!success)
+        Log(EError, "render(): rendering of scene \"%s\" did not complete successfully!",
+            name.c_str());
+
+    Bitmap::EComponentFormat componentFormat =
+        (request.fileFormat == Bitmap::EOpenEXR || request.fileFormat == Bitmap::ERGBE
+         || request.fileFormat == Bitmap::EPFM) ? Bitmap::EFloat32 : Bitmap::EUInt8;
+    ref<Bitmap> bitmap = new Bitmap(film->hasAlpha() ? Bitmap::ERGBA : Bitmap::ERGB,
+        componentFormat, film->getCropSize());
+    if (!film->develop(Point2i(0), film->getCropSize(), Point2i(0), bitmap))
+        Log(EError, "render(): unable to develop the film!");
+    return bitmap;
+}
+
+std::string RenderService::toString() const {
+    LockGuard lock(m_mutex);
+    std::ostringstream oss;
+    oss << "RenderService[" << endl
+        << "  scenes = {";
+    for (std::map<std::string, SceneRecord>::const_iterator it = m_scenes.begin();
+            it != m_scenes.end(); ++it)
+        oss << (it == m_scenes.begin() ? " " : ", ") << "\"" << it->first << "\"";
+    oss << " }" << endl
+        << "]";
+    return oss.str();
+}
+
+RenderServiceConnection::RenderServiceConnection(const std::string &name,
+        RenderService *service, Stream *stream, bool detach)
+    : Thread(name), m_service(service), m_stream(stream), m_detach(detach) { }
+
+void RenderServiceConnection::sendError(const std::string &message) {
+    Log(EWarn, "%s", message.c_str());
+    m_stream->writeShort(RenderService::EFailure);
+    m_stream->writeString(message);
+    m_stream->flush();
+}
+
+void RenderServiceConnection::run() {
+    if (m_detach)
+        detach();
+
+    ref<MemoryStream> image = new MemoryStream();
+    while (true) {
+        short msg;
+        try {
+            msg = m_stream->readShort();
+        } catch (const std::exception &) {
+            /* The client disconnected */
+            break;
+        }
+
+        try {
+            if (msg == RenderService::EQuit)
+                break;
+
+            switch (msg) {
+                case RenderService::ELoadScene: {
+                        std::string name = m_stream->readString();
+                        std::string filename = m_stream->readString();
+                        SceneHandler::ParameterMap params;
+                        int count = m_stream->readInt();
+                        for (int i=0; i<count; ++i) {
+                            std::string key = m_stream->readString();
+                            params[key] = m_stream->readString();
+                        }
+                        try {
+                            m_service->loadScene(name, filename, params);
+                            m_stream->writeShort(RenderService::ESuccess);
+                            m_stream->flush();
+                        } catch (const std::exception &ex) {
+                            sendError(formatString("Unable to load the scene \"%s\": %s",
+                                name.c_str(), ex.what()));
+                        }
+                    }
+                    break;
+                case RenderService::EUnloadScene: {
+                        std::string name = m_stream->readString();
+                        if (m_service->unloadScene(name)) {
+                            m_stream->writeShort(RenderService::ESuccess);
+                            m_stream->flush();
+                        } else {
+                            sendError(formatString("The scene \"%s\" is not loaded!",
+                                name.c_str()));
+                        }
+                    }
+                    break;
+                case RenderService::ERender: {
+                        std::string name = m_stream->readString();
+                        RenderRequest request(m_stream);
+                        Float renderTime = 0;
+                        try {
+                            ref<Bitmap> bitmap = m_service->render(name, request, renderTime);
+                            image->reset();
+                            bitmap->write(request.fileFormat, image);
+                        } catch (const std::exception &ex) {
+                            sendError(formatString("Unable to render the scene \"%s\": %s",
+                                name.c_str(), ex.what()));
+                            break;
+                        }
+                        m_stream->writeShort(RenderService::EImage);
+                        m_stream->writeFloat(renderTime);
+                        m_stream->writeSize(image->getSize());
+                        m_stream->write(image->getData(), image->getSize());
+                        m_stream->flush();
+                    }
+                    break;
+                default:
+                    Log(EError, "Received an unknown message (type %i)", msg);
+            }
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Closing the connection: %s", ex.what());
+            break;
+        }
+    }
+    Log(EInfo, "Client disconnected");
+}
+
+MTS_IMPLEMENT_CLASS(RenderService, false, Object)
+MTS_IMPLEMENT_CLASS(RenderServiceConnection, false, Thread)
+MTS_NAMESPACE_END
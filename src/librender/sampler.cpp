@@ -48,6 +48,8 @@ void Sampler::serialize(Stream *stream, InstanceManager *manager) const {
 
 void Sampler::setFilmResolution(const Vector2i &, bool) { }
 
+void Sampler::setBlock(const Point2i &, const Vector2i &) { }
+
 void Sampler::generate(const Point2i &) {
     m_sampleIndex = 0;
     m_dimension1DArray = m_dimension2DArray = 0;
@@ -69,6 +71,16 @@ void Sampler::setSampleIndex(size_t sampleIndex) {
     m_dimension1DArray = m_dimension2DArray = 0;
 }
 
+void Sampler::next1DBatch(Float *values, size_t count) {
+    for (size_t i=0; i<count; ++i)
+        values[i] = next1D();
+}
+
+void Sampler::next2DBatch(Point2 *values, size_t count) {
+    for (size_t i=0; i<count; ++i)
+        values[i] = next2D();
+}
+
 void Sampler::request1DArray(size_t size) {
     m_req1D.push_back(size);
     m_sampleArrays1D.push_back(new Float[m_sampleCount * size]);
@@ -18,26 +18,48 @@
 
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/renderjob.h>
+#include <mitsuba/render/trcache.h>
+#include <mitsuba/render/emittertree.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
+#if defined(MTS_HAS_COHERENT_RT)
+#include <mitsuba/core/ray_sse.h>
+#endif
 
 #define DEFAULT_BLOCKSIZE 32
 
 MTS_NAMESPACE_BEGIN
 
+#if defined(MTS_HOTPATH_TIMING)
+namespace hotpath {
+    StatsCounter rayIntersect("Hot paths", "Ray intersection", ECycleCount);
+    StatsCounter bsdfSample("Hot paths", "BSDF sampling", ECycleCount);
+    StatsCounter bsdfEval("Hot paths", "BSDF evaluation", ECycleCount);
+    StatsCounter emitterSample("Hot paths", "Emitter sampling", ECycleCount);
+    StatsCounter mediumSample("Hot paths", "Medium distance sampling", ECycleCount);
+    StatsCounter imageBlockPut("Hot paths", "Image block splatting", ECycleCount);
+};
+#endif
+
 // ===========================================================================
 //         Constructors, destructor and serialization-related code
 // ===========================================================================
 
 Scene::Scene()
- : NetworkedObject(Properties()), m_blockSize(DEFAULT_BLOCKSIZE) {
+ : NetworkedObject(Properties()), m_blockSize(DEFAULT_BLOCKSIZE),
+   m_blockOrder(BlockedImageProcess::ESpiral), m_kdCache(false),
+   m_emitterTreeSampling(false), m_footprint(NULL),
+   m_lastShape(NULL), m_lastShapeFootprint(NULL) {
     m_kdtree = new ShapeKDTree();
     m_sourceFile = new fs::path();
     m_destinationFile = new fs::path();
 }
 
 Scene::Scene(const Properties &props)
- : NetworkedObject(props), m_blockSize(DEFAULT_BLOCKSIZE) {
+ : NetworkedObject(props), m_blockSize(DEFAULT_BLOCKSIZE),
+   m_blockOrder(BlockedImageProcess::ESpiral), m_footprint(NULL),
+   m_lastShape(NULL), m_lastShapeFootprint(NULL) {
     m_kdtree = new ShapeKDTree();
     /* kd-tree construction: Enable primitive clipping? Generally leads to a
       significant improvement of the resulting tree. */
@@ -76,13 +98,37 @@ Scene::Scene(const Properties &props)
        in succession before a leaf node will be created.*/
     if (props.hasProperty("kdMaxBadRefines"))
         m_kdtree->setMaxBadRefines(props.getInteger("kdMaxBadRefines"));
+    /* kd-tree construction: store the tree next to the scene file and
+       memory-map it in subsequent runs if the geometry is unchanged? */
+    m_kdCache = props.getBoolean("kdCache", false);
+    /* Acceleration data structure: 'kdtree' (default) or a 4-wide 'bvh' */
+    std::string accelerator = props.getString("accelerator", "kdtree");
+    if (accelerator == "bvh")
+        m_bvh = new ShapeBVH();
+    else if (accelerator != "kdtree")
+        Log(EError, "Unknown acceleration data structure \"%s\" (must be "
+            "\"kdtree\" or \"bvh\")", accelerator.c_str());
+    /* Emitter selection for direct illumination: proportional to the sampling
+       weights ('discrete', default) or via a light hierarchy ('tree') */
+    std::string emitterSampling = props.getString("emitterSampling", "discrete");
+    if (emitterSampling == "tree")
+        m_emitterTreeSampling = true;
+    else if (emitterSampling == "discrete")
+        m_emitterTreeSampling = false;
+    else
+        Log(EError, "Unknown emitter sampling strategy \"%s\" (must be "
+            "\"discrete\" or \"tree\")", emitterSampling.c_str());
     m_sourceFile = new fs::path();
     m_destinationFile = new fs::path();
 }
 
-Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
+Scene::Scene(Scene *scene) : NetworkedObject(Properties()), m_footprint(NULL),
+   m_lastShape(NULL), m_lastShapeFootprint(NULL) {
     m_kdtree = scene->m_kdtree;
+    m_bvh = scene->m_bvh;
     m_blockSize = scene->m_blockSize;
+    m_blockOrder = scene->m_blockOrder;
+    m_kdCache = scene->m_kdCache;
     m_aabb = scene->m_aabb;
     m_environmentEmitter = scene->m_environmentEmitter;
     m_sensor = scene->m_sensor;
@@ -90,6 +136,8 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
     m_sourceFile = new fs::path(*scene->m_sourceFile);
     m_destinationFile = new fs::path(*scene->m_destinationFile);
     m_emitterPDF = scene->m_emitterPDF;
+    m_emitterTree = scene->m_emitterTree;
+    m_emitterTreeSampling = scene->m_emitterTreeSampling;
     m_shapes = scene->m_shapes;
     m_sensors = scene->m_sensors;
     m_meshes = scene->m_meshes;
@@ -104,7 +152,8 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
 }
 
 Scene::Scene(Stream *stream, InstanceManager *manager)
- : NetworkedObject(stream, manager) {
+ : NetworkedObject(stream, manager), m_footprint(NULL),
+   m_lastShape(NULL), m_lastShapeFootprint(NULL) {
     m_kdtree = new ShapeKDTree();
     m_kdtree->setQueryCost(stream->readFloat());
     m_kdtree->setTraversalCost(stream->readFloat());
@@ -116,7 +165,12 @@ Scene::Scene(Stream *stream, InstanceManager *manager)
     m_kdtree->setParallelBuild(stream->readBool());
     m_kdtree->setRetract(stream->readBool());
     m_kdtree->setMaxBadRefines(stream->readUInt());
+    m_kdCache = false;
+    if (stream->readBool())
+        m_bvh = new ShapeBVH();
+    m_emitterTreeSampling = stream->readBool();
     m_blockSize = stream->readUInt();
+    m_blockOrder = (BlockedImageProcess::EBlockOrder) stream->readInt();
     m_degenerateSensor = stream->readBool();
     m_degenerateEmitters = stream->readBool();
     m_aabb = AABB(stream);
@@ -182,7 +236,10 @@ void Scene::serialize(Stream *stream, InstanceManager *manager) const {
     stream->writeBool(m_kdtree->getParallelBuild());
     stream->writeBool(m_kdtree->getRetract());
     stream->writeUInt(m_kdtree->getMaxBadRefines());
+    stream->writeBool(m_bvh.get() != NULL);
+    stream->writeBool(m_emitterTreeSampling);
     stream->writeUInt(m_blockSize);
+    stream->writeInt(m_blockOrder);
     stream->writeBool(m_degenerateSensor);
     stream->writeBool(m_degenerateEmitters);
     m_aabb.serialize(stream);
@@ -317,10 +374,111 @@ void Scene::configure() {
 
 void Scene::invalidate() {
     m_kdtree = new ShapeKDTree();
+    if (m_bvh)
+        m_bvh = new ShapeBVH();
+}
+
+bool Scene::commit(bool geometryChanged) {
+    if (m_bvh ? !m_bvh->isBuilt() : !m_kdtree->isBuilt()) {
+        initialize();
+        return true;
+    }
+
+    /* Detect moved shapes (e.g. instances with a new transformation) */
+    size_t moved = 0;
+    m_shapeBounds.resize(m_shapes.size());
+    for (size_t i=0; i<m_shapes.size(); ++i) {
+        AABB aabb = m_shapes[i]->getAABB();
+        if (aabb != m_shapeBounds[i]) {
+            m_shapeBounds[i] = aabb;
+            ++moved;
+        }
+    }
+
+    if (moved == 0 && !geometryChanged)
+        return false;
+
+    ref<Timer> timer = new Timer();
+    if (m_bvh) {
+        m_bvh->refit();
+    } else {
+        /* The kd-tree cannot be refit -- rebuild the top level */
+        const std::vector<const Shape *> &shapes = m_kdtree->getShapes();
+        ref<ShapeKDTree> kdtree = new ShapeKDTree();
+        kdtree->setClip(m_kdtree->getClip());
+        kdtree->setQueryCost(m_kdtree->getQueryCost());
+        kdtree->setTraversalCost(m_kdtree->getTraversalCost());
+        kdtree->setEmptySpaceBonus(m_kdtree->getEmptySpaceBonus());
+        kdtree->setStopPrims(m_kdtree->getStopPrims());
+        kdtree->setMaxDepth(m_kdtree->getMaxDepth());
+        kdtree->setExactPrimitiveThreshold(m_kdtree->getExactPrimitiveThreshold());
+        kdtree->setParallelBuild(m_kdtree->getParallelBuild());
+        kdtree->setRetract(m_kdtree->getRetract());
+        kdtree->setMaxBadRefines(m_kdtree->getMaxBadRefines());
+        for (size_t i=0; i<shapes.size(); ++i)
+            kdtree->addShape(shapes[i]);
+        kdtree->build();
+        m_kdtree = kdtree;
+    }
+    m_aabb = m_bvh ? m_bvh->getAABB() : m_kdtree->getAABB();
+    initializeBidirectional();
+
+    Log(EDebug, "Committed the changes of " SIZE_T_FMT " shape(s) in %i ms",
+        moved, timer->getMilliseconds());
+    return true;
+}
+
+/// Collect the primitive shapes of a shape like \ref Scene::addShape()
+static void expandShape(Shape *shape, std::vector<const Shape *> &shapes) {
+    if (shape->isCompound()) {
+        int index = 0;
+        do {
+            ref<Shape> element = shape->getElement(index++);
+            if (element == NULL)
+                break;
+            expandShape(element, shapes);
+        } while (true);
+    } else {
+        shapes.push_back(shape);
+    }
+}
+
+bool Scene::reuseGeometry(const Scene *scene) {
+    if ((m_bvh ? m_bvh->isBuilt() : m_kdtree->isBuilt())
+        || (scene->m_bvh.get() != NULL) != (m_bvh.get() != NULL)
+        || (scene->m_bvh.get() ? !scene->m_bvh->isBuilt() : !scene->m_kdtree->isBuilt()))
+        return false;
+
+    m_shapes.ensureUnique();
+    std::vector<const Shape *> shapes;
+    for (size_t i=0; i<m_shapes.size(); ++i)
+        expandShape(m_shapes[i], shapes);
+    if (shapes.size() != scene->m_shapes.size())
+        return false;
+    for (size_t i=0; i<shapes.size(); ++i) {
+        if (shapes[i] != scene->m_shapes[i].get())
+            return false;
+    }
+
+    /* Register the shapes (and their emitters, media, etc.) like
+       initialize(), but keep the existing acceleration data structure */
+    ref_vector<Shape> temp;
+    m_shapes.swap(temp);
+    for (size_t i=0; i<temp.size(); ++i)
+        addShape(temp[i]);
+
+    m_kdtree = scene->m_kdtree;
+    m_bvh = scene->m_bvh;
+    m_aabb = scene->m_aabb;
+    m_shapeBounds = scene->m_shapeBounds;
+
+    Log(EInfo, "Reusing the %s of the previous scene (" SIZE_T_FMT " shapes)",
+        m_bvh ? "BVH" : "kd-tree", m_shapes.size());
+    return true;
 }
 
 void Scene::initialize() {
-    if (!m_kdtree->isBuilt()) {
+    if (m_bvh ? !m_bvh->isBuilt() : !m_kdtree->isBuilt()) {
         /* Expand all geometry */
         ref_vector<Shape> temp;
         temp.reserve(m_shapes.size());
@@ -341,10 +499,21 @@ void Scene::initialize() {
                 SIZE_T_FMT ".", primitiveCount, effPrimitiveCount);
         }
 
-        /* Build the kd-tree */
-        m_kdtree->build();
+        if (m_bvh) {
+            /* Build the BVH */
+            m_bvh->build();
+        } else {
+            /* Build the kd-tree (or load it from the cache) */
+            if (m_kdCache && !m_sourceFile->empty())
+                m_kdtree->setCacheDirectory(fs::absolute(*m_sourceFile).parent_path());
+            m_kdtree->build();
+        }
 
-        m_aabb = m_kdtree->getAABB();
+        m_aabb = m_bvh ? m_bvh->getAABB() : m_kdtree->getAABB();
+
+        m_shapeBounds.resize(m_shapes.size());
+        for (size_t i=0; i<m_shapes.size(); ++i)
+            m_shapeBounds[i] = m_shapes[i]->getAABB();
     }
 
     /* Make sure that there are no duplicates */
@@ -380,11 +549,14 @@ void Scene::initialize() {
         m_emitterPDF.normalize();
     }
 
+    if (m_emitterTreeSampling && !m_emitterTree)
+        m_emitterTree = new EmitterTree(m_emitters);
+
     initializeBidirectional();
 }
 
 void Scene::initializeBidirectional() {
-    m_aabb = m_kdtree->getAABB();
+    m_aabb = m_bvh ? m_bvh->getAABB() : m_kdtree->getAABB();
     m_degenerateEmitters = true;
     m_specialShapes.clear();
 
@@ -415,13 +587,18 @@ void Scene::initializeBidirectional() {
 
 bool Scene::preprocess(RenderQueue *queue, const RenderJob *job,
         int sceneResID, int sensorResID, int samplerResID) {
+    ScopedPhase phase("Preprocess");
 
     initialize();
 
     /* Pre-process step for the main scene integrator */
-    if (!m_integrator->preprocess(this, queue, job,
-        sceneResID, sensorResID, samplerResID))
-        return false;
+    {
+        ScopedPhase integratorPhase(formatString("Integrator \"%s\"",
+            m_integrator->getClass()->getName().c_str()));
+        if (!m_integrator->preprocess(this, queue, job,
+            sceneResID, sensorResID, samplerResID))
+            return false;
+    }
 
     /* Pre-process step for all sub-surface integrators (each one in independence) */
     for (ref_vector<Subsurface>::iterator it = m_ssIntegrators.begin();
@@ -443,6 +620,7 @@ bool Scene::preprocess(RenderQueue *queue, const RenderJob *job,
 
 bool Scene::render(RenderQueue *queue, const RenderJob *job,
         int sceneResID, int sensorResID, int samplerResID) {
+    ScopedPhase phase("Render");
     m_sensor->getFilm()->clear();
     return m_integrator->render(this, queue, job, sceneResID,
         sensorResID, samplerResID);
@@ -586,7 +764,10 @@ void Scene::addShape(Shape *shape) {
         if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
             m_meshes.push_back(static_cast<TriMesh *>(shape));
 
-        m_kdtree->addShape(shape);
+        if (m_bvh)
+            m_bvh->addShape(shape);
+        else
+            m_kdtree->addShape(shape);
         m_shapes.push_back(shape);
     }
 }
@@ -599,6 +780,7 @@ std::string Scene::toString() const {
         << "  sampler = " << indent(m_sampler.toString()) << "," << endl
         << "  integrator = " << indent(m_integrator.toString()) << "," << endl
         << "  kdtree = " << indent(m_kdtree.toString()) << "," << endl
+        << "  bvh = " << indent(m_bvh.toString()) << "," << endl
         << "  environmentEmitter = " << indent(m_environmentEmitter.toString()) << "," << endl
         << "  shapes = " << indent(containerToString(m_shapes.begin(), m_shapes.end())) << "," << endl
         << "  emitters = " << indent(containerToString(m_emitters.begin(), m_emitters.end())) << "," << endl
@@ -624,7 +806,7 @@ Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point
 
     Float lengthFactor = p2OnSurface ? (1-ShadowEpsilon) : 1;
     Ray ray(p1, d, p1OnSurface ? Epsilon : 0, remaining * lengthFactor, time);
-    Spectrum transmittance(1.0f);
+    TransmittanceAccumulator transmittance(medium);
     Intersection its;
     int maxInteractions = interactions;
     interactions = 0;
@@ -639,9 +821,7 @@ Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point
             return Spectrum(0.0f);
         }
 
-        if (medium)
-            transmittance *= medium->evalTransmittance(
-                Ray(ray, 0, std::min(its.t, remaining)), sampler);
+        transmittance.append(Ray(ray, 0, std::min(its.t, remaining)), sampler);
 
         if (!surface || transmittance.isZero())
             break;
@@ -654,7 +834,7 @@ Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point
         Vector wo = its.geoFrame.toLocal(ray.d);
         BSDFSamplingRecord bRec(its, -wo, wo, ERadiance);
         bRec.typeMask = BSDF::ENull;
-        transmittance *= bsdf->eval(bRec, EDiscrete);
+        transmittance.scale(bsdf->eval(bRec, EDiscrete));
 
         if (its.isMediumTransition()) {
             if (medium != its.getTargetMedium(-d)) {
@@ -662,6 +842,7 @@ Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point
                 return Spectrum(0.0f);
             }
             medium = its.getTargetMedium(d);
+            transmittance.setMedium(medium);
         }
 
         if (++interactions > 100) { /// Just a precaution..
@@ -675,7 +856,75 @@ Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point
         ray.mint = Epsilon;
     }
 
-    return transmittance;
+    return transmittance.get();
+}
+
+void Scene::rayIntersectPacket(const Ray *rays, Intersection *its) const {
+#if defined(MTS_HAS_COHERENT_RT)
+    RayPacket4 MM_ALIGN16 packet;
+
+    /* Packets whose direction signs disagree are faster to trace one by one */
+    if (!m_bvh.get() && packet.load(rays)) {
+        uint8_t temp[MTS_KD_INTERSECTION_TEMP * 4];
+        RayInterval4 MM_ALIGN16 interval;
+        Intersection4 MM_ALIGN16 its4;
+
+        for (int i=0; i<4; ++i) {
+            /* Use an adaptive ray epsilon (as in ShapeKDTree::rayIntersect) */
+            Float mint = rays[i].mint;
+            if (mint == Epsilon)
+                mint *= std::max(std::max(std::max(std::abs(rays[i].o.x),
+                    std::abs(rays[i].o.y)), std::abs(rays[i].o.z)), Epsilon);
+            interval.mint.f[i] = mint;
+            interval.maxt.f[i] = rays[i].maxt;
+        }
+
+        m_kdtree->rayIntersectPacket(packet, interval, its4, temp);
+
+        for (int i=0; i<4; ++i) {
+            if (its4.t.f[i] < std::numeric_limits<Float>::infinity())
+                m_kdtree->fillPacketIntersectionRecord(rays[i], its4, i, temp, its[i]);
+            else
+                its[i].t = std::numeric_limits<Float>::infinity();
+        }
+        return;
+    }
+#endif
+    for (int i=0; i<4; ++i)
+        rayIntersect(rays[i], its[i]);
+}
+
+void Scene::rayIntersectStream(const Ray *rays, Intersection *its, size_t count) const {
+    size_t i = 0;
+#if defined(MTS_HAS_COHERENT_RT)
+    if (!m_bvh.get()) {
+        for (; i+4 <= count; i += 4)
+            rayIntersectPacket(rays + i, its + i);
+        if (EXPECT_NOT_TAKEN(m_footprint != NULL)) {
+            for (size_t j=0; j<i; ++j)
+                if (its[j].isValid())
+                    recordFootprint(its[j].shape);
+        }
+    }
+#endif
+    for (; i<count; ++i)
+        rayIntersect(rays[i], its[i]);
+}
+
+void Scene::recordFootprint(const Shape *shape) const {
+    if (shape != m_lastShape) {
+        std::map<const Shape *, ObjectFootprint>::iterator it
+            = m_shapeFootprints.find(shape);
+        if (it == m_shapeFootprints.end()) {
+            ObjectFootprint footprint(shape->getID());
+            if (shape->getBSDF())
+                footprint.insert(shape->getBSDF()->getID());
+            it = m_shapeFootprints.insert(std::make_pair(shape, footprint)).first;
+        }
+        m_lastShape = shape;
+        m_lastShapeFootprint = &it->second;
+    }
+    m_footprint->insert(*m_lastShapeFootprint);
 }
 
 // ===========================================================================
@@ -767,7 +1016,7 @@ Spectrum Scene::evalTransmittanceAll(const Point &p1, bool p1OnSurface, const Po
 
     Float lengthFactor = p2OnSurface ? (1-ShadowEpsilon) : 1;
     Ray ray(p1, d, p1OnSurface ? Epsilon : 0, remaining * lengthFactor, time);
-    Spectrum transmittance(1.0f);
+    TransmittanceAccumulator transmittance(medium);
     Intersection its;
     int maxInteractions = interactions;
     interactions = 0;
@@ -782,9 +1031,7 @@ Spectrum Scene::evalTransmittanceAll(const Point &p1, bool p1OnSurface, const Po
             return Spectrum(0.0f);
         }
 
-        if (medium)
-            transmittance *= medium->evalTransmittance(
-                Ray(ray, 0, std::min(its.t, remaining)), sampler);
+        transmittance.append(Ray(ray, 0, std::min(its.t, remaining)), sampler);
 
         if (!surface || transmittance.isZero())
             break;
@@ -797,7 +1044,7 @@ Spectrum Scene::evalTransmittanceAll(const Point &p1, bool p1OnSurface, const Po
         Vector wo = its.geoFrame.toLocal(ray.d);
         BSDFSamplingRecord bRec(its, -wo, wo, ERadiance);
         bRec.typeMask = BSDF::ENull;
-        transmittance *= bsdf->eval(bRec, EDiscrete);
+        transmittance.scale(bsdf->eval(bRec, EDiscrete));
 
         if (its.isMediumTransition()) {
             if (medium != its.getTargetMedium(-d)) {
@@ -805,6 +1052,7 @@ Spectrum Scene::evalTransmittanceAll(const Point &p1, bool p1OnSurface, const Po
                 return Spectrum(0.0f);
             }
             medium = its.getTargetMedium(d);
+            transmittance.setMedium(medium);
         }
 
         if (++interactions > 100) { /// Just a precaution..
@@ -818,7 +1066,7 @@ Spectrum Scene::evalTransmittanceAll(const Point &p1, bool p1OnSurface, const Po
         ray.mint = Epsilon;
     }
 
-    return transmittance;
+    return transmittance.get();
 }
 
 // ===========================================================================
@@ -827,11 +1075,12 @@ Spectrum Scene::evalTransmittanceAll(const Point &p1, bool p1OnSurface, const Po
 
 Spectrum Scene::sampleEmitterDirect(DirectSamplingRecord &dRec,
         const Point2 &_sample, bool testVisibility) const {
+    MTS_HOTPATH_SCOPE(emitterSample);
     Point2 sample(_sample);
 
     /* Randomly pick an emitter */
     Float emPdf;
-    size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
+    size_t index = sampleEmitterIndex(dRec, sample.x, emPdf);
     const Emitter *emitter = m_emitters[index].get();
     Spectrum value = emitter->sampleDirect(dRec, sample);
 
@@ -839,7 +1088,7 @@ Spectrum Scene::sampleEmitterDirect(DirectSamplingRecord &dRec,
         if (testVisibility) {
             Ray ray(dRec.ref, dRec.d, Epsilon,
                     dRec.dist*(1-ShadowEpsilon), dRec.time);
-            if (m_kdtree->rayIntersect(ray))
+            if (rayIntersect(ray))
                 return Spectrum(0.0f);
         }
         dRec.object = emitter;
@@ -852,19 +1101,24 @@ Spectrum Scene::sampleEmitterDirect(DirectSamplingRecord &dRec,
 }
 
 Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
-        const Medium *medium, int &interactions, const Point2 &_sample, Sampler *sampler) const {
+        const Medium *medium, int &interactions, const Point2 &_sample,
+        Sampler *sampler, const TransmittanceCache *cache) const {
+    MTS_HOTPATH_SCOPE(emitterSample);
     Point2 sample(_sample);
 
     /* Randomly pick an emitter */
     Float emPdf;
-    size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
+    size_t index = sampleEmitterIndex(dRec, sample.x, emPdf);
     const Emitter *emitter = m_emitters[index].get();
     Spectrum value = emitter->sampleDirect(dRec, sample);
 
     if (dRec.pdf != 0) {
-        value *= evalTransmittance(dRec.ref, false,
-            dRec.p, emitter->isOnSurface(), dRec.time, medium,
-            interactions, sampler) / emPdf;
+        Spectrum transmittance;
+        if (!cache || !cache->eval(emitter, medium, dRec.ref, transmittance))
+            transmittance = evalTransmittance(dRec.ref, false,
+                dRec.p, emitter->isOnSurface(), dRec.time, medium,
+                interactions, sampler);
+        value *= transmittance / emPdf;
         dRec.object = emitter;
         dRec.pdf *= emPdf;
         return value;
@@ -876,11 +1130,12 @@ Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
 Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
         const Intersection &its, const Medium *medium, int &interactions,
         const Point2 &_sample, Sampler *sampler) const {
+    MTS_HOTPATH_SCOPE(emitterSample);
     Point2 sample(_sample);
 
     /* Randomly pick an emitter */
     Float emPdf;
-    size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
+    size_t index = sampleEmitterIndex(dRec, sample.x, emPdf);
     const Emitter *emitter = m_emitters[index].get();
     Spectrum value = emitter->sampleDirect(dRec, sample);
 
@@ -905,7 +1160,7 @@ Spectrum Scene::sampleSensorDirect(DirectSamplingRecord &dRec,
         if (testVisibility) {
             Ray ray(dRec.ref, dRec.d, Epsilon,
                     dRec.dist*(1-ShadowEpsilon), dRec.time);
-            if (m_kdtree->rayIntersect(ray))
+            if (rayIntersect(ray))
                 return Spectrum(0.0f);
         }
         dRec.object = m_sensor.get();
@@ -948,7 +1203,9 @@ Spectrum Scene::sampleAttenuatedSensorDirect(DirectSamplingRecord &dRec,
 
 Float Scene::pdfEmitterDirect(const DirectSamplingRecord &dRec) const {
     const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
-    return emitter->pdfDirect(dRec) * pdfEmitterDiscrete(emitter);
+    Float emPdf = m_emitterTree.get() ? m_emitterTree->pdf(dRec.ref, dRec.refN, emitter)
+        : pdfEmitterDiscrete(emitter);
+    return emitter->pdfDirect(dRec) * emPdf;
 }
 
 Float Scene::pdfSensorDirect(const DirectSamplingRecord &dRec) const {
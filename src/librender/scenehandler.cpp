@@ -30,9 +30,12 @@
 #include <xercesc/sax/Locator.hpp>
 #include <mitsuba/render/scenehandler.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/statistics.h>
 #include <mitsuba/render/scene.h>
+#include <mitsuba/render/trimesh.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/unordered_set.hpp>
+#include <list>
 
 MTS_NAMESPACE_BEGIN
 XERCES_CPP_NAMESPACE_USE
@@ -45,6 +48,11 @@ XERCES_CPP_NAMESPACE_USE
     m_locator ? m_locator->getLineNumber() : -1, \
     ## __VA_ARGS__)
 
+/* Log a message about an object whose tag has already been parsed */
+#define NodeLog(node, level, fmt, ...) Thread::getThread()->getLogger()->log(\
+    level, NULL, __FILE__, __LINE__, "%s" fmt, (node)->location.c_str(), \
+    ## __VA_ARGS__)
+
 typedef void (*CleanupFun) ();
 typedef boost::unordered_set<CleanupFun> CleanupSet;
 static PrimitiveThreadLocal<CleanupSet> __cleanup_tls;
@@ -54,12 +62,17 @@ SceneHandler::SceneHandler(const ParameterMap &params,
         m_namedObjects(namedObjects), m_isIncludedFile(isIncludedFile) {
     m_pluginManager = PluginManager::getInstance();
     m_locator = NULL;
+    m_sceneNode = NULL;
+    m_reuseObjects = false;
 
     if (m_isIncludedFile) {
         SAssert(namedObjects != NULL);
+        /* Shares the node list of the including file (set by the parent) */
+        m_nodes = NULL;
     } else {
         SAssert(namedObjects == NULL);
         m_namedObjects = new NamedObjectMap();
+        m_nodes = new std::vector<ObjectNode *>();
     }
 
 #if !defined(WIN32)
@@ -113,8 +126,15 @@ SceneHandler::SceneHandler(const ParameterMap &params,
 SceneHandler::~SceneHandler() {
     delete m_transcoder;
     clear();
-    if (!m_isIncludedFile)
+    if (!m_isIncludedFile) {
         delete m_namedObjects;
+        delete m_nodes;
+    }
+}
+
+void SceneHandler::setObjectReuse(bool reuse) {
+    m_reuseObjects = reuse;
+    m_reusableObjects.clear();
 }
 
 void SceneHandler::setDocumentLocator(const xercesc::Locator* const locator) {
@@ -123,12 +143,12 @@ void SceneHandler::setDocumentLocator(const xercesc::Locator* const locator) {
 
 void SceneHandler::clear() {
     if (!m_isIncludedFile) {
-        for (NamedObjectMap::iterator it = m_namedObjects->begin();
-                it != m_namedObjects->end(); ++it)
-            if (it->second)
-                it->second->decRef();
+        for (size_t i=0; i<m_nodes->size(); ++i)
+            delete (*m_nodes)[i];
+        m_nodes->clear();
         m_namedObjects->clear();
     }
+    m_sceneNode = NULL;
 }
 
 std::string SceneHandler::transcode(const XMLCh * input) const {
@@ -162,7 +182,7 @@ void SceneHandler::startDocument() {
 }
 
 void SceneHandler::endDocument() {
-    SAssert(m_scene != NULL);
+    SAssert(m_isIncludedFile ? (m_sceneNode != NULL) : (m_scene != NULL));
 
     /* Call cleanup handlers */
     CleanupSet &cleanup = __cleanup_tls.get();
@@ -278,7 +298,8 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
     if (context.attributes.find("id") != context.attributes.end())
         context.properties.setID(context.attributes["id"]);
 
-    ref<ConfigurableObject> object;
+    ObjectNode *node = NULL;
+    bool isObject = false;
 
     TagMap::const_iterator it = m_tags.find(name);
     if (it == m_tags.end())
@@ -288,18 +309,17 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
 
     switch (tag.first) {
         case EScene:
-            object = m_scene = new Scene(context.properties);
+            isObject = true;
             break;
 
         case ENull:
-            object = NULL;
             break;
 
         case EReference: {
                 std::string id = context.attributes["id"];
                 if (m_namedObjects->find(id) == m_namedObjects->end())
                     XMLLog(EError, "Referenced object '%s' not found!", id.c_str());
-                object = (*m_namedObjects)[id];
+                node = (*m_namedObjects)[id];
             }
             break;
 
@@ -647,10 +667,9 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
                 std::string id = context.attributes["id"], as = context.attributes["as"];
                 if (m_namedObjects->find(id) == m_namedObjects->end())
                     XMLLog(EError, "Referenced object '%s' not found!", id.c_str());
-                ConfigurableObject *obj = (*m_namedObjects)[id];
+                ObjectNode *obj = (*m_namedObjects)[id];
                 if (m_namedObjects->find(as) != m_namedObjects->end())
                     XMLLog(EError, "Duplicate ID '%s' used in scene description!", id.c_str());
-                obj->incRef();
                 (*m_namedObjects)[as] = obj;
             }
             break;
@@ -668,6 +687,7 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
 
                 /* Set the handler and start parsing */
                 SceneHandler *handler = new SceneHandler(m_params, m_namedObjects, true);
+                handler->m_nodes = m_nodes;
                 parser->setDoNamespaces(true);
                 parser->setDocumentHandler(handler);
                 parser->setErrorHandler(handler);
@@ -675,7 +695,7 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
                 XMLLog(EInfo, "Parsing included file \"%s\" ..", path.filename().string().c_str());
                 parser->parse(path.c_str());
 
-                object = handler->getScene();
+                node = handler->m_sceneNode;
                 delete parser;
                 delete handler;
             }
@@ -691,110 +711,466 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
                 if (tag.second == NULL)
                     XMLLog(EError, "Internal error: could not instantiate an object "
                         "corresponding to the tag '%s'", name.c_str());
+                isObject = true;
+            }
+            break;
+    }
 
-                Properties &props = context.properties;
-
-                /* Convenience hack: allow passing animated transforms to arbitrary shapes
-                   and then internally rewrite this into a shape group + animated instance */
-                if (tag.second == MTS_CLASS(Shape)
-                    && props.hasProperty("toWorld")
-                    && props.getType("toWorld") == Properties::EAnimatedTransform
-                    && (props.getPluginName() != "instance" && props.getPluginName() != "disk")) {
-                    /* (The 'disk' plugin also directly supports animated transformations, so
-                        the instancing trick isn't required for it) */
-
-                    ref<const AnimatedTransform> trafo = props.getAnimatedTransform("toWorld");
-                    props.removeProperty("toWorld");
-
-                    if (trafo->isStatic())
-                        props.setTransform("toWorld", trafo->eval(0));
-
-                    object = m_pluginManager->createObject(tag.second, props);
-
-                    if (!trafo->isStatic()) {
-                        object = m_pluginManager->createObject(tag.second, props);
-                        /* If the object has children, append them */
-                        for (std::vector<std::pair<std::string, ConfigurableObject *> >
-                                ::iterator it = context.children.begin();
-                                it != context.children.end(); ++it) {
-                            if (it->second != NULL) {
-                                object->addChild(it->first, it->second);
-                                it->second->setParent(object);
-                                it->second->decRef();
-                            }
-                        }
-                        context.children.clear();
+    if (isObject) {
+        /* Record the object, it is created once the whole scene is known */
+        node = new ObjectNode();
+        node->tag = name;
+        node->location = formatString("In file \"%s\" (near line %i): ",
+            m_locator ? transcode(m_locator->getSystemId()).c_str() : "<unknown>",
+            m_locator ? (int) m_locator->getLineNumber() : -1);
+        node->cls = tag.second;
+        node->properties = context.properties;
+        node->reused = false;
+        node->children.swap(context.children);
+        /* Don't configure a scene object if it is from an included file */
+        node->configure = !(tag.first == EScene && m_isIncludedFile);
+        node->index = m_nodes->size();
+        node->level = 0;
+        node->parents = 0;
+        for (size_t i=0; i<node->children.size(); ++i) {
+            ObjectNode *child = node->children[i].second;
+            node->level = std::max(node->level, child->level + 1);
+            child->parents++;
+        }
+        m_nodes->push_back(node);
+    }
+
+    if (node != NULL || name == "null") {
+        std::string id = context.attributes["id"];
+        std::string nodeName = context.attributes["name"];
 
-                        object->configure();
+        /* If the object has a parent, add it to the parent's children list */
+        if (node && context.parent != NULL)
+            context.parent->children.push_back(
+                std::pair<std::string, ObjectNode *>(nodeName, node));
 
-                        ref<Shape> shapeGroup = static_cast<Shape *> (
-                            m_pluginManager->createObject(MTS_CLASS(Shape), Properties("shapegroup")));
-                        shapeGroup->addChild(object);
-                        shapeGroup->configure();
+        if (id != "" && name != "ref") {
+            if (m_namedObjects->find(id) != m_namedObjects->end())
+                XMLLog(EError, "Duplicate ID '%s' used in scene description!", id.c_str());
+            (*m_namedObjects)[id] = node;
+        }
+    }
 
-                        Properties instanceProps("instance");
-                        instanceProps.setAnimatedTransform("toWorld", trafo);
-                        object = m_pluginManager->createObject(instanceProps);
-                        object->addChild(shapeGroup);
+    if (!isObject) {
+        /* Warn about unqueried properties (done after
+           configuration in the case of objects) */
+        std::vector<std::string> unq = context.properties.getUnqueried();
+        for (unsigned int i=0; i<unq.size(); ++i)
+            XMLLog(EWarn, "Unqueried attribute \"%s\" in element \"%s\"", unq[i].c_str(), name.c_str());
+    }
 
-                    }
-                } else {
-                    try {
-                        object = m_pluginManager->createObject(tag.second, props);
-                    } catch (const std::exception &ex) {
-                        XMLLog(EError, "Error while creating object: %s", ex.what());
+    if (tag.first == EScene) {
+        if (m_isIncludedFile) {
+            m_sceneNode = node;
+        } else {
+            std::vector<ObjectNode *> groups;
+            if (node->properties.getBoolean("instanceDuplicates", true))
+                groups = instanceDuplicates(node);
+            instantiate();
+            m_scene = static_cast<Scene *>(node->object.get());
+            if (m_reuseObjects)
+                rememberObjects();
+            if (!groups.empty())
+                reportInstancing(groups);
+        }
+    }
+
+    m_context.pop();
+}
+
+/// Can a shape node be moved into a shape group?
+static bool isInstanceable(const SceneHandler::ObjectNode *node) {
+    if (node->cls != MTS_CLASS(Shape) || node->parents != 1)
+        return false;
+    const std::string &plugin = node->properties.getPluginName();
+    if (plugin != "serialized" && plugin != "ply" && plugin != "obj")
+        return false;
+    if (node->properties.hasProperty("toWorld") &&
+        node->properties.getType("toWorld") != Properties::ETransform)
+        return false;
+    /* Shape groups don't support emitters, sensors, subsurface
+       integrators or media, hence only a BSDF can be attached */
+    for (size_t i=0; i<node->children.size(); ++i) {
+        if (node->children[i].second->cls != MTS_CLASS(BSDF))
+            return false;
+    }
+    return true;
+}
+
+std::vector<SceneHandler::ObjectNode *> SceneHandler::instanceDuplicates(ObjectNode *scene) {
+    /* Group the shapes by everything except their transformation. The
+       string key is a coarse filter, an exact comparison follows */
+    typedef std::list<std::pair<Properties, std::vector<ObjectNode *> > > Bucket;
+    std::map<std::string, Bucket> buckets;
+    std::vector<std::vector<ObjectNode *> *> candidates;
+
+    for (size_t i=0; i<scene->children.size(); ++i) {
+        ObjectNode *node = scene->children[i].second;
+        if (!isInstanceable(node))
+            continue;
+        Properties props(node->properties);
+        props.removeProperty("toWorld");
+        props.setID("");
+
+        std::ostringstream oss;
+        oss << props.toString();
+        for (size_t j=0; j<node->children.size(); ++j)
+            oss << node->children[j].first << "=" << node->children[j].second << ";";
+
+        Bucket &bucket = buckets[oss.str()];
+        std::vector<ObjectNode *> *match = NULL;
+        for (Bucket::iterator it = bucket.begin(); it != bucket.end() && !match; ++it) {
+            if (it->first == props && it->second[0]->children == node->children)
+                match = &it->second;
+        }
+        if (!match) {
+            bucket.push_back(std::make_pair(props, std::vector<ObjectNode *>()));
+            match = &bucket.back().second;
+            candidates.push_back(match);
+        }
+        match->push_back(node);
+    }
+
+    std::vector<ObjectNode *> groups;
+    for (size_t i=0; i<candidates.size(); ++i) {
+        const std::vector<ObjectNode *> &copies = *candidates[i];
+        if (copies.size() < 2)
+            continue;
+
+        /* The mesh itself, without transformation */
+        ObjectNode *mesh = new ObjectNode(*copies[0]);
+        mesh->properties.removeProperty("toWorld");
+        mesh->properties.setID("");
+        mesh->index = m_nodes->size();
+        mesh->parents = 1;
+        m_nodes->push_back(mesh);
+
+        ObjectNode *group = new ObjectNode();
+        group->tag = "shape";
+        group->location = mesh->location;
+        group->cls = MTS_CLASS(Shape);
+        group->reused = false;
+        group->properties = Properties("shapegroup");
+        group->children.push_back(std::make_pair(std::string(), mesh));
+        group->configure = true;
+        group->index = m_nodes->size();
+        group->level = mesh->level + 1;
+        group->parents = (int) copies.size();
+        m_nodes->push_back(group);
+        groups.push_back(group);
+
+        /* Turn every copy into an instance of the group */
+        for (size_t j=0; j<copies.size(); ++j) {
+            ObjectNode *node = copies[j];
+            for (size_t k=0; k<node->children.size(); ++k)
+                node->children[k].second->parents--;
+
+            Properties props("instance");
+            props.setID(node->properties.getID());
+            props.setTransform("toWorld",
+                node->properties.getTransform("toWorld", Transform()));
+            node->properties = props;
+            node->children.clear();
+            node->children.push_back(std::make_pair(std::string(), group));
+            node->level = group->level + 1;
+        }
+        for (size_t k=0; k<mesh->children.size(); ++k)
+            mesh->children[k].second->parents++;
+    }
+
+    if (!groups.empty()) {
+        scene->level = 0;
+        for (size_t i=0; i<scene->children.size(); ++i)
+            scene->level = std::max(scene->level, scene->children[i].second->level + 1);
+    }
+
+    return groups;
+}
+
+/// Approximate amount of memory used by the geometry of a shape
+static size_t getGeometrySize(Shape *shape) {
+    if (shape->isCompound()) {
+        size_t result = 0;
+        for (int i=0; ; ++i) {
+            ref<Shape> element = shape->getElement(i);
+            if (!element)
+                break;
+            result += getGeometrySize(element);
+        }
+        return result;
+    } else if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+        const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+        size_t vertexSize = sizeof(Point);
+        if (mesh->hasVertexNormals())
+            vertexSize += sizeof(Normal);
+        if (mesh->hasVertexTexcoords())
+            vertexSize += sizeof(Point2);
+        if (mesh->hasVertexColors())
+            vertexSize += sizeof(Color3);
+        return mesh->getVertexCount() * vertexSize
+            + mesh->getTriangleCount() * sizeof(Triangle);
+    }
+    return 0;
+}
+
+void SceneHandler::reportInstancing(const std::vector<ObjectNode *> &groups) {
+    size_t copies = 0, saved = 0;
+    for (size_t i=0; i<groups.size(); ++i) {
+        ObjectNode *mesh = groups[i]->children[0].second;
+        copies += groups[i]->parents;
+        saved += (groups[i]->parents - 1)
+            * getGeometrySize(static_cast<Shape *>(mesh->object.get()));
+    }
+    SLog(EInfo, "Instanced " SIZE_T_FMT " transformed copies of " SIZE_T_FMT
+        " meshes (saved approximately %s)", copies, groups.size(),
+        memString(saved).c_str());
+}
+
+void SceneHandler::instantiate() {
+    /* Every object only depends on objects of a lower level */
+    int maxLevel = 0;
+    for (size_t i=0; i<m_nodes->size(); ++i)
+        maxLevel = std::max(maxLevel, (*m_nodes)[i]->level);
+    std::vector<std::vector<ObjectNode *> > levels(maxLevel + 1);
+    for (size_t i=0; i<m_nodes->size(); ++i)
+        levels[(*m_nodes)[i]->level].push_back((*m_nodes)[i]);
+
+    /* Load all required plugins up front instead of one at a time */
+    std::vector<std::string> pluginNames;
+    for (size_t i=0; i<m_nodes->size(); ++i) {
+        const ObjectNode *node = (*m_nodes)[i];
+        if (node->cls != NULL && !node->properties.getPluginName().empty())
+            pluginNames.push_back(node->properties.getPluginName());
+    }
+    m_pluginManager->preloadPlugins(pluginNames);
+
+    Thread *loader = Thread::getThread();
+    ref<FileResolver> resolver = loader->getFileResolver();
+    ref<Logger> logger = loader->getLogger();
+    ScopedPhase::Handle phase = ScopedPhase::getCurrent();
+    int threadCount = mts_omp_get_max_threads();
+    bool usedThreads = false;
+
+    for (size_t l=0; l<levels.size(); ++l) {
+        const std::vector<ObjectNode *> &level = levels[l];
+
+        if (level.size() == 1 || threadCount == 1) {
+            /* Create single objects on the loading thread, which keeps
+               the parallelism within them (e.g. MIP map construction) */
+            for (size_t i=0; i<level.size(); ++i)
+                instantiateNode(level[i]);
+            continue;
+        }
+
+        ObjectNode *errorNode = NULL;
+        std::string error;
+        usedThreads = true;
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i=0; i<(int) level.size(); ++i) {
+            /* Resolve files and log messages like the loading thread */
+            Thread *thread = Thread::registerUnmanagedThread("load");
+            ref<FileResolver> oldResolver = thread->getFileResolver();
+            ref<Logger> oldLogger = thread->getLogger();
+            ScopedPhase::Handle oldPhase = ScopedPhase::getCurrent();
+            thread->setFileResolver(resolver);
+            thread->setLogger(logger);
+            ScopedPhase::setCurrent(phase);
+
+            try {
+                instantiateNode(level[i]);
+            } catch (const std::exception &ex) {
+                #pragma omp critical
+                {
+                    /* Report the first error in document order */
+                    if (errorNode == NULL || level[i]->index < errorNode->index) {
+                        errorNode = level[i];
+                        error = ex.what();
                     }
                 }
             }
-            break;
-    }
 
-    if (object != NULL || name == "null") {
-        std::string id = context.attributes["id"];
-        std::string nodeName = context.attributes["name"];
+            thread->setFileResolver(oldResolver);
+            thread->setLogger(oldLogger);
+            ScopedPhase::setCurrent(oldPhase);
+        }
 
-        if (object) {
-            /* If the object has a parent, add it to the parent's children list */
-            if (context.parent != NULL) {
-                object->incRef();
-                context.parent->children.push_back(
-                    std::pair<std::string, ConfigurableObject *>(nodeName, object));
-            }
+        if (errorNode != NULL)
+            throw std::runtime_error(error);
+    }
 
-            /* If the object has children, append them */
-            for (std::vector<std::pair<std::string, ConfigurableObject *> >
-                    ::iterator it = context.children.begin();
-                    it != context.children.end(); ++it) {
-                if (it->second != NULL) {
-                    object->addChild(it->first, it->second);
-                    it->second->setParent(object);
-                    it->second->decRef();
-                }
+    if (usedThreads) {
+        /* Release thread-local caches of plugins (e.g. 'serialized'); the
+           ones of the loading thread are released by endDocument() */
+        #pragma omp parallel
+        {
+            if (Thread::registerUnmanagedThread("load") != loader) {
+                CleanupSet &cleanup = __cleanup_tls.get();
+                for (CleanupSet::iterator it = cleanup.begin();
+                        it != cleanup.end(); ++it)
+                    (*it)();
+                cleanup.clear();
             }
+        }
+    }
 
-            /* Don't configure a scene object if it is from an included file */
-            if (name != "include" && (!m_isIncludedFile || !object->getClass()->derivesFrom(MTS_CLASS(Scene))))
-                object->configure();
+    /* A child that is shared by several objects keeps the parent
+       that comes last in the file (as if created one by one) */
+    for (size_t i=0; i<m_nodes->size(); ++i) {
+        ObjectNode *node = (*m_nodes)[i];
+        for (size_t j=0; j<node->children.size(); ++j) {
+            ObjectNode *child = node->children[j].second;
+            if (child->parents > 1)
+                child->object->setParent(node->object);
+        }
+    }
+}
+
+/// Add the objects of child nodes to a newly created object
+static void addChildren(ConfigurableObject *object,
+        const std::vector<std::pair<std::string, SceneHandler::ObjectNode *> > &children) {
+    for (size_t i=0; i<children.size(); ++i) {
+        SceneHandler::ObjectNode *child = children[i].second;
+        object->addChild(children[i].first, child->object);
+        if (child->parents == 1)
+            child->object->setParent(object);
+    }
+}
 
-            if (object->getClass()->derivesFrom(MTS_CLASS(Texture)))
-                object = static_cast<Texture *>(object.get())->expand();
+ConfigurableObject *SceneHandler::findReusableObject(const ObjectNode *node) const {
+    std::pair<ReusableObjectMap::const_iterator, ReusableObjectMap::const_iterator> range =
+        m_reusableObjects.equal_range(node->properties.getPluginName());
+
+    for (ReusableObjectMap::const_iterator it = range.first; it != range.second; ++it) {
+        const ReusableObject &entry = it->second;
+        if (entry.cls != node->cls || entry.children.size() != node->children.size()
+            || entry.properties != node->properties)
+            continue;
+        bool match = true;
+        for (size_t i=0; i<node->children.size() && match; ++i)
+            match = entry.children[i].first == node->children[i].first
+                && entry.children[i].second == node->children[i].second->object;
+        if (match)
+            return const_cast<ConfigurableObject *>(entry.object.get());
+    }
+    return NULL;
+}
+
+void SceneHandler::rememberObjects() {
+    ReusableObjectMap objects;
+    size_t reused = 0, count = 0;
+
+    for (size_t i=0; i<m_nodes->size(); ++i) {
+        const ObjectNode *node = (*m_nodes)[i];
+        if (node->cls == NULL || node->cls == MTS_CLASS(Scene) || !node->configure)
+            continue;
+        ReusableObject entry;
+        entry.cls = node->cls;
+        entry.properties = node->sourceProperties;
+        for (size_t j=0; j<node->children.size(); ++j)
+            entry.children.push_back(std::make_pair(node->children[j].first,
+                node->children[j].second->object));
+        entry.object = node->object;
+        objects.insert(std::make_pair(entry.properties.getPluginName(), entry));
+        if (node->reused)
+            ++reused;
+        ++count;
+    }
+
+    if (!m_reusableObjects.empty())
+        SLog(EInfo, "Reused " SIZE_T_FMT " of " SIZE_T_FMT " objects of the "
+            "previous scene", reused, count);
+    m_reusableObjects.swap(objects);
+}
+
+void SceneHandler::instantiateNode(ObjectNode *node) {
+    Properties &props = node->properties;
+    ref<ConfigurableObject> object;
+    bool hasChildren = !node->children.empty();
+
+    if (m_reuseObjects && node->cls != MTS_CLASS(Scene) && node->configure) {
+        /* Take over an identical object of the previous scene */
+        ConfigurableObject *previous = findReusableObject(node);
+        if (previous) {
+            node->object = previous;
+            node->sourceProperties = props;
+            node->reused = true;
+            return;
         }
+        /* Keep the properties before they are modified below */
+        node->sourceProperties = props;
+    }
 
-        if (id != "" && name != "ref") {
-            if (m_namedObjects->find(id) != m_namedObjects->end())
-                XMLLog(EError, "Duplicate ID '%s' used in scene description!", id.c_str());
-            (*m_namedObjects)[id] = object;
-            if (object)
-                object->incRef();
+    /* Time the creation and configuration of every plugin */
+    ScopedPhase phase(props.getPluginName().empty() ? node->cls->getName()
+        : formatString("%s \"%s\"", node->cls->getName().c_str(),
+            props.getPluginName().c_str()));
+
+    try {
+        if (node->cls == MTS_CLASS(Scene)) {
+            object = new Scene(props);
+        } else if (node->cls == MTS_CLASS(Shape)
+            && props.hasProperty("toWorld")
+            && props.getType("toWorld") == Properties::EAnimatedTransform
+            && (props.getPluginName() != "instance" && props.getPluginName() != "disk")) {
+            /* Convenience hack: allow passing animated transforms to arbitrary shapes
+               and then internally rewrite this into a shape group + animated instance */
+            /* (The 'disk' plugin also directly supports animated transformations, so
+                the instancing trick isn't required for it) */
+
+            ref<const AnimatedTransform> trafo = props.getAnimatedTransform("toWorld");
+            props.removeProperty("toWorld");
+
+            if (trafo->isStatic())
+                props.setTransform("toWorld", trafo->eval(0));
+
+            object = m_pluginManager->createObject(node->cls, props);
+
+            if (!trafo->isStatic()) {
+                /* The children belong to the shape within the group */
+                addChildren(object, node->children);
+                hasChildren = false;
+                object->configure();
+
+                ref<Shape> shapeGroup = static_cast<Shape *> (
+                    m_pluginManager->createObject(MTS_CLASS(Shape), Properties("shapegroup")));
+                shapeGroup->addChild(object);
+                shapeGroup->configure();
+
+                Properties instanceProps("instance");
+                instanceProps.setAnimatedTransform("toWorld", trafo);
+                object = m_pluginManager->createObject(instanceProps);
+                object->addChild(shapeGroup);
+            }
+        } else {
+            object = m_pluginManager->createObject(node->cls, props);
         }
+    } catch (const std::exception &ex) {
+        NodeLog(node, EError, "Error while creating object: %s", ex.what());
     }
 
+    /* If the object has children, append them */
+    if (hasChildren)
+        addChildren(object, node->children);
+
+    if (node->configure)
+        object->configure();
+
+    if (object->getClass()->derivesFrom(MTS_CLASS(Texture)))
+        object = static_cast<Texture *>(object.get())->expand();
+
+    node->object = object;
+
     /* Warn about unqueried properties */
-    std::vector<std::string> unq = context.properties.getUnqueried();
+    std::vector<std::string> unq = props.getUnqueried();
     for (unsigned int i=0; i<unq.size(); ++i)
-        XMLLog(EWarn, "Unqueried attribute \"%s\" in element \"%s\"", unq[i].c_str(), name.c_str());
-
-    m_context.pop();
+        NodeLog(node, EWarn, "Unqueried attribute \"%s\" in element \"%s\"",
+            unq[i].c_str(), node->tag.c_str());
 }
 
 // -----------------------------------------------------------------------
@@ -839,7 +1215,10 @@ ref<Scene> SceneHandler::loadScene(const fs::path &filename, const ParameterMap
     parser->setDocumentHandler(handler);
     parser->setErrorHandler(handler);
 
-    parser->parse(filename.c_str());
+    {
+        ScopedPhase phase("Load scene");
+        parser->parse(filename.c_str());
+    }
     ref<Scene> scene = handler->getScene();
 
     delete parser;
@@ -869,7 +1248,10 @@ ref<Scene> SceneHandler::loadSceneFromString(const std::string &content, const P
 
     MemBufInputSource input((const XMLByte *) content.c_str(),
             content.length(), inputName);
-    parser->parse(input);
+    {
+        ScopedPhase phase("Load scene");
+        parser->parse(input);
+    }
     ref<Scene> scene = handler->getScene();
     XMLString::release(&inputName);
 
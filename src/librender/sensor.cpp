@@ -36,6 +36,11 @@ Sensor::Sensor(const Properties &props)
 
     if (m_shutterOpenTime == 0)
         m_type |= EDeltaTime;
+
+    /* Optionally restrict the time samples to a few bucket centers so that
+       rays share the (cached) evaluations of animated transformations */
+    m_timeBuckets = props.getSize("timeBuckets", 0);
+    m_invTimeBuckets = m_timeBuckets > 0 ? 1.0f / (Float) m_timeBuckets : 0.0f;
 }
 
 Sensor::Sensor(Stream *stream, InstanceManager *manager)
@@ -44,6 +49,8 @@ Sensor::Sensor(Stream *stream, InstanceManager *manager)
     m_sampler = static_cast<Sampler *>(manager->getInstance(stream));
     m_shutterOpen = stream->readFloat();
     m_shutterOpenTime = stream->readFloat();
+    m_timeBuckets = stream->readSize();
+    m_invTimeBuckets = m_timeBuckets > 0 ? 1.0f / (Float) m_timeBuckets : 0.0f;
 }
 
 Sensor::~Sensor() {
@@ -55,6 +62,7 @@ void Sensor::serialize(Stream *stream, InstanceManager *manager) const {
     manager->serialize(stream, m_sampler.get());
     stream->writeFloat(m_shutterOpen);
     stream->writeFloat(m_shutterOpenTime);
+    stream->writeSize(m_timeBuckets);
 }
 
 void Sensor::setShutterOpenTime(Float time) {
@@ -131,6 +139,20 @@ Spectrum Sensor::sampleRayDifferential(RayDifferential &ray,
     return result;
 }
 
+void Sensor::sampleRayDifferentials(size_t count,
+        const Point2 *samplePositions, const Point2 *apertureSamples,
+        const Float *timeSamples, RayDifferential *rays,
+        Spectrum *weights) const {
+    for (size_t i=0; i<count; ++i)
+        weights[i] = sampleRayDifferential(rays[i], samplePositions[i],
+            apertureSamples ? apertureSamples[i] : Point2(0.5f),
+            timeSamples ? timeSamples[i] : 0.5f);
+}
+
+Float Sensor::getSampleBudget(const Point2i &pixel) const {
+    return 1.0f;
+}
+
 Float Sensor::pdfTime(const Ray &ray, EMeasure measure) const {
     if (ray.time < m_shutterOpen || ray.time > m_shutterOpen + m_shutterOpenTime)
         return 0.0f;
@@ -0,0 +1,88 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/shadowqueue.h>
+
+/// Number of bits per axis of the Morton code of the ray origins
+#define MTS_SHADOWQUEUE_MORTON_BITS 9
+
+MTS_NAMESPACE_BEGIN
+
+/// Spread the lower 10 bits of \c x so that there are two zero bits between each of them
+static inline uint32_t spreadBits(uint32_t x) {
+    x &= 0x3FF;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x <<  8)) & 0x0300F00F;
+    x = (x | (x <<  4)) & 0x030C30C3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+ShadowRayQueue::ShadowRayQueue(const Scene *scene, size_t capacity)
+        : m_scene(scene) {
+    const AABB &aabb = scene->getAABB();
+    m_origin = aabb.min;
+    for (int i=0; i<3; ++i) {
+        Float extents = aabb.max[i] - aabb.min[i];
+        m_invExtents[i] = extents > 0 ? 1.0f / extents : 0.0f;
+    }
+    m_entries.reserve(capacity);
+    m_order.reserve(capacity);
+}
+
+uint32_t ShadowRayQueue::getKey(const Ray &ray) const {
+    const uint32_t resolution = 1 << MTS_SHADOWQUEUE_MORTON_BITS;
+
+    uint32_t morton = 0;
+    for (int i=0; i<3; ++i) {
+        Float pos = (ray.o[i] - m_origin[i]) * m_invExtents[i];
+        uint32_t cell = (uint32_t) std::min((Float) (resolution - 1),
+            std::max((Float) 0, pos * resolution));
+        morton |= spreadBits(cell) << i;
+    }
+
+    uint32_t octant = (ray.d.x < 0 ? 1 : 0) | (ray.d.y < 0 ? 2 : 0)
+        | (ray.d.z < 0 ? 4 : 0);
+
+    return (octant << (3 * MTS_SHADOWQUEUE_MORTON_BITS)) | morton;
+}
+
+size_t ShadowRayQueue::flush() {
+    size_t count = m_entries.size();
+    if (count == 0)
+        return 0;
+
+    m_order.resize(count);
+    for (size_t i=0; i<count; ++i)
+        m_order[i] = std::make_pair(getKey(m_entries[i].ray), (uint32_t) i);
+    std::sort(m_order.begin(), m_order.end());
+
+    size_t unoccluded = 0;
+    for (size_t i=0; i<count; ++i) {
+        const Entry &entry = m_entries[m_order[i].second];
+        if (!m_scene->rayIntersect(entry.ray)) {
+            *entry.target += entry.value;
+            ++unoccluded;
+        }
+    }
+
+    m_entries.clear();
+    return unoccluded;
+}
+
+MTS_NAMESPACE_END
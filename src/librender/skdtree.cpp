@@ -18,6 +18,8 @@
 
 #include <mitsuba/render/skdtree.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/mstream.h>
 
 #if defined(MTS_SSE)
 #include <mitsuba/core/sse.h>
@@ -25,6 +27,12 @@
 #include <mitsuba/render/triaccel_sse.h>
 #endif
 
+/// Version of the on-disk kd-tree cache format
+#define MTS_KD_CACHE_VERSION 1
+
+/// Alignment of the data sections within a kd-tree cache file
+#define MTS_KD_CACHE_ALIGNMENT 64
+
 MTS_NAMESPACE_BEGIN
 
 ShapeKDTree::ShapeKDTree() {
@@ -32,9 +40,21 @@ ShapeKDTree::ShapeKDTree() {
     m_triAccel = NULL;
 #endif
     m_shapeMap.push_back(0);
+    m_cacheDirectory = new fs::path();
+    m_shared = false;
 }
 
 ShapeKDTree::~ShapeKDTree() {
+    if (m_cacheData) {
+        /* The tree data resides in a memory-mapped cache file
+           or in the image of a shared tree */
+        m_nodes = NULL;
+        m_indices = NULL;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+        m_triAccel = NULL;
+#endif
+    }
+    delete m_cacheDirectory;
 #if !defined(MTS_KD_CONSERVE_MEMORY)
     if (m_triAccel)
         freeAligned(m_triAccel);
@@ -43,9 +63,17 @@ ShapeKDTree::~ShapeKDTree() {
         m_shapes[i]->decRef();
 }
 
+/// Process-wide registry of shared trees (see \ref ShapeKDTree::setShared())
+static std::map<uint64_t, ref<Object> > sharedTrees;
+static ref<Mutex> sharedTreesMutex = new Mutex();
+
 static StatsCounter raysTraced("General", "Normal rays traced");
 static StatsCounter shadowRaysTraced("General", "Shadow rays traced");
 
+uint64_t ShapeKDTree::getThreadRayCount() {
+    return raysTraced.getThreadValue() + shadowRaysTraced.getThreadValue();
+}
+
 void ShapeKDTree::addShape(const Shape *shape) {
     Assert(!isBuilt());
     if (shape->isCompound())
@@ -65,10 +93,39 @@ void ShapeKDTree::addShape(const Shape *shape) {
     m_shapes.push_back(shape);
 }
 
+void ShapeKDTree::setCacheDirectory(const fs::path &path) {
+    *m_cacheDirectory = path;
+}
+
+const fs::path &ShapeKDTree::getCacheDirectory() const {
+    return *m_cacheDirectory;
+}
+
 void ShapeKDTree::build() {
+    ScopedPhase phase("Build kd-tree");
+
     for (size_t i=1; i<m_shapeMap.size(); ++i)
         m_shapeMap[i] += m_shapeMap[i-1];
 
+    fs::path cacheFile;
+    uint64_t cacheKey = 0;
+    bool share = m_shared && getPrimitiveCount() > 0,
+         useCache = !m_cacheDirectory->empty() && getPrimitiveCount() > 0;
+    if (share || useCache)
+        cacheKey = getCacheKey();
+    if (share && acquireSharedTree(cacheKey))
+        return;
+
+    if (useCache) {
+        cacheFile = *m_cacheDirectory / formatString("%016llx.kdtree",
+            (unsigned long long) cacheKey);
+        if (fs::exists(cacheFile) && loadCache(cacheFile, cacheKey)) {
+            if (share)
+                publishSharedTree(cacheKey);
+            return;
+        }
+    }
+
     SAHKDTree3D<ShapeKDTree>::buildInternal();
 
 #if !defined(MTS_KD_CONSERVE_MEMORY)
@@ -107,6 +164,274 @@ void ShapeKDTree::build() {
     Log(m_logLevel, "");
     KDAssert(idx == primCount);
 #endif
+
+    /* The tree was built by a few threads, hence its memory likely resides
+       on a single NUMA node. Distribute it evenly if requested. */
+    if (getNUMAInterleaving()) {
+        bool success = interleaveMemory(m_nodes - 1, sizeof(KDNode) * (m_nodeCount + 1));
+        success &= interleaveMemory(m_indices, sizeof(IndexType) * m_indexCount);
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+        success &= interleaveMemory(m_triAccel, sizeof(TriAccel) * getPrimitiveCount());
+#endif
+        if (success)
+            Log(EDebug, "Interleaved the kd-tree data across %i NUMA nodes",
+                getNUMANodeCount());
+    }
+
+    if (!cacheFile.empty())
+        saveCache(cacheFile, cacheKey);
+    if (share)
+        publishSharedTree(cacheKey);
+}
+
+/// Mix a 64-bit word into a running hash value
+static inline uint64_t hashCombine(uint64_t hash, uint64_t value) {
+    hash ^= value;
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+}
+
+/// Hash an arbitrary memory region
+static uint64_t hashBuffer(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *ptr = static_cast<const uint8_t *>(data);
+    size_t wordCount = size / sizeof(uint64_t);
+    for (size_t i=0; i<wordCount; ++i) {
+        uint64_t word;
+        memcpy(&word, ptr + i * sizeof(uint64_t), sizeof(uint64_t));
+        hash = hashCombine(hash, word);
+    }
+    for (size_t i=wordCount * sizeof(uint64_t); i<size; ++i)
+        hash = hashCombine(hash, ptr[i]);
+    return hashCombine(hash, size);
+}
+
+template <typename T> static inline uint64_t hashValue(uint64_t hash, const T &value) {
+    return hashBuffer(hash, &value, sizeof(T));
+}
+
+uint64_t ShapeKDTree::getCacheKey() const {
+    ref<Timer> timer = new Timer();
+
+    /* Include everything that affects the binary layout of the tree */
+    uint64_t hash = hashCombine(0, MTS_KD_CACHE_VERSION);
+    hash = hashCombine(hash, sizeof(Float));
+    hash = hashCombine(hash, sizeof(KDNode));
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+    hash = hashCombine(hash, sizeof(TriAccel));
+#endif
+    hash = hashCombine(hash, (uint64_t) Stream::getHostByteOrder());
+
+    /* .. the construction parameters .. */
+    hash = hashValue(hash, m_traversalCost);
+    hash = hashValue(hash, m_queryCost);
+    hash = hashValue(hash, m_emptySpaceBonus);
+    hash = hashCombine(hash, m_clip);
+    hash = hashCombine(hash, m_retract);
+    hash = hashCombine(hash, m_maxDepth);
+    hash = hashCombine(hash, m_stopPrims);
+    hash = hashCombine(hash, m_maxBadRefines);
+    hash = hashCombine(hash, m_exactPrimThreshold);
+    hash = hashCombine(hash, m_minMaxBins);
+
+    /* .. and the geometry itself. Generic shapes only enter
+       the construction by means of their bounding boxes */
+    for (size_t i=0; i<m_shapes.size(); ++i) {
+        const Shape *shape = m_shapes[i];
+        if (m_triangleFlag[i]) {
+            const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+            hash = hashBuffer(hash, mesh->getTriangles(),
+                sizeof(Triangle) * mesh->getTriangleCount());
+            hash = hashBuffer(hash, mesh->getVertexPositions(),
+                sizeof(Point) * mesh->getVertexCount());
+        } else {
+            const std::string &name = shape->getClass()->getName();
+            hash = hashBuffer(hash, name.c_str(), name.length());
+            hash = hashValue(hash, shape->getAABB());
+        }
+    }
+
+    Log(EDebug, "Hashed the kd-tree geometry in %i ms", timer->getMilliseconds());
+    return hash;
+}
+
+/// Round up to the alignment of the data sections in the cache file
+static inline size_t alignCacheOffset(size_t offset) {
+    return (offset + MTS_KD_CACHE_ALIGNMENT - 1) & ~(size_t) (MTS_KD_CACHE_ALIGNMENT - 1);
+}
+
+/// Write zero padding until the stream position matches the section alignment
+static void padCacheFile(Stream *stream) {
+    const uint8_t zero[MTS_KD_CACHE_ALIGNMENT] = { 0 };
+    size_t pos = stream->getPos();
+    stream->write(zero, alignCacheOffset(pos) - pos);
+}
+
+bool ShapeKDTree::loadCache(const fs::path &filename, uint64_t key) {
+    try {
+        ref<MemoryMappedFile> mmap = new MemoryMappedFile(filename);
+        mapCache(mmap, static_cast<uint8_t *>(mmap->getData()), mmap->getSize(), key);
+        Log(EInfo, "Loaded the kd-tree from \"%s\" (%s)",
+            filename.filename().string().c_str(),
+            memString(mmap->getSize()).c_str());
+        return true;
+    } catch (const std::exception &ex) {
+        Log(EWarn, "Unable to load the cached kd-tree \"%s\" (%s), rebuilding it ..",
+            filename.string().c_str(), ex.what());
+        return false;
+    }
+}
+
+void ShapeKDTree::mapCache(Object *owner, uint8_t *data, size_t size, uint64_t key) {
+    ref<MemoryStream> stream = new MemoryStream(data, size);
+    stream->setByteOrder(Stream::ELittleEndian);
+
+    char header[3];
+    stream->read(header, 3);
+    if (header[0] != 'K' || header[1] != 'D' || header[2] != 'C')
+        Log(EError, "Encountered an invalid kd-tree cache file "
+            "(incorrect header identifier)");
+    uint8_t version;
+    stream->read(&version, 1);
+    if (version != MTS_KD_CACHE_VERSION)
+        Log(EError, "Encountered a kd-tree cache file of an incompatible version");
+    if (stream->readULong() != key)
+        Log(EError, "The kd-tree cache file does not match the scene geometry");
+
+    SizeType nodeCount = stream->readUInt();
+    SizeType indexCount = stream->readUInt();
+    SizeType primCount = stream->readUInt();
+    SizeType maxDepth = stream->readUInt();
+    AABB aabb(stream), tightAABB(stream);
+
+    if (primCount != getPrimitiveCount())
+        Log(EError, "The kd-tree cache file has an invalid primitive count");
+
+    size_t nodeOffset = alignCacheOffset(stream->getPos());
+    size_t indexOffset = alignCacheOffset(nodeOffset + sizeof(KDNode) * (nodeCount + 1));
+    size_t endOffset = indexOffset + sizeof(IndexType) * indexCount;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+    size_t triAccelOffset = alignCacheOffset(endOffset);
+    endOffset = triAccelOffset + sizeof(TriAccel) * primCount;
+#endif
+    if (endOffset != size)
+        Log(EError, "The kd-tree cache file is truncated");
+
+    /* Release previously owned tree data */
+    if (!m_cacheData) {
+        if (m_indices)
+            delete[] m_indices;
+        if (m_nodes)
+            freeAligned(m_nodes-1);
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+        if (m_triAccel)
+            freeAligned(m_triAccel);
+#endif
+    }
+
+    // +1 shift is for alignment purposes (see KDNode::getSibling)
+    m_nodes = reinterpret_cast<KDNode *>(data + nodeOffset) + 1;
+    m_indices = reinterpret_cast<IndexType *>(data + indexOffset);
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+    m_triAccel = reinterpret_cast<TriAccel *>(data + triAccelOffset);
+#endif
+    m_nodeCount = nodeCount;
+    m_indexCount = indexCount;
+    m_maxDepth = maxDepth;
+    m_aabb = aabb;
+    m_tightAABB = tightAABB;
+    m_cacheData = owner;
+}
+
+bool ShapeKDTree::acquireSharedTree(uint64_t key) {
+    LockGuard lock(sharedTreesMutex);
+    std::map<uint64_t, ref<Object> >::iterator it = sharedTrees.find(key);
+    if (it == sharedTrees.end())
+        return false;
+
+    uint8_t *data;
+    size_t size;
+    if (it->second->getClass()->derivesFrom(MTS_CLASS(MemoryMappedFile))) {
+        MemoryMappedFile *mmap = static_cast<MemoryMappedFile *>(it->second.get());
+        data = static_cast<uint8_t *>(mmap->getData());
+        size = mmap->getSize();
+    } else {
+        MemoryStream *image = static_cast<MemoryStream *>(it->second.get());
+        data = image->getData();
+        size = image->getSize();
+    }
+
+    mapCache(it->second, data, size, key);
+    Log(m_logLevel, "Reusing a shared kd-tree (%s)", memString(size).c_str());
+    return true;
+}
+
+void ShapeKDTree::publishSharedTree(uint64_t key) {
+    if (!m_cacheData) {
+        /* Move the tree into a memory image that outlives this instance */
+        ref<MemoryStream> image = new MemoryStream(
+            sizeof(KDNode) * (m_nodeCount + 1) + sizeof(IndexType) * m_indexCount);
+        writeCache(image, key);
+        mapCache(image, image->getData(), image->getSize(), key);
+    }
+
+    LockGuard lock(sharedTreesMutex);
+    /* Drop the trees that are no longer referenced by anyone else */
+    for (std::map<uint64_t, ref<Object> >::iterator it = sharedTrees.begin();
+            it != sharedTrees.end(); ) {
+        if (it->second->getRefCount() == 1)
+            sharedTrees.erase(it++);
+        else
+            ++it;
+    }
+    sharedTrees[key] = m_cacheData;
+}
+
+void ShapeKDTree::saveCache(const fs::path &filename, uint64_t key) const {
+    /* Write to a temporary file first so that concurrently running
+       instances never get to see a partially written cache entry */
+    fs::path tempFile = filename.parent_path() /
+        (filename.filename().string() + ".tmp");
+
+    try {
+        ref<Timer> timer = new Timer();
+        ref<FileStream> stream = new FileStream(tempFile, FileStream::ETruncWrite);
+        writeCache(stream, key);
+        stream->close();
+        fs::rename(tempFile, filename);
+
+        Log(EDebug, "Stored the kd-tree in \"%s\" (took %i ms)",
+            filename.filename().string().c_str(), timer->getMilliseconds());
+    } catch (const std::exception &ex) {
+        Log(EWarn, "Unable to store the kd-tree in \"%s\": %s",
+            filename.string().c_str(), ex.what());
+        boost::system::error_code ec;
+        fs::remove(tempFile, ec);
+    }
+}
+
+void ShapeKDTree::writeCache(Stream *stream, uint64_t key) const {
+    stream->setByteOrder(Stream::ELittleEndian);
+
+    const char header[3] = { 'K', 'D', 'C' };
+    const uint8_t version = MTS_KD_CACHE_VERSION;
+    stream->write(header, 3);
+    stream->write(&version, 1);
+    stream->writeULong(key);
+    stream->writeUInt(m_nodeCount);
+    stream->writeUInt(m_indexCount);
+    stream->writeUInt(getPrimitiveCount());
+    stream->writeUInt(m_maxDepth);
+    m_aabb.serialize(stream);
+    m_tightAABB.serialize(stream);
+
+    padCacheFile(stream);
+    stream->write(m_nodes - 1, sizeof(KDNode) * (m_nodeCount + 1));
+    padCacheFile(stream);
+    stream->write(m_indices, sizeof(IndexType) * m_indexCount);
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+    padCacheFile(stream);
+    stream->write(m_triAccel, sizeof(TriAccel) * getPrimitiveCount());
+#endif
 }
 
 bool ShapeKDTree::rayIntersect(const Ray &ray, Intersection &its) const {
@@ -168,18 +493,17 @@ bool ShapeKDTree::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
                     const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
                     const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
                     const Point *vertexPositions = trimesh->getVertexPositions();
-                    const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
                     const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
                     const Point &p0 = vertexPositions[idx0];
                     const Point &p1 = vertexPositions[idx1];
                     const Point &p2 = vertexPositions[idx2];
                     n = normalize(cross(p1-p0, p2-p0));
 
-                    if (EXPECT_TAKEN(vertexTexcoords)) {
+                    if (EXPECT_TAKEN(trimesh->hasVertexTexcoords())) {
                         const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
-                        const Point2 &t0 = vertexTexcoords[idx0];
-                        const Point2 &t1 = vertexTexcoords[idx1];
-                        const Point2 &t2 = vertexTexcoords[idx2];
+                        const Point2 t0 = trimesh->getVertexTexcoord(idx0);
+                        const Point2 t1 = trimesh->getVertexTexcoord(idx1);
+                        const Point2 t2 = trimesh->getVertexTexcoord(idx2);
                         uv = t0 * b.x + t1 * b.y + t2 * b.z;
                     } else {
                         uv = Point2(0.0f);
@@ -204,6 +528,45 @@ bool ShapeKDTree::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
 }
 
 
+bool ShapeKDTree::rayIntersectDeferred(const Ray &ray, Float &t,
+        ConstShapePtr &shape, void *temp) const {
+    Float mint, maxt;
+
+    t = std::numeric_limits<Float>::infinity();
+
+    ++raysTraced;
+    if (m_aabb.rayIntersect(ray, mint, maxt)) {
+        /* Use an adaptive ray epsilon */
+        Float rayMinT = ray.mint;
+        if (rayMinT == Epsilon)
+            rayMinT *= std::max(std::max(std::max(std::abs(ray.o.x),
+                std::abs(ray.o.y)), std::abs(ray.o.z)), Epsilon);
+
+        if (rayMinT > mint) mint = rayMinT;
+        if (ray.maxt < maxt) maxt = ray.maxt;
+
+        if (EXPECT_TAKEN(maxt > mint)) {
+            if (rayIntersectHavran<false>(ray, mint, maxt, t, temp)) {
+                const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
+                shape = m_shapes[cache->shapeIndex];
+
+                if (!m_triangleFlag[cache->shapeIndex]) {
+                    /* Other shapes (e.g. instances) may report a different
+                       shape in their intersection record */
+                    Intersection its;
+                    its.t = t;
+                    shape->fillIntersectionRecord(ray,
+                        reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
+                    if (its.shape)
+                        shape = its.shape;
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 bool ShapeKDTree::rayIntersect(const Ray &ray) const {
     Float mint, maxt, t = std::numeric_limits<Float>::infinity();
 
@@ -326,6 +689,7 @@ void ShapeKDTree::rayIntersectPacket(const RayPacket4 &packet,
                             ray.d[axis] = packet.d[axis].f[i];
                             ray.dRcp[axis] = packet.dRcp[axis].f[i];
                         }
+                        ray.time = packet.time[i];
                         Float t;
 
                         if (shape->rayIntersect(ray, searchStart.f[i], searchEnd.f[i], t,
@@ -367,6 +731,7 @@ void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet,
             ray.d[axis] = packet.d[axis].f[i];
             ray.dRcp[axis] = packet.dRcp[axis].f[i];
         }
+        ray.time = packet.time[i];
         ray.mint = rayInterval.mint.f[i];
         ray.maxt = rayInterval.maxt.f[i];
         uint8_t *rayTemp = reinterpret_cast<uint8_t *>(temp) + i * MTS_KD_INTERSECTION_TEMP;
@@ -381,6 +746,23 @@ void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet,
     }
 }
 
+void ShapeKDTree::fillPacketIntersectionRecord(const Ray &ray,
+        const Intersection4 &its4, int index, void *temp, Intersection &its) const {
+    uint8_t *rayTemp = reinterpret_cast<uint8_t *>(temp) + index * MTS_KD_INTERSECTION_TEMP;
+    IntersectionCache *cache = reinterpret_cast<IntersectionCache *>(rayTemp);
+    cache->shapeIndex = its4.shapeIndex.i[index];
+    cache->primIndex = its4.primIndex.i[index];
+
+    /* Generic shapes store their own data right after the two indices */
+    if (cache->primIndex != KNoTriangleFlag) {
+        cache->u = its4.u.f[index];
+        cache->v = its4.v.f[index];
+    }
+
+    its.t = its4.t.f[index];
+    fillIntersectionRecord<true>(ray, rayTemp, its);
+}
+
 #endif
 
 MTS_IMPLEMENT_CLASS(ShapeKDTree, false, KDTreeBase)
@@ -119,5 +119,146 @@ void TestCase::succeed() {
     m_succeeded++;
 }
 
+void TestCase::parseBenchmarkOptions(int argc, char **argv) {
+    m_benchmark = m_updateBaseline = false;
+    m_benchmarkRuns = 10;
+    m_benchmarkTolerance = 0.05f;
+    m_baselineFile = getClass()->getName() + ".perf";
+    m_baseline.clear();
+    m_measured.clear();
+    m_benchmarkTimer = new Timer();
+
+    char *end_ptr = NULL;
+    for (int i=0; i<argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.length() != 2 || arg[0] != '-')
+            continue;
+        bool hasValue = i+1 < argc;
+        switch (arg[1]) {
+            case 'b':
+                m_benchmark = true;
+                break;
+            case 'u':
+                m_benchmark = m_updateBaseline = true;
+                break;
+            case 'n':
+                if (!hasValue)
+                    Log(EError, "The '-n' option requires an argument!");
+                m_benchmarkRuns = strtol(argv[++i], &end_ptr, 10);
+                if (*end_ptr != '\0' || m_benchmarkRuns < 2)
+                    Log(EError, "Could not parse the number of benchmark "
+                        "repetitions (must be at least 2)!");
+                break;
+            case 'B':
+                if (!hasValue)
+                    Log(EError, "The '-B' option requires an argument!");
+                m_baselineFile = argv[++i];
+                break;
+            case 'T':
+                if (!hasValue)
+                    Log(EError, "The '-T' option requires an argument!");
+                m_benchmarkTolerance = (Float) strtod(argv[++i], &end_ptr) / 100;
+                if (*end_ptr != '\0' || m_benchmarkTolerance < 0)
+                    Log(EError, "Could not parse the benchmark tolerance!");
+                break;
+            default:
+                Log(EError, "Unknown test case option \"%s\"!", arg.c_str());
+        }
+    }
+
+    if (!m_benchmark)
+        return;
+
+    fs::ifstream is(m_baselineFile);
+    std::string line;
+    while (std::getline(is, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream iss(line);
+        std::string name;
+        BenchmarkResult result;
+        if (iss >> name >> result.mean >> result.stddev >> result.runs)
+            m_baseline[name] = result;
+    }
+}
+
+bool TestCase::evaluateBenchmark(const std::string &name,
+        const std::vector<Float> &times, size_t operations) {
+    BenchmarkResult result;
+    double sum = 0, sumSqr = 0;
+    for (size_t i=0; i<times.size(); ++i) {
+        double value = times[i] / (double) operations;
+        sum += value;
+        sumSqr += value * value;
+    }
+    result.runs = (int) times.size();
+    result.mean = sum / result.runs;
+    result.stddev = std::sqrt(std::max(0.0,
+        (sumSqr - sum * result.mean) / (result.runs - 1)));
+    m_measured[name] = result;
+
+    Log(EInfo, "  %.3f ns per operation (standard deviation: %.1f%%), "
+        "%.3f Mops/s over %i runs", result.mean * 1e9,
+        100 * result.stddev / result.mean, 1e-6 / result.mean, result.runs);
+
+    BenchmarkMap::const_iterator it = m_baseline.find(name);
+    if (it == m_baseline.end()) {
+        Log(EInfo, "  No baseline for this benchmark (use -u to record one)");
+        return true;
+    }
+
+    /* Welch's t-test for the difference of the two means */
+    const BenchmarkResult &base = it->second;
+    double var0 = base.stddev * base.stddev / base.runs,
+           var1 = result.stddev * result.stddev / result.runs,
+           se = std::sqrt(var0 + var1),
+           delta = (result.mean - base.mean) / base.mean;
+
+    double pValue = 0, halfWidth = 0;
+    if (se > 0) {
+        double dof = (var0 + var1) * (var0 + var1) /
+            (var0 * var0 / std::max(base.runs - 1, 1)
+             + var1 * var1 / (result.runs - 1));
+        boost::math::students_t dist(dof);
+        double t = (result.mean - base.mean) / se;
+        pValue = 2 * boost::math::cdf(boost::math::complement(dist, std::abs(t)));
+        halfWidth = boost::math::quantile(boost::math::complement(dist, 0.025))
+            * se / base.mean;
+    }
+
+    Log(EInfo, "  %+.1f%% time per operation relative to the baseline (95%% "
+        "confidence interval: %+.1f%% .. %+.1f%%, p = %.4f)", 100 * delta,
+        100 * (delta - halfWidth), 100 * (delta + halfWidth), pValue);
+
+    if (delta > m_benchmarkTolerance && pValue < 0.05) {
+        Log(EWarn, "Performance regression in \"%s\": %.1f%% slower than "
+            "the baseline (tolerance: %.1f%%)", name.c_str(), 100 * delta,
+            100 * m_benchmarkTolerance);
+        return false;
+    }
+    return true;
+}
+
+void TestCase::finishBenchmarks() {
+    if (!m_updateBaseline || m_measured.empty())
+        return;
+
+    for (BenchmarkMap::const_iterator it = m_measured.begin();
+            it != m_measured.end(); ++it)
+        m_baseline[it->first] = it->second;
+
+    fs::ofstream os(m_baselineFile);
+    if (os.fail())
+        Log(EError, "Could not write the benchmark baseline \"%s\"!",
+            m_baselineFile.c_str());
+    os << "# name, mean time per operation [s], standard deviation [s], runs" << endl;
+    os.precision(9);
+    for (BenchmarkMap::const_iterator it = m_baseline.begin();
+            it != m_baseline.end(); ++it)
+        os << it->first << " " << it->second.mean << " "
+           << it->second.stddev << " " << it->second.runs << endl;
+    Log(EInfo, "Wrote the benchmark baseline to \"%s\"", m_baselineFile.c_str());
+}
+
 MTS_IMPLEMENT_CLASS(TestCase, false, Utility)
 MTS_NAMESPACE_END
@@ -123,7 +123,13 @@ Spectrum Texture2D::eval(const Intersection &its, bool filter) const {
 void Texture2D::evalGradient(const Intersection &its, Spectrum *gradient) const {
     Point2 uv = Point2(its.uv.x * m_uvScale.x, its.uv.y * m_uvScale.y) + m_uvOffset;
 
-    evalGradient(uv, gradient);
+    if (its.hasUVPartials) {
+        evalGradient(uv,
+            Vector2(its.dudx * m_uvScale.x, its.dvdx * m_uvScale.y),
+            Vector2(its.dudy * m_uvScale.x, its.dvdy * m_uvScale.y), gradient);
+    } else {
+        evalGradient(uv, gradient);
+    }
 
     gradient[0] *= m_uvScale.x;
     gradient[1] *= m_uvScale.y;
@@ -140,6 +146,11 @@ void Texture2D::evalGradient(const Point2 &uv, Spectrum *gradient) const {
     gradient[1] = (valueV - value)*(1/eps);
 }
 
+void Texture2D::evalGradient(const Point2 &uv, const Vector2 &d0,
+        const Vector2 &d1, Spectrum *gradient) const {
+    evalGradient(uv, gradient);
+}
+
 ref<Bitmap> Texture2D::getBitmap(const Vector2i &sizeHint) const {
     Vector2i res(sizeHint);
     if (res.x <= 0 || res.y <= 0)
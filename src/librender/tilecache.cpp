@@ -0,0 +1,262 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/tilecache.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/lock.h>
+#include <mitsuba/core/statistics.h>
+#include <boost/unordered_map.hpp>
+#include <list>
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter statsLookups("Texture tile cache", "Shared cache hits", EPercentage);
+static StatsCounter statsLoads("Texture tile cache", "Tile loads");
+static StatsCounter statsEvictions("Texture tile cache", "Tile evictions");
+
+ref<TextureTileCache> TextureTileCache::m_instance = NULL;
+
+namespace {
+    /// A resident tile
+    struct Tile : public Object {
+        uint64_t key;
+        uint8_t *data;
+        size_t size;
+        std::list<Tile *>::iterator lruIt;
+
+        Tile(uint64_t key, size_t size) : key(key), size(size) {
+            data = static_cast<uint8_t *>(allocAligned(size));
+        }
+
+        virtual ~Tile() {
+            freeAligned(data);
+        }
+    };
+};
+
+/// Open file and storage layout of a registered texture
+struct TextureTileCache::CachedFile : public Object {
+    fs::path filename;
+    ref<FileStream> stream;
+    ref<Mutex> mutex;
+    size_t cellSize;
+    int tileCellShift;
+    size_t tileSize;
+    std::vector<LevelInfo> levels;
+
+    /// Read a tile from disk
+    void load(Tile *tile, int level, int x, int y) {
+        int tileCells = 1 << tileCellShift;
+        int x0 = x << tileCellShift, y0 = y << tileCellShift;
+        if (level < 0 || level >= (int) levels.size() || x0 < 0 || y0 < 0
+            || x0 >= levels[level].cells.x || y0 >= levels[level].cells.y)
+            Log(EError, "Tile (%i, %i) of level %i of \"%s\" is out of bounds!",
+                x, y, level, filename.string().c_str());
+
+        const LevelInfo &info = levels[level];
+
+        int width = std::min(tileCells, info.cells.x - x0),
+            height = std::min(tileCells, info.cells.y - y0);
+        size_t rowSize = cellSize * tileCells;
+
+        /* Read the cell rows overlapping with the tile */
+        LockGuard lock(mutex);
+        for (int row=0; row<height; ++row) {
+            stream->seek((size_t) (info.offset + cellSize *
+                ((uint64_t) (y0 + row) * info.cells.x + x0)));
+            stream->read(tile->data + row * rowSize, cellSize * width);
+        }
+    }
+};
+
+/// Shared state of the cache that is protected by a mutex
+struct TextureTileCache::TileStore {
+    typedef boost::unordered_map<uint64_t, ref<Tile> > TileMap;
+    typedef std::map<uint32_t, ref<CachedFile> > FileMap;
+
+    ref<Mutex> mutex;
+    TileMap tiles;
+    FileMap files;
+    /// Resident tiles, most recently used ones first
+    std::list<Tile *> lru;
+    size_t usage;
+    uint32_t nextID;
+
+    TileStore() : mutex(new Mutex()), usage(0), nextID(1) { }
+
+    /// Remove a tile from the cache (mutex must be held)
+    void remove(TileMap::iterator it) {
+        usage -= it->second->size;
+        lru.erase(it->second->lruIt);
+        tiles.erase(it);
+    }
+};
+
+TextureTileCache::TextureTileCache()
+    : m_memoryLimit(MTS_TILECACHE_DEFAULT_LIMIT) {
+    m_store = new TileStore();
+}
+
+TextureTileCache::~TextureTileCache() {
+    delete m_store;
+}
+
+uint32_t TextureTileCache::registerFile(const fs::path &filename, size_t cellSize,
+        int tileCellShift, const std::vector<LevelInfo> &levels) {
+    if (levels.empty() || levels.size() > 0xFF)
+        Log(EError, "registerFile(): invalid number of levels (%i)!", (int) levels.size());
+
+    ref<CachedFile> file = new CachedFile();
+    file->filename = filename;
+    file->stream = new FileStream(filename, FileStream::EReadOnly);
+    file->mutex = new Mutex();
+    file->cellSize = cellSize;
+    file->tileCellShift = tileCellShift;
+    file->tileSize = cellSize << (2*tileCellShift);
+    file->levels = levels;
+
+    for (size_t i=0; i<levels.size(); ++i) {
+        const Vector2i &cells = levels[i].cells;
+        if (((cells.x - 1) >> tileCellShift) > 0xFFFF ||
+            ((cells.y - 1) >> tileCellShift) > 0xFFFF)
+            Log(EError, "registerFile(): level %i of \"%s\" has too many tiles!",
+                (int) i, filename.string().c_str());
+    }
+
+    LockGuard lock(m_store->mutex);
+    uint32_t id = m_store->nextID++;
+    if (id >= (1 << 24))
+        Log(EError, "registerFile(): ran out of file identifiers!");
+    m_store->files[id] = file;
+
+    Log(EDebug, "Registered \"%s\" with the texture tile cache (%i levels, %s per tile)",
+        filename.filename().string().c_str(), (int) levels.size(),
+        memString(file->tileSize).c_str());
+
+    return id;
+}
+
+void TextureTileCache::unregisterFile(uint32_t id) {
+    LockGuard lock(m_store->mutex);
+    m_store->files.erase(id);
+
+    /* Release the file's tiles. Identifiers are never reused, hence entries
+       that are still held by per-thread caches are simply never hit again */
+    for (TileStore::TileMap::iterator it = m_store->tiles.begin();
+            it != m_store->tiles.end(); ) {
+        if ((uint32_t) (it->first >> 40) == id)
+            m_store->remove(it++);
+        else
+            ++it;
+    }
+}
+
+const uint8_t *TextureTileCache::lookupSlow(MicroCache::Entry &entry, uint64_t key,
+        uint32_t id, int level, int x, int y) const {
+    TileStore &store = *m_store;
+    ref<Tile> tile;
+    ref<CachedFile> file;
+
+    {
+        LockGuard lock(store.mutex);
+        TileStore::TileMap::iterator it = store.tiles.find(key);
+        if (it != store.tiles.end()) {
+            tile = it->second;
+            store.lru.splice(store.lru.begin(), store.lru, tile->lruIt);
+            ++statsLookups;
+        } else {
+            TileStore::FileMap::iterator it2 = store.files.find(id);
+            if (it2 == store.files.end())
+                Log(EError, "lookup(): unknown file identifier %i!", id);
+            file = it2->second;
+        }
+        statsLookups.incrementBase();
+    }
+
+    if (!tile) {
+        /* Read the tile without holding the global lock */
+        ref<Tile> loaded = new Tile(key, file->tileSize);
+        file->load(loaded, level, x, y);
+
+        LockGuard lock(store.mutex);
+        TileStore::TileMap::iterator it = store.tiles.find(key);
+        if (it != store.tiles.end()) {
+            /* Another thread was faster */
+            tile = it->second;
+        } else if (store.files.find(id) != store.files.end()) {
+            tile = loaded;
+            store.lru.push_front(tile.get());
+            tile->lruIt = store.lru.begin();
+            store.tiles[key] = tile;
+            store.usage += tile->size;
+            ++statsLoads;
+            enforceLimit();
+        } else {
+            /* The file was unregistered in the meantime */
+            tile = loaded;
+        }
+    }
+
+    entry.key = key;
+    entry.data = tile->data;
+    entry.tile = tile.get();
+    return tile->data;
+}
+
+void TextureTileCache::enforceLimit() const {
+    /* Always keep the most recently used tile */
+    while (m_store->usage > m_memoryLimit && m_store->lru.size() > 1) {
+        Tile *tile = m_store->lru.back();
+        m_store->remove(m_store->tiles.find(tile->key));
+        ++statsEvictions;
+    }
+}
+
+void TextureTileCache::setMemoryLimit(size_t limit) {
+    LockGuard lock(m_store->mutex);
+    m_memoryLimit = limit;
+    enforceLimit();
+}
+
+size_t TextureTileCache::getMemoryUsage() const {
+    LockGuard lock(m_store->mutex);
+    return m_store->usage;
+}
+
+std::string TextureTileCache::toString() const {
+    LockGuard lock(m_store->mutex);
+    std::ostringstream oss;
+    oss << "TextureTileCache[" << endl
+        << "  files = " << m_store->files.size() << "," << endl
+        << "  tiles = " << m_store->tiles.size() << "," << endl
+        << "  memoryUsage = " << memString(m_store->usage) << "," << endl
+        << "  memoryLimit = " << memString(m_memoryLimit) << endl
+        << "]";
+    return oss.str();
+}
+
+void TextureTileCache::staticInitialization() {
+    m_instance = new TextureTileCache();
+}
+
+void TextureTileCache::staticShutdown() {
+    m_instance = NULL;
+}
+
+MTS_IMPLEMENT_CLASS(TextureTileCache, false, Object)
+MTS_NAMESPACE_END
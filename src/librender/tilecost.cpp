@@ -0,0 +1,123 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/tilecost.h>
+#include <boost/filesystem/operations.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+static ref<Bitmap> createCostBitmap(const Vector2i &size) {
+    ref<Bitmap> bitmap = new Bitmap(Bitmap::EMultiChannel,
+        Bitmap::EFloat32, size, 3);
+    std::vector<std::string> names;
+    names.push_back("time");
+    names.push_back("samples");
+    names.push_back("rays");
+    bitmap->setChannelNames(names);
+    bitmap->clear();
+    return bitmap;
+}
+
+TileCostMap::TileCostMap(const Vector2i &size) {
+    m_bitmap = createCostBitmap(size);
+    m_mutex = new Mutex();
+}
+
+void TileCostMap::put(const ImageBlock *block) {
+    const BlockCost *cost = block->getCost();
+    const Vector2i &size = block->getSize();
+    if (!cost || size.x <= 0 || size.y <= 0)
+        return;
+
+    /* Distribute the cost uniformly over the pixels of the block */
+    Float invPixels = 1 / ((Float) size.x * (Float) size.y);
+    float time = (float) (cost->time * invPixels),
+          samples = (float) (cost->samples * invPixels),
+          rays = (float) (cost->rays * invPixels);
+
+    LockGuard lock(m_mutex);
+    const Point2i &offset = block->getOffset();
+    const Vector2i &mapSize = m_bitmap->getSize();
+    int xs = std::max(offset.x, 0), xe = std::min(offset.x + size.x, mapSize.x),
+        ys = std::max(offset.y, 0), ye = std::min(offset.y + size.y, mapSize.y);
+
+    for (int y=ys; y<ye; ++y) {
+        float *target = m_bitmap->getFloat32Data() + (y * (size_t) mapSize.x + xs) * 3;
+        for (int x=xs; x<xe; ++x) {
+            target[0] += time;
+            target[1] += samples;
+            target[2] += rays;
+            target += 3;
+        }
+    }
+}
+
+Float TileCostMap::getTotalTime() const {
+    LockGuard lock(m_mutex);
+    const float *data = m_bitmap->getFloat32Data();
+    size_t pixelCount = m_bitmap->getPixelCount();
+    double total = 0;
+    for (size_t i=0; i<pixelCount; ++i)
+        total += data[3*i];
+    return (Float) total;
+}
+
+ref<Bitmap> TileCostMap::getTimePrediction() const {
+    LockGuard lock(m_mutex);
+    return m_bitmap->extractChannel(0);
+}
+
+bool TileCostMap::load(const fs::path &filename) {
+    LockGuard lock(m_mutex);
+    Vector2i size = m_bitmap->getSize();
+    m_bitmap = createCostBitmap(size);
+    if (!fs::exists(filename))
+        return false;
+
+    try {
+        ref<Bitmap> bitmap = new Bitmap(filename);
+        if (bitmap->getSize() != size || bitmap->getChannelCount() != 3) {
+            Log(EWarn, "The tile cost map \"%s\" has a different size -- ignoring it.",
+                filename.string().c_str());
+            return false;
+        }
+        bitmap = bitmap->convert(bitmap->getPixelFormat(), Bitmap::EFloat32);
+        memcpy(m_bitmap->getFloat32Data(), bitmap->getFloat32Data(),
+            m_bitmap->getBufferSize());
+    } catch (const std::exception &ex) {
+        Log(EWarn, "Could not load the tile cost map \"%s\": %s",
+            filename.string().c_str(), ex.what());
+        return false;
+    }
+    return true;
+}
+
+void TileCostMap::save(const fs::path &filename) const {
+    LockGuard lock(m_mutex);
+    m_bitmap->write(Bitmap::EOpenEXR, filename);
+}
+
+std::string TileCostMap::toString() const {
+    std::ostringstream oss;
+    oss << "TileCostMap[size=" << getSize().toString()
+        << ", totalTime=" << getTotalTime() << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(TileCostMap, false, Object)
+MTS_NAMESPACE_END
@@ -0,0 +1,478 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/trcache.h>
+#include <mitsuba/render/range.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/statistics.h>
+
+/// Number of grid vertices per work unit
+#define TRCACHE_GRANULARITY 1024
+
+/// Number of random positions used to estimate the interpolation error
+#define TRCACHE_VALIDATION_POINTS 256
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Stores the transmittance values computed for a range
+ * of grid vertices
+ */
+class TransmittanceSampleVector : public WorkResult {
+public:
+    inline void clear() { m_values.clear(); }
+    inline void put(const Spectrum &value) { m_values.push_back(value); }
+    inline size_t size() const { return m_values.size(); }
+    inline const Spectrum &operator[](size_t index) const { return m_values[index]; }
+
+    inline void setRangeStart(size_t rangeStart) { m_rangeStart = rangeStart; }
+    inline size_t getRangeStart() const { return m_rangeStart; }
+
+    void load(Stream *stream) {
+        m_rangeStart = stream->readSize();
+        m_values.resize(stream->readSize());
+        for (size_t i=0; i<m_values.size(); ++i)
+            m_values[i] = Spectrum(stream);
+    }
+
+    void save(Stream *stream) const {
+        stream->writeSize(m_rangeStart);
+        stream->writeSize(m_values.size());
+        for (size_t i=0; i<m_values.size(); ++i)
+            m_values[i].serialize(stream);
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "TransmittanceSampleVector[rangeStart=" << m_rangeStart
+            << ", size=" << m_values.size() << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~TransmittanceSampleVector() { }
+private:
+    size_t m_rangeStart;
+    std::vector<Spectrum> m_values;
+};
+
+/* Parallel transmittance cache construction (worker) */
+class TransmittanceCacheWorker : public WorkProcessor {
+public:
+    TransmittanceCacheWorker(uint32_t emitterIndex, uint32_t mediumIndex,
+        const Point &origin, const Vector &cellSize, const Vector3i &res,
+        int sampleCount, Float time) : m_emitterIndex(emitterIndex),
+        m_mediumIndex(mediumIndex), m_origin(origin), m_cellSize(cellSize),
+        m_res(res), m_sampleCount(sampleCount), m_time(time) { }
+
+    TransmittanceCacheWorker(Stream *stream, InstanceManager *manager) {
+        m_emitterIndex = stream->readUInt();
+        m_mediumIndex = stream->readUInt();
+        m_origin = Point(stream);
+        m_cellSize = Vector(stream);
+        m_res = Vector3i(stream);
+        m_sampleCount = stream->readInt();
+        m_time = stream->readFloat();
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        stream->writeUInt(m_emitterIndex);
+        stream->writeUInt(m_mediumIndex);
+        m_origin.serialize(stream);
+        m_cellSize.serialize(stream);
+        m_res.serialize(stream);
+        stream->writeInt(m_sampleCount);
+        stream->writeFloat(m_time);
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RangeWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new TransmittanceSampleVector();
+    }
+
+    void prepare() {
+        m_scene = static_cast<Scene *>(getResource("scene"));
+        m_sampler = static_cast<Sampler *>(getResource("sampler"));
+        m_scene->wakeup(NULL, m_resources);
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+        TransmittanceSampleVector *result = static_cast<TransmittanceSampleVector *>(workResult);
+        const Emitter *emitter = m_scene->getEmitters()[m_emitterIndex].get();
+        const Medium *medium = m_scene->getMedia()[m_mediumIndex].get();
+
+        result->clear();
+        result->setRangeStart(range->getRangeStart());
+
+        for (size_t i=range->getRangeStart(); i<=range->getRangeEnd(); ++i) {
+            int x = (int) (i % m_res.x),
+                y = (int) ((i / m_res.x) % m_res.y),
+                z = (int) (i / ((size_t) m_res.x * m_res.y));
+            Point p = m_origin + Vector(x * m_cellSize.x,
+                y * m_cellSize.y, z * m_cellSize.z);
+
+            result->put(evalTransmittance(m_scene, emitter, medium,
+                p, m_time, m_sampleCount, m_sampler));
+
+            if (stop)
+                break;
+        }
+    }
+
+    /// Average several transmittance estimates from \c p towards \c emitter
+    static Spectrum evalTransmittance(const Scene *scene, const Emitter *emitter,
+            const Medium *medium, const Point &p, Float time,
+            int sampleCount, Sampler *sampler) {
+        DirectSamplingRecord dRec(p, time);
+        dRec.pdf = 0.0f;
+        if (emitter->sampleDirect(dRec, Point2(0.5f)).isZero() || dRec.pdf == 0)
+            return Spectrum(0.0f);
+
+        Spectrum result(0.0f);
+        for (int i=0; i<sampleCount; ++i) {
+            int interactions = -1;
+            result += scene->evalTransmittance(p, false, dRec.p,
+                emitter->isOnSurface(), time, medium, interactions, sampler);
+        }
+        return result / (Float) sampleCount;
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new TransmittanceCacheWorker(m_emitterIndex, m_mediumIndex,
+            m_origin, m_cellSize, m_res, m_sampleCount, m_time);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~TransmittanceCacheWorker() { }
+private:
+    ref<Scene> m_scene;
+    ref<Sampler> m_sampler;
+    uint32_t m_emitterIndex, m_mediumIndex;
+    Point m_origin;
+    Vector m_cellSize;
+    Vector3i m_res;
+    int m_sampleCount;
+    Float m_time;
+};
+
+/* Parallel transmittance cache construction (work distribution) */
+class TransmittanceCacheProcess : public ParallelProcess {
+public:
+    TransmittanceCacheProcess(std::vector<Spectrum> &values,
+            TransmittanceCacheWorker *worker, const std::string &title,
+            const void *progressReporterPayload)
+        : m_values(values), m_worker(worker), m_workUnits(0), m_finished(0) {
+        m_resultMutex = new Mutex();
+        m_progress = new ProgressReporter(title, values.size(),
+            progressReporterPayload);
+    }
+
+    ref<WorkProcessor> createWorkProcessor() const {
+        return m_worker->clone();
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        size_t start = m_workUnits * TRCACHE_GRANULARITY;
+        if (start >= m_values.size())
+            return EFailure;
+        size_t end = std::min(start + TRCACHE_GRANULARITY, m_values.size()) - 1;
+        static_cast<RangeWorkUnit *>(unit)->setRange(start, end);
+        ++m_workUnits;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *wr, bool cancelled) {
+        if (cancelled)
+            return;
+        const TransmittanceSampleVector *result =
+            static_cast<const TransmittanceSampleVector *>(wr);
+        LockGuard lock(m_resultMutex);
+        for (size_t i=0; i<result->size(); ++i)
+            m_values[result->getRangeStart() + i] = (*result)[i];
+        m_finished += result->size();
+        m_progress->update(m_finished);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~TransmittanceCacheProcess() {
+        delete m_progress;
+    }
+private:
+    std::vector<Spectrum> &m_values;
+    ref<TransmittanceCacheWorker> m_worker;
+    ref<Mutex> m_resultMutex;
+    ProgressReporter *m_progress;
+    size_t m_workUnits, m_finished;
+};
+
+TransmittanceCache::TransmittanceCache(int resolution, int sampleCount)
+    : m_resolution(resolution), m_sampleCount(sampleCount), m_cancelled(false) {
+    if (resolution < 2)
+        Log(EError, "The transmittance cache resolution must be at least 2!");
+    if (sampleCount < 1)
+        Log(EError, "The transmittance cache needs at least one sample per vertex!");
+}
+
+TransmittanceCache::TransmittanceCache(Stream *stream, InstanceManager *manager)
+    : SerializableObject(stream, manager), m_cancelled(false) {
+    m_resolution = stream->readInt();
+    m_sampleCount = stream->readInt();
+    m_aabb = AABB(stream);
+    m_res = Vector3i(stream);
+    m_cellSize = Vector(stream);
+    m_invCellSize = Vector(stream);
+    m_grids.resize(stream->readSize());
+    for (size_t i=0; i<m_grids.size(); ++i) {
+        Grid &grid = m_grids[i];
+        grid.emitterIndex = stream->readUInt();
+        grid.mediumIndex = stream->readUInt();
+        grid.emitter = NULL;
+        grid.medium = NULL;
+        grid.meanError = stream->readFloat();
+        grid.maxError = stream->readFloat();
+        grid.values.resize((size_t) m_res.x * m_res.y * m_res.z);
+        for (size_t j=0; j<grid.values.size(); ++j)
+            grid.values[j] = Spectrum(stream);
+    }
+}
+
+void TransmittanceCache::serialize(Stream *stream, InstanceManager *manager) const {
+    SerializableObject::serialize(stream, manager);
+    stream->writeInt(m_resolution);
+    stream->writeInt(m_sampleCount);
+    m_aabb.serialize(stream);
+    m_res.serialize(stream);
+    m_cellSize.serialize(stream);
+    m_invCellSize.serialize(stream);
+    stream->writeSize(m_grids.size());
+    for (size_t i=0; i<m_grids.size(); ++i) {
+        const Grid &grid = m_grids[i];
+        stream->writeUInt(grid.emitterIndex);
+        stream->writeUInt(grid.mediumIndex);
+        stream->writeFloat(grid.meanError);
+        stream->writeFloat(grid.maxError);
+        for (size_t j=0; j<grid.values.size(); ++j)
+            grid.values[j].serialize(stream);
+    }
+}
+
+bool TransmittanceCache::build(const Scene *scene,
+        const void *progressReporterPayload, int sceneResID, int samplerResID) {
+    const ref_vector<Emitter> &emitters = scene->getEmitters();
+    const ref_vector<Medium> &media = scene->getMedia();
+    const Sensor *sensor = scene->getSensor();
+    Float time = sensor->getShutterOpen() + 0.5f * sensor->getShutterOpenTime();
+
+    /* Determine the grid layout (cubic cells spanning the scene) */
+    m_aabb = scene->getAABB();
+    Vector extents = m_aabb.getExtents();
+    Float cellSize = extents[m_aabb.getLargestAxis()] / (m_resolution - 1);
+    for (int i=0; i<3; ++i) {
+        m_res[i] = std::max(2, (int) std::ceil(extents[i] / cellSize) + 1);
+        m_cellSize[i] = extents[i] / (m_res[i] - 1);
+        m_invCellSize[i] = m_cellSize[i] > 0 ? 1.0f / m_cellSize[i] : 0.0f;
+    }
+
+    m_grids.clear();
+    m_cancelled = false;
+    for (size_t i=0; i<emitters.size(); ++i) {
+        const Emitter *emitter = emitters[i].get();
+        if (emitter->needsDirectionSample() || !emitter->getWorldTransform()->isStatic())
+            continue;
+
+        for (size_t j=0; j<media.size(); ++j) {
+            Grid grid;
+            grid.emitterIndex = (uint32_t) i;
+            grid.mediumIndex = (uint32_t) j;
+            grid.emitter = emitter;
+            grid.medium = media[j].get();
+            grid.meanError = grid.maxError = 0.0f;
+            m_grids.push_back(grid);
+        }
+    }
+
+    if (m_grids.empty())
+        return true;
+
+    Log(EInfo, "Building " SIZE_T_FMT " transmittance cache grid(s) with %ix%ix%i "
+        "vertices and %i sample(s) per vertex ..", m_grids.size(),
+        m_res.x, m_res.y, m_res.z, m_sampleCount);
+
+    ref<Timer> timer = new Timer();
+    for (size_t i=0; i<m_grids.size(); ++i) {
+        if (!buildGrid(scene, i, time, progressReporterPayload, sceneResID, samplerResID)) {
+            m_grids.clear();
+            return false;
+        }
+        validateGrid(scene, i, time);
+    }
+
+    Log(EInfo, "Transmittance cache construction took %i ms (memory usage: %s, "
+        "mean abs. error: %.4f, max abs. error: %.4f)", timer->getMilliseconds(),
+        memString(m_grids.size() * m_grids[0].values.size() * sizeof(Spectrum)).c_str(),
+        getMeanError(), getMaxError());
+
+    return true;
+}
+
+bool TransmittanceCache::buildGrid(const Scene *scene, size_t index, Float time,
+        const void *progressReporterPayload, int sceneResID, int samplerResID) {
+    Grid &grid = m_grids[index];
+    grid.values.resize((size_t) m_res.x * m_res.y * m_res.z);
+
+    ref<TransmittanceCacheWorker> worker = new TransmittanceCacheWorker(
+        grid.emitterIndex, grid.mediumIndex, m_aabb.min, m_cellSize,
+        m_res, m_sampleCount, time);
+
+    ref<TransmittanceCacheProcess> proc = new TransmittanceCacheProcess(
+        grid.values, worker, formatString("Caching transmittance (%i/%i)",
+        (int) index + 1, (int) m_grids.size()), progressReporterPayload);
+    proc->bindResource("scene", sceneResID);
+    proc->bindResource("sampler", samplerResID);
+
+    ref<Scheduler> sched = Scheduler::getInstance();
+    m_process = proc;
+    sched->schedule(proc);
+    sched->wait(proc);
+    m_process = NULL;
+
+    return !m_cancelled && proc->getReturnStatus() == ParallelProcess::ESuccess;
+}
+
+void TransmittanceCache::validateGrid(const Scene *scene, size_t index, Float time) {
+    Grid &grid = m_grids[index];
+    ref<Random> random = new Random();
+    ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+        createObject(MTS_CLASS(Sampler), Properties("independent")));
+
+    /* Use a longer reference estimate so that the error reflects
+       the interpolation more than the noise of the reference */
+    int referenceSamples = 4 * m_sampleCount;
+    Float errorSum = 0.0f, errorMax = 0.0f;
+    for (int i=0; i<TRCACHE_VALIDATION_POINTS; ++i) {
+        Point p = m_aabb.min + Vector(m_aabb.getExtents().x * random->nextFloat(),
+            m_aabb.getExtents().y * random->nextFloat(),
+            m_aabb.getExtents().z * random->nextFloat());
+
+        Spectrum cached(0.0f);
+        eval(grid.emitter, grid.medium, p, cached);
+        Spectrum reference = TransmittanceCacheWorker::evalTransmittance(scene,
+            grid.emitter, grid.medium, p, time, referenceSamples, sampler);
+
+        Float error = (cached - reference).abs().average();
+        errorSum += error;
+        errorMax = std::max(errorMax, error);
+    }
+
+    grid.meanError = errorSum / TRCACHE_VALIDATION_POINTS;
+    grid.maxError = errorMax;
+}
+
+void TransmittanceCache::cancel() {
+    m_cancelled = true;
+    if (m_process)
+        Scheduler::getInstance()->cancel(m_process);
+}
+
+void TransmittanceCache::bind(const Scene *scene) {
+    const ref_vector<Emitter> &emitters = scene->getEmitters();
+    const ref_vector<Medium> &media = scene->getMedia();
+
+    for (size_t i=0; i<m_grids.size(); ++i) {
+        Grid &grid = m_grids[i];
+        if (grid.emitterIndex >= emitters.size() || grid.mediumIndex >= media.size())
+            Log(EError, "The transmittance cache does not match the scene!");
+        grid.emitter = emitters[grid.emitterIndex].get();
+        grid.medium = media[grid.mediumIndex].get();
+    }
+}
+
+bool TransmittanceCache::eval(const Emitter *emitter, const Medium *medium,
+        const Point &p, Spectrum &result) const {
+    const Grid *grid = NULL;
+    for (size_t i=0; i<m_grids.size(); ++i) {
+        if (m_grids[i].emitter == emitter && m_grids[i].medium == medium) {
+            grid = &m_grids[i];
+            break;
+        }
+    }
+
+    if (!grid || !m_aabb.contains(p))
+        return false;
+
+    /* Trilinear interpolation of the vertex values */
+    int pos[3];
+    Float w[3];
+    for (int i=0; i<3; ++i) {
+        Float x = (p[i] - m_aabb.min[i]) * m_invCellSize[i];
+        pos[i] = std::min(std::max(0, math::floorToInt(x)), m_res[i] - 2);
+        w[i] = std::min(std::max((Float) 0, x - pos[i]), (Float) 1);
+    }
+
+    const size_t dy = m_res.x, dz = (size_t) m_res.x * m_res.y;
+    const Spectrum *v = &grid->values[pos[2] * dz + pos[1] * dy + pos[0]];
+
+    result = ((v[0]       * (1-w[0]) + v[1]         * w[0]) * (1-w[1])
+           +  (v[dy]      * (1-w[0]) + v[dy+1]      * w[0]) * w[1]) * (1-w[2])
+           + ((v[dz]      * (1-w[0]) + v[dz+1]      * w[0]) * (1-w[1])
+           +  (v[dz+dy]   * (1-w[0]) + v[dz+dy+1]   * w[0]) * w[1]) * w[2];
+
+    return true;
+}
+
+Float TransmittanceCache::getMeanError() const {
+    Float result = 0.0f;
+    for (size_t i=0; i<m_grids.size(); ++i)
+        result += m_grids[i].meanError;
+    return m_grids.empty() ? 0.0f : result / m_grids.size();
+}
+
+Float TransmittanceCache::getMaxError() const {
+    Float result = 0.0f;
+    for (size_t i=0; i<m_grids.size(); ++i)
+        result = std::max(result, m_grids[i].maxError);
+    return result;
+}
+
+std::string TransmittanceCache::toString() const {
+    std::ostringstream oss;
+    oss << "TransmittanceCache[" << endl
+        << "  aabb = " << m_aabb.toString() << "," << endl
+        << "  resolution = " << m_res.toString() << "," << endl
+        << "  sampleCount = " << m_sampleCount << "," << endl
+        << "  grids = " << m_grids.size() << "," << endl
+        << "  meanError = " << getMeanError() << "," << endl
+        << "  maxError = " << getMaxError() << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(TransmittanceSampleVector, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(TransmittanceCacheWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(TransmittanceCacheProcess, false, ParallelProcess)
+MTS_IMPLEMENT_CLASS_S(TransmittanceCache, false, SerializableObject)
+MTS_NAMESPACE_END
@@ -21,9 +21,12 @@
 #include <mitsuba/core/random.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/zstream.h>
+#include <mitsuba/core/mstream.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/warp.h>
 #include <mitsuba/core/lock.h>
 #include <mitsuba/core/properties.h>
+#include <mitsuba/core/statistics.h>
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/bsdf.h>
@@ -34,9 +37,24 @@
 #define MTS_FILEFORMAT_HEADER     0x041C
 #define MTS_FILEFORMAT_VERSION_V3 0x0003
 #define MTS_FILEFORMAT_VERSION_V4 0x0004
+#define MTS_FILEFORMAT_VERSION_V5 0x0005 /* Uncompressed, can be memory-mapped */
+#define MTS_FILEFORMAT_VERSION_V6 0x0006 /* Compressed in independent blocks */
+
+/// Meshes with more data than this are written using the block-compressed format
+#define MTS_FILEFORMAT_BLOCK_THRESHOLD (4 * ZSTREAM_BLOCKSIZE)
+
+/// Alignment of the first attribute array in uncompressed files
+#define MTS_FILEFORMAT_PAGE_SIZE  4096
+/// Alignment of the remaining attribute arrays in uncompressed files
+#define MTS_FILEFORMAT_ALIGNMENT  64
 
 MTS_NAMESPACE_BEGIN
 
+static StatsCounter quantizedMemory("Triangle meshes",
+    "Quantized vertex attribute storage", EByteCount);
+static StatsCounter quantizationSavings("Triangle meshes",
+    "Memory saved by attribute quantization", EByteCount);
+
 TriMesh::TriMesh(const std::string &name, size_t triangleCount,
         size_t vertexCount, bool hasNormals, bool hasTexcoords,
         bool hasVertexColors, bool flipNormals, bool faceNormals)
@@ -50,14 +68,21 @@ TriMesh::TriMesh(const std::string &name, size_t triangleCount,
     m_texcoords = hasTexcoords ? new Point2[m_vertexCount] : NULL;
     m_colors = hasVertexColors ? new Color3[m_vertexCount] : NULL;
     m_tangents = NULL;
+    m_vertexTangents = NULL;
+    m_packedNormals = NULL;
+    m_packedTexcoords = NULL;
+    m_packedColors = NULL;
+    m_quantize = m_quantized = false;
+    m_smoothTangents = false;
     m_surfaceArea = m_invSurfaceArea = -1;
     m_mutex = new Mutex();
 }
 
 TriMesh::TriMesh(const Properties &props)
  : Shape(props), m_triangles(NULL), m_positions(NULL),
-    m_normals(NULL), m_texcoords(NULL), m_tangents(NULL),
-    m_colors(NULL) {
+    m_normals(NULL), m_texcoords(NULL), m_tangents(NULL), m_vertexTangents(NULL),
+    m_colors(NULL), m_packedNormals(NULL), m_packedTexcoords(NULL),
+    m_packedColors(NULL), m_quantized(false) {
 
     /* By default, any existing normals will be used for
        rendering. If no normals are found, Mitsuba will
@@ -71,6 +96,14 @@ TriMesh::TriMesh(const Properties &props)
     /* Causes all normals to be flipped */
     m_flipNormals = props.getBoolean("flipNormals", false);
 
+    /* Store normals, texture coordinates and colors in a compact
+       quantized form to save memory (see TriMesh::quantize()) */
+    m_quantize = props.getBoolean("quantize", false);
+
+    /* Interpolate per-vertex UV tangents instead of using
+       per-triangle ones (see TriMesh::computeUVTangents()) */
+    m_smoothTangents = props.getBoolean("smoothTangents", false);
+
     m_triangles = NULL;
     m_surfaceArea = m_invSurfaceArea = -1;
     m_mutex = new Mutex();
@@ -79,7 +112,9 @@ TriMesh::TriMesh(const Properties &props)
 TriMesh::TriMesh(Stream *stream, int index)
         : Shape(Properties()), m_triangles(NULL),
     m_positions(NULL), m_normals(NULL), m_texcoords(NULL),
-    m_tangents(NULL), m_colors(NULL) {
+    m_tangents(NULL), m_vertexTangents(NULL), m_colors(NULL), m_packedNormals(NULL),
+    m_packedTexcoords(NULL), m_packedColors(NULL),
+    m_quantize(false), m_quantized(false), m_smoothTangents(false) {
 
     m_mutex = new Mutex();
     loadCompressed(stream, index);
@@ -92,12 +127,16 @@ enum ETriMeshFlags {
     EHasTangents     = 0x0004, // unused
     EHasColors       = 0x0008,
     EFaceNormals     = 0x0010,
+    EQuantize        = 0x0020,
+    ESmoothTangents  = 0x0040,
     ESinglePrecision = 0x1000,
     EDoublePrecision = 0x2000
 };
 
 TriMesh::TriMesh(Stream *stream, InstanceManager *manager)
-    : Shape(stream, manager), m_tangents(NULL) {
+    : Shape(stream, manager), m_tangents(NULL), m_vertexTangents(NULL),
+      m_packedNormals(NULL), m_packedTexcoords(NULL), m_packedColors(NULL),
+      m_quantized(false) {
     m_name = stream->readString();
     m_aabb = AABB(stream);
 
@@ -110,6 +149,8 @@ TriMesh::TriMesh(Stream *stream, InstanceManager *manager)
         m_vertexCount * sizeof(Point)/sizeof(Float));
 
     m_faceNormals = flags & EFaceNormals;
+    m_quantize = flags & EQuantize;
+    m_smoothTangents = flags & ESmoothTangents;
 
     if (flags & EHasNormals) {
         m_normals = new Normal[m_vertexCount];
@@ -144,6 +185,23 @@ TriMesh::TriMesh(Stream *stream, InstanceManager *manager)
     configure();
 }
 
+/// Round up to the next file offset with the given alignment
+static inline size_t alignOffset(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+/// Skip the padding in front of an array of an uncompressed mesh
+static void alignStream(Stream *stream, size_t alignment) {
+    stream->seek(alignOffset(stream->getPos(), alignment));
+}
+
+/// Write the padding in front of an array of an uncompressed mesh
+static void writePadding(Stream *stream, size_t alignment) {
+    static const uint8_t zeros[MTS_FILEFORMAT_PAGE_SIZE] = { 0 };
+    size_t pos = stream->getPos();
+    stream->write(zeros, alignOffset(pos, alignment) - pos);
+}
+
 static void readHelper(Stream *stream, bool fileDoublePrecision,
         Float *target, size_t count, size_t nelems) {
 #if defined(SINGLE_PRECISION)
@@ -187,11 +245,18 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
         stream->skip(sizeof(short) * 2); // Skip the header
     }
 
-    stream = new ZStream(stream);
-    stream->setByteOrder(Stream::ELittleEndian);
+    /* Version 5 files are not compressed, but the attribute arrays are aligned */
+    bool uncompressed = version == MTS_FILEFORMAT_VERSION_V5;
+    if (version == MTS_FILEFORMAT_VERSION_V6) {
+        /* Decompress all blocks at once (in parallel) */
+        stream = ZStream::readBlocks(stream);
+    } else if (!uncompressed) {
+        stream = new ZStream(stream);
+        stream->setByteOrder(Stream::ELittleEndian);
+    }
 
     uint32_t flags = stream->readUInt();
-    if (version == MTS_FILEFORMAT_VERSION_V4)
+    if (version != MTS_FILEFORMAT_VERSION_V3)
         m_name = stream->readString();
     m_vertexCount = stream->readSize();
     m_triangleCount = stream->readSize();
@@ -199,18 +264,20 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
     bool fileDoublePrecision = flags & EDoublePrecision;
     m_faceNormals = flags & EFaceNormals;
 
-    if (m_positions)
-        delete[] m_positions;
+    freeArray(m_positions);
 
+    if (uncompressed)
+        alignStream(stream, MTS_FILEFORMAT_PAGE_SIZE);
     m_positions = new Point[m_vertexCount];
     readHelper(stream, fileDoublePrecision,
             reinterpret_cast<Float *>(m_positions),
             m_vertexCount, sizeof(Point)/sizeof(Float));
 
-    if (m_normals)
-        delete[] m_normals;
+    freeArray(m_normals);
 
     if (flags & EHasNormals) {
+        if (uncompressed)
+            alignStream(stream, MTS_FILEFORMAT_ALIGNMENT);
         m_normals = new Normal[m_vertexCount];
         readHelper(stream, fileDoublePrecision,
                 reinterpret_cast<Float *>(m_normals),
@@ -219,10 +286,11 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
         m_normals = NULL;
     }
 
-    if (m_texcoords)
-        delete[] m_texcoords;
+    freeArray(m_texcoords);
 
     if (flags & EHasTexcoords) {
+        if (uncompressed)
+            alignStream(stream, MTS_FILEFORMAT_ALIGNMENT);
         m_texcoords = new Point2[m_vertexCount];
         readHelper(stream, fileDoublePrecision,
                 reinterpret_cast<Float *>(m_texcoords),
@@ -231,10 +299,11 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
         m_texcoords = NULL;
     }
 
-    if (m_colors)
-        delete[] m_colors;
+    freeArray(m_colors);
 
     if (flags & EHasColors) {
+        if (uncompressed)
+            alignStream(stream, MTS_FILEFORMAT_ALIGNMENT);
         m_colors = new Color3[m_vertexCount];
         readHelper(stream, fileDoublePrecision,
                 reinterpret_cast<Float *>(m_colors),
@@ -243,14 +312,123 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
         m_colors = NULL;
     }
 
+    freeArray(m_triangles);
+
+    if (uncompressed)
+        alignStream(stream, MTS_FILEFORMAT_ALIGNMENT);
     m_triangles = new Triangle[m_triangleCount];
     stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
         m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 
+    m_mappedFile = NULL;
     m_surfaceArea = m_invSurfaceArea = -1;
     m_flipNormals = false;
 }
 
+bool TriMesh::loadMapped(MemoryMappedFile *file, size_t offset) {
+    if (Stream::getHostByteOrder() != Stream::ELittleEndian)
+        return false;
+
+    uint8_t *data = static_cast<uint8_t *>(const_cast<void *>(
+        static_cast<const MemoryMappedFile *>(file)->getData()));
+    size_t size = file->getSize();
+
+    ref<MemoryStream> stream = new MemoryStream(data, size);
+    stream->setByteOrder(Stream::ELittleEndian);
+    stream->seek(offset);
+
+    if (stream->readShort() != MTS_FILEFORMAT_HEADER ||
+        stream->readShort() != MTS_FILEFORMAT_VERSION_V5)
+        return false;
+
+    uint32_t flags = stream->readUInt();
+#if defined(SINGLE_PRECISION)
+    if (!(flags & ESinglePrecision))
+        return false;
+#else
+    if (!(flags & EDoublePrecision))
+        return false;
+#endif
+
+    std::string name = stream->readString();
+    size_t vertexCount = stream->readSize();
+    size_t triangleCount = stream->readSize();
+
+    /* Locate the attribute arrays, see serializeUncompressed() */
+    size_t pos = alignOffset(stream->getPos(), MTS_FILEFORMAT_PAGE_SIZE);
+    size_t positionsOffset = pos, normalsOffset = 0,
+           texcoordsOffset = 0, colorsOffset = 0;
+    pos += sizeof(Point) * vertexCount;
+    if (flags & EHasNormals) {
+        normalsOffset = pos = alignOffset(pos, MTS_FILEFORMAT_ALIGNMENT);
+        pos += sizeof(Normal) * vertexCount;
+    }
+    if (flags & EHasTexcoords) {
+        texcoordsOffset = pos = alignOffset(pos, MTS_FILEFORMAT_ALIGNMENT);
+        pos += sizeof(Point2) * vertexCount;
+    }
+    if (flags & EHasColors) {
+        colorsOffset = pos = alignOffset(pos, MTS_FILEFORMAT_ALIGNMENT);
+        pos += sizeof(Color3) * vertexCount;
+    }
+    size_t trianglesOffset = pos = alignOffset(pos, MTS_FILEFORMAT_ALIGNMENT);
+    pos += sizeof(Triangle) * triangleCount;
+
+    if (pos > size)
+        Log(EError, "\"%s\": the memory-mapped mesh \"%s\" is truncated!",
+            file->getFilename().string().c_str(), name.c_str());
+
+    freeArray(m_positions);
+    freeArray(m_normals);
+    freeArray(m_texcoords);
+    freeArray(m_colors);
+    freeArray(m_triangles);
+
+    m_name = name;
+    m_vertexCount = vertexCount;
+    m_triangleCount = triangleCount;
+    m_faceNormals = flags & EFaceNormals;
+    m_positions = reinterpret_cast<Point *>(data + positionsOffset);
+    if (flags & EHasNormals)
+        m_normals = reinterpret_cast<Normal *>(data + normalsOffset);
+    if (flags & EHasTexcoords)
+        m_texcoords = reinterpret_cast<Point2 *>(data + texcoordsOffset);
+    if (flags & EHasColors)
+        m_colors = reinterpret_cast<Color3 *>(data + colorsOffset);
+    m_triangles = reinterpret_cast<Triangle *>(data + trianglesOffset);
+    m_mappedFile = file;
+
+    m_surfaceArea = m_invSurfaceArea = -1;
+    m_flipNormals = false;
+    return true;
+}
+
+template <typename T> static T *copyArray(const T *ptr, size_t count) {
+    if (!ptr)
+        return NULL;
+    T *result = new T[count];
+    memcpy(result, ptr, sizeof(T) * count);
+    return result;
+}
+
+void TriMesh::makeWritable() {
+    if (!m_mappedFile)
+        return;
+
+    if (isMapped(m_positions))
+        m_positions = copyArray(m_positions, m_vertexCount);
+    if (isMapped(m_normals))
+        m_normals = copyArray(m_normals, m_vertexCount);
+    if (isMapped(m_texcoords))
+        m_texcoords = copyArray(m_texcoords, m_vertexCount);
+    if (isMapped(m_colors))
+        m_colors = copyArray(m_colors, m_vertexCount);
+    if (isMapped(m_triangles))
+        m_triangles = copyArray(m_triangles, m_triangleCount);
+
+    m_mappedFile = NULL;
+}
+
 short TriMesh::readHeader(Stream *stream) {
     short format = stream->readShort();
     if (format == 0x1C04) {
@@ -263,7 +441,9 @@ short TriMesh::readHeader(Stream *stream) {
     }
     short version = stream->readShort();
     if (version != MTS_FILEFORMAT_VERSION_V3 &&
-        version != MTS_FILEFORMAT_VERSION_V4) {
+        version != MTS_FILEFORMAT_VERSION_V4 &&
+        version != MTS_FILEFORMAT_VERSION_V5 &&
+        version != MTS_FILEFORMAT_VERSION_V6) {
         Log(EError, "Encountered an incompatible file version!");
     }
     return version;
@@ -283,7 +463,7 @@ size_t TriMesh::readOffset(Stream *stream, short version, int idx) {
     }
 
     // Seek to the correct position
-    if (version == MTS_FILEFORMAT_VERSION_V4) {
+    if (version != MTS_FILEFORMAT_VERSION_V3) {
         stream->seek(stream->getSize() - sizeof(uint64_t) * (count-idx) - sizeof(uint32_t));
         return stream->readSize();
     } else {
@@ -310,7 +490,7 @@ int TriMesh::readOffsetDictionary(Stream *stream, short version,
 
     if (streamSize >= minSize) {
         outOffsets.resize(count);
-        if (version == MTS_FILEFORMAT_VERSION_V4) {
+        if (version != MTS_FILEFORMAT_VERSION_V3) {
             stream->seek(stream->getSize() - sizeof(uint64_t) * count - sizeof(uint32_t));
             if (typeid(size_t) == typeid(uint64_t)) {
                 stream->readArray(&outOffsets[0], count);
@@ -336,19 +516,26 @@ int TriMesh::readOffsetDictionary(Stream *stream, short version,
     }
 }
 
+bool TriMesh::isMappableVersion(short version) {
+    return version == MTS_FILEFORMAT_VERSION_V5;
+}
+
 TriMesh::~TriMesh() {
-    if (m_positions)
-        delete[] m_positions;
-    if (m_normals)
-        delete[] m_normals;
-    if (m_texcoords)
-        delete[] m_texcoords;
+    freeArray(m_positions);
+    freeArray(m_normals);
+    freeArray(m_texcoords);
     if (m_tangents)
         delete[] m_tangents;
-    if (m_colors)
-        delete[] m_colors;
-    if (m_triangles)
-        delete[] m_triangles;
+    if (m_vertexTangents)
+        delete[] m_vertexTangents;
+    freeArray(m_colors);
+    if (m_packedNormals)
+        delete[] m_packedNormals;
+    if (m_packedTexcoords)
+        delete[] m_packedTexcoords;
+    if (m_packedColors)
+        delete[] m_packedColors;
+    freeArray(m_triangles);
 }
 
 AABB TriMesh::getAABB() const {
@@ -369,20 +556,141 @@ void TriMesh::configure() {
             m_aabb.expandBy(m_positions[i]);
     }
 
-    /* Potentially compute/recompute/flip normals, as specified by the user */
-    computeNormals();
+    /* The remaining steps need the full-precision attributes and were
+       already performed before the mesh was quantized */
+    if (!m_quantized) {
+        /* Potentially compute/recompute/flip normals, as specified by the user */
+        computeNormals();
 
-    /* Compute proper position partials with respect to the UV paramerization when:
-        1. An anisotropic BRDF is attached to the shape
-        2. The material explicitly requests tangents so that it can do texture filtering
-    */
-    if (hasBSDF() &&
-        ((m_bsdf->getType() & BSDF::EAnisotropic) || m_bsdf->usesRayDifferentials()))
+        /* Compute proper position partials with respect to the UV paramerization when:
+            1. An anisotropic BRDF is attached to the shape
+            2. The material explicitly requests tangents so that it can do texture filtering
+        */
+        if (hasBSDF() &&
+            ((m_bsdf->getType() & BSDF::EAnisotropic) || m_bsdf->usesRayDifferentials()))
+            computeUVTangents();
+
+        /* For manifold exploration: always compute UV tangents when a glossy material
+           is involved. TODO: find a way to avoid this expense (compute on demand?) */
         computeUVTangents();
 
-    /* For manifold exploration: always compute UV tangents when a glossy material
-       is involved. TODO: find a way to avoid this expense (compute on demand?) */
-    computeUVTangents();
+        if (m_quantize)
+            quantize();
+    }
+
+    /* Spread the mesh data over all NUMA nodes if requested */
+    if (getNUMAInterleaving()) {
+        /* (Leave the page cache of memory-mapped files alone) */
+        if (!isMapped(m_triangles))
+            interleaveMemory(m_triangles, sizeof(Triangle) * m_triangleCount);
+        if (!isMapped(m_positions))
+            interleaveMemory(m_positions, sizeof(Point) * m_vertexCount);
+        if (m_normals && !isMapped(m_normals))
+            interleaveMemory(m_normals, sizeof(Normal) * m_vertexCount);
+        if (m_texcoords && !isMapped(m_texcoords))
+            interleaveMemory(m_texcoords, sizeof(Point2) * m_vertexCount);
+        if (m_tangents)
+            interleaveMemory(m_tangents, sizeof(TangentSpace) * m_triangleCount);
+        if (m_vertexTangents)
+            interleaveMemory(m_vertexTangents, sizeof(TangentSpace) * m_vertexCount);
+        if (m_colors && !isMapped(m_colors))
+            interleaveMemory(m_colors, sizeof(Color3) * m_vertexCount);
+        if (m_packedNormals)
+            interleaveMemory(m_packedNormals, sizeof(uint32_t) * m_vertexCount);
+        if (m_packedTexcoords)
+            interleaveMemory(m_packedTexcoords, sizeof(half) * 2 * m_vertexCount);
+        if (m_packedColors)
+            interleaveMemory(m_packedColors, sizeof(half) * 3 * m_vertexCount);
+    }
+
+    trackMemory();
+}
+
+void TriMesh::trackMemory() {
+    m_memory.set(
+        arraySize(m_triangles, m_triangleCount) +
+        arraySize(m_positions, m_vertexCount) +
+        arraySize(m_normals, m_vertexCount) +
+        arraySize(m_texcoords, m_vertexCount) +
+        arraySize(m_tangents, m_triangleCount) +
+        arraySize(m_vertexTangents, m_vertexCount) +
+        arraySize(m_colors, m_vertexCount) +
+        arraySize(m_packedNormals, m_vertexCount) +
+        arraySize(m_packedTexcoords, 2 * m_vertexCount) +
+        arraySize(m_packedColors, 3 * m_vertexCount));
+}
+
+uint32_t TriMesh::encodeNormal(const Normal &n) {
+    /* Project onto the octahedron and fold the lower hemisphere */
+    Float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    Float x = n.x / l1, y = n.y / l1;
+    if (n.z < 0) {
+        Float ox = x;
+        x = (1 - std::abs(y))  * (ox < 0 ? -1.0f : 1.0f);
+        y = (1 - std::abs(ox)) * (y  < 0 ? -1.0f : 1.0f);
+    }
+
+    /* Choose the rounding direction of both coordinates
+       so that the decoded direction is closest to 'n' */
+    uint32_t best = 0;
+    Float bestDot = -std::numeric_limits<Float>::infinity();
+    for (int i=0; i<4; ++i) {
+        Float qx = (i & 1) ? std::ceil(x * 32767) : std::floor(x * 32767),
+              qy = (i & 2) ? std::ceil(y * 32767) : std::floor(y * 32767);
+        uint32_t value =
+            (uint32_t) (uint16_t) (int16_t) math::clamp(qx, (Float) -32767, (Float) 32767)
+         | ((uint32_t) (uint16_t) (int16_t) math::clamp(qy, (Float) -32767, (Float) 32767) << 16);
+        Float d = dot(decodeNormal(value), n);
+        if (d > bestDot) {
+            best = value;
+            bestDot = d;
+        }
+    }
+    return best;
+}
+
+void TriMesh::quantize() {
+    if (m_quantized)
+        return;
+
+    size_t before = 0, after = 0;
+
+    if (m_normals) {
+        m_packedNormals = new uint32_t[m_vertexCount];
+        for (size_t i=0; i<m_vertexCount; ++i)
+            m_packedNormals[i] = encodeNormal(m_normals[i]);
+        freeArray(m_normals);
+        before += sizeof(Normal) * m_vertexCount;
+        after += sizeof(uint32_t) * m_vertexCount;
+    }
+
+    if (m_texcoords) {
+        m_packedTexcoords = new half[2 * m_vertexCount];
+        for (size_t i=0; i<m_vertexCount; ++i) {
+            m_packedTexcoords[2*i]   = half((float) m_texcoords[i].x);
+            m_packedTexcoords[2*i+1] = half((float) m_texcoords[i].y);
+        }
+        freeArray(m_texcoords);
+        before += sizeof(Point2) * m_vertexCount;
+        after += sizeof(half) * 2 * m_vertexCount;
+    }
+
+    if (m_colors) {
+        m_packedColors = new half[3 * m_vertexCount];
+        for (size_t i=0; i<m_vertexCount; ++i)
+            for (int j=0; j<3; ++j)
+                m_packedColors[3*i+j] = half((float) m_colors[i][j]);
+        freeArray(m_colors);
+        before += sizeof(Color3) * m_vertexCount;
+        after += sizeof(half) * 3 * m_vertexCount;
+    }
+
+    m_quantized = true;
+    quantizedMemory += after;
+    quantizationSavings += before - after;
+
+    Log(EDebug, "\"%s\": quantized the vertex attributes (%s -> %s)",
+        m_name.c_str(), memString(before).c_str(), memString(after).c_str());
 }
 
 void TriMesh::prepareSamplingTable() {
@@ -416,10 +724,183 @@ void TriMesh::samplePosition(PositionSamplingRecord &pRec,
 
     Point2 sample(_sample);
     size_t index = m_areaDistr.sampleReuse(sample.y);
-    pRec.p = m_triangles[index].sample(m_positions, m_normals,
+    const Triangle &tri = m_triangles[index];
+    pRec.p = tri.sample(m_positions, m_normals,
         m_texcoords, pRec.n, pRec.uv, sample);
+
+    if (EXPECT_NOT_TAKEN(m_quantized)) {
+        /* Without the raw arrays, 'uv' holds the barycentric coordinates */
+        Vector b(1 - pRec.uv.x - pRec.uv.y, pRec.uv.x, pRec.uv.y);
+        if (m_packedNormals)
+            pRec.n = normalize(getVertexNormal(tri.idx[0]) * b.x
+                + getVertexNormal(tri.idx[1]) * b.y + getVertexNormal(tri.idx[2]) * b.z);
+        if (m_packedTexcoords)
+            pRec.uv = getVertexTexcoord(tri.idx[0]) * b.x
+                + getVertexTexcoord(tri.idx[1]) * b.y + getVertexTexcoord(tri.idx[2]) * b.z;
+    }
     pRec.pdf = m_invSurfaceArea;
     pRec.measure = EArea;
+    pRec.primIndex = (uint32_t) index;
+}
+
+/* Triangles that subtend a smaller or larger solid angle than this are
+   sampled uniformly with respect to area (avoids numerical issues) */
+static const Float minSphericalTriangleArea = 3e-4f;
+static const Float maxSphericalTriangleArea = 6.22f;
+
+/// Solid angle of the spherical triangle with unit vertices a, b, c
+static inline Float sphericalTriangleArea(const Vector &a, const Vector &b, const Vector &c) {
+    return 2 * std::atan2(std::abs(dot(a, cross(b, c))),
+        1 + dot(a, b) + dot(a, c) + dot(b, c));
+}
+
+/// Uniformly sample a direction within a spherical triangle (Arvo 1995)
+static bool sampleSphericalTriangle(const Vector &a, const Vector &b,
+        const Vector &c, const Point2 &sample, Vector &w) {
+    Vector nAB = cross(a, b), nBC = cross(b, c), nCA = cross(c, a);
+    if (nAB.lengthSquared() == 0 || nBC.lengthSquared() == 0 || nCA.lengthSquared() == 0)
+        return false;
+    nAB = normalize(nAB); nBC = normalize(nBC); nCA = normalize(nCA);
+
+    /* Interior angles of the spherical triangle */
+    Float alpha = unitAngle(nAB, -nCA),
+          beta  = unitAngle(nBC, -nAB),
+          gamma = unitAngle(nCA, -nBC);
+
+    /* Choose the area of the sub-triangle and compute the vertex c' */
+    Float areaPi = (1 - sample.x) * (Float) M_PI + sample.x * (alpha + beta + gamma);
+    Float sinAlpha, cosAlpha, sinA, cosA;
+    math::sincos(alpha, &sinAlpha, &cosAlpha);
+    math::sincos(areaPi, &sinA, &cosA);
+    Float sinPhi = sinA * cosAlpha - cosA * sinAlpha,
+          cosPhi = cosA * cosAlpha + sinA * sinAlpha;
+    Float k1 = cosPhi + cosAlpha,
+          k2 = sinPhi - sinAlpha * dot(a, b);
+    Float denom = (k2 * sinPhi + k1 * cosPhi) * sinAlpha;
+    if (denom == 0)
+        return false;
+    Float cosBp = math::clamp((k2 + (k2 * cosPhi - k1 * sinPhi) * cosAlpha) / denom,
+        (Float) -1, (Float) 1);
+    Float sinBp = math::safe_sqrt(1 - cosBp * cosBp);
+
+    Vector cPerp = c - dot(c, a) * a;
+    if (cPerp.lengthSquared() == 0)
+        return false;
+    Vector cp = cosBp * a + sinBp * normalize(cPerp);
+
+    /* Sample the arc between b and c' */
+    Float cosTheta = 1 - sample.y * (1 - dot(cp, b));
+    Float sinTheta = math::safe_sqrt(1 - cosTheta * cosTheta);
+    Vector cpPerp = cp - dot(cp, b) * b;
+    if (cpPerp.lengthSquared() == 0)
+        return false;
+    w = normalize(cosTheta * b + sinTheta * normalize(cpPerp));
+    return true;
+}
+
+/// Fill in the attributes of a position on a triangle with the given barycentrics
+static void fillTrianglePosition(const TriMesh *mesh, size_t index,
+        Float b1, Float b2, PositionSamplingRecord &pRec) {
+    const Triangle &tri = mesh->getTriangles()[index];
+    const Point *positions = mesh->getVertexPositions();
+    const Point &p0 = positions[tri.idx[0]], &p1 = positions[tri.idx[1]],
+                &p2 = positions[tri.idx[2]];
+    Float b0 = 1 - b1 - b2;
+
+    pRec.p = p0 * b0 + p1 * b1 + p2 * b2;
+    if (mesh->hasVertexNormals())
+        pRec.n = normalize(mesh->getVertexNormal(tri.idx[0]) * b0
+            + mesh->getVertexNormal(tri.idx[1]) * b1
+            + mesh->getVertexNormal(tri.idx[2]) * b2);
+    else
+        pRec.n = Normal(normalize(cross(p1 - p0, p2 - p0)));
+    if (mesh->hasVertexTexcoords())
+        pRec.uv = mesh->getVertexTexcoord(tri.idx[0]) * b0
+            + mesh->getVertexTexcoord(tri.idx[1]) * b1
+            + mesh->getVertexTexcoord(tri.idx[2]) * b2;
+    else
+        pRec.uv = Point2(b1, b2);
+    pRec.primIndex = (uint32_t) index;
+}
+
+void TriMesh::sampleDirectSolidAngle(DirectSamplingRecord &dRec,
+        const Point2 &_sample) const {
+    if (EXPECT_NOT_TAKEN(m_surfaceArea < 0))
+        const_cast<TriMesh *>(this)->prepareSamplingTable();
+
+    Point2 sample(_sample);
+    size_t index = m_areaDistr.sampleReuse(sample.y);
+    const Triangle &tri = m_triangles[index];
+    const Point &p0 = m_positions[tri.idx[0]], &p1 = m_positions[tri.idx[1]],
+                &p2 = m_positions[tri.idx[2]];
+    Vector a = normalize(p0 - dRec.ref), b = normalize(p1 - dRec.ref),
+           c = normalize(p2 - dRec.ref);
+    Float solidAngle = sphericalTriangleArea(a, b, c);
+
+    dRec.measure = ESolidAngle;
+    if (!(solidAngle >= minSphericalTriangleArea && solidAngle <= maxSphericalTriangleArea)) {
+        /* Uniform sampling with respect to area */
+        Point2 bary = warp::squareToUniformTriangle(sample);
+        fillTrianglePosition(this, index, bary.x, bary.y, dRec);
+        dRec.d = dRec.p - dRec.ref;
+        Float distSquared = dRec.d.lengthSquared();
+        dRec.dist = std::sqrt(distSquared);
+        dRec.d /= dRec.dist;
+        Float dp = absDot(dRec.d, dRec.n);
+        dRec.pdf = dp != 0 ? m_invSurfaceArea * distSquared / dp : 0.0f;
+        return;
+    }
+
+    Vector w;
+    Vector ng = cross(p1 - p0, p2 - p0);
+    Float dn;
+    if (!sampleSphericalTriangle(a, b, c, sample, w) || (dn = dot(w, ng)) == 0) {
+        dRec.pdf = 0.0f;
+        return;
+    }
+
+    /* Intersect the sampled direction with the triangle */
+    Point p = dRec.ref + w * (dot(p0 - dRec.ref, ng) / dn);
+    Vector e1 = p1 - p0, e2 = p2 - p0, v = p - p0;
+    Float d00 = dot(e1, e1), d01 = dot(e1, e2), d11 = dot(e2, e2),
+          d20 = dot(v, e1), d21 = dot(v, e2);
+    Float det = d00 * d11 - d01 * d01;
+    Float b1 = std::max((Float) 0, (d11 * d20 - d01 * d21) / det),
+          b2 = std::max((Float) 0, (d00 * d21 - d01 * d20) / det);
+    if (b1 + b2 > 1) {
+        Float scale = 1 / (b1 + b2);
+        b1 *= scale; b2 *= scale;
+    }
+
+    fillTrianglePosition(this, index, b1, b2, dRec);
+    dRec.d = dRec.p - dRec.ref;
+    dRec.dist = dRec.d.length();
+    dRec.d /= dRec.dist;
+    dRec.pdf = m_areaDistr[index] / solidAngle;
+}
+
+Float TriMesh::pdfDirectSolidAngle(const DirectSamplingRecord &dRec) const {
+    if (dRec.primIndex >= m_triangleCount)
+        return Shape::pdfDirect(dRec);
+    if (EXPECT_NOT_TAKEN(m_surfaceArea < 0))
+        const_cast<TriMesh *>(this)->prepareSamplingTable();
+
+    const Triangle &tri = m_triangles[dRec.primIndex];
+    Vector a = normalize(m_positions[tri.idx[0]] - dRec.ref),
+           b = normalize(m_positions[tri.idx[1]] - dRec.ref),
+           c = normalize(m_positions[tri.idx[2]] - dRec.ref);
+    Float solidAngle = sphericalTriangleArea(a, b, c);
+
+    if (!(solidAngle >= minSphericalTriangleArea && solidAngle <= maxSphericalTriangleArea))
+        return Shape::pdfDirect(dRec);
+
+    Float pdf = m_areaDistr[dRec.primIndex] / solidAngle;
+    if (dRec.measure == ESolidAngle)
+        return pdf;
+    else if (dRec.measure == EArea)
+        return pdf * absDot(dRec.d, dRec.n) / (dRec.dist * dRec.dist);
+    else
+        return 0.0f;
 }
 
 struct Vertex {
@@ -471,6 +952,12 @@ void TriMesh::rebuildTopology(Float maxAngle) {
     const Float dpThresh = std::cos(degToRad(maxAngle));
     size_t degenerateTriangles = 0;
 
+    if (m_quantized)
+        Log(EError, "\"%s\": rebuildTopology() cannot be applied "
+            "to a quantized mesh!", m_name.c_str());
+
+    makeWritable();
+
     if (m_normals) {
         delete[] m_normals;
         m_normals = NULL;
@@ -481,6 +968,11 @@ void TriMesh::rebuildTopology(Float maxAngle) {
         m_tangents = NULL;
     }
 
+    if (m_vertexTangents) {
+        delete[] m_vertexTangents;
+        m_vertexTangents = NULL;
+    }
+
     Log(EInfo, "Rebuilding the topology of \"%s\" (" SIZE_T_FMT
             " triangles, " SIZE_T_FMT " vertices, max. angle = %f)",
             m_name.c_str(), m_triangleCount, m_vertexCount, maxAngle);
@@ -607,6 +1099,11 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 
 void TriMesh::computeNormals(bool force) {
     int invalidNormals = 0;
+
+    /* Memory-mapped arrays are read-only */
+    if (m_flipNormals || force || (m_faceNormals && m_normals))
+        makeWritable();
+
     if (m_faceNormals) {
         if (m_normals) {
             delete[] m_normals;
@@ -734,6 +1231,39 @@ void TriMesh::computeUVTangents() {
         }
     }
 
+    if (m_smoothTangents && !m_vertexTangents) {
+        /* Average the tangents of the adjacent triangles. Weighting by
+           their areas ensures that slivers don't have an excessive
+           influence on the result */
+        m_vertexTangents = new TangentSpace[m_vertexCount];
+        memset(m_vertexTangents, 0, sizeof(TangentSpace)*m_vertexCount);
+        Float *weights = new Float[m_vertexCount];
+        memset(weights, 0, sizeof(Float)*m_vertexCount);
+
+        for (size_t i=0; i<m_triangleCount; i++) {
+            const Triangle &tri = m_triangles[i];
+            const Point &v0 = m_positions[tri.idx[0]];
+            Float area = 0.5f * cross(m_positions[tri.idx[1]] - v0,
+                m_positions[tri.idx[2]] - v0).length();
+            for (int j=0; j<3; ++j) {
+                m_vertexTangents[tri.idx[j]].dpdu += m_tangents[i].dpdu * area;
+                m_vertexTangents[tri.idx[j]].dpdv += m_tangents[i].dpdv * area;
+                weights[tri.idx[j]] += area;
+            }
+        }
+
+        /* Normalize by the total area of the adjacent triangles,
+           which preserves the magnitude of the position partials */
+        for (size_t i=0; i<m_vertexCount; i++) {
+            if (weights[i] > 0) {
+                Float invWeight = 1.0f / weights[i];
+                m_vertexTangents[i].dpdu *= invWeight;
+                m_vertexTangents[i].dpdv *= invWeight;
+            }
+        }
+        delete[] weights;
+    }
+
     #if 0
         /* Don't be so noisy -- this isn't usually a problem.. */
         if (degenerate > 0)
@@ -744,7 +1274,7 @@ void TriMesh::computeUVTangents() {
 
 void TriMesh::getNormalDerivative(const Intersection &its,
         Vector &dndu, Vector &dndv, bool shadingFrame) const {
-    if (!shadingFrame || !m_normals) {
+    if (!shadingFrame || !hasVertexNormals()) {
         dndu = dndv = Vector(0.0f);
     } else {
         Assert(its.primIndex < m_triangleCount);
@@ -780,9 +1310,9 @@ void TriMesh::getNormalDerivative(const Intersection &its,
               w = 1 - u - v;
 
         const Normal
-            &n0 = m_normals[idx0],
-            &n1 = m_normals[idx1],
-            &n2 = m_normals[idx2];
+            n0 = getVertexNormal(idx0),
+            n1 = getVertexNormal(idx1),
+            n2 = getVertexNormal(idx2);
 
         /* Now compute the derivative of "normalize(u*n1 + v*n2 + (1-u-v)*n0)"
            with respect to [u, v] in the local triangle parameterization.
@@ -797,13 +1327,13 @@ void TriMesh::getNormalDerivative(const Intersection &its,
         dndu = (n1 - n0) * il; dndu -= N * dot(N, dndu);
         dndv = (n2 - n0) * il; dndv -= N * dot(N, dndv);
 
-        if (m_texcoords) {
+        if (hasVertexTexcoords()) {
             /* Compute derivatives with respect to a specified texture
                UV parameterization.  */
             const Point2
-                &uv0 = m_texcoords[idx0],
-                &uv1 = m_texcoords[idx1],
-                &uv2 = m_texcoords[idx2];
+                uv0 = getVertexTexcoord(idx0),
+                uv1 = getVertexTexcoord(idx1),
+                uv2 = getVertexTexcoord(idx2);
 
             Vector2 duv1 = uv1 - uv0, duv2 = uv2 - uv0;
 
@@ -829,35 +1359,63 @@ ref<TriMesh> TriMesh::createTriMesh() {
 void TriMesh::serialize(Stream *stream, InstanceManager *manager) const {
     Shape::serialize(stream, manager);
     uint32_t flags = 0;
-    if (m_normals)
+    if (hasVertexNormals())
         flags |= EHasNormals;
-    if (m_texcoords)
+    if (hasVertexTexcoords())
         flags |= EHasTexcoords;
-    if (m_colors)
+    if (hasVertexColors())
         flags |= EHasColors;
     if (m_faceNormals)
         flags |= EFaceNormals;
+    if (m_quantize)
+        flags |= EQuantize;
+    if (m_smoothTangents)
+        flags |= ESmoothTangents;
     stream->writeString(m_name);
     m_aabb.serialize(stream);
     stream->writeUInt(flags);
     stream->writeSize(m_vertexCount);
     stream->writeSize(m_triangleCount);
 
-    stream->writeFloatArray(reinterpret_cast<Float *>(m_positions),
-        m_vertexCount * sizeof(Point)/sizeof(Float));
-    if (m_normals)
-        stream->writeFloatArray(reinterpret_cast<Float *>(m_normals),
-            m_vertexCount * sizeof(Normal)/sizeof(Float));
-    if (m_texcoords)
-        stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords),
-            m_vertexCount * sizeof(Point2)/sizeof(Float));
-    if (m_colors)
-        stream->writeFloatArray(reinterpret_cast<Float *>(m_colors),
-            m_vertexCount * sizeof(Color3)/sizeof(Float));
+    serializeAttributes(stream);
     stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
         m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 }
 
+void TriMesh::serializeAttributes(Stream *stream) const {
+    stream->writeFloatArray(reinterpret_cast<Float *>(m_positions),
+        m_vertexCount * sizeof(Point)/sizeof(Float));
+
+    if (!m_quantized) {
+        if (m_normals)
+            stream->writeFloatArray(reinterpret_cast<Float *>(m_normals),
+                m_vertexCount * sizeof(Normal)/sizeof(Float));
+        if (m_texcoords)
+            stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords),
+                m_vertexCount * sizeof(Point2)/sizeof(Float));
+        if (m_colors)
+            stream->writeFloatArray(reinterpret_cast<Float *>(m_colors),
+                m_vertexCount * sizeof(Color3)/sizeof(Float));
+        return;
+    }
+
+    /* Decode quantized attributes one vertex at a time */
+    if (hasVertexNormals()) {
+        for (size_t i=0; i<m_vertexCount; ++i)
+            getVertexNormal(i).serialize(stream);
+    }
+    if (hasVertexTexcoords()) {
+        for (size_t i=0; i<m_vertexCount; ++i)
+            getVertexTexcoord(i).serialize(stream);
+    }
+    if (hasVertexColors()) {
+        for (size_t i=0; i<m_vertexCount; ++i) {
+            Color3 color = getVertexColor(i);
+            stream->writeFloatArray(&color[0], 3);
+        }
+    }
+}
+
 ref<TriMesh> TriMesh::fromBlender(const std::string &name,
         size_t faceCount, void *_facePtr, size_t vertexCount, void *_vertexPtr, void *_uvPtr, void *_colPtr, short mat_nr) {
     const int ME_SMOOTH = 1;
@@ -1015,20 +1573,22 @@ void TriMesh::writeOBJ(const fs::path &path) const {
             << m_positions[i].z << endl;
     }
 
-    if (m_texcoords) {
+    if (hasVertexTexcoords()) {
         for (size_t i=0; i<m_vertexCount; ++i) {
+            Point2 uv = getVertexTexcoord(i);
             os << "vt "
-                << m_texcoords[i].x << " "
-                << m_texcoords[i].y << endl;
+                << uv.x << " "
+                << uv.y << endl;
         }
     }
 
-    if (m_normals) {
+    if (hasVertexNormals()) {
         for (size_t i=0; i<m_vertexCount; ++i) {
+            Normal n = getVertexNormal(i);
             os << "vn "
-                << m_normals[i].x << " "
-                << m_normals[i].y << " "
-                << m_normals[i].z << endl;
+                << n.x << " "
+                << n.y << " "
+                << n.z << endl;
         }
     }
 
@@ -1037,11 +1597,11 @@ void TriMesh::writeOBJ(const fs::path &path) const {
                  i1 = m_triangles[i].idx[1] + 1,
                  i2 = m_triangles[i].idx[2] + 1;
 
-        if (m_normals && m_texcoords) {
+        if (hasVertexNormals() && hasVertexTexcoords()) {
             os << "f " << i0 << "/" << i0 << "/" << i0 << " "
                <<  i1 << "/" << i1 << "/" << i1 << " "
                <<  i2 << "/" << i2 << "/" << i2 << endl;
-        } else if (m_normals) {
+        } else if (hasVertexNormals()) {
             os << "f " << i0 << "//" << i0 << " "
                <<  i1 << "//" << i1 << " "
                <<  i2 << "//" << i2 << endl;
@@ -1069,20 +1629,20 @@ void TriMesh::writePLY(const fs::path &path) const {
     os << "property float y\n";
     os << "property float z\n";
 
-    if (m_normals) {
+    if (hasVertexNormals()) {
         os << "property float nx\n";
         os << "property float ny\n";
         os << "property float nz\n";
         storagePerVertex += 3 * sizeof(float);
     }
 
-    if (m_texcoords) {
+    if (hasVertexTexcoords()) {
         os << "property float u\n";
         os << "property float v\n";
         storagePerVertex += 2 * sizeof(float);
     }
 
-    if (m_colors) {
+    if (hasVertexColors()) {
         os << "property uchar red\n";
         os << "property uchar green\n";
         os << "property uchar blue\n";
@@ -1098,16 +1658,17 @@ void TriMesh::writePLY(const fs::path &path) const {
 
     for (size_t i=0; i< getVertexCount(); ++i) {
         Vector3f p(m_positions[i]); memcpy(ptr, &p, sizeof(Vector3f)); ptr += sizeof(Vector3f);
-        if (m_normals) {
-            Vector3f n(m_normals[i]); memcpy(ptr, &n, sizeof(Vector3f)); ptr += sizeof(Vector3f);
+        if (hasVertexNormals()) {
+            Vector3f n(getVertexNormal(i)); memcpy(ptr, &n, sizeof(Vector3f)); ptr += sizeof(Vector3f);
         }
-        if (m_texcoords) {
-            Vector2f uv(m_texcoords[i]); memcpy(ptr, &uv, sizeof(Vector2f)); ptr += sizeof(Vector2f);
+        if (hasVertexTexcoords()) {
+            Vector2f uv(getVertexTexcoord(i)); memcpy(ptr, &uv, sizeof(Vector2f)); ptr += sizeof(Vector2f);
         }
-        if (m_colors) {
-            *ptr += (uint8_t) std::max(0.0f, std::min(255.0f, (float) m_colors[i][0] * 255.0f + 0.5f));
-            *ptr += (uint8_t) std::max(0.0f, std::min(255.0f, (float) m_colors[i][1] * 255.0f + 0.5f));
-            *ptr += (uint8_t) std::max(0.0f, std::min(255.0f, (float) m_colors[i][2] * 255.0f + 0.5f));
+        if (hasVertexColors()) {
+            Color3 color = getVertexColor(i);
+            *ptr += (uint8_t) std::max(0.0f, std::min(255.0f, (float) color[0] * 255.0f + 0.5f));
+            *ptr += (uint8_t) std::max(0.0f, std::min(255.0f, (float) color[1] * 255.0f + 0.5f));
+            *ptr += (uint8_t) std::max(0.0f, std::min(255.0f, (float) color[2] * 255.0f + 0.5f));
         }
     }
     Assert((size_t) (ptr-vertexStorage) == vertexStorageSize);
@@ -1131,13 +1692,68 @@ void TriMesh::writePLY(const fs::path &path) const {
 void TriMesh::serialize(Stream *_stream) const {
     ref<Stream> stream = _stream;
 
+    if (stream->getByteOrder() != Stream::ELittleEndian)
+        Log(EError, "Tried to unserialize a shape from a stream, "
+            "which was not previously set to little endian byte order!");
+
+    size_t vertexSize = sizeof(Point);
+    if (hasVertexNormals())
+        vertexSize += sizeof(Normal);
+    if (hasVertexTexcoords())
+        vertexSize += sizeof(Point2);
+    if (hasVertexColors())
+        vertexSize += sizeof(Color3);
+    size_t dataSize = m_vertexCount * vertexSize + m_triangleCount * sizeof(Triangle);
+
+    /* Large meshes are compressed in independent blocks on several threads */
+    bool blocks = dataSize >= MTS_FILEFORMAT_BLOCK_THRESHOLD;
+    stream->writeShort(MTS_FILEFORMAT_HEADER);
+    stream->writeShort(blocks ? MTS_FILEFORMAT_VERSION_V6 : MTS_FILEFORMAT_VERSION_V4);
+
+    ref<MemoryStream> mstream;
+    if (blocks) {
+        mstream = new MemoryStream(dataSize + 256 + m_name.length());
+        mstream->setByteOrder(Stream::ELittleEndian);
+        stream = mstream;
+    } else {
+        stream = new ZStream(stream);
+    }
+
+#if defined(SINGLE_PRECISION)
+    uint32_t flags = ESinglePrecision;
+#else
+    uint32_t flags = EDoublePrecision;
+#endif
+
+    if (hasVertexNormals())
+        flags |= EHasNormals;
+    if (hasVertexTexcoords())
+        flags |= EHasTexcoords;
+    if (hasVertexColors())
+        flags |= EHasColors;
+    if (m_faceNormals)
+        flags |= EFaceNormals;
+
+    stream->writeUInt(flags);
+    stream->writeString(m_name);
+    stream->writeSize(m_vertexCount);
+    stream->writeSize(m_triangleCount);
+
+    serializeAttributes(stream);
+    stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
+        m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+
+    if (blocks)
+        ZStream::writeBlocks(_stream, mstream->getData(), mstream->getSize());
+}
+
+void TriMesh::serializeUncompressed(Stream *stream) const {
     if (stream->getByteOrder() != Stream::ELittleEndian)
         Log(EError, "Tried to unserialize a shape from a stream, "
             "which was not previously set to little endian byte order!");
 
     stream->writeShort(MTS_FILEFORMAT_HEADER);
-    stream->writeShort(MTS_FILEFORMAT_VERSION_V4);
-    stream = new ZStream(stream);
+    stream->writeShort(MTS_FILEFORMAT_VERSION_V5);
 
 #if defined(SINGLE_PRECISION)
     uint32_t flags = ESinglePrecision;
@@ -1145,11 +1761,11 @@ void TriMesh::serialize(Stream *_stream) const {
     uint32_t flags = EDoublePrecision;
 #endif
 
-    if (m_normals)
+    if (hasVertexNormals())
         flags |= EHasNormals;
-    if (m_texcoords)
+    if (hasVertexTexcoords())
         flags |= EHasTexcoords;
-    if (m_colors)
+    if (hasVertexColors())
         flags |= EHasColors;
     if (m_faceNormals)
         flags |= EFaceNormals;
@@ -1159,17 +1775,30 @@ void TriMesh::serialize(Stream *_stream) const {
     stream->writeSize(m_vertexCount);
     stream->writeSize(m_triangleCount);
 
+    /* Same order as serializeAttributes(), but each array is aligned */
+    writePadding(stream, MTS_FILEFORMAT_PAGE_SIZE);
     stream->writeFloatArray(reinterpret_cast<Float *>(m_positions),
         m_vertexCount * sizeof(Point)/sizeof(Float));
-    if (m_normals)
-        stream->writeFloatArray(reinterpret_cast<Float *>(m_normals),
-            m_vertexCount * sizeof(Normal)/sizeof(Float));
-    if (m_texcoords)
-        stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords),
-            m_vertexCount * sizeof(Point2)/sizeof(Float));
-    if (m_colors)
-        stream->writeFloatArray(reinterpret_cast<Float *>(m_colors),
-            m_vertexCount * sizeof(Color3)/sizeof(Float));
+
+    if (hasVertexNormals()) {
+        writePadding(stream, MTS_FILEFORMAT_ALIGNMENT);
+        for (size_t i=0; i<m_vertexCount; ++i)
+            getVertexNormal(i).serialize(stream);
+    }
+    if (hasVertexTexcoords()) {
+        writePadding(stream, MTS_FILEFORMAT_ALIGNMENT);
+        for (size_t i=0; i<m_vertexCount; ++i)
+            getVertexTexcoord(i).serialize(stream);
+    }
+    if (hasVertexColors()) {
+        writePadding(stream, MTS_FILEFORMAT_ALIGNMENT);
+        for (size_t i=0; i<m_vertexCount; ++i) {
+            Color3 color = getVertexColor(i);
+            stream->writeFloatArray(&color[0], 3);
+        }
+    }
+
+    writePadding(stream, MTS_FILEFORMAT_ALIGNMENT);
     stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
         m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 }
@@ -1189,10 +1818,12 @@ std::string TriMesh::toString() const {
         << "  triangleCount = " << m_triangleCount << "," << endl
         << "  vertexCount = " << m_vertexCount << "," << endl
         << "  faceNormals = " << (m_faceNormals ? "true" : "false") << "," << endl
-        << "  hasNormals = " << (m_normals ? "true" : "false") << "," << endl
-        << "  hasTexcoords = " << (m_texcoords ? "true" : "false") << "," << endl
+        << "  hasNormals = " << (hasVertexNormals() ? "true" : "false") << "," << endl
+        << "  hasTexcoords = " << (hasVertexTexcoords() ? "true" : "false") << "," << endl
         << "  hasTangents = " << (m_tangents ? "true" : "false") << "," << endl
-        << "  hasColors = " << (m_colors ? "true" : "false") << "," << endl
+        << "  smoothTangents = " << (m_vertexTangents ? "true" : "false") << "," << endl
+        << "  hasColors = " << (hasVertexColors() ? "true" : "false") << "," << endl
+        << "  quantized = " << (m_quantized ? "true" : "false") << "," << endl
         << "  surfaceArea = " << m_surfaceArea << "," << endl
         << "  aabb = " << m_aabb.toString() << "," << endl
         << "  bsdf = " << indent(m_bsdf.toString()) << "," << endl;
@@ -44,6 +44,12 @@ Float VolumeDataSource::lookupFloat(const Point &p) const {
     return 0;
 }
 
+void VolumeDataSource::lookupFloatBatch(const Point &p, const Vector &step,
+        size_t count, Float *result) const {
+    for (size_t i=0; i<count; ++i)
+        result[i] = lookupFloat(p + step * (Float) i);
+}
+
 Spectrum VolumeDataSource::lookupSpectrum(const Point &p) const {
     Log(EError, "'%s': does not implement lookupSpectrum()!", getClass()->getName().c_str());
     return Spectrum(0.0f);
@@ -54,6 +60,10 @@ Vector VolumeDataSource::lookupVector(const Point &p) const {
     return Vector();
 }
 
+Float VolumeDataSource::getLocalMaximumFloatValue(const AABB &aabb) const {
+    return getMaximumFloatValue();
+}
+
 bool VolumeDataSource::supportsFloatLookups() const {
     return false;
 }
@@ -30,6 +30,18 @@ MTS_NAMESPACE_BEGIN
  */
 #define HETVOL_EARLY_EXIT 1
 
+/// Upper limit on the resolution of the majorant grid along each axis
+#define HETVOL_MAX_MAJORANT_RES 256
+
+/// Number of density lookups that are batched during Simpson quadrature
+#define HETVOL_LOOKUP_BATCH 64
+
+/// Number of lookups per axis used to estimate the control density of a majorant cell
+#define HETVOL_CONTROL_SAMPLES 2
+
+/// Ratio tracking applies Russian roulette below this transmittance
+#define HETVOL_RR_THRESHOLD 0.1f
+
 /// Generate a few statistics related to the implementation?
 // #define HETVOL_STATISTICS 1
 
@@ -44,6 +56,13 @@ static StatsCounter earlyExits("Heterogeneous volume",
         "Number of early exits", EPercentage);
 #endif
 
+static StatsCounter avgNullCollisions("Heterogeneous volume",
+        "Avg. # of null collisions (Woodcock tracking)", EAverage);
+static StatsCounter emptyCellsSkipped("Heterogeneous volume",
+        "Empty majorant grid cells skipped");
+static StatsCounter avgRatioTrackingLookups("Heterogeneous volume",
+        "Avg. # of density lookups (ratio tracking)", EAverage);
+
 /*!\plugin{heterogeneous}{Heterogeneous participating medium}
  * \order{2}
  * \parameters{
@@ -61,6 +80,20 @@ static StatsCounter earlyExits("Heterogeneous volume",
  *             from good sample generators and not providing
  *             information that is required by bidirectional
  *             rendering techniques.
+ *             \item \code{ratio}: Sample scattering events using
+ *             Woodcock tracking, but estimate transmittances (e.g. of
+ *             shadow rays) using ratio tracking \cite{Novak2014Residual}.
+ *             Instead of the binary estimate of Woodcock tracking, every
+ *             tentative collision multiplies the transmittance by the
+ *             probability of it being a null collision, which greatly
+ *             reduces the variance of direct illumination.
+ *             \item \code{residual}: Like \code{ratio}, but uses residual
+ *             ratio tracking for transmittances: an estimate of the mean
+ *             density within each cell of the majorant grid serves as a
+ *             control density, whose transmittance is computed analytically.
+ *             Ratio tracking then only handles the (much smaller) residual,
+ *             which reduces both the variance and the number of lookups
+ *             in smoothly varying media.
  *         \end{enumerate}
  *         Default: \texttt{woodcock}
  *     }
@@ -81,6 +114,15 @@ static StatsCounter earlyExits("Heterogeneous volume",
  *         Provided for convenience when accomodating data based on different units,
  *         or to simply tweak the density of the medium. \default{1}
  *     }
+ *     \parameter{majorantResolution}{\Integer}{
+ *         Resolution (along each axis) of a coarse grid that stores
+ *         upper bounds of the density within its cells. Woodcock tracking
+ *         uses these local bounds instead of a single global one and
+ *         skips empty cells entirely, which greatly reduces the number of
+ *         null collisions in media containing a few dense regions surrounded
+ *         by (nearly) empty space. Set to \code{1} to use a single bound.
+ *         \default{16}
+ *     }
  *     \parameter{\Unnamed}{\Phase}{
  *          A nested phase function that describes the directional
  *          scattering properties of the medium. When none is specified,
@@ -177,13 +219,29 @@ public:
          * incompatible with bidirectional rendering methods, which
          * usually need to know the probability of a sample.
          */
-        EWoodcockTracking
+        EWoodcockTracking,
+
+        /**
+         * \brief Use Woodcock tracking to sample scattering locations
+         * and ratio tracking to estimate transmittances
+         */
+        ERatioTracking,
+
+        /**
+         * \brief Use Woodcock tracking to sample scattering locations
+         * and residual ratio tracking to estimate transmittances
+         */
+        EResidualRatioTracking
     };
 
     HeterogeneousMedium(const Properties &props)
         : Medium(props) {
         m_stepSize = props.getFloat("stepSize", 0);
         m_scale = props.getFloat("scale", 1);
+        m_majorantRes = props.getInteger("majorantResolution", 16);
+        if (m_majorantRes < 1 || m_majorantRes > HETVOL_MAX_MAJORANT_RES)
+            Log(EError, "The 'majorantResolution' parameter must be between 1 and %i!",
+                HETVOL_MAX_MAJORANT_RES);
         if (props.hasProperty("sigmaS") || props.hasProperty("sigmaA"))
             Log(EError, "The 'sigmaS' and 'sigmaA' properties are only supported by "
                 "homogeneous media. Please use nested volume instances to supply "
@@ -197,6 +255,10 @@ public:
             m_method = EWoodcockTracking;
         else if (method == "simpson")
             m_method = ESimpsonQuadrature;
+        else if (method == "ratio")
+            m_method = ERatioTracking;
+        else if (method == "residual")
+            m_method = EResidualRatioTracking;
         else
             Log(EError, "Unsupported integration method \"%s\"!", method.c_str());
     }
@@ -210,6 +272,7 @@ public:
         m_albedo = static_cast<VolumeDataSource *>(manager->getInstance(stream));
         m_orientation = static_cast<VolumeDataSource *>(manager->getInstance(stream));
         m_stepSize = stream->readFloat();
+        m_majorantRes = stream->readInt();
         configure();
     }
 
@@ -222,6 +285,7 @@ public:
         manager->serialize(stream, m_albedo.get());
         manager->serialize(stream, m_orientation.get());
         stream->writeFloat(m_stepSize);
+        stream->writeInt(m_majorantRes);
     }
 
     void configure() {
@@ -241,6 +305,9 @@ public:
             m_maxDensity *= m_phaseFunction->sigmaDirMax();
         m_invMaxDensity = 1.0f/m_maxDensity;
 
+        if (m_method != ESimpsonQuadrature)
+            buildMajorantGrid();
+
         if (m_stepSize == 0) {
             m_stepSize = std::min(
                 m_density->getStepSize(), m_albedo->getStepSize());
@@ -280,6 +347,272 @@ public:
         }
     }
 
+    /**
+     * \brief Compute an upper bound of the (scaled) density within each
+     * cell of a coarse grid covering the density volume
+     */
+    void buildMajorantGrid() {
+        Vector extents = m_densityAABB.getExtents();
+        for (int i=0; i<3; ++i) {
+            /* Don't subdivide flat or degenerate dimensions */
+            m_majorantGridRes[i] = extents[i] > 0 ? m_majorantRes : 1;
+            m_majorantCellSize[i] = extents[i] / m_majorantGridRes[i];
+        }
+
+        size_t cellCount = (size_t) m_majorantGridRes.x
+            * (size_t) m_majorantGridRes.y * (size_t) m_majorantGridRes.z;
+        m_invMajorants.resize(cellCount);
+
+        Float scale = m_scale;
+        if (m_anisotropicMedium)
+            scale *= m_phaseFunction->sigmaDirMax();
+
+        size_t emptyCells = 0, idx = 0;
+        for (int z=0; z<m_majorantGridRes.z; ++z) {
+            for (int y=0; y<m_majorantGridRes.y; ++y) {
+                for (int x=0; x<m_majorantGridRes.x; ++x) {
+                    Point min = m_densityAABB.min + Vector(
+                        x * m_majorantCellSize.x,
+                        y * m_majorantCellSize.y,
+                        z * m_majorantCellSize.z);
+                    AABB cell(min, min + m_majorantCellSize);
+                    Float majorant = std::min(m_maxDensity,
+                        scale * m_density->getLocalMaximumFloatValue(cell));
+                    /* Store the reciprocal (infinity denotes an empty cell) */
+                    m_invMajorants[idx++] = majorant > 0 ? 1.0f / majorant
+                        : std::numeric_limits<Float>::infinity();
+                    if (majorant <= 0)
+                        ++emptyCells;
+                }
+            }
+        }
+
+        if (m_method == EResidualRatioTracking)
+            buildControlDensities();
+
+        Log(EDebug, "Built a %ix%ix%i majorant grid (%.1f%% of the cells are empty)",
+            m_majorantGridRes.x, m_majorantGridRes.y, m_majorantGridRes.z,
+            100.0f * emptyCells / (Float) cellCount);
+    }
+
+    /**
+     * \brief Compute the control densities used by residual ratio tracking
+     *
+     * The control density of a cell is an estimate of its mean density
+     * (from a few stratified lookups). Since densities within the cell lie
+     * between zero and the majorant, the residual is bounded by the larger
+     * of the control and the difference between majorant and control.
+     */
+    void buildControlDensities() {
+        size_t cellCount = m_invMajorants.size(), idx = 0;
+        m_controlDensities.resize(cellCount);
+        m_invResidualMajorants.resize(cellCount);
+        const int n = HETVOL_CONTROL_SAMPLES;
+
+        for (int z=0; z<m_majorantGridRes.z; ++z) {
+            for (int y=0; y<m_majorantGridRes.y; ++y) {
+                for (int x=0; x<m_majorantGridRes.x; ++x, ++idx) {
+                    Float invMajorant = m_invMajorants[idx];
+                    if (invMajorant == std::numeric_limits<Float>::infinity()) {
+                        m_controlDensities[idx] = 0.0f;
+                        m_invResidualMajorants[idx] = invMajorant;
+                        continue;
+                    }
+
+                    Float majorant = 1.0f / invMajorant, mean = 0.0f;
+                    for (int i=0; i<n*n*n; ++i) {
+                        Point p = m_densityAABB.min + Vector(
+                            (x + ((i % n) + 0.5f) / n) * m_majorantCellSize.x,
+                            (y + (((i / n) % n) + 0.5f) / n) * m_majorantCellSize.y,
+                            (z + ((i / (n*n)) + 0.5f) / n) * m_majorantCellSize.z);
+                        mean += m_density->lookupFloat(p);
+                    }
+                    Float control = std::min(majorant,
+                        mean * m_scale / (Float) (n*n*n));
+                    if (m_anisotropicMedium)
+                        control = 0.0f; /* Directional factors are unknown */
+
+                    Float bound = std::max(control, majorant - control);
+                    m_controlDensities[idx] = control;
+                    m_invResidualMajorants[idx] = bound > 0 ? 1.0f / bound
+                        : std::numeric_limits<Float>::infinity();
+                }
+            }
+        }
+    }
+
+    /**
+     * \brief Iterates over the cells of the majorant grid that are
+     * traversed by a ray segment (using a 3D-DDA)
+     */
+    struct MajorantTraversal {
+        MajorantTraversal(const HeterogeneousMedium *medium, const Ray &ray,
+                Float mint, Float maxt) : m(medium), maxt(maxt), tCell(mint), done(false) {
+            /* Locate the cell containing the start of the segment */
+            Point p = ray(mint);
+            for (int i=0; i<3; ++i) {
+                idx[i] = m->m_majorantCellSize[i] > 0 ? math::floorToInt(
+                    (p[i] - m->m_densityAABB.min[i]) / m->m_majorantCellSize[i]) : 0;
+                idx[i] = std::max(0, std::min(idx[i], m->m_majorantGridRes[i] - 1));
+
+                if (ray.d[i] > 0) {
+                    step[i] = 1; limit[i] = m->m_majorantGridRes[i];
+                    tNext[i] = (m->m_densityAABB.min[i] + (idx[i] + 1)
+                        * m->m_majorantCellSize[i] - ray.o[i]) * ray.dRcp[i];
+                    tDelta[i] = m->m_majorantCellSize[i] * ray.dRcp[i];
+                } else if (ray.d[i] < 0) {
+                    step[i] = -1; limit[i] = -1;
+                    tNext[i] = (m->m_densityAABB.min[i] + idx[i]
+                        * m->m_majorantCellSize[i] - ray.o[i]) * ray.dRcp[i];
+                    tDelta[i] = -m->m_majorantCellSize[i] * ray.dRcp[i];
+                } else {
+                    step[i] = 0; limit[i] = -1;
+                    tNext[i] = tDelta[i] = std::numeric_limits<Float>::infinity();
+                }
+            }
+        }
+
+        /**
+         * \brief Return the next cell as the interval [t0, t1) and
+         * its index within the majorant grid
+         *
+         * \return \c false when the end of the segment was reached
+         */
+        inline bool next(Float &t0, Float &t1, size_t &cell) {
+            if (done)
+                return false;
+            int axis = (tNext[0] < tNext[1])
+                ? (tNext[0] < tNext[2] ? 0 : 2)
+                : (tNext[1] < tNext[2] ? 1 : 2);
+            t0 = tCell;
+            t1 = std::min(tNext[axis], maxt);
+            cell = ((size_t) idx[2] * m->m_majorantGridRes.y
+                + idx[1]) * m->m_majorantGridRes.x + idx[0];
+
+            /* Advance to the next cell */
+            tCell = t1;
+            idx[axis] += step[axis];
+            tNext[axis] += tDelta[axis];
+            if (t1 >= maxt || idx[axis] == limit[axis])
+                done = true;
+            return true;
+        }
+
+        const HeterogeneousMedium *m;
+        int idx[3], step[3], limit[3];
+        Float tNext[3], tDelta[3];
+        Float maxt, tCell;
+        bool done;
+    };
+
+    /**
+     * \brief Find the next real collision along a ray segment using
+     * Woodcock tracking with the local majorants of the cells traversed
+     * by the ray. Empty cells are skipped without generating any samples.
+     *
+     * \return \c true if a collision was found before \c maxt. In this
+     * case, its distance and the density at that point are returned
+     * via \c t and \c density.
+     */
+    bool trackCollision(const Ray &ray, Float mint, Float maxt,
+            Sampler *sampler, Float &t, Float &density) const {
+        MajorantTraversal traversal(this, ray, mint, maxt);
+        size_t nullCollisions = 0, emptyCells = 0, cell;
+        bool success = false;
+        Float t0, t1;
+
+        while (!success && traversal.next(t0, t1, cell)) {
+            const Float invMajorant = m_invMajorants[cell];
+            if (invMajorant == std::numeric_limits<Float>::infinity()) {
+                ++emptyCells;
+                continue;
+            }
+
+            /* Delta tracking within the current cell. Due to the
+               memorylessness of the exponential distribution, the
+               free path can simply be re-sampled at the cell boundary */
+            Float tt = t0;
+            while (true) {
+                tt -= math::fastlog(1-sampler->next1D()) * invMajorant;
+                if (tt >= t1)
+                    break;
+
+                Float value = lookupDensity(ray(tt), ray.d) * m_scale;
+                if (value * invMajorant > sampler->next1D()) {
+                    t = tt;
+                    density = value;
+                    success = true;
+                    break;
+                }
+                ++nullCollisions;
+            }
+        }
+
+        avgNullCollisions.incrementBase();
+        avgNullCollisions += nullCollisions;
+        if (emptyCells > 0)
+            emptyCellsSkipped += emptyCells;
+
+        return success;
+    }
+
+    /**
+     * \brief Estimate the transmittance along a ray segment using
+     * (residual) ratio tracking with the local majorants.
+     *
+     * Tentative collisions are generated with the rate of the majorant
+     * and scale the estimate by the probability of a null collision.
+     * In residual mode, each cell's control density is accounted for
+     * analytically, and the tracking only handles the residual density
+     * (whose magnitude is bounded by a correspondingly smaller majorant).
+     */
+    Float ratioTracking(const Ray &ray, Float mint, Float maxt,
+            Sampler *sampler, bool residual) const {
+        MajorantTraversal traversal(this, ray, mint, maxt);
+        Float transmittance = 1.0f, controlDepth = 0.0f, t0, t1;
+        size_t lookups = 0, cell;
+
+        while (traversal.next(t0, t1, cell)) {
+            Float invBound = m_invMajorants[cell], control = 0.0f;
+            if (invBound == std::numeric_limits<Float>::infinity())
+                continue;
+
+            if (residual) {
+                control = m_controlDensities[cell];
+                invBound = m_invResidualMajorants[cell];
+                controlDepth += control * (t1 - t0);
+                if (invBound == std::numeric_limits<Float>::infinity())
+                    continue;
+            }
+
+            Float tt = t0;
+            while (true) {
+                tt -= math::fastlog(1-sampler->next1D()) * invBound;
+                if (tt >= t1)
+                    break;
+
+                Float value = lookupDensity(ray(tt), ray.d) * m_scale;
+                transmittance *= 1.0f - (value - control) * invBound;
+                ++lookups;
+            }
+
+            /* Russian roulette for segments with a very low transmittance */
+            if (transmittance < HETVOL_RR_THRESHOLD) {
+                if (transmittance <= 0 || sampler->next1D() >= 0.5f) {
+                    transmittance = 0.0f;
+                    break;
+                }
+                transmittance *= 2.0f;
+            }
+        }
+
+        avgRatioTrackingLookups.incrementBase();
+        avgRatioTrackingLookups += lookups;
+
+        return transmittance == 0 ? 0.0f
+            : transmittance * math::fastexp(-controlDepth);
+    }
+
     /*
      * This function uses Simpson quadrature to compute following
      * integral:
@@ -329,16 +662,55 @@ public:
             earlyExits.incrementBase();
         #endif
 
-        /* Perform lookups at the first and last node */
-        Float integratedDensity = lookupDensity(p, ray.d)
-            + lookupDensity(pLast, ray.d);
-
         #if defined(HETVOL_EARLY_EXIT)
             const Float stopAfterDensity = -math::fastlog(Epsilon);
             const Float stopValue = stopAfterDensity*3.0f/(stepSize
                     * m_scale);
         #endif
 
+        if (!m_anisotropicMedium) {
+            /* Isotropic case: fetch the densities at all nodes through
+               the batched interface. This is done in chunks so that
+               the early exit test still gets a chance to run. */
+            Float values[HETVOL_LOOKUP_BATCH];
+            Float integratedDensity = 0.0f;
+
+            for (uint32_t i=0; i<=nSteps; i += HETVOL_LOOKUP_BATCH) {
+                uint32_t count = std::min(nSteps + 1 - i,
+                    (uint32_t) HETVOL_LOOKUP_BATCH);
+                m_density->lookupFloatBatch(ray(mint + i * stepSize),
+                    increment, count, values);
+
+                for (uint32_t j=0; j<count; ++j) {
+                    uint32_t k = i + j;
+                    Float weight = (k == 0 || k == nSteps) ? 1.0f
+                        : ((k & 1) ? 4.0f : 2.0f);
+                    integratedDensity += weight * values[j];
+                }
+
+                #if defined(HETVOL_STATISTICS)
+                    avgRayMarchingStepsTransmittance += count;
+                #endif
+
+                #if defined(HETVOL_EARLY_EXIT)
+                    if (integratedDensity > stopValue) {
+                        // Reached the threshold -- stop early
+                        #if defined(HETVOL_STATISTICS)
+                            ++earlyExits;
+                        #endif
+                        return std::numeric_limits<Float>::infinity();
+                    }
+                #endif
+            }
+
+            return integratedDensity * m_scale
+                * stepSize * (1.0f / 3.0f);
+        }
+
+        /* Perform lookups at the first and last node */
+        Float integratedDensity = lookupDensity(p, ray.d)
+            + lookupDensity(pLast, ray.d);
+
         p += increment;
 
         Float m = 4;
@@ -556,31 +928,17 @@ public:
             mint = std::max(mint, ray.mint);
             maxt = std::min(maxt, ray.maxt);
 
-            #if defined(HETVOL_STATISTICS)
-                avgRayMarchingStepsTransmittance.incrementBase();
-            #endif
+            if (m_method == ERatioTracking || m_method == EResidualRatioTracking)
+                return Spectrum(ratioTracking(ray, mint, maxt, sampler,
+                    m_method == EResidualRatioTracking));
+
             int nSamples = 2; /// XXX make configurable
             Float result = 0;
 
             for (int i=0; i<nSamples; ++i) {
-                Float t = mint;
-                while (true) {
-                    t -= math::fastlog(1-sampler->next1D()) * m_invMaxDensity;
-                    if (t >= maxt) {
-                        result += 1;
-                        break;
-                    }
-
-                    Point p = ray(t);
-                    Float density = lookupDensity(p, ray.d) * m_scale;
-
-                    #if defined(HETVOL_STATISTICS)
-                        ++avgRayMarchingStepsTransmittance;
-                    #endif
-
-                    if (density * m_invMaxDensity > sampler->next1D())
-                        break;
-                }
+                Float t, density;
+                if (!trackCollision(ray, mint, maxt, sampler, t, density))
+                    result += 1;
             }
             return Spectrum(result/nSamples);
         }
@@ -619,42 +977,27 @@ public:
             mRec.transmittance = Spectrum(1.0f);
             mRec.time = ray.time;
 
-            #if defined(HETVOL_STATISTICS)
-                avgRayMarchingStepsSampling.incrementBase();
-            #endif
-
             Float mint, maxt;
             if (!m_densityAABB.rayIntersect(ray, mint, maxt))
                 return false;
             mint = std::max(mint, ray.mint);
             maxt = std::min(maxt, ray.maxt);
 
-            Float t = mint, densityAtT = 0;
-            while (true) {
-                t -= math::fastlog(1-sampler->next1D()) * m_invMaxDensity;
-                if (t >= maxt)
-                    break;
-
+            Float t, densityAtT = 0;
+            if (trackCollision(ray, mint, maxt, sampler, t, densityAtT)) {
                 Point p = ray(t);
-                densityAtT = lookupDensity(p, ray.d) * m_scale;
-                #if defined(HETVOL_STATISTICS)
-                    ++avgRayMarchingStepsSampling;
-                #endif
-                if (densityAtT * m_invMaxDensity > sampler->next1D()) {
-                    mRec.t = t;
-                    mRec.p = p;
-                    Spectrum albedo = m_albedo->lookupSpectrum(p);
-                    mRec.sigmaS = albedo * densityAtT;
-                    mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
-                    mRec.transmittance = Spectrum(densityAtT != 0.0f ? 1.0f / densityAtT : 0);
-                    if (!std::isfinite(mRec.transmittance[0])) // prevent rare overflow warnings
-                        mRec.transmittance = Spectrum(0.0f);
-                    mRec.orientation = m_orientation != NULL
-                        ? m_orientation->lookupVector(p) : Vector(0.0f);
-                    mRec.medium = this;
-                    success = true;
-                    break;
-                }
+                mRec.t = t;
+                mRec.p = p;
+                Spectrum albedo = m_albedo->lookupSpectrum(p);
+                mRec.sigmaS = albedo * densityAtT;
+                mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
+                mRec.transmittance = Spectrum(densityAtT != 0.0f ? 1.0f / densityAtT : 0);
+                if (!std::isfinite(mRec.transmittance[0])) // prevent rare overflow warnings
+                    mRec.transmittance = Spectrum(0.0f);
+                mRec.orientation = m_orientation != NULL
+                    ? m_orientation->lookupVector(p) : Vector(0.0f);
+                mRec.medium = this;
+                success = true;
             }
         }
         mRec.medium = this;
@@ -701,6 +1044,7 @@ public:
             << "  albedo = " << indent(m_albedo.toString()) << "," << endl
             << "  orientation = " << indent(m_orientation.toString()) << "," << endl
             << "  stepSize = " << m_stepSize << "," << endl
+            << "  majorantResolution = " << m_majorantRes << "," << endl
             << "  scale = " << m_scale << endl
             << "]";
         return oss.str();
@@ -730,6 +1074,12 @@ protected:
     AABB m_densityAABB;
     Float m_maxDensity;
     Float m_invMaxDensity;
+    int m_majorantRes;
+    Vector3i m_majorantGridRes;
+    Vector m_majorantCellSize;
+    std::vector<Float> m_invMajorants;
+    std::vector<Float> m_controlDensities;
+    std::vector<Float> m_invResidualMajorants;
 };
 
 MTS_IMPLEMENT_CLASS_S(HeterogeneousMedium, false, Medium)
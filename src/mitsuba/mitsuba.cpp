@@ -33,7 +33,9 @@
 #include <mitsuba/core/shvector.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/render/renderjob.h>
+#include <mitsuba/render/rendermonitor.h>
 #include <mitsuba/render/scenehandler.h>
+#include <mitsuba/render/tilecache.h>
 #include <fstream>
 #include <stdexcept>
 #include <boost/algorithm/string.hpp>
@@ -71,18 +73,45 @@ void help() {
     cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
     cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
     cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+    cout <<  "   -R fanout   Broadcast mode: only connect to 'fanout' of the servers given" << endl;
+    cout <<  "               by -c and -s, which relay the scene data and work to the others" << endl;
+    cout <<  "               along a tree. Requires direct connections (no SSH)" << endl << endl;
     cout <<  "   -j count    Simultaneously schedule several scenes. Can sometimes accelerate" << endl;
     cout <<  "               rendering when large amounts of processing power are available" << endl;
     cout <<  "               (e.g. when running Mitsuba on a cluster. Default: 1)" << endl << endl;
     cout <<  "   -n name     Assign a node name to this instance (Default: host name)" << endl << endl;
     cout <<  "   -x          Skip rendering of files where output already exists" << endl << endl;
-    cout <<  "   -r sec      Write (partial) output images every 'sec' seconds" << endl << endl;
+    cout <<  "   -S file     Sequence mode: render one frame per line of 'file', which" << endl;
+    cout <<  "               lists the parameters of the frame (key=val, separated by" << endl;
+    cout <<  "               spaces) on top of the -D ones. Objects that don't change" << endl;
+    cout <<  "               between frames (e.g. meshes, textures and the kd-tree) are" << endl;
+    cout <<  "               only loaded and built once. Frame i is written to" << endl;
+    cout <<  "               \"<name>_<i>\". Only one frame is rendered at a time" << endl << endl;
+    cout <<  "   -r sec      Write (partial) output images every 'sec' seconds. Integrators" << endl;
+    cout <<  "               that support it (e.g. sppm) also write a checkpoint, from which" << endl;
+    cout <<  "               a subsequent run using -r resumes an interrupted rendering" << endl << endl;
     cout <<  "   -b res      Specify the block resolution used to split images into parallel" << endl;
     cout <<  "               workloads (default: 32). Only applies to some integrators." << endl << endl;
+    cout <<  "   -H          Hand out the blocks along a Hilbert curve instead of a spiral," << endl;
+    cout <<  "               which improves the cache locality of every worker" << endl << endl;
+    cout <<  "   -N          NUMA mode: distribute worker threads evenly over the NUMA nodes" << endl;
+    cout <<  "               and interleave large scene data structures across them" << endl << endl;
+    cout <<  "   -k count    Work stealing: let every local worker prefetch up to 'count'" << endl;
+    cout <<  "               work units at a time (default: 1, i.e. disabled). Reduces" << endl;
+    cout <<  "               scheduling overhead for small blocks on many-core machines" << endl << endl;
+    cout <<  "   -M size     Memory budget for the tracked scene data structures (e.g." << endl;
+    cout <<  "               512M or 8G). Loading fails once the budget is exceeded" << endl << endl;
     cout <<  "   -v          Be more verbose (can be specified twice)" << endl << endl;
     cout <<  "   -L level    Explicitly specify the log level (trace/debug/info/warn/error)" << endl << endl;
     cout <<  "   -w          Treat warnings as errors" << endl << endl;
     cout <<  "   -z          Disable progress bars" << endl << endl;
+    cout <<  "   -P file     Write the time spent loading, building, preprocessing and" << endl;
+    cout <<  "               rendering (a nested list of phases) as JSON to 'file'" << endl << endl;
+    cout <<  "   -J file     Write all statistics (counters, timings, work units per" << endl;
+    cout <<  "               machine and peak memory usage) as JSON to 'file'" << endl << endl;
+    cout <<  "   -m file     Append live progress metrics (finished blocks, samples/s," << endl;
+    cout <<  "               ETA, utilization per machine, queue depth and memory usage)" << endl;
+    cout <<  "               to 'file' every second, one JSON object per line" << endl << endl;
     cout <<  " For documentation, please refer to http://www.mitsuba-renderer.org/docs.html" << endl;
 }
 
@@ -135,14 +164,21 @@ int mitsuba_app(int argc, char **argv) {
         int nprocs_avail = getCoreCount(), nprocs = nprocs_avail;
         int numParallelScenes = 1;
         std::string nodeName = getHostName(),
-                    networkHosts = "", destFile="";
+                    networkHosts = "", destFile="", timingFile="", statsFile="", monitorFile="",
+                    sequenceFile="";
         bool quietMode = false, progressBars = true, skipExisting = false;
         ELogLevel logLevel = EInfo;
         ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
+        /* Remember resolved paths (changing the search path clears them) */
+        fileResolver->setCaching(true);
         bool treatWarningsAsErrors = false;
         std::map<std::string, std::string, SimpleStringOrdering> parameters;
         int blockSize = 32;
+        bool hilbertOrder = false;
         int flushTimer = -1;
+        int localBatchSize = 1;
+        bool numaMode = false;
+        int relayFanout = 0;
 
         if (argc < 2) {
             help();
@@ -151,7 +187,7 @@ int mitsuba_app(int argc, char **argv) {
 
         optind = 1;
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:p:L:qhzvtwx")) != -1) {
+        while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:k:p:L:R:P:J:M:m:S:qhzvtwxNH")) != -1) {
             switch (optchar) {
                 case 'a': {
                         std::vector<std::string> paths = tokenize(optarg, ";");
@@ -230,6 +266,14 @@ int mitsuba_app(int argc, char **argv) {
                     if (*end_ptr != '\0')
                         SLog(EError, "Could not parse the '-r' parameter argument!");
                     break;
+                case 'H':
+                    hilbertOrder = true;
+                    break;
+                case 'R':
+                    relayFanout = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || relayFanout < 1)
+                        SLog(EError, "Could not parse the relay fanout!");
+                    break;
                 case 'b':
                     blockSize = strtol(optarg, &end_ptr, 10);
                     if (*end_ptr != '\0')
@@ -237,9 +281,45 @@ int mitsuba_app(int argc, char **argv) {
                     if (blockSize < 2 || blockSize > 128)
                         SLog(EError, "Invalid block size (should be in the range 2-128)");
                     break;
+                case 'k':
+                    localBatchSize = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0')
+                        SLog(EError, "Could not parse the work unit batch size!");
+                    if (localBatchSize < 1)
+                        SLog(EError, "Invalid work unit batch size (should be >= 1)");
+                    break;
+                case 'N':
+                    numaMode = true;
+                    break;
+                case 'M': {
+                        double budget = strtod(optarg, &end_ptr);
+                        switch (toupper(*end_ptr)) {
+                            case 'T': budget *= 1024.0;
+                            case 'G': budget *= 1024.0;
+                            case 'M': budget *= 1024.0;
+                            case 'K': budget *= 1024.0; ++end_ptr;
+                            default: break;
+                        }
+                        if (*end_ptr != '\0' || budget <= 0)
+                            SLog(EError, "Could not parse the memory budget!");
+                        MemoryTracker::setBudget((size_t) budget);
+                    }
+                    break;
                 case 'z':
                     progressBars = false;
                     break;
+                case 'P':
+                    timingFile = optarg;
+                    break;
+                case 'J':
+                    statsFile = optarg;
+                    break;
+                case 'm':
+                    monitorFile = optarg;
+                    break;
+                case 'S':
+                    sequenceFile = optarg;
+                    break;
                 case 'q':
                     quietMode = true;
                     break;
@@ -260,6 +340,9 @@ int mitsuba_app(int argc, char **argv) {
         log->setLogLevel(logLevel);
         log->setErrorLevel(treatWarningsAsErrors ? EWarn : EError);
 
+        /* Keep slow appenders from serializing the worker threads */
+        log->setAsynchronous(true);
+
         /* Disable the default appenders */
         for (size_t i=0; i<log->getAppenderCount(); ++i) {
             Appender *appender = log->getAppender(i);
@@ -277,11 +360,41 @@ int mitsuba_app(int argc, char **argv) {
         /* Configure the scheduling subsystem */
         Scheduler *scheduler = Scheduler::getInstance();
         bool useCoreAffinity = nprocs == nprocs_avail;
-        for (int i=0; i<nprocs; ++i)
-            scheduler->registerWorker(new LocalWorker(useCoreAffinity ? i : -1,
-                formatString("wrk%i", i)));
+        scheduler->setLocalBatchSize((size_t) localBatchSize);
+        if (numaMode && nprocs <= nprocs_avail && getNUMANodeCount() > 1) {
+            /* Pin the workers so that they are spread evenly over all NUMA nodes */
+            std::vector<int> cores = getNUMAInterleavedCores();
+            std::vector<int> coreNodes = getCoreNUMANodes();
+            SLog(EInfo, "NUMA mode: distributing %i workers over %i nodes",
+                nprocs, getNUMANodeCount());
+            for (int i=0; i<nprocs; ++i)
+                scheduler->registerWorker(new LocalWorker(cores[i],
+                    formatString("wrk%i.%i", i, coreNodes[cores[i]])));
+            setNUMAInterleaving(true);
+        } else {
+            if (numaMode)
+                SLog(EWarn, "NUMA mode requested, but this machine has a single NUMA node "
+                    "or fewer cores than workers -- ignoring.");
+            for (int i=0; i<nprocs; ++i)
+                scheduler->registerWorker(new LocalWorker(useCoreAffinity ? i : -1,
+                    formatString("wrk%i", i)));
+        }
         std::vector<std::string> hosts = tokenize(networkHosts, ";");
 
+        if (relayFanout > 0) {
+            /* Broadcast mode: connect to a few servers, which relay to the rest */
+            std::vector<std::vector<std::string> > tree =
+                RemoteWorker::partitionBroadcastTree(hosts, relayFanout);
+            for (size_t i=0; i<tree.size(); ++i) {
+                std::string subtree;
+                for (size_t j=1; j<tree[i].size(); ++j)
+                    subtree += (j > 1 ? ";" : "") + tree[i][j];
+                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i),
+                    RemoteWorker::connect(tree[i][0]), subtree, relayFanout));
+            }
+            hosts.clear();
+        }
+
         /* Establish network connections to nested servers */
         for (size_t i=0; i<hosts.size(); ++i) {
             const std::string &hostName = hosts[i];
@@ -356,6 +469,33 @@ int mitsuba_app(int argc, char **argv) {
         parser->setDocumentHandler(handler);
         parser->setErrorHandler(handler);
 
+        /* Parameters of the frames in sequence mode */
+        std::vector<SceneHandler::ParameterMap> frames;
+        if (!sequenceFile.empty()) {
+            std::ifstream is(sequenceFile.c_str());
+            if (is.fail())
+                SLog(EError, "Could not open the sequence file \"%s\"!", sequenceFile.c_str());
+            std::string line;
+            while (std::getline(is, line)) {
+                line = trim(line);
+                if (line.empty() || line[0] == '#')
+                    continue;
+                SceneHandler::ParameterMap frame(parameters);
+                std::vector<std::string> tokens = tokenize(line, " \t");
+                for (size_t j=0; j<tokens.size(); ++j) {
+                    std::vector<std::string> param = tokenize(tokens[j], "=");
+                    if (param.size() != 2)
+                        SLog(EError, "Invalid parameter specification \"%s\" in the "
+                            "sequence file", tokens[j].c_str());
+                    frame[param[0]] = param[1];
+                }
+                frames.push_back(frame);
+            }
+            if (frames.empty())
+                SLog(EError, "The sequence file \"%s\" does not contain any frames!",
+                    sequenceFile.c_str());
+        }
+
         renderQueue = new RenderQueue();
 
         ref<FlushThread> flushThread;
@@ -364,6 +504,13 @@ int mitsuba_app(int argc, char **argv) {
             flushThread->start();
         }
 
+        ref<RenderMonitor> monitor;
+        if (!monitorFile.empty()) {
+            monitor = new RenderMonitor(renderQueue,
+                new FileStream(monitorFile, FileStream::EAppendWrite));
+            renderQueue->registerListener(monitor);
+        }
+
         int jobIdx = 0;
         for (int i=optind; i<argc; ++i) {
             fs::path
@@ -374,38 +521,94 @@ int mitsuba_app(int argc, char **argv) {
             frClone->prependPath(filePath);
             Thread::getThread()->setFileResolver(frClone);
 
-            SLog(EInfo, "Parsing scene description from \"%s\" ..", argv[i]);
-
-            parser->parse(filename.c_str());
-            ref<Scene> scene = handler->getScene();
-
-            scene->setSourceFile(filename);
-            scene->setDestinationFile(destFile.length() > 0 ?
-                fs::path(destFile) : (filePath / baseName));
-            scene->setBlockSize(blockSize);
-
-            if (scene->destinationExists() && skipExisting)
-                continue;
-
-            ref<RenderJob> thr = new RenderJob(formatString("ren%i", jobIdx++),
-                scene, renderQueue, -1, -1, -1, true, flushTimer > 0);
-            thr->start();
+            /* In sequence mode, the frames of a scene share all objects
+               that don't change (but different scene files don't) */
+            bool sequence = !frames.empty();
+            size_t frameCount = sequence ? frames.size() : 1;
+            handler->setObjectReuse(sequence);
+            ref<Scene> previous;
+
+            for (size_t frame=0; frame<frameCount; ++frame) {
+                if (sequence) {
+                    handler->setParameters(frames[frame]);
+                    SLog(EInfo, "Parsing frame " SIZE_T_FMT " of the scene description "
+                        "from \"%s\" ..", frame, argv[i]);
+                } else {
+                    SLog(EInfo, "Parsing scene description from \"%s\" ..", argv[i]);
+                }
 
-            renderQueue->waitLeft(numParallelScenes-1);
-            if (i+1 < argc && numParallelScenes == 1)
-                Statistics::getInstance()->resetAll();
+                {
+                    ScopedPhase phase("Load scene");
+                    parser->parse(filename.c_str());
+                }
+                ref<Scene> scene = handler->getScene();
+
+                fs::path destination = destFile.length() > 0 ?
+                    fs::path(destFile) : (filePath / baseName);
+                if (sequence)
+                    destination = destination.parent_path() / (destination.stem().string()
+                        + formatString("_%04i", (int) frame) + destination.extension().string());
+
+                scene->setSourceFile(filename);
+                scene->setDestinationFile(destination);
+                scene->setBlockSize(blockSize);
+                if (hilbertOrder)
+                    scene->setBlockOrder(BlockedImageProcess::EHilbert);
+
+                if (scene->destinationExists() && skipExisting)
+                    continue;
+
+                if (previous)
+                    scene->reuseGeometry(previous);
+
+                ref<RenderJob> thr = new RenderJob(formatString("ren%i", jobIdx++),
+                    scene, renderQueue, -1, -1, -1, true, flushTimer > 0);
+                thr->setCheckpointInterval(flushTimer);
+                thr->start();
+
+                if (sequence) {
+                    /* The next frame may reuse the objects of this one */
+                    renderQueue->waitLeft(0);
+                    previous = scene;
+                } else {
+                    renderQueue->waitLeft(numParallelScenes-1);
+                }
+                if ((i+1 < argc || frame+1 < frameCount) && (numParallelScenes == 1 || sequence))
+                    Statistics::getInstance()->resetAll();
+            }
         }
+        handler->setObjectReuse(false);
 
         /* Wait for all render processes to finish */
         renderQueue->waitLeft(0);
         if (flushThread)
             flushThread->quit();
+        if (monitor) {
+            monitor->stop();
+            renderQueue->unregisterListener(monitor);
+        }
         renderQueue = NULL;
 
         delete handler;
         delete parser;
 
         Statistics::getInstance()->printStats();
+
+        if (!timingFile.empty()) {
+            std::ofstream os(timingFile.c_str());
+            if (os.fail())
+                SLog(EError, "Could not write the timing report to \"%s\"!",
+                    timingFile.c_str());
+            os << Statistics::getInstance()->getPhaseTimingsJSON() << endl;
+        }
+
+        if (!statsFile.empty()) {
+            std::ofstream os(statsFile.c_str());
+            if (os.fail())
+                SLog(EError, "Could not write the statistics to \"%s\"!",
+                    statsFile.c_str());
+            os << Statistics::getInstance()->getStatsJSON() << endl;
+        }
     } catch (const std::exception &e) {
         std::cerr << "Caught a critical exception: " << e.what() << endl;
         return -1;
@@ -431,6 +634,7 @@ int mts_main(int argc, char **argv) {
     Scheduler::staticInitialization();
     SHVector::staticInitialization();
     SceneHandler::staticInitialization();
+    TextureTileCache::staticInitialization();
 
 #if defined(__WINDOWS__)
     /* Initialize WINSOCK2 */
@@ -449,6 +653,7 @@ int mts_main(int argc, char **argv) {
     int retval = mitsuba_app(argc, argv);
 
     /* Shutdown the core framework */
+    TextureTileCache::staticShutdown();
     SceneHandler::staticShutdown();
     SHVector::staticShutdown();
     Scheduler::staticShutdown();
@@ -28,6 +28,8 @@
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/bitmap.h>
+#include <mitsuba/render/renderservice.h>
+#include <mitsuba/render/tilecache.h>
 #include <fstream>
 #include <stdexcept>
 #include <boost/algorithm/string.hpp>
@@ -106,10 +108,14 @@ int mtssrv(int argc, char **argv) {
         std::string hostName = getFQDN();
         FileResolver *fileResolver = Thread::getThread()->getFileResolver();
         bool hostNameSet = false;
+        std::string cacheDir;
+        size_t cacheSize = 16384;
+        bool serviceMode = false;
+        size_t memoryLimit = getTotalSystemMemory();
 
         optind = 1;
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "a:c:s:n:p:i:l:L:qhv")) != -1) {
+        while ((optchar = getopt(argc, argv, "a:c:d:m:M:s:n:p:i:l:L:qhvS")) != -1) {
             switch (optchar) {
                 case 'a': {
                         std::vector<std::string> paths = tokenize(optarg, ";");
@@ -120,6 +126,19 @@ int mtssrv(int argc, char **argv) {
                 case 'c':
                     networkHosts = networkHosts + std::string(";") + std::string(optarg);
                     break;
+                case 'd':
+                    cacheDir = optarg;
+                    break;
+                case 'm':
+                    cacheSize = (size_t) strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0')
+                        SLog(EError, "Could not parse the resource cache size!");
+                    break;
+                case 'M':
+                    memoryLimit = (size_t) strtol(optarg, &end_ptr, 10) * 1024 * 1024;
+                    if (*end_ptr != '\0')
+                        SLog(EError, "Could not parse the memory size!");
+                    break;
                 case 'i':
                     hostName = optarg;
                     hostNameSet = true;
@@ -176,6 +195,9 @@ int mtssrv(int argc, char **argv) {
                 case 'q':
                     quietMode = true;
                     break;
+                case 'S':
+                    serviceMode = true;
+                    break;
                 case 'h':
                 default:
                     cout <<  "Mitsuba version " << Version(MTS_VERSION).toStringComplete()
@@ -197,6 +219,15 @@ int mtssrv(int argc, char **argv) {
                     cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
                     cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
                     cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+                    cout <<  "   -d dir      Keep the resources of past jobs (meshes, textures, ..) in a" << endl;
+                    cout <<  "               persistent cache in the given directory, so that unchanged" << endl;
+                    cout <<  "               resources need not be sent again by later jobs" << endl << endl;
+                    cout <<  "   -m size     Maximum size of the resource cache in MiB (Default: 16384)" << endl << endl;
+                    cout <<  "   -M size     Memory in MiB announced to clients, which only send work of" << endl;
+                    cout <<  "               jobs that fit (Default: physical memory of this machine)" << endl << endl;
+                    cout <<  "   -S          Service mode: instead of acting as a compute node, keep scenes" << endl;
+                    cout <<  "               loaded and render them on request (see the documentation" << endl;
+                    cout <<  "               of the RenderService class for the protocol)" << endl << endl;
                     cout <<  "   -i name     IP address / host name on which to listen for connections" << endl << endl;
                     cout <<  "   -l port     Listen for connections on a certain port (Default: " << MTS_DEFAULT_PORT << ")." << endl;
                     cout <<  "               To listen on stdin, specify \"-ls\" (implies -q)" << endl << endl;
@@ -215,6 +246,9 @@ int mtssrv(int argc, char **argv) {
         /* Initialize OpenMP */
         Thread::initializeOpenMP(nprocs);
 
+        /* Keep slow appenders from serializing the worker threads */
+        log->setAsynchronous(true);
+
         /* Disable the default appenders */
         for (size_t i=0; i<log->getAppenderCount(); ++i) {
             Appender *appender = log->getAppender(i);
@@ -285,9 +319,28 @@ int mtssrv(int argc, char **argv) {
         }
         scheduler->start();
 
+        /* Set up the persistent resource cache, if requested */
+        ref<ResourceCache> cache;
+        if (!cacheDir.empty())
+            cache = new ResourceCache(cacheDir, cacheSize * 1024 * 1024);
+
+        /* In service mode, the loaded scenes are shared by all connections */
+        ref<RenderService> service;
+        if (serviceMode)
+            service = new RenderService();
+
         if (listenPort == -1) {
+            if (service) {
+                ref<RenderServiceConnection> connection = new RenderServiceConnection(
+                    "con0", service, new ConsoleStream(), false);
+                connection->start();
+                connection->join();
+                return 0;
+            }
             ref<StreamBackend> backend = new StreamBackend("con0",
                     scheduler, nodeName, new ConsoleStream(), false);
+            backend->setResourceCache(cache);
+            backend->setMemoryLimit(memoryLimit);
             backend->start();
             backend->join();
             return 0;
@@ -384,8 +437,18 @@ int mtssrv(int argc, char **argv) {
                 continue;
             }
 
+            if (service) {
+                ref<RenderServiceConnection> connection = new RenderServiceConnection(
+                    formatString("con%i", connectionIndex++), service,
+                    new SocketStream(newSocket), true);
+                connection->start();
+                continue;
+            }
+
             ref<StreamBackend> backend = new StreamBackend(formatString("con%i", connectionIndex++),
                 scheduler, nodeName, new SocketStream(newSocket), true);
+            backend->setResourceCache(cache);
+            backend->setMemoryLimit(memoryLimit);
             backend->start();
         }
 #if defined(__WINDOWS__)
@@ -418,6 +481,8 @@ int mts_main(int argc, char **argv) {
     Bitmap::staticInitialization();
     Scheduler::staticInitialization();
     SHVector::staticInitialization();
+    SceneHandler::staticInitialization();
+    TextureTileCache::staticInitialization();
 
 #if defined(__WINDOWS__)
     /* Initialize WINSOCK2 */
@@ -435,6 +500,8 @@ int mts_main(int argc, char **argv) {
     int retval = mtssrv(argc, argv);
 
     /* Shutdown the core framework */
+    TextureTileCache::staticShutdown();
+    SceneHandler::staticShutdown();
     SHVector::staticShutdown();
     Scheduler::staticShutdown();
     Bitmap::staticShutdown();
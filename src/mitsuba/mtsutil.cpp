@@ -36,6 +36,7 @@
 #include <mitsuba/render/testcase.h>
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/render/scenehandler.h>
+#include <mitsuba/render/tilecache.h>
 #include <boost/algorithm/string.hpp>
 #include <fstream>
 #include <stdexcept>
@@ -400,6 +401,7 @@ int mts_main(int argc, char **argv) {
     Scheduler::staticInitialization();
     SHVector::staticInitialization();
     SceneHandler::staticInitialization();
+    TextureTileCache::staticInitialization();
 
 #if defined(__WINDOWS__)
     /* Initialize WINSOCK2 */
@@ -418,6 +420,7 @@ int mts_main(int argc, char **argv) {
     int retval = mtsutil(argc, argv);
 
     /* Shutdown the core framework */
+    TextureTileCache::staticShutdown();
     SceneHandler::staticShutdown();
     SHVector::staticShutdown();
     Scheduler::staticShutdown();
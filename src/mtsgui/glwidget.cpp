@@ -29,7 +29,7 @@
 #include <boost/tuple/tuple.hpp>
 
 GLWidget::GLWidget(QWidget *parent) :
-    QGLWidget(parent), m_context(NULL) {
+    QGLWidget(parent), m_context(NULL), m_fallbackInvalid(true) {
     setAutoBufferSwap(false);
     setFocusPolicy(Qt::StrongFocus);
     m_clock = new Timer();
@@ -63,6 +63,10 @@ GLWidget::GLWidget(QWidget *parent) :
     m_ignoreScrollEvents = false;
     m_animation = false;
     m_cropping = false;
+#if MTS_SSE
+    m_fallbackSource = NULL;
+    m_fallbackMethod = EGamma;
+#endif
     setAcceptDrops(true);
 }
 
@@ -228,6 +232,7 @@ void GLWidget::setScene(SceneContext *context) {
 
     m_preview->setSceneContext(context, true, false);
     m_framebufferChanged = true;
+    invalidateFallback();
     m_mouseDrag = m_animation = m_cropping = false;
     m_leftKeyDown = m_rightKeyDown = m_upKeyDown = m_downKeyDown = false;
     m_aabb.reset();
@@ -239,6 +244,7 @@ void GLWidget::setScene(SceneContext *context) {
 
 void GLWidget::refreshScene() {
     m_framebufferChanged = true;
+    invalidateFallback();
     resetPreview();
     updateGeometry();
     updateScrollBars();
@@ -326,6 +332,7 @@ void GLWidget::setReinhardBurn(Float value) {
 
 void GLWidget::downloadFramebuffer() {
     bool createdFramebuffer = false;
+    invalidateFallback();
 
     if (!m_preview->isRunning()
         || m_context->previewMethod == EDisabled) {
@@ -535,6 +542,7 @@ void GLWidget::keyPressEvent(QKeyEvent *event) {
             if (m_context->layers.size() > 0) {
                 m_context->currentLayer = std::max(0, m_context->currentLayer-1);
                 m_context->framebuffer = m_context->layers[m_context->currentLayer].second->convert(Bitmap::ERGBA, Bitmap::EFloat32);
+                invalidateFallback();
                 m_statusMessage =
                     formatString("Showing layer \"%s\" (%i/%i); use '[' and ']' to switch.",
                         m_context->layers[m_context->currentLayer].first.c_str(),
@@ -551,6 +559,7 @@ void GLWidget::keyPressEvent(QKeyEvent *event) {
             if (m_context->layers.size() > 0) {
                 m_context->currentLayer = std::min((int) m_context->layers.size() - 1, m_context->currentLayer+1);
                 m_context->framebuffer = m_context->layers[m_context->currentLayer].second->convert(Bitmap::ERGBA, Bitmap::EFloat32);
+                invalidateFallback();
                 m_statusMessage =
                     formatString("Showing layer \"%s\" (%i/%i); use '[' and ']' to switch.",
                         m_context->layers[m_context->currentLayer].first.c_str(),
@@ -1041,6 +1050,8 @@ void GLWidget::paintGL() {
                     m_cpuTonemap = new TonemapCPU;
 #endif
                 }
+                /* The new texture must be uploaded in its entirety */
+                invalidateFallback();
                 m_framebuffer->setMipMapped(false);
                 m_framebuffer->setFilterType(GPUTexture::ENearest);
                 m_framebuffer->init();
@@ -1054,6 +1065,8 @@ void GLWidget::paintGL() {
                         mult /= entry.vplSampleOffset;
                     }
                     m_cpuTonemap->setLuminanceInfo(m_context->framebuffer,mult);
+                    /* The changed regions are uploaded after tonemapping */
+                    m_framebufferChanged = false;
 #else
                     /* Manually generate a gamma-corrected image
                        on the CPU (with gamma=2.2) - this will be slow! */
@@ -1075,7 +1088,15 @@ void GLWidget::paintGL() {
                     }
 #endif
                 }
-                m_framebuffer->refresh();
+                if (m_framebufferChanged) {
+                    if (m_softwareFallback) {
+                        /* The whole image was converted above */
+                        QMutexLocker locker(&m_dirtyMutex);
+                        m_dirtyRegions.clear();
+                        m_framebuffer->refresh();
+                    } else
+                        updateFramebuffer();
+                }
                 m_framebufferChanged = false;
             }
 
@@ -1099,8 +1120,6 @@ void GLWidget::paintGL() {
                     invWhitePoint /= entry.vplSampleOffset;
 
                 m_cpuTonemap->setInvWhitePoint(invWhitePoint);
-                m_cpuTonemap->gammaTonemap(m_context->framebuffer,
-                    m_fallbackBitmap);
             } else if (m_context->toneMappingMethod == EReinhard) {
                 Float mult = 1.0;
                 if (m_context->mode == EPreview)
@@ -1120,10 +1139,8 @@ void GLWidget::paintGL() {
                 m_cpuTonemap->setScale(scale);
                 m_cpuTonemap->setMultiplier(mult);
                 m_cpuTonemap->setInvWhitePoint(1 / (Lwhite * (burn*burn)));
-                m_cpuTonemap->reinhardTonemap(m_context->framebuffer,
-                    m_fallbackBitmap);
             }
-            m_framebuffer->refresh();
+            updateFallback();
 #endif
             buffer->bind();
             m_renderer->setColor(Spectrum(1.0f));
@@ -1467,6 +1484,95 @@ void GLWidget::onUpdateView() {
     m_framebufferChanged = true;
 }
 
+void GLWidget::addDirtyRegion(const Point2i &offset, const Vector2i &size) {
+    QMutexLocker locker(&m_dirtyMutex);
+    m_dirtyRegions.push_back(std::make_pair(offset, size));
+}
+
+void GLWidget::invalidateFallback() {
+    QMutexLocker locker(&m_dirtyMutex);
+    m_dirtyRegions.clear();
+    m_fallbackInvalid = true;
+}
+
+void GLWidget::updateFramebuffer() {
+    std::vector<std::pair<Point2i, Vector2i> > regions;
+    bool invalid;
+    m_dirtyMutex.lock();
+    regions.swap(m_dirtyRegions);
+    invalid = m_fallbackInvalid;
+    m_fallbackInvalid = false;
+    m_dirtyMutex.unlock();
+
+    /* The texture directly holds the framebuffer, hence only the blocks
+       that were developed since the last refresh need to be uploaded */
+    if (invalid) {
+        m_framebuffer->refresh();
+        return;
+    }
+
+    const Vector2i &size = m_context->framebuffer->getSize();
+    for (size_t i=0; i<regions.size(); ++i) {
+        /* Clip to the framebuffer */
+        Point2i offset(std::max(regions[i].first.x, 0),
+            std::max(regions[i].first.y, 0));
+        Vector2i extent(
+            std::min(regions[i].first.x + regions[i].second.x, size.x) - offset.x,
+            std::min(regions[i].first.y + regions[i].second.y, size.y) - offset.y);
+        if (extent.x > 0 && extent.y > 0)
+            m_framebuffer->refresh(offset, extent);
+    }
+}
+
+#if MTS_SSE
+void GLWidget::updateFallback() {
+    std::vector<std::pair<Point2i, Vector2i> > regions;
+    bool invalid;
+    m_dirtyMutex.lock();
+    regions.swap(m_dirtyRegions);
+    invalid = m_fallbackInvalid;
+    m_fallbackInvalid = false;
+    m_dirtyMutex.unlock();
+
+    /* During progressive rendering, only the blocks that were finished since
+       the last refresh need to be tonemapped and uploaded again. This is not
+       possible when the parameters change (e.g. the luminance statistics of
+       the Reinhard operator) or in preview mode */
+    const Bitmap *source = m_context->framebuffer;
+    bool reinhard = m_context->toneMappingMethod == EReinhard;
+    if (invalid || m_context->mode != ERender || source != m_fallbackSource
+        || m_context->toneMappingMethod != m_fallbackMethod
+        || m_cpuTonemap->params() != m_fallbackParams) {
+        if (reinhard)
+            m_cpuTonemap->reinhardTonemap(source, m_fallbackBitmap);
+        else
+            m_cpuTonemap->gammaTonemap(source, m_fallbackBitmap);
+        m_framebuffer->refresh();
+        m_fallbackSource = source;
+        m_fallbackMethod = m_context->toneMappingMethod;
+        m_fallbackParams = m_cpuTonemap->params();
+        return;
+    }
+
+    const Vector2i &size = source->getSize();
+    for (size_t i=0; i<regions.size(); ++i) {
+        /* Clip to the framebuffer */
+        Point2i offset(std::max(regions[i].first.x, 0),
+            std::max(regions[i].first.y, 0));
+        Vector2i extent(
+            std::min(regions[i].first.x + regions[i].second.x, size.x) - offset.x,
+            std::min(regions[i].first.y + regions[i].second.y, size.y) - offset.y);
+        if (extent.x <= 0 || extent.y <= 0)
+            continue;
+        if (reinhard)
+            m_cpuTonemap->reinhardTonemap(source, m_fallbackBitmap, offset, extent);
+        else
+            m_cpuTonemap->gammaTonemap(source, m_fallbackBitmap, offset, extent);
+        m_framebuffer->refresh(offset, extent);
+    }
+}
+#endif
+
 Point2i GLWidget::upperLeft(bool flipY) const {
     if (!m_context)
         return Point2i(0, 0);
@@ -54,6 +54,8 @@ public:
     void resumePreview();
     void refreshScene();
     void resetPreview();
+    void addDirtyRegion(const Point2i &offset, const Vector2i &size);
+    void invalidateFallback();
     void shutdown();
     inline const RendererCapabilities *getRendererCapabilities() const {
         return m_renderer->getCapabilities();
@@ -123,6 +125,12 @@ protected:
     void wheelEvent(QWheelEvent *event);
     void dragEnterEvent(QDragEnterEvent *event);
     void dropEvent(QDropEvent *event);
+    /// Upload the changed parts of the framebuffer to the GPU texture
+    void updateFramebuffer();
+#if MTS_SSE
+    /// Tonemap the changed parts of the framebuffer for the software fallback
+    void updateFallback();
+#endif
     void oglRenderKDTree(const KDTreeBase<AABB> *kdtree);
     Point2i upperLeft(bool flipY = false) const;
     void reveal(const AABB &aabb);
@@ -209,7 +217,19 @@ private:
     ref<GPUProgram> m_downsamplingProgram, m_luminanceProgram;
 #if MTS_SSE
     ref<TonemapCPU> m_cpuTonemap;
+    /* State of the software fallback image, which is only tonemapped
+       again where the framebuffer changed, as long as the parameters
+       and the framebuffer itself stay the same */
+    TonemapCPU::Params m_fallbackParams;
+    EToneMappingMethod m_fallbackMethod;
+    const Bitmap *m_fallbackSource;
 #endif
+    /* Regions of the framebuffer that changed since the last refresh of
+       the software fallback image. Written by the workers, hence guarded
+       by m_dirtyMutex */
+    std::vector<std::pair<Point2i, Vector2i> > m_dirtyRegions;
+    QMutex m_dirtyMutex;
+    bool m_fallbackInvalid;
     ref<QtDevice> m_device;
     ref<Font> m_font;
     ref<Bitmap> m_fallbackBitmap;
@@ -27,6 +27,7 @@
 #include <mitsuba/core/appender.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/render/scenehandler.h>
+#include <mitsuba/render/tilecache.h>
 
 #if defined(__OSX__)
 #include <ApplicationServices/ApplicationServices.h>
@@ -180,6 +181,7 @@ int main(int argc, char *argv[]) {
     Scheduler::staticInitialization();
     SHVector::staticInitialization();
     SceneHandler::staticInitialization();
+    TextureTileCache::staticInitialization();
 
 #if defined(__LINUX__)
     XInitThreads();
@@ -307,6 +309,7 @@ int main(int argc, char *argv[]) {
 #endif
 
     /* Shutdown the core framework */
+    TextureTileCache::staticShutdown();
     SceneHandler::staticShutdown();
     SHVector::staticShutdown();
     Scheduler::staticShutdown();
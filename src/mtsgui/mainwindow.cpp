@@ -1849,8 +1849,10 @@ void MainWindow::onWorkBegin(const RenderJob *job, const RectangularWorkUnit *wu
     bool isCurrentView = ui->tabBar->currentIndex() < m_context.size() &&
         m_context[ui->tabBar->currentIndex()] == context;
     m_contextMutex.unlock();
-    if (isCurrentView)
+    if (isCurrentView) {
+        ui->glView->addDirtyRegion(wu->getOffset(), wu->getSize());
         emit updateView();
+    }
 }
 
 void MainWindow::drawVisualWorkUnit(SceneContext *context, const VisualWorkUnit &vwu) {
@@ -1920,19 +1922,11 @@ void MainWindow::onWorkEnd(const RenderJob *job, const ImageBlock *block) {
     if (context == NULL)
         return;
 
-    // int border = block->getBorderSize();
-    int border = 0; // produces a more appealing preview
-
-    Point2i offset(
-        std::max(0, block->getOffset().x - border),
-        std::max(0, block->getOffset().y - border));
-
-    Bitmap *target = context->framebuffer;
-    Vector2i size(
-        std::min(target->getWidth(),  offset.x + block->getSize().x + 2 * border)-offset.x,
-        std::min(target->getHeight(), offset.y + block->getSize().y + 2 * border)-offset.y);
-
-    context->scene->getFilm()->develop(offset, size, offset, target);
+    /* Only develop the parts of the film that changed since the last
+       update (this block including its filter border, and possibly
+       blocks finished concurrently by other workers) */
+    std::vector<std::pair<Point2i, Vector2i> > regions;
+    developDirtyRegions(context, regions);
 
     /* This is executed by worker threads -- take some precautions */
     m_contextMutex.lock();
@@ -1949,8 +1943,12 @@ void MainWindow::onWorkEnd(const RenderJob *job, const ImageBlock *block) {
         context->workUnits.begin(); it != context->workUnits.end(); ++it)
         drawVisualWorkUnit(context, *it);
     m_contextMutex.unlock();
-    if (isCurrentView)
+    if (isCurrentView) {
+        /* Redrawing the other work units doesn't change their pixels */
+        for (size_t i=0; i<regions.size(); ++i)
+            ui->glView->addDirtyRegion(regions[i].first, regions[i].second);
         emit updateView();
+    }
 }
 
 void MainWindow::onRefresh() {
@@ -1965,9 +1963,8 @@ void MainWindow::refresh(const RenderJob *job) {
     if (context == NULL)
         return;
 
-    Bitmap *target = context->framebuffer;
-    context->scene->getFilm()->develop(Point2i(0, 0),
-        target->getSize(), Point2i(0, 0), target);
+    std::vector<std::pair<Point2i, Vector2i> > regions;
+    developDirtyRegions(context, regions);
 
     /* This is executed by worker threads -- take some precautions */
     m_contextMutex.lock();
@@ -1977,8 +1974,28 @@ void MainWindow::refresh(const RenderJob *job) {
         context->workUnits.begin(); it != context->workUnits.end(); ++it)
         drawVisualWorkUnit(context, *it);
     m_contextMutex.unlock();
-    if (isCurrentView)
+    if (isCurrentView) {
+        for (size_t i=0; i<regions.size(); ++i)
+            ui->glView->addDirtyRegion(regions[i].first, regions[i].second);
         emit updateView();
+    }
+}
+
+void MainWindow::developDirtyRegions(SceneContext *context,
+        std::vector<std::pair<Point2i, Vector2i> > &regions) {
+    Film *film = context->scene->getFilm();
+    Bitmap *target = context->framebuffer;
+    film->takeDirtyRegions(regions);
+
+    for (size_t i=0; i<regions.size(); ++i) {
+        const Point2i &offset = regions[i].first;
+        Vector2i size(
+            std::min(target->getWidth(),  offset.x + regions[i].second.x) - offset.x,
+            std::min(target->getHeight(), offset.y + regions[i].second.y) - offset.y);
+        regions[i].second = size;
+        if (size.x > 0 && size.y > 0)
+            film->develop(offset, size, offset, target);
+    }
 }
 
 void MainWindow::onActivateCamera() {
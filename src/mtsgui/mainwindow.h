@@ -136,6 +136,8 @@ protected:
     void checkForUpdates(bool notifyIfNone = false);
     void saveAs(SceneContext *ctx, const QString &targetFile);
     void refresh(const RenderJob *job);
+    void developDirtyRegions(SceneContext *context,
+        std::vector<std::pair<Point2i, Vector2i> > &regions);
     void updateCameraMenu();
     QSize sizeHint() const;
 
@@ -34,6 +34,9 @@ PreviewThread::PreviewThread(Device *parentDevice, Renderer *parentRenderer)
     m_queueEntryIndex = 0;
     m_session->init();
     m_timer = new Timer();
+    m_vplTimer = new Timer();
+    m_vplTime = 0;
+    m_targetFrameTime = 50;
     m_accumBuffer = NULL;
     m_sleep = false;
     m_started = new WaitFlag();
@@ -191,8 +194,10 @@ void PreviewThread::setSceneContext(SceneContext *context, bool swapContext, boo
         m_accumBuffer = NULL;
     }
 
-    if (m_context != context)
+    if (m_context != context) {
         m_minVPLs = 0;
+        m_vplTime = 0;
+    }
 
     m_vplsPerSecond = 0;
     m_raysPerSecond = 0;
@@ -354,6 +359,7 @@ void PreviewThread::run() {
             }
 
             int method = m_context->previewMethod;
+            Float vplTime = -1;
 
             if (method != EOpenGL) {
                 /* Do nothing, fall asleep in the next iteration */
@@ -416,7 +422,18 @@ void PreviewThread::run() {
                 VPL vpl = m_vpls.front();
                 m_vpls.pop_front();
 
+                /* While the user is moving around, compile at most one
+                   new material program per VPL to keep the preview
+                   responsive. The remaining materials are temporarily
+                   drawn using a placeholder */
+                m_shaderManager->setCompilationBudget(m_motion ? 1 : -1);
+                m_vplTimer->reset();
                 oglRenderVPL(target, vpl);
+                vplTime = (Float) m_vplTimer->getMilliseconds();
+
+                /* Don't let shader compilation skew the timings */
+                if (m_shaderManager->getCompiledProgramCount() > 0)
+                    vplTime = -1;
 
                 if (m_useSync)
                     target.sync->init();
@@ -426,10 +443,18 @@ void PreviewThread::run() {
             m_vplsPerSecond++;
             m_vplCount++;
 
-            if (m_minVPLs == 0) {
-                if (m_timer->getMilliseconds() > 50)
-                    m_minVPLs = m_vplCount;
-            }
+            /* Determine how many VPLs can be rendered within the
+               target frame time from a running average of the time
+               taken by a single VPL */
+            if (vplTime >= 0)
+                m_vplTime = m_vplTime == 0 ? vplTime
+                    : (Float) 0.8f * m_vplTime + (Float) 0.2f * vplTime;
+
+            if (m_vplTime > 0)
+                m_minVPLs = std::max(1, (int) std::min((Float) 1024,
+                    m_targetFrameTime / m_vplTime));
+            else if (m_minVPLs == 0 && m_timer->getMilliseconds() > m_targetFrameTime)
+                m_minVPLs = m_vplCount;
 
             if (m_vplCount >= m_minVPLs && m_minVPLs > 0)
                 m_readyQueue.push_back(target);
@@ -89,13 +89,14 @@ private:
     const GPUTexture *m_accumBuffer;
     ref<Mutex> m_mutex;
     ref<ConditionVariable> m_queueCV;
-    ref<Timer> m_timer;
+    ref<Timer> m_timer, m_vplTimer;
     ref<WaitFlag> m_started;
     std::list<PreviewQueueEntry> m_readyQueue, m_recycleQueue;
     SceneContext *m_context;
     size_t m_vplSampleOffset;
     int m_minVPLs, m_vplCount;
     int m_vplsPerSecond, m_raysPerSecond;
+    Float m_vplTime, m_targetFrameTime;
     int m_bufferCount, m_queueEntryIndex;
     std::deque<VPL> m_vpls;
     std::vector<GPUTexture *> m_releaseList;
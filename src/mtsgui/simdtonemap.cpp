@@ -329,9 +329,87 @@ void tonemap(const PixelRGBA32FGroup* const begin,
 
 
 
+// Number of pixels processed by one task when whole rows are tonemapped
+const size_t CHUNK_SIZE = 16384;
+
+
+// Split a region of the image into ranges of pixel indices which can be
+// processed concurrently. All ranges start at a multiple of 4 pixels (i.e.
+// at a group boundary, as required by the aligned stores) and are disjoint.
+// Rounding the boundaries to groups may include a few pixels outside of the
+// region, which are tonemapped as well.
+void splitRegion(const mitsuba::Vector2i &imageSize,
+    const mitsuba::Point2i &offset, const mitsuba::Vector2i &size,
+    std::vector<std::pair<size_t, size_t> > &ranges)
+{
+    const int x0 = std::max(offset.x, 0), y0 = std::max(offset.y, 0);
+    const int x1 = std::min(offset.x + size.x, imageSize.x);
+    const int y1 = std::min(offset.y + size.y, imageSize.y);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    const size_t width = static_cast<size_t>(imageSize.x);
+    const size_t pixelCount = width * static_cast<size_t>(imageSize.y);
+
+    if (x1 - x0 + 8 >= imageSize.x) {
+        // Nearly complete rows: process the rows as one contiguous range,
+        // otherwise the rounded row boundaries could overlap
+        const size_t begin = (y0 * width) & ~static_cast<size_t>(3);
+        const size_t end = std::min((y1 * width + 3) & ~static_cast<size_t>(3),
+            pixelCount);
+        for (size_t i = begin; i < end; i += CHUNK_SIZE)
+            ranges.push_back(std::make_pair(i, std::min(i + CHUNK_SIZE, end)));
+    } else {
+        for (int y = y0; y < y1; ++y) {
+            const size_t begin = y * width + x0, end = y * width + x1;
+            ranges.push_back(std::make_pair(begin & ~static_cast<size_t>(3),
+                std::min((end + 3) & ~static_cast<size_t>(3), pixelCount)));
+        }
+    }
+}
+
+
+// Tonemap the pixels [begin, end), where begin is a multiple of 4. The range
+// may only end within a group at the end of the image
+template <ELuminanceMethod luminanceMethod, EDisplayMethod displayMethod>
+void tonemapRange(const float *sourceData, uint8_t *targetData,
+    size_t begin, size_t end, const TonemapCPU::Params& params)
+{
+    // Reinterpret the data as groups of 4 pixels
+    const PixelRGBA32FGroup* groups =
+        reinterpret_cast<const PixelRGBA32FGroup*>(sourceData);
+    PixelRGBA8Group* dest = reinterpret_cast<PixelRGBA8Group*>(targetData);
+    const size_t groupEnd = end & ~static_cast<size_t>(3);
+
+    // Main processing
+    tonemap<luminanceMethod, displayMethod> (groups + begin / 4,
+        groups + groupEnd / 4, dest + begin / 4, params);
+
+    if (end != groupEnd) {
+        // Individual final group
+        PixelRGBA32FGroup last = PixelRGBA32FGroup::zero();
+        const V4f* pixels = reinterpret_cast<const V4f*>(sourceData) + groupEnd;
+        for (int i = 0; i < static_cast<int>(end - groupEnd); ++i) {
+            last.p[i] = pixels[i];
+        }
+
+        PixelRGBA8Group lastTarget = PixelRGBA8Group::zero();
+        tonemap<luminanceMethod, displayMethod> (&last, (&last)+1,
+            &lastTarget, params);
+
+        // Copy the final pixels to the target
+        PixelRGBA8* dest = reinterpret_cast<PixelRGBA8*>(targetData) + groupEnd;
+        for (int i = 0; i < static_cast<int>(end - groupEnd); ++i) {
+            dest[i].abgr = lastTarget.p[i].abgr;
+        }
+    }
+}
+
+
 // Tonemap dispatcher
 template <ELuminanceMethod luminanceMethod, EDisplayMethod displayMethod>
 bool tonemap(const mitsuba::Bitmap* source, mitsuba::Bitmap* target,
+    const mitsuba::Point2i &offset, const mitsuba::Vector2i &size,
     const TonemapCPU::Params& params)
 {
     using namespace mitsuba;
@@ -368,35 +446,16 @@ bool tonemap(const mitsuba::Bitmap* source, mitsuba::Bitmap* target,
         return false;
     }
 
-    // So far so good, now reinterpret the data as groups of 4 pixels. We may
-    // have an incomplete final group which needs separate handling
-    const size_t pixelCount = source->getPixelCount();
-    const PixelRGBA32FGroup* begin =
-        reinterpret_cast<const PixelRGBA32FGroup*>(sourceData);
-    const PixelRGBA32FGroup* end   = begin + (pixelCount / 4);
-    PixelRGBA8Group* dest = reinterpret_cast<PixelRGBA8Group*>(targetData);
-
-    // Main processing
-    tonemap<luminanceMethod, displayMethod> (begin, end, dest, params);
-
-    if (pixelCount % 4 != 0) {
-        // Individual final group
-        PixelRGBA32FGroup last = PixelRGBA32FGroup::zero();
-        const size_t offset = pixelCount & ~0x3;
-        const V4f* pixels = reinterpret_cast<const V4f*>(sourceData) + offset;
-        for (int i = 0; i < static_cast<int>(pixelCount % 4); ++i) {
-            last.p[i] = pixels[i];
-        }
-
-        PixelRGBA8Group lastTarget = PixelRGBA8Group::zero();
-        tonemap<luminanceMethod, displayMethod> (&last, (&last)+1,
-            &lastTarget, params);
+    // So far so good, distribute the rows of the region over the cores
+    std::vector<std::pair<size_t, size_t> > ranges;
+    splitRegion(source->getSize(), offset, size, ranges);
+    const int rangeCount = static_cast<int>(ranges.size());
+    const bool parallel = static_cast<size_t>(size.x) * size.y > CHUNK_SIZE;
 
-        // Copy the final pixels to the target
-        PixelRGBA8* dest = reinterpret_cast<PixelRGBA8*>(targetData) + offset;
-        for (int i = 0; i < static_cast<int>(pixelCount % 4); ++i) {
-            dest[i].abgr = lastTarget.p[i].abgr;
-        }
+    #pragma omp parallel for schedule(dynamic) if (parallel)
+    for (int i = 0; i < rangeCount; ++i) {
+        tonemapRange<luminanceMethod, displayMethod> (sourceData, targetData,
+            ranges[i].first, ranges[i].second, params);
     }
 
     return true;
@@ -473,52 +532,31 @@ LuminanceResult luminance(const PixelRGBA32FGroup* const begin,
 
 
 
-// Luminance dispatcher
-bool luminance(const mitsuba::Bitmap* source, const float multiplier,
-    float& outMaxLuminance, float &outAvgLogLuminance)
+// Luminance of the pixels [begin, end), where begin is a multiple of 4. The
+// range may only end within a group at the end of the image
+LuminanceResult luminanceRange(const float *sourceData, size_t begin,
+    size_t end, const float multiplier)
 {
-    using namespace mitsuba;
-
-    // Check the format
-    if (source->getPixelFormat() != Bitmap::ERGBA) {
-        SLog(EWarn, "TonemapCPU: the image is not in RGBA format");
-        return false;
-    }
-    else if (source->getComponentFormat() != Bitmap::EFloat32) {
-        SLog(EWarn, "TonemapCPU: the image component format is not Float32");
-        return false;
-    }
-
-    // Raw pointers to the data, checking for alignment
-    const float *sourceData = source->getFloat32Data();
-    if (reinterpret_cast<uintptr_t>(sourceData) % 16 != 0) {
-        SLog(EWarn, "TonemapCPU: the source data is not 16-byte aligned");
-        return false;
-    }
-
-    // So far so good, now reinterpret the data as groups of 4 pixels. We may
-    // have an incomplete final group which needs separate handling
-    const size_t pixelCount = source->getPixelCount();
-    const PixelRGBA32FGroup* begin =
+    const PixelRGBA32FGroup* groups =
         reinterpret_cast<const PixelRGBA32FGroup*>(sourceData);
-    const PixelRGBA32FGroup* end   = begin + (pixelCount / 4);
+    const size_t groupEnd = end & ~static_cast<size_t>(3);
 
     // Main processing
-    LuminanceResult result = luminance(begin, end, multiplier);
+    LuminanceResult result = luminance(groups + begin / 4,
+        groups + groupEnd / 4, multiplier);
 
-    if (pixelCount % 4 != 0) {
+    if (end != groupEnd) {
         // Individual final group
         PixelRGBA32FGroup last = PixelRGBA32FGroup::zero();
-        const size_t offset = pixelCount & ~0x3;
-        const V4f* pixels = reinterpret_cast<const V4f*>(sourceData) + offset;
-        for (int i = 0; i < static_cast<int>(pixelCount % 4); ++i) {
+        const V4f* pixels = reinterpret_cast<const V4f*>(sourceData) + groupEnd;
+        for (int i = 0; i < static_cast<int>(end - groupEnd); ++i) {
             last.p[i] = pixels[i];
         }
         LuminanceResult rTail = luminance(&last, (&last)+1, multiplier);
 
         // Remove the invalid results
         V4i tailMask = V4i::zero();
-        switch (pixelCount % 4) {
+        switch (end - groupEnd) {
         case 1:
             tailMask = V4i::constant<0, 0, 0, -1>();
             break;
@@ -535,14 +573,63 @@ bool luminance(const mitsuba::Bitmap* source, const float multiplier,
         result.sumLogLuminance += rTail.sumLogLuminance;
         result.maxLuminance = max(rTail.maxLuminance, result.maxLuminance);
     }
+    return result;
+}
+
+
+
+// Luminance dispatcher
+bool luminance(const mitsuba::Bitmap* source, const float multiplier,
+    float& outMaxLuminance, float &outAvgLogLuminance)
+{
+    using namespace mitsuba;
 
+    // Check the format
+    if (source->getPixelFormat() != Bitmap::ERGBA) {
+        SLog(EWarn, "TonemapCPU: the image is not in RGBA format");
+        return false;
+    }
+    else if (source->getComponentFormat() != Bitmap::EFloat32) {
+        SLog(EWarn, "TonemapCPU: the image component format is not Float32");
+        return false;
+    }
+
+    // Raw pointers to the data, checking for alignment
+    const float *sourceData = source->getFloat32Data();
+    if (reinterpret_cast<uintptr_t>(sourceData) % 16 != 0) {
+        SLog(EWarn, "TonemapCPU: the source data is not 16-byte aligned");
+        return false;
+    }
+
+    // So far so good, now process chunks of the image in parallel. The
+    // partial results are combined in a fixed order to stay deterministic
     using mitsuba::math::hmax_ps;
     using mitsuba::math::hsum_ps;
     using mitsuba::math::fastexp;
 
-    outMaxLuminance = hmax_ps(result.maxLuminance);
-    const float sumLogLuminance = hsum_ps(result.sumLogLuminance);
-    outAvgLogLuminance =  fastexp(sumLogLuminance / pixelCount);
+    const size_t pixelCount = source->getPixelCount();
+    const int chunkCount = static_cast<int>(
+        (pixelCount + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    std::vector<float> maxLuminance(chunkCount);
+    std::vector<double> sumLogLuminance(chunkCount);
+
+    #pragma omp parallel for schedule(dynamic) if (chunkCount > 1)
+    for (int i = 0; i < chunkCount; ++i) {
+        const size_t begin = i * CHUNK_SIZE;
+        const size_t end = std::min(begin + CHUNK_SIZE, pixelCount);
+        LuminanceResult result = luminanceRange(sourceData, begin, end,
+            multiplier);
+        maxLuminance[i] = hmax_ps(result.maxLuminance);
+        sumLogLuminance[i] = hsum_ps(result.sumLogLuminance);
+    }
+
+    outMaxLuminance = -1.0f;
+    double sum = 0.0;
+    for (int i = 0; i < chunkCount; ++i) {
+        outMaxLuminance = std::max(outMaxLuminance, maxLuminance[i]);
+        sum += sumLogLuminance[i];
+    }
+    outAvgLogLuminance = fastexp(static_cast<float>(sum / pixelCount));
     return true;
 };
 
@@ -552,22 +639,44 @@ bool luminance(const mitsuba::Bitmap* source, const float multiplier,
 
 bool TonemapCPU::gammaTonemap(const mitsuba::Bitmap* source,
     mitsuba::Bitmap* target) const
+{
+    return gammaTonemap(source, target, mitsuba::Point2i(0),
+        source->getSize());
+}
+
+
+bool TonemapCPU::gammaTonemap(const mitsuba::Bitmap* source,
+    mitsuba::Bitmap* target, const mitsuba::Point2i &offset,
+    const mitsuba::Vector2i &size) const
 {
     if (m_params.isSRGB) {
-        return tonemap<EExposure, ESRGB> (source, target, m_params);
+        return tonemap<EExposure, ESRGB> (source, target, offset, size,
+            m_params);
     } else {
-        return tonemap<EExposure, EGamma>(source, target, m_params);
+        return tonemap<EExposure, EGamma>(source, target, offset, size,
+            m_params);
     }
 }
 
 
 bool TonemapCPU::reinhardTonemap(const mitsuba::Bitmap* source,
     mitsuba::Bitmap* target) const
+{
+    return reinhardTonemap(source, target, mitsuba::Point2i(0),
+        source->getSize());
+}
+
+
+bool TonemapCPU::reinhardTonemap(const mitsuba::Bitmap* source,
+    mitsuba::Bitmap* target, const mitsuba::Point2i &offset,
+    const mitsuba::Vector2i &size) const
 {
     if (m_params.isSRGB) {
-        return tonemap<EReinhard02, ESRGB> (source, target, m_params);
+        return tonemap<EReinhard02, ESRGB> (source, target, offset, size,
+            m_params);
     } else {
-        return tonemap<EReinhard02, EGamma>(source, target, m_params);
+        return tonemap<EReinhard02, EGamma>(source, target, offset, size,
+            m_params);
     }
 }
 
@@ -47,8 +47,23 @@ public:
         invGamma(1.0f/2.2f), invWhitePoint(1.0f), multiplier(1.0f), scale(1.0f),
         isSRGB(true), avgLogLum(0.18f), maxLum(1.0f)
         {}
+
+        // Do both parameter sets produce the same tonemapped image?
+        bool operator==(const Params &p) const {
+            return invGamma == p.invGamma && invWhitePoint == p.invWhitePoint
+                && multiplier == p.multiplier && scale == p.scale
+                && isSRGB == p.isSRGB;
+        }
+
+        bool operator!=(const Params &p) const {
+            return !operator==(p);
+        }
     };
 
+    inline const Params &params() const {
+        return m_params;
+    }
+
     inline mitsuba::Float logAvgLuminance() const {
         return m_params.avgLogLum;
     }
@@ -81,11 +96,20 @@ public:
         m_params.isSRGB = srgb;
     }
 
-    // Source: RGBA32F, Target: RGBA8
+    // Source: RGBA32F, Target: RGBA8. The rows of the image are distributed
+    // over all cores using OpenMP
     bool gammaTonemap(const mitsuba::Bitmap* source, mitsuba::Bitmap* target) const;
     bool reinhardTonemap(const mitsuba::Bitmap* source, mitsuba::Bitmap* target) const;
 
-    // Source: RGBA32F
+    // Only update the given region of the target, e.g. the blocks which
+    // were finished since the last refresh. Up to 3 pixels to the left and
+    // right of every row of the region may be updated as well
+    bool gammaTonemap(const mitsuba::Bitmap* source, mitsuba::Bitmap* target,
+        const mitsuba::Point2i &offset, const mitsuba::Vector2i &size) const;
+    bool reinhardTonemap(const mitsuba::Bitmap* source, mitsuba::Bitmap* target,
+        const mitsuba::Point2i &offset, const mitsuba::Vector2i &size) const;
+
+    // Source: RGBA32F. The image is processed in parallel chunks
     bool setLuminanceInfo(const mitsuba::Bitmap* source,
         mitsuba::Float multiplier = 1);
 
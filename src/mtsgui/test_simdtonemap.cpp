@@ -269,6 +269,7 @@ public:
     MTS_DECLARE_TEST(testLuminance);
     MTS_DECLARE_TEST(testGamma);
     MTS_DECLARE_TEST(testReinhard);
+    MTS_DECLARE_TEST(testRegion);
     MTS_END_TESTCASE()
 
     virtual void init();
@@ -283,6 +284,8 @@ public:
     void testReinhard(int numImageSizes = 5, int runsPerImage = 2,
         int paramsPerImage = 10);
 
+    void testRegion(int numImageSizes = 5, int regionsPerImage = 10);
+
 private:
 
     static inline float pow2(float x) {
@@ -564,6 +567,65 @@ void TestTonemapperSSE::testLuminance(int numImageSizes,int runsPerImage) {
     assertTrue(m_varAvgLogLum.stddev() < 1e-6);
 }
 
+void TestTonemapperSSE::testRegion(int numImageSizes, int regionsPerImage) {
+    ref<TonemapCPU> tmoSIMD = new TonemapCPU;
+    tmoSIMD->setInvWhitePoint(0.5f);
+
+    for (int i = 0; i < numImageSizes; ++i) {
+        mitsuba::Vector2i size = nextSize();
+        ref<Bitmap> hdr    = new Bitmap(Bitmap::ERGBA, Bitmap::EFloat32, size);
+        ref<Bitmap> ldr    = new Bitmap(Bitmap::ERGBA, Bitmap::EUInt8, size);
+        ref<Bitmap> ldrRef = new Bitmap(Bitmap::ERGBA, Bitmap::EUInt8, size);
+        fill(hdr);
+        tmoSIMD->gammaTonemap(hdr, ldrRef);
+
+        for (int j = 0; j < regionsPerImage; ++j) {
+            Point2i offset(m_rnd->nextUInt(size.x), m_rnd->nextUInt(size.y));
+            Vector2i extent(m_rnd->nextUInt(size.x - offset.x) + 1,
+                m_rnd->nextUInt(size.y - offset.y) + 1);
+            if (j == 0) {
+                // Also cover the case of complete rows
+                offset.x = 0;
+                extent.x = size.x;
+            }
+
+            ldr->clear();
+            tmoSIMD->gammaTonemap(hdr, ldr, offset, extent);
+
+            // Every pixel of the region matches the full image, and the
+            // pixels more than 3 positions (in scanline order) away from
+            // the rows of the region are not touched
+            const uint32_t *actual = static_cast<const uint32_t *>(ldr->getData());
+            const uint32_t *expected = static_cast<const uint32_t *>(ldrRef->getData());
+            const int64_t width = size.x;
+            bool inside = true, outside = true;
+            for (int y = 0; y < size.y; ++y) {
+                for (int x = 0; x < size.x; ++x) {
+                    int64_t idx = y * width + x;
+                    if (y >= offset.y && y < offset.y + extent.y &&
+                        x >= offset.x && x < offset.x + extent.x) {
+                        inside &= actual[idx] == expected[idx];
+                        continue;
+                    } else if (extent.x + 8 >= size.x) {
+                        continue;
+                    }
+                    bool nearby = false;
+                    for (int row = y-1; row <= y+1; ++row) {
+                        if (row < offset.y || row >= offset.y + extent.y)
+                            continue;
+                        nearby |= idx >= row * width + offset.x - 3 &&
+                            idx < row * width + offset.x + extent.x + 3;
+                    }
+                    if (!nearby)
+                        outside &= actual[idx] == 0;
+                }
+            }
+            assertTrue(inside);
+            assertTrue(outside);
+        }
+    }
+}
+
 void TestTonemapperSSE::testBasic(const RGBA32F &pixel,
     const TonemapCPU::Params &params, const Vector4f &delta) {
     // Setup the reference tonemapper
@@ -20,11 +20,119 @@
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/sampler.h>
 #include <mitsuba/core/properties.h>
+#include <mitsuba/core/lock.h>
 #include <mitsuba/core/frame.h>
 #include <mitsuba/core/warp.h>
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Precomputed quantities of the Kajiya-Kay lobe for one exponent
+ *
+ * Besides the normalization factor, this class stores a tabulated
+ * inverse CDF of the density \cos^n(\theta') on [-\pi/2, \pi/2],
+ * where \theta' is the angle between a direction and the specular
+ * cone (i.e. the lobe's shape in terms of the longitudinal angle).
+ * Since it only depends on the exponent, instances are shared by all
+ * phase functions with the same parameters (see \ref get()).
+ */
+class KajiyaKayTable : public Object {
+public:
+    enum {
+        /// Number of entries of the inverse CDF
+        EResolution = 1024,
+        /// Number of steps used to integrate the CDF
+        EIntegrationSteps = 8192
+    };
+
+    /// Return the (shared) table for a given exponent
+    static ref<KajiyaKayTable> get(Float exponent);
+
+    /// Return the normalization factor for perpendicular illumination
+    inline Float getNormalization() const { return m_normalization; }
+
+    /// Map a uniform sample to an angular offset from the specular cone
+    inline Float sample(Float sample) const {
+        Float pos = sample * EResolution;
+        int idx = std::max(0, std::min((int) pos, (int) EResolution - 1));
+        Float alpha = pos - idx;
+        return (1-alpha) * m_invCDF[idx] + alpha * m_invCDF[idx+1];
+    }
+
+    /// Density of \ref sample() with respect to the angular offset
+    inline Float pdf(Float offset) const {
+        if (offset < -M_PI/2 || offset > M_PI/2)
+            return 0.0f;
+        int idx = (int) (std::upper_bound(m_invCDF.begin(),
+            m_invCDF.end(), offset) - m_invCDF.begin()) - 1;
+        idx = std::max(0, std::min(idx, (int) EResolution - 1));
+        return 1.0f / (EResolution * (m_invCDF[idx+1] - m_invCDF[idx]));
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Create the table for a given exponent
+    KajiyaKayTable(Float exponent) {
+        /* Compute the normalization for perpendicular illumination
+           using Simpson quadrature */
+        int nParts = 1000;
+        Float stepSize = M_PI / nParts, m=4, theta = stepSize;
+
+        m_normalization = 0; /* 0 at the endpoints */
+        for (int i=1; i<nParts; ++i) {
+            Float value = std::pow(std::cos(theta - M_PI/2), exponent)
+                * std::sin(theta);
+            m_normalization += value * m;
+            theta += stepSize;
+            m = 6-m;
+        }
+        m_normalization = 1/(m_normalization * stepSize/3 * 2 * M_PI);
+
+        /* Integrate the (unnormalized) CDF using the trapezoid rule */
+        std::vector<double> cdf(EIntegrationSteps + 1);
+        double step = M_PI / EIntegrationSteps, prev = 0;
+        cdf[0] = 0;
+        for (int i=1; i<=EIntegrationSteps; ++i) {
+            double value = std::pow(std::cos(-M_PI/2 + i * step), (double) exponent);
+            cdf[i] = cdf[i-1] + (prev + value) * 0.5 * step;
+            prev = value;
+        }
+
+        /* Invert it at regularly spaced sample values */
+        m_invCDF.resize(EResolution + 1);
+        m_invCDF[0] = (Float) (-M_PI/2);
+        m_invCDF[EResolution] = (Float) (M_PI/2);
+        for (int k=1, i=0; k<EResolution; ++k) {
+            double u = k * cdf[EIntegrationSteps] / EResolution;
+            while (cdf[i+1] < u)
+                ++i;
+            double alpha = (u - cdf[i]) / std::max(cdf[i+1] - cdf[i], 1e-300);
+            m_invCDF[k] = (Float) (-M_PI/2 + (i + alpha) * step);
+        }
+    }
+
+    /// Virtual destructor
+    virtual ~KajiyaKayTable() { }
+private:
+    std::vector<Float> m_invCDF;
+    Float m_normalization;
+};
+
+/* Tables of all exponents that were used so far */
+static std::map<Float, ref<KajiyaKayTable> > kajiyaKayTables;
+static ref<Mutex> kajiyaKayTablesMutex = new Mutex();
+
+ref<KajiyaKayTable> KajiyaKayTable::get(Float exponent) {
+    LockGuard lock(kajiyaKayTablesMutex);
+    std::map<Float, ref<KajiyaKayTable> >::iterator it
+        = kajiyaKayTables.find(exponent);
+    if (it != kajiyaKayTables.end())
+        return it->second;
+    ref<KajiyaKayTable> table = new KajiyaKayTable(exponent);
+    kajiyaKayTables[exponent] = table;
+    return table;
+}
+
 /*!\plugin{kkay}{Kajiya-Kay phase function}
  * This plugin implements the Kajiya-Kay \cite{Kajiya1989Rendering}
  * phase function for volumetric rendering of fibers, e.g.
@@ -32,6 +140,12 @@ MTS_NAMESPACE_BEGIN
  *
  * The function is normalized so that it has no energy loss when
  * \code{ks}=1 and illumination arrives perpendicularly to the surface.
+ *
+ * Scattered directions are importance sampled: the specular term
+ * is sampled using a tabulated inverse CDF of its longitudinal profile
+ * and the diffuse term uniformly, with probabilities proportional
+ * to \code{ks} and \code{kd}. The tables and the normalization are
+ * computed once per exponent and shared by all instances.
  */
 class KajiyaKayPhaseFunction : public PhaseFunction {
 public:
@@ -55,21 +169,9 @@ public:
     virtual ~KajiyaKayPhaseFunction() { }
 
     void configure() {
-        /* Compute the normalization for perpendicular illumination
-           using Simpson quadrature */
-        int nParts = 1000;
-        Float stepSize = M_PI / nParts, m=4, theta = stepSize;
-
-        m_normalization = 0; /* 0 at the endpoints */
-        for (int i=1; i<nParts; ++i) {
-            Float value = std::pow(std::cos(theta - M_PI/2), m_exponent)
-                * std::sin(theta);
-            m_normalization += value * m;
-            theta += stepSize;
-            m = 6-m;
-        }
-
-        m_normalization = 1/(m_normalization * stepSize/3 * 2 * M_PI);
+        m_table = KajiyaKayTable::get(m_exponent);
+        m_normalization = m_table->getNormalization();
+        m_specularProb = (m_ks + m_kd > 0) ? m_ks / (m_ks + m_kd) : (Float) 0;
         m_type = EAnisotropic;
         Log(EDebug, "Kajiya-kay normalization factor = %f", m_normalization);
     }
@@ -84,19 +186,63 @@ public:
 
     Float sample(PhaseFunctionSamplingRecord &pRec,
             Sampler *sampler) const {
-        pRec.wo = warp::squareToUniformSphere(sampler->next2D());
-        return eval(pRec) * (4 * M_PI);
+        Float pdf;
+        return sample(pRec, pdf, sampler);
     }
 
     Float sample(PhaseFunctionSamplingRecord &pRec,
             Float &pdf, Sampler *sampler) const {
-        pRec.wo = warp::squareToUniformSphere(sampler->next2D());
-        pdf = warp::squareToUniformSpherePdf();
-        return eval(pRec) * (4 * M_PI);
+        Point2 sample(sampler->next2D());
+
+        if (pRec.mRec.orientation.length() == 0) {
+            pRec.wo = warp::squareToUniformSphere(sample);
+            pdf = warp::squareToUniformSpherePdf();
+            return m_kd;
+        }
+
+        if (sample.x < m_specularProb) {
+            sample.x /= m_specularProb;
+
+            /* Offset the longitudinal angle from the specular
+               cone and fold it back onto [0, pi] */
+            Frame frame(normalize(pRec.mRec.orientation));
+            Float theta = thetaR(pRec, frame) + m_table->sample(sample.x);
+            if (theta < 0)
+                theta = -theta;
+            else if (theta > M_PI)
+                theta = 2 * M_PI - theta;
+
+            Float sinTheta, cosTheta, sinPhi, cosPhi;
+            math::sincos(theta, &sinTheta, &cosTheta);
+            math::sincos(2 * M_PI * sample.y, &sinPhi, &cosPhi);
+            pRec.wo = frame.toWorld(Vector(sinTheta * cosPhi,
+                sinTheta * sinPhi, cosTheta));
+        } else {
+            sample.x = (sample.x - m_specularProb) / (1 - m_specularProb);
+            pRec.wo = warp::squareToUniformSphere(sample);
+        }
+
+        pdf = this->pdf(pRec);
+        if (pdf == 0)
+            return 0.0f;
+        return eval(pRec) / pdf;
     }
 
     Float pdf(const PhaseFunctionSamplingRecord &pRec) const {
-        return warp::squareToUniformSpherePdf();
+        if (pRec.mRec.orientation.length() == 0)
+            return warp::squareToUniformSpherePdf();
+
+        Frame frame(normalize(pRec.mRec.orientation));
+        Float cosTheta = math::clamp(dot(pRec.wo, frame.n), (Float) -1, (Float) 1),
+              sinTheta = std::sqrt(1 - cosTheta*cosTheta),
+              theta = std::acos(cosTheta), theta0 = thetaR(pRec, frame);
+
+        /* Account for all branches of the folded longitudinal angle */
+        Float density = m_table->pdf(theta - theta0) + m_table->pdf(-theta - theta0)
+            + m_table->pdf(2 * M_PI - theta - theta0);
+
+        return m_specularProb * density / (2 * M_PI * std::max(sinTheta, Epsilon))
+            + (1 - m_specularProb) * warp::squareToUniformSpherePdf();
     }
 
     Float eval(const PhaseFunctionSamplingRecord &pRec) const {
@@ -123,10 +269,19 @@ public:
 
     MTS_DECLARE_CLASS()
 private:
+    /// Longitudinal angle of the specular cone
+    inline Float thetaR(const PhaseFunctionSamplingRecord &pRec,
+            const Frame &frame) const {
+        return std::acos(math::clamp(-dot(pRec.wi, frame.n), (Float) -1, (Float) 1));
+    }
+
+    ref<KajiyaKayTable> m_table;
     Float m_ks, m_kd, m_exponent, m_normalization;
+    Float m_specularProb;
 };
 
 
+MTS_IMPLEMENT_CLASS(KajiyaKayTable, false, Object)
 MTS_IMPLEMENT_CLASS_S(KajiyaKayPhaseFunction, false, PhaseFunction)
 MTS_EXPORT_PLUGIN(KajiyaKayPhaseFunction, "Kajiya-Kay phase function");
 MTS_NAMESPACE_END
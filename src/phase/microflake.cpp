@@ -20,9 +20,7 @@
 #include <mitsuba/render/phase.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/sampler.h>
-
-/// Generate a few statistics related to the implementation?
-// #define MICROFLAKE_STATISTICS 1
+#include <mitsuba/core/lock.h>
 
 /// The following file implements the micro-flake distribution
 /// for rough fibers
@@ -30,10 +28,106 @@
 
 MTS_NAMESPACE_BEGIN
 
-#if defined(MICROFLAKE_STATISTICS)
-static StatsCounter avgSampleIterations("Micro-flake model",
-        "Average rejection sampling iterations", EAverage);
-#endif
+/* Tables of all standard deviations that were used so far */
+static std::map<Float, ref<FiberDistributionTable> > fiberTables;
+static ref<Mutex> fiberTablesMutex = new Mutex();
+
+ref<FiberDistributionTable> FiberDistributionTable::get(Float stddev) {
+    LockGuard lock(fiberTablesMutex);
+    std::map<Float, ref<FiberDistributionTable> >::iterator it
+        = fiberTables.find(stddev);
+    if (it != fiberTables.end())
+        return it->second;
+    ref<FiberDistributionTable> table = new FiberDistributionTable(stddev);
+    fiberTables[stddev] = table;
+    return table;
+}
+
+FiberDistributionTable::FiberDistributionTable(Float stddev)
+        : m_distr(stddev) {
+    m_sigmaT.resize(ESigmaTResolution + 1);
+    for (int i=0; i<=ESigmaTResolution; ++i) {
+        Float sinTheta = i / (Float) ESigmaTResolution;
+        m_sigmaT[i] = m_distr.sigmaT(std::sqrt(std::max((Float) 0,
+            1-sinTheta*sinTheta)));
+    }
+
+    /* Flake normals at the corners and centers of the table cells */
+    const int nu = 2*EResolutionU + 1, nv = 2*EResolutionV + 1;
+    std::vector<Vector> normals(nu * nv);
+    for (int i=0; i<nu; ++i) {
+        Float cosTheta = m_distr.sampleCosTheta(i / (Float) (nu-1)),
+              sinTheta = std::sqrt(std::max((Float) 0, 1-cosTheta*cosTheta));
+        for (int j=0; j<nv; ++j) {
+            Float sinPhi, cosPhi;
+            math::sincos(2 * M_PI * j / (Float) (nv-1), &sinPhi, &cosPhi);
+            normals[i*nv + j] = Vector(sinTheta*cosPhi, sinTheta*sinPhi, cosTheta);
+        }
+    }
+
+    m_marginal.resize(ERows);
+    m_conditional.resize(ERows * EResolutionU);
+    std::vector<Float> cells(EResolutionU * EResolutionV);
+    for (int row=0; row<ERows; ++row) {
+        Float cosThetaI = (row + 0.5f) / ERows;
+        Vector wi(std::sqrt(1-cosThetaI*cosThetaI), 0, cosThetaI);
+
+        /* Bound the projected area over each cell */
+        Float mean = 0;
+        for (int u=0; u<EResolutionU; ++u) {
+            for (int v=0; v<EResolutionV; ++v) {
+                Float value = 0;
+                for (int i=0; i<3; ++i)
+                    for (int j=0; j<3; ++j)
+                        value = std::max(value, absDot(wi,
+                            normals[(2*u+i)*nv + 2*v+j]));
+                cells[u*EResolutionV + v] = value;
+                mean += value;
+            }
+        }
+        mean /= EResolutionU * EResolutionV;
+
+        /* Ensure that all directions can be generated
+           (the rows only approximate the incident direction) */
+        DiscreteDistribution &marginal = m_marginal[row];
+        marginal.reserve(EResolutionU);
+        for (int u=0; u<EResolutionU; ++u) {
+            DiscreteDistribution &conditional = m_conditional[row*EResolutionU + u];
+            conditional.reserve(EResolutionV);
+            for (int v=0; v<EResolutionV; ++v)
+                conditional.append(std::max(cells[u*EResolutionV + v], 0.05f * mean));
+            marginal.append(conditional.normalize());
+        }
+        marginal.normalize();
+    }
+}
+
+Vector FiberDistributionTable::sampleVisible(const Vector &wi,
+        Point2 sample, Float &weight) const {
+    Float cosThetaI = Frame::cosTheta(wi);
+    int row = std::min((int) (std::abs(cosThetaI) * ERows), (int) ERows - 1);
+
+    Float pdfU, pdfV;
+    size_t u = m_marginal[row].sampleReuse(sample.x, pdfU);
+    size_t v = m_conditional[row*EResolutionU + u].sampleReuse(sample.y, pdfV);
+
+    /* The tables are symmetric with respect to the sign of cos(theta) */
+    Float xi = (u + sample.x) / EResolutionU;
+    if (cosThetaI < 0)
+        xi = 1 - xi;
+
+    Float cosTheta = m_distr.sampleCosTheta(xi),
+          sinTheta = std::sqrt(std::max((Float) 0, 1-cosTheta*cosTheta)),
+          phi = 2 * M_PI * (v + sample.y) / EResolutionV + std::atan2(wi.y, wi.x),
+          sinPhi, cosPhi;
+    math::sincos(phi, &sinPhi, &cosPhi);
+    Vector H(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta);
+
+    /* The flake distribution is uniform in the primary sample space */
+    Float pdf = pdfU * pdfV * (EResolutionU * EResolutionV);
+    weight = absDot(wi, H) / (sigmaT(cosThetaI) * pdf);
+    return H;
+}
 
 /*!\plugin{microflake}{Micro-flake phase function}
  * \parameters{
@@ -82,11 +176,13 @@ public:
     MicroflakePhaseFunction(const Properties &props) : PhaseFunction(props) {
         /// Standard deviation of the flake distribution
         m_fiberDistr = GaussianFiberDistribution(props.getFloat("stddev"));
+        m_table = FiberDistributionTable::get(m_fiberDistr.getStdDev());
     }
 
     MicroflakePhaseFunction(Stream *stream, InstanceManager *manager)
         : PhaseFunction(stream, manager) {
         m_fiberDistr = GaussianFiberDistribution(stream->readFloat());
+        m_table = FiberDistributionTable::get(m_fiberDistr.getStdDev());
         configure();
     }
 
@@ -122,7 +218,7 @@ public:
             return 0.0f;
 
         return 0.5f * m_fiberDistr.pdfCosTheta(Frame::cosTheta(H)/length)
-                / m_fiberDistr.sigmaT(Frame::cosTheta(wi));
+                / m_table->sigmaT(Frame::cosTheta(wi));
     }
 
     inline Float sample(PhaseFunctionSamplingRecord &pRec, Sampler *sampler) const {
@@ -139,44 +235,23 @@ public:
         Frame frame(pRec.mRec.orientation);
         Vector wi = frame.toLocal(pRec.wi);
 
-        #if defined(MICROFLAKE_STATISTICS)
-            avgSampleIterations.incrementBase();
-        #endif
-
-        int iterations = 0, maxIterations = 1000;
-        while (true) {
-            Vector H = m_fiberDistr.sample(sampler->next2D());
-            #if defined(MICROFLAKE_STATISTICS)
-                ++avgSampleIterations;
-            #endif
-            ++iterations;
-
-            if (sampler->next1D() < absDot(wi, H)) {
-                Vector wo = H*(2*dot(wi, H)) - wi;
-                pRec.wo = frame.toWorld(wo);
-                break;
-            }
-
-            if (iterations >= maxIterations) {
-                Log(EWarn, "Sample generation unsuccessful after %i iterations"
-                    " (dp=%f, fiberOrientation=%s, wi=%s)", iterations,
-                    absDot(pRec.wi, pRec.mRec.orientation),
-                    pRec.mRec.orientation.toString().c_str(),
-                    pRec.wi.toString().c_str());
-                return 0.0f;
-            }
-        }
+        /* Sample a visible flake normal and reflect */
+        Float weight;
+        Vector H = m_table->sampleVisible(wi, sampler->next2D(), weight);
+        Vector wo = H*(2*dot(wi, H)) - wi;
+        pRec.wo = frame.toWorld(wo);
 
-        return 1.0f;
+        return weight;
     }
 
     Float sample(PhaseFunctionSamplingRecord &pRec,
             Float &pdf, Sampler *sampler) const {
-        if (sample(pRec, sampler) == 0) {
+        Float weight = sample(pRec, sampler);
+        if (weight == 0) {
             pdf = 0; return 0.0f;
         }
         pdf = eval(pRec);
-        return 1.0f;
+        return weight;
     }
 
     bool needsDirectionallyVaryingCoefficients() const { return true; }
@@ -184,7 +259,7 @@ public:
     Float sigmaDir(Float cosTheta) const {
         // Scaled such that replacing an isotropic phase function with an
         // isotropic microflake distribution does not cause changes
-        return 2 * m_fiberDistr.sigmaT(cosTheta);
+        return 2 * m_table->sigmaT(cosTheta);
     }
 
     Float sigmaDirMax() const {
@@ -202,8 +277,10 @@ public:
     MTS_DECLARE_CLASS()
 private:
     GaussianFiberDistribution m_fiberDistr;
+    ref<FiberDistributionTable> m_table;
 };
 
+MTS_IMPLEMENT_CLASS(FiberDistributionTable, false, Object)
 MTS_IMPLEMENT_CLASS_S(MicroflakePhaseFunction, false, PhaseFunction)
 MTS_EXPORT_PLUGIN(MicroflakePhaseFunction, "Microflake phase function");
 MTS_NAMESPACE_END
@@ -19,9 +19,7 @@
 #if !defined(__MICROFLAKE_FIBER_DIST_H)
 #define __MICROFLAKE_FIBER_DIST_H
 
-#include <mitsuba/core/statistics.h>
-#include <mitsuba/core/brent.h>
-#include <boost/bind.hpp>
+#include <mitsuba/core/pmf.h>
 #include <boost/math/special_functions/erf.hpp>
 
 MTS_NAMESPACE_BEGIN
@@ -181,11 +179,6 @@ double sigmaT_fiberDist(double stddev, double sinTheta) {
     return result;
 }
 
-#if defined(MICROFLAKE_STATISTICS)
-static StatsCounter avgBrentFunEvals("Micro-flake model",
-        "Average Brent solver function evaluations", EAverage);
-#endif
-
 
 /**
  * \brief Flake distribution for simulating rough fibers
@@ -255,19 +248,18 @@ public:
     /**
      * \brief Apply the inversion method to sample \cos\theta given
      * a uniformly distributed r.v. \xi on [0, 1]
+     *
+     * The longitudinal CDF is an error function, hence this
+     * amounts to a single evaluation of its inverse.
      */
-    Vector sample(const Point2 &sample) const {
-        BrentSolver brentSolver(100, 1e-6f);
-        BrentSolver::Result result = brentSolver.solve(
-            boost::bind(&GaussianFiberDistribution::cdfFunctor,
-                this, sample.x, _1), -1, 1);
-        SAssert(result.success);
-
-        #if defined(MICROFLAKE_STATISTICS)
-            avgBrentFunEvals.incrementBase();
-        #endif
+    inline Float sampleCosTheta(Float xi) const {
+        Float cosTheta = SQRT_TWO * m_stddev * math::erfinv((1 - 2*xi) / m_c1);
+        return math::clamp(cosTheta, (Float) -1, (Float) 1);
+    }
 
-        Float cosTheta = result.x,
+    /// Sample a flake normal from the distribution
+    Vector sample(const Point2 &sample) const {
+        Float cosTheta = sampleCosTheta(sample.x),
               sinTheta = std::sqrt(std::max((Float) 0, 1-cosTheta*cosTheta)),
               phi = 2 * M_PI * sample.y,
               sinPhi = std::sin(phi), cosPhi = std::cos(phi);
@@ -290,13 +282,6 @@ protected:
             mts_erf(cosTheta / (SQRT_TWO * m_stddev)) * m_c1);
     }
 
-    Float cdfFunctor(Float xi, Float cosTheta) const {
-        #if defined(MICROFLAKE_STATISTICS)
-            ++avgBrentFunEvals;
-        #endif
-        return cdf(cosTheta)-xi;
-    }
-
 protected:
     Float m_stddev;
     Float m_normalization;
@@ -304,6 +289,71 @@ protected:
     Float m_coeffs[FIBERDIST_SIGMA_T_COEFFS];
 };
 
+/**
+ * \brief Precomputed tables for a \ref GaussianFiberDistribution
+ *
+ * This class tabulates \sigma_t in terms of \sin\theta, and stores
+ * a piecewise constant approximation of the distribution of visible
+ * flake normals for a range of incident directions. The latter is
+ * defined over the primary sample space of \ref
+ * GaussianFiberDistribution::sample(), where the flake distribution
+ * itself is uniform, so that its resolution adapts to the standard
+ * deviation. Since the tables only depend on the standard deviation,
+ * instances are shared by all phase functions with the same
+ * parameters (see \ref get()).
+ */
+class FiberDistributionTable : public Object {
+public:
+    enum {
+        /// Number of \sigma_t entries on [0, 1]
+        ESigmaTResolution = 256,
+        /// Number of tabulated incident elevations
+        ERows = 32,
+        /// Resolution of the sampling tables (longitudinal / azimuthal)
+        EResolutionU = 64,
+        EResolutionV = 64
+    };
+
+    /// Return the (shared) tables for a given standard deviation
+    static ref<FiberDistributionTable> get(Float stddev);
+
+    /// Return the underlying flake distribution
+    inline const GaussianFiberDistribution &getDistribution() const { return m_distr; }
+
+    /// Evaluate \sigma_t as a function of \cos\theta
+    inline Float sigmaT(Float cosTheta) const {
+        Float sinTheta = std::sqrt(std::max(
+                (Float) 0, 1-cosTheta*cosTheta)),
+              pos = std::min(sinTheta, (Float) 1) * ESigmaTResolution;
+        int idx = std::min((int) pos, (int) ESigmaTResolution - 1);
+        Float alpha = pos - idx;
+        return (1-alpha) * m_sigmaT[idx] + alpha * m_sigmaT[idx+1];
+    }
+
+    /**
+     * \brief Sample a flake normal proportional to its projected
+     * area as seen from \c wi (specified in the fiber's frame)
+     *
+     * \param weight
+     *     Receives the ratio of the exact density of visible normals and
+     *     the density of the generated sample (approximately one)
+     */
+    Vector sampleVisible(const Vector &wi, Point2 sample, Float &weight) const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Create the tables for a given stddev
+    FiberDistributionTable(Float stddev);
+
+    /// Virtual destructor
+    virtual ~FiberDistributionTable() { }
+private:
+    GaussianFiberDistribution m_distr;
+    std::vector<Float> m_sigmaT;
+    std::vector<DiscreteDistribution> m_marginal;
+    std::vector<DiscreteDistribution> m_conditional;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MICROFLAKE_FIBER_DIST_H */
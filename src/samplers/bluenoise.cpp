@@ -0,0 +1,327 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/sampler.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/qmc.h>
+#include <mitsuba/core/lock.h>
+
+/* Resolution of the blue noise mask, which is tiled across the image.
+   Must be a power of two */
+#define MASK_RESOLUTION 64
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{bluenoise}{Blue-noise dithered sampler}
+ * \order{7}
+ * \parameters{
+ *     \parameter{sampleCount}{\Integer}{
+ *       Number of samples per pixel \default{4}
+ *     }
+ *     \parameter{scramble}{\Integer}{
+ *       Scramble value that can be used to break up temporally coherent
+ *       noise patterns. For stills, this parameter is irrelevant. When rendering
+ *       an animation, simply set it to the current frame index. \default{0}
+ *     }
+ * }
+ *
+ * This plugin is intended for interactive previews at very low sample
+ * counts (e.g. 1--4 samples per pixel). At such counts, the remaining error of
+ * the other samplers is white noise, which looks clumpy. This sampler instead
+ * distributes the error of neighboring pixels as blue noise, which the eye
+ * perceives as much smoother, by using the blue-noise dithered sampling scheme
+ * by Georgiev and Fajardo \cite{Georgiev2016Blue}.
+ *
+ * Within each pixel, every 2D sample dimension is filled with a stratified
+ * Hammersley point set (1D dimensions are simply stratified), and the
+ * samples are permuted differently for each dimension to avoid correlations.
+ * The resulting points are then shifted on the torus (i.e. Cranley-Patterson
+ * rotated) by an offset that is read from a blue noise mask with a
+ * dimension-dependent position. Neighboring pixels therefore receive
+ * offsets that are as different as possible. Each dimension costs a
+ * constant amount of work, and no per-pixel tables must be generated.
+ *
+ * The $64\times 64$ blue noise mask is computed at startup using a variant
+ * of the void-and-cluster method \cite{Ulichney1993Void}, which takes a
+ * fraction of a second.
+ *
+ * The sampler is deterministic: subsequent runs of Mitsuba will compute
+ * the same image, even when rendering with multiple threads and/or machines.
+ *
+ * \remarks{
+ *   \item As the sample count grows, the advantage over the \pluginref{ldsampler}
+ *   and \pluginref{sobol} plugins vanishes. Use those for final renderings.
+ *   \item This sampler is incompatible with Metropolis Light Transport (all variants).
+ * }
+ */
+class BlueNoiseSampler : public Sampler {
+public:
+    BlueNoiseSampler() : Sampler(Properties()) { }
+
+    BlueNoiseSampler(const Properties &props) : Sampler(props) {
+        /* Number of samples per pixel when used with a sampling-based integrator */
+        m_sampleCount = props.getSize("sampleCount", 4);
+
+        /* Scramble value, which can be used to break up temporally coherent
+           noise patterns when rendering the frames of an animation. */
+        m_scramble = (uint32_t) props.getInteger("scramble", 0);
+
+        m_pixelPosition = Point2i(0);
+        m_dimension = 0;
+    }
+
+    BlueNoiseSampler(Stream *stream, InstanceManager *manager)
+     : Sampler(stream, manager) {
+        m_scramble = stream->readUInt();
+        m_pixelPosition = Point2i(0);
+        m_dimension = 0;
+        configure();
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Sampler::serialize(stream, manager);
+        stream->writeUInt(m_scramble);
+    }
+
+    void configure() {
+        Sampler::configure();
+
+        /* Only create one mask per address space */
+        LockGuard guard(m_globalMaskMutex);
+        if (m_globalMask.empty())
+            computeMask(m_globalMask);
+        m_mask = &m_globalMask[0];
+    }
+
+    ref<Sampler> clone() {
+        ref<BlueNoiseSampler> sampler = new BlueNoiseSampler();
+        sampler->m_sampleCount = m_sampleCount;
+        sampler->m_sampleIndex = m_sampleIndex;
+        sampler->m_dimension = m_dimension;
+        sampler->m_scramble = m_scramble;
+        sampler->m_pixelPosition = m_pixelPosition;
+        sampler->m_mask = m_mask;
+        for (size_t i=0; i<m_req1D.size(); ++i)
+            sampler->request1DArray(m_req1D[i]);
+        for (size_t i=0; i<m_req2D.size(); ++i)
+            sampler->request2DArray(m_req2D[i]);
+        return sampler.get();
+    }
+
+    /**
+     * \brief Rank the pixels of a toroidal mask such that the pixels of
+     * every prefix of the ranking are distributed as blue noise
+     *
+     * Simplified void-and-cluster method: starting from an empty mask, the
+     * pixel with the lowest energy (i.e. the center of the largest void) is
+     * repeatedly added, after which its Gaussian energy footprint is
+     * splatted onto the neighboring pixels.
+     */
+    static void computeMask(std::vector<Float> &mask) {
+        const int res = MASK_RESOLUTION, n = res * res, radius = 6;
+        const Float sigma = 1.9f;
+
+        Float kernel[2*radius+1][2*radius+1];
+        for (int y=-radius; y<=radius; ++y)
+            for (int x=-radius; x<=radius; ++x)
+                kernel[y+radius][x+radius] = math::fastexp(
+                    -(x*x + y*y) / (2 * sigma * sigma));
+
+        /* Tiny random energies break the ties between equivalent voids */
+        ref<Random> random = new Random(0x2c9277b5ULL);
+        std::vector<Float> energy(n);
+        random->fill(&energy[0], n);
+        for (int i=0; i<n; ++i)
+            energy[i] *= 1e-3f;
+
+        std::vector<bool> taken(n, false);
+        mask.resize(n);
+
+        for (int rank=0; rank<n; ++rank) {
+            int best = -1;
+            Float bestEnergy = std::numeric_limits<Float>::infinity();
+            for (int i=0; i<n; ++i) {
+                if (!taken[i] && energy[i] < bestEnergy) {
+                    bestEnergy = energy[i];
+                    best = i;
+                }
+            }
+
+            taken[best] = true;
+            mask[best] = (rank + 0.5f) / n;
+
+            int bx = best % res, by = best / res;
+            for (int y=-radius; y<=radius; ++y) {
+                int row = ((by + y) & (res-1)) * res;
+                for (int x=-radius; x<=radius; ++x)
+                    energy[row + ((bx + x) & (res-1))] += kernel[y+radius][x+radius];
+            }
+        }
+    }
+
+    /**
+     * \brief Pseudorandom permutation of the integers [0, l) (Kensler,
+     * ``Correlated Multi-Jittered Sampling'', 2013)
+     */
+    static inline uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+        uint32_t w = l - 1;
+        w |= w >> 1; w |= w >> 2; w |= w >> 4;
+        w |= w >> 8; w |= w >> 16;
+        do {
+            i ^= p; i *= 0xe170893d;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8; i *= 0x0929eb3f;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1; i *= 1 | p >> 27;
+            i *= 0x6935fa69;
+            i ^= (i & w) >> 11; i *= 0x74dcb303;
+            i ^= (i & w) >> 2; i *= 0x9e501cc3;
+            i ^= (i & w) >> 2; i *= 0xc860a3df;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= l);
+        return (i + p) % l;
+    }
+
+    /*
+     * The 64 bits of a per-dimension hash are used as follows:
+     * bits 0-11 select the toroidal shift of the mask, bits 12-31
+     * seed the permutation, and bits 32-63 provide the jitter.
+     */
+
+    /// Permutation seed for the given dimension hash
+    static inline uint32_t permutationSeed(uint64_t hash) {
+        return ((uint32_t) hash >> 12) * 0x9e3779b9U;
+    }
+
+    /// Blue noise offset of the current pixel for the given dimension hash
+    inline Float offset(uint64_t hash) const {
+        /* Each dimension reads the mask at a different toroidal shift,
+           and adds a shared jitter to obtain a continuous offset */
+        uint32_t x = ((uint32_t) m_pixelPosition.x + (uint32_t) hash) & (MASK_RESOLUTION-1);
+        uint32_t y = ((uint32_t) m_pixelPosition.y + (uint32_t) (hash >> 6)) & (MASK_RESOLUTION-1);
+        Float jitter = ((uint32_t) (hash >> 32) * (1.0f / 4294967296.0f) - 0.5f)
+            / (MASK_RESOLUTION * MASK_RESOLUTION);
+        return m_mask[x + y * MASK_RESOLUTION] + jitter;
+    }
+
+    /// Toroidal shift of a value in [0, 1)
+    static inline Float rotate(Float value, Float offset) {
+        value += offset;
+        value -= std::floor(value);
+        return std::min(value, ONE_MINUS_EPS);
+    }
+
+    /// Fill in a stratified 1D sample set with the given number of entries
+    inline void generate1D(Float *samples, size_t count, uint32_t dim) {
+        uint64_t hash = sampleTEA(dim, m_scramble);
+        Float off = offset(hash), invCount = (Float) 1 / count;
+        for (size_t i=0; i<count; ++i) {
+            uint32_t j = permute((uint32_t) i, (uint32_t) count, permutationSeed(hash));
+            samples[i] = rotate((j + 0.5f) * invCount, off);
+        }
+    }
+
+    /// Fill in a 2D Hammersley sample set with the given number of entries
+    inline void generate2D(Point2 *samples, size_t count, uint32_t dim) {
+        uint64_t hash1 = sampleTEA(dim, m_scramble), hash2 = sampleTEA(dim + 1, m_scramble);
+        Float off1 = offset(hash1), off2 = offset(hash2), invCount = (Float) 1 / count;
+        for (size_t i=0; i<count; ++i) {
+            uint32_t j = permute((uint32_t) i, (uint32_t) count, permutationSeed(hash1));
+            samples[i] = Point2(
+                rotate((j + 0.5f) * invCount, off1),
+                rotate(radicalInverseFast(0, j), off2));
+        }
+    }
+
+    void generate(const Point2i &pos) {
+        m_pixelPosition = pos;
+
+        /* Sample arrays use dimensions that are disjoint from next1D()/next2D() */
+        uint32_t dim = 0x80000000U;
+        for (size_t i=0; i<m_req1D.size(); i++) {
+            generate1D(m_sampleArrays1D[i], m_sampleCount * m_req1D[i], dim);
+            dim += 1;
+        }
+        for (size_t i=0; i<m_req2D.size(); i++) {
+            generate2D(m_sampleArrays2D[i], m_sampleCount * m_req2D[i], dim);
+            dim += 2;
+        }
+
+        setSampleIndex(0);
+    }
+
+    void advance() {
+        setSampleIndex(m_sampleIndex + 1);
+    }
+
+    void setSampleIndex(size_t sampleIndex) {
+        m_sampleIndex = sampleIndex;
+        m_dimension = 0;
+        m_dimension1DArray = m_dimension2DArray = 0;
+
+        /* Sample indices beyond the sample count start a new, differently
+           scrambled epoch of the same stratified point set */
+        m_index = (uint32_t) (m_sampleIndex % m_sampleCount);
+        m_epoch = (uint32_t) (m_sampleIndex / m_sampleCount) * 0x9e3779b9U;
+    }
+
+    Float next1D() {
+        uint64_t hash = sampleTEA(m_dimension++, m_scramble ^ m_epoch);
+        uint32_t j = permute(m_index, (uint32_t) m_sampleCount, permutationSeed(hash));
+        return rotate((j + 0.5f) / m_sampleCount, offset(hash));
+    }
+
+    Point2 next2D() {
+        uint64_t hash1 = sampleTEA(m_dimension++, m_scramble ^ m_epoch);
+        uint64_t hash2 = sampleTEA(m_dimension++, m_scramble ^ m_epoch);
+        uint32_t j = permute(m_index, (uint32_t) m_sampleCount, permutationSeed(hash1));
+        return Point2(
+            rotate((j + 0.5f) / m_sampleCount, offset(hash1)),
+            rotate(radicalInverseFast(0, j), offset(hash2)));
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "BlueNoiseSampler[" << endl
+            << "  sampleCount = " << m_sampleCount << "," << endl
+            << "  sampleIndex = " << m_sampleIndex << "," << endl
+            << "  scramble = " << m_scramble << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    uint32_t m_dimension;
+    uint32_t m_scramble;
+    uint32_t m_index, m_epoch;
+    Point2i m_pixelPosition;
+    const Float *m_mask;
+
+    static std::vector<Float> m_globalMask;
+    static ref<Mutex> m_globalMaskMutex;
+};
+
+ref<Mutex> BlueNoiseSampler::m_globalMaskMutex = new Mutex();
+std::vector<Float> BlueNoiseSampler::m_globalMask;
+
+MTS_IMPLEMENT_CLASS_S(BlueNoiseSampler, false, Sampler)
+MTS_EXPORT_PLUGIN(BlueNoiseSampler, "Blue-noise dithered sampler");
+MTS_NAMESPACE_END
@@ -140,6 +140,8 @@ public:
         m_primePowers = Vector2i(stream);
         m_primeExponents = Vector2i(stream);
         m_pixelPosition = Point2i(0);
+        m_blockOffset = Point2i(0);
+        m_blockSize = Vector2i(0);
         configure();
     }
 
@@ -173,6 +175,8 @@ public:
         sampler->m_pixelPosition = m_pixelPosition;
         sampler->m_scramble = m_scramble;
         sampler->m_permutations = m_permutations;
+        sampler->m_blockOffset = Point2i(0);
+        sampler->m_blockSize = Vector2i(0);
         for (size_t i=0; i<m_req1D.size(); ++i)
             sampler->request1DArray(m_req1D[i]);
         for (size_t i=0; i<m_req2D.size(); ++i)
@@ -269,6 +273,33 @@ public:
         }
         m_pixelPosition = Point2i(0);
         m_offset = 0;
+
+        /* Invalidate the cached pixel offsets */
+        m_blockOffset = Point2i(0);
+        m_blockSize = Vector2i(0);
+    }
+
+    /// Offset contributed by the given pixel coordinate along one axis (modulo the stride)
+    inline uint64_t axisOffset(int axis, int pos) {
+        uint64_t offset = inverseScrambledRadicalInverse(primeTable[axis], pos % MAX_RESOLUTION,
+                m_primeExponents[axis], m_permutations.get()
+                ? m_permutations->getInversePermutation(axis) : NULL);
+        return (offset * (m_stride / m_primePowers[axis]) * m_multInverse[axis]) % m_stride;
+    }
+
+    void setBlock(const Point2i &offset, const Vector2i &size) {
+        if (m_stride <= 1 || (offset == m_blockOffset && size == m_blockSize))
+            return;
+
+        /* The Chinese remainder theorem combines the axis offsets additively,
+           hence it suffices to precompute them for each row and column */
+        m_blockOffset = offset;
+        m_blockSize = size;
+        m_blockOffsets[0].resize(size.x);
+        m_blockOffsets[1].resize(size.y);
+        for (int i=0; i<2; ++i)
+            for (int j=0; j<size[i]; ++j)
+                m_blockOffsets[i][j] = axisOffset(i, offset[i] + j);
     }
 
     void generate(const Point2i &pos) {
@@ -280,15 +311,15 @@ public:
         m_offset = 0;
 
         if (m_stride > 1) {
+            Vector2i rel = pos - m_blockOffset;
+            bool cached = rel.x >= 0 && rel.y >= 0 && rel.x < m_blockSize.x && rel.y < m_blockSize.y;
+
             for (int i=0; i<2; ++i) {
                 m_pixelPosition[i] = pos[i] % MAX_RESOLUTION;
 
                 /* Determine axis offset along each requested coordinate independently and
                    use the chinese remainder theorem to solve for a combined offset */
-                uint64_t offset = inverseScrambledRadicalInverse(primeTable[i], m_pixelPosition[i],
-                        m_primeExponents[i], m_permutations.get()
-                        ? m_permutations->getInversePermutation(i) : NULL);
-                m_offset += offset * (m_stride / m_primePowers[i]) * m_multInverse[i];
+                m_offset += cached ? m_blockOffsets[i][rel[i]] : axisOffset(i, pos[i]);
             }
             m_offset %= m_stride;
         }
@@ -383,6 +414,45 @@ public:
         return Point2(value1, value2);
     }
 
+    void next1DBatch(Float *values, size_t count) {
+        /* Only locate the current sample once for the whole batch */
+        uint64_t index = m_offset + m_stride * m_sampleIndex;
+
+        for (size_t i=0; i<count; ++i) {
+            /* Skip over dimensions that were reserved to arrays */
+            if (m_dimension >= m_arrayStartDim && m_dimension < m_arrayEndDim)
+                m_dimension = m_arrayEndDim;
+            if (m_dimension >= primeTableSize)
+                Log(EError, "Lookup dimension exceeds the prime number table size! "
+                    "You may have to reduce the 'maxDepth' parameter of your integrator.");
+
+            values[i] = nextFloat(index);
+        }
+    }
+
+    void next2DBatch(Point2 *values, size_t count) {
+        /* The first dimension pair may need to be mapped into the pixel */
+        if (count > 0 && m_dimension == 0) {
+            *values++ = next2D();
+            --count;
+        }
+
+        uint64_t index = m_offset + m_stride * m_sampleIndex;
+
+        for (size_t i=0; i<count; ++i) {
+            /* Skip over dimensions that were reserved to arrays */
+            if (m_dimension + 1 >= m_arrayStartDim && m_dimension < m_arrayEndDim)
+                m_dimension = m_arrayEndDim;
+            if (m_dimension + 1 >= primeTableSize)
+                Log(EError, "Lookup dimension exceeds the prime number table size! "
+                    "You may have to reduce the 'maxDepth' parameter of your integrator.");
+
+            Float value1 = nextFloat(index);
+            Float value2 = nextFloat(index);
+            values[i] = Point2(value1, value2);
+        }
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "HaltonSampler[" << endl
@@ -406,6 +476,10 @@ private:
 
     /* Faure permutation */
     ref<const PermutationStorage> m_permutations;
+    /* Cached per-column and per-row offsets of the current block (see setBlock()) */
+    std::vector<uint64_t> m_blockOffsets[2];
+    Point2i m_blockOffset;
+    Vector2i m_blockSize;
     static ref<const PermutationStorage> m_globalPermutations;
     static ref<Mutex> m_globalPermutationsMutex;
 
@@ -280,6 +280,50 @@ public:
         return Point2(value1, value2);
     }
 
+    void next1DBatch(Float *values, size_t count) {
+        if (count > 0 && m_sampleIndex >= m_samplesPerBatch)
+            Log(EError, "Sample index exceeded the maximum count!");
+
+        /* Only locate the current sample once for the whole batch */
+        uint64_t index = m_offset + m_stride * m_sampleIndex;
+
+        for (size_t i=0; i<count; ++i) {
+            /* Skip over dimensions that were reserved to arrays */
+            if (m_dimension >= m_arrayStartDim && m_dimension < m_arrayEndDim)
+                m_dimension = m_arrayEndDim;
+            if (m_dimension >= primeTableSize)
+                Log(EError, "Lookup dimension exceeds the prime number table size! "
+                    "You may have to reduce the 'maxDepth' parameter of your integrator.");
+
+            values[i] = nextFloat(index);
+        }
+    }
+
+    void next2DBatch(Point2 *values, size_t count) {
+        /* The first dimension pair may need to be mapped into the pixel */
+        if (count > 0 && m_dimension == 0) {
+            *values++ = next2D();
+            --count;
+        }
+        if (count > 0 && m_sampleIndex >= m_samplesPerBatch)
+            Log(EError, "Sample index exceeded the maximum count!");
+
+        uint64_t index = m_offset + m_stride * m_sampleIndex;
+
+        for (size_t i=0; i<count; ++i) {
+            /* Skip over dimensions that were reserved to arrays */
+            if (m_dimension + 1 >= m_arrayStartDim && m_dimension < m_arrayEndDim)
+                m_dimension = m_arrayEndDim;
+            if (m_dimension + 1 >= primeTableSize)
+                Log(EError, "Lookup dimension exceeds the prime number table size! "
+                    "You may have to reduce the 'maxDepth' parameter of your integrator.");
+
+            Float value1 = nextFloat(index);
+            Float value2 = nextFloat(index);
+            values[i] = Point2(value1, value2);
+        }
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "HammersleySampler[" << endl
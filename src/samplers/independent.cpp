@@ -18,6 +18,9 @@
 
 #include <mitsuba/render/sampler.h>
 
+/// Number of random numbers that the independent sampler generates at a time
+#define MTS_INDEPENDENT_BUFFER_SIZE 256
+
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{independent}{Independent sampler}
@@ -50,16 +53,17 @@ MTS_NAMESPACE_BEGIN
  */
 class IndependentSampler : public Sampler {
 public:
-    IndependentSampler() : Sampler(Properties()) { }
+    IndependentSampler() : Sampler(Properties()), m_bufferPos(MTS_INDEPENDENT_BUFFER_SIZE) { }
 
-    IndependentSampler(const Properties &props) : Sampler(props) {
+    IndependentSampler(const Properties &props) : Sampler(props),
+            m_bufferPos(MTS_INDEPENDENT_BUFFER_SIZE) {
         /* Number of samples per pixel when used with a sampling-based integrator */
         m_sampleCount = props.getSize("sampleCount", 4);
         m_random = new Random();
     }
 
     IndependentSampler(Stream *stream, InstanceManager *manager)
-     : Sampler(stream, manager) {
+     : Sampler(stream, manager), m_bufferPos(MTS_INDEPENDENT_BUFFER_SIZE) {
         m_random = static_cast<Random *>(manager->getInstance(stream));
     }
 
@@ -81,27 +85,38 @@ public:
 
     void generate(const Point2i &) {
         for (size_t i=0; i<m_req1D.size(); i++)
-            for (size_t j=0; j<m_sampleCount * m_req1D[i]; ++j)
-                m_sampleArrays1D[i][j] = m_random->nextFloat();
+            m_random->fill(m_sampleArrays1D[i], m_sampleCount * m_req1D[i]);
         for (size_t i=0; i<m_req2D.size(); i++)
             for (size_t j=0; j<m_sampleCount * m_req2D[i]; ++j)
-                m_sampleArrays2D[i][j] = Point2(
-                    m_random->nextFloat(),
-                    m_random->nextFloat());
+                m_sampleArrays2D[i][j] = next2D();
         m_sampleIndex = 0;
         m_dimension1DArray = m_dimension2DArray = 0;
     }
 
+    /// Return the next buffered random number, refilling the buffer when needed
+    inline Float nextFloat() {
+        if (EXPECT_NOT_TAKEN(m_bufferPos == MTS_INDEPENDENT_BUFFER_SIZE)) {
+            m_random->fill(m_buffer, MTS_INDEPENDENT_BUFFER_SIZE);
+            m_bufferPos = 0;
+        }
+        return m_buffer[m_bufferPos++];
+    }
+
     Float next1D() {
-        return m_random->nextFloat();
+        return nextFloat();
     }
 
     Point2 next2D() {
-        Float value1 = m_random->nextFloat();
-        Float value2 = m_random->nextFloat();
+        Float value1 = nextFloat();
+        Float value2 = nextFloat();
         return Point2(value1, value2);
     }
 
+    void next1DBatch(Float *values, size_t count) {
+        for (size_t i=0; i<count; ++i)
+            values[i] = nextFloat();
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "IndependentSampler[" << endl
@@ -113,6 +128,9 @@ public:
     MTS_DECLARE_CLASS()
 private:
     ref<Random> m_random;
+    /* Random numbers generated in bulk by next1D() and next2D() */
+    Float m_buffer[MTS_INDEPENDENT_BUFFER_SIZE];
+    size_t m_bufferPos;
 };
 
 MTS_IMPLEMENT_CLASS_S(IndependentSampler, false, Sampler)
@@ -227,6 +227,26 @@ public:
             return Point2(m_random->nextFloat(), m_random->nextFloat());
     }
 
+    void next1DBatch(Float *values, size_t count) {
+        Assert(m_sampleIndex < m_sampleCount);
+        for (size_t i=0; i<count; ++i) {
+            if (m_dimension1D < m_maxDimension)
+                values[i] = m_samples1D[m_dimension1D++][m_sampleIndex];
+            else
+                values[i] = m_random->nextFloat();
+        }
+    }
+
+    void next2DBatch(Point2 *values, size_t count) {
+        Assert(m_sampleIndex < m_sampleCount);
+        for (size_t i=0; i<count; ++i) {
+            if (m_dimension2D < m_maxDimension)
+                values[i] = m_samples2D[m_dimension2D++][m_sampleIndex];
+            else
+                values[i] = Point2(m_random->nextFloat(), m_random->nextFloat());
+        }
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "LowDiscrepancySampler[" << endl
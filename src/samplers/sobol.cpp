@@ -104,6 +104,9 @@ public:
         m_resolution = 1; m_logResolution = 0;
         m_arrayStartDim = m_arrayEndDim = 5;
         m_pixelPosition = Point2i(0);
+        m_blockOffset = Point2i(0);
+        m_blockSize = Vector2i(0);
+        m_pixelCached = false;
     }
 
     SobolSampler(Stream *stream, InstanceManager *manager)
@@ -114,6 +117,9 @@ public:
         m_arrayStartDim = stream->readUInt();
         m_arrayEndDim = stream->readUInt();
         m_pixelPosition = Point2i(0);
+        m_blockOffset = Point2i(0);
+        m_blockSize = Vector2i(0);
+        m_pixelCached = false;
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -137,6 +143,9 @@ public:
         sampler->m_pixelPosition = m_pixelPosition;
         sampler->m_arrayStartDim = m_arrayStartDim;
         sampler->m_arrayEndDim = m_arrayEndDim;
+        sampler->m_blockOffset = Point2i(0);
+        sampler->m_blockSize = Vector2i(0);
+        sampler->m_pixelCached = false;
         for (size_t i=0; i<m_req1D.size(); ++i)
             sampler->request1DArray(m_req1D[i]);
         for (size_t i=0; i<m_req2D.size(); ++i)
@@ -155,6 +164,54 @@ public:
             m_resolution = (Float) resolution;
             m_logResolution = math::log2i(resolution);
         }
+
+        /* Invalidate the cached index mappings */
+        m_frameIndices.clear();
+        m_blockSize = Vector2i(0);
+        m_pixelCached = false;
+    }
+
+    void setBlock(const Point2i &offset, const Vector2i &size) {
+        m_pixelCached = false;
+        if (m_logResolution <= 1) {
+            m_blockSize = Vector2i(0);
+            return;
+        }
+
+        /* The frame-dependent part of the index lookup is shared by all
+           pixels. Make sure that it covers the sample arrays as well */
+        size_t frameCount = m_sampleCount;
+        for (size_t i=0; i<m_req1D.size(); ++i)
+            frameCount = std::max(frameCount, m_sampleCount * m_req1D[i]);
+        for (size_t i=0; i<m_req2D.size(); ++i)
+            frameCount = std::max(frameCount, m_sampleCount * m_req2D[i]);
+
+        if (m_frameIndices.size() != frameCount) {
+            m_frameIndices.resize(frameCount);
+            for (size_t j=0; j<frameCount; ++j)
+                m_frameIndices[j] = sobol::look_up_frame(m_logResolution, (uint32_t) j);
+        }
+
+        /* Blocks are usually rendered several times (e.g. by the adaptive
+           or progressive modes) -- reuse the pixel mapping in that case */
+        if (offset == m_blockOffset && size == m_blockSize)
+            return;
+
+        m_blockOffset = offset;
+        m_blockSize = size;
+        m_pixelIndices.resize((size_t) size.x * (size_t) size.y);
+        for (int y=0; y<size.y; ++y)
+            for (int x=0; x<size.x; ++x)
+                m_pixelIndices[x + y * (size_t) size.x] = sobol::look_up_pixel(
+                    m_logResolution, offset.x + x, offset.y + y, m_scramble);
+    }
+
+    /// Return the index of the frame-th sample within the current pixel
+    inline uint64_t lookUp(uint32_t frame) const {
+        if (m_pixelCached && frame < m_frameIndices.size())
+            return m_pixelIndex ^ m_frameIndices[frame];
+        return sobol::look_up(m_logResolution, frame,
+            m_pixelPosition.x, m_pixelPosition.y, m_scramble);
     }
 
     template <typename Iterator> void shuffle(uint32_t seed, Iterator it1, Iterator it2) {
@@ -170,6 +227,13 @@ public:
 
     void generate(const Point2i &pos) {
         m_pixelPosition = pos;
+
+        /* Fetch the precomputed index mapping, if the pixel is part of the current block */
+        Vector2i rel = pos - m_blockOffset;
+        m_pixelCached = rel.x >= 0 && rel.y >= 0 && rel.x < m_blockSize.x && rel.y < m_blockSize.y;
+        if (m_pixelCached)
+            m_pixelIndex = m_pixelIndices[rel.x + rel.y * (size_t) m_blockSize.x];
+
         setSampleIndex(0);
 
         /* Dimensions reserved to sample array requests */
@@ -180,7 +244,7 @@ public:
         uint32_t dim = m_arrayStartDim;
         for (size_t i=0; i<m_req1D.size(); i++) {
             for (size_t j=0; j<m_sampleCount * m_req1D[i]; ++j) {
-                uint64_t idx = sobol::look_up(m_logResolution, (uint32_t) j, m_pixelPosition.x, m_pixelPosition.y, m_scramble);
+                uint64_t idx = lookUp((uint32_t) j);
                 m_sampleArrays1D[i][j] = sobol::sample(idx, dim, m_scramble);
             }
             dim += 1;
@@ -188,7 +252,7 @@ public:
 
         for (size_t i=0; i<m_req2D.size(); i++) {
             for (size_t j=0; j<m_sampleCount * m_req2D[i]; ++j) {
-                uint64_t idx = sobol::look_up(m_logResolution, (uint32_t) j, m_pixelPosition.x, m_pixelPosition.y, m_scramble);
+                uint64_t idx = lookUp((uint32_t) j);
                 m_sampleArrays2D[i][j] = Point2(
                     sobol::sample(idx, dim, m_scramble),
                     sobol::sample(idx, dim+1, m_scramble));
@@ -208,8 +272,7 @@ public:
 
         if (m_logResolution > 1 && m_pixelPosition.x >= 0) {
             /* Find the next sample that is located in the current pixel */
-            m_sobolSampleIndex = sobol::look_up(m_logResolution, (uint32_t) m_sampleIndex,
-                    m_pixelPosition.x, m_pixelPosition.y, m_scramble);
+            m_sobolSampleIndex = lookUp((uint32_t) m_sampleIndex);
         } else {
             m_sobolSampleIndex = (uint64_t) m_sampleIndex;
         }
@@ -249,6 +312,65 @@ public:
         return Point2(value1, value2);
     }
 
+    void next1DBatch(Float *values, size_t count) {
+        while (count > 0) {
+            /* Skip over dimensions that were reserved to arrays */
+            if (m_dimension >= m_arrayStartDim && m_dimension < m_arrayEndDim)
+                m_dimension = m_arrayEndDim;
+
+            /* Largest run of dimensions that doesn't overlap the arrays */
+            size_t n = count;
+            if (m_dimension < m_arrayStartDim)
+                n = std::min(n, (size_t) (m_arrayStartDim - m_dimension));
+
+            if (m_dimension + n > sobol::Matrices::num_dimensions)
+                Log(EError, "Lookup dimension exceeds the direction number table size! You "
+                    "may have to reduce the 'maxDepth' parameter of your integrator.");
+
+            sobol::sampleBatch(m_sobolSampleIndex, m_dimension,
+                (uint32_t) n, m_scramble, values);
+
+            m_dimension += (uint32_t) n;
+            values += n;
+            count -= n;
+        }
+    }
+
+    void next2DBatch(Point2 *values, size_t count) {
+        /* The first dimension pair may need to be mapped into the pixel */
+        if (count > 0 && m_dimension == 0) {
+            *values++ = next2D();
+            --count;
+        }
+
+        const size_t chunkSize = 16;
+        Float temp[2 * chunkSize];
+
+        while (count > 0) {
+            /* Skip over dimensions that were reserved to arrays */
+            if (m_dimension + 1 >= m_arrayStartDim && m_dimension < m_arrayEndDim)
+                m_dimension = m_arrayEndDim;
+
+            size_t n = std::min(count, chunkSize);
+            if (m_dimension < m_arrayStartDim)
+                n = std::min(n, (size_t) (m_arrayStartDim - m_dimension) / 2);
+
+            if (m_dimension + 2 * n > sobol::Matrices::num_dimensions)
+                Log(EError, "Lookup dimension exceeds the direction number table size! You "
+                    "may have to reduce the 'maxDepth' parameter of your integrator.");
+
+            sobol::sampleBatch(m_sobolSampleIndex, m_dimension,
+                (uint32_t) (2 * n), m_scramble, temp);
+
+            for (size_t i=0; i<n; ++i)
+                values[i] = Point2(temp[2*i], temp[2*i+1]);
+
+            m_dimension += (uint32_t) (2 * n);
+            values += n;
+            count -= n;
+        }
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "SobolSampler[" << endl
@@ -270,6 +392,14 @@ private:
     uint32_t m_arrayStartDim;
     uint32_t m_arrayEndDim;
     Point2i m_pixelPosition;
+
+    /* Cached index mappings of the current block (see setBlock()) */
+    std::vector<uint64_t> m_frameIndices;
+    std::vector<uint64_t> m_pixelIndices;
+    Point2i m_blockOffset;
+    Vector2i m_blockSize;
+    uint64_t m_pixelIndex;
+    bool m_pixelCached;
 };
 
 MTS_IMPLEMENT_CLASS_S(SobolSampler, false, Sampler)
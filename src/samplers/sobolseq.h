@@ -93,6 +93,61 @@ inline mitsuba::Float sample(
 #endif
 }
 
+// Compute 'count' consecutive components of the Sobol'-sequence,
+// starting at the given dimension. This produces the same values as
+// calling sample() once per dimension, but the bits of the index are
+// only traversed once, and the inner loop over the dimensions is free
+// of data-dependent branches so that the compiler can vectorize it.
+inline void sampleBatch(
+    uint64_t index,
+    uint32_t dimension,
+    uint32_t count,
+    const uint64_t scramble,
+    mitsuba::Float *out)
+{
+    assert(dimension + count <= Matrices::num_dimensions);
+
+#if defined(SINGLE_PRECISION)
+    typedef uint32_t Word;
+    const Word *matrices = Matrices::matrices32;
+    const Word initial = (uint32_t) scramble;
+    const float scale = 1.0f / (1ULL << 32);
+    const float maxValue = ONE_MINUS_EPS_FLT;
+#else
+    typedef uint64_t Word;
+    const Word *matrices = Matrices::matrices64;
+    const Word initial = scramble & ~-(1LL << Matrices::size);
+    const double scale = 1.0 / (1ULL << Matrices::size);
+    const double maxValue = ONE_MINUS_EPS_DBL;
+#endif
+
+    const uint32_t chunkSize = 16;
+    Word result[chunkSize];
+
+    while (count > 0)
+    {
+        const uint32_t n = std::min(count, chunkSize);
+        for (uint32_t k = 0; k < n; ++k)
+            result[k] = initial;
+
+        const Word *column = matrices + dimension * Matrices::size;
+        for (uint64_t i = index; i; i >>= 1, ++column)
+        {
+            // All ones if the current bit of the index is set
+            const Word mask = (Word) 0 - (Word) (i & 1);
+            for (uint32_t k = 0; k < n; ++k)
+                result[k] ^= column[k * Matrices::size] & mask;
+        }
+
+        for (uint32_t k = 0; k < n; ++k)
+            out[k] = std::min((mitsuba::Float) (result[k] * scale), maxValue);
+
+        out += n;
+        dimension += n;
+        count -= n;
+    }
+}
+
 // Return the index of the frame-th sample falling
 // into the square elementary interval (px, py),
 // without using look-up tables.
@@ -130,6 +185,51 @@ inline uint64_t look_up(
     return index;
 }
 
+// The GF(2) matrix product in look_up() is linear, hence its result
+// is the XOR of a term that only depends on the frame and a term that
+// only depends on the pixel. The following two functions compute these
+// terms separately, so that they can be cached and combined, i.e.
+//   look_up(m, f, px, py, s) == look_up_frame(m, f) ^ look_up_pixel(m, px, py, s)
+inline uint64_t look_up_frame(
+    const uint32_t m,
+    uint32_t frame)
+{
+    const uint32_t m2 = m << 1;
+    uint64_t index = uint64_t(frame) << m2;
+
+    uint64_t delta = 0;
+    for (uint32_t c = 0; frame; frame >>= 1, ++c)
+        if (frame & 1) // Add flipped column m + c + 1.
+            delta ^= Matrices::vdc_sobol_matrices[m - 1][c];
+
+    for (uint32_t c = 0; delta; delta >>= 1, ++c)
+        if (delta & 1) // Add column 2 * m - c.
+            index ^= Matrices::vdc_sobol_matrices_inv[m - 1][c];
+
+    return index;
+}
+
+inline uint64_t look_up_pixel(
+    const uint32_t m,
+    const uint32_t px,
+    const uint32_t py,
+    uint64_t scramble)
+{
+#if defined(SINGLE_PRECISION)
+    scramble = (scramble & 0xFFFFFFFF) >> (32 - m);
+#else
+    scramble = (scramble & ~-(1ULL << Matrices::size)) >> (Matrices::size - m);
+#endif
+
+    uint64_t b = ((uint64_t) (px ^ scramble) << m) | (py ^ scramble);
+
+    uint64_t index = 0;
+    for (uint32_t c = 0; b; b >>= 1, ++c)
+        if (b & 1) // Add column 2 * m - c.
+            index ^= Matrices::vdc_sobol_matrices_inv[m - 1][c];
+
+    return index;
+}
 
 } // namespace sobol
 
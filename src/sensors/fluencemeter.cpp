@@ -20,6 +20,7 @@
 #include <mitsuba/render/medium.h>
 #include <mitsuba/core/track.h>
 #include <mitsuba/core/warp.h>
+#include "probes.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -35,12 +36,26 @@ MTS_NAMESPACE_BEGIN
  *         is only relevant when the scene is in motion.
  *         \default{0}
  *     }
+ *     \parameter{probes}{\String}{
+ *         Optional ASCII file with a list of probe positions (one per line,
+ *         specified in sensor space). In this case, every pixel of the film
+ *         records one probe, and the film resolution must match the number
+ *         of probes.
+ *         \default{none, i.e. a single probe at the origin}
+ *     }
  * }
  *
  * This sensor plugin implements a simple fluence meter, which measures
  * the average radiance passing through a specified position.
  * By default, the sensor is located at the origin.
  *
+ * When many locations should be measured, the \code{probes} parameter
+ * turns the sensor into an array of fluence meters that are all evaluated
+ * by a single rendering job. The probes are distributed over the blocks
+ * of the film like ordinary pixels, hence they are rendered in parallel,
+ * and e.g. an \pluginref{mfilm} with a resolution of $N\times 1$ writes
+ * all $N$ measurements into one file.
+ *
  * Such a sensor is useful for conducting virtual experiments and
  * testing the renderer for correctness.
  *
@@ -77,13 +92,39 @@ public:
         if (props.getTransform("toWorld", Transform()).hasScale())
             Log(EError, "Scale factors in the sensor-to-world "
                 "transformation are not allowed!");
+
+        m_probes.load(props, false);
     }
 
     FluenceMeter(Stream *stream, InstanceManager *manager)
      : Sensor(stream, manager) {
+        m_probes.load(stream);
         configure();
     }
 
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Sensor::serialize(stream, manager);
+        m_probes.serialize(stream);
+    }
+
+    void configure() {
+        Sensor::configure();
+        if (m_probes.isEnabled())
+            m_probes.checkFilm(m_film);
+    }
+
+    /// Return the position of a probe (in sensor space)
+    inline Point getProbe(size_t index) const {
+        return m_probes.isEnabled() ? m_probes.getPosition(index) : Point(0.0f);
+    }
+
+    /// Pick one of the probes using a uniform sample
+    inline size_t sampleProbe(Float sample) const {
+        if (!m_probes.isEnabled())
+            return 0;
+        return std::min((size_t) (sample * m_probes.size()), m_probes.size() - 1);
+    }
+
     Spectrum sampleRay(Ray &ray, const Point2 &pixelSample,
             const Point2 &otherSample, Float timeSample) const {
         ray.time = sampleTime(timeSample);
@@ -91,15 +132,30 @@ public:
         ray.maxt = std::numeric_limits<Float>::infinity();
 
         const Transform &trafo = m_worldTransform->eval(ray.time);
-        ray.setOrigin(trafo(Point(0.0f)));
-        ray.setDirection(trafo(warp::squareToUniformSphere(pixelSample)));
+        if (m_probes.isEnabled()) {
+            Point2 sample;
+            size_t index = m_probes.lookup(pixelSample, m_film->getCropSize().x, sample);
+            ray.setOrigin(trafo(m_probes.getPosition(index)));
+            ray.setDirection(trafo(warp::squareToUniformSphere(sample)));
+        } else {
+            ray.setOrigin(trafo(Point(0.0f)));
+            ray.setDirection(trafo(warp::squareToUniformSphere(pixelSample)));
+        }
         return Spectrum(1.0f);
     }
 
     Spectrum samplePosition(PositionSamplingRecord &pRec, const Point2 &sample,
             const Point2 *extra) const {
         const Transform &trafo = m_worldTransform->eval(pRec.time);
-        pRec.p = trafo(Point(0.0f));
+        size_t index = 0;
+        if (m_probes.isEnabled()) {
+            int width = m_film->getCropSize().x;
+            /* The caller may want to condition on a specific pixel position */
+            index = extra ? m_probes.getIndex(*extra + Vector2(0.5f), width)
+                : sampleProbe(sample.x);
+            pRec.uv = m_probes.getPixel(index, width);
+        }
+        pRec.p = trafo(getProbe(index));
         pRec.n = Normal(0.0f);
         pRec.pdf = 1.0f;
         pRec.measure = EDiscrete;
@@ -137,10 +193,14 @@ public:
     Spectrum sampleDirect(DirectSamplingRecord &dRec, const Point2 &sample) const {
         const Transform &trafo = m_worldTransform->eval(dRec.time);
 
-        dRec.p = trafo.transformAffine(Point(0.0f));
+        /* When there are several probes, pick one of them. This is
+           balanced by the film's normalization by the pixel count */
+        size_t index = sampleProbe(sample.x);
+        dRec.p = trafo.transformAffine(getProbe(index));
         dRec.pdf = 1.0f;
         dRec.measure = EDiscrete;
-        dRec.uv = Point2(0.5f);
+        dRec.uv = m_probes.isEnabled() ? m_probes.getPixel(index,
+            m_film->getCropSize().x) : Point2(0.5f);
         dRec.d = dRec.p - dRec.ref;
         dRec.dist = dRec.d.length();
         Float invDist = 1.0f / dRec.dist;
@@ -156,14 +216,27 @@ public:
         return dRec.measure == EDiscrete ? 1.0f : 0.0f;
     }
 
+    bool getSamplePosition(const PositionSamplingRecord &pRec,
+            const DirectionSamplingRecord &dRec, Point2 &samplePosition) const {
+        samplePosition = m_probes.isEnabled() ? pRec.uv : Point2(0.5f);
+        return true;
+    }
+
     AABB getAABB() const {
-        return m_worldTransform->getTranslationBounds();
+        if (!m_probes.isEnabled())
+            return m_worldTransform->getTranslationBounds();
+
+        AABB aabb;
+        for (size_t i=0; i<m_probes.size(); ++i)
+            aabb.expandBy(m_probes.getPosition(i));
+        return m_worldTransform->getSpatialBounds(aabb);
     }
 
     std::string toString() const {
         std::ostringstream oss;
         oss << "FluenceMeter[" << endl
             << "  worldTransform = " << indent(m_worldTransform.toString()) << "," << endl
+            << "  probes = " << m_probes.size() << "," << endl
             << "  sampler = " << indent(m_sampler->toString()) << "," << endl
             << "  film = " << indent(m_film->toString()) << "," << endl
             << "  medium = " << indent(m_medium.toString()) << "," << endl
@@ -174,6 +247,8 @@ public:
     }
 
     MTS_DECLARE_CLASS()
+private:
+    SensorProbes m_probes;
 };
 
 MTS_IMPLEMENT_CLASS_S(FluenceMeter, false, Sensor)
@@ -20,6 +20,7 @@
 #include <mitsuba/render/shape.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/core/warp.h>
+#include "probes.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -31,6 +32,14 @@ MTS_NAMESPACE_BEGIN
  *         is only relevant when the scene is in motion.
  *         \default{0}
  *     }
+ *     \parameter{probes}{\String}{
+ *         Optional ASCII file with a list of probes, i.e. positions and
+ *         normals (six numbers per line, in world space). In this case, the
+ *         sensor is declared at the scene level instead of within a shape,
+ *         and every pixel of the film records the irradiance at one probe.
+ *         The film resolution must match the number of probes.
+ *         \default{none}
+ *     }
  * }
  *
  * This sensor plugin implements a simple irradiance meter, which
@@ -48,6 +57,14 @@ MTS_NAMESPACE_BEGIN
  * will record the average irradiance over a rectangular part of the
  * shape's UV parameterization.
  *
+ * Alternatively, the \code{probes} parameter turns the sensor into an
+ * array of point irradiance meters, which are all evaluated by a single
+ * rendering job (e.g. to validate an optical setup at thousands of
+ * locations without reloading the scene for each of them). The probes are
+ * distributed over the blocks of the film like ordinary pixels, and e.g.
+ * an \pluginref{mfilm} with a resolution of $N\times 1$ writes all $N$
+ * measurements into one file.
+ *
  * \vspace{4mm}
  * \begin{xml}
  * <scene version=$\MtsVer$>
@@ -75,7 +92,9 @@ MTS_NAMESPACE_BEGIN
 class IrradianceMeter : public Sensor {
 public:
     IrradianceMeter(const Properties &props) : Sensor(props) {
-        m_type |= ENeedsApertureSample | EOnSurface;
+        m_probes.load(props, true);
+        m_type |= ENeedsApertureSample |
+            (m_probes.isEnabled() ? EDeltaPosition : EOnSurface);
 
         if (props.hasProperty("toWorld"))
             Log(EError, "Found a 'toWorld' transformation -- this is not "
@@ -85,12 +104,14 @@ public:
 
     IrradianceMeter(Stream *stream, InstanceManager *manager)
         : Sensor(stream, manager) {
+        m_probes.load(stream);
         m_shape = static_cast<Shape *>(manager->getInstance(stream));
         configure();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         Sensor::serialize(stream, manager);
+        m_probes.serialize(stream);
         manager->serialize(stream, m_shape);
     }
 
@@ -100,6 +121,13 @@ public:
             1.0f / m_film->getCropSize().x,
             1.0f / m_film->getCropSize().y
         );
+        if (m_probes.isEnabled())
+            m_probes.checkFilm(m_film);
+    }
+
+    /// Pick one of the probes using a uniform sample
+    inline size_t sampleProbe(Float sample) const {
+        return std::min((size_t) (sample * m_probes.size()), m_probes.size() - 1);
     }
 
     Spectrum sampleRay(Ray &ray, const Point2 &pixelSample,
@@ -108,6 +136,15 @@ public:
         ray.mint = Epsilon;
         ray.maxt = std::numeric_limits<Float>::infinity();
 
+        if (m_probes.isEnabled()) {
+            Point2 sample;
+            size_t index = m_probes.lookup(pixelSample, m_film->getCropSize().x, sample);
+            ray.setOrigin(m_probes.getPosition(index));
+            ray.setDirection(Frame(m_probes.getNormal(index)).toWorld(
+                warp::squareToCosineHemisphere(otherSample)));
+            return Spectrum(M_PI);
+        }
+
         PositionSamplingRecord pRec(ray.time);
             m_shape->samplePosition(pRec, Point2(
             pixelSample.x * m_invResolution.x,
@@ -122,6 +159,19 @@ public:
 
     Spectrum samplePosition(PositionSamplingRecord &pRec,
             const Point2 &sample, const Point2 *extra) const {
+        if (m_probes.isEnabled()) {
+            int width = m_film->getCropSize().x;
+            /* The caller may want to condition on a specific pixel position */
+            size_t index = extra ? m_probes.getIndex(*extra + Vector2(0.5f), width)
+                : sampleProbe(sample.x);
+            pRec.p = m_probes.getPosition(index);
+            pRec.n = m_probes.getNormal(index);
+            pRec.uv = m_probes.getPixel(index, width);
+            pRec.pdf = 1.0f;
+            pRec.measure = EDiscrete;
+            return Spectrum(M_PI);
+        }
+
         Point2 samplePos(sample);
 
         if (extra) {
@@ -139,10 +189,14 @@ public:
     }
 
     Spectrum evalPosition(const PositionSamplingRecord &pRec) const {
+        if (m_probes.isEnabled())
+            return Spectrum((pRec.measure == EDiscrete) ? M_PI : 0.0f);
         return Spectrum(M_PI / m_shape->getSurfaceArea());
     }
 
     Float pdfPosition(const PositionSamplingRecord &pRec) const {
+        if (m_probes.isEnabled())
+            return (pRec.measure == EDiscrete) ? 1.0f : 0.0f;
         return m_shape->pdfPosition(pRec);
     }
 
@@ -178,6 +232,28 @@ public:
 
     Spectrum sampleDirect(DirectSamplingRecord &dRec,
             const Point2 &sample) const {
+        if (m_probes.isEnabled()) {
+            /* Pick one of the probes. This is balanced
+               by the film's normalization by the pixel count */
+            size_t index = sampleProbe(sample.x);
+            dRec.p = m_probes.getPosition(index);
+            dRec.n = m_probes.getNormal(index);
+            dRec.d = dRec.p - dRec.ref;
+            dRec.dist = dRec.d.length();
+            Float invDist = 1.0f / dRec.dist;
+            dRec.d *= invDist;
+            dRec.uv = m_probes.getPixel(index, m_film->getCropSize().x);
+            dRec.measure = EDiscrete;
+
+            Float dp = -dot(dRec.d, dRec.n);
+            if (dot(dRec.d, dRec.refN) < 0 || dp <= 0) {
+                dRec.pdf = 0.0f;
+                return Spectrum(0.0f);
+            }
+            dRec.pdf = 1.0f;
+            return Spectrum(dp * invDist * invDist);
+        }
+
         m_shape->sampleDirect(dRec, sample);
 
         /* Check that the sensor and reference position are oriented correctly
@@ -201,6 +277,8 @@ public:
         /* Check that the sensor and reference position are oriented correctly
            with respect to each other. */
         if (dot(dRec.d, dRec.refN) >= 0 && dot(dRec.d, dRec.n) < 0) {
+            if (m_probes.isEnabled())
+                return (dRec.measure == EDiscrete) ? 1.0f : 0.0f;
             return m_shape->pdfDirect(dRec);
         } else {
             return 0.0f;
@@ -208,6 +286,8 @@ public:
     }
 
     Spectrum eval(const Intersection &its, const Vector &d, Point2 &samplePos) const {
+        if (m_probes.isEnabled())
+            return Spectrum(0.0f);
         if (dot(its.shFrame.n, d) < 0)
             return Spectrum(0.0f);
 
@@ -227,6 +307,13 @@ public:
     void setParent(ConfigurableObject *parent) {
         Sensor::setParent(parent);
 
+        if (m_probes.isEnabled()) {
+            if (parent->getClass()->derivesFrom(MTS_CLASS(Shape)))
+                Log(EError, "An irradiance sensor with a list of probes "
+                    "cannot be child of a shape instance");
+            return;
+        }
+
         if (parent->getClass()->derivesFrom(MTS_CLASS(Shape))) {
             Shape *shape = static_cast<Shape *>(parent);
             if (m_shape == shape || shape->isCompound())
@@ -242,12 +329,19 @@ public:
     }
 
     AABB getAABB() const {
+        if (m_probes.isEnabled()) {
+            AABB aabb;
+            for (size_t i=0; i<m_probes.size(); ++i)
+                aabb.expandBy(m_probes.getPosition(i));
+            return aabb;
+        }
         return m_shape->getAABB();
     }
 
     std::string toString() const {
         std::ostringstream oss;
         oss << "IrradianceMeter[" << endl
+            << "  probes = " << m_probes.size() << "," << endl
             << "  sampler = " << indent(m_sampler->toString()) << "," << endl
             << "  film = " << indent(m_film->toString()) << "," << endl
             << "  medium = " << indent(m_medium.toString()) << "," << endl
@@ -258,6 +352,8 @@ public:
     }
 
     MTS_DECLARE_CLASS()
+private:
+    SensorProbes m_probes;
 };
 
 MTS_IMPLEMENT_CLASS_S(IrradianceMeter, false, Sensor)
@@ -36,6 +36,14 @@ MTS_NAMESPACE_BEGIN
  *         is only relevant when the scene is in motion.
  *         \default{0}
  *     }
+ *     \parameter{timeBuckets}{\Integer}{
+ *         When set to a nonzero value, the shutter interval is only
+ *         sampled at the centers of this many equal-sized buckets. Rays
+ *         with the same time then share the evaluation of animated
+ *         transformations, at the cost of replacing the continuous
+ *         motion blur by a sum of discrete exposures.
+ *         \default{0, i.e. continuous}
+ *     }
  *     \parameter{nearClip, farClip}{\Float}{
  *         Distance to the near/far clip
  *         planes.\default{\code{near\code}-\code{Clip=1e-2} (i.e.
@@ -178,6 +186,41 @@ public:
         return Spectrum(1.0f);
     }
 
+    void sampleRayDifferentials(size_t count, const Point2 *samplePositions,
+            const Point2 *apertureSamples, const Float *timeSamples,
+            RayDifferential *rays, Spectrum *weights) const {
+        if (!m_worldTransform->isStatic()) {
+            ProjectiveCamera::sampleRayDifferentials(count, samplePositions,
+                apertureSamples, timeSamples, rays, weights);
+            return;
+        }
+
+        /* All rays share their direction, and the origin is an
+           affine function of the sample position in world space */
+        const Transform &trafo = m_worldTransform->eval(0);
+        Point nearP0 = m_sampleToCamera.transformAffine(Point(0.0f));
+        nearP0.z = 0.0f;
+        const Point origin0 = trafo.transformAffine(nearP0);
+        const Vector dx = trafo(m_dx), dy = trafo(m_dy);
+        const Vector d = normalize(trafo(Vector(0, 0, 1)));
+
+        for (size_t i=0; i<count; ++i) {
+            RayDifferential &ray = rays[i];
+            const Point2 &pixelSample = samplePositions[i];
+            ray.time = sampleTime(timeSamples ? timeSamples[i] : 0.5f);
+
+            ray.setOrigin(origin0 + dx * pixelSample.x + dy * pixelSample.y);
+            ray.setDirection(d);
+            ray.mint = m_nearClip;
+            ray.maxt = m_farClip;
+            ray.rxOrigin = ray.o + dx;
+            ray.ryOrigin = ray.o + dy;
+            ray.rxDirection = ray.ryDirection = d;
+            ray.hasDifferentials = true;
+            weights[i] = Spectrum(1.0f);
+        }
+    }
+
     Spectrum samplePosition(PositionSamplingRecord &pRec,
             const Point2 &sample, const Point2 *extra) const {
         const Transform &trafo = m_worldTransform->eval(pRec.time);
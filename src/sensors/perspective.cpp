@@ -66,6 +66,14 @@ MTS_NAMESPACE_BEGIN
  *         is only relevant when the scene is in motion.
  *         \default{0}
  *     }
+ *     \parameter{timeBuckets}{\Integer}{
+ *         When set to a nonzero value, the shutter interval is only
+ *         sampled at the centers of this many equal-sized buckets. Rays
+ *         with the same time then share the evaluation of animated
+ *         transformations, at the cost of replacing the continuous
+ *         motion blur by a sum of discrete exposures.
+ *         \default{0, i.e. continuous}
+ *     }
  *     \parameter{nearClip, farClip}{\Float}{
  *         Distance to the near/far clip
  *         planes.\default{\code{near\code}-\code{Clip=1e-2} (i.e.
@@ -297,6 +305,42 @@ public:
         return Spectrum(1.0f);
     }
 
+    void sampleRayDifferentials(size_t count, const Point2 *samplePositions,
+            const Point2 *apertureSamples, const Float *timeSamples,
+            RayDifferential *rays, Spectrum *weights) const {
+        if (!m_worldTransform->isStatic()) {
+            PerspectiveCamera::sampleRayDifferentials(count, samplePositions,
+                apertureSamples, timeSamples, rays, weights);
+            return;
+        }
+
+        /* The transformation is evaluated once, and the near plane
+           position is an affine function of the sample position */
+        const Transform &trafo = m_worldTransform->eval(0);
+        const Point origin = trafo.transformAffine(Point(0.0f));
+        const Vector nearP0(m_sampleToCamera(Point(0.0f)));
+
+        for (size_t i=0; i<count; ++i) {
+            RayDifferential &ray = rays[i];
+            const Point2 &pixelSample = samplePositions[i];
+            ray.time = sampleTime(timeSamples ? timeSamples[i] : 0.5f);
+
+            Vector nearP = nearP0 + m_dx * pixelSample.x + m_dy * pixelSample.y;
+            Vector d = normalize(nearP);
+            Float invZ = 1.0f / d.z;
+            ray.mint = m_nearClip * invZ;
+            ray.maxt = m_farClip * invZ;
+
+            ray.setOrigin(origin);
+            ray.setDirection(trafo(d));
+            ray.rxOrigin = ray.ryOrigin = origin;
+            ray.rxDirection = trafo(normalize(nearP + m_dx));
+            ray.ryDirection = trafo(normalize(nearP + m_dy));
+            ray.hasDifferentials = true;
+            weights[i] = Spectrum(1.0f);
+        }
+    }
+
     Spectrum samplePosition(PositionSamplingRecord &pRec,
             const Point2 &sample, const Point2 *extra) const {
         const Transform &trafo = m_worldTransform->eval(pRec.time);
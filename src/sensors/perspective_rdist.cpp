@@ -20,6 +20,8 @@
 #include <mitsuba/render/medium.h>
 #include <mitsuba/core/track.h>
 #include <mitsuba/core/frame.h>
+#include <mitsuba/core/spline.h>
+#include <boost/algorithm/string.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -31,10 +33,21 @@ MTS_NAMESPACE_BEGIN
  *        \default{none (i.e. camera space $=$ world space)}
  *     }
  *     \parameter{kc}{\String}{
- *         Second and fourth-order coefficient of a polynomial radial distortion model
- *         specified as a comma-separated list
+ *         Coefficients of the distortion model specified as a comma-separated
+ *         list. For the \code{polynomial} model, these are either the second
+ *         and fourth-order radial coefficients, the second, fourth and sixth-order
+ *         radial coefficients, or all five coefficients $k_1, k_2, p_1, p_2, k_3$
+ *         including the tangential terms $p_1, p_2$.
  *         The specifics of the model are described in detail on the following page:
  *         \url{http://www.vision.caltech.edu/bouguetj/calib_doc/htmls/parameters.html}
+ *         For the \code{fisheye} model, up to four coefficients of the
+ *         polynomial $\theta_d=\theta(1+k_1\theta^2+k_2\theta^4+k_3\theta^6+k_4\theta^8)$
+ *         can be given.
+ *     }
+ *     \parameter{distortionModel}{\String}{
+ *         Specifies the distortion model, i.e. either
+ *         \code{polynomial} or \code{fisheye}.
+ *         \default{\code{polynomial}}
  *     }
  *     \parameter{focalLength}{\String}{
  *         Denotes the camera's focal length specified using
@@ -92,6 +105,20 @@ MTS_NAMESPACE_BEGIN
  * (\url{http://www.vision.caltech.edu/bouguetj/calib_doc/}) can be used to
  * obtain a distortion model, and the first entries of the \code{kc} variable
  * generated by this tool can directly be passed into this plugin.
+ *
+ * The \code{fisheye} model maps the angle $\theta$ between a ray and the
+ * optical axis to the radius $\theta_d$ on the image plane (an equidistant
+ * projection when all coefficients are zero), which matches the fisheye
+ * model of common calibration tools. As with the other model, \code{fov}
+ * and \code{focalLength} specify the extents of the (distorted) image plane,
+ * and all visible directions must lie within 90 degrees of the optical axis.
+ *
+ * Generating a ray requires inverting the distortion. Instead of solving for
+ * it iteratively every time, the plugin tabulates the inverse over the visible
+ * part of the image plane when the scene is loaded and evaluates a cubic spline
+ * interpolant. The table is refined until its relative error is below
+ * $10^{-5}$ (a 1D table for purely radial models, and a 2D table when
+ * tangential terms are present).
  */
 
 class PerspectiveCameraRDist : public PerspectiveCamera {
@@ -107,36 +134,73 @@ public:
             Log(EError, "Scale factors in the camera-to-world "
                 "transformation are not allowed!");
 
-        /* Parse parameter for radial distortion model */
+        /* Parse parameters of the distortion model */
+        std::string model = boost::to_lower_copy(
+            props.getString("distortionModel", "polynomial"));
+        if (model == "polynomial")
+            m_model = EPolynomial;
+        else if (model == "fisheye")
+            m_model = EFisheye;
+        else
+            Log(EError, "Unknown distortion model \"%s\"!", model.c_str());
+
         std::string kc = props.getString("kc", "");
         std::vector<std::string> kc_tokens = tokenize(kc, ", ");
-        if (kc_tokens.size() == 0) {
-            m_kc[0] = m_kc[1] = 0.0f;
-            m_distortion = false;
-        } else if (kc_tokens.size() == 2) {
-            char *end_ptr0, *end_ptr1;
-            m_kc[0] = (Float) std::strtod(kc_tokens[0].c_str(), &end_ptr0);
-            m_kc[1] = (Float) std::strtod(kc_tokens[1].c_str(), &end_ptr1);
-            if (*end_ptr0 != '\0' || *end_ptr1 != 0)
+        std::vector<Float> coeffs(kc_tokens.size());
+        for (size_t i=0; i<kc_tokens.size(); ++i) {
+            char *end_ptr;
+            coeffs[i] = (Float) std::strtod(kc_tokens[i].c_str(), &end_ptr);
+            if (*end_ptr != '\0')
                 Log(EError, "Invalid input to the 'kc' parameter!");
-            m_distortion = m_kc[0] != 0 || m_kc[1] != 0;
+        }
+
+        for (int i=0; i<4; ++i)
+            m_kc[i] = 0.0f;
+        m_pc[0] = m_pc[1] = 0.0f;
+
+        if (m_model == EPolynomial) {
+            if (coeffs.size() == 2 || coeffs.size() == 3) {
+                for (size_t i=0; i<coeffs.size(); ++i)
+                    m_kc[i] = coeffs[i];
+            } else if (coeffs.size() == 5) {
+                /* Ordering of the Camera Calibration Toolbox */
+                m_kc[0] = coeffs[0]; m_kc[1] = coeffs[1];
+                m_pc[0] = coeffs[2]; m_pc[1] = coeffs[3];
+                m_kc[2] = coeffs[4];
+            } else if (coeffs.size() != 0) {
+                Log(EError, "The 'kc' parameter of the polynomial "
+                    "model requires two, three or five arguments!");
+            }
         } else {
-            Log(EError, "The 'kc' requires two arguments!");
+            if (coeffs.size() > 4)
+                Log(EError, "The 'kc' parameter of the fisheye "
+                    "model accepts at most four arguments!");
+            for (size_t i=0; i<coeffs.size(); ++i)
+                m_kc[i] = coeffs[i];
         }
+        updateFlags();
     }
 
     PerspectiveCameraRDist(Stream *stream, InstanceManager *manager)
             : PerspectiveCamera(stream, manager) {
+        m_model = (EModel) stream->readUInt();
+        stream->readFloatArray(m_kc, 4);
+        stream->readFloatArray(m_pc, 2);
+        updateFlags();
         configure();
-        m_kc[0] = stream->readFloat();
-        m_kc[1] = stream->readFloat();
-        m_distortion = m_kc[0] != 0 || m_kc[1] != 0;
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         PerspectiveCamera::serialize(stream, manager);
-        stream->writeFloat(m_kc[0]);
-        stream->writeFloat(m_kc[1]);
+        stream->writeUInt((uint32_t) m_model);
+        stream->writeFloatArray(m_kc, 4);
+        stream->writeFloatArray(m_pc, 2);
+    }
+
+    void updateFlags() {
+        m_tangential = m_pc[0] != 0 || m_pc[1] != 0;
+        m_distortion = m_model == EFisheye || m_tangential ||
+            m_kc[0] != 0 || m_kc[1] != 0 || m_kc[2] != 0;
     }
 
     void configure() {
@@ -193,27 +257,245 @@ public:
             Vector((1-2*relOffset.x)/relSize.x - 1,
                   -(1-2*relOffset.y)/relSize.y + 1, 0.0f)) *
             Transform::scale(Vector(1.0f / relSize.x, 1.0f / relSize.y, 1.0f));
+
+        m_radialTable.clear();
+        m_warpX.clear();
+        m_warpY.clear();
+        if (m_distortion) {
+            if (m_tangential)
+                tabulateWarp();
+            else
+                tabulateRadial();
+        }
+    }
+
+    /**
+     * \brief Evaluate the radial part of the distortion model
+     *
+     * \param r2
+     *     Squared radius of an undistorted position on the plane z=1
+     * \param ds
+     *     If non-NULL, receives the derivative of the returned
+     *     factor with respect to \c r2 (polynomial model only)
+     * \param drd
+     *     If non-NULL, receives the derivative of the distorted
+     *     radius with respect to the undistorted one
+     * \return
+     *     The ratio of the distorted and undistorted radius
+     */
+    inline Float radialFactor(Float r2, Float *ds = NULL, Float *drd = NULL) const {
+        if (m_model == EPolynomial) {
+            if (ds)
+                *ds = m_kc[0] + r2*(2*m_kc[1] + 3*m_kc[2]*r2);
+            if (drd)
+                *drd = 1 + r2*(3*m_kc[0] + r2*(5*m_kc[1] + 7*m_kc[2]*r2));
+            return 1 + r2*(m_kc[0] + r2*(m_kc[1] + r2*m_kc[2]));
+        } else {
+            Float r = std::sqrt(r2), theta = std::atan(r), theta2 = theta*theta;
+            Float thetaD = theta * (1 + theta2*(m_kc[0] + theta2*(m_kc[1]
+                + theta2*(m_kc[2] + theta2*m_kc[3]))));
+            if (drd)
+                *drd = (1 + theta2*(3*m_kc[0] + theta2*(5*m_kc[1]
+                    + theta2*(7*m_kc[2] + 9*theta2*m_kc[3])))) / (1 + r2);
+            return r > RCPOVERFLOW ? thetaD / r : (Float) 1;
+        }
     }
 
-    Float applyDistortion(Float r2) const {
-        return 1 + r2*(m_kc[0] + r2*m_kc[1]);
+    /// Map an undistorted position on the plane z=1 to its distorted position
+    inline Point2 distort(const Point2 &p) const {
+        Float r2 = p.x*p.x + p.y*p.y, s = radialFactor(r2);
+        Point2 result(p.x*s, p.y*s);
+        if (m_tangential) {
+            result.x += 2*m_pc[0]*p.x*p.y + m_pc[1]*(r2 + 2*p.x*p.x);
+            result.y += m_pc[0]*(r2 + 2*p.y*p.y) + 2*m_pc[1]*p.x*p.y;
+        }
+        return result;
     }
 
-    Float invertDistortion(Float y) const {
-        int it = 0;
-        Float r = y;
+    /**
+     * \brief Return the Jacobian of \ref distort() at \c p
+     * (as the entries <tt>dx/dx, dx/dy, dy/dx, dy/dy</tt>)
+     */
+    inline void distortJacobian(const Point2 &p, Float J[4]) const {
+        Float r2 = p.x*p.x + p.y*p.y, ds, s = radialFactor(r2, &ds);
+        Float cross = 2*p.x*p.y*ds + 2*m_pc[0]*p.x + 2*m_pc[1]*p.y;
+        J[0] = s + 2*p.x*p.x*ds + 2*m_pc[0]*p.y + 6*m_pc[1]*p.x;
+        J[1] = J[2] = cross;
+        J[3] = s + 2*p.y*p.y*ds + 6*m_pc[0]*p.y + 2*m_pc[1]*p.x;
+    }
 
-        while (true) {
-            Float r2 = r*r,
-                  f  = r*(1+r2*(m_kc[0] + r2*m_kc[1])) - y,
-                  df = 1 + r2*(3*m_kc[0] + 5*m_kc[1]*r2);
+    /// Return the Jacobian determinant of \ref distort() at \c p
+    inline Float distortDeterminant(const Point2 &p) const {
+        if (m_tangential) {
+            Float J[4];
+            distortJacobian(p, J);
+            return J[0]*J[3] - J[1]*J[2];
+        } else {
+            Float drd, s = radialFactor(p.x*p.x + p.y*p.y, NULL, &drd);
+            return s * drd;
+        }
+    }
 
-            r -= f / df;
+    /// Invert the radial distortion using Newton's method
+    Float invertRadial(Float rd) const {
+        if (m_model == EPolynomial) {
+            Float r = rd;
+            for (int it=0; it<20; ++it) {
+                Float drd, f = r * radialFactor(r*r, NULL, &drd) - rd;
+                r -= f / drd;
+                if (std::abs(f) < 1e-7f * rd)
+                    break;
+            }
+            return r;
+        } else {
+            /* Solve for the angle, which is well-behaved near 90 degrees */
+            Float theta = std::min(rd, (Float) (0.5f * M_PI));
+            for (int it=0; it<20; ++it) {
+                Float theta2 = theta*theta;
+                Float f = theta * (1 + theta2*(m_kc[0] + theta2*(m_kc[1]
+                    + theta2*(m_kc[2] + theta2*m_kc[3])))) - rd;
+                Float df = 1 + theta2*(3*m_kc[0] + theta2*(5*m_kc[1]
+                    + theta2*(7*m_kc[2] + 9*theta2*m_kc[3])));
+                theta = std::max((Float) 0, std::min(theta - f / df,
+                    (Float) (0.5f * M_PI) - Epsilon));
+                if (std::abs(f) < 1e-7f * rd)
+                    break;
+            }
+            return std::tan(theta);
+        }
+    }
 
-            if (std::abs(f) < 1e-6 || ++it > 4)
+    /// Invert the full distortion model using Newton's method
+    Point2 invertDistortionIterative(const Point2 &pd) const {
+        if (!m_tangential) {
+            Float rd = Vector2(pd).length();
+            if (rd < RCPOVERFLOW)
+                return pd;
+            return pd * (invertRadial(rd) / rd);
+        }
+
+        Point2 p = pd;
+        for (int it=0; it<20; ++it) {
+            Vector2 f = distort(p) - pd;
+            Float J[4];
+            distortJacobian(p, J);
+            Float det = J[0]*J[3] - J[1]*J[2];
+            if (det == 0)
+                break;
+            Float invDet = 1.0f / det;
+            p.x -= (J[3] * f.x - J[1] * f.y) * invDet;
+            p.y -= (J[0] * f.y - J[2] * f.x) * invDet;
+            if (f.lengthSquared() < 1e-14f * (pd.x*pd.x + pd.y*pd.y + 1))
                 break;
         }
-        return r/y;
+        return p;
+    }
+
+    /**
+     * \brief Map a distorted position on the plane z=1 to the
+     * undistorted one using the precomputed tables
+     */
+    inline Point2 invertDistortion(const Point2 &pd) const {
+        if (!m_radialTable.empty()) {
+            Float rd = Vector2(pd).length();
+            if (EXPECT_TAKEN(rd <= m_maxRadius))
+                return pd * evalCubicInterp1D(rd, &m_radialTable[0],
+                    m_radialTable.size(), 0, m_maxRadius);
+        } else if (!m_warpX.empty()) {
+            if (EXPECT_TAKEN(pd.x >= m_warpMin.x && pd.x <= m_warpMax.x &&
+                             pd.y >= m_warpMin.y && pd.y <= m_warpMax.y))
+                return pd + Vector2(
+                    evalCubicInterp2D(pd, &m_warpX[0], m_warpSize, m_warpMin, m_warpMax),
+                    evalCubicInterp2D(pd, &m_warpY[0], m_warpSize, m_warpMin, m_warpMax));
+        }
+        /* Outside of the visible region (only happens due to roundoff) */
+        return invertDistortionIterative(pd);
+    }
+
+    /// Tabulate the ratio of the undistorted and distorted radius
+    void tabulateRadial() {
+        m_maxRadius = 0;
+        for (int i=0; i<4; ++i) {
+            Point2 corner = m_imageRect.getCorner(i);
+            m_maxRadius = std::max(m_maxRadius, Vector2(corner).length());
+        }
+        m_maxRadius *= 1 + 1e-3f;
+
+        Float error = 0;
+        for (size_t res = 64; ; res *= 2) {
+            Float step = m_maxRadius / (res - 1);
+            m_radialTable.resize(res);
+            m_radialTable[0] = 1;
+            for (size_t i=1; i<res; ++i)
+                m_radialTable[i] = invertRadial(i * step) / (i * step);
+
+            /* Check the resulting error between the knots */
+            error = 0;
+            for (size_t i=0; i<res-1; ++i) {
+                Float rd = (i + 0.5f) * step, ref = invertRadial(rd) / rd;
+                Float value = evalCubicInterp1D(rd, &m_radialTable[0],
+                    res, 0, m_maxRadius);
+                error = std::max(error, std::abs(value - ref) / ref);
+            }
+            if (error < 1e-5f || res >= 16384)
+                break;
+        }
+        reportTable(m_radialTable.size(), error);
+    }
+
+    /// Tabulate the offset from distorted to undistorted positions
+    void tabulateWarp() {
+        Vector2 margin = m_imageRect.getExtents() * 1e-3f;
+        m_warpMin = m_imageRect.min - margin;
+        m_warpMax = m_imageRect.max + margin;
+        Vector2 extents = m_warpMax - m_warpMin;
+        Float scale = std::max(extents.x, extents.y), error = 0;
+
+        for (size_t res = 32; ; res *= 2) {
+            m_warpSize = Size2(
+                std::max((size_t) 4, (size_t) std::ceil(res * extents.x / scale)),
+                std::max((size_t) 4, (size_t) std::ceil(res * extents.y / scale)));
+            Vector2 step(extents.x / (m_warpSize.x - 1),
+                extents.y / (m_warpSize.y - 1));
+
+            m_warpX.resize(m_warpSize.x * m_warpSize.y);
+            m_warpY.resize(m_warpSize.x * m_warpSize.y);
+            for (size_t y=0, idx=0; y<m_warpSize.y; ++y) {
+                for (size_t x=0; x<m_warpSize.x; ++x, ++idx) {
+                    Point2 pd(m_warpMin.x + x * step.x, m_warpMin.y + y * step.y);
+                    Vector2 offset = invertDistortionIterative(pd) - pd;
+                    m_warpX[idx] = offset.x;
+                    m_warpY[idx] = offset.y;
+                }
+            }
+
+            /* Check the resulting error at the cell centers */
+            error = 0;
+            for (size_t y=0; y<m_warpSize.y-1; ++y) {
+                for (size_t x=0; x<m_warpSize.x-1; ++x) {
+                    Point2 pd(m_warpMin.x + (x + 0.5f) * step.x,
+                              m_warpMin.y + (y + 0.5f) * step.y);
+                    Point2 ref = invertDistortionIterative(pd);
+                    Point2 value = pd + Vector2(
+                        evalCubicInterp2D(pd, &m_warpX[0], m_warpSize, m_warpMin, m_warpMax),
+                        evalCubicInterp2D(pd, &m_warpY[0], m_warpSize, m_warpMin, m_warpMax));
+                    error = std::max(error, (value - ref).length() / scale);
+                }
+            }
+            if (error < 1e-5f || res >= 512)
+                break;
+        }
+        reportTable(m_warpX.size(), error);
+    }
+
+    void reportTable(size_t entries, Float error) const {
+        if (error < 1e-5f)
+            Log(EDebug, "Tabulated the inverse distortion using %i entries "
+                "(max. relative error %e)", (int) entries, error);
+        else
+            Log(EWarn, "Could not tabulate the inverse distortion to the "
+                "desired accuracy (max. relative error %e). Is the distortion "
+                "model invertible over the field of view?", error);
     }
 
     /**
@@ -277,13 +559,9 @@ public:
                 * invCosTheta * invCosTheta;
 
         if (m_distortion) {
-            /* Correct importance for radial distortion */
-            Float rOrig2  = Vector2(p).lengthSquared(),
-                  rFactor = applyDistortion(rOrig2);
-
-            Float deriv = 1 + rOrig2*(3*m_kc[0] + 5*m_kc[1]*rOrig2);
-            importance *= std::abs(rFactor*deriv);
-            p *= rFactor;
+            /* Correct importance for the distortion */
+            importance *= std::abs(distortDeterminant(p));
+            p = distort(p);
         }
 
         /* Check if the point lies inside the chosen crop rectangle */
@@ -304,8 +582,8 @@ public:
             pixelSample.y * m_invResolution.y, 0.0f));
 
         if (m_distortion) {
-            Float correction = invertDistortion(Vector2(nearP.x / nearP.z, nearP.y / nearP.z).length());
-            nearP.x *= correction; nearP.y *= correction;
+            Point2 p = invertDistortion(Point2(nearP.x / nearP.z, nearP.y / nearP.z));
+            nearP.x = p.x * nearP.z; nearP.y = p.y * nearP.z;
         }
 
         /* Turn that into a normalized ray direction, and
@@ -337,8 +615,8 @@ public:
 
         if (m_distortion) {
             /* Ray differentials don't take distortion into account */
-            Float correction = invertDistortion(Vector2(nearP.x / nearP.z, nearP.y / nearP.z).length());
-            nearP.x *= correction; nearP.y *= correction;
+            Point2 p = invertDistortion(Point2(nearP.x / nearP.z, nearP.y / nearP.z));
+            nearP.x = p.x * nearP.z; nearP.y = p.y * nearP.z;
         }
 
         /* Turn that into a normalized ray direction, and
@@ -399,8 +677,8 @@ public:
         Point nearP = m_sampleToCamera(samplePos);
 
         if (m_distortion) {
-            Float correction = invertDistortion(Vector2(nearP.x / nearP.z, nearP.y / nearP.z).length());
-            nearP.x *= correction; nearP.y *= correction;
+            Point2 p = invertDistortion(Point2(nearP.x / nearP.z, nearP.y / nearP.z));
+            nearP.x = p.x * nearP.z; nearP.y = p.y * nearP.z;
         }
 
         /* Turn that into a normalized ray direction */
@@ -437,14 +715,14 @@ public:
         Transform invTrafo = m_worldTransform->eval(pRec.time).inverse();
         Point local(Point(invTrafo(dRec.d)));
 
-        if (m_distortion) {
-            Float correction = applyDistortion(Vector2(local.x / local.z, local.y / local.z).lengthSquared());
-            local.x *= correction; local.y *= correction;
-        }
-
         if (local.z <= 0)
             return false;
 
+        if (m_distortion) {
+            Point2 p = distort(Point2(local.x / local.z, local.y / local.z));
+            local.x = p.x * local.z; local.y = p.y * local.z;
+        }
+
         Point screenSample = m_cameraToSample(local);
         if (screenSample.x < 0 || screenSample.x > 1 ||
             screenSample.y < 0 || screenSample.y > 1)
@@ -472,8 +750,8 @@ public:
         Point refPc(refP);
 
         if (m_distortion) {
-            Float correction = applyDistortion(Vector2(refPc.x / refPc.z, refPc.y / refPc.z).lengthSquared());
-            refPc.x *= correction; refPc.y *= correction;
+            Point2 p = distort(Point2(refPc.x / refPc.z, refPc.y / refPc.z));
+            refPc.x = p.x * refPc.z; refPc.y = p.y * refPc.z;
         }
 
         Point screenSample = m_cameraToSample(refPc);
@@ -531,6 +809,9 @@ public:
             << "  xfov = " << m_xfov << "," << endl
             << "  nearClip = " << m_nearClip << "," << endl
             << "  farClip = " << m_farClip << "," << endl
+            << "  distortionModel = " << (m_model == EPolynomial ? "polynomial" : "fisheye") << "," << endl
+            << "  kc = [" << m_kc[0] << ", " << m_kc[1] << ", " << m_kc[2] << ", " << m_kc[3] << "]," << endl
+            << "  pc = [" << m_pc[0] << ", " << m_pc[1] << "]," << endl
             << "  worldTransform = " << indent(m_worldTransform.toString()) << "," << endl
             << "  sampler = " << indent(m_sampler->toString()) << "," << endl
             << "  film = " << indent(m_film->toString()) << "," << endl
@@ -543,14 +824,27 @@ public:
 
     MTS_DECLARE_CLASS()
 private:
+    enum EModel {
+        EPolynomial = 0,
+        EFisheye = 1
+    };
+
     Transform m_cameraToSample;
     Transform m_sampleToCamera;
     Transform m_clipTransform;
     AABB2 m_imageRect;
     Float m_normalization;
     Vector m_dx, m_dy;
-    bool m_distortion;
-    Float m_kc[2];
+    EModel m_model;
+    bool m_distortion, m_tangential;
+    Float m_kc[4], m_pc[2];
+    /* Inverse of a radial distortion on [0, m_maxRadius] */
+    std::vector<Float> m_radialTable;
+    Float m_maxRadius;
+    /* Inverse of a general distortion on [m_warpMin, m_warpMax] */
+    std::vector<Float> m_warpX, m_warpY;
+    Size2 m_warpSize;
+    Point2 m_warpMin, m_warpMax;
 };
 
 MTS_IMPLEMENT_CLASS_S(PerspectiveCameraRDist, false, PerspectiveCamera)
@@ -0,0 +1,166 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(__SENSOR_PROBES_H)
+#define __SENSOR_PROBES_H
+
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/properties.h>
+#include <boost/filesystem/fstream.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief List of measurement locations shared by the fluence and
+ * irradiance meters, which evaluate one probe per film pixel
+ *
+ * The probes are loaded from an ASCII file with one probe per line,
+ * which contains its position and (optionally) a normal as three or
+ * six whitespace-separated numbers. Empty lines and lines starting
+ * with \c # are ignored. Probe \c i is recorded by the pixel
+ * <tt>(i mod width, i div width)</tt> of the film.
+ */
+class SensorProbes {
+public:
+    inline SensorProbes() { }
+
+    /// Load the probes referenced by the \c probes parameter (if any)
+    void load(const Properties &props, bool needsNormals) {
+        if (!props.hasProperty("probes"))
+            return;
+
+        fs::path filename = Thread::getThread()->getFileResolver()->resolve(
+            props.getString("probes"));
+        fs::ifstream is(filename);
+        if (is.fail())
+            SLog(EError, "Could not open the probe file \"%s\"!",
+                filename.string().c_str());
+
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(is, line)) {
+            ++lineNumber;
+            std::vector<std::string> tokens = tokenize(line, " \t\r,");
+            if (tokens.empty() || tokens[0][0] == '#')
+                continue;
+            if (tokens.size() != 3 && tokens.size() != 6)
+                SLog(EError, "\"%s\", line %i: expected a position, optionally "
+                    "followed by a normal!", filename.string().c_str(), lineNumber);
+
+            Float values[6];
+            for (size_t i=0; i<tokens.size(); ++i) {
+                char *end_ptr = NULL;
+                values[i] = (Float) std::strtod(tokens[i].c_str(), &end_ptr);
+                if (*end_ptr != '\0')
+                    SLog(EError, "\"%s\", line %i: could not parse \"%s\"!",
+                        filename.string().c_str(), lineNumber, tokens[i].c_str());
+            }
+
+            m_positions.push_back(Point(values[0], values[1], values[2]));
+            if (tokens.size() == 6) {
+                Normal n(values[3], values[4], values[5]);
+                if (n.isZero())
+                    SLog(EError, "\"%s\", line %i: zero normal!",
+                        filename.string().c_str(), lineNumber);
+                m_normals.push_back(normalize(n));
+            } else if (needsNormals) {
+                SLog(EError, "\"%s\", line %i: irradiance probes require a normal!",
+                    filename.string().c_str(), lineNumber);
+            }
+        }
+
+        if (m_positions.empty())
+            SLog(EError, "The probe file \"%s\" is empty!", filename.string().c_str());
+        if (!m_normals.empty() && m_normals.size() != m_positions.size())
+            SLog(EError, "\"%s\": either all or none of the probes must "
+                "specify a normal!", filename.string().c_str());
+        SLog(EInfo, "Loaded " SIZE_T_FMT " probes from \"%s\"", m_positions.size(),
+            filename.filename().string().c_str());
+    }
+
+    /// Unserialize the probes from a binary data stream
+    void load(Stream *stream) {
+        size_t count = stream->readSize();
+        bool hasNormals = stream->readBool();
+        m_positions.resize(count);
+        m_normals.resize(hasNormals ? count : 0);
+        for (size_t i=0; i<count; ++i) {
+            m_positions[i] = Point(stream);
+            if (hasNormals)
+                m_normals[i] = Normal(stream);
+        }
+    }
+
+    /// Serialize the probes to a binary data stream
+    void serialize(Stream *stream) const {
+        stream->writeSize(m_positions.size());
+        stream->writeBool(!m_normals.empty());
+        for (size_t i=0; i<m_positions.size(); ++i) {
+            m_positions[i].serialize(stream);
+            if (!m_normals.empty())
+                m_normals[i].serialize(stream);
+        }
+    }
+
+    /// Were any probes specified?
+    inline bool isEnabled() const { return !m_positions.empty(); }
+
+    /// Return the number of probes
+    inline size_t size() const { return m_positions.size(); }
+
+    /// Check that the film has one pixel per probe
+    void checkFilm(const Film *film) const {
+        const Vector2i &size = film->getCropSize();
+        if ((size_t) size.x * (size_t) size.y != m_positions.size())
+            SLog(EError, "The film must have exactly one pixel per probe (i.e. a "
+                "resolution of " SIZE_T_FMT "x1), found %ix%i!",
+                m_positions.size(), size.x, size.y);
+    }
+
+    /**
+     * \brief Return the probe recorded by the pixel containing
+     * \c pixelSample, and the fractional position within the pixel
+     */
+    inline size_t lookup(const Point2 &pixelSample, int width, Point2 &sample) const {
+        int x = math::floorToInt(pixelSample.x), y = math::floorToInt(pixelSample.y);
+        sample = Point2(pixelSample.x - x, pixelSample.y - y);
+        return std::min((size_t) std::max(0, y * width + x), m_positions.size() - 1);
+    }
+
+    /// Return the center of the pixel that records a probe
+    inline Point2 getPixel(size_t index, int width) const {
+        return Point2((index % width) + 0.5f, (index / width) + 0.5f);
+    }
+
+    /// Return the index of the probe recorded by a pixel position
+    inline size_t getIndex(const Point2 &uv, int width) const {
+        Point2 sample;
+        return lookup(uv, width, sample);
+    }
+
+    inline const Point &getPosition(size_t index) const { return m_positions[index]; }
+    inline const Normal &getNormal(size_t index) const { return m_normals[index]; }
+private:
+    std::vector<Point> m_positions;
+    std::vector<Normal> m_normals;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __SENSOR_PROBES_H */
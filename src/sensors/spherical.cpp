@@ -19,6 +19,7 @@
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/core/track.h>
+#include <boost/algorithm/string.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -34,6 +35,23 @@ MTS_NAMESPACE_BEGIN
  *         is only relevant when the scene is in motion.
  *         \default{0}
  *     }
+ *     \parameter{mapping}{\String}{
+ *         Specifies how directions are mapped to the image.
+ *         \vspace{-1mm}
+ *         \begin{enumerate}[(i)]
+ *             \item \code{latlong}: Latitude-longitude (equirectangular) layout,
+ *             where the rows are spaced uniformly in the elevation angle.
+ *             \item \code{equalarea}: Cylindrical equal-area layout,
+ *             where the rows are spaced uniformly in the cosine of the
+ *             elevation angle, so that every pixel covers the same solid angle.
+ *         \end{enumerate}
+ *         \default{\code{latlong}}
+ *     }
+ *     \parameter{reducePoleSamples}{\Boolean}{
+ *         When using the \code{latlong} mapping, take fewer samples in the
+ *         pixels close to the poles, in proportion to the solid angle they cover.
+ *         \default{\code{false}}
+ *     }
  * }
  *
  * \renderings{
@@ -47,23 +65,97 @@ MTS_NAMESPACE_BEGIN
  * using the \pluginref{envmap} plugin.
  * By default, the camera is located at the origin, which can
  * be changed by providing a custom \code{toWorld} transformation.
+ *
+ * The pixels of a latitude-longitude map become narrower towards the poles,
+ * so a uniform number of samples per pixel spends most of them on a small
+ * part of the sphere. This can be avoided in two ways: the \code{equalarea}
+ * mapping assigns the same solid angle to every pixel (the resulting images
+ * must be converted before they can be used with the \pluginref{envmap}
+ * plugin), while \code{reducePoleSamples} keeps the standard layout and
+ * instead lowers the number of samples of the rows close to the poles.
+ * The latter only applies to the sampling-based integrators, and the
+ * affected pixels use the first samples of the sampler's sequence, hence it
+ * works best with the \pluginref{independent}, \pluginref{halton} and
+ * \pluginref{sobol} samplers.
  */
 
 class SphericalCamera : public Sensor {
 public:
+    /// Layout of the directions in the image
+    enum EMapping {
+        ELatLong = 0,
+        EEqualArea
+    };
+
     SphericalCamera(const Properties &props) : Sensor(props) {
         m_type |= EDeltaPosition | EDirectionSampleMapsToPixels;
 
         if (props.getTransform("toWorld", Transform()).hasScale())
             Log(EError, "Scale factors in the sensor-to-world "
                 "transformation are not allowed!");
+
+        std::string mapping = boost::to_lower_copy(
+            props.getString("mapping", "latlong"));
+        if (mapping == "latlong")
+            m_mapping = ELatLong;
+        else if (mapping == "equalarea")
+            m_mapping = EEqualArea;
+        else
+            Log(EError, "The 'mapping' parameter must be equal to either "
+                "'latlong' or 'equalarea'!");
+
+        m_reducePoleSamples = props.getBoolean("reducePoleSamples", false);
     }
 
     SphericalCamera(Stream *stream, InstanceManager *manager)
      : Sensor(stream, manager) {
+        m_mapping = (EMapping) stream->readUInt();
+        m_reducePoleSamples = stream->readBool();
         configure();
     }
 
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Sensor::serialize(stream, manager);
+        stream->writeUInt(m_mapping);
+        stream->writeBool(m_reducePoleSamples);
+    }
+
+    void configure() {
+        Sensor::configure();
+
+        if (m_reducePoleSamples && m_mapping == ELatLong)
+            m_type |= ENonuniformSampleBudget;
+        else
+            m_type &= ~ENonuniformSampleBudget;
+    }
+
+    /// Compute the elevation of an image row given in fractional coordinates [0, 1]
+    inline void evalElevation(Float y, Float &sinTheta, Float &cosTheta) const {
+        if (m_mapping == ELatLong) {
+            math::sincos(y * M_PI, &sinTheta, &cosTheta);
+        } else {
+            cosTheta = 1 - 2 * y;
+            sinTheta = math::safe_sqrt(1 - cosTheta * cosTheta);
+        }
+    }
+
+    /// Map a direction in local coordinates to fractional image coordinates
+    inline Point2 directionToSample(const Vector &d) const {
+        return Point2(
+            math::modulo(std::atan2(d.x, -d.z) * INV_TWOPI, (Float) 1),
+            m_mapping == ELatLong ? math::safe_acos(d.y) * INV_PI
+                                  : (1 - math::clamp(d.y, (Float) -1, (Float) 1)) * 0.5f
+        );
+    }
+
+    /// Density of the mapping with respect to solid angle
+    inline Float directionDensity(const Vector &d) const {
+        if (m_mapping == EEqualArea)
+            return INV_FOURPI;
+        Float sinTheta = math::safe_sqrt(1-d.y*d.y);
+        return 1 / (2 * M_PI * M_PI * std::max(sinTheta, Epsilon));
+    }
+
     Spectrum sampleRay(Ray &ray, const Point2 &pixelSample,
             const Point2 &otherSample, Float timeSample) const {
         ray.time = sampleTime(timeSample);
@@ -74,7 +166,7 @@ public:
 
         Float sinPhi, cosPhi, sinTheta, cosTheta;
         math::sincos(pixelSample.x * m_invResolution.x * 2 * M_PI, &sinPhi, &cosPhi);
-        math::sincos(pixelSample.y * m_invResolution.y * M_PI, &sinTheta, &cosTheta);
+        evalElevation(pixelSample.y * m_invResolution.y, sinTheta, cosTheta);
 
         Vector d(sinPhi*sinTheta, cosTheta, -cosPhi*sinTheta);
 
@@ -83,6 +175,90 @@ public:
         return Spectrum(1.0f);
     }
 
+    /**
+     * Generate a ray together with its differentials in local coordinates.
+     * The azimuthal differential is the derivative of the direction, which
+     * avoids the two additional ray evaluations of the generic implementation.
+     */
+    inline void sampleLocalRay(const Point2 &pixelSample, Vector &d,
+            Vector &dx, Vector &dy) const {
+        Float sinPhi, cosPhi, sinTheta, cosTheta, sinTheta2, cosTheta2;
+        math::sincos(pixelSample.x * m_invResolution.x * 2 * M_PI, &sinPhi, &cosPhi);
+        evalElevation(pixelSample.y * m_invResolution.y, sinTheta, cosTheta);
+        evalElevation(std::min((Float) 1, (pixelSample.y + 1) * m_invResolution.y),
+            sinTheta2, cosTheta2);
+
+        Float dPhi = 2 * M_PI * m_invResolution.x;
+        d  = Vector(sinPhi*sinTheta, cosTheta, -cosPhi*sinTheta);
+        dx = d + Vector(cosPhi*sinTheta, 0, sinPhi*sinTheta) * dPhi;
+        dy = Vector(sinPhi*sinTheta2, cosTheta2, -cosPhi*sinTheta2);
+    }
+
+    Spectrum sampleRayDifferential(RayDifferential &ray, const Point2 &pixelSample,
+            const Point2 &otherSample, Float timeSample) const {
+        ray.time = sampleTime(timeSample);
+        ray.mint = Epsilon;
+        ray.maxt = std::numeric_limits<Float>::infinity();
+
+        const Transform &trafo = m_worldTransform->eval(ray.time);
+
+        Vector d, dx, dy;
+        sampleLocalRay(pixelSample, d, dx, dy);
+
+        Point origin = trafo(Point(0.0f));
+        ray.setOrigin(origin);
+        ray.setDirection(trafo(d));
+        ray.rxOrigin = ray.ryOrigin = origin;
+        ray.rxDirection = normalize(trafo(dx));
+        ray.ryDirection = trafo(dy);
+        ray.hasDifferentials = true;
+        return Spectrum(1.0f);
+    }
+
+    void sampleRayDifferentials(size_t count, const Point2 *samplePositions,
+            const Point2 *apertureSamples, const Float *timeSamples,
+            RayDifferential *rays, Spectrum *weights) const {
+        if (!m_worldTransform->isStatic()) {
+            Sensor::sampleRayDifferentials(count, samplePositions,
+                apertureSamples, timeSamples, rays, weights);
+            return;
+        }
+
+        /* The transformation is evaluated once per batch */
+        const Transform &trafo = m_worldTransform->eval(0);
+        const Point origin = trafo.transformAffine(Point(0.0f));
+
+        for (size_t i=0; i<count; ++i) {
+            RayDifferential &ray = rays[i];
+            ray.time = sampleTime(timeSamples ? timeSamples[i] : 0.5f);
+            ray.mint = Epsilon;
+            ray.maxt = std::numeric_limits<Float>::infinity();
+
+            Vector d, dx, dy;
+            sampleLocalRay(samplePositions[i], d, dx, dy);
+
+            ray.setOrigin(origin);
+            ray.setDirection(trafo(d));
+            ray.rxOrigin = ray.ryOrigin = origin;
+            ray.rxDirection = normalize(trafo(dx));
+            ray.ryDirection = trafo(dy);
+            ray.hasDifferentials = true;
+            weights[i] = Spectrum(1.0f);
+        }
+    }
+
+    Float getSampleBudget(const Point2i &pixel) const {
+        if (!(m_type & ENonuniformSampleBudget))
+            return 1.0f;
+
+        /* Relative width of the row at its edge closest to the equator */
+        Float y0 = pixel.y * m_invResolution.y,
+              y1 = (pixel.y + 1) * m_invResolution.y;
+        if (y0 <= 0.5f && y1 >= 0.5f)
+            return 1.0f;
+        return std::sin((y1 < 0.5f ? y1 : y0) * M_PI);
+    }
+
     Spectrum samplePosition(PositionSamplingRecord &pRec,
             const Point2 &sample, const Point2 *extra) const {
         const Transform &trafo = m_worldTransform->eval(pRec.time);
@@ -119,11 +295,12 @@ public:
 
         Float sinPhi, cosPhi, sinTheta, cosTheta;
         math::sincos(samplePos.x * 2 * M_PI, &sinPhi, &cosPhi);
-        math::sincos(samplePos.y * M_PI, &sinTheta, &cosTheta);
+        evalElevation(samplePos.y, sinTheta, cosTheta);
 
-        dRec.d = trafo(Vector(sinPhi*sinTheta, cosTheta, -cosPhi*sinTheta));
+        Vector d(sinPhi*sinTheta, cosTheta, -cosPhi*sinTheta);
+        dRec.d = trafo(d);
         dRec.measure = ESolidAngle;
-        dRec.pdf = 1 / (2 * M_PI * M_PI * std::max(sinTheta, Epsilon));
+        dRec.pdf = directionDensity(d);
 
         return Spectrum(1.0f);
     }
@@ -134,9 +311,7 @@ public:
             return 0.0f;
 
         Vector d = m_worldTransform->eval(pRec.time).inverse()(dRec.d);
-        Float sinTheta = math::safe_sqrt(1-d.y*d.y);
-
-        return 1 / (2 * M_PI * M_PI * std::max(sinTheta, Epsilon));
+        return directionDensity(d);
     }
 
     Spectrum evalDirection(const DirectionSamplingRecord &dRec,
@@ -145,19 +320,15 @@ public:
             return Spectrum(0.0f);
 
         Vector d = m_worldTransform->eval(pRec.time).inverse()(dRec.d);
-        Float sinTheta = math::safe_sqrt(1-d.y*d.y);
-
-        return Spectrum(1 / (2 * M_PI * M_PI * std::max(sinTheta, Epsilon)));
+        return Spectrum(directionDensity(d));
     }
 
     bool getSamplePosition(const PositionSamplingRecord &pRec,
             const DirectionSamplingRecord &dRec, Point2 &samplePosition) const {
         Vector d = normalize(m_worldTransform->eval(pRec.time).inverse()(dRec.d));
+        Point2 uv = directionToSample(d);
 
-        samplePosition = Point2(
-            math::modulo(std::atan2(d.x, -d.z) * INV_TWOPI, (Float) 1) * m_resolution.x,
-            math::safe_acos(d.y) * INV_PI * m_resolution.y
-        );
+        samplePosition = Point2(uv.x * m_resolution.x, uv.y * m_resolution.y);
 
         return true;
     }
@@ -172,12 +343,8 @@ public:
               invDist = 1.0f / dist;
         d *= invDist;
 
-        dRec.uv = Point2(
-            math::modulo(std::atan2(d.x, -d.z) * INV_TWOPI, (Float) 1) * m_resolution.x,
-            math::safe_acos(d.y) * INV_PI * m_resolution.y
-        );
-
-        Float sinTheta = math::safe_sqrt(1-d.y*d.y);
+        Point2 uv = directionToSample(d);
+        dRec.uv = Point2(uv.x * m_resolution.x, uv.y * m_resolution.y);
 
         dRec.p = trafo.transformAffine(Point(0.0f));
         dRec.d = (dRec.p - dRec.ref) * invDist;
@@ -186,8 +353,7 @@ public:
         dRec.pdf = 1;
         dRec.measure = EDiscrete;
 
-        return Spectrum(
-            (1/(2 * M_PI * M_PI * std::max(sinTheta, Epsilon))) * invDist * invDist);
+        return Spectrum(directionDensity(d) * invDist * invDist);
     }
 
     Float pdfDirect(const DirectSamplingRecord &dRec) const {
@@ -202,6 +368,8 @@ public:
         std::ostringstream oss;
         oss << "SphericalCamera[" << endl
             << "  worldTransform = " << indent(m_worldTransform.toString()) << "," << endl
+            << "  mapping = " << (m_mapping == ELatLong ? "latlong" : "equalarea") << "," << endl
+            << "  reducePoleSamples = " << m_reducePoleSamples << "," << endl
             << "  sampler = " << indent(m_sampler->toString()) << "," << endl
             << "  film = " << indent(m_film->toString()) << "," << endl
             << "  medium = " << indent(m_medium.toString()) << "," << endl
@@ -212,6 +380,9 @@ public:
     }
 
     MTS_DECLARE_CLASS()
+private:
+    EMapping m_mapping;
+    bool m_reducePoleSamples;
 };
 
 MTS_IMPLEMENT_CLASS_S(SphericalCamera, false, Sensor)
@@ -41,9 +41,11 @@ public:
         Float u, v;
     };
 
-    SpaceTimeKDTree(const std::vector<Float> &times) : m_times(times) { }
+    SpaceTimeKDTree(const std::vector<Float> &times) : m_times(times),
+        m_refit(true), m_refitThreshold(1.5f) { }
 
-    SpaceTimeKDTree(Stream *stream, InstanceManager *manager) {
+    SpaceTimeKDTree(Stream *stream, InstanceManager *manager)
+        : m_refit(true), m_refitThreshold(1.5f) {
         size_t times = (size_t) stream->readUInt();
         m_times.resize(times);
         m_meshes.resize(times);
@@ -58,9 +60,7 @@ public:
     }
 
     ~SpaceTimeKDTree() {
-        for (size_t i=0; i<m_meshes.size(); ++i)
-            for (size_t j=0; j<m_meshes[i].size(); ++j)
-                m_meshes[i][j]->decRef();
+        clearShapes();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -99,8 +99,78 @@ public:
             m_meshes.push_back(vec);
     }
 
+    /// Release all key-framed meshes (e.g. before adding a new set)
+    void clearShapes() {
+        for (size_t i=0; i<m_meshes.size(); ++i)
+            for (size_t j=0; j<m_meshes[i].size(); ++j)
+                m_meshes[i][j]->decRef();
+        m_meshes.clear();
+    }
 
     void build() {
+        validate();
+        this->setClip(false);
+        buildInternal();
+        finalize();
+    }
+
+    /**
+     * \brief Update the tree after the key-framed meshes have been
+     * replaced by a new set with the same topology
+     *
+     * Unless disabled, this refits the existing tree and only falls
+     * back to a full rebuild once its SAH cost has grown by more than
+     * the refit threshold (relative to the last full build).
+     */
+    void update() {
+        std::vector<IndexType> shapeMap(m_shapeMap);
+        validate();
+
+        if (!isBuilt()) {
+            build();
+            return;
+        } else if (!m_refit || shapeMap != m_shapeMap) {
+            clearInternal();
+            build();
+            return;
+        }
+
+        Float buildCost = getSAHCost();
+        Float cost = refitInternal(buildCost * m_refitThreshold);
+
+        if (cost > buildCost * m_refitThreshold) {
+            KDLog(EInfo, "Refitting the spacetime kd-tree increased its SAH cost "
+                "by more than %.1f%% -- rebuilding ..", (m_refitThreshold - 1) * 100);
+            clearInternal();
+            build();
+            return;
+        }
+
+        Float drift = buildCost > 0 ? cost / buildCost : 1.0f;
+
+        KDLog(EInfo, "Refitted the spacetime kd-tree (SAH cost: %.2f, "
+            "drift: %+.1f%%)", cost, (drift - 1) * 100);
+
+        m_spatialAABB = AABB(
+            Point(m_aabb.min.x, m_aabb.min.y, m_aabb.min.z),
+            Point(m_aabb.max.x, m_aabb.max.y, m_aabb.max.z)
+        );
+    }
+
+    /// Enable or disable refitting in \ref update()
+    inline void setRefit(bool refit) { m_refit = refit; }
+
+    /// Return whether \ref update() refits the tree instead of rebuilding it
+    inline bool getRefit() const { return m_refit; }
+
+    /// Set the tolerated relative SAH cost increase before \ref update() rebuilds
+    inline void setRefitThreshold(Float threshold) { m_refitThreshold = threshold; }
+
+    /// Return the tolerated relative SAH cost increase before \ref update() rebuilds
+    inline Float getRefitThreshold() const { return m_refitThreshold; }
+
+    /// Check the key-framed meshes and compute the primitive index map
+    void validate() {
         if (m_meshes.size() < 2)
             Log(EError, "The deformable shape requires at least two sub-shapes!");
 
@@ -136,10 +206,10 @@ public:
         m_shapeMap[0] = 0;
         for (size_t i=0; i<m_meshes[0].size(); ++i)
             m_shapeMap[i+1] = m_shapeMap[i] + (SizeType) m_meshes[0][i]->getTriangleCount();
+    }
 
-        this->setClip(false);
-        buildInternal();
-
+    /// Collect statistics and compute the spatial bounds after a build
+    void finalize() {
         /* Collect some statistics */
         std::stack<const KDNode *> stack;
 
@@ -368,6 +438,12 @@ public:
         return m_meshes[frameIndex][shapeIndex];
     }
 
+    /// Return the index of a sub-shape given its mesh in the first key frame
+    inline IndexType getShapeIndex(const Shape *shape) const {
+        const std::vector<const TriMesh *> &meshes = m_meshes[0];
+        return (IndexType) (std::find(meshes.begin(), meshes.end(), shape) - meshes.begin());
+    }
+
     inline Triangle getTriangle(IndexType shapeIndex, IndexType primIndex) const {
         return m_meshes[0][shapeIndex]->getTriangles()[primIndex];
     }
@@ -383,6 +459,8 @@ protected:
     std::vector<IndexType> m_shapeMap;
     AABB m_spatialAABB;
     Float m_traceTime;
+    bool m_refit;
+    Float m_refitThreshold;
 };
 
 class Deformable : public Shape {
@@ -400,11 +478,25 @@ public:
             times[i] = value;
         }
         m_kdtree = new SpaceTimeKDTree(times);
+
+        /* When the key-framed meshes are replaced after the shape has
+           been configured (e.g. for the next frame of a simulation),
+           refit the existing kd-tree instead of building a new one? */
+        m_kdtree->setRefit(props.getBoolean("refit", true));
+
+        /* Rebuild from scratch once refitting has increased the SAH cost
+           by more than this factor (relative to the last full build) */
+        Float refitThreshold = props.getFloat("refitThreshold", 1.5f);
+        if (refitThreshold < 1)
+            Log(EError, "The 'refitThreshold' parameter must be >= 1!");
+        m_kdtree->setRefitThreshold(refitThreshold);
+        m_replacingShapes = false;
     }
 
     Deformable(Stream *stream, InstanceManager *manager)
         : Shape(stream, manager) {
         m_kdtree = new SpaceTimeKDTree(stream, manager);
+        m_replacingShapes = false;
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -413,7 +505,11 @@ public:
     }
 
     void configure() {
-        m_kdtree->build();
+        if (m_kdtree->isBuilt())
+            m_kdtree->update();
+        else
+            m_kdtree->build();
+        m_replacingShapes = false;
     }
 
     bool rayIntersect(const Ray &ray, Float mint,
@@ -438,12 +534,6 @@ public:
 
         const Point *vertexPositions0 = trimesh0->getVertexPositions();
         const Point *vertexPositions1 = trimesh1->getVertexPositions();
-        const Normal *vertexNormals0 = trimesh0->getVertexNormals();
-        const Normal *vertexNormals1 = trimesh1->getVertexNormals();
-        const Point2 *vertexTexcoords0 = trimesh0->getVertexTexcoords();
-        const Point2 *vertexTexcoords1 = trimesh1->getVertexTexcoords();
-        const Color3 *vertexColors0 = trimesh0->getVertexColors();
-        const Color3 *vertexColors1 = trimesh1->getVertexColors();
         const TangentSpace *vertexTangents0 = trimesh0->getUVTangents();
         const TangentSpace *vertexTangents1 = trimesh1->getUVTangents();
 
@@ -469,11 +559,11 @@ public:
             its.dpdv = side2;
         }
 
-        if (EXPECT_TAKEN(vertexNormals0)) {
+        if (EXPECT_TAKEN(trimesh0->hasVertexNormals())) {
             Normal
-                n0 = (1-alpha) * vertexNormals0[idx0] + alpha * vertexNormals1[idx0],
-                n1 = (1-alpha) * vertexNormals0[idx1] + alpha * vertexNormals1[idx1],
-                n2 = (1-alpha) * vertexNormals0[idx2] + alpha * vertexNormals1[idx2];
+                n0 = (1-alpha) * trimesh0->getVertexNormal(idx0) + alpha * trimesh1->getVertexNormal(idx0),
+                n1 = (1-alpha) * trimesh0->getVertexNormal(idx1) + alpha * trimesh1->getVertexNormal(idx1),
+                n2 = (1-alpha) * trimesh0->getVertexNormal(idx2) + alpha * trimesh1->getVertexNormal(idx2);
 
             its.shFrame.n = normalize(n0 * b.x + n1 * b.y + n2 * b.z);
 
@@ -485,21 +575,21 @@ public:
         }
         its.geoFrame = Frame(faceNormal);
 
-        if (EXPECT_TAKEN(vertexTexcoords0)) {
+        if (EXPECT_TAKEN(trimesh0->hasVertexTexcoords())) {
             Point2
-                t0 = (1-alpha) * vertexTexcoords0[idx0] + alpha * vertexTexcoords1[idx0],
-                t1 = (1-alpha) * vertexTexcoords0[idx1] + alpha * vertexTexcoords1[idx1],
-                t2 = (1-alpha) * vertexTexcoords0[idx2] + alpha * vertexTexcoords1[idx2];
+                t0 = (1-alpha) * trimesh0->getVertexTexcoord(idx0) + alpha * trimesh1->getVertexTexcoord(idx0),
+                t1 = (1-alpha) * trimesh0->getVertexTexcoord(idx1) + alpha * trimesh1->getVertexTexcoord(idx1),
+                t2 = (1-alpha) * trimesh0->getVertexTexcoord(idx2) + alpha * trimesh1->getVertexTexcoord(idx2);
             its.uv = t0 * b.x + t1 * b.y + t2 * b.z;
         } else {
             its.uv = Point2(b.y, b.z);
         }
 
-        if (EXPECT_NOT_TAKEN(vertexColors0)) {
+        if (EXPECT_NOT_TAKEN(trimesh0->hasVertexColors())) {
             Color3
-                c0 = (1-alpha) * vertexColors0[idx0] + alpha * vertexColors1[idx0],
-                c1 = (1-alpha) * vertexColors0[idx1] + alpha * vertexColors1[idx1],
-                c2 = (1-alpha) * vertexColors0[idx2] + alpha * vertexColors1[idx2];
+                c0 = (1-alpha) * trimesh0->getVertexColor(idx0) + alpha * trimesh1->getVertexColor(idx0),
+                c1 = (1-alpha) * trimesh0->getVertexColor(idx1) + alpha * trimesh1->getVertexColor(idx1),
+                c2 = (1-alpha) * trimesh0->getVertexColor(idx2) + alpha * trimesh1->getVertexColor(idx2);
             Color3 result(c0 * b.x + c1 * b.y + c2 * b.z);
             its.color.fromLinearRGB(result[0], result[1],
                 result[2], Spectrum::EReflectance);
@@ -508,7 +598,6 @@ public:
         its.shape = m_kdtree->getMesh(0, cache->shapeIndex);
         its.hasUVPartials = false;
         its.primIndex = cache->primIndex;
-        its.other = cache->shapeIndex;
         its.instance = this;
         its.time = ray.time;
     }
@@ -522,17 +611,14 @@ public:
             (its.time - times[frameIndex])
             / (times[frameIndex + 1] - times[frameIndex])));
 
-        uint32_t primIndex = its.primIndex, shapeIndex = its.other;
+        uint32_t primIndex = its.primIndex,
+                 shapeIndex = m_kdtree->getShapeIndex(its.shape);
         const TriMesh *trimesh0 = m_kdtree->getMesh(frameIndex,   shapeIndex);
         const TriMesh *trimesh1 = m_kdtree->getMesh(frameIndex+1, shapeIndex);
         const Point *vertexPositions0 = trimesh0->getVertexPositions();
         const Point *vertexPositions1 = trimesh1->getVertexPositions();
-        const Point2 *vertexTexcoords0 = trimesh0->getVertexTexcoords();
-        const Point2 *vertexTexcoords1 = trimesh1->getVertexTexcoords();
-        const Normal *vertexNormals0 = trimesh0->getVertexNormals();
-        const Normal *vertexNormals1 = trimesh1->getVertexNormals();
 
-        if (!vertexNormals0 || !vertexNormals1) {
+        if (!trimesh0->hasVertexNormals() || !trimesh1->hasVertexNormals()) {
             dndu = dndv = Vector(0.0f);
         } else {
             const Triangle &tri = trimesh0->getTriangles()[primIndex];
@@ -565,9 +651,9 @@ public:
                   w = 1 - u - v;
 
             const Normal
-                n0 = normalize((1-alpha)*vertexNormals0[idx0] + alpha*vertexNormals1[idx0]),
-                n1 = normalize((1-alpha)*vertexNormals0[idx1] + alpha*vertexNormals1[idx1]),
-                n2 = normalize((1-alpha)*vertexNormals0[idx2] + alpha*vertexNormals1[idx2]);
+                n0 = normalize((1-alpha)*trimesh0->getVertexNormal(idx0) + alpha*trimesh1->getVertexNormal(idx0)),
+                n1 = normalize((1-alpha)*trimesh0->getVertexNormal(idx1) + alpha*trimesh1->getVertexNormal(idx1)),
+                n2 = normalize((1-alpha)*trimesh0->getVertexNormal(idx2) + alpha*trimesh1->getVertexNormal(idx2));
 
             /* Now compute the derivative of "normalize(u*n1 + v*n2 + (1-u-v)*n0)"
                with respect to [u, v] in the local triangle parameterization.
@@ -582,13 +668,13 @@ public:
             dndu = (n1 - n0) * il; dndu -= N * dot(N, dndu);
             dndv = (n2 - n0) * il; dndv -= N * dot(N, dndv);
 
-            if (vertexTexcoords0 && vertexTexcoords1) {
+            if (trimesh0->hasVertexTexcoords() && trimesh1->hasVertexTexcoords()) {
                 /* Compute derivatives with respect to a specified texture
                    UV parameterization.  */
                 const Point2
-                    uv0 = (1-alpha)*vertexTexcoords0[idx0] + alpha*vertexTexcoords1[idx0],
-                    uv1 = (1-alpha)*vertexTexcoords0[idx1] + alpha*vertexTexcoords1[idx1],
-                    uv2 = (1-alpha)*vertexTexcoords0[idx2] + alpha*vertexTexcoords1[idx2];
+                    uv0 = (1-alpha)*trimesh0->getVertexTexcoord(idx0) + alpha*trimesh1->getVertexTexcoord(idx0),
+                    uv1 = (1-alpha)*trimesh0->getVertexTexcoord(idx1) + alpha*trimesh1->getVertexTexcoord(idx1),
+                    uv2 = (1-alpha)*trimesh0->getVertexTexcoord(idx2) + alpha*trimesh1->getVertexTexcoord(idx2);
 
                 Vector2 duv1 = uv1 - uv0, duv2 = uv2 - uv0;
 
@@ -614,7 +700,7 @@ public:
         const std::vector<Float> &times = m_kdtree->getTimes();
 
         cache.primIndex = its.primIndex;
-        cache.shapeIndex = its.other;
+        cache.shapeIndex = m_kdtree->getShapeIndex(its.shape);
         cache.frameIndex = m_kdtree->findFrame(its.time);
         cache.alpha = std::max((Float) 0.0f, std::min((Float) 1.0f,
             (its.time - times[cache.frameIndex])
@@ -663,9 +749,15 @@ public:
     }
 
     void addChild(const std::string &name, ConfigurableObject *child) {
-        if (child->getClass()->derivesFrom(MTS_CLASS(Shape)))
+        if (child->getClass()->derivesFrom(MTS_CLASS(Shape))) {
+            /* Adding meshes to a configured shape starts a new set of
+               key frames, which replaces the current one */
+            if (m_kdtree->isBuilt() && !m_replacingShapes) {
+                m_kdtree->clearShapes();
+                m_replacingShapes = true;
+            }
             m_kdtree->addShape(static_cast<Shape *>(child));
-        else
+        } else
             Shape::addChild(name, child);
     }
 
@@ -678,6 +770,8 @@ public:
         oss << "Deformable[" << endl
             << "   primitiveCount = " << m_kdtree->getPrimitiveCount() << "," << endl
             << "   timeCount = " << m_kdtree->getTimeCount() << "," << endl
+            << "   refit = " << (m_kdtree->getRefit() ? "true" : "false") << "," << endl
+            << "   refitThreshold = " << m_kdtree->getRefitThreshold() << "," << endl
             << "   aabb = " << indent(m_kdtree->getSpatialAABB().toString()) << endl
             << "]";
         return oss.str();
@@ -686,6 +780,7 @@ public:
     MTS_DECLARE_CLASS()
 private:
     ref<SpaceTimeKDTree> m_kdtree;
+    bool m_replacingShapes;
 };
 
 MTS_IMPLEMENT_CLASS_S(SpaceTimeKDTree, false, KDTreeBase)
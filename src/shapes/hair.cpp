@@ -28,6 +28,12 @@
 
 #define MTS_HAIR_USE_FANCY_CLIPPING 1
 
+/// Number of vertices that share a quantization range (as a power of two)
+#define MTS_HAIR_QUANTIZATION_BLOCK_SHIFT 6
+
+/// Number of bits per coordinate of a quantized vertex
+#define MTS_HAIR_QUANTIZATION_BITS 21
+
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{hair}{Hair intersection shape}
@@ -54,6 +60,13 @@ MTS_NAMESPACE_BEGIN
  *       \cite{Cook2007Stochastic}). This parameter is convenient for fast
  *       previews. \default{0, i.e. all geometry is rendered}
  *     }
+ *     \parameter{quantize}{\Boolean}{
+ *       Store the hair vertices in a compact quantized form, which
+ *       reduces their memory usage by about a third. Every block of
+ *       64 consecutive vertices is quantized to 21 bits per coordinate
+ *       relative to its own bounding box, hence the error is far
+ *       below the hair radius. \default{\code{false}}
+ *     }
  *     \parameter{toWorld}{\Transform}{
  *        Specifies an optional linear object-to-world transformation.
  *        Note that non-uniform scales are not permitted!
@@ -106,11 +119,12 @@ public:
     using SAHKDTree3D<HairKDTree>::SizeType;
 
     HairKDTree(std::vector<Point> &vertices,
-            std::vector<bool> &vertexStartsFiber, Float radius)
-            : m_radius(radius) {
+            std::vector<bool> &vertexStartsFiber, Float radius, bool quantize)
+            : m_radius(radius), m_quantized(false) {
         /* Take the supplied vertex & start fiber arrays (without copying) */
         m_vertices.swap(vertices);
         m_vertexStartsFiber.swap(vertexStartsFiber);
+        m_vertexCount = m_vertices.size();
         m_hairCount = 0;
 
         /* Compute the index of the first vertex in each segment. */
@@ -123,9 +137,14 @@ public:
         }
         m_segmentCount = m_segIndex.size();
 
+        /* The tree is built from the quantized vertices, so
+           that it is consistent with the intersection code */
+        if (quantize)
+            quantizeVertices();
+
         Log(EDebug, "Building a kd-tree for " SIZE_T_FMT " hair vertices, "
             SIZE_T_FMT " segments, " SIZE_T_FMT " hairs",
-            m_vertices.size(), m_segmentCount, m_hairCount);
+            m_vertexCount, m_segmentCount, m_hairCount);
 
         /* Ray-cylinder intersections are expensive. Use only the
            SAH cost as the tree subdivision stopping criterion,
@@ -145,8 +164,10 @@ public:
         Log(EDebug, "Total amount of storage (kd-tree & vertex data): %s",
             memString(m_nodeCount * sizeof(KDNode)
             + m_indexCount * sizeof(IndexType)
-            + vertices.size() * sizeof(Point)
-            + vertexStartsFiber.size() / 8).c_str());
+            + m_vertices.size() * sizeof(Point)
+            + m_quantizedVertices.size() * sizeof(uint64_t)
+            + m_blocks.size() * sizeof(QuantizationBlock)
+            + m_vertexStartsFiber.size() / 8).c_str());
 
         /* Optimization: replace all primitive indices by the
            associated vertex indices (this avoids an extra
@@ -163,9 +184,23 @@ public:
         return m_aabb;
     }
 
-    /// Return the list of vertices underlying the hair kd-tree
-    inline const std::vector<Point> &getVertices() const {
-        return m_vertices;
+    /// Return the position of a vertex
+    inline Point getVertex(IndexType iv) const {
+        if (EXPECT_TAKEN(!m_quantized))
+            return m_vertices[iv];
+
+        const QuantizationBlock &block = m_blocks[iv >> MTS_HAIR_QUANTIZATION_BLOCK_SHIFT];
+        const uint64_t value = m_quantizedVertices[iv];
+        const uint64_t mask = (((uint64_t) 1) << MTS_HAIR_QUANTIZATION_BITS) - 1;
+        return block.origin + Vector(
+            (Float) (value & mask) * block.scale.x,
+            (Float) ((value >> MTS_HAIR_QUANTIZATION_BITS) & mask) * block.scale.y,
+            (Float) ((value >> (2*MTS_HAIR_QUANTIZATION_BITS)) & mask) * block.scale.z);
+    }
+
+    /// Are the vertices stored in quantized form?
+    inline bool isQuantized() const {
+        return m_quantized;
     }
 
     /**
@@ -193,7 +228,7 @@ public:
 
     /// Return the total number of vertices
     inline size_t getVertexCount() const {
-        return m_vertices.size();
+        return m_vertexCount;
     }
 
     /// Intersect a ray with all segments stored in the kd-tree
@@ -548,14 +583,14 @@ public:
     }
 
     /* Some utility functions */
-    inline Point firstVertex(IndexType iv) const { return m_vertices[iv]; }
-    inline Point3d firstVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv]); }
-    inline Point secondVertex(IndexType iv) const { return m_vertices[iv+1]; }
-    inline Point3d secondVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv+1]); }
-    inline Point prevVertex(IndexType iv) const { return m_vertices[iv-1]; }
-    inline Point3d prevVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv-1]); }
-    inline Point nextVertex(IndexType iv) const { return m_vertices[iv+2]; }
-    inline Point3d nextVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv+2]); }
+    inline Point firstVertex(IndexType iv) const { return getVertex(iv); }
+    inline Point3d firstVertexDouble(IndexType iv) const { return Point3d(getVertex(iv)); }
+    inline Point secondVertex(IndexType iv) const { return getVertex(iv+1); }
+    inline Point3d secondVertexDouble(IndexType iv) const { return Point3d(getVertex(iv+1)); }
+    inline Point prevVertex(IndexType iv) const { return getVertex(iv-1); }
+    inline Point3d prevVertexDouble(IndexType iv) const { return Point3d(getVertex(iv-1)); }
+    inline Point nextVertex(IndexType iv) const { return getVertex(iv+2); }
+    inline Point3d nextVertexDouble(IndexType iv) const { return Point3d(getVertex(iv+2)); }
 
     inline bool prevSegmentExists(IndexType iv) const { return !m_vertexStartsFiber[iv]; }
     inline bool nextSegmentExists(IndexType iv) const { return !m_vertexStartsFiber[iv+2]; }
@@ -598,18 +633,72 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    /// Quantization range of a block of consecutive vertices
+    struct QuantizationBlock {
+        Point origin;
+        Vector scale;
+    };
+
+    /**
+     * \brief Replace the vertices by their quantized form
+     *
+     * Each coordinate becomes a fixed-point number relative to the
+     * bounding box of its block, and all three are packed into 64 bits.
+     */
+    void quantizeVertices() {
+        const size_t blockSize = ((size_t) 1) << MTS_HAIR_QUANTIZATION_BLOCK_SHIFT;
+        const uint64_t maxValue = (((uint64_t) 1) << MTS_HAIR_QUANTIZATION_BITS) - 1;
+
+        m_blocks.resize((m_vertexCount + blockSize - 1) / blockSize);
+        m_quantizedVertices.resize(m_vertexCount);
+
+        for (size_t i=0; i<m_blocks.size(); ++i) {
+            size_t start = i * blockSize, end = std::min(start + blockSize, m_vertexCount);
+
+            AABB aabb;
+            for (size_t j=start; j<end; ++j)
+                aabb.expandBy(m_vertices[j]);
+
+            QuantizationBlock &block = m_blocks[i];
+            block.origin = aabb.min;
+            Vector extents = aabb.getExtents();
+            for (int k=0; k<3; ++k)
+                block.scale[k] = extents[k] / (Float) maxValue;
+
+            for (size_t j=start; j<end; ++j) {
+                uint64_t value = 0;
+                for (int k=0; k<3; ++k) {
+                    uint64_t q = 0;
+                    if (block.scale[k] > 0)
+                        q = std::min(maxValue, (uint64_t) ((m_vertices[j][k]
+                            - block.origin[k]) / block.scale[k] + (Float) 0.5f));
+                    value |= q << (k * MTS_HAIR_QUANTIZATION_BITS);
+                }
+                m_quantizedVertices[j] = value;
+            }
+        }
+
+        std::vector<Point>().swap(m_vertices);
+        m_quantized = true;
+    }
+
     std::vector<Point> m_vertices;
+    std::vector<uint64_t> m_quantizedVertices;
+    std::vector<QuantizationBlock> m_blocks;
     std::vector<bool> m_vertexStartsFiber;
     std::vector<IndexType> m_segIndex;
+    size_t m_vertexCount;
     size_t m_segmentCount;
     size_t m_hairCount;
     Float m_radius;
+    bool m_quantized;
 };
 
 HairShape::HairShape(const Properties &props) : Shape(props) {
     fs::path path = Thread::getThread()->getFileResolver()->resolve(
         props.getString("filename"));
     Float radius = props.getFloat("radius", 0.025f);
+    bool quantize = props.getBoolean("quantize", false);
     /* Skip segments, whose tangent differs by less than one degree
        compared to the previous one */
     Float angleThreshold = degToRad(props.getFloat("angleThreshold", 1.0f));
@@ -781,12 +870,13 @@ HairShape::HairShape(const Properties &props) : Shape(props) {
 
     vertexStartsFiber.push_back(true);
 
-    m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius);
+    m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius, quantize);
 }
 
 HairShape::HairShape(Stream *stream, InstanceManager *manager)
     : Shape(stream, manager) {
     Float radius = stream->readFloat();
+    bool quantize = stream->readBool();
     size_t vertexCount = stream->readSize();
 
     std::vector<Point> vertices(vertexCount);
@@ -797,16 +887,19 @@ HairShape::HairShape(Stream *stream, InstanceManager *manager)
         vertexStartsFiber[i] = stream->readBool();
     vertexStartsFiber[vertexCount] = true;
 
-    m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius);
+    m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius, quantize);
 }
 
 void HairShape::serialize(Stream *stream, InstanceManager *manager) const {
     Shape::serialize(stream, manager);
 
-    const std::vector<Point> &vertices = m_kdtree->getVertices();
+    /* Quantized vertices are sent in decoded form and quantized
+       again on the receiving side */
+    std::vector<Point> vertices = getVertices();
     const std::vector<bool> &vertexStartsFiber = m_kdtree->getStartFiber();
 
     stream->writeFloat(m_kdtree->getRadius());
+    stream->writeBool(m_kdtree->isQuantized());
     stream->writeSize(vertices.size());
     stream->writeFloatArray((Float *) &vertices[0], vertices.size() * 3);
     for (size_t i=0; i<vertices.size(); ++i)
@@ -866,7 +959,7 @@ ref<TriMesh> HairShape::createTriMesh() {
     Triangle *triangles = mesh->getTriangles();
     size_t triangleIdx = 0, vertexIdx = 0;
 
-    const std::vector<Point> &hairVertices = m_kdtree->getVertices();
+    const size_t vertexCount = m_kdtree->getVertexCount();
     const std::vector<bool> &vertexStartsFiber = m_kdtree->getStartFiber();
     const Float radius = m_kdtree->getRadius();
     Float *cosPhi = new Float[phiSteps];
@@ -877,7 +970,7 @@ ref<TriMesh> HairShape::createTriMesh() {
     }
 
     uint32_t hairIdx = 0;
-    for (HairKDTree::IndexType iv=0; iv<(HairKDTree::IndexType) hairVertices.size()-1; iv++) {
+    for (HairKDTree::IndexType iv=0; iv<(HairKDTree::IndexType) vertexCount-1; iv++) {
         if (!vertexStartsFiber[iv+1]) {
             for (uint32_t phi=0; phi<phiSteps; ++phi) {
                 Vector tangent = m_kdtree->tangent(iv);
@@ -924,8 +1017,12 @@ const KDTreeBase<AABB> *HairShape::getKDTree() const {
     return m_kdtree.get();
 }
 
-const std::vector<Point> &HairShape::getVertices() const {
-    return m_kdtree->getVertices();
+std::vector<Point> HairShape::getVertices() const {
+    size_t vertexCount = m_kdtree->getVertexCount();
+    std::vector<Point> vertices(vertexCount);
+    for (size_t i=0; i<vertexCount; ++i)
+        vertices[i] = m_kdtree->getVertex((HairKDTree::IndexType) i);
+    return vertices;
 }
 
 const std::vector<bool> &HairShape::getStartFiber() const {
@@ -955,7 +1052,8 @@ std::string HairShape::toString() const {
         << "   numVertices = " << m_kdtree->getVertexCount() << ","
         << "   numSegments = " << m_kdtree->getSegmentCount() << ","
         << "   numHairs = " << m_kdtree->getHairCount() << ","
-        << "   radius = " << m_kdtree->getRadius()
+        << "   radius = " << m_kdtree->getRadius() << ","
+        << "   quantized = " << m_kdtree->isQuantized()
         << "]";
     return oss.str();
 }
@@ -47,8 +47,13 @@ public:
     //! @{ \name Access the internal vertex data
     // =============================================================
 
-    /// Return the list of vertices underlying the hair shape
-    const std::vector<Point> &getVertices() const;
+    /**
+     * \brief Return the list of vertices underlying the hair shape
+     *
+     * When the vertices are stored in quantized form, this returns
+     * the decoded positions.
+     */
+    std::vector<Point> getVertices() const;
 
     /**
      * Return a boolean list specifying whether a vertex
@@ -60,6 +60,17 @@ namespace {
     struct StackEntry {
         int level, x, y;
     };
+
+    /**
+     * \brief Conservatively quantized height interval of a quadtree node
+     *
+     * The bounds are given in steps relative to the minimum height of the
+     * whole height field. The minimum is rounded down and the maximum is
+     * rounded up, hence the decoded interval always contains the exact one.
+     */
+    struct QuantizedInterval {
+        uint16_t min, max;
+    };
 };
 
 /*!\plugin{heightfield}{Height field intersection shape}
@@ -109,7 +120,11 @@ namespace {
  * \cite{Tevs2008Maximum}, allowing cheap storage and efficient ray
  * intersection queries. It is generally preferable to represent
  * height fields using this specialized plugin rather than converting
- * them into triangle meshes.
+ * them into triangle meshes. To keep the memory usage close to that of
+ * the height values themselves, the bounds of the finest level are
+ * computed from the height values when needed, the coarser levels store
+ * conservatively quantized 16-bit bounds, and the shading normals are
+ * evaluated on the fly.
  *
  * \begin{xml}[caption={Declaring a height field from a monochromatic scaled bitmap texture}, label=lst:heightfield-bitmap]
  * <shape type="heightfield">
@@ -121,7 +136,7 @@ namespace {
 
 class Heightfield : public Shape {
 public:
-    Heightfield(const Properties &props) : Shape(props), m_data(NULL), m_normals(NULL), m_minmax(NULL) {
+    Heightfield(const Properties &props) : Shape(props), m_data(NULL), m_minmax(NULL) {
         m_sizeHint = Vector2i(
             props.getInteger("width", -1),
             props.getInteger("height", -1)
@@ -138,7 +153,7 @@ public:
     }
 
     Heightfield(Stream *stream, InstanceManager *manager)
-        : Shape(stream, manager), m_data(NULL), m_normals(NULL), m_minmax(NULL) {
+        : Shape(stream, manager), m_data(NULL), m_minmax(NULL) {
 
         m_objectToWorld = Transform(stream);
         m_shadingNormals = stream->readBool();
@@ -156,7 +171,7 @@ public:
         if (m_data)
             freeAligned(m_data);
         if (m_minmax) {
-            for (int i=0; i<m_levelCount; ++i)
+            for (int i=1; i<m_levelCount; ++i)
                 freeAligned(m_minmax[i]);
             delete[] m_minmax;
             delete[] m_levelSize;
@@ -164,8 +179,6 @@ public:
             delete[] m_blockSize;
             delete[] m_blockSizeF;
         }
-        if (m_normals)
-            freeAligned(m_normals);
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -269,13 +282,29 @@ public:
             ++nTraversals;
 
             /* Pop a node from the stack and compute its bounding box */
-            StackEntry entry         = stack[stackIdx--];
-            const Interval &interval = m_minmax[entry.level][
-                entry.x + entry.y * m_levelSize[entry.level].x];
+            StackEntry entry = stack[stackIdx--];
             const Vector2 &blockSize = m_blockSizeF[entry.level];
+            Float f00 = 0, f01 = 0, f10 = 0, f11 = 0, zMin, zMax;
+
+            if (entry.level == 0) {
+                /* The bounds of a single patch follow from its corners */
+                const Float *data = m_data + entry.y * m_dataSize.x + entry.x;
+                f00 = data[0];
+                f10 = data[1];
+                f01 = data[m_dataSize.x];
+                f11 = data[m_dataSize.x + 1];
+                zMin = std::min(std::min(f00, f01), std::min(f10, f11));
+                zMax = std::max(std::max(f00, f01), std::max(f10, f11));
+            } else {
+                const QuantizedInterval &interval = m_minmax[entry.level][
+                    entry.x + entry.y * m_levelSize[entry.level].x];
+                zMin = m_heightOffset + interval.min * m_heightStep;
+                zMax = m_heightOffset + interval.max * m_heightStep;
+            }
+
             AABB aabb(
-                Point3(0, 0, interval.min),
-                Point3(blockSize.x, blockSize.y, interval.max)
+                Point3(0, 0, zMin),
+                Point3(blockSize.x, blockSize.y, zMax)
             );
 
             /* Intersect the ray against the bounding box, in local coordinates */
@@ -324,12 +353,6 @@ public:
                 }
             } else {
                 /* Intersect the ray against a bilinear patch */
-                Float
-                    f00 = m_data[entry.y * m_dataSize.x + entry.x],
-                    f01 = m_data[(entry.y + 1) * m_dataSize.x + entry.x],
-                    f10 = m_data[entry.y * m_dataSize.x + entry.x + 1],
-                    f11 = m_data[(entry.y + 1) * m_dataSize.x + entry.x + 1];
-
                 Float A = ray.d.x * ray.d.y * (f00 - f01 - f10 + f11);
                 Float B = ray.d.y * (f01 - f00 + enterPt.x * (f00 - f01 - f10 + f11))
                         + ray.d.x * (f10 - f00 + enterPt.y * (f00 - f01 - f10 + f11))
@@ -394,10 +417,10 @@ public:
 
         if (m_shadingNormals) {
             const Normal
-                &n00 = m_normals[y     * width + x],
-                &n01 = m_normals[(y+1) * width + x],
-                &n10 = m_normals[y     * width + x + 1],
-                &n11 = m_normals[(y+1) * width + x + 1];
+                n00 = getVertexNormal(x,     y),
+                n01 = getVertexNormal(x,     y + 1),
+                n10 = getVertexNormal(x + 1, y),
+                n11 = getVertexNormal(x + 1, y + 1);
 
             its.shFrame.n = normalize(m_objectToWorld(Normal(
                 (1 - temp.p.x) * ((1-temp.p.y) * n00 + temp.p.y * n01)
@@ -436,10 +459,10 @@ public:
         if (shadingFrame && m_shadingNormals) {
             /* Derivatives for bilinear patch with interpolated shading normals */
             const Normal
-                &n00 = m_normals[y     * width + x],
-                &n01 = m_normals[(y+1) * width + x],
-                &n10 = m_normals[y     * width + x + 1],
-                &n11 = m_normals[(y+1) * width + x + 1];
+                n00 = getVertexNormal(x,     y),
+                n01 = getVertexNormal(x,     y + 1),
+                n10 = getVertexNormal(x + 1, y),
+                n11 = getVertexNormal(x + 1, y + 1);
 
             normal = m_objectToWorld(Normal(
                 (1 - u) * ((1-v) * n00 + v * n01)
@@ -544,7 +567,7 @@ public:
         m_numChildren = new Vector2i[m_levelCount];
         m_blockSize = new Vector2i[m_levelCount];
         m_blockSizeF = new Vector2[m_levelCount];
-        m_minmax = new Interval*[m_levelCount];
+        m_minmax = new QuantizedInterval*[m_levelCount];
 
         m_levelSize[0]  = Vector2i(m_dataSize.x - 1, m_dataSize.y - 1);
         m_levelSize0f  = Vector2(m_levelSize[0]);
@@ -553,21 +576,19 @@ public:
         m_invSize = Vector2((Float) 1 / m_levelSize[0].x, (Float) 1 / m_levelSize[0].y);
         m_surfaceArea = 0;
 
-        size = (size_t) m_levelSize[0].x * (size_t) m_levelSize[0].y * sizeof(Interval);
-        m_minmax[0] = (Interval *) allocAligned(size);
-        storageSize += size;
-
-        /* Build the lowest MIP layer directly from the heightfield data */
-        Interval *bounds = m_minmax[0];
+        /* The bounds of the lowest MIP layer are not stored, since they
+           are quickly computed from the height field data. Determine the
+           overall height range, which is the basis of the quantization */
+        Float heightMin = std::numeric_limits<Float>::infinity(),
+              heightMax = -std::numeric_limits<Float>::infinity();
         for (int y=0; y<m_levelSize[0].y; ++y) {
             for (int x=0; x<m_levelSize[0].x; ++x) {
                 Float f00 = m_data[y * m_dataSize.x + x];
                 Float f10 = m_data[y * m_dataSize.x + x + 1];
                 Float f01 = m_data[(y + 1) * m_dataSize.x + x];
                 Float f11 = m_data[(y + 1) * m_dataSize.x + x + 1];
-                Float fmin = std::min(std::min(f00, f01), std::min(f10, f11));
-                Float fmax = std::max(std::max(f00, f01), std::max(f10, f11));
-                *bounds++ = Interval(fmin, fmax);
+                heightMin = std::min(heightMin, std::min(std::min(f00, f01), std::min(f10, f11)));
+                heightMax = std::max(heightMax, std::max(std::max(f00, f01), std::max(f10, f11)));
 
                 /* Estimate the total surface area (this is approximate) */
                 Float diff0 = f01-f10, diff1 = f00-f11;
@@ -575,6 +596,14 @@ public:
             }
         }
 
+        /* One step less than the full range, so that the largest
+           code is guaranteed to decode to at least 'heightMax' */
+        m_heightOffset = heightMin;
+        m_heightStep = (heightMax - heightMin) / 0xFFFE;
+        if (!(m_heightStep > 0))
+            m_heightStep = 1;
+        m_minmax[0] = NULL;
+
         /* Propagate height bounds upwards to the other layers */
         for (int level=1; level<m_levelCount; ++level) {
             Vector2i &cur  = m_levelSize[level],
@@ -593,62 +622,42 @@ public:
             m_blockSizeF[level] = Vector2(m_blockSize[level]);
 
             /* Allocate memory for interval data */
-            Interval *prevBounds = m_minmax[level-1], *curBounds;
-            size_t size = (size_t) cur.x * (size_t) cur.y * sizeof(Interval);
-            m_minmax[level] = curBounds = (Interval *) allocAligned(size);
+            QuantizedInterval *prevBounds = m_minmax[level-1], *curBounds;
+            size_t size = (size_t) cur.x * (size_t) cur.y * sizeof(QuantizedInterval);
+            m_minmax[level] = curBounds = (QuantizedInterval *) allocAligned(size);
             storageSize += size;
 
-            /* Build by querying the previous layer */
+            /* Build by querying the previous layer (or the data itself) */
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for
+            #endif
             for (int y=0; y<cur.y; ++y) {
                 int y0 = std::min(2*y,   prev.y-1),
                     y1 = std::min(2*y+1, prev.y-1);
                 for (int x=0; x<cur.x; ++x) {
                     int x0 = std::min(2*x,   prev.x-1),
                         x1 = std::min(2*x+1, prev.x-1);
-                    const Interval &f00 = prevBounds[y0 * prev.x + x0], &f01 = prevBounds[y0 * prev.x + x1];
-                    const Interval &f10 = prevBounds[y1 * prev.x + x0], &f11 = prevBounds[y1 * prev.x + x1];
-                    Interval combined(f00);
-                    combined.expandBy(f01);
-                    combined.expandBy(f10);
-                    combined.expandBy(f11);
-                    *curBounds++ = combined;
-                }
-            }
-        }
-
-        if (m_shadingNormals) {
-            Log(EInfo, "Precomputing shading normals ..");
-            size_t size = (size_t) m_dataSize.x * (size_t) m_dataSize.y * sizeof(Normal);
-            m_normals = (Normal *) allocAligned(size);
-            memset(m_normals, 0, size);
-            storageSize += size;
-
-            for (int offset=0; offset<2; ++offset) {
-                #if defined(MTS_OPENMP)
-                    #pragma omp parallel for
-                #endif
-                for (int y=offset; y<m_levelSize[0].y; y+=2) {
-                    for (int x=0; x<m_levelSize[0].x; ++x) {
-                            Float f00 = m_data[y * m_dataSize.x + x];
-                        Float f10 = m_data[y * m_dataSize.x + x + 1];
-                        Float f01 = m_data[(y + 1) * m_dataSize.x + x];
-                        Float f11 = m_data[(y + 1) * m_dataSize.x + x + 1];
-
-                        m_normals[y       * m_dataSize.x + x]     += normalize(Normal(f00 - f10, f00 - f01, 1));
-                        m_normals[y       * m_dataSize.x + x + 1] += normalize(Normal(f00 - f10, f10 - f11, 1));
-                        m_normals[(y + 1) * m_dataSize.x + x]     += normalize(Normal(f01 - f11, f00 - f01, 1));
-                        m_normals[(y + 1) * m_dataSize.x + x + 1] += normalize(Normal(f01 - f11, f10 - f11, 1));
+                    QuantizedInterval combined;
+                    if (level == 1) {
+                        Float fmin = std::numeric_limits<Float>::infinity(),
+                              fmax = -std::numeric_limits<Float>::infinity();
+                        for (int py=y0; py<=y1+1; ++py) {
+                            for (int px=x0; px<=x1+1; ++px) {
+                                Float value = m_data[py * m_dataSize.x + px];
+                                fmin = std::min(fmin, value);
+                                fmax = std::max(fmax, value);
+                            }
+                        }
+                        combined.min = quantizeHeight(fmin, false);
+                        combined.max = quantizeHeight(fmax, true);
+                    } else {
+                        const QuantizedInterval
+                            &f00 = prevBounds[y0 * prev.x + x0], &f01 = prevBounds[y0 * prev.x + x1],
+                            &f10 = prevBounds[y1 * prev.x + x0], &f11 = prevBounds[y1 * prev.x + x1];
+                        combined.min = std::min(std::min(f00.min, f01.min), std::min(f10.min, f11.min));
+                        combined.max = std::max(std::max(f00.max, f01.max), std::max(f10.max, f11.max));
                     }
-                }
-            }
-
-            #if defined(MTS_OPENMP)
-                #pragma omp parallel for
-            #endif
-            for (int y=0; y<m_dataSize.y; ++y) {
-                for (int x=0; x<m_dataSize.x; ++x) {
-                    Normal &normal = m_normals[x + y * m_dataSize.x];
-                    normal /= normal.length();
+                    curBounds[y * cur.x + x] = combined;
                 }
             }
         }
@@ -657,11 +666,44 @@ public:
                 memString(storageSize).c_str());
 
         m_dataAABB = AABB(
-            Point3(0, 0, m_minmax[m_levelCount-1][0].min),
-            Point3(m_levelSize0f.x, m_levelSize0f.y, m_minmax[m_levelCount-1][0].max)
+            Point3(0, 0, heightMin),
+            Point3(m_levelSize0f.x, m_levelSize0f.y, heightMax)
         );
     }
 
+    /// Quantize a height value, rounding down or up
+    inline uint16_t quantizeHeight(Float value, bool roundUp) const {
+        Float scaled = (value - m_heightOffset) / m_heightStep;
+        Float rounded = roundUp ? std::ceil(scaled) + 1 : std::floor(scaled) - 1;
+        return (uint16_t) math::clamp(rounded, (Float) 0, (Float) 0xFFFF);
+    }
+
+    /**
+     * \brief Compute the shading normal at a vertex of the height field
+     *
+     * This is the normalized sum of the normals that the (up to four)
+     * adjacent bilinear patches have at this vertex.
+     */
+    Normal getVertexNormal(int vx, int vy) const {
+        const int width = m_dataSize.x;
+        Normal result(0.0f);
+
+        for (int y=std::max(vy-1, 0); y<=std::min(vy, m_levelSize[0].y-1); ++y) {
+            for (int x=std::max(vx-1, 0); x<=std::min(vx, m_levelSize[0].x-1); ++x) {
+                Float f00 = m_data[y * width + x];
+                Float f10 = m_data[y * width + x + 1];
+                Float f01 = m_data[(y + 1) * width + x];
+                Float f11 = m_data[(y + 1) * width + x + 1];
+
+                Float dx = (vy == y) ? (f00 - f10) : (f01 - f11);
+                Float dy = (vx == x) ? (f00 - f01) : (f10 - f11);
+                result += normalize(Normal(dx, dy, 1));
+            }
+        }
+
+        return result / result.length();
+    }
+
     ref<TriMesh> createTriMesh() {
         Vector2i size = m_dataSize;
 
@@ -757,7 +799,6 @@ private:
 
     /* Height field data */
     Float *m_data;
-    Normal *m_normals;
     Vector2i m_dataSize;
     Vector2 m_invSize;
     Float m_surfaceArea;
@@ -769,7 +810,9 @@ private:
     Vector2i *m_numChildren;
     Vector2i *m_blockSize;
     Vector2 *m_blockSizeF;
-    Interval **m_minmax;
+    QuantizedInterval **m_minmax;
+    Float m_heightOffset;
+    Float m_heightStep;
 };
 
 MTS_IMPLEMENT_CLASS_S(Heightfield, false, Shape)
@@ -54,6 +54,14 @@ public:
     /// Return the underlying animated transformation
     inline const AnimatedTransform *getAnimatedTransform() const { return m_transform.get(); }
 
+    /**
+     * \brief Move the instance
+     *
+     * The scene's acceleration data structure must be updated afterwards
+     * using \ref Scene::commit().
+     */
+    inline void setWorldTransform(const AnimatedTransform *trafo) { m_transform = trafo; }
+
     // =============================================================
     //! @{ \name Implementation of the Shape interface
     // =============================================================
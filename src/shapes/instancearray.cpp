@@ -0,0 +1,695 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "instance.h"
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/timer.h>
+
+/// Offset of the temporary storage passed to the kd-tree of the shape group
+#define MTS_INSTANCEARRAY_TEMP_OFFSET 8
+
+/// Maximum number of instances in a leaf of the instance BVH
+#define MTS_INSTANCEARRAY_LEAF_SIZE 4
+
+/// Number of bins used to evaluate the surface area heuristic
+#define MTS_INSTANCEARRAY_BIN_COUNT 16
+
+/// Depth after which the instance BVH only splits oversized leaves
+#define MTS_INSTANCEARRAY_MAX_DEPTH 48
+
+/// Traversal stack size (the median splits of oversized leaves add at most 32 levels)
+#define MTS_INSTANCEARRAY_STACK_SIZE (MTS_INSTANCEARRAY_MAX_DEPTH + 32)
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{instancearray}{Instance array}
+ * \order{10}
+ * \parameters{
+ *     \parameter{\Unnamed}{\ShapeGroup}{A reference to a
+ *     shape group that should be instantiated}
+ *     \parameter{filename}{\String}{
+ *       Binary file with one object-to-world transformation per instance.
+ *       Every transformation is given by the upper three rows of its
+ *       matrix in row-major order (12 little-endian single precision
+ *       values, i.e. 48 bytes per instance). \default{none}
+ *     }
+ *     \parameter{toWorld}{\Transform}{
+ *        Transformation that is applied on top of those of all
+ *        instances. \default{none}
+ *     }
+ *     \parameter{\Unnamed}{\Shape}{
+ *       Instances (\pluginref{instance}) of the same shape group can be
+ *       nested as well. Their transformations are added to the array,
+ *       and the instance objects themselves are released.
+ *     }
+ * }
+ *
+ * This plugin replicates a shape group many times, like a large number of
+ * \pluginref{instance} shapes would, but it is designed for scenes with
+ * millions of copies (e.g. the trees of a forest). Instead of a full shape
+ * with two $4\times 4$ matrices, every copy only stores its affine
+ * world-to-object transformation (48 bytes in single precision). The
+ * object-to-world transformation is derived from it when an intersection
+ * is found, and normals are transformed by its transpose. The copies are
+ * organized in a dedicated bounding volume hierarchy, and the array
+ * itself appears as a single primitive in the acceleration data structure
+ * of the scene. Building this hierarchy is much faster than building
+ * the scene kd-tree over millions of separate instances.
+ *
+ * \begin{xml}[caption={Replicate a tree many times}]
+ * <shape type="shapegroup" id="tree">
+ *     <shape type="serialized">
+ *         <string name="filename" value="tree.serialized"/>
+ *     </shape>
+ * </shape>
+ *
+ * <shape type="instancearray">
+ *     <ref id="tree"/>
+ *     <string name="filename" value="forest.bin"/>
+ * </shape>
+ * \end{xml}
+ *
+ * \remarks{
+ *   \item Only static transformations are supported.
+ *   \item The same restrictions as for the \pluginref{instance}
+ *   plugin apply.
+ * }
+ */
+class InstanceArray : public Shape {
+public:
+    /// Affine transformation given by the upper three rows of a matrix
+    struct AffineTransform {
+        Float m[3][4];
+
+        inline AffineTransform() { }
+
+        explicit AffineTransform(const Matrix4x4 &matrix) {
+            for (int i=0; i<3; ++i)
+                for (int j=0; j<4; ++j)
+                    m[i][j] = matrix.m[i][j];
+        }
+
+        inline Point transformPoint(const Point &p) const {
+            return Point(
+                m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+        }
+
+        inline Vector transformVector(const Vector &v) const {
+            return Vector(
+                m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+        }
+
+        /**
+         * \brief Transform a normal by the inverse of this transformation
+         *
+         * Normals are transformed by the inverse transpose, hence this
+         * only needs the transpose of the current matrix.
+         */
+        inline Normal transformNormalInverse(const Normal &n) const {
+            return Normal(
+                m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+                m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+                m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z);
+        }
+
+        /// Compute the inverse transformation
+        AffineTransform inverse() const {
+            Float det =
+                  m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+
+            AffineTransform result;
+            if (det == 0) {
+                memset(result.m, 0, sizeof(result.m));
+                return result;
+            }
+            Float invDet = 1 / det;
+
+            result.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * invDet;
+            result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+            result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+            result.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * invDet;
+            result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+            result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+            result.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * invDet;
+            result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+            result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+
+            for (int i=0; i<3; ++i)
+                result.m[i][3] = -(result.m[i][0] * m[0][3]
+                    + result.m[i][1] * m[1][3] + result.m[i][2] * m[2][3]);
+            return result;
+        }
+
+        /// Is this transformation invertible?
+        inline bool isSingular() const {
+            return m[0][0] == 0 && m[0][1] == 0 && m[0][2] == 0;
+        }
+    };
+
+    /// Node of the instance BVH
+    struct BVHNode {
+        /// World-space bounds of all instances below the node
+        AABB aabb;
+        /// Index of the right child (inner nodes) or first instance (leaves)
+        uint32_t index;
+        /// Number of instances (or zero for inner nodes)
+        uint16_t count;
+        /// Split axis of an inner node
+        uint16_t axis;
+
+        inline bool isLeaf() const { return count != 0; }
+    };
+
+    InstanceArray(const Properties &props) : Shape(props) {
+        m_toWorld = props.getTransform("toWorld", Transform());
+
+        if (props.hasProperty("filename")) {
+            FileResolver *fResolver = Thread::getThread()->getFileResolver();
+            fs::path filePath = fResolver->resolve(props.getString("filename"));
+            loadTransforms(filePath);
+        }
+    }
+
+    InstanceArray(Stream *stream, InstanceManager *manager)
+            : Shape(stream, manager) {
+        m_shapeGroup = static_cast<ShapeGroup *>(manager->getInstance(stream));
+        m_instances.resize(stream->readSize());
+        if (!m_instances.empty())
+            stream->readFloatArray(&m_instances[0].m[0][0], m_instances.size() * 12);
+        buildBVH();
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Shape::serialize(stream, manager);
+        manager->serialize(stream, m_shapeGroup.get());
+        stream->writeSize(m_instances.size());
+        if (!m_instances.empty())
+            stream->writeFloatArray(&m_instances[0].m[0][0], m_instances.size() * 12);
+    }
+
+    void configure() {
+        if (!m_shapeGroup)
+            Log(EError, "A reference to a 'shapegroup' must be specified!");
+        if (m_instances.empty())
+            Log(EWarn, "The instance array \"%s\" is empty!", m_name.c_str());
+        if (m_nodes.empty())
+            buildBVH();
+    }
+
+    void addChild(const std::string &name, ConfigurableObject *child) {
+        const Class *cClass = child->getClass();
+        if (cClass->getName() == "ShapeGroup") {
+            if (m_shapeGroup && m_shapeGroup != child)
+                Log(EError, "An instance array can only replicate a single shape group!");
+            m_shapeGroup = static_cast<ShapeGroup *>(child);
+        } else if (cClass->getName() == "Instance") {
+            const Instance *instance = static_cast<const Instance *>(child);
+            if (m_shapeGroup && m_shapeGroup.get() != instance->getShapeGroup())
+                Log(EError, "An instance array can only replicate a single shape group!");
+            m_shapeGroup = const_cast<ShapeGroup *>(instance->getShapeGroup());
+            const AnimatedTransform *trafo = instance->getWorldTransform();
+            if (!trafo->isStatic())
+                Log(EError, "Instance arrays don't support animated transformations!");
+            addInstance(trafo->eval(0).getMatrix());
+        } else {
+            Shape::addChild(name, child);
+        }
+    }
+
+    AABB getAABB() const {
+        if (m_nodes.empty())
+            return AABB();
+        return m_nodes[0].aabb;
+    }
+
+    Float getSurfaceArea() const {
+        return 0.0f;
+    }
+
+    size_t getPrimitiveCount() const {
+        return 0;
+    }
+
+    size_t getEffectivePrimitiveCount() const {
+        return m_instances.size() * m_shapeGroup->getPrimitiveCount();
+    }
+
+    bool rayIntersect(const Ray &ray, Float mint, Float maxt, Float &t, void *temp) const {
+        if (m_nodes.empty())
+            return false;
+
+        const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
+        uint8_t *innerTemp = static_cast<uint8_t *>(temp) + MTS_INSTANCEARRAY_TEMP_OFFSET;
+        uint32_t stack[MTS_INSTANCEARRAY_STACK_SIZE];
+        uint32_t nodeIndex = 0;
+        int stackSize = 0;
+        bool hit = false;
+
+        while (true) {
+            const BVHNode &node = m_nodes[nodeIndex];
+            Float nearT, farT;
+            if (node.aabb.rayIntersect(ray, nearT, farT) && nearT <= maxt && farT >= mint) {
+                if (!node.isLeaf()) {
+                    /* Visit the nearer child first */
+                    if (ray.d[node.axis] < 0) {
+                        stack[stackSize++] = nodeIndex + 1;
+                        nodeIndex = node.index;
+                    } else {
+                        stack[stackSize++] = node.index;
+                        nodeIndex = nodeIndex + 1;
+                    }
+                    continue;
+                }
+
+                for (uint32_t i=node.index; i<node.index + node.count; ++i) {
+                    Ray localRay;
+                    transformRay(m_instances[i], ray, localRay);
+                    if (kdtree->rayIntersect(localRay, mint, maxt, t, innerTemp)) {
+                        *static_cast<uint32_t *>(temp) = i;
+                        maxt = t;
+                        hit = true;
+                    }
+                }
+            }
+
+            if (stackSize == 0)
+                break;
+            nodeIndex = stack[--stackSize];
+        }
+
+        return hit;
+    }
+
+    bool rayIntersect(const Ray &ray, Float mint, Float maxt) const {
+        if (m_nodes.empty())
+            return false;
+
+        const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
+        uint32_t stack[MTS_INSTANCEARRAY_STACK_SIZE];
+        uint32_t nodeIndex = 0;
+        int stackSize = 0;
+
+        while (true) {
+            const BVHNode &node = m_nodes[nodeIndex];
+            Float nearT, farT;
+            if (node.aabb.rayIntersect(ray, nearT, farT) && nearT <= maxt && farT >= mint) {
+                if (!node.isLeaf()) {
+                    stack[stackSize++] = node.index;
+                    nodeIndex = nodeIndex + 1;
+                    continue;
+                }
+
+                for (uint32_t i=node.index; i<node.index + node.count; ++i) {
+                    Ray localRay;
+                    transformRay(m_instances[i], ray, localRay);
+                    if (kdtree->rayIntersect(localRay, mint, maxt))
+                        return true;
+                }
+            }
+
+            if (stackSize == 0)
+                break;
+            nodeIndex = stack[--stackSize];
+        }
+
+        return false;
+    }
+
+    void fillIntersectionRecord(const Ray &ray,
+            const void *temp, Intersection &its) const {
+        const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
+        const AffineTransform &invTrafo = m_instances[*static_cast<const uint32_t *>(temp)];
+        const uint8_t *innerTemp = static_cast<const uint8_t *>(temp) + MTS_INSTANCEARRAY_TEMP_OFFSET;
+
+        Ray localRay;
+        transformRay(invTrafo, ray, localRay);
+        kdtree->fillIntersectionRecord<false>(localRay, innerTemp, its);
+
+        AffineTransform trafo = invTrafo.inverse();
+        its.shFrame.n = normalize(invTrafo.transformNormalInverse(its.shFrame.n));
+        its.geoFrame = Frame(normalize(invTrafo.transformNormalInverse(its.geoFrame.n)));
+        its.dpdu = trafo.transformVector(its.dpdu);
+        its.dpdv = trafo.transformVector(its.dpdv);
+        its.p = trafo.transformPoint(its.p);
+        its.instance = this;
+    }
+
+    void getNormalDerivative(const Intersection &its,
+            Vector &dndu, Vector &dndv, bool shadingFrame) const {
+        uint32_t index = findInstance(its);
+        if (index == (uint32_t) -1) {
+            dndu = dndv = Vector(0.0f);
+            return;
+        }
+
+        const AffineTransform &invTrafo = m_instances[index];
+        AffineTransform trafo = invTrafo.inverse();
+
+        /* Same as Instance::getNormalDerivative() */
+        Intersection temp(its);
+        temp.p = invTrafo.transformPoint(its.p);
+        temp.dpdu = invTrafo.transformVector(its.dpdu);
+        temp.dpdv = invTrafo.transformVector(its.dpdv);
+
+        Normal tn = invTrafo.transformNormalInverse(
+            normalize(trafo.transformNormalInverse(its.shFrame.n)));
+        Float invLen = 1 / tn.length();
+        tn *= invLen;
+
+        its.shape->getNormalDerivative(temp, dndu, dndv, shadingFrame);
+
+        dndu = invTrafo.transformNormalInverse(Normal(dndu)) * invLen;
+        dndv = invTrafo.transformNormalInverse(Normal(dndv)) * invLen;
+
+        dndu -= tn * dot(tn, dndu);
+        dndv -= tn * dot(tn, dndv);
+    }
+
+    void adjustTime(Intersection &its, Float time) const {
+        /* Only static transformations are supported */
+        its.time = time;
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "InstanceArray[" << endl
+            << "  name = \"" << m_name << "\"," << endl
+            << "  instanceCount = " << m_instances.size() << "," << endl
+            << "  nodeCount = " << m_nodes.size() << "," << endl
+            << "  aabb = " << getAABB().toString() << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    /// Add an instance given its object-to-world matrix
+    void addInstance(const Matrix4x4 &objectToWorld) {
+        AffineTransform invTrafo = AffineTransform((m_toWorld.getMatrix()
+            * objectToWorld)).inverse();
+        if (invTrafo.isSingular())
+            Log(EError, "Instance %u of \"%s\" has a singular transformation!",
+                (uint32_t) m_instances.size(), m_name.c_str());
+        m_instances.push_back(invTrafo);
+    }
+
+    /// Load the object-to-world matrices of all instances from a file
+    void loadTransforms(const fs::path &filePath) {
+        ref<FileStream> stream = new FileStream(filePath, FileStream::EReadOnly);
+        stream->setByteOrder(Stream::ELittleEndian);
+        size_t fileSize = stream->getSize();
+        if (fileSize % (12 * sizeof(float)) != 0)
+            Log(EError, "\"%s\": the file size must be a multiple of 48 bytes!",
+                filePath.filename().string().c_str());
+
+        size_t count = fileSize / (12 * sizeof(float));
+        m_instances.reserve(m_instances.size() + count);
+
+        const size_t chunkSize = 4096;
+        std::vector<float> buffer(chunkSize * 12);
+        for (size_t i=0; i<count; i += chunkSize) {
+            size_t size = std::min(chunkSize, count - i);
+            stream->readSingleArray(&buffer[0], size * 12);
+            for (size_t j=0; j<size; ++j) {
+                Matrix4x4 matrix;
+                for (int k=0; k<3; ++k)
+                    for (int l=0; l<4; ++l)
+                        matrix.m[k][l] = (Float) buffer[j*12 + k*4 + l];
+                matrix.m[3][0] = matrix.m[3][1] = matrix.m[3][2] = 0;
+                matrix.m[3][3] = 1;
+                addInstance(matrix);
+            }
+        }
+
+        Log(EDebug, "Loaded " SIZE_T_FMT " instance transformations from \"%s\"",
+            count, filePath.filename().string().c_str());
+    }
+
+    inline void transformRay(const AffineTransform &trafo, const Ray &ray, Ray &result) const {
+        result.o = trafo.transformPoint(ray.o);
+        result.setDirection(trafo.transformVector(ray.d));
+        result.mint = ray.mint;
+        result.maxt = ray.maxt;
+        result.time = ray.time;
+    }
+
+    /**
+     * \brief Find the instance that an intersection record refers to
+     *
+     * The intersection record has no space for the instance index, hence
+     * it is recovered by searching for an instance whose local copy of the
+     * intersected shape contains the intersection point.
+     */
+    uint32_t findInstance(const Intersection &its) const {
+        if (m_nodes.empty())
+            return (uint32_t) -1;
+
+        AABB shapeAABB = its.shape->getAABB();
+        Float eps = Epsilon * (1 + std::max(shapeAABB.getExtents().length(),
+            Vector(its.p).length()));
+        shapeAABB.min -= Vector(eps);
+        shapeAABB.max += Vector(eps);
+
+        const TriMesh *mesh = its.shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))
+            ? static_cast<const TriMesh *>(its.shape) : NULL;
+
+        uint32_t stack[MTS_INSTANCEARRAY_STACK_SIZE];
+        uint32_t nodeIndex = 0, result = (uint32_t) -1;
+        int stackSize = 0;
+        Float bestDistance = std::numeric_limits<Float>::infinity();
+
+        while (true) {
+            const BVHNode &node = m_nodes[nodeIndex];
+            AABB aabb(node.aabb);
+            aabb.min -= Vector(eps);
+            aabb.max += Vector(eps);
+
+            if (aabb.contains(its.p)) {
+                if (!node.isLeaf()) {
+                    stack[stackSize++] = node.index;
+                    nodeIndex = nodeIndex + 1;
+                    continue;
+                }
+
+                for (uint32_t i=node.index; i<node.index + node.count; ++i) {
+                    Point p = m_instances[i].transformPoint(its.p);
+                    if (!shapeAABB.contains(p))
+                        continue;
+
+                    /* Distance to the plane of the intersected triangle */
+                    Float distance = 0;
+                    if (mesh && its.primIndex < mesh->getTriangleCount()) {
+                        const Triangle &tri = mesh->getTriangles()[its.primIndex];
+                        const Point *positions = mesh->getVertexPositions();
+                        Vector n = cross(positions[tri.idx[1]] - positions[tri.idx[0]],
+                            positions[tri.idx[2]] - positions[tri.idx[0]]);
+                        Float length = n.length();
+                        if (length > 0)
+                            distance = std::abs(dot(p - positions[tri.idx[0]], n)) / length;
+                    }
+
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        result = i;
+                    }
+                }
+            }
+
+            if (stackSize == 0)
+                break;
+            nodeIndex = stack[--stackSize];
+        }
+
+        return result;
+    }
+
+    /// Build the BVH over all instances and sort them by leaf
+    void buildBVH() {
+        m_nodes.clear();
+        if (m_instances.empty() || !m_shapeGroup)
+            return;
+
+        ref<Timer> timer = new Timer();
+        const AABB &groupAABB = m_shapeGroup->getKDTree()->getAABB();
+        size_t count = m_instances.size();
+        if (count > (size_t) std::numeric_limits<uint32_t>::max() / 2)
+            Log(EError, "Too many instances!");
+
+        BuildContext ctx;
+        ctx.bounds.resize(count);
+        ctx.centroids.resize(count);
+        ctx.indices.resize(count);
+
+        #pragma omp parallel for
+        for (int i=0; i<(int) count; ++i) {
+            AffineTransform trafo = m_instances[i].inverse();
+            AABB aabb;
+            for (int j=0; j<8; ++j)
+                aabb.expandBy(trafo.transformPoint(groupAABB.getCorner(j)));
+            ctx.bounds[i] = aabb;
+            ctx.centroids[i] = aabb.getCenter();
+            ctx.indices[i] = (uint32_t) i;
+        }
+
+        m_nodes.reserve(2 * count / MTS_INSTANCEARRAY_LEAF_SIZE + 1);
+        build(ctx, 0, (uint32_t) count, 0);
+
+        /* Store the instances in the order of the leaves */
+        std::vector<AffineTransform> instances(count);
+        for (size_t i=0; i<count; ++i)
+            instances[i] = m_instances[ctx.indices[i]];
+        m_instances.swap(instances);
+        std::vector<BVHNode>(m_nodes).swap(m_nodes);
+
+        Log(EDebug, "Built the BVH of \"%s\" over " SIZE_T_FMT " instances (" SIZE_T_FMT
+            " nodes, %s, %i ms)", m_name.c_str(), count, m_nodes.size(),
+            memString(m_nodes.size() * sizeof(BVHNode)
+                + m_instances.size() * sizeof(AffineTransform)).c_str(),
+            timer->getMilliseconds());
+    }
+
+    struct BuildContext {
+        std::vector<AABB> bounds;
+        std::vector<Point> centroids;
+        std::vector<uint32_t> indices;
+    };
+
+    struct CentroidOrder {
+        const std::vector<Point> &centroids;
+        int axis;
+
+        CentroidOrder(const std::vector<Point> &centroids, int axis)
+            : centroids(centroids), axis(axis) { }
+
+        inline bool operator()(uint32_t i, uint32_t j) const {
+            return centroids[i][axis] < centroids[j][axis];
+        }
+    };
+
+    /// Recursively build the BVH using a binned surface area heuristic
+    uint32_t build(BuildContext &ctx, uint32_t start, uint32_t end, int depth) {
+        uint32_t nodeIndex = (uint32_t) m_nodes.size();
+        m_nodes.push_back(BVHNode());
+
+        AABB aabb, centroidAABB;
+        for (uint32_t i=start; i<end; ++i) {
+            aabb.expandBy(ctx.bounds[ctx.indices[i]]);
+            centroidAABB.expandBy(ctx.centroids[ctx.indices[i]]);
+        }
+        m_nodes[nodeIndex].aabb = aabb;
+
+        uint32_t count = end - start;
+        int axis = centroidAABB.getLargestAxis();
+        Float extent = centroidAABB.max[axis] - centroidAABB.min[axis];
+
+        if (count <= MTS_INSTANCEARRAY_LEAF_SIZE ||
+            ((depth >= MTS_INSTANCEARRAY_MAX_DEPTH || extent <= 0) && count <= 0xFFFF)) {
+            m_nodes[nodeIndex].index = start;
+            m_nodes[nodeIndex].count = (uint16_t) count;
+            m_nodes[nodeIndex].axis = 0;
+            return nodeIndex;
+        }
+
+        uint32_t mid = start;
+        if (extent > 0 && depth < MTS_INSTANCEARRAY_MAX_DEPTH) {
+            const int binCount = MTS_INSTANCEARRAY_BIN_COUNT;
+            Float scale = binCount / extent;
+            AABB binAABBs[binCount];
+            uint32_t binCounts[binCount];
+            memset(binCounts, 0, sizeof(binCounts));
+
+            for (uint32_t i=start; i<end; ++i) {
+                uint32_t index = ctx.indices[i];
+                int bin = std::min(binCount - 1, (int)
+                    ((ctx.centroids[index][axis] - centroidAABB.min[axis]) * scale));
+                binCounts[bin]++;
+                binAABBs[bin].expandBy(ctx.bounds[index]);
+            }
+
+            /* Sweep from the right, then evaluate the splits from the left */
+            Float rightCost[binCount];
+            AABB right;
+            uint32_t rightCount = 0;
+            for (int i=binCount-1; i>0; --i) {
+                right.expandBy(binAABBs[i]);
+                rightCount += binCounts[i];
+                rightCost[i] = rightCount > 0 ? right.getSurfaceArea() * rightCount : 0;
+            }
+
+            AABB left;
+            uint32_t leftCount = 0;
+            Float bestCost = std::numeric_limits<Float>::infinity();
+            int bestSplit = -1;
+            for (int i=1; i<binCount; ++i) {
+                left.expandBy(binAABBs[i-1]);
+                leftCount += binCounts[i-1];
+                if (leftCount == 0 || leftCount == count)
+                    continue;
+                Float cost = left.getSurfaceArea() * leftCount + rightCost[i];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestSplit = i;
+                }
+            }
+
+            if (bestSplit > 0) {
+                uint32_t *first = &ctx.indices[0] + start, *last = &ctx.indices[0] + end;
+                uint32_t *pivot = first;
+                for (uint32_t *it = first; it != last; ++it) {
+                    int bin = std::min(binCount - 1, (int)
+                        ((ctx.centroids[*it][axis] - centroidAABB.min[axis]) * scale));
+                    if (bin < bestSplit)
+                        std::swap(*it, *pivot++);
+                }
+                mid = start + (uint32_t) (pivot - first);
+            }
+        }
+
+        if (mid == start || mid == end) {
+            /* Fall back to a median split */
+            mid = start + count / 2;
+            std::nth_element(ctx.indices.begin() + start, ctx.indices.begin() + mid,
+                ctx.indices.begin() + end, CentroidOrder(ctx.centroids, axis));
+        }
+
+        build(ctx, start, mid, depth + 1);
+        uint32_t rightChild = build(ctx, mid, end, depth + 1);
+        m_nodes[nodeIndex].index = rightChild;
+        m_nodes[nodeIndex].count = 0;
+        m_nodes[nodeIndex].axis = (uint16_t) axis;
+        return nodeIndex;
+    }
+
+private:
+    ref<ShapeGroup> m_shapeGroup;
+    Transform m_toWorld;
+    std::vector<AffineTransform> m_instances;
+    std::vector<BVHNode> m_nodes;
+};
+
+MTS_IMPLEMENT_CLASS_S(InstanceArray, false, Shape)
+MTS_EXPORT_PLUGIN(InstanceArray, "Instance array");
+MTS_NAMESPACE_END
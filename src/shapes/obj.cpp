@@ -20,14 +20,20 @@
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/render/emitter.h>
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/hw/basicshader.h>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
 #include <set>
 
+/// Minimum number of bytes per chunk when parsing an OBJ file in parallel
+#define MTS_OBJ_CHUNK_SIZE (4*1024*1024)
+
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{obj}{Wavefront OBJ mesh loader}
@@ -50,6 +56,18 @@ MTS_NAMESPACE_BEGIN
  *       Optional flag to flip all normals. \default{\code{false}, i.e.
  *       the normals are left unchanged}.
  *     }
+ *     \parameter{quantize}{\Boolean}{
+ *       Store vertex normals, texture coordinates and colors in a compact
+ *       quantized form (octahedral normals, half precision texture coordinates
+ *       and colors), which reduces the memory usage of large meshes
+ *       at a negligible loss of precision. \default{\code{false}}
+ *     }
+ *     \parameter{smoothTangents}{\Boolean}{
+ *       Interpolate per-vertex UV tangents instead of using a constant
+ *       tangent frame per triangle. This hides the tessellation of the mesh
+ *       in renderings with bump maps, normal maps and anisotropic materials.
+ *       \default{\code{false}}
+ *     }
  *     \parameter{flipTexCoords}{\Boolean}{
  *       Treat the vertical component of the texture as inverted? Most OBJ files use
  *       this convention. \default{\code{true}}
@@ -77,7 +95,8 @@ MTS_NAMESPACE_BEGIN
  *
  * This plugin implements a simple loader for Wavefront OBJ files. It handles
  * meshes containing triangles and quadrilaterals, and it also imports vertex normals
- * and texture coordinates.
+ * and texture coordinates. The file is memory-mapped and parsed by several
+ * threads at once; the resulting meshes do not depend on the number of threads.
  *
  * Loading an ordinary OBJ file is as simple as writing:
  * \begin{xml}
@@ -162,6 +181,33 @@ public:
         }
     };
 
+    /// Statement that determines how the geometry is split into meshes
+    struct OBJStatement {
+        enum EType { EGroup, EMaterial, EMaterialLibrary };
+
+        EType type;
+        std::string arg;
+        /* Number of elements of the chunk that precede this statement */
+        size_t vertexCount, normalCount, texcoordCount, triangleCount;
+    };
+
+    /// Contents of a range of lines of an OBJ file
+    struct OBJChunk {
+        std::vector<Point> vertices;
+        std::vector<Normal> normals;
+        std::vector<Point2> texcoords;
+        std::vector<OBJTriangle> triangles;
+        std::vector<OBJStatement> statements;
+    };
+
+    /// A mesh that should be created once the whole file has been parsed
+    struct OBJMesh {
+        std::string name, materialName;
+        std::vector<OBJTriangle> triangles;
+        /* Number of elements that were defined before the mesh ended */
+        size_t vertexCount, normalCount, texcoordCount;
+    };
+
     bool fetch_line(std::istream &is, std::string &line) {
         /// Fetch a line from the stream, while handling line breaks with backslashes
         if (!std::getline(is, line))
@@ -207,6 +253,12 @@ public:
         /* Collapse all contained shapes / groups into a single object? */
         m_collapse = props.getBoolean("collapse", false);
 
+        /* Store the vertex attributes in a compact quantized form? */
+        m_quantize = props.getBoolean("quantize", false);
+
+        /* Interpolate per-vertex UV tangents? */
+        m_smoothTangents = props.getBoolean("smoothTangents", false);
+
         /* Causes all texture coordinates to be vertically flipped */
         bool flipTexCoords = props.getBoolean("flipTexCoords", true);
 
@@ -221,124 +273,202 @@ public:
 
         /* Load the geometry */
         Log(EInfo, "Loading geometry from \"%s\" ..", path.filename().string().c_str());
-        fs::ifstream is(path);
-        if (is.bad() || is.fail())
+        if (!fs::exists(path))
             Log(EError, "Wavefront OBJ file '%s' not found!", path.string().c_str());
 
         fileResolver->prependPath(fs::absolute(path).parent_path());
 
         ref<Timer> timer = new Timer();
-        std::string buf;
+        ref<MemoryMappedFile> mmap;
+        const char *data = NULL;
+        size_t size = (size_t) fs::file_size(path);
+        if (size > 0) {
+            mmap = new MemoryMappedFile(path);
+            data = static_cast<const char *>(mmap->getData());
+        }
+
+        /* Split the file into chunks of whole lines and parse them in parallel */
+        std::vector<const char *> bounds = splitLines(data, size);
+        std::vector<OBJChunk> chunks(bounds.size() - 1);
+        std::string error;
+        int errorChunk = -1;
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i=0; i<(int) chunks.size(); ++i) {
+            try {
+                parseChunk(bounds[i], bounds[i+1], chunks[i], flipTexCoords);
+            } catch (const std::exception &ex) {
+                #pragma omp critical
+                {
+                    if (errorChunk < 0 || i < errorChunk) {
+                        errorChunk = i;
+                        error = ex.what();
+                    }
+                }
+            }
+        }
+        mmap = NULL;
+
+        if (errorChunk >= 0)
+            throw std::runtime_error(error);
+
+        /* Assemble the chunks and replay the statements in file order */
+        size_t vertexCount = 0, normalCount = 0, texcoordCount = 0;
+        for (size_t i=0; i<chunks.size(); ++i) {
+            vertexCount += chunks[i].vertices.size();
+            normalCount += chunks[i].normals.size();
+            texcoordCount += chunks[i].texcoords.size();
+        }
+
         std::vector<Point> vertices;
         std::vector<Normal> normals;
         std::vector<Point2> texcoords;
         std::vector<OBJTriangle> triangles;
-        std::string name = m_name, line;
+        std::vector<OBJMesh> meshes;
+        vertices.reserve(vertexCount);
+        normals.reserve(normalCount);
+        texcoords.reserve(texcoordCount);
+
+        std::string name = m_name;
         std::set<std::string> geomNames;
-        std::vector<Vertex> vertexBuffer;
         fs::path materialLibrary;
         int geomIndex = 0;
         bool nameBeforeGeometry = false;
         std::string materialName;
 
-        while (is.good() && !is.eof() && fetch_line(is, line)) {
-            std::istringstream iss(line);
-            if (!(iss >> buf))
-                continue;
-
-            if (buf == "v") {
-                /* Parse + transform vertices */
-                Point p;
-                iss >> p.x >> p.y >> p.z;
-                vertices.push_back(p);
-            } else if (buf == "vn") {
-                Normal n;
-                iss >> n.x >> n.y >> n.z;
-                normals.push_back(n);
-            } else if (buf == "g" && !m_collapse) {
-                std::string targetName;
-                std::string newName = trim(line.substr(1, line.length()-1));
-
-                /* There appear to be two different conventions
-                   for specifying object names in OBJ file -- try
-                   to detect which one is being used */
-                if (nameBeforeGeometry)
-                    // Save geometry under the previously specified name
-                    targetName = name;
-                else
-                    targetName = newName;
-
-                if (triangles.size() > 0) {
-                    /// make sure that we have unique names
-                    if (geomNames.find(targetName) != geomNames.end())
-                        targetName = formatString("%s_%i", targetName.c_str(), geomIndex);
-                    geomIndex += 1;
-                    geomNames.insert(targetName);
-                    if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
-                        createMesh(targetName, vertices, normals, texcoords,
-                            triangles, materialName, objectToWorld, vertexBuffer);
-                    triangles.clear();
-                } else {
-                    nameBeforeGeometry = true;
-                }
-                name = newName;
-            } else if (buf == "usemtl") {
-                /* Flush if necessary */
-                if (triangles.size() > 0 && !m_collapse) {
-                    /// make sure that we have unique names
-                    if (geomNames.find(name) != geomNames.end())
-                        name = formatString("%s_%i", name.c_str(), geomIndex);
-                    geomIndex += 1;
-                    geomNames.insert(name);
-                    if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
-                        createMesh(name, vertices, normals, texcoords,
-                            triangles, materialName, objectToWorld, vertexBuffer);
-                    triangles.clear();
-                    name = m_name;
-                }
+        for (size_t i=0; i<chunks.size(); ++i) {
+            OBJChunk &chunk = chunks[i];
+            size_t v = 0, n = 0, t = 0, f = 0;
+
+            for (size_t j=0; j<=chunk.statements.size(); ++j) {
+                /* Append the elements that precede the next statement */
+                bool last = j == chunk.statements.size();
+                size_t v1 = last ? chunk.vertices.size()  : chunk.statements[j].vertexCount,
+                       n1 = last ? chunk.normals.size()   : chunk.statements[j].normalCount,
+                       t1 = last ? chunk.texcoords.size() : chunk.statements[j].texcoordCount,
+                       f1 = last ? chunk.triangles.size() : chunk.statements[j].triangleCount;
+                vertices.insert(vertices.end(), chunk.vertices.begin() + v, chunk.vertices.begin() + v1);
+                normals.insert(normals.end(), chunk.normals.begin() + n, chunk.normals.begin() + n1);
+                texcoords.insert(texcoords.end(), chunk.texcoords.begin() + t, chunk.texcoords.begin() + t1);
+                triangles.insert(triangles.end(), chunk.triangles.begin() + f, chunk.triangles.begin() + f1);
+                v = v1; n = n1; t = t1; f = f1;
+
+                if (last)
+                    break;
+
+                const OBJStatement &stmt = chunk.statements[j];
+                if (stmt.type == OBJStatement::EGroup) {
+                    std::string targetName;
+                    const std::string &newName = stmt.arg;
+
+                    /* There appear to be two different conventions
+                       for specifying object names in OBJ file -- try
+                       to detect which one is being used */
+                    if (nameBeforeGeometry)
+                        // Save geometry under the previously specified name
+                        targetName = name;
+                    else
+                        targetName = newName;
+
+                    if (triangles.size() > 0) {
+                        /// make sure that we have unique names
+                        if (geomNames.find(targetName) != geomNames.end())
+                            targetName = formatString("%s_%i", targetName.c_str(), geomIndex);
+                        geomIndex += 1;
+                        geomNames.insert(targetName);
+                        if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
+                            addMesh(meshes, targetName, vertices, normals, texcoords,
+                                triangles, materialName);
+                        triangles.clear();
+                    } else {
+                        nameBeforeGeometry = true;
+                    }
+                    name = newName;
+                } else if (stmt.type == OBJStatement::EMaterial) {
+                    /* Flush if necessary */
+                    if (triangles.size() > 0 && !m_collapse) {
+                        /// make sure that we have unique names
+                        if (geomNames.find(name) != geomNames.end())
+                            name = formatString("%s_%i", name.c_str(), geomIndex);
+                        geomIndex += 1;
+                        geomNames.insert(name);
+                        if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
+                            addMesh(meshes, name, vertices, normals, texcoords,
+                                triangles, materialName);
+                        triangles.clear();
+                        name = m_name;
+                    }
 
-                materialName = trim(line.substr(6, line.length()-1));
-            } else if (buf == "mtllib") {
-                materialLibrary = fileResolver->resolve(trim(line.substr(6, line.length()-1)));
-            } else if (buf == "vt") {
-                Float u, v;
-                iss >> u >> v;
-                if (flipTexCoords)
-                    v = 1-v;
-                texcoords.push_back(Point2(u, v));
-            } else if (buf == "f") {
-                std::string  tmp;
-                OBJTriangle t;
-                iss >> tmp; parse(t, 0, tmp);
-                iss >> tmp; parse(t, 1, tmp);
-                iss >> tmp; parse(t, 2, tmp);
-                triangles.push_back(t);
-                /* Handle n-gons assuming a convex shape */
-                while (iss >> tmp) {
-                    t.p[1] = t.p[2];
-                    t.uv[1] = t.uv[2];
-                    t.n[1] = t.n[2];
-                    parse(t, 2, tmp);
-                    triangles.push_back(t);
+                    materialName = stmt.arg;
+                } else if (stmt.type == OBJStatement::EMaterialLibrary) {
+                    materialLibrary = fileResolver->resolve(stmt.arg);
                 }
-            } else {
-                /* Ignore */
             }
+
+            /* Release the memory of the chunk */
+            std::vector<OBJStatement>().swap(chunk.statements);
+            std::vector<Point>().swap(chunk.vertices);
+            std::vector<Normal>().swap(chunk.normals);
+            std::vector<Point2>().swap(chunk.texcoords);
+            std::vector<OBJTriangle>().swap(chunk.triangles);
         }
         if (geomNames.find(name) != geomNames.end())
             /// make sure that we have unique names
             name = formatString("%s_%i", m_name.c_str(), geomIndex);
 
         if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
-            createMesh(name, vertices, normals, texcoords,
-                triangles, materialName, objectToWorld, vertexBuffer);
+            addMesh(meshes, name, vertices, normals, texcoords,
+                triangles, materialName);
+
+        /* Transform all vertices once (instead of at every reference) */
+        if (!objectToWorld.isIdentity()) {
+            if (!vertices.empty())
+                objectToWorld.transformPoints(&vertices[0], &vertices[0], vertices.size());
+            if (!normals.empty())
+                objectToWorld.transformNormals(&normals[0], &normals[0], normals.size());
+        }
+
+        /* Merge the vertices of the individual meshes in parallel */
+        std::vector<ref<TriMesh> > results(meshes.size());
+        std::vector<size_t> merged(meshes.size());
+        errorChunk = -1;
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i=0; i<(int) meshes.size(); ++i) {
+            try {
+                results[i] = createMesh(meshes[i], vertices, normals,
+                    texcoords, merged[i]);
+            } catch (const std::exception &ex) {
+                #pragma omp critical
+                {
+                    if (errorChunk < 0 || i < errorChunk) {
+                        errorChunk = i;
+                        error = ex.what();
+                    }
+                }
+            }
+        }
+
+        if (errorChunk >= 0)
+            throw std::runtime_error(error);
+
+        for (size_t i=0; i<meshes.size(); ++i) {
+            TriMesh *mesh = results[i];
+            mesh->incRef();
+            m_materialAssignment.push_back(meshes[i].materialName);
+            m_meshes.push_back(mesh);
+            Log(EInfo, "%s: " SIZE_T_FMT " triangles, " SIZE_T_FMT
+                " vertices (merged " SIZE_T_FMT " vertices).", mesh->getName().c_str(),
+                mesh->getTriangleCount(), mesh->getVertexCount(), merged[i]);
+        }
 
         if (props.hasProperty("maxSmoothAngle")) {
             if (m_faceNormals)
                 Log(EError, "The properties 'maxSmoothAngle' and 'faceNormals' "
                 "can't be specified at the same time!");
             Float maxSmoothAngle = props.getFloat("maxSmoothAngle");
-            for (size_t i=0; i<m_meshes.size(); ++i)
+            #pragma omp parallel for schedule(dynamic)
+            for (int i=0; i<(int) m_meshes.size(); ++i)
                 m_meshes[i]->rebuildTopology(maxSmoothAngle);
         }
 
@@ -368,27 +498,310 @@ public:
             manager->serialize(stream, m_meshes[i]);
     }
 
-    void parse(OBJTriangle &t, int i, const std::string &str) {
-        std::vector<std::string> tokens = tokenize(str, "/");
-        if (tokens.size() == 1) {
-            t.p[i] = atoi(tokens[0].c_str());
-        } else if (tokens.size() == 2) {
-            if (str.find("//") == std::string::npos) {
-                t.p[i]  = atoi(tokens[0].c_str());
-                t.uv[i] = atoi(tokens[1].c_str());
+    static inline bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+    }
+
+    /// Find the next whitespace-separated token of a line
+    static inline bool nextToken(const char *&ptr, const char *end,
+            const char *&tokenStart, const char *&tokenEnd) {
+        while (ptr < end && isSpace(*ptr))
+            ++ptr;
+        if (ptr == end)
+            return false;
+        tokenStart = ptr;
+        while (ptr < end && !isSpace(*ptr))
+            ++ptr;
+        tokenEnd = ptr;
+        return true;
+    }
+
+    /// Check whether a line ends with a backslash (i.e. continues on the next one)
+    static inline bool isContinued(const char *lineStart, const char *lineEnd) {
+        while (lineEnd > lineStart && (lineEnd[-1] == '\r' || lineEnd[-1] == '\n' ||
+               lineEnd[-1] == '\t' || lineEnd[-1] == ' '))
+            --lineEnd;
+        return lineEnd > lineStart && lineEnd[-1] == '\\';
+    }
+
+    /**
+     * \brief Split a memory region into chunks of complete lines
+     *
+     * Lines that are continued with a backslash are never separated.
+     * Returns the chunk boundaries, including the start and end pointer.
+     */
+    static std::vector<const char *> splitLines(const char *data, size_t size) {
+        std::vector<const char *> bounds;
+        const char *end = data + size;
+        size_t chunkCount = std::max((size_t) 1, size / MTS_OBJ_CHUNK_SIZE);
+        bounds.push_back(data);
+        for (size_t i=1; i<chunkCount; ++i) {
+            const char *ptr = std::max(bounds.back(), data + i * (size / chunkCount));
+            while (ptr < end) {
+                const char *lineStart = ptr;
+                while (lineStart > data && lineStart[-1] != '\n')
+                    --lineStart;
+                const char *eol = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+                if (!eol) {
+                    ptr = end;
+                    break;
+                }
+                ptr = eol + 1;
+                if (!isContinued(lineStart, eol))
+                    break;
+            }
+            if (ptr >= end)
+                break;
+            bounds.push_back(ptr);
+        }
+        bounds.push_back(end);
+        return bounds;
+    }
+
+    /**
+     * \brief Parse a floating point value
+     *
+     * Decimal numbers with few digits are converted directly; everything
+     * else (long mantissas, large exponents, \c inf, \c nan) is passed
+     * on to \c strtod. A missing value evaluates to zero.
+     */
+    static Float parseFloat(const char *&ptr, const char *end) {
+        const char *start, *tokenEnd;
+        if (!nextToken(ptr, end, start, tokenEnd))
+            return 0.0f;
+
+        const char *cur = start;
+        bool negative = false;
+        if (*cur == '-' || *cur == '+')
+            negative = *cur++ == '-';
+
+        uint64_t mantissa = 0;
+        int exponent = 0, digits = 0;
+        while (cur < tokenEnd && *cur >= '0' && *cur <= '9') {
+            mantissa = mantissa * 10 + (uint64_t) (*cur++ - '0');
+            ++digits;
+        }
+        if (cur < tokenEnd && *cur == '.') {
+            ++cur;
+            while (cur < tokenEnd && *cur >= '0' && *cur <= '9') {
+                mantissa = mantissa * 10 + (uint64_t) (*cur++ - '0');
+                --exponent;
+                ++digits;
+            }
+        }
+        if (digits > 0 && cur < tokenEnd && (*cur == 'e' || *cur == 'E')) {
+            ++cur;
+            bool negativeExp = false;
+            if (cur < tokenEnd && (*cur == '-' || *cur == '+'))
+                negativeExp = *cur++ == '-';
+            int value = 0;
+            while (cur < tokenEnd && *cur >= '0' && *cur <= '9' && value < 10000)
+                value = value * 10 + (*cur++ - '0');
+            exponent += negativeExp ? -value : value;
+        }
+
+#if defined(SINGLE_PRECISION)
+        const uint64_t maxMantissa = (uint64_t) 1 << 24;
+        const int maxExponent = 10;
+#else
+        const uint64_t maxMantissa = (uint64_t) 1 << 53;
+        const int maxExponent = 22;
+#endif
+        static const Float powersOfTen[] = {
+            1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+#if !defined(SINGLE_PRECISION)
+            1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+#endif
+        };
+
+        /* Both the mantissa and the power of ten are exactly representable,
+           hence a single multiplication or division yields the correctly
+           rounded result */
+        if (cur == tokenEnd && digits > 0 && digits <= 19 && mantissa <= maxMantissa
+                && exponent >= -maxExponent && exponent <= maxExponent) {
+            Float value = (Float) mantissa;
+            if (exponent < 0)
+                value /= powersOfTen[-exponent];
+            else
+                value *= powersOfTen[exponent];
+            return negative ? -value : value;
+        }
+
+        char buf[64];
+        size_t length = std::min((size_t) (tokenEnd - start), sizeof(buf) - 1);
+        memcpy(buf, start, length);
+        buf[length] = '\0';
+        return (Float) strtod(buf, NULL);
+    }
+
+    /// Equivalent of \c atoi() for a character range
+    static int parseInt(const char *ptr, const char *end) {
+        bool negative = false;
+        if (ptr < end && (*ptr == '-' || *ptr == '+'))
+            negative = *ptr++ == '-';
+        int value = 0;
+        while (ptr < end && *ptr >= '0' && *ptr <= '9')
+            value = value * 10 + (*ptr++ - '0');
+        return negative ? -value : value;
+    }
+
+    /// Parse a face vertex token of the form p, p/uv, p//n or p/uv/n
+    static void parse(OBJTriangle &t, int i, const char *start, const char *end) {
+        int values[3], count = 0;
+        bool hasDoubleSlash = false;
+        const char *ptr = start;
+        while (ptr < end) {
+            const char *sep = ptr;
+            while (sep < end && *sep != '/')
+                ++sep;
+            if (sep > ptr) {
+                if (count == 3)
+                    Log(EError, "Invalid OBJ face format!");
+                values[count++] = parseInt(ptr, sep);
+            }
+            if (sep + 1 < end && sep[1] == '/')
+                hasDoubleSlash = true;
+            ptr = sep + 1;
+        }
+
+        if (count == 1) {
+            t.p[i] = values[0];
+        } else if (count == 2) {
+            if (!hasDoubleSlash) {
+                t.p[i]  = values[0];
+                t.uv[i] = values[1];
             } else {
-                t.p[i] = atoi(tokens[0].c_str());
-                t.n[i] = atoi(tokens[1].c_str());
+                t.p[i] = values[0];
+                t.n[i] = values[1];
             }
-        } else if (tokens.size() == 3) {
-            t.p[i] = atoi(tokens[0].c_str());
-            t.uv[i] = atoi(tokens[1].c_str());
-            t.n[i] = atoi(tokens[2].c_str());
+        } else if (count == 3) {
+            t.p[i] = values[0];
+            t.uv[i] = values[1];
+            t.n[i] = values[2];
         } else {
             Log(EError, "Invalid OBJ face format!");
         }
     }
 
+    /// Parse a single (already joined) line of an OBJ file
+    void parseLine(const char *lineStart, const char *lineEnd,
+            OBJChunk &chunk, bool flipTexCoords) const {
+        const char *ptr = lineStart, *start, *end;
+        if (!nextToken(ptr, lineEnd, start, end))
+            return;
+        size_t length = end - start;
+
+        if (length == 1 && *start == 'v') {
+            /* Parse + transform vertices */
+            Point p;
+            p.x = parseFloat(ptr, lineEnd);
+            p.y = parseFloat(ptr, lineEnd);
+            p.z = parseFloat(ptr, lineEnd);
+            chunk.vertices.push_back(p);
+        } else if (length == 2 && start[0] == 'v' && start[1] == 'n') {
+            Normal n;
+            n.x = parseFloat(ptr, lineEnd);
+            n.y = parseFloat(ptr, lineEnd);
+            n.z = parseFloat(ptr, lineEnd);
+            chunk.normals.push_back(n);
+        } else if (length == 2 && start[0] == 'v' && start[1] == 't') {
+            Float u = parseFloat(ptr, lineEnd);
+            Float v = parseFloat(ptr, lineEnd);
+            if (flipTexCoords)
+                v = 1-v;
+            chunk.texcoords.push_back(Point2(u, v));
+        } else if (length == 1 && *start == 'f') {
+            OBJTriangle t;
+            const char *tokenStart = ptr, *tokenEnd = ptr;
+            /* A missing vertex repeats the previous one */
+            for (int i=0; i<3; ++i) {
+                nextToken(ptr, lineEnd, tokenStart, tokenEnd);
+                parse(t, i, tokenStart, tokenEnd);
+            }
+            chunk.triangles.push_back(t);
+            /* Handle n-gons assuming a convex shape */
+            while (nextToken(ptr, lineEnd, tokenStart, tokenEnd)) {
+                t.p[1] = t.p[2];
+                t.uv[1] = t.uv[2];
+                t.n[1] = t.n[2];
+                parse(t, 2, tokenStart, tokenEnd);
+                chunk.triangles.push_back(t);
+            }
+        } else if ((length == 1 && *start == 'g' && !m_collapse) ||
+                   (length == 6 && (memcmp(start, "usemtl", 6) == 0 ||
+                                    memcmp(start, "mtllib", 6) == 0))) {
+            OBJStatement stmt;
+            std::string line(lineStart, lineEnd);
+            if (length == 1) {
+                stmt.type = OBJStatement::EGroup;
+                stmt.arg = trim(line.substr(1, line.length()-1));
+            } else {
+                stmt.type = *start == 'u' ? OBJStatement::EMaterial
+                    : OBJStatement::EMaterialLibrary;
+                stmt.arg = trim(line.substr(6, line.length()-1));
+            }
+            stmt.vertexCount = chunk.vertices.size();
+            stmt.normalCount = chunk.normals.size();
+            stmt.texcoordCount = chunk.texcoords.size();
+            stmt.triangleCount = chunk.triangles.size();
+            chunk.statements.push_back(stmt);
+        } else {
+            /* Ignore */
+        }
+    }
+
+    /// Parse a range of complete lines of an OBJ file
+    void parseChunk(const char *ptr, const char *end,
+            OBJChunk &chunk, bool flipTexCoords) const {
+        while (ptr < end) {
+            const char *eol = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+            const char *lineEnd = eol ? eol : end;
+            const char *next = eol ? eol + 1 : end;
+
+            if (!isContinued(ptr, lineEnd)) {
+                parseLine(ptr, lineEnd, chunk, flipTexCoords);
+            } else {
+                /* Rare case: join lines that end with a backslash */
+                std::string line;
+                while (true) {
+                    const char *last = lineEnd;
+                    while (last > ptr && (last[-1] == '\r' || last[-1] == '\t' || last[-1] == ' '))
+                        --last;
+                    bool continued = last > ptr && last[-1] == '\\';
+                    line.append(ptr, continued ? last - 1 : last);
+                    ptr = next;
+                    if (!continued || ptr >= end)
+                        break;
+                    eol = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+                    lineEnd = eol ? eol : end;
+                    next = eol ? eol + 1 : end;
+                }
+                parseLine(line.data(), line.data() + line.size(), chunk, flipTexCoords);
+                continue;
+            }
+            ptr = next;
+        }
+    }
+
+    /// Queue a mesh containing the triangles that were parsed so far
+    static void addMesh(std::vector<OBJMesh> &meshes, const std::string &name,
+            const std::vector<Point> &vertices,
+            const std::vector<Normal> &normals,
+            const std::vector<Point2> &texcoords,
+            std::vector<OBJTriangle> &triangles,
+            const std::string &materialName) {
+        if (triangles.size() == 0)
+            return;
+        meshes.push_back(OBJMesh());
+        OBJMesh &mesh = meshes.back();
+        mesh.name = name;
+        mesh.materialName = materialName;
+        mesh.triangles.swap(triangles);
+        mesh.vertexCount = vertices.size();
+        mesh.normalCount = normals.size();
+        mesh.texcoordCount = texcoords.size();
+    }
+
     Texture *loadTexture(const FileResolver *fileResolver,
             std::map<std::string, Texture *> &cache,
             const fs::path &mtlPath, std::string filename,
@@ -578,53 +991,58 @@ public:
         Point p;
         Normal n;
         Point2 uv;
+
+        inline bool operator==(const Vertex &v) const {
+            return p == v.p && n == v.n && uv == v.uv;
+        }
     };
 
-    /// For using vertices as keys in an associative structure
-    struct vertex_key_order : public
-        std::binary_function<Vertex, Vertex, bool> {
-    public:
-        bool operator()(const Vertex &v1, const Vertex &v2) const {
-            if (v1.p.x < v2.p.x) return true;
-            else if (v1.p.x > v2.p.x) return false;
-            if (v1.p.y < v2.p.y) return true;
-            else if (v1.p.y > v2.p.y) return false;
-            if (v1.p.z < v2.p.z) return true;
-            else if (v1.p.z > v2.p.z) return false;
-            if (v1.n.x < v2.n.x) return true;
-            else if (v1.n.x > v2.n.x) return false;
-            if (v1.n.y < v2.n.y) return true;
-            else if (v1.n.y > v2.n.y) return false;
-            if (v1.n.z < v2.n.z) return true;
-            else if (v1.n.z > v2.n.z) return false;
-            if (v1.uv.x < v2.uv.x) return true;
-            else if (v1.uv.x > v2.uv.x) return false;
-            if (v1.uv.y < v2.uv.y) return true;
-            else if (v1.uv.y > v2.uv.y) return false;
-            return false;
+    /// For using vertices as keys in a hash table
+    struct vertex_hash : public std::unary_function<Vertex, size_t> {
+        static inline void combine(size_t &seed, Float value) {
+            /* Ensure that +0 and -0 (which compare equal) hash identically */
+            boost::hash_combine(seed, value == 0 ? (Float) 0 : value);
+        }
+
+        size_t operator()(const Vertex &v) const {
+            size_t seed = 0;
+            for (int i=0; i<3; ++i)
+                combine(seed, v.p[i]);
+            for (int i=0; i<3; ++i)
+                combine(seed, v.n[i]);
+            combine(seed, v.uv.x);
+            combine(seed, v.uv.y);
+            return seed;
         }
     };
 
-    void createMesh(const std::string &name,
+    /**
+     * \brief Build a triangle mesh with merged vertices
+     *
+     * The vertices and normals must already be in world space.
+     * Indices are resolved against the number of elements that
+     * had been defined when the mesh was completed. Only accesses
+     * the member variables in a read-only manner, hence it's safe
+     * to build several meshes in parallel.
+     */
+    ref<TriMesh> createMesh(const OBJMesh &obj,
             const std::vector<Point> &vertices,
             const std::vector<Normal> &normals,
             const std::vector<Point2> &texcoords,
-            const std::vector<OBJTriangle> &triangles,
-            const std::string &materialName,
-            const Transform &objectToWorld,
-            std::vector<Vertex> &vertexBuffer) {
-        if (triangles.size() == 0)
-            return;
-        typedef std::map<Vertex, uint32_t, vertex_key_order> VertexMapType;
-        VertexMapType vertexMap;
+            size_t &numMerged) const {
+        typedef boost::unordered_map<Vertex, uint32_t, vertex_hash> VertexMapType;
+        const std::vector<OBJTriangle> &triangles = obj.triangles;
+        const int vertexCount = (int) obj.vertexCount,
+                  normalCount = (int) obj.normalCount,
+                  texcoordCount = (int) obj.texcoordCount;
 
-        vertexBuffer.reserve(vertices.size());
-        size_t numMerged = 0;
+        std::vector<Vertex> vertexBuffer;
+        vertexBuffer.reserve(std::min(obj.vertexCount, 3 * triangles.size()));
+        VertexMapType vertexMap(vertexBuffer.capacity());
+        numMerged = 0;
         AABB aabb;
         bool hasTexcoords = false;
         bool hasNormals = false;
-        ref<Timer> timer = new Timer();
-        vertexBuffer.clear();
 
         /* Collapse the mesh into a more usable form */
         Triangle *triangleArray = new Triangle[triangles.size()];
@@ -634,26 +1052,29 @@ public:
                 int vertexId = triangles[i].p[j];
                 int normalId = triangles[i].n[j];
                 int uvId = triangles[i].uv[j];
-                uint32_t key;
 
                 Vertex vertex;
                 if (vertexId < 0)
-                    vertexId += (int) vertices.size() + 1;
+                    vertexId += vertexCount + 1;
                 if (normalId < 0)
-                    normalId += (int) normals.size() + 1;
+                    normalId += normalCount + 1;
                 if (uvId < 0)
-                    uvId += (int) texcoords.size() + 1;
+                    uvId += texcoordCount + 1;
 
-                if (vertexId > (int) vertices.size() || vertexId <= 0)
-                    Log(EError, "Out of bounds: tried to access vertex %i (max: %i)", vertexId, (int) vertices.size());
+                if (vertexId > vertexCount || vertexId <= 0) {
+                    delete[] triangleArray;
+                    Log(EError, "Out of bounds: tried to access vertex %i (max: %i)", vertexId, vertexCount);
+                }
 
-                vertex.p = objectToWorld(vertices[vertexId-1]);
+                vertex.p = vertices[vertexId-1];
                 aabb.expandBy(vertex.p);
 
                 if (normalId != 0) {
-                    if (normalId > (int) normals.size() || normalId < 0)
-                        Log(EError, "Out of bounds: tried to access normal %i (max: %i)", normalId, (int) normals.size());
-                    vertex.n = objectToWorld(normals[normalId-1]);
+                    if (normalId > normalCount || normalId < 0) {
+                        delete[] triangleArray;
+                        Log(EError, "Out of bounds: tried to access normal %i (max: %i)", normalId, normalCount);
+                    }
+                    vertex.n = normals[normalId-1];
                     if (!vertex.n.isZero())
                         vertex.n = normalize(vertex.n);
                     hasNormals = true;
@@ -662,35 +1083,37 @@ public:
                 }
 
                 if (uvId != 0) {
-                    if (uvId > (int) texcoords.size() || uvId < 0)
-                        Log(EError, "Out of bounds: tried to access uv %i (max: %i)", uvId, (int) texcoords.size());
+                    if (uvId > texcoordCount || uvId < 0) {
+                        delete[] triangleArray;
+                        Log(EError, "Out of bounds: tried to access uv %i (max: %i)", uvId, texcoordCount);
+                    }
                     vertex.uv = texcoords[uvId-1];
                     hasTexcoords = true;
                 } else {
                     vertex.uv = Point2(0.0f);
                 }
 
-                VertexMapType::iterator it = vertexMap.find(vertex);
-                if (it != vertexMap.end()) {
-                    key = it->second;
-                    numMerged++;
-                } else {
-                    key = (uint32_t) vertexBuffer.size();
-                    vertexMap[vertex] = key;
+                std::pair<VertexMapType::iterator, bool> result =
+                    vertexMap.insert(std::make_pair(vertex, (uint32_t) vertexBuffer.size()));
+                if (result.second)
                     vertexBuffer.push_back(vertex);
-                }
+                else
+                    numMerged++;
 
-                tri.idx[j] = key;
+                tri.idx[j] = result.first->second;
             }
             triangleArray[i] = tri;
         }
 
-        ref<TriMesh> mesh = new TriMesh(name,
+        ref<TriMesh> mesh = new TriMesh(obj.name,
             triangles.size(), vertexBuffer.size(),
             hasNormals, hasTexcoords, false,
             m_flipNormals, m_faceNormals);
+        mesh->setQuantize(m_quantize);
+        mesh->setSmoothTangents(m_smoothTangents);
 
         std::copy(triangleArray, triangleArray+triangles.size(), mesh->getTriangles());
+        delete[] triangleArray;
 
         Point    *target_positions = mesh->getVertexPositions();
         Normal   *target_normals   = mesh->getVertexNormals();
@@ -706,12 +1129,7 @@ public:
                 *target_texcoords++ = vertexBuffer[i].uv;
         }
 
-        mesh->incRef();
-        m_materialAssignment.push_back(materialName);
-        m_meshes.push_back(mesh);
-        Log(EInfo, "%s: " SIZE_T_FMT " triangles, " SIZE_T_FMT
-            " vertices (merged " SIZE_T_FMT " vertices).", name.c_str(),
-            triangles.size(), vertexBuffer.size(), numMerged);
+        return mesh;
     }
 
     virtual ~WavefrontOBJ() {
@@ -836,6 +1254,8 @@ private:
     bool m_flipNormals, m_faceNormals;
     AABB m_aabb;
     bool m_collapse;
+    bool m_quantize;
+    bool m_smoothTangents;
 };
 
 MTS_IMPLEMENT_CLASS_S(WavefrontOBJ, false, Shape)
@@ -21,9 +21,13 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/mmap.h>
 #include <ply/ply_parser.hpp>
 #include <functional>
 
+/// Number of vertices or faces that are decoded by one task of the binary fast path
+#define MTS_PLY_CHUNK_SIZE (64*1024)
+
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{ply}{PLY (Stanford Triangle Format) mesh loader}
@@ -45,6 +49,18 @@ MTS_NAMESPACE_BEGIN
  *       Optional flag to flip all normals. \default{\code{false}, i.e.
  *       the normals are left unchanged}.
  *     }
+ *     \parameter{quantize}{\Boolean}{
+ *       Store vertex normals, texture coordinates and colors in a compact
+ *       quantized form (octahedral normals, half precision texture coordinates
+ *       and colors), which reduces the memory usage of large meshes
+ *       at a negligible loss of precision. \default{\code{false}}
+ *     }
+ *     \parameter{smoothTangents}{\Boolean}{
+ *       Interpolate per-vertex UV tangents instead of using a constant
+ *       tangent frame per triangle. This hides the tessellation of the mesh
+ *       in renderings with bump maps, normal maps and anisotropic materials.
+ *       \default{\code{false}}
+ *     }
  *     \parameter{toWorld}{\Transform\Or\Animation}{
  *        Specifies an optional linear object-to-world transformation.
  *        \default{none (i.e. object space $=$ world space)}
@@ -65,6 +81,9 @@ MTS_NAMESPACE_BEGIN
  * Ares Lagae (\url{http://people.cs.kuleuven.be/~ares.lagae/libply}).
  * The current plugin implementation supports triangle meshes with optional
  * UV coordinates, vertex normals, and vertex colors.
+ * Binary files whose vertex and face records have a fixed layout are
+ * memory-mapped and decoded in parallel without going through
+ * \code{libply}, which is considerably faster for very large meshes.
  *
  * When loading meshes that contain vertex colors, note that they need to be
  * explicitly referenced in a BSDF using a special texture named
@@ -89,7 +108,7 @@ public:
         if (!fs::exists(filePath))
             Log(EError, "PLY file \"%s\" could not be found!", filePath.string().c_str());
 
-        m_triangleCount = m_vertexCount = 0;
+        m_triangleCount = m_vertexCount = m_triangleCapacity = 0;
         m_vertexCtr = m_faceCount = m_faceCtr = m_indexCtr = 0;
         m_normal = Normal(0.0f);
         m_uv = Point2(0.0f);
@@ -111,7 +130,7 @@ public:
             rebuildTopology(props.getFloat("maxSmoothAngle"));
         }
 
-        if (m_triangleCount < m_faceCount * 2) {
+        if (m_triangleCount < m_triangleCapacity) {
             /* Needed less memory than the earlier conservative estimate -- free it! */
             Triangle *temp = new Triangle[m_triangleCount];
             memcpy(temp, m_triangles, sizeof(Triangle) * m_triangleCount);
@@ -125,6 +144,19 @@ public:
 
     void loadPLY(const fs::path &path);
 
+    /**
+     * \brief Fast path for binary PLY files
+     *
+     * Memory-maps the file and decodes the vertex and face arrays in
+     * parallel. Returns \c false without modifying the mesh when the file
+     * is in ASCII format or uses a layout that is not supported here, in
+     * which case it should be loaded using \c libply.
+     */
+    bool loadBinaryPLY(const fs::path &path);
+
+    /// Load a PLY file of any kind using \c libply
+    void loadPLYGeneric(const fs::path &path);
+
     void info_callback(const std::string& filename, std::size_t line_number,
             const std::string& message) {
         Log(EInfo, "\"%s\" [line %i] info: %s", filename.c_str(), line_number,
@@ -164,7 +196,8 @@ public:
             );
         } else if (element_name == "face") {
             m_faceCount = count;
-            m_triangles = new Triangle[m_faceCount*2];
+            m_triangleCapacity = m_faceCount*2;
+            m_triangles = new Triangle[m_triangleCapacity];
             return std::tuple<std::function<void()>,
                 std::function<void()> >(
                 std::bind(&PLYLoader::face_begin_callback, this),
@@ -203,11 +236,10 @@ public:
 
     void vertex_begin_callback() { }
     void vertex_end_callback() {
-        Point p = m_objectToWorld(m_position);
-        m_aabb.expandBy(p);
-        m_positions[m_vertexCtr] = p;
+        /* Transformed in a batch once all vertices have been parsed */
+        m_positions[m_vertexCtr] = m_position;
         if (m_normals)
-            m_normals[m_vertexCtr] = normalize(m_objectToWorld(m_normal));
+            m_normals[m_vertexCtr] = m_normal;
         if (m_texcoords)
             m_texcoords[m_vertexCtr] = m_uv;
         if (m_colors) {
@@ -294,7 +326,7 @@ private:
     Normal m_normal;
     Float m_red, m_green, m_blue;
     Transform m_objectToWorld;
-    size_t m_faceCount, m_vertexCtr;
+    size_t m_faceCount, m_vertexCtr, m_triangleCapacity;
     size_t m_faceCtr, m_indexCtr;
     uint32_t m_face[4];
     bool m_hasNormals, m_hasTexCoords;
@@ -440,6 +472,26 @@ template<> std::tuple<std::function<void (ply::uint32)>,
 
 
 void PLYLoader::loadPLY(const fs::path &path) {
+    ref<Timer> timer = new Timer();
+    if (!loadBinaryPLY(path))
+        loadPLYGeneric(path);
+
+    size_t vertexSize = sizeof(Point);
+    if (m_normals)
+        vertexSize += sizeof(Normal);
+    if (m_colors)
+        vertexSize += sizeof(Spectrum);
+    if (m_texcoords)
+        vertexSize += sizeof(Point2);
+
+    Log(EInfo, "\"%s\": Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT
+            " vertices (%s in %i ms).", m_name.c_str(), m_triangleCount, m_vertexCount,
+            memString(sizeof(uint32_t) * m_triangleCount * 3 + vertexSize * m_vertexCount).c_str(),
+            timer->getMilliseconds());
+}
+
+
+void PLYLoader::loadPLYGeneric(const fs::path &path) {
     ply::ply_parser ply_parser;
     ply_parser.info_callback(std::bind(&PLYLoader::info_callback,
         this, std::ref(m_name), _1, _2));
@@ -475,23 +527,438 @@ void PLYLoader::loadPLY(const fs::path &path) {
     ply_parser.scalar_property_definition_callbacks(scalar_property_definition_callbacks);
     ply_parser.list_property_definition_callbacks(list_property_definition_callbacks);
 
-    ref<Timer> timer = new Timer();
     ply_parser.parse(path.string());
 
-    size_t vertexSize = sizeof(Point);
+    m_objectToWorld.transformPoints(m_positions, m_positions, m_vertexCtr);
     if (m_normals)
-        vertexSize += sizeof(Normal);
-    if (m_colors)
-        vertexSize += sizeof(Spectrum);
-    if (m_texcoords)
-        vertexSize += sizeof(Point2);
+        m_objectToWorld.transformNormals(m_normals, m_normals, m_vertexCtr, true);
+    for (size_t i=0; i<m_vertexCtr; ++i)
+        m_aabb.expandBy(m_positions[i]);
+}
 
-    Log(EInfo, "\"%s\": Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT
-            " vertices (%s in %i ms).", m_name.c_str(), m_triangleCount, m_vertexCount,
-            memString(sizeof(uint32_t) * m_triangleCount * 3 + vertexSize * m_vertexCount).c_str(),
-            timer->getMilliseconds());
+/* ==================================================================== */
+/*                   Fast path for binary PLY files                     */
+/* ==================================================================== */
+
+namespace {
+    enum EPLYType {
+        EPLYInvalid = 0, EPLYInt8, EPLYUInt8, EPLYInt16, EPLYUInt16,
+        EPLYInt32, EPLYUInt32, EPLYFloat32, EPLYFloat64
+    };
+
+    struct PLYProperty {
+        std::string name;
+        EPLYType type;
+        /// Type of the element count (only for list properties)
+        EPLYType countType;
+        size_t offset;
+    };
+
+    struct PLYElement {
+        std::string name;
+        size_t count;
+        std::vector<PLYProperty> properties;
+    };
+
+    EPLYType parsePLYType(const std::string &name) {
+        if (name == "char" || name == "int8") return EPLYInt8;
+        else if (name == "uchar" || name == "uint8") return EPLYUInt8;
+        else if (name == "short" || name == "int16") return EPLYInt16;
+        else if (name == "ushort" || name == "uint16") return EPLYUInt16;
+        else if (name == "int" || name == "int32") return EPLYInt32;
+        else if (name == "uint" || name == "uint32") return EPLYUInt32;
+        else if (name == "float" || name == "float32") return EPLYFloat32;
+        else if (name == "double" || name == "float64") return EPLYFloat64;
+        return EPLYInvalid;
+    }
+
+    size_t getPLYTypeSize(EPLYType type) {
+        switch (type) {
+            case EPLYInt8: case EPLYUInt8: return 1;
+            case EPLYInt16: case EPLYUInt16: return 2;
+            case EPLYInt32: case EPLYUInt32: case EPLYFloat32: return 4;
+            case EPLYFloat64: return 8;
+            default: return 0;
+        }
+    }
+
+    template <typename T> inline T readPLYValue(const uint8_t *ptr, bool swap) {
+        T value;
+        memcpy(&value, ptr, sizeof(T));
+        return swap ? endianness_swap(value) : value;
+    }
+
+    /// Read an integer-valued property (list sizes and vertex indices)
+    inline int64_t readPLYInteger(const uint8_t *ptr, EPLYType type, bool swap) {
+        switch (type) {
+            case EPLYInt8: return (int8_t) *ptr;
+            case EPLYUInt8: return *ptr;
+            case EPLYInt16: return readPLYValue<int16_t>(ptr, swap);
+            case EPLYUInt16: return readPLYValue<uint16_t>(ptr, swap);
+            case EPLYInt32: return readPLYValue<int32_t>(ptr, swap);
+            case EPLYUInt32: return readPLYValue<uint32_t>(ptr, swap);
+            default: return -1;
+        }
+    }
+
+    /// Read a floating point property (positions, normals, texture coordinates)
+    inline Float readPLYFloat(const uint8_t *ptr, EPLYType type, bool swap) {
+        if (type == EPLYFloat32)
+            return (Float) readPLYValue<float>(ptr, swap);
+        else
+            return (Float) readPLYValue<double>(ptr, swap);
+    }
+
+    const PLYProperty *findPLYProperty(const PLYElement &element,
+            const char *name1, const char *name2 = NULL, const char *name3 = NULL) {
+        for (size_t i=0; i<element.properties.size(); ++i) {
+            const std::string &name = element.properties[i].name;
+            if (name == name1 || (name2 && name == name2) || (name3 && name == name3))
+                return &element.properties[i];
+        }
+        return NULL;
+    }
+
+    /// Range of faces that is decoded by one task
+    struct PLYFaceChunk {
+        size_t faceOffset, byteOffset, triangleOffset;
+    };
 }
 
+bool PLYLoader::loadBinaryPLY(const fs::path &path) {
+    size_t size = (size_t) fs::file_size(path);
+    if (size < 4)
+        return false;
+    ref<MemoryMappedFile> mmap = new MemoryMappedFile(path);
+    const uint8_t *data = static_cast<const uint8_t *>(mmap->getData());
+
+    /* Parse the header */
+    const char *headerEnd = NULL;
+    const char *ptr = reinterpret_cast<const char *>(data),
+               *end = reinterpret_cast<const char *>(data + size);
+    std::vector<PLYElement> elements;
+    bool swap = false, hasFormat = false;
+
+    if (memcmp(ptr, "ply", 3) != 0)
+        return false;
+
+    while (ptr < end) {
+        const char *eol = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+        if (!eol)
+            return false;
+        std::istringstream iss(std::string(ptr, eol));
+        ptr = eol + 1;
+
+        std::string keyword;
+        if (!(iss >> keyword))
+            continue;
+
+        if (keyword == "format") {
+            std::string format;
+            iss >> format;
+            Stream::EByteOrder byteOrder;
+            if (format == "binary_little_endian")
+                byteOrder = Stream::ELittleEndian;
+            else if (format == "binary_big_endian")
+                byteOrder = Stream::EBigEndian;
+            else
+                return false;
+            swap = byteOrder != Stream::getHostByteOrder();
+            hasFormat = true;
+        } else if (keyword == "element") {
+            PLYElement element;
+            if (!(iss >> element.name >> element.count))
+                return false;
+            elements.push_back(element);
+        } else if (keyword == "property") {
+            if (elements.empty())
+                return false;
+            PLYProperty prop;
+            std::string type;
+            iss >> type;
+            if (type == "list") {
+                std::string countType, valueType;
+                iss >> countType >> valueType;
+                prop.countType = parsePLYType(countType);
+                prop.type = parsePLYType(valueType);
+                if (prop.countType == EPLYInvalid || prop.countType >= EPLYFloat32)
+                    return false;
+            } else {
+                prop.countType = EPLYInvalid;
+                prop.type = parsePLYType(type);
+            }
+            if (prop.type == EPLYInvalid || !(iss >> prop.name))
+                return false;
+            elements.back().properties.push_back(prop);
+        } else if (keyword == "end_header") {
+            headerEnd = ptr;
+            break;
+        }
+    }
+
+    if (!hasFormat || !headerEnd)
+        return false;
+
+    /* Determine the record layout of every element. Only face elements
+       may contain a list (the vertex indices), which must come last */
+    const PLYElement *vertexElement = NULL, *faceElement = NULL;
+    size_t vertexOffset = 0, faceOffset = 0, vertexStride = 0;
+    size_t faceStride = 0, faceIndexOffset = 0;
+    const PLYProperty *indexProp = NULL;
+    size_t offset = (size_t) (headerEnd - reinterpret_cast<const char *>(data));
+
+    for (size_t i=0; i<elements.size(); ++i) {
+        PLYElement &element = elements[i];
+        size_t stride = 0;
+        const PLYProperty *list = NULL;
+
+        for (size_t j=0; j<element.properties.size(); ++j) {
+            PLYProperty &prop = element.properties[j];
+            if (list)
+                return false;
+            prop.offset = stride;
+            if (prop.countType != EPLYInvalid) {
+                if (element.name != "face" || prop.type >= EPLYFloat32 ||
+                    (prop.name != "vertex_indices" && prop.name != "vertex_index"))
+                    return false;
+                list = &prop;
+                stride += getPLYTypeSize(prop.countType);
+            } else {
+                stride += getPLYTypeSize(prop.type);
+            }
+        }
+
+        if (element.name == "vertex" && !vertexElement) {
+            vertexElement = &element;
+            vertexOffset = offset;
+            vertexStride = stride;
+        } else if (element.name == "face" && !faceElement && list) {
+            faceElement = &element;
+            faceOffset = offset;
+            indexProp = list;
+            /* Size of a triangle record */
+            faceStride = stride + 3 * getPLYTypeSize(list->type);
+            faceIndexOffset = stride;
+            /* Any further elements cannot be located without a full scan */
+            break;
+        } else if (list) {
+            return false;
+        }
+        if (element.count > (size - offset) / std::max(stride, (size_t) 1))
+            return false;
+        offset += element.count * stride;
+    }
+
+    if (!vertexElement || !faceElement)
+        return false;
+
+    const PLYProperty
+        *px = findPLYProperty(*vertexElement, "x"),
+        *py = findPLYProperty(*vertexElement, "y"),
+        *pz = findPLYProperty(*vertexElement, "z"),
+        *nx = findPLYProperty(*vertexElement, "nx"),
+        *ny = findPLYProperty(*vertexElement, "ny"),
+        *nz = findPLYProperty(*vertexElement, "nz"),
+        *tu = findPLYProperty(*vertexElement, "u", "texture_u", "s"),
+        *tv = findPLYProperty(*vertexElement, "v", "texture_v", "t"),
+        *cr = findPLYProperty(*vertexElement, "diffuse_red", "red"),
+        *cg = findPLYProperty(*vertexElement, "diffuse_green", "green"),
+        *cb = findPLYProperty(*vertexElement, "diffuse_blue", "blue");
+
+    const PLYProperty *floatProps[] = { px, py, pz, nx, ny, nz, tu, tv };
+    for (int i=0; i<8; ++i) {
+        if (i < 3 && !floatProps[i])
+            return false;
+        if (floatProps[i] && floatProps[i]->type != EPLYFloat32 &&
+            floatProps[i]->type != EPLYFloat64)
+            return false;
+    }
+    if ((nx == NULL) != (nz == NULL) || (ny == NULL) != (nz == NULL) ||
+        (tu == NULL) != (tv == NULL) || (cr == NULL) != (cg == NULL) ||
+        (cg == NULL) != (cb == NULL))
+        return false;
+    bool colorsUInt8 = cr && cr->type == EPLYUInt8;
+    if (cr && ((cr->type != EPLYUInt8 && cr->type != EPLYFloat32) ||
+               cg->type != cr->type || cb->type != cr->type))
+        return false;
+
+    size_t vertexCount = vertexElement->count,
+           faceCount = faceElement->count;
+    const uint8_t *vertexData = data + vertexOffset,
+                  *faceData = data + faceOffset;
+    size_t faceBytes = size - faceOffset;
+    EPLYType countType = indexProp->countType,
+             indexType = indexProp->type;
+    size_t countOffset = indexProp->offset,
+           indexSize = getPLYTypeSize(indexType);
+
+    /* Locate the faces. When all of them are triangles, the records
+       have a fixed size and can be addressed directly; otherwise, the
+       file is scanned once to find the chunk boundaries. */
+    size_t faceChunkCount = (faceCount + MTS_PLY_CHUNK_SIZE - 1) / MTS_PLY_CHUNK_SIZE;
+    std::vector<PLYFaceChunk> faceChunks(faceChunkCount);
+    size_t triangleCount = faceCount;
+    bool uniform = faceCount <= faceBytes / faceStride;
+
+    if (uniform) {
+        int nonTriangle = 0;
+        #pragma omp parallel for reduction(+:nonTriangle)
+        for (int i=0; i<(int) faceChunkCount; ++i) {
+            size_t start = (size_t) i * MTS_PLY_CHUNK_SIZE,
+                   stop = std::min(start + MTS_PLY_CHUNK_SIZE, faceCount);
+            for (size_t j=start; j<stop; ++j) {
+                if (readPLYInteger(faceData + j * faceStride + countOffset, countType, swap) != 3) {
+                    nonTriangle++;
+                    break;
+                }
+            }
+            faceChunks[i].faceOffset = start;
+            faceChunks[i].byteOffset = start * faceStride;
+            faceChunks[i].triangleOffset = start;
+        }
+        uniform = nonTriangle == 0;
+    }
+
+    if (!uniform) {
+        size_t pos = 0;
+        triangleCount = 0;
+        for (size_t i=0; i<faceCount; ++i) {
+            if (i % MTS_PLY_CHUNK_SIZE == 0) {
+                PLYFaceChunk &chunk = faceChunks[i / MTS_PLY_CHUNK_SIZE];
+                chunk.faceOffset = i;
+                chunk.byteOffset = pos;
+                chunk.triangleOffset = triangleCount;
+            }
+            if (pos + faceIndexOffset > faceBytes)
+                return false;
+            int64_t count = readPLYInteger(faceData + pos + countOffset, countType, swap);
+            if (count != 3 && count != 4)
+                Log(EError, "Encountered a face with %i vertices! "
+                    "Only triangle and quad-based PLY meshes are supported for now.", (int) count);
+            pos += faceStride + (size_t) (count - 3) * indexSize;
+            if (pos > faceBytes)
+                return false;
+            triangleCount += (size_t) count - 2;
+        }
+    }
+
+    /* The layout is supported -- allocate and decode the mesh */
+    m_vertexCount = vertexCount;
+    m_faceCount = faceCount;
+    m_triangleCount = m_triangleCapacity = triangleCount;
+    m_positions = new Point[m_vertexCount];
+    m_triangles = new Triangle[m_triangleCapacity];
+    if (nx && vertexCount > 0) {
+        m_normals = new Normal[m_vertexCount];
+        m_hasNormals = true;
+    }
+    if (tu && vertexCount > 0) {
+        m_texcoords = new Point2[m_vertexCount];
+        m_hasTexCoords = true;
+    }
+    if (cr && vertexCount > 0)
+        m_colors = new Color3[m_vertexCount];
+
+    size_t vertexChunkCount = (vertexCount + MTS_PLY_CHUNK_SIZE - 1) / MTS_PLY_CHUNK_SIZE;
+    std::vector<AABB> aabbs(vertexChunkCount);
+
+    #pragma omp parallel for
+    for (int i=0; i<(int) vertexChunkCount; ++i) {
+        size_t start = (size_t) i * MTS_PLY_CHUNK_SIZE,
+               stop = std::min(start + MTS_PLY_CHUNK_SIZE, vertexCount);
+        AABB aabb;
+        for (size_t j=start; j<stop; ++j) {
+            const uint8_t *record = vertexData + j * vertexStride;
+            m_positions[j] = Point(
+                readPLYFloat(record + px->offset, px->type, swap),
+                readPLYFloat(record + py->offset, py->type, swap),
+                readPLYFloat(record + pz->offset, pz->type, swap));
+
+            if (nx)
+                m_normals[j] = Normal(
+                    readPLYFloat(record + nx->offset, nx->type, swap),
+                    readPLYFloat(record + ny->offset, ny->type, swap),
+                    readPLYFloat(record + nz->offset, nz->type, swap));
+
+            if (tu)
+                m_texcoords[j] = Point2(
+                    readPLYFloat(record + tu->offset, tu->type, swap),
+                    readPLYFloat(record + tv->offset, tv->type, swap));
+
+            if (cr) {
+                Float r, g, b;
+                if (colorsUInt8) {
+                    r = record[cr->offset] / 255.0f;
+                    g = record[cg->offset] / 255.0f;
+                    b = record[cb->offset] / 255.0f;
+                } else {
+                    r = readPLYValue<float>(record + cr->offset, swap);
+                    g = readPLYValue<float>(record + cg->offset, swap);
+                    b = readPLYValue<float>(record + cb->offset, swap);
+                }
+                if (m_sRGB)
+                    m_colors[j] = Color3(fromSRGBComponent(r),
+                        fromSRGBComponent(g), fromSRGBComponent(b));
+                else
+                    m_colors[j] = Color3(r, g, b);
+            }
+        }
+
+        /* Transform the chunk in batches */
+        m_objectToWorld.transformPoints(m_positions + start, m_positions + start, stop - start);
+        if (nx)
+            m_objectToWorld.transformNormals(m_normals + start, m_normals + start, stop - start, true);
+        for (size_t j=start; j<stop; ++j)
+            aabb.expandBy(m_positions[j]);
+        aabbs[i] = aabb;
+    }
+
+    for (size_t i=0; i<vertexChunkCount; ++i)
+        m_aabb.expandBy(aabbs[i]);
+
+    int invalidIndices = 0;
+    #pragma omp parallel for reduction(+:invalidIndices)
+    for (int i=0; i<(int) faceChunkCount; ++i) {
+        const PLYFaceChunk &chunk = faceChunks[i];
+        size_t stop = std::min(chunk.faceOffset + MTS_PLY_CHUNK_SIZE, faceCount);
+        const uint8_t *record = faceData + chunk.byteOffset;
+        Triangle *target = m_triangles + chunk.triangleOffset;
+
+        for (size_t j=chunk.faceOffset; j<stop; ++j) {
+            int count = uniform ? 3 : (int) readPLYInteger(record + countOffset, countType, swap);
+            const uint8_t *indices = record + faceIndexOffset;
+            uint32_t face[4];
+            for (int k=0; k<count; ++k) {
+                int64_t index = readPLYInteger(indices + k * indexSize, indexType, swap);
+                if (index < 0 || (size_t) index >= vertexCount) {
+                    invalidIndices++;
+                    index = 0;
+                }
+                face[k] = (uint32_t) index;
+            }
+
+            Triangle t;
+            t.idx[0] = face[0]; t.idx[1] = face[1]; t.idx[2] = face[2];
+            *target++ = t;
+
+            if (count == 4) {
+                t.idx[0] = face[3]; t.idx[1] = face[0]; t.idx[2] = face[2];
+                *target++ = t;
+            }
+
+            record += faceStride + (count - 3) * indexSize;
+        }
+    }
+
+    m_vertexCtr = m_vertexCount;
+    m_faceCtr = m_faceCount;
+
+    if (invalidIndices > 0)
+        Log(EError, "\"%s\": %i faces reference nonexistent vertices!",
+            m_name.c_str(), invalidIndices);
+
+    return true;
+}
 
 MTS_IMPLEMENT_CLASS_S(PLYLoader, false, TriMesh)
 MTS_EXPORT_PLUGIN(PLYLoader, "PLY mesh loader");
@@ -0,0 +1,496 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/skdtree.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/render/bsdf.h>
+#include <mitsuba/core/properties.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/atomic.h>
+#include <mitsuba/core/timer.h>
+
+/// Offset of the temporary storage passed to the kd-tree of a proxy
+#define MTS_PROXY_TEMP_OFFSET 8
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{proxy}{Deferred geometry}
+ * \order{10}
+ * \parameters{
+ *     \parameter{shape}{\String}{
+ *       Name of the shape plugin that loads the actual geometry, e.g.
+ *       \code{serialized}, \code{obj}, or \code{ply}
+ *     }
+ *     \parameter{min, max}{\Point}{
+ *       Corners of a world-space bounding box that contains the geometry
+ *     }
+ *     \parameter{maxResidentMemory}{\Integer}{
+ *       Approximate upper bound on the memory (in MiB) that is used by the
+ *       geometry of all proxies combined. When it is exceeded, the least
+ *       recently used proxies are unloaded and will be loaded again
+ *       when needed. The smallest value specified by any proxy is the one
+ *       that is used. \default{0, i.e. no limit}
+ *     }
+ *     \parameter{\Unnamed}{\BSDF}{
+ *       Material of the geometry. Materials defined in the file
+ *       itself (e.g. in an OBJ material library) are ignored.
+ *     }
+ * }
+ *
+ * This plugin defers loading a shape until a ray actually hits its bounding
+ * box. The scene acceleration data structure only contains the box, and
+ * the actual geometry is loaded and given its own kd-tree the first time
+ * it's needed. This speeds up loading a scene and reduces memory usage
+ * when large parts of it are never seen (e.g. an entire city, of which the
+ * camera only views a few blocks).
+ *
+ * All parameters that are not listed above (\code{filename},
+ * \code{toWorld}, \code{faceNormals}, etc.) are passed to the plugin
+ * given by \code{shape}, e.g.:
+ * \begin{xml}
+ * <shape type="proxy">
+ *     <string name="shape" value="serialized"/>
+ *     <string name="filename" value="block_042.serialized"/>
+ *     <point name="min" x="-100" y="0" z="-100"/>
+ *     <point name="max" x="100" y="80" z="100"/>
+ *     <bsdf type="diffuse"/>
+ * </shape>
+ * \end{xml}
+ * \remarks{
+ *   \item Rays that leave the bounding box never see the geometry, so it
+ *   must really contain the shape. A warning is printed when it doesn't.
+ *   \item Deferred shapes cannot have attached emitters, sensors, or
+ *   subsurface scattering models.
+ *   \item The files must be available to the machine that renders the
+ *   scene. When the scene is sent to network rendering nodes, the geometry
+ *   of every proxy is loaded first and sent along with it.
+ * }
+ */
+class ShapeProxy : public Shape {
+public:
+    /// Loaded geometry of a proxy
+    struct Geometry : public Object {
+        ref<ShapeKDTree> kdtree;
+        /// Shapes in the kd-tree and the index of their first primitive
+        std::vector<std::pair<const Shape *, uint32_t> > offsets;
+        /// Approximate storage requirements
+        size_t memory;
+        /// Incremented every time the geometry is (re)loaded
+        uint32_t generation;
+    };
+
+    ShapeProxy(const Properties &props) : Shape(props), m_props(props) {
+        m_shapeType = props.getString("shape");
+        m_aabb = AABB(props.getPoint("min"), props.getPoint("max"));
+        if (!m_aabb.isValid())
+            Log(EError, "The bounding box of a proxy must be specified "
+                "using the 'min' and 'max' parameters!");
+
+        int64_t maxResident = props.getLong("maxResidentMemory", 0);
+        if (maxResident < 0)
+            Log(EError, "The 'maxResidentMemory' parameter must be positive!");
+        setMemoryLimit((size_t) maxResident * 1024 * 1024);
+
+        /* Remaining parameters are meant for the actual shape */
+        m_props.removeProperty("shape");
+        m_props.removeProperty("min");
+        m_props.removeProperty("max");
+        m_props.removeProperty("maxResidentMemory");
+        m_props.setPluginName(m_shapeType);
+
+        std::vector<std::string> names;
+        m_props.putPropertyNames(names);
+        for (size_t i=0; i<names.size(); ++i)
+            props.markQueried(names[i]);
+
+        m_fileResolver = Thread::getThread()->getFileResolver()->clone();
+        m_mutex = new Mutex();
+        m_resident = NULL;
+        m_lastUsed = 0;
+        m_generation = 0;
+    }
+
+    ShapeProxy(Stream *stream, InstanceManager *manager)
+            : Shape(stream, manager) {
+        /* The geometry was loaded before serialization */
+        m_aabb = AABB(stream);
+        ref<Geometry> geometry = new Geometry();
+        geometry->kdtree = new ShapeKDTree();
+        size_t shapeCount = stream->readSize();
+        for (size_t i=0; i<shapeCount; ++i)
+            geometry->kdtree->addShape(static_cast<Shape *>(manager->getInstance(stream)));
+        geometry->kdtree->setLogLevel(EDebug);
+        geometry->kdtree->build();
+        m_mutex = new Mutex();
+        m_lastUsed = 0;
+        m_generation = 0;
+        finalize(geometry);
+        m_geometry = geometry;
+        m_resident = geometry;
+    }
+
+    virtual ~ShapeProxy() {
+        LockGuard lock(s_mutex);
+        std::vector<ShapeProxy *>::iterator it =
+            std::find(s_residentProxies.begin(), s_residentProxies.end(), this);
+        if (it != s_residentProxies.end()) {
+            s_residentProxies.erase(it);
+            s_residentMemory -= m_geometry->memory;
+        }
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Shape::serialize(stream, manager);
+        m_aabb.serialize(stream);
+
+        ref<Geometry> holder;
+        const Geometry *geometry = acquire(holder);
+        const std::vector<const Shape *> &shapes = geometry->kdtree->getShapes();
+        stream->writeSize(shapes.size());
+        for (size_t i=0; i<shapes.size(); ++i)
+            manager->serialize(stream, shapes[i]);
+    }
+
+    void configure() {
+        Shape::configure();
+        if (isEmitter())
+            Log(EError, "Deferred loading of emitters is not supported");
+        if (isSensor())
+            Log(EError, "Deferred loading of sensors is not supported");
+        if (hasSubsurface())
+            Log(EError, "Deferred loading of subsurface scattering models is not supported");
+    }
+
+    AABB getAABB() const {
+        return m_aabb;
+    }
+
+    Float getSurfaceArea() const {
+        ref<Geometry> holder;
+        const Geometry *geometry = acquire(holder);
+        Float result = 0;
+        for (size_t i=0; i<geometry->offsets.size(); ++i)
+            result += geometry->offsets[i].first->getSurfaceArea();
+        return result;
+    }
+
+    size_t getPrimitiveCount() const {
+        return 1;
+    }
+
+    size_t getEffectivePrimitiveCount() const {
+        return 1;
+    }
+
+    bool rayIntersect(const Ray &ray, Float mint, Float maxt, Float &t, void *temp) const {
+        Float nearT, farT;
+        if (!m_aabb.rayIntersect(ray, nearT, farT) || nearT > maxt || farT < mint)
+            return false;
+
+        ref<Geometry> holder;
+        const Geometry *geometry = acquire(holder);
+        *static_cast<uint32_t *>(temp) = geometry->generation;
+        return geometry->kdtree->rayIntersect(ray, mint, maxt, t,
+            static_cast<uint8_t *>(temp) + MTS_PROXY_TEMP_OFFSET);
+    }
+
+    bool rayIntersect(const Ray &ray, Float mint, Float maxt) const {
+        Float nearT, farT;
+        if (!m_aabb.rayIntersect(ray, nearT, farT) || nearT > maxt || farT < mint)
+            return false;
+
+        ref<Geometry> holder;
+        const Geometry *geometry = acquire(holder);
+        return geometry->kdtree->rayIntersect(ray, mint, maxt);
+    }
+
+    void fillIntersectionRecord(const Ray &ray,
+            const void *temp, Intersection &its) const {
+        ref<Geometry> holder;
+        const Geometry *geometry = acquire(holder);
+        const uint8_t *innerTemp = static_cast<const uint8_t *>(temp) + MTS_PROXY_TEMP_OFFSET;
+
+        uint8_t buf[MTS_KD_INTERSECTION_TEMP];
+        if (*static_cast<const uint32_t *>(temp) != geometry->generation) {
+            /* The geometry was unloaded and loaded again since the
+               intersection was found -- redo the intersection search */
+            Float t;
+            if (!geometry->kdtree->rayIntersect(ray, ray.mint, ray.maxt, t, buf))
+                Log(EError, "Internal error: lost the intersection with a reloaded proxy");
+            innerTemp = buf;
+        }
+
+        geometry->kdtree->fillIntersectionRecord<false>(ray, innerTemp, its);
+
+        /* Refer to the proxy instead of the loaded shapes, which
+           might not exist anymore once the record is used */
+        its.primIndex += findOffset(geometry, its.shape);
+        its.shape = this;
+        its.instance = this;
+    }
+
+    void getNormalDerivative(const Intersection &its,
+            Vector &dndu, Vector &dndv, bool shadingFrame) const {
+        ref<Geometry> holder;
+        const Geometry *geometry = acquire(holder);
+        const std::vector<std::pair<const Shape *, uint32_t> > &offsets = geometry->offsets;
+
+        size_t index = 0;
+        while (index + 1 < offsets.size() && offsets[index+1].second <= its.primIndex)
+            ++index;
+
+        Intersection temp(its);
+        temp.shape = offsets[index].first;
+        temp.primIndex = its.primIndex - offsets[index].second;
+        temp.instance = NULL;
+        temp.shape->getNormalDerivative(temp, dndu, dndv, shadingFrame);
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "ShapeProxy[" << endl
+            << "  name = \"" << m_name << "\"," << endl
+            << "  shape = \"" << m_shapeType << "\"," << endl
+            << "  aabb = " << m_aabb.toString() << "," << endl
+            << "  loaded = " << (m_geometry.get() ? "true" : "false") << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    /**
+     * \brief Return the loaded geometry, loading it if necessary
+     *
+     * \param holder
+     *    Receives a reference that keeps the geometry alive while it
+     *    is being used. It is only needed (and only set) when a memory
+     *    limit is active, which avoids reference counting in the
+     *    common case.
+     */
+    inline const Geometry *acquire(ref<Geometry> &holder) const {
+        m_lastUsed = s_clock;
+
+        /* Without a memory limit, loaded geometry stays forever */
+        Geometry *resident = m_resident;
+        if (EXPECT_TAKEN(resident != NULL && s_memoryLimit == 0))
+            return resident;
+
+        UniqueLock lock(m_mutex);
+        if (m_geometry) {
+            holder = m_geometry;
+            return holder.get();
+        }
+
+        holder = load();
+        m_geometry = holder;
+        atomicCompareAndExchangePtr(&m_resident, holder.get(), (Geometry *) NULL);
+        lock.unlock();
+
+        evict(holder->memory);
+        return holder.get();
+    }
+
+    /// Create the actual shape and build a kd-tree over it
+    ref<Geometry> load() const {
+        ref<Timer> timer = new Timer();
+        Thread *thread = Thread::getThread();
+        ref<FileResolver> fileResolver = thread->getFileResolver();
+        thread->setFileResolver(m_fileResolver);
+
+        ref<Geometry> geometry = new Geometry();
+        geometry->kdtree = new ShapeKDTree();
+        geometry->kdtree->setLogLevel(EDebug);
+
+        try {
+            ref<Shape> shape = static_cast<Shape *> (PluginManager::getInstance()->
+                createObject(MTS_CLASS(Shape), m_props));
+            if (m_bsdf.get())
+                shape->addChild(const_cast<BSDF *>(m_bsdf.get()));
+            shape->configure();
+            addShape(geometry->kdtree, shape);
+            geometry->kdtree->build();
+        } catch (...) {
+            thread->setFileResolver(fileResolver);
+            throw;
+        }
+        thread->setFileResolver(fileResolver);
+
+        finalize(geometry);
+        geometry->generation = ++m_generation;
+
+        const AABB &aabb = geometry->kdtree->getAABB();
+        if (aabb.isValid() && (!m_aabb.contains(aabb.min) || !m_aabb.contains(aabb.max)))
+            Log(EWarn, "\"%s\": the geometry %s extends beyond the bounding box "
+                "%s of the proxy and will be clipped!", getName().c_str(),
+                aabb.toString().c_str(), m_aabb.toString().c_str());
+
+        Log(EInfo, "\"%s\": loaded " SIZE_T_FMT " primitives (%s in %i ms)",
+            getName().c_str(), geometry->kdtree->getPrimitiveCount(),
+            memString(geometry->memory).c_str(), timer->getMilliseconds());
+
+        return geometry;
+    }
+
+    /// Add a shape to the kd-tree, while expanding compound shapes
+    void addShape(ShapeKDTree *kdtree, Shape *shape) const {
+        const Class *cClass = shape->getClass();
+        if (cClass->getName() == "ShapeGroup" || cClass->getName() == "Instance"
+                || cClass->getName() == "ShapeProxy")
+            Log(EError, "Shape groups, instances and proxies cannot be "
+                "loaded by a proxy");
+
+        if (shape->isCompound()) {
+            int index = 0;
+            do {
+                ref<Shape> element = shape->getElement(index++);
+                if (element == NULL)
+                    break;
+                addShape(kdtree, element);
+            } while (true);
+        } else {
+            kdtree->addShape(shape);
+        }
+    }
+
+    /// Compute the primitive offsets and memory usage of a geometry record
+    static void finalize(Geometry *geometry) {
+        const std::vector<const Shape *> &shapes = geometry->kdtree->getShapes();
+        uint32_t offset = 0;
+        size_t memory = 0;
+
+        geometry->offsets.clear();
+        for (size_t i=0; i<shapes.size(); ++i) {
+            const Shape *shape = shapes[i];
+            geometry->offsets.push_back(std::make_pair(shape, offset));
+            offset += (uint32_t) shape->getPrimitiveCount();
+
+            if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+                const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+                size_t vertexSize = sizeof(Point);
+                if (mesh->hasVertexNormals())
+                    vertexSize += sizeof(Normal);
+                if (mesh->hasVertexTexcoords())
+                    vertexSize += sizeof(Point2);
+                if (mesh->hasVertexColors())
+                    vertexSize += sizeof(Color3);
+                memory += mesh->getTriangleCount() * sizeof(Triangle)
+                    + mesh->getVertexCount() * vertexSize;
+            }
+        }
+
+        /* Rough estimate of the kd-tree storage */
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+        memory += offset * sizeof(TriAccel);
+#endif
+        memory += offset * 3 * sizeof(uint32_t);
+
+        geometry->memory = memory;
+        geometry->generation = 0;
+    }
+
+    /// Return the index of the first primitive of a loaded shape
+    static uint32_t findOffset(const Geometry *geometry, const Shape *shape) {
+        for (size_t i=0; i<geometry->offsets.size(); ++i) {
+            if (geometry->offsets[i].first == shape)
+                return geometry->offsets[i].second;
+        }
+        SLog(EError, "Internal error: could not find a shape in a proxy");
+        return 0;
+    }
+
+    /**
+     * \brief Register newly loaded geometry and unload the least
+     * recently used proxies if the memory limit is exceeded
+     */
+    void evict(size_t memory) const {
+        std::vector<ShapeProxy *> victims;
+        {
+            LockGuard lock(s_mutex);
+            s_residentProxies.push_back(const_cast<ShapeProxy *>(this));
+            s_residentMemory += memory;
+            ++s_clock;
+
+            while (s_memoryLimit != 0 && s_residentMemory > s_memoryLimit) {
+                std::vector<ShapeProxy *>::iterator victim = s_residentProxies.end();
+                for (std::vector<ShapeProxy *>::iterator it = s_residentProxies.begin();
+                        it != s_residentProxies.end(); ++it) {
+                    if (*it != this && (victim == s_residentProxies.end() ||
+                            (*it)->m_lastUsed < (*victim)->m_lastUsed))
+                        victim = it;
+                }
+                if (victim == s_residentProxies.end())
+                    break;
+                victims.push_back(*victim);
+                s_residentMemory -= (*victim)->m_geometry->memory;
+                s_residentProxies.erase(victim);
+            }
+        }
+
+        for (size_t i=0; i<victims.size(); ++i) {
+            ShapeProxy *victim = victims[i];
+            ref<Geometry> geometry;
+            {
+                /* Threads that are still using the geometry hold
+                   a reference, so it is released once they're done */
+                LockGuard lock(victim->m_mutex);
+                geometry = victim->m_geometry;
+                victim->m_geometry = NULL;
+                victim->m_resident = NULL;
+            }
+            Log(EDebug, "\"%s\": unloaded geometry (%s)", victim->getName().c_str(),
+                memString(geometry->memory).c_str());
+        }
+    }
+
+    /// Set the memory limit shared by all proxies
+    static void setMemoryLimit(size_t limit) {
+        if (limit == 0)
+            return;
+        LockGuard lock(s_mutex);
+        if (s_memoryLimit == 0 || limit < s_memoryLimit)
+            s_memoryLimit = limit;
+    }
+
+private:
+    Properties m_props;
+    std::string m_shapeType;
+    AABB m_aabb;
+    mutable ref<FileResolver> m_fileResolver;
+    mutable ref<Mutex> m_mutex;
+    mutable ref<Geometry> m_geometry;
+    mutable Geometry *m_resident;
+    mutable volatile uint64_t m_lastUsed;
+    mutable uint32_t m_generation;
+
+    static ref<Mutex> s_mutex;
+    static std::vector<ShapeProxy *> s_residentProxies;
+    static size_t s_residentMemory, s_memoryLimit;
+    static volatile uint64_t s_clock;
+};
+
+ref<Mutex> ShapeProxy::s_mutex = new Mutex();
+std::vector<ShapeProxy *> ShapeProxy::s_residentProxies;
+size_t ShapeProxy::s_residentMemory = 0;
+size_t ShapeProxy::s_memoryLimit = 0;
+volatile uint64_t ShapeProxy::s_clock = 0;
+
+MTS_IMPLEMENT_CLASS_S(ShapeProxy, false, Shape)
+MTS_EXPORT_PLUGIN(ShapeProxy, "Deferred geometry");
+MTS_NAMESPACE_END
@@ -22,8 +22,10 @@
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/lrucache.h>
+#include <mitsuba/core/mmap.h>
 
 #include <boost/make_shared.hpp>
+#include <boost/functional/hash.hpp>
 
 /// How many files to keep open in the cache, per thread
 #define MTS_SERIALIZED_CACHE_SIZE 4
@@ -57,6 +59,34 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  *       Optional flag to flip all normals. \default{\code{false}, i.e.
  *       the normals are left unchanged}.
  *     }
+ *     \parameter{memoryMap}{\Boolean}{
+ *       When the file was written in the uncompressed format (see below),
+ *       reference the mesh data in a memory-mapped view of the file
+ *       instead of copying it. \default{\code{true}}
+ *     }
+ *     \parameter{cache}{\Boolean}{
+ *       Store the fully processed mesh (i.e. after decompression and after
+ *       applying \code{toWorld} and \code{maxSmoothAngle}) in an uncompressed
+ *       cache file and map it into memory. Other Mitsuba processes on the
+ *       same machine that load the same mesh then share the physical memory
+ *       instead of keeping a private copy each. \default{\code{false}}
+ *     }
+ *     \parameter{cacheDirectory}{\String}{
+ *       Directory for the cache files created by the \code{cache} option.
+ *       \default{the directory containing \code{filename}}
+ *     }
+ *     \parameter{quantize}{\Boolean}{
+ *       Store vertex normals, texture coordinates and colors in a compact
+ *       quantized form (octahedral normals, half precision texture coordinates
+ *       and colors), which reduces the memory usage of large meshes
+ *       at a negligible loss of precision. \default{\code{false}}
+ *     }
+ *     \parameter{smoothTangents}{\Boolean}{
+ *       Interpolate per-vertex UV tangents instead of using a constant
+ *       tangent frame per triangle. This hides the tessellation of the mesh
+ *       in renderings with bump maps, normal maps and anisotropic materials.
+ *       \default{\code{false}}
+ *     }
  *     \parameter{toWorld}{\Transform\Or\Animation}{
  *        Specifies an optional linear object-to-world transformation.
  *        \default{none (i.e. object space $=$ world space)}
@@ -126,6 +156,39 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  * uncompressed format, followed by an uncompressed header, and so on.
  * This is neccessary for efficient read access to arbitrary sub-meshes.
  *
+ * \paragraph{Uncompressed variant:}
+ * Files with the version identifier \code{0x0005} store the same fields
+ * without \code{DEFLATE} compression. Each of the arrays is preceded by
+ * zero padding, so that the vertex positions start at a multiple of 4096 bytes
+ * and the remaining arrays at a multiple of 64 bytes (relative to the
+ * beginning of the file). When the file uses the floating
+ * point precision of the running Mitsuba build, the \code{serialized} plugin
+ * maps it into memory and uses the data in place, which makes loading nearly
+ * instantaneous and lets processes on the same machine share the pages.
+ * Such files are created by \code{mtsimport -u}. Shapes that need to modify
+ * the data (e.g. due to \code{toWorld}, \code{flipNormals} or
+ * \code{maxSmoothAngle}) silently fall back to a private copy.
+ *
+ * \paragraph{Block-compressed variant:}
+ * Meshes with more than 4 MiB of vertex and index data are written with the
+ * version identifier \code{0x0006}. Instead of a single \code{DEFLATE}
+ * stream, the fields are split into blocks of 1 MiB that are compressed
+ * independently, which allows compressing and decompressing them on all
+ * cores. The header is followed by the number of blocks (\code{uint32}),
+ * the compressed sizes of all blocks (\code{uint64} each), their
+ * uncompressed sizes (\code{uint64} each) and the \code{zlib} streams
+ * of the blocks.
+ *
+ * \paragraph{Shared mesh cache:}
+ * When several renderings of the same scene run concurrently on a machine
+ * (e.g. one process per camera), the \code{cache} parameter avoids that every
+ * process holds its own copy of compressed or transformed meshes. The first
+ * process to load a mesh writes the final vertex and index data to a file of
+ * the uncompressed variant, whose name encodes the shape index and a hash of
+ * the input file and the relevant parameters. All processes then map this file,
+ * so that the operating system keeps a single copy in memory. Stale cache files
+ * are never reused, but they are also not deleted automatically.
+ *
  * \paragraph{End-of-file dictionary:} In addition to the previous table,
  * a \code{.serialized} file also concludes with a brief summary at the end of
  * the file, which specifies the starting position of each sub-mesh:
@@ -159,12 +222,26 @@ public:
         std::string name = (props.getID() != "unnamed") ? props.getID()
             : formatString("%s@%i", filePath.stem().string().c_str(), shapeIndex);
 
+        /* Reference uncompressed files in memory instead of copying them? */
+        m_memoryMap = props.getBoolean("memoryMap", true);
+
+        /* Share the processed mesh with other processes using a cache file? */
+        fs::path cacheFile;
+        if (props.getBoolean("cache", false)) {
+            fs::path cacheDirectory = props.getString("cacheDirectory",
+                fs::absolute(filePath).parent_path().string());
+            cacheFile = getCacheFile(cacheDirectory, filePath, shapeIndex, props);
+        }
+
         /* Load the geometry */
         Log(EInfo, "Loading shape %i from \"%s\" ..", shapeIndex, filePath.filename().string().c_str());
         ref<Timer> timer = new Timer();
-        loadCompressed(filePath, shapeIndex);
-        Log(EDebug, "Done (" SIZE_T_FMT " triangles, " SIZE_T_FMT " vertices, %i ms)",
-            m_triangleCount, m_vertexCount, timer->getMilliseconds());
+        bool cached = !cacheFile.empty() && loadCache(cacheFile);
+        if (!cached)
+            loadCompressed(filePath, shapeIndex);
+        Log(EDebug, "Done (" SIZE_T_FMT " triangles, " SIZE_T_FMT " vertices, %i ms%s)",
+            m_triangleCount, m_vertexCount, timer->getMilliseconds(),
+            cached ? ", shared cache" : (isMapped() ? ", memory-mapped" : ""));
 
         if (m_name.empty())
             m_name = name;
@@ -181,17 +258,18 @@ public:
         /* Causes all normals to be flipped */
         m_flipNormals = props.getBoolean("flipNormals", false);
 
+        /* The cache file already contains the processed mesh */
+        if (cached)
+            return;
+
         if (!objectToWorld.isIdentity()) {
+            makeWritable();
             m_aabb.reset();
-            for (size_t i=0; i<m_vertexCount; ++i) {
-                Point p = objectToWorld(m_positions[i]);
-                m_positions[i] = p;
-                m_aabb.expandBy(p);
-            }
-            if (m_normals) {
-                for (size_t i=0; i<m_vertexCount; ++i)
-                    m_normals[i] = normalize(objectToWorld(m_normals[i]));
-            }
+            objectToWorld.transformPoints(m_positions, m_positions, m_vertexCount);
+            for (size_t i=0; i<m_vertexCount; ++i)
+                m_aabb.expandBy(m_positions[i]);
+            if (m_normals)
+                objectToWorld.transformNormals(m_normals, m_normals, m_vertexCount, true);
         }
 
         if (objectToWorld.det3x3() < 0) {
@@ -207,6 +285,9 @@ public:
                 "can't be specified at the same time!");
             rebuildTopology(props.getFloat("maxSmoothAngle"));
         }
+
+        if (!cacheFile.empty())
+            writeCache(cacheFile);
     }
 
     SerializedMesh(Stream *stream, InstanceManager *manager)
@@ -226,35 +307,55 @@ private:
      */
     class MeshLoader {
     public:
-        MeshLoader(const fs::path& filePath) {
+        MeshLoader(const fs::path& filePath) : m_filePath(filePath) {
             m_fstream = new FileStream(filePath, FileStream::EReadOnly);
             m_fstream->setByteOrder(Stream::ELittleEndian);
-            const short version = SerializedMesh::readHeader(m_fstream);
+            m_version = SerializedMesh::readHeader(m_fstream);
             if (SerializedMesh::readOffsetDictionary(m_fstream,
-                version, m_offsets) < 0) {
+                m_version, m_offsets) < 0) {
                 // Assume there is a single mesh in the file at offset 0
                 m_offsets.resize(1, 0);
             }
         }
 
+        /// Return the file offset of the given shape index
+        inline size_t getOffset(size_t shapeIndex) const {
+            if (shapeIndex >= m_offsets.size()) {
+                SLog(EError, "Unable to unserialize mesh, "
+                    "shape index is out of range! (requested %i out of 0..%i)",
+                    (int) shapeIndex, (int) (m_offsets.size()-1));
+            }
+            return m_offsets[shapeIndex];
+        }
+
         /**
          * Positions the stream at the location for the given shape index.
          * Returns the modified stream.
          */
         inline FileStream* seekStream(size_t shapeIndex) {
-            if (shapeIndex > m_offsets.size()) {
-                SLog(EError, "Unable to unserialize mesh, "
-                    "shape index is out of range! (requested %i out of 0..%i)",
-                    shapeIndex, (int) (m_offsets.size()-1));
-            }
-            const size_t pos = m_offsets[shapeIndex];
-            m_fstream->seek(pos);
+            m_fstream->seek(getOffset(shapeIndex));
             return m_fstream;
         }
 
+        /**
+         * Return a memory-mapped view of the file, or \c NULL if the
+         * file uses a compressed format. The mapping is created on demand
+         * and shared by all meshes loaded from this file.
+         */
+        inline MemoryMappedFile *getMapping() {
+            if (!SerializedMesh::isMappableVersion(m_version))
+                return NULL;
+            if (!m_mapping)
+                m_mapping = new MemoryMappedFile(m_filePath, true);
+            return m_mapping;
+        }
+
     private:
+        fs::path m_filePath;
         std::vector<size_t> m_offsets;
         ref<FileStream> m_fstream;
+        ref<MemoryMappedFile> m_mapping;
+        short m_version;
     };
 
     typedef LRUCache<fs::path, std::less<fs::path>,
@@ -298,10 +399,109 @@ private:
 
         boost::shared_ptr<MeshLoader> meshLoader = cache->get(filePath);
         Assert(meshLoader != NULL);
+
+        if (m_memoryMap) {
+            MemoryMappedFile *mapping = meshLoader->getMapping();
+            if (mapping && loadMapped(mapping, meshLoader->getOffset((size_t) idx)))
+                return;
+        }
+
         TriMesh::loadCompressed(meshLoader->seekStream((size_t) idx));
     }
 
+    /**
+     * \brief Return the name of the shared cache file of a mesh
+     *
+     * The name contains a hash of everything that influences the processed
+     * mesh, hence a change to the input file or to the parameters leads to
+     * a new cache file.
+     */
+    static fs::path getCacheFile(const fs::path &cacheDirectory, const fs::path &filePath,
+            int shapeIndex, const Properties &props) {
+        boost::system::error_code ec;
+        size_t hash = 0;
+        boost::hash_combine(hash, fs::absolute(filePath).string());
+        boost::hash_combine(hash, (uint64_t) fs::file_size(filePath, ec));
+        boost::hash_combine(hash, (int64_t) fs::last_write_time(filePath, ec));
+        boost::hash_combine(hash, shapeIndex);
+        boost::hash_combine(hash, sizeof(Float));
+
+        const Matrix4x4 &m = props.getTransform("toWorld", Transform()).getMatrix();
+        for (int i=0; i<4; ++i)
+            for (int j=0; j<4; ++j)
+                boost::hash_combine(hash, m.m[i][j]);
+        boost::hash_combine(hash, props.getBoolean("faceNormals", false));
+        if (props.hasProperty("maxSmoothAngle"))
+            boost::hash_combine(hash, props.getFloat("maxSmoothAngle"));
+
+        return cacheDirectory / formatString("%s.%i.%016llx.cache",
+            filePath.stem().string().c_str(), shapeIndex, (unsigned long long) hash);
+    }
+
+    /// Map a processed mesh from a shared cache file
+    bool loadCache(const fs::path &cacheFile) {
+        if (!fs::exists(cacheFile))
+            return false;
+        try {
+            ref<MemoryMappedFile> mapping = new MemoryMappedFile(cacheFile, true);
+            return loadMapped(mapping, 0);
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Could not load the mesh cache file \"%s\": %s",
+                cacheFile.string().c_str(), ex.what());
+            return false;
+        }
+    }
+
+    /**
+     * \brief Write the processed mesh to a shared cache file and map it
+     *
+     * The file is written under a temporary name and then renamed, so
+     * that concurrent processes never see a partially written file.
+     */
+    void writeCache(const fs::path &cacheFile) {
+        /* Also store the normals that would otherwise be
+           computed by configure() in every process */
+        if (m_faceNormals) {
+            makeWritable();
+            delete[] m_normals;
+            m_normals = NULL;
+        } else if (!m_normals) {
+            bool flipNormals = m_flipNormals;
+            m_flipNormals = false;
+            computeNormals();
+            m_flipNormals = flipNormals;
+        }
+
+        fs::path tmpPath = cacheFile.parent_path() / (cacheFile.filename().string()
+            + "." + fs::unique_path().string());
+        try {
+            if (!fs::exists(cacheFile.parent_path()))
+                fs::create_directories(cacheFile.parent_path());
+            ref<FileStream> fs = new FileStream(tmpPath, FileStream::ETruncWrite);
+            fs->setByteOrder(Stream::ELittleEndian);
+            serializeUncompressed(fs);
+            fs->close();
+            fs::rename(tmpPath, cacheFile);
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Could not write the mesh cache file \"%s\": %s",
+                cacheFile.string().c_str(), ex.what());
+            boost::system::error_code ec;
+            fs::remove(tmpPath, ec);
+            return;
+        }
+
+        /* Switch over to the shared copy */
+        bool faceNormals = m_faceNormals, flipNormals = m_flipNormals;
+        std::string name = m_name;
+        if (loadCache(cacheFile)) {
+            m_faceNormals = faceNormals;
+            m_flipNormals = flipNormals;
+            m_name = name;
+        }
+    }
+
     static ThreadLocal<FileStreamCache> m_cache;
+    bool m_memoryMap;
 };
 
 ThreadLocal<SerializedMesh::FileStreamCache> SerializedMesh::m_cache;
@@ -17,12 +17,16 @@
 */
 
 #include "shapegroup.h"
+#include <mitsuba/core/fresolver.h>
 
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{shapegroup}{Shape group for geometry instancing}
  * \order{8}
  * \parameters{
+ *     \parameter{kdCache}{\Boolean}{Store the kd-tree of the group
+ *         in the directory of the scene and memory-map it in subsequent
+ *         runs if the geometry is unchanged \default{\code{false}}}
  *     \parameter{\Unnamed}{\Shape}{One or more shapes that should be
  *         made available for geometry instancing}
  * }
@@ -68,15 +72,30 @@ MTS_NAMESPACE_BEGIN
  *     </transform>
  * </shape>
  * \end{xml}
+ *
+ * Shape groups with identical geometry share their kd-tree within a
+ * process, e.g. when the same instancing library is included by several
+ * scenes that are loaded at the same time. With \code{kdCache} enabled,
+ * the tree is furthermore only built once across scene reloads and
+ * separate runs of Mitsuba.
  */
 
 ShapeGroup::ShapeGroup(const Properties &props) : Shape(props) {
     m_kdtree = new ShapeKDTree();
+    m_kdtree->setShared(true);
+
+    /* The file resolver searches the directory of the scene first */
+    if (props.getBoolean("kdCache", false)) {
+        const FileResolver *fileResolver = Thread::getThread()->getFileResolver();
+        if (fileResolver->getPathCount() > 0)
+            m_kdtree->setCacheDirectory(fs::absolute(fileResolver->getPath(0)));
+    }
 }
 
 ShapeGroup::ShapeGroup(Stream *stream, InstanceManager *manager)
     : Shape(stream, manager) {
     m_kdtree = new ShapeKDTree();
+    m_kdtree->setShared(true);
     size_t shapeCount = stream->readSize();
     for (size_t i=0; i<shapeCount; ++i)
         m_kdtree->addShape(static_cast<Shape *>(manager->getInstance(stream)));
@@ -17,6 +17,7 @@
 */
 
 #include "bluenoise.h"
+#include <mitsuba/render/trimesh.h>
 #include <mitsuba/core/statistics.h>
 #include <boost/unordered_map.hpp>
 
@@ -272,4 +273,50 @@ void blueNoisePointSet(const Scene *scene, const std::vector<Shape *> &shapes,
     SLog(EInfo, "Sampling finished (obtained %i blue noise samples)", (int) target->size());
 }
 
+/// Incrementally compute a 64-bit FNV-1a hash of a block of memory
+static inline void hashBytes(uint64_t &hash, const void *data, size_t size) {
+    const uint8_t *ptr = static_cast<const uint8_t *>(data);
+    for (size_t i=0; i<size; ++i)
+        hash = (hash ^ ptr[i]) * 0x100000001b3ULL;
+}
+
+uint64_t blueNoisePointSetKey(const Scene *scene,
+        const std::vector<Shape *> &shapes, Float radius) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hashBytes(hash, &radius, sizeof(Float));
+
+    for (size_t i=0; i<shapes.size(); ++i) {
+        const Shape *shape = shapes[i];
+
+        /* The samples refer to shapes by their index within the scene */
+        int shapeIndex = -1;
+        for (size_t j=0; j<scene->getShapes().size(); ++j) {
+            if (scene->getShapes()[j].get() == shape) {
+                shapeIndex = (int) j;
+                break;
+            }
+        }
+        hashBytes(hash, &shapeIndex, sizeof(int));
+
+        if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+            const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+            hashBytes(hash, mesh->getVertexPositions(),
+                mesh->getVertexCount() * sizeof(Point));
+            hashBytes(hash, mesh->getTriangles(),
+                mesh->getTriangleCount() * sizeof(Triangle));
+        } else {
+            /* Other shapes are identified by their type, bounds and area */
+            const std::string &name = shape->getClass()->getName();
+            AABB aabb = shape->getAABB();
+            Float area = shape->getSurfaceArea();
+            hashBytes(hash, name.c_str(), name.length());
+            hashBytes(hash, &aabb.min, sizeof(Point));
+            hashBytes(hash, &aabb.max, sizeof(Point));
+            hashBytes(hash, &area, sizeof(Float));
+        }
+    }
+
+    return hash;
+}
+
 MTS_NAMESPACE_END
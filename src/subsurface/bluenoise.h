@@ -51,6 +51,17 @@ extern void blueNoisePointSet(const Scene *scene,
     PositionSampleVector *target, Float &sa, AABB &aabb,
     const void *data);
 
+/**
+ * \brief Compute a key that identifies the point set generated by
+ * \ref blueNoisePointSet() for the given shapes and radius
+ *
+ * The key is a hash of the geometry of the shapes (including their
+ * index within the scene) and of the radius. It can be used to cache
+ * point sets on disk.
+ */
+extern uint64_t blueNoisePointSetKey(const Scene *scene,
+    const std::vector<Shape *> &shapes, Float radius);
+
 MTS_NAMESPACE_END
 
 #endif /* __BLUENOISE_H */
@@ -18,11 +18,16 @@
 
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fstream.h>
 #include <mitsuba/core/sse.h>
 #include <mitsuba/core/ssemath.h>
 #include "../medium/materials.h"
 #include "irrtree.h"
 #include "bluenoise.h"
+#include <boost/filesystem/operations.hpp>
+
+/// Version of the cached point set file format
+#define DIPOLE_POINTSET_VERSION 1
 
 MTS_NAMESPACE_BEGIN
 
@@ -140,6 +145,10 @@ static int irrOctreeIndex = 0;
  *         Number of samples to use when estimating the
  *         irradiance at a point on the surface \default{16}
  *     }
+ *     \parameter{cacheDirectory}{\String}{
+ *         Directory in which the sample positions are cached
+ *         across renderings \default{none, i.e. caching is disabled}
+ *     }
  * }
  *
  * \renderings{
@@ -178,6 +187,11 @@ static int irrOctreeIndex = 0;
  * rendering, these  illumination samples are convolved with the diffusion profile
  * using a fast hierarchical technique proposed by Jensen and Buhler \cite{Jensen2005Rapid}.
  *
+ * Since the sample positions only depend on the geometry and the medium
+ * properties (but not on the illumination), they can be cached on disk using the
+ * \code{cacheDirectory} parameter. The cache files are named after a hash of the
+ * mesh data and the sample density, hence a point set is reused whenever both match.
+ *
  * There are two different ways of configuring the medium properties.
  * One possibility is to load a material preset
  * using the \code{material} parameter---see \tblref{medium-coefficients}
@@ -289,6 +303,9 @@ public:
         /* Error threshold - lower means better quality */
         m_quality = props.getFloat("quality", 0.2f);
 
+        /* Directory for caching the sample positions */
+        m_cacheDirectory = props.getString("cacheDirectory", "");
+
         /* Asymmetry parameter of the phase function */
         m_octreeResID = -1;
 
@@ -392,7 +409,11 @@ public:
         /* It is necessary to increase the sampling resolution to
            prevent low-frequency noise in the output */
         Float actualRadius = m_radius / std::sqrt(m_sampleMultiplier * 20);
-        blueNoisePointSet(scene, m_shapes, actualRadius, points, sa, aabb, job);
+        uint64_t key = blueNoisePointSetKey(scene, m_shapes, actualRadius);
+        if (!loadPointSet(key, points, sa, aabb)) {
+            blueNoisePointSet(scene, m_shapes, actualRadius, points, sa, aabb, job);
+            savePointSet(key, points, sa, aabb);
+        }
 
         /* 2. Gather irradiance in parallel */
         const Sensor *sensor = scene->getSensor();
@@ -461,7 +482,76 @@ public:
     }
 
     MTS_DECLARE_CLASS()
+protected:
+    /// Return the path of the cache file for the point set with the given key
+    fs::path getCachePath(uint64_t key) const {
+        return m_cacheDirectory / formatString("dipole_%016llx.cache",
+            (unsigned long long) key);
+    }
+
+    /// Try to load a cached point set
+    bool loadPointSet(uint64_t key, PositionSampleVector *points,
+            Float &sa, AABB &aabb) const {
+        if (m_cacheDirectory.empty())
+            return false;
+        fs::path path = getCachePath(key);
+        if (!fs::exists(path))
+            return false;
+
+        try {
+            ref<FileStream> fs = new FileStream(path, FileStream::EReadOnly);
+            char identifier[4];
+            fs->read(identifier, 4);
+            if (memcmp(identifier, "DPTS", 4) != 0
+                || fs->readUInt() != DIPOLE_POINTSET_VERSION
+                || fs->readULong() != key)
+                return false;
+            sa = fs->readFloat();
+            aabb = AABB(fs);
+            points->load(fs);
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Could not read the point set cache file \"%s\": %s",
+                path.string().c_str(), ex.what());
+            points->clear();
+            return false;
+        }
+
+        Log(EInfo, "Loaded " SIZE_T_FMT " cached sample positions from \"%s\"",
+            points->size(), path.filename().string().c_str());
+        return true;
+    }
+
+    /// Store a point set in the cache (using a temporary file that is then renamed)
+    void savePointSet(uint64_t key, const PositionSampleVector *points,
+            Float sa, const AABB &aabb) const {
+        if (m_cacheDirectory.empty())
+            return;
+        fs::path path = getCachePath(key),
+                 tmpPath = path.parent_path() / (path.filename().string()
+                    + "." + fs::unique_path().string());
+
+        try {
+            if (!fs::exists(m_cacheDirectory))
+                fs::create_directories(m_cacheDirectory);
+
+            ref<FileStream> fs = new FileStream(tmpPath, FileStream::ETruncWrite);
+            fs->write("DPTS", 4);
+            fs->writeUInt(DIPOLE_POINTSET_VERSION);
+            fs->writeULong(key);
+            fs->writeFloat(sa);
+            aabb.serialize(fs);
+            points->save(fs);
+            fs->close();
+            fs::rename(tmpPath, path);
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Could not write the point set cache file \"%s\": %s",
+                path.string().c_str(), ex.what());
+            boost::system::error_code ec;
+            fs::remove(tmpPath, ec);
+        }
+    }
 private:
+    fs::path m_cacheDirectory;
     Float m_radius, m_sampleMultiplier;
     Float m_Fdr, m_quality, m_eta;
     Spectrum m_sigmaS, m_sigmaA, m_g;
@@ -26,6 +26,7 @@
 
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/timer.h>
 #include <mitsuba/core/sse.h>
 #include <mitsuba/core/ssemath.h>
 #include "../medium/materials.h"
@@ -65,6 +66,13 @@ static ref<Mutex> mutex = new Mutex;
  *         Optional scale factor that will be applied to the \code{sigma*} parameters.
  *         It is provided for convenience when accomodating data based on different units,
  *         or to simply tweak the density of the medium. \default{1}}
+ *     \parameter{distanceField}{\Integer}{
+ *         When nonzero, the fast single scattering approximation
+ *         finds the exit points of the light paths using a precomputed
+ *         signed distance field of the object instead of tracing rays
+ *         inside it. The value specifies the resolution of the field along
+ *         the longest axis of the bounding box. Larger values are more
+ *         accurate but take longer to precompute. \default{0, i.e. disabled}}
  *
  * }
  *
@@ -110,6 +118,12 @@ static ref<Mutex> mutex = new Mutex;
  *   is too small by a factor of 1000, the plugin will attempt to create
  *   one million times as many irradiance samples, which will likely cause
  *   the rendering process to crash with an ``out of memory'' failure.
+ *   \item The distance field is computed by tracing a few rays from every
+ *   grid point, so it may miss features smaller than a grid cell. The
+ *   surface normal at the exit point is taken from the field's gradient and
+ *   is therefore smoother than the shading normals of the mesh. This is
+ *   usually acceptable for thick, strongly scattering objects, whose exit
+ *   points are blurred by the medium anyway.
  * }
  */
 
@@ -137,6 +151,11 @@ public:
         /* Single scattering: number of total internal reflexion? */
         m_singleScatterDepth = props.getInteger("singleScatterDepth", 4);
 
+        /* Single scattering: resolution of the distance field (0: disabled) */
+        m_distanceFieldResolution = props.getInteger("distanceField", 0);
+        if (m_distanceFieldResolution < 0 || m_distanceFieldResolution == 1)
+            Log(EError, "The 'distanceField' resolution must be zero or at least 2!");
+
         /* Get the material parameters: */
         lookupMaterial(props, m_sigmaS, m_sigmaA, m_g);
 
@@ -173,6 +192,7 @@ public:
         m_singleScatterShadowRays = stream->readBool();
         m_singleScatterTransmittance = stream->readBool();
         m_singleScatterDepth = stream->readInt();
+        m_distanceFieldResolution = stream->readInt();
         configure();
     }
 
@@ -193,6 +213,7 @@ public:
         stream->writeBool(m_singleScatterShadowRays);
         stream->writeBool(m_singleScatterTransmittance);
         stream->writeInt(m_singleScatterDepth);
+        stream->writeInt(m_distanceFieldResolution);
     }
 
     //---------------- Begin set of functions for single scattering --------------------
@@ -1441,11 +1462,22 @@ public:
                 Vector VL = L - V;
                 Float dVL = VL.length();
                 VL /= dVL;
-                Ray toTheLight(V, VL, Epsilon, dVL * (1 - ShadowEpsilon), its.time);
-                if (!scene->rayIntersect(toTheLight, its2))
-                    continue;
+                Point PWorld;
+                Normal exitNormal;
+                if (!m_distanceField.empty()) {
+                    Float tExit;
+                    if (!findExitPoint(V, VL, dVL * (1 - ShadowEpsilon), tExit))
+                        continue;
+                    PWorld = V + VL * tExit;
+                    exitNormal = distanceFieldNormal(PWorld);
+                } else {
+                    Ray toTheLight(V, VL, Epsilon, dVL * (1 - ShadowEpsilon), its.time);
+                    if (!scene->rayIntersect(toTheLight, its2))
+                        continue;
+                    PWorld = its2.p;
+                    exitNormal = its2.shFrame.n;
+                }
 
-                const Point PWorld = its2.p;
                 /* Make sure that the light source is not occluded from this
                  * position */
                 Vector omegaL = L - PWorld;
@@ -1454,7 +1486,7 @@ public:
 
                 /* shadow ray */
                 Ray ray(PWorld, omegaL, Epsilon, dL * (1 - ShadowEpsilon),
-                        its2.time);
+                        its.time);
                 if (scene->rayIntersect(ray)) {
                     continue;
                 }
@@ -1464,8 +1496,8 @@ public:
                 omegaV /= dV;
 
                 /* Account for importance sampling wrt. transmittance */
-                const Float cosThetaL = dot(omegaL, its2.shFrame.n);
-                const Float cosThetaV = dot(omegaV, its2.shFrame.n);
+                const Float cosThetaL = dot(omegaL, exitNormal);
+                const Float cosThetaV = dot(omegaV, exitNormal);
                 if (cosThetaL == 0 || cosThetaV == 0)
                     continue;
 
@@ -1488,6 +1520,10 @@ public:
             const TriMesh *triMesh = static_cast<const TriMesh *>(its.shape);
             const Point *positions = triMesh->getVertexPositions();
             const Vector *normals = triMesh->getVertexNormals();
+            if (!normals)
+                Log(EError, "The slow single scattering path requires full-precision "
+                    "vertex normals on \"%s\"",
+                    triMesh->getName().c_str());
 
             size_t numTriangles = triMesh->getTriangleCount();
             bool *doneThisTriangleBefore = new bool[numTriangles];
@@ -1666,6 +1702,153 @@ public:
                 MTS_CLASS(SamplingIntegrator)))
             Log(EError, "The single scattering pluging requires "
                         "a sampling-based surface integrator!");
+        if (m_distanceFieldResolution > 0 && m_fastSingleScatter)
+            buildDistanceField(scene);
+        return true;
+    }
+
+    //---------------- Distance field acceleration -----------------------------
+
+    /**
+     * Precompute the signed distance to the boundary of the object (negative
+     * inside) on a regular grid. The distance of every grid point is estimated
+     * from the nearest hit of a set of rays in 26 directions, and the point
+     * counts as inside when most of the rays hit the object from behind.
+     */
+    void buildDistanceField(const Scene *scene) {
+        ref<Timer> timer = new Timer();
+        AABB aabb;
+        for (size_t i = 0; i < m_shapes.size(); ++i)
+            aabb.expandBy(m_shapes[i]->getAABB());
+        if (!aabb.isValid()) {
+            m_distanceField.clear();
+            return;
+        }
+
+        /* Leave room for one cell on every side */
+        Float cellSize = aabb.getExtents()[aabb.getLargestAxis()]
+            / (m_distanceFieldResolution - 1);
+        aabb.min -= Vector(cellSize);
+        aabb.max += Vector(cellSize);
+        for (int i = 0; i < 3; ++i)
+            m_fieldRes[i] = std::max(2, (int) std::ceil(
+                (aabb.max[i] - aabb.min[i]) / cellSize) + 1);
+        m_fieldAABB = aabb;
+        m_fieldCellSize = cellSize;
+        m_fieldInvCellSize = 1 / cellSize;
+
+        std::vector<Vector> directions;
+        for (int x = -1; x <= 1; ++x)
+            for (int y = -1; y <= 1; ++y)
+                for (int z = -1; z <= 1; ++z)
+                    if (x != 0 || y != 0 || z != 0)
+                        directions.push_back(normalize(Vector((Float) x, (Float) y, (Float) z)));
+
+        const Float maxDistance = (aabb.max - aabb.min).length();
+        m_distanceField.resize((size_t) m_fieldRes.x * m_fieldRes.y * m_fieldRes.z);
+
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(dynamic)
+        #endif
+        for (int z = 0; z < m_fieldRes.z; ++z) {
+            for (int y = 0; y < m_fieldRes.y; ++y) {
+                for (int x = 0; x < m_fieldRes.x; ++x) {
+                    Point p = aabb.min + Vector(x, y, z) * cellSize;
+                    Float distance = maxDistance;
+                    int inside = 0, outside = 0;
+                    for (size_t i = 0; i < directions.size(); ++i) {
+                        Ray ray(p, directions[i], 0);
+                        Intersection its;
+                        if (!scene->rayIntersect(ray, its) || !isOwnShape(its.shape)) {
+                            ++outside;
+                            continue;
+                        }
+                        distance = std::min(distance, its.t);
+                        if (dot(its.geoFrame.n, directions[i]) > 0)
+                            ++inside;
+                        else
+                            ++outside;
+                    }
+                    m_distanceField[(z * m_fieldRes.y + y) * m_fieldRes.x + x] =
+                        (float) (inside > outside ? -distance : distance);
+                }
+            }
+        }
+
+        Log(EInfo, "Precomputed a %ix%ix%i distance field (%s, took %i ms)",
+            m_fieldRes.x, m_fieldRes.y, m_fieldRes.z,
+            memString(m_distanceField.size() * sizeof(float)).c_str(),
+            timer->getMilliseconds());
+    }
+
+    inline bool isOwnShape(const Shape *shape) const {
+        for (size_t i = 0; i < m_shapes.size(); ++i)
+            if (m_shapes[i] == shape)
+                return true;
+        return false;
+    }
+
+    /// Trilinearly interpolate the distance field (positive outside the grid)
+    Float lookupDistance(const Point &p) const {
+        Vector rel = (p - m_fieldAABB.min) * m_fieldInvCellSize;
+        int x = math::floorToInt(rel.x), y = math::floorToInt(rel.y), z = math::floorToInt(rel.z);
+        if (x < 0 || y < 0 || z < 0 || x >= m_fieldRes.x - 1 ||
+            y >= m_fieldRes.y - 1 || z >= m_fieldRes.z - 1)
+            return m_fieldCellSize;
+        Float fx = rel.x - x, fy = rel.y - y, fz = rel.z - z;
+
+        const float *d = &m_distanceField[(z * m_fieldRes.y + y) * m_fieldRes.x + x];
+        size_t dy = m_fieldRes.x, dz = (size_t) m_fieldRes.x * m_fieldRes.y;
+        Float d00 = d[0]      * (1 - fx) + d[1]          * fx,
+              d10 = d[dy]     * (1 - fx) + d[dy + 1]      * fx,
+              d01 = d[dz]     * (1 - fx) + d[dz + 1]      * fx,
+              d11 = d[dz + dy] * (1 - fx) + d[dz + dy + 1] * fx;
+        return (d00 * (1 - fy) + d10 * fy) * (1 - fz)
+             + (d01 * (1 - fy) + d11 * fy) * fz;
+    }
+
+    /// Approximate the outward surface normal using the field gradient
+    Normal distanceFieldNormal(const Point &p) const {
+        Float h = m_fieldCellSize * 0.5f;
+        Normal n(
+            lookupDistance(p + Vector(h, 0, 0)) - lookupDistance(p - Vector(h, 0, 0)),
+            lookupDistance(p + Vector(0, h, 0)) - lookupDistance(p - Vector(0, h, 0)),
+            lookupDistance(p + Vector(0, 0, h)) - lookupDistance(p - Vector(0, 0, h)));
+        Float length = n.length();
+        return length > 0 ? n / length : Normal(0.0f);
+    }
+
+    /**
+     * Sphere trace the distance field from \c p (inside the object) along \c d
+     * and refine the zero crossing by bisection. The number of lookups is
+     * bounded, so this costs a constant amount of time per query.
+     */
+    bool findExitPoint(const Point &p, const Vector &d, Float maxt, Float &t) const {
+        const Float minStep = m_fieldCellSize * 0.25f;
+        Float tInside = 0, tOutside = -1;
+        for (int i = 0; i < 64; ++i) {
+            Float tNext = tInside + std::max(-lookupDistance(p + d * tInside), minStep);
+            if (tNext > maxt)
+                tNext = maxt;
+            if (lookupDistance(p + d * tNext) >= 0) {
+                tOutside = tNext;
+                break;
+            }
+            if (tNext == maxt)
+                return false;
+            tInside = tNext;
+        }
+        if (tOutside < 0)
+            return false;
+
+        for (int i = 0; i < 6; ++i) {
+            Float tMid = 0.5f * (tInside + tOutside);
+            if (lookupDistance(p + d * tMid) >= 0)
+                tOutside = tMid;
+            else
+                tInside = tMid;
+        }
+        t = 0.5f * (tInside + tOutside);
         return true;
     }
 
@@ -1688,6 +1871,12 @@ private:
     bool m_singleScatterShadowRays;
     bool m_singleScatterTransmittance;
     int m_singleScatterDepth;
+
+    int m_distanceFieldResolution;
+    std::vector<float> m_distanceField;
+    AABB m_fieldAABB;
+    Vector3i m_fieldRes;
+    Float m_fieldCellSize, m_fieldInvCellSize;
 };
 
 MTS_IMPLEMENT_CLASS_S(SingleScatter, false, Subsurface)
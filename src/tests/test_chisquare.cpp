@@ -22,6 +22,7 @@
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/render/testcase.h>
 #include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
 
 /* Statistical significance level of the test. Set to
    1/4 percent by default -- we want there to be strong
@@ -106,6 +107,14 @@ public:
 //          m_isSymmetric = true;
         }
 
+        /// Create a copy that draws its samples from \c sampler
+        BSDFAdapter(const BSDFAdapter &adapter, Sampler *sampler)
+            : m_its(adapter.m_its), m_bsdf(adapter.m_bsdf), m_sampler(sampler),
+              m_wi(adapter.m_wi), m_component(adapter.m_component),
+              m_largestWeight(0) {
+            m_fakeSampler = new FakeSampler(m_sampler);
+        }
+
         boost::tuple<Vector, Float, EMeasure> generateSample() {
             Point2 sample(m_sampler->next2D());
             BSDFSamplingRecord bRec(m_its, m_fakeSampler);
@@ -252,6 +261,13 @@ public:
             m_fakeSampler = new FakeSampler(m_sampler);
         }
 
+        /// Create a copy that draws its samples from \c sampler
+        PhaseFunctionAdapter(const PhaseFunctionAdapter &adapter, Sampler *sampler)
+            : m_mRec(adapter.m_mRec), m_phase(adapter.m_phase), m_sampler(sampler),
+              m_wi(adapter.m_wi), m_largestWeight(0) {
+            m_fakeSampler = new FakeSampler(m_sampler);
+        }
+
         boost::tuple<Vector, Float, EMeasure> generateSample() {
             PhaseFunctionSamplingRecord pRec(m_mRec, m_wi);
 
@@ -346,6 +362,11 @@ public:
             emitter->samplePosition(m_pRec, m_sampler->next2D());
         }
 
+        /// Create a copy that draws its samples from \c sampler
+        EmitterAdapter(const EmitterAdapter &adapter, Sampler *sampler)
+            : m_emitter(adapter.m_emitter), m_sampler(sampler),
+              m_pRec(adapter.m_pRec) { }
+
         boost::tuple<Vector, Float, EMeasure> generateSample() {
             #if defined(MTS_DEBUG_FP)
                 enableFPExceptions();
@@ -388,6 +409,34 @@ public:
         PositionSamplingRecord m_pRec;
     };
 
+    /**
+     * Creates the sample functions of \ref ChiSquare::fillParallel(). Every
+     * chunk uses a copy of the adapter, whose sampler is cloned from the
+     * sampler of the test (in chunk order, hence deterministically)
+     */
+    template <typename Adapter> class ChunkAdapters {
+    public:
+        ChunkAdapters(const Adapter &adapter, Sampler *sampler)
+            : m_adapter(adapter), m_sampler(sampler) { }
+
+        boost::function<boost::tuple<Vector, Float, EMeasure>()> operator()(size_t) {
+            boost::shared_ptr<Adapter> adapter(new Adapter(m_adapter, m_sampler->clone()));
+            m_chunks.push_back(adapter);
+            return boost::bind(&Adapter::generateSample, adapter);
+        }
+
+        Float getLargestWeight() const {
+            Float result = 0;
+            for (size_t i=0; i<m_chunks.size(); ++i)
+                result = std::max(result, m_chunks[i]->getLargestWeight());
+            return result;
+        }
+    private:
+        const Adapter &m_adapter;
+        ref<Sampler> m_sampler;
+        std::vector<boost::shared_ptr<Adapter> > m_chunks;
+    };
+
     void test01_BSDF() {
         /* Load a set of BSDF instances to be tested from the following XML file */
         FileResolver *resolver = Thread::getThread()->getFileResolver();
@@ -428,8 +477,9 @@ public:
                 chiSqr->setLogLevel(EDebug);
 
                 // Initialize the tables used by the chi-square test
-                chiSqr->fill(
-                    boost::bind(&BSDFAdapter::generateSample, &adapter),
+                ChunkAdapters<BSDFAdapter> chunks(adapter, sampler);
+                chiSqr->fillParallel(
+                    boost::ref(chunks),
                     boost::bind(&BSDFAdapter::pdf, &adapter, _1, _2)
                 );
 
@@ -444,7 +494,7 @@ public:
                 } else {
                     succeed();
                 }
-                largestWeight = std::max(largestWeight, adapter.getLargestWeight());
+                largestWeight = std::max(largestWeight, chunks.getLargestWeight());
                 ++testCount;
                 progress->update(j+1);
 
@@ -476,8 +526,9 @@ public:
                         chiSqr->setLogLevel(EDebug);
 
                         // Initialize the tables used by the chi-square test
-                        chiSqr->fill(
-                            boost::bind(&BSDFAdapter::generateSample, &adapter),
+                        ChunkAdapters<BSDFAdapter> chunks(adapter, sampler);
+                        chiSqr->fillParallel(
+                            boost::ref(chunks),
                             boost::bind(&BSDFAdapter::pdf, &adapter, _1, _2)
                         );
 
@@ -492,7 +543,7 @@ public:
                         } else {
                             succeed();
                         }
-                        largestWeight = std::max(largestWeight, adapter.getLargestWeight());
+                        largestWeight = std::max(largestWeight, chunks.getLargestWeight());
                         ++testCount;
                         progress->update(j+1);
                     }
@@ -544,8 +595,9 @@ public:
                 chiSqr->setLogLevel(EDebug);
 
                 // Initialize the tables used by the chi-square test
-                chiSqr->fill(
-                    boost::bind(&PhaseFunctionAdapter::generateSample, &adapter),
+                ChunkAdapters<PhaseFunctionAdapter> chunks(adapter, sampler);
+                chiSqr->fillParallel(
+                    boost::ref(chunks),
                     boost::bind(&PhaseFunctionAdapter::pdf, &adapter, _1, _2)
                 );
 
@@ -560,7 +612,7 @@ public:
                 } else {
                     succeed();
                 }
-                largestWeight = std::max(largestWeight, adapter.getLargestWeight());
+                largestWeight = std::max(largestWeight, chunks.getLargestWeight());
                 ++testCount;
                 progress->update(j+1);
             }
@@ -596,8 +648,9 @@ public:
             chiSqr->setLogLevel(EDebug);
 
             // Initialize the tables used by the chi-square test
-            chiSqr->fill(
-                boost::bind(&EmitterAdapter::generateSample, &adapter),
+            ChunkAdapters<EmitterAdapter> chunks(adapter, sampler);
+            chiSqr->fillParallel(
+                boost::ref(chunks),
                 boost::bind(&EmitterAdapter::pdf, &adapter, _1, _2)
             );
             chiSqr->dumpTables("test.m");
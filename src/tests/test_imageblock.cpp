@@ -0,0 +1,87 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/render/imageblock.h>
+#include <mitsuba/render/testcase.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestImageBlock : public TestCase {
+public:
+    MTS_BEGIN_TESTCASE()
+    MTS_DECLARE_TEST(test01_put)
+    MTS_DECLARE_BENCHMARK(bench01_putBox, 1000000)
+    MTS_DECLARE_BENCHMARK(bench02_putGaussian, 1000000)
+    MTS_END_TESTCASE()
+
+    ref<ReconstructionFilter> createFilter(const std::string &name) {
+        ref<ReconstructionFilter> filter = static_cast<ReconstructionFilter *> (
+            PluginManager::getInstance()->createObject(
+                MTS_CLASS(ReconstructionFilter), Properties(name)));
+        filter->configure();
+        return filter;
+    }
+
+    void test01_put() {
+        ref<ReconstructionFilter> filter = createFilter("box");
+        ref<ImageBlock> block = new ImageBlock(Bitmap::ESpectrumAlphaWeight,
+            Vector2i(8, 8), filter);
+        block->clear();
+
+        /* A box-filtered sample at a pixel center only affects that pixel */
+        block->put(Point2(2.5f, 3.5f), Spectrum(2.0f), 1.0f);
+        const int channels = block->getBitmap()->getChannelCount();
+        const int width = block->getBitmap()->getWidth();
+        const Float *data = block->getBitmap()->getFloatData();
+        Float total = 0;
+        for (int i=0; i<8*8; ++i)
+            total += data[i*channels + channels-1];
+        const Float *pixel = data + (3*width + 2) * channels;
+        assertEqualsEpsilon(total, (Float) 1, Epsilon);
+        assertEqualsEpsilon(pixel[channels-1], (Float) 1, Epsilon);
+        assertEqualsEpsilon(pixel[0], (Float) 2, Epsilon);
+        assertEqualsEpsilon(pixel[channels-2], (Float) 1, Epsilon);
+    }
+
+    void benchmarkPut(const std::string &filterName) {
+        ref<ReconstructionFilter> filter = createFilter(filterName);
+        ref<ImageBlock> block = new ImageBlock(Bitmap::ESpectrumAlphaWeight,
+            Vector2i(32, 32), filter);
+        block->clear();
+        ref<Random> random = new Random();
+
+        startMeasurement();
+        for (int i=0; i<1000000; ++i) {
+            Point2 pos(random->nextFloat() * 32, random->nextFloat() * 32);
+            block->put(pos, Spectrum(0.5f), 1.0f);
+        }
+    }
+
+    void bench01_putBox() {
+        benchmarkPut("box");
+    }
+
+    void bench02_putGaussian() {
+        benchmarkPut("gaussian");
+    }
+};
+
+MTS_EXPORT_TESTCASE(TestImageBlock, "Testcase for image block accumulation")
+MTS_NAMESPACE_END
@@ -29,6 +29,7 @@ public:
     MTS_DECLARE_TEST(test01_sutherlandHodgman)
     MTS_DECLARE_TEST(test02_bunnyBenchmark)
     MTS_DECLARE_TEST(test03_pointKDTree)
+    MTS_DECLARE_BENCHMARK(bench01_pointKDTreeQueries, 200000)
     MTS_END_TESTCASE()
 
     void test01_sutherlandHodgman() {
@@ -214,6 +215,28 @@ public:
         Log(EInfo, "Normal node size = " SIZE_T_FMT " bytes", sizeof(KDTree2::NodeType));
         Log(EInfo, "Left-balanced node size = " SIZE_T_FMT " bytes", sizeof(KDTree2Left::NodeType));
     }
+
+    void bench01_pointKDTreeQueries() {
+        typedef PointKDTree< SimpleKDNode<Point, Float> > KDTree3;
+
+        size_t nPoints = 200000, nQueries = 200000;
+        ref<Random> random = new Random();
+        KDTree3 kdtree(nPoints, KDTree3::ESlidingMidpoint);
+        for (size_t i=0; i<nPoints; ++i)
+            kdtree[i].setPosition(Point(random->nextFloat(),
+                random->nextFloat(), random->nextFloat()));
+        kdtree.build();
+
+        /* Only time the 10-nearest neighbor queries */
+        startMeasurement();
+        KDTree3::SearchResult results[11];
+        size_t found = 0;
+        for (size_t i=0; i<nQueries; ++i) {
+            Point p(random->nextFloat(), random->nextFloat(), random->nextFloat());
+            found += kdtree.nnSearch(p, 10, results);
+        }
+        assertEquals((int) found, (int) (nQueries * 10));
+    }
 };
 
 MTS_EXPORT_TESTCASE(TestKDTree, "Testcase for kd-tree related code")
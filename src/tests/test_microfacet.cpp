@@ -45,6 +45,8 @@ public:
     MTS_BEGIN_TESTCASE()
     MTS_DECLARE_TEST(test01_Microfacet)
     MTS_DECLARE_TEST(test02_MicrofacetVisible)
+    MTS_DECLARE_BENCHMARK(bench01_sampleAll, 1000000)
+    MTS_DECLARE_BENCHMARK(bench02_sampleVisible, 1000000)
     MTS_END_TESTCASE()
 
     class MicrofacetAdapter {
@@ -170,6 +172,32 @@ public:
             }
         }
     }
+
+    void benchmarkSample(bool sampleVisible) {
+        MicrofacetDistribution distrs[] = {
+            MicrofacetDistribution(MicrofacetDistribution::EBeckmann, 0.5f, 0.3f, sampleVisible),
+            MicrofacetDistribution(MicrofacetDistribution::EGGX, 0.2f, 0.3f, sampleVisible)
+        };
+        ref<Random> random = new Random();
+        Vector wi = normalize(Vector(0.3f, 0.2f, 1.0f));
+        Float sum = 0, pdf;
+        for (int i=0; i<1000000; ++i) {
+            Point2 sample(random->nextFloat(), random->nextFloat());
+            sum += distrs[i & 1].sample(wi, sample, pdf).z + pdf;
+        }
+        m_sink = sum;
+    }
+
+    void bench01_sampleAll() {
+        benchmarkSample(false);
+    }
+
+    void bench02_sampleVisible() {
+        benchmarkSample(true);
+    }
+
+    /// Keeps the compiler from discarding the benchmark results
+    volatile Float m_sink;
 };
 
 MTS_EXPORT_TESTCASE(TestChiSquare, "Chi-square test for microfacet sampling")
@@ -344,6 +344,7 @@ public:
     MTS_DECLARE_TEST(test07_uniform_distribution_ks);
     MTS_DECLARE_TEST(test08_serialize);
     MTS_DECLARE_TEST(test09_set);
+    MTS_DECLARE_TEST(test10_fill);
     MTS_DECLARE_TEST(benchmark);
     MTS_END_TESTCASE()
 
@@ -358,6 +359,7 @@ public:
     void test07_uniform_distribution_ks();
     void test08_serialize();
     void test09_set();
+    void test10_fill();
     void benchmark();
 
 private:
@@ -817,6 +819,42 @@ void TestRandom::test09_set()
 
 
 
+// Test that the bulk Random::fill functions match the individual calls
+void TestRandom::test10_fill()
+{
+    const size_t counts[] = { 1, 3, 17, 155, 156, 1000, 4097 };
+    ref<Random> rnd1 = new Random(0x4daaccdcbcbe32dcULL);
+    ref<Random> rnd2 = new Random(0x4daaccdcbcbe32dcULL);
+    std::vector<uint64_t> ulongs;
+    std::vector<uint32_t> uints;
+    std::vector<Float> floats;
+
+    for (size_t k = 0; k < array_size(counts); ++k) {
+        const size_t n = counts[k];
+
+        ulongs.resize(n);
+        rnd1->fill(&ulongs[0], n);
+        for (size_t i = 0; i < n; ++i)
+            assertTrue(ulongs[i] == rnd2->nextULong());
+
+        floats.resize(n);
+        rnd1->fill(&floats[0], n);
+        for (size_t i = 0; i < n; ++i)
+            assertTrue(floats[i] == rnd2->nextFloat());
+
+        uints.resize(n);
+        rnd1->fill(&uints[0], n);
+        for (size_t i = 0; i < n; i += 2) {
+            const uint64_t v = rnd2->nextULong();
+            assertTrue(uints[i] == (uint32_t) v);
+            if (i + 1 < n)
+                assertTrue(uints[i + 1] == (uint32_t) (v >> 32));
+        }
+    }
+}
+
+
+
 // Simple benchmark based on the mean test
 void TestRandom::benchmark()
 {
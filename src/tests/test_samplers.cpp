@@ -28,6 +28,7 @@ public:
     MTS_DECLARE_TEST(test01_Halton)
     MTS_DECLARE_TEST(test02_Hammersley)
     MTS_DECLARE_TEST(test03_radicalInverseIncr)
+    MTS_DECLARE_TEST(test04_BlueNoise)
     MTS_END_TESTCASE()
 
     void test01_Halton() {
@@ -84,6 +85,39 @@ public:
             x = radicalInverseIncremental(2, x);
         }
     }
+
+    void test04_BlueNoise() {
+        const int sampleCount = 8, dimCount = 6;
+        Properties props("bluenoise");
+        props.setInteger("sampleCount", sampleCount);
+
+        ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+                createObject(MTS_CLASS(Sampler), props));
+
+        /* The samples of each pixel and 1D dimension must form a
+           stratified set, which is shifted on the torus */
+        for (int pixel=0; pixel<4; ++pixel) {
+            Float values[sampleCount][dimCount];
+            sampler->generate(Point2i(pixel, 3*pixel));
+            for (int i=0; i<sampleCount; ++i) {
+                for (int j=0; j<dimCount; ++j)
+                    values[i][j] = sampler->next1D();
+                sampler->advance();
+            }
+
+            for (int j=0; j<dimCount; ++j) {
+                bool occupied[sampleCount] = { false };
+                for (int i=0; i<sampleCount; ++i) {
+                    Float delta = values[i][j] - values[0][j];
+                    Float stratum = (delta - std::floor(delta)) * sampleCount;
+                    int index = math::roundToInt(stratum) % sampleCount;
+                    assertEqualsEpsilon(stratum, (Float) math::roundToInt(stratum), 1e-3f);
+                    assertFalse(occupied[index]);
+                    occupied[index] = true;
+                }
+            }
+        }
+    }
 };
 
 MTS_EXPORT_TESTCASE(TestSamplers, "Testcase for sampling-related code")
@@ -19,6 +19,8 @@
 #include <mitsuba/render/testcase.h>
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -28,6 +30,9 @@ public:
     MTS_DECLARE_TEST(test01_spectrum)
     MTS_DECLARE_TEST(test02_interpolatedSpectrum)
     MTS_DECLARE_TEST(test03_blackBody)
+    MTS_DECLARE_TEST(test04_simd)
+    MTS_DECLARE_BENCHMARK(bench01_arithmetic, 1000000)
+    MTS_DECLARE_BENCHMARK(bench02_rgbConversion, 1000000)
     MTS_END_TESTCASE()
 
     void test01_spectrum() {
@@ -140,6 +145,128 @@ public:
         assertEqualsEpsilon(spec.eval(2000)/10, 115.8f, .5f);
         assertEqualsEpsilon(spec.average(100, 1000) * .09f, 715.f, 1);
     }
+
+    /// Compare the (possibly vectorized) operations of TSpectrum<float, N> against scalar code
+    template <int N> void checkSIMD(Random *random) {
+        typedef TSpectrum<float, N> Spec;
+        for (int trial=0; trial<1000; ++trial) {
+            Spec a, b;
+            for (int i=0; i<N; ++i) {
+                a[i] = (random->nextFloat() - 0.5f) * 20.0f;
+                b[i] = random->nextFloat() + 0.5f;
+            }
+            float f = random->nextFloat();
+
+            Spec sum = a + b, diff = a - b, prod = a * b, quot = a / b,
+                 scaled = a * f, neg = -a, abs = a.abs(), sqrt = b.sqrt(),
+                 exp = a.exp(), clamped = a, acc = a;
+            clamped.clampNegative();
+            acc.addWeighted(f, b);
+
+            float avg = 0, maxValue = a[0], minValue = a[0];
+            for (int i=0; i<N; ++i) {
+                assertEquals(sum[i], a[i] + b[i]);
+                assertEquals(diff[i], a[i] - b[i]);
+                assertEquals(prod[i], a[i] * b[i]);
+                assertEquals(quot[i], a[i] / b[i]);
+                assertEquals(scaled[i], a[i] * f);
+                assertEquals(neg[i], -a[i]);
+                assertEquals(abs[i], std::abs(a[i]));
+                assertEquals(sqrt[i], std::sqrt(b[i]));
+                assertEqualsEpsilon(exp[i] / std::exp(a[i]), 1.0f, 1e-6f);
+                assertEquals(clamped[i], std::max(0.0f, a[i]));
+                assertEqualsEpsilon(acc[i], a[i] + f * b[i], 1e-5f);
+                avg += a[i];
+                maxValue = std::max(maxValue, a[i]);
+                minValue = std::min(minValue, a[i]);
+            }
+            assertEqualsEpsilon(a.average(), avg / N, 1e-5f);
+            assertEquals(a.max(), maxValue);
+            assertEquals(a.min(), minValue);
+            assertTrue(!a.isZero() && Spec(0.0f).isZero());
+        }
+
+        /* Special cases of the exponential function */
+        Spec x(0.0f);
+        x[0] = -std::numeric_limits<float>::infinity();
+        x[1] = std::numeric_limits<float>::infinity();
+        x[2] = std::numeric_limits<float>::quiet_NaN();
+        x[3] = -200.0f;
+        Spec y = x.exp();
+        assertEquals(y[0], 0.0f);
+        assertTrue(y[1] == std::numeric_limits<float>::infinity());
+        assertTrue(std::isnan(y[2]));
+        assertEquals(y[3], 0.0f);
+
+        /* Microbenchmark: a typical attenuation/accumulation expression */
+        const int iterations = 2000000;
+        Spec throughput(1.0f), result(0.0f), sigma;
+        float refThroughput[N], refResult[N];
+        for (int i=0; i<N; ++i) {
+            refThroughput[i] = 1.0f; refResult[i] = 0.0f;
+        }
+
+        ref<Timer> timer = new Timer();
+        for (int it=0; it<iterations; ++it) {
+            for (int i=0; i<N; ++i)
+                sigma[i] = 1e-8f * (it + i);
+            throughput *= (-sigma).exp() * 0.999f;
+            result += throughput * sigma;
+        }
+        unsigned int timeSpec = timer->getMicroseconds();
+
+        timer->reset();
+        for (int it=0; it<iterations; ++it) {
+            for (int i=0; i<N; ++i) {
+                float sigma = 1e-8f * (it + i);
+                refThroughput[i] *= math::fastexp(-sigma) * 0.999f;
+                refResult[i] += refThroughput[i] * sigma;
+            }
+        }
+        unsigned int timeScalar = timer->getMicroseconds();
+
+        for (int i=0; i<N; ++i)
+            assertEqualsEpsilon(result[i] / refResult[i], 1.0f, 1e-3f);
+
+        Log(EInfo, "TSpectrum<float, %i> (%s): %.2f ns per iteration, "
+            "scalar loop: %.2f ns per iteration", N,
+            Spec::SSE::enabled ? "SSE" : "scalar",
+            timeSpec * 1000.0f / iterations, timeScalar * 1000.0f / iterations);
+    }
+
+    void test04_simd() {
+        ref<Random> random = new Random();
+        checkSIMD<4>(random);
+        checkSIMD<8>(random);
+        checkSIMD<16>(random);
+        checkSIMD<SPECTRUM_SAMPLES>(random);
+    }
+
+    void bench01_arithmetic() {
+        /* Attenuation and accumulation as done by a path tracer */
+        Spectrum throughput(1.0f), result(0.0f), sigma(0.0f);
+        for (int it=0; it<1000000; ++it) {
+            sigma[it % SPECTRUM_SAMPLES] = 1e-7f * (it & 1023);
+            throughput *= (-sigma).exp() * 0.999999f;
+            result += throughput * sigma;
+        }
+        m_sink = result.average();
+    }
+
+    void bench02_rgbConversion() {
+        Spectrum spec;
+        Float r, g, b, sum = 0;
+        for (int it=0; it<1000000; ++it) {
+            Float value = (it & 1023) / 1023.0f;
+            spec.fromLinearRGB(value, 0.5f, 1 - value);
+            spec.toLinearRGB(r, g, b);
+            sum += r + g + b;
+        }
+        m_sink = sum;
+    }
+
+    /// Keeps the compiler from discarding the benchmark results
+    volatile Float m_sink;
 };
 
 MTS_EXPORT_TESTCASE(TestSpectrum, "Testcase for manipulating spectral data")
@@ -0,0 +1,106 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/render/volume.h>
+#include <mitsuba/render/testcase.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestVolume : public TestCase {
+public:
+    MTS_BEGIN_TESTCASE()
+    MTS_DECLARE_TEST(test01_gridLookup)
+    MTS_DECLARE_BENCHMARK(bench01_gridLookupFloat, 1000000)
+    MTS_END_TESTCASE()
+
+    /// Volume resolution along each axis
+    static const int Resolution = 64;
+
+    /// Value of the test volume in grid coordinates (a linear function)
+    static Float gridValue(Float x, Float y, Float z) {
+        return x + 2*y + 3*z;
+    }
+
+    void init() {
+        m_filename = fs::temp_directory_path() / fs::unique_path("mts_%%%%%%%%.vol");
+
+        /* Write a single-channel float32 grid that covers the unit cube */
+        ref<FileStream> stream = new FileStream(m_filename, FileStream::ETruncWrite);
+        stream->setByteOrder(Stream::ELittleEndian);
+        stream->write("VOL", 3);
+        stream->writeUChar(3);
+        stream->writeInt(1);
+        for (int i=0; i<3; ++i)
+            stream->writeInt(Resolution);
+        stream->writeInt(1);
+        for (int i=0; i<3; ++i)
+            stream->writeSingle(0.0f);
+        for (int i=0; i<3; ++i)
+            stream->writeSingle(1.0f);
+        for (int z=0; z<Resolution; ++z)
+            for (int y=0; y<Resolution; ++y)
+                for (int x=0; x<Resolution; ++x)
+                    stream->writeSingle((float) gridValue((Float) x, (Float) y, (Float) z));
+        stream->close();
+
+        Properties props("gridvolume");
+        props.setString("filename", m_filename.string());
+        m_volume = static_cast<VolumeDataSource *> (PluginManager::getInstance()->
+            createObject(MTS_CLASS(VolumeDataSource), props));
+        m_volume->configure();
+    }
+
+    void shutdown() {
+        m_volume = NULL;
+        fs::remove(m_filename);
+    }
+
+    void test01_gridLookup() {
+        ref<Random> random = new Random();
+        const Float scale = (Float) (Resolution - 1);
+
+        /* Trilinear interpolation reproduces a linear function exactly */
+        for (int i=0; i<1000; ++i) {
+            Point p(random->nextFloat(), random->nextFloat(), random->nextFloat());
+            assertEqualsEpsilon(m_volume->lookupFloat(p),
+                gridValue(p.x * scale, p.y * scale, p.z * scale), 1e-3f);
+        }
+    }
+
+    void bench01_gridLookupFloat() {
+        ref<Random> random = new Random();
+        Float sum = 0;
+        for (int i=0; i<1000000; ++i) {
+            Point p(random->nextFloat(), random->nextFloat(), random->nextFloat());
+            sum += m_volume->lookupFloat(p);
+        }
+        m_sink = sum;
+    }
+
+private:
+    fs::path m_filename;
+    ref<VolumeDataSource> m_volume;
+    /// Keeps the compiler from discarding the benchmark results
+    volatile Float m_sink;
+};
+
+MTS_EXPORT_TESTCASE(TestVolume, "Testcase for volume data sources")
+MTS_NAMESPACE_END
@@ -24,13 +24,29 @@
 #include <mitsuba/core/sched.h>
 #include <mitsuba/render/texture.h>
 #include <mitsuba/render/mipmap.h>
+#include <mitsuba/render/tilecache.h>
 #include <mitsuba/hw/renderer.h>
 #include <mitsuba/hw/gputexture.h>
 #include <mitsuba/hw/gpuprogram.h>
+#include <mitsuba/hw/basicshader.h>
 #include <boost/algorithm/string.hpp>
 
 MTS_NAMESPACE_BEGIN
 
+/* The scene loader creates textures concurrently. Textures that share a
+   MIP map cache file are loaded one after the other, so that the first one
+   generates the file and the others reuse it instead of writing it again */
+static ref<Mutex> __cacheFileMutex = new Mutex();
+static std::map<std::string, ref<Mutex> > __cacheFileMutexes;
+
+static Mutex *getCacheFileMutex(const fs::path &path) {
+    LockGuard lock(__cacheFileMutex);
+    ref<Mutex> &mutex = __cacheFileMutexes[path.string()];
+    if (!mutex)
+        mutex = new Mutex();
+    return mutex;
+}
+
 /*!\plugin{bitmap}{Bitmap texture}
  * \order{1}
  * \parameters{
@@ -75,6 +91,21 @@ MTS_NAMESPACE_BEGIN
  *        \emph{filename}\code{.mip} to be created.
  *        \default{automatic---use caching for textures larger than 1M pixels.}
  *     }
+ *     \parameter{outOfCore}{\Boolean}{
+ *        Load tiles of the MIP map cache file on demand instead of keeping
+ *        the entire texture in memory (see below). This implies \code{cache}.
+ *        \default{\code{false}}
+ *     }
+ *     \parameter{compress}{\Boolean}{
+ *        Store the MIP map in a block-compressed format (see below), which
+ *        reduces its memory and cache file footprint by about $5\times$ (RGB)
+ *        at the cost of a slight loss of precision. \default{\code{false}}
+ *     }
+ *     \parameter{tileCacheSize}{\Integer}{
+ *        Memory budget in MiB of the tile cache that is shared by all
+ *        out-of-core textures. When specified by several textures, the last
+ *        value wins. \default{512}
+ *     }
  *     \parameter{uoffset, voffset}{\Float}{
  *       Numerical offset that should be applied to UV lookups
  *     }
@@ -155,6 +186,24 @@ MTS_NAMESPACE_BEGIN
  *    Mitsuba is able to work with truly massive textures that would otherwise exhaust the main system memory.
  * \end{enumerate}
  *
+ * For scenes whose textures exceed the available memory even then, the \code{outOfCore}
+ * parameter switches to demand paging: the cache file is split into tiles of $64\times 64$
+ * texels per MIP level, which are only read when a lookup first touches them. All
+ * out-of-core textures share a single tile cache with a global memory budget
+ * (\code{tileCacheSize}); when it is exceeded, the least recently used tiles are
+ * evicted. Each rendering thread additionally remembers its most recently accessed
+ * tiles, so that repeated lookups don't require any synchronization. Any supported input
+ * format (including tiled OpenEXR files) is converted into a cache file first.
+ *
+ * The \code{compress} parameter additionally stores the MIP map in blocks of
+ * $4\times 4$ texels using a format similar to BC6H: each block holds two half precision
+ * endpoint colors and a 4-bit interpolation weight per texel, which takes up 20 bytes instead
+ * of 96 bytes (RGB) or 12 instead of 32 bytes (monochromatic data). The interpolation operates
+ * on the bit patterns of the endpoints, so that the relative error of high dynamic range textures
+ * stays bounded. Texels are decoded on the fly during lookups, which makes them slightly more
+ * expensive, and generating compressed MIP maps takes longer. Both are compensated
+ * by the reduced I/O when the cache files (or tiles thereof) don't fit into memory.
+ *
  * The texture caches are automatically regenerated when the input texture is modified.
  * Of course, the cache files can be cumbersome when they are not needed anymore. On Linux
  * or Mac OS, they can safely be deleted by executing the following command within a scene directory.
@@ -180,6 +229,7 @@ public:
         uint64_t timestamp = 0;
         bool tryReuseCache = false;
         fs::path cacheFile;
+        Mutex *cacheMutex = NULL;
         ref<Bitmap> bitmap;
 
         m_channel = boost::to_lower_copy(props.getString("channel", ""));
@@ -207,9 +257,13 @@ public:
             else
                 cacheFile.replace_extension(formatString(".%s.mip", m_channel.c_str()));
 
-            tryReuseCache = fs::exists(cacheFile) && props.getBoolean("cache", true);
+            cacheMutex = getCacheFileMutex(cacheFile);
         }
 
+        UniqueLock cacheLock(cacheMutex, cacheMutex != NULL);
+        if (cacheMutex)
+            tryReuseCache = fs::exists(cacheFile) && props.getBoolean("cache", true);
+
         std::string filterType = boost::to_lower_copy(props.getString("filterType", "ewa"));
         std::string wrapMode = props.getString("wrapMode", "repeat");
         m_wrapModeU = parseWrapMode(props.getString("wrapModeU", wrapMode));
@@ -234,14 +288,24 @@ public:
         if (m_filterType != EEWA)
             m_maxAnisotropy = 1.0f;
 
+        bool outOfCore = props.getBoolean("outOfCore", false);
+        m_compress = props.getBoolean("compress", false);
+        if (props.hasProperty("tileCacheSize")) {
+            int tileCacheSize = props.getInteger("tileCacheSize");
+            if (tileCacheSize <= 0)
+                Log(EError, "The 'tileCacheSize' parameter must be positive!");
+            TextureTileCache::getInstance()->setMemoryLimit(
+                (size_t) tileCacheSize * 1024 * 1024);
+        }
+
         if (tryReuseCache && MIPMap3::validateCacheFile(cacheFile, timestamp,
-                Bitmap::ERGB, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
+                Bitmap::ERGB, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma, m_compress)) {
             /* Reuse an existing MIP map cache file */
-            m_mipmap3 = new MIPMap3(cacheFile, m_maxAnisotropy);
+            m_mipmap3 = new MIPMap3(cacheFile, m_maxAnisotropy, outOfCore);
         } else if (tryReuseCache && MIPMap1::validateCacheFile(cacheFile, timestamp,
-                Bitmap::ELuminance, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
+                Bitmap::ELuminance, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma, m_compress)) {
             /* Reuse an existing MIP map cache file */
-            m_mipmap1 = new MIPMap1(cacheFile, m_maxAnisotropy);
+            m_mipmap1 = new MIPMap1(cacheFile, m_maxAnisotropy, outOfCore);
         } else {
             if (bitmap == NULL) {
                 /* Load the input image if necessary */
@@ -288,16 +352,36 @@ public:
 
             /* Potentially create a new MIP map cache file */
             bool createCache = !cacheFile.empty() && props.getBoolean("cache",
-                bitmap->getSize().x * bitmap->getSize().y > 1024*1024);
+                outOfCore || bitmap->getSize().x * bitmap->getSize().y > 1024*1024);
+
+            if (outOfCore && !createCache) {
+                Log(EWarn, "Out-of-core texture access requires a MIP map cache file "
+                    "-- keeping the texture in memory.");
+                outOfCore = false;
+            }
 
             if (pixelFormat == Bitmap::ELuminance)
                 m_mipmap1 = new MIPMap1(bitmap, pixelFormat, Bitmap::EFloat,
                     rfilter, m_wrapModeU, m_wrapModeV, m_filterType, m_maxAnisotropy,
-                    createCache ? cacheFile : fs::path(), timestamp);
+                    createCache ? cacheFile : fs::path(), timestamp, 1.0f,
+                    Spectrum::EReflectance, m_compress);
             else
                 m_mipmap3 = new MIPMap3(bitmap, pixelFormat, Bitmap::EFloat,
                     rfilter, m_wrapModeU, m_wrapModeV, m_filterType, m_maxAnisotropy,
-                    createCache ? cacheFile : fs::path(), timestamp);
+                    createCache ? cacheFile : fs::path(), timestamp, 1.0f,
+                    Spectrum::EReflectance, m_compress);
+
+            if (outOfCore) {
+                /* Release the freshly written cache file and page it in on demand */
+                bitmap = NULL;
+                if (m_mipmap1.get()) {
+                    m_mipmap1 = NULL;
+                    m_mipmap1 = new MIPMap1(cacheFile, m_maxAnisotropy, true);
+                } else {
+                    m_mipmap3 = NULL;
+                    m_mipmap3 = new MIPMap3(cacheFile, m_maxAnisotropy, true);
+                }
+            }
         }
     }
 
@@ -347,6 +431,7 @@ public:
         m_wrapModeV = (ReconstructionFilter::EBoundaryCondition) stream->readUInt();
         m_gamma = stream->readFloat();
         m_maxAnisotropy = stream->readFloat();
+        m_compress = stream->readBool();
         m_channel = stream->readString();
 
         size_t size = stream->readSize();
@@ -391,11 +476,11 @@ public:
         if (pixelFormat == Bitmap::ELuminance)
             m_mipmap1 = new MIPMap1(bitmap, pixelFormat, Bitmap::EFloat,
                 rfilter, m_wrapModeU, m_wrapModeV, m_filterType, m_maxAnisotropy,
-                fs::path(), 0);
+                fs::path(), 0, 1.0f, Spectrum::EReflectance, m_compress);
         else
             m_mipmap3 = new MIPMap3(bitmap, pixelFormat, Bitmap::EFloat,
                 rfilter, m_wrapModeU, m_wrapModeV, m_filterType, m_maxAnisotropy,
-                fs::path(), 0);
+                fs::path(), 0, 1.0f, Spectrum::EReflectance, m_compress);
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -406,6 +491,7 @@ public:
         stream->writeUInt(m_wrapModeV);
         stream->writeFloat(m_gamma);
         stream->writeFloat(m_maxAnisotropy);
+        stream->writeBool(m_compress);
 
         if (!m_filename.empty() && fs::exists(m_filename)) {
             /* We still have access to the original image -- use that, since
@@ -479,6 +565,25 @@ public:
         stats::filteredLookups.incrementBase();
     }
 
+    void evalGradient(const Point2 &uv, const Vector2 &d0,
+            const Vector2 &d1, Spectrum *gradient) const {
+        /* Differentiate the prefiltered MIP map levels instead
+           of the full-resolution texture */
+        if (m_mipmap3.get()) {
+            Color3 result[2];
+            m_mipmap3->evalGradient(uv, d0, d1, result);
+            gradient[0].fromLinearRGB(result[0][0], result[0][1], result[0][2]);
+            gradient[1].fromLinearRGB(result[1][0], result[1][1], result[1][2]);
+        } else {
+            Color1 result[2];
+            m_mipmap1->evalGradient(uv, d0, d1, result);
+            gradient[0] = Spectrum(result[0][0]);
+            gradient[1] = Spectrum(result[1][0]);
+        }
+        stats::filteredLookups.incrementBase();
+        ++stats::filteredLookups;
+    }
+
     ref<Bitmap> getBitmap(const Vector2i &/* unused */) const {
         return m_mipmap1.get() ? m_mipmap1->toBitmap() : m_mipmap3->toBitmap();
     }
@@ -535,7 +640,15 @@ public:
     }
 
     bool isConstant() const {
-        return false;
+        /* E.g. a solid color or a single pixel */
+        return getMinimum() == getMaximum();
+    }
+
+    ref<Texture> expand() {
+        /* Avoid the MIP map lookups for images of uniform color */
+        if (isConstant())
+            return new ConstantSpectrumTexture(getAverage());
+        return this;
     }
 
     bool usesRayDifferentials() const {
@@ -586,6 +699,7 @@ protected:
     ReconstructionFilter::EBoundaryCondition m_wrapModeU;
     ReconstructionFilter::EBoundaryCondition m_wrapModeV;
     Float m_gamma, m_maxAnisotropy;
+    bool m_compress;
     std::string m_channel;
     fs::path m_filename;
 };
@@ -19,6 +19,7 @@
 #include <mitsuba/render/texture.h>
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/core/properties.h>
+#include <mitsuba/core/tls.h>
 #include <mitsuba/hw/basicshader.h>
 
 MTS_NAMESPACE_BEGIN
@@ -45,6 +46,9 @@ MTS_NAMESPACE_BEGIN
  * This texture can visualize the mean and Gaussian curvature of the underlying
  * shape for inspection. Red and blue denote positive and negative values,
  * respectively.
+ *
+ * On triangle meshes, the curvature is computed once per vertex (when the
+ * mesh is first looked up) and interpolated across the triangles.
  */
 class Curvature : public Texture {
 public:
@@ -57,12 +61,14 @@ public:
             m_showK = false;
         else
             Log(EError, "Invalid 'curvature' parameter: must be set to 'gaussian' or ' mean'!");
+        m_mutex = new Mutex();
     }
 
     Curvature(Stream *stream, InstanceManager *manager)
      : Texture(stream, manager) {
          m_scale = stream->readFloat();
          m_showK = stream->readBool();
+         m_mutex = new Mutex();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -82,14 +88,131 @@ public:
 
     Spectrum eval(const Intersection &its, bool /* unused */) const {
         Float H, K;
-        its.shape->getCurvature(its, H, K);
+        if (its.instance == NULL && its.shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+            interpolateCurvature(static_cast<const TriMesh *>(its.shape), its, H, K);
+        else
+            its.shape->getCurvature(its, H, K);
         return lookupGradient(m_showK ? K : H);
     }
 
+    /// Interpolate the per-vertex curvature of a triangle mesh
+    void interpolateCurvature(const TriMesh *mesh, const Intersection &its,
+            Float &H, Float &K) const {
+        H = K = 0;
+        const Vector2 *curvature = getVertexCurvature(mesh);
+        if (!curvature)
+            return;
+
+        const Triangle &tri = mesh->getTriangles()[its.primIndex];
+        const Point *positions = mesh->getVertexPositions();
+        const Point &p0 = positions[tri.idx[0]];
+
+        /* Recompute the barycentric coordinates, since 'its.uv' may
+           hold the coordinates of the texture parameterization */
+        Vector rel = its.p - p0,
+               du  = positions[tri.idx[1]] - p0,
+               dv  = positions[tri.idx[2]] - p0;
+
+        Float b1  = dot(du, rel), b2 = dot(dv, rel),
+              a11 = dot(du, du), a12 = dot(du, dv),
+              a22 = dot(dv, dv),
+              det = a11 * a22 - a12 * a12;
+
+        if (det == 0)
+            return;
+
+        Float invDet = 1.0f / det,
+              u = ( a22 * b1 - a12 * b2) * invDet,
+              v = (-a12 * b1 + a11 * b2) * invDet;
+
+        Vector2 value = curvature[tri.idx[0]] * (1 - u - v)
+            + curvature[tri.idx[1]] * u + curvature[tri.idx[2]] * v;
+        H = value.x;
+        K = value.y;
+    }
+
+    /**
+     * \brief Return the (mean, Gaussian) curvature of every vertex
+     * of a mesh, or \c NULL if it doesn't have vertex normals
+     */
+    const Vector2 *getVertexCurvature(const TriMesh *mesh) const {
+        LocalCache &cache = m_localCache.get();
+        if (cache.mesh == mesh)
+            return cache.data;
+
+        std::map<const TriMesh *, const Vector2 *>::const_iterator it
+            = cache.meshes.find(mesh);
+        if (it == cache.meshes.end()) {
+            LockGuard lock(m_mutex);
+            std::vector<Vector2> &curvature = m_curvature[mesh];
+            if (curvature.empty() && mesh->hasVertexNormals())
+                computeVertexCurvature(mesh, curvature);
+            it = cache.meshes.insert(std::make_pair(mesh,
+                curvature.empty() ? NULL : &curvature[0])).first;
+        }
+        cache.mesh = mesh;
+        cache.data = it->second;
+        return cache.data;
+    }
+
+    /**
+     * \brief Compute the curvature of the interpolated vertex normals at
+     * every vertex, averaged over the adjacent triangles (weighted by area)
+     *
+     * This matches \ref Shape::getCurvature() evaluated at the vertices.
+     */
+    static void computeVertexCurvature(const TriMesh *mesh,
+            std::vector<Vector2> &curvature) {
+        const Triangle *triangles = mesh->getTriangles();
+        const Point *positions = mesh->getVertexPositions();
+        std::vector<Float> weights(mesh->getVertexCount(), 0.0f);
+        curvature.resize(mesh->getVertexCount(), Vector2(0.0f));
+
+        for (size_t i=0; i<mesh->getTriangleCount(); ++i) {
+            const Triangle &tri = triangles[i];
+            const Point &p0 = positions[tri.idx[0]];
+            Vector dpdu = positions[tri.idx[1]] - p0,
+                   dpdv = positions[tri.idx[2]] - p0;
+            Normal n[3];
+            for (int j=0; j<3; ++j)
+                n[j] = mesh->getVertexNormal(tri.idx[j]);
+
+            /* First fundamental form of the triangle parameterization */
+            Float E = dot(dpdu, dpdu),
+                  F = dot(dpdu, dpdv),
+                  G = dot(dpdv, dpdv),
+                  det = E*G - F*F;
+            if (det <= 0)
+                continue;
+            Float invDenom = 1.0f / det,
+                  weight = 0.5f * std::sqrt(det);
+
+            for (int j=0; j<3; ++j) {
+                /* Derivative of the normalized interpolated normal at the corner */
+                Float il = 1.0f / n[j].length();
+                Normal N = n[j] * il;
+                Vector dndu = (n[1] - n[0]) * il; dndu -= N * dot(N, dndu);
+                Vector dndv = (n[2] - n[0]) * il; dndv -= N * dot(N, dndv);
+
+                Float e = -dot(dpdu, dndu),
+                      f = -dot(dpdv, dndu),
+                      g = -dot(dpdv, dndv),
+                      K = (e*g - f*f) * invDenom,
+                      H = .5f*(e*G - 2*f*F + g*E) * invDenom;
+
+                curvature[tri.idx[j]] += Vector2(H, K) * weight;
+                weights[tri.idx[j]] += weight;
+            }
+        }
+
+        for (size_t i=0; i<curvature.size(); ++i) {
+            if (weights[i] > 0)
+                curvature[i] /= weights[i];
+        }
+    }
+
     bool usesRayDifferentials() const {
-        /// Intentionally return \c true here so that required tangent
-        /// space information is provided for triangle meshes
-        return true;
+        return false;
     }
 
     Spectrum getAverage() const {
@@ -126,8 +249,20 @@ public:
 
     MTS_DECLARE_CLASS()
 private:
+    /// Per-thread references to the curvature of recently used meshes
+    struct LocalCache {
+        const TriMesh *mesh;
+        const Vector2 *data;
+        std::map<const TriMesh *, const Vector2 *> meshes;
+
+        inline LocalCache() : mesh(NULL), data(NULL) { }
+    };
+
     Float m_scale;
     bool m_showK;
+    mutable std::map<const TriMesh *, std::vector<Vector2> > m_curvature;
+    mutable PrimitiveThreadLocal<LocalCache> m_localCache;
+    mutable ref<Mutex> m_mutex;
 };
 
 // ================ Hardware shader implementation ================
@@ -108,6 +108,13 @@ public:
         return m_nested->isConstant();
     }
 
+    ref<Texture> expand() {
+        /* Fold the scale into constant nested textures */
+        if (isConstant())
+            return new ConstantSpectrumTexture(getAverage());
+        return this;
+    }
+
     ref<Bitmap> getBitmap(const Vector2i &sizeHint) const {
         ref<Bitmap> result = m_nested->getBitmap(sizeHint);
 
@@ -17,91 +17,121 @@
 */
 
 #include <mitsuba/core/plugin.h>
-#include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/core/fresolver.h>
 #include <mitsuba/render/util.h>
+#if defined(WIN32)
+# include <mitsuba/core/getopt.h>
+#endif
+#include "imgstream.h"
 
 MTS_NAMESPACE_BEGIN
 
 class AddImages : public Utility {
 public:
+    /// Adds the weighted images of a job in strips of scanlines
+    struct AddJob {
+        Float weight1, weight2;
+
+        void operator()(const std::vector<std::string> &paths) const {
+            const FileResolver *resolver = Thread::getThread()->getFileResolver();
+            EXRStripReader a(resolver->resolve(paths[0]).string());
+            EXRStripReader b(resolver->resolve(paths[1]).string());
+
+            /* A few sanity checks */
+            std::vector<std::string> channels = a.getChannelNames();
+            if (channels != b.getChannelNames())
+                SLog(EError, "Error: Input bitmaps have different channels!");
+            if (getPixelType(a.getHeader()) != getPixelType(b.getHeader()))
+                SLog(EError, "Error: Input bitmaps have a different component format!");
+            if (a.getSize() != b.getSize() || a.getOffset() != b.getOffset())
+                SLog(EError, "Error: Input bitmaps have a different size!");
+
+            SLog(EInfo, "Writing \"%s\" ..", paths[2].c_str());
+            EXRStripWriter out(paths[2], a.getHeader(), channels, getPixelType(a.getHeader()));
+
+            const Vector2i &size = a.getSize();
+            size_t stripEntries = (size_t) size.x * channels.size() * IMGSTREAM_STRIP_LINES;
+            std::vector<float> aData(stripEntries), bData(stripEntries);
+
+            for (int y=0; y<size.y; y += IMGSTREAM_STRIP_LINES) {
+                int lines = std::min(IMGSTREAM_STRIP_LINES, size.y - y);
+                a.read(y, lines, channels, &aData[0]);
+                b.read(y, lines, channels, &bData[0]);
+
+                size_t nEntries = (size_t) size.x * channels.size() * lines;
+                for (size_t i=0; i<nEntries; ++i)
+                    aData[i] = (float) std::max((Float) 0,
+                        weight1 * (Float) aData[i] + weight2 * (Float) bData[i]);
+
+                out.write(y, lines, &aData[0]);
+            }
+        }
+    };
+
+    void help() {
+        cout << "Add the weighted pixel values of two EXR images to produce a new one" << endl;
+        cout << "Syntax: mtsutil addimages [options] <weight 1> <image 1.exr> <weight 2> <image 2.exr> <target.exr>" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -R first:last[:step]" << endl;
+        cout << "                  Process a frame sequence: runs of '#' in the file names" << endl;
+        cout << "                  are replaced by the zero-padded frame numbers" << endl << endl;
+        cout << "   -t             Multithreaded: process several frames in parallel" << endl << endl;
+        cout << " Without -R, a '*' in the file name of the first image selects all matching" << endl;
+        cout << " files. The text matched by it replaces the '*' of the other paths, e.g." << endl;
+        cout << " 'mtsutil addimages -t 1 beauty/*.exr 0.5 glow/*.exr out/*.exr'. Images are" << endl;
+        cout << " streamed in strips of scanlines, hence the memory usage doesn't depend on" << endl;
+        cout << " their resolution. Place '--' before a negative first weight." << endl;
+    }
+
     int run(int argc, char **argv) {
-        if (argc != 6) {
-            cout << "Add the weighted pixel values of two EXR images to produce a new one" << endl;
-            cout << "Syntax: mtsutil addimages <weight 1> <image 1.exr> <weight 2> <image 2.exr> <target.exr>" << endl;
+        int optchar;
+        optind = 1;
+        std::string range;
+        bool runParallel = false;
+
+        /* Stop at the first positional argument (the weights may be negative) */
+        while ((optchar = getopt(argc, argv, "+htR:")) != -1) {
+            switch (optchar) {
+                case 'h':
+                    help();
+                    return 0;
+                case 't':
+                    runParallel = true;
+                    break;
+                case 'R':
+                    range = optarg;
+                    break;
+                default:
+                    help();
+                    return -1;
+            }
+        }
+
+        if (argc - optind != 5) {
+            help();
             return -1;
         }
+
+        AddJob job;
         char *end_ptr = NULL;
-        Float weight1 = (Float) strtod(argv[1], &end_ptr);
+        job.weight1 = (Float) strtod(argv[optind], &end_ptr);
         if (*end_ptr != '\0')
             SLog(EError, "Could not parse floating point value");
-        Float weight2 = (Float) strtod(argv[3], &end_ptr);
+        job.weight2 = (Float) strtod(argv[optind+2], &end_ptr);
         if (*end_ptr != '\0')
             SLog(EError, "Could not parse floating point value");
 
-        ref<FileStream> aFile   = new FileStream(argv[2], FileStream::EReadOnly);
-        ref<FileStream> bFile   = new FileStream(argv[4], FileStream::EReadOnly);
-        ref<FileStream> outFile = new FileStream(argv[5], FileStream::ETruncReadWrite);
-
-        ref<Bitmap> aBitmap = new Bitmap(Bitmap::EOpenEXR, aFile);
-        ref<Bitmap> bBitmap = new Bitmap(Bitmap::EOpenEXR, bFile);
-
-        /* A few sanity checks */
-        if (aBitmap->getPixelFormat() != bBitmap->getPixelFormat())
-            Log(EError, "Error: Input bitmaps have a different pixel format!");
-        if (aBitmap->getComponentFormat() != bBitmap->getComponentFormat())
-            Log(EError, "Error: Input bitmaps have a different component format!");
-        if (aBitmap->getSize() != bBitmap->getSize())
-            Log(EError, "Error: Input bitmaps have a different size!");
-
-        ref<Bitmap> outBitmap = new Bitmap(aBitmap->getPixelFormat(),
-                aBitmap->getComponentFormat(), aBitmap->getSize());
-
-        size_t nEntries =
-            (size_t) aBitmap->getSize().x *
-            (size_t) aBitmap->getSize().y *
-            aBitmap->getChannelCount();
-
-        switch (aBitmap->getComponentFormat()) {
-            case Bitmap::EFloat16: {
-                    half *aData = aBitmap->getFloat16Data();
-                    half *bData = bBitmap->getFloat16Data();
-                    half *outData = outBitmap->getFloat16Data();
-                    for (size_t i=0; i<nEntries; ++i)
-                        *outData++ = (half) ((float) std::max((Float) 0,
-                                weight1 * (Float) (*aData++) +
-                                weight2 * (Float) (*bData++)));
-                }
-                break;
-
-            case Bitmap::EFloat32: {
-                    float *aData = aBitmap->getFloat32Data();
-                    float *bData = bBitmap->getFloat32Data();
-                    float *outData = outBitmap->getFloat32Data();
-                    for (size_t i=0; i<nEntries; ++i)
-                        *outData++ = (float) std::max((Float) 0,
-                                weight1 * (Float) (*aData++) +
-                                weight2 * (Float) (*bData++));
-                }
-                break;
-
-            case Bitmap::EUInt32: {
-                    uint32_t *aData = aBitmap->getUInt32Data();
-                    uint32_t *bData = bBitmap->getUInt32Data();
-                    uint32_t *outData = outBitmap->getUInt32Data();
-                    for (size_t i=0; i<nEntries; ++i)
-                        *outData++ = (uint32_t) std::max((Float) 0,
-                                weight1 * (Float) (*aData++) +
-                                weight2 * (Float) (*bData++));
-                }
-                break;
-
-            default:
-                Log(EError, "Unsupported component format!");
-        }
+        std::vector<std::string> paths;
+        paths.push_back(argv[optind+1]);
+        paths.push_back(argv[optind+3]);
+        paths.push_back(argv[optind+4]);
 
-        outBitmap->write(Bitmap::EOpenEXR, outFile);
-        return 0;
+        std::vector<std::vector<std::string> > jobs = expandJobs(paths, range);
+        if (jobs.size() > 1)
+            Log(EInfo, "Adding the images of " SIZE_T_FMT " frames ..", jobs.size());
+        return runJobs(jobs, runParallel, job) == 0 ? 0 : -1;
     }
 
     MTS_DECLARE_UTILITY()
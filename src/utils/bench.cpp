@@ -0,0 +1,799 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/render/renderjob.h>
+#include <mitsuba/render/renderqueue.h>
+#include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/version.h>
+#include <mitsuba/core/warp.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem/fstream.hpp>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/* All scenes are generated from this seed, so that every run of the
+   benchmark (and every commit) sees exactly the same geometry */
+#define BENCH_SEED 0x5EED
+
+/**
+ * Render benchmark suite: generates a fixed set of canonical scenes,
+ * measures their construction time, ray throughput and rendering
+ * throughput, and writes the results in a format that can be compared
+ * against a baseline from another build.
+ */
+class Bench : public Utility {
+public:
+    typedef std::vector<std::pair<std::string, Float> > ResultList;
+    typedef std::map<std::string, Float> ResultMap;
+
+    void help() {
+        cout << endl;
+        cout << "Synopsis: Render benchmark suite. Generates a fixed set of procedural scenes" << endl;
+        cout << "and measures their build time, ray tracing throughput (primary, incoherent" << endl;
+        cout << "and shadow rays, single-threaded), rendering throughput of one or more" << endl;
+        cout << "integrators (all cores) and memory usage. The results can be saved and" << endl;
+        cout << "compared against those of another build to catch performance regressions." << endl;
+        cout << endl;
+        cout << "Usage: mtsutil bench [options]" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -s scenes      Comma-separated list of scenes to run. Available:" << endl;
+        cout << "                  soup, forest, interior, volume, hair (default: all)" << endl << endl;
+        cout << "   -i names       Comma-separated list of integrator plugins to benchmark" << endl;
+        cout << "                  on every scene (default: a suitable set per scene)" << endl << endl;
+        cout << "   -x factor      Scale the geometric complexity of all scenes (default: 1)" << endl << endl;
+        cout << "   -r res         Horizontal and vertical image resolution (default: 128)" << endl << endl;
+        cout << "   -p spp         Samples per pixel used for rendering (default: 16)" << endl << endl;
+        cout << "   -n count       Number of rays per ray tracing test (default: 1000000)" << endl << endl;
+        cout << "   -o file        Write the results to a JSON file" << endl << endl;
+        cout << "   -c file        Compare the results against a previously written file" << endl << endl;
+        cout << "   -t percent     Slowdown that is reported as a regression (default: 5)." << endl;
+        cout << "                  The utility returns a nonzero value when one is found" << endl << endl;
+        cout << "   -l label       Label stored in the results file (e.g. a commit hash)" << endl << endl;
+        cout << "Examples:" << endl;
+        cout << "  $ mtsutil bench -l before -o before.json" << endl;
+        cout << "  $ mtsutil bench -l after -c before.json" << endl << endl;
+    }
+
+    int run(int argc, char **argv) {
+        int optchar;
+        char *end_ptr = NULL;
+        std::vector<std::string> sceneNames, integrators;
+        std::string outFile, compareFile, label;
+        Float threshold = 5;
+        optind = 1;
+
+        m_scale = 1;
+        m_resolution = 128;
+        m_sampleCount = 16;
+        m_rayCount = 1000000;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "s:i:x:r:p:n:o:c:t:l:h")) != -1) {
+            switch (optchar) {
+                case 'h': {
+                        help();
+                        return 0;
+                    }
+                    break;
+                case 's':
+                    boost::split(sceneNames, optarg, boost::is_any_of(","));
+                    break;
+                case 'i':
+                    boost::split(integrators, optarg, boost::is_any_of(","));
+                    break;
+                case 'x':
+                    m_scale = (Float) strtod(optarg, &end_ptr);
+                    if (*end_ptr != '\0' || m_scale <= 0)
+                        SLog(EError, "Could not parse the complexity factor!");
+                    break;
+                case 'r':
+                    m_resolution = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || m_resolution <= 0)
+                        SLog(EError, "Could not parse the image resolution!");
+                    break;
+                case 'p':
+                    m_sampleCount = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || m_sampleCount <= 0)
+                        SLog(EError, "Could not parse the sample count!");
+                    break;
+                case 'n':
+                    m_rayCount = (size_t) strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || m_rayCount == 0)
+                        SLog(EError, "Could not parse the ray count!");
+                    break;
+                case 'o':
+                    outFile = optarg;
+                    break;
+                case 'c':
+                    compareFile = optarg;
+                    break;
+                case 't':
+                    threshold = (Float) strtod(optarg, &end_ptr);
+                    if (*end_ptr != '\0')
+                        SLog(EError, "Could not parse the regression threshold!");
+                    break;
+                case 'l':
+                    label = optarg;
+                    break;
+            };
+        }
+
+        if (optind != argc) {
+            help();
+            return 0;
+        }
+
+        if (sceneNames.empty())
+            boost::split(sceneNames, "soup,forest,interior,volume,hair",
+                boost::is_any_of(","));
+
+        ResultMap baseline;
+        if (!compareFile.empty())
+            baseline = loadResults(compareFile);
+
+        m_dir = fs::temp_directory_path() / fs::unique_path("mtsbench-%%%%%%%%");
+        fs::create_directories(m_dir);
+
+        ResultList results;
+        for (size_t i=0; i<sceneNames.size(); ++i) {
+            std::vector<std::string> sceneIntegrators = integrators;
+            std::string xml = createScene(sceneNames[i], sceneIntegrators);
+            benchmark(sceneNames[i], xml, sceneIntegrators, results);
+        }
+        results.push_back(std::make_pair(std::string("all.peakMemory"),
+            (Float) getPeakMemoryUsage()));
+
+        try {
+            fs::remove_all(m_dir);
+        } catch (const std::exception &e) {
+            Log(EWarn, "Could not remove the scene directory \"%s\": %s",
+                m_dir.string().c_str(), e.what());
+        }
+
+        if (!outFile.empty())
+            saveResults(outFile, label, results);
+
+        if (!compareFile.empty())
+            return compare(results, baseline, threshold) ? 1 : 0;
+
+        return 0;
+    }
+
+    /* ======================= Measurements ======================= */
+
+    void benchmark(const std::string &name, const std::string &xml,
+            const std::vector<std::string> &integrators, ResultList &results) {
+        Log(EInfo, "Benchmarking scene \"%s\" ..", name.c_str());
+
+        size_t memory = getPrivateMemoryUsage();
+        ref<Timer> timer = new Timer();
+        ref<Scene> scene = loadSceneFromString(xml);
+        scene->initialize();
+        Float buildTime = timer->getSeconds();
+        size_t memoryAfter = getPrivateMemoryUsage();
+        memory = memoryAfter > memory ? memoryAfter - memory : 0;
+
+        results.push_back(std::make_pair(name + ".buildTime", buildTime));
+        results.push_back(std::make_pair(name + ".memory", (Float) memory));
+        Log(EInfo, "  Build time: %.3f s, memory: %s", buildTime,
+            memString(memory).c_str());
+
+        /* Ray tracing throughput (single-threaded) */
+        std::vector<Ray> primary, incoherent, shadow;
+        std::vector<Point> primaryHits, incoherentHits;
+        ref<Random> random = new Random(BENCH_SEED);
+        generatePrimaryRays(scene, random, primary);
+        generateIncoherentRays(scene, random, incoherent);
+
+        Float mrays = traceRays(scene, primary, &primaryHits);
+        results.push_back(std::make_pair(name + ".primary", mrays));
+        Log(EInfo, "  Primary rays: %.3f MRays/s", mrays);
+
+        mrays = traceRays(scene, incoherent, &incoherentHits);
+        results.push_back(std::make_pair(name + ".incoherent", mrays));
+        Log(EInfo, "  Incoherent rays: %.3f MRays/s", mrays);
+
+        generateShadowRays(random, primaryHits, incoherentHits, shadow);
+        std::vector<Ray>().swap(primary);
+        std::vector<Ray>().swap(incoherent);
+        mrays = traceRays(scene, shadow, NULL);
+        results.push_back(std::make_pair(name + ".shadow", mrays));
+        Log(EInfo, "  Shadow rays: %.3f MRays/s", mrays);
+        std::vector<Ray>().swap(shadow);
+
+        /* Rendering throughput (all cores) */
+        for (size_t i=0; i<integrators.size(); ++i) {
+            Float msamples = render(scene, integrators[i]);
+            results.push_back(std::make_pair(name + "." + integrators[i], msamples));
+            Log(EInfo, "  Integrator \"%s\": %.3f MSamples/s",
+                integrators[i].c_str(), msamples);
+        }
+    }
+
+    void generatePrimaryRays(const Scene *scene, Random *random,
+            std::vector<Ray> &rays) {
+        const Sensor *sensor = scene->getSensor();
+        Vector2i size = sensor->getFilm()->getCropSize();
+        size_t pixelCount = (size_t) size.x * (size_t) size.y;
+
+        rays.resize(m_rayCount);
+        for (size_t i=0; i<m_rayCount; ++i) {
+            /* Scanline order, like an image rendered one pixel at a time */
+            size_t pixel = i % pixelCount;
+            Point2 samplePos(
+                (Float) (pixel % size.x) + random->nextFloat(),
+                (Float) (pixel / size.x) + random->nextFloat());
+            Point2 apertureSample(random->nextFloat(), random->nextFloat());
+            sensor->sampleRay(rays[i], samplePos, apertureSample, 0.5f);
+        }
+    }
+
+    void generateIncoherentRays(const Scene *scene, Random *random,
+            std::vector<Ray> &rays) {
+        BSphere bsphere(scene->getKDTree()->getAABB().getBSphere());
+
+        rays.resize(m_rayCount);
+        for (size_t i=0; i<m_rayCount; ++i) {
+            Point2 sample1(random->nextFloat(), random->nextFloat()),
+                   sample2(random->nextFloat(), random->nextFloat());
+            Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+            Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+            rays[i] = Ray(p1, normalize(p2-p1), 0.0f);
+        }
+    }
+
+    /* Connect the surface points found by the camera rays to random
+       surface points found by the incoherent rays */
+    void generateShadowRays(Random *random, const std::vector<Point> &origins,
+            const std::vector<Point> &targets, std::vector<Ray> &rays) {
+        rays.clear();
+        if (origins.empty() || targets.empty())
+            return;
+        rays.reserve(m_rayCount);
+        for (size_t i=0; i<m_rayCount; ++i) {
+            const Point &p1 = origins[i % origins.size()];
+            const Point &p2 = targets[std::min(targets.size()-1,
+                (size_t) (random->nextFloat() * targets.size()))];
+            Vector d = p2 - p1;
+            Float length = d.length();
+            if (length == 0)
+                continue;
+            d /= length;
+            rays.push_back(Ray(p1, d, Epsilon,
+                length * (1-ShadowEpsilon), 0.0f));
+        }
+    }
+
+    /**
+     * Trace a batch of rays three times and return the best throughput
+     * (in MRays/s). When \c hits is specified, the rays are traced as
+     * regular intersection queries and the intersections are recorded.
+     * Otherwise, they are traced as shadow rays.
+     */
+    Float traceRays(const Scene *scene, const std::vector<Ray> &rays,
+            std::vector<Point> *hits) {
+        if (rays.empty())
+            return 0;
+
+        Float best = 0;
+        ref<Timer> timer = new Timer();
+        for (int j=0; j<3; ++j) {
+            if (hits)
+                hits->clear();
+            timer->reset();
+            if (hits) {
+                Intersection its;
+                for (size_t i=0; i<rays.size(); ++i) {
+                    if (scene->rayIntersect(rays[i], its))
+                        hits->push_back(its.p);
+                }
+            } else {
+                size_t nOccluded = 0;
+                for (size_t i=0; i<rays.size(); ++i) {
+                    if (scene->rayIntersect(rays[i]))
+                        ++nOccluded;
+                }
+                Log(EDebug, "  " SIZE_T_FMT " of " SIZE_T_FMT " shadow rays were occluded",
+                    nOccluded, rays.size());
+            }
+            Float seconds = timer->getSeconds();
+            best = std::max(best, (Float) rays.size() / std::max(seconds, (Float) 1e-6f));
+        }
+        return best / 1e6f;
+    }
+
+    /// Render the scene with a given integrator, returns MSamples/s
+    Float render(const Scene *base, const std::string &name) {
+        Properties props(name);
+        ref<Integrator> integrator = static_cast<Integrator *> (PluginManager::getInstance()->
+                createObject(MTS_CLASS(Integrator), props));
+        integrator->configure();
+
+        ref<Scene> scene = new Scene(const_cast<Scene *>(base));
+        scene->setIntegrator(integrator);
+        scene->configure();
+        scene->setDestinationFile(fs::path());
+
+        ref<RenderQueue> queue = new RenderQueue();
+        ref<Timer> timer = new Timer();
+        ref<RenderJob> job = new RenderJob("bench", scene, queue,
+            -1, -1, -1, false, false);
+        job->start();
+        bool success = job->wait();
+        queue->join();
+        Float seconds = timer->getSeconds();
+
+        if (!success)
+            Log(EError, "Rendering with the \"%s\" integrator failed!", name.c_str());
+
+        Vector2i size = scene->getFilm()->getCropSize();
+        Float samples = (Float) size.x * size.y * m_sampleCount;
+        return samples / std::max(seconds, (Float) 1e-3f) / 1e6f;
+    }
+
+    /* ======================= Results ======================= */
+
+    /// Metrics where smaller values are better (all others are throughputs)
+    static bool lowerIsBetter(const std::string &key) {
+        return boost::ends_with(key, ".buildTime") ||
+               boost::ends_with(key, ".memory") ||
+               boost::ends_with(key, ".peakMemory");
+    }
+
+    void saveResults(const fs::path &path, const std::string &label,
+            const ResultList &results) {
+        fs::ofstream os(path);
+        if (os.fail())
+            Log(EError, "Could not open \"%s\" for writing!", path.string().c_str());
+
+        /* One metric per line, so that the files can be diffed and
+           parsed again without a JSON library */
+        os << "{" << endl
+           << "  \"label\": \"" << label << "\"," << endl
+           << "  \"version\": \"" << MTS_VERSION << "\"," << endl
+           << "  \"host\": \"" << getHostName() << "\"," << endl
+           << "  \"cores\": " << getCoreCount() << "," << endl
+#if defined(SINGLE_PRECISION)
+           << "  \"precision\": \"single\"," << endl
+#else
+           << "  \"precision\": \"double\"," << endl
+#endif
+           << "  \"spectrumSamples\": " << SPECTRUM_SAMPLES << "," << endl
+           << "  \"scale\": " << m_scale << "," << endl
+           << "  \"resolution\": " << m_resolution << "," << endl
+           << "  \"sampleCount\": " << m_sampleCount << "," << endl
+           << "  \"rayCount\": " << m_rayCount << "," << endl
+           << "  \"results\": {" << endl;
+        for (size_t i=0; i<results.size(); ++i) {
+            os << "    \"" << results[i].first << "\": "
+               << formatString("%.6g", results[i].second);
+            os << (i+1 < results.size() ? "," : "") << endl;
+        }
+        os << "  }" << endl << "}" << endl;
+        Log(EInfo, "Wrote the benchmark results to \"%s\"", path.string().c_str());
+    }
+
+    ResultMap loadResults(const fs::path &path) {
+        fs::ifstream is(path);
+        if (is.fail())
+            Log(EError, "Could not open the baseline \"%s\"!", path.string().c_str());
+
+        ResultMap results;
+        std::string line;
+        while (std::getline(is, line)) {
+            size_t start = line.find('"'), end = line.find('"', start + 1);
+            if (start == std::string::npos || end == std::string::npos)
+                continue;
+            std::string key = line.substr(start + 1, end - start - 1);
+            size_t colon = line.find(':', end);
+            /* Metrics are always named "scene.metric" */
+            if (colon == std::string::npos || key.find('.') == std::string::npos)
+                continue;
+            const char *value = line.c_str() + colon + 1;
+            char *end_ptr = NULL;
+            double result = strtod(value, &end_ptr);
+            if (end_ptr != value)
+                results[key] = (Float) result;
+        }
+        if (results.empty())
+            Log(EError, "The baseline \"%s\" does not contain any results!",
+                path.string().c_str());
+        return results;
+    }
+
+    /// Compare against a baseline, returns \c true if there was a regression
+    bool compare(const ResultList &results, const ResultMap &baseline,
+            Float threshold) {
+        bool regression = false;
+        Log(EInfo, "Comparison against the baseline:");
+        for (size_t i=0; i<results.size(); ++i) {
+            const std::string &key = results[i].first;
+            ResultMap::const_iterator it = baseline.find(key);
+            if (it == baseline.end() || it->second == 0)
+                continue;
+            /* Relative change, positive means faster/smaller */
+            Float change = (results[i].second - it->second) / it->second * 100;
+            if (lowerIsBetter(key))
+                change = -change;
+            bool bad = change < -threshold;
+            regression |= bad;
+            Log(bad ? EWarn : EInfo, "  %-28s %12.4g -> %12.4g (%+.1f%%)%s",
+                key.c_str(), it->second, results[i].second, change,
+                bad ? " REGRESSION" : "");
+        }
+        if (regression)
+            Log(EWarn, "Found performance regressions (threshold: %.1f%%)!", threshold);
+        return regression;
+    }
+
+    /* ======================= Scene generation ======================= */
+
+    std::string createScene(const std::string &name, std::vector<std::string> &integrators) {
+        std::ostringstream oss;
+        oss << "<?xml version=\"1.0\" encoding=\"utf-8\"?>" << endl
+            << "<scene version=\"" << MTS_VERSION << "\">" << endl;
+
+        std::string defaultIntegrators;
+        ref<Random> random = new Random(BENCH_SEED);
+        if (name == "soup") {
+            createSoup(random, oss);
+            defaultIntegrators = "path,direct";
+        } else if (name == "forest") {
+            createForest(random, oss);
+            defaultIntegrators = "path";
+        } else if (name == "interior") {
+            createInterior(random, oss);
+            defaultIntegrators = "path,direct";
+        } else if (name == "volume") {
+            createVolume(random, oss);
+            defaultIntegrators = "volpath";
+        } else if (name == "hair") {
+            createHair(random, oss);
+            defaultIntegrators = "path";
+        } else {
+            Log(EError, "Unknown benchmark scene \"%s\"!", name.c_str());
+        }
+        oss << "</scene>" << endl;
+
+        if (integrators.empty())
+            boost::split(integrators, defaultIntegrators, boost::is_any_of(","));
+        return oss.str();
+    }
+
+    void writeSensor(std::ostream &os, const Point &origin,
+            const Point &target, Float fov) {
+        os << formatString(
+            "\t<sensor type=\"perspective\">\n"
+            "\t\t<float name=\"fov\" value=\"%f\"/>\n"
+            "\t\t<transform name=\"toWorld\">\n"
+            "\t\t\t<lookat origin=\"%f, %f, %f\" target=\"%f, %f, %f\" up=\"0, 1, 0\"/>\n"
+            "\t\t</transform>\n"
+            "\t\t<sampler type=\"independent\">\n"
+            "\t\t\t<integer name=\"sampleCount\" value=\"%i\"/>\n"
+            "\t\t</sampler>\n"
+            "\t\t<film type=\"hdrfilm\">\n"
+            "\t\t\t<integer name=\"width\" value=\"%i\"/>\n"
+            "\t\t\t<integer name=\"height\" value=\"%i\"/>\n"
+            "\t\t\t<boolean name=\"banner\" value=\"false\"/>\n"
+            "\t\t</film>\n"
+            "\t</sensor>\n", fov, origin.x, origin.y, origin.z,
+            target.x, target.y, target.z, m_sampleCount,
+            m_resolution, m_resolution);
+    }
+
+    fs::path writeMesh(const std::string &name, const TriMesh *mesh) {
+        fs::path path = m_dir / (name + ".serialized");
+        ref<FileStream> stream = new FileStream(path, FileStream::ETruncWrite);
+        stream->setByteOrder(Stream::ELittleEndian);
+        mesh->serialize(stream);
+        return path;
+    }
+
+    /// Append random small triangles within a sphere to a mesh
+    static void addSoup(Random *random, TriMesh *mesh, size_t &vertex,
+            size_t &triangle, size_t count, const Point &center,
+            Float radius, Float size) {
+        Point *positions = mesh->getVertexPositions();
+        Triangle *triangles = mesh->getTriangles();
+        for (size_t i=0; i<count; ++i) {
+            Point2 sample(random->nextFloat(), random->nextFloat());
+            Point c = center + warp::squareToUniformSphere(sample) * radius
+                * std::pow(random->nextFloat(), (Float) 1 / (Float) 3);
+            for (int j=0; j<3; ++j) {
+                Vector offset(random->nextFloat() - 0.5f,
+                    random->nextFloat() - 0.5f, random->nextFloat() - 0.5f);
+                positions[vertex + j] = c + offset * size;
+                triangles[triangle].idx[j] = (uint32_t) (vertex + j);
+            }
+            vertex += 3;
+            triangle += 1;
+        }
+    }
+
+    /// Triangle soup: many small, randomly oriented and overlapping triangles
+    void createSoup(Random *random, std::ostream &os) {
+        size_t count = (size_t) (200000 * m_scale);
+        ref<TriMesh> mesh = new TriMesh("soup", count, 3*count);
+        size_t vertex = 0, triangle = 0;
+        addSoup(random, mesh, vertex, triangle, count, Point(0.0f), 1.0f, 0.08f);
+        fs::path path = writeMesh("soup", mesh);
+
+        writeSensor(os, Point(0, 0, -4), Point(0.0f), 40);
+        os << "\t<shape type=\"serialized\">" << endl
+           << "\t\t<string name=\"filename\" value=\"" << path.string() << "\"/>" << endl
+           << "\t\t<boolean name=\"faceNormals\" value=\"true\"/>" << endl
+           << "\t\t<bsdf type=\"diffuse\"/>" << endl
+           << "\t</shape>" << endl
+           << "\t<emitter type=\"constant\"/>" << endl;
+    }
+
+    /// Instanced forest: a grid of instanced trees on a ground plane
+    void createForest(Random *random, std::ostream &os) {
+        /* A tree consists of a hexagonal trunk and a crown of leaves */
+        const int trunkSides = 6;
+        size_t leafCount = 4000;
+        ref<TriMesh> mesh = new TriMesh("tree", 2*trunkSides + leafCount,
+            2*trunkSides + 3*leafCount);
+        Point *positions = mesh->getVertexPositions();
+        Triangle *triangles = mesh->getTriangles();
+        for (int i=0; i<trunkSides; ++i) {
+            Float phi = 2 * M_PI * i / (Float) trunkSides;
+            Float x = 0.1f * std::cos(phi), z = 0.1f * std::sin(phi);
+            positions[2*i] = Point(x, 0, z);
+            positions[2*i+1] = Point(x, 1.5f, z);
+            uint32_t a = 2*i, b = 2*i+1, c = 2*((i+1) % trunkSides),
+                     d = 2*((i+1) % trunkSides) + 1;
+            triangles[2*i].idx[0] = a; triangles[2*i].idx[1] = c; triangles[2*i].idx[2] = b;
+            triangles[2*i+1].idx[0] = b; triangles[2*i+1].idx[1] = c; triangles[2*i+1].idx[2] = d;
+        }
+        size_t vertex = 2*trunkSides, triangle = 2*trunkSides;
+        addSoup(random, mesh, vertex, triangle, leafCount, Point(0, 2.2f, 0), 0.9f, 0.15f);
+        fs::path path = writeMesh("tree", mesh);
+
+        int side = std::max(1, (int) std::sqrt(400 * m_scale));
+        Float spacing = 3, extent = side * spacing * 0.5f;
+
+        writeSensor(os, Point(0, 8, -extent - 10), Point(0, 0, 0), 50);
+        os << "\t<shape type=\"shapegroup\" id=\"tree\">" << endl
+           << "\t\t<shape type=\"serialized\">" << endl
+           << "\t\t\t<string name=\"filename\" value=\"" << path.string() << "\"/>" << endl
+           << "\t\t\t<boolean name=\"faceNormals\" value=\"true\"/>" << endl
+           << "\t\t\t<bsdf type=\"diffuse\">" << endl
+           << "\t\t\t\t<rgb name=\"reflectance\" value=\"0.2, 0.4, 0.15\"/>" << endl
+           << "\t\t\t</bsdf>" << endl
+           << "\t\t</shape>" << endl
+           << "\t</shape>" << endl;
+
+        for (int y=0; y<side; ++y) {
+            for (int x=0; x<side; ++x) {
+                Float px = (x + 0.5f) * spacing - extent + (random->nextFloat() - 0.5f) * spacing * 0.5f,
+                      pz = (y + 0.5f) * spacing - extent + (random->nextFloat() - 0.5f) * spacing * 0.5f;
+                os << formatString(
+                    "\t<shape type=\"instance\">\n"
+                    "\t\t<ref id=\"tree\"/>\n"
+                    "\t\t<transform name=\"toWorld\">\n"
+                    "\t\t\t<scale value=\"%f\"/>\n"
+                    "\t\t\t<rotate y=\"1\" angle=\"%f\"/>\n"
+                    "\t\t\t<translate x=\"%f\" z=\"%f\"/>\n"
+                    "\t\t</transform>\n"
+                    "\t</shape>\n", 0.8f + 0.4f * random->nextFloat(),
+                    360 * random->nextFloat(), px, pz);
+            }
+        }
+
+        os << "\t<shape type=\"rectangle\">" << endl
+           << "\t\t<transform name=\"toWorld\">" << endl
+           << "\t\t\t<rotate x=\"1\" angle=\"-90\"/>" << endl
+           << "\t\t\t<scale value=\"" << extent + 5 << "\"/>" << endl
+           << "\t\t</transform>" << endl
+           << "\t\t<bsdf type=\"diffuse\"/>" << endl
+           << "\t</shape>" << endl
+           << "\t<emitter type=\"constant\">" << endl
+           << "\t\t<spectrum name=\"radiance\" value=\"0.5\"/>" << endl
+           << "\t</emitter>" << endl
+           << "\t<emitter type=\"directional\">" << endl
+           << "\t\t<vector name=\"direction\" x=\"-1\" y=\"-2\" z=\"0.5\"/>" << endl
+           << "\t</emitter>" << endl;
+    }
+
+    /// Textured interior: a closed room with boxes, lit by an area light
+    void createInterior(Random *random, std::ostream &os) {
+        /* Procedural texture: tiles with random colors and fine stripes */
+        const int texSize = 512, tiles = 8;
+        ref<Bitmap> bitmap = new Bitmap(Bitmap::ERGB, Bitmap::EUInt8,
+            Vector2i(texSize, texSize));
+        std::vector<Spectrum> colors(tiles * tiles);
+        for (size_t i=0; i<colors.size(); ++i)
+            colors[i].fromLinearRGB(0.2f + 0.6f * random->nextFloat(),
+                0.2f + 0.6f * random->nextFloat(), 0.2f + 0.6f * random->nextFloat());
+        uint8_t *data = bitmap->getUInt8Data();
+        for (int y=0; y<texSize; ++y) {
+            for (int x=0; x<texSize; ++x) {
+                int tile = (y * tiles / texSize) * tiles + x * tiles / texSize;
+                Float r, g, b;
+                colors[tile].toLinearRGB(r, g, b);
+                Float stripe = 0.85f + 0.15f * std::sin(x * 0.7f);
+                *data++ = (uint8_t) math::clamp((int) (255 * r * stripe), 0, 255);
+                *data++ = (uint8_t) math::clamp((int) (255 * g * stripe), 0, 255);
+                *data++ = (uint8_t) math::clamp((int) (255 * b * stripe), 0, 255);
+            }
+        }
+        fs::path path = m_dir / "texture.png";
+        ref<FileStream> stream = new FileStream(path, FileStream::ETruncWrite);
+        bitmap->write(Bitmap::EPNG, stream);
+        stream->close();
+
+        writeSensor(os, Point(0, 0, -4.5f), Point(0, -1, 0), 70);
+        os << "\t<bsdf type=\"diffuse\" id=\"textured\">" << endl
+           << "\t\t<texture type=\"bitmap\" name=\"reflectance\">" << endl
+           << "\t\t\t<string name=\"filename\" value=\"" << path.string() << "\"/>" << endl
+           << "\t\t</texture>" << endl
+           << "\t</bsdf>" << endl
+           << "\t<shape type=\"cube\">" << endl
+           << "\t\t<transform name=\"toWorld\">" << endl
+           << "\t\t\t<scale value=\"5\"/>" << endl
+           << "\t\t</transform>" << endl
+           << "\t\t<ref id=\"textured\"/>" << endl
+           << "\t</shape>" << endl;
+
+        size_t boxCount = (size_t) (200 * m_scale);
+        for (size_t i=0; i<boxCount; ++i) {
+            Vector extents(0.15f + 0.5f * random->nextFloat(),
+                0.15f + 0.5f * random->nextFloat(), 0.15f + 0.5f * random->nextFloat());
+            Point center(8 * random->nextFloat() - 4, -5 + extents.y
+                + 4 * random->nextFloat() * random->nextFloat(), 8 * random->nextFloat() - 4);
+            os << formatString(
+                "\t<shape type=\"cube\">\n"
+                "\t\t<transform name=\"toWorld\">\n"
+                "\t\t\t<scale x=\"%f\" y=\"%f\" z=\"%f\"/>\n"
+                "\t\t\t<rotate y=\"1\" angle=\"%f\"/>\n"
+                "\t\t\t<translate x=\"%f\" y=\"%f\" z=\"%f\"/>\n"
+                "\t\t</transform>\n"
+                "\t\t<ref id=\"textured\"/>\n"
+                "\t</shape>\n", extents.x, extents.y, extents.z,
+                360 * random->nextFloat(), center.x, center.y, center.z);
+        }
+
+        os << "\t<shape type=\"rectangle\">" << endl
+           << "\t\t<transform name=\"toWorld\">" << endl
+           << "\t\t\t<scale value=\"1.5\"/>" << endl
+           << "\t\t\t<rotate x=\"1\" angle=\"90\"/>" << endl
+           << "\t\t\t<translate y=\"4.9\"/>" << endl
+           << "\t\t</transform>" << endl
+           << "\t\t<emitter type=\"area\">" << endl
+           << "\t\t\t<spectrum name=\"radiance\" value=\"20\"/>" << endl
+           << "\t\t</emitter>" << endl
+           << "\t</shape>" << endl;
+    }
+
+    /// Heterogeneous volume: a noisy cloud of participating media
+    void createVolume(Random *random, std::ostream &os) {
+        int res = std::max(8, (int) (64 * std::pow(m_scale, (Float) 1 / (Float) 3)));
+        fs::path path = m_dir / "density.vol";
+        ref<FileStream> stream = new FileStream(path, FileStream::ETruncWrite);
+        stream->setByteOrder(Stream::ELittleEndian);
+        stream->write("VOL", 3);
+        stream->writeChar(3);
+        stream->writeInt(1); /* float32, dense */
+        stream->writeInt(res);
+        stream->writeInt(res);
+        stream->writeInt(res);
+        stream->writeInt(1);
+        float bounds[6] = { -1, -1, -1, 1, 1, 1 };
+        stream->writeSingleArray(bounds);
+
+        std::vector<float> data((size_t) res * res * res);
+        size_t idx = 0;
+        for (int z=0; z<res; ++z) {
+            for (int y=0; y<res; ++y) {
+                for (int x=0; x<res; ++x) {
+                    Point p(2 * (x + 0.5f) / res - 1, 2 * (y + 0.5f) / res - 1,
+                        2 * (z + 0.5f) / res - 1);
+                    Float falloff = std::max((Float) 0, 1 - Vector(p).length());
+                    Float noise = 0.5f + 0.25f * (std::sin(7 * p.x) * std::sin(9 * p.y)
+                        * std::sin(11 * p.z) + random->nextFloat());
+                    data[idx++] = (float) (falloff * noise);
+                }
+            }
+        }
+        stream->writeSingleArray(&data[0], data.size());
+        stream->close();
+
+        writeSensor(os, Point(0, 0.5f, -4), Point(0.0f), 40);
+        os << "\t<medium type=\"heterogeneous\" id=\"cloud\">" << endl
+           << "\t\t<string name=\"method\" value=\"woodcock\"/>" << endl
+           << "\t\t<volume name=\"density\" type=\"gridvolume\">" << endl
+           << "\t\t\t<string name=\"filename\" value=\"" << path.string() << "\"/>" << endl
+           << "\t\t</volume>" << endl
+           << "\t\t<volume name=\"albedo\" type=\"constvolume\">" << endl
+           << "\t\t\t<spectrum name=\"value\" value=\"0.9\"/>" << endl
+           << "\t\t</volume>" << endl
+           << "\t\t<float name=\"scale\" value=\"20\"/>" << endl
+           << "\t</medium>" << endl
+           << "\t<shape type=\"cube\">" << endl
+           << "\t\t<ref name=\"interior\" id=\"cloud\"/>" << endl
+           << "\t</shape>" << endl
+           << "\t<emitter type=\"constant\">" << endl
+           << "\t\t<spectrum name=\"radiance\" value=\"0.5\"/>" << endl
+           << "\t</emitter>" << endl
+           << "\t<emitter type=\"directional\">" << endl
+           << "\t\t<vector name=\"direction\" x=\"-1\" y=\"-2\" z=\"0.5\"/>" << endl
+           << "\t</emitter>" << endl;
+    }
+
+    /// Hair: curved strands growing out of a sphere
+    void createHair(Random *random, std::ostream &os) {
+        size_t strandCount = (size_t) (20000 * m_scale);
+        const int segments = 12;
+        const Float length = 0.8f;
+
+        fs::path path = m_dir / "hair.hair";
+        ref<FileStream> stream = new FileStream(path, FileStream::ETruncWrite);
+        stream->setByteOrder(Stream::ELittleEndian);
+        stream->write("BINARY_HAIR", 11);
+        stream->writeUInt((uint32_t) (strandCount * (segments + 1)));
+        for (size_t i=0; i<strandCount; ++i) {
+            Point2 sample(random->nextFloat(), random->nextFloat());
+            Vector n = warp::squareToUniformSphere(sample);
+            Vector jitter = warp::squareToUniformSphere(
+                Point2(random->nextFloat(), random->nextFloat())) * 0.05f;
+            stream->writeSingle(std::numeric_limits<float>::infinity());
+            for (int j=0; j<=segments; ++j) {
+                Float t = length * j / (Float) segments;
+                /* Grow along the normal and droop under gravity */
+                Point p = Point(n) + (n + jitter * j) * t
+                    + Vector(0, -0.8f, 0) * t * t;
+                stream->writeSingle((float) p.x);
+                stream->writeSingle((float) p.y);
+                stream->writeSingle((float) p.z);
+            }
+        }
+        stream->close();
+
+        writeSensor(os, Point(0, 0.5f, -5), Point(0, -0.2f, 0), 45);
+        os << "\t<shape type=\"hair\">" << endl
+           << "\t\t<string name=\"filename\" value=\"" << path.string() << "\"/>" << endl
+           << "\t\t<float name=\"radius\" value=\"0.004\"/>" << endl
+           << "\t\t<bsdf type=\"roughconductor\"/>" << endl
+           << "\t</shape>" << endl
+           << "\t<shape type=\"sphere\">" << endl
+           << "\t\t<float name=\"radius\" value=\"0.98\"/>" << endl
+           << "\t\t<bsdf type=\"diffuse\"/>" << endl
+           << "\t</shape>" << endl
+           << "\t<emitter type=\"constant\"/>" << endl;
+    }
+
+    MTS_DECLARE_UTILITY()
+private:
+    fs::path m_dir;
+    Float m_scale;
+    int m_resolution, m_sampleCount;
+    size_t m_rayCount;
+};
+
+MTS_EXPORT_UTILITY(Bench, "Render benchmark suite with canonical scenes")
+MTS_NAMESPACE_END
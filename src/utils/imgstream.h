@@ -0,0 +1,327 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_UTILS_IMGSTREAM_H_)
+#define __MITSUBA_UTILS_IMGSTREAM_H_
+
+#include <mitsuba/core/version.h>
+#include <boost/filesystem/operations.hpp>
+#include <algorithm>
+
+#if defined(MTS_HAS_OPENEXR)
+#if defined(_MSC_VER)
+#pragma warning(disable : 4231) // nonstandard extension used : 'extern' before template explicit instantiation
+#endif
+#include <ImfInputFile.h>
+#include <ImfOutputFile.h>
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfStringAttribute.h>
+#endif
+
+/// Number of scanlines that are kept in memory while streaming an image
+#define IMGSTREAM_STRIP_LINES 64
+
+MTS_NAMESPACE_BEGIN
+
+/* ==================================================================== */
+/*          Frame sequences shared by the image batch utilities          */
+/* ==================================================================== */
+
+/**
+ * \brief Parse a frame range of the form <tt>first:last[:step]</tt>
+ * (or a single frame number)
+ */
+inline std::vector<int> parseFrameRange(const std::string &str) {
+    std::vector<std::string> tokens = tokenize(str, ":");
+    if (tokens.empty() || tokens.size() > 3)
+        SLog(EError, "Invalid frame range \"%s\" (expected first:last[:step])", str.c_str());
+
+    int values[3] = { 0, 0, 1 };
+    for (size_t i=0; i<tokens.size(); ++i) {
+        char *end_ptr = NULL;
+        values[i] = (int) std::strtol(tokens[i].c_str(), &end_ptr, 10);
+        if (*end_ptr != '\0')
+            SLog(EError, "Could not parse the frame range \"%s\"", str.c_str());
+    }
+    if (tokens.size() == 1)
+        values[1] = values[0];
+    if (values[2] <= 0 || values[1] < values[0])
+        SLog(EError, "Invalid frame range \"%s\"", str.c_str());
+
+    std::vector<int> frames;
+    for (int frame = values[0]; frame <= values[1]; frame += values[2])
+        frames.push_back(frame);
+    return frames;
+}
+
+/**
+ * \brief Replace the first run of '#' characters in \c pattern by the
+ * frame number, zero-padded to the length of the run
+ */
+inline std::string substituteFrame(const std::string &pattern, int frame) {
+    size_t start = pattern.find('#');
+    if (start == std::string::npos)
+        return pattern;
+    size_t end = pattern.find_first_not_of('#', start);
+    if (end == std::string::npos)
+        end = pattern.length();
+    return pattern.substr(0, start) + formatString("%0*i",
+        (int) (end - start), frame) + pattern.substr(end);
+}
+
+/// Match a file name against a pattern containing a single '*'
+inline bool matchWildcard(const std::string &pattern, const std::string &name,
+        std::string &match) {
+    size_t star = pattern.find('*');
+    if (star == std::string::npos)
+        return false;
+    std::string prefix = pattern.substr(0, star), suffix = pattern.substr(star + 1);
+    if (name.length() < prefix.length() + suffix.length() ||
+        name.compare(0, prefix.length(), prefix) != 0 ||
+        name.compare(name.length() - suffix.length(), suffix.length(), suffix) != 0)
+        return false;
+    match = name.substr(prefix.length(), name.length() - prefix.length() - suffix.length());
+    return true;
+}
+
+/**
+ * \brief Expand the inputs and outputs of a batch job
+ *
+ * Every job is a list of paths: the inputs followed by the outputs.
+ * When \c range is nonempty, the '#' characters of all paths are
+ * replaced by the frame numbers of the range. Otherwise, when the file
+ * name of the first path contains a '*' wildcard, one job is created
+ * per matching file (in lexicographic order), and the matched text is
+ * substituted for the '*' of the other paths. Without either, a single
+ * job with the given paths is returned.
+ */
+inline std::vector<std::vector<std::string> > expandJobs(
+        const std::vector<std::string> &paths, const std::string &range) {
+    std::vector<std::vector<std::string> > jobs;
+
+    if (!range.empty()) {
+        std::vector<int> frames = parseFrameRange(range);
+        for (size_t i=0; i<frames.size(); ++i) {
+            std::vector<std::string> job;
+            for (size_t j=0; j<paths.size(); ++j)
+                job.push_back(substituteFrame(paths[j], frames[i]));
+            jobs.push_back(job);
+        }
+        return jobs;
+    }
+
+    fs::path first(paths[0]);
+    std::string filePattern = first.filename().string();
+    if (filePattern.find('*') == std::string::npos) {
+        jobs.push_back(paths);
+        return jobs;
+    }
+
+    fs::path dir = first.parent_path();
+    if (dir.empty())
+        dir = fs::current_path();
+    std::vector<std::pair<std::string, std::string> > matches;
+    for (fs::directory_iterator it(dir), end; it != end; ++it) {
+        std::string match;
+        if (matchWildcard(filePattern, it->path().filename().string(), match))
+            matches.push_back(std::make_pair(it->path().string(), match));
+    }
+    std::sort(matches.begin(), matches.end());
+    if (matches.empty())
+        SLog(EError, "No files match \"%s\"!", paths[0].c_str());
+
+    for (size_t i=0; i<matches.size(); ++i) {
+        std::vector<std::string> job;
+        job.push_back(matches[i].first);
+        for (size_t j=1; j<paths.size(); ++j) {
+            std::string path = paths[j];
+            size_t star = path.rfind('*');
+            if (star != std::string::npos)
+                path.replace(star, 1, matches[i].second);
+            job.push_back(path);
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+#if defined(MTS_HAS_OPENEXR)
+
+/* ==================================================================== */
+/*           Scanline streaming of OpenEXR images (as floats)           */
+/* ==================================================================== */
+
+/**
+ * \brief Reads a few channels of an OpenEXR image in strips of
+ * scanlines, which are converted to interleaved single precision values
+ */
+class EXRStripReader {
+public:
+    EXRStripReader(const std::string &filename) : m_file(filename.c_str()) {
+        const Imath::Box2i &dw = m_file.header().dataWindow();
+        m_offset = Point2i(dw.min.x, dw.min.y);
+        m_size = Vector2i(dw.max.x - dw.min.x + 1, dw.max.y - dw.min.y + 1);
+    }
+
+    inline const Imf::Header &getHeader() const { return m_file.header(); }
+    inline const Vector2i &getSize() const { return m_size; }
+    inline const Point2i &getOffset() const { return m_offset; }
+
+    /// Return the names of all channels (in file order)
+    std::vector<std::string> getChannelNames() const {
+        std::vector<std::string> names;
+        const Imf::ChannelList &channels = m_file.header().channels();
+        for (Imf::ChannelList::ConstIterator it = channels.begin(); it != channels.end(); ++it)
+            names.push_back(it.name());
+        return names;
+    }
+
+    /**
+     * \brief Read \c lines scanlines starting at row \c y (relative to
+     * the data window) into \c buffer, which holds the given channels
+     * of every pixel. Missing channels are filled with zeros.
+     */
+    void read(int y, int lines, const std::vector<std::string> &channels, float *buffer) {
+        size_t xStride = sizeof(float) * channels.size(),
+               yStride = xStride * m_size.x;
+        char *base = reinterpret_cast<char *>(buffer)
+            - m_offset.x * (ptrdiff_t) xStride - (m_offset.y + y) * (ptrdiff_t) yStride;
+
+        Imf::FrameBuffer frameBuffer;
+        for (size_t i=0; i<channels.size(); ++i)
+            frameBuffer.insert(channels[i].c_str(), Imf::Slice(Imf::FLOAT,
+                base + i * sizeof(float), xStride, yStride, 1, 1, 0.0));
+        m_file.setFrameBuffer(frameBuffer);
+        m_file.readPixels(m_offset.y + y, m_offset.y + y + lines - 1);
+    }
+
+private:
+    Imf::InputFile m_file;
+    Point2i m_offset;
+    Vector2i m_size;
+};
+
+/**
+ * \brief Writes an OpenEXR image in strips of scanlines (in increasing
+ * order), which are given as interleaved single precision values
+ */
+class EXRStripWriter {
+public:
+    /**
+     * \brief Create an image with the given channels, whose other
+     * attributes (e.g. data window and compression) are copied from
+     * \c templ. The channels are stored using \c pixelType.
+     */
+    EXRStripWriter(const std::string &filename, const Imf::Header &templ,
+            const std::vector<std::string> &channels, Imf::PixelType pixelType)
+            : m_channels(channels), m_file(NULL) {
+        Imf::Header header(templ);
+        header.channels() = Imf::ChannelList();
+        for (size_t i=0; i<channels.size(); ++i)
+            header.channels().insert(channels[i].c_str(), Imf::Channel(pixelType));
+        header.insert("generated-by", Imf::StringAttribute("Mitsuba version " MTS_VERSION));
+
+        const Imath::Box2i &dw = header.dataWindow();
+        m_offset = Point2i(dw.min.x, dw.min.y);
+        m_size = Vector2i(dw.max.x - dw.min.x + 1, dw.max.y - dw.min.y + 1);
+        m_file = new Imf::OutputFile(filename.c_str(), header);
+    }
+
+    ~EXRStripWriter() {
+        delete m_file;
+    }
+
+    /// Append \c lines scanlines (starting at row \c y) from \c buffer
+    void write(int y, int lines, const float *buffer) {
+        size_t xStride = sizeof(float) * m_channels.size(),
+               yStride = xStride * m_size.x;
+        char *base = reinterpret_cast<char *>(const_cast<float *>(buffer))
+            - m_offset.x * (ptrdiff_t) xStride - (m_offset.y + y) * (ptrdiff_t) yStride;
+
+        Imf::FrameBuffer frameBuffer;
+        for (size_t i=0; i<m_channels.size(); ++i)
+            frameBuffer.insert(m_channels[i].c_str(), Imf::Slice(Imf::FLOAT,
+                base + i * sizeof(float), xStride, yStride));
+        m_file->setFrameBuffer(frameBuffer);
+        m_file->writePixels(lines);
+    }
+
+private:
+    std::vector<std::string> m_channels;
+    Imf::OutputFile *m_file;
+    Point2i m_offset;
+    Vector2i m_size;
+};
+
+/// Return the "largest" pixel type used by the channels of an image
+inline Imf::PixelType getPixelType(const Imf::Header &header) {
+    Imf::PixelType type = Imf::HALF;
+    const Imf::ChannelList &channels = header.channels();
+    for (Imf::ChannelList::ConstIterator it = channels.begin(); it != channels.end(); ++it) {
+        if (it.channel().type == Imf::FLOAT)
+            type = Imf::FLOAT;
+        else if (it.channel().type == Imf::UINT && type == Imf::HALF)
+            type = Imf::UINT;
+    }
+    return type;
+}
+
+#endif
+
+/**
+ * \brief Run \c job on every element of \c jobs, optionally on several
+ * threads, and report the errors at the end
+ *
+ * \return The number of failed jobs
+ */
+template <typename Functor> int runJobs(
+        const std::vector<std::vector<std::string> > &jobs,
+        bool parallel, const Functor &job) {
+    ref<Logger> logger = Thread::getThread()->getLogger();
+    ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
+    std::vector<std::string> messages;
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic) if (parallel)
+    #endif
+    for (int i=0; i<(int) jobs.size(); ++i) {
+        Thread *thread = Thread::getThread();
+        if (!thread) {
+            thread = Thread::registerUnmanagedThread("omp");
+            thread->setLogger(logger);
+            thread->setFileResolver(fileResolver);
+        }
+        try {
+            job(jobs[i]);
+        } catch (const std::exception &e) {
+            #if defined(MTS_OPENMP)
+                #pragma omp critical
+            #endif
+            messages.push_back(e.what());
+        }
+    }
+    for (size_t i=0; i<messages.size(); ++i)
+        SLog(EWarn, "Error %i: %s", (int) i, messages[i].c_str());
+    return (int) messages.size();
+}
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_UTILS_IMGSTREAM_H_ */
@@ -17,43 +17,122 @@
 */
 
 #include <mitsuba/render/util.h>
-#include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/core/fresolver.h>
+#if defined(WIN32)
+# include <mitsuba/core/getopt.h>
+#endif
+#include "imgstream.h"
 
 MTS_NAMESPACE_BEGIN
 
 class JoinRGB : public Utility {
 public:
-    void joinRGB(const std::string &s1, const std::string &s2, const std::string &s3, const std::string &s4) {
-        ref<FileStream> rFile   = new FileStream(s1, FileStream::EReadOnly);
-        ref<FileStream> gFile   = new FileStream(s2, FileStream::EReadOnly);
-        ref<FileStream> bFile   = new FileStream(s3, FileStream::EReadOnly);
-
-        ref<Bitmap> rBitmap = new Bitmap(Bitmap::EOpenEXR, rFile);
-        ref<Bitmap> gBitmap = new Bitmap(Bitmap::EOpenEXR, gFile);
-        ref<Bitmap> bBitmap = new Bitmap(Bitmap::EOpenEXR, bFile);
-        rBitmap = rBitmap->extractChannel(0);
-        gBitmap = gBitmap->extractChannel(0);
-        bBitmap = bBitmap->extractChannel(0);
-
-        std::vector<Bitmap *> sourceBitmaps;
-        sourceBitmaps.push_back(rBitmap);
-        sourceBitmaps.push_back(gBitmap);
-        sourceBitmaps.push_back(bBitmap);
-
-        ref<Bitmap> result = Bitmap::join(Bitmap::ERGBA, sourceBitmaps);
-        ref<FileStream> outFile = new FileStream(s4, FileStream::ETruncReadWrite);
-        result->write(Bitmap::EOpenEXR, outFile);
+    /// Joins the first channels of three images in strips of scanlines
+    struct JoinJob {
+        void operator()(const std::vector<std::string> &paths) const {
+            const FileResolver *resolver = Thread::getThread()->getFileResolver();
+            EXRStripReader *inputs[3];
+            std::string sourceChannel[3];
+            for (int i=0; i<3; ++i)
+                inputs[i] = NULL;
+
+            try {
+                for (int i=0; i<3; ++i) {
+                    inputs[i] = new EXRStripReader(resolver->resolve(paths[i]).string());
+                    /* Use the luminance or red channel if present, or else the first one */
+                    std::vector<std::string> names = inputs[i]->getChannelNames();
+                    if (names.empty())
+                        SLog(EError, "\"%s\" has no channels!", paths[i].c_str());
+                    sourceChannel[i] = names[0];
+                    for (size_t j=0; j<names.size(); ++j) {
+                        if (names[j] == "Y" || names[j] == "R") {
+                            sourceChannel[i] = names[j];
+                            break;
+                        }
+                    }
+                    if (inputs[i]->getSize() != inputs[0]->getSize() ||
+                        inputs[i]->getOffset() != inputs[0]->getOffset())
+                        SLog(EError, "Error: Input bitmaps have a different size!");
+                }
+
+                std::vector<std::string> channels;
+                channels.push_back("R"); channels.push_back("G"); channels.push_back("B");
+                SLog(EInfo, "Writing \"%s\" ..", paths[3].c_str());
+                EXRStripWriter out(paths[3], inputs[0]->getHeader(), channels,
+                    getPixelType(inputs[0]->getHeader()));
+
+                const Vector2i &size = inputs[0]->getSize();
+                size_t stripPixels = (size_t) size.x * IMGSTREAM_STRIP_LINES;
+                std::vector<float> source(stripPixels), result(stripPixels * 3);
+
+                for (int y=0; y<size.y; y += IMGSTREAM_STRIP_LINES) {
+                    int lines = std::min(IMGSTREAM_STRIP_LINES, size.y - y);
+                    size_t pixels = (size_t) size.x * lines;
+                    for (int i=0; i<3; ++i) {
+                        inputs[i]->read(y, lines, std::vector<std::string>(1, sourceChannel[i]), &source[0]);
+                        for (size_t j=0; j<pixels; ++j)
+                            result[3*j + i] = source[j];
+                    }
+                    out.write(y, lines, &result[0]);
+                }
+            } catch (...) {
+                for (int i=0; i<3; ++i)
+                    delete inputs[i];
+                throw;
+            }
+            for (int i=0; i<3; ++i)
+                delete inputs[i];
+        }
+    };
+
+    void help() {
+        cout << "Join three monochromatic images into a RGB-valued EXR file" << endl;
+        cout << "Syntax: mtsutil joinrgb [options] <red.exr> <green.exr> <blue.exr> <combined.exr>" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -R first:last[:step]" << endl;
+        cout << "                  Process a frame sequence: runs of '#' in the file names" << endl;
+        cout << "                  are replaced by the zero-padded frame numbers" << endl << endl;
+        cout << "   -t             Multithreaded: process several frames in parallel" << endl << endl;
+        cout << " Without -R, a '*' in the file name of the red image selects all matching" << endl;
+        cout << " files. The text matched by it replaces the '*' of the other paths." << endl;
+        cout << " Images are streamed in strips of scanlines." << endl;
     }
 
     int run(int argc, char **argv) {
-        if (argc < 5) {
-            cout << "Join three monochromatic images into a RGB-valued EXR file" << endl;
-            cout << "joinrgb <red.exr> <green.exr> <blue.exr> <combined.exr>" << endl;
-        } else {
-            joinRGB(argv[1], argv[2], argv[3], argv[4]);
+        int optchar;
+        optind = 1;
+        std::string range;
+        bool runParallel = false;
+
+        while ((optchar = getopt(argc, argv, "htR:")) != -1) {
+            switch (optchar) {
+                case 'h':
+                    help();
+                    return 0;
+                case 't':
+                    runParallel = true;
+                    break;
+                case 'R':
+                    range = optarg;
+                    break;
+                default:
+                    help();
+                    return -1;
+            }
         }
-        return 0;
+
+        if (argc - optind != 4) {
+            help();
+            return 0;
+        }
+
+        std::vector<std::string> paths(argv + optind, argv + argc);
+        std::vector<std::vector<std::string> > jobs = expandJobs(paths, range);
+        if (jobs.size() > 1)
+            Log(EInfo, "Joining the images of " SIZE_T_FMT " frames ..", jobs.size());
+        return runJobs(jobs, runParallel, JoinJob()) == 0 ? 0 : -1;
     }
 
     MTS_DECLARE_UTILITY()
@@ -27,14 +27,78 @@
 
 MTS_NAMESPACE_BEGIN
 
+/// Ray types traced by the benchmark
+enum ERayMode {
+    ECoherent = 0,
+    EIncoherent,
+    EShadow,
+    EAll,
+    EModeCount
+};
+
+static const char *rayModeNames[] = {
+    "coherent", "incoherent", "shadow", "all"
+};
+
+/// Traces a contiguous range of a batch of rays
+class TraversalThread : public Thread {
+public:
+    TraversalThread(int id, ERayMode mode, const Scene *scene,
+            const ShapeKDTree *kdtree, const std::vector<Ray> &rays,
+            size_t start, size_t end)
+        : Thread(formatString("trav%i", id)), m_mode(mode), m_scene(scene),
+          m_kdtree(kdtree), m_rays(rays), m_start(start), m_end(end),
+          m_hits(0) {
+        setCritical(true);
+    }
+
+    void run() {
+        Intersection its;
+        size_t hits = 0;
+
+        switch (m_mode) {
+            case EShadow:
+                for (size_t i=m_start; i<m_end; ++i) {
+                    if (m_kdtree->rayIntersect(m_rays[i]))
+                        ++hits;
+                }
+                break;
+            case EAll:
+                for (size_t i=m_start; i<m_end; ++i) {
+                    if (m_scene->rayIntersectAll(m_rays[i], its))
+                        ++hits;
+                }
+                break;
+            default:
+                for (size_t i=m_start; i<m_end; ++i) {
+                    if (m_kdtree->rayIntersect(m_rays[i], its))
+                        ++hits;
+                }
+                break;
+        }
+        m_hits = hits;
+    }
+
+    /// Return the number of rays that hit something
+    inline size_t getHitCount() const { return m_hits; }
+
+private:
+    ERayMode m_mode;
+    const Scene *m_scene;
+    const ShapeKDTree *m_kdtree;
+    const std::vector<Ray> &m_rays;
+    size_t m_start, m_end, m_hits;
+};
+
 class KDBench : public Utility {
 public:
     void help() {
         cout << endl;
-        cout << "Synopsis: kd-tree performance benchmark. Traces uniformly distributed rays" << endl;
-        cout << "though the bounding sphere of a scene and reports the resulting number of" << endl;
-        cout << "rays per second. The main intent of this utility is to optimize the kd-tree" << endl;
-        cout << "construction parameters for particular scenes and machines." << endl;
+        cout << "Synopsis: kd-tree performance benchmark. Traces coherent, incoherent and" << endl;
+        cout << "shadow rays through a scene using different numbers of threads and reports" << endl;
+        cout << "the resulting number of rays per second. The main intent of this utility is" << endl;
+        cout << "to optimize the kd-tree construction parameters for particular scenes and" << endl;
+        cout << "machines." << endl;
         cout << endl;
         cout << "Usage: mtsutil kdbench [options] <Scene XML file or PLY file>" << endl;
         cout << "Options/Arguments:" << endl;
@@ -55,6 +119,18 @@ public:
         cout << "                  optimization method." << endl << endl;
         cout << "   -f             Try to empirically find the best SAH cost values by" << endl;
         cout << "                  fitting the cost model to collected performance data" << endl << endl;
+        cout << "   -s             Rebuild the tree both in parallel and serially and report" << endl;
+        cout << "                  the construction speedup" << endl << endl;
+        cout << "   -m modes       Comma-separated list of ray types to trace (default: all):" << endl;
+        cout << "                    coherent   : camera rays in scanline order" << endl;
+        cout << "                    incoherent : uniformly distributed rays through the" << endl;
+        cout << "                                 bounding sphere" << endl;
+        cout << "                    shadow     : occlusion queries between surface points" << endl;
+        cout << "                    all        : Scene::rayIntersectAll(), which also visits" << endl;
+        cout << "                                 the special shapes (XML scenes only)" << endl << endl;
+        cout << "   -T threads     Comma-separated list of thread counts to trace with" << endl;
+        cout << "                  (default: 1 and the number of cores)" << endl << endl;
+        cout << "   -n count       Number of rays per ray type (default: 2000000)" << endl << endl;
         cout << "Examples:" << endl;
         cout << "  E.g. to build a tree for the Stanford bunny having a low SAH cost, type " << endl << endl;
         cout << "  $ mtsutil kdbench -e .9 -l1 -d48 -x100000 data/tests/bunny.ply" << endl << endl;
@@ -71,10 +147,14 @@ public:
         Float intersectionCost = -1, traversalCost = -1, emptySpaceBonus = -1;
         int stopPrims = -1, maxDepth = -1, exactPrims = -1, minMaxBins = -1;
         bool clip = true, parallel = true, retract = true, fitParameters = false;
+        bool compareBuild = false;
+        size_t nRays = 2000000;
+        std::vector<std::string> modes;
+        std::vector<int> threadCounts;
         optind = 1;
 
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:hf")) != -1) {
+        while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:m:T:n:hfs")) != -1) {
             switch (optchar) {
                 case 'h': {
                         help();
@@ -84,6 +164,30 @@ public:
                 case 'f':
                     fitParameters = true;
                     break;
+                case 's':
+                    compareBuild = true;
+                    break;
+                case 'm':
+                    boost::split(modes, optarg, boost::is_any_of(","));
+                    for (size_t i=0; i<modes.size(); ++i)
+                        parseMode(modes[i]);
+                    break;
+                case 'T': {
+                        std::vector<std::string> tokens;
+                        boost::split(tokens, optarg, boost::is_any_of(","));
+                        for (size_t i=0; i<tokens.size(); ++i) {
+                            int count = strtol(tokens[i].c_str(), &end_ptr, 10);
+                            if (*end_ptr != '\0' || count <= 0)
+                                SLog(EError, "Could not parse the thread counts!");
+                            threadCounts.push_back(count);
+                        }
+                    }
+                    break;
+                case 'n':
+                    nRays = (size_t) strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || nRays == 0)
+                        SLog(EError, "Could not parse the ray count!");
+                    break;
                 case 'i':
                     intersectionCost = (Float) strtod(optarg, &end_ptr);
                     if (*end_ptr != '\0')
@@ -151,6 +255,14 @@ public:
             return 0;
         }
 
+        if (modes.empty())
+            boost::split(modes, "coherent,incoherent,shadow,all", boost::is_any_of(","));
+        if (threadCounts.empty()) {
+            threadCounts.push_back(1);
+            if (getCoreCount() > 1)
+                threadCounts.push_back(getCoreCount());
+        }
+
         ref<Scene> scene;
         ref<ShapeKDTree> kdtree;
 
@@ -202,44 +314,74 @@ public:
         logger->setLogLevel(EDebug);
         formatter->setHaveDate(false);
 
+        ref<Timer> buildTimer = new Timer();
         if (scene)
             scene->initialize();
         else
             kdtree->build();
+        Log(EInfo, "%s took %i ms", scene ? "Scene initialization" : "kd-tree construction",
+            buildTimer->getMilliseconds());
 
-        BSphere bsphere(kdtree->getAABB().getBSphere());
-        const size_t nRays = 5000000;
+        if (compareBuild) {
+            /* Construct two more trees with identical settings to
+               measure the benefit of the parallel construction */
+            const std::vector<const Shape *> &shapes = kdtree->getShapes();
+            int timings[2];
+            for (int i=0; i<2; ++i) {
+                ref<ShapeKDTree> tree = new ShapeKDTree();
+                for (size_t j=0; j<shapes.size(); ++j)
+                    tree->addShape(shapes[j]);
+                tree->setQueryCost(kdtree->getQueryCost());
+                tree->setTraversalCost(kdtree->getTraversalCost());
+                tree->setEmptySpaceBonus(kdtree->getEmptySpaceBonus());
+                tree->setStopPrims(kdtree->getStopPrims());
+                tree->setMaxDepth(kdtree->getMaxDepth());
+                tree->setExactPrimitiveThreshold(kdtree->getExactPrimitiveThreshold());
+                tree->setMinMaxBins(kdtree->getMinMaxBins());
+                tree->setClip(kdtree->getClip());
+                tree->setRetract(kdtree->getRetract());
+                tree->setParallelBuild(i == 0);
+                tree->setLogLevel(ETrace);
+
+                buildTimer->reset();
+                tree->build();
+                timings[i] = buildTimer->getMilliseconds();
+            }
+            Log(EInfo, "kd-tree construction: %i ms (parallel, %i cores), "
+                "%i ms (serial) -> speedup: %.2fx", timings[0], getCoreCount(),
+                timings[1], timings[1] / (Float) std::max(timings[0], 1));
+            Log(EInfo, "");
+        }
 
         if (!fitParameters) {
+            BSphere bsphere(kdtree->getAABB().getBSphere());
             Log(EInfo, "Bounding sphere: %s", bsphere.toString().c_str());
-            Float best = 0;
-            for (int j=0; j<3; ++j) {
-                ref<Random> random = new Random();
-                ref<Timer> timer = new Timer();
-                size_t nIntersections = 0;
-
-                Log(EInfo, "Shooting " SIZE_T_FMT " rays (1 thread, incoherent) ..", nRays);
-
-                for (size_t i=0; i<nRays; ++i) {
-                    Point2 sample1(random->nextFloat(), random->nextFloat()),
-                        sample2(random->nextFloat(), random->nextFloat());
-                    Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
-                    Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
-                    Ray r(p1, normalize(p2-p1), 0.0f);
-
-                    Intersection its;
-                    if (kdtree->rayIntersect(r, its))
-                        nIntersections++;
+
+            for (size_t i=0; i<modes.size(); ++i) {
+                ERayMode mode = parseMode(modes[i]);
+                if (mode == EAll && !scene) {
+                    Log(EWarn, "Skipping the \"all\" rays, which require an XML scene");
+                    continue;
                 }
 
-                Log(EInfo, "Found " SIZE_T_FMT " intersections in %i ms",
-                    nIntersections, timer->getMilliseconds());
-                Float mrays = nRays / (timer->getMilliseconds() * (Float) 1000);
-                Log(EInfo, "-> %.3f MRays/s", mrays);
+                std::vector<Ray> rays;
+                generateRays(mode, scene, kdtree, nRays, rays);
+                Log(EInfo, "Shooting " SIZE_T_FMT " %s rays ..", rays.size(), modes[i].c_str());
+
+                for (size_t j=0; j<threadCounts.size(); ++j) {
+                    Float best = 0;
+                    size_t nHits = 0;
+                    for (int k=0; k<3; ++k) {
+                        Float seconds = traceRays(mode, scene, kdtree,
+                            rays, threadCounts[j], nHits);
+                        best = std::max(best, rays.size() / (seconds * (Float) 1e6));
+                    }
+                    Log(EInfo, "  %2i thread%s: %8.3f MRays/s (best of three, "
+                        SIZE_T_FMT " %s)", threadCounts[j], threadCounts[j] > 1 ? "s" : " ",
+                        best, nHits, mode == EShadow ? "occluded" : "hits");
+                }
                 Log(EInfo, "");
-                best = std::max(best, mrays);
             }
-            Log(EInfo, "Best of three: %.3f MRays/s", best);
         } else {
             Float intersectionCost, traversalCost;
             kdtree->findCosts(intersectionCost, traversalCost);
@@ -249,6 +391,103 @@ public:
         return 0;
     }
 
+    static ERayMode parseMode(const std::string &name) {
+        for (int i=0; i<EModeCount; ++i) {
+            if (name == rayModeNames[i])
+                return (ERayMode) i;
+        }
+        SLog(EError, "Unknown ray type \"%s\"!", name.c_str());
+        return EModeCount;
+    }
+
+    /// Generate a batch of rays of the given type
+    void generateRays(ERayMode mode, const Scene *scene, const ShapeKDTree *kdtree,
+            size_t nRays, std::vector<Ray> &rays) {
+        ref<Random> random = new Random();
+        BSphere bsphere(kdtree->getAABB().getBSphere());
+
+        if (mode == ECoherent) {
+            const Sensor *sensor = scene ? scene->getSensor() : NULL;
+            Vector2i size = sensor ? sensor->getFilm()->getCropSize() : Vector2i(512);
+            size_t pixelCount = (size_t) size.x * (size_t) size.y;
+
+            /* Without a sensor, look at the scene from a distance */
+            Transform toWorld = Transform::lookAt(
+                bsphere.center - Vector(0, 0, 3 * bsphere.radius),
+                bsphere.center, Vector(0, 1, 0));
+            Float invWidth = 1 / (Float) size.x, invHeight = 1 / (Float) size.y;
+
+            rays.resize(nRays);
+            for (size_t i=0; i<nRays; ++i) {
+                size_t pixel = i % pixelCount;
+                Point2 samplePos(
+                    (Float) (pixel % size.x) + random->nextFloat(),
+                    (Float) (pixel / size.x) + random->nextFloat());
+                if (sensor) {
+                    Point2 apertureSample(random->nextFloat(), random->nextFloat());
+                    sensor->sampleRay(rays[i], samplePos, apertureSample, 0.5f);
+                } else {
+                    Vector d(0.8f * (1 - 2 * samplePos.x * invWidth),
+                        0.8f * (1 - 2 * samplePos.y * invHeight), 2.0f);
+                    rays[i] = Ray(toWorld(Point(0.0f)), normalize(toWorld(d)), 0.0f);
+                }
+            }
+        } else if (mode == EShadow) {
+            /* Connect pairs of surface points found by incoherent rays */
+            std::vector<Ray> probes;
+            std::vector<Point> points;
+            generateRays(EIncoherent, scene, kdtree, std::min(nRays, (size_t) 100000), probes);
+            for (size_t i=0; i<probes.size(); ++i) {
+                Intersection its;
+                if (kdtree->rayIntersect(probes[i], its))
+                    points.push_back(its.p);
+            }
+            rays.clear();
+            if (points.size() < 2)
+                return;
+            rays.reserve(nRays);
+            for (size_t i=0; i<nRays; ++i) {
+                const Point &p1 = points[i % points.size()];
+                const Point &p2 = points[std::min(points.size() - 1,
+                    (size_t) (random->nextFloat() * points.size()))];
+                Vector d = p2 - p1;
+                Float length = d.length();
+                if (length == 0)
+                    continue;
+                rays.push_back(Ray(p1, d / length, Epsilon,
+                    length * (1 - ShadowEpsilon), 0.0f));
+            }
+        } else {
+            rays.resize(nRays);
+            for (size_t i=0; i<nRays; ++i) {
+                Point2 sample1(random->nextFloat(), random->nextFloat()),
+                    sample2(random->nextFloat(), random->nextFloat());
+                Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+                Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+                rays[i] = Ray(p1, normalize(p2-p1), 0.0f);
+            }
+        }
+    }
+
+    /// Trace a batch of rays using the given number of threads, returns the time in seconds
+    Float traceRays(ERayMode mode, const Scene *scene, const ShapeKDTree *kdtree,
+            const std::vector<Ray> &rays, int nThreads, size_t &nHits) {
+        ref_vector<TraversalThread> threads;
+        for (int i=0; i<nThreads; ++i)
+            threads.push_back(new TraversalThread(i, mode, scene, kdtree, rays,
+                rays.size() * i / nThreads, rays.size() * (i+1) / nThreads));
+
+        ref<Timer> timer = new Timer();
+        for (int i=0; i<nThreads; ++i)
+            threads[i]->start();
+        nHits = 0;
+        for (int i=0; i<nThreads; ++i) {
+            threads[i]->join();
+            nHits += threads[i]->getHitCount();
+        }
+        return std::max(timer->getSeconds(), (Float) 1e-6f);
+    }
+
     MTS_DECLARE_UTILITY()
 };
 
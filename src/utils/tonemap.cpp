@@ -29,6 +29,7 @@
 #ifdef MTS_OPENMP
 # include <omp.h>
 #endif
+#include "imgstream.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -59,11 +60,16 @@ public:
         cout << "                  processed in order to compute a point spread function." << endl << endl;
         cout << "   -x             Temporal coherence mode: activate this flag when tonemapping " << endl;
         cout << "                  frames of an animation using the '-p' option to avoid flicker" << endl << endl;
-        cout << "   -o file        Save the output with a given filename" << endl << endl;
+        cout << "   -o file        Save the output with a given filename. When processing a" << endl;
+        cout << "                  sequence, it may contain '#' or '*' like the inputs" << endl << endl;
+        cout << "   -R first:last[:step]" << endl;
+        cout << "                  Process a frame sequence: runs of '#' in the file names" << endl;
+        cout << "                  are replaced by the zero-padded frame numbers" << endl << endl;
         cout << "   -t             Multithreaded: process several files in parallel" << endl << endl;
         cout << " The operations are ordered as follows: 1. crop, 2. bloom, 3. resize, 4. color" << endl;
         cout << " balance, 5. tonemap, 6. annotate. To simply process a directory full of EXRs" << endl;
         cout << " in parallel, run the following: 'mtsutil tonemap -t path-to-directory/*.exr'" << endl;
+        cout << " (wildcards in the file names are also expanded by the tonemapper itself)." << endl;
     }
 
     typedef struct {
@@ -130,9 +136,10 @@ public:
         ReconstructionFilter *rfilter = NULL;
         Float bloomFov = 0;
         std::string rfilterName = "lanczos";
+        std::string range;
 
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "htxag:m:f:r:b:c:o:p:s:B:F:")) != -1) {
+        while ((optchar = getopt(argc, argv, "htxag:m:f:r:b:c:o:p:s:B:F:R:")) != -1) {
             switch (optchar) {
                 case 'h': {
                         help();
@@ -257,6 +264,24 @@ public:
                 case 't':
                     runParallel = true;
                     break;
+
+                case 'R':
+                    range = optarg;
+                    break;
+            }
+        }
+
+        /* Expand frame ranges and wildcards into pairs of input and output files */
+        bool outputPattern = outputFilename.find_first_of("#*") != std::string::npos;
+        std::vector<std::string> inputFiles, outputFiles;
+        for (int i=optind; i<argc; ++i) {
+            std::vector<std::string> paths(1, argv[i]);
+            if (outputPattern)
+                paths.push_back(outputFilename);
+            std::vector<std::vector<std::string> > jobs = expandJobs(paths, range);
+            for (size_t j=0; j<jobs.size(); ++j) {
+                inputFiles.push_back(jobs[j][0]);
+                outputFiles.push_back(outputPattern ? jobs[j][1] : outputFilename);
             }
         }
 
@@ -264,7 +289,7 @@ public:
             Log(EError, "Bloom field of view value must be between 0 and 180!");
 
         if (runParallel) {
-            if (outputFilename != "" || temporalCoherence) {
+            if ((outputFilename != "" && !outputPattern) || temporalCoherence) {
                 Log(EWarn, "Requested multithreaded tonemapping along with incompatible options, disabling threading..");
                 runParallel = false;
             } else {
@@ -272,7 +297,7 @@ public:
             }
         }
 
-        if (optind == argc) {
+        if (inputFiles.empty()) {
             help();
             return 0;
         }
@@ -294,14 +319,14 @@ public:
             #if defined(MTS_OPENMP)
                 #pragma omp parallel for schedule(static)
             #endif
-            for (int i=optind; i<argc; ++i) {
+            for (int i=0; i<(int) inputFiles.size(); ++i) {
                 Thread *thread = Thread::getThread();
                 if (!thread) {
                     thread = Thread::registerUnmanagedThread("omp");
                     thread->setLogger(logger);
                 }
                 try {
-                    fs::path inputFile = fileResolver->resolve(argv[i]);
+                    fs::path inputFile = fileResolver->resolve(inputFiles[i]);
                     Log(EInfo, "Loading image \"%s\" ..", inputFile.string().c_str());
                     ref<FileStream> is = new FileStream(inputFile, FileStream::EReadOnly);
                     ref<Bitmap> input = new Bitmap(Bitmap::EAuto, is);
@@ -345,7 +370,9 @@ public:
                     }
 
                     fs::path outputFile = inputFile;
-                    if (format == Bitmap::EPNG)
+                    if (outputFiles[i] != "")
+                        outputFile = outputFiles[i];
+                    else if (format == Bitmap::EPNG)
                         outputFile.replace_extension(".png");
                     else if (format == Bitmap::EJPEG)
                         outputFile.replace_extension(".jpg");
@@ -368,8 +395,8 @@ public:
             }
         } else {
             ref<Bitmap> bloomFilter;
-            for (int i=optind; i<argc; ++i) {
-                fs::path inputFile = fileResolver->resolve(argv[i]);
+            for (int i=0; i<(int) inputFiles.size(); ++i) {
+                fs::path inputFile = fileResolver->resolve(inputFiles[i]);
                 Log(EInfo, "Loading image \"%s\" ..", inputFile.string().c_str());
                 ref<FileStream> is = new FileStream(inputFile, FileStream::EReadOnly);
                 ref<Bitmap> input = new Bitmap(Bitmap::EAuto, is);
@@ -417,7 +444,7 @@ public:
                 }
 
                 fs::path outputFile = inputFile;
-                if (outputFilename == "") {
+                if (outputFiles[i] == "") {
                     if (format == Bitmap::EPNG)
                         outputFile.replace_extension(".png");
                     else if (format == Bitmap::EJPEG)
@@ -425,7 +452,7 @@ public:
                     else
                         Log(EError, "Unknown target format!");
                 } else {
-                    outputFile = outputFilename;
+                    outputFile = outputFiles[i];
                 }
 
                 Log(EInfo, "Writing tonemapped image to \"%s\" ..", outputFile.string().c_str());
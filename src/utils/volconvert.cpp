@@ -0,0 +1,490 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/half.h>
+#include <boost/algorithm/string.hpp>
+#if defined(WIN32)
+# include <mitsuba/core/getopt.h>
+#endif
+
+/// Log2 of the brick resolution of tiled files (must match the 'sparsevolume' plugin)
+#define VOLCONVERT_BRICK_SHIFT 3
+#define VOLCONVERT_BRICK_RES (1 << VOLCONVERT_BRICK_SHIFT)
+#define VOLCONVERT_BRICK_SIZE (VOLCONVERT_BRICK_RES * VOLCONVERT_BRICK_RES * VOLCONVERT_BRICK_RES)
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * Converts volume data files between the encodings supported by the
+ * 'gridvolume' plugin and writes tiled files for the 'sparsevolume' plugin.
+ */
+class VolumeConverter : public Utility {
+public:
+    /// Storage formats (same numbering as the dense file format)
+    enum EFormat {
+        EFloat32 = 1,
+        EFloat16 = 2,
+        EUInt8 = 3
+    };
+
+    /// A dense volume that has been expanded into single precision
+    struct Volume {
+        Vector3i res;
+        int channels;
+        float bbox[6];
+        std::vector<float> data;
+
+        inline float get(int x, int y, int z, int c) const {
+            if (x >= res.x || y >= res.y || z >= res.z)
+                return 0.0f;
+            return data[(((size_t) z * res.y + y) * res.x + x) * channels + c];
+        }
+    };
+
+    void help() {
+        cout << endl;
+        cout << "Synopsis: Converts, quantizes and tiles volume data files" << endl;
+        cout << endl;
+        cout << "Usage: mtsutil volconvert [options] <input.vol> <output.vol>" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -f format      Output encoding: float32, float16 or uint8 (Default: float32)" << endl << endl;
+        cout << "   -t             Write a tiled file for the 'sparsevolume' plugin: the data" << endl;
+        cout << "                  is split into bricks of 8^3 voxels, which are stored in" << endl;
+        cout << "                  Morton order. With the uint8 encoding, each brick is" << endl;
+        cout << "                  quantized relative to its own value range." << endl << endl;
+        cout << "   -e threshold   Tiled files only: bricks whose values all lie below or at" << endl;
+        cout << "                  this threshold are discarded (Default: 0)" << endl << endl;
+        cout << "   -b size        Dense files only: store the data in bricks of 2^size voxels" << endl;
+        cout << "                  along each axis, which improves the memory locality of" << endl;
+        cout << "                  lookups (e.g. 2 or 3, Default: 0, i.e. the linear layout)" << endl << endl;
+        cout << " Without -t, a dense file in the format of the 'gridvolume' plugin is written." << endl;
+        cout << " In this case, uint8 data represents the range [0, 1] and larger values are" << endl;
+        cout << " clamped. The introduced error is reported in both cases." << endl;
+    }
+
+    /// Load a dense volume data file (float32, float16 or uint8 encoding)
+    void load(const fs::path &filename, Volume &vol) {
+        ref<MemoryMappedFile> mmap = new MemoryMappedFile(filename);
+        ref<MemoryStream> stream = new MemoryStream(mmap->getData(), mmap->getSize());
+        stream->setByteOrder(Stream::ELittleEndian);
+
+        char header[3];
+        stream->read(header, 3);
+        if (header[0] != 'V' || header[1] != 'O' || header[2] != 'L')
+            Log(EError, "Encountered an invalid volume data file "
+                "(incorrect header identifier)");
+        uint8_t version;
+        stream->read(&version, 1);
+        if (version != 3)
+            Log(EError, "Encountered an invalid volume data file "
+                "(incorrect file version, only dense files can be converted)");
+        int type = stream->readInt();
+        int brickShift = (type >> 8) & 0xFF;
+        type &= 0xFF;
+        vol.res.x = stream->readInt();
+        vol.res.y = stream->readInt();
+        vol.res.z = stream->readInt();
+        vol.channels = stream->readInt();
+        stream->readSingleArray(vol.bbox, 6);
+
+        if (type != EFloat32 && type != EFloat16 && type != EUInt8)
+            Log(EError, "Encountered an unsupported volume data file (type=%i)", type);
+
+        std::vector<size_t> offsets[3];
+        size_t storageSize = computeLayout(vol.res, brickShift, offsets) * vol.channels;
+        size_t bytesPerValue = type == EFloat32 ? 4 : (type == EFloat16 ? 2 : 1);
+        if (mmap->getSize() < 48 + storageSize * bytesPerValue)
+            Log(EError, "Encountered a truncated volume data file!");
+
+        vol.data.resize((size_t) vol.res.x * (size_t) vol.res.y
+            * (size_t) vol.res.z * vol.channels);
+        const uint8_t *data = (const uint8_t *) mmap->getData() + 48;
+        size_t i = 0;
+        for (int z=0; z<vol.res.z; ++z) {
+            for (int y=0; y<vol.res.y; ++y) {
+                for (int x=0; x<vol.res.x; ++x) {
+                    size_t offset = (offsets[0][x] + offsets[1][y] + offsets[2][z]) * vol.channels;
+                    for (int c=0; c<vol.channels; ++c, ++i) {
+                        switch (type) {
+                            case EFloat32: vol.data[i] = ((const float *) data)[offset + c]; break;
+                            case EFloat16: vol.data[i] = (float) ((const half *) data)[offset + c]; break;
+                            default:       vol.data[i] = data[offset + c] / 255.0f; break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * \brief Compute the per-axis storage offsets of the voxels for the
+     * linear (\c brickShift == 0) or bricked layout of the 'gridvolume'
+     * plugin and return the number of stored entries
+     */
+    static size_t computeLayout(const Vector3i &res, int brickShift,
+            std::vector<size_t> *offsets) {
+        const int brickRes = 1 << brickShift, brickMask = brickRes - 1;
+        const size_t brickSize = (size_t) brickRes * brickRes * brickRes;
+        size_t bricks[3], stride = brickSize;
+        for (int axis=0; axis<3; ++axis) {
+            bricks[axis] = (res[axis] + brickMask) >> brickShift;
+            offsets[axis].resize(res[axis]);
+            for (int i=0; i<res[axis]; ++i) {
+                size_t morton = 0;
+                for (int bit=0; bit<brickShift; ++bit)
+                    morton |= (size_t) (((i & brickMask) >> bit) & 1) << (3*bit + axis);
+                offsets[axis][i] = (i >> brickShift) * stride + morton;
+            }
+            stride *= bricks[axis];
+        }
+        return bricks[0] * bricks[1] * bricks[2] * brickSize;
+    }
+
+    /// Write the header that is shared by the dense and tiled formats
+    void writeHeader(Stream *stream, int version, int type, const Volume &vol) {
+        stream->write("VOL", 3);
+        uint8_t v = (uint8_t) version;
+        stream->write(&v, 1);
+        stream->writeInt(type);
+        stream->writeInt(vol.res.x);
+        stream->writeInt(vol.res.y);
+        stream->writeInt(vol.res.z);
+        stream->writeInt(vol.channels);
+        stream->writeSingleArray(vol.bbox, 6);
+    }
+
+    /**
+     * \brief Write a dense file in the format of the 'gridvolume'
+     * plugin and return the decoded values
+     */
+    void writeDense(Stream *stream, EFormat format, int brickShift,
+            const Volume &vol, std::vector<float> &decoded) {
+        writeHeader(stream, 3, format | (brickShift << 8), vol);
+
+        std::vector<size_t> offsets[3];
+        size_t storageSize = computeLayout(vol.res, brickShift, offsets) * vol.channels;
+        size_t bytesPerValue = format == EFloat32 ? 4 : (format == EFloat16 ? 2 : 1);
+        std::vector<uint8_t> buffer(storageSize * bytesPerValue, 0);
+        decoded.resize(vol.data.size());
+        size_t clamped = 0, i = 0;
+
+        for (int z=0; z<vol.res.z; ++z) {
+            for (int y=0; y<vol.res.y; ++y) {
+                for (int x=0; x<vol.res.x; ++x) {
+                    size_t offset = (offsets[0][x] + offsets[1][y] + offsets[2][z]) * vol.channels;
+                    for (int c=0; c<vol.channels; ++c, ++i) {
+                        float value = vol.data[i];
+                        switch (format) {
+                            case EFloat32:
+                                ((float *) &buffer[0])[offset + c] = value;
+                                decoded[i] = value;
+                                break;
+                            case EFloat16: {
+                                    half h(value);
+                                    ((half *) &buffer[0])[offset + c] = h;
+                                    decoded[i] = (float) h;
+                                }
+                                break;
+                            default: {
+                                    if (value < 0 || value > 1)
+                                        ++clamped;
+                                    uint8_t q = (uint8_t) std::min(255, std::max(0,
+                                        (int) (value * 255.0f + 0.5f)));
+                                    buffer[offset + c] = q;
+                                    decoded[i] = q / 255.0f;
+                                }
+                                break;
+                        }
+                    }
+                }
+            }
+        }
+
+        /* Write the data with the stream's byte order */
+        if (format == EFloat32)
+            stream->writeSingleArray((const float *) &buffer[0], storageSize);
+        else if (format == EFloat16)
+            stream->writeUShortArray((const uint16_t *) &buffer[0], storageSize);
+        else
+            stream->write(&buffer[0], storageSize);
+
+        if (clamped > 0)
+            Log(EWarn, SIZE_T_FMT " values were outside of the range [0, 1] "
+                "representable by the dense uint8 encoding and have been clamped. "
+                "Consider writing a tiled file (-t) instead.", clamped);
+    }
+
+    /// Interleave the bits of three 21-bit integers
+    static inline uint64_t morton3D(uint32_t x, uint32_t y, uint32_t z) {
+        uint64_t result = 0;
+        for (int i=0; i<21; ++i) {
+            result |= ((uint64_t) ((x >> i) & 1) << (3*i))
+                    | ((uint64_t) ((y >> i) & 1) << (3*i + 1))
+                    | ((uint64_t) ((z >> i) & 1) << (3*i + 2));
+        }
+        return result;
+    }
+
+    /**
+     * \brief Write a tiled file for the 'sparsevolume' plugin and return
+     * the decoded values
+     *
+     * Format (little endian): the dense header with version 4, where
+     * the type field stores the encoding, followed by the brick shift
+     * (int32) and brick count (uint32), the dense brick index (uint32
+     * per brick position in x-major order, 0xFFFFFFFF denotes an empty
+     * brick), per-brick minima, scale factors and maxima (float32), and
+     * finally the brick data in Morton order.
+     */
+    void writeTiled(Stream *stream, EFormat format, Float threshold,
+            const Volume &vol, std::vector<float> &decoded) {
+        const Vector3i brickRes(
+            (vol.res.x + VOLCONVERT_BRICK_RES - 1) >> VOLCONVERT_BRICK_SHIFT,
+            (vol.res.y + VOLCONVERT_BRICK_RES - 1) >> VOLCONVERT_BRICK_SHIFT,
+            (vol.res.z + VOLCONVERT_BRICK_RES - 1) >> VOLCONVERT_BRICK_SHIFT);
+        const int valueCount = VOLCONVERT_BRICK_SIZE * vol.channels;
+
+        /* Find the occupied bricks and sort them along a Morton curve */
+        std::vector<std::pair<uint64_t, Vector3i> > bricks;
+        for (int bz=0; bz<brickRes.z; ++bz) {
+            for (int by=0; by<brickRes.y; ++by) {
+                for (int bx=0; bx<brickRes.x; ++bx) {
+                    bool empty = true;
+                    for (int lz=0; lz<VOLCONVERT_BRICK_RES && empty; ++lz)
+                        for (int ly=0; ly<VOLCONVERT_BRICK_RES && empty; ++ly)
+                            for (int lx=0; lx<VOLCONVERT_BRICK_RES && empty; ++lx)
+                                for (int c=0; c<vol.channels; ++c)
+                                    if (std::abs(vol.get((bx << VOLCONVERT_BRICK_SHIFT) + lx,
+                                          (by << VOLCONVERT_BRICK_SHIFT) + ly,
+                                          (bz << VOLCONVERT_BRICK_SHIFT) + lz, c)) > threshold)
+                                        empty = false;
+                    if (!empty)
+                        bricks.push_back(std::make_pair(morton3D(bx, by, bz),
+                            Vector3i(bx, by, bz)));
+                }
+            }
+        }
+        std::sort(bricks.begin(), bricks.end(), MortonOrder());
+
+        std::vector<uint32_t> index((size_t) brickRes.x * brickRes.y * brickRes.z, 0xFFFFFFFFu);
+        std::vector<float> brickMin(bricks.size()), brickScale(bricks.size()), brickMax(bricks.size());
+        std::vector<uint8_t> brickData;
+        size_t bytesPerValue = format == EFloat32 ? 4 : (format == EFloat16 ? 2 : 1);
+        brickData.resize(bricks.size() * valueCount * bytesPerValue);
+
+        /* Decoded values default to zero (i.e. discarded bricks) */
+        decoded.clear();
+        decoded.resize(vol.data.size(), 0.0f);
+
+        std::vector<float> values(valueCount);
+        for (size_t i=0; i<bricks.size(); ++i) {
+            const Vector3i &b = bricks[i].second;
+            index[((size_t) b.z * brickRes.y + b.y) * brickRes.x + b.x] = (uint32_t) i;
+
+            float minValue = std::numeric_limits<float>::infinity(),
+                  maxValue = -std::numeric_limits<float>::infinity();
+            int idx = 0;
+            for (int lz=0; lz<VOLCONVERT_BRICK_RES; ++lz) {
+                for (int ly=0; ly<VOLCONVERT_BRICK_RES; ++ly) {
+                    for (int lx=0; lx<VOLCONVERT_BRICK_RES; ++lx) {
+                        for (int c=0; c<vol.channels; ++c) {
+                            float value = vol.get((b.x << VOLCONVERT_BRICK_SHIFT) + lx,
+                                (b.y << VOLCONVERT_BRICK_SHIFT) + ly,
+                                (b.z << VOLCONVERT_BRICK_SHIFT) + lz, c);
+                            minValue = std::min(minValue, value);
+                            maxValue = std::max(maxValue, value);
+                            values[idx++] = value;
+                        }
+                    }
+                }
+            }
+
+            float scale = maxValue > minValue ? (maxValue - minValue) / 255.0f : 0.0f,
+                  invScale = scale > 0 ? 1.0f / scale : 0.0f;
+            uint8_t *target = &brickData[i * valueCount * bytesPerValue];
+            brickMin[i] = minValue;
+            brickScale[i] = scale;
+            brickMax[i] = 0.0f;
+
+            idx = 0;
+            for (int lz=0; lz<VOLCONVERT_BRICK_RES; ++lz) {
+                int z = (b.z << VOLCONVERT_BRICK_SHIFT) + lz;
+                for (int ly=0; ly<VOLCONVERT_BRICK_RES; ++ly) {
+                    int y = (b.y << VOLCONVERT_BRICK_SHIFT) + ly;
+                    for (int lx=0; lx<VOLCONVERT_BRICK_RES; ++lx) {
+                        int x = (b.x << VOLCONVERT_BRICK_SHIFT) + lx;
+                        for (int c=0; c<vol.channels; ++c, ++idx) {
+                            float value = values[idx], result;
+                            switch (format) {
+                                case EFloat32:
+                                    ((float *) target)[idx] = value;
+                                    result = value;
+                                    break;
+                                case EFloat16: {
+                                        half h(value);
+                                        ((half *) target)[idx] = h;
+                                        result = (float) h;
+                                    }
+                                    break;
+                                default: {
+                                        uint8_t q = (uint8_t) std::min(255, std::max(0,
+                                            (int) ((value - minValue) * invScale + 0.5f)));
+                                        target[idx] = q;
+                                        result = minValue + scale * q;
+                                    }
+                                    break;
+                            }
+                            brickMax[i] = std::max(brickMax[i], result);
+                            if (x < vol.res.x && y < vol.res.y && z < vol.res.z)
+                                decoded[(((size_t) z * vol.res.y + y) * vol.res.x + x)
+                                    * vol.channels + c] = result;
+                        }
+                    }
+                }
+            }
+        }
+
+        /* The tiled format numbers the encodings like the 'quantization' parameter */
+        int quantization = format == EFloat32 ? 0 : (format == EFloat16 ? 1 : 2);
+        writeHeader(stream, 4, quantization, vol);
+        stream->writeInt(VOLCONVERT_BRICK_SHIFT);
+        stream->writeUInt((uint32_t) bricks.size());
+        stream->writeUIntArray(&index[0], index.size());
+        if (!bricks.empty()) {
+            stream->writeSingleArray(&brickMin[0], bricks.size());
+            stream->writeSingleArray(&brickScale[0], bricks.size());
+            stream->writeSingleArray(&brickMax[0], bricks.size());
+            if (format == EFloat16) {
+                /* Write half-precision values with the stream's byte order */
+                const uint16_t *ptr = (const uint16_t *) &brickData[0];
+                stream->writeUShortArray(ptr, brickData.size() / 2);
+            } else if (format == EFloat32) {
+                stream->writeSingleArray((const float *) &brickData[0], brickData.size() / 4);
+            } else {
+                stream->write(&brickData[0], brickData.size());
+            }
+        }
+
+        cout << formatString("Stored " SIZE_T_FMT " of " SIZE_T_FMT " bricks (%.1f%%)",
+            bricks.size(), index.size(), index.empty() ? 0.0f
+            : 100.0f * bricks.size() / (Float) index.size()) << endl;
+    }
+
+    int run(int argc, char **argv) {
+        int optchar;
+        char *end_ptr = NULL;
+        optind = 1;
+        EFormat format = EFloat32;
+        Float threshold = 0;
+        bool tiled = false;
+        int brickShift = 0;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "htf:e:b:")) != -1) {
+            switch (optchar) {
+                case 'h': {
+                        help();
+                        return 0;
+                    }
+                    break;
+                case 't':
+                    tiled = true;
+                    break;
+                case 'f': {
+                        std::string fmt = boost::to_lower_copy(std::string(optarg));
+                        if (fmt == "float32")
+                            format = EFloat32;
+                        else if (fmt == "float16")
+                            format = EFloat16;
+                        else if (fmt == "uint8")
+                            format = EUInt8;
+                        else
+                            SLog(EError, "Unknown format! (must be float32/float16/uint8)");
+                    }
+                    break;
+                case 'b':
+                    brickShift = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || brickShift < 0 || brickShift > 6)
+                        SLog(EError, "Could not parse the brick size (must be in 0..6)!");
+                    break;
+                case 'e':
+                    threshold = (Float) strtod(optarg, &end_ptr);
+                    if (*end_ptr != '\0')
+                        SLog(EError, "Could not parse the threshold!");
+                    break;
+            }
+        }
+
+        if (argc - optind != 2) {
+            help();
+            return 0;
+        }
+
+        fs::path inputFile(argv[optind]), outputFile(argv[optind+1]);
+        Volume vol;
+        load(inputFile, vol);
+
+        if (tiled && vol.channels != 1 && vol.channels != 3)
+            SLog(EError, "Tiled files support only 1 or 3 channels (this file has %i)!",
+                vol.channels);
+
+        ref<FileStream> stream = new FileStream(outputFile, FileStream::ETruncReadWrite);
+        stream->setByteOrder(Stream::ELittleEndian);
+        std::vector<float> decoded;
+        if (tiled)
+            writeTiled(stream, format, threshold, vol, decoded);
+        else
+            writeDense(stream, format, brickShift, vol, decoded);
+        size_t outputSize = stream->getSize();
+        stream->close();
+
+        /* Report the error introduced by the conversion */
+        double maxError = 0, sqrError = 0, maxValue = 0;
+        for (size_t i=0; i<vol.data.size(); ++i) {
+            double error = std::abs((double) vol.data[i] - (double) decoded[i]);
+            maxError = std::max(maxError, error);
+            sqrError += error * error;
+            maxValue = std::max(maxValue, (double) std::abs(vol.data[i]));
+        }
+        double rmsError = vol.data.empty() ? 0 : std::sqrt(sqrError / vol.data.size());
+
+        cout << "Wrote \"" << outputFile.string() << "\" (" << memString(outputSize)
+             << ", input: " << memString(fs::file_size(inputFile)) << ")" << endl;
+        cout << formatString("Max. absolute error: %g (%.4f%% of the max. value)", maxError,
+            maxValue > 0 ? 100 * maxError / maxValue : 0.0) << endl;
+        cout << formatString("RMS error: %g", rmsError) << endl;
+        return 0;
+    }
+
+    MTS_DECLARE_UTILITY()
+private:
+    struct MortonOrder {
+        inline bool operator()(const std::pair<uint64_t, Vector3i> &a,
+                const std::pair<uint64_t, Vector3i> &b) const {
+            return a.first < b.first;
+        }
+    };
+};
+
+MTS_EXPORT_UTILITY(VolumeConverter, "Convert, quantize and tile volume data files");
+MTS_NAMESPACE_END
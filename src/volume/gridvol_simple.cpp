@@ -22,6 +22,7 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/mmap.h>
 #include <mitsuba/core/math.h>
+#include "quantdir.h"
 
 
 MTS_NAMESPACE_BEGIN
@@ -80,17 +81,9 @@ public:
 		for (int i=0; i<8; ++i)
 			m_aabb.expandBy(m_volumeToWorld(m_dataAABB.getCorner(i)));
 
-		/* Precompute cosine and sine lookup tables */
-		for (int i=0; i<255; i++) {
-			Float angle = (float) i * ((float) M_PI / 255.0f);
-			m_cosPhi[i] = std::cos(2.0f * angle);
-			m_sinPhi[i] = std::sin(2.0f * angle);
-			m_cosTheta[i] = std::cos(angle);
-			m_sinTheta[i] = std::sin(angle);
+		/* Precompute the density lookup table */
+		for (int i=0; i<255; i++)
 			m_densityMap[i] = i/255.0f;
-		}
-		m_cosPhi[255] = m_sinPhi[255] = 0;
-		m_cosTheta[255] = m_sinTheta[255] = 0;
 		m_densityMap[255] = 1.0f;
 	}
 
@@ -317,12 +310,7 @@ public:
 	MTS_DECLARE_CLASS()
 protected: 
 	FINLINE Vector lookupQuantizedDirection(size_t index) const {
-		uint8_t theta = m_data[2*index], phi = m_data[2*index+1];
-		return Vector(
-			m_cosPhi[phi] * m_sinTheta[theta],
-			m_sinPhi[phi] * m_sinTheta[theta],
-			m_cosTheta[theta]
-		);
+		return quantizedDirections.decode(m_data + 2*index);
 	}
 
 protected:
@@ -337,8 +325,6 @@ protected:
 	Float m_stepSize;
 	AABB m_dataAABB;
 	ref<MemoryMappedFile> m_mmap;
-	Float m_cosTheta[256], m_sinTheta[256];
-	Float m_cosPhi[256], m_sinPhi[256];
 	Float m_densityMap[256];
 };
 
@@ -21,6 +21,8 @@
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/mmap.h>
+#include <mitsuba/core/statistics.h>
+#include "quantdir.h"
 
 
 // Uncomment to enable nearest-neighbor direction interpolation
@@ -29,6 +31,9 @@
 // Number of power iteration steps used to find the dominant direction
 #define POWER_ITERATION_STEPS 5
 
+/// Largest supported brick size (log2) of the bricked data layout
+#define GRIDVOL_MAX_BRICK_SHIFT 6
+
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{gridvolume}{Grid-based volume data source}
@@ -67,11 +72,14 @@ MTS_NAMESPACE_BEGIN
  * choices are available:
  * \begin{enumerate}[1.]
  * \item Dense \code{float32}-based representation
- * \item Dense \code{float16}-based representation (\emph{currently not supported by this implementation})
+ * \item Dense \code{float16}-based representation
  * \item Dense \code{uint8}-based representation (The range 0..255 will be mapped to 0..1)
  * \item Dense quantized directions. The directions are stored in spherical
  * coordinates with a total storage cost of 16 bit per entry.
- * \end{enumerate}\\
+ * \end{enumerate}
+ * Bits 8--15 optionally specify the base-2 logarithm of a brick size,
+ * selecting the bricked data layout explained below (zero denotes
+ * the standard linear layout).\\
  * Bytes 9-12 &  Number of cells along the X axis (32 bit integer)\\
  * Bytes 13-16 &  Number of cells along the Y axis (32 bit integer)\\
  * Bytes 17-20 &  Number of cells along the Z axis (32 bit integer)\\
@@ -88,6 +96,23 @@ MTS_NAMESPACE_BEGIN
  * \end{tabular}
  * \end{center}
  *
+ * \paragraph{Bricked layout:}
+ * With the linear layout, neighboring voxels along the Z axis are far apart
+ * in memory, hence ray marching touches a new cache line (and, for large
+ * memory-mapped files, often a new page) at every step. Alternatively,
+ * the data can be split into cubical bricks of $2^k$ voxels along each
+ * axis, where $k$ is the brick size specified in the encoding identifier.
+ * The resolution is padded to a multiple of the brick size, the bricks are
+ * stored in the same order as voxels of the linear layout, and the voxels
+ * within each brick are stored in Morton (Z-curve) order with the X
+ * coordinate in the lowest bit. The lookup cost is practically identical
+ * for both layouts.
+ *
+ * Files can be converted between the \code{float32}, \code{float16}, and
+ * \code{uint8} encodings and the two layouts using
+ * \code{mtsutil volconvert}, which reports the error introduced by the
+ * conversion.
+ *
  * Note that Mitsuba expects that entries in direction volumes are either
  * zero or valid unit vectors.
  *
@@ -137,8 +162,10 @@ public:
             m_volumeType = (EVolumeType) stream->readInt();
             m_res = Vector3i(stream);
             m_channels = stream->readInt();
+            m_brickShift = stream->readInt();
             m_filename = stream->readString();
             size_t volumeSize = getVolumeSize();
+            m_memory.set(volumeSize);
             m_data = new uint8_t[volumeSize];
             stream->read(m_data, volumeSize);
         } else {
@@ -154,8 +181,9 @@ public:
     }
 
     size_t getVolumeSize() const {
-        size_t nEntries = (size_t) m_res.x
-            * (size_t) m_res.y * (size_t) m_res.z;
+        const Vector3i res = getStorageRes();
+        size_t nEntries = (size_t) res.x
+            * (size_t) res.y * (size_t) res.z;
         switch (m_volumeType) {
             case EFloat32: return 4 * nEntries * m_channels;
             case EFloat16: return 2 * nEntries * m_channels;
@@ -178,6 +206,7 @@ public:
             stream->writeInt(m_volumeType);
             m_res.serialize(stream);
             stream->writeInt(m_channels);
+            stream->writeInt(m_brickShift);
             stream->writeString(m_filename.string());
             stream->write(m_data, getVolumeSize());
         } else {
@@ -200,17 +229,30 @@ public:
         for (int i=0; i<8; ++i)
             m_aabb.expandBy(m_volumeToWorld(m_dataAABB.getCorner(i)));
 
-        /* Precompute cosine and sine lookup tables */
-        for (int i=0; i<255; i++) {
-            Float angle = (float) i * ((float) M_PI / 255.0f);
-            m_cosPhi[i] = std::cos(2.0f * angle);
-            m_sinPhi[i] = std::sin(2.0f * angle);
-            m_cosTheta[i] = std::cos(angle);
-            m_sinTheta[i] = std::sin(angle);
-            m_densityMap[i] = i/255.0f;
+        /* Precompute the per-axis storage offsets of the voxels, which
+           turns the indexing operation into three table lookups for
+           both the linear and the bricked layout. With bricks, the
+           voxels within each brick are stored in Morton order. */
+        const Vector3i storageRes = getStorageRes();
+        const int brickRes = 1 << m_brickShift, brickMask = brickRes - 1;
+        const size_t brickSize = (size_t) brickRes * brickRes * brickRes;
+        const size_t bricksX = storageRes.x >> m_brickShift,
+                     bricksY = storageRes.y >> m_brickShift;
+        const size_t brickStride[3] = { brickSize, brickSize * bricksX,
+                                        brickSize * bricksX * bricksY };
+        for (int axis=0; axis<3; ++axis) {
+            m_offsets[axis].resize(m_res[axis]);
+            for (int i=0; i<m_res[axis]; ++i) {
+                size_t morton = 0;
+                for (int bit=0; bit<m_brickShift; ++bit)
+                    morton |= (size_t) (((i & brickMask) >> bit) & 1) << (3*bit + axis);
+                m_offsets[axis][i] = (i >> m_brickShift) * brickStride[axis] + morton;
+            }
         }
-        m_cosPhi[255] = m_sinPhi[255] = 0;
-        m_cosTheta[255] = m_sinTheta[255] = 0;
+
+        /* Precompute the density lookup table */
+        for (int i=0; i<255; i++)
+            m_densityMap[i] = i/255.0f;
         m_densityMap[255] = 1.0f;
     }
 
@@ -233,6 +275,13 @@ public:
                 "(incorrect file version)");
         int type = stream->readInt();
 
+        /* Bits 8-15 of the encoding identifier specify the brick size */
+        m_brickShift = (type >> 8) & 0xFF;
+        type &= 0xFF;
+        if (m_brickShift > GRIDVOL_MAX_BRICK_SHIFT)
+            Log(EError, "Encountered a volume data file with an unsupported "
+                "brick size (2^%i)!", m_brickShift);
+
         int xres = stream->readInt(),
             yres = stream->readInt(),
             zres = stream->readInt();
@@ -250,7 +299,10 @@ public:
                 break;
             case EFloat16:
                 format = "float16";
-                Log(EError, "Error: float16 volumes are not yet supported!");
+                if (m_channels != 1 && m_channels != 3)
+                    Log(EError, "Encountered an unsupported float16 volume data "
+                        "file (%i channels, only 1 and 3 are supported)", m_channels);
+                break;
             case EUInt8:
                 format = "uint8";
                 if (m_channels != 1 && m_channels != 3)
@@ -280,8 +332,13 @@ public:
             m_dataAABB = AABB(Point(xmin, ymin, zmin), Point(xmax, ymax, zmax));
         }
 
-        Log(EDebug, "Mapped \"%s\" into memory: %ix%ix%i (%i channels, format = %s), %s, %s",
+        if (m_mmap->getSize() < 48 + getVolumeSize())
+            Log(EError, "Encountered a truncated volume data file (expected %s of data)!",
+                memString(getVolumeSize()).c_str());
+
+        Log(EDebug, "Mapped \"%s\" into memory: %ix%ix%i (%i channels, format = %s, layout = %s), %s, %s",
             resolved.filename().string().c_str(), m_res.x, m_res.y, m_res.z, m_channels, format.c_str(),
+            m_brickShift == 0 ? "linear" : formatString("%i^3 bricks", 1 << m_brickShift).c_str(),
             memString(m_mmap->getSize()).c_str(), m_dataAABB.toString().c_str());
         m_data = (uint8_t *) (((float *) m_mmap->getData()) + 12);
     }
@@ -336,131 +393,35 @@ public:
 
     Float lookupFloat(const Point &_p) const {
         const Point p = m_worldToGrid.transformAffine(_p);
-        const int x1 = math::floorToInt(p.x),
-              y1 = math::floorToInt(p.y),
-              z1 = math::floorToInt(p.z),
-              x2 = x1+1, y2 = y1+1, z2 = z1+1;
-
-        if (x1 < 0 || y1 < 0 || z1 < 0 || x2 >= m_res.x ||
-            y2 >= m_res.y || z2 >= m_res.z)
-            return 0;
-
-        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
-                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+        switch (m_volumeType) {
+            case EFloat32: return lookupFloat<EFloat32>(p);
+            case EFloat16: return lookupFloat<EFloat16>(p);
+            case EUInt8:   return lookupFloat<EUInt8>(p);
+            default:       return 0.0f;
+        }
+    }
 
+    void lookupFloatBatch(const Point &_p, const Vector &_step,
+            size_t count, Float *result) const {
+        const Point p = m_worldToGrid.transformAffine(_p);
+        const Vector step = m_worldToGrid(_step);
         switch (m_volumeType) {
-            case EFloat32: {
-                const float *floatData = (float *) m_data;
-                const Float
-                    d000 = floatData[(z1*m_res.y + y1)*m_res.x + x1],
-                    d001 = floatData[(z1*m_res.y + y1)*m_res.x + x2],
-                    d010 = floatData[(z1*m_res.y + y2)*m_res.x + x1],
-                    d011 = floatData[(z1*m_res.y + y2)*m_res.x + x2],
-                    d100 = floatData[(z2*m_res.y + y1)*m_res.x + x1],
-                    d101 = floatData[(z2*m_res.y + y1)*m_res.x + x2],
-                    d110 = floatData[(z2*m_res.y + y2)*m_res.x + x1],
-                    d111 = floatData[(z2*m_res.y + y2)*m_res.x + x2];
-
-                return ((d000*_fx + d001*fx)*_fy +
-                        (d010*_fx + d011*fx)*fy)*_fz +
-                       ((d100*_fx + d101*fx)*_fy +
-                        (d110*_fx + d111*fx)*fy)*fz;
-            }
-            case EUInt8: {
-                const Float
-                    d000 = m_densityMap[m_data[(z1*m_res.y + y1)*m_res.x + x1]],
-                    d001 = m_densityMap[m_data[(z1*m_res.y + y1)*m_res.x + x2]],
-                    d010 = m_densityMap[m_data[(z1*m_res.y + y2)*m_res.x + x1]],
-                    d011 = m_densityMap[m_data[(z1*m_res.y + y2)*m_res.x + x2]],
-                    d100 = m_densityMap[m_data[(z2*m_res.y + y1)*m_res.x + x1]],
-                    d101 = m_densityMap[m_data[(z2*m_res.y + y1)*m_res.x + x2]],
-                    d110 = m_densityMap[m_data[(z2*m_res.y + y2)*m_res.x + x1]],
-                    d111 = m_densityMap[m_data[(z2*m_res.y + y2)*m_res.x + x2]];
-
-                return ((d000*_fx + d001*fx)*_fy +
-                        (d010*_fx + d011*fx)*fy)*_fz +
-                       ((d100*_fx + d101*fx)*_fy +
-                        (d110*_fx + d111*fx)*fy)*fz;
-            }
+            case EFloat32: lookupFloatBatch<EFloat32>(p, step, count, result); break;
+            case EFloat16: lookupFloatBatch<EFloat16>(p, step, count, result); break;
+            case EUInt8:   lookupFloatBatch<EUInt8>(p, step, count, result); break;
             default:
-                return 0.0f;
+                for (size_t i=0; i<count; ++i)
+                    result[i] = 0.0f;
         }
     }
 
     Spectrum lookupSpectrum(const Point &_p) const {
         const Point p = m_worldToGrid.transformAffine(_p);
-        const int x1 = math::floorToInt(p.x),
-              y1 = math::floorToInt(p.y),
-              z1 = math::floorToInt(p.z),
-              x2 = x1+1, y2 = y1+1, z2 = z1+1;
-
-        if (x1 < 0 || y1 < 0 || z1 < 0 || x2 >= m_res.x ||
-            y2 >= m_res.y || z2 >= m_res.z)
-            return Spectrum(0.0f);
-
-        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
-                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
-
         switch (m_volumeType) {
-            case EFloat32: {
-                const float3 *spectrumData = (float3 *) m_data;
-                const float3
-                    &d000 = spectrumData[(z1*m_res.y + y1)*m_res.x + x1],
-                    &d001 = spectrumData[(z1*m_res.y + y1)*m_res.x + x2],
-                    &d010 = spectrumData[(z1*m_res.y + y2)*m_res.x + x1],
-                    &d011 = spectrumData[(z1*m_res.y + y2)*m_res.x + x2],
-                    &d100 = spectrumData[(z2*m_res.y + y1)*m_res.x + x1],
-                    &d101 = spectrumData[(z2*m_res.y + y1)*m_res.x + x2],
-                    &d110 = spectrumData[(z2*m_res.y + y2)*m_res.x + x1],
-                    &d111 = spectrumData[(z2*m_res.y + y2)*m_res.x + x2];
-
-                return (((d000*_fx + d001*fx)*_fy +
-                         (d010*_fx + d011*fx)*fy)*_fz +
-                        ((d100*_fx + d101*fx)*_fy +
-                         (d110*_fx + d111*fx)*fy)*fz).toSpectrum();
-                }
-            case EUInt8: {
-                const float3
-                    d000 = float3(
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x1)+0]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x1)+1]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x1)+2]]),
-                    d001 = float3(
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x2)+0]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x2)+1]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x2)+2]]),
-                    d010 = float3(
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x1)+0]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x1)+1]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x1)+2]]),
-                    d011 = float3(
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x2)+0]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x2)+1]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x2)+2]]),
-                    d100 = float3(
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x1)+0]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x1)+1]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x1)+2]]),
-                    d101 = float3(
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x2)+0]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x2)+1]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x2)+2]]),
-                    d110 = float3(
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x1)+0]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x1)+1]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x1)+2]]),
-                    d111 = float3(
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x2)+0]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x2)+1]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x2)+2]]);
-
-                return (((d000*_fx + d001*fx)*_fy +
-                         (d010*_fx + d011*fx)*fy)*_fz +
-                        ((d100*_fx + d101*fx)*_fy +
-                         (d110*_fx + d111*fx)*fy)*fz).toSpectrum();
-
-                }
-            default: return Spectrum(0.0f);
+            case EFloat32: return lookupSpectrum<EFloat32>(p);
+            case EFloat16: return lookupSpectrum<EFloat16>(p);
+            case EUInt8:   return lookupSpectrum<EUInt8>(p);
+            default:       return Spectrum(0.0f);
         }
     }
 
@@ -483,17 +444,15 @@ public:
             switch (m_volumeType) {
                 case EFloat32: {
                     const float3 *vectorData = (float3 *) m_data;
-                    value = vectorData[
-                        (((fz < .5) ? z1 : z2) * m_res.y +
-                        ((fy < .5) ? y1 : y2)) * m_res.x +
-                        ((fx < .5) ? x1 : x2)].toVector();
+                    value = vectorData[getIndex(
+                        (fx < .5) ? x1 : x2, (fy < .5) ? y1 : y2,
+                        (fz < .5) ? z1 : z2)].toVector();
                     }
                     break;
                 case EQuantizedDirections: {
-                    value = lookupQuantizedDirection(
-                        (((fz < .5) ? z1 : z2) * m_res.y +
-                        ((fy < .5) ? y1 : y2)) * m_res.x +
-                        ((fx < .5) ? x1 : x2));
+                    value = lookupQuantizedDirection(getIndex(
+                        (fx < .5) ? x1 : x2, (fy < .5) ? y1 : y2,
+                        (fz < .5) ? z1 : z2));
                     }
                     break;
                 default:
@@ -507,8 +466,8 @@ public:
                 case EFloat32: {
                         const float3 *vectorData = (float3 *) m_data;
                         for (int k=0; k<8; ++k) {
-                            uint32_t index = (((k & 4) ? z2 : z1) * m_res.y +
-                                ((k & 2) ? y2 : y1)) * m_res.x + ((k & 1) ? x2 : x1);
+                            size_t index = getIndex((k & 1) ? x2 : x1,
+                                (k & 2) ? y2 : y1, (k & 4) ? z2 : z1);
                             Float factor = ((k & 1) ? fx : _fx) * ((k & 2) ? fy : _fy)
                                 * ((k & 4) ? fz : _fz);
                             Vector d = vectorData[index].toVector();
@@ -522,19 +481,33 @@ public:
                     }
                     break;
                 case EQuantizedDirections: {
-                        for (int k=0; k<8; ++k) {
-                            uint32_t index = (((k & 4) ? z2 : z1) * m_res.y +
-                                ((k & 2) ? y2 : y1)) * m_res.x + ((k & 1) ? x2 : x1);
-                            Float factor = ((k & 1) ? fx : _fx) * ((k & 2) ? fy : _fy)
-                                * ((k & 4) ? fz : _fz);
-                            Vector d = lookupQuantizedDirection(index);
-                            tensor(0, 0) += factor * d.x * d.x;
-                            tensor(0, 1) += factor * d.x * d.y;
-                            tensor(0, 2) += factor * d.x * d.z;
-                            tensor(1, 1) += factor * d.y * d.y;
-                            tensor(1, 2) += factor * d.y * d.z;
-                            tensor(2, 2) += factor * d.z * d.z;
-                        }
+                        /* Accumulate the table entries directly, without
+                           converting them to Vector instances first */
+                        size_t idx[8];
+                        getCellIndices(x1, y1, z1, idx);
+                        #if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+                            __m128 row0 = _mm_setzero_ps(), row1 = _mm_setzero_ps();
+                            for (int k=0; k<8; ++k) {
+                                Float factor = ((k & 1) ? fx : _fx) * ((k & 2) ? fy : _fy)
+                                    * ((k & 4) ? fz : _fz);
+                                quantizedDirections.accumulate(m_data + 2*idx[k],
+                                    _mm_set1_ps(factor), row0, row1);
+                            }
+                            SSEVector r0(row0), r1(row1);
+                            tensor(0, 0) = r0.f[0]; tensor(0, 1) = r0.f[1];
+                            tensor(0, 2) = r0.f[2]; tensor(1, 1) = r1.f[0];
+                            tensor(1, 2) = r1.f[1]; tensor(2, 2) = r1.f[2];
+                        #else
+                            Float t[6] = { 0, 0, 0, 0, 0, 0 };
+                            for (int k=0; k<8; ++k) {
+                                Float factor = ((k & 1) ? fx : _fx) * ((k & 2) ? fy : _fy)
+                                    * ((k & 4) ? fz : _fz);
+                                quantizedDirections.accumulate(m_data + 2*idx[k], factor, t);
+                            }
+                            tensor(0, 0) = t[0]; tensor(0, 1) = t[1];
+                            tensor(0, 2) = t[2]; tensor(1, 1) = t[3];
+                            tensor(1, 2) = t[4]; tensor(2, 2) = t[5];
+                        #endif
                     }
                     break;
                 default:
@@ -584,11 +557,49 @@ public:
         return 1.0f;
     }
 
+    Float getLocalMaximumFloatValue(const AABB &aabb) const {
+        if (m_channels != 1 || (m_volumeType != EFloat32 &&
+                m_volumeType != EFloat16 && m_volumeType != EUInt8))
+            return getMaximumFloatValue();
+
+        /* Determine the range of voxels that can influence
+           trilinearly interpolated lookups within 'aabb' */
+        AABB gridAABB;
+        for (int i=0; i<8; ++i)
+            gridAABB.expandBy(m_worldToGrid.transformAffine(aabb.getCorner(i)));
+
+        Point3i min, max;
+        for (int i=0; i<3; ++i) {
+            min[i] = std::max(math::floorToInt(gridAABB.min[i]), 0);
+            max[i] = std::min(math::floorToInt(gridAABB.max[i]) + 1, m_res[i] - 1);
+            if (min[i] > max[i])
+                return 0.0f;
+        }
+
+        Float result = 0.0f;
+        for (int z=min.z; z<=max.z; ++z) {
+            for (int y=min.y; y<=max.y; ++y) {
+                for (int x=min.x; x<=max.x; ++x) {
+                    size_t idx = getIndex(x, y, z);
+                    Float value;
+                    switch (m_volumeType) {
+                        case EFloat32: value = fetchFloat<EFloat32>(idx); break;
+                        case EFloat16: value = fetchFloat<EFloat16>(idx); break;
+                        default:       value = fetchFloat<EUInt8>(idx); break;
+                    }
+                    result = std::max(result, value);
+                }
+            }
+        }
+        return result;
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "GridVolume[" << endl
             << "  res = " << m_res.toString() << "," << endl
             << "  channels = " << m_channels << "," << endl
+            << "  brickShift = " << m_brickShift << "," << endl
             << "  aabb = " << m_dataAABB.toString() << endl
             << "]";
         return oss.str();
@@ -596,13 +607,204 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    /// Fetch a single-channel voxel value of the given storage type
+    template <EVolumeType Type> FINLINE Float fetchFloat(size_t index) const {
+        if (Type == EFloat32)
+            return ((const float *) m_data)[index];
+        else if (Type == EFloat16)
+            return (Float) ((const half *) m_data)[index];
+        else
+            return m_densityMap[m_data[index]];
+    }
+
+    /// Fetch a three-channel voxel value of the given storage type
+    template <EVolumeType Type> FINLINE float3 fetchSpectrum(size_t index) const {
+        if (Type == EFloat32)
+            return ((const float3 *) m_data)[index];
+        else if (Type == EFloat16)
+            return float3(
+                (float) ((const half *) m_data)[3*index+0],
+                (float) ((const half *) m_data)[3*index+1],
+                (float) ((const half *) m_data)[3*index+2]);
+        else
+            return float3(
+                (float) m_densityMap[m_data[3*index+0]],
+                (float) m_densityMap[m_data[3*index+1]],
+                (float) m_densityMap[m_data[3*index+2]]);
+    }
+
+    /// Trilinearly interpolated float lookup (in grid coordinates)
+    template <EVolumeType Type> FINLINE Float lookupFloat(const Point &p) const {
+        const int x1 = math::floorToInt(p.x),
+              y1 = math::floorToInt(p.y),
+              z1 = math::floorToInt(p.z),
+              x2 = x1+1, y2 = y1+1, z2 = z1+1;
+
+        if (x1 < 0 || y1 < 0 || z1 < 0 || x2 >= m_res.x ||
+            y2 >= m_res.y || z2 >= m_res.z)
+            return 0;
+
+        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
+                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+
+        size_t idx[8];
+        getCellIndices(x1, y1, z1, idx);
+
+        const Float
+            d000 = fetchFloat<Type>(idx[0]), d001 = fetchFloat<Type>(idx[1]),
+            d010 = fetchFloat<Type>(idx[2]), d011 = fetchFloat<Type>(idx[3]),
+            d100 = fetchFloat<Type>(idx[4]), d101 = fetchFloat<Type>(idx[5]),
+            d110 = fetchFloat<Type>(idx[6]), d111 = fetchFloat<Type>(idx[7]);
+
+        return ((d000*_fx + d001*fx)*_fy +
+                (d010*_fx + d011*fx)*fy)*_fz +
+               ((d100*_fx + d101*fx)*_fy +
+                (d110*_fx + d111*fx)*fy)*fz;
+    }
+
+    /**
+     * \brief Trilinearly interpolated float lookups at the grid space
+     * positions <tt>p + i*step</tt>
+     *
+     * When SSE is available, four positions are processed at a time:
+     * cell indices, bounds checks and interpolation weights are computed
+     * in SIMD registers, and only the voxel fetches remain scalar.
+     */
+    template <EVolumeType Type> void lookupFloatBatch(const Point &p,
+            const Vector &step, size_t count, Float *result) const {
+        size_t i = 0;
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+        const __m128i
+            zero = _mm_setzero_si128(),
+            one = _mm_set1_epi32(1),
+            resX = _mm_set1_epi32(m_res.x - 1),
+            resY = _mm_set1_epi32(m_res.y - 1),
+            resZ = _mm_set1_epi32(m_res.z - 1);
+        const __m128 onePS = _mm_set1_ps(1.0f),
+            offsets = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+
+        for (; i+4 <= count; i += 4) {
+            const __m128 t = _mm_add_ps(_mm_set1_ps((float) i), offsets);
+            const __m128 px = _mm_add_ps(_mm_set1_ps(p.x), _mm_mul_ps(t, _mm_set1_ps(step.x))),
+                         py = _mm_add_ps(_mm_set1_ps(p.y), _mm_mul_ps(t, _mm_set1_ps(step.y))),
+                         pz = _mm_add_ps(_mm_set1_ps(p.z), _mm_mul_ps(t, _mm_set1_ps(step.z)));
+
+            /* Round towards negative infinity (cvtt truncates) */
+            __m128i x1 = _mm_cvttps_epi32(px),
+                    y1 = _mm_cvttps_epi32(py),
+                    z1 = _mm_cvttps_epi32(pz);
+            x1 = _mm_add_epi32(x1, _mm_castps_si128(_mm_cmplt_ps(px, _mm_cvtepi32_ps(x1))));
+            y1 = _mm_add_epi32(y1, _mm_castps_si128(_mm_cmplt_ps(py, _mm_cvtepi32_ps(y1))));
+            z1 = _mm_add_epi32(z1, _mm_castps_si128(_mm_cmplt_ps(pz, _mm_cvtepi32_ps(z1))));
+
+            const __m128 fx = _mm_sub_ps(px, _mm_cvtepi32_ps(x1)),
+                         fy = _mm_sub_ps(py, _mm_cvtepi32_ps(y1)),
+                         fz = _mm_sub_ps(pz, _mm_cvtepi32_ps(z1));
+
+            /* Valid lanes satisfy 0 <= x1 and x1+1 < res.x (etc.) */
+            const __m128i invalid = _mm_or_si128(
+                _mm_or_si128(
+                    _mm_or_si128(_mm_cmplt_epi32(x1, zero), _mm_cmplt_epi32(y1, zero)),
+                    _mm_or_si128(_mm_cmplt_epi32(z1, zero), _mm_cmpgt_epi32(_mm_add_epi32(x1, one), resX))),
+                _mm_or_si128(_mm_cmpgt_epi32(_mm_add_epi32(y1, one), resY),
+                    _mm_cmpgt_epi32(_mm_add_epi32(z1, one), resZ)));
+
+            int32_t ix[4] MM_ALIGN16, iy[4] MM_ALIGN16,
+                    iz[4] MM_ALIGN16, inv[4] MM_ALIGN16;
+            _mm_store_si128((__m128i *) ix, x1);
+            _mm_store_si128((__m128i *) iy, y1);
+            _mm_store_si128((__m128i *) iz, z1);
+            _mm_store_si128((__m128i *) inv, invalid);
+
+            /* Gather the eight corner values of each cell (SoA layout) */
+            float d[8][4] MM_ALIGN16;
+            for (int j=0; j<4; ++j) {
+                if (inv[j]) {
+                    for (int k=0; k<8; ++k)
+                        d[k][j] = 0.0f;
+                    continue;
+                }
+                size_t idx[8];
+                getCellIndices(ix[j], iy[j], iz[j], idx);
+                for (int k=0; k<8; ++k)
+                    d[k][j] = fetchFloat<Type>(idx[k]);
+            }
+
+            const __m128 _fx = _mm_sub_ps(onePS, fx),
+                         _fy = _mm_sub_ps(onePS, fy),
+                         _fz = _mm_sub_ps(onePS, fz);
+
+            #define GRIDVOL_LERP(a, b, wa, wb) \
+                _mm_add_ps(_mm_mul_ps((a), (wa)), _mm_mul_ps((b), (wb)))
+            const __m128
+                d00 = GRIDVOL_LERP(_mm_load_ps(d[0]), _mm_load_ps(d[1]), _fx, fx),
+                d01 = GRIDVOL_LERP(_mm_load_ps(d[2]), _mm_load_ps(d[3]), _fx, fx),
+                d10 = GRIDVOL_LERP(_mm_load_ps(d[4]), _mm_load_ps(d[5]), _fx, fx),
+                d11 = GRIDVOL_LERP(_mm_load_ps(d[6]), _mm_load_ps(d[7]), _fx, fx),
+                d0 = GRIDVOL_LERP(d00, d01, _fy, fy),
+                d1 = GRIDVOL_LERP(d10, d11, _fy, fy);
+            _mm_storeu_ps(result + i, GRIDVOL_LERP(d0, d1, _fz, fz));
+            #undef GRIDVOL_LERP
+        }
+#endif
+        for (; i<count; ++i)
+            result[i] = lookupFloat<Type>(p + step * (Float) i);
+    }
+
+    /// Trilinearly interpolated spectrum lookup (in grid coordinates)
+    template <EVolumeType Type> FINLINE Spectrum lookupSpectrum(const Point &p) const {
+        const int x1 = math::floorToInt(p.x),
+              y1 = math::floorToInt(p.y),
+              z1 = math::floorToInt(p.z),
+              x2 = x1+1, y2 = y1+1, z2 = z1+1;
+
+        if (x1 < 0 || y1 < 0 || z1 < 0 || x2 >= m_res.x ||
+            y2 >= m_res.y || z2 >= m_res.z)
+            return Spectrum(0.0f);
+
+        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
+                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+
+        size_t idx[8];
+        getCellIndices(x1, y1, z1, idx);
+
+        const float3
+            d000 = fetchSpectrum<Type>(idx[0]), d001 = fetchSpectrum<Type>(idx[1]),
+            d010 = fetchSpectrum<Type>(idx[2]), d011 = fetchSpectrum<Type>(idx[3]),
+            d100 = fetchSpectrum<Type>(idx[4]), d101 = fetchSpectrum<Type>(idx[5]),
+            d110 = fetchSpectrum<Type>(idx[6]), d111 = fetchSpectrum<Type>(idx[7]);
+
+        return (((d000*_fx + d001*fx)*_fy +
+                 (d010*_fx + d011*fx)*fy)*_fz +
+                ((d100*_fx + d101*fx)*_fy +
+                 (d110*_fx + d111*fx)*fy)*fz).toSpectrum();
+    }
+
+    /// Return the storage resolution (padded to a multiple of the brick size)
+    inline Vector3i getStorageRes() const {
+        const int mask = (1 << m_brickShift) - 1;
+        return Vector3i((m_res.x + mask) & ~mask,
+            (m_res.y + mask) & ~mask, (m_res.z + mask) & ~mask);
+    }
+
+    /// Return the storage index of a voxel
+    FINLINE size_t getIndex(int x, int y, int z) const {
+        return m_offsets[0][x] + m_offsets[1][y] + m_offsets[2][z];
+    }
+
+    /// Return the storage indices of the eight corners of a cell (x-major order)
+    FINLINE void getCellIndices(int x1, int y1, int z1, size_t *idx) const {
+        const size_t x1o = m_offsets[0][x1], x2o = m_offsets[0][x1+1],
+                     y1o = m_offsets[1][y1], y2o = m_offsets[1][y1+1],
+                     z1o = m_offsets[2][z1], z2o = m_offsets[2][z1+1];
+        idx[0] = x1o + y1o + z1o; idx[1] = x2o + y1o + z1o;
+        idx[2] = x1o + y2o + z1o; idx[3] = x2o + y2o + z1o;
+        idx[4] = x1o + y1o + z2o; idx[5] = x2o + y1o + z2o;
+        idx[6] = x1o + y2o + z2o; idx[7] = x2o + y2o + z2o;
+    }
+
     FINLINE Vector lookupQuantizedDirection(size_t index) const {
-        uint8_t theta = m_data[2*index], phi = m_data[2*index+1];
-        return Vector(
-            m_cosPhi[phi] * m_sinTheta[theta],
-            m_sinPhi[phi] * m_sinTheta[theta],
-            m_cosTheta[theta]
-        );
+        return quantizedDirections.decode(m_data + 2*index);
     }
 
 protected:
@@ -612,14 +814,15 @@ protected:
     EVolumeType m_volumeType;
     Vector3i m_res;
     int m_channels;
+    int m_brickShift;
+    std::vector<size_t> m_offsets[3];
     Transform m_worldToGrid;
     Transform m_worldToVolume;
     Transform m_volumeToWorld;
     Float m_stepSize;
     AABB m_dataAABB;
     ref<MemoryMappedFile> m_mmap;
-    Float m_cosTheta[256], m_sinTheta[256];
-    Float m_cosPhi[256], m_sinPhi[256];
+    TrackedMemory<EMemoryVolume> m_memory;
     Float m_densityMap[256];
 };
 
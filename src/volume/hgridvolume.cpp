@@ -17,25 +17,262 @@
 */
 
 #include <mitsuba/render/volume.h>
+#include <mitsuba/render/range.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/tls.h>
+#include <mitsuba/core/lock.h>
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/timer.h>
+#include <deque>
+#include <list>
+
+/// Number of blocks that every thread keeps references to
+#define HGRID_LOCAL_BLOCKS 8
+
+/// Maximum number of outstanding prefetch requests
+#define HGRID_MAX_PREFETCH 64
+
+/// Number of baked cells per work unit
+#define HGRID_BAKE_GRANULARITY 256
+
+/// Number of lookups per axis used to estimate the mean and minimum of a baked cell
+#define HGRID_BAKE_SAMPLES 4
 
 MTS_NAMESPACE_BEGIN
 
+static StatsCounter statsLocalHits("Hierarchical grid", "Thread-local block hits", EPercentage);
+static StatsCounter statsLoads("Hierarchical grid", "Block loads");
+static StatsCounter statsPrefetches("Hierarchical grid", "Prefetched blocks");
+static StatsCounter statsEvictions("Hierarchical grid", "Block evictions");
+static StatsCounter statsBakedLookups("Hierarchical grid", "Lookups served by the baked grid", EPercentage);
+
 /**
  * This class implements a two-layer hierarchical grid
  * using 'gridvolume'-based files. It loads a dictionary
  * and then proceeds to map volume data into memory
+ *
+ * Blocks are mapped lazily when they are first touched by a lookup.
+ * Only their headers are read up front (to determine the step size
+ * and supported lookup types). An optional memory limit (in MiB)
+ * bounds the size of the resident set, which is then evicted in
+ * least recently used order. When 'prefetch' is enabled, a
+ * background thread maps and pages in the neighbors of blocks that
+ * were loaded on demand.
+ *
+ * Every thread additionally holds references to the last few blocks
+ * that it accessed so that lookups don't need to synchronize. Such
+ * blocks stay alive even if they were evicted, so the limit can be
+ * exceeded by up to this many blocks per thread.
+ *
+ * When 'bakeResolution' is nonzero, a coarse grid (with up to this many
+ * cells along the longest axis and at most 'bakeMemory' MiB) is computed
+ * in parallel when the data source is configured. Every cell stores an
+ * upper bound of the density within it (from the overlapping blocks) and
+ * its mean (from a few stratified lookups). The bounds serve as the local
+ * maxima reported to Woodcock tracking, and float lookups within cells
+ * that are empty or whose estimated range of values is below 'bakeError'
+ * (relative to the maximum value) return the mean without going through
+ * the block index.
  */
 class HierarchicalGridDataSource : public VolumeDataSource {
 public:
+    /// Per-thread references to recently accessed blocks
+    struct LocalCache : public Object {
+        uint32_t cells[HGRID_LOCAL_BLOCKS];
+        ref<VolumeDataSource> blocks[HGRID_LOCAL_BLOCKS];
+        size_t last, next;
+
+        LocalCache() : last(0), next(0) {
+            for (int i=0; i<HGRID_LOCAL_BLOCKS; ++i)
+                cells[i] = EInvalidCell;
+        }
+
+        static const uint32_t EInvalidCell = (uint32_t) -1;
+    };
+
+    /// Bookkeeping of a block file and its mapping (if resident)
+    struct BlockInfo {
+        std::string filename;
+        Vector3i pos;
+        size_t size;
+        ref<VolumeDataSource> data;
+        std::list<uint32_t>::iterator lruIt;
+        bool queued;
+    };
+
+    /// Background thread that maps blocks before they are needed
+    class PrefetchThread : public Thread {
+    public:
+        PrefetchThread(const HierarchicalGridDataSource *parent)
+            : Thread("hgrid"), m_parent(parent), m_stop(false) { }
+
+        void run() {
+            while (true) {
+                uint32_t index;
+                {
+                    LockGuard lock(m_parent->m_mutex);
+                    while (m_parent->m_prefetchQueue.empty() && !m_stop)
+                        m_parent->m_prefetchCond->wait();
+                    if (m_stop)
+                        break;
+                    index = m_parent->m_prefetchQueue.front();
+                    m_parent->m_prefetchQueue.pop_front();
+                    m_parent->m_blockInfo[index].queued = false;
+                }
+
+                ref<VolumeDataSource> block = m_parent->acquireBlock(index, false);
+
+                /* Scanning the block pages its contents into memory */
+                block->getLocalMaximumFloatValue(block->getAABB());
+                ++statsPrefetches;
+            }
+        }
+
+        /// Ask the thread to terminate (must be called with the parent's lock held)
+        inline void stop() { m_stop = true; }
+
+        MTS_DECLARE_CLASS()
+    protected:
+        virtual ~PrefetchThread() { }
+    private:
+        const HierarchicalGridDataSource *m_parent;
+        bool m_stop;
+    };
+
+    /// Summary of the density within a cell of the baked grid
+    struct BakedCell {
+        Float mean, max;
+        bool uniform;
+    };
+
+    /// Baked cells of a range of the grid
+    class BakedCellVector : public WorkResult {
+    public:
+        inline void clear() { m_cells.clear(); }
+        inline void put(const BakedCell &cell) { m_cells.push_back(cell); }
+        inline size_t size() const { return m_cells.size(); }
+        inline const BakedCell &operator[](size_t index) const { return m_cells[index]; }
+
+        inline void setRangeStart(size_t rangeStart) { m_rangeStart = rangeStart; }
+        inline size_t getRangeStart() const { return m_rangeStart; }
+
+        /* The bake is a local process, hence results are never transmitted */
+        void load(Stream *stream) { Log(EError, "BakedCellVector::load(): not supported!"); }
+        void save(Stream *stream) const { Log(EError, "BakedCellVector::save(): not supported!"); }
+
+        std::string toString() const {
+            std::ostringstream oss;
+            oss << "BakedCellVector[rangeStart=" << m_rangeStart
+                << ", size=" << m_cells.size() << "]";
+            return oss.str();
+        }
+
+        MTS_DECLARE_CLASS()
+    protected:
+        virtual ~BakedCellVector() { }
+    private:
+        size_t m_rangeStart;
+        std::vector<BakedCell> m_cells;
+    };
+
+    /// Parallel baking of the coarse grid (worker)
+    class BakeWorker : public WorkProcessor {
+    public:
+        BakeWorker(const HierarchicalGridDataSource *parent) : m_parent(parent) { }
+
+        void serialize(Stream *stream, InstanceManager *manager) const {
+            Log(EError, "BakeWorker::serialize(): not supported!");
+        }
+
+        ref<WorkUnit> createWorkUnit() const { return new RangeWorkUnit(); }
+        ref<WorkResult> createWorkResult() const { return new BakedCellVector(); }
+        ref<WorkProcessor> clone() const { return new BakeWorker(m_parent); }
+        void prepare() { }
+
+        void process(const WorkUnit *workUnit, WorkResult *workResult,
+            const bool &stop) {
+            const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+            BakedCellVector *result = static_cast<BakedCellVector *>(workResult);
+            result->clear();
+            result->setRangeStart(range->getRangeStart());
+            for (size_t i=range->getRangeStart(); i<=range->getRangeEnd() && !stop; ++i)
+                result->put(m_parent->bakeCell(i));
+        }
+
+        MTS_DECLARE_CLASS()
+    protected:
+        virtual ~BakeWorker() { }
+    private:
+        const HierarchicalGridDataSource *m_parent;
+    };
+
+    /// Parallel baking of the coarse grid (work distribution)
+    class BakeProcess : public ParallelProcess {
+    public:
+        BakeProcess(const HierarchicalGridDataSource *parent, std::vector<BakedCell> &cells)
+            : m_parent(parent), m_cells(cells), m_workUnits(0), m_finished(0) {
+            m_resultMutex = new Mutex();
+            m_progress = new ProgressReporter("Baking hierarchical grid", cells.size(), NULL);
+        }
+
+        bool isLocal() const { return true; }
+
+        ref<WorkProcessor> createWorkProcessor() const {
+            return new BakeWorker(m_parent);
+        }
+
+        EStatus generateWork(WorkUnit *unit, int worker) {
+            size_t start = m_workUnits * HGRID_BAKE_GRANULARITY;
+            if (start >= m_cells.size())
+                return EFailure;
+            size_t end = std::min(start + HGRID_BAKE_GRANULARITY, m_cells.size()) - 1;
+            static_cast<RangeWorkUnit *>(unit)->setRange(start, end);
+            ++m_workUnits;
+            return ESuccess;
+        }
+
+        void processResult(const WorkResult *wr, bool cancelled) {
+            if (cancelled)
+                return;
+            const BakedCellVector *result = static_cast<const BakedCellVector *>(wr);
+            LockGuard lock(m_resultMutex);
+            for (size_t i=0; i<result->size(); ++i)
+                m_cells[result->getRangeStart() + i] = (*result)[i];
+            m_finished += result->size();
+            m_progress->update(m_finished);
+        }
+
+        MTS_DECLARE_CLASS()
+    protected:
+        virtual ~BakeProcess() {
+            delete m_progress;
+        }
+    private:
+        const HierarchicalGridDataSource *m_parent;
+        std::vector<BakedCell> &m_cells;
+        ref<Mutex> m_resultMutex;
+        ProgressReporter *m_progress;
+        size_t m_workUnits, m_finished;
+    };
+
     HierarchicalGridDataSource(const Properties &props)
         : VolumeDataSource(props) {
         m_volumeToWorld = props.getTransform("toWorld", Transform());
         m_prefix = props.getString("prefix");
         m_postfix = props.getString("postfix");
+        m_memoryLimit = (size_t) props.getLong("memoryLimit", 0) * 1024 * 1024;
+        m_prefetch = props.getBoolean("prefetch", false);
+        m_bakeResolution = props.getInteger("bakeResolution", 0);
+        m_bakeError = props.getFloat("bakeError", 0.01f);
+        m_bakeMemory = (size_t) props.getLong("bakeMemory", 16) * 1024 * 1024;
+        if (m_bakeResolution < 0 || m_bakeError < 0)
+            Log(EError, "'bakeResolution' and 'bakeError' must be nonnegative!");
+        m_bakeRes = Vector3i(0);
+        m_bakeScale = Vector(0.0f);
         std::string filename = props.getString("filename");
         loadDictionary(filename);
     }
@@ -46,16 +283,33 @@ public:
         std::string filename = stream->readString();
         m_prefix = stream->readString();
         m_postfix = stream->readString();
+        m_memoryLimit = stream->readSize();
+        m_prefetch = stream->readBool();
+        m_bakeResolution = stream->readInt();
+        m_bakeError = stream->readFloat();
+        m_bakeMemory = stream->readSize();
         loadDictionary(filename);
+
+        m_bakeRes = Vector3i(stream);
+        m_bakeScale = Vector(stream);
+        m_bakedCells.resize(stream->readSize());
+        for (size_t i=0; i<m_bakedCells.size(); ++i) {
+            BakedCell &cell = m_bakedCells[i];
+            cell.mean = stream->readFloat();
+            cell.max = stream->readFloat();
+            cell.uniform = stream->readBool();
+        }
     }
 
     virtual ~HierarchicalGridDataSource() {
-        size_t nCells = m_res.x*m_res.y*m_res.z;
-        for (size_t i=0; i<nCells; ++i) {
-            if (m_blocks[i] != NULL)
-                m_blocks[i]->decRef();
+        if (m_prefetchThread) {
+            {
+                LockGuard lock(m_mutex);
+                m_prefetchThread->stop();
+                m_prefetchCond->signal();
+            }
+            m_prefetchThread->join();
         }
-        delete[] m_blocks;
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -65,10 +319,32 @@ public:
         stream->writeString(m_filename);
         stream->writeString(m_prefix);
         stream->writeString(m_postfix);
+        stream->writeSize(m_memoryLimit);
+        stream->writeBool(m_prefetch);
+        stream->writeInt(m_bakeResolution);
+        stream->writeFloat(m_bakeError);
+        stream->writeSize(m_bakeMemory);
+
+        m_bakeRes.serialize(stream);
+        m_bakeScale.serialize(stream);
+        stream->writeSize(m_bakedCells.size());
+        for (size_t i=0; i<m_bakedCells.size(); ++i) {
+            const BakedCell &cell = m_bakedCells[i];
+            stream->writeFloat(cell.mean);
+            stream->writeFloat(cell.max);
+            stream->writeBool(cell.uniform);
+        }
+    }
+
+    void configure() {
+        VolumeDataSource::configure();
+        if (m_bakeResolution > 0 && m_bakedCells.empty() && m_supportsFloatLookups)
+            bake();
     }
 
     void loadDictionary(const std::string &filename) {
-        fs::path resolved = Thread::getThread()->getFileResolver()->resolve(filename);
+        const FileResolver *resolver = Thread::getThread()->getFileResolver();
+        fs::path resolved = resolver->resolve(filename);
         Log(EInfo, "Loading hierarchical grid dictionary \"%s\"", filename.c_str());
         ref<FileStream> stream = new FileStream(resolved, FileStream::EReadOnly);
         stream->setByteOrder(Stream::ELittleEndian);
@@ -77,9 +353,10 @@ public:
         AABB aabb = AABB(Point(xmin, ymin, zmin), Point(xmax, ymax, zmax));
         m_res = Vector3i(stream);
         m_filename = filename;
-        size_t nCells = m_res.x*m_res.y*m_res.z;
-        m_blocks = new VolumeDataSource*[nCells];
-        memset(m_blocks, 0, nCells*sizeof(VolumeDataSource *));
+        size_t nCells = (size_t) m_res.x*m_res.y*m_res.z;
+        m_blockIndex.clear();
+        m_blockIndex.resize(nCells, (uint32_t) LocalCache::EInvalidCell);
+        m_blockInfo.clear();
         Vector extents = aabb.getExtents();
         m_worldToVolume = m_volumeToWorld.inverse();
         m_worldToGrid = Transform::scale(Vector(
@@ -87,42 +364,328 @@ public:
                 (m_res[1]) / extents[1],
                 (m_res[2]) / extents[2])
             ) * Transform::translate(-Vector(aabb.min)) * m_worldToVolume;
+        m_gridToWorld = m_worldToGrid.inverse();
 
         m_supportsFloatLookups = true;
         m_supportsVectorLookups = true;
         m_supportsSpectrumLookups = true;
         m_stepSize = std::numeric_limits<Float>::infinity();
+        m_maxFloatValue = 1.0f; /* Matches the value reported by 'gridvolume' */
 
-        int numBlocks = 0;
+        size_t totalSize = 0;
         while (!stream->isEOF()) {
             Vector3i block = Vector3i(stream);
             Assert(block.x >= 0 && block.y >= 0 && block.z >= 0
                     && block.x < m_res.x && block.y < m_res.y && block.z < m_res.z);
-            Properties props("gridvolume");
-            props.setString("filename", formatString("%s%03i_%03i_%03i%s",
-                        m_prefix.c_str(), block.x, block.y, block.z, m_postfix.c_str()));
-            props.setTransform("toWorld", m_volumeToWorld);
-            props.setBoolean("sendData", false);
-
-            VolumeDataSource *content = static_cast<VolumeDataSource *> (PluginManager::getInstance()->
-                    createObject(MTS_CLASS(VolumeDataSource), props));
-            content->configure();
-
-            m_maxFloatValue = content->getMaximumFloatValue();
-            m_blocks[(m_res.y * block.z + block.y) * m_res.x + block.x] = content;
-            m_stepSize = std::min(m_stepSize, content->getStepSize());
-            m_supportsVectorLookups = m_supportsVectorLookups && content->supportsVectorLookups();
-            m_supportsFloatLookups = m_supportsFloatLookups && content->supportsFloatLookups();
-            m_supportsSpectrumLookups = m_supportsSpectrumLookups && content->supportsSpectrumLookups();
-            content->incRef();
-            ++numBlocks;
-        }
-        Log(EInfo, "%i blocks total, %s, stepSize=%f, resolution=%s", numBlocks,
-                aabb.toString().c_str(), m_stepSize, m_res.toString().c_str());
+
+            BlockInfo info;
+            info.filename = resolver->resolve(formatString("%s%03i_%03i_%03i%s",
+                m_prefix.c_str(), block.x, block.y, block.z, m_postfix.c_str())).string();
+            info.pos = block;
+            info.queued = false;
+            info.lruIt = m_lru.end();
+            readHeader(info);
+            totalSize += info.size;
+
+            m_blockIndex[(m_res.y * block.z + block.y) * m_res.x + block.x]
+                = (uint32_t) m_blockInfo.size();
+            m_blockInfo.push_back(info);
+        }
+        Log(EInfo, "%i blocks total (%s), %s, stepSize=%f, resolution=%s, memory limit=%s",
+                (int) m_blockInfo.size(), memString(totalSize).c_str(),
+                aabb.toString().c_str(), m_stepSize, m_res.toString().c_str(),
+                m_memoryLimit == 0 ? "none" : memString(m_memoryLimit).c_str());
 
         m_aabb.reset();
         for (int i=0; i<8; ++i)
             m_aabb.expandBy(m_volumeToWorld(aabb.getCorner(i)));
+
+        m_mutex = new Mutex();
+        m_residentSize = 0;
+        if (m_prefetch && !m_prefetchThread) {
+            m_prefetchCond = new ConditionVariable(m_mutex);
+            m_prefetchThread = new PrefetchThread(this);
+            m_prefetchThread->setCritical(false);
+            m_prefetchThread->start();
+        }
+    }
+
+    /**
+     * \brief Read the header of a block file, which provides
+     * everything that is needed before the block is mapped
+     */
+    void readHeader(BlockInfo &info) {
+        ref<FileStream> stream = new FileStream(info.filename, FileStream::EReadOnly);
+        stream->setByteOrder(Stream::ELittleEndian);
+        info.size = stream->getSize();
+
+        char header[3];
+        stream->read(header, 3);
+        uint8_t version;
+        stream->read(&version, 1);
+        if (header[0] != 'V' || header[1] != 'O' || header[2] != 'L' || version != 3)
+            Log(EError, "\"%s\" is not a valid volume data file!", info.filename.c_str());
+        stream->readInt(); /* Encoding */
+        Vector3i res(stream);
+        int channels = stream->readInt();
+        Float xmin = stream->readSingle(), ymin = stream->readSingle(), zmin = stream->readSingle();
+        Float xmax = stream->readSingle(), ymax = stream->readSingle(), zmax = stream->readSingle();
+        Vector extents(xmax - xmin, ymax - ymin, zmax - zmin);
+
+        /* Same step size as the one chosen by 'gridvolume' */
+        for (int i=0; i<3; ++i)
+            m_stepSize = std::min(m_stepSize, 0.5f * extents[i] / (Float) (res[i]-1));
+        m_supportsFloatLookups = m_supportsFloatLookups && channels == 1;
+        m_supportsVectorLookups = m_supportsVectorLookups && channels == 3;
+        m_supportsSpectrumLookups = m_supportsSpectrumLookups && channels == 3;
+    }
+
+    /// Map the given block into memory
+    ref<VolumeDataSource> loadBlock(uint32_t index) const {
+        Properties props("gridvolume");
+        props.setString("filename", m_blockInfo[index].filename);
+        props.setTransform("toWorld", m_volumeToWorld);
+        props.setBoolean("sendData", false);
+
+        ref<VolumeDataSource> content = static_cast<VolumeDataSource *> (PluginManager::getInstance()->
+                createObject(MTS_CLASS(VolumeDataSource), props));
+        content->configure();
+        ++statsLoads;
+        return content;
+    }
+
+    /**
+     * \brief Return the given block, mapping it into memory if necessary
+     *
+     * Blocks are mapped without holding the lock. If two threads load
+     * the same block concurrently, the copy of the slower one is dropped.
+     */
+    ref<VolumeDataSource> acquireBlock(uint32_t index, bool onDemand) const {
+        {
+            LockGuard lock(m_mutex);
+            BlockInfo &info = m_blockInfo[index];
+            if (info.data) {
+                m_lru.splice(m_lru.begin(), m_lru, info.lruIt);
+                return info.data;
+            }
+        }
+
+        ref<VolumeDataSource> block = loadBlock(index);
+
+        LockGuard lock(m_mutex);
+        BlockInfo &info = m_blockInfo[index];
+        if (info.data)
+            return info.data;
+
+        info.data = block;
+        m_lru.push_front(index);
+        info.lruIt = m_lru.begin();
+        m_residentSize += info.size;
+
+        /* Evict the least recently used blocks */
+        while (m_memoryLimit != 0 && m_residentSize > m_memoryLimit && m_lru.size() > 1) {
+            BlockInfo &victim = m_blockInfo[m_lru.back()];
+            m_lru.pop_back();
+            victim.data = NULL;
+            victim.lruIt = m_lru.end();
+            m_residentSize -= victim.size;
+            ++statsEvictions;
+        }
+
+        if (onDemand && m_prefetchThread.get())
+            enqueueNeighbors(index);
+
+        return block;
+    }
+
+    /// Request the face neighbors of a block from the prefetch thread (lock must be held)
+    void enqueueNeighbors(uint32_t index) const {
+        const Vector3i &pos = m_blockInfo[index].pos;
+        for (int axis=0; axis<3; ++axis) {
+            for (int dir=-1; dir<=1; dir+=2) {
+                Vector3i n(pos);
+                n[axis] += dir;
+                if (n[axis] < 0 || n[axis] >= m_res[axis])
+                    continue;
+                uint32_t neighbor = m_blockIndex[(m_res.y * n.z + n.y) * m_res.x + n.x];
+                if (neighbor == LocalCache::EInvalidCell || m_prefetchQueue.size() >= HGRID_MAX_PREFETCH)
+                    continue;
+                BlockInfo &info = m_blockInfo[neighbor];
+                if (info.data || info.queued)
+                    continue;
+                info.queued = true;
+                m_prefetchQueue.push_back(neighbor);
+            }
+        }
+        m_prefetchCond->signal();
+    }
+
+    /**
+     * \brief Compute the baked grid (in parallel when the scheduler is running)
+     *
+     * The cells are cubic in grid space. Their resolution is reduced
+     * until the grid fits into the memory budget.
+     */
+    void bake() {
+        int maxRes = std::max(m_res.x, std::max(m_res.y, m_res.z));
+        Float cellSize = maxRes / (Float) m_bakeResolution;
+        size_t cellCount = 0;
+        while (true) {
+            for (int i=0; i<3; ++i) {
+                m_bakeRes[i] = std::max(1, (int) std::ceil(m_res[i] / cellSize));
+                m_bakeScale[i] = m_bakeRes[i] / (Float) m_res[i];
+            }
+            cellCount = (size_t) m_bakeRes.x * m_bakeRes.y * m_bakeRes.z;
+            if (cellCount * sizeof(BakedCell) <= m_bakeMemory || cellSize >= maxRes)
+                break;
+            cellSize *= std::pow((Float) (cellCount * sizeof(BakedCell))
+                / (Float) m_bakeMemory, (Float) (1.0f / 3.0f)) * 1.01f;
+        }
+
+        Log(EInfo, "Baking a %ix%ix%i grid of the hierarchical grid (%s) ..",
+            m_bakeRes.x, m_bakeRes.y, m_bakeRes.z,
+            memString(cellCount * sizeof(BakedCell)).c_str());
+
+        ref<Timer> timer = new Timer();
+        std::vector<BakedCell> cells(cellCount);
+        ref<Scheduler> sched = Scheduler::getInstance();
+        if (sched->isRunning() && sched->hasLocalWorkers()) {
+            ref<BakeProcess> proc = new BakeProcess(this, cells);
+            sched->schedule(proc);
+            sched->wait(proc);
+            if (proc->getReturnStatus() != ParallelProcess::ESuccess) {
+                Log(EWarn, "Baking the hierarchical grid failed, disabling it");
+                return;
+            }
+        } else {
+            for (size_t i=0; i<cellCount; ++i)
+                cells[i] = bakeCell(i);
+        }
+
+        size_t uniformCells = 0;
+        for (size_t i=0; i<cellCount; ++i)
+            if (cells[i].uniform)
+                ++uniformCells;
+        m_bakedCells.swap(cells);
+
+        Log(EInfo, "Baking took %i ms, %.1f%% of the cells are uniform",
+            timer->getMilliseconds(), 100.0f * uniformCells / (Float) cellCount);
+    }
+
+    /// Compute a cell of the baked grid
+    BakedCell bakeCell(size_t index) const {
+        Point3i pos((int) (index % m_bakeRes.x),
+            (int) ((index / m_bakeRes.x) % m_bakeRes.y),
+            (int) (index / ((size_t) m_bakeRes.x * m_bakeRes.y)));
+        Point min, max;
+        for (int i=0; i<3; ++i) {
+            min[i] = pos[i] / m_bakeScale[i];
+            max[i] = std::min((pos[i] + 1) / m_bakeScale[i], (Float) m_res[i]);
+        }
+
+        /* Upper bound, restricted to the blocks overlapping the cell */
+        BakedCell cell;
+        cell.max = 0.0f;
+        Point3i first, last;
+        for (int i=0; i<3; ++i) {
+            first[i] = std::max(0, math::floorToInt(min[i]));
+            last[i] = std::min(m_res[i], math::ceilToInt(max[i])) - 1;
+        }
+        for (int z=first.z; z<=last.z; ++z) {
+            for (int y=first.y; y<=last.y; ++y) {
+                for (int x=first.x; x<=last.x; ++x) {
+                    uint32_t blockIndex = m_blockIndex[((z * m_res.y) + y) * m_res.x + x];
+                    if (blockIndex == LocalCache::EInvalidCell)
+                        continue;
+                    Point3i blockPos(x, y, z);
+                    AABB gridAABB, worldAABB;
+                    for (int i=0; i<3; ++i) {
+                        gridAABB.min[i] = std::max(min[i], (Float) blockPos[i]);
+                        gridAABB.max[i] = std::min(max[i], (Float) (blockPos[i] + 1));
+                    }
+                    for (int i=0; i<8; ++i)
+                        worldAABB.expandBy(m_gridToWorld.transformAffine(gridAABB.getCorner(i)));
+                    ref<VolumeDataSource> block = acquireBlock(blockIndex, false);
+                    cell.max = std::max(cell.max, block->getLocalMaximumFloatValue(worldAABB));
+                }
+            }
+        }
+
+        if (cell.max == 0) {
+            cell.mean = 0.0f;
+            cell.uniform = true;
+            return cell;
+        }
+
+        /* Mean and (estimated) minimum from stratified lookups */
+        const int n = HGRID_BAKE_SAMPLES;
+        Float sum = 0.0f, minValue = std::numeric_limits<Float>::infinity();
+        for (int i=0; i<n*n*n; ++i) {
+            Point p(
+                min.x + ((i % n) + 0.5f) / n * (max.x - min.x),
+                min.y + (((i / n) % n) + 0.5f) / n * (max.y - min.y),
+                min.z + ((i / (n*n)) + 0.5f) / n * (max.z - min.z));
+            const VolumeDataSource *block = getBlock(p);
+            Float value = block ? block->lookupFloat(m_gridToWorld.transformAffine(p)) : 0.0f;
+            sum += value;
+            minValue = std::min(minValue, value);
+        }
+        cell.mean = std::min(cell.max, sum / (Float) (n*n*n));
+        cell.uniform = cell.max - minValue <= m_bakeError * m_maxFloatValue;
+        return cell;
+    }
+
+    /// Return the baked cell containing a grid-space position (or \c NULL)
+    inline const BakedCell *getBakedCell(const Point &p) const {
+        const int x = math::floorToInt(p.x * m_bakeScale.x),
+              y = math::floorToInt(p.y * m_bakeScale.y),
+              z = math::floorToInt(p.z * m_bakeScale.z);
+        if (x < 0 || x >= m_bakeRes.x ||
+            y < 0 || y >= m_bakeRes.y ||
+            z < 0 || z >= m_bakeRes.z)
+            return NULL;
+        return &m_bakedCells[((size_t) z * m_bakeRes.y + y) * m_bakeRes.x + x];
+    }
+
+    /// Return the block containing a grid-space position (or \c NULL)
+    inline const VolumeDataSource *getBlock(const Point &p) const {
+        const int x = math::floorToInt(p.x),
+              y = math::floorToInt(p.y),
+              z = math::floorToInt(p.z);
+        if (x < 0 || x >= m_res.x ||
+            y < 0 || y >= m_res.y ||
+            z < 0 || z >= m_res.z)
+            return NULL;
+
+        uint32_t index = m_blockIndex[((z * m_res.y) + y) * m_res.x + x];
+        if (index == LocalCache::EInvalidCell)
+            return NULL;
+
+        LocalCache *cache = m_localCache.get();
+        if (EXPECT_NOT_TAKEN(cache == NULL)) {
+            cache = new LocalCache();
+            m_localCache.set(cache);
+        }
+
+        statsLocalHits.incrementBase();
+        if (cache->cells[cache->last] == index) {
+            ++statsLocalHits;
+            return cache->blocks[cache->last].get();
+        }
+        for (size_t i=0; i<HGRID_LOCAL_BLOCKS; ++i) {
+            if (cache->cells[i] == index) {
+                ++statsLocalHits;
+                cache->last = i;
+                return cache->blocks[i].get();
+            }
+        }
+
+        size_t slot = cache->next;
+        cache->next = (slot + 1) % HGRID_LOCAL_BLOCKS;
+        cache->blocks[slot] = acquireBlock(index, true);
+        cache->cells[slot] = index;
+        cache->last = slot;
+        return cache->blocks[slot].get();
     }
 
     bool supportsFloatLookups() const {
@@ -142,16 +705,17 @@ public:
     }
 
     Float lookupFloat(const Point &_p) const {
-        const Point p = m_worldToGrid.transformAffine(_p);
-        const int x = math::floorToInt(p.x),
-              y = math::floorToInt(p.y),
-              z = math::floorToInt(p.z);
-        if (x < 0 || x >= m_res.x ||
-            y < 0 || y >= m_res.y ||
-            z < 0 || z >= m_res.z)
-            return 0.0f;
+        Point p = m_worldToGrid.transformAffine(_p);
+        if (!m_bakedCells.empty()) {
+            const BakedCell *cell = getBakedCell(p);
+            statsBakedLookups.incrementBase();
+            if (cell == NULL || cell->uniform) {
+                ++statsBakedLookups;
+                return cell ? cell->mean : 0.0f;
+            }
+        }
 
-        VolumeDataSource *block = m_blocks[((z * m_res.y) + y) * m_res.x + x];
+        const VolumeDataSource *block = getBlock(p);
         if (block == NULL)
             return 0.0f;
         else
@@ -159,16 +723,7 @@ public:
     }
 
     Spectrum lookupSpectrum(const Point &_p) const {
-        const Point p = m_worldToGrid.transformAffine(_p);
-        const int x = math::floorToInt(p.x),
-              y = math::floorToInt(p.y),
-              z = math::floorToInt(p.z);
-        if (x < 0 || x >= m_res.x ||
-            y < 0 || y >= m_res.y ||
-            z < 0 || z >= m_res.z)
-            return Spectrum(0.0f);
-
-        VolumeDataSource *block = m_blocks[((z * m_res.y) + y) * m_res.x + x];
+        const VolumeDataSource *block = getBlock(m_worldToGrid.transformAffine(_p));
         if (block == NULL)
             return Spectrum(0.0f);
         else
@@ -176,18 +731,9 @@ public:
     }
 
     Vector lookupVector(const Point &_p) const {
-        const Point p = m_worldToGrid.transformAffine(_p);
-        const int x = math::floorToInt(p.x),
-              y = math::floorToInt(p.y),
-              z = math::floorToInt(p.z);
-        if (x < 0 || x >= m_res.x ||
-            y < 0 || y >= m_res.y ||
-            z < 0 || z >= m_res.z)
-            return Vector(0.0f);
-
-        VolumeDataSource *block = m_blocks[((z * m_res.y) + y) * m_res.x + x];
+        const VolumeDataSource *block = getBlock(m_worldToGrid.transformAffine(_p));
         if (block == NULL)
-            return Vector();
+            return Vector(0.0f);
         else
             return block->lookupVector(_p);
     }
@@ -196,21 +742,70 @@ public:
         return m_maxFloatValue;
     }
 
+    Float getLocalMaximumFloatValue(const AABB &aabb) const {
+        if (m_bakedCells.empty())
+            return getMaximumFloatValue();
+
+        AABB gridAABB;
+        for (int i=0; i<8; ++i)
+            gridAABB.expandBy(m_worldToGrid.transformAffine(aabb.getCorner(i)));
+
+        Point3i min, max;
+        for (int i=0; i<3; ++i) {
+            min[i] = std::max(math::floorToInt(gridAABB.min[i] * m_bakeScale[i]), 0);
+            max[i] = std::min(math::floorToInt(gridAABB.max[i] * m_bakeScale[i]), m_bakeRes[i] - 1);
+            if (min[i] > max[i])
+                return 0.0f;
+        }
+
+        Float result = 0.0f;
+        for (int z=min.z; z<=max.z; ++z)
+            for (int y=min.y; y<=max.y; ++y)
+                for (int x=min.x; x<=max.x; ++x)
+                    result = std::max(result, m_bakedCells[
+                        ((size_t) z * m_bakeRes.y + y) * m_bakeRes.x + x].max);
+        return result;
+    }
+
     MTS_DECLARE_CLASS()
 protected:
     std::string m_filename, m_prefix, m_postfix;
     Transform m_volumeToWorld;
     Transform m_worldToVolume;
     Transform m_worldToGrid;
-    VolumeDataSource **m_blocks;
+    Transform m_gridToWorld;
+    std::vector<uint32_t> m_blockIndex;
     Vector3i m_res;
-    size_t m_count;
     bool m_supportsFloatLookups;
     bool m_supportsSpectrumLookups;
     bool m_supportsVectorLookups;
     Float m_stepSize, m_maxFloatValue;
+
+    /* Resident set, protected by 'm_mutex' */
+    mutable std::vector<BlockInfo> m_blockInfo;
+    mutable std::list<uint32_t> m_lru;
+    mutable std::deque<uint32_t> m_prefetchQueue;
+    mutable size_t m_residentSize;
+    size_t m_memoryLimit;
+    mutable ref<Mutex> m_mutex;
+    mutable ref<ConditionVariable> m_prefetchCond;
+    ref<PrefetchThread> m_prefetchThread;
+    bool m_prefetch;
+    mutable ThreadLocal<LocalCache> m_localCache;
+
+    /* Baked grid */
+    int m_bakeResolution;
+    Float m_bakeError;
+    size_t m_bakeMemory;
+    Vector3i m_bakeRes;
+    Vector m_bakeScale;
+    std::vector<BakedCell> m_bakedCells;
 };
 
+MTS_IMPLEMENT_CLASS(HierarchicalGridDataSource::PrefetchThread, false, Thread);
+MTS_IMPLEMENT_CLASS(HierarchicalGridDataSource::BakedCellVector, false, WorkResult);
+MTS_IMPLEMENT_CLASS(HierarchicalGridDataSource::BakeWorker, false, WorkProcessor);
+MTS_IMPLEMENT_CLASS(HierarchicalGridDataSource::BakeProcess, false, ParallelProcess);
 MTS_IMPLEMENT_CLASS_S(HierarchicalGridDataSource, false, VolumeDataSource);
 MTS_EXPORT_PLUGIN(HierarchicalGridDataSource, "Hierarchical grid data source");
 MTS_NAMESPACE_END
@@ -0,0 +1,123 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#if !defined(__QUANTIZED_DIRECTIONS_H)
+#define __QUANTIZED_DIRECTIONS_H
+
+#include <mitsuba/mitsuba.h>
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Decoding table for the quantized direction format of
+ * the grid-based volume data sources
+ *
+ * A quantized direction is stored as two bytes encoding its spherical
+ * coordinates \theta and \phi, where the value 255 marks an undefined
+ * direction (\theta) or a direction along the z axis (\phi). Instead of
+ * looking up sines and cosines of both angles, this table stores the unit
+ * vectors for all 65536 combinations (padded to four floats, so that they
+ * can be loaded into an SSE register at once).
+ */
+class QuantizedDirectionTable {
+public:
+    QuantizedDirectionTable() {
+        float cosTheta[256], sinTheta[256], cosPhi[256], sinPhi[256];
+        for (int i=0; i<255; i++) {
+            float angle = (float) i * ((float) M_PI / 255.0f);
+            cosPhi[i] = std::cos(2.0f * angle);
+            sinPhi[i] = std::sin(2.0f * angle);
+            cosTheta[i] = std::cos(angle);
+            sinTheta[i] = std::sin(angle);
+        }
+        cosPhi[255] = sinPhi[255] = 0;
+        cosTheta[255] = sinTheta[255] = 0;
+
+        m_entries = (float *) allocAligned(sizeof(float) * 4 * 65536);
+        for (int theta=0; theta<256; ++theta) {
+            for (int phi=0; phi<256; ++phi) {
+                float *entry = m_entries + 4 * (theta * 256 + phi);
+                entry[0] = cosPhi[phi] * sinTheta[theta];
+                entry[1] = sinPhi[phi] * sinTheta[theta];
+                entry[2] = cosTheta[theta];
+                entry[3] = 0.0f;
+            }
+        }
+    }
+
+    ~QuantizedDirectionTable() {
+        freeAligned(m_entries);
+    }
+
+    /// Return the table entry of the direction stored at \c data
+    FINLINE const float *get(const uint8_t *data) const {
+        return m_entries + 4 * (((int) data[0] << 8) | (int) data[1]);
+    }
+
+    /// Decode the direction stored at \c data
+    FINLINE Vector decode(const uint8_t *data) const {
+        const float *entry = get(data);
+        return Vector((Float) entry[0], (Float) entry[1], (Float) entry[2]);
+    }
+
+    /**
+     * \brief Add <tt>weight * d * d^T</tt> to a structure tensor, where \c d
+     * is the direction stored at \c data
+     *
+     * \param tensor
+     *     Upper triangle of the tensor in the order xx, xy, xz, yy, yz, zz
+     */
+    FINLINE void accumulate(const uint8_t *data, Float weight, Float *tensor) const {
+        const float *d = get(data);
+        Float wx = weight * d[0], wy = weight * d[1];
+        tensor[0] += wx * d[0]; tensor[1] += wx * d[1];
+        tensor[2] += wx * d[2]; tensor[3] += wy * d[1];
+        tensor[4] += wy * d[2]; tensor[5] += weight * d[2] * d[2];
+    }
+
+#if defined(MTS_SSE)
+    /**
+     * \brief SSE version of \ref accumulate(), which adds to the
+     * entries <tt>(xx, xy, xz, 0)</tt> and <tt>(yy, yz, zz, 0)</tt>
+     */
+    FINLINE void accumulate(const uint8_t *data, __m128 weight,
+            __m128 &row0, __m128 &row1) const {
+        const __m128 d = _mm_load_ps(get(data)),
+            wd = _mm_mul_ps(weight, d);
+        row0 = _mm_add_ps(row0, _mm_mul_ps(
+            _mm_shuffle_ps(wd, wd, _MM_SHUFFLE(0, 0, 0, 0)), d));
+        row1 = _mm_add_ps(row1, _mm_mul_ps(
+            _mm_shuffle_ps(wd, wd, _MM_SHUFFLE(3, 2, 1, 1)),
+            _mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 2, 2, 1))));
+    }
+#endif
+
+private:
+    float *m_entries;
+};
+
+/// Decoding table shared by all volumes of a plugin (built when it is loaded)
+static QuantizedDirectionTable quantizedDirections;
+
+MTS_NAMESPACE_END
+
+#endif /* __QUANTIZED_DIRECTIONS_H */
@@ -0,0 +1,624 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/volume.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/properties.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/statistics.h>
+#include <boost/algorithm/string.hpp>
+
+/// Log2 of the resolution of a leaf brick along each axis
+#define SPARSEVOL_BRICK_SHIFT 3
+
+/// Resolution of a leaf brick along each axis
+#define SPARSEVOL_BRICK_RES (1 << SPARSEVOL_BRICK_SHIFT)
+
+/// Number of voxels per leaf brick
+#define SPARSEVOL_BRICK_SIZE (SPARSEVOL_BRICK_RES * SPARSEVOL_BRICK_RES * SPARSEVOL_BRICK_RES)
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{sparsevolume}{Sparse grid-based volume data source}
+ * \parameters{
+ *     \parameter{filename}{\String}{
+ *       Specifies the filename of a volume data file in the format
+ *       of \pluginref{gridvolume} (\code{float32} or \code{uint8}
+ *       encoding, 1 or 3 channels), or of a tiled file created by
+ *       \code{mtsutil volconvert -t}
+ *     }
+ *     \parameter{quantization}{\String}{
+ *       Storage format of the leaf bricks: \code{float32},
+ *       \code{float16}, or \code{uint8}. The latter quantizes the
+ *       values of each brick relative to the brick's own value range.
+ *       Tiled files specify their own format, and this parameter is
+ *       ignored in that case. \default{\code{float32}}
+ *     }
+ *     \parameter{threshold}{\Float}{
+ *       Bricks whose values all lie below or at this threshold
+ *       are discarded and treated as being zero. \default{0}
+ *     }
+ *     \parameter{toWorld}{\Transform}{
+ *         Optional linear transformation that should be applied to the data
+ *     }
+ *     \parameter{min, max}{\Point}{
+ *         Optional parameter that can be used to re-scale the data so that
+ *         it lies in the bounding box between \code{min} and \code{max}.
+ *     }
+ * }
+ *
+ * This plugin provides the same kind of data as \pluginref{gridvolume},
+ * but converts the dense grid into a sparse representation when the
+ * scene is loaded: the volume is split into leaf bricks of $8^3$ voxels,
+ * and only bricks containing nonzero values are kept in memory. A dense
+ * index maps each brick position to its storage location. For volumes
+ * that are mostly empty (e.g. smoke and explosion simulations), this
+ * significantly reduces memory usage and improves cache efficiency.
+ * The dense input file is only accessed once while loading.
+ *
+ * Since the conversion has to touch every voxel, large volumes can instead
+ * be converted ahead of time using the \code{volconvert} utility, e.g.
+ * \begin{shell}
+ * $\texttt{mtsutil volconvert -t -f uint8 smoke.vol smoke-tiled.vol}
+ * \end{shell}
+ * which also reports the error introduced by the quantization. Tiled files
+ * store the bricks in Morton order for better cache locality and are read
+ * directly without further processing.
+ *
+ * The data source also answers queries about the maximum value within
+ * a region by looking at the bricks' precomputed maxima, which allows
+ * \pluginref{heterogeneous} to skip empty space during Woodcock tracking.
+ *
+ * \remarks{
+ *    \item Direction data (encoding 4 of the \pluginref{gridvolume} format)
+ *    is not supported; 3-channel volumes are trilinearly interpolated and
+ *    normalized when used as orientation fields.
+ * }
+ */
+class SparseGridDataSource : public VolumeDataSource {
+public:
+    /// Storage format of the leaf bricks
+    enum EQuantization {
+        EFloat32 = 0,
+        EFloat16,
+        EUInt8
+    };
+
+    /// Marks an empty brick in the brick index
+    enum {
+        EEmptyBrick = 0xFFFFFFFFu
+    };
+
+    SparseGridDataSource(const Properties &props)
+        : VolumeDataSource(props) {
+        m_volumeToWorld = props.getTransform("toWorld", Transform());
+
+        if (props.hasProperty("min") && props.hasProperty("max")) {
+            /* Optionally allow to use an AABB other than
+               the one specified by the grid file */
+            m_dataAABB.min = props.getPoint("min");
+            m_dataAABB.max = props.getPoint("max");
+        }
+
+        std::string quantization = boost::to_lower_copy(
+            props.getString("quantization", "float32"));
+        if (quantization == "float32")
+            m_quantization = EFloat32;
+        else if (quantization == "float16")
+            m_quantization = EFloat16;
+        else if (quantization == "uint8")
+            m_quantization = EUInt8;
+        else
+            Log(EError, "The \"quantization\" parameter must be equal to "
+                "\"float32\", \"float16\", or \"uint8\"!");
+
+        m_threshold = props.getFloat("threshold", 0.0f);
+        m_filename = props.getString("filename");
+
+        loadFromFile(m_filename);
+    }
+
+    SparseGridDataSource(Stream *stream, InstanceManager *manager)
+            : VolumeDataSource(stream, manager) {
+        m_volumeToWorld = Transform(stream);
+        m_dataAABB = AABB(stream);
+        m_filename = stream->readString();
+        m_quantization = (EQuantization) stream->readInt();
+        m_threshold = stream->readFloat();
+        m_res = Vector3i(stream);
+        m_channels = stream->readInt();
+        m_maxValue = stream->readFloat();
+
+        size_t indexSize = stream->readSize(),
+               brickCount = stream->readSize();
+        m_brickIndex.resize(indexSize);
+        stream->readUIntArray(&m_brickIndex[0], indexSize);
+        m_brickMin.resize(brickCount);
+        m_brickScale.resize(brickCount);
+        m_brickMax.resize(brickCount);
+        m_data.resize(brickCount * getBrickBytes());
+        if (brickCount > 0) {
+            stream->readSingleArray(&m_brickMin[0], brickCount);
+            stream->readSingleArray(&m_brickScale[0], brickCount);
+            stream->readSingleArray(&m_brickMax[0], brickCount);
+            stream->read(&m_data[0], m_data.size());
+        }
+        configure();
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        VolumeDataSource::serialize(stream, manager);
+
+        /* The sparse representation is compact -- always send it */
+        m_volumeToWorld.serialize(stream);
+        m_dataAABB.serialize(stream);
+        stream->writeString(m_filename.string());
+        stream->writeInt(m_quantization);
+        stream->writeFloat(m_threshold);
+        m_res.serialize(stream);
+        stream->writeInt(m_channels);
+        stream->writeFloat(m_maxValue);
+
+        size_t brickCount = m_brickMax.size();
+        stream->writeSize(m_brickIndex.size());
+        stream->writeSize(brickCount);
+        stream->writeUIntArray(&m_brickIndex[0], m_brickIndex.size());
+        if (brickCount > 0) {
+            stream->writeSingleArray(&m_brickMin[0], brickCount);
+            stream->writeSingleArray(&m_brickScale[0], brickCount);
+            stream->writeSingleArray(&m_brickMax[0], brickCount);
+            stream->write(&m_data[0], m_data.size());
+        }
+    }
+
+    void configure() {
+        Vector extents(m_dataAABB.getExtents());
+        m_worldToVolume = m_volumeToWorld.inverse();
+        m_worldToGrid = Transform::scale(Vector(
+                (m_res[0] - 1) / extents[0],
+                (m_res[1] - 1) / extents[1],
+                (m_res[2] - 1) / extents[2])
+            ) * Transform::translate(-Vector(m_dataAABB.min)) * m_worldToVolume;
+        m_stepSize = std::numeric_limits<Float>::infinity();
+        for (int i=0; i<3; ++i)
+            m_stepSize = std::min(m_stepSize, 0.5f * extents[i] / (Float) (m_res[i]-1));
+        m_aabb.reset();
+        for (int i=0; i<8; ++i)
+            m_aabb.expandBy(m_volumeToWorld(m_dataAABB.getCorner(i)));
+
+        m_memory.set(m_brickIndex.capacity() * sizeof(uint32_t)
+            + (m_brickMin.capacity() + m_brickScale.capacity()
+               + m_brickMax.capacity()) * sizeof(float)
+            + m_data.capacity());
+    }
+
+    /// Convert a dense volume data file into the sparse representation
+    void loadFromFile(const fs::path &filename) {
+        fs::path resolved = Thread::getThread()->getFileResolver()->resolve(filename);
+        ref<MemoryMappedFile> mmap = new MemoryMappedFile(resolved);
+        ref<MemoryStream> stream = new MemoryStream(mmap->getData(), mmap->getSize());
+        stream->setByteOrder(Stream::ELittleEndian);
+
+        char header[3];
+        stream->read(header, 3);
+        if (header[0] != 'V' || header[1] != 'O' || header[2] != 'L')
+            Log(EError, "Encountered an invalid volume data file "
+                "(incorrect header identifier)");
+        uint8_t version;
+        stream->read(&version, 1);
+        if (version == 4) {
+            loadTiled(stream, resolved);
+            return;
+        } else if (version != 3) {
+            Log(EError, "Encountered an invalid volume data file "
+                "(incorrect file version)");
+        }
+        int type = stream->readInt();
+
+        int xres = stream->readInt(),
+            yres = stream->readInt(),
+            zres = stream->readInt();
+        m_res = Vector3i(xres, yres, zres);
+        m_channels = stream->readInt();
+
+        if (type != 1 && type != 3)
+            Log(EError, "Encountered an unsupported volume data file (type=%i): only "
+                "float32 and uint8 encodings can be converted into a sparse volume!", type);
+        if (m_channels != 1 && m_channels != 3)
+            Log(EError, "Encountered an unsupported volume data file "
+                "(%i channels, only 1 and 3 are supported)", m_channels);
+
+        Float xmin = stream->readSingle(),
+              ymin = stream->readSingle(),
+              zmin = stream->readSingle();
+        Float xmax = stream->readSingle(),
+              ymax = stream->readSingle(),
+              zmax = stream->readSingle();
+        if (!m_dataAABB.isValid())
+            m_dataAABB = AABB(Point(xmin, ymin, zmin), Point(xmax, ymax, zmax));
+
+        const uint8_t *data = (const uint8_t *) (((float *) mmap->getData()) + 12);
+        const float *floatData = (const float *) data;
+
+        Vector3i brickRes(
+            (m_res.x + SPARSEVOL_BRICK_RES - 1) >> SPARSEVOL_BRICK_SHIFT,
+            (m_res.y + SPARSEVOL_BRICK_RES - 1) >> SPARSEVOL_BRICK_SHIFT,
+            (m_res.z + SPARSEVOL_BRICK_RES - 1) >> SPARSEVOL_BRICK_SHIFT);
+        m_brickIndex.resize((size_t) brickRes.x * (size_t) brickRes.y * (size_t) brickRes.z);
+
+        const size_t brickBytes = getBrickBytes();
+        const int valueCount = SPARSEVOL_BRICK_SIZE * m_channels;
+        std::vector<float> values(valueCount);
+        m_maxValue = 0;
+
+        size_t index = 0;
+        for (int bz=0; bz<brickRes.z; ++bz) {
+            for (int by=0; by<brickRes.y; ++by) {
+                for (int bx=0; bx<brickRes.x; ++bx) {
+                    /* Gather the voxels of this brick (zero-padded at the boundary) */
+                    float minValue = std::numeric_limits<float>::infinity(),
+                          maxValue = -std::numeric_limits<float>::infinity();
+                    bool empty = true;
+                    int idx = 0;
+                    for (int lz=0; lz<SPARSEVOL_BRICK_RES; ++lz) {
+                        int z = (bz << SPARSEVOL_BRICK_SHIFT) + lz;
+                        for (int ly=0; ly<SPARSEVOL_BRICK_RES; ++ly) {
+                            int y = (by << SPARSEVOL_BRICK_SHIFT) + ly;
+                            for (int lx=0; lx<SPARSEVOL_BRICK_RES; ++lx) {
+                                int x = (bx << SPARSEVOL_BRICK_SHIFT) + lx;
+                                bool inside = x < m_res.x && y < m_res.y && z < m_res.z;
+                                size_t offset = (((size_t) z * m_res.y + y) * m_res.x + x) * m_channels;
+                                for (int c=0; c<m_channels; ++c) {
+                                    float value = 0;
+                                    if (inside)
+                                        value = type == 1 ? floatData[offset + c]
+                                            : data[offset + c] / 255.0f;
+                                    if (std::abs(value) > m_threshold)
+                                        empty = false;
+                                    minValue = std::min(minValue, value);
+                                    maxValue = std::max(maxValue, value);
+                                    values[idx++] = value;
+                                }
+                            }
+                        }
+                    }
+
+                    if (empty) {
+                        m_brickIndex[index++] = EEmptyBrick;
+                        continue;
+                    }
+
+                    uint32_t brick = (uint32_t) m_brickMax.size();
+                    m_brickIndex[index++] = brick;
+                    m_data.resize(m_data.size() + brickBytes);
+                    float scale = maxValue > minValue ? (maxValue - minValue) / 255.0f : 0.0f;
+                    m_brickMin.push_back(minValue);
+                    m_brickScale.push_back(scale);
+                    m_brickMax.push_back(0.0f);
+                    encodeBrick(brick, &values[0]);
+
+                    /* Compute the maximum of the stored (i.e. quantized) values */
+                    float brickMax = 0;
+                    for (int i=0; i<valueCount; ++i)
+                        brickMax = std::max(brickMax, (float) fetch(brick, i));
+                    m_brickMax[brick] = brickMax;
+                    m_maxValue = std::max(m_maxValue, (Float) brickMax);
+                }
+            }
+        }
+
+        size_t brickCount = m_brickMax.size();
+        Log(EDebug, "Loaded \"%s\" into a sparse volume: %ix%ix%i (%i channels), " SIZE_T_FMT
+            " of " SIZE_T_FMT " bricks occupied (%.1f%%), %s instead of %s, %s",
+            resolved.filename().string().c_str(), m_res.x, m_res.y, m_res.z, m_channels,
+            brickCount, m_brickIndex.size(), 100.0f * brickCount / (Float) m_brickIndex.size(),
+            memString(m_data.size() + m_brickIndex.size() * sizeof(uint32_t)
+                + brickCount * 3 * sizeof(float)).c_str(),
+            memString(mmap->getSize()).c_str(), m_dataAABB.toString().c_str());
+    }
+
+    /// Load a tiled file created by 'mtsutil volconvert -t'
+    void loadTiled(Stream *stream, const fs::path &resolved) {
+        m_quantization = (EQuantization) stream->readInt();
+        int xres = stream->readInt(),
+            yres = stream->readInt(),
+            zres = stream->readInt();
+        m_res = Vector3i(xres, yres, zres);
+        m_channels = stream->readInt();
+
+        if (m_quantization != EFloat32 && m_quantization != EFloat16 && m_quantization != EUInt8)
+            Log(EError, "Encountered an invalid tiled volume data file "
+                "(unknown quantization %i)", (int) m_quantization);
+        if (m_channels != 1 && m_channels != 3)
+            Log(EError, "Encountered an unsupported tiled volume data file "
+                "(%i channels, only 1 and 3 are supported)", m_channels);
+
+        Float xmin = stream->readSingle(),
+              ymin = stream->readSingle(),
+              zmin = stream->readSingle();
+        Float xmax = stream->readSingle(),
+              ymax = stream->readSingle(),
+              zmax = stream->readSingle();
+        if (!m_dataAABB.isValid())
+            m_dataAABB = AABB(Point(xmin, ymin, zmin), Point(xmax, ymax, zmax));
+
+        if (stream->readInt() != SPARSEVOL_BRICK_SHIFT)
+            Log(EError, "Encountered a tiled volume data file with an "
+                "incompatible brick resolution!");
+        size_t brickCount = stream->readUInt();
+
+        Vector3i brickRes = getBrickRes();
+        m_brickIndex.resize((size_t) brickRes.x * (size_t) brickRes.y * (size_t) brickRes.z);
+        stream->readUIntArray(&m_brickIndex[0], m_brickIndex.size());
+        for (size_t i=0; i<m_brickIndex.size(); ++i) {
+            if (m_brickIndex[i] != EEmptyBrick && m_brickIndex[i] >= brickCount)
+                Log(EError, "Encountered an invalid tiled volume data file "
+                    "(brick index out of range)");
+        }
+
+        m_brickMin.resize(brickCount);
+        m_brickScale.resize(brickCount);
+        m_brickMax.resize(brickCount);
+        m_data.resize(brickCount * getBrickBytes());
+        m_maxValue = 0;
+        if (brickCount > 0) {
+            stream->readSingleArray(&m_brickMin[0], brickCount);
+            stream->readSingleArray(&m_brickScale[0], brickCount);
+            stream->readSingleArray(&m_brickMax[0], brickCount);
+            if (m_quantization == EFloat32)
+                stream->readSingleArray((float *) &m_data[0], m_data.size() / sizeof(float));
+            else if (m_quantization == EFloat16)
+                stream->readUShortArray((uint16_t *) &m_data[0], m_data.size() / sizeof(half));
+            else
+                stream->read(&m_data[0], m_data.size());
+            for (size_t i=0; i<brickCount; ++i)
+                m_maxValue = std::max(m_maxValue, (Float) m_brickMax[i]);
+        }
+
+        Log(EDebug, "Loaded tiled volume \"%s\": %ix%ix%i (%i channels), " SIZE_T_FMT
+            " of " SIZE_T_FMT " bricks occupied, %s, %s", resolved.filename().string().c_str(),
+            m_res.x, m_res.y, m_res.z, m_channels, brickCount, m_brickIndex.size(),
+            memString(m_data.size()).c_str(), m_dataAABB.toString().c_str());
+    }
+
+    Float lookupFloat(const Point &_p) const {
+        const Point p = m_worldToGrid.transformAffine(_p);
+        const int x1 = math::floorToInt(p.x),
+              y1 = math::floorToInt(p.y),
+              z1 = math::floorToInt(p.z),
+              x2 = x1+1, y2 = y1+1, z2 = z1+1;
+
+        if (x1 < 0 || y1 < 0 || z1 < 0 || x2 >= m_res.x ||
+            y2 >= m_res.y || z2 >= m_res.z)
+            return 0;
+
+        /* Fast path: all lookups fall into one empty brick */
+        const int mask = SPARSEVOL_BRICK_RES - 1;
+        if ((x1 & mask) != mask && (y1 & mask) != mask && (z1 & mask) != mask
+            && getBrick(x1, y1, z1) == EEmptyBrick)
+            return 0;
+
+        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
+                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+
+        const Float
+            d000 = voxel(x1, y1, z1, 0), d001 = voxel(x2, y1, z1, 0),
+            d010 = voxel(x1, y2, z1, 0), d011 = voxel(x2, y2, z1, 0),
+            d100 = voxel(x1, y1, z2, 0), d101 = voxel(x2, y1, z2, 0),
+            d110 = voxel(x1, y2, z2, 0), d111 = voxel(x2, y2, z2, 0);
+
+        return ((d000*_fx + d001*fx)*_fy +
+                (d010*_fx + d011*fx)*fy)*_fz +
+               ((d100*_fx + d101*fx)*_fy +
+                (d110*_fx + d111*fx)*fy)*fz;
+    }
+
+    Spectrum lookupSpectrum(const Point &p) const {
+        Float value[3];
+        if (!lookup3(p, value))
+            return Spectrum(0.0f);
+        Spectrum result;
+        result.fromLinearRGB(value[0], value[1], value[2]);
+        return result;
+    }
+
+    Vector lookupVector(const Point &p) const {
+        Float value[3];
+        if (!lookup3(p, value))
+            return Vector(0.0f);
+        Vector v(value[0], value[1], value[2]);
+        if (!v.isZero())
+            return normalize(m_volumeToWorld(v));
+        else
+            return Vector(0.0f);
+    }
+
+    bool supportsFloatLookups() const { return m_channels == 1; }
+    bool supportsSpectrumLookups() const { return m_channels == 3; }
+    bool supportsVectorLookups() const { return m_channels == 3; }
+    Float getStepSize() const { return m_stepSize; }
+
+    Float getMaximumFloatValue() const {
+        return m_maxValue;
+    }
+
+    Float getLocalMaximumFloatValue(const AABB &aabb) const {
+        /* Determine the range of voxels that can influence
+           trilinearly interpolated lookups within 'aabb' */
+        AABB gridAABB;
+        for (int i=0; i<8; ++i)
+            gridAABB.expandBy(m_worldToGrid.transformAffine(aabb.getCorner(i)));
+
+        Point3i min, max;
+        for (int i=0; i<3; ++i) {
+            min[i] = std::max(math::floorToInt(gridAABB.min[i]), 0);
+            max[i] = std::min(math::floorToInt(gridAABB.max[i]) + 1, m_res[i] - 1);
+            if (min[i] > max[i])
+                return 0.0f;
+            min[i] >>= SPARSEVOL_BRICK_SHIFT;
+            max[i] >>= SPARSEVOL_BRICK_SHIFT;
+        }
+
+        /* Only consult the precomputed brick maxima */
+        const Vector3i brickRes = getBrickRes();
+        Float result = 0.0f;
+        for (int z=min.z; z<=max.z; ++z) {
+            for (int y=min.y; y<=max.y; ++y) {
+                for (int x=min.x; x<=max.x; ++x) {
+                    uint32_t brick = m_brickIndex[((size_t) z * brickRes.y + y) * brickRes.x + x];
+                    if (brick != EEmptyBrick)
+                        result = std::max(result, (Float) m_brickMax[brick]);
+                }
+            }
+        }
+        return result;
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "SparseGridVolume[" << endl
+            << "  res = " << m_res.toString() << "," << endl
+            << "  channels = " << m_channels << "," << endl
+            << "  quantization = " << m_quantization << "," << endl
+            << "  bricks = " << m_brickMax.size() << " of " << m_brickIndex.size() << "," << endl
+            << "  aabb = " << m_dataAABB.toString() << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Return the number of bricks along each axis
+    inline Vector3i getBrickRes() const {
+        return Vector3i(
+            (m_res.x + SPARSEVOL_BRICK_RES - 1) >> SPARSEVOL_BRICK_SHIFT,
+            (m_res.y + SPARSEVOL_BRICK_RES - 1) >> SPARSEVOL_BRICK_SHIFT,
+            (m_res.z + SPARSEVOL_BRICK_RES - 1) >> SPARSEVOL_BRICK_SHIFT);
+    }
+
+    /// Return the storage size of a single brick in bytes
+    inline size_t getBrickBytes() const {
+        size_t bytes = m_quantization == EFloat32 ? sizeof(float)
+            : (m_quantization == EFloat16 ? sizeof(half) : sizeof(uint8_t));
+        return SPARSEVOL_BRICK_SIZE * m_channels * bytes;
+    }
+
+    /// Look up the brick containing a voxel
+    inline uint32_t getBrick(int x, int y, int z) const {
+        const int brx = (m_res.x + SPARSEVOL_BRICK_RES - 1) >> SPARSEVOL_BRICK_SHIFT,
+                  bry = (m_res.y + SPARSEVOL_BRICK_RES - 1) >> SPARSEVOL_BRICK_SHIFT;
+        return m_brickIndex[((size_t) (z >> SPARSEVOL_BRICK_SHIFT) * bry
+            + (y >> SPARSEVOL_BRICK_SHIFT)) * brx + (x >> SPARSEVOL_BRICK_SHIFT)];
+    }
+
+    /// Decode a value stored in a brick
+    inline Float fetch(uint32_t brick, size_t idx) const {
+        size_t offset = (size_t) brick * SPARSEVOL_BRICK_SIZE * m_channels + idx;
+        switch (m_quantization) {
+            case EFloat32:
+                return ((const float *) &m_data[0])[offset];
+            case EFloat16:
+                return (Float) ((const half *) &m_data[0])[offset];
+            default:
+                return m_brickMin[brick] + m_brickScale[brick] * m_data[offset];
+        }
+    }
+
+    /// Look up the value of a voxel
+    inline Float voxel(int x, int y, int z, int channel) const {
+        uint32_t brick = getBrick(x, y, z);
+        if (brick == EEmptyBrick)
+            return 0;
+        const int mask = SPARSEVOL_BRICK_RES - 1;
+        size_t idx = ((((z & mask) << SPARSEVOL_BRICK_SHIFT) + (y & mask))
+            << SPARSEVOL_BRICK_SHIFT) + (x & mask);
+        return fetch(brick, idx * m_channels + channel);
+    }
+
+    /// Trilinearly interpolate a 3-channel value
+    bool lookup3(const Point &_p, Float *value) const {
+        const Point p = m_worldToGrid.transformAffine(_p);
+        const int x1 = math::floorToInt(p.x),
+              y1 = math::floorToInt(p.y),
+              z1 = math::floorToInt(p.z),
+              x2 = x1+1, y2 = y1+1, z2 = z1+1;
+
+        if (x1 < 0 || y1 < 0 || z1 < 0 || x2 >= m_res.x ||
+            y2 >= m_res.y || z2 >= m_res.z)
+            return false;
+
+        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
+                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+
+        for (int c=0; c<3; ++c) {
+            value[c] =
+                ((voxel(x1, y1, z1, c)*_fx + voxel(x2, y1, z1, c)*fx)*_fy +
+                 (voxel(x1, y2, z1, c)*_fx + voxel(x2, y2, z1, c)*fx)*fy)*_fz +
+                ((voxel(x1, y1, z2, c)*_fx + voxel(x2, y1, z2, c)*fx)*_fy +
+                 (voxel(x1, y2, z2, c)*_fx + voxel(x2, y2, z2, c)*fx)*fy)*fz;
+        }
+        return true;
+    }
+
+    /// Store the values of a brick using the selected quantization
+    void encodeBrick(uint32_t brick, const float *values) {
+        const size_t count = SPARSEVOL_BRICK_SIZE * m_channels;
+        uint8_t *target = &m_data[brick * getBrickBytes()];
+        switch (m_quantization) {
+            case EFloat32:
+                memcpy(target, values, count * sizeof(float));
+                break;
+            case EFloat16:
+                for (size_t i=0; i<count; ++i)
+                    ((half *) target)[i] = half(values[i]);
+                break;
+            default: {
+                    float min = m_brickMin[brick], scale = m_brickScale[brick];
+                    float invScale = scale > 0 ? 1.0f / scale : 0.0f;
+                    for (size_t i=0; i<count; ++i)
+                        target[i] = (uint8_t) std::min(255, std::max(0,
+                            (int) ((values[i] - min) * invScale + 0.5f)));
+                }
+                break;
+        }
+    }
+
+protected:
+    fs::path m_filename;
+    EQuantization m_quantization;
+    Float m_threshold;
+    Vector3i m_res;
+    int m_channels;
+    Float m_maxValue;
+    std::vector<uint32_t> m_brickIndex;
+    std::vector<float> m_brickMin;
+    std::vector<float> m_brickScale;
+    std::vector<float> m_brickMax;
+    std::vector<uint8_t> m_data;
+    TrackedMemory<EMemoryVolume> m_memory;
+    Transform m_worldToGrid;
+    Transform m_worldToVolume;
+    Transform m_volumeToWorld;
+    Float m_stepSize;
+    AABB m_dataAABB;
+};
+
+MTS_IMPLEMENT_CLASS_S(SparseGridDataSource, false, VolumeDataSource);
+MTS_EXPORT_PLUGIN(SparseGridDataSource, "Sparse grid data source");
+MTS_NAMESPACE_END
@@ -20,29 +20,18 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/sched.h>
-#include <mitsuba/core/lrucache.h>
+#include <boost/unordered_map.hpp>
 #include <fstream>
 
 MTS_NAMESPACE_BEGIN
 
 static StatsCounter statsHitRate("Volume cache", "Cache hit rate", EPercentage);
+static StatsCounter statsLastBlock("Volume cache", "Hits in the previously accessed block", EPercentage);
 static StatsCounter statsCreate("Volume cache", "Block creations");
+static StatsCounter statsEvict("Volume cache", "Block evictions");
 static StatsCounter statsDestruct("Volume cache", "Block destructions");
 static StatsCounter statsEmpty("Volume cache", "Empty blocks", EPercentage);
 
-/* Lexicographic ordering for Vector3i */
-struct Vector3iKeyOrder : public std::binary_function<Vector3i, Vector3i, bool> {
-    inline bool operator()(const Vector3i &v1, const Vector3i &v2) const {
-        if (v1.x < v2.x) return true;
-        else if (v1.x > v2.x) return false;
-        if (v1.y < v2.y) return true;
-        else if (v1.y > v2.y) return false;
-        if (v1.z < v2.z) return true;
-        else if (v1.z > v2.z) return false;
-        return false;
-    }
-};
-
 /*!\plugin{volcache}{Caching volume data source}
  * \parameters{
  *     \parameter{blockSize}{\Integer}{
@@ -74,12 +63,122 @@ struct Vector3iKeyOrder : public std::binary_function<Vector3i, Vector3i, bool>
  * The cache works by performing on-demand rasterization of subregions
  * of the nested volume into blocks ($8\times 8 \times 8$ by default).
  * These are kept in memory until a user-specifiable threshold is exeeded,
- * after which point a \emph{least recently used} (LRU) policy removes
- * records that haven't been accessed in a long time.
+ * after which point a \emph{second chance} policy (which approximates
+ * least recently used (LRU) replacement) removes records that haven't
+ * been accessed in a long time.
+ *
+ * Every rendering thread has its own cache, hence lookups never need to
+ * synchronize with other threads. The memory limit is split evenly
+ * amongst the local worker threads.
  */
 class CachingDataSource : public VolumeDataSource {
 public:
-    typedef LRUCache<Vector3i, Vector3iKeyOrder, float *> BlockCache;
+    /**
+     * \brief Per-thread cache of rasterized blocks
+     *
+     * Blocks are located using a hash table and replaced using the CLOCK
+     * (second chance) policy, which avoids reordering a list on every
+     * access. The most recently accessed block is remembered separately,
+     * since consecutive lookups during ray marching usually fall into
+     * the same block.
+     */
+    class BlockCache : public Object {
+    public:
+        BlockCache(const CachingDataSource *parent, size_t capacity)
+            : m_parent(parent), m_capacity(std::max(capacity, (size_t) 1)),
+              m_hand(0), m_lastKey(EInvalidKey), m_lastData(NULL) {
+            m_index.rehash(2 * m_capacity);
+            m_slots.reserve(m_capacity);
+        }
+
+        /// Return the block with the given (packed) index, rasterizing it if necessary
+        inline float *get(uint64_t key, bool &hit) {
+            if (key == m_lastKey) {
+                statsLastBlock.incrementBase();
+                ++statsLastBlock;
+                hit = true;
+                return m_lastData;
+            }
+            statsLastBlock.incrementBase();
+
+            boost::unordered_map<uint64_t, uint32_t>::const_iterator it = m_index.find(key);
+            if (it != m_index.end()) {
+                Slot &slot = m_slots[it->second];
+                slot.referenced = true;
+                hit = true;
+                m_lastKey = key;
+                m_lastData = slot.data;
+                return slot.data;
+            }
+
+            hit = false;
+            float *data = m_parent->renderBlock(Vector3i(
+                (int) (key & EKeyMask),
+                (int) ((key >> EKeyBits) & EKeyMask),
+                (int) (key >> (2*EKeyBits))));
+            insert(key, data);
+            m_lastKey = key;
+            m_lastData = data;
+            return data;
+        }
+
+        /// Pack a block index into a 64 bit key
+        static inline uint64_t getKey(int x, int y, int z) {
+            return (uint64_t) x | ((uint64_t) y << EKeyBits)
+                | ((uint64_t) z << (2*EKeyBits));
+        }
+
+        enum {
+            EKeyBits = 21,
+            EKeyMask = (1 << EKeyBits) - 1
+        };
+        static const uint64_t EInvalidKey = (uint64_t) -1;
+    protected:
+        virtual ~BlockCache() {
+            for (size_t i=0; i<m_slots.size(); ++i)
+                m_parent->destroyBlock(m_slots[i].data);
+        }
+
+        void insert(uint64_t key, float *data) {
+            if (m_slots.size() < m_capacity) {
+                m_index[key] = (uint32_t) m_slots.size();
+                m_slots.push_back(Slot(key, data));
+                return;
+            }
+
+            /* Advance the clock hand to the first block that has
+               not been referenced since the last pass */
+            while (m_slots[m_hand].referenced) {
+                m_slots[m_hand].referenced = false;
+                m_hand = (m_hand + 1) % m_capacity;
+            }
+
+            Slot &slot = m_slots[m_hand];
+            m_index.erase(slot.key);
+            m_parent->destroyBlock(slot.data);
+            ++statsEvict;
+
+            slot = Slot(key, data);
+            m_index[key] = (uint32_t) m_hand;
+            m_hand = (m_hand + 1) % m_capacity;
+        }
+
+        struct Slot {
+            uint64_t key;
+            float *data;
+            bool referenced;
+
+            inline Slot(uint64_t key, float *data)
+                : key(key), data(data), referenced(true) { }
+        };
+    private:
+        const CachingDataSource *m_parent;
+        size_t m_capacity, m_hand;
+        std::vector<Slot> m_slots;
+        boost::unordered_map<uint64_t, uint32_t> m_index;
+        uint64_t m_lastKey;
+        float *m_lastData;
+    };
 
     CachingDataSource(const Properties &props)
         : VolumeDataSource(props) {
@@ -176,42 +275,12 @@ public:
 
         BlockCache *cache = m_cache.get();
         if (EXPECT_NOT_TAKEN(cache == NULL)) {
-            cache = new BlockCache(m_blocksPerCore,
-                boost::bind(&CachingDataSource::renderBlock, this, _1),
-                boost::bind(&CachingDataSource::destroyBlock, this, _1));
+            cache = new BlockCache(this, m_blocksPerCore);
             m_cache.set(cache);
         }
 
-#if defined(VOLCACHE_DEBUG)
-        if (cache->isFull()) {
-            /* For debugging: when the cache is full, dump locations
-               of all cache records into an OBJ file and exit */
-            std::vector<Vector3i> keys;
-            cache->get_keys(std::back_inserter(keys));
-
-            std::ofstream os("keys.obj");
-            os << "o Keys" << endl;
-            for (size_t i=0; i<keys.size(); i++) {
-                Vector3i key = keys[i];
-                key = key * m_blockSize + Vector3i(m_blockSize/2);
-
-                Point p(key.x * m_voxelWidth + m_aabb.min.x,
-                    key.y * m_voxelWidth + m_aabb.min.y,
-                    key.z * m_voxelWidth + m_aabb.min.z);
-
-                os << "v " << p.x << " " << p.y << " " << p.z << endl;
-            }
-
-            /// Need to generate some fake geometry so that blender will import the points
-            for (size_t i=3; i<=keys.size(); i++)
-                os << "f " << i << " " << i-1 << " " << i-2 << endl;
-            os.close();
-            _exit(-1);
-        }
-#endif
-
         bool hit = false;
-        float *blockData = cache->get(Vector3i(
+        float *blockData = cache->get(BlockCache::getKey(
             (x & m_blockMask) >> m_blockShift,
             (y & m_blockMask) >> m_blockShift,
             (z & m_blockMask) >> m_blockShift), hit);
@@ -321,6 +390,10 @@ public:
         return m_nested->getMaximumFloatValue();
     }
 
+    Float getLocalMaximumFloatValue(const AABB &aabb) const {
+        return m_nested->getLocalMaximumFloatValue(aabb);
+    }
+
     MTS_DECLARE_CLASS()
 protected:
     ref<VolumeDataSource> m_nested;